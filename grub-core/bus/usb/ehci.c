@@ -1937,7 +1937,9 @@ static struct grub_usb_controller_dev usb_controller = {
   .portstatus = grub_ehci_portstatus,
   .detect_dev = grub_ehci_detect_dev,
   /* estimated max. count of TDs for one bulk transfer */
-  .max_bulk_tds = GRUB_EHCI_N_TD * 3 / 4 
+  .max_bulk_tds = GRUB_EHCI_N_TD * 3 / 4,
+  /* one qTD covers five pages of packets */
+  .max_bulk_trans_len = GRUB_EHCI_MAXBUFLEN
 };
 
 GRUB_MOD_INIT (ehci)
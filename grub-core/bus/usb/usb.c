@@ -76,6 +76,7 @@ grub_usb_err_t
 grub_usb_clear_halt (grub_usb_device_t dev, int endpoint)
 {
   dev->toggle[endpoint] = 0;
+  dev->stats.clear_halts++;
   return grub_usb_control_msg (dev, (GRUB_USB_REQTYPE_OUT
 				     | GRUB_USB_REQTYPE_STANDARD
 				     | GRUB_USB_REQTYPE_TARGET_ENDP),
@@ -147,6 +148,7 @@ grub_usb_device_initialize (grub_usb_device_t dev)
     {
       int pos;
       int currif;
+      int currep;
       char *data;
       struct grub_usb_desc *desc;
 
@@ -192,25 +194,40 @@ grub_usb_device_initialize (grub_usb_device_t dev)
 	    = (struct grub_usb_desc_if *) &data[pos];
 	  pos += dev->config[i].interf[currif].descif->length;
 
-	  while (pos < config.totallen)
-            {
-              desc = (struct grub_usb_desc *)&data[pos];
-              if (desc->type == GRUB_USB_DESCRIPTOR_ENDPOINT)
-                break;
-              if (!desc->length)
-                {
-                  err = GRUB_USB_ERR_BADDEVICE;
-                  goto fail;
-                }
-              pos += desc->length;
-            }
-
-	  /* Point to the first endpoint.  */
-	  dev->config[i].interf[currif].descendp
-	    = (struct grub_usb_desc_endp *) &data[pos];
-	  pos += (sizeof (struct grub_usb_desc_endp)
-		  * dev->config[i].interf[currif].descif->endpointcnt);
+	  for (currep = 0;
+	       currep < dev->config[i].interf[currif].descif->endpointcnt;
+	       currep++)
+	    {
+	      while (pos < config.totallen)
+		{
+		  desc = (struct grub_usb_desc *)&data[pos];
+		  if (desc->type == GRUB_USB_DESCRIPTOR_ENDPOINT)
+		    break;
+		  if (!desc->length || desc->length > config.totallen - pos)
+		    {
+		      err = GRUB_USB_ERR_BADDEVICE;
+		      goto fail;
+		    }
+		  /* Endpoints are used as an array, so drop what comes
+		     between them, e.g. SuperSpeed companion descriptors.  */
+		  if (currep)
+		    {
+		      config.totallen -= desc->length;
+		      grub_memmove (&data[pos], &data[pos + desc->length],
+				    config.totallen - pos);
+		    }
+		  else
+		    pos += desc->length;
+		}
+
+	      /* Point to the first endpoint.  */
+	      if (!currep)
+		dev->config[i].interf[currif].descendp
+		  = (struct grub_usb_desc_endp *) &data[pos];
+	      pos += sizeof (struct grub_usb_desc_endp);
+	    }
 	}
+      dev->config[i].descconf->totallen = config.totallen;
     }
 
   return GRUB_USB_ERR_NONE;
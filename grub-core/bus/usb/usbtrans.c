@@ -37,6 +37,72 @@ grub_usb_bulk_maxpacket (grub_usb_device_t dev,
   return 64;
 }
 
+#define GRUB_USB_BULK_PAGE 4096
+
+/* Length of one bulk transaction.  Controllers that split transactions
+   into packets take as much as fits into one TD, others one packet.  */
+static grub_size_t
+grub_usb_bulk_translen (grub_usb_device_t dev, unsigned int max)
+{
+  grub_size_t len = dev->controller.dev->max_bulk_trans_len;
+
+  if (len <= max || GRUB_USB_BULK_PAGE % max)
+    return max;
+  return len;
+}
+
+/* Number of packets transaction TR took when DONE bytes of it were
+   transferred; anything short of its size ended with a short packet.  */
+static int
+grub_usb_bulk_packets (grub_usb_transaction_t tr, grub_size_t done,
+		       unsigned int max)
+{
+  if (done >= (grub_size_t) tr->size)
+    return tr->size ? (tr->size + max - 1) / max : 1;
+  return done / max + 1;
+}
+
+
+/* Count the end of TRANSFER, which took MS milliseconds if it was
+   waited for.  */
+static void
+grub_usb_account_transfer (grub_usb_transfer_t transfer, grub_usb_err_t err,
+			   grub_size_t actual, grub_uint64_t ms)
+{
+  struct grub_usb_stats *stats = &transfer->dev->stats;
+  grub_size_t expected = 0;
+  int i;
+
+  for (i = 0; i < transfer->transcnt; i++)
+    if (transfer->transactions[i].pid != GRUB_USB_TRANSFER_TYPE_SETUP)
+      expected += transfer->transactions[i].size;
+
+  if (transfer->type == GRUB_USB_TRANSACTION_TYPE_CONTROL)
+    stats->control++;
+  else
+    stats->bulk++;
+  stats->bytes += actual;
+  stats->wait_ms += ms;
+  if (ms > stats->max_ms)
+    stats->max_ms = ms;
+
+  switch (err)
+    {
+    case GRUB_USB_ERR_NONE:
+      if (actual < expected)
+	stats->short_packets++;
+      break;
+    case GRUB_USB_ERR_STALL:
+      stats->stalls++;
+      break;
+    case GRUB_USB_ERR_TIMEOUT:
+      stats->timeouts++;
+      break;
+    default:
+      stats->errors++;
+      break;
+    }
+}
 
 static grub_usb_err_t
 grub_usb_execute_and_wait_transfer (grub_usb_device_t dev, 
@@ -44,11 +110,15 @@ grub_usb_execute_and_wait_transfer (grub_usb_device_t dev,
 				    int timeout, grub_size_t *actual)
 {
   grub_usb_err_t err;
-  grub_uint64_t endtime;
+  grub_uint64_t start, endtime;
 
+  start = grub_get_time_ms ();
   err = dev->controller.dev->setup_transfer (&dev->controller, transfer);
   if (err)
-    return err;
+    {
+      grub_usb_account_transfer (transfer, err, 0, 0);
+      return err;
+    }
   /* endtime moved behind setup transfer to prevent false timeouts
    * while debugging... */
   endtime = grub_get_time_ms () + timeout;
@@ -56,20 +126,22 @@ grub_usb_execute_and_wait_transfer (grub_usb_device_t dev,
     {
       err = dev->controller.dev->check_transfer (&dev->controller, transfer,
 						 actual);
-      if (!err)
-	return GRUB_USB_ERR_NONE;
       if (err != GRUB_USB_ERR_WAIT)
-	return err;
+	break;
       if (grub_get_time_ms () > endtime)
 	{
 	  err = dev->controller.dev->cancel_transfer (&dev->controller,
 						      transfer);
-	  if (err)
-	    return err;
-	  return GRUB_USB_ERR_TIMEOUT;
+	  if (!err)
+	    err = GRUB_USB_ERR_TIMEOUT;
+	  break;
 	}
       grub_cpu_idle ();
     }
+
+  grub_usb_account_transfer (transfer, err, *actual,
+			     grub_get_time_ms () - start);
+  return err;
 }
 
 grub_usb_err_t
@@ -91,7 +163,7 @@ grub_usb_control_msg (grub_usb_device_t dev,
   volatile char *data;
   grub_uint32_t data_addr;
   grub_size_t size = size0;
-  grub_size_t actual;
+  grub_size_t actual = 0;
 
   /* FIXME: avoid allocation any kind of buffer in a first place.  */
   data_chunk = grub_memalign_dma32 (128, size ? : 16);
@@ -143,6 +215,7 @@ grub_usb_control_msg (grub_usb_device_t dev,
   transfer->type = GRUB_USB_TRANSACTION_TYPE_CONTROL;
   transfer->max = max;
   transfer->dev = dev;
+  transfer->setup = setupdata;
 
   /* Allocate an array of transfer data structures.  */
   transfer->transactions = grub_malloc (transfer->transcnt
@@ -220,6 +293,7 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   grub_usb_transfer_t transfer;
   int datablocks;
   unsigned int max;
+  grub_size_t translen;
   volatile char *data;
   grub_uint32_t data_addr;
   struct grub_pci_dma_chunk *data_chunk;
@@ -229,8 +303,13 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   grub_dprintf ("usb", "bulk: size=0x%02lx type=%d\n", (unsigned long) size,
 		type);
 
-  /* FIXME: avoid allocation any kind of buffer in a first place.  */
-  data_chunk = grub_memalign_dma32 (128, size);
+  max = grub_usb_bulk_maxpacket (dev, endpoint);
+  translen = grub_usb_bulk_translen (dev, max);
+
+  /* FIXME: avoid allocation any kind of buffer in a first place.
+     Multi-packet transactions must each start on a page.  */
+  data_chunk = grub_memalign_dma32 (translen > max ? GRUB_USB_BULK_PAGE : 128,
+				    size);
   if (!data_chunk)
     return NULL;
   data = grub_dma_get_virt (data_chunk);
@@ -246,9 +325,7 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
       return NULL;
     }
 
-  max = grub_usb_bulk_maxpacket (dev, endpoint);
-
-  datablocks = ((size + max - 1) / max);
+  datablocks = ((size + translen - 1) / translen);
   transfer->transcnt = datablocks;
   transfer->size = size - 1;
   transfer->endpoint = endpoint->endp_addr;
@@ -260,6 +337,7 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   transfer->last_trans = -1; /* Reset index of last processed transaction (TD) */
   transfer->data_chunk = data_chunk;
   transfer->data = data_in;
+  transfer->setup = NULL;
 
   /* Allocate an array of transfer data structures.  */
   transfer->transactions = grub_malloc (transfer->transcnt
@@ -276,30 +354,40 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
     {
       grub_usb_transaction_t tr = &transfer->transactions[i];
 
-      tr->size = (size > max) ? max : size;
-      /* XXX: Use the right most bit as the data toggle.  Simple and
-	 effective.  */
+      tr->size = (size > translen) ? translen : size;
+      /* The toggle flips with every packet.  */
       tr->toggle = toggle;
-      toggle = toggle ? 0 : 1;
+      if (grub_usb_bulk_packets (tr, tr->size, max) & 1)
+	toggle = toggle ? 0 : 1;
       tr->pid = type;
-      tr->data = data_addr + i * max;
-      tr->preceding = i * max;
+      tr->data = data_addr + i * translen;
+      tr->preceding = i * translen;
       size -= tr->size;
     }
   return transfer;
 }
 
 static void
-grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer)
+grub_usb_bulk_finish_readwrite (grub_usb_transfer_t transfer,
+				grub_size_t actual)
 {
   grub_usb_device_t dev = transfer->dev;
   int toggle = dev->toggle[transfer->endpoint];
 
   /* We must remember proper toggle value even if some transactions
-   * were not processed - correct value should be inversion of last
-   * processed transaction (TD). */
+   * were not processed - correct value should be the toggle after
+   * the packets of last processed transaction (TD). */
   if (transfer->last_trans >= 0)
-    toggle = transfer->transactions[transfer->last_trans].toggle ? 0 : 1;
+    {
+      grub_usb_transaction_t tr = &transfer->transactions[transfer->last_trans];
+      grub_size_t done = 0;
+
+      if (actual > tr->preceding)
+	done = actual - tr->preceding;
+      toggle = tr->toggle;
+      if (grub_usb_bulk_packets (tr, done, transfer->max) & 1)
+	toggle = toggle ? 0 : 1;
+    }
   else
     toggle = dev->toggle[transfer->endpoint]; /* Nothing done, take original */
   grub_dprintf ("usb", "bulk: toggle=%d\n", toggle);
@@ -329,9 +417,10 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
 					    data_in, type);
   if (!transfer)
     return GRUB_USB_ERR_INTERNAL;
+  *actual = 0;
   err = grub_usb_execute_and_wait_transfer (dev, transfer, timeout, actual);
 
-  grub_usb_bulk_finish_readwrite (transfer);
+  grub_usb_bulk_finish_readwrite (transfer, *actual);
 
   return err;
 }
@@ -353,7 +442,8 @@ grub_usb_bulk_readwrite_packetize (grub_usb_device_t dev,
       max = grub_usb_bulk_maxpacket (dev, endpoint);
 
       /* Calculate max. possible length of bulk transfer */
-      max_bulk_transfer_len = dev->controller.dev->max_bulk_tds * max;
+      max_bulk_transfer_len = dev->controller.dev->max_bulk_tds
+	* grub_usb_bulk_translen (dev, max);
     }
 
   for (position = 0, transferred = 0;
@@ -404,7 +494,8 @@ grub_usb_check_transfer (grub_usb_transfer_t transfer, grub_size_t *actual)
   if (err == GRUB_USB_ERR_WAIT)
     return err;
 
-  grub_usb_bulk_finish_readwrite (transfer);
+  grub_usb_account_transfer (transfer, err, *actual, 0);
+  grub_usb_bulk_finish_readwrite (transfer, *actual);
 
   return err;
 }
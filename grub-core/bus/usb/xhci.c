@@ -0,0 +1,1779 @@
+/* xhci.c - XHCI Support.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/usb.h>
+#include <grub/usbtrans.h>
+#include <grub/misc.h>
+#include <grub/pci.h>
+#include <grub/cpu/pci.h>
+#include <grub/time.h>
+#include <grub/loader.h>
+#include <grub/disk.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* This simple GRUB implementation of XHCI driver:
+ *      - assumes no IRQ, the event ring is polled
+ *      - uses a single segment for every ring
+ *      - keeps at most one TD in flight per endpoint
+ *      - is not supporting isochronous transfers and streams
+ *      - reaches devices behind hubs through USB 2.0 hubs only
+ *
+ * The USB core assigns device addresses itself with SET_ADDRESS, which
+ * XHCI doesn't allow.  A new device gets a slot addressed with BSR set,
+ * so that it answers at address 0, and the SET_ADDRESS request is
+ * turned into the real Address Device command.  GRUB's address then
+ * just names the slot.
+ */
+
+/* Capability registers offsets */
+enum
+{
+  GRUB_XHCI_CAP_CAPLEN = 0x00,
+  GRUB_XHCI_CAP_VERSION = 0x02,
+  GRUB_XHCI_CAP_SPARAMS1 = 0x04,
+  GRUB_XHCI_CAP_SPARAMS2 = 0x08,
+  GRUB_XHCI_CAP_CPARAMS1 = 0x10,
+  GRUB_XHCI_CAP_DBOFF = 0x14,
+  GRUB_XHCI_CAP_RTSOFF = 0x18
+};
+
+#define GRUB_XHCI_SPARAMS1_SLOTS(x)	((x) & 0xff)
+#define GRUB_XHCI_SPARAMS1_PORTS(x)	(((x) >> 24) & 0xff)
+#define GRUB_XHCI_SPARAMS2_SCRATCH(x)	((((x) >> 21) & 0x1f) << 5 \
+					 | (((x) >> 27) & 0x1f))
+#define GRUB_XHCI_CPARAMS1_CSZ		(1 << 2)
+#define GRUB_XHCI_CPARAMS1_PPC		(1 << 3)
+#define GRUB_XHCI_CPARAMS1_XECP(x)	(((x) >> 16) << 2)
+
+/* Operational registers offsets */
+enum
+{
+  GRUB_XHCI_COMMAND = 0x00,
+  GRUB_XHCI_STATUS = 0x04,
+  GRUB_XHCI_PAGESIZE = 0x08,
+  GRUB_XHCI_CRCR = 0x18,
+  GRUB_XHCI_CRCR_HIGH = 0x1c,
+  GRUB_XHCI_DCBAAP = 0x30,
+  GRUB_XHCI_DCBAAP_HIGH = 0x34,
+  GRUB_XHCI_CONFIG = 0x38,
+  GRUB_XHCI_PORTSC = 0x400
+};
+
+enum
+{
+  GRUB_XHCI_CMD_RUNSTOP = (1 << 0),
+  GRUB_XHCI_CMD_HC_RESET = (1 << 1)
+};
+
+enum
+{
+  GRUB_XHCI_ST_HC_HALTED = (1 << 0),
+  GRUB_XHCI_ST_NOT_READY = (1 << 11)
+};
+
+/* Port status and control register bits */
+enum
+{
+  GRUB_XHCI_PORT_CONNECT = (1 << 0),
+  GRUB_XHCI_PORT_ENABLED = (1 << 1),
+  GRUB_XHCI_PORT_RESET = (1 << 4),
+  GRUB_XHCI_PORT_POWER = (1 << 9),
+  GRUB_XHCI_PORT_CONNECT_CH = (1 << 17),
+  GRUB_XHCI_PORT_ENABLED_CH = (1 << 18),
+  GRUB_XHCI_PORT_WARM_RESET_CH = (1 << 19),
+  GRUB_XHCI_PORT_RESET_CH = (1 << 21)
+};
+
+#define GRUB_XHCI_PORT_SPEED(x)		(((x) >> 10) & 0xf)
+/* Bits which are kept when writing PORTSC: read-only and read/write
+   ones, but none of those where writing 1 clears or starts something.  */
+#define GRUB_XHCI_PORT_KEEP		0x0e00c3e1
+
+/* Runtime registers of interrupter 0 */
+enum
+{
+  GRUB_XHCI_IR_ERSTSZ = 0x28,
+  GRUB_XHCI_IR_ERSTBA = 0x30,
+  GRUB_XHCI_IR_ERSTBA_HIGH = 0x34,
+  GRUB_XHCI_IR_ERDP = 0x38,
+  GRUB_XHCI_IR_ERDP_HIGH = 0x3c
+};
+
+#define GRUB_XHCI_ERDP_BUSY	(1 << 3)
+
+/* USB legacy support extended capability */
+#define GRUB_XHCI_XECP_LEGACY		1
+#define GRUB_XHCI_LEGACY_BIOS_OWNED	(1 << 16)
+#define GRUB_XHCI_LEGACY_OS_OWNED	(1 << 24)
+/* Keep the SMI enables except those for USB and the ownership change,
+   and clear the status bits.  */
+#define GRUB_XHCI_LEGACY_SMI_KEEP	0x000e1fee
+#define GRUB_XHCI_LEGACY_SMI_CLEAR	0xe0000000
+
+/* TRB types */
+enum
+{
+  GRUB_XHCI_TRB_NORMAL = 1,
+  GRUB_XHCI_TRB_SETUP = 2,
+  GRUB_XHCI_TRB_DATA = 3,
+  GRUB_XHCI_TRB_STATUS = 4,
+  GRUB_XHCI_TRB_LINK = 6,
+  GRUB_XHCI_TRB_ENABLE_SLOT = 9,
+  GRUB_XHCI_TRB_DISABLE_SLOT = 10,
+  GRUB_XHCI_TRB_ADDRESS_DEVICE = 11,
+  GRUB_XHCI_TRB_CONFIGURE_EP = 12,
+  GRUB_XHCI_TRB_EVALUATE_CONTEXT = 13,
+  GRUB_XHCI_TRB_RESET_EP = 14,
+  GRUB_XHCI_TRB_STOP_EP = 15,
+  GRUB_XHCI_TRB_SET_DEQUEUE = 16,
+  GRUB_XHCI_TRB_TRANSFER_EVENT = 32,
+  GRUB_XHCI_TRB_COMMAND_EVENT = 33
+};
+
+/* TRB control word */
+#define GRUB_XHCI_TRB_CYCLE		(1 << 0)
+#define GRUB_XHCI_TRB_TOGGLE		(1 << 1)
+#define GRUB_XHCI_TRB_ISP		(1 << 2)
+#define GRUB_XHCI_TRB_CHAIN		(1 << 4)
+#define GRUB_XHCI_TRB_IOC		(1 << 5)
+#define GRUB_XHCI_TRB_IDT		(1 << 6)
+#define GRUB_XHCI_TRB_BSR		(1 << 9)
+#define GRUB_XHCI_TRB_DIR_IN		(1 << 16)
+#define GRUB_XHCI_TRB_TRT_OUT		(2 << 16)
+#define GRUB_XHCI_TRB_TRT_IN		(3 << 16)
+#define GRUB_XHCI_TRB_TYPE(x)		((x) << 10)
+#define GRUB_XHCI_TRB_GET_TYPE(x)	(((x) >> 10) & 0x3f)
+#define GRUB_XHCI_TRB_EP(x)		((x) << 16)
+#define GRUB_XHCI_TRB_GET_EP(x)		(((x) >> 16) & 0x1f)
+#define GRUB_XHCI_TRB_SLOT(x)		((x) << 24)
+#define GRUB_XHCI_TRB_GET_SLOT(x)	((x) >> 24)
+
+/* TRB status word */
+#define GRUB_XHCI_TRB_TD_SIZE(x)	((x) << 17)
+#define GRUB_XHCI_TRB_LEN_MASK		0x1ffff
+#define GRUB_XHCI_TRB_RESIDUE(x)	((x) & 0xffffff)
+#define GRUB_XHCI_TRB_CODE(x)		((x) >> 24)
+
+/* A TRB buffer may not cross a 64 KiB boundary.  */
+#define GRUB_XHCI_TRB_MAXLEN		0x10000
+
+/* Completion codes */
+enum
+{
+  GRUB_XHCI_CC_SUCCESS = 1,
+  GRUB_XHCI_CC_DATA_BUFFER = 2,
+  GRUB_XHCI_CC_BABBLE = 3,
+  GRUB_XHCI_CC_TRANSACTION = 4,
+  GRUB_XHCI_CC_STALL = 6,
+  GRUB_XHCI_CC_SHORT_PACKET = 13
+};
+
+/* Slot and endpoint context fields */
+#define GRUB_XHCI_SLOT_ROUTE_MASK	0xfffff
+#define GRUB_XHCI_SLOT_SPEED(x)		((x) << 20)
+#define GRUB_XHCI_SLOT_HUB		(1 << 26)
+#define GRUB_XHCI_SLOT_ENTRIES(x)	((x) << 27)
+#define GRUB_XHCI_SLOT_GET_ENTRIES(x)	((x) >> 27)
+#define GRUB_XHCI_SLOT_ROOT_PORT(x)	((x) << 16)
+#define GRUB_XHCI_SLOT_PORTS(x)		((x) << 24)
+#define GRUB_XHCI_SLOT_TT(slot, port)	((slot) | ((port) << 8))
+
+#define GRUB_XHCI_EP_INTERVAL(x)	((x) << 16)
+#define GRUB_XHCI_EP_CERR_3		(3 << 1)
+#define GRUB_XHCI_EP_TYPE(x)		((x) << 3)
+#define GRUB_XHCI_EP_MAXPACKET(x)	((x) << 16)
+#define GRUB_XHCI_EP_DCS		1
+
+enum
+{
+  GRUB_XHCI_EP_ISOCH_OUT = 1,
+  GRUB_XHCI_EP_BULK_OUT = 2,
+  GRUB_XHCI_EP_INTR_OUT = 3,
+  GRUB_XHCI_EP_CONTROL = 4,
+  GRUB_XHCI_EP_ISOCH_IN = 5,
+  GRUB_XHCI_EP_BULK_IN = 6,
+  GRUB_XHCI_EP_INTR_IN = 7
+};
+
+/* Protocol speed IDs of the default speed ID mapping */
+enum
+{
+  GRUB_XHCI_SPEED_FULL = 1,
+  GRUB_XHCI_SPEED_LOW = 2,
+  GRUB_XHCI_SPEED_HIGH = 3,
+  GRUB_XHCI_SPEED_SUPER = 4
+};
+
+/* Number of device contexts, slot context included */
+#define GRUB_XHCI_N_CTX		32
+/* TRBs per ring including the link TRB */
+#define GRUB_XHCI_RING_SIZE	256
+#define GRUB_XHCI_N_EVENTS	256
+/* Our device addresses come from usbhub.c and are below 128 */
+#define GRUB_XHCI_N_ADDR	128
+
+#define GRUB_XHCI_COMMAND_TIMEOUT	1000
+
+struct grub_xhci_trb
+{
+  grub_uint64_t ptr;
+  grub_uint32_t status;
+  grub_uint32_t control;
+};
+typedef volatile struct grub_xhci_trb *grub_xhci_trb_t;
+
+struct grub_xhci_erst_entry
+{
+  grub_uint64_t addr;
+  grub_uint32_t size;
+  grub_uint32_t reserved;
+};
+
+struct grub_xhci_ring
+{
+  struct grub_pci_dma_chunk *chunk;
+  grub_xhci_trb_t trbs;
+  grub_uint32_t phys;
+  /* Producer index and cycle state, or for the event ring consumer
+     index and the cycle state expected there.  */
+  unsigned int index;
+  grub_uint32_t cycle;
+};
+
+struct grub_xhci_transfer_controller_data;
+
+struct grub_xhci_slot
+{
+  int id;
+  struct grub_pci_dma_chunk *out_chunk;	/* Device context, xHC owned */
+  struct grub_pci_dma_chunk *in_chunk;	/* Input context */
+  struct grub_xhci_ring *rings[GRUB_XHCI_N_CTX];	/* By context index */
+  /* The TD currently queued on each endpoint */
+  struct grub_xhci_transfer_controller_data *active[GRUB_XHCI_N_CTX];
+  grub_uint32_t route;
+  int root_port;
+  int speed;
+  int ep0_maxpacket;
+};
+
+struct grub_xhci
+{
+  volatile grub_uint8_t *iobase_cap;	/* Capability registers */
+  volatile grub_uint8_t *iobase;	/* Operational registers */
+  volatile grub_uint8_t *iobase_rt;	/* Runtime registers */
+  volatile grub_uint32_t *doorbells;
+  grub_size_t mapped;
+  int n_slots;
+  int n_ports;
+  unsigned int ctx_size;		/* 32 or 64 bytes */
+  struct grub_pci_dma_chunk *dcbaa_chunk;
+  volatile grub_uint64_t *dcbaa;
+  struct grub_pci_dma_chunk *scratch_chunk;
+  struct grub_pci_dma_chunk *scratch_pages_chunk;
+  struct grub_xhci_ring cmd_ring;
+  struct grub_xhci_ring event_ring;
+  struct grub_pci_dma_chunk *erst_chunk;
+  volatile struct grub_xhci_erst_entry *erst;
+  /* Command completion being waited for */
+  grub_uint32_t cmd_phys;
+  int cmd_done;
+  grub_uint32_t cmd_code;
+  int cmd_slot;
+  struct grub_xhci_slot **slots;	/* By slot ID */
+  int addr_slot[GRUB_XHCI_N_ADDR];	/* Slot ID by our device address */
+  /* The slot answering at address 0, and where the next one will be */
+  int addr0_slot;
+  int new_root_port;
+  grub_uint32_t new_route;
+  int new_tt_slot;
+  int new_tt_port;
+  struct grub_xhci *next;
+};
+
+struct grub_xhci_transfer_controller_data
+{
+  struct grub_xhci_slot *slot;
+  int dci;
+  grub_uint32_t first_phys;
+  grub_uint32_t last_phys;
+  unsigned int first;			/* Ring index of the first TRB */
+  int control;
+  grub_size_t size;
+  int done;
+  int short_packet;
+  grub_uint32_t code;
+  grub_size_t actual;
+};
+
+static struct grub_xhci *xhci;
+
+/* Register access functions */
+static inline grub_uint32_t
+grub_xhci_cap_read32 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return
+    grub_le_to_cpu32 (*((volatile grub_uint32_t *) (x->iobase_cap + addr)));
+}
+
+static inline grub_uint8_t
+grub_xhci_cap_read8 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return *(x->iobase_cap + addr);
+}
+
+static inline grub_uint32_t
+grub_xhci_oper_read32 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return grub_le_to_cpu32 (*((volatile grub_uint32_t *) (x->iobase + addr)));
+}
+
+static inline void
+grub_xhci_oper_write32 (struct grub_xhci *x, grub_uint32_t addr,
+			grub_uint32_t value)
+{
+  *((volatile grub_uint32_t *) (x->iobase + addr)) = grub_cpu_to_le32 (value);
+}
+
+static inline void
+grub_xhci_rt_write32 (struct grub_xhci *x, grub_uint32_t addr,
+		      grub_uint32_t value)
+{
+  *((volatile grub_uint32_t *) (x->iobase_rt + addr)) =
+    grub_cpu_to_le32 (value);
+}
+
+static inline grub_uint32_t
+grub_xhci_port_read (struct grub_xhci *x, grub_uint32_t port)
+{
+  return grub_xhci_oper_read32 (x, GRUB_XHCI_PORTSC + port * 0x10);
+}
+
+/* Write BITS to PORTSC without touching any of its other controls.  */
+static inline void
+grub_xhci_port_write (struct grub_xhci *x, grub_uint32_t port,
+		      grub_uint32_t bits)
+{
+  grub_xhci_oper_write32 (x, GRUB_XHCI_PORTSC + port * 0x10,
+			  (grub_xhci_port_read (x, port)
+			   & GRUB_XHCI_PORT_KEEP) | bits);
+}
+
+static inline void
+grub_xhci_doorbell (struct grub_xhci *x, int slot, grub_uint32_t target)
+{
+  x->doorbells[slot] = grub_cpu_to_le32 (target);
+}
+
+static inline volatile grub_uint32_t *
+grub_xhci_ctx (struct grub_xhci *x, struct grub_pci_dma_chunk *chunk,
+	       int index)
+{
+  return (volatile grub_uint32_t *)
+    ((volatile grub_uint8_t *) grub_dma_get_virt (chunk)
+     + index * x->ctx_size);
+}
+
+/* Context index of endpoint address EP.  */
+static inline int
+grub_xhci_dci (int ep)
+{
+  if (!(ep & 0xf))
+    return 1;
+  return (ep & 0xf) * 2 + ((ep & 0x80) ? 1 : 0);
+}
+
+static int
+grub_xhci_speed (grub_usb_speed_t speed)
+{
+  switch (speed)
+    {
+    case GRUB_USB_SPEED_LOW:
+      return GRUB_XHCI_SPEED_LOW;
+    case GRUB_USB_SPEED_FULL:
+      return GRUB_XHCI_SPEED_FULL;
+    case GRUB_USB_SPEED_SUPER:
+      return GRUB_XHCI_SPEED_SUPER;
+    case GRUB_USB_SPEED_HIGH:
+    default:
+      return GRUB_XHCI_SPEED_HIGH;
+    }
+}
+
+static struct grub_xhci_ring *
+grub_xhci_ring_alloc (void)
+{
+  struct grub_xhci_ring *ring;
+
+  ring = grub_zalloc (sizeof (*ring));
+  if (!ring)
+    return NULL;
+  ring->chunk = grub_memalign_dma32 (64, GRUB_XHCI_RING_SIZE
+				     * sizeof (struct grub_xhci_trb));
+  if (!ring->chunk)
+    {
+      grub_free (ring);
+      return NULL;
+    }
+  ring->trbs = grub_dma_get_virt (ring->chunk);
+  ring->phys = grub_dma_get_phys (ring->chunk);
+  grub_memset ((void *) ring->trbs, 0,
+	       GRUB_XHCI_RING_SIZE * sizeof (struct grub_xhci_trb));
+  ring->cycle = GRUB_XHCI_TRB_CYCLE;
+  /* The last TRB links back to the start and toggles the cycle.  */
+  ring->trbs[GRUB_XHCI_RING_SIZE - 1].ptr = grub_cpu_to_le64 (ring->phys);
+  return ring;
+}
+
+static void
+grub_xhci_ring_free (struct grub_xhci_ring *ring)
+{
+  if (!ring)
+    return;
+  grub_dma_free (ring->chunk);
+  grub_free (ring);
+}
+
+static inline grub_uint32_t
+grub_xhci_ring_phys (struct grub_xhci_ring *ring, unsigned int index)
+{
+  return ring->phys + index * sizeof (struct grub_xhci_trb);
+}
+
+/* Queue one TRB and return its address.  The caller makes the TRB
+   valid by passing the ring's cycle state in CONTROL; that is done by
+   this function.  */
+static grub_uint32_t
+grub_xhci_ring_push (struct grub_xhci_ring *ring, grub_uint64_t ptr,
+		     grub_uint32_t status, grub_uint32_t control)
+{
+  grub_xhci_trb_t trb = &ring->trbs[ring->index];
+  grub_uint32_t phys = grub_xhci_ring_phys (ring, ring->index);
+
+  trb->ptr = grub_cpu_to_le64 (ptr);
+  trb->status = grub_cpu_to_le32 (status);
+  trb->control = grub_cpu_to_le32 (control | ring->cycle);
+
+  if (++ring->index == GRUB_XHCI_RING_SIZE - 1)
+    {
+      /* A link inside a TD must carry the chain bit on.  */
+      trb = &ring->trbs[ring->index];
+      trb->control = grub_cpu_to_le32 (GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_LINK)
+				       | GRUB_XHCI_TRB_TOGGLE
+				       | (control & GRUB_XHCI_TRB_CHAIN)
+				       | ring->cycle);
+      ring->index = 0;
+      ring->cycle ^= GRUB_XHCI_TRB_CYCLE;
+    }
+  return phys;
+}
+
+/* Handle every event posted so far.  Transfer events complete the TD
+   of their endpoint, command events the command being waited for.  */
+static void
+grub_xhci_poll_events (struct grub_xhci *x)
+{
+  struct grub_xhci_ring *ring = &x->event_ring;
+  int handled = 0;
+
+  while (1)
+    {
+      grub_xhci_trb_t trb = &ring->trbs[ring->index];
+      grub_uint32_t control = grub_le_to_cpu32 (trb->control);
+      grub_uint32_t status = grub_le_to_cpu32 (trb->status);
+      grub_uint32_t ptr = grub_le_to_cpu64 (trb->ptr);
+
+      if ((control & GRUB_XHCI_TRB_CYCLE) != ring->cycle)
+	break;
+
+      switch (GRUB_XHCI_TRB_GET_TYPE (control))
+	{
+	case GRUB_XHCI_TRB_TRANSFER_EVENT:
+	  {
+	    int id = GRUB_XHCI_TRB_GET_SLOT (control);
+	    int dci = GRUB_XHCI_TRB_GET_EP (control);
+	    struct grub_xhci_transfer_controller_data *cdata;
+	    struct grub_xhci_ring *ep_ring;
+	    grub_uint32_t code = GRUB_XHCI_TRB_CODE (status);
+	    unsigned int i, n;
+
+	    if (id > x->n_slots || !x->slots[id])
+	      break;
+	    cdata = x->slots[id]->active[dci];
+	    ep_ring = x->slots[id]->rings[dci];
+	    /* Late events of a TD already finished are dropped here.  */
+	    if (!cdata || cdata->done || !ep_ring
+		|| ptr < ep_ring->phys
+		|| ptr >= ep_ring->phys + GRUB_XHCI_RING_SIZE
+		* sizeof (struct grub_xhci_trb))
+	      break;
+
+	    cdata->code = code;
+	    if (cdata->control && ptr == cdata->last_phys)
+	      {
+		/* The status stage says nothing about the data, which was
+		   all moved unless a short packet was reported before.  */
+		if (!cdata->short_packet)
+		  cdata->actual = cdata->size;
+		cdata->done = 1;
+		break;
+	      }
+
+	    /* Bytes done: all TRBs of the TD before this one, then this
+	       one less what it left.  The setup stage carries no data.  */
+	    n = (ptr - ep_ring->phys) / sizeof (struct grub_xhci_trb);
+	    cdata->actual = 0;
+	    for (i = cdata->first; i != n; i = (i + 1) % GRUB_XHCI_RING_SIZE)
+	      {
+		grub_uint32_t c = grub_le_to_cpu32 (ep_ring->trbs[i].control);
+
+		if (GRUB_XHCI_TRB_GET_TYPE (c) == GRUB_XHCI_TRB_NORMAL
+		    || GRUB_XHCI_TRB_GET_TYPE (c) == GRUB_XHCI_TRB_DATA)
+		  cdata->actual += grub_le_to_cpu32 (ep_ring->trbs[i].status)
+		    & GRUB_XHCI_TRB_LEN_MASK;
+	      }
+	    control = grub_le_to_cpu32 (ep_ring->trbs[n].control);
+	    if (GRUB_XHCI_TRB_GET_TYPE (control) == GRUB_XHCI_TRB_NORMAL
+		|| GRUB_XHCI_TRB_GET_TYPE (control) == GRUB_XHCI_TRB_DATA)
+	      cdata->actual += (grub_le_to_cpu32 (ep_ring->trbs[n].status)
+				& GRUB_XHCI_TRB_LEN_MASK)
+		- GRUB_XHCI_TRB_RESIDUE (status);
+
+	    /* A short data stage still goes on with the status stage.  */
+	    if (cdata->control && code == GRUB_XHCI_CC_SHORT_PACKET)
+	      cdata->short_packet = 1;
+	    else
+	      cdata->done = 1;
+	    break;
+	  }
+
+	case GRUB_XHCI_TRB_COMMAND_EVENT:
+	  if (ptr == x->cmd_phys)
+	    {
+	      x->cmd_done = 1;
+	      x->cmd_code = GRUB_XHCI_TRB_CODE (status);
+	      x->cmd_slot = GRUB_XHCI_TRB_GET_SLOT (control);
+	    }
+	  break;
+
+	default:
+	  /* Port status changes are found by polling PORTSC.  */
+	  break;
+	}
+
+      handled = 1;
+      if (++ring->index == GRUB_XHCI_N_EVENTS)
+	{
+	  ring->index = 0;
+	  ring->cycle ^= GRUB_XHCI_TRB_CYCLE;
+	}
+    }
+
+  if (handled)
+    {
+      grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP,
+			    grub_xhci_ring_phys (ring, ring->index)
+			    | GRUB_XHCI_ERDP_BUSY);
+      grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP_HIGH, 0);
+    }
+}
+
+/* Run a command and return its completion code, or 0 on timeout.  */
+static grub_uint32_t
+grub_xhci_command (struct grub_xhci *x, grub_uint64_t ptr,
+		   grub_uint32_t status, grub_uint32_t control, int *slot)
+{
+  grub_uint64_t maxtime;
+
+  x->cmd_done = 0;
+  x->cmd_phys = grub_xhci_ring_push (&x->cmd_ring, ptr, status, control);
+  grub_xhci_doorbell (x, 0, 0);
+
+  maxtime = grub_get_time_ms () + GRUB_XHCI_COMMAND_TIMEOUT;
+  while (1)
+    {
+      grub_xhci_poll_events (x);
+      if (x->cmd_done)
+	break;
+      if (grub_get_time_ms () > maxtime)
+	{
+	  grub_dprintf ("xhci", "command %d timed out\n",
+			GRUB_XHCI_TRB_GET_TYPE (control));
+	  return 0;
+	}
+    }
+
+  grub_dprintf ("xhci", "command %d: code=%d slot=%d\n",
+		GRUB_XHCI_TRB_GET_TYPE (control), x->cmd_code, x->cmd_slot);
+  if (slot)
+    *slot = x->cmd_slot;
+  return x->cmd_code;
+}
+
+static void
+grub_xhci_free_slot (struct grub_xhci *x, int id)
+{
+  struct grub_xhci_slot *slot;
+  int i;
+
+  if (!id || !x->slots[id])
+    return;
+  slot = x->slots[id];
+
+  grub_xhci_command (x, 0, 0, GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_DISABLE_SLOT)
+		     | GRUB_XHCI_TRB_SLOT (id), NULL);
+  x->dcbaa[id] = 0;
+  x->slots[id] = NULL;
+  for (i = 0; i < GRUB_XHCI_N_ADDR; i++)
+    if (x->addr_slot[i] == id)
+      x->addr_slot[i] = 0;
+  if (x->addr0_slot == id)
+    x->addr0_slot = 0;
+
+  for (i = 0; i < GRUB_XHCI_N_CTX; i++)
+    {
+      grub_xhci_ring_free (slot->rings[i]);
+      grub_free (slot->active[i]);
+    }
+  grub_dma_free (slot->in_chunk);
+  grub_dma_free (slot->out_chunk);
+  grub_free (slot);
+}
+
+/* Start the input context of SLOT with the add flags ADD and a copy of
+   the current slot context.  */
+static volatile grub_uint32_t *
+grub_xhci_input_ctx (struct grub_xhci *x, struct grub_xhci_slot *slot,
+		     grub_uint32_t add)
+{
+  volatile grub_uint32_t *ctrl;
+  volatile grub_uint32_t *in_slot;
+  volatile grub_uint32_t *out_slot;
+  int i;
+
+  grub_memset ((void *) grub_dma_get_virt (slot->in_chunk), 0,
+	       (GRUB_XHCI_N_CTX + 1) * x->ctx_size);
+  ctrl = grub_xhci_ctx (x, slot->in_chunk, 0);
+  ctrl[1] = grub_cpu_to_le32 (add);
+
+  in_slot = grub_xhci_ctx (x, slot->in_chunk, 1);
+  out_slot = grub_xhci_ctx (x, slot->out_chunk, 0);
+  for (i = 0; i < 3; i++)
+    in_slot[i] = out_slot[i];
+  return in_slot;
+}
+
+/* Fill the input context of endpoint DCI.  */
+static void
+grub_xhci_ep_ctx (struct grub_xhci *x, struct grub_xhci_slot *slot, int dci,
+		  int type, int maxpacket, int interval)
+{
+  volatile grub_uint32_t *ep = grub_xhci_ctx (x, slot->in_chunk, dci + 1);
+  struct grub_xhci_ring *ring = slot->rings[dci];
+
+  ep[0] = grub_cpu_to_le32 (GRUB_XHCI_EP_INTERVAL (interval));
+  ep[1] = grub_cpu_to_le32 (GRUB_XHCI_EP_CERR_3 | GRUB_XHCI_EP_TYPE (type)
+			    | GRUB_XHCI_EP_MAXPACKET (maxpacket));
+  ep[2] = grub_cpu_to_le32 (grub_xhci_ring_phys (ring, ring->index)
+			    | (ring->cycle ? GRUB_XHCI_EP_DCS : 0));
+  ep[3] = 0;
+  ep[4] = grub_cpu_to_le32 (type == GRUB_XHCI_EP_CONTROL ? 8 : maxpacket);
+}
+
+/* Enable a slot for the device just reset and address it with BSR set,
+   so that it can be talked to at address 0.  */
+static grub_usb_err_t
+grub_xhci_new_slot (struct grub_xhci *x, grub_usb_transfer_t transfer)
+{
+  struct grub_xhci_slot *slot;
+  volatile grub_uint32_t *sc;
+  grub_uint32_t code;
+  int id = 0;
+
+  if (!x->new_root_port)
+    {
+      grub_dprintf ("xhci", "device at address 0 without a port reset\n");
+      return GRUB_USB_ERR_BADDEVICE;
+    }
+
+  code = grub_xhci_command (x, 0, 0,
+			    GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_ENABLE_SLOT),
+			    &id);
+  if (code != GRUB_XHCI_CC_SUCCESS || id <= 0 || id > x->n_slots)
+    return GRUB_USB_ERR_INTERNAL;
+
+  slot = grub_zalloc (sizeof (*slot));
+  if (!slot)
+    return GRUB_USB_ERR_INTERNAL;
+  slot->id = id;
+  x->slots[id] = slot;
+  slot->out_chunk = grub_memalign_dma32 (64, GRUB_XHCI_N_CTX * x->ctx_size);
+  slot->in_chunk = grub_memalign_dma32 (64, (GRUB_XHCI_N_CTX + 1)
+					* x->ctx_size);
+  slot->rings[1] = grub_xhci_ring_alloc ();
+  if (!slot->out_chunk || !slot->in_chunk || !slot->rings[1])
+    goto fail;
+  grub_memset ((void *) grub_dma_get_virt (slot->out_chunk), 0,
+	       GRUB_XHCI_N_CTX * x->ctx_size);
+  x->dcbaa[id] = grub_cpu_to_le64 (grub_dma_get_phys (slot->out_chunk));
+
+  slot->route = x->new_route;
+  slot->root_port = x->new_root_port;
+  slot->speed = grub_xhci_speed (transfer->dev->speed);
+  if (slot->speed == GRUB_XHCI_SPEED_SUPER)
+    slot->ep0_maxpacket = 512;
+  else if (slot->speed == GRUB_XHCI_SPEED_LOW)
+    slot->ep0_maxpacket = 8;
+  else
+    slot->ep0_maxpacket = 64;
+
+  sc = grub_xhci_input_ctx (x, slot, (1 << 0) | (1 << 1));
+  sc[0] = grub_cpu_to_le32 ((slot->route & GRUB_XHCI_SLOT_ROUTE_MASK)
+			    | GRUB_XHCI_SLOT_SPEED (slot->speed)
+			    | GRUB_XHCI_SLOT_ENTRIES (1));
+  sc[1] = grub_cpu_to_le32 (GRUB_XHCI_SLOT_ROOT_PORT (slot->root_port));
+  sc[2] = grub_cpu_to_le32 (GRUB_XHCI_SLOT_TT (x->new_tt_slot,
+					       x->new_tt_port));
+  grub_xhci_ep_ctx (x, slot, 1, GRUB_XHCI_EP_CONTROL, slot->ep0_maxpacket, 0);
+
+  code = grub_xhci_command (x, grub_dma_get_phys (slot->in_chunk), 0,
+			    GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_ADDRESS_DEVICE)
+			    | GRUB_XHCI_TRB_BSR | GRUB_XHCI_TRB_SLOT (id),
+			    NULL);
+  if (code != GRUB_XHCI_CC_SUCCESS)
+    goto fail;
+
+  grub_dprintf ("xhci", "slot %d: port=%d route=%05x speed=%d\n",
+		id, slot->root_port, slot->route, slot->speed);
+  x->addr0_slot = id;
+  x->new_root_port = 0;
+  return GRUB_USB_ERR_NONE;
+
+ fail:
+  grub_xhci_free_slot (x, id);
+  return GRUB_USB_ERR_INTERNAL;
+}
+
+/* Address the slot at address 0 for real, in place of sending the
+   device SET_ADDRESS ADDR.  */
+static grub_usb_err_t
+grub_xhci_set_address (struct grub_xhci *x, int addr)
+{
+  struct grub_xhci_slot *slot;
+  grub_uint32_t code;
+
+  if (!x->addr0_slot || addr <= 0 || addr >= GRUB_XHCI_N_ADDR)
+    return GRUB_USB_ERR_BADDEVICE;
+  slot = x->slots[x->addr0_slot];
+
+  /* The address may still name a device that went away.  */
+  if (x->addr_slot[addr])
+    grub_xhci_free_slot (x, x->addr_slot[addr]);
+
+  grub_xhci_input_ctx (x, slot, (1 << 0) | (1 << 1));
+  grub_xhci_ep_ctx (x, slot, 1, GRUB_XHCI_EP_CONTROL, slot->ep0_maxpacket, 0);
+  code = grub_xhci_command (x, grub_dma_get_phys (slot->in_chunk), 0,
+			    GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_ADDRESS_DEVICE)
+			    | GRUB_XHCI_TRB_SLOT (slot->id), NULL);
+  if (code != GRUB_XHCI_CC_SUCCESS)
+    return GRUB_USB_ERR_DATA;
+
+  x->addr_slot[addr] = slot->id;
+  x->addr0_slot = 0;
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Tell the xHC about the default pipe's real packet size, which is
+   known only after the device descriptor has been read.  */
+static grub_usb_err_t
+grub_xhci_update_ep0 (struct grub_xhci *x, struct grub_xhci_slot *slot,
+		      int maxpacket)
+{
+  volatile grub_uint32_t *ep;
+
+  grub_xhci_input_ctx (x, slot, 1 << 1);
+  ep = grub_xhci_ctx (x, slot->in_chunk, 2);
+  ep[1] = grub_cpu_to_le32 (GRUB_XHCI_EP_CERR_3
+			    | GRUB_XHCI_EP_TYPE (GRUB_XHCI_EP_CONTROL)
+			    | GRUB_XHCI_EP_MAXPACKET (maxpacket));
+  if (grub_xhci_command (x, grub_dma_get_phys (slot->in_chunk), 0,
+			 GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_EVALUATE_CONTEXT)
+			 | GRUB_XHCI_TRB_SLOT (slot->id), NULL)
+      != GRUB_XHCI_CC_SUCCESS)
+    return GRUB_USB_ERR_INTERNAL;
+  slot->ep0_maxpacket = maxpacket;
+  return GRUB_USB_ERR_NONE;
+}
+
+static struct grub_usb_desc_endp *
+grub_xhci_find_endp (grub_usb_device_t dev, int endp_addr)
+{
+  int c, i, j;
+
+  for (c = 0; c < 8; c++)
+    {
+      if (!dev->config[c].descconf)
+	continue;
+      for (i = 0; i < dev->config[c].descconf->numif; i++)
+	{
+	  struct grub_usb_interface *interf = &dev->config[c].interf[i];
+
+	  if (!interf->descif || !interf->descendp)
+	    continue;
+	  for (j = 0; j < interf->descif->endpointcnt; j++)
+	    if (interf->descendp[j].endp_addr == endp_addr)
+	      return &interf->descendp[j];
+	}
+    }
+  return NULL;
+}
+
+/* Add the ring of endpoint DCI of SLOT, used by TRANSFER.  */
+static grub_usb_err_t
+grub_xhci_configure_ep (struct grub_xhci *x, struct grub_xhci_slot *slot,
+			int dci, grub_usb_transfer_t transfer)
+{
+  struct grub_usb_desc_endp *endp;
+  volatile grub_uint32_t *sc;
+  int in = (transfer->endpoint & 0x80) != 0;
+  int type, interval = 0, maxpacket, entries;
+
+  endp = grub_xhci_find_endp (transfer->dev, transfer->endpoint);
+  if (!endp)
+    return GRUB_USB_ERR_BADDEVICE;
+
+  switch (grub_usb_get_ep_type (endp))
+    {
+    case GRUB_USB_EP_BULK:
+      type = in ? GRUB_XHCI_EP_BULK_IN : GRUB_XHCI_EP_BULK_OUT;
+      break;
+    case GRUB_USB_EP_INTERRUPT:
+      type = in ? GRUB_XHCI_EP_INTR_IN : GRUB_XHCI_EP_INTR_OUT;
+      /* In 125 us units as a power of two.  Full and low speed
+	 descriptors give frames.  */
+      if (slot->speed == GRUB_XHCI_SPEED_HIGH
+	  || slot->speed == GRUB_XHCI_SPEED_SUPER)
+	interval = endp->interval ? endp->interval - 1 : 0;
+      else
+	while ((2U << interval) <= endp->interval * 8U && interval < 10)
+	  interval++;
+      if (interval > 15)
+	interval = 15;
+      break;
+    default:
+      return GRUB_USB_ERR_BADDEVICE;
+    }
+  maxpacket = grub_le_to_cpu16 (endp->maxpacket) & 0x7ff;
+
+  slot->rings[dci] = grub_xhci_ring_alloc ();
+  if (!slot->rings[dci])
+    return GRUB_USB_ERR_INTERNAL;
+
+  sc = grub_xhci_input_ctx (x, slot, (1 << 0) | (1 << dci));
+  entries = GRUB_XHCI_SLOT_GET_ENTRIES (grub_le_to_cpu32 (sc[0]));
+  if (dci > entries)
+    entries = dci;
+  sc[0] = grub_cpu_to_le32 ((grub_le_to_cpu32 (sc[0])
+			     & ~GRUB_XHCI_SLOT_ENTRIES (0x1f))
+			    | GRUB_XHCI_SLOT_ENTRIES (entries));
+  /* Hubs are configured through their status change endpoint.  */
+  if (transfer->dev->descdev.class == GRUB_USB_CLASS_HUB)
+    {
+      sc[0] |= grub_cpu_to_le32_compile_time (GRUB_XHCI_SLOT_HUB);
+      sc[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (sc[1])
+				 & ~GRUB_XHCI_SLOT_PORTS (0xff))
+				| GRUB_XHCI_SLOT_PORTS (transfer->dev->nports));
+    }
+  grub_xhci_ep_ctx (x, slot, dci, type, maxpacket, interval);
+
+  if (grub_xhci_command (x, grub_dma_get_phys (slot->in_chunk), 0,
+			 GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_CONFIGURE_EP)
+			 | GRUB_XHCI_TRB_SLOT (slot->id), NULL)
+      != GRUB_XHCI_CC_SUCCESS)
+    {
+      grub_xhci_ring_free (slot->rings[dci]);
+      slot->rings[dci] = NULL;
+      return GRUB_USB_ERR_INTERNAL;
+    }
+  grub_dprintf ("xhci", "slot %d: endpoint %02x dci=%d type=%d max=%d\n",
+		slot->id, transfer->endpoint, dci, type, maxpacket);
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Move the dequeue pointer of endpoint DCI past everything queued,
+   after a halt or a stop.  */
+static void
+grub_xhci_skip_ring (struct grub_xhci *x, struct grub_xhci_slot *slot,
+		     int dci, int halted)
+{
+  struct grub_xhci_ring *ring = slot->rings[dci];
+
+  if (halted)
+    grub_xhci_command (x, 0, 0, GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_RESET_EP)
+		       | GRUB_XHCI_TRB_EP (dci)
+		       | GRUB_XHCI_TRB_SLOT (slot->id), NULL);
+  else
+    grub_xhci_command (x, 0, 0, GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_STOP_EP)
+		       | GRUB_XHCI_TRB_EP (dci)
+		       | GRUB_XHCI_TRB_SLOT (slot->id), NULL);
+
+  grub_xhci_command (x, grub_xhci_ring_phys (ring, ring->index)
+		     | (ring->cycle ? GRUB_XHCI_EP_DCS : 0), 0,
+		     GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_SET_DEQUEUE)
+		     | GRUB_XHCI_TRB_EP (dci)
+		     | GRUB_XHCI_TRB_SLOT (slot->id), NULL);
+}
+
+/* Queue the buffer of SIZE bytes at DATA as TRBs no longer than the
+   64 KiB boundaries allow, as one TD.  The first one has type TYPE.  TD
+   size tells how many packets of MAXPACKET remain after each TRB.  LAST
+   asks for an interrupt at the end, which the data stage of a control
+   transfer leaves to its status stage: that is a TD of its own, where a
+   short packet skips to.  */
+static void
+grub_xhci_push_data (struct grub_xhci_ring *ring, int type,
+		     grub_uint32_t data, grub_size_t size,
+		     grub_uint32_t flags, int maxpacket, int last)
+{
+  grub_size_t done = 0;
+
+  do
+    {
+      grub_size_t len = GRUB_XHCI_TRB_MAXLEN - (data & (GRUB_XHCI_TRB_MAXLEN - 1));
+      grub_size_t left;
+      grub_uint32_t control = GRUB_XHCI_TRB_TYPE (type) | flags
+	| GRUB_XHCI_TRB_ISP | GRUB_XHCI_TRB_CHAIN;
+
+      if (len > size - done)
+	len = size - done;
+      left = (size - done - len + maxpacket - 1) / maxpacket;
+      if (left > 31)
+	left = 31;
+      if (done + len == size)
+	{
+	  control &= ~GRUB_XHCI_TRB_CHAIN;
+	  if (last)
+	    control |= GRUB_XHCI_TRB_IOC;
+	}
+
+      grub_xhci_ring_push (ring, data, len | GRUB_XHCI_TRB_TD_SIZE (left),
+			   control);
+      data += len;
+      done += len;
+      type = GRUB_XHCI_TRB_NORMAL;
+      flags &= ~GRUB_XHCI_TRB_DIR_IN;
+    }
+  while (done < size);
+}
+
+static grub_usb_err_t
+grub_xhci_setup_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata;
+  struct grub_xhci_slot *slot;
+  struct grub_xhci_ring *ring;
+  grub_usb_err_t err;
+  grub_size_t size = 0;
+  grub_uint32_t data = 0;
+  int id, dci, i;
+
+  if (grub_xhci_oper_read32 (x, GRUB_XHCI_STATUS) & GRUB_XHCI_ST_HC_HALTED)
+    return GRUB_USB_ERR_INTERNAL;
+
+  cdata = grub_zalloc (sizeof (*cdata));
+  if (!cdata)
+    return GRUB_USB_ERR_INTERNAL;
+  cdata->control = (transfer->type == GRUB_USB_TRANSACTION_TYPE_CONTROL);
+
+  /* Transactions lie one after the other, so the data goes as one.  */
+  for (i = 0; i < transfer->transcnt; i++)
+    {
+      grub_usb_transaction_t tr = &transfer->transactions[i];
+
+      if (tr->pid == GRUB_USB_TRANSFER_TYPE_SETUP || !tr->size)
+	continue;
+      if (!size)
+	data = tr->data;
+      size += tr->size;
+    }
+  cdata->size = size;
+
+  if (cdata->control)
+    {
+      volatile struct grub_usb_packet_setup *setup = transfer->setup;
+
+      if (transfer->devaddr == 0 && setup
+	  && setup->request == GRUB_USB_REQ_SET_ADDRESS
+	  && setup->reqtype == (GRUB_USB_REQTYPE_OUT
+				| GRUB_USB_REQTYPE_STANDARD
+				| GRUB_USB_REQTYPE_TARGET_DEV))
+	{
+	  /* Done by the xHC, nothing goes on the ring.  */
+	  err = grub_xhci_set_address (x, grub_le_to_cpu16 (setup->value));
+	  cdata->done = 1;
+	  cdata->code = err ? GRUB_XHCI_CC_TRANSACTION : GRUB_XHCI_CC_SUCCESS;
+	  transfer->controller_data = cdata;
+	  return GRUB_USB_ERR_NONE;
+	}
+
+      if (setup
+	  && setup->request == GRUB_USB_REQ_SET_FEATURE
+	  && setup->reqtype == (GRUB_USB_REQTYPE_OUT | GRUB_USB_REQTYPE_CLASS
+				| GRUB_USB_REQTYPE_TARGET_OTHER)
+	  && grub_le_to_cpu16 (setup->value) == GRUB_USB_HUB_FEATURE_PORT_RESET
+	  && transfer->devaddr < GRUB_XHCI_N_ADDR
+	  && x->addr_slot[transfer->devaddr])
+	{
+	  /* A hub port is being reset: the next device is behind it.  */
+	  struct grub_xhci_slot *hub = x->slots[x->addr_slot[transfer->devaddr]];
+	  int port = grub_le_to_cpu16 (setup->index);
+	  int depth;
+
+	  for (depth = 0; depth < 5 && (hub->route >> (4 * depth)); depth++);
+	  if (x->addr0_slot)
+	    grub_xhci_free_slot (x, x->addr0_slot);
+	  x->new_root_port = hub->root_port;
+	  x->new_route = hub->route | ((port > 15 ? 15 : port) << (4 * depth));
+	  x->new_tt_slot = 0;
+	  x->new_tt_port = 0;
+	  if (hub->speed == GRUB_XHCI_SPEED_HIGH)
+	    {
+	      x->new_tt_slot = hub->id;
+	      x->new_tt_port = port;
+	    }
+	  else if (hub->speed != GRUB_XHCI_SPEED_SUPER)
+	    {
+	      volatile grub_uint32_t *sc = grub_xhci_ctx (x, hub->out_chunk, 0);
+	      grub_uint32_t tt = grub_le_to_cpu32 (sc[2]);
+
+	      x->new_tt_slot = tt & 0xff;
+	      x->new_tt_port = (tt >> 8) & 0xff;
+	    }
+	}
+    }
+
+  if (transfer->devaddr == 0)
+    {
+      if (!x->addr0_slot)
+	{
+	  err = grub_xhci_new_slot (x, transfer);
+	  if (err)
+	    {
+	      grub_free (cdata);
+	      return err;
+	    }
+	}
+      id = x->addr0_slot;
+    }
+  else if (transfer->devaddr < GRUB_XHCI_N_ADDR)
+    id = x->addr_slot[transfer->devaddr];
+  else
+    id = 0;
+  if (!id)
+    {
+      grub_free (cdata);
+      return GRUB_USB_ERR_BADDEVICE;
+    }
+  slot = x->slots[id];
+  dci = grub_xhci_dci (transfer->endpoint);
+  cdata->slot = slot;
+  cdata->dci = dci;
+
+  if (slot->active[dci])
+    {
+      grub_dprintf ("xhci", "slot %d: endpoint %d busy\n", id, dci);
+      grub_free (cdata);
+      return GRUB_USB_ERR_INTERNAL;
+    }
+
+  /* SuperSpeed descriptors give the size as a power of two, and it is
+     512 anyway.  */
+  if (cdata->control && slot->speed != GRUB_XHCI_SPEED_SUPER
+      && transfer->max != slot->ep0_maxpacket)
+    grub_xhci_update_ep0 (x, slot, transfer->max);
+
+  if (!slot->rings[dci])
+    {
+      err = grub_xhci_configure_ep (x, slot, dci, transfer);
+      if (err)
+	{
+	  grub_free (cdata);
+	  return err;
+	}
+    }
+  ring = slot->rings[dci];
+  cdata->first = ring->index;
+  cdata->first_phys = grub_xhci_ring_phys (ring, ring->index);
+
+  if (cdata->control)
+    {
+      grub_uint64_t setup;
+      int in = (transfer->setup->reqtype & GRUB_USB_REQTYPE_IN) != 0;
+      grub_uint32_t trt = 0;
+
+      grub_memcpy (&setup, (void *) transfer->setup, sizeof (setup));
+      if (size)
+	trt = in ? GRUB_XHCI_TRB_TRT_IN : GRUB_XHCI_TRB_TRT_OUT;
+      grub_xhci_ring_push (ring, grub_le_to_cpu64 (setup), 8,
+			   GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_SETUP)
+			   | GRUB_XHCI_TRB_IDT | trt);
+      if (size)
+	grub_xhci_push_data (ring, GRUB_XHCI_TRB_DATA, data, size,
+			     in ? GRUB_XHCI_TRB_DIR_IN : 0,
+			     slot->ep0_maxpacket, 0);
+      cdata->last_phys =
+	grub_xhci_ring_push (ring, 0, 0,
+			     GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_STATUS)
+			     | GRUB_XHCI_TRB_IOC
+			     | ((in && size) ? 0 : GRUB_XHCI_TRB_DIR_IN));
+    }
+  else
+    {
+      unsigned int last;
+
+      if (size)
+	grub_xhci_push_data (ring, GRUB_XHCI_TRB_NORMAL, data, size, 0,
+			     transfer->max, 1);
+      else
+	grub_xhci_ring_push (ring, 0, 0,
+			     GRUB_XHCI_TRB_TYPE (GRUB_XHCI_TRB_NORMAL)
+			     | GRUB_XHCI_TRB_IOC);
+      last = ring->index ? ring->index - 1 : GRUB_XHCI_RING_SIZE - 2;
+      cdata->last_phys = grub_xhci_ring_phys (ring, last);
+    }
+
+  slot->active[dci] = cdata;
+  transfer->controller_data = cdata;
+  grub_xhci_doorbell (x, id, dci);
+
+  grub_dprintf ("xhci", "setup_transfer: slot=%d dci=%d size=%lu\n",
+		id, dci, (unsigned long) size);
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Release the TD of TRANSFER and tell how it ended.  */
+static grub_usb_err_t
+grub_xhci_finish_transfer (struct grub_xhci *x, grub_usb_transfer_t transfer,
+			   grub_size_t *actual)
+{
+  struct grub_xhci_transfer_controller_data *cdata =
+    transfer->controller_data;
+  grub_uint32_t code = cdata->code;
+  int i;
+
+  *actual = cdata->actual;
+  if (code == GRUB_XHCI_CC_SUCCESS && !cdata->control)
+    *actual = cdata->size;
+
+  /* For the toggle bookkeeping of the core, which the xHC does itself.  */
+  transfer->last_trans = -1;
+  for (i = 0; i < transfer->transcnt; i++)
+    if (transfer->transactions[i].preceding < *actual)
+      transfer->last_trans = i;
+
+  if (cdata->slot)
+    {
+      cdata->slot->active[cdata->dci] = NULL;
+      if (code == GRUB_XHCI_CC_STALL || code == GRUB_XHCI_CC_BABBLE
+	  || code == GRUB_XHCI_CC_TRANSACTION)
+	grub_xhci_skip_ring (x, cdata->slot, cdata->dci, 1);
+    }
+  grub_free (cdata);
+  transfer->controller_data = NULL;
+
+  switch (code)
+    {
+    case GRUB_XHCI_CC_SUCCESS:
+    case GRUB_XHCI_CC_SHORT_PACKET:
+      return GRUB_USB_ERR_NONE;
+    case GRUB_XHCI_CC_STALL:
+      return GRUB_USB_ERR_STALL;
+    case GRUB_XHCI_CC_BABBLE:
+      return GRUB_USB_ERR_BABBLE;
+    default:
+      return GRUB_USB_ERR_DATA;
+    }
+}
+
+static grub_usb_err_t
+grub_xhci_check_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer, grub_size_t *actual)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata =
+    transfer->controller_data;
+
+  if (!cdata->done)
+    grub_xhci_poll_events (x);
+  if (!cdata->done)
+    {
+      if (grub_xhci_oper_read32 (x, GRUB_XHCI_STATUS)
+	  & GRUB_XHCI_ST_HC_HALTED)
+	{
+	  cdata->slot->active[cdata->dci] = NULL;
+	  grub_free (cdata);
+	  transfer->controller_data = NULL;
+	  *actual = 0;
+	  return GRUB_USB_ERR_UNRECOVERABLE;
+	}
+      return GRUB_USB_ERR_WAIT;
+    }
+
+  return grub_xhci_finish_transfer (x, transfer, actual);
+}
+
+static grub_usb_err_t
+grub_xhci_cancel_transfer (grub_usb_controller_t dev,
+			   grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  struct grub_xhci_transfer_controller_data *cdata =
+    transfer->controller_data;
+
+  grub_dprintf ("xhci", "cancel_transfer\n");
+
+  if (cdata->slot)
+    {
+      cdata->slot->active[cdata->dci] = NULL;
+      if (!cdata->done)
+	grub_xhci_skip_ring (x, cdata->slot, cdata->dci, 0);
+      else if (cdata->code == GRUB_XHCI_CC_STALL
+	       || cdata->code == GRUB_XHCI_CC_BABBLE
+	       || cdata->code == GRUB_XHCI_CC_TRANSACTION)
+	grub_xhci_skip_ring (x, cdata->slot, cdata->dci, 1);
+    }
+  grub_free (cdata);
+  transfer->controller_data = NULL;
+  return GRUB_USB_ERR_NONE;
+}
+
+static int
+grub_xhci_hubports (grub_usb_controller_t dev)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+
+  grub_dprintf ("xhci", "root hub ports=%d\n", x->n_ports);
+  return x->n_ports;
+}
+
+static grub_usb_err_t
+grub_xhci_portstatus (grub_usb_controller_t dev,
+		      unsigned int port, unsigned int enable)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  grub_uint64_t endtime;
+
+  grub_dprintf ("xhci", "portstatus: port=%d, status=0x%08x\n",
+		port, grub_xhci_port_read (x, port));
+
+  if (!enable)
+    {
+      /* Writing the enable bit disables the port.  */
+      grub_xhci_port_write (x, port, GRUB_XHCI_PORT_ENABLED);
+      return GRUB_USB_ERR_NONE;
+    }
+
+  grub_boot_time ("Resetting port %d", port);
+
+  /* The xHC times the reset itself and sets the change bit at its end.  */
+  grub_xhci_port_write (x, port, GRUB_XHCI_PORT_RESET);
+  endtime = grub_get_time_ms () + 1000;
+  while (!(grub_xhci_port_read (x, port) & GRUB_XHCI_PORT_RESET_CH))
+    if (grub_get_time_ms () > endtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  grub_xhci_port_write (x, port, GRUB_XHCI_PORT_RESET_CH
+			| GRUB_XHCI_PORT_WARM_RESET_CH
+			| GRUB_XHCI_PORT_ENABLED_CH);
+  grub_boot_time ("Port %d reset", port);
+
+  if (!(grub_xhci_port_read (x, port) & GRUB_XHCI_PORT_ENABLED))
+    return GRUB_USB_ERR_BADDEVICE;
+
+  /* "Reset recovery time" (USB spec.) */
+  grub_millisleep (10);
+
+  /* The device which answers at address 0 next is on this port.  */
+  if (x->addr0_slot)
+    grub_xhci_free_slot (x, x->addr0_slot);
+  x->new_root_port = port + 1;
+  x->new_route = 0;
+  x->new_tt_slot = 0;
+  x->new_tt_port = 0;
+
+  grub_dprintf ("xhci", "portstatus: end, status=0x%08x\n",
+		grub_xhci_port_read (x, port));
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_speed_t
+grub_xhci_detect_dev (grub_usb_controller_t dev, int port, int *changed)
+{
+  struct grub_xhci *x = (struct grub_xhci *) dev->data;
+  grub_uint32_t status;
+
+  status = grub_xhci_port_read (x, port);
+
+  if (status & GRUB_XHCI_PORT_CONNECT_CH)
+    {
+      *changed = 1;
+      grub_xhci_port_write (x, port, GRUB_XHCI_PORT_CONNECT_CH);
+    }
+  else
+    *changed = 0;
+
+  if (!(status & GRUB_XHCI_PORT_CONNECT))
+    return GRUB_USB_SPEED_NONE;
+
+  switch (GRUB_XHCI_PORT_SPEED (status))
+    {
+    case GRUB_XHCI_SPEED_LOW:
+      return GRUB_USB_SPEED_LOW;
+    case GRUB_XHCI_SPEED_FULL:
+      return GRUB_USB_SPEED_FULL;
+    case GRUB_XHCI_SPEED_HIGH:
+      return GRUB_USB_SPEED_HIGH;
+    case 0:
+      /* Not known before the port is reset.  */
+      return GRUB_USB_SPEED_FULL;
+    default:
+      return GRUB_USB_SPEED_SUPER;
+    }
+}
+
+static grub_usb_err_t
+grub_xhci_halt (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_COMMAND,
+			  grub_xhci_oper_read32 (x, GRUB_XHCI_COMMAND)
+			  & ~GRUB_XHCI_CMD_RUNSTOP);
+  maxtime = grub_get_time_ms () + 100;
+  while (!(grub_xhci_oper_read32 (x, GRUB_XHCI_STATUS)
+	   & GRUB_XHCI_ST_HC_HALTED))
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_reset (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_COMMAND, GRUB_XHCI_CMD_HC_RESET);
+  maxtime = grub_get_time_ms () + 1000;
+  while ((grub_xhci_oper_read32 (x, GRUB_XHCI_COMMAND)
+	  & GRUB_XHCI_CMD_HC_RESET)
+	 || (grub_xhci_oper_read32 (x, GRUB_XHCI_STATUS)
+	     & GRUB_XHCI_ST_NOT_READY))
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_err_t
+grub_xhci_run (struct grub_xhci *x)
+{
+  grub_uint64_t maxtime;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_COMMAND,
+			  grub_xhci_oper_read32 (x, GRUB_XHCI_COMMAND)
+			  | GRUB_XHCI_CMD_RUNSTOP);
+  maxtime = grub_get_time_ms () + 100;
+  while (grub_xhci_oper_read32 (x, GRUB_XHCI_STATUS)
+	 & GRUB_XHCI_ST_HC_HALTED)
+    if (grub_get_time_ms () > maxtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Take the controller over from the firmware's legacy USB support.  */
+static void
+grub_xhci_take_ownership (struct grub_xhci *x)
+{
+  grub_uint32_t offset;
+  grub_uint64_t maxtime;
+
+  offset = GRUB_XHCI_CPARAMS1_XECP (grub_xhci_cap_read32
+				     (x, GRUB_XHCI_CAP_CPARAMS1));
+  while (offset && offset + 8 <= x->mapped)
+    {
+      grub_uint32_t cap = grub_xhci_cap_read32 (x, offset);
+      volatile grub_uint32_t *reg =
+	(volatile grub_uint32_t *) (x->iobase_cap + offset);
+
+      if ((cap & 0xff) == GRUB_XHCI_XECP_LEGACY)
+	{
+	  if (cap & GRUB_XHCI_LEGACY_BIOS_OWNED)
+	    {
+	      grub_boot_time ("Taking ownership of XHCI controller");
+	      reg[0] = grub_cpu_to_le32 (cap | GRUB_XHCI_LEGACY_OS_OWNED);
+	      maxtime = grub_get_time_ms () + 1000;
+	      while ((grub_le_to_cpu32 (reg[0]) & GRUB_XHCI_LEGACY_BIOS_OWNED)
+		     && grub_get_time_ms () < maxtime);
+	      if (grub_le_to_cpu32 (reg[0]) & GRUB_XHCI_LEGACY_BIOS_OWNED)
+		{
+		  grub_dprintf ("xhci", "change ownership timeout\n");
+		  reg[0] = grub_cpu_to_le32 (GRUB_XHCI_LEGACY_OS_OWNED
+					     | (cap & 0xffff));
+		}
+	    }
+	  else
+	    reg[0] = grub_cpu_to_le32 (cap | GRUB_XHCI_LEGACY_OS_OWNED);
+
+	  /* Disable SMI, just to be sure.  */
+	  reg[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (reg[1])
+				      & GRUB_XHCI_LEGACY_SMI_KEEP)
+				     | GRUB_XHCI_LEGACY_SMI_CLEAR);
+	  return;
+	}
+      if (!((cap >> 8) & 0xff))
+	break;
+      offset += ((cap >> 8) & 0xff) << 2;
+    }
+}
+
+/* Program the data structures into a halted, reset controller.  */
+static void
+grub_xhci_setup_hw (struct grub_xhci *x)
+{
+  grub_uint32_t phys;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_CONFIG, x->n_slots);
+  grub_xhci_oper_write32 (x, GRUB_XHCI_DCBAAP,
+			  grub_dma_get_phys (x->dcbaa_chunk));
+  grub_xhci_oper_write32 (x, GRUB_XHCI_DCBAAP_HIGH, 0);
+
+  phys = grub_xhci_ring_phys (&x->cmd_ring, x->cmd_ring.index);
+  grub_xhci_oper_write32 (x, GRUB_XHCI_CRCR, phys | x->cmd_ring.cycle);
+  grub_xhci_oper_write32 (x, GRUB_XHCI_CRCR_HIGH, 0);
+
+  /* The segment table goes last, it starts the event ring.  */
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERSTSZ, 1);
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP,
+			grub_xhci_ring_phys (&x->event_ring,
+					     x->event_ring.index));
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP_HIGH, 0);
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERSTBA,
+			grub_dma_get_phys (x->erst_chunk));
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERSTBA_HIGH, 0);
+}
+
+static void
+grub_xhci_power_ports (struct grub_xhci *x)
+{
+  int i;
+
+  if (!(grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_CPARAMS1)
+	& GRUB_XHCI_CPARAMS1_PPC))
+    return;
+  for (i = 0; i < x->n_ports; i++)
+    grub_xhci_port_write (x, i, GRUB_XHCI_PORT_POWER);
+}
+
+static int
+grub_xhci_pci_iter (grub_pci_device_t dev,
+		    grub_pci_id_t pciid __attribute__ ((unused)),
+		    void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t class_code;
+  grub_uint32_t base, base_h;
+  grub_uint32_t sparams1, sparams2, dboff, rtsoff, version;
+  grub_uint32_t pagesize;
+  grub_uint8_t caplen;
+  grub_size_t size;
+  unsigned int n_scratch, i;
+  struct grub_xhci *x;
+  volatile grub_uint64_t *scratch;
+  grub_uint32_t scratch_phys;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class_code = grub_pci_read (addr) >> 8;
+
+  /* If this is not an XHCI controller, just return.  */
+  if (class_code != 0x0c0330)
+    return 0;
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: class OK\n");
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  base = grub_pci_read (addr);
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+  base_h = grub_pci_read (addr);
+  /* Stop if registers are mapped above 4G - GRUB does not currently
+   * work with registers mapped above 4G */
+  if (((base & GRUB_PCI_ADDR_MEM_TYPE_MASK) != GRUB_PCI_ADDR_MEM_TYPE_32)
+      && (base_h != 0))
+    {
+      grub_dprintf ("xhci",
+		    "XHCI grub_xhci_pci_iter: registers above 4G are not supported\n");
+      return 0;
+    }
+  base &= GRUB_PCI_ADDR_MEM_MASK;
+  if (!base)
+    {
+      grub_dprintf ("xhci", "XHCI: XHCI is not mapped\n");
+      return 0;
+    }
+
+  /* Set bus master - needed for coreboot, VMware, broken BIOSes etc. */
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr,
+		       GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER
+		       | grub_pci_read_word (addr));
+
+  x = grub_zalloc (sizeof (*x));
+  if (!x)
+    return 1;
+
+  /* Map the capability registers first, they tell where the rest is.  */
+  x->iobase_cap = grub_pci_device_map_range (dev, base, 0x20);
+  caplen = grub_xhci_cap_read8 (x, GRUB_XHCI_CAP_CAPLEN);
+  /* GRUB_XHCI_CAP_VERSION, the upper half of the first dword.  */
+  version = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_CAPLEN) >> 16;
+  sparams1 = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_SPARAMS1);
+  sparams2 = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_SPARAMS2);
+  dboff = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_DBOFF) & ~3;
+  rtsoff = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_RTSOFF) & ~0x1f;
+  x->n_slots = GRUB_XHCI_SPARAMS1_SLOTS (sparams1);
+  x->n_ports = GRUB_XHCI_SPARAMS1_PORTS (sparams1);
+  x->ctx_size = (grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_CPARAMS1)
+		 & GRUB_XHCI_CPARAMS1_CSZ) ? 64 : 32;
+  grub_pci_device_unmap_range (dev, x->iobase_cap, 0x20);
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: VERSION: %04x\n",
+		version);
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: slots=%d ports=%d "
+		"ctx=%d\n", x->n_slots, x->n_ports, x->ctx_size);
+
+  size = 0x10000;
+  if (size < dboff + (x->n_slots + 1) * 4)
+    size = dboff + (x->n_slots + 1) * 4;
+  if (size < rtsoff + 0x40)
+    size = rtsoff + 0x40;
+  if (size < caplen + GRUB_XHCI_PORTSC + x->n_ports * 0x10U)
+    size = caplen + GRUB_XHCI_PORTSC + x->n_ports * 0x10U;
+  x->mapped = size;
+  x->iobase_cap = grub_pci_device_map_range (dev, base, size);
+  x->iobase = x->iobase_cap + caplen;
+  x->iobase_rt = x->iobase_cap + rtsoff;
+  x->doorbells = (volatile grub_uint32_t *) (x->iobase_cap + dboff);
+
+  if (!x->n_slots || !x->n_ports)
+    goto fail;
+
+  x->slots = grub_zalloc ((x->n_slots + 1) * sizeof (x->slots[0]));
+  if (!x->slots)
+    goto fail;
+
+  /* Device context base address array */
+  x->dcbaa_chunk = grub_memalign_dma32 (4096, (x->n_slots + 1)
+					* sizeof (grub_uint64_t));
+  if (!x->dcbaa_chunk)
+    goto fail;
+  x->dcbaa = grub_dma_get_virt (x->dcbaa_chunk);
+  grub_memset ((void *) x->dcbaa, 0, (x->n_slots + 1) * sizeof (grub_uint64_t));
+
+  /* Scratchpad buffers the xHC may want for itself */
+  pagesize = (grub_xhci_oper_read32 (x, GRUB_XHCI_PAGESIZE) & 0xffff) << 12;
+  n_scratch = GRUB_XHCI_SPARAMS2_SCRATCH (sparams2);
+  if (n_scratch)
+    {
+      if (!pagesize || (pagesize & (pagesize - 1)))
+	pagesize = 4096;
+      x->scratch_chunk = grub_memalign_dma32 (64, n_scratch
+					      * sizeof (grub_uint64_t));
+      x->scratch_pages_chunk = grub_memalign_dma32 (pagesize,
+						    n_scratch * pagesize);
+      if (!x->scratch_chunk || !x->scratch_pages_chunk)
+	goto fail;
+      scratch = grub_dma_get_virt (x->scratch_chunk);
+      scratch_phys = grub_dma_get_phys (x->scratch_pages_chunk);
+      grub_memset ((void *) grub_dma_get_virt (x->scratch_pages_chunk), 0,
+		   n_scratch * pagesize);
+      for (i = 0; i < n_scratch; i++)
+	scratch[i] = grub_cpu_to_le64 (scratch_phys + i * pagesize);
+      x->dcbaa[0] = grub_cpu_to_le64 (grub_dma_get_phys (x->scratch_chunk));
+    }
+
+  /* Command ring */
+  {
+    struct grub_xhci_ring *ring = grub_xhci_ring_alloc ();
+
+    if (!ring)
+      goto fail;
+    x->cmd_ring = *ring;
+    grub_free (ring);
+  }
+
+  /* Event ring, a single segment */
+  x->event_ring.chunk = grub_memalign_dma32 (64, GRUB_XHCI_N_EVENTS
+					     * sizeof (struct grub_xhci_trb));
+  x->erst_chunk = grub_memalign_dma32 (64, sizeof (struct grub_xhci_erst_entry));
+  if (!x->event_ring.chunk || !x->erst_chunk)
+    goto fail;
+  x->event_ring.trbs = grub_dma_get_virt (x->event_ring.chunk);
+  x->event_ring.phys = grub_dma_get_phys (x->event_ring.chunk);
+  x->event_ring.cycle = GRUB_XHCI_TRB_CYCLE;
+  grub_memset ((void *) x->event_ring.trbs, 0,
+	       GRUB_XHCI_N_EVENTS * sizeof (struct grub_xhci_trb));
+  x->erst = grub_dma_get_virt (x->erst_chunk);
+  x->erst->addr = grub_cpu_to_le64 (x->event_ring.phys);
+  x->erst->size = grub_cpu_to_le32 (GRUB_XHCI_N_EVENTS);
+  x->erst->reserved = 0;
+
+  grub_xhci_take_ownership (x);
+
+  if (grub_xhci_halt (x) != GRUB_USB_ERR_NONE)
+    {
+      grub_error (GRUB_ERR_TIMEOUT,
+		  "XHCI grub_xhci_pci_iter: XHCI halt timeout");
+      goto fail;
+    }
+  if (grub_xhci_reset (x) != GRUB_USB_ERR_NONE)
+    {
+      grub_error (GRUB_ERR_TIMEOUT,
+		  "XHCI grub_xhci_pci_iter: XHCI reset timeout");
+      goto fail;
+    }
+
+  grub_xhci_setup_hw (x);
+  if (grub_xhci_run (x) != GRUB_USB_ERR_NONE)
+    {
+      grub_error (GRUB_ERR_TIMEOUT,
+		  "XHCI grub_xhci_pci_iter: XHCI start timeout");
+      goto fail;
+    }
+  grub_xhci_power_ports (x);
+
+  /* Link to xhci now that initialisation is successful.  */
+  x->next = xhci;
+  xhci = x;
+
+  grub_dprintf ("xhci", "XHCI grub_xhci_pci_iter: OK at all\n");
+  return 0;
+
+ fail:
+  if (x->cmd_ring.chunk)
+    grub_dma_free (x->cmd_ring.chunk);
+  if (x->event_ring.chunk)
+    grub_dma_free (x->event_ring.chunk);
+  if (x->erst_chunk)
+    grub_dma_free (x->erst_chunk);
+  if (x->scratch_pages_chunk)
+    grub_dma_free (x->scratch_pages_chunk);
+  if (x->scratch_chunk)
+    grub_dma_free (x->scratch_chunk);
+  if (x->dcbaa_chunk)
+    grub_dma_free (x->dcbaa_chunk);
+  grub_free (x->slots);
+  grub_free (x);
+  return 0;
+}
+
+static int
+grub_xhci_iterate (grub_usb_controller_iterate_hook_t hook, void *hook_data)
+{
+  struct grub_xhci *x;
+  struct grub_usb_controller dev;
+
+  for (x = xhci; x; x = x->next)
+    {
+      dev.data = x;
+      if (hook (&dev, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static void
+grub_xhci_inithw (void)
+{
+  grub_pci_iterate (grub_xhci_pci_iter, NULL);
+}
+
+static grub_err_t
+grub_xhci_restore_hw (void)
+{
+  struct grub_xhci *x;
+
+  /* Halting kept the rings and slots, so running again is enough.  */
+  for (x = xhci; x; x = x->next)
+    if (grub_xhci_run (x) != GRUB_USB_ERR_NONE)
+      grub_error (GRUB_ERR_TIMEOUT, "restore_hw: XHCI start timeout");
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_xhci_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_xhci *x;
+
+  /* We should disable all XHCI HW to prevent any DMA access etc. */
+  for (x = xhci; x; x = x->next)
+    grub_xhci_halt (x);
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_usb_controller_dev usb_controller = {
+  .name = "xhci",
+  .iterate = grub_xhci_iterate,
+  .setup_transfer = grub_xhci_setup_transfer,
+  .check_transfer = grub_xhci_check_transfer,
+  .cancel_transfer = grub_xhci_cancel_transfer,
+  .hubports = grub_xhci_hubports,
+  .portstatus = grub_xhci_portstatus,
+  .detect_dev = grub_xhci_detect_dev,
+  /* a TD takes this many TRBs at most, the ring keeps room for one */
+  .max_bulk_tds = 64,
+  /* the xHC splits packets itself; TRBs stop at 64 KiB boundaries */
+  .max_bulk_trans_len = GRUB_XHCI_TRB_MAXLEN
+};
+
+GRUB_MOD_INIT (xhci)
+{
+  COMPILE_TIME_ASSERT (sizeof (struct grub_xhci_trb) == 16);
+  COMPILE_TIME_ASSERT (sizeof (struct grub_xhci_erst_entry) == 16);
+
+  grub_stop_disk_firmware ();
+
+  grub_boot_time ("Initing XHCI hardware");
+  grub_xhci_inithw ();
+  grub_boot_time ("Registering XHCI driver");
+  grub_usb_controller_dev_register (&usb_controller);
+  grub_boot_time ("XHCI driver registered");
+  grub_loader_register_preboot_hook (grub_xhci_fini_hw, grub_xhci_restore_hw,
+				     GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI (xhci)
+{
+  grub_xhci_fini_hw (0);
+  grub_usb_controller_dev_unregister (&usb_controller);
+}
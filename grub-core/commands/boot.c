@@ -24,6 +24,10 @@
 #include <grub/kernel.h>
 #include <grub/mm.h>
 #include <grub/i18n.h>
+#if BOOT_TIME_STATS && defined (GRUB_MACHINE_EFI)
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -136,6 +140,38 @@ grub_loader_unset(void)
   grub_loader_loaded = 0;
 }
 
+#if BOOT_TIME_STATS && defined (GRUB_MACHINE_EFI)
+/* Leave the trace ring, oldest event first, in a configuration table for
+   the OS to pick up.  It's in ACPI reclaim memory, to be copied early.  */
+static void
+grub_loader_export_trace (void)
+{
+  grub_efi_guid_t guid = GRUB_EFI_GRUB_TRACE_TABLE_GUID;
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_trace_table *table;
+  grub_efi_physical_address_t address;
+  grub_uint32_t count, first, i;
+  grub_efi_status_t status;
+  grub_size_t size;
+
+  count = grub_min (grub_trace_count, GRUB_TRACE_RING_SIZE);
+  first = grub_trace_count - count;
+  size = sizeof (*table) + count * sizeof (table->events[0]);
+  status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_ANY_PAGES,
+		       GRUB_EFI_ACPI_RECLAIM_MEMORY,
+		       (size + 0xfff) >> 12, &address);
+  if (status != GRUB_EFI_SUCCESS)
+    return;
+
+  table = (struct grub_trace_table *) (grub_addr_t) address;
+  table->magic = GRUB_TRACE_TABLE_MAGIC;
+  table->count = count;
+  for (i = 0; i < count; i++)
+    table->events[i] = grub_trace_ring[(first + i) % GRUB_TRACE_RING_SIZE];
+  efi_call_2 (b->install_configuration_table, &guid, table);
+}
+#endif
+
 grub_err_t
 grub_loader_boot (void)
 {
@@ -146,6 +182,14 @@ grub_loader_boot (void)
     return grub_error (GRUB_ERR_NO_KERNEL,
 		       N_("you need to load the kernel first"));
 
+  grub_trace_enter (GRUB_TRACE_BOOT, 0, 0);
+#if BOOT_TIME_STATS && defined (GRUB_MACHINE_EFI)
+  grub_loader_export_trace ();
+#endif
+
+  /* Terminals may still hold output back, e.g. a buffered serial port.  */
+  grub_refresh ();
+
   grub_machine_fini (grub_loader_flags);
 
   for (cur = preboots_head; cur; cur = cur->next)
@@ -155,6 +199,7 @@ grub_loader_boot (void)
 	{
 	  for (cur = cur->prev; cur; cur = cur->prev)
 	    cur->preboot_rest_func ();
+	  grub_trace_exit (GRUB_TRACE_BOOT, 0, err);
 	  return err;
 	}
     }
@@ -166,6 +211,7 @@ grub_loader_boot (void)
     else
       cur->preboot_rest_func ();
 
+  grub_trace_exit (GRUB_TRACE_BOOT, 0, err);
   return err;
 }
 
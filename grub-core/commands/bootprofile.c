@@ -0,0 +1,390 @@
+/* bootprofile.c - record the disk reads of a boot and prefetch them  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* A profile is a list of disk ranges, "DISK:START+COUNT" separated by
+   spaces, START and COUNT being hexadecimal numbers of disk cache blocks
+   from the start of the disk.  It is kept in a variable, so that load_env
+   and save_env can store it in a file of its own.  */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/env.h>
+#include <grub/disk.h>
+#include <grub/partition.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Recording stops growing the profile past this many ranges.  */
+#define PROFILE_MAX_RANGES	1024
+
+/* Ranges at most this many cache blocks apart are read as one: reading
+   the gap costs less than a seek.  */
+#define PROFILE_MERGE_GAP	4
+
+static const struct grub_arg_option options[] =
+  {
+    {"set", 's', 0,
+     N_("Store the reads recorded so far in VARNAME."), N_("VARNAME"),
+     ARG_TYPE_STRING},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+struct profile_range
+{
+  /* Points into disk_names.  */
+  const char *disk;
+  grub_disk_addr_t start;
+  grub_uint64_t count;
+};
+
+struct profile_name
+{
+  struct profile_name *next;
+  char name[0];
+};
+
+static struct profile_range *ranges;
+static unsigned nranges, ranges_alloc;
+static struct profile_name *disk_names;
+
+static const char *
+profile_intern (const char *name)
+{
+  struct profile_name *n;
+
+  for (n = disk_names; n; n = n->next)
+    if (grub_strcmp (n->name, name) == 0)
+      return n->name;
+
+  n = grub_malloc (sizeof (*n) + grub_strlen (name) + 1);
+  if (! n)
+    return 0;
+  grub_strcpy (n->name, name);
+  n->next = disk_names;
+  disk_names = n;
+  return n->name;
+}
+
+static void
+profile_clear (void)
+{
+  struct profile_name *n;
+
+  grub_free (ranges);
+  ranges = 0;
+  nranges = ranges_alloc = 0;
+  while (disk_names)
+    {
+      n = disk_names->next;
+      grub_free (disk_names);
+      disk_names = n;
+    }
+}
+
+static void
+profile_record (grub_disk_t disk, grub_disk_addr_t sector, grub_off_t offset,
+		grub_size_t size)
+{
+  grub_disk_addr_t first, last;
+  struct profile_range *r;
+  const char *name;
+
+  if (! size || grub_strchr (disk->name, ' ')
+      || grub_strchr (disk->name, '\'') || grub_strchr (disk->name, '"'))
+    return;
+
+  sector += grub_partition_get_start (disk->partition)
+    + (offset >> GRUB_DISK_SECTOR_BITS);
+  offset &= GRUB_DISK_SECTOR_SIZE - 1;
+  first = sector >> GRUB_DISK_CACHE_BITS;
+  last = (sector + ((offset + size - 1) >> GRUB_DISK_SECTOR_BITS))
+    >> GRUB_DISK_CACHE_BITS;
+
+  /* Most reads continue or repeat the one before.  */
+  r = nranges ? ranges + nranges - 1 : 0;
+  if (r && grub_strcmp (r->disk, disk->name) == 0
+      && first <= r->start + r->count && last + 1 >= r->start)
+    {
+      if (last + 1 > r->start + r->count)
+	r->count = last + 1 - r->start;
+      if (first < r->start)
+	{
+	  r->count += r->start - first;
+	  r->start = first;
+	}
+      return;
+    }
+
+  if (nranges == PROFILE_MAX_RANGES)
+    return;
+  if (nranges == ranges_alloc)
+    {
+      unsigned alloc = ranges_alloc ? ranges_alloc * 2 : 64;
+
+      r = grub_realloc (ranges, alloc * sizeof (ranges[0]));
+      if (! r)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      ranges = r;
+      ranges_alloc = alloc;
+    }
+  name = profile_intern (disk->name);
+  if (! name)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  r = ranges + nranges++;
+  r->disk = name;
+  r->start = first;
+  r->count = last + 1 - first;
+}
+
+static int
+range_before (const struct profile_range *a, const struct profile_range *b)
+{
+  int c = grub_strcmp (a->disk, b->disk);
+
+  return c < 0 || (c == 0 && a->start < b->start);
+}
+
+/* Sort R by disk and position and merge neighbours, returning the number
+   of ranges left.  */
+static unsigned
+profile_merge (struct profile_range *r, unsigned n)
+{
+  unsigned i, j;
+
+  for (i = 1; i < n; i++)
+    {
+      struct profile_range t = r[i];
+
+      for (j = i; j > 0 && range_before (&t, &r[j - 1]); j--)
+	r[j] = r[j - 1];
+      r[j] = t;
+    }
+
+  for (i = 0, j = 0; i < n; i++)
+    {
+      if (j && grub_strcmp (r[j - 1].disk, r[i].disk) == 0
+	  && r[i].start <= r[j - 1].start + r[j - 1].count + PROFILE_MERGE_GAP)
+	{
+	  if (r[i].start + r[i].count > r[j - 1].start + r[j - 1].count)
+	    r[j - 1].count = r[i].start + r[i].count - r[j - 1].start;
+	  continue;
+	}
+      r[j++] = r[i];
+    }
+  return j;
+}
+
+static grub_err_t
+profile_save (const char *var)
+{
+  struct profile_range *r;
+  unsigned n, i;
+  grub_size_t len = 1;
+  char *str, *p;
+
+  r = grub_malloc ((nranges ? : 1) * sizeof (r[0]));
+  if (! r)
+    return grub_errno;
+  grub_memcpy (r, ranges, nranges * sizeof (r[0]));
+  n = profile_merge (r, nranges);
+
+  for (i = 0; i < n; i++)
+    len += grub_strlen (r[i].disk) + 1 + 16 + 1 + 16 + 1;
+  p = str = grub_malloc (len);
+  if (! str)
+    {
+      grub_free (r);
+      return grub_errno;
+    }
+  *p = 0;
+  for (i = 0; i < n; i++)
+    p += grub_snprintf (p, str + len - p, "%s%s:%llx+%llx", i ? " " : "",
+			r[i].disk, (unsigned long long) r[i].start,
+			(unsigned long long) r[i].count);
+
+  grub_env_set (var, str);
+  grub_free (str);
+  grub_free (r);
+  return grub_errno;
+}
+
+/* Parse PROFILE and prefetch its ranges, at most half the disk cache in
+   all so that they don't push each other out.  All of them are queued
+   before any is read, so that the reads of every disk go out together.  */
+static grub_err_t
+profile_prefetch (const char *profile)
+{
+  struct profile_range *r = 0;
+  unsigned n = 0, alloc = 0, i, ndisks = 0;
+  char *copy, *p;
+  grub_uint64_t budget;
+  grub_disk_t disk = 0, *disks = 0;
+
+  copy = grub_strdup (profile);
+  if (! copy)
+    return grub_errno;
+
+  for (p = copy; *p; )
+    {
+      char *word, *colon, *end;
+      grub_disk_addr_t start;
+      grub_uint64_t count;
+
+      while (*p == ' ')
+	p++;
+      if (! *p)
+	break;
+      word = p;
+      while (*p && *p != ' ')
+	p++;
+      if (*p)
+	*p++ = 0;
+
+      colon = grub_strrchr (word, ':');
+      if (! colon)
+	continue;
+      *colon = 0;
+      start = grub_strtoull (colon + 1, &end, 16);
+      if (grub_errno || *end != '+')
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+      count = grub_strtoull (end + 1, &end, 16);
+      if (grub_errno || *end || ! count)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      if (n == alloc)
+	{
+	  struct profile_range *t;
+
+	  alloc = alloc ? alloc * 2 : 64;
+	  t = grub_realloc (r, alloc * sizeof (r[0]));
+	  if (! t)
+	    goto out;
+	  r = t;
+	}
+      r[n].disk = word;
+      r[n].start = start;
+      r[n].count = count;
+      n++;
+    }
+
+  /* A profile written by another version may not be in order.  */
+  n = profile_merge (r, n);
+
+  /* Sorted by disk, so each is opened once.  */
+  disks = grub_malloc ((n ? : 1) * sizeof (disks[0]));
+  if (! disks)
+    goto out;
+
+  budget = (grub_uint64_t) grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS / 2;
+  for (i = 0; i < n && budget; i++)
+    {
+      grub_uint64_t count = r[i].count;
+
+      if (i == 0 || grub_strcmp (r[i - 1].disk, r[i].disk) != 0)
+	{
+	  disk = grub_disk_open (r[i].disk);
+	  if (! disk)
+	    {
+	      grub_dprintf ("bootprofile", "skipping %s\n", r[i].disk);
+	      grub_errno = GRUB_ERR_NONE;
+	      continue;
+	    }
+	  disks[ndisks++] = disk;
+	}
+      else if (! disk)
+	continue;
+
+      if (count > budget)
+	count = budget;
+      budget -= count;
+      grub_dprintf ("bootprofile", "prefetching %s:%llx+%llx\n", r[i].disk,
+		    (unsigned long long) r[i].start,
+		    (unsigned long long) count);
+      grub_disk_preload (disk, r[i].start << GRUB_DISK_CACHE_BITS,
+			 (grub_size_t) count << (GRUB_DISK_CACHE_BITS
+						 + GRUB_DISK_SECTOR_BITS));
+    }
+  grub_disk_run_queue ();
+
+ out:
+  for (i = 0; i < ndisks; i++)
+    grub_disk_close (disks[i]);
+  grub_free (disks);
+  grub_free (r);
+  grub_free (copy);
+  return grub_errno;
+}
+
+static grub_err_t
+grub_cmd_bootprofile (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+
+  if (argc > 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  if (state[0].set)
+    {
+      if (argc)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			   N_("unexpected argument"));
+      return profile_save (state[0].arg);
+    }
+
+  /* Start over, so that the profile saved later is this boot's.  */
+  grub_disk_profile_hook = 0;
+  profile_clear ();
+  if (argc && profile_prefetch (args[0]))
+    return grub_errno;
+  grub_disk_profile_hook = profile_record;
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(bootprofile)
+{
+  cmd = grub_register_extcmd ("bootprofile", grub_cmd_bootprofile, 0,
+			      N_("[--set VARNAME] [PROFILE]"),
+			      N_("Prefetch the disk ranges of PROFILE and"
+				 " record the reads that follow."),
+			      options);
+}
+
+GRUB_MOD_FINI(bootprofile)
+{
+  grub_disk_profile_hook = 0;
+  profile_clear ();
+  grub_unregister_extcmd (cmd);
+}
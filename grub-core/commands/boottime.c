@@ -19,6 +19,7 @@
 #include <grub/dl.h>
 #include <grub/misc.h>
 #include <grub/command.h>
+#include <grub/extcmd.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -50,16 +51,107 @@ grub_cmd_boottime (struct grub_command *cmd __attribute__ ((unused)),
  return 0;
 }
 
+static const char *const trace_names[GRUB_TRACE_MAX] =
+  {
+    [GRUB_TRACE_DL_LOAD] = "module",
+    [GRUB_TRACE_FILE_OPEN] = "open",
+    [GRUB_TRACE_FILE_READ] = "read",
+    [GRUB_TRACE_DISK_READ] = "disk",
+    [GRUB_TRACE_FS_PROBE] = "fs",
+    [GRUB_TRACE_COMMAND] = "command",
+    [GRUB_TRACE_BOOT] = "boot"
+  };
+
+static const struct grub_arg_option trace_options[] =
+  {
+    {"events", 'e', 0, N_("Show the recorded events too."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static void
+print_us (grub_uint64_t us)
+{
+  grub_uint64_t ms, rem;
+
+  ms = grub_divmod64 (us, 1000, &rem);
+  grub_printf ("%6llu.%03llums", (unsigned long long) ms,
+	       (unsigned long long) rem);
+}
+
+static void
+print_events (void)
+{
+  grub_uint32_t count, i;
+  grub_uint64_t start;
+  unsigned depth = 0;
+
+  count = grub_min (grub_trace_count, GRUB_TRACE_RING_SIZE);
+  i = grub_trace_count - count;
+  start = grub_trace_ring[i % GRUB_TRACE_RING_SIZE].us;
+  for (; i != grub_trace_count; i++)
+    {
+      struct grub_trace_event *e = &grub_trace_ring[i % GRUB_TRACE_RING_SIZE];
+      grub_uint32_t type = e->type & ~GRUB_TRACE_EXIT;
+      unsigned j;
+
+      if ((e->type & GRUB_TRACE_EXIT) && depth)
+	depth--;
+      print_us (e->us - start);
+      for (j = 0; j < depth + 1 && j < 16; j++)
+	grub_printf ("  ");
+      /* grub_printf has no '*', this is GRUB_TRACE_NAME_SIZE.  */
+      grub_printf ("%c %s %.16s %u\n", (e->type & GRUB_TRACE_EXIT) ? '<' : '>',
+		   type < GRUB_TRACE_MAX ? trace_names[type] : "?",
+		   e->name, e->arg);
+      if (!(e->type & GRUB_TRACE_EXIT))
+	depth++;
+    }
+}
+
+static grub_err_t
+grub_cmd_boottrace (grub_extcmd_context_t ctxt,
+		    int argc __attribute__ ((unused)),
+		    char **args __attribute__ ((unused)))
+{
+  unsigned i;
+
+  if (!grub_trace_count)
+    {
+      grub_puts_ (N_("No boot trace is available"));
+      return 0;
+    }
+
+  for (i = 0; i < GRUB_TRACE_MAX; i++)
+    {
+      if (!grub_trace_totals[i].count)
+	continue;
+      grub_printf ("%-8s %8llu calls ", trace_names[i],
+		   (unsigned long long) grub_trace_totals[i].count);
+      print_us (grub_trace_totals[i].us);
+      grub_printf ("\n");
+    }
+
+  if (ctxt->state[0].set)
+    print_events ();
+  return 0;
+}
+
 static grub_command_t cmd_boottime;
+static grub_extcmd_t cmd_boottrace;
 
 GRUB_MOD_INIT(boottime)
 {
   cmd_boottime =
     grub_register_command ("boottime", grub_cmd_boottime,
 			   0, N_("Show boot time statistics."));
+  cmd_boottrace =
+    grub_register_extcmd ("boottrace", grub_cmd_boottrace, 0, N_("[-e]"),
+			  N_("Show the time spent in each boot phase."),
+			  trace_options);
 }
 
 GRUB_MOD_FINI(boottime)
 {
   grub_unregister_command (cmd_boottime);
+  grub_unregister_extcmd (cmd_boottrace);
 }
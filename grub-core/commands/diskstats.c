@@ -0,0 +1,85 @@
+/* diskstats.c - per-disk I/O statistics  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/command.h>
+#include <grub/i18n.h>
+#include <grub/disk.h>
+#include <grub/list.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static grub_err_t
+grub_cmd_diskstats (struct grub_command *cmd __attribute__ ((unused)),
+		    int argc __attribute__ ((unused)),
+		    char *argv[] __attribute__ ((unused)))
+{
+  struct grub_disk_stats *stats;
+
+  if (! grub_disk_stats_list)
+    {
+      grub_printf ("%s\n", _("No disk statistics available"));
+      return GRUB_ERR_NONE;
+    }
+
+  FOR_LIST_ELEMENTS (stats, grub_disk_stats_list)
+    {
+      unsigned i, last;
+
+      grub_printf_ (N_("%s: %lu requests, %llu bytes\n"), stats->name,
+		    stats->requests, (unsigned long long) stats->bytes);
+      grub_printf_ (N_("  sectors: %llu from cache, %llu from device\n"),
+		    (unsigned long long) stats->cached_sectors,
+		    (unsigned long long) stats->device_sectors);
+      grub_printf_ (N_("  device reads: %lu taking %llu ms\n"),
+		    stats->device_reads,
+		    (unsigned long long) stats->device_ms);
+
+      for (last = GRUB_DISK_STATS_LATENCY_BUCKETS; last > 0; last--)
+	if (stats->latency[last - 1])
+	  break;
+      for (i = 0; i < last; i++)
+	{
+	  if (i == 0)
+	    grub_printf ("  %6s: %lu\n", "<1ms", stats->latency[i]);
+	  else if (i == GRUB_DISK_STATS_LATENCY_BUCKETS - 1)
+	    grub_printf ("  >=%ums: %lu\n", 1U << (i - 1), stats->latency[i]);
+	  else
+	    grub_printf ("  %ums-%ums: %lu\n", 1U << (i - 1),
+			 (1U << i) - 1, stats->latency[i]);
+	}
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_command_t cmd_diskstats;
+
+GRUB_MOD_INIT(diskstats)
+{
+  cmd_diskstats =
+    grub_register_command ("diskstats", grub_cmd_diskstats,
+			   0, N_("Show per-disk I/O statistics."));
+}
+
+GRUB_MOD_FINI(diskstats)
+{
+  grub_unregister_command (cmd_diskstats);
+}
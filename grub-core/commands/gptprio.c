@@ -25,6 +25,8 @@
 #include <grub/gpt_partition.h>
 #include <grub/i18n.h>
 #include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -210,7 +212,79 @@ done:
   return grub_errno;
 }
 
-static grub_extcmd_t cmd_next;
+/* Take a partition out of the rotation, for when something checked before
+   booting it found it unusable: with no tries left and not marked
+   successful, gptprio.next passes over it.  */
+static grub_err_t
+grub_cmd_reject (grub_extcmd_context_t ctxt __attribute__ ((unused)),
+		 int argc, char **args)
+{
+  grub_device_t dev = NULL;
+  grub_gpt_t gpt = NULL;
+  char *disk_name = NULL, *p;
+  grub_uint32_t index;
+
+  if (argc != 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  dev = grub_device_open (args[0]);
+  if (!dev)
+    goto done;
+  if (!dev->disk || !dev->disk->partition
+      || grub_strcmp (dev->disk->partition->partmap->name, "gpt") != 0
+      || dev->disk->partition->parent)
+    {
+      grub_error (GRUB_ERR_BAD_DEVICE, N_("not a GPT partition"));
+      goto done;
+    }
+  index = dev->disk->partition->number;
+  grub_device_close (dev);
+
+  disk_name = grub_strdup (args[0]);
+  if (!disk_name)
+    goto done;
+  p = grub_strchr (disk_name, ',');
+  if (p)
+    *p = '\0';
+
+  dev = grub_device_open (disk_name);
+  if (!dev)
+    goto done;
+
+  gpt = grub_gpt_read (dev->disk);
+  if (!gpt)
+    goto done;
+
+  if (!(gpt->status & GRUB_GPT_BOTH_VALID))
+    if (grub_gpt_repair (dev->disk, gpt))
+      goto done;
+
+  if (index >= grub_le_to_cpu32 (gpt->primary.maxpart))
+    {
+      grub_error (GRUB_ERR_BAD_DEVICE, N_("no such partition"));
+      goto done;
+    }
+
+  grub_gptprio_set_tries_left (&gpt->entries[index], 0);
+  grub_gpt_entry_set_attribute (&gpt->entries[index], 0,
+				GRUB_GPT_PART_ATTR_OFFSET_GPTPRIO_SUCCESSFUL, 1);
+
+  if (grub_gpt_update_checksums (gpt))
+    goto done;
+
+  grub_gpt_write (dev->disk, gpt);
+
+done:
+  grub_gpt_free (gpt);
+  grub_free (disk_name);
+
+  if (dev)
+    grub_device_close (dev);
+
+  return grub_errno;
+}
+
+static grub_extcmd_t cmd_next, cmd_reject;
 
 GRUB_MOD_INIT(gptprio)
 {
@@ -218,9 +292,13 @@ GRUB_MOD_INIT(gptprio)
 				   N_("-d VARNAME -u VARNAME [DEVICE]"),
 				   N_("Select next partition to boot."),
 				   options_next);
+  cmd_reject = grub_register_extcmd ("gptprio.reject", grub_cmd_reject, 0,
+				     N_("DEVICE"),
+				     N_("Stop booting a partition."), 0);
 }
 
 GRUB_MOD_FINI(gptprio)
 {
   grub_unregister_extcmd (cmd_next);
+  grub_unregister_extcmd (cmd_reject);
 }
@@ -60,47 +60,86 @@ hextoval (char c)
   return -1;
 }
 
+/* Files are hashed through one buffer of up to HASH_BUF_MAX bytes, grown
+   as needed and shared by all files of a command, so that large images
+   are read in a few big requests instead of 4 KiB at a time.  */
+#define HASH_BUF_MAX	(4 << 20)
+#define HASH_BUF_MIN	4096
+
+struct hash_buf
+{
+  grub_uint8_t *data;
+  grub_size_t size;
+};
+
+/* Make BUF large enough to read FILE in as few calls as possible.  If
+   memory is short a smaller buffer will do.  */
+static grub_err_t
+hash_buf_reserve (struct hash_buf *buf, grub_file_t file)
+{
+  grub_off_t want = grub_file_size (file);
+  grub_size_t size;
+
+  if (want == GRUB_FILE_SIZE_UNKNOWN || want > HASH_BUF_MAX)
+    want = HASH_BUF_MAX;
+  if (want < HASH_BUF_MIN)
+    want = HASH_BUF_MIN;
+  if (buf->size >= want)
+    return GRUB_ERR_NONE;
+
+  grub_free (buf->data);
+  buf->data = NULL;
+  buf->size = 0;
+  for (size = want; size >= HASH_BUF_MIN; size >>= 1)
+    {
+      buf->data = grub_malloc (size);
+      if (buf->data)
+	{
+	  buf->size = size;
+	  return GRUB_ERR_NONE;
+	}
+      grub_errno = GRUB_ERR_NONE;
+    }
+  return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+}
+
 static grub_err_t
-hash_file (grub_file_t file, const gcry_md_spec_t *hash, void *result)
+hash_file (grub_file_t file, const gcry_md_spec_t *hash, void *result,
+	   struct hash_buf *buf)
 {
-  void *context;
-  grub_uint8_t *readbuf;
-#define BUF_SIZE 4096
-  readbuf = grub_malloc (BUF_SIZE);
-  if (!readbuf)
+  GRUB_PROPERLY_ALIGNED_ARRAY (context, GRUB_CRYPTO_MAX_MD_CONTEXT_SIZE);
+
+  if (hash->contextsize > sizeof (context))
+    return grub_error (GRUB_ERR_BUG, "context is too large");
+
+  if (hash_buf_reserve (buf, file))
     return grub_errno;
-  context = grub_zalloc (hash->contextsize);
-  if (!readbuf || !context)
-    goto fail;
 
+  /* Every block is read exactly once, keep it out of the disk cache.  */
+  file->streaming = 1;
+
+  grub_memset (context, 0, hash->contextsize);
   hash->init (context);
   while (1)
     {
       grub_ssize_t r;
-      r = grub_file_read (file, readbuf, BUF_SIZE);
+      r = grub_file_read (file, buf->data, buf->size);
       if (r < 0)
-	goto fail;
+	return grub_errno;
       if (r == 0)
 	break;
-      hash->write (context, readbuf, r);
+      hash->write (context, buf->data, r);
     }
   hash->final (context);
   grub_memcpy (result, hash->read (context), hash->mdlen);
 
-  grub_free (readbuf);
-  grub_free (context);
-
   return GRUB_ERR_NONE;
-
- fail:
-  grub_free (readbuf);
-  grub_free (context);
-  return grub_errno;
 }
 
 static grub_err_t
 check_list (const gcry_md_spec_t *hash, const char *hashfilename,
-	    const char *prefix, int keep, int uncompress)
+	    const char *prefix, int keep, int uncompress,
+	    struct hash_buf *hbuf)
 {
   grub_file_t hashlist, file;
   char *buf = NULL;
@@ -158,7 +197,7 @@ check_list (const gcry_md_spec_t *hash, const char *hashfilename,
 	  grub_free (buf);
 	  return grub_errno;
 	}
-      err = hash_file (file, hash, actual);
+      err = hash_file (file, hash, actual, hbuf);
       grub_file_close (file);
       if (err)
 	{
@@ -208,6 +247,8 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
   int keep = state[3].set;
   int uncompress = state[4].set;
   unsigned unread = 0;
+  struct hash_buf hbuf = { NULL, 0 };
+  grub_err_t err;
 
   for (i = 0; i < ARRAY_SIZE (aliases); i++)
     if (grub_strcmp (ctxt->extcmd->cmd->name, aliases[i].name) == 0)
@@ -233,14 +274,15 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
       if (argc != 0)
 	return grub_error (GRUB_ERR_BAD_ARGUMENT,
 			   "--check is incompatible with file list");
-      return check_list (hash, state[1].arg, prefix, keep, uncompress);
+      err = check_list (hash, state[1].arg, prefix, keep, uncompress, &hbuf);
+      grub_free (hbuf.data);
+      return err;
     }
 
   for (i = 0; i < (unsigned) argc; i++)
     {
       GRUB_PROPERLY_ALIGNED_ARRAY (result, GRUB_CRYPTO_MAX_MDLEN);
       grub_file_t file;
-      grub_err_t err;
       unsigned j;
       if (!uncompress)
 	grub_file_filter_disable_compression ();
@@ -248,18 +290,18 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
       if (!file)
 	{
 	  if (!keep)
-	    return grub_errno;
+	    goto fail;
 	  grub_print_error ();
 	  grub_errno = GRUB_ERR_NONE;
 	  unread++;
 	  continue;
 	}
-      err = hash_file (file, hash, result);
+      err = hash_file (file, hash, result, &hbuf);
       grub_file_close (file);
       if (err)
 	{
 	  if (!keep)
-	    return err;
+	    goto fail;
 	  grub_print_error ();
 	  grub_errno = GRUB_ERR_NONE;
 	  unread++;
@@ -270,10 +312,15 @@ grub_cmd_hashsum (struct grub_extcmd_context *ctxt,
       grub_printf ("  %s\n", args[i]);
     }
 
+  grub_free (hbuf.data);
   if (unread)
     return grub_error (GRUB_ERR_TEST_FAILURE, "%d files couldn't be read",
 		       unread);
   return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (hbuf.data);
+  return grub_errno;
 }
 
 static grub_extcmd_t cmd, cmd_md5, cmd_sha1, cmd_sha256, cmd_sha512, cmd_crc;
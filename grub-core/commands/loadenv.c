@@ -40,6 +40,26 @@ static const struct grub_arg_option options[] =
     {0, 0, 0, 0, 0, 0}
   };
 
+/* Returns the name of the environment block file, FILENAME or the default
+   one, in a new buffer.  */
+static char *
+envblk_file_name (const char *filename)
+{
+  const char *prefix;
+
+  if (filename)
+    return grub_strdup (filename);
+
+  prefix = grub_env_get ("prefix");
+  if (! prefix)
+    {
+      grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("variable `%s' isn't set"), "prefix");
+      return 0;
+    }
+
+  return grub_xasprintf ("%s/" GRUB_ENVBLK_DEFCFG, prefix);
+}
+
 /* Opens 'filename' with compression filters disabled. Optionally disables the
    PUBKEY filter (that insists upon properly signed files) as well.  PUBKEY
    filter is restored before the function returns. */
@@ -47,30 +67,12 @@ static grub_file_t
 open_envblk_file (char *filename, int untrusted)
 {
   grub_file_t file;
-  char *buf = 0;
-
-  if (! filename)
-    {
-      const char *prefix;
-      int len;
-
-      prefix = grub_env_get ("prefix");
-      if (! prefix)
-        {
-          grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("variable `%s' isn't set"), "prefix");
-          return 0;
-        }
-
-      len = grub_strlen (prefix);
-      buf = grub_malloc (len + 1 + sizeof (GRUB_ENVBLK_DEFCFG));
-      if (! buf)
-        return 0;
-      filename = buf;
+  char *buf;
 
-      grub_strcpy (filename, prefix);
-      filename[len] = '/';
-      grub_strcpy (filename + len + 1, GRUB_ENVBLK_DEFCFG);
-    }
+  buf = envblk_file_name (filename);
+  if (! buf)
+    return 0;
+  filename = buf;
 
   /* The filters that are disabled will be re-enabled by the call to
      grub_file_open() after this particular file is opened. */
@@ -319,29 +321,115 @@ check_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
   return GRUB_ERR_NONE;
 }
 
-static int
-write_blocklists (grub_envblk_t envblk, struct blocklist *blocklists,
-                  grub_file_t file)
+/* Write ENVBLK to DISK through BLOCKLISTS.  OLD holds what is on disk
+   now; only the sectors that differ from it are written, so a small
+   change costs a single sector write.  */
+static grub_err_t
+write_blocklists (grub_envblk_t envblk, const char *old,
+		  struct blocklist *blocklists, grub_disk_t disk)
 {
   char *buf;
-  grub_disk_t disk;
   grub_disk_addr_t part_start;
   struct blocklist *p;
   grub_size_t index;
 
   buf = grub_envblk_buffer (envblk);
-  disk = file->device->disk;
   part_start = grub_partition_get_start (disk->partition);
 
   index = 0;
   for (p = blocklists; p; index += p->length, p = p->next)
     {
-      if (grub_disk_write (disk, p->sector - part_start,
-                           p->offset, p->length, buf + index))
-        return 0;
+      grub_disk_addr_t sector;
+      grub_size_t offset, done, n;
+
+      sector = p->sector - part_start + (p->offset >> GRUB_DISK_SECTOR_BITS);
+      offset = p->offset & (GRUB_DISK_SECTOR_SIZE - 1);
+      for (done = 0; done < p->length; done += n, sector++, offset = 0)
+	{
+	  n = GRUB_DISK_SECTOR_SIZE - offset;
+	  if (n > p->length - done)
+	    n = p->length - done;
+
+	  if (grub_memcmp (buf + index + done, old + index + done, n) == 0)
+	    continue;
+
+	  if (grub_disk_write (disk, sector, offset, n, buf + index + done))
+	    return grub_errno;
+	}
     }
 
-  return 1;
+  return GRUB_ERR_NONE;
+}
+
+/* The blocklist of the environment block file saved to last.  Within one
+   boot nothing but save_env writes to it, and save_env never moves it, so
+   saving to the same file again can go straight to the disk.  */
+static struct
+{
+  /* The file name, always with a device.  */
+  char *name;
+  grub_size_t size;
+  struct blocklist *blocklists;
+} envblk_cache;
+
+static void
+envblk_cache_flush (void)
+{
+  grub_free (envblk_cache.name);
+  free_blocklists (envblk_cache.blocklists);
+  envblk_cache.name = 0;
+  envblk_cache.blocklists = 0;
+}
+
+/* Returns FILENAME (or the default name) with its device spelled out, the
+   key of envblk_cache.  */
+static char *
+envblk_cache_key (const char *filename)
+{
+  char *name, *key;
+  const char *root;
+
+  name = envblk_file_name (filename);
+  if (! name || name[0] == '(')
+    return name;
+
+  root = grub_env_get ("root");
+  key = grub_xasprintf ("(%s)%s", root ? root : "", name);
+  grub_free (name);
+  return key;
+}
+
+/* Read the cached environment block file back through its blocklist.  */
+static grub_envblk_t
+read_envblk_cached (grub_disk_t disk)
+{
+  grub_disk_addr_t part_start;
+  struct blocklist *p;
+  grub_size_t index;
+  grub_envblk_t envblk;
+  char *buf;
+
+  buf = grub_malloc (envblk_cache.size);
+  if (! buf)
+    return 0;
+
+  part_start = grub_partition_get_start (disk->partition);
+  for (p = envblk_cache.blocklists, index = 0; p;
+       index += p->length, p = p->next)
+    if (grub_disk_read (disk, p->sector - part_start, p->offset, p->length,
+			buf + index))
+      {
+	grub_free (buf);
+	return 0;
+      }
+
+  envblk = grub_envblk_open (buf, envblk_cache.size);
+  if (! envblk)
+    {
+      grub_free (buf);
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid environment block");
+    }
+  return envblk;
 }
 
 /* Context for grub_cmd_save_env.  */
@@ -375,6 +463,83 @@ save_env_read_hook (grub_disk_addr_t sector, unsigned offset, unsigned length,
     ctx->head = block;
 }
 
+/* Set ARGS in ENVBLK and write the sectors that changed to DISK.  */
+static grub_err_t
+save_env_write (grub_envblk_t envblk, int argc, char **args,
+		struct blocklist *blocklists, grub_disk_t disk)
+{
+  grub_size_t size = grub_envblk_size (envblk);
+  char *old;
+
+  old = grub_malloc (size);
+  if (! old)
+    return grub_errno;
+  grub_memcpy (old, grub_envblk_buffer (envblk), size);
+
+  while (argc)
+    {
+      const char *value;
+
+      value = grub_env_get (args[0]);
+      if (value)
+        {
+          if (! grub_envblk_set (envblk, args[0], value))
+	    {
+	      grub_free (old);
+	      return grub_error (GRUB_ERR_BAD_ARGUMENT,
+				 "environment block too small");
+	    }
+        }
+      else
+	grub_envblk_delete (envblk, args[0]);
+
+      argc--;
+      args++;
+    }
+
+  write_blocklists (envblk, old, blocklists, disk);
+  grub_free (old);
+  return grub_errno;
+}
+
+/* Save ARGS to the file KEY through its cached blocklist.  Returns 1 if
+   that was done, successfully or not, and 0 if the caller should go
+   through the file system instead.  */
+static int
+save_env_cached (const char *key, int argc, char **args)
+{
+  grub_disk_t disk;
+  grub_envblk_t envblk;
+  char *devname;
+
+  if (! envblk_cache.name || grub_strcmp (envblk_cache.name, key) != 0)
+    return 0;
+
+  devname = grub_file_get_device_name (key);
+  disk = devname ? grub_disk_open (devname) : 0;
+  grub_free (devname);
+  if (! disk)
+    goto fallback;
+
+  envblk = read_envblk_cached (disk);
+  if (! envblk)
+    {
+      grub_disk_close (disk);
+      goto fallback;
+    }
+
+  save_env_write (envblk, argc, args, envblk_cache.blocklists, disk);
+
+  grub_envblk_close (envblk);
+  grub_disk_close (disk);
+  return 1;
+
+ fallback:
+  grub_errno = GRUB_ERR_NONE;
+  envblk_cache_flush ();
+  return 0;
+}
+
 static grub_err_t
 grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
 {
@@ -385,18 +550,33 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
     .head = 0,
     .tail = 0
   };
+  char *key;
 
   if (! argc)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "no variable is specified");
 
+  key = envblk_cache_key ((state[0].set) ? state[0].arg : 0);
+  if (! key)
+    return grub_errno;
+
+  if (save_env_cached (key, argc, args))
+    {
+      grub_free (key);
+      return grub_errno;
+    }
+
   file = open_envblk_file ((state[0].set) ? state[0].arg : 0,
                            1 /* allow untrusted */);
   if (! file)
-    return grub_errno;
+    {
+      grub_free (key);
+      return grub_errno;
+    }
 
   if (! file->device->disk)
     {
       grub_file_close (file);
+      grub_free (key);
       return grub_error (GRUB_ERR_BAD_DEVICE, "disk device required");
     }
 
@@ -410,33 +590,23 @@ grub_cmd_save_env (grub_extcmd_context_t ctxt, int argc, char **args)
   if (check_blocklists (envblk, ctx.head, file))
     goto fail;
 
-  while (argc)
-    {
-      const char *value;
-
-      value = grub_env_get (args[0]);
-      if (value)
-        {
-          if (! grub_envblk_set (envblk, args[0], value))
-            {
-              grub_error (GRUB_ERR_BAD_ARGUMENT, "environment block too small");
-              goto fail;
-            }
-        }
-      else
-	grub_envblk_delete (envblk, args[0]);
-
-      argc--;
-      args++;
-    }
+  if (save_env_write (envblk, argc, args, ctx.head, file->device->disk))
+    goto fail;
 
-  write_blocklists (envblk, ctx.head, file);
+  /* Remember where the file is for the next time.  */
+  envblk_cache_flush ();
+  envblk_cache.name = key;
+  envblk_cache.size = grub_envblk_size (envblk);
+  envblk_cache.blocklists = ctx.head;
+  key = 0;
+  ctx.head = 0;
 
  fail:
   if (envblk)
     grub_envblk_close (envblk);
   free_blocklists (ctx.head);
   grub_file_close (file);
+  grub_free (key);
   return grub_errno;
 }
 
@@ -465,4 +635,5 @@ GRUB_MOD_FINI(loadenv)
   grub_unregister_extcmd (cmd_load);
   grub_unregister_extcmd (cmd_list);
   grub_unregister_extcmd (cmd_save);
+  envblk_cache_flush ();
 }
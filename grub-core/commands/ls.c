@@ -114,7 +114,15 @@ print_files_long (const char *filename, const struct grub_dirhook_info *info,
   if ((! ctx->all) && (filename[0] == '.'))
     return 0;
 
-  if (! info->dir)
+  if (info->sizeset)
+    {
+      if (! ctx->human)
+	grub_printf ("%-12llu", (unsigned long long) info->size);
+      else
+	grub_printf ("%-12s", grub_get_human_size (info->size,
+						   GRUB_HUMAN_SIZE_SHORT));
+    }
+  else if (! info->dir)
     {
       grub_file_t file;
       char *pathname;
@@ -144,12 +144,51 @@ grub_mini_cmd_rmmod (struct grub_command *cmd __attribute__ ((unused)),
 }
 
 /* lsmod */
+static void
+print_ms (grub_uint64_t ns)
+{
+  grub_uint64_t ms, us;
+
+  ms = grub_divmod64 (grub_divmod64 (ns, 1000, 0), 1000, &us);
+  grub_printf ("%llu.%03u\t", (unsigned long long) ms, (unsigned) us);
+}
+
 static grub_err_t
 grub_mini_cmd_lsmod (struct grub_command *cmd __attribute__ ((unused)),
-		     int argc __attribute__ ((unused)),
-		     char *argv[] __attribute__ ((unused)))
+		     int argc, char *argv[])
 {
   grub_dl_t mod;
+  grub_uint64_t read_ns = 0, link_ns = 0, init_ns = 0;
+  grub_size_t size = 0;
+
+  if (argc == 1 && (grub_strcmp (argv[0], "-v") == 0
+		    || grub_strcmp (argv[0], "--verbose") == 0))
+    {
+      /* TRANSLATORS: header of lsmod -v.  Size is the memory the module
+	 takes, the times are in milliseconds spent reading its file,
+	 linking it and running its init.  */
+      grub_printf_ (N_("Name\tSize\tRead\tLink\tInit\n"));
+      FOR_DL_MODULES (mod)
+      {
+	grub_printf ("%s\t%lu\t", mod->name, (unsigned long) mod->sz);
+	print_ms (mod->read_ns);
+	print_ms (mod->link_ns);
+	print_ms (mod->init_ns);
+	grub_xputs ("\n");
+	size += mod->sz;
+	read_ns += mod->read_ns;
+	link_ns += mod->link_ns;
+	init_ns += mod->init_ns;
+      }
+      grub_printf ("%s\t%lu\t", _("Total"), (unsigned long) size);
+      print_ms (read_ns);
+      print_ms (link_ns);
+      print_ms (init_ns);
+      grub_xputs ("\n");
+      return 0;
+    }
+  if (argc)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("unexpected argument"));
 
   /* TRANSLATORS: this is module list header.  Name
      is module name, Ref Count is a reference counter
@@ -204,7 +243,7 @@ GRUB_MOD_INIT(minicmd)
 			   N_("MODULE"), N_("Remove a module."));
   cmd_lsmod =
     grub_register_command ("lsmod", grub_mini_cmd_lsmod,
-			   0, N_("Show loaded modules."));
+			   N_("[-v|--verbose]"), N_("Show loaded modules."));
   cmd_exit =
     grub_register_command ("exit", grub_mini_cmd_exit,
 			   0, N_("Exit from GRUB."));
@@ -0,0 +1,200 @@
+/* mmstats.c - Command to show how the heap is used  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/mm_private.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/normal.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Free blocks are counted by powers of two, from one cell up.  */
+#define HISTOGRAM_SIZE	(sizeof (grub_size_t) * 8 - GRUB_MM_ALIGN_LOG2)
+
+#define DEFAULT_TOP	10
+
+static const struct grub_arg_option options[] =
+  {
+    {"top", 'n', 0, N_("Show the N places holding the most memory."),
+     N_("N"), ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+struct free_stats
+{
+  grub_size_t total;
+  grub_size_t largest;
+  unsigned blocks;
+  unsigned count[HISTOGRAM_SIZE];
+  grub_size_t bytes[HISTOGRAM_SIZE];
+};
+
+static void
+count_free (struct free_stats *st, grub_size_t cells)
+{
+  grub_size_t bytes = cells << GRUB_MM_ALIGN_LOG2;
+  unsigned i;
+
+  for (i = 0; i < HISTOGRAM_SIZE - 1 && (cells >> (i + 1)); i++);
+
+  st->total += bytes;
+  st->blocks++;
+  if (bytes > st->largest)
+    st->largest = bytes;
+  st->count[i]++;
+  st->bytes[i] += bytes;
+}
+
+#ifdef MM_DEBUG
+static void
+print_sites (unsigned top)
+{
+  unsigned char shown[GRUB_MM_SITES];
+  unsigned i, j;
+
+  grub_memset (shown, 0, sizeof (shown));
+  grub_printf_ (N_("Top allocation sites:\n"));
+  for (i = 0; i < top; i++)
+    {
+      struct grub_mm_site *best = 0;
+
+      for (j = 0; j < GRUB_MM_SITES; j++)
+	if (!shown[j] && grub_mm_sites[j].live
+	    && (!best || grub_mm_sites[j].live > best->live))
+	  best = &grub_mm_sites[j];
+      if (!best)
+	break;
+      shown[best - grub_mm_sites] = 1;
+
+      grub_printf ("  %10s in %6u blocks, %8llu allocations  ",
+		   grub_get_human_size (best->live, GRUB_HUMAN_SIZE_SHORT),
+		   (unsigned) best->count,
+		   (unsigned long long) best->allocs);
+      if (best->file)
+	grub_printf ("%s:%d\n", best->file, best->line);
+      else
+	grub_printf_ (N_("(other)\n"));
+    }
+}
+#endif
+
+static grub_err_t
+grub_cmd_mmstats (grub_extcmd_context_t ctxt,
+		  int argc __attribute__ ((unused)),
+		  char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct free_stats st;
+  grub_mm_region_t r;
+  grub_size_t heap = 0;
+  unsigned regions = 0, i;
+  unsigned top = DEFAULT_TOP;
+
+  if (state[0].set)
+    top = grub_strtoul (state[0].arg, 0, 0);
+
+  grub_memset (&st, 0, sizeof (st));
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_mm_header_t p;
+
+      heap += r->size;
+      regions++;
+
+      /* A full region points to an allocated block.  */
+      if (r->first->magic != GRUB_MM_FREE_MAGIC)
+	continue;
+      p = r->first;
+      do
+	{
+	  count_free (&st, p->size);
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+
+  grub_printf_ (N_("Heap: %s in %u regions, grown %llu times\n"),
+		grub_get_human_size (heap, GRUB_HUMAN_SIZE_SHORT), regions,
+		(unsigned long long) grub_mm_stats.grown);
+  grub_printf_ (N_("In use: %s"),
+		grub_get_human_size (grub_mm_stats.live,
+				     GRUB_HUMAN_SIZE_SHORT));
+  grub_printf_ (N_(", peak %s\n"),
+		grub_get_human_size (grub_mm_stats.peak,
+				     GRUB_HUMAN_SIZE_SHORT));
+  grub_printf_ (N_("Calls: %llu allocations, %llu frees, %llu failed\n"),
+		(unsigned long long) grub_mm_stats.allocs,
+		(unsigned long long) grub_mm_stats.frees,
+		(unsigned long long) grub_mm_stats.failures);
+  grub_printf_ (N_("Free: %s in %u blocks"),
+		grub_get_human_size (st.total, GRUB_HUMAN_SIZE_SHORT),
+		st.blocks);
+  grub_printf_ (N_(", largest %s"),
+		grub_get_human_size (st.largest, GRUB_HUMAN_SIZE_SHORT));
+  grub_printf_ (N_(", another %s in small blocks\n"),
+		grub_get_human_size (grub_mm_stats.small_cached,
+				     GRUB_HUMAN_SIZE_SHORT));
+
+  /* The share of free memory out of reach of the largest allocation
+     that could still succeed.  */
+  if (st.total)
+    grub_printf_ (N_("Fragmentation: %u%%\n"),
+		  (unsigned) (100 - grub_divmod64 ((grub_uint64_t) st.largest
+						   * 100, st.total, 0)));
+
+  grub_printf_ (N_("Free blocks by size:\n"));
+  for (i = 0; i < HISTOGRAM_SIZE; i++)
+    {
+      if (!st.count[i])
+	continue;
+      grub_printf ("  >= %10s: %6u blocks, ",
+		   grub_get_human_size ((grub_size_t) GRUB_MM_ALIGN << i,
+					GRUB_HUMAN_SIZE_SHORT),
+		   st.count[i]);
+      grub_printf ("%s\n", grub_get_human_size (st.bytes[i],
+						GRUB_HUMAN_SIZE_SHORT));
+    }
+
+#ifdef MM_DEBUG
+  if (top)
+    print_sites (top);
+#else
+  (void) top;
+#endif
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(mmstats)
+{
+  cmd = grub_register_extcmd ("mmstats", grub_cmd_mmstats, 0,
+			      N_("[-n N]"),
+			      N_("Show heap usage and fragmentation."),
+			      options);
+}
+
+GRUB_MOD_FINI(mmstats)
+{
+  grub_unregister_extcmd (cmd);
+}
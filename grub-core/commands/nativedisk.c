@@ -34,7 +34,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 static const char *modnames_def[] = { 
   /* FIXME: autogenerate this.  */
 #if defined (__i386__) || defined (__x86_64__) || defined (GRUB_MACHINE_MIPS_LOONGSON)
-  "pata", "ahci", "usbms", "ohci", "uhci", "ehci"
+  "pata", "ahci", "nvme", "usbms", "ohci", "uhci", "ehci"
 #elif defined (GRUB_MACHINE_MIPS_QEMU_MIPS)
   "pata"
 #else
@@ -77,6 +77,7 @@ get_uuid (const char *name, char **uuid, int getnative)
     case GRUB_DISK_DEVICE_ATA_ID:
     case GRUB_DISK_DEVICE_SCSI_ID:
     case GRUB_DISK_DEVICE_XEN:
+    case GRUB_DISK_DEVICE_NVME_ID:
       if (getnative)
 	break;
 
@@ -89,6 +90,9 @@ get_uuid (const char *name, char **uuid, int getnative)
     case GRUB_DISK_DEVICE_CBFSDISK_ID:
       /* GRUB-only memdisk. Can't match any of firmware devices.  */
     case GRUB_DISK_DEVICE_MEMDISK_ID:
+      /* Fetched over the network by GRUB itself.  */
+    case GRUB_DISK_DEVICE_HTTPDISK_ID:
+    case GRUB_DISK_DEVICE_ISCSI_ID:
       grub_dprintf ("nativedisk", "Skipping native disk %s\n",
 		    dev->disk->name);
       grub_device_close (dev);
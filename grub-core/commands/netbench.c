@@ -0,0 +1,206 @@
+/* netbench.c - Command to measure network file transfers  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mm.h>
+#include <grub/file.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/normal.h>
+#include <grub/net.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define DEFAULT_BLOCK_SIZE	65536
+#define DEFAULT_INTERVAL	1000
+
+static const struct grub_arg_option options[] =
+  {
+    {"size", 's', 0, N_("Specify size for each read operation"), 0, ARG_TYPE_INT},
+    {"interval", 'i', 0, N_("Report throughput every MS milliseconds"),
+     N_("MS"), ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static void
+print_speed (grub_uint64_t bytes, grub_uint64_t ms)
+{
+  if (ms)
+    grub_printf ("%s", grub_get_human_size (grub_divmod64 (bytes * 100ULL
+							   * 1000ULL, ms, 0),
+					    GRUB_HUMAN_SIZE_SPEED));
+  else
+    grub_printf ("-");
+}
+
+static void
+print_ms (grub_uint64_t ms)
+{
+  grub_uint64_t whole, fraction;
+
+  whole = grub_divmod64 (ms, 1000, &fraction);
+  grub_printf ("%u.%03u s", (unsigned) whole, (unsigned) fraction);
+}
+
+static void
+print_rtt (const char *proto, const struct grub_net_rtt_stats *before,
+	   const struct grub_net_rtt_stats *after)
+{
+  grub_uint64_t samples = after->samples - before->samples;
+  grub_uint64_t avg, whole, fraction;
+
+  if (!samples)
+    return;
+  /* In hundredths of a millisecond.  */
+  avg = grub_divmod64 ((after->sum - before->sum) * 100, samples, 0);
+  whole = grub_divmod64 (avg, 100, &fraction);
+  grub_printf_ (N_("%s RTT: %llu samples, average %llu.%02llu ms, "
+		   "maximum %llu ms\n"), proto,
+		(unsigned long long) samples, (unsigned long long) whole,
+		(unsigned long long) fraction,
+		(unsigned long long) after->max);
+}
+
+static grub_err_t
+grub_cmd_netbench (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct grub_net_stats before, after;
+  grub_uint64_t start, end, last, now;
+  grub_uint64_t interval;
+  grub_ssize_t block_size;
+  grub_uint64_t total_size, last_size;
+  char *buffer;
+  grub_file_t file;
+
+  if (argc == 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  block_size = (state[0].set) ?
+    grub_strtoul (state[0].arg, 0, 0) : DEFAULT_BLOCK_SIZE;
+  if (block_size <= 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+
+  interval = (state[1].set) ?
+    grub_strtoul (state[1].arg, 0, 0) : DEFAULT_INTERVAL;
+  if (interval == 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid interval"));
+
+  buffer = grub_malloc (block_size);
+  if (buffer == NULL)
+    return grub_errno;
+
+  /* Opening goes into the figures too: it is part of every boot.  The
+     maxima can't be subtracted, start them afresh.  */
+  grub_net_stats.tcp_rtt.max = 0;
+  grub_net_stats.tftp_rtt.max = 0;
+  before = grub_net_stats;
+  start = last = grub_get_time_ms ();
+  file = grub_file_open (args[0]);
+  if (file == NULL)
+    goto quit;
+
+  total_size = last_size = 0;
+  while (1)
+    {
+      grub_ssize_t size = grub_file_read (file, buffer, block_size);
+      if (size <= 0)
+	break;
+      total_size += size;
+
+      now = grub_get_time_ms ();
+      if (now - last >= interval)
+	{
+	  print_ms (now - start);
+	  grub_printf (" %s ", grub_get_human_size (total_size,
+						    GRUB_HUMAN_SIZE_NORMAL));
+	  print_speed (total_size - last_size, now - last);
+	  grub_printf ("\n");
+	  last = now;
+	  last_size = total_size;
+	}
+    }
+  end = grub_get_time_ms ();
+  after = grub_net_stats;
+  grub_file_close (file);
+
+  grub_printf_ (N_("File size: %s\n"),
+		grub_get_human_size (total_size, GRUB_HUMAN_SIZE_NORMAL));
+  grub_printf_ (N_("Elapsed time: "));
+  print_ms (end - start);
+  grub_printf_ (N_("\nSpeed: "));
+  print_speed (total_size, end - start);
+  grub_printf ("\n");
+
+  grub_printf_ (N_("Frames: %llu received, %llu sent, %llu send errors, "
+		   "%llu dropped\n"),
+		(unsigned long long) (after.rx_packets - before.rx_packets),
+		(unsigned long long) (after.tx_packets - before.tx_packets),
+		(unsigned long long) (after.tx_errors - before.tx_errors),
+		(unsigned long long) (after.rx_dropped - before.rx_dropped));
+  grub_printf_ (N_("Polling: %llu ms, %llu ms of it receiving\n"),
+		(unsigned long long) (after.poll_ms - before.poll_ms),
+		(unsigned long long) (after.poll_busy_ms
+				      - before.poll_busy_ms));
+
+  if (after.tcp_rtt.samples != before.tcp_rtt.samples
+      || after.tcp_retransmits != before.tcp_retransmits
+      || after.tcp_out_of_order != before.tcp_out_of_order)
+    grub_printf_ (N_("TCP: %llu retransmits, %llu fast retransmits, "
+		     "%llu out of order\n"),
+		  (unsigned long long) (after.tcp_retransmits
+					- before.tcp_retransmits),
+		  (unsigned long long) (after.tcp_fast_retransmits
+					- before.tcp_fast_retransmits),
+		  (unsigned long long) (after.tcp_out_of_order
+					- before.tcp_out_of_order));
+  print_rtt ("TCP", &before.tcp_rtt, &after.tcp_rtt);
+
+  if (after.tftp_rtt.samples != before.tftp_rtt.samples
+      || after.tftp_out_of_order != before.tftp_out_of_order
+      || after.tftp_duplicates != before.tftp_duplicates)
+    grub_printf_ (N_("TFTP: %llu out of order, %llu duplicates\n"),
+		  (unsigned long long) (after.tftp_out_of_order
+					- before.tftp_out_of_order),
+		  (unsigned long long) (after.tftp_duplicates
+					- before.tftp_duplicates));
+  print_rtt ("TFTP", &before.tftp_rtt, &after.tftp_rtt);
+
+ quit:
+  grub_free (buffer);
+
+  return grub_errno;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(netbench)
+{
+  cmd = grub_register_extcmd ("netbench", grub_cmd_netbench, 0,
+			      N_("[-s SIZE] [-i MS] FILENAME"),
+			      N_("Measure a network file transfer."),
+			      options);
+}
+
+GRUB_MOD_FINI(netbench)
+{
+  grub_unregister_extcmd (cmd);
+}
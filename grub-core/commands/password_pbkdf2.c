@@ -45,6 +45,7 @@ check_password (const char *user, const char *entered, void *pin)
   grub_uint8_t *buf;
   struct pbkdf2_password *pass = pin;
   gcry_err_code_t err;
+  int mismatch;
 
   buf = grub_malloc (pass->buflen);
   if (!buf)
@@ -60,7 +61,10 @@ check_password (const char *user, const char *entered, void *pin)
       return grub_crypto_gcry_error (err);
     }
 
-  if (grub_crypto_memcmp (buf, pass->expected, pass->buflen) != 0)
+  mismatch = grub_crypto_memcmp (buf, pass->expected, pass->buflen);
+  grub_memset (buf, 0, pass->buflen);
+  grub_free (buf);
+  if (mismatch)
     return GRUB_ACCESS_DENIED;
 
   grub_auth_authenticate (user);
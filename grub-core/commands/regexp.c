@@ -100,49 +100,118 @@ set_matches (char **varnames, char *str, grub_size_t nmatches,
 }
 
 static grub_err_t
-grub_cmd_regexp (grub_extcmd_context_t ctxt, int argc, char **args)
+regexp_error (int ret, const regex_t *regex)
 {
-  regex_t regex;
-  int ret;
   grub_size_t s;
   char *comperr;
   grub_err_t err;
-  regmatch_t *matches = 0;
 
-  if (argc != 2)
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("two arguments expected"));
+  s = regerror (ret, regex, 0, 0);
+  comperr = grub_malloc (s);
+  if (!comperr)
+    return grub_errno;
+  regerror (ret, regex, comperr, s);
+  err = grub_error (GRUB_ERR_TEST_FAILURE, "%s", comperr);
+  grub_free (comperr);
+  return err;
+}
 
-  ret = regcomp (&regex, args[0], REG_EXTENDED);
-  if (ret)
-    goto fail;
+/* Compiled patterns, most recently used first.  Scripts tend to match
+   many strings against the same few patterns, and compiling one costs
+   far more than matching it.  */
+#define REGEX_CACHE_SIZE 8
 
-  matches = grub_zalloc (sizeof (*matches) * (regex.re_nsub + 1));
-  if (! matches)
-    goto fail;
+struct regex_cache_entry
+{
+  char *pattern;
+  int cflags;
+  regex_t regex;
+};
+
+static struct regex_cache_entry *regex_cache[REGEX_CACHE_SIZE];
+
+static void
+regex_cache_free (struct regex_cache_entry *e)
+{
+  regfree (&e->regex);
+  grub_free (e->pattern);
+  grub_free (e);
+}
+
+/* Return PATTERN compiled with CFLAGS, from the cache if it's there.  The
+   result stays valid until the next call.  */
+static regex_t *
+regex_cache_get (const char *pattern, int cflags)
+{
+  struct regex_cache_entry *e;
+  int i, ret;
 
-  ret = regexec (&regex, args[1], regex.re_nsub + 1, matches, 0);
-  if (!ret)
+  for (i = 0; i < REGEX_CACHE_SIZE && regex_cache[i]; i++)
+    if (regex_cache[i]->cflags == cflags
+	&& grub_strcmp (regex_cache[i]->pattern, pattern) == 0)
+      break;
+
+  if (i < REGEX_CACHE_SIZE && regex_cache[i])
+    e = regex_cache[i];
+  else
     {
-      err = set_matches (ctxt->state[0].args, args[1],
-			 regex.re_nsub + 1, matches);
-      regfree (&regex);
-      grub_free (matches);
-      return err;
+      e = grub_malloc (sizeof (*e));
+      if (!e)
+	return 0;
+      e->pattern = grub_strdup (pattern);
+      if (!e->pattern)
+	{
+	  grub_free (e);
+	  return 0;
+	}
+      e->cflags = cflags;
+      ret = regcomp (&e->regex, pattern, cflags);
+      if (ret)
+	{
+	  regexp_error (ret, &e->regex);
+	  regex_cache_free (e);
+	  return 0;
+	}
+
+      if (i == REGEX_CACHE_SIZE)
+	{
+	  i = REGEX_CACHE_SIZE - 1;
+	  regex_cache_free (regex_cache[i]);
+	}
     }
 
- fail:
+  for (; i > 0; i--)
+    regex_cache[i] = regex_cache[i - 1];
+  regex_cache[0] = e;
+  return &e->regex;
+}
+
+static grub_err_t
+grub_cmd_regexp (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  regex_t *regex;
+  int ret;
+  grub_err_t err;
+  regmatch_t *matches;
+
+  if (argc != 2)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("two arguments expected"));
+
+  regex = regex_cache_get (args[0], REG_EXTENDED);
+  if (! regex)
+    return grub_errno;
+
+  matches = grub_zalloc (sizeof (*matches) * (regex->re_nsub + 1));
+  if (! matches)
+    return grub_errno;
+
+  ret = regexec (regex, args[1], regex->re_nsub + 1, matches, 0);
+  if (ret)
+    err = regexp_error (ret, regex);
+  else
+    err = set_matches (ctxt->state[0].args, args[1],
+		       regex->re_nsub + 1, matches);
   grub_free (matches);
-  s = regerror (ret, &regex, 0, 0);
-  comperr = grub_malloc (s);
-  if (!comperr)
-    {
-      regfree (&regex);
-      return grub_errno;
-    }
-  regerror (ret, &regex, comperr, s);
-  err = grub_error (GRUB_ERR_TEST_FAILURE, "%s", comperr);
-  regfree (&regex);
-  grub_free (comperr);
   return err;
 }
 
@@ -163,6 +232,11 @@ GRUB_MOD_INIT(regexp)
 
 GRUB_MOD_FINI(regexp)
 {
+  int i;
+
   grub_unregister_extcmd (cmd);
   grub_wildcard_translator = 0;
+
+  for (i = 0; i < REGEX_CACHE_SIZE && regex_cache[i]; i++)
+    regex_cache_free (regex_cache[i]);
 }
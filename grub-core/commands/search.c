@@ -30,6 +30,7 @@
 #include <grub/i18n.h>
 #include <grub/disk.h>
 #include <grub/partition.h>
+#include <grub/fs.h>
 #if defined(DO_SEARCH_PART_UUID) || defined(DO_SEARCH_PART_LABEL) || \
     defined(DO_SEARCH_DISK_UUID)
 #include <grub/gpt_partition.h>
@@ -58,6 +59,165 @@ struct search_ctx
   int is_cache;
 };
 
+#ifndef DO_SEARCH_FILE
+/* What every device seen so far carries, so that later searches, for
+   any key, only open the devices instead of probing them again.  An
+   entry is trusted as long as its name still refers to the same disk
+   and partition.  */
+struct index_entry
+{
+  struct index_entry *next;
+  char *name;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t size;
+  /* NULL if the device has none.  */
+  char *value;
+  /* File systems registered when VALUE was found to be missing, and
+     whether missing ones could be autoloaded: either changing may change
+     that.  */
+  unsigned nfs;
+  int autoload;
+};
+
+static struct index_entry *device_index;
+
+static unsigned
+count_fs (void)
+{
+  grub_fs_t fs;
+  unsigned n = 0;
+
+  FOR_FILESYSTEMS (fs)
+    n++;
+  return n;
+}
+
+/* Read the value searched for from DEV into *QUID, NULL if none.  */
+static void
+read_key (grub_device_t dev, char **quid)
+{
+  *quid = NULL;
+#if defined(DO_SEARCH_PART_UUID)
+  if (grub_gpt_part_uuid (dev, quid) != GRUB_ERR_NONE)
+    *quid = NULL;
+#elif defined(DO_SEARCH_PART_LABEL)
+  if (grub_gpt_part_label (dev, quid) != GRUB_ERR_NONE)
+    *quid = NULL;
+#elif defined(DO_SEARCH_DISK_UUID)
+  if (grub_gpt_disk_uuid (dev, quid) != GRUB_ERR_NONE)
+    *quid = NULL;
+#else
+  {
+    /* SEARCH_FS_UUID or SEARCH_LABEL */
+    grub_fs_t fs;
+
+    fs = grub_fs_probe (dev);
+
+#ifdef DO_SEARCH_FS_UUID
+#define read_fn uuid
+#else
+#define read_fn label
+#endif
+
+    if (fs && fs->read_fn)
+      {
+	fs->read_fn (dev, quid);
+	if (grub_errno != GRUB_ERR_NONE)
+	  {
+	    grub_free (*quid);
+	    *quid = NULL;
+	  }
+      }
+  }
+#endif
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Give in *QUID the value searched for of the device NAME, NULL if it has
+   none, probing it only if it isn't indexed yet.  */
+static grub_err_t
+device_index_lookup (const char *name, const char **quid)
+{
+  grub_device_t dev;
+  struct index_entry *ent;
+  char *value;
+
+  *quid = NULL;
+  dev = grub_device_open (name);
+  if (! dev)
+    return grub_errno;
+
+  for (ent = device_index; ent; ent = ent->next)
+    if (grub_strcmp (ent->name, name) == 0)
+      break;
+
+  if (ent && dev->disk
+      && ent->dev_id == dev->disk->dev->id
+      && ent->disk_id == dev->disk->id
+      && ent->part_start == grub_partition_get_start (dev->disk->partition)
+      && ent->size == grub_disk_get_size (dev->disk)
+      && (ent->value || (ent->nfs == count_fs ()
+			 && (ent->autoload || ! grub_fs_autoload_hook))))
+    {
+      grub_device_close (dev);
+      *quid = ent->value;
+      return GRUB_ERR_NONE;
+    }
+
+  read_key (dev, &value);
+
+  if (! ent)
+    {
+      ent = grub_zalloc (sizeof (*ent));
+      if (ent)
+	ent->name = grub_strdup (name);
+      if (! ent || ! ent->name)
+	{
+	  grub_free (ent);
+	  grub_free (value);
+	  grub_device_close (dev);
+	  return grub_errno;
+	}
+      ent->next = device_index;
+      device_index = ent;
+    }
+
+  grub_free (ent->value);
+  ent->value = value;
+  ent->nfs = count_fs ();
+  ent->autoload = !! grub_fs_autoload_hook;
+  /* Network devices and such can't be told apart: their entry is never
+     trusted and only holds the value just read.  */
+  if (dev->disk)
+    {
+      ent->dev_id = dev->disk->dev->id;
+      ent->disk_id = dev->disk->id;
+      ent->part_start = grub_partition_get_start (dev->disk->partition);
+      ent->size = grub_disk_get_size (dev->disk);
+    }
+  grub_device_close (dev);
+
+  *quid = ent->value;
+  return GRUB_ERR_NONE;
+}
+
+static void
+device_index_free (void)
+{
+  struct index_entry *ent;
+
+  while ((ent = device_index))
+    {
+      device_index = ent->next;
+      grub_free (ent->name);
+      grub_free (ent->value);
+      grub_free (ent);
+    }
+}
+#endif
+
 /* Helper for FUNC_NAME.  */
 static int
 iterate_device (const char *name, void *data)
@@ -94,96 +254,21 @@ iterate_device (const char *name, void *data)
 	}
       grub_free (buf);
     }
-#elif defined(DO_SEARCH_PART_UUID)
-    {
-      grub_device_t dev;
-      char *quid;
-
-      dev = grub_device_open (name);
-      if (dev)
-	{
-	  if (grub_gpt_part_uuid (dev, &quid) == GRUB_ERR_NONE)
-	    {
-	      if (grub_strcasecmp (quid, ctx->key) == 0)
-		    found = 1;
-
-	      grub_free (quid);
-	    }
-
-	  grub_device_close (dev);
-	}
-    }
-#elif defined(DO_SEARCH_PART_LABEL)
-    {
-      grub_device_t dev;
-      char *quid;
-
-      dev = grub_device_open (name);
-      if (dev)
-	{
-	  if (grub_gpt_part_label (dev, &quid) == GRUB_ERR_NONE)
-	    {
-	      if (grub_strcmp (quid, ctx->key) == 0)
-		    found = 1;
-
-	      grub_free (quid);
-	    }
-
-	  grub_device_close (dev);
-	}
-    }
-#elif defined(DO_SEARCH_DISK_UUID)
-    {
-      grub_device_t dev;
-      char *quid;
-
-      dev = grub_device_open (name);
-      if (dev)
-	{
-	  if (grub_gpt_disk_uuid (dev, &quid) == GRUB_ERR_NONE)
-	    {
-	      if (grub_strcmp (quid, ctx->key) == 0)
-		found = 1;
-
-	      grub_free (quid);
-	    }
-
-	  grub_device_close (dev);
-	}
-    }
 #else
     {
-      /* SEARCH_FS_UUID or SEARCH_LABEL */
-      grub_device_t dev;
-      grub_fs_t fs;
-      char *quid;
-
-      dev = grub_device_open (name);
-      if (dev)
-	{
-	  fs = grub_fs_probe (dev);
+      const char *quid;
 
-#ifdef DO_SEARCH_FS_UUID
-#define read_fn uuid
+#if defined(DO_SEARCH_PART_UUID)
+#define key_cmp grub_strcasecmp
+#elif defined(DO_SEARCH_DISK_UUID)
+#define key_cmp grub_strcmp
 #else
-#define read_fn label
+#define key_cmp compare_fn
 #endif
 
-	  if (fs && fs->read_fn)
-	    {
-	      fs->read_fn (dev, &quid);
-
-	      if (grub_errno == GRUB_ERR_NONE && quid)
-		{
-		  if (compare_fn (quid, ctx->key) == 0)
-		    found = 1;
-
-		  grub_free (quid);
-		}
-	    }
-
-	  grub_device_close (dev);
-	}
+      if (device_index_lookup (name, &quid) == GRUB_ERR_NONE && quid
+	  && key_cmp (quid, ctx->key) == 0)
+	found = 1;
     }
 #endif
 
@@ -407,4 +492,7 @@ GRUB_MOD_FINI(search_label)
 #endif
 {
   grub_unregister_command (cmd);
+#ifndef DO_SEARCH_FILE
+  device_index_free ();
+#endif
 }
@@ -23,6 +23,8 @@
 #include <grub/err.h>
 #include <grub/dl.h>
 #include <grub/env.h>
+#include <grub/device.h>
+#include <grub/disk.h>
 #include <grub/extcmd.h>
 #include <grub/search.h>
 #include <grub/i18n.h>
@@ -46,6 +48,8 @@ static const struct grub_arg_option options[] =
      N_("Set a variable to the first device found."), N_("VARNAME"),
      ARG_TYPE_STRING},
     {"no-floppy",	'n', 0, N_("Do not probe any floppy drive."), 0, 0},
+    {"parallel",	0, 0,
+     N_("Read the start of all devices at once before probing them."), 0, 0},
     {"hint",	        'h', GRUB_ARG_OPTION_REPEATABLE,
      N_("First try the device HINT. If HINT ends in comma, "
 	"also try subpartitions"), N_("HINT"), ARG_TYPE_STRING},
@@ -82,6 +86,7 @@ enum options
     SEARCH_DISK_UUID,
     SEARCH_SET,
     SEARCH_NO_FLOPPY,
+    SEARCH_PARALLEL,
     SEARCH_HINT,
     SEARCH_HINT_IEEE1275,
     SEARCH_HINT_BIOS,
@@ -90,6 +95,91 @@ enum options
     SEARCH_HINT_ARC,
  };
 
+/* Enough to cover the superblocks of all the filesystems GRUB knows of,
+   the farthest being the one of btrfs at 64 KiB.  */
+#define SEARCH_PREFETCH_SIZE	(96 << 10)
+
+struct prefetch_ctx
+{
+  int no_floppy;
+  grub_device_t *devs;
+  grub_size_t ndevs;
+  grub_size_t alloc;
+};
+
+/* Helper for search_prefetch.  */
+static int
+prefetch_iter (const char *name, void *data)
+{
+  struct prefetch_ctx *ctx = data;
+  grub_device_t dev;
+
+  if (ctx->no_floppy &&
+      name[0] == 'f' && name[1] == 'd' && name[2] >= '0' && name[2] <= '9')
+    return 0;
+
+  if (ctx->ndevs == ctx->alloc)
+    {
+      grub_device_t *t;
+
+      t = grub_realloc (ctx->devs, (ctx->alloc ? 2 * ctx->alloc : 32)
+			* sizeof (ctx->devs[0]));
+      if (!t)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 1;
+	}
+      ctx->devs = t;
+      ctx->alloc = ctx->alloc ? 2 * ctx->alloc : 32;
+    }
+
+  dev = grub_device_open (name);
+  if (!dev)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  if (!dev->disk)
+    {
+      grub_device_close (dev);
+      return 0;
+    }
+  ctx->devs[ctx->ndevs++] = dev;
+  return 0;
+}
+
+/* Warm the disk cache with the start of every device, letting the disk
+   drivers which can overlap their reads do so, so that the probes of the
+   search which follows mostly hit the cache.  */
+static void
+search_prefetch (int no_floppy)
+{
+  struct prefetch_ctx ctx = {
+    .no_floppy = no_floppy,
+    .devs = NULL,
+    .ndevs = 0,
+    .alloc = 0
+  };
+  grub_disk_t *disks;
+  grub_size_t i;
+
+  grub_device_iterate (prefetch_iter, &ctx);
+
+  disks = grub_malloc (ctx.ndevs * sizeof (disks[0]));
+  if (disks)
+    {
+      for (i = 0; i < ctx.ndevs; i++)
+	disks[i] = ctx.devs[i]->disk;
+      grub_disk_prefetch (disks, ctx.ndevs, 0, SEARCH_PREFETCH_SIZE);
+      grub_free (disks);
+    }
+
+  for (i = 0; i < ctx.ndevs; i++)
+    grub_device_close (ctx.devs[i]);
+  grub_free (ctx.devs);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_cmd_search (grub_extcmd_context_t ctxt, int argc, char **args)
 {
@@ -189,6 +279,9 @@ grub_cmd_search (grub_extcmd_context_t ctxt, int argc, char **args)
       goto out;
     }
 
+  if (state[SEARCH_PARALLEL].set)
+    search_prefetch (state[SEARCH_NO_FLOPPY].set);
+
   if (state[SEARCH_LABEL].set)
     grub_search_label (id, var, state[SEARCH_NO_FLOPPY].set, 
 		       hints, nhints);
@@ -222,7 +315,8 @@ GRUB_MOD_INIT(search)
   cmd =
     grub_register_extcmd ("search", grub_cmd_search,
 			  GRUB_COMMAND_FLAG_EXTRACTOR | GRUB_COMMAND_ACCEPT_DASH,
-			  N_("[-f|-l|-u|-s|-n] [--hint HINT [--hint HINT] ...]"
+			  N_("[-f|-l|-u|-s|-n] [--parallel]"
+			     " [--hint HINT [--hint HINT] ...]"
 			     " NAME"),
 			  N_("Search devices by file, filesystem label"
 			     " or filesystem UUID."
@@ -31,8 +31,8 @@ grub_cmd_time (grub_command_t ctxt __attribute__ ((unused)),
 	       int argc, char **args)
 {
   grub_command_t cmd;
-  grub_uint32_t start;
-  grub_uint32_t end;
+  grub_uint64_t start;
+  grub_uint64_t us, sec;
 
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("no command is specified"));
@@ -43,12 +43,13 @@ grub_cmd_time (grub_command_t ctxt __attribute__ ((unused)),
     return grub_error (GRUB_ERR_UNKNOWN_COMMAND, N_("can't find command `%s'"),
 		       args[0]);
 
-  start = grub_get_time_ms ();
+  start = grub_get_time_ns ();
   (cmd->func) (cmd, argc - 1, &args[1]);
-  end = grub_get_time_ms ();
+  us = grub_divmod64 (grub_get_time_ns () - start, 1000, 0);
+  sec = grub_divmod64 (us, 1000000, &us);
 
-  grub_printf_ (N_("Elapsed time: %d.%03d seconds \n"), (end - start) / 1000,
-		(end - start) % 1000);
+  grub_printf_ (N_("Elapsed time: %llu.%06llu seconds \n"),
+		(unsigned long long) sec, (unsigned long long) us);
 
   return grub_errno;
 }
@@ -24,7 +24,9 @@
 #include <grub/err.h>
 #include <grub/dl.h>
 #include <grub/usb.h>
-#include <grub/command.h>
+#include <grub/extcmd.h>
+#include <grub/disk.h>
+#include <grub/time.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -60,9 +62,31 @@ static const char *usb_devspeed[] =
     "",
     "Low",
     "Full",
-    "High"
+    "High",
+    "Super"
   };
 
+static const struct grub_arg_option options[] =
+  {
+    {"stats", 's', 0, N_("Show transfer counters of each device."), 0, 0},
+    {"reset", 'r', 0, N_("Reset the transfer counters."), 0, 0},
+    {"bench", 'b', 0, N_("Measure sequential reads from DISK."), N_("DISK"),
+     ARG_TYPE_STRING},
+    {"size", 'n', 0, N_("Read N MiB for --bench (default 64)."), N_("N"),
+     ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    USBTEST_STATS,
+    USBTEST_RESET,
+    USBTEST_BENCH,
+    USBTEST_SIZE
+  };
+
+#define BENCH_CHUNK	(64 * 1024)
+
 static grub_usb_err_t
 grub_usb_get_string (grub_usb_device_t dev, grub_uint8_t index, int langid,
 		     char **string)
@@ -191,28 +215,144 @@ usb_iterate (grub_usb_device_t dev, void *data __attribute__ ((unused)))
   return 0;
 }
 
+static int
+usb_stats_iterate (grub_usb_device_t dev, void *data __attribute__ ((unused)))
+{
+  struct grub_usb_stats *stats = &dev->stats;
+
+  grub_printf ("Device %d (%04x:%04x): %llu control, %llu bulk, "
+	       "%llu bytes\n", dev->addr, dev->descdev.vendorid,
+	       dev->descdev.prodid, (unsigned long long) stats->control,
+	       (unsigned long long) stats->bulk,
+	       (unsigned long long) stats->bytes);
+  grub_printf ("  short: %llu, stalls: %llu, halt clears: %llu, "
+	       "timeouts: %llu, errors: %llu\n",
+	       (unsigned long long) stats->short_packets,
+	       (unsigned long long) stats->stalls,
+	       (unsigned long long) stats->clear_halts,
+	       (unsigned long long) stats->timeouts,
+	       (unsigned long long) stats->errors);
+  grub_printf ("  waited %llu ms, longest transfer %llu ms\n",
+	       (unsigned long long) stats->wait_ms,
+	       (unsigned long long) stats->max_ms);
+
+  return 0;
+}
+
+static int
+usb_reset_iterate (grub_usb_device_t dev, void *data __attribute__ ((unused)))
+{
+  grub_memset (&dev->stats, 0, sizeof (dev->stats));
+  return 0;
+}
+
+/* Read SIZE bytes of DISK from its start and print the rate.  */
+static grub_err_t
+usb_bench (const char *name, grub_uint64_t size)
+{
+  grub_disk_t disk;
+  char *buf;
+  grub_disk_addr_t sector;
+  grub_uint64_t done, start, ms, rate;
+  grub_size_t len;
+
+  if (name[0] == '(' && name[grub_strlen (name) - 1] == ')')
+    {
+      char *copy = grub_strndup (name + 1, grub_strlen (name) - 2);
+
+      if (!copy)
+	return grub_errno;
+      disk = grub_disk_open (copy);
+      grub_free (copy);
+    }
+  else
+    disk = grub_disk_open (name);
+  if (!disk)
+    return grub_errno;
+
+  if (grub_disk_get_size (disk) != GRUB_DISK_SIZE_UNKNOWN
+      && (grub_disk_get_size (disk) << GRUB_DISK_SECTOR_BITS) < size)
+    size = grub_disk_get_size (disk) << GRUB_DISK_SECTOR_BITS;
+
+  buf = grub_malloc (BENCH_CHUNK);
+  if (!buf)
+    {
+      grub_disk_close (disk);
+      return grub_errno;
+    }
+
+  /* The counters then tell about the benchmark alone.  */
+  grub_usb_iterate (usb_reset_iterate, NULL);
+
+  start = grub_get_time_ms ();
+  for (done = 0, sector = 0; done < size; done += len)
+    {
+      len = BENCH_CHUNK;
+      if (len > size - done)
+	len = size - done;
+      if (grub_disk_read (disk, sector, 0, len, buf))
+	break;
+      sector += len >> GRUB_DISK_SECTOR_BITS;
+    }
+  ms = grub_get_time_ms () - start;
+
+  grub_free (buf);
+  grub_disk_close (disk);
+  if (grub_errno)
+    return grub_errno;
+
+  rate = grub_divmod64 (done * 1000, ms ? : 1, 0) >> 10;
+  grub_printf_ (N_("Read %llu KiB in %llu ms, %llu KiB/s\n"),
+		(unsigned long long) (done >> 10), (unsigned long long) ms,
+		(unsigned long long) rate);
+  grub_usb_iterate (usb_stats_iterate, NULL);
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
-grub_cmd_usbtest (grub_command_t cmd __attribute__ ((unused)),
+grub_cmd_usbtest (grub_extcmd_context_t ctxt,
 		  int argc __attribute__ ((unused)),
 		  char **args __attribute__ ((unused)))
 {
+  struct grub_arg_list *state = ctxt->state;
+
   grub_usb_poll_devices (1);
 
+  if (state[USBTEST_BENCH].set)
+    {
+      grub_uint64_t size = 64;
+
+      if (state[USBTEST_SIZE].set)
+	size = grub_strtoull (state[USBTEST_SIZE].arg, 0, 0);
+      if (grub_errno || size == 0)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid size"));
+      return usb_bench (state[USBTEST_BENCH].arg, size << 20);
+    }
+
+  if (state[USBTEST_STATS].set)
+    grub_usb_iterate (usb_stats_iterate, NULL);
+  if (state[USBTEST_RESET].set)
+    grub_usb_iterate (usb_reset_iterate, NULL);
+  if (state[USBTEST_STATS].set || state[USBTEST_RESET].set)
+    return 0;
+
   grub_printf ("USB devices:\n\n");
   grub_usb_iterate (usb_iterate, NULL);
 
   return 0;
 }
 
-static grub_command_t cmd;
+static grub_extcmd_t cmd;
 
 GRUB_MOD_INIT(usbtest)
 {
-  cmd = grub_register_command ("usb", grub_cmd_usbtest,
-			       0, N_("Test USB support."));
+  cmd = grub_register_extcmd ("usb", grub_cmd_usbtest, 0,
+			      N_("[-s] [-r] [-b DISK [-n N]]"),
+			      N_("Test USB support."), options);
 }
 
 GRUB_MOD_FINI(usbtest)
 {
-  grub_unregister_command (cmd);
+  grub_unregister_extcmd (cmd);
 }
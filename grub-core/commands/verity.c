@@ -0,0 +1,346 @@
+/* verity.c - check the root of a dm-verity hash tree.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/crypto.h>
+#include <grub/device.h>
+#include <grub/disk.h>
+#include <grub/dl.h>
+#include <grub/err.h>
+#include <grub/extcmd.h>
+#include <grub/file.h>
+#include <grub/i18n.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Where CoreOS keeps the root hash of /usr in its kernel images, see
+   loader/i386/verity-hash.h.  */
+#define KERNEL_HASH_OFFSET	0x40
+#define KERNEL_HASH_LENGTH	64
+
+#define VERITY_SIGNATURE	"verity\0\0"
+#define VERITY_MAX_BLOCK_SIZE	(1 << 16)
+
+/* The superblock veritysetup writes at the start of the hash area.  */
+struct verity_sb
+{
+  grub_uint8_t signature[8];
+  grub_uint32_t version;
+  grub_uint32_t hash_type;
+  grub_uint8_t uuid[16];
+  char algorithm[32];
+  grub_uint32_t data_block_size;
+  grub_uint32_t hash_block_size;
+  grub_uint64_t data_blocks;
+  grub_uint16_t salt_size;
+  grub_uint8_t pad1[6];
+  grub_uint8_t salt[256];
+  grub_uint8_t pad2[168];
+} GRUB_PACKED;
+
+static const struct grub_arg_option options[] =
+  {
+    {"hash-offset", 'o', 0,
+     N_("The hash area starts BYTES into the device."), N_("BYTES"),
+     ARG_TYPE_INT},
+    {"kernel", 'k', 0,
+     N_("Take the root hash from the header of this kernel."), N_("FILE"),
+     ARG_TYPE_FILE},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    VERITY_HASH_OFFSET,
+    VERITY_KERNEL
+  };
+
+static int
+is_power_of_2 (grub_uint32_t n)
+{
+  return n && !(n & (n - 1));
+}
+
+static int
+hex_digit (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static grub_err_t
+parse_hash (const char *hex, grub_size_t hexlen, grub_uint8_t *out,
+	    grub_size_t mdlen)
+{
+  grub_size_t i;
+
+  if (hexlen != 2 * mdlen)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid root hash"));
+  for (i = 0; i < mdlen; i++)
+    {
+      int hi = hex_digit (hex[2 * i]), lo = hex_digit (hex[2 * i + 1]);
+
+      if (hi < 0 || lo < 0)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid root hash"));
+      out[i] = (hi << 4) | lo;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+read_kernel_hash (const char *name, char *hex)
+{
+  grub_file_t file;
+  char buf[KERNEL_HASH_OFFSET + KERNEL_HASH_LENGTH];
+
+  file = grub_file_open (name);
+  if (!file)
+    return grub_errno;
+  if (grub_file_read (file, buf, sizeof (buf)) != sizeof (buf))
+    {
+      grub_file_close (file);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), name);
+      return grub_errno;
+    }
+  grub_file_close (file);
+  grub_memcpy (hex, buf + KERNEL_HASH_OFFSET, KERNEL_HASH_LENGTH);
+  hex[KERNEL_HASH_LENGTH] = '\0';
+  return GRUB_ERR_NONE;
+}
+
+/* Hash one block the way the hash type says: type 1 puts the salt first,
+   the Chrome OS type 0 puts it last.  */
+static void
+hash_block (const gcry_md_spec_t *md, void *ctx, const struct verity_sb *sb,
+	    const void *data, grub_size_t size, grub_uint8_t *out)
+{
+  grub_uint16_t salt_size = grub_le_to_cpu16 (sb->salt_size);
+
+  md->init (ctx);
+  if (sb->hash_type)
+    md->write (ctx, sb->salt, salt_size);
+  md->write (ctx, data, size);
+  if (!sb->hash_type)
+    md->write (ctx, sb->salt, salt_size);
+  md->final (ctx);
+  grub_memcpy (out, md->read (ctx), md->mdlen);
+}
+
+static grub_err_t
+read_bytes (grub_disk_t disk, grub_uint64_t offset, grub_size_t size,
+	    void *buf)
+{
+  return grub_disk_read (disk, offset >> GRUB_DISK_SECTOR_BITS,
+			 offset & (GRUB_DISK_SECTOR_SIZE - 1), size, buf);
+}
+
+/* Check the hash blocks covering the first data block, from the root
+   down, and that block itself.  That is one block per level, which is
+   enough to tell a partition from another release or one whose hash
+   area is damaged, without reading the whole tree.  */
+static grub_err_t
+check_root_path (grub_disk_t disk, grub_uint64_t hash_offset,
+		 const char *root_hex)
+{
+  struct verity_sb *sb;
+  const gcry_md_spec_t *md;
+  grub_uint8_t expected[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t digest[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint64_t level_offset[64];
+  grub_uint64_t data_blocks, position;
+  grub_uint32_t data_bs, hash_bs;
+  grub_size_t digest_size;
+  unsigned bits, levels;
+  void *ctx = 0, *block = 0;
+  char algorithm[sizeof (sb->algorithm) + 1];
+  int i;
+
+  sb = grub_malloc (sizeof (*sb));
+  if (!sb)
+    return grub_errno;
+  if (read_bytes (disk, hash_offset, sizeof (*sb), sb))
+    goto fail;
+
+  if (grub_memcmp (sb->signature, VERITY_SIGNATURE, sizeof (sb->signature))
+      != 0)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "no verity superblock found");
+      goto fail;
+    }
+  sb->version = grub_le_to_cpu32 (sb->version);
+  sb->hash_type = grub_le_to_cpu32 (sb->hash_type);
+  data_bs = grub_le_to_cpu32 (sb->data_block_size);
+  hash_bs = grub_le_to_cpu32 (sb->hash_block_size);
+  data_blocks = grub_le_to_cpu64 (sb->data_blocks);
+  if (sb->version != 1 || sb->hash_type > 1
+      || !is_power_of_2 (data_bs) || data_bs < GRUB_DISK_SECTOR_SIZE
+      || data_bs > VERITY_MAX_BLOCK_SIZE
+      || !is_power_of_2 (hash_bs) || hash_bs < GRUB_DISK_SECTOR_SIZE
+      || hash_bs > VERITY_MAX_BLOCK_SIZE
+      || !data_blocks
+      || grub_le_to_cpu16 (sb->salt_size) > sizeof (sb->salt))
+    {
+      grub_error (GRUB_ERR_BAD_FS, "unsupported verity superblock");
+      goto fail;
+    }
+
+  grub_memcpy (algorithm, sb->algorithm, sizeof (sb->algorithm));
+  algorithm[sizeof (sb->algorithm)] = '\0';
+  md = grub_crypto_lookup_md_by_name (algorithm);
+  if (!md)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "unknown verity hash %s", algorithm);
+      goto fail;
+    }
+  if (parse_hash (root_hex, grub_strlen (root_hex), expected, md->mdlen))
+    goto fail;
+
+  /* Type 1 pads each digest to a power of two.  */
+  for (digest_size = md->mdlen; sb->hash_type && !is_power_of_2 (digest_size);
+       digest_size++);
+  if (2 * digest_size > hash_bs)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "unsupported verity superblock");
+      goto fail;
+    }
+  for (bits = 0; (digest_size << (bits + 1)) <= hash_bs; bits++);
+
+  /* The levels are stored from the root down, after the block holding
+     the superblock.  */
+  for (levels = 0; bits * levels < 64 && ((data_blocks - 1)
+					   >> (bits * levels)); levels++);
+  position = ALIGN_UP (hash_offset + sizeof (*sb), (grub_uint64_t) hash_bs);
+  for (i = levels - 1; i >= 0; i--)
+    {
+      unsigned shift = (i + 1) * bits;
+      grub_uint64_t blocks = 1;
+
+      if (shift < 64)
+	blocks = (data_blocks >> shift)
+	  + !!(data_blocks & ((1ULL << shift) - 1));
+      level_offset[i] = position;
+      position += blocks * hash_bs;
+    }
+
+  ctx = grub_malloc (md->contextsize);
+  block = grub_malloc (data_bs > hash_bs ? data_bs : hash_bs);
+  if (!ctx || !block)
+    goto fail;
+
+  for (i = levels - 1; i >= 0; i--)
+    {
+      if (read_bytes (disk, level_offset[i], hash_bs, block))
+	goto fail;
+      hash_block (md, ctx, sb, block, hash_bs, digest);
+      if (grub_memcmp (digest, expected, md->mdlen) != 0)
+	{
+	  grub_error (GRUB_ERR_BAD_SIGNATURE,
+		      "verity hash mismatch at level %d", i);
+	  goto fail;
+	}
+      grub_memcpy (expected, block, md->mdlen);
+    }
+
+  if (read_bytes (disk, 0, data_bs, block))
+    goto fail;
+  hash_block (md, ctx, sb, block, data_bs, digest);
+  if (grub_memcmp (digest, expected, md->mdlen) != 0)
+    grub_error (GRUB_ERR_BAD_SIGNATURE, "verity hash mismatch at data block 0");
+
+ fail:
+  grub_free (block);
+  grub_free (ctx);
+  grub_free (sb);
+  return grub_errno;
+}
+
+static grub_err_t
+grub_cmd_verity_check (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  char kernel_hash[KERNEL_HASH_LENGTH + 1];
+  const char *root_hex;
+  grub_uint64_t hash_offset;
+  grub_device_t dev;
+  grub_size_t len;
+  char *name;
+
+  if (argc != (state[VERITY_KERNEL].set ? 1 : 2))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("device and root hash expected"));
+  if (!state[VERITY_HASH_OFFSET].set)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("-o is required"));
+
+  if (state[VERITY_KERNEL].set)
+    {
+      if (read_kernel_hash (state[VERITY_KERNEL].arg, kernel_hash))
+	return grub_errno;
+      root_hex = kernel_hash;
+    }
+  else
+    root_hex = args[1];
+
+  name = args[0];
+  len = grub_strlen (name);
+  if (len > 1 && name[0] == '(' && name[len - 1] == ')')
+    {
+      name = grub_strndup (name + 1, len - 2);
+      if (!name)
+	return grub_errno;
+    }
+  dev = grub_device_open (name);
+  if (name != args[0])
+    grub_free (name);
+  if (!dev)
+    return grub_errno;
+  if (!dev->disk)
+    {
+      grub_device_close (dev);
+      return grub_error (GRUB_ERR_BAD_DEVICE, N_("disk `%s' not found"),
+			 args[0]);
+    }
+
+  hash_offset = grub_strtoull (state[VERITY_HASH_OFFSET].arg, 0, 0);
+  if (!grub_errno)
+    check_root_path (dev->disk, hash_offset, root_hex);
+  grub_device_close (dev);
+  return grub_errno;
+}
+
+static grub_extcmd_t cmd_check;
+
+GRUB_MOD_INIT(verity)
+{
+  cmd_check = grub_register_extcmd ("verity.check", grub_cmd_verity_check, 0,
+				    N_("-o BYTES [-k KERNEL] DEVICE [ROOTHASH]"),
+				    N_("Check the root of a dm-verity hash tree."),
+				    options);
+}
+
+GRUB_MOD_FINI(verity)
+{
+  grub_unregister_extcmd (cmd_check);
+}
@@ -0,0 +1,300 @@
+/* videobench.c - Command to measure offscreen rendering  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/video.h>
+#include <grub/video_fb.h>
+#include <grub/bitmap.h>
+#include <grub/bitmap_scale.h>
+#include <grub/font.h>
+#include <grub/gfxmenu_view.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define DEFAULT_FRAMES	60
+#define DEFAULT_WIDTH	1024
+#define DEFAULT_HEIGHT	768
+#define DEFAULT_FONT	"Unknown Regular 16"
+
+static const struct grub_arg_option options[] =
+  {
+    {"frames", 'n', 0, N_("Render N frames of each phase"), N_("N"),
+     ARG_TYPE_INT},
+    {"mode", 'm', 0, N_("Render at WIDTHxHEIGHT"), N_("WIDTHxHEIGHT"),
+     ARG_TYPE_STRING},
+    {"theme", 't', 0, N_("Load the gfxmenu theme FILE"), N_("FILE"),
+     ARG_TYPE_STRING},
+    {"image", 'i', 0, N_("Scale and blit the image FILE"), N_("FILE"),
+     ARG_TYPE_STRING},
+    {"font", 'f', 0, N_("Draw text with FONT"), N_("FONT"),
+     ARG_TYPE_STRING},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum options
+  {
+    VIDEOBENCH_FRAMES,
+    VIDEOBENCH_MODE,
+    VIDEOBENCH_THEME,
+    VIDEOBENCH_IMAGE,
+    VIDEOBENCH_FONT
+  };
+
+static const char sample_text[] =
+  "The quick brown fox jumps over the lazy dog. 0123456789 !\"#$%&'()*+,-./";
+
+static void
+print_phase (const char *name, grub_uint64_t ms, unsigned frames)
+{
+  grub_uint64_t per_frame, fraction;
+
+  /* In microseconds.  */
+  per_frame = grub_divmod64 (ms * 1000, frames, 0);
+  per_frame = grub_divmod64 (per_frame, 1000, &fraction);
+  grub_printf_ (N_("%-8s %6llu ms total, %llu.%03llu ms per frame\n"), name,
+		(unsigned long long) ms, (unsigned long long) per_frame,
+		(unsigned long long) fraction);
+}
+
+/* Fill BITMAP with a gradient whose alpha is ALPHA.  */
+static void
+fill_gradient (struct grub_video_bitmap *bitmap, grub_uint8_t alpha)
+{
+  unsigned x, y;
+  grub_uint8_t *p = bitmap->data;
+
+  for (y = 0; y < bitmap->mode_info.height; y++)
+    for (x = 0; x < bitmap->mode_info.width; x++)
+      {
+	*p++ = x * 255 / bitmap->mode_info.width;
+	*p++ = y * 255 / bitmap->mode_info.height;
+	*p++ = 0x80;
+	*p++ = alpha;
+      }
+}
+
+/* Draw rows of text from line FIRST on, down to the bottom of the
+   screen.  */
+static void
+draw_text (grub_font_t font, unsigned first, unsigned width, unsigned height)
+{
+  unsigned line_height = grub_font_get_height (font);
+  grub_video_color_t color = grub_video_map_rgb (0xc0, 0xc0, 0xc0);
+  unsigned y, x;
+
+  for (y = first * line_height; y + line_height <= height; y += line_height)
+    for (x = 0; x < width;
+	 x += grub_font_get_string_width (font, sample_text))
+      grub_font_draw_string (sample_text, font, color, x,
+			     y + grub_font_get_ascent (font));
+}
+
+static grub_err_t
+grub_cmd_videobench (grub_extcmd_context_t ctxt, int argc,
+		     char **args __attribute__ ((unused)))
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct grub_video_mode_info mode_info;
+  struct grub_video_bitmap *raw = 0, *background = 0, *panel = 0;
+  grub_font_t font;
+  unsigned frames, width, height, line_height, i;
+  grub_uint64_t start;
+  grub_err_t err;
+
+  if (argc != 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("unexpected argument"));
+
+  frames = state[VIDEOBENCH_FRAMES].set
+    ? grub_strtoul (state[VIDEOBENCH_FRAMES].arg, 0, 0) : DEFAULT_FRAMES;
+  if (frames == 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid frame count"));
+
+  width = DEFAULT_WIDTH;
+  height = DEFAULT_HEIGHT;
+  if (state[VIDEOBENCH_MODE].set)
+    {
+      char *ptr = state[VIDEOBENCH_MODE].arg;
+
+      width = grub_strtoul (ptr, &ptr, 0);
+      if (*ptr == 'x')
+	height = grub_strtoul (ptr + 1, &ptr, 0);
+      if (grub_errno || *ptr || width == 0 || height == 0)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid video mode"));
+    }
+
+  font = grub_font_get (state[VIDEOBENCH_FONT].set
+			? state[VIDEOBENCH_FONT].arg : DEFAULT_FONT);
+  line_height = grub_font_get_height (font);
+  if (line_height == 0 || line_height >= height)
+    return grub_error (GRUB_ERR_BAD_FONT, N_("no usable font"));
+
+  /* The image is loaded before capture starts, so that it doesn't count
+     in any phase.  */
+  if (state[VIDEOBENCH_IMAGE].set
+      && grub_video_bitmap_load (&raw, state[VIDEOBENCH_IMAGE].arg))
+    return grub_errno;
+
+  grub_memset (&mode_info, 0, sizeof (mode_info));
+  mode_info.width = width;
+  mode_info.height = height;
+  mode_info.pitch = width * 4;
+  GRUB_VIDEO_MI_RGBA8888 (mode_info);
+
+  err = grub_video_capture_start (&mode_info, grub_video_fbstd_colors,
+				  GRUB_VIDEO_FBSTD_NUMCOLORS);
+  if (err)
+    {
+      grub_video_bitmap_destroy (raw);
+      return err;
+    }
+
+  /* Text goes to the capture target only, so nothing can be printed until
+     it ends.  Collect the timings first.  */
+  {
+    grub_uint64_t layout_ms = 0, scale_ms = 0, blit_ms, text_ms;
+    grub_uint64_t scroll_ms, swap_ms;
+
+    if (state[VIDEOBENCH_THEME].set)
+      {
+	start = grub_get_time_ms ();
+	for (i = 0; i < frames; i++)
+	  {
+	    grub_gfxmenu_view_t view;
+
+	    view = grub_gfxmenu_view_new (state[VIDEOBENCH_THEME].arg,
+					  width, height);
+	    if (!view)
+	      goto fail;
+	    grub_gfxmenu_view_destroy (view);
+	  }
+	layout_ms = grub_get_time_ms () - start;
+      }
+
+    if (raw)
+      {
+	start = grub_get_time_ms ();
+	for (i = 0; i < frames; i++)
+	  {
+	    grub_video_bitmap_destroy (background);
+	    background = 0;
+	    if (grub_video_bitmap_create_scaled (&background, width, height,
+						 raw,
+						 GRUB_VIDEO_BITMAP_SCALE_METHOD_BEST))
+	      goto fail;
+	  }
+	scale_ms = grub_get_time_ms () - start;
+      }
+    else
+      {
+	if (grub_video_bitmap_create (&background, width, height,
+				      GRUB_VIDEO_BLIT_FORMAT_RGBA_8888))
+	  goto fail;
+	fill_gradient (background, 0xff);
+      }
+
+    /* A translucent panel, as themes put over the background.  */
+    if (grub_video_bitmap_create (&panel, width * 2 / 3, height * 2 / 3,
+				  GRUB_VIDEO_BLIT_FORMAT_RGBA_8888))
+      goto fail;
+    fill_gradient (panel, 0x80);
+
+    start = grub_get_time_ms ();
+    for (i = 0; i < frames; i++)
+      {
+	grub_video_blit_bitmap (background, GRUB_VIDEO_BLIT_REPLACE, 0, 0,
+				0, 0, width, height);
+	grub_video_blit_bitmap (panel, GRUB_VIDEO_BLIT_BLEND,
+				width / 6, height / 6, 0, 0,
+				panel->mode_info.width,
+				panel->mode_info.height);
+      }
+    blit_ms = grub_get_time_ms () - start;
+
+    start = grub_get_time_ms ();
+    for (i = 0; i < frames; i++)
+      {
+	grub_video_fill_rect (grub_video_map_rgb (0, 0, 0), 0, 0,
+			      width, height);
+	draw_text (font, 0, width, height);
+      }
+    text_ms = grub_get_time_ms () - start;
+
+    /* As gfxterm does for each new line at the bottom.  */
+    start = grub_get_time_ms ();
+    for (i = 0; i < frames; i++)
+      {
+	grub_video_scroll (grub_video_map_rgb (0, 0, 0), 0,
+			   -(int) line_height);
+	draw_text (font, height / line_height - 1, width, height);
+      }
+    scroll_ms = grub_get_time_ms () - start;
+
+    start = grub_get_time_ms ();
+    for (i = 0; i < frames; i++)
+      grub_video_swap_buffers ();
+    swap_ms = grub_get_time_ms () - start;
+
+    grub_video_bitmap_destroy (panel);
+    grub_video_bitmap_destroy (background);
+    grub_video_bitmap_destroy (raw);
+    grub_video_capture_end ();
+
+    grub_printf_ (N_("%ux%ux32, %u frames per phase\n"), width, height,
+		  frames);
+    if (state[VIDEOBENCH_THEME].set)
+      print_phase ("layout", layout_ms, frames);
+    if (state[VIDEOBENCH_IMAGE].set)
+      print_phase ("scale", scale_ms, frames);
+    print_phase ("blit", blit_ms, frames);
+    print_phase ("text", text_ms, frames);
+    print_phase ("scroll", scroll_ms, frames);
+    print_phase ("swap", swap_ms, frames);
+
+    return GRUB_ERR_NONE;
+  }
+
+ fail:
+  grub_video_bitmap_destroy (panel);
+  grub_video_bitmap_destroy (background);
+  grub_video_bitmap_destroy (raw);
+  grub_video_capture_end ();
+  return grub_errno;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(videobench)
+{
+  cmd = grub_register_extcmd ("videobench", grub_cmd_videobench, 0,
+			      N_("[-n N] [-m WIDTHxHEIGHT] [-t FILE] "
+				 "[-i FILE] [-f FONT]"),
+			      N_("Measure rendering into an offscreen "
+				 "framebuffer."),
+			      options);
+}
+
+GRUB_MOD_FINI(videobench)
+{
+  grub_unregister_extcmd (cmd);
+}
@@ -163,6 +163,7 @@ grub_cmd_videoinfo (grub_command_t cmd __attribute__ ((unused)),
     grub_dl_load ("vbe");
 #endif
 
+  grub_video_autoload ();
   id = grub_video_get_driver_id ();
 
   grub_puts_ (N_("List of supported video modes:"));
@@ -24,17 +24,30 @@
 #include <grub/device.h>
 #include <grub/script_sh.h>
 
-#include <regex.h>
+/* A glob pattern: one path component, still escaped.  */
+struct glob
+{
+  const char *start;
+  const char *end;
+};
+
+/* The device the last directory was on, kept open so that listing many
+   directories of one file system only probes it once.  */
+struct wildcard_dev
+{
+  char *name;
+  grub_device_t dev;
+  grub_fs_t fs;
+};
 
 static inline int isregexop (char ch);
 static char ** merge (char **lhs, char **rhs);
 static char *make_dir (const char *prefix, const char *start, const char *end);
-static int make_regex (const char *regex_start, const char *regex_end,
-		       regex_t *regexp);
 static void split_path (const char *path, const char **suffix_end, const char **regex_end);
-static char ** match_devices (const regex_t *regexp, int noparts);
-static char ** match_files (const char *prefix, const char *suffix_start,
-			    const char *suffix_end, const regex_t *regexp);
+static char ** match_devices (const struct glob *glob, int noparts);
+static char ** match_files (struct wildcard_dev *wd, const char *prefix,
+			    const char *suffix_start, const char *suffix_end,
+			    const struct glob *glob);
 
 static grub_err_t wildcard_expand (const char *s, char ***strs);
 
@@ -109,68 +122,53 @@ make_dir (const char *prefix, const char *start, const char *end)
   return result;
 }
 
+/* Match NAME against GLOB, where `*' matches any string, `?' any
+   character and a backslash makes the next character literal.  A
+   mismatch in the literal text before the first `*' fails at once, so
+   names that don't share a pattern's prefix cost a few comparisons.  */
 static int
-make_regex (const char *start, const char *end, regex_t *regexp)
+glob_match (const struct glob *glob, const char *name)
 {
-  char ch;
-  int i = 0;
-  unsigned len = end - start;
-  char *buffer = grub_malloc (len * 2 + 2 + 1); /* worst case size. */
+  const char *p = glob->start;
+  const char *star = 0, *backtrack = 0;
 
-  if (! buffer)
-    return 1;
-
-  buffer[i++] = '^';
-  while (start < end)
+  while (1)
     {
-      /* XXX Only * and ? expansion for now.  */
-      switch ((ch = *start++))
+      if (p < glob->end && *p == '*')
 	{
-	case '\\':
-	  buffer[i++] = ch;
-	  if (*start != '\0')
-	    buffer[i++] = *start++;
-	  break;
-
-	case '.':
-	case '(':
-	case ')':
-	case '@':
-	case '+':
-	case '|':
-	case '{':
-	case '}':
-	case '[':
-	case ']':
-	  buffer[i++] = '\\';
-	  buffer[i++] = ch;
-	  break;
-
-	case '*':
-	  buffer[i++] = '.';
-	  buffer[i++] = '*';
-	  break;
-
-	case '?':
-	  buffer[i++] = '.';
-	  break;
-
-	default:
-	  buffer[i++] = ch;
+	  star = ++p;
+	  backtrack = name;
+	  continue;
 	}
-    }
-  buffer[i++] = '$';
-  buffer[i] = '\0';
-  grub_dprintf ("expand", "Regexp is %s\n", buffer);
 
-  if (regcomp (regexp, buffer, RE_SYNTAX_GNU_AWK))
-    {
-      grub_free (buffer);
-      return 1;
-    }
+      if (p < glob->end && *name)
+	{
+	  const char *q = p + 1;
+	  char ch = *p;
 
-  grub_free (buffer);
-  return 0;
+	  if (ch == '?')
+	    {
+	      p = q;
+	      name++;
+	      continue;
+	    }
+	  if (ch == '\\' && q < glob->end)
+	    ch = *q++;
+	  if (ch == *name)
+	    {
+	      p = q;
+	      name++;
+	      continue;
+	    }
+	}
+      else if (p == glob->end && ! *name)
+	return 1;
+
+      if (! star || ! *backtrack)
+	return 0;
+      p = star;
+      name = ++backtrack;
+    }
 }
 
 /* Split `str' into two parts: (1) dirname that is regexop free (2)
@@ -213,7 +211,7 @@ split_path (const char *str, const char **noregexop, const char **regexop)
 /* Context for match_devices.  */
 struct match_devices_ctx
 {
-  const regex_t *regexp;
+  const struct glob *glob;
   int noparts;
   int ndev;
   char **devs;
@@ -236,7 +234,7 @@ match_devices_iter (const char *name, void *data)
     return 1;
 
   grub_dprintf ("expand", "matching: %s\n", buffer);
-  if (regexec (ctx->regexp, buffer, 0, 0, 0))
+  if (! glob_match (ctx->glob, buffer))
     {
       grub_dprintf ("expand", "not matched\n");
       grub_free (buffer);
@@ -257,10 +255,10 @@ match_devices_iter (const char *name, void *data)
 }
 
 static char **
-match_devices (const regex_t *regexp, int noparts)
+match_devices (const struct glob *glob, int noparts)
 {
   struct match_devices_ctx ctx = {
-    .regexp = regexp,
+    .glob = glob,
     .noparts = noparts,
     .ndev = 0,
     .devs = 0
@@ -285,7 +283,7 @@ match_devices (const regex_t *regexp, int noparts)
 /* Context for match_files.  */
 struct match_files_ctx
 {
-  const regex_t *regexp;
+  const struct glob *glob;
   char **files;
   unsigned nfile;
   char *dir;
@@ -306,7 +304,7 @@ match_files_iter (const char *name,
     return 0;
 
   grub_dprintf ("expand", "matching: %s in %s\n", name, ctx->dir);
-  if (regexec (ctx->regexp, name, 0, 0, 0))
+  if (! glob_match (ctx->glob, name))
     return 0;
 
   grub_dprintf ("expand", "matched\n");
@@ -328,54 +326,89 @@ match_files_iter (const char *name,
   return 0;
 }
 
+/* Get the device and file system DIR is on into WD, reusing the ones
+   from the last call if they are the same, and the path within it into
+   *PATH.  */
+static int
+wildcard_dev_open (struct wildcard_dev *wd, const char *dir,
+		   const char **path)
+{
+  char *name;
+
+  if (dir[0] == '(')
+    {
+      *path = grub_strchr (dir, ')');
+      if (! *path)
+	return 0;
+      (*path)++;
+    }
+  else
+    *path = dir;
+
+  name = grub_file_get_device_name (dir);
+  if (grub_errno)
+    {
+      grub_free (name);
+      return 0;
+    }
+
+  if (wd->dev && ((! name && ! wd->name)
+		  || (name && wd->name && grub_strcmp (name, wd->name) == 0)))
+    {
+      grub_free (name);
+      return wd->fs != 0;
+    }
+
+  if (wd->dev)
+    grub_device_close (wd->dev);
+  grub_free (wd->name);
+  wd->name = name;
+  wd->fs = 0;
+
+  wd->dev = grub_device_open (name);
+  if (! wd->dev)
+    return 0;
+
+  wd->fs = grub_fs_probe (wd->dev);
+  return wd->fs != 0;
+}
+
+static void
+wildcard_dev_close (struct wildcard_dev *wd)
+{
+  if (wd->dev)
+    grub_device_close (wd->dev);
+  grub_free (wd->name);
+  wd->dev = 0;
+  wd->name = 0;
+  wd->fs = 0;
+}
+
 static char **
-match_files (const char *prefix, const char *suffix, const char *end,
-	     const regex_t *regexp)
+match_files (struct wildcard_dev *wd, const char *prefix, const char *suffix,
+	     const char *end, const struct glob *glob)
 {
   struct match_files_ctx ctx = {
-    .regexp = regexp,
+    .glob = glob,
     .nfile = 0,
     .files = 0
   };
   int i;
   const char *path;
-  char *device_name;
-  grub_fs_t fs;
-  grub_device_t dev;
 
-  dev = 0;
-  device_name = 0;
   grub_error_push ();
 
   ctx.dir = make_dir (prefix, suffix, end);
   if (! ctx.dir)
     goto fail;
 
-  device_name = grub_file_get_device_name (ctx.dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
+  if (! wildcard_dev_open (wd, ctx.dir, &path))
     goto fail;
 
-  fs = grub_fs_probe (dev);
-  if (! fs)
-    goto fail;
-
-  if (ctx.dir[0] == '(')
-    {
-      path = grub_strchr (ctx.dir, ')');
-      if (!path)
-	goto fail;
-      path++;
-    }
-  else
-    path = ctx.dir;
-
-  if (fs->dir (dev, path, match_files_iter, &ctx))
+  if (wd->fs->dir (wd->dev, path, match_files_iter, &ctx))
     goto fail;
 
   grub_free (ctx.dir);
-  grub_device_close (dev);
-  grub_free (device_name);
   grub_error_pop ();
   return ctx.files;
 
@@ -388,11 +421,6 @@ match_files (const char *prefix, const char *suffix, const char *end,
 
   grub_free (ctx.files);
 
-  if (dev)
-    grub_device_close (dev);
-
-  grub_free (device_name);
-
   grub_error_pop ();
   return 0;
 }
@@ -423,36 +451,18 @@ check_file_iter (const char *name, const struct grub_dirhook_info *info,
 }
 
 static int
-check_file (const char *dir, const char *basename)
+check_file (struct wildcard_dev *wd, const char *dir, const char *basename)
 {
   struct check_file_ctx ctx = {
     .basename = basename,
     .found = 0
   };
-  grub_fs_t fs;
-  grub_device_t dev;
-  const char *device_name, *path;
-
-  device_name = grub_file_get_device_name (dir);
-  dev = grub_device_open (device_name);
-  if (! dev)
-    goto fail;
+  const char *path;
 
-  fs = grub_fs_probe (dev);
-  if (! fs)
+  if (! wildcard_dev_open (wd, dir, &path))
     goto fail;
 
-  if (dir[0] == '(')
-    {
-      path = grub_strchr (dir, ')');
-      if (!path)
-	goto fail;
-      path++;
-    }
-  else
-    path = dir;
-
-  fs->dir (dev, path[0] ? path : "/", check_file_iter, &ctx);
+  wd->fs->dir (wd->dev, path[0] ? path : "/", check_file_iter, &ctx);
   if (grub_errno == 0 && basename[0] == 0)
     ctx.found = 1;
 
@@ -491,9 +501,10 @@ wildcard_expand (const char *s, char ***strs)
   const char *noregexop;
   char **paths = 0;
   int had_regexp = 0;
+  struct glob glob;
+  struct wildcard_dev wd = { 0, 0, 0 };
 
   unsigned i;
-  regex_t regexp;
 
   *strs = 0;
   if (s[0] != '/' && s[0] != '(' && s[0] != '*')
@@ -545,7 +556,7 @@ wildcard_expand (const char *s, char ***strs)
 		      continue;
 		    }
 		  *p = 0;
-		  if (!check_file (n, p + 1))
+		  if (!check_file (&wd, n, p + 1))
 		    {
 		      grub_dprintf ("expand", "file <%s> in <%s> not found\n",
 				    p + 1, n);
@@ -570,18 +581,18 @@ wildcard_expand (const char *s, char ***strs)
 	  continue;
 	}
 
-      if (make_regex (noregexop, regexop, &regexp))
-	goto fail;
+      glob.start = noregexop;
+      glob.end = regexop;
 
       had_regexp = 1;
 
       if (paths == 0)
 	{
 	  if (start == noregexop) /* device part has regexop */
-	    paths = match_devices (&regexp, *start != '(');
+	    paths = match_devices (&glob, *start != '(');
 
 	  else  /* device part explicit wo regexop */
-	    paths = match_files ("", start, noregexop, &regexp);
+	    paths = match_files (&wd, "", start, noregexop, &glob);
 	}
       else
 	{
@@ -591,7 +602,7 @@ wildcard_expand (const char *s, char ***strs)
 	    {
 	      char **p;
 
-	      p = match_files (paths[i], start, noregexop, &regexp);
+	      p = match_files (&wd, paths[i], start, noregexop, &glob);
 	      grub_free (paths[i]);
 	      if (! p)
 		continue;
@@ -604,7 +615,6 @@ wildcard_expand (const char *s, char ***strs)
 	  paths = r;
 	}
 
-      regfree (&regexp);
       if (! paths)
 	goto done;
 
@@ -613,14 +623,15 @@ wildcard_expand (const char *s, char ***strs)
 
  done:
 
+  wildcard_dev_close (&wd);
   *strs = paths;
   return 0;
 
  fail:
 
+  wildcard_dev_close (&wd);
   for (i = 0; paths && paths[i]; i++)
     grub_free (paths[i]);
   grub_free (paths);
-  regfree (&regexp);
   return grub_errno;
 }
@@ -101,9 +101,22 @@ struct grub_ahci_received_fis
 
 enum
   {
-    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f
+    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f,
+    GRUB_AHCI_HBA_CAP_NCS_MASK = 0x1f00,
+    GRUB_AHCI_HBA_CAP_SNCQ = 0x40000000
   };
 
+#define GRUB_AHCI_HBA_CAP_NCS_SHIFT 8
+
+enum
+  {
+    GRUB_AHCI_HBA_PORT_IS_TFES = 0x40000000
+  };
+
+/* Command tables of queued commands are 128-byte aligned and carry a
+   single PRDT entry.  */
+#define GRUB_AHCI_CMD_TABLE_STRIDE 0x100
+
 enum
   {
     GRUB_AHCI_HBA_GLOBAL_CONTROL_RESET = 0x00000001,
@@ -134,6 +147,8 @@ struct grub_ahci_device
   struct grub_pci_dma_chunk *rfis;
   int present;
   int atapi;
+  /* Number of command slots usable for NCQ, 0 if unsupported.  */
+  int ncq_slots;
 };
 
 static grub_err_t 
@@ -349,6 +364,9 @@ grub_ahci_pciinit (grub_pci_device_t dev,
       adevs[i]->port = i;
       adevs[i]->present = 1;
       adevs[i]->num = numdevs++;
+      if (hba->cap & GRUB_AHCI_HBA_CAP_SNCQ)
+	adevs[i]->ncq_slots = ((hba->cap & GRUB_AHCI_HBA_CAP_NCS_MASK)
+			       >> GRUB_AHCI_HBA_CAP_NCS_SHIFT) + 1;
     }
 
   for (i = 0; i < nports; i++)
@@ -695,7 +713,8 @@ reinit_port (struct grub_ahci_device *dev)
   struct grub_pci_dma_chunk *command_table;
   grub_uint64_t endtime;
 
-  command_list = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head));
+  command_list = grub_memalign_dma32 (1024,
+				      sizeof (struct grub_ahci_cmd_head) * 32);
   if (!command_list)
     return 1;
 
@@ -1084,6 +1103,142 @@ grub_ahci_readwrite (grub_ata_t disk,
   return grub_ahci_readwrite_real (disk->data, parms, spinup, 0);
 }
 
+/* Issue N FPDMA commands at once, one per command slot, and wait for
+   the device to complete all of them.  */
+static grub_err_t
+grub_ahci_readwrite_queued (grub_ata_t disk,
+			    struct grub_disk_ata_pass_through_parms *parms,
+			    int n)
+{
+  struct grub_ahci_device *dev = disk->data;
+  struct grub_pci_dma_chunk *bufc[GRUB_ATA_MAX_NCQ_DEPTH];
+  struct grub_pci_dma_chunk *tablec;
+  volatile struct grub_ahci_hba_port *port = &dev->hba->ports[dev->port];
+  grub_uint32_t mask = 0;
+  grub_uint64_t endtime;
+  grub_err_t err = GRUB_ERR_NONE;
+  int i, nbufs = 0;
+
+  if (n > dev->ncq_slots || n > GRUB_ATA_MAX_NCQ_DEPTH)
+    return grub_error (GRUB_ERR_BUG, "too many queued commands");
+
+  for (i = 0; i < n; i++)
+    if (parms[i].size > GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH || parms[i].write
+	|| parms[i].taskfile.cmd != GRUB_ATA_CMD_READ_FPDMA_QUEUED)
+      return grub_error (GRUB_ERR_BUG, "invalid queued command");
+
+  tablec = grub_memalign_dma32 (1024, GRUB_AHCI_CMD_TABLE_STRIDE * n);
+  if (!tablec)
+    return grub_errno;
+
+  for (nbufs = 0; nbufs < n; nbufs++)
+    {
+      bufc[nbufs] = grub_memalign_dma32 (1024, parms[nbufs].size);
+      if (!bufc[nbufs])
+	{
+	  err = grub_errno;
+	  goto out;
+	}
+    }
+
+  grub_ahci_reset_port (dev, 0);
+
+  port->sata_error = port->sata_error;
+
+  for (i = 0; i < n; i++)
+    {
+      volatile struct grub_ahci_cmd_table *table;
+      grub_uint32_t count = parms[i].taskfile.sectors
+	| (parms[i].taskfile.sectors48 << 8);
+
+      table = (volatile struct grub_ahci_cmd_table *)
+	((char *) grub_dma_get_virt (tablec) + GRUB_AHCI_CMD_TABLE_STRIDE * i);
+      grub_memset ((char *) table, 0, GRUB_AHCI_CMD_TABLE_STRIDE);
+
+      /* FPDMA commands carry the sector count in the features registers
+	 and the tag in the sector count register.  */
+      table->cfis[0] = GRUB_AHCI_FIS_REG_H2D;
+      table->cfis[1] = 0x80;
+      table->cfis[2] = GRUB_ATA_CMD_READ_FPDMA_QUEUED;
+      table->cfis[3] = count & 0xff;
+      table->cfis[4] = parms[i].taskfile.lba_low;
+      table->cfis[5] = parms[i].taskfile.lba_mid;
+      table->cfis[6] = parms[i].taskfile.lba_high;
+      table->cfis[7] = 0x40;
+      table->cfis[8] = parms[i].taskfile.lba48_low;
+      table->cfis[9] = parms[i].taskfile.lba48_mid;
+      table->cfis[10] = parms[i].taskfile.lba48_high;
+      table->cfis[11] = (count >> 8) & 0xff;
+      table->cfis[12] = i << 3;
+
+      table->prdt[0].data_base = grub_dma_get_phys (bufc[i]);
+      table->prdt[0].unused = 0;
+      table->prdt[0].size = parms[i].size - 1;
+
+      dev->command_list[i].config
+	= (5 << GRUB_AHCI_CONFIG_CFIS_LENGTH_SHIFT)
+	| (0 << GRUB_AHCI_CONFIG_PMP_SHIFT)
+	| (1 << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT)
+	| GRUB_AHCI_CONFIG_READ;
+      dev->command_list[i].transfered = 0;
+      dev->command_list[i].command_table_base
+	= grub_dma_get_phys (tablec) + GRUB_AHCI_CMD_TABLE_STRIDE * i;
+      grub_memset ((char *) dev->command_list[i].unused, 0,
+		   sizeof (dev->command_list[i].unused));
+
+      mask |= 1 << i;
+    }
+
+  port->inten = 0xffffffff;
+  port->intstatus = 0xffffffff;
+  port->sata_active = mask;
+  port->command_issue = mask;
+
+  grub_dprintf ("ahci", "AHCI queued %d commands, mask %x\n", n, mask);
+
+  /* The device clears the SActive bit of each tag through a Set Device
+     Bits FIS as the command completes, in any order.  */
+  endtime = grub_get_time_ms () + 20000;
+  while ((port->sata_active | port->command_issue) & mask)
+    {
+      if ((port->intstatus & GRUB_AHCI_HBA_PORT_IS_TFES)
+	  || (port->task_file_data & GRUB_ATA_STATUS_ERR))
+	{
+	  grub_dprintf ("ahci", "AHCI queued error <%x %x %x>\n",
+			port->sata_active, port->intstatus,
+			port->task_file_data);
+	  err = grub_error (GRUB_ERR_READ_ERROR, "AHCI queued read failed");
+	  break;
+	}
+      if (grub_get_time_ms () > endtime)
+	{
+	  grub_dprintf ("ahci", "AHCI queued status <%x %x %x %x>\n",
+			port->command_issue, port->sata_active,
+			port->intstatus, port->task_file_data);
+	  err = grub_error (GRUB_ERR_IO, "AHCI transfer timed out");
+	  break;
+	}
+    }
+
+  if (err)
+    {
+      for (i = 0; i < n; i++)
+	parms[i].size = 0;
+      grub_ahci_reset_port (dev, 1);
+      goto out;
+    }
+
+  for (i = 0; i < n; i++)
+    grub_memcpy (parms[i].buffer, (char *) grub_dma_get_virt (bufc[i]),
+		 parms[i].size);
+
+ out:
+  for (i = 0; i < nbufs; i++)
+    grub_dma_free (bufc[i]);
+  grub_dma_free (tablec);
+  return err;
+}
+
 static grub_err_t
 grub_ahci_open (int id, int devnum, struct grub_ata *ata)
 {
@@ -1106,6 +1261,8 @@ grub_ahci_open (int id, int devnum, struct grub_ata *ata)
   ata->atapi = dev->atapi;
   ata->maxbuffer = GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH;
   ata->present = &dev->present;
+  if (!dev->atapi)
+    ata->ncq_depth = dev->ncq_slots;
 
   return GRUB_ERR_NONE;
 }
@@ -1115,6 +1272,7 @@ static struct grub_ata_dev grub_ahci_dev =
     .iterate = grub_ahci_iterate,
     .open = grub_ahci_open,
     .readwrite = grub_ahci_readwrite,
+    .readwrite_queued = grub_ahci_readwrite_queued,
   };
 
 
@@ -91,6 +91,7 @@ grub_atapi_identify (struct grub_ata *dev)
     }
 
   dev->atapi = 1;
+  dev->ncq_depth = 0;
 
   grub_ata_dumpinfo (dev, info);
 
@@ -189,6 +190,23 @@ grub_ata_identify (struct grub_ata *dev)
   else
     dev->log_sector_size = 9;
 
+  /* Use native command queuing only if both the controller and the
+     device support it.  The backend sets ncq_depth to the number of
+     commands it can queue.  */
+  if (dev->ncq_depth && dev->dma && dev->addr == GRUB_ATA_LBA48
+      && dev->dev->readwrite_queued
+      && (info16[76] & grub_cpu_to_le16_compile_time ((1 << 8))))
+    {
+      int depth = (grub_le_to_cpu16 (info16[75]) & 0x1f) + 1;
+      if (depth < dev->ncq_depth)
+	dev->ncq_depth = depth;
+      if (dev->ncq_depth > GRUB_ATA_MAX_NCQ_DEPTH)
+	dev->ncq_depth = GRUB_ATA_MAX_NCQ_DEPTH;
+      grub_dprintf ("ata", "using NCQ with depth %d\n", dev->ncq_depth);
+    }
+  else
+    dev->ncq_depth = 0;
+
   /* Read CHS information.  */
   dev->cylinders = grub_le_to_cpu16 (info16[1]);
   dev->heads = grub_le_to_cpu16 (info16[3]);
@@ -278,6 +296,49 @@ grub_ata_setaddress (struct grub_ata *dev,
   return GRUB_ERR_NONE;
 }
 
+/* Read SIZE sectors starting at SECTOR, keeping up to ncq_depth
+   FPDMA commands of 256 sectors each in flight.  */
+static grub_err_t
+grub_ata_read_queued (struct grub_ata *ata, grub_disk_addr_t sector,
+		      grub_size_t size, char *buf)
+{
+  struct grub_disk_ata_pass_through_parms parms[GRUB_ATA_MAX_NCQ_DEPTH];
+
+  while (size)
+    {
+      grub_err_t err;
+      int n, i;
+
+      for (n = 0; n < ata->ncq_depth && size; n++)
+	{
+	  grub_size_t batch = size < 256 ? size : 256;
+
+	  grub_memset (&parms[n], 0, sizeof (parms[n]));
+	  grub_ata_setaddress (ata, &parms[n], sector, batch, GRUB_ATA_LBA48);
+	  parms[n].taskfile.cmd = GRUB_ATA_CMD_READ_FPDMA_QUEUED;
+	  parms[n].buffer = buf;
+	  parms[n].size = batch << ata->log_sector_size;
+	  parms[n].dma = 1;
+
+	  buf += batch << ata->log_sector_size;
+	  sector += batch;
+	  size -= batch;
+	}
+
+      grub_dprintf ("ata", "queued %d commands, next sector=%llu\n", n,
+		    (unsigned long long) sector);
+
+      err = ata->dev->readwrite_queued (ata, parms, n);
+      if (err)
+	return err;
+      for (i = 0; i < n; i++)
+	if (parms[i].size == 0)
+	  return grub_error (GRUB_ERR_READ_ERROR, "incomplete read");
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf, int rw)
@@ -292,6 +353,9 @@ grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
   grub_dprintf("ata", "grub_ata_readwrite (size=%llu, rw=%d)\n",
 	       (unsigned long long) size, rw);
 
+  if (!rw && ata->ncq_depth > 1 && size > 256)
+    return grub_ata_read_queued (ata, sector, size, buf);
+
   if (addressing == GRUB_ATA_LBA48 && ((sector + size) >> 28) != 0)
     {
       if (ata->dma)
@@ -473,6 +537,10 @@ grub_ata_open (const char *name, grub_disk_t disk)
   disk->max_agglomerate = (ata->maxbuffer >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
   if (disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
     disk->max_agglomerate = (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size));
+  /* With NCQ a single read may keep several 256-sector commands in
+     flight.  */
+  if (ata->ncq_depth > 1)
+    disk->max_agglomerate *= ata->ncq_depth;
 
   disk->log_sector_size = ata->log_sector_size;
 
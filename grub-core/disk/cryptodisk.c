@@ -25,6 +25,7 @@
 #include <grub/fs.h>
 #include <grub/file.h>
 #include <grub/procfs.h>
+#include <grub/mp.h>
 
 #ifdef GRUB_UTIL
 #include <grub/emu/hostdisk.h>
@@ -220,6 +221,203 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+/* Compute the IV of SECTOR into IV, which has room for
+   GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE bytes.  */
+static gcry_err_code_t
+grub_cryptodisk_generate_iv (struct grub_cryptodisk *dev,
+			     grub_disk_addr_t sector, grub_uint32_t *iv)
+{
+  grub_size_t sz = ((dev->cipher->cipher->blocksize
+		     + sizeof (grub_uint32_t) - 1)
+		    / sizeof (grub_uint32_t));
+  gcry_err_code_t err;
+
+  grub_memset (iv, 0, GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE);
+  switch (dev->mode_iv)
+    {
+    case GRUB_CRYPTODISK_MODE_IV_NULL:
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH:
+      {
+	grub_uint64_t tmp;
+	void *ctx;
+
+	ctx = grub_zalloc (dev->iv_hash->contextsize);
+	if (!ctx)
+	  return GPG_ERR_OUT_OF_MEMORY;
+
+	tmp = grub_cpu_to_le64 (sector << dev->log_sector_size);
+	dev->iv_hash->init (ctx);
+	dev->iv_hash->write (ctx, dev->iv_prefix, dev->iv_prefix_len);
+	dev->iv_hash->write (ctx, &tmp, sizeof (tmp));
+	dev->iv_hash->final (ctx);
+
+	grub_memcpy (iv, dev->iv_hash->read (ctx),
+		     GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE);
+	grub_free (ctx);
+      }
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
+      iv[1] = grub_cpu_to_le32 (sector >> 32);
+    case GRUB_CRYPTODISK_MODE_IV_PLAIN:
+      iv[0] = grub_cpu_to_le32 (sector & 0xFFFFFFFF);
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64:
+      iv[1] = grub_cpu_to_le32 (sector >> (32 - dev->log_sector_size));
+      iv[0] = grub_cpu_to_le32 ((sector << dev->log_sector_size)
+				& 0xFFFFFFFF);
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_BENBI:
+      {
+	grub_uint64_t num = (sector << dev->benbi_log) + 1;
+	iv[sz - 2] = grub_cpu_to_be32 (num >> 32);
+	iv[sz - 1] = grub_cpu_to_be32 (num & 0xFFFFFFFF);
+      }
+      break;
+    case GRUB_CRYPTODISK_MODE_IV_ESSIV:
+      iv[0] = grub_cpu_to_le32 (sector & 0xFFFFFFFF);
+      err = grub_crypto_ecb_encrypt (dev->essiv_cipher, iv, iv,
+				     dev->cipher->cipher->blocksize);
+      if (err)
+	return err;
+    }
+  return GPG_ERR_NO_ERROR;
+}
+
+/* XTS over a run of sectors: the tweaks of all the blocks of up to
+   XTS_BATCH_SIZE bytes are computed first so that the data cipher goes
+   through the whole run in one call.  */
+#define XTS_BATCH_SIZE 4096
+/* Below this, starting the other processors costs more than it saves.  */
+#define XTS_PARALLEL_MIN 65536
+
+static gcry_err_code_t
+grub_cryptodisk_xts_run (struct grub_cryptodisk *dev,
+			 grub_uint8_t *data, grub_size_t len,
+			 grub_disk_addr_t sector, int do_encrypt)
+{
+  grub_uint32_t tweaks[XTS_BATCH_SIZE / sizeof (grub_uint32_t)];
+  grub_uint8_t *t = (grub_uint8_t *) tweaks;
+  grub_size_t sector_size = 1U << dev->log_sector_size;
+  grub_size_t nsec = len >> dev->log_sector_size;
+  grub_size_t s, j;
+  gcry_err_code_t err;
+
+  if (!nsec || (len & (sector_size - 1)))
+    return GPG_ERR_INV_ARG;
+
+  /* Gather the IVs at the start of the buffer and encrypt them all
+     with the secondary key.  */
+  for (s = 0; s < nsec; s++)
+    {
+      grub_uint32_t iv[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
+
+      err = grub_cryptodisk_generate_iv (dev, sector + s, iv);
+      if (err)
+	return err;
+      grub_memcpy (t + s * GRUB_CRYPTODISK_GF_BYTES, iv,
+		   GRUB_CRYPTODISK_GF_BYTES);
+    }
+  err = grub_crypto_ecb_encrypt (dev->secondary_cipher, t, t,
+				 nsec * GRUB_CRYPTODISK_GF_BYTES);
+  if (err)
+    return err;
+
+  /* Spread them to the first block of their sector, last one first
+     so that none is overwritten before it is moved, and derive the
+     tweaks of the following blocks.  */
+  for (s = nsec; s > 0; s--)
+    {
+      grub_uint8_t *st = t + ((s - 1) << dev->log_sector_size);
+
+      grub_memmove (st, t + (s - 1) * GRUB_CRYPTODISK_GF_BYTES,
+		    GRUB_CRYPTODISK_GF_BYTES);
+      for (j = GRUB_CRYPTODISK_GF_BYTES; j < sector_size;
+	   j += GRUB_CRYPTODISK_GF_BYTES)
+	{
+	  grub_memcpy (st + j, st + j - GRUB_CRYPTODISK_GF_BYTES,
+		       GRUB_CRYPTODISK_GF_BYTES);
+	  gf_mul_x (st + j);
+	}
+    }
+
+  grub_crypto_xor (data, data, t, len);
+  if (do_encrypt)
+    err = grub_crypto_ecb_encrypt (dev->cipher, data, data, len);
+  else
+    err = grub_crypto_ecb_decrypt (dev->cipher, data, data, len);
+  if (err)
+    return err;
+  grub_crypto_xor (data, data, t, len);
+  return GPG_ERR_NO_ERROR;
+}
+
+struct xts_job
+{
+  struct grub_cryptodisk *dev;
+  grub_uint8_t *data;
+  grub_size_t len;
+  grub_disk_addr_t sector;
+  int do_encrypt;
+  gcry_err_code_t err;
+};
+
+static void
+grub_cryptodisk_xts_job (void *data, grub_size_t index)
+{
+  struct xts_job *job = data;
+  grub_size_t off = index * XTS_BATCH_SIZE;
+  grub_size_t len = job->len - off;
+  gcry_err_code_t err;
+
+  if (len > XTS_BATCH_SIZE)
+    len = XTS_BATCH_SIZE;
+  err = grub_cryptodisk_xts_run (job->dev, job->data + off, len,
+				 job->sector
+				 + (off >> job->dev->log_sector_size),
+				 job->do_encrypt);
+  if (err)
+    job->err = err;
+}
+
+static gcry_err_code_t
+grub_cryptodisk_xts_batch (struct grub_cryptodisk *dev,
+			   grub_uint8_t *data, grub_size_t len,
+			   grub_disk_addr_t sector, int do_encrypt)
+{
+  struct xts_job job;
+  grub_size_t chunk;
+  gcry_err_code_t err;
+
+  /* The first run goes on this processor: it lets the cipher finish
+     setting up any state it prepares lazily before others share it.  */
+  chunk = len < XTS_BATCH_SIZE ? len : XTS_BATCH_SIZE;
+  err = grub_cryptodisk_xts_run (dev, data, chunk, sector, do_encrypt);
+  if (err || chunk == len)
+    return err;
+
+  job.dev = dev;
+  job.data = data + chunk;
+  job.len = len - chunk;
+  job.sector = sector + (chunk >> dev->log_sector_size);
+  job.do_encrypt = do_encrypt;
+  job.err = GPG_ERR_NO_ERROR;
+
+  /* Hashed IVs allocate, which only this processor may do.  */
+  if (len >= XTS_PARALLEL_MIN
+      && dev->mode_iv != GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH)
+    grub_mp_run (grub_cryptodisk_xts_job, &job,
+		 (job.len + XTS_BATCH_SIZE - 1) / XTS_BATCH_SIZE);
+  else
+    {
+      grub_size_t i;
+
+      for (i = 0; i * XTS_BATCH_SIZE < job.len && !job.err; i++)
+	grub_cryptodisk_xts_job (&job, i);
+    }
+  return job.err;
+}
+
 static gcry_err_code_t
 grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 			   grub_uint8_t * data, grub_size_t len,
@@ -236,11 +434,14 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
     return (do_encrypt ? grub_crypto_ecb_encrypt (dev->cipher, data, data, len)
 	    : grub_crypto_ecb_decrypt (dev->cipher, data, data, len));
 
+  /* Rekeying may happen at any sector, so leave it to the loop below.  */
+  if (dev->mode == GRUB_CRYPTODISK_MODE_XTS && !dev->rekey
+      && dev->cipher->cipher->blocksize == GRUB_CRYPTODISK_GF_BYTES
+      && (1U << dev->log_sector_size) <= XTS_BATCH_SIZE)
+    return grub_cryptodisk_xts_batch (dev, data, len, sector, do_encrypt);
+
   for (i = 0; i < len; i += (1U << dev->log_sector_size))
     {
-      grub_size_t sz = ((dev->cipher->cipher->blocksize
-			 + sizeof (grub_uint32_t) - 1)
-			/ sizeof (grub_uint32_t));
       grub_uint32_t iv[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
 
       if (dev->rekey)
@@ -255,54 +456,9 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    }
 	}
 
-      grub_memset (iv, 0, sizeof (iv));
-      switch (dev->mode_iv)
-	{
-	case GRUB_CRYPTODISK_MODE_IV_NULL:
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH:
-	  {
-	    grub_uint64_t tmp;
-	    void *ctx;
-
-	    ctx = grub_zalloc (dev->iv_hash->contextsize);
-	    if (!ctx)
-	      return GPG_ERR_OUT_OF_MEMORY;
-
-	    tmp = grub_cpu_to_le64 (sector << dev->log_sector_size);
-	    dev->iv_hash->init (ctx);
-	    dev->iv_hash->write (ctx, dev->iv_prefix, dev->iv_prefix_len);
-	    dev->iv_hash->write (ctx, &tmp, sizeof (tmp));
-	    dev->iv_hash->final (ctx);
-
-	    grub_memcpy (iv, dev->iv_hash->read (ctx), sizeof (iv));
-	    grub_free (ctx);
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
-	  iv[1] = grub_cpu_to_le32 (sector >> 32);
-	case GRUB_CRYPTODISK_MODE_IV_PLAIN:
-	  iv[0] = grub_cpu_to_le32 (sector & 0xFFFFFFFF);
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64:
-	  iv[1] = grub_cpu_to_le32 (sector >> (32 - dev->log_sector_size));
-	  iv[0] = grub_cpu_to_le32 ((sector << dev->log_sector_size)
-				    & 0xFFFFFFFF);
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_BENBI:
-	  {
-	    grub_uint64_t num = (sector << dev->benbi_log) + 1;
-	    iv[sz - 2] = grub_cpu_to_be32 (num >> 32);
-	    iv[sz - 1] = grub_cpu_to_be32 (num & 0xFFFFFFFF);
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_IV_ESSIV:
-	  iv[0] = grub_cpu_to_le32 (sector & 0xFFFFFFFF);
-	  err = grub_crypto_ecb_encrypt (dev->essiv_cipher, iv, iv,
-					 dev->cipher->cipher->blocksize);
-	  if (err)
-	    return err;
-	}
+      err = grub_cryptodisk_generate_iv (dev, sector, iv);
+      if (err)
+	return err;
 
       switch (dev->mode)
 	{
@@ -466,6 +622,156 @@ grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t ke
   return GPG_ERR_NO_ERROR;
 }
 
+grub_err_t
+grub_cryptodisk_setcipher (grub_cryptodisk_t crypt, const char *ciphername,
+			   const char *ciphermode)
+{
+  const char *cipheriv = NULL;
+  grub_crypto_cipher_handle_t cipher = NULL, secondary_cipher = NULL;
+  grub_crypto_cipher_handle_t essiv_cipher = NULL;
+  const gcry_md_spec_t *essiv_hash = NULL;
+  const struct gcry_cipher_spec *ciph;
+  grub_cryptodisk_mode_t mode;
+  grub_cryptodisk_mode_iv_t mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN64;
+  int benbi_log = 0;
+
+  ciph = grub_crypto_lookup_cipher_by_name (ciphername);
+  if (!ciph)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, "Cipher %s isn't available",
+		       ciphername);
+
+  /* Configure the cipher used for the bulk data.  */
+  cipher = grub_crypto_cipher_open (ciph);
+  if (!cipher)
+    return grub_errno;
+
+  /* Configure the cipher mode.  */
+  if (grub_strcmp (ciphermode, "ecb") == 0)
+    {
+      mode = GRUB_CRYPTODISK_MODE_ECB;
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN;
+      cipheriv = NULL;
+    }
+  else if (grub_strcmp (ciphermode, "plain") == 0)
+    {
+      mode = GRUB_CRYPTODISK_MODE_CBC;
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN;
+      cipheriv = NULL;
+    }
+  else if (grub_memcmp (ciphermode, "cbc-", sizeof ("cbc-") - 1) == 0)
+    {
+      mode = GRUB_CRYPTODISK_MODE_CBC;
+      cipheriv = ciphermode + sizeof ("cbc-") - 1;
+    }
+  else if (grub_memcmp (ciphermode, "pcbc-", sizeof ("pcbc-") - 1) == 0)
+    {
+      mode = GRUB_CRYPTODISK_MODE_PCBC;
+      cipheriv = ciphermode + sizeof ("pcbc-") - 1;
+    }
+  else if (grub_memcmp (ciphermode, "xts-", sizeof ("xts-") - 1) == 0)
+    {
+      mode = GRUB_CRYPTODISK_MODE_XTS;
+      cipheriv = ciphermode + sizeof ("xts-") - 1;
+      secondary_cipher = grub_crypto_cipher_open (ciph);
+      if (!secondary_cipher)
+	goto fail;
+      if (cipher->cipher->blocksize != GRUB_CRYPTODISK_GF_BYTES)
+	{
+	  grub_error (GRUB_ERR_BAD_ARGUMENT, "Unsupported XTS block size: %d",
+		      cipher->cipher->blocksize);
+	  goto fail;
+	}
+      if (secondary_cipher->cipher->blocksize != GRUB_CRYPTODISK_GF_BYTES)
+	{
+	  grub_error (GRUB_ERR_BAD_ARGUMENT, "Unsupported XTS block size: %d",
+		      secondary_cipher->cipher->blocksize);
+	  goto fail;
+	}
+    }
+  else if (grub_memcmp (ciphermode, "lrw-", sizeof ("lrw-") - 1) == 0)
+    {
+      mode = GRUB_CRYPTODISK_MODE_LRW;
+      cipheriv = ciphermode + sizeof ("lrw-") - 1;
+      if (cipher->cipher->blocksize != GRUB_CRYPTODISK_GF_BYTES)
+	{
+	  grub_error (GRUB_ERR_BAD_ARGUMENT, "Unsupported LRW block size: %d",
+		      cipher->cipher->blocksize);
+	  goto fail;
+	}
+    }
+  else
+    {
+      grub_error (GRUB_ERR_BAD_ARGUMENT, "Unknown cipher mode: %s",
+		  ciphermode);
+      goto fail;
+    }
+
+  if (cipheriv == NULL);
+  else if (grub_memcmp (cipheriv, "plain", sizeof ("plain") - 1) == 0)
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN;
+  else if (grub_memcmp (cipheriv, "plain64", sizeof ("plain64") - 1) == 0)
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_PLAIN64;
+  else if (grub_memcmp (cipheriv, "benbi", sizeof ("benbi") - 1) == 0)
+    {
+      if (cipher->cipher->blocksize & (cipher->cipher->blocksize - 1)
+	  || cipher->cipher->blocksize == 0)
+	grub_error (GRUB_ERR_BAD_ARGUMENT, "Unsupported benbi blocksize: %d",
+		    cipher->cipher->blocksize);
+	/* FIXME should we return an error here? */
+      for (benbi_log = 0; 
+	   (cipher->cipher->blocksize << benbi_log) < GRUB_DISK_SECTOR_SIZE;
+	   benbi_log++);
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_BENBI;
+    }
+  else if (grub_memcmp (cipheriv, "null", sizeof ("null") - 1) == 0)
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_NULL;
+  else if (grub_memcmp (cipheriv, "essiv:", sizeof ("essiv:") - 1) == 0)
+    {
+      const char *hash_str = cipheriv + 6;
+
+      mode_iv = GRUB_CRYPTODISK_MODE_IV_ESSIV;
+
+      /* Configure the hash and cipher used for ESSIV.  */
+      essiv_hash = grub_crypto_lookup_md_by_name (hash_str);
+      if (!essiv_hash)
+	{
+	  grub_error (GRUB_ERR_FILE_NOT_FOUND,
+		      "Couldn't load %s hash", hash_str);
+	  goto fail;
+	}
+      essiv_cipher = grub_crypto_cipher_open (ciph);
+      if (!essiv_cipher)
+	goto fail;
+    }
+  else
+    {
+      grub_error (GRUB_ERR_BAD_ARGUMENT, "Unknown IV mode: %s",
+		  cipheriv);
+      goto fail;
+    }
+
+  /* Only now that everything is set up replace what CRYPT had, so that it
+     can be reconfigured, e.g. between a key slot and the data.  */
+  grub_crypto_cipher_close (crypt->cipher);
+  grub_crypto_cipher_close (crypt->secondary_cipher);
+  grub_crypto_cipher_close (crypt->essiv_cipher);
+  crypt->cipher = cipher;
+  crypt->benbi_log = benbi_log;
+  crypt->mode = mode;
+  crypt->mode_iv = mode_iv;
+  crypt->secondary_cipher = secondary_cipher;
+  crypt->essiv_cipher = essiv_cipher;
+  crypt->essiv_hash = essiv_hash;
+
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_crypto_cipher_close (cipher);
+  grub_crypto_cipher_close (secondary_cipher);
+  grub_crypto_cipher_close (essiv_cipher);
+  return grub_errno;
+}
+
 static int
 grub_cryptodisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
 			 grub_disk_pull_t pull)
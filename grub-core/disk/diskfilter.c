@@ -24,6 +24,7 @@
 #include <grub/misc.h>
 #include <grub/diskfilter.h>
 #include <grub/partition.h>
+#include <grub/time.h>
 #ifdef GRUB_UTIL
 #include <grub/i18n.h>
 #include <grub/util/misc.h>
@@ -36,9 +37,27 @@ static struct grub_diskfilter_vg *array_list;
 grub_raid5_recover_func_t grub_raid5_recover_func;
 grub_raid6_recover_func_t grub_raid6_recover_func;
 grub_diskfilter_t grub_diskfilter_list;
+unsigned int grub_diskfilter_list_generation;
 static int inscnt = 0;
 static int lv_num = 0;
 
+/* Disks whose partitions have all been probed by every backend.  Arrays
+   found on them are in array_list already, so on the next miss only new
+   disks need to be opened.  The whole index is dropped when the set of
+   backends changes.  */
+struct scanned_disk
+{
+  struct scanned_disk *next;
+  char *name;
+};
+static struct scanned_disk *scanned_disks;
+static unsigned int scanned_generation;
+
+/* Read at the start and at the end of each partition before running the
+   backends, so that their label and superblock probes are served from
+   the disk cache instead of issuing small reads each.  */
+#define SCAN_PREFETCH_SECTORS	128
+
 static struct grub_diskfilter_lv *
 find_lv (const char *name);
 static int is_lv_readable (struct grub_diskfilter_lv *lv, int easily);
@@ -123,6 +142,83 @@ is_valid_diskfilter_name (const char *name)
 	  || grub_memcmp (name, "ldm/", sizeof ("ldm/") - 1) == 0);
 }
 
+static void
+scanned_disks_free (void)
+{
+  struct scanned_disk *d;
+
+  while ((d = scanned_disks))
+    {
+      scanned_disks = d->next;
+      grub_free (d->name);
+      grub_free (d);
+    }
+}
+
+static int
+scanned_disks_find (const char *name)
+{
+  struct scanned_disk *d;
+
+  if (scanned_generation != grub_diskfilter_list_generation)
+    {
+      scanned_disks_free ();
+      scanned_generation = grub_diskfilter_list_generation;
+    }
+
+  for (d = scanned_disks; d; d = d->next)
+    if (grub_strcmp (d->name, name) == 0)
+      return 1;
+  return 0;
+}
+
+static void
+scanned_disks_add (const char *name)
+{
+  struct scanned_disk *d;
+
+  d = grub_malloc (sizeof (*d));
+  if (!d)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  d->name = grub_strdup (name);
+  if (!d->name)
+    {
+      grub_free (d);
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  d->next = scanned_disks;
+  scanned_disks = d;
+}
+
+static void
+scan_prefetch (grub_disk_t disk)
+{
+  grub_uint64_t size = grub_disk_get_size (disk);
+  grub_size_t n = SCAN_PREFETCH_SECTORS;
+  char *buf;
+
+  if (size != GRUB_DISK_SIZE_UNKNOWN && size < n)
+    n = size;
+  if (n == 0)
+    return;
+
+  buf = grub_malloc (n << GRUB_DISK_SECTOR_BITS);
+  if (!buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_disk_read (disk, 0, 0, n << GRUB_DISK_SECTOR_BITS, buf);
+  if (size != GRUB_DISK_SIZE_UNKNOWN && size >= 2 * n)
+    grub_disk_read (disk, size - n, 0, n << GRUB_DISK_SECTOR_BITS, buf);
+  grub_free (buf);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 /* Helper for scan_disk.  */
 static int
 scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
@@ -152,6 +248,8 @@ scan_disk_partition_iter (grub_disk_t disk, grub_partition_t p, void *data)
 	  return 0;
     }
 
+  scan_prefetch (disk);
+
   for (diskfilter = grub_diskfilter_list; diskfilter; diskfilter = diskfilter->next)
     {
 #ifdef GRUB_UTIL
@@ -194,6 +292,9 @@ scan_disk (const char *name, int accept_diskfilter)
   if (scan_depth > 100)
     return 0;
 
+  if (scanned_disks_find (name))
+    return 0;
+
   scan_depth++;
   disk = grub_disk_open (name);
   if (!disk)
@@ -205,6 +306,7 @@ scan_disk (const char *name, int accept_diskfilter)
   scan_disk_partition_iter (disk, 0, (void *) name);
   grub_partition_iterate (disk, scan_disk_partition_iter, (void *) name);
   grub_disk_close (disk);
+  scanned_disks_add (name);
   scan_depth--;
   return 0;
 }
@@ -575,6 +677,232 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+/* Only reads of at least this many sectors are timed for the mirror
+   policy: shorter ones are mostly cache hits, and below the timer
+   resolution anyway.  */
+#define MIRROR_TIMED_SECTORS	64
+/* A member is considered measured once this much has been timed.  */
+#define MIRROR_MEASURED_SECTORS	2048
+
+static int
+mirror_measured (const struct grub_diskfilter_node *node)
+{
+  return node->pv && node->pv->mirror_sectors >= MIRROR_MEASURED_SECTORS;
+}
+
+/* Whether member A should be tried before member B.  Members which failed
+   come last for the rest of the session.  Between two measured members
+   the one which took less time per sector wins; otherwise NVMe disks are
+   preferred, as their latency is known to be lower.  */
+static int
+mirror_before (const struct grub_diskfilter_node *a,
+	       const struct grub_diskfilter_node *b)
+{
+  unsigned int ea = a->pv ? a->pv->mirror_errors : 0;
+  unsigned int eb = b->pv ? b->pv->mirror_errors : 0;
+  int ra, rb;
+
+  if (!!ea != !!eb)
+    return ! ea;
+
+  if (mirror_measured (a) && mirror_measured (b))
+    return a->pv->mirror_ms * b->pv->mirror_sectors
+      < b->pv->mirror_ms * a->pv->mirror_sectors;
+
+  ra = ! (a->pv && a->pv->disk
+	  && a->pv->disk->dev->id == GRUB_DISK_DEVICE_NVME_ID);
+  rb = ! (b->pv && b->pv->disk
+	  && b->pv->disk->dev->id == GRUB_DISK_DEVICE_NVME_ID);
+  return ra < rb;
+}
+
+/* Read SIZE sectors at SECTOR from the member ORDER[FIRST], falling back
+   to the members following it in ORDER.  */
+static grub_err_t
+read_mirror_part (struct grub_diskfilter_segment *seg,
+		  const unsigned int *order, unsigned int first,
+		  grub_disk_addr_t sector, grub_size_t size, char *buf)
+{
+  grub_err_t err = GRUB_ERR_NONE;
+  unsigned int i;
+
+  for (i = 0; i < seg->node_count; i++)
+    {
+      const struct grub_diskfilter_node *node;
+      grub_uint64_t start;
+
+      node = &seg->nodes[order[(first + i) % seg->node_count]];
+
+      if (grub_errno == GRUB_ERR_READ_ERROR
+	  || grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
+	grub_errno = GRUB_ERR_NONE;
+
+      start = grub_get_time_ms ();
+      err = grub_diskfilter_read_node (node, sector, size, buf);
+      if (! err)
+	{
+	  if (node->pv && size >= MIRROR_TIMED_SECTORS)
+	    {
+	      node->pv->mirror_sectors += size;
+	      node->pv->mirror_ms += grub_get_time_ms () - start;
+	    }
+	  return GRUB_ERR_NONE;
+	}
+      if (err != GRUB_ERR_READ_ERROR && err != GRUB_ERR_UNKNOWN_DEVICE)
+	return err;
+      if (node->pv)
+	node->pv->mirror_errors++;
+    }
+
+  return err;
+}
+
+/* Read from a mirror, trying the members in the order given by
+   mirror_before.  While the members which have not failed are not all
+   measured yet, large reads are split between them so that each gets
+   timed; GRUB waits for every read, so once they are measured reading
+   everything from the fastest one is best.  */
+static grub_err_t
+read_mirror (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	     grub_size_t size, char *buf)
+{
+  unsigned int order_buf[8], *order = order_buf;
+  unsigned int i, j, healthy = 0, parts = 1;
+  grub_err_t err;
+
+  if (seg->node_count > ARRAY_SIZE (order_buf))
+    {
+      order = grub_malloc (seg->node_count * sizeof (order[0]));
+      if (! order)
+	return grub_errno;
+    }
+
+  /* Insertion sort, keeping the configured order between equals.  */
+  for (i = 0; i < seg->node_count; i++)
+    {
+      for (j = i; j > 0 && mirror_before (&seg->nodes[i],
+					  &seg->nodes[order[j - 1]]); j--)
+	order[j] = order[j - 1];
+      order[j] = i;
+    }
+
+  for (i = 0; i < seg->node_count; i++)
+    if (! seg->nodes[order[i]].pv || ! seg->nodes[order[i]].pv->mirror_errors)
+      healthy++;
+  for (i = 0; i < healthy; i++)
+    if (seg->nodes[order[i]].pv && ! mirror_measured (&seg->nodes[order[i]]))
+      break;
+  if (i < healthy && size >= 2 * MIRROR_TIMED_SECTORS)
+    {
+      parts = healthy;
+      if (size < parts * MIRROR_TIMED_SECTORS)
+	parts = size / MIRROR_TIMED_SECTORS;
+    }
+
+  err = GRUB_ERR_NONE;
+  for (i = 0; i < parts && ! err; i++)
+    {
+      grub_size_t len = size / parts + (i < size % parts);
+
+      err = read_mirror_part (seg, order, i, sector, len, buf);
+      sector += len;
+      buf += len << GRUB_DISK_SECTOR_BITS;
+    }
+
+  if (order != order_buf)
+    grub_free (order);
+  return err;
+}
+
+/* Read the first copy of every chunk of a striped, mirrored or RAID10
+   segment with one vectored read per member, instead of one read per
+   chunk: each member gets all its chunks at once and the ones adjacent
+   on it are merged.  The chunks are walked the way read_segment does when
+   no copy fails.  Returns 0, with grub_errno cleared, when the caller has
+   to read chunk by chunk instead.  */
+static int
+read_chunks_vec (struct grub_diskfilter_segment *seg,
+		 grub_disk_addr_t read_sector, grub_uint64_t disknr,
+		 grub_uint64_t b, grub_uint64_t near, grub_uint64_t ofs,
+		 grub_size_t size, char *buf)
+{
+  struct grub_disk_vec *vec = NULL, *sub = NULL;
+  unsigned int *owner = NULL;
+  grub_uint64_t nchunks;
+  grub_size_t n = 0, i, nsub;
+  unsigned int k;
+  int ret = 0;
+
+  if (size <= seg->stripe_size - b)
+    return 0;
+
+  for (k = 0; k < seg->node_count; k++)
+    if (! seg->nodes[k].pv || ! seg->nodes[k].pv->disk)
+      return 0;
+
+  nchunks = grub_divmod64 (b + size + seg->stripe_size - 1,
+			   seg->stripe_size, 0);
+  vec = grub_malloc (nchunks * sizeof (vec[0]));
+  sub = grub_malloc (nchunks * sizeof (sub[0]));
+  owner = grub_malloc (nchunks * sizeof (owner[0]));
+  if (! vec || ! sub || ! owner)
+    goto out;
+
+  while (1)
+    {
+      grub_size_t read_size;
+
+      read_size = seg->stripe_size - b;
+      if (read_size > size)
+	read_size = size;
+
+      vec[n].sector = read_sector + b;
+      vec[n].size = read_size << GRUB_DISK_SECTOR_BITS;
+      vec[n].buf = buf;
+      owner[n] = disknr;
+      n++;
+
+      buf += read_size << GRUB_DISK_SECTOR_BITS;
+      size -= read_size;
+      if (! size)
+	break;
+
+      b = 0;
+      disknr += near;
+      while (disknr >= seg->node_count)
+	{
+	  disknr -= seg->node_count;
+	  read_sector += ofs;
+	}
+    }
+
+  for (k = 0; k < seg->node_count; k++)
+    {
+      const struct grub_diskfilter_node *node = &seg->nodes[k];
+
+      for (i = 0, nsub = 0; i < n; i++)
+	if (owner[i] == k)
+	  {
+	    sub[nsub] = vec[i];
+	    sub[nsub].sector += node->start + node->pv->start_sector;
+	    nsub++;
+	  }
+
+      if (nsub && grub_disk_read_vec (node->pv->disk, sub, nsub))
+	goto out;
+    }
+
+  ret = 1;
+
+ out:
+  grub_free (vec);
+  grub_free (sub);
+  grub_free (owner);
+  if (! ret)
+    grub_errno = GRUB_ERR_NONE;
+  return ret;
+}
+
 static grub_err_t
 read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	      grub_size_t size, char *buf)
@@ -594,6 +922,9 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 	grub_uint64_t disknr, b, near, far, ofs;
 	unsigned int i, j;
 	    
+	if (seg->type == GRUB_DISKFILTER_MIRROR)
+	  return read_mirror (seg, sector, size, buf);
+
 	read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
 	far = ofs = near = 1;
 	far_ofs = 0;
@@ -622,7 +953,11 @@ read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
 
 	ofs *= seg->stripe_size;
 	read_sector *= ofs;
-	
+
+	if (read_chunks_vec (seg, read_sector, disknr, b, near, ofs,
+			     size, buf))
+	  return GRUB_ERR_NONE;
+
 	while (1)
 	  {
 	    grub_size_t read_size;
@@ -1293,6 +1628,7 @@ free_array (void)
     }
 
   array_list = 0;
+  scanned_disks_free ();
 }
 
 #ifdef GRUB_UTIL
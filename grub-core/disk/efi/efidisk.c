@@ -33,11 +33,17 @@ struct grub_efidisk_data
   grub_efi_device_path_t *device_path;
   grub_efi_device_path_t *last_device_path;
   grub_efi_block_io_t *block_io;
+  /* Asynchronous interface to the same device, if the firmware has it.  */
+  grub_efi_block_io2_t *block_io2;
   struct grub_efidisk_data *next;
 };
 
 /* GUID.  */
 static grub_efi_guid_t block_io_guid = GRUB_EFI_BLOCK_IO_GUID;
+static grub_efi_guid_t block_io2_guid = GRUB_EFI_BLOCK_IO2_GUID;
+
+/* Maximum number of Block I/O 2 requests in flight.  */
+#define GRUB_EFIDISK_QUEUE_DEPTH 8
 
 static struct grub_efidisk_data *fd_devices;
 static struct grub_efidisk_data *hd_devices;
@@ -92,6 +98,8 @@ make_devices (void)
       d->device_path = dp;
       d->last_device_path = ldp;
       d->block_io = bio;
+      d->block_io2 = grub_efi_open_protocol (*handle, &block_io2_guid,
+					     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
       d->next = devices;
       devices = d;
     }
@@ -550,6 +558,139 @@ grub_efidisk_read (struct grub_disk *disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
+/* Queue the pieces on the Block I/O 2 interface, keeping up to
+   GRUB_EFIDISK_QUEUE_DEPTH of them in flight.  Piece I is read from
+   DISKS[I] if DISKS isn't NULL and from DISK otherwise.  Without DONE the
+   first error stops the submission; with it every piece is tried, the
+   ones of disks lacking Block I/O 2 synchronously, and DONE[I] is set for
+   each one which was read.  */
+static grub_err_t
+grub_efidisk_queue_reads (struct grub_disk **disks, struct grub_disk *disk,
+			  const struct grub_disk_vec *vec, grub_size_t n,
+			  char *done)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_block_io2_token_t tokens[GRUB_EFIDISK_QUEUE_DEPTH];
+  grub_size_t owner[GRUB_EFIDISK_QUEUE_DEPTH];
+  int busy[GRUB_EFIDISK_QUEUE_DEPTH];
+  grub_size_t next = 0;
+  grub_efi_status_t status;
+  unsigned i, slot, nslots = 0;
+
+  for (i = 0; i < GRUB_EFIDISK_QUEUE_DEPTH; i++)
+    {
+      busy[i] = 0;
+      status = efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK,
+			   NULL, NULL, &tokens[i].event);
+      if (status != GRUB_EFI_SUCCESS)
+	break;
+      nslots++;
+    }
+
+  if (!nslots)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, "couldn't create event");
+
+  for (slot = 0; ; slot = (slot + 1) % nslots)
+    {
+      if (busy[slot])
+	{
+	  grub_efi_uintn_t idx;
+	  struct grub_disk *pd = disks ? disks[owner[slot]] : disk;
+
+	  efi_call_3 (b->wait_for_event, 1, &tokens[slot].event, &idx);
+	  busy[slot] = 0;
+	  if (tokens[slot].transaction_status == GRUB_EFI_SUCCESS)
+	    {
+	      if (done)
+		done[owner[slot]] = 1;
+	    }
+	  else if (grub_errno == GRUB_ERR_NONE)
+	    grub_error (GRUB_ERR_READ_ERROR,
+			N_("failure reading sector 0x%llx from `%s'"),
+			(unsigned long long) vec[owner[slot]].sector,
+			pd->name);
+	}
+
+      if (next < n && (done || grub_errno == GRUB_ERR_NONE))
+	{
+	  struct grub_disk *pd = disks ? disks[next] : disk;
+	  struct grub_efidisk_data *d = pd->data;
+	  grub_efi_block_io2_t *bio2 = d->block_io2;
+
+	  if (! bio2)
+	    {
+	      if (grub_efidisk_read (pd, vec[next].sector, vec[next].size,
+				     vec[next].buf) == GRUB_ERR_NONE && done)
+		done[next] = 1;
+	      next++;
+	      continue;
+	    }
+
+	  grub_dprintf ("efidisk",
+			"queueing 0x%lx sectors at the sector 0x%llx from %s\n",
+			(unsigned long) vec[next].size,
+			(unsigned long long) vec[next].sector, pd->name);
+
+	  tokens[slot].transaction_status = GRUB_EFI_SUCCESS;
+	  status = efi_call_6 (bio2->read_blocks_ex, bio2,
+			       bio2->media->media_id,
+			       (grub_efi_uint64_t) vec[next].sector,
+			       &tokens[slot],
+			       (grub_efi_uintn_t) vec[next].size
+			       << pd->log_sector_size,
+			       vec[next].buf);
+	  if (status != GRUB_EFI_SUCCESS)
+	    grub_error (GRUB_ERR_READ_ERROR,
+			N_("failure reading sector 0x%llx from `%s'"),
+			(unsigned long long) vec[next].sector, pd->name);
+	  else
+	    {
+	      busy[slot] = 1;
+	      owner[slot] = next;
+	    }
+	  next++;
+	  continue;
+	}
+
+      /* Nothing left to submit, stop once every slot has drained.  */
+      for (i = 0; i < nslots; i++)
+	if (busy[i])
+	  break;
+      if (i == nslots)
+	break;
+    }
+
+  for (i = 0; i < nslots; i++)
+    efi_call_1 (b->close_event, tokens[i].event);
+
+  return grub_errno;
+}
+
+static grub_err_t
+grub_efidisk_read_vec (struct grub_disk *disk,
+		       const struct grub_disk_vec *vec, grub_size_t n)
+{
+  struct grub_efidisk_data *d = disk->data;
+  grub_size_t i;
+
+  if (d->block_io2 && n > 1)
+    return grub_efidisk_queue_reads (NULL, disk, vec, n, NULL);
+
+  for (i = 0; i < n; i++)
+    if (grub_efidisk_read (disk, vec[i].sector, vec[i].size, vec[i].buf))
+      return grub_errno;
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_efidisk_read_multi (struct grub_disk **disks,
+			 const struct grub_disk_vec *vec, grub_size_t n,
+			 char *done)
+{
+  return grub_efidisk_queue_reads (disks, NULL, vec, n, done);
+}
+
 static grub_err_t
 grub_efidisk_write (struct grub_disk *disk, grub_disk_addr_t sector,
 		    grub_size_t size, const char *buf)
@@ -579,6 +720,8 @@ static struct grub_disk_dev grub_efidisk_dev =
     .close = grub_efidisk_close,
     .read = grub_efidisk_read,
     .write = grub_efidisk_write,
+    .read_vec = grub_efidisk_read_vec,
+    .read_multi = grub_efidisk_read_multi,
     .next = 0
   };
 
@@ -31,9 +31,46 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* For readability.  */
+#define GRUB_BIOSDISK_READ	0
+#define GRUB_BIOSDISK_WRITE	1
+
 static int cd_drive = 0;
 static int grub_biosdisk_rw_int13_extensions (int ah, int drive, void *dap);
 
+/* Set in the interface support bitmap of int 13 %ah=0x41 when the 64-bit
+   flat buffer address of EDD 3.0 is supported.  */
+#define GRUB_BIOSDISK_EXT_64BIT	8
+
+/* Sectors tried at once when probing for large transfers, 1MiB worth of
+   512-byte sectors.  */
+#define GRUB_BIOSDISK_LARGE_SECTORS	0x800
+
+/* What EDD 3.0 transfers are known to break on drives of an interface
+   type, as the Device Path Information names it.  */
+#define GRUB_BIOSDISK_QUIRK_NO_FLAT	1
+#define GRUB_BIOSDISK_QUIRK_SMALL	2
+
+static const struct
+{
+  const char *interface;
+  unsigned quirks;
+} grub_biosdisk_quirks[] =
+  {
+    /* BIOS USB emulation is where claimed 64-bit support and large
+       transfers are least trustworthy, and a failed probe can hang.  */
+    { "USB", GRUB_BIOSDISK_QUIRK_NO_FLAT | GRUB_BIOSDISK_QUIRK_SMALL }
+  };
+
+/* What probing found for each BIOS drive, as it doesn't change until the
+   next boot.  */
+static struct
+{
+  grub_uint8_t probed;
+  grub_uint8_t flat;
+  grub_uint16_t max_sectors;
+} edd_probe[256];
+
 static int grub_biosdisk_get_num_floppies (void)
 {
   struct grub_bios_int_registers regs;
@@ -144,7 +181,7 @@ grub_biosdisk_rw_standard (int ah, int drive, int coff, int hoff,
  *   the major version of extensions, otherwise zero.
  */
 static int
-grub_biosdisk_check_int13_extensions (int drive)
+grub_biosdisk_check_int13_extensions (int drive, unsigned *support)
 {
   struct grub_bios_int_registers regs;
 
@@ -164,6 +201,7 @@ grub_biosdisk_check_int13_extensions (int drive)
   if (!(regs.ecx & 1))
     return 0;
 
+  *support = regs.ecx & 0xffff;
   return (regs.eax >> 8) & 0xff;
 }
 
@@ -329,12 +367,112 @@ grub_biosdisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
   return 0;
 }
 
+/* Transfer SIZE sectors at SECTOR of DRIVE straight to or from BUF
+   through its 64-bit flat address.  Return non-zero on error.  */
+static int
+grub_biosdisk_rw_flat (int cmd, int drive, grub_disk_addr_t sector,
+		       grub_size_t size, void *buf)
+{
+  struct grub_biosdisk_dap *dap
+    = (struct grub_biosdisk_dap *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
+
+  dap->length = sizeof (*dap);
+  dap->reserved = 0;
+  dap->blocks = size;
+  dap->buffer = 0xffffffff;
+  dap->block = sector;
+  dap->flat_buffer = (grub_addr_t) buf;
+  return grub_biosdisk_rw_int13_extensions (cmd + 0x42, drive, dap);
+}
+
+/* Check that sector SECTOR of DRIVE, read the usual way through the
+   scratch area, is what EXPECTED holds.  */
+static int
+grub_biosdisk_probe_match (int drive, grub_disk_addr_t sector,
+			   grub_size_t sector_size, const void *expected)
+{
+  struct grub_biosdisk_dap *dap
+    = (struct grub_biosdisk_dap *) (GRUB_MEMORY_MACHINE_SCRATCH_ADDR
+				    + sector_size);
+
+  dap->length = GRUB_BIOSDISK_DAP_SIZE;
+  dap->reserved = 0;
+  dap->blocks = 1;
+  dap->buffer = GRUB_MEMORY_MACHINE_SCRATCH_SEG << 16;
+  dap->block = sector;
+  if (grub_biosdisk_rw_int13_extensions (0x42, drive, dap))
+    return 0;
+  return grub_memcmp ((void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR, expected,
+		      sector_size) == 0;
+}
+
+/* Find out once per drive whether reads through flat addresses work,
+   first with large transfers and then with the 127 sectors Phoenix EDD
+   is limited to.  Each try is checked against the usual reads of its
+   first and last sector.  */
+static void
+grub_biosdisk_probe_edd (grub_disk_t disk, struct grub_biosdisk_data *data,
+			 unsigned quirks)
+{
+  grub_size_t sector_size = (grub_size_t) 1 << disk->log_sector_size;
+  grub_size_t n;
+  grub_uint8_t *buf;
+
+  if (!edd_probe[data->drive & 0xff].probed)
+    {
+      edd_probe[data->drive & 0xff].probed = 1;
+
+      n = GRUB_BIOSDISK_LARGE_SECTORS >> (disk->log_sector_size
+					  - GRUB_DISK_SECTOR_BITS);
+      if ((quirks & GRUB_BIOSDISK_QUIRK_SMALL) || n < 0x7f)
+	n = 0x7f;
+      if ((quirks & GRUB_BIOSDISK_QUIRK_NO_FLAT) || disk->total_sectors < n)
+	return;
+
+      buf = grub_malloc (n * sector_size);
+      if (!buf)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      while (1)
+	{
+	  grub_memset (buf, 0xa5, n * sector_size);
+	  if (!grub_biosdisk_rw_flat (GRUB_BIOSDISK_READ, data->drive, 0, n, buf)
+	      && grub_biosdisk_probe_match (data->drive, 0, sector_size, buf)
+	      && grub_biosdisk_probe_match (data->drive, n - 1, sector_size,
+					    buf + (n - 1) * sector_size))
+	    {
+	      edd_probe[data->drive & 0xff].flat = 1;
+	      edd_probe[data->drive & 0xff].max_sectors = n;
+	      break;
+	    }
+	  if (n == 0x7f)
+	    break;
+	  n = 0x7f;
+	}
+      grub_free (buf);
+      grub_dprintf ("biosdisk", "drive 0x%x: flat transfers %s, %u sectors\n",
+		    data->drive,
+		    edd_probe[data->drive & 0xff].flat ? "work" : "don't work",
+		    edd_probe[data->drive & 0xff].max_sectors);
+    }
+
+  if (edd_probe[data->drive & 0xff].flat)
+    {
+      data->flags |= GRUB_BIOSDISK_FLAG_FLAT;
+      data->max_sectors = edd_probe[data->drive & 0xff].max_sectors;
+    }
+}
+
 static grub_err_t
 grub_biosdisk_open (const char *name, grub_disk_t disk)
 {
   grub_uint64_t total_sectors = 0;
   int drive;
   struct grub_biosdisk_data *data;
+  unsigned support = 0, quirks = 0;
+  int edd3 = 0;
 
   drive = grub_biosdisk_get_drive (name);
   if (drive < 0)
@@ -363,7 +501,7 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
 
       disk->log_sector_size = 9;
 
-      version = grub_biosdisk_check_int13_extensions (drive);
+      version = grub_biosdisk_check_int13_extensions (drive, &support);
       if (version)
 	{
 	  struct grub_biosdisk_drp *drp
@@ -376,6 +514,19 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
 	    {
 	      data->flags = GRUB_BIOSDISK_FLAG_LBA;
 
+	      if (version >= 0x30 && (support & GRUB_BIOSDISK_EXT_64BIT))
+		{
+		  unsigned i;
+
+		  edd3 = 1;
+		  for (i = 0; i < ARRAY_SIZE (grub_biosdisk_quirks); i++)
+		    if (drp->signature_dpi == 0xbedd
+			&& grub_memcmp (drp->name_of_interface_type,
+					grub_biosdisk_quirks[i].interface,
+					grub_strlen (grub_biosdisk_quirks[i].interface)) == 0)
+		      quirks |= grub_biosdisk_quirks[i].quirks;
+		}
+
 	      if (drp->total_sectors)
 		total_sectors = drp->total_sectors;
 	      else
@@ -438,6 +589,20 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
 		       + sizeof (struct grub_biosdisk_dap)
 		       < GRUB_MEMORY_MACHINE_SCRATCH_SIZE);
 
+  /* Without the bounce through the scratch area, only what the BIOS
+     handles limits transfers.  */
+  if (edd3)
+    grub_biosdisk_probe_edd (disk, data, quirks);
+  if (data->flags & GRUB_BIOSDISK_FLAG_FLAT)
+    {
+      disk->max_agglomerate = ((grub_size_t) data->max_sectors
+			       << (disk->log_sector_size
+				   - GRUB_DISK_SECTOR_BITS))
+	>> GRUB_DISK_CACHE_BITS;
+      if (disk->max_agglomerate > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+	disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+    }
+
   disk->data = data;
 
   return GRUB_ERR_NONE;
@@ -449,10 +614,6 @@ grub_biosdisk_close (grub_disk_t disk)
   grub_free (disk->data);
 }
 
-/* For readability.  */
-#define GRUB_BIOSDISK_READ	0
-#define GRUB_BIOSDISK_WRITE	1
-
 #define GRUB_BIOSDISK_CDROM_RETRY_COUNT 3
 
 static grub_err_t
@@ -477,7 +638,7 @@ grub_biosdisk_rw (int cmd, grub_disk_t disk,
       dap = (struct grub_biosdisk_dap *) (GRUB_MEMORY_MACHINE_SCRATCH_ADDR
 					  + (data->sectors
 					     << disk->log_sector_size));
-      dap->length = sizeof (*dap);
+      dap->length = GRUB_BIOSDISK_DAP_SIZE;
       dap->reserved = 0;
       dap->blocks = size;
       dap->buffer = segment << 16;	/* The format SEGMENT:ADDRESS.  */
@@ -573,10 +734,44 @@ get_safe_sectors (grub_disk_t disk, grub_disk_addr_t sector)
   return size;
 }
 
+/* Transfer as much as possible of SIZE sectors at *SECTOR straight to or
+   from *BUF, advancing the three.  If the BIOS fails, go back to the
+   scratch area for good.  */
+static void
+grub_biosdisk_rw_direct (int cmd, grub_disk_t disk, grub_disk_addr_t *sector,
+			 grub_size_t *size, char **buf)
+{
+  struct grub_biosdisk_data *data = disk->data;
+
+  if (!(data->flags & GRUB_BIOSDISK_FLAG_FLAT))
+    return;
+
+  while (*size)
+    {
+      grub_size_t len = *size;
+
+      if (len > data->max_sectors)
+	len = data->max_sectors;
+      if (grub_biosdisk_rw_flat (cmd, data->drive, *sector, len, *buf))
+	{
+	  grub_dprintf ("biosdisk", "flat transfer failed on drive 0x%x\n",
+			data->drive);
+	  data->flags &= ~GRUB_BIOSDISK_FLAG_FLAT;
+	  edd_probe[data->drive & 0xff].flat = 0;
+	  return;
+	}
+      *buf += len << disk->log_sector_size;
+      *sector += len;
+      *size -= len;
+    }
+}
+
 static grub_err_t
 grub_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
+  grub_biosdisk_rw_direct (GRUB_BIOSDISK_READ, disk, &sector, &size, &buf);
+
   while (size)
     {
       grub_size_t len;
@@ -610,6 +805,9 @@ grub_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
   if (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
     return grub_error (GRUB_ERR_IO, N_("cannot write to CD-ROM"));
 
+  grub_biosdisk_rw_direct (GRUB_BIOSDISK_WRITE, disk, &sector, &size,
+			   (char **) &buf);
+
   while (size)
     {
       grub_size_t len;
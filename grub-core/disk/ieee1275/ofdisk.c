@@ -25,8 +25,11 @@
 #include <grub/i18n.h>
 #include <grub/time.h>
 
-static char *last_devpath;
-static grub_ieee1275_ihandle_t last_ihandle;
+/* Opening an instance is slow on some firmware, so instances are kept
+   open, up to OFDISK_MAX_OPEN of them, until GRUB exits.  */
+#define OFDISK_MAX_OPEN	8
+static unsigned ofdisk_nopen;
+static unsigned long ofdisk_use;
 
 struct ofdisk_hash_ent
 {
@@ -36,6 +39,12 @@ struct ofdisk_hash_ent
   int is_boot;
   int is_removable;
   int block_size_fails;
+  grub_uint32_t block_size;
+  /* Largest read or write of the device in bytes, 0 if unknown.  */
+  grub_uint32_t max_transfer;
+  int max_transfer_known;
+  grub_ieee1275_ihandle_t ihandle;
+  unsigned long last_use;
   /* Pointer to shortest available name on nodes representing canonical names,
      otherwise NULL.  */
   const char *shortest;
@@ -47,6 +56,9 @@ static grub_err_t
 grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
 			    struct ofdisk_hash_ent *op);
 
+static grub_ieee1275_ihandle_t
+ofdisk_get_ihandle (struct ofdisk_hash_ent *op);
+
 #define OFDISK_HASH_SZ	8
 static struct ofdisk_hash_ent *ofdisk_hash[OFDISK_HASH_SZ];
 
@@ -427,9 +439,9 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
     if (!op)
       return grub_errno;
     disk->id = (unsigned long) op;
-    disk->data = op->open_path;
+    disk->data = op;
 
-    err = grub_ofdisk_get_block_size (devpath, &block_size, op);
+    err = grub_ofdisk_get_block_size (op->devpath, &block_size, op);
     if (err)
       return err;
     if (block_size != 0)
@@ -440,6 +452,20 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
       }
     else
       disk->log_sector_size = 9;
+
+    if (!ofdisk_get_ihandle (op))
+      return grub_errno;
+    if (op->max_transfer > (1U << (GRUB_DISK_CACHE_BITS
+				   + GRUB_DISK_SECTOR_BITS)))
+      {
+	unsigned max = op->max_transfer >> (GRUB_DISK_CACHE_BITS
+					    + GRUB_DISK_SECTOR_BITS);
+
+	if (max > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+	  max = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+	if (max > disk->max_agglomerate)
+	  disk->max_agglomerate = max;
+      }
   }
 
   return 0;
@@ -448,38 +474,88 @@ grub_ofdisk_open (const char *name, grub_disk_t disk)
 static void
 grub_ofdisk_close (grub_disk_t disk)
 {
-  if (disk->data == last_devpath)
+  disk->data = 0;
+}
+
+/* Ask the instance of OP for the largest transfer it supports.  */
+static void
+ofdisk_get_max_transfer (struct ofdisk_hash_ent *op)
+{
+  struct max_transfer_args
+  {
+    struct grub_ieee1275_common_hdr common;
+    grub_ieee1275_cell_t method;
+    grub_ieee1275_cell_t ihandle;
+    grub_ieee1275_cell_t catch_result;
+    grub_ieee1275_cell_t size;
+  }
+  args;
+
+  op->max_transfer_known = 1;
+  op->max_transfer = 0;
+
+  INIT_IEEE1275_COMMON (&args.common, "call-method", 2, 2);
+  args.method = (grub_ieee1275_cell_t) "max-transfer";
+  args.ihandle = op->ihandle;
+  args.catch_result = 1;
+
+  if (IEEE1275_CALL_ENTRY_FN (&args) == -1 || args.catch_result)
+    return;
+  if (args.size >= 512)
+    op->max_transfer = (args.size < 0x80000000) ? args.size : 0x80000000;
+  grub_dprintf ("disk", "%s: max-transfer %u\n", op->devpath,
+		(unsigned) op->max_transfer);
+}
+
+static grub_ieee1275_ihandle_t
+ofdisk_get_ihandle (struct ofdisk_hash_ent *op)
+{
+  if (!op->ihandle)
     {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
+      if (ofdisk_nopen >= OFDISK_MAX_OPEN)
+	{
+	  struct ofdisk_hash_ent *p, *lru = NULL;
+	  unsigned i;
+
+	  for (i = 0; i < OFDISK_HASH_SZ; i++)
+	    for (p = ofdisk_hash[i]; p; p = p->next)
+	      if (p->ihandle && (!lru || p->last_use < lru->last_use))
+		lru = p;
+	  if (lru)
+	    {
+	      grub_ieee1275_close (lru->ihandle);
+	      lru->ihandle = 0;
+	      ofdisk_nopen--;
+	    }
+	}
+
+      grub_ieee1275_open (op->open_path, &op->ihandle);
+      if (! op->ihandle)
+	{
+	  grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
+	  return 0;
+	}
+      ofdisk_nopen++;
+      if (!op->max_transfer_known)
+	ofdisk_get_max_transfer (op);
     }
-  disk->data = 0;
+  op->last_use = ++ofdisk_use;
+  return op->ihandle;
 }
 
 static grub_err_t
 grub_ofdisk_prepare (grub_disk_t disk, grub_disk_addr_t sector)
 {
+  struct ofdisk_hash_ent *op = disk->data;
   grub_ssize_t status;
   unsigned long long pos;
 
-  if (disk->data != last_devpath)
-    {
-      if (last_ihandle)
-	grub_ieee1275_close (last_ihandle);
-      last_ihandle = 0;
-      last_devpath = NULL;
-
-      grub_ieee1275_open (disk->data, &last_ihandle);
-      if (! last_ihandle)
-	return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
-      last_devpath = disk->data;      
-    }
+  if (!ofdisk_get_ihandle (op))
+    return grub_errno;
 
   pos = sector << disk->log_sector_size;
 
-  grub_ieee1275_seek (last_ihandle, pos, &status);
+  grub_ieee1275_seek (op->ihandle, pos, &status);
   if (status < 0)
     return grub_error (GRUB_ERR_READ_ERROR,
 		       "seek error, can't seek block %llu",
@@ -487,22 +563,44 @@ grub_ofdisk_prepare (grub_disk_t disk, grub_disk_addr_t sector)
   return 0;
 }
 
+/* Bytes of LEN the device takes in one call.  */
+static grub_size_t
+ofdisk_chunk (grub_disk_t disk, grub_size_t len)
+{
+  struct ofdisk_hash_ent *op = disk->data;
+  grub_size_t max;
+
+  max = op->max_transfer & ~((1U << disk->log_sector_size) - 1);
+  if (max && len > max)
+    return max;
+  return len;
+}
+
 static grub_err_t
 grub_ofdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		  grub_size_t size, char *buf)
 {
+  struct ofdisk_hash_ent *op = disk->data;
+  grub_size_t len = size << disk->log_sector_size;
   grub_err_t err;
   grub_ssize_t actual;
+
   err = grub_ofdisk_prepare (disk, sector);
   if (err)
     return err;
-  grub_ieee1275_read (last_ihandle, buf, size  << disk->log_sector_size,
-		      &actual);
-  if (actual != (grub_ssize_t) (size  << disk->log_sector_size))
-    return grub_error (GRUB_ERR_READ_ERROR, N_("failure reading sector 0x%llx "
-					       "from `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+  while (len)
+    {
+      grub_size_t chunk = ofdisk_chunk (disk, len);
+
+      grub_ieee1275_read (op->ihandle, buf, chunk, &actual);
+      if (actual != (grub_ssize_t) chunk)
+	return grub_error (GRUB_ERR_READ_ERROR, N_("failure reading sector 0x%llx "
+						   "from `%s'"),
+			   (unsigned long long) sector,
+			   disk->name);
+      buf += chunk;
+      len -= chunk;
+    }
 
   return 0;
 }
@@ -511,18 +609,27 @@ static grub_err_t
 grub_ofdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 		   grub_size_t size, const char *buf)
 {
+  struct ofdisk_hash_ent *op = disk->data;
+  grub_size_t len = size << disk->log_sector_size;
   grub_err_t err;
   grub_ssize_t actual;
+
   err = grub_ofdisk_prepare (disk, sector);
   if (err)
     return err;
-  grub_ieee1275_write (last_ihandle, buf, size  << disk->log_sector_size,
-		       &actual);
-  if (actual != (grub_ssize_t) (size << disk->log_sector_size))
-    return grub_error (GRUB_ERR_WRITE_ERROR, N_("failure writing sector 0x%llx "
-						"to `%s'"),
-		       (unsigned long long) sector,
-		       disk->name);
+  while (len)
+    {
+      grub_size_t chunk = ofdisk_chunk (disk, len);
+
+      grub_ieee1275_write (op->ihandle, buf, chunk, &actual);
+      if (actual != (grub_ssize_t) chunk)
+	return grub_error (GRUB_ERR_WRITE_ERROR, N_("failure writing sector 0x%llx "
+						    "to `%s'"),
+			   (unsigned long long) sector,
+			   disk->name);
+      buf += chunk;
+      len -= chunk;
+    }
 
   return 0;
 }
@@ -582,10 +689,17 @@ insert_bootpath (void)
 void
 grub_ofdisk_fini (void)
 {
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
-  last_ihandle = 0;
-  last_devpath = NULL;
+  struct ofdisk_hash_ent *p;
+  unsigned i;
+
+  for (i = 0; i < OFDISK_HASH_SZ; i++)
+    for (p = ofdisk_hash[i]; p; p = p->next)
+      if (p->ihandle)
+	{
+	  grub_ieee1275_close (p->ihandle);
+	  p->ihandle = 0;
+	}
+  ofdisk_nopen = 0;
 
   grub_disk_dev_unregister (&grub_ofdisk_dev);
 }
@@ -613,25 +727,20 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
       grub_ieee1275_cell_t size1;
       grub_ieee1275_cell_t size2;
     } args_ieee1275;
+  grub_ieee1275_ihandle_t ihandle;
 
-  if (last_ihandle)
-    grub_ieee1275_close (last_ihandle);
-
-  last_ihandle = 0;
-  last_devpath = NULL;
+  /* Asked once per device.  */
+  *block_size = op->block_size;
+  if (op->block_size || op->block_size_fails >= 2)
+    return GRUB_ERR_NONE;
 
-  grub_ieee1275_open (device, &last_ihandle);
-  if (! last_ihandle)
+  grub_ieee1275_open (device, &ihandle);
+  if (! ihandle)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
 
-  *block_size = 0;
-
-  if (op->block_size_fails >= 2)
-    return GRUB_ERR_NONE;
-
   INIT_IEEE1275_COMMON (&args_ieee1275.common, "call-method", 2, 2);
   args_ieee1275.method = (grub_ieee1275_cell_t) "block-size";
-  args_ieee1275.ihandle = last_ihandle;
+  args_ieee1275.ihandle = ihandle;
   args_ieee1275.result = 1;
 
   if (IEEE1275_CALL_ENTRY_FN (&args_ieee1275) == -1)
@@ -650,8 +759,10 @@ grub_ofdisk_get_block_size (const char *device, grub_uint32_t *block_size,
 	   && args_ieee1275.size1 >= 512 && args_ieee1275.size1 <= 16384)
     {
       op->block_size_fails = 0;
+      op->block_size = args_ieee1275.size1;
       *block_size = args_ieee1275.size1;
     }
 
+  grub_ieee1275_close (ihandle);
   return 0;
 }
@@ -24,15 +24,32 @@
 #include <grub/mm.h>
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* COUNT sectors of the file from SECTOR on are stored from DISK_SECTOR
+   on in the partition the file is on.  */
+struct grub_loopback_extent
+{
+  grub_disk_addr_t sector;
+  grub_disk_addr_t disk_sector;
+  grub_disk_addr_t count;
+};
+
 struct grub_loopback
 {
   char *devname;
   grub_file_t file;
   struct grub_loopback *next;
   unsigned long id;
+
+  /* Where the parts of the file read so far are on the disk below, so
+     that reading them again bypasses the filesystem.  Sorted by
+     SECTOR.  */
+  struct grub_loopback_extent *extents;
+  grub_size_t nextents;
+  grub_size_t extents_alloc;
 };
 
 static struct grub_loopback *loopback_list;
@@ -68,6 +85,7 @@ delete_loopback (const char *name)
 
   grub_free (dev->devname);
   grub_file_close (dev->file);
+  grub_free (dev->extents);
   grub_free (dev);
 
   return 0;
@@ -105,6 +123,10 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
     {
       grub_file_close (newdev->file);
       newdev->file = file;
+      grub_free (newdev->extents);
+      newdev->extents = NULL;
+      newdev->nextents = 0;
+      newdev->extents_alloc = 0;
 
       return 0;
     }
@@ -123,6 +145,9 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
 
   newdev->file = file;
   newdev->id = last_id++;
+  newdev->extents = NULL;
+  newdev->nextents = 0;
+  newdev->extents_alloc = 0;
 
   /* Add the new entry to the list.  */
   newdev->next = loopback_list;
@@ -181,16 +206,229 @@ grub_loopback_open (const char *name, grub_disk_t disk)
   return 0;
 }
 
+/* Return the first extent that ends after SECTOR.  */
+static grub_size_t
+extent_find (struct grub_loopback *dev, grub_disk_addr_t sector)
+{
+  grub_size_t lo = 0, hi = dev->nextents, mid;
+
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (dev->extents[mid].sector + dev->extents[mid].count <= sector)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Record that COUNT sectors of the file from SECTOR on are at DISK_SECTOR,
+   merging with the extents around.  Failing to is not an error.  */
+static void
+extent_add (struct grub_loopback *dev, grub_disk_addr_t sector,
+	    grub_disk_addr_t disk_sector, grub_disk_addr_t count)
+{
+  struct grub_loopback_extent *e;
+  grub_size_t i;
+
+  i = extent_find (dev, sector);
+  /* Already known, as reads of the same sectors repeat.  */
+  if (i < dev->nextents && dev->extents[i].sector <= sector)
+    return;
+  if (i < dev->nextents && dev->extents[i].sector < sector + count)
+    return;
+
+  if (i > 0)
+    {
+      e = &dev->extents[i - 1];
+      if (e->sector + e->count == sector
+	  && e->disk_sector + e->count == disk_sector)
+	{
+	  e->count += count;
+	  if (i < dev->nextents
+	      && dev->extents[i].sector == e->sector + e->count
+	      && dev->extents[i].disk_sector == e->disk_sector + e->count)
+	    {
+	      e->count += dev->extents[i].count;
+	      grub_memmove (&dev->extents[i], &dev->extents[i + 1],
+			    (dev->nextents - i - 1) * sizeof (*e));
+	      dev->nextents--;
+	    }
+	  return;
+	}
+    }
+  if (i < dev->nextents
+      && dev->extents[i].sector == sector + count
+      && dev->extents[i].disk_sector == disk_sector + count)
+    {
+      dev->extents[i].sector = sector;
+      dev->extents[i].disk_sector = disk_sector;
+      dev->extents[i].count += count;
+      return;
+    }
+
+  if (dev->nextents == dev->extents_alloc)
+    {
+      grub_size_t alloc = dev->extents_alloc ? 2 * dev->extents_alloc : 16;
+
+      e = grub_realloc (dev->extents, alloc * sizeof (*e));
+      if (!e)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      dev->extents = e;
+      dev->extents_alloc = alloc;
+    }
+  grub_memmove (&dev->extents[i + 1], &dev->extents[i],
+		(dev->nextents - i) * sizeof (*e));
+  dev->extents[i].sector = sector;
+  dev->extents[i].disk_sector = disk_sector;
+  dev->extents[i].count = count;
+  dev->nextents++;
+}
+
+/* Read SIZE sectors at SECTOR straight from the disk below if the extents
+   known cover all of them.  */
+static int
+read_passthrough (struct grub_loopback *dev, grub_disk_addr_t sector,
+		  grub_size_t size, char *buf)
+{
+  grub_disk_t under = dev->file->device->disk;
+  grub_disk_addr_t s;
+  grub_size_t i;
+  int streaming;
+
+  for (i = extent_find (dev, sector), s = sector; s < sector + size; i++)
+    {
+      if (i >= dev->nextents || dev->extents[i].sector > s)
+	return 0;
+      s = dev->extents[i].sector + dev->extents[i].count;
+    }
+
+  /* The loop disk caches the data already.  */
+  streaming = under->streaming;
+  under->streaming = 1;
+  for (i = extent_find (dev, sector); size; i++)
+    {
+      struct grub_loopback_extent *e = &dev->extents[i];
+      grub_disk_addr_t n = e->sector + e->count - sector;
+
+      if (n > size)
+	n = size;
+      if (grub_disk_read (under, e->disk_sector + (sector - e->sector), 0,
+			  n << GRUB_DISK_SECTOR_BITS, buf))
+	break;
+      sector += n;
+      size -= n;
+      buf += n << GRUB_DISK_SECTOR_BITS;
+    }
+  under->streaming = streaming;
+  return 1;
+}
+
+/* Context for record_extent.  */
+struct record_extent_ctx
+{
+  grub_disk_addr_t part_start;
+  /* The pieces read, in order.  */
+  struct grub_loopback_extent *pieces;
+  grub_size_t npieces;
+  grub_size_t pieces_alloc;
+  /* The file sector the next piece read holds.  */
+  grub_disk_addr_t sector;
+  /* Cleared when the file's data doesn't come from whole sectors read
+     in order, such as for compressed files.  */
+  int usable;
+};
+
+/* Read hook remembering where the file is on disk.  */
+static void
+record_extent (grub_disk_addr_t sector, unsigned offset, unsigned length,
+	       void *data)
+{
+  struct record_extent_ctx *ctx = data;
+  struct grub_loopback_extent *p;
+  grub_disk_addr_t count = length >> GRUB_DISK_SECTOR_BITS;
+
+  if (!ctx->usable)
+    return;
+  if (offset != 0 || (length & (GRUB_DISK_SECTOR_SIZE - 1))
+      || sector < ctx->part_start)
+    {
+      ctx->usable = 0;
+      return;
+    }
+  sector -= ctx->part_start;
+
+  p = ctx->npieces ? &ctx->pieces[ctx->npieces - 1] : NULL;
+  if (p && p->disk_sector + p->count == sector)
+    p->count += count;
+  else
+    {
+      if (ctx->npieces == ctx->pieces_alloc)
+	{
+	  grub_size_t alloc = ctx->pieces_alloc ? 2 * ctx->pieces_alloc : 8;
+
+	  p = grub_realloc (ctx->pieces, alloc * sizeof (*p));
+	  if (!p)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      ctx->usable = 0;
+	      return;
+	    }
+	  ctx->pieces = p;
+	  ctx->pieces_alloc = alloc;
+	}
+      p = &ctx->pieces[ctx->npieces++];
+      p->sector = ctx->sector;
+      p->disk_sector = sector;
+      p->count = count;
+    }
+  ctx->sector += count;
+}
+
 static grub_err_t
 grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_file_t file = ((struct grub_loopback *) disk->data)->file;
+  struct grub_loopback *dev = disk->data;
+  grub_file_t file = dev->file;
   grub_off_t pos;
+  grub_ssize_t res;
+  grub_size_t i;
+  struct record_extent_ctx ctx = {
+    .sector = sector,
+    .usable = 0
+  };
+
+  /* Sectors read before are taken from the disk below, skipping the
+     filesystem and the copy its disk would cache.  */
+  if (file->device && file->device->disk)
+    {
+      if (read_passthrough (dev, sector, size, buf))
+	return grub_errno;
+      ctx.part_start = grub_partition_get_start (file->device->disk->partition);
+      ctx.usable = 1;
+      file->read_hook = record_extent;
+      file->read_hook_data = &ctx;
+    }
 
   grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
 
-  grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
+  res = grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
+  file->read_hook = 0;
+  file->read_hook_data = 0;
+
+  /* Holes and partial sectors leave the pieces short.  */
+  if (ctx.usable && !grub_errno
+      && res == (grub_ssize_t) (size << GRUB_DISK_SECTOR_BITS)
+      && ctx.sector == sector + size)
+    for (i = 0; i < ctx.npieces; i++)
+      extent_add (dev, ctx.pieces[i].sector, ctx.pieces[i].disk_sector,
+		  ctx.pieces[i].count);
+  grub_free (ctx.pieces);
   if (grub_errno)
     return grub_errno;
 
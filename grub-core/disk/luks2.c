@@ -0,0 +1,877 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/cryptodisk.h>
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/dl.h>
+#include <grub/err.h>
+#include <grub/disk.h>
+#include <grub/crypto.h>
+#include <grub/partition.h>
+#include <grub/json.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define MAX_PASSPHRASE 256
+
+#define LUKS_MAGIC_1ST "LUKS\xBA\xBE"
+#define LUKS_MAGIC_2ND "SKUL\xBA\xBE"
+
+/* Keyslot priorities as cryptsetup defines them.  0 means the slot is only
+   used when asked for explicitly, which GRUB has no way to do.  */
+#define LUKS2_PRIORITY_IGNORE	0
+#define LUKS2_PRIORITY_NORMAL	1
+#define LUKS2_PRIORITY_HIGH	2
+
+#define LUKS2_MAX_KEYSLOTS_SIZE	(128ULL * 1024 * 1024)
+
+gcry_err_code_t AF_merge (const gcry_md_spec_t * hash, grub_uint8_t * src,
+			  grub_uint8_t * dst, grub_size_t blocksize,
+			  grub_size_t blocknumbers);
+
+/* On disk binary header, followed by the JSON area up to hdr_size.  Both
+   copies of the metadata start with one.  */
+struct grub_luks2_header
+{
+  char magic[6];
+  grub_uint16_t version;
+  grub_uint64_t hdr_size;
+  grub_uint64_t seqid;
+  char label[48];
+  char csum_alg[32];
+  grub_uint8_t salt[64];
+  char uuid[40];
+  char subsystem[48];
+  grub_uint64_t hdr_offset;
+  char _padding[184];
+  grub_uint8_t csum[64];
+  char _padding4096[7 * 512];
+} GRUB_PACKED;
+typedef struct grub_luks2_header grub_luks2_header_t;
+
+enum grub_luks2_kdf_type
+{
+  LUKS2_KDF_TYPE_PBKDF2,
+  LUKS2_KDF_TYPE_ARGON2
+};
+
+struct grub_luks2_keyslot
+{
+  grub_uint64_t id;
+  grub_int64_t key_size;
+  grub_int64_t priority;
+  /* Whether a token, i.e. some other unlocking method than a passphrase,
+     refers to the slot.  */
+  int has_token;
+  struct
+  {
+    const char *encryption;
+    grub_uint64_t offset;
+    grub_uint64_t size;
+    grub_int64_t key_size;
+  } area;
+  struct
+  {
+    const char *hash;
+    grub_int64_t stripes;
+  } af;
+  struct
+  {
+    enum grub_luks2_kdf_type type;
+    const char *salt;
+    const char *hash;
+    grub_int64_t iterations;
+  } kdf;
+};
+typedef struct grub_luks2_keyslot grub_luks2_keyslot_t;
+
+struct grub_luks2_segment
+{
+  grub_uint64_t offset;
+  const char *size;
+  const char *encryption;
+  grub_int64_t sector_size;
+};
+typedef struct grub_luks2_segment grub_luks2_segment_t;
+
+struct grub_luks2_digest
+{
+  /* Both of these are bitmaps of the ids of the slots and segments the
+     digest covers.  */
+  grub_uint64_t keyslots;
+  grub_uint64_t segments;
+  const char *salt;
+  const char *digest;
+  const char *hash;
+  grub_int64_t iterations;
+};
+typedef struct grub_luks2_digest grub_luks2_digest_t;
+
+static const grub_int8_t base64_values[128] =
+  {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1
+  };
+
+/* Decode the base64 string IN into at most OUTSIZE bytes at OUT.  */
+static grub_err_t
+base64_decode (const char *in, grub_uint8_t *out, grub_size_t outsize,
+	       grub_size_t *outlen)
+{
+  grub_uint32_t acc = 0;
+  grub_size_t len = 0;
+  int bits = 0;
+
+  for (; *in && *in != '='; in++)
+    {
+      grub_uint8_t c = *in;
+
+      if (c == '\n' || c == '\r')
+	continue;
+      if (c >= 128 || base64_values[c] < 0)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid base64 data");
+      acc = (acc << 6) | base64_values[c];
+      bits += 6;
+      if (bits >= 8)
+	{
+	  bits -= 8;
+	  if (len == outsize)
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT, "base64 data too long");
+	  out[len++] = acc >> bits;
+	}
+    }
+  *outlen = len;
+  return GRUB_ERR_NONE;
+}
+
+/* Set the bits of the ids listed in the array of strings JSON in *BITS.  */
+static grub_err_t
+luks2_parse_idlist (grub_uint64_t *bits, const grub_json_t *json)
+{
+  grub_size_t i, size;
+  grub_json_t child;
+
+  if (grub_json_gettype (json) != GRUB_JSON_ARRAY
+      || grub_json_getsize (&size, json))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid id list");
+
+  *bits = 0;
+  for (i = 0; i < size; i++)
+    {
+      grub_uint64_t id;
+
+      if (grub_json_getchild (&child, json, i)
+	  || grub_json_getuint64 (&id, &child, NULL))
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid id list");
+      if (id < 64)
+	*bits |= 1ULL << id;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+luks2_parse_keyslot (grub_luks2_keyslot_t *out, const grub_json_t *keyslot)
+{
+  grub_json_t area, af, kdf;
+  const char *type;
+
+  if (grub_json_getstring (&type, keyslot, "type"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing or invalid keyslot");
+  else if (grub_strcmp (type, "luks2"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unsupported keyslot type %s",
+		       type);
+  else if (grub_json_getint64 (&out->key_size, keyslot, "key_size"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing keyslot information");
+  if (grub_json_getint64 (&out->priority, keyslot, "priority"))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      out->priority = LUKS2_PRIORITY_NORMAL;
+    }
+
+  if (grub_json_getvalue (&area, keyslot, "area")
+      || grub_json_getstring (&type, &area, "type"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing or invalid key area");
+  else if (grub_strcmp (type, "raw"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unsupported key area type: %s",
+		       type);
+  else if (grub_json_getuint64 (&out->area.offset, &area, "offset")
+	   || grub_json_getuint64 (&out->area.size, &area, "size")
+	   || grub_json_getstring (&out->area.encryption, &area, "encryption")
+	   || grub_json_getint64 (&out->area.key_size, &area, "key_size"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing key area information");
+
+  if (grub_json_getvalue (&kdf, keyslot, "kdf")
+      || grub_json_getstring (&type, &kdf, "type")
+      || grub_json_getstring (&out->kdf.salt, &kdf, "salt"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing or invalid KDF");
+  else if (!grub_strcmp (type, "argon2i") || !grub_strcmp (type, "argon2id"))
+    out->kdf.type = LUKS2_KDF_TYPE_ARGON2;
+  else if (!grub_strcmp (type, "pbkdf2"))
+    {
+      out->kdf.type = LUKS2_KDF_TYPE_PBKDF2;
+      if (grub_json_getstring (&out->kdf.hash, &kdf, "hash")
+	  || grub_json_getint64 (&out->kdf.iterations, &kdf, "iterations"))
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing PBKDF2 parameters");
+    }
+  else
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unsupported KDF type %s", type);
+
+  if (grub_json_getvalue (&af, keyslot, "af")
+      || grub_json_getstring (&type, &af, "type"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing or invalid AF");
+  else if (grub_strcmp (type, "luks1"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unsupported AF type %s", type);
+  else if (grub_json_getint64 (&out->af.stripes, &af, "stripes")
+	   || grub_json_getstring (&out->af.hash, &af, "hash"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing AF parameters");
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+luks2_parse_segment (grub_luks2_segment_t *out, const grub_json_t *segment)
+{
+  const char *type;
+
+  if (grub_json_getstring (&type, segment, "type"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid segment type");
+  else if (grub_strcmp (type, "crypt"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unsupported segment type %s",
+		       type);
+
+  if (grub_json_getuint64 (&out->offset, segment, "offset")
+      || grub_json_getstring (&out->size, segment, "size")
+      || grub_json_getstring (&out->encryption, segment, "encryption")
+      || grub_json_getint64 (&out->sector_size, segment, "sector_size"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing segment parameters");
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+luks2_parse_digest (grub_luks2_digest_t *out, const grub_json_t *digest)
+{
+  grub_json_t segments, keyslots;
+  const char *type;
+
+  if (grub_json_getstring (&type, digest, "type"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid digest type");
+  else if (grub_strcmp (type, "pbkdf2"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "unsupported digest type %s",
+		       type);
+
+  if (grub_json_getvalue (&segments, digest, "segments")
+      || grub_json_getvalue (&keyslots, digest, "keyslots")
+      || grub_json_getstring (&out->salt, digest, "salt")
+      || grub_json_getstring (&out->digest, digest, "digest")
+      || grub_json_getstring (&out->hash, digest, "hash")
+      || grub_json_getint64 (&out->iterations, digest, "iterations"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "missing digest parameters");
+
+  if (luks2_parse_idlist (&out->segments, &segments)
+      || luks2_parse_idlist (&out->keyslots, &keyslots))
+    return grub_errno;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Find the first segment and the digest that vouches for its key.  */
+static grub_err_t
+luks2_get_segment (grub_luks2_segment_t *segment, grub_uint64_t *segment_id,
+		   grub_luks2_digest_t *digest, const grub_json_t *root)
+{
+  grub_json_t segments, digests, child, obj;
+  grub_size_t i, size;
+  const char *name;
+
+  if (grub_json_getvalue (&segments, root, "segments")
+      || grub_json_getchild (&child, &segments, 0)
+      || grub_json_getstring (&name, &child, NULL)
+      || grub_json_getuint64 (segment_id, &child, NULL)
+      || grub_json_getchild (&obj, &child, 0)
+      || luks2_parse_segment (segment, &obj))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "no usable segment");
+
+  if (grub_json_getvalue (&digests, root, "digests")
+      || grub_json_getsize (&size, &digests))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "could not get digests");
+
+  for (i = 0; i < size; i++)
+    {
+      if (grub_json_getchild (&child, &digests, i)
+	  || grub_json_getchild (&obj, &child, 0)
+	  || luks2_parse_digest (digest, &obj))
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "could not parse digest");
+      if (*segment_id < 64 && (digest->segments & (1ULL << *segment_id)))
+	return GRUB_ERR_NONE;
+    }
+
+  return grub_error (GRUB_ERR_BAD_ARGUMENT, "no digest for segment %s", name);
+}
+
+/* Read the binary header and the JSON metadata of the newest valid copy.
+   The JSON text is returned NUL-terminated in *JSON.  */
+static grub_err_t
+luks2_read_header (grub_disk_t disk, grub_luks2_header_t *outhdr,
+		   char **json)
+{
+  grub_luks2_header_t primary, secondary, *header = &primary;
+  grub_size_t json_size;
+  grub_err_t err;
+
+  err = grub_disk_read (disk, 0, 0, sizeof (primary), &primary);
+  if (err)
+    return err;
+
+  if (grub_memcmp (primary.magic, LUKS_MAGIC_1ST, sizeof (primary.magic))
+      || grub_be_to_cpu16 (primary.version) != 2)
+    return GRUB_ERR_BAD_SIGNATURE;
+
+  /* The second copy follows the first.  It's only used when newer, which
+     it is after an interrupted update.  */
+  if (grub_be_to_cpu64 (primary.hdr_size) >= sizeof (primary))
+    {
+      err = grub_disk_read (disk, 0, grub_be_to_cpu64 (primary.hdr_size),
+			    sizeof (secondary), &secondary);
+      if (err)
+	grub_errno = GRUB_ERR_NONE;
+      else if (!grub_memcmp (secondary.magic, LUKS_MAGIC_2ND,
+			     sizeof (secondary.magic))
+	       && grub_be_to_cpu16 (secondary.version) == 2
+	       && grub_be_to_cpu64 (secondary.hdr_size)
+	       == grub_be_to_cpu64 (primary.hdr_size)
+	       && grub_be_to_cpu64 (secondary.seqid)
+	       > grub_be_to_cpu64 (primary.seqid))
+	header = &secondary;
+    }
+
+  if (grub_be_to_cpu64 (header->hdr_size) <= sizeof (*header)
+      || grub_be_to_cpu64 (header->hdr_size) > 4 * 1024 * 1024)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid LUKS2 header size");
+  json_size = grub_be_to_cpu64 (header->hdr_size) - sizeof (*header);
+
+  *json = grub_malloc (json_size + 1);
+  if (!*json)
+    return grub_errno;
+
+  err = grub_disk_read (disk, 0, grub_be_to_cpu64 (header->hdr_offset)
+			+ sizeof (*header), json_size, *json);
+  if (err)
+    {
+      grub_free (*json);
+      *json = NULL;
+      return err;
+    }
+  (*json)[json_size] = '\0';
+
+  grub_memcpy (outhdr, header, sizeof (*header));
+  return GRUB_ERR_NONE;
+}
+
+static grub_cryptodisk_t
+luks2_scan (grub_disk_t disk, const char *check_uuid, int check_boot)
+{
+  grub_cryptodisk_t cryptodisk = NULL;
+  grub_luks2_header_t header;
+  grub_luks2_segment_t segment;
+  grub_luks2_digest_t digest;
+  grub_uint64_t segment_id;
+  char uuid[sizeof (header.uuid) + 1];
+  char *json = NULL, *cipher, *mode;
+  grub_json_t *root = NULL;
+  grub_size_t i, j;
+  grub_err_t err;
+
+  if (check_boot)
+    return NULL;
+
+  err = luks2_read_header (disk, &header, &json);
+  if (err)
+    {
+      if (err == GRUB_ERR_OUT_OF_RANGE || err == GRUB_ERR_BAD_SIGNATURE)
+	grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+
+  for (i = 0, j = 0; i < sizeof (header.uuid) && header.uuid[i]; i++)
+    if (header.uuid[i] != '-')
+      uuid[j++] = header.uuid[i];
+  uuid[j] = '\0';
+
+  if (check_uuid && grub_strcasecmp (check_uuid, uuid) != 0)
+    {
+      grub_dprintf ("luks2", "%s != %s\n", uuid, check_uuid);
+      goto out;
+    }
+
+  if (grub_json_parse (&root, json, grub_strlen (json))
+      || luks2_get_segment (&segment, &segment_id, &digest, root))
+    goto out;
+
+  /* "aes-xts-plain64" is cipher "aes" in mode "xts-plain64".  */
+  cipher = grub_strdup (segment.encryption);
+  if (!cipher)
+    goto out;
+  mode = grub_strchr (cipher, '-');
+  if (!mode)
+    {
+      grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid encryption %s",
+		  segment.encryption);
+      grub_free (cipher);
+      goto out;
+    }
+  *mode++ = '\0';
+
+  if (segment.sector_size < GRUB_DISK_SECTOR_SIZE
+      || segment.sector_size > 4096
+      || (segment.sector_size & (segment.sector_size - 1))
+      || (segment.offset & (GRUB_DISK_SECTOR_SIZE - 1)))
+    {
+      grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid segment geometry");
+      grub_free (cipher);
+      goto out;
+    }
+
+  cryptodisk = grub_zalloc (sizeof (*cryptodisk));
+  if (!cryptodisk)
+    {
+      grub_free (cipher);
+      goto out;
+    }
+  err = grub_cryptodisk_setcipher (cryptodisk, cipher, mode);
+  grub_free (cipher);
+  if (err)
+    {
+      grub_free (cryptodisk);
+      cryptodisk = NULL;
+      goto out;
+    }
+
+  COMPILE_TIME_ASSERT (sizeof (cryptodisk->uuid) >= sizeof (uuid));
+  grub_memcpy (cryptodisk->uuid, uuid, sizeof (uuid));
+
+  cryptodisk->offset = segment.offset >> GRUB_DISK_SECTOR_BITS;
+  for (cryptodisk->log_sector_size = GRUB_DISK_SECTOR_BITS;
+       (1 << cryptodisk->log_sector_size) < segment.sector_size;
+       cryptodisk->log_sector_size++);
+  if (grub_strcmp (segment.size, "dynamic") == 0)
+    cryptodisk->total_length = (grub_disk_get_size (disk)
+				- cryptodisk->offset)
+      >> (cryptodisk->log_sector_size - GRUB_DISK_SECTOR_BITS);
+  else
+    cryptodisk->total_length = grub_strtoull (segment.size, NULL, 10)
+      >> cryptodisk->log_sector_size;
+  cryptodisk->source_disk = NULL;
+  cryptodisk->modname = "luks2";
+
+ out:
+  grub_json_free (root);
+  grub_free (json);
+  return cryptodisk;
+}
+
+static grub_err_t
+luks2_verify_key (const grub_luks2_digest_t *d, grub_uint8_t *candidate_key,
+		  grub_size_t candidate_key_len)
+{
+  grub_uint8_t candidate_digest[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_uint8_t digest[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_uint8_t salt[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_size_t saltlen, digestlen;
+  const gcry_md_spec_t *hash;
+  gcry_err_code_t gcry_err;
+
+  if (base64_decode (d->digest, digest, sizeof (digest), &digestlen)
+      || base64_decode (d->salt, salt, sizeof (salt), &saltlen))
+    return grub_errno;
+  /* An empty digest would match any key.  */
+  if (digestlen == 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid digest");
+
+  hash = grub_crypto_lookup_md_by_name (d->hash);
+  if (!hash)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, "Couldn't load %s hash",
+		       d->hash);
+
+  gcry_err = grub_crypto_pbkdf2 (hash, candidate_key, candidate_key_len,
+				 salt, saltlen, d->iterations,
+				 candidate_digest, digestlen);
+  if (gcry_err)
+    return grub_crypto_gcry_error (gcry_err);
+
+  if (grub_crypto_memcmp (candidate_digest, digest, digestlen) != 0)
+    return grub_error (GRUB_ERR_ACCESS_DENIED, "mismatching digests");
+
+  return GRUB_ERR_NONE;
+}
+
+/* Recover the key of slot K into OUT_KEY, leaving CRYPT set up for the
+   area cipher.  */
+static grub_err_t
+luks2_decrypt_key (grub_uint8_t *out_key,
+		   grub_disk_t disk, grub_cryptodisk_t crypt,
+		   const grub_luks2_keyslot_t *k,
+		   const grub_uint8_t *passphrase, grub_size_t passphraselen)
+{
+  grub_uint8_t area_key[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_uint8_t salt[GRUB_CRYPTODISK_MAX_KEYLEN];
+  grub_uint8_t *split_key = NULL;
+  grub_size_t saltlen, split_len;
+  char cipher[32], *p;
+  const gcry_md_spec_t *hash;
+  gcry_err_code_t gcry_err;
+  grub_err_t err;
+
+  if (k->area.key_size <= 0 || k->area.key_size > GRUB_CRYPTODISK_MAX_KEYLEN
+      || k->key_size <= 0 || k->key_size > GRUB_CRYPTODISK_MAX_KEYLEN
+      || k->af.stripes <= 0
+      || (grub_uint64_t) k->af.stripes
+	 > GRUB_SIZE_MAX / (grub_uint64_t) k->key_size)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid keyslot geometry");
+  split_len = (grub_size_t) k->key_size * (grub_size_t) k->af.stripes;
+  if (split_len > k->area.size)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid keyslot geometry");
+
+  err = base64_decode (k->kdf.salt, salt, sizeof (salt), &saltlen);
+  if (err)
+    return err;
+
+  if (k->kdf.type != LUKS2_KDF_TYPE_PBKDF2)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "Argon2 not supported");
+
+  hash = grub_crypto_lookup_md_by_name (k->kdf.hash);
+  if (!hash)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, "Couldn't load %s hash",
+		       k->kdf.hash);
+  gcry_err = grub_crypto_pbkdf2 (hash, passphrase, passphraselen,
+				 salt, saltlen, k->kdf.iterations,
+				 area_key, k->area.key_size);
+  if (gcry_err)
+    return grub_crypto_gcry_error (gcry_err);
+
+  /* The key area is always encrypted with 512-byte sectors.  */
+  grub_strncpy (cipher, k->area.encryption, sizeof (cipher) - 1);
+  cipher[sizeof (cipher) - 1] = '\0';
+  p = grub_strchr (cipher, '-');
+  if (!p)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid encryption %s",
+		       k->area.encryption);
+  *p++ = '\0';
+
+  err = grub_cryptodisk_setcipher (crypt, cipher, p);
+  if (err)
+    return err;
+  crypt->log_sector_size = GRUB_DISK_SECTOR_BITS;
+
+  gcry_err = grub_cryptodisk_setkey (crypt, area_key, k->area.key_size);
+  if (gcry_err)
+    return grub_crypto_gcry_error (gcry_err);
+
+  hash = grub_crypto_lookup_md_by_name (k->af.hash);
+  if (!hash)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND, "Couldn't load %s hash",
+		       k->af.hash);
+
+  split_key = grub_malloc (split_len);
+  if (!split_key)
+    return grub_errno;
+
+  err = grub_disk_read (disk, k->area.offset >> GRUB_DISK_SECTOR_BITS,
+			k->area.offset & (GRUB_DISK_SECTOR_SIZE - 1),
+			split_len, split_key);
+  if (err)
+    goto fail;
+
+  gcry_err = grub_cryptodisk_decrypt (crypt, split_key, split_len, 0);
+  if (!gcry_err)
+    gcry_err = AF_merge (hash, split_key, out_key, k->key_size,
+			 k->af.stripes);
+  if (gcry_err)
+    err = grub_crypto_gcry_error (gcry_err);
+
+ fail:
+  grub_free (split_key);
+  return err;
+}
+
+/* Order in which slots are tried: high priority ones first and, since
+   a slot a token refers to usually holds a key for another unlocking
+   method, e.g. a TPM, the ones that are only for passphrases before those.
+   Each wrong guess costs a full key derivation.  */
+static int
+luks2_keyslot_cmp (const grub_luks2_keyslot_t *a,
+		   const grub_luks2_keyslot_t *b)
+{
+  if (a->priority != b->priority)
+    return a->priority > b->priority ? -1 : 1;
+  if (a->has_token != b->has_token)
+    return a->has_token ? 1 : -1;
+  if (a->id != b->id)
+    return a->id < b->id ? -1 : 1;
+  return 0;
+}
+
+/* Collect the slots the digest DIGEST covers into *OUT, in the order they
+   should be tried.  HDR_SIZE is the size of one copy of the metadata,
+   after both of which the keyslots area starts.  */
+static grub_err_t
+luks2_sorted_keyslots (grub_luks2_keyslot_t **out, grub_size_t *count,
+		       const grub_json_t *root,
+		       const grub_luks2_digest_t *digest,
+		       grub_uint64_t hdr_size)
+{
+  grub_luks2_keyslot_t *slots;
+  grub_json_t keyslots, tokens, child, obj, list, config;
+  grub_uint64_t token_bound = 0, area_start, area_end, keyslots_size;
+  grub_size_t i, j, size, n = 0;
+
+  *out = NULL;
+  *count = 0;
+
+  if (grub_json_getvalue (&keyslots, root, "keyslots")
+      || grub_json_getsize (&size, &keyslots))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "could not get keyslots");
+
+  if (grub_json_getvalue (&config, root, "config")
+      || grub_json_getuint64 (&keyslots_size, &config, "keyslots_size"))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "could not get keyslots size");
+  /* The limit of cryptsetup; HDR_SIZE is at most 4 MiB already.  */
+  if (keyslots_size > LUKS2_MAX_KEYSLOTS_SIZE)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid keyslots size");
+  area_start = 2 * hdr_size;
+  area_end = area_start + keyslots_size;
+
+  /* Tokens are optional.  */
+  if (grub_json_getvalue (&tokens, root, "tokens") == GRUB_ERR_NONE)
+    {
+      grub_size_t ntokens;
+
+      grub_json_getsize (&ntokens, &tokens);
+      for (i = 0; i < ntokens; i++)
+	{
+	  grub_uint64_t bits;
+
+	  if (grub_json_getchild (&child, &tokens, i)
+	      || grub_json_getchild (&obj, &child, 0)
+	      || grub_json_getvalue (&list, &obj, "keyslots")
+	      || luks2_parse_idlist (&bits, &list))
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      continue;
+	    }
+	  token_bound |= bits;
+	}
+    }
+  grub_errno = GRUB_ERR_NONE;
+
+  slots = grub_malloc ((size ? : 1) * sizeof (*slots));
+  if (!slots)
+    return grub_errno;
+
+  for (i = 0; i < size; i++)
+    {
+      grub_luks2_keyslot_t k;
+
+      if (grub_json_getchild (&child, &keyslots, i)
+	  || grub_json_getuint64 (&k.id, &child, NULL)
+	  || grub_json_getchild (&obj, &child, 0)
+	  || luks2_parse_keyslot (&k, &obj))
+	{
+	  grub_dprintf ("luks2", "Skipping keyslot %" PRIuGRUB_SIZE ": %s\n",
+			i, grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      if (k.id >= 64 || !(digest->keyslots & (1ULL << k.id)))
+	continue;
+      if (k.area.offset < area_start || k.area.offset > area_end
+	  || k.area.size > area_end - k.area.offset)
+	{
+	  grub_dprintf ("luks2", "Skipping keyslot %" PRIuGRUB_UINT64_T
+			": area outside the keyslots area\n", k.id);
+	  continue;
+	}
+      if (k.priority == LUKS2_PRIORITY_IGNORE)
+	{
+	  grub_dprintf ("luks2", "Ignoring keyslot %" PRIuGRUB_UINT64_T
+			" per its priority\n", k.id);
+	  continue;
+	}
+      if (k.kdf.type == LUKS2_KDF_TYPE_ARGON2)
+	{
+	  grub_dprintf ("luks2", "Skipping keyslot %" PRIuGRUB_UINT64_T
+			": Argon2 is not supported\n", k.id);
+	  continue;
+	}
+      k.has_token = !!(token_bound & (1ULL << k.id));
+
+      /* Insertion sort, there are at most a handful of slots.  */
+      for (j = n; j > 0 && luks2_keyslot_cmp (&k, &slots[j - 1]) < 0; j--)
+	slots[j] = slots[j - 1];
+      slots[j] = k;
+      n++;
+    }
+
+  *out = slots;
+  *count = n;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+luks2_recover_key (grub_disk_t disk, grub_cryptodisk_t crypt)
+{
+  grub_uint8_t candidate_key[GRUB_CRYPTODISK_MAX_KEYLEN];
+  char passphrase[MAX_PASSPHRASE], cipher[32], *mode;
+  grub_luks2_keyslot_t *slots = NULL;
+  grub_luks2_header_t header;
+  grub_luks2_segment_t segment;
+  grub_luks2_digest_t digest;
+  grub_uint64_t segment_id;
+  int log_sector_size = crypt->log_sector_size;
+  char *json = NULL, *part = NULL;
+  grub_json_t *root = NULL;
+  grub_size_t i, nslots;
+  gcry_err_code_t gcry_err;
+  grub_err_t err;
+
+  err = luks2_read_header (disk, &header, &json);
+  if (err)
+    return err;
+
+  err = grub_json_parse (&root, json, grub_strlen (json));
+  if (err)
+    goto out;
+  err = luks2_get_segment (&segment, &segment_id, &digest, root);
+  if (err)
+    goto out;
+  err = luks2_sorted_keyslots (&slots, &nslots, root, &digest,
+			       grub_be_to_cpu64 (header.hdr_size));
+  if (err)
+    goto out;
+  if (!nslots)
+    {
+      err = grub_error (GRUB_ERR_BAD_ARGUMENT, "no usable keyslot");
+      goto out;
+    }
+
+  /* Get the passphrase from the user.  */
+  if (disk->partition)
+    part = grub_partition_get_name (disk->partition);
+  grub_printf_ (N_("Enter passphrase for %s%s%s (%s): "), disk->name,
+		disk->partition ? "," : "", part ? : "",
+		crypt->uuid);
+  if (!grub_password_get (passphrase, MAX_PASSPHRASE))
+    {
+      err = grub_error (GRUB_ERR_BAD_ARGUMENT, "Passphrase not supplied");
+      goto out;
+    }
+
+  for (i = 0; i < nslots; i++)
+    {
+      grub_luks2_keyslot_t *k = &slots[i];
+
+      grub_dprintf ("luks2", "Trying keyslot %" PRIuGRUB_UINT64_T "\n", k->id);
+
+      err = luks2_decrypt_key (candidate_key, disk, crypt, k,
+			       (const grub_uint8_t *) passphrase,
+			       grub_strlen (passphrase));
+      if (err)
+	{
+	  grub_dprintf ("luks2", "Decryption with keyslot %" PRIuGRUB_UINT64_T
+			" failed: %s\n", k->id, grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      err = luks2_verify_key (&digest, candidate_key, k->key_size);
+      if (err)
+	{
+	  grub_dprintf ("luks2", "Could not open keyslot %" PRIuGRUB_UINT64_T
+			": %s\n", k->id, grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      /* TRANSLATORS: It's a cryptographic key slot: one element of an array
+	 where each element is either empty or holds a key.  */
+      grub_printf_ (N_("Slot %" PRIuGRUB_UINT64_T " opened\n"), k->id);
+      break;
+    }
+
+  if (i == nslots)
+    {
+      err = grub_error (GRUB_ERR_ACCESS_DENIED, "Invalid passphrase");
+      goto out;
+    }
+
+  /* Switch back from the key area to the data segment.  */
+  grub_strncpy (cipher, segment.encryption, sizeof (cipher) - 1);
+  cipher[sizeof (cipher) - 1] = '\0';
+  mode = grub_strchr (cipher, '-');
+  if (!mode)
+    {
+      err = grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid encryption %s",
+			segment.encryption);
+      goto out;
+    }
+  *mode++ = '\0';
+
+  err = grub_cryptodisk_setcipher (crypt, cipher, mode);
+  if (err)
+    goto out;
+  crypt->log_sector_size = log_sector_size;
+
+  gcry_err = grub_cryptodisk_setkey (crypt, candidate_key, slots[i].key_size);
+  if (gcry_err)
+    err = grub_crypto_gcry_error (gcry_err);
+
+ out:
+  crypt->log_sector_size = log_sector_size;
+  grub_memset (passphrase, 0, sizeof (passphrase));
+  grub_memset (candidate_key, 0, sizeof (candidate_key));
+  grub_free (part);
+  grub_free (slots);
+  grub_json_free (root);
+  grub_free (json);
+  return err;
+}
+
+static struct grub_cryptodisk_dev luks2_crypto = {
+  .scan = luks2_scan,
+  .recover_key = luks2_recover_key
+};
+
+GRUB_MOD_INIT (luks2)
+{
+  grub_cryptodisk_dev_register (&luks2_crypto);
+}
+
+GRUB_MOD_FINI (luks2)
+{
+  grub_cryptodisk_dev_unregister (&luks2_crypto);
+}
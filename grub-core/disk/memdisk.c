@@ -65,6 +65,12 @@ grub_memdisk_read (grub_disk_t disk __attribute((unused)), grub_disk_addr_t sect
   return 0;
 }
 
+static char *
+grub_memdisk_map (grub_disk_t disk __attribute((unused)), grub_disk_addr_t sector)
+{
+  return memdisk_addr + (sector << GRUB_DISK_SECTOR_BITS);
+}
+
 static grub_err_t
 grub_memdisk_write (grub_disk_t disk __attribute((unused)), grub_disk_addr_t sector,
 		     grub_size_t size, const char *buf)
@@ -82,6 +88,7 @@ static struct grub_disk_dev grub_memdisk_dev =
     .close = grub_memdisk_close,
     .read = grub_memdisk_read,
     .write = grub_memdisk_write,
+    .map = grub_memdisk_map,
     .next = 0
   };
 
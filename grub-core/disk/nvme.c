@@ -0,0 +1,851 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/misc.h>
+#include <grub/list.h>
+#include <grub/loader.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Controller registers.  */
+enum
+  {
+    GRUB_NVME_REG_CAP = 0x00,
+    GRUB_NVME_REG_INTMS = 0x0c,
+    GRUB_NVME_REG_CC = 0x14,
+    GRUB_NVME_REG_CSTS = 0x1c,
+    GRUB_NVME_REG_AQA = 0x24,
+    GRUB_NVME_REG_ASQ = 0x28,
+    GRUB_NVME_REG_ACQ = 0x30,
+    GRUB_NVME_REG_DOORBELL = 0x1000
+  };
+
+enum
+  {
+    GRUB_NVME_CC_EN = 0x1,
+    GRUB_NVME_CC_IOSQES = 6 << 16,
+    GRUB_NVME_CC_IOCQES = 4 << 20
+  };
+
+enum
+  {
+    GRUB_NVME_CSTS_RDY = 0x1,
+    GRUB_NVME_CSTS_CFS = 0x2
+  };
+
+#define GRUB_NVME_CAP_MQES(cap) ((cap) & 0xffff)
+#define GRUB_NVME_CAP_TO(cap) (((cap) >> 24) & 0xff)
+#define GRUB_NVME_CAP_DSTRD(cap) (((cap) >> 32) & 0xf)
+
+/* Command opcodes.  */
+enum
+  {
+    GRUB_NVME_ADMIN_CREATE_SQ = 0x01,
+    GRUB_NVME_ADMIN_CREATE_CQ = 0x05,
+    GRUB_NVME_ADMIN_IDENTIFY = 0x06,
+    GRUB_NVME_CMD_WRITE = 0x01,
+    GRUB_NVME_CMD_READ = 0x02
+  };
+
+enum
+  {
+    GRUB_NVME_IDENTIFY_NAMESPACE = 0,
+    GRUB_NVME_IDENTIFY_CONTROLLER = 1
+  };
+
+#define GRUB_NVME_PAGE_SIZE 4096
+#define GRUB_NVME_ADMIN_QUEUE_SIZE 4
+/* The admin queue pair and one for I/O.  */
+#define GRUB_NVME_NQUEUES 2
+/* Number of I/O commands kept in flight and the bounce buffer size of
+   each of them.  */
+#define GRUB_NVME_IO_SLOTS 8
+#define GRUB_NVME_MAX_TRANSFER 0x20000
+/* Only look at this many namespaces per controller.  */
+#define GRUB_NVME_MAX_NAMESPACES 16
+
+struct grub_nvme_sqe
+{
+  grub_uint32_t cdw0;
+  grub_uint32_t nsid;
+  grub_uint64_t reserved;
+  grub_uint64_t mptr;
+  grub_uint64_t prp1;
+  grub_uint64_t prp2;
+  grub_uint32_t cdw10;
+  grub_uint32_t cdw11;
+  grub_uint32_t cdw12;
+  grub_uint32_t cdw13;
+  grub_uint32_t cdw14;
+  grub_uint32_t cdw15;
+};
+
+struct grub_nvme_cqe
+{
+  grub_uint32_t result;
+  grub_uint32_t reserved;
+  grub_uint16_t sq_head;
+  grub_uint16_t sq_id;
+  grub_uint16_t cid;
+  /* Bit 0 is the phase tag, the rest is the status field.  */
+  grub_uint16_t status;
+};
+
+struct grub_nvme_queue
+{
+  unsigned id;
+  unsigned size;
+  unsigned sq_tail;
+  unsigned cq_head;
+  unsigned phase;
+  struct grub_pci_dma_chunk *sq_chunk;
+  volatile struct grub_nvme_sqe *sq;
+  struct grub_pci_dma_chunk *cq_chunk;
+  volatile struct grub_nvme_cqe *cq;
+};
+
+/* One in-flight I/O command and its bounce buffer.  */
+struct grub_nvme_slot
+{
+  struct grub_pci_dma_chunk *buf;
+  struct grub_pci_dma_chunk *prp_list;
+  char *dest;
+  grub_size_t len;
+  int busy;
+};
+
+struct grub_nvme_ctrl
+{
+  struct grub_nvme_ctrl *next;
+  struct grub_nvme_ctrl **prev;
+  grub_pci_device_t pcidev;
+  volatile grub_uint8_t *regs;
+  grub_uint64_t cap;
+  unsigned doorbell_stride;
+  grub_uint64_t timeout;
+  grub_size_t max_transfer;
+  unsigned nslots;
+  grub_uint32_t nn;
+  struct grub_pci_dma_chunk *ident;
+  struct grub_nvme_queue admin;
+  struct grub_nvme_queue io;
+  struct grub_nvme_slot slots[GRUB_NVME_IO_SLOTS];
+  int present;
+};
+
+struct grub_nvme_ns
+{
+  struct grub_nvme_ns *next;
+  struct grub_nvme_ns **prev;
+  struct grub_nvme_ctrl *ctrl;
+  grub_uint32_t nsid;
+  int num;
+  grub_uint64_t nsectors;
+  unsigned log_sector_size;
+};
+
+static struct grub_nvme_ctrl *grub_nvme_ctrls;
+static struct grub_nvme_ns *grub_nvme_namespaces;
+static int numdevs;
+
+static inline grub_uint32_t
+grub_nvme_read32 (struct grub_nvme_ctrl *ctrl, unsigned reg)
+{
+  return *(volatile grub_uint32_t *) (ctrl->regs + reg);
+}
+
+static inline void
+grub_nvme_write32 (struct grub_nvme_ctrl *ctrl, unsigned reg,
+		   grub_uint32_t val)
+{
+  *(volatile grub_uint32_t *) (ctrl->regs + reg) = val;
+}
+
+/* 64-bit registers are accessed as two halves, low one first.  */
+static inline grub_uint64_t
+grub_nvme_read64 (struct grub_nvme_ctrl *ctrl, unsigned reg)
+{
+  return grub_nvme_read32 (ctrl, reg)
+    | ((grub_uint64_t) grub_nvme_read32 (ctrl, reg + 4) << 32);
+}
+
+static inline void
+grub_nvme_write64 (struct grub_nvme_ctrl *ctrl, unsigned reg,
+		   grub_uint64_t val)
+{
+  grub_nvme_write32 (ctrl, reg, val);
+  grub_nvme_write32 (ctrl, reg + 4, val >> 32);
+}
+
+static void
+grub_nvme_ring_sq (struct grub_nvme_ctrl *ctrl, struct grub_nvme_queue *q)
+{
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_DOORBELL
+		     + (2 * q->id) * ctrl->doorbell_stride, q->sq_tail);
+}
+
+static void
+grub_nvme_ring_cq (struct grub_nvme_ctrl *ctrl, struct grub_nvme_queue *q)
+{
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_DOORBELL
+		     + (2 * q->id + 1) * ctrl->doorbell_stride, q->cq_head);
+}
+
+/* Put CMD on the submission queue without notifying the controller.  */
+static void
+grub_nvme_queue_cmd (struct grub_nvme_queue *q, struct grub_nvme_sqe *cmd,
+		     grub_uint16_t cid)
+{
+  cmd->cdw0 |= (grub_uint32_t) cid << 16;
+  grub_memcpy ((void *) &q->sq[q->sq_tail], cmd, sizeof (*cmd));
+  q->sq_tail = (q->sq_tail + 1) % q->size;
+}
+
+/* Wait for the next completion on Q and return its command id in CID.  */
+static grub_err_t
+grub_nvme_reap (struct grub_nvme_ctrl *ctrl, struct grub_nvme_queue *q,
+		grub_uint16_t *cid)
+{
+  grub_uint64_t endtime;
+  grub_uint16_t status;
+
+  endtime = grub_get_time_ms () + ctrl->timeout;
+  while ((q->cq[q->cq_head].status & 1) != q->phase)
+    if (grub_get_time_ms () > endtime)
+      return grub_error (GRUB_ERR_IO, "NVMe command timed out");
+
+  status = q->cq[q->cq_head].status >> 1;
+  *cid = q->cq[q->cq_head].cid;
+
+  if (++q->cq_head == q->size)
+    {
+      q->cq_head = 0;
+      q->phase ^= 1;
+    }
+  grub_nvme_ring_cq (ctrl, q);
+
+  if (status)
+    return grub_error (GRUB_ERR_IO, "NVMe command failed with status 0x%x",
+		       status);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_admin (struct grub_nvme_ctrl *ctrl, struct grub_nvme_sqe *cmd)
+{
+  grub_uint16_t cid;
+
+  grub_nvme_queue_cmd (&ctrl->admin, cmd, 0);
+  grub_nvme_ring_sq (ctrl, &ctrl->admin);
+  return grub_nvme_reap (ctrl, &ctrl->admin, &cid);
+}
+
+static grub_err_t
+grub_nvme_identify (struct grub_nvme_ctrl *ctrl, grub_uint32_t cns,
+		    grub_uint32_t nsid)
+{
+  struct grub_nvme_sqe cmd;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = GRUB_NVME_ADMIN_IDENTIFY;
+  cmd.nsid = nsid;
+  cmd.prp1 = grub_dma_get_phys (ctrl->ident);
+  cmd.cdw10 = cns;
+  return grub_nvme_admin (ctrl, &cmd);
+}
+
+static void
+grub_nvme_free_queue (struct grub_nvme_queue *q)
+{
+  if (q->sq_chunk)
+    grub_dma_free (q->sq_chunk);
+  if (q->cq_chunk)
+    grub_dma_free (q->cq_chunk);
+  q->sq_chunk = NULL;
+  q->cq_chunk = NULL;
+}
+
+static grub_err_t
+grub_nvme_alloc_queue (struct grub_nvme_queue *q, unsigned id, unsigned size)
+{
+  q->id = id;
+  q->size = size;
+  q->sq_tail = 0;
+  q->cq_head = 0;
+  q->phase = 1;
+
+  q->sq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_sqe));
+  q->cq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_cqe));
+  if (!q->sq_chunk || !q->cq_chunk)
+    {
+      grub_nvme_free_queue (q);
+      return grub_errno;
+    }
+
+  q->sq = grub_dma_get_virt (q->sq_chunk);
+  q->cq = grub_dma_get_virt (q->cq_chunk);
+  grub_memset ((void *) q->sq, 0, size * sizeof (struct grub_nvme_sqe));
+  grub_memset ((void *) q->cq, 0, size * sizeof (struct grub_nvme_cqe));
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_wait_ready (struct grub_nvme_ctrl *ctrl, grub_uint32_t ready)
+{
+  grub_uint64_t endtime;
+
+  endtime = grub_get_time_ms () + ctrl->timeout;
+  while ((grub_nvme_read32 (ctrl, GRUB_NVME_REG_CSTS) & GRUB_NVME_CSTS_RDY)
+	 != ready)
+    {
+      if (grub_nvme_read32 (ctrl, GRUB_NVME_REG_CSTS) & GRUB_NVME_CSTS_CFS)
+	return grub_error (GRUB_ERR_IO, "NVMe controller fatal status");
+      if (grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_IO, "NVMe controller timed out");
+    }
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_ctrl_fini (struct grub_nvme_ctrl *ctrl)
+{
+  unsigned i;
+
+  if (grub_nvme_read32 (ctrl, GRUB_NVME_REG_CC) & GRUB_NVME_CC_EN)
+    {
+      grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC,
+			 grub_nvme_read32 (ctrl, GRUB_NVME_REG_CC)
+			 & ~GRUB_NVME_CC_EN);
+      if (grub_nvme_wait_ready (ctrl, 0))
+	{
+	  grub_dprintf ("nvme", "couldn't disable controller\n");
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
+  for (i = 0; i < GRUB_NVME_IO_SLOTS; i++)
+    {
+      if (ctrl->slots[i].buf)
+	grub_dma_free (ctrl->slots[i].buf);
+      if (ctrl->slots[i].prp_list)
+	grub_dma_free (ctrl->slots[i].prp_list);
+      ctrl->slots[i].buf = NULL;
+      ctrl->slots[i].prp_list = NULL;
+      ctrl->slots[i].busy = 0;
+    }
+  grub_nvme_free_queue (&ctrl->io);
+  grub_nvme_free_queue (&ctrl->admin);
+  if (ctrl->ident)
+    grub_dma_free (ctrl->ident);
+  ctrl->ident = NULL;
+  ctrl->present = 0;
+}
+
+/* Reset the controller and bring up the admin and one I/O queue pair.
+   All commands are polled, so a single I/O queue with several slots in
+   flight is all we can use.  */
+static grub_err_t
+grub_nvme_ctrl_init (struct grub_nvme_ctrl *ctrl)
+{
+  struct grub_nvme_sqe cmd;
+  grub_uint8_t *ident;
+  unsigned i, io_size;
+
+  ctrl->cap = grub_nvme_read64 (ctrl, GRUB_NVME_REG_CAP);
+  ctrl->doorbell_stride = 4 << GRUB_NVME_CAP_DSTRD (ctrl->cap);
+  ctrl->timeout = GRUB_NVME_CAP_TO (ctrl->cap) * 500;
+  if (ctrl->timeout < 1000)
+    ctrl->timeout = 1000;
+
+  if (grub_nvme_read32 (ctrl, GRUB_NVME_REG_CC) & GRUB_NVME_CC_EN)
+    {
+      grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC, 0);
+      if (grub_nvme_wait_ready (ctrl, 0))
+	return grub_errno;
+    }
+
+  io_size = 2 * GRUB_NVME_IO_SLOTS;
+  if (io_size > GRUB_NVME_CAP_MQES (ctrl->cap) + 1)
+    io_size = GRUB_NVME_CAP_MQES (ctrl->cap) + 1;
+  /* A full queue would look empty.  */
+  ctrl->nslots = io_size - 1;
+  if (ctrl->nslots > GRUB_NVME_IO_SLOTS)
+    ctrl->nslots = GRUB_NVME_IO_SLOTS;
+
+  ctrl->ident = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE, GRUB_NVME_PAGE_SIZE);
+  if (!ctrl->ident)
+    goto fail;
+  if (grub_nvme_alloc_queue (&ctrl->admin, 0, GRUB_NVME_ADMIN_QUEUE_SIZE)
+      || grub_nvme_alloc_queue (&ctrl->io, 1, io_size))
+    goto fail;
+
+  for (i = 0; i < GRUB_NVME_IO_SLOTS; i++)
+    {
+      ctrl->slots[i].buf = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+						GRUB_NVME_MAX_TRANSFER);
+      ctrl->slots[i].prp_list = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+						     GRUB_NVME_PAGE_SIZE);
+      if (!ctrl->slots[i].buf || !ctrl->slots[i].prp_list)
+	goto fail;
+    }
+
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_AQA,
+		     (GRUB_NVME_ADMIN_QUEUE_SIZE - 1)
+		     | ((GRUB_NVME_ADMIN_QUEUE_SIZE - 1) << 16));
+  grub_nvme_write64 (ctrl, GRUB_NVME_REG_ASQ,
+		     grub_dma_get_phys (ctrl->admin.sq_chunk));
+  grub_nvme_write64 (ctrl, GRUB_NVME_REG_ACQ,
+		     grub_dma_get_phys (ctrl->admin.cq_chunk));
+  /* Interrupts are never used.  */
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_INTMS, 0xffffffff);
+  grub_nvme_write32 (ctrl, GRUB_NVME_REG_CC, GRUB_NVME_CC_EN
+		     | GRUB_NVME_CC_IOSQES | GRUB_NVME_CC_IOCQES);
+  if (grub_nvme_wait_ready (ctrl, GRUB_NVME_CSTS_RDY))
+    goto fail;
+
+  if (grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_CONTROLLER, 0))
+    goto fail;
+  ident = (grub_uint8_t *) grub_dma_get_virt (ctrl->ident);
+  ctrl->nn = grub_get_unaligned32 (ident + 516);
+  ctrl->max_transfer = GRUB_NVME_MAX_TRANSFER;
+  /* MDTS is a power of two in units of the minimum page size.  */
+  if (ident[77] && ident[77] < 20
+      && ((grub_size_t) GRUB_NVME_PAGE_SIZE << ident[77]) < ctrl->max_transfer)
+    ctrl->max_transfer = (grub_size_t) GRUB_NVME_PAGE_SIZE << ident[77];
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = GRUB_NVME_ADMIN_CREATE_CQ;
+  cmd.prp1 = grub_dma_get_phys (ctrl->io.cq_chunk);
+  cmd.cdw10 = ((io_size - 1) << 16) | ctrl->io.id;
+  /* Physically contiguous, no interrupts.  */
+  cmd.cdw11 = 1;
+  if (grub_nvme_admin (ctrl, &cmd))
+    goto fail;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = GRUB_NVME_ADMIN_CREATE_SQ;
+  cmd.prp1 = grub_dma_get_phys (ctrl->io.sq_chunk);
+  cmd.cdw10 = ((io_size - 1) << 16) | ctrl->io.id;
+  cmd.cdw11 = (ctrl->io.id << 16) | 1;
+  if (grub_nvme_admin (ctrl, &cmd))
+    goto fail;
+
+  ctrl->present = 1;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_error_push ();
+  grub_nvme_ctrl_fini (ctrl);
+  grub_error_pop ();
+  if (grub_errno == GRUB_ERR_NONE)
+    grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+  return grub_errno;
+}
+
+static void
+grub_nvme_scan_namespaces (struct grub_nvme_ctrl *ctrl)
+{
+  grub_uint32_t nsid;
+  grub_uint8_t *ident = (grub_uint8_t *) grub_dma_get_virt (ctrl->ident);
+
+  for (nsid = 1; nsid <= ctrl->nn && nsid <= GRUB_NVME_MAX_NAMESPACES; nsid++)
+    {
+      struct grub_nvme_ns *ns;
+      grub_uint64_t nsze;
+      unsigned lbads;
+
+      if (grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_NAMESPACE, nsid))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      nsze = grub_get_unaligned64 (ident);
+      lbads = ident[128 + 4 * (ident[26] & 0xf) + 2];
+      grub_dprintf ("nvme", "namespace %u: %llu blocks of 2^%u bytes\n",
+		    nsid, (unsigned long long) nsze, lbads);
+      if (!nsze || lbads < GRUB_DISK_SECTOR_BITS
+	  || lbads > GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS)
+	continue;
+
+      ns = grub_zalloc (sizeof (*ns));
+      if (!ns)
+	return;
+      ns->ctrl = ctrl;
+      ns->nsid = nsid;
+      ns->nsectors = nsze;
+      ns->log_sector_size = lbads;
+      ns->num = numdevs++;
+      grub_list_push (GRUB_AS_LIST_P (&grub_nvme_namespaces),
+		      GRUB_AS_LIST (ns));
+    }
+}
+
+static int
+grub_nvme_pciinit (grub_pci_device_t dev,
+		   grub_pci_id_t pciid __attribute__ ((unused)),
+		   void *data __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t class, bar;
+  grub_uint64_t base, cap;
+  grub_size_t regs_size;
+  struct grub_nvme_ctrl *ctrl;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class = grub_pci_read (addr);
+
+  /* Mass storage, non-volatile memory, NVM Express.  */
+  if (class >> 8 != 0x010802)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+  base = bar & GRUB_PCI_ADDR_MEM_MASK;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+      base |= (grub_uint64_t) grub_pci_read (addr) << 32;
+    }
+  if (base != (grub_addr_t) base)
+    {
+      grub_dprintf ("nvme", "BAR above addressable memory\n");
+      return 0;
+    }
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		       | GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  ctrl = grub_zalloc (sizeof (*ctrl));
+  if (!ctrl)
+    return 1;
+  ctrl->pcidev = dev;
+
+  /* The doorbells follow the registers, CAP.DSTRD apart, so the size of
+     the whole range is only known once CAP has been read.  */
+  ctrl->regs = grub_pci_device_map_range (dev, base, GRUB_NVME_REG_DOORBELL);
+  cap = grub_nvme_read64 (ctrl, GRUB_NVME_REG_CAP);
+  grub_pci_device_unmap_range (dev, ctrl->regs, GRUB_NVME_REG_DOORBELL);
+  regs_size = GRUB_NVME_REG_DOORBELL
+    + 2 * GRUB_NVME_NQUEUES * (4 << GRUB_NVME_CAP_DSTRD (cap));
+  ctrl->regs = grub_pci_device_map_range (dev, base, regs_size);
+
+  grub_dprintf ("nvme", "dev: %x:%x.%x\n", dev.bus, dev.device, dev.function);
+
+  if (grub_nvme_ctrl_init (ctrl))
+    {
+      grub_dprintf ("nvme", "couldn't initialize controller: %s\n",
+		    grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (ctrl);
+      return 0;
+    }
+
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_ctrls), GRUB_AS_LIST (ctrl));
+  grub_nvme_scan_namespaces (ctrl);
+
+  return 0;
+}
+
+/* Run the transfers described by VEC, in device sectors, keeping up
+   to GRUB_NVME_IO_SLOTS commands of at most max_transfer bytes in
+   flight.  */
+static grub_err_t
+grub_nvme_transfer (grub_disk_t disk, const struct grub_disk_vec *vec,
+		    grub_size_t n, int write)
+{
+  struct grub_nvme_ns *ns = disk->data;
+  struct grub_nvme_ctrl *ctrl = ns->ctrl;
+  grub_size_t i = 0, done = 0, inflight = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (!ctrl->present)
+    return grub_error (GRUB_ERR_IO, "NVMe controller is not available");
+
+  while (1)
+    {
+      unsigned slot;
+      int queued = 0;
+      grub_uint16_t cid;
+
+      /* Fill all free slots before ringing the doorbell once.  */
+      for (slot = 0; slot < ctrl->nslots && i < n && !err; slot++)
+	{
+	  struct grub_nvme_slot *s = &ctrl->slots[slot];
+	  struct grub_nvme_sqe cmd;
+	  grub_uint32_t phys;
+	  grub_size_t len, pages, j;
+
+	  if (s->busy)
+	    continue;
+
+	  len = (vec[i].size - done) << ns->log_sector_size;
+	  if (len > ctrl->max_transfer)
+	    len = ctrl->max_transfer;
+
+	  s->dest = vec[i].buf + (done << ns->log_sector_size);
+	  s->len = len;
+	  if (write)
+	    grub_memcpy ((char *) grub_dma_get_virt (s->buf), s->dest, len);
+
+	  grub_memset (&cmd, 0, sizeof (cmd));
+	  cmd.cdw0 = write ? GRUB_NVME_CMD_WRITE : GRUB_NVME_CMD_READ;
+	  cmd.nsid = ns->nsid;
+	  cmd.cdw10 = vec[i].sector + done;
+	  cmd.cdw11 = (vec[i].sector + done) >> 32;
+	  cmd.cdw12 = (len >> ns->log_sector_size) - 1;
+
+	  phys = grub_dma_get_phys (s->buf);
+	  pages = (len + GRUB_NVME_PAGE_SIZE - 1) / GRUB_NVME_PAGE_SIZE;
+	  cmd.prp1 = phys;
+	  if (pages == 2)
+	    cmd.prp2 = phys + GRUB_NVME_PAGE_SIZE;
+	  else if (pages > 2)
+	    {
+	      volatile grub_uint64_t *list = grub_dma_get_virt (s->prp_list);
+
+	      for (j = 1; j < pages; j++)
+		list[j - 1] = phys + j * GRUB_NVME_PAGE_SIZE;
+	      cmd.prp2 = grub_dma_get_phys (s->prp_list);
+	    }
+
+	  grub_nvme_queue_cmd (&ctrl->io, &cmd, slot);
+	  s->busy = 1;
+	  inflight++;
+	  queued = 1;
+
+	  done += len >> ns->log_sector_size;
+	  if (done == vec[i].size)
+	    {
+	      i++;
+	      done = 0;
+	    }
+	}
+
+      if (queued)
+	grub_nvme_ring_sq (ctrl, &ctrl->io);
+
+      if (!inflight)
+	break;
+
+      cid = 0xffff;
+      if (grub_nvme_reap (ctrl, &ctrl->io, &cid))
+	{
+	  if (cid == 0xffff)
+	    {
+	      /* Timed out, the queue state is unknown.  */
+	      grub_nvme_ctrl_fini (ctrl);
+	      return grub_errno;
+	    }
+	  if (!err)
+	    err = grub_errno;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      if (cid >= ctrl->nslots || !ctrl->slots[cid].busy)
+	{
+	  grub_nvme_ctrl_fini (ctrl);
+	  return grub_error (GRUB_ERR_IO, "NVMe completion for unknown command");
+	}
+
+      if (!write && !err)
+	grub_memcpy (ctrl->slots[cid].dest,
+		     (char *) grub_dma_get_virt (ctrl->slots[cid].buf),
+		     ctrl->slots[cid].len);
+      ctrl->slots[cid].busy = 0;
+      inflight--;
+    }
+
+  if (err && write)
+    return grub_error (err, N_("failure writing sector 0x%llx to `%s'"),
+		       (unsigned long long) vec[0].sector, disk->name);
+  if (err)
+    return grub_error (err, N_("failure reading sector 0x%llx from `%s'"),
+		       (unsigned long long) vec[0].sector, disk->name);
+  return GRUB_ERR_NONE;
+}
+
+static int
+grub_nvme_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		   grub_disk_pull_t pull)
+{
+  struct grub_nvme_ns *ns;
+  char name[sizeof ("nvmeXXXXXXXXXX")];
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    {
+      grub_snprintf (name, sizeof (name), "nvme%d", ns->num);
+      if (hook (name, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_open (const char *name, grub_disk_t disk)
+{
+  struct grub_nvme_ns *ns;
+  const char *end;
+  unsigned long num;
+
+  if (grub_strncmp (name, "nvme", sizeof ("nvme") - 1) != 0
+      || !grub_isdigit (name[sizeof ("nvme") - 1]))
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe device");
+
+  num = grub_strtoul (name + sizeof ("nvme") - 1, (char **) &end, 10);
+  if (grub_errno || *end)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe device");
+    }
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    if (ns->num == (int) num)
+      break;
+
+  if (!ns)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "no such NVMe device");
+
+  disk->id = ns->num;
+  disk->total_sectors = ns->nsectors;
+  disk->log_sector_size = ns->log_sector_size;
+  /* Let several commands be in flight for one request.  */
+  disk->max_agglomerate = (ns->ctrl->max_transfer * ns->ctrl->nslots)
+    >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+  disk->data = ns;
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_size_t size, char *buf)
+{
+  struct grub_disk_vec vec = { sector, size, buf };
+
+  return grub_nvme_transfer (disk, &vec, 1, 0);
+}
+
+static grub_err_t
+grub_nvme_write (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, const char *buf)
+{
+  struct grub_disk_vec vec = { sector, size, (char *) buf };
+
+  return grub_nvme_transfer (disk, &vec, 1, 1);
+}
+
+static grub_err_t
+grub_nvme_read_vec (grub_disk_t disk, const struct grub_disk_vec *vec,
+		    grub_size_t n)
+{
+  return grub_nvme_transfer (disk, vec, n, 0);
+}
+
+static struct grub_disk_dev grub_nvme_dev =
+  {
+    .name = "nvme",
+    .id = GRUB_DISK_DEVICE_NVME_ID,
+    .iterate = grub_nvme_iterate,
+    .open = grub_nvme_open,
+    .read = grub_nvme_read,
+    .write = grub_nvme_write,
+    .read_vec = grub_nvme_read_vec,
+    .next = 0
+  };
+
+static grub_err_t
+grub_nvme_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_nvme_ctrl *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_ctrls)
+    grub_nvme_ctrl_fini (ctrl);
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_restore_hw (void)
+{
+  struct grub_nvme_ctrl *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_ctrls)
+    if (grub_nvme_ctrl_init (ctrl))
+      {
+	grub_dprintf ("nvme", "couldn't reinitialize controller: %s\n",
+		      grub_errmsg);
+	grub_errno = GRUB_ERR_NONE;
+      }
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_preboot *fini_hnd;
+
+GRUB_MOD_INIT(nvme)
+{
+  grub_stop_disk_firmware ();
+
+  grub_pci_iterate (grub_nvme_pciinit, NULL);
+
+  grub_disk_dev_register (&grub_nvme_dev);
+
+  fini_hnd = grub_loader_register_preboot_hook (grub_nvme_fini_hw,
+						grub_nvme_restore_hw,
+						GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI(nvme)
+{
+  struct grub_nvme_ctrl *ctrl, *next_ctrl;
+  struct grub_nvme_ns *ns, *next_ns;
+
+  grub_nvme_fini_hw (0);
+  grub_loader_unregister_preboot_hook (fini_hnd);
+  grub_disk_dev_unregister (&grub_nvme_dev);
+
+  for (ns = grub_nvme_namespaces; ns; ns = next_ns)
+    {
+      next_ns = ns->next;
+      grub_free (ns);
+    }
+  grub_nvme_namespaces = NULL;
+
+  for (ctrl = grub_nvme_ctrls; ctrl; ctrl = next_ctrl)
+    {
+      next_ctrl = ctrl->next;
+      grub_free (ctrl);
+    }
+  grub_nvme_ctrls = NULL;
+}
@@ -27,22 +27,151 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+#if defined (GRUB_MACHINE_EFI) && defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#define RAID6_SIMD	1
+#elif defined (GRUB_MACHINE_EFI) && defined (__aarch64__)
+#define RAID6_SIMD	1
+#endif
+
 /* x**y.  */
 static grub_uint8_t powx[255 * 2];
 /* Such an s that x**s = y */
 static unsigned powx_inv[256];
 static const grub_uint8_t poly = 0x1d;
 
+/* Multiplying by a constant is linear, so the product of a byte is the
+   XOR of the products of its two nibbles: 32 bytes of table, which is
+   what PSHUFB and TBL look up 16 bytes at a time.  */
+struct raid6_mul_table
+{
+  grub_uint8_t lo[16];
+  grub_uint8_t hi[16];
+};
+
+typedef void (*raid6_xor_t) (grub_uint8_t *dst, const grub_uint8_t *src,
+			     grub_size_t size);
+typedef void (*raid6_mul_t) (const struct raid6_mul_table *table,
+			     grub_uint8_t *dst, const grub_uint8_t *src,
+			     grub_size_t size);
+
+static void
+raid6_xor_generic (grub_uint8_t *dst, const grub_uint8_t *src,
+		   grub_size_t size)
+{
+  grub_crypto_xor (dst, dst, src, size);
+}
+
 static void
-grub_raid_block_mulx (unsigned mul, char *buf, grub_size_t size)
+raid6_mul_generic (const struct raid6_mul_table *table, grub_uint8_t *dst,
+		   const grub_uint8_t *src, grub_size_t size)
 {
   grub_size_t i;
-  grub_uint8_t *p;
 
-  p = (grub_uint8_t *) buf;
-  for (i = 0; i < size; i++, p++)
-    if (*p)
-      *p = powx[mul + powx_inv[*p]];
+  for (i = 0; i < size; i++)
+    dst[i] = table->lo[src[i] & 0xf] ^ table->hi[src[i] >> 4];
+}
+
+static void
+raid6_mul_xor_generic (const struct raid6_mul_table *table, grub_uint8_t *dst,
+		       const grub_uint8_t *src, grub_size_t size)
+{
+  grub_size_t i;
+
+  for (i = 0; i < size; i++)
+    dst[i] ^= table->lo[src[i] & 0xf] ^ table->hi[src[i] >> 4];
+}
+
+#ifdef RAID6_SIMD
+/* In lib/ARCH/raid6_simd.S.  XOR takes multiples of 64 bytes, the
+   multiplications multiples of 32.  */
+#ifdef __x86_64__
+void grub_raid6_xor_sse2 (grub_uint8_t *dst, const grub_uint8_t *src,
+			  grub_size_t size);
+void grub_raid6_mul_ssse3 (const struct raid6_mul_table *table,
+			   grub_uint8_t *dst, const grub_uint8_t *src,
+			   grub_size_t size);
+void grub_raid6_mul_xor_ssse3 (const struct raid6_mul_table *table,
+			       grub_uint8_t *dst, const grub_uint8_t *src,
+			       grub_size_t size);
+#define raid6_xor_simd		grub_raid6_xor_sse2
+#define raid6_mul_simd		grub_raid6_mul_ssse3
+#define raid6_mul_xor_simd	grub_raid6_mul_xor_ssse3
+#else
+void grub_raid6_xor_neon (grub_uint8_t *dst, const grub_uint8_t *src,
+			  grub_size_t size);
+void grub_raid6_mul_neon (const struct raid6_mul_table *table,
+			  grub_uint8_t *dst, const grub_uint8_t *src,
+			  grub_size_t size);
+void grub_raid6_mul_xor_neon (const struct raid6_mul_table *table,
+			      grub_uint8_t *dst, const grub_uint8_t *src,
+			      grub_size_t size);
+#define raid6_xor_simd		grub_raid6_xor_neon
+#define raid6_mul_simd		grub_raid6_mul_neon
+#define raid6_mul_xor_simd	grub_raid6_mul_xor_neon
+#endif
+
+static void
+raid6_xor_vec (grub_uint8_t *dst, const grub_uint8_t *src, grub_size_t size)
+{
+  grub_size_t n = size & ~(grub_size_t) 63;
+
+  raid6_xor_simd (dst, src, n);
+  raid6_xor_generic (dst + n, src + n, size - n);
+}
+
+static void
+raid6_mul_vec (const struct raid6_mul_table *table, grub_uint8_t *dst,
+	       const grub_uint8_t *src, grub_size_t size)
+{
+  grub_size_t n = size & ~(grub_size_t) 31;
+
+  raid6_mul_simd (table, dst, src, n);
+  raid6_mul_generic (table, dst + n, src + n, size - n);
+}
+
+static void
+raid6_mul_xor_vec (const struct raid6_mul_table *table, grub_uint8_t *dst,
+		   const grub_uint8_t *src, grub_size_t size)
+{
+  grub_size_t n = size & ~(grub_size_t) 31;
+
+  raid6_mul_xor_simd (table, dst, src, n);
+  raid6_mul_xor_generic (table, dst + n, src + n, size - n);
+}
+
+static int
+raid6_simd_supported (void)
+{
+#ifdef __x86_64__
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  /* SSE2 is part of x86_64; CPUID.01H:ECX.SSSE3 adds PSHUFB.  */
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  return !!(ecx & (1 << 9));
+#else
+  /* Advanced SIMD is mandatory on AArch64.  */
+  return 1;
+#endif
+}
+#endif
+
+static raid6_xor_t raid6_xor = raid6_xor_generic;
+static raid6_mul_t raid6_mul = raid6_mul_generic;
+static raid6_mul_t raid6_mul_xor = raid6_mul_xor_generic;
+
+/* TABLE for multiplying by x**MUL.  */
+static void
+grub_raid6_mul_table (struct raid6_mul_table *table, unsigned mul)
+{
+  unsigned i;
+
+  table->lo[0] = table->hi[0] = 0;
+  for (i = 1; i < 16; i++)
+    {
+      table->lo[i] = powx[mul + powx_inv[i]];
+      table->hi[i] = powx[mul + powx_inv[i << 4]];
+    }
 }
 
 static void
@@ -78,15 +207,18 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
                     char *buf, grub_disk_addr_t sector, grub_size_t size)
 {
   int i, q, pos;
-  int bad1 = -1, bad2 = -1;
-  char *pbuf = 0, *qbuf = 0;
+  int bad1, bad2;
+  int have_p, need_q;
+  grub_uint8_t *pbuf = 0, *qbuf = 0;
+  struct raid6_mul_table table;
+  grub_size_t nsec = size;
 
   size <<= GRUB_DISK_SECTOR_BITS;
-  pbuf = grub_zalloc (size);
+  pbuf = grub_malloc (size);
   if (!pbuf)
     goto quit;
 
-  qbuf = grub_zalloc (size);
+  qbuf = grub_malloc (size);
   if (!qbuf)
     goto quit;
 
@@ -94,6 +226,20 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
   if (q == (int) array->node_count)
     q = 0;
 
+  /* Start from P: as long as only one data device is missing, XORing
+     the others into it is all there is to do and Q is not needed.  */
+  have_p = ! grub_diskfilter_read_node (&array->nodes[p], sector, nsec,
+					(char *) pbuf);
+  if (!have_p)
+    grub_errno = GRUB_ERR_NONE;
+  need_q = !have_p;
+
+ again:
+  bad1 = -1;
+  bad2 = -1;
+  if (need_q)
+    grub_memset (qbuf, 0, size);
+
   pos = q + 1;
   if (pos == (int) array->node_count)
     pos = 0;
@@ -110,20 +256,35 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
       else
         {
           if (! grub_diskfilter_read_node (&array->nodes[pos], sector,
-					   size >> GRUB_DISK_SECTOR_BITS, buf))
+					   nsec, buf))
             {
-              grub_crypto_xor (pbuf, pbuf, buf, size);
-              grub_raid_block_mulx (c, buf, size);
-              grub_crypto_xor (qbuf, qbuf, buf, size);
+	      if (have_p)
+		raid6_xor (pbuf, (grub_uint8_t *) buf, size);
+	      if (need_q)
+		{
+		  grub_raid6_mul_table (&table, c);
+		  raid6_mul_xor (&table, qbuf, (grub_uint8_t *) buf, size);
+		}
             }
           else
             {
               /* Too many bad devices */
-              if (bad2 >= 0)
+              if (bad2 >= 0 || !have_p)
                 goto quit;
 
               bad2 = c;
               grub_errno = GRUB_ERR_NONE;
+
+	      if (!need_q)
+		{
+		  /* Two data devices are missing after all: start over,
+		     accumulating Q this time.  */
+		  need_q = 1;
+		  if (grub_diskfilter_read_node (&array->nodes[p], sector,
+						 nsec, (char *) pbuf))
+		    goto quit;
+		  goto again;
+		}
             }
         }
 
@@ -139,48 +300,35 @@ grub_raid6_recover (struct grub_diskfilter_segment *array, int disknr, int p,
   if (bad2 < 0)
     {
       /* One bad device */
-      if ((! grub_diskfilter_read_node (&array->nodes[p], sector,
-					size >> GRUB_DISK_SECTOR_BITS, buf)))
+      if (have_p)
         {
-          grub_crypto_xor (buf, buf, pbuf, size);
+	  grub_memcpy (buf, pbuf, size);
           goto quit;
         }
 
-      grub_errno = GRUB_ERR_NONE;
-      if (grub_diskfilter_read_node (&array->nodes[q], sector,
-				     size >> GRUB_DISK_SECTOR_BITS, buf))
+      if (grub_diskfilter_read_node (&array->nodes[q], sector, nsec, buf))
         goto quit;
 
-      grub_crypto_xor (buf, buf, qbuf, size);
-      grub_raid_block_mulx (255 - bad1, buf,
-                           size);
+      raid6_xor ((grub_uint8_t *) buf, qbuf, size);
+      grub_raid6_mul_table (&table, 255 - bad1);
+      raid6_mul (&table, (grub_uint8_t *) buf, (grub_uint8_t *) buf, size);
     }
   else
     {
       /* Two bad devices */
       unsigned c;
 
-      if (grub_diskfilter_read_node (&array->nodes[p], sector,
-				     size >> GRUB_DISK_SECTOR_BITS, buf))
+      if (grub_diskfilter_read_node (&array->nodes[q], sector, nsec, buf))
         goto quit;
 
-      grub_crypto_xor (pbuf, pbuf, buf, size);
-
-      if (grub_diskfilter_read_node (&array->nodes[q], sector,
-				     size >> GRUB_DISK_SECTOR_BITS, buf))
-        goto quit;
-
-      grub_crypto_xor (qbuf, qbuf, buf, size);
+      raid6_xor (qbuf, (grub_uint8_t *) buf, size);
 
       c = mod_255((255 ^ bad1)
 		  + (255 ^ powx_inv[(powx[bad2 + (bad1 ^ 255)] ^ 1)]));
-      grub_raid_block_mulx (c, qbuf, size);
-
-      c = mod_255((unsigned) bad2 + c);
-      grub_raid_block_mulx (c, pbuf, size);
-
-      grub_crypto_xor (pbuf, pbuf, qbuf, size);
-      grub_memcpy (buf, pbuf, size);
+      grub_raid6_mul_table (&table, mod_255((unsigned) bad2 + c));
+      raid6_mul (&table, (grub_uint8_t *) buf, pbuf, size);
+      grub_raid6_mul_table (&table, c);
+      raid6_mul_xor (&table, (grub_uint8_t *) buf, qbuf, size);
     }
 
 quit:
@@ -193,6 +341,14 @@ quit:
 GRUB_MOD_INIT(raid6rec)
 {
   grub_raid6_init_table ();
+#ifdef RAID6_SIMD
+  if (raid6_simd_supported ())
+    {
+      raid6_xor = raid6_xor_vec;
+      raid6_mul = raid6_mul_vec;
+      raid6_mul_xor = raid6_mul_xor_vec;
+    }
+#endif
   grub_raid6_recover_func = grub_raid6_recover;
 }
 
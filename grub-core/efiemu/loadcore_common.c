@@ -31,6 +31,47 @@ static grub_ssize_t efiemu_core_size;
 static void *efiemu_core = 0;
 /* Linked list of segments */
 static grub_efiemu_segment_t efiemu_segments = 0;
+/* Name of the runtime file, to recognise it when it's loaded again.  */
+static char *efiemu_core_name = 0;
+
+/* The image of the last runtime unloaded.  Loading only reads it, so the
+   next load of the same file takes it instead of reading the file.  */
+static void *cached_core = 0;
+static char *cached_core_name = 0;
+static grub_ssize_t cached_core_size;
+static int cache_shrinker_registered;
+
+static void
+grub_efiemu_drop_cached_core (void)
+{
+  grub_free (cached_core);
+  grub_free (cached_core_name);
+  cached_core = 0;
+  cached_core_name = 0;
+}
+
+static grub_size_t
+grub_efiemu_shrink (grub_size_t bytes __attribute__ ((unused)))
+{
+  grub_size_t freed = cached_core ? cached_core_size : 0;
+
+  grub_efiemu_drop_cached_core ();
+  return freed;
+}
+
+static struct grub_mm_shrinker grub_efiemu_shrinker =
+  {
+    .shrink = grub_efiemu_shrink
+  };
+
+void
+grub_efiemu_loadcore_fini (void)
+{
+  if (cache_shrinker_registered)
+    grub_mm_shrinker_unregister (&grub_efiemu_shrinker);
+  cache_shrinker_registered = 0;
+  grub_efiemu_drop_cached_core ();
+}
 
 /* equivalent to sizeof (grub_efi_uintn_t) but taking the mode into account*/
 int
@@ -98,8 +139,23 @@ grub_efiemu_loadcore_unload(void)
 
   grub_efiemu_mode = GRUB_EFIEMU_NOTLOADED;
 
-  grub_free (efiemu_core);
+  if (efiemu_core && efiemu_core_name)
+    {
+      grub_efiemu_drop_cached_core ();
+      cached_core = efiemu_core;
+      cached_core_name = efiemu_core_name;
+      cached_core_size = efiemu_core_size;
+      if (! cache_shrinker_registered)
+	grub_mm_shrinker_register (&grub_efiemu_shrinker);
+      cache_shrinker_registered = 1;
+    }
+  else
+    {
+      grub_free (efiemu_core);
+      grub_free (efiemu_core_name);
+    }
   efiemu_core = 0;
+  efiemu_core_name = 0;
 
   grub_efiemu_unload_segs (efiemu_segments);
   efiemu_segments = 0;
@@ -116,18 +172,39 @@ grub_efiemu_loadcore_init (grub_file_t file,
 {
   grub_err_t err;
 
+  /* Left over from a load that failed.  */
+  grub_free (efiemu_core_name);
+  efiemu_core_name = 0;
+
   efiemu_core_size = grub_file_size (file);
   efiemu_core = 0;
-  efiemu_core = grub_malloc (efiemu_core_size);
-  if (! efiemu_core)
-    return grub_errno;
 
-  if (grub_file_read (file, efiemu_core, efiemu_core_size)
-      != (int) efiemu_core_size)
+  if (cached_core && cached_core_size == efiemu_core_size
+      && grub_strcmp (cached_core_name, filename) == 0)
     {
-      grub_free (efiemu_core);
-      efiemu_core = 0;
-      return grub_errno;
+      grub_dprintf ("efiemu", "reusing the image of %s\n", filename);
+      efiemu_core = cached_core;
+      efiemu_core_name = cached_core_name;
+      cached_core = 0;
+      cached_core_name = 0;
+    }
+  else
+    {
+      efiemu_core = grub_malloc (efiemu_core_size);
+      if (! efiemu_core)
+	return grub_errno;
+
+      if (grub_file_read (file, efiemu_core, efiemu_core_size)
+	  != (int) efiemu_core_size)
+	{
+	  grub_free (efiemu_core);
+	  efiemu_core = 0;
+	  return grub_errno;
+	}
+
+      /* Without the name the image just isn't kept.  */
+      efiemu_core_name = grub_strdup (filename);
+      grub_errno = GRUB_ERR_NONE;
     }
 
   if (grub_efiemu_check_header (efiemu_core, efiemu_core_size,
@@ -325,4 +325,5 @@ GRUB_MOD_FINI(efiemu)
   grub_unregister_command (cmd_loadcore);
   grub_unregister_command (cmd_prepare);
   grub_unregister_command (cmd_unload);
+  grub_efiemu_loadcore_fini ();
 }
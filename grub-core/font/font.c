@@ -205,7 +205,9 @@ font_init (grub_font_t font)
   font->descent = 0;
   font->num_chars = 0;
   font->char_index = 0;
-  font->bmp_idx = 0;
+  font->index_offset = 0;
+  font->index_page_loaded = 0;
+  font->latin_idx = 0;
 }
 
 /* Open the next section in the file.
@@ -263,17 +265,89 @@ open_section (grub_file_t file, struct font_file_section *section)
    entry in the font file.  */
 #define FONT_CHAR_INDEX_ENTRY_SIZE (4 + 1 + 4)
 
-/* Load the character index (CHIX) section contents from the font file.  This
+/* The character index is read in pages of this many entries, each when a
+   lookup first needs it, so that opening a large font doesn't cost a pass
+   over all of its index.  */
+#define FONT_INDEX_PAGE_SIZE 128
+
+/* Code points below this are looked up directly in `latin_idx'.  */
+#define FONT_LATIN_IDX_SIZE 0x100
+
+/* Read page PAGE of the character index of FONT, unless already done.
+   Returns 0 upon success, nonzero for failure (in which case grub_errno is
+   set appropriately).  */
+static int
+load_font_index_page (grub_font_t font, grub_uint32_t page)
+{
+  grub_uint8_t buf[FONT_INDEX_PAGE_SIZE * FONT_CHAR_INDEX_ENTRY_SIZE];
+  grub_uint32_t first, count, i;
+  grub_ssize_t len;
+
+  if (font->index_page_loaded[page])
+    return 0;
+
+  first = page * FONT_INDEX_PAGE_SIZE;
+  count = font->num_chars - first;
+  if (count > FONT_INDEX_PAGE_SIZE)
+    count = FONT_INDEX_PAGE_SIZE;
+  len = count * FONT_CHAR_INDEX_ENTRY_SIZE;
+
+  if (grub_file_seek (font->file, font->index_offset
+		      + first * FONT_CHAR_INDEX_ENTRY_SIZE) == (grub_off_t) -1)
+    return 1;
+  if (grub_file_read (font->file, buf, len) != len)
+    {
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_FONT, "premature end of font index");
+      return 1;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      struct char_index_entry *entry = &font->char_index[first + i];
+      const grub_uint8_t *ptr = buf + i * FONT_CHAR_INDEX_ENTRY_SIZE;
+
+      entry->code = grub_be_to_cpu32 (grub_get_unaligned32 (ptr));
+
+      /* Verify that characters are in ascending order, as far as the
+	 loaded part of the index shows.  */
+      if ((i != 0 || (page != 0 && font->index_page_loaded[page - 1]))
+	  && entry->code <= entry[-1].code)
+	return grub_error (GRUB_ERR_BAD_FONT,
+			   "font characters not in ascending order: %u <= %u",
+			   entry->code, entry[-1].code);
+
+      if (entry->code < FONT_LATIN_IDX_SIZE)
+	font->latin_idx[entry->code] = first + i;
+
+      entry->storage_flags = ptr[4];
+      entry->offset = grub_be_to_cpu32 (grub_get_unaligned32 (ptr + 5));
+
+      /* No glyph loaded.  Will be loaded on demand and cached thereafter.  */
+      entry->glyph = 0;
+
+#if FONT_DEBUG >= 5
+      /* Print the 1st 10 characters.  */
+      if (first + i < 10)
+	grub_dprintf ("font", "c=%d o=%d\n", entry->code, entry->offset);
+#endif
+    }
+
+  font->index_page_loaded[page] = 1;
+  return 0;
+}
+
+/* Set up the character index (CHIX) section of the font file.  This
    presumes that the position of FILE is positioned immediately after the
    section length for the CHIX section (i.e., at the start of the section
-   contents).  Returns 0 upon success, nonzero for failure (in which case
-   grub_errno is set appropriately).  */
+   contents), and leaves it at the end of the section.  Only the pages
+   holding `latin_idx' are read now.  Returns 0 upon success, nonzero for
+   failure (in which case grub_errno is set appropriately).  */
 static int
 load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 		 grub_font *font)
 {
-  unsigned i;
-  grub_uint32_t last_code;
+  grub_uint32_t num_pages, page;
 
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "load_font_index(sect_length=%d)\n", sect_length);
@@ -291,67 +365,51 @@ load_font_index (grub_file_t file, grub_uint32_t sect_length, struct
 
   /* Calculate the number of characters.  */
   font->num_chars = sect_length / FONT_CHAR_INDEX_ENTRY_SIZE;
+  if (font->num_chars == 0)
+    return 0;
+  num_pages = (font->num_chars + FONT_INDEX_PAGE_SIZE - 1)
+    / FONT_INDEX_PAGE_SIZE;
 
-  /* Allocate the character index array.  */
+  /* Allocate the character index array.  Entries are filled as their
+     page is read.  */
   font->char_index = grub_malloc (font->num_chars
 				  * sizeof (struct char_index_entry));
   if (!font->char_index)
     return 1;
-  font->bmp_idx = grub_malloc (0x10000 * sizeof (grub_uint16_t));
-  if (!font->bmp_idx)
+  font->index_page_loaded = grub_zalloc (num_pages);
+  if (!font->index_page_loaded)
     return 1;
-  grub_memset (font->bmp_idx, 0xff, 0x10000 * sizeof (grub_uint16_t));
-
+  font->latin_idx = grub_malloc (FONT_LATIN_IDX_SIZE * sizeof (grub_uint16_t));
+  if (!font->latin_idx)
+    return 1;
+  grub_memset (font->latin_idx, 0xff,
+	       FONT_LATIN_IDX_SIZE * sizeof (grub_uint16_t));
 
 #if FONT_DEBUG >= 2
   grub_dprintf ("font", "num_chars=%d)\n", font->num_chars);
 #endif
 
-  last_code = 0;
+  font->index_offset = grub_file_tell (file);
 
-  /* Load the character index data from the file.  */
-  for (i = 0; i < font->num_chars; i++)
+  /* Characters are sorted, so the pages up to the first code point past
+     `latin_idx' hold all of its entries.  */
+  for (page = 0; page < num_pages; page++)
     {
-      struct char_index_entry *entry = &font->char_index[i];
-
-      /* Read code point value; convert to native byte order.  */
-      if (grub_file_read (file, &entry->code, 4) != 4)
-	return 1;
-      entry->code = grub_be_to_cpu32 (entry->code);
-
-      /* Verify that characters are in ascending order.  */
-      if (i != 0 && entry->code <= last_code)
-	{
-	  grub_error (GRUB_ERR_BAD_FONT,
-		      "font characters not in ascending order: %u <= %u",
-		      entry->code, last_code);
-	  return 1;
-	}
-
-      if (entry->code < 0x10000)
-	font->bmp_idx[entry->code] = i;
-
-      last_code = entry->code;
+      grub_uint32_t last;
 
-      /* Read storage flags byte.  */
-      if (grub_file_read (file, &entry->storage_flags, 1) != 1)
+      if (load_font_index_page (font, page) != 0)
 	return 1;
-
-      /* Read glyph data offset; convert to native byte order.  */
-      if (grub_file_read (file, &entry->offset, 4) != 4)
-	return 1;
-      entry->offset = grub_be_to_cpu32 (entry->offset);
-
-      /* No glyph loaded.  Will be loaded on demand and cached thereafter.  */
-      entry->glyph = 0;
-
-#if FONT_DEBUG >= 5
-      /* Print the 1st 10 characters.  */
-      if (i < 10)
-	grub_dprintf ("font", "c=%d o=%d\n", entry->code, entry->offset);
-#endif
+      last = (page + 1) * FONT_INDEX_PAGE_SIZE - 1;
+      if (last >= font->num_chars)
+	last = font->num_chars - 1;
+      if (font->char_index[last].code >= FONT_LATIN_IDX_SIZE)
+	break;
     }
 
+  if (grub_file_seek (file, font->index_offset + sect_length)
+      == (grub_off_t) -1)
+    return 1;
+
   return 0;
 }
 
@@ -417,8 +475,12 @@ grub_font_load (const char *filename)
   grub_dprintf ("font", "add_font(%s)\n", filename);
 #endif
 
+  /* Fonts are never compressed.  */
   if (filename[0] == '(' || filename[0] == '/' || filename[0] == '+')
-    file = grub_buffile_open (filename, 1024);
+    {
+      grub_file_filter_disable_compression ();
+      file = grub_buffile_open (filename, 1024, GRUB_BUFIO_HINT_RANDOM);
+    }
   else
     {
       const char *prefix = grub_env_get ("prefix");
@@ -438,7 +500,8 @@ grub_font_load (const char *filename)
       ptr = grub_stpcpy (ptr, filename);
       ptr = grub_stpcpy (ptr, ".pf2");
       *ptr = 0;
-      file = grub_buffile_open (fullname, 1024);
+      grub_file_filter_disable_compression ();
+      file = grub_buffile_open (fullname, 1024, GRUB_BUFIO_HINT_RANDOM);
       grub_free (fullname);
     }
   if (!file)
@@ -677,32 +740,68 @@ static inline struct char_index_entry *
 find_glyph (const grub_font_t font, grub_uint32_t code)
 {
   struct char_index_entry *table;
-  grub_size_t lo;
-  grub_size_t hi;
-  grub_size_t mid;
+  grub_uint32_t lo, hi, mid;
+  grub_uint32_t first, count;
 
   table = font->char_index;
+  if (!table)
+    return 0;
 
-  /* Use BMP index if possible.  */
-  if (code < 0x10000 && font->bmp_idx)
+  /* All of `latin_idx' is filled when the font is loaded.  */
+  if (code < FONT_LATIN_IDX_SIZE)
     {
-      if (font->bmp_idx[code] == 0xffff)
+      if (font->latin_idx[code] == 0xffff)
 	return 0;
-      return &table[font->bmp_idx[code]];
+      return &table[font->latin_idx[code]];
     }
 
-  /* Do a binary search in `char_index', which is ordered by code point.  */
+  /* Do a binary search over the pages of `char_index', which is ordered
+     by code point, reading those it visits.  */
   lo = 0;
-  hi = font->num_chars - 1;
+  hi = (font->num_chars + FONT_INDEX_PAGE_SIZE - 1) / FONT_INDEX_PAGE_SIZE;
+  first = count = 0;
 
-  if (!table)
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+
+      if (!font->index_page_loaded[mid])
+	{
+	  int err;
+
+	  /* Keep any pending error message, as glyph loading does; a page
+	     that can't be read just has no glyphs.  */
+	  grub_error_push ();
+	  err = load_font_index_page (font, mid);
+	  grub_error_pop ();
+	  if (err)
+	    return 0;
+	}
+
+      first = mid * FONT_INDEX_PAGE_SIZE;
+      count = font->num_chars - first;
+      if (count > FONT_INDEX_PAGE_SIZE)
+	count = FONT_INDEX_PAGE_SIZE;
+
+      if (code < table[first].code)
+	hi = mid;
+      else if (code > table[first + count - 1].code)
+	lo = mid + 1;
+      else
+	break;
+    }
+
+  if (lo >= hi)
     return 0;
 
-  while (lo <= hi)
+  /* Then within the page.  */
+  lo = first;
+  hi = first + count;
+  while (lo < hi)
     {
       mid = lo + (hi - lo) / 2;
       if (code < table[mid].code)
-	hi = mid - 1;
+	hi = mid;
       else if (code > table[mid].code)
 	lo = mid + 1;
       else
@@ -808,7 +907,8 @@ free_font (grub_font_t font)
       grub_free (font->name);
       grub_free (font->family);
       grub_free (font->char_index);
-      grub_free (font->bmp_idx);
+      grub_free (font->index_page_loaded);
+      grub_free (font->latin_idx);
       grub_free (font);
     }
 }
@@ -1488,13 +1588,17 @@ grub_font_get_constructed_device_width (grub_font_t hinted_font,
   return ret;
 }
 
+/* Combined glyphs are built in this buffer, reused from one call to the
+   next.  */
+static struct grub_font_glyph *constructed_glyph;
+
 struct grub_font_glyph *
 grub_font_construct_glyph (grub_font_t hinted_font,
 			   const struct grub_unicode_glyph *glyph_id)
 {
   struct grub_font_glyph *main_glyph;
   struct grub_video_signed_rect bounds;
-  static struct grub_font_glyph *glyph = 0;
+  struct grub_font_glyph *glyph = constructed_glyph;
   static grub_size_t max_glyph_size = 0;
 
   ensure_comb_space (glyph_id);
@@ -1518,7 +1622,7 @@ grub_font_construct_glyph (grub_font_t hinted_font,
       max_glyph_size = (sizeof (*glyph) + (bounds.width * bounds.height + GRUB_CHAR_BIT - 1) / GRUB_CHAR_BIT) * 2;
       if (max_glyph_size < 8)
 	max_glyph_size = 8;
-      glyph = grub_malloc (max_glyph_size);
+      glyph = constructed_glyph = grub_malloc (max_glyph_size);
     }
   if (!glyph)
     {
@@ -1553,6 +1657,195 @@ grub_font_construct_glyph (grub_font_t hinted_font,
   return glyph;
 }
 
+/* Glyphs drawn to a 32-bit target are converted once into a bitmap of
+   the target's format and colour, kept in a small LRU cache, so drawing
+   them again is a same-format blend instead of expanding bits.  Glyphs
+   stay allocated for as long as their font, which is never freed once
+   registered, so they are keyed by address; the combined glyph buffer,
+   whose contents change from call to call, is not cached.  */
+#define GLYPH_CACHE_SIZE	256
+#define GLYPH_CACHE_HASH	64
+/* Larger glyphs are rare and would crowd out the common ones.  */
+#define GLYPH_CACHE_MAX_PIXELS	(64 * 64)
+
+struct glyph_cache_entry
+{
+  struct glyph_cache_entry *hash_next;
+  struct glyph_cache_entry *lru_prev, *lru_next;
+  struct grub_font_glyph *glyph;
+  grub_video_color_t color;
+  enum grub_video_blit_format format;
+  /* The bitmap header followed by its pixels, or NULL if unused.  */
+  struct grub_video_bitmap *bitmap;
+};
+
+static struct glyph_cache_entry glyph_cache[GLYPH_CACHE_SIZE];
+static struct glyph_cache_entry *glyph_cache_hash[GLYPH_CACHE_HASH];
+/* Most recently used first.  */
+static struct glyph_cache_entry *glyph_cache_head, *glyph_cache_tail;
+
+static inline unsigned
+glyph_cache_bucket (struct grub_font_glyph *glyph, grub_video_color_t color)
+{
+  return (((grub_addr_t) glyph >> 4) ^ color) % GLYPH_CACHE_HASH;
+}
+
+static void
+glyph_cache_move_to_head (struct glyph_cache_entry *entry)
+{
+  if (glyph_cache_head == entry)
+    return;
+
+  /* Unlink.  */
+  entry->lru_prev->lru_next = entry->lru_next;
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    glyph_cache_tail = entry->lru_prev;
+
+  entry->lru_prev = 0;
+  entry->lru_next = glyph_cache_head;
+  glyph_cache_head->lru_prev = entry;
+  glyph_cache_head = entry;
+}
+
+/* Make ENTRY unused.  */
+static void
+glyph_cache_evict (struct glyph_cache_entry *entry)
+{
+  struct glyph_cache_entry **p;
+
+  if (!entry->bitmap)
+    return;
+
+  for (p = &glyph_cache_hash[glyph_cache_bucket (entry->glyph, entry->color)];
+       *p; p = &(*p)->hash_next)
+    if (*p == entry)
+      {
+	*p = entry->hash_next;
+	break;
+      }
+
+  grub_free (entry->bitmap);
+  entry->bitmap = 0;
+}
+
+static struct grub_video_bitmap *
+glyph_cache_create_bitmap (struct grub_font_glyph *glyph,
+			   grub_video_color_t color,
+			   enum grub_video_blit_format format)
+{
+  struct grub_video_bitmap *bitmap;
+  struct grub_video_mode_info *mode_info;
+  grub_uint32_t *pixels, fg;
+  grub_uint8_t r, g, b, a;
+  unsigned i, n = glyph->width * glyph->height;
+
+  bitmap = grub_zalloc (sizeof (*bitmap) + n * sizeof (grub_uint32_t));
+  if (!bitmap)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  mode_info = &bitmap->mode_info;
+  mode_info->width = glyph->width;
+  mode_info->height = glyph->height;
+  mode_info->mode_type = GRUB_VIDEO_MODE_TYPE_RGB | GRUB_VIDEO_MODE_TYPE_ALPHA;
+  mode_info->blit_format = format;
+  mode_info->bpp = 32;
+  mode_info->bytes_per_pixel = 4;
+  mode_info->pitch = glyph->width * 4;
+  mode_info->number_of_colors = 256;
+  mode_info->red_mask_size = 8;
+  mode_info->green_mask_size = 8;
+  mode_info->green_field_pos = 8;
+  mode_info->blue_mask_size = 8;
+  mode_info->reserved_mask_size = 8;
+  mode_info->reserved_field_pos = 24;
+
+  grub_video_unmap_color (color, &r, &g, &b, &a);
+  if (format == GRUB_VIDEO_BLIT_FORMAT_BGRA_8888)
+    {
+      mode_info->red_field_pos = 16;
+      fg = ((grub_uint32_t) a << 24) | (r << 16) | (g << 8) | b;
+    }
+  else
+    {
+      mode_info->blue_field_pos = 16;
+      fg = ((grub_uint32_t) a << 24) | (b << 16) | (g << 8) | r;
+    }
+
+  pixels = (grub_uint32_t *) (bitmap + 1);
+  bitmap->data = pixels;
+  for (i = 0; i < n; i++)
+    if (glyph->bitmap[i >> 3] & (0x80 >> (i & 7)))
+      pixels[i] = fg;
+
+  return bitmap;
+}
+
+/* Return GLYPH in COLOR converted for the current render target, or NULL
+   if it is not cached and can't be.  */
+static struct grub_video_bitmap *
+glyph_cache_get (struct grub_font_glyph *glyph, grub_video_color_t color)
+{
+  struct grub_video_mode_info mode_info;
+  enum grub_video_blit_format format;
+  struct glyph_cache_entry *entry;
+  unsigned bucket;
+
+  if (glyph == constructed_glyph
+      || glyph->width * glyph->height > GLYPH_CACHE_MAX_PIXELS
+      || grub_video_get_info (&mode_info) != GRUB_ERR_NONE)
+    return 0;
+
+  format = grub_video_get_blit_format (&mode_info);
+  if (format != GRUB_VIDEO_BLIT_FORMAT_BGRA_8888
+      && format != GRUB_VIDEO_BLIT_FORMAT_RGBA_8888)
+    return 0;
+
+  bucket = glyph_cache_bucket (glyph, color);
+  for (entry = glyph_cache_hash[bucket]; entry; entry = entry->hash_next)
+    if (entry->glyph == glyph && entry->color == color
+	&& entry->format == format)
+      {
+	glyph_cache_move_to_head (entry);
+	return entry->bitmap;
+      }
+
+  if (!glyph_cache_head)
+    {
+      unsigned i;
+
+      for (i = 0; i < GLYPH_CACHE_SIZE; i++)
+	{
+	  glyph_cache[i].lru_prev = i ? &glyph_cache[i - 1] : 0;
+	  glyph_cache[i].lru_next
+	    = (i + 1 < GLYPH_CACHE_SIZE) ? &glyph_cache[i + 1] : 0;
+	}
+      glyph_cache_head = &glyph_cache[0];
+      glyph_cache_tail = &glyph_cache[GLYPH_CACHE_SIZE - 1];
+    }
+
+  /* Reuse the least recently used entry.  */
+  entry = glyph_cache_tail;
+  glyph_cache_evict (entry);
+
+  entry->bitmap = glyph_cache_create_bitmap (glyph, color, format);
+  if (!entry->bitmap)
+    return 0;
+
+  entry->glyph = glyph;
+  entry->color = color;
+  entry->format = format;
+  entry->hash_next = glyph_cache_hash[bucket];
+  glyph_cache_hash[bucket] = entry;
+  glyph_cache_move_to_head (entry);
+
+  return entry->bitmap;
+}
+
 /* Draw the specified glyph at (x, y).  The y coordinate designates the
    baseline of the character, while the x coordinate designates the left
    side location of the character.  */
@@ -1562,10 +1855,22 @@ grub_font_draw_glyph (struct grub_font_glyph * glyph,
 {
   struct grub_video_bitmap glyph_bitmap;
 
+  struct grub_video_bitmap *cached;
+  int bitmap_left, bitmap_top;
+
   /* Don't try to draw empty glyphs (U+0020, etc.).  */
   if (glyph->width == 0 || glyph->height == 0)
     return GRUB_ERR_NONE;
 
+  bitmap_left = left_x + glyph->offset_x;
+  bitmap_top = baseline_y - glyph->offset_y - glyph->height;
+
+  cached = glyph_cache_get (glyph, color);
+  if (cached)
+    return grub_video_blit_bitmap (cached, GRUB_VIDEO_BLIT_BLEND,
+				   bitmap_left, bitmap_top,
+				   0, 0, glyph->width, glyph->height);
+
   glyph_bitmap.mode_info.width = glyph->width;
   glyph_bitmap.mode_info.height = glyph->height;
   glyph_bitmap.mode_info.mode_type
@@ -1591,10 +1896,6 @@ grub_font_draw_glyph (struct grub_font_glyph * glyph,
 			  &glyph_bitmap.mode_info.fg_alpha);
   glyph_bitmap.data = glyph->bitmap;
 
-  int bitmap_left = left_x + glyph->offset_x;
-  int bitmap_bottom = baseline_y - glyph->offset_y;
-  int bitmap_top = bitmap_bottom - glyph->height;
-
   return grub_video_blit_bitmap (&glyph_bitmap, GRUB_VIDEO_BLIT_BLEND,
 				 bitmap_left, bitmap_top,
 				 0, 0, glyph->width, glyph->height);
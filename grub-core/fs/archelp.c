@@ -20,7 +20,10 @@
 #include <grub/err.h>
 #include <grub/fs.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
+#include <grub/mm.h>
 #include <grub/dl.h>
+#include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -133,6 +136,390 @@ handle_symlink (struct grub_archelp_data *data,
   return GRUB_ERR_NONE;
 }
 
+/* Listing a directory or opening a file walks every header of the
+   archive, and an initrd has thousands.  So the first walk over a device
+   records every name, with the header it came from, in a hash table whose
+   entries also link each directory to its children.  Later mounts of the
+   same device look names up there and only read the one header they
+   need.  Backends opt in by providing tell, seek and get_disk.  */
+
+#define ARCHELP_HASH_SIZE	1024
+#define ARCHELP_MAX_INDICES	4
+/* The position of a directory only implied by the names below it.  */
+#define ARCHELP_NO_POS		((grub_off_t) -1)
+
+struct archelp_node
+{
+  struct archelp_node *hash_next;
+  struct archelp_node *first_child, *last_child, *next_sibling;
+  /* Header of the entry, or ARCHELP_NO_POS.  */
+  grub_off_t pos;
+  grub_int32_t mtime;
+  grub_uint32_t mode;
+  grub_uint32_t hash;
+  char name[0];
+};
+
+struct archelp_index
+{
+  struct archelp_index *next;
+  struct grub_archelp_ops *ops;
+  unsigned long dev_id, disk_id;
+  grub_disk_addr_t part_start;
+  /* Held while a lookup uses it; a flush during one only marks it.  */
+  int refs;
+  int dropped;
+  struct archelp_node *root;
+  struct archelp_node *table[ARCHELP_HASH_SIZE];
+};
+
+static struct archelp_index *archelp_indices;
+
+static grub_uint32_t
+archelp_hash (const char *name, grub_size_t len)
+{
+  grub_uint32_t h = 2166136261U;
+
+  while (len--)
+    h = (h ^ (grub_uint8_t) *name++) * 16777619U;
+  return h;
+}
+
+static struct archelp_node *
+archelp_lookup (struct archelp_index *idx, const char *name, grub_size_t len)
+{
+  grub_uint32_t hash = archelp_hash (name, len);
+  struct archelp_node *n;
+
+  if (len == 0)
+    return idx->root;
+  for (n = idx->table[hash % ARCHELP_HASH_SIZE]; n; n = n->hash_next)
+    if (n->hash == hash && grub_strncmp (n->name, name, len) == 0
+	&& n->name[len] == 0)
+      return n;
+  return 0;
+}
+
+/* Find or add the node for the first LEN bytes of NAME, along with its
+   parents.  */
+static struct archelp_node *
+archelp_insert (struct archelp_index *idx, const char *name, grub_size_t len,
+		grub_int32_t mtime, grub_uint32_t mode)
+{
+  struct archelp_node *n, *parent;
+  grub_size_t plen;
+
+  n = archelp_lookup (idx, name, len);
+  if (n)
+    return n;
+
+  for (plen = len; plen > 0 && name[plen - 1] != '/'; plen--);
+  parent = archelp_insert (idx, name, plen ? plen - 1 : 0, mtime,
+			   GRUB_ARCHELP_ATTR_DIR
+			   | (mode & GRUB_ARCHELP_ATTR_NOTIME));
+  if (!parent)
+    return 0;
+
+  n = grub_zalloc (sizeof (*n) + len + 1);
+  if (!n)
+    return 0;
+  grub_memcpy (n->name, name, len);
+  n->name[len] = 0;
+  n->pos = ARCHELP_NO_POS;
+  n->mtime = mtime;
+  n->mode = mode;
+  n->hash = archelp_hash (name, len);
+  n->hash_next = idx->table[n->hash % ARCHELP_HASH_SIZE];
+  idx->table[n->hash % ARCHELP_HASH_SIZE] = n;
+  if (parent->last_child)
+    parent->last_child->next_sibling = n;
+  else
+    parent->first_child = n;
+  parent->last_child = n;
+  return n;
+}
+
+static void
+archelp_index_free (struct archelp_index *idx)
+{
+  unsigned i;
+
+  for (i = 0; i < ARCHELP_HASH_SIZE; i++)
+    while (idx->table[i])
+      {
+	struct archelp_node *n = idx->table[i];
+	idx->table[i] = n->hash_next;
+	grub_free (n);
+      }
+  grub_free (idx->root);
+  grub_free (idx);
+}
+
+static void
+archelp_index_release (struct archelp_index *idx)
+{
+  if (--idx->refs == 0 && idx->dropped)
+    archelp_index_free (idx);
+}
+
+static void
+archelp_index_drop (struct archelp_index *idx)
+{
+  idx->dropped = 1;
+  if (idx->refs == 0)
+    archelp_index_free (idx);
+}
+
+static void
+archelp_flush (void)
+{
+  while (archelp_indices)
+    {
+      struct archelp_index *idx = archelp_indices;
+      archelp_indices = idx->next;
+      archelp_index_drop (idx);
+    }
+}
+
+/* Walk the whole archive of DATA into a new index.  On failure the caller
+   goes back to walking the archive itself, and hits the same error where
+   it matters.  */
+static struct archelp_index *
+archelp_index_build (struct grub_archelp_data *data,
+		     struct grub_archelp_ops *arcops)
+{
+  struct archelp_index *idx;
+
+  idx = grub_zalloc (sizeof (*idx));
+  if (!idx)
+    return 0;
+  idx->root = grub_zalloc (sizeof (*idx->root) + 1);
+  if (!idx->root)
+    {
+      grub_free (idx);
+      return 0;
+    }
+  idx->root->pos = ARCHELP_NO_POS;
+  idx->root->mode = GRUB_ARCHELP_ATTR_DIR | GRUB_ARCHELP_ATTR_NOTIME;
+
+  arcops->rewind (data);
+  while (1)
+    {
+      grub_off_t pos = arcops->tell (data);
+      struct archelp_node *n;
+      grub_archelp_mode_t mode;
+      grub_int32_t mtime;
+      grub_size_t len;
+      char *name;
+
+      if (arcops->find_file (data, &name, &mtime, &mode))
+	goto fail;
+      if (mode == GRUB_ARCHELP_ATTR_END)
+	break;
+
+      canonicalize (name);
+      for (len = grub_strlen (name); len > 0 && name[len - 1] == '/'; len--);
+      n = len ? archelp_insert (idx, name, len, mtime, mode) : idx->root;
+      grub_free (name);
+      if (!n)
+	goto fail;
+      /* The first entry of a name is the one a walk would find.  */
+      if (n->pos == ARCHELP_NO_POS && n != idx->root)
+	{
+	  n->pos = pos;
+	  n->mtime = mtime;
+	  n->mode = mode;
+	}
+    }
+  arcops->rewind (data);
+  return idx;
+
+ fail:
+  grub_errno = GRUB_ERR_NONE;
+  arcops->rewind (data);
+  archelp_index_free (idx);
+  return 0;
+}
+
+/* Return the index of the archive DATA is mounted on, holding a reference
+   to it, or NULL if there is none to be had.  */
+static struct archelp_index *
+archelp_index_get (struct grub_archelp_data *data,
+		   struct grub_archelp_ops *arcops)
+{
+  struct archelp_index *idx, **p;
+  grub_disk_addr_t part_start;
+  grub_disk_t disk;
+  unsigned n;
+
+  if (!arcops->tell || !arcops->seek || !arcops->get_disk)
+    return 0;
+  disk = arcops->get_disk (data);
+  part_start = grub_partition_get_start (disk->partition);
+
+  for (p = &archelp_indices; *p; p = &(*p)->next)
+    {
+      idx = *p;
+      if (idx->ops == arcops && idx->dev_id == disk->dev->id
+	  && idx->disk_id == disk->id && idx->part_start == part_start)
+	{
+	  *p = idx->next;
+	  goto found;
+	}
+    }
+
+  idx = archelp_index_build (data, arcops);
+  if (!idx)
+    return 0;
+  idx->ops = arcops;
+  idx->dev_id = disk->dev->id;
+  idx->disk_id = disk->id;
+  idx->part_start = part_start;
+
+ found:
+  idx->next = archelp_indices;
+  archelp_indices = idx;
+  for (n = 1, p = &idx->next; *p; n++)
+    if (n >= ARCHELP_MAX_INDICES)
+      {
+	struct archelp_index *old = *p;
+	*p = old->next;
+	archelp_index_drop (old);
+      }
+    else
+      p = &(*p)->next;
+  idx->refs++;
+  return idx;
+}
+
+/* Position DATA on the entry of node N, as if a walk had just found it.  */
+static grub_err_t
+archelp_node_load (struct grub_archelp_data *data,
+		   struct grub_archelp_ops *arcops, struct archelp_node *n)
+{
+  grub_archelp_mode_t mode;
+  grub_int32_t mtime;
+  char *name;
+
+  arcops->seek (data, n->pos);
+  if (arcops->find_file (data, &name, &mtime, &mode))
+    return grub_errno;
+  grub_free (name);
+  if (mode == GRUB_ARCHELP_ATTR_END)
+    return grub_error (GRUB_ERR_BAD_FS, "archive changed under its index");
+  return GRUB_ERR_NONE;
+}
+
+/* Follow the first symlink along *NAME, the way handle_symlink would have
+   on the walk.  *RESTART is set if *NAME changed.  */
+static grub_err_t
+archelp_index_symlink (struct grub_archelp_data *data,
+		       struct grub_archelp_ops *arcops,
+		       struct archelp_index *idx, char **name, int *restart)
+{
+  grub_size_t len;
+  const char *p;
+
+  *restart = 0;
+  for (p = *name; ; p++)
+    {
+      if (*p != '/' && *p != 0)
+	continue;
+      len = p - *name;
+      if (len)
+	{
+	  struct archelp_node *n = archelp_lookup (idx, *name, len);
+
+	  if (!n)
+	    return GRUB_ERR_NONE;
+	  if (n->pos != ARCHELP_NO_POS
+	      && (n->mode & GRUB_ARCHELP_ATTR_TYPE) == GRUB_ARCHELP_ATTR_LNK)
+	    {
+	      if (archelp_node_load (data, arcops, n))
+		return grub_errno;
+	      return handle_symlink (data, arcops, n->name, name, n->mode,
+				     restart);
+	    }
+	}
+      if (*p == 0)
+	return GRUB_ERR_NONE;
+    }
+}
+
+static grub_err_t
+archelp_index_dir (struct grub_archelp_data *data,
+		   struct grub_archelp_ops *arcops,
+		   struct archelp_index *idx, char **path,
+		   grub_fs_dir_hook_t hook, void *hook_data)
+{
+  struct archelp_node *dir, *n;
+  int symlinknest = 0;
+
+  while (1)
+    {
+      int restart;
+
+      dir = archelp_lookup (idx, *path, grub_strlen (*path));
+      if (dir && (dir->mode & GRUB_ARCHELP_ATTR_TYPE) != GRUB_ARCHELP_ATTR_LNK)
+	break;
+      if (archelp_index_symlink (data, arcops, idx, path, &restart))
+	return grub_errno;
+      if (!restart)
+	return GRUB_ERR_NONE;
+      if (++symlinknest == 8)
+	return grub_error (GRUB_ERR_SYMLINK_LOOP,
+			   N_("too deep nesting of symlinks"));
+    }
+
+  for (n = dir->first_child; n; n = n->next_sibling)
+    {
+      struct grub_dirhook_info info;
+      const char *base = n->name + grub_strlen (dir->name);
+
+      if (*base == '/')
+	base++;
+      grub_memset (&info, 0, sizeof (info));
+      info.dir = n->first_child != NULL
+	|| (n->mode & GRUB_ARCHELP_ATTR_TYPE) == GRUB_ARCHELP_ATTR_DIR;
+      if (!(n->mode & GRUB_ARCHELP_ATTR_NOTIME))
+	{
+	  info.mtime = n->mtime;
+	  info.mtimeset = 1;
+	}
+      if (hook (base, &info, hook_data))
+	break;
+    }
+  return grub_errno;
+}
+
+static grub_err_t
+archelp_index_open (struct grub_archelp_data *data,
+		    struct grub_archelp_ops *arcops,
+		    struct archelp_index *idx, char **name,
+		    const char *name_in)
+{
+  int symlinknest = 0;
+
+  while (1)
+    {
+      struct archelp_node *n;
+      int restart;
+
+      n = archelp_lookup (idx, *name, grub_strlen (*name));
+      if (n && n->pos != ARCHELP_NO_POS
+	  && (n->mode & GRUB_ARCHELP_ATTR_TYPE) != GRUB_ARCHELP_ATTR_LNK)
+	return archelp_node_load (data, arcops, n);
+      if (archelp_index_symlink (data, arcops, idx, name, &restart))
+	return grub_errno;
+      if (!restart)
+	return grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+			   name_in);
+      if (++symlinknest == 8)
+	return grub_error (GRUB_ERR_SYMLINK_LOOP,
+			   N_("too deep nesting of symlinks"));
+    }
+}
+
 grub_err_t
 grub_archelp_dir (struct grub_archelp_data *data,
 		  struct grub_archelp_ops *arcops,
@@ -140,6 +527,7 @@ grub_archelp_dir (struct grub_archelp_data *data,
 		  grub_fs_dir_hook_t hook, void *hook_data)
 {
   char *prev, *name, *path, *ptr;
+  struct archelp_index *idx;
   grub_size_t len;
   int symlinknest = 0;
 
@@ -150,6 +538,15 @@ grub_archelp_dir (struct grub_archelp_data *data,
   for (ptr = path + grub_strlen (path) - 1; ptr >= path && *ptr == '/'; ptr--)
     *ptr = 0;
 
+  idx = archelp_index_get (data, arcops);
+  if (idx)
+    {
+      archelp_index_dir (data, arcops, idx, &path, hook, hook_data);
+      archelp_index_release (idx);
+      grub_free (path);
+      return grub_errno;
+    }
+
   prev = 0;
 
   len = grub_strlen (path);
@@ -239,6 +636,7 @@ grub_archelp_open (struct grub_archelp_data *data,
 {
   char *fn;
   char *name = grub_strdup (name_in + 1);
+  struct archelp_index *idx;
   int symlinknest = 0;
 
   if (!name)
@@ -246,6 +644,15 @@ grub_archelp_open (struct grub_archelp_data *data,
 
   canonicalize (name);
 
+  idx = archelp_index_get (data, arcops);
+  if (idx)
+    {
+      archelp_index_open (data, arcops, idx, &name, name_in);
+      archelp_index_release (idx);
+      grub_free (name);
+      return grub_errno;
+    }
+
   while (1)
     {
       grub_uint32_t mode;
@@ -299,3 +706,25 @@ fail:
 
   return grub_errno;
 }
+
+static void (*prev_invalidate_hook) (void);
+
+static void
+archelp_invalidate_hook (void)
+{
+  archelp_flush ();
+  if (prev_invalidate_hook)
+    prev_invalidate_hook ();
+}
+
+GRUB_MOD_INIT(archelp)
+{
+  prev_invalidate_hook = grub_disk_cache_invalidate_hook;
+  grub_disk_cache_invalidate_hook = archelp_invalidate_hook;
+}
+
+GRUB_MOD_FINI(archelp)
+{
+  grub_disk_cache_invalidate_hook = prev_invalidate_hook;
+  archelp_flush ();
+}
@@ -26,9 +26,11 @@
 #include <grub/types.h>
 #include <grub/lib/crc.h>
 #include <grub/deflate.h>
+#include <grub/zstd.h>
 #include <minilzo.h>
 #include <grub/i18n.h>
 #include <grub/btrfs.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -66,7 +68,9 @@ struct grub_btrfs_superblock
   grub_uint64_t chunk_tree;
   grub_uint8_t dummy2[0x20];
   grub_uint64_t root_dir_objectid;
-  grub_uint8_t dummy3[0x41];
+  grub_uint8_t dummy3[0xc];
+  grub_uint32_t nodesize;
+  grub_uint8_t dummy5[0x31];
   struct grub_btrfs_device this_device;
   char label[0x100];
   grub_uint8_t dummy4[0x100];
@@ -82,12 +86,32 @@ struct btrfs_header
   grub_uint8_t level;
 } GRUB_PACKED;
 
+/* DEV is NULL for a member that a full rescan didn't find.  LATENCY is
+   the running average time of a read from the device, in ms.  */
 struct grub_btrfs_device_desc
 {
   grub_device_t dev;
   grub_uint64_t id;
+  int failed;
+  grub_uint64_t latency;
 };
 
+/* Copies kept of a block at most, as for RAID1C4.  */
+#define GRUB_BTRFS_MAX_MIRRORS 4
+
+/* A chunk item found in the chunk tree, KEY's offset being the logical
+   address where it starts.  */
+struct grub_btrfs_chunk_map_entry
+{
+  struct grub_btrfs_key key;
+  struct grub_btrfs_chunk_item *chunk;
+};
+
+/* Tree nodes kept per mount, and the biggest node size cached.  */
+#define GRUB_BTRFS_NODE_CACHE 8
+#define GRUB_BTRFS_NODE_CACHE_MAX 0x10000
+#define GRUB_BTRFS_NODE_NONE 0xffffffffffffffffULL
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
@@ -105,6 +129,19 @@ struct grub_btrfs_data
   grub_uint64_t exttree;
   grub_size_t extsize;
   struct grub_btrfs_extent_data *extent;
+
+  /* Chunks looked up so far, sorted by logical address.  */
+  struct grub_btrfs_chunk_map_entry *chunk_map;
+  grub_size_t chunk_map_count;
+  grub_size_t chunk_map_alloc;
+
+  /* Recently read tree nodes, replaced round-robin.  */
+  struct
+  {
+    grub_uint64_t addr;
+    grub_uint8_t *buf;
+  } node_cache[GRUB_BTRFS_NODE_CACHE];
+  unsigned node_cache_next;
 };
 
 struct grub_btrfs_chunk_item
@@ -119,6 +156,10 @@ struct grub_btrfs_chunk_item
 #define GRUB_BTRFS_CHUNK_TYPE_RAID1         0x10
 #define GRUB_BTRFS_CHUNK_TYPE_DUPLICATED    0x20
 #define GRUB_BTRFS_CHUNK_TYPE_RAID10        0x40
+#define GRUB_BTRFS_CHUNK_TYPE_RAID5         0x80
+#define GRUB_BTRFS_CHUNK_TYPE_RAID6         0x100
+#define GRUB_BTRFS_CHUNK_TYPE_RAID1C3       0x200
+#define GRUB_BTRFS_CHUNK_TYPE_RAID1C4       0x400
   grub_uint8_t dummy2[0xc];
   grub_uint16_t nstripes;
   grub_uint16_t nsubstripes;
@@ -212,6 +253,7 @@ struct grub_btrfs_extent_data
 #define GRUB_BTRFS_COMPRESSION_NONE 0
 #define GRUB_BTRFS_COMPRESSION_ZLIB 1
 #define GRUB_BTRFS_COMPRESSION_LZO  2
+#define GRUB_BTRFS_COMPRESSION_ZSTD 3
 
 #define GRUB_BTRFS_OBJECT_ID_CHUNK 0x100
 
@@ -284,6 +326,63 @@ free_iterator (struct grub_btrfs_leaf_descriptor *desc)
   grub_free (desc->data);
 }
 
+/* Read SIZE bytes at OFFSET into the tree node at NODE, keeping the
+   whole node in the mount's node cache.  */
+static grub_err_t
+read_tree_node (struct grub_btrfs_data *data, grub_disk_addr_t node,
+		grub_size_t offset, void *buf, grub_size_t size,
+		int recursion_depth)
+{
+  grub_size_t nodesize = grub_le_to_cpu32 (data->sblock.nodesize);
+  grub_err_t err;
+  unsigned i;
+
+  if (nodesize == 0 || nodesize > GRUB_BTRFS_NODE_CACHE_MAX
+      || offset + size > nodesize)
+    return grub_btrfs_read_logical (data, node + offset, buf, size,
+				    recursion_depth);
+
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE; i++)
+    if (data->node_cache[i].buf && data->node_cache[i].addr == node)
+      {
+	grub_memcpy (buf, data->node_cache[i].buf + offset, size);
+	return GRUB_ERR_NONE;
+      }
+
+  i = data->node_cache_next;
+  if (!data->node_cache[i].buf)
+    {
+      data->node_cache[i].buf = grub_malloc (nodesize);
+      if (!data->node_cache[i].buf)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return grub_btrfs_read_logical (data, node + offset, buf, size,
+					  recursion_depth);
+	}
+    }
+
+  /* Mapping NODE may read more nodes, which then go to the next
+     slots.  */
+  data->node_cache[i].addr = GRUB_BTRFS_NODE_NONE;
+  data->node_cache_next = (i + 1) % GRUB_BTRFS_NODE_CACHE;
+  err = grub_btrfs_read_logical (data, node, data->node_cache[i].buf,
+				 nodesize, recursion_depth);
+  if (err)
+    return err;
+
+  /* Unless they came round to this slot while it was being read.  */
+  if (data->node_cache[i].addr != GRUB_BTRFS_NODE_NONE)
+    {
+      data->node_cache[i].addr = GRUB_BTRFS_NODE_NONE;
+      return grub_btrfs_read_logical (data, node + offset, buf, size,
+				      recursion_depth);
+    }
+
+  data->node_cache[i].addr = node;
+  grub_memcpy (buf, data->node_cache[i].buf + offset, size);
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 save_ref (struct grub_btrfs_leaf_descriptor *desc,
 	  grub_disk_addr_t addr, unsigned i, unsigned m, int l)
@@ -329,27 +428,25 @@ next (struct grub_btrfs_data *data,
       struct grub_btrfs_internal_node node;
       struct btrfs_header head;
 
-      err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				     * sizeof (node)
-				     + sizeof (struct btrfs_header)
-				     + desc->data[desc->depth - 1].addr,
-				     &node, sizeof (node), 0);
+      err = read_tree_node (data, desc->data[desc->depth - 1].addr,
+			    desc->data[desc->depth - 1].iter * sizeof (node)
+			    + sizeof (struct btrfs_header),
+			    &node, sizeof (node), 0);
       if (err)
 	return -err;
 
-      err = grub_btrfs_read_logical (data, grub_le_to_cpu64 (node.addr),
-				     &head, sizeof (head), 0);
+      err = read_tree_node (data, grub_le_to_cpu64 (node.addr), 0,
+			    &head, sizeof (head), 0);
       if (err)
 	return -err;
 
       save_ref (desc, grub_le_to_cpu64 (node.addr), 0,
 		grub_le_to_cpu32 (head.nitems), !head.level);
     }
-  err = grub_btrfs_read_logical (data, desc->data[desc->depth - 1].iter
-				 * sizeof (leaf)
-				 + sizeof (struct btrfs_header)
-				 + desc->data[desc->depth - 1].addr, &leaf,
-				 sizeof (leaf), 0);
+  err = read_tree_node (data, desc->data[desc->depth - 1].addr,
+			desc->data[desc->depth - 1].iter * sizeof (leaf)
+			+ sizeof (struct btrfs_header),
+			&leaf, sizeof (leaf), 0);
   if (err)
     return -err;
   *outsize = grub_le_to_cpu32 (leaf.size);
@@ -397,9 +494,8 @@ lower_bound (struct grub_btrfs_data *data,
 
     reiter:
       depth++;
-      /* FIXME: preread few nodes into buffer. */
-      err = grub_btrfs_read_logical (data, addr, &head, sizeof (head),
-				     recursion_depth + 1);
+      err = read_tree_node (data, addr, 0, &head, sizeof (head),
+			    recursion_depth + 1);
       if (err)
 	return err;
       addr += sizeof (head);
@@ -411,9 +507,10 @@ lower_bound (struct grub_btrfs_data *data,
 	  grub_memset (&node_last, 0, sizeof (node_last));
 	  for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
 	    {
-	      err = grub_btrfs_read_logical (data, addr + i * sizeof (node),
-					     &node, sizeof (node),
-					     recursion_depth + 1);
+	      err = read_tree_node (data, addr - sizeof (head),
+				    sizeof (head) + i * sizeof (node),
+				    &node, sizeof (node),
+				    recursion_depth + 1);
 	      if (err)
 		return err;
 
@@ -464,9 +561,10 @@ lower_bound (struct grub_btrfs_data *data,
 	int have_last = 0;
 	for (i = 0; i < grub_le_to_cpu32 (head.nitems); i++)
 	  {
-	    err = grub_btrfs_read_logical (data, addr + i * sizeof (leaf),
-					   &leaf, sizeof (leaf),
-					   recursion_depth + 1);
+	    err = read_tree_node (data, addr - sizeof (head),
+				  sizeof (head) + i * sizeof (leaf),
+				  &leaf, sizeof (leaf),
+				  recursion_depth + 1);
 	    if (err)
 	      return err;
 
@@ -514,6 +612,63 @@ lower_bound (struct grub_btrfs_data *data,
     }
 }
 
+/* Every device probed for a member superblock in this session, so that
+   looking for a member again doesn't open and read all of them.  */
+struct grub_btrfs_probe
+{
+  struct grub_btrfs_probe *next;
+  char *name;
+  int is_member;
+  grub_btrfs_uuid_t uuid;
+  grub_uint64_t id;
+};
+
+static struct grub_btrfs_probe *probes;
+
+static struct grub_btrfs_probe *
+probe_find (const char *name)
+{
+  struct grub_btrfs_probe *p;
+
+  for (p = probes; p; p = p->next)
+    if (grub_strcmp (p->name, name) == 0)
+      return p;
+  return NULL;
+}
+
+/* Remember what probing NAME found.  SB is NULL if it isn't a btrfs
+   device at all.  */
+static void
+probe_record (struct grub_btrfs_probe *p, const char *name,
+	      const struct grub_btrfs_superblock *sb)
+{
+  if (!p)
+    {
+      p = grub_zalloc (sizeof (*p));
+      if (!p)
+	{
+	  /* Caching is only an optimization.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      p->name = grub_strdup (name);
+      if (!p->name)
+	{
+	  grub_free (p);
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      p->next = probes;
+      probes = p;
+    }
+  p->is_member = !!sb;
+  if (sb)
+    {
+      grub_memcpy (p->uuid, sb->uuid, sizeof (p->uuid));
+      p->id = sb->this_device.device_id;
+    }
+}
+
 /* Context for find_device.  */
 struct find_device_ctx
 {
@@ -527,16 +682,26 @@ static int
 find_device_iter (const char *name, void *data)
 {
   struct find_device_ctx *ctx = data;
+  struct grub_btrfs_probe *p;
   grub_device_t dev;
   grub_err_t err;
   struct grub_btrfs_superblock sb;
 
+  /* Only a device that was the member looked for is opened again, and
+     its superblock checked in case the name now refers to another.  */
+  p = probe_find (name);
+  if (p && (!p->is_member || p->id != ctx->id
+	    || grub_memcmp (ctx->data->sblock.uuid, p->uuid,
+			    sizeof (p->uuid)) != 0))
+    return 0;
+
   dev = grub_device_open (name);
   if (!dev)
     return 0;
   if (!dev->disk)
     {
       grub_device_close (dev);
+      probe_record (p, name, NULL);
       return 0;
     }
   err = read_sblock (dev->disk, &sb);
@@ -544,6 +709,7 @@ find_device_iter (const char *name, void *data)
     {
       grub_device_close (dev);
       grub_errno = GRUB_ERR_NONE;
+      probe_record (p, name, NULL);
       return 0;
     }
   if (err)
@@ -552,6 +718,7 @@ find_device_iter (const char *name, void *data)
       grub_print_error ();
       return 0;
     }
+  probe_record (p, name, &sb);
   if (grub_memcmp (ctx->data->sblock.uuid, sb.uuid, sizeof (sb.uuid)) != 0
       || sb.this_device.device_id != ctx->id)
     {
@@ -575,10 +742,16 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id, int do_rescan)
 
   for (i = 0; i < data->n_devices_attached; i++)
     if (id == data->devices_attached[i].id)
-      return data->devices_attached[i].dev;
+      {
+	if (data->devices_attached[i].dev)
+	  return data->devices_attached[i].dev;
+	/* Not found before, so don't look again.  */
+	do_rescan = 0;
+	break;
+      }
   if (do_rescan)
     grub_device_iterate (find_device_iter, &ctx);
-  if (!ctx.dev_found)
+  if (!ctx.dev_found && (!do_rescan || grub_errno))
     {
       grub_error (GRUB_ERR_BAD_FS,
 		  N_("couldn't find a necessary member device "
@@ -596,16 +769,187 @@ find_device (struct grub_btrfs_data *data, grub_uint64_t id, int do_rescan)
 			* sizeof (data->devices_attached[0]));
       if (!data->devices_attached)
 	{
-	  grub_device_close (ctx.dev_found);
+	  if (ctx.dev_found)
+	    grub_device_close (ctx.dev_found);
 	  data->devices_attached = tmp;
 	  return NULL;
 	}
     }
   data->devices_attached[data->n_devices_attached - 1].id = id;
   data->devices_attached[data->n_devices_attached - 1].dev = ctx.dev_found;
+  data->devices_attached[data->n_devices_attached - 1].failed = 0;
+  data->devices_attached[data->n_devices_attached - 1].latency = 0;
+  if (!ctx.dev_found)
+    grub_error (GRUB_ERR_BAD_FS,
+		N_("couldn't find a necessary member device "
+		   "of multi-device filesystem"));
   return ctx.dev_found;
 }
 
+static struct grub_btrfs_device_desc *
+find_device_desc (struct grub_btrfs_data *data, grub_uint64_t id)
+{
+  unsigned i;
+
+  for (i = 0; i < data->n_devices_attached; i++)
+    if (id == data->devices_attached[i].id)
+      return &data->devices_attached[i];
+  return NULL;
+}
+
+/* Order in which to try the device holding ID: attached healthy devices
+   first, the faster ones before, then those not looked for yet, then
+   those that failed or are missing.  */
+static grub_uint64_t
+device_cost (struct grub_btrfs_data *data, grub_uint64_t id)
+{
+  struct grub_btrfs_device_desc *desc = find_device_desc (data, id);
+
+  if (!desc)
+    return GRUB_BTRFS_NODE_NONE - 1;
+  if (!desc->dev || desc->failed)
+    return GRUB_BTRFS_NODE_NONE;
+  return desc->latency;
+}
+
+/* Read SIZE bytes at STRIPE_OFFSET in STRIPE into BUF, keeping track of
+   how the device does.  */
+static grub_err_t
+read_stripe (struct grub_btrfs_data *data,
+	     struct grub_btrfs_chunk_stripe *stripe,
+	     grub_uint64_t stripe_offset, void *buf, grub_size_t size,
+	     int do_rescan)
+{
+  struct grub_btrfs_device_desc *desc;
+  grub_disk_addr_t paddr;
+  grub_device_t dev;
+  grub_uint64_t start;
+  grub_err_t err;
+
+  paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
+  grub_dprintf ("btrfs", "reading paddr 0x%" PRIxGRUB_UINT64_T
+		" from device %" PRIxGRUB_UINT64_T "\n", paddr,
+		grub_le_to_cpu64 (stripe->device_id));
+
+  dev = find_device (data, stripe->device_id, do_rescan);
+  if (!dev)
+    return grub_errno;
+
+  start = grub_get_time_ms ();
+  err = grub_disk_read (dev->disk, paddr >> GRUB_DISK_SECTOR_BITS,
+			paddr & (GRUB_DISK_SECTOR_SIZE - 1), size, buf);
+  desc = find_device_desc (data, stripe->device_id);
+  if (desc)
+    {
+      desc->failed = !!err;
+      if (!err)
+	desc->latency = (3 * desc->latency
+			 + grub_get_time_ms () - start) / 4;
+    }
+  return err;
+}
+
+/* Rebuild data stripe TARGET of a RAID5 or RAID6 row from the other data
+   stripes and the P stripe, leaving out the Q stripe SKIP.  */
+static grub_err_t
+rebuild_stripe (struct grub_btrfs_data *data,
+		struct grub_btrfs_chunk_stripe *stripes, unsigned nstripes,
+		unsigned target, unsigned skip, grub_uint64_t stripe_offset,
+		grub_uint8_t *buf, grub_size_t size)
+{
+  grub_uint8_t *tmp;
+  grub_size_t k;
+  unsigned i;
+  grub_err_t err;
+
+  grub_dprintf ("btrfs", "rebuilding stripe %u\n", target);
+
+  tmp = grub_malloc (size);
+  if (!tmp)
+    return grub_errno;
+
+  grub_memset (buf, 0, size);
+  for (i = 0; i < nstripes; i++)
+    {
+      if (i == target || i == skip)
+	continue;
+      err = read_stripe (data, &stripes[i], stripe_offset, tmp, size, 1);
+      if (err)
+	{
+	  grub_free (tmp);
+	  return err;
+	}
+      for (k = 0; k < size; k++)
+	buf[k] ^= tmp[k];
+    }
+  grub_free (tmp);
+  return GRUB_ERR_NONE;
+}
+
+/* Return the chunk map entry covering ADDR, if it was looked up
+   before.  */
+static struct grub_btrfs_chunk_map_entry *
+chunk_map_find (struct grub_btrfs_data *data, grub_disk_addr_t addr)
+{
+  struct grub_btrfs_chunk_map_entry *e;
+  grub_size_t lo = 0, hi = data->chunk_map_count, mid;
+
+  if (hi == 0 || grub_le_to_cpu64 (data->chunk_map[0].key.offset) > addr)
+    return NULL;
+
+  while (hi - lo > 1)
+    {
+      mid = (lo + hi) / 2;
+      if (grub_le_to_cpu64 (data->chunk_map[mid].key.offset) <= addr)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  e = &data->chunk_map[lo];
+  if (addr - grub_le_to_cpu64 (e->key.offset)
+      >= grub_le_to_cpu64 (e->chunk->size))
+    return NULL;
+  return e;
+}
+
+/* Add CHUNK, found at KEY, to the chunk map, which then owns it.
+   Return 0 if there was no memory for it.  */
+static int
+chunk_map_insert (struct grub_btrfs_data *data,
+		  const struct grub_btrfs_key *key,
+		  struct grub_btrfs_chunk_item *chunk)
+{
+  grub_uint64_t start = grub_le_to_cpu64 (key->offset);
+  grub_size_t pos;
+
+  if (data->chunk_map_count == data->chunk_map_alloc)
+    {
+      struct grub_btrfs_chunk_map_entry *map;
+      grub_size_t alloc = data->chunk_map_alloc ? data->chunk_map_alloc * 2
+	: 16;
+
+      map = grub_realloc (data->chunk_map, alloc * sizeof (map[0]));
+      if (!map)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      data->chunk_map = map;
+      data->chunk_map_alloc = alloc;
+    }
+
+  for (pos = data->chunk_map_count; pos > 0; pos--)
+    if (grub_le_to_cpu64 (data->chunk_map[pos - 1].key.offset) < start)
+      break;
+  grub_memmove (&data->chunk_map[pos + 1], &data->chunk_map[pos],
+		(data->chunk_map_count - pos) * sizeof (data->chunk_map[0]));
+  data->chunk_map[pos].key = *key;
+  data->chunk_map[pos].chunk = chunk;
+  data->chunk_map_count++;
+  return 1;
+}
+
 static grub_err_t
 grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 			 void *buf, grub_size_t size, int recursion_depth)
@@ -619,13 +963,26 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
       grub_err_t err = 0;
       struct grub_btrfs_key key_out;
       int challoc = 0;
-      grub_device_t dev;
       struct grub_btrfs_key key_in;
       grub_size_t chsize;
       grub_disk_addr_t chaddr;
 
+      struct grub_btrfs_chunk_map_entry *e;
+
       grub_dprintf ("btrfs", "searching for laddr %" PRIxGRUB_UINT64_T "\n",
 		    addr);
+
+      /* The chunk was looked up before.  Its key is copied, as reads
+	 below may move the map.  */
+      e = chunk_map_find (data, addr);
+      if (e)
+	{
+	  key_out = e->key;
+	  key = &key_out;
+	  chunk = e->chunk;
+	  goto chunk_found;
+	}
+
       for (ptr = data->sblock.bootstrap_mapping;
 	   ptr < data->sblock.bootstrap_mapping
 	   + sizeof (data->sblock.bootstrap_mapping)
@@ -675,6 +1032,14 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	  return err;
 	}
 
+      /* Another lookup may have added it while the item was read.  */
+      if (chsize >= sizeof (*chunk)
+	  + grub_le_to_cpu16 (chunk->nstripes)
+	  * sizeof (struct grub_btrfs_chunk_stripe)
+	  && !chunk_map_find (data, addr)
+	  && chunk_map_insert (data, key, chunk))
+	challoc = 0;
+
     chunk_found:
       {
 	grub_uint64_t stripen;
@@ -683,6 +1048,10 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	grub_uint64_t chunk_stripe_length;
 	grub_uint16_t nstripes;
 	unsigned redundancy = 1;
+	unsigned nparities = 0;
+	grub_uint64_t parity = 0;
+	unsigned order[GRUB_BTRFS_MAX_MIRRORS];
+	struct grub_btrfs_chunk_stripe *stripes;
 	unsigned i, j;
 
 	if (grub_le_to_cpu64 (chunk->size) <= off)
@@ -722,12 +1091,21 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	    }
 	  case GRUB_BTRFS_CHUNK_TYPE_DUPLICATED:
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID1:
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID1C3:
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID1C4:
 	    {
 	      grub_dprintf ("btrfs", "RAID1\n");
 	      stripen = 0;
 	      stripe_offset = off;
 	      csize = grub_le_to_cpu64 (chunk->size) - off;
-	      redundancy = 2;
+	      if (grub_le_to_cpu64 (chunk->type)
+		  & GRUB_BTRFS_CHUNK_TYPE_RAID1C4)
+		redundancy = 4;
+	      else if (grub_le_to_cpu64 (chunk->type)
+		       & GRUB_BTRFS_CHUNK_TYPE_RAID1C3)
+		redundancy = 3;
+	      else
+		redundancy = 2;
 	      break;
 	    }
 	  case GRUB_BTRFS_CHUNK_TYPE_RAID0:
@@ -766,6 +1144,28 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	      csize = chunk_stripe_length - low;
 	      break;
 	    }
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID5:
+	  case GRUB_BTRFS_CHUNK_TYPE_RAID6:
+	    {
+	      grub_uint64_t middle, high;
+	      grub_uint64_t low;
+
+	      nparities = (grub_le_to_cpu64 (chunk->type)
+			   & GRUB_BTRFS_CHUNK_TYPE_RAID6) ? 2 : 1;
+	      grub_dprintf ("btrfs", "RAID%d\n", nparities + 4);
+	      if (nstripes <= nparities)
+		return grub_error (GRUB_ERR_BAD_FS,
+				   "too few stripes for RAID%d",
+				   nparities + 4);
+	      middle = grub_divmod64 (off, chunk_stripe_length, &low);
+	      high = grub_divmod64 (middle, nstripes - nparities, &stripen);
+	      /* Parity moves by one stripe on each row.  */
+	      grub_divmod64 (high + stripen, nstripes, &stripen);
+	      grub_divmod64 (high + nstripes - nparities, nstripes, &parity);
+	      stripe_offset = low + chunk_stripe_length * high;
+	      csize = chunk_stripe_length - low;
+	      break;
+	    }
 	  default:
 	    grub_dprintf ("btrfs", "unsupported RAID\n");
 	    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
@@ -778,46 +1178,41 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	if (csize > (grub_uint64_t) size)
 	  csize = size;
 
+	if (redundancy > GRUB_BTRFS_MAX_MIRRORS
+	    || stripen + redundancy > nstripes)
+	  return grub_error (GRUB_ERR_BAD_FS,
+			     "invalid stripe %" PRIxGRUB_UINT64_T, stripen);
+
+	grub_dprintf ("btrfs", "chunk 0x%" PRIxGRUB_UINT64_T
+		      "+0x%" PRIxGRUB_UINT64_T
+		      " stripe %" PRIxGRUB_UINT64_T
+		      " offset 0x%" PRIxGRUB_UINT64_T
+		      " for laddr 0x%" PRIxGRUB_UINT64_T "\n",
+		      grub_le_to_cpu64 (key->offset),
+		      grub_le_to_cpu64 (chunk->size),
+		      stripen, stripe_offset, addr);
+
+	/* Copies on healthy and faster devices first.  */
+	stripes = (struct grub_btrfs_chunk_stripe *) (chunk + 1) + stripen;
+	for (i = 0; i < redundancy; i++)
+	  {
+	    grub_uint64_t cost = device_cost (data, stripes[i].device_id);
+
+	    for (j = i; j > 0
+		   && device_cost (data, stripes[order[j - 1]].device_id) > cost;
+		 j--)
+	      order[j] = order[j - 1];
+	    order[j] = i;
+	  }
+
+	/* Members not attached yet are looked for only once the attached
+	   ones failed.  */
 	for (j = 0; j < 2; j++)
 	  {
 	    for (i = 0; i < redundancy; i++)
 	      {
-		struct grub_btrfs_chunk_stripe *stripe;
-		grub_disk_addr_t paddr;
-
-		stripe = (struct grub_btrfs_chunk_stripe *) (chunk + 1);
-		/* Right now the redundancy handling is easy.
-		   With RAID5-like it will be more difficult.  */
-		stripe += stripen + i;
-
-		paddr = grub_le_to_cpu64 (stripe->offset) + stripe_offset;
-
-		grub_dprintf ("btrfs", "chunk 0x%" PRIxGRUB_UINT64_T
-			      "+0x%" PRIxGRUB_UINT64_T
-			      " (%d stripes (%d substripes) of %"
-			      PRIxGRUB_UINT64_T ") stripe %" PRIxGRUB_UINT64_T
-			      " maps to 0x%" PRIxGRUB_UINT64_T "\n",
-			      grub_le_to_cpu64 (key->offset),
-			      grub_le_to_cpu64 (chunk->size),
-			      grub_le_to_cpu16 (chunk->nstripes),
-			      grub_le_to_cpu16 (chunk->nsubstripes),
-			      grub_le_to_cpu64 (chunk->stripe_length),
-			      stripen, stripe->offset);
-		grub_dprintf ("btrfs", "reading paddr 0x%" PRIxGRUB_UINT64_T
-			      " for laddr 0x%" PRIxGRUB_UINT64_T "\n", paddr,
-			      addr);
-
-		dev = find_device (data, stripe->device_id, j);
-		if (!dev)
-		  {
-		    err = grub_errno;
-		    grub_errno = GRUB_ERR_NONE;
-		    continue;
-		  }
-
-		err = grub_disk_read (dev->disk, paddr >> GRUB_DISK_SECTOR_BITS,
-				      paddr & (GRUB_DISK_SECTOR_SIZE - 1),
-				      csize, buf);
+		err = read_stripe (data, &stripes[order[i]], stripe_offset,
+				   buf, csize, j);
 		if (!err)
 		  break;
 		grub_errno = GRUB_ERR_NONE;
@@ -825,6 +1220,16 @@ grub_btrfs_read_logical (struct grub_btrfs_data *data, grub_disk_addr_t addr,
 	    if (i != redundancy)
 	      break;
 	  }
+	if (err && nparities)
+	  {
+	    grub_errno = GRUB_ERR_NONE;
+	    err = rebuild_stripe (data,
+				  (struct grub_btrfs_chunk_stripe *) (chunk + 1),
+				  nstripes, stripen,
+				  nparities == 1 ? nstripes
+				  : parity + 1 == nstripes ? 0 : parity + 1,
+				  stripe_offset, buf, csize);
+	  }
 	if (err)
 	  return grub_errno = err;
       }
@@ -871,6 +1276,8 @@ grub_btrfs_mount (grub_device_t dev)
   data->n_devices_attached = 1;
   data->devices_attached[0].dev = dev;
   data->devices_attached[0].id = data->sblock.this_device.device_id;
+  data->devices_attached[0].failed = 0;
+  data->devices_attached[0].latency = 0;
 
   return data;
 }
@@ -879,11 +1286,19 @@ static void
 grub_btrfs_unmount (struct grub_btrfs_data *data)
 {
   unsigned i;
+  grub_size_t j;
+
   /* The device 0 is closed one layer upper.  */
   for (i = 1; i < data->n_devices_attached; i++)
-    grub_device_close (data->devices_attached[i].dev);
+    if (data->devices_attached[i].dev)
+      grub_device_close (data->devices_attached[i].dev);
   grub_free (data->devices_attached);
   grub_free (data->extent);
+  for (j = 0; j < data->chunk_map_count; j++)
+    grub_free (data->chunk_map[j].chunk);
+  grub_free (data->chunk_map);
+  for (i = 0; i < GRUB_BTRFS_NODE_CACHE; i++)
+    grub_free (data->node_cache[i].buf);
   grub_free (data);
 }
 
@@ -1087,7 +1502,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
       if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE
 	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZLIB
-	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO)
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_LZO
+	  && data->extent->compression != GRUB_BTRFS_COMPRESSION_ZSTD)
 	{
 	  grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		      "compression type 0x%x not supported",
@@ -1127,6 +1543,20 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  != (grub_ssize_t) csize)
 		return -1;
 	    }
+	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+	    {
+	      if (grub_zstd_decompress (data->extent->inl, data->extsize -
+					((grub_uint8_t *) data->extent->inl
+					 - (grub_uint8_t *) data->extent),
+					extoff, buf, csize)
+		  != (grub_ssize_t) csize)
+		{
+		  if (!grub_errno)
+		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+				"premature end of compressed");
+		  return -1;
+		}
+	    }
 	  else
 	    grub_memcpy (buf, data->extent->inl + extoff, csize);
 	  break;
@@ -1164,6 +1594,10 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
 				    + grub_le_to_cpu64 (data->extent->offset),
 				    buf, csize);
+	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
+		ret = grub_zstd_decompress (tmp, zsize, extoff
+				    + grub_le_to_cpu64 (data->extent->offset),
+				    buf, csize);
 	      else
 		ret = -1;
 
@@ -1597,6 +2031,11 @@ grub_btrfs_dir (grub_device_t device, const char *path,
 	    {
 	      info.mtime = grub_le_to_cpu64 (inode.mtime.sec);
 	      info.mtimeset = 1;
+	      if (cdirel->type == GRUB_BTRFS_DIR_ITEM_TYPE_REGULAR)
+		{
+		  info.size = grub_le_to_cpu64 (inode.size);
+		  info.sizeset = 1;
+		}
 	    }
 	  c = cdirel->name[grub_le_to_cpu16 (cdirel->n)];
 	  cdirel->name[grub_le_to_cpu16 (cdirel->n)] = 0;
@@ -1772,4 +2211,12 @@ GRUB_MOD_INIT (btrfs)
 GRUB_MOD_FINI (btrfs)
 {
   grub_fs_unregister (&grub_btrfs_fs);
+  while (probes)
+    {
+      struct grub_btrfs_probe *next = probes->next;
+
+      grub_free (probes->name);
+      grub_free (probes);
+      probes = next;
+    }
 }
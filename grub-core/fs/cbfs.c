@@ -113,10 +113,33 @@ grub_cbfs_rewind (struct grub_archelp_data *data)
   data->next_hofs = data->cbfs_start;
 }
 
+static grub_off_t
+grub_cbfs_tell (struct grub_archelp_data *data)
+{
+  return data->next_hofs;
+}
+
+static void
+grub_cbfs_seek (struct grub_archelp_data *data, grub_off_t pos)
+{
+  data->next_hofs = pos;
+}
+
+static grub_disk_t
+grub_cbfs_get_disk (struct grub_archelp_data *data)
+{
+  return data->disk;
+}
+
+/* The index lets lookups skip the walk over the headers, which on flash
+   is slow.  */
 static struct grub_archelp_ops arcops =
   {
     .find_file = grub_cbfs_find_file,
-    .rewind = grub_cbfs_rewind
+    .rewind = grub_cbfs_rewind,
+    .tell = grub_cbfs_tell,
+    .seek = grub_cbfs_seek,
+    .get_disk = grub_cbfs_get_disk
   };
 
 static int
@@ -304,13 +327,22 @@ grub_cbfsdisk_close (grub_disk_t disk __attribute((unused)))
 {
 }
 
+/* Every load from the flash mapping is a bus cycle to the SPI flash, so
+   read it a dword at a time rather than with grub_memcpy, which goes byte
+   by byte.  Sectors are dword-aligned in the mapping; BUF needn't be.  */
 static grub_err_t
 grub_cbfsdisk_read (grub_disk_t disk __attribute((unused)),
 		    grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_memcpy (buf, cbfsdisk_addr + (sector << GRUB_DISK_SECTOR_BITS),
-	       size << GRUB_DISK_SECTOR_BITS);
+  const grub_uint32_t *src;
+  grub_size_t n;
+
+  src = (const grub_uint32_t *) (cbfsdisk_addr
+				 + (sector << GRUB_DISK_SECTOR_BITS));
+  n = (size << GRUB_DISK_SECTOR_BITS) / sizeof (*src);
+  for (; n; n--, buf += sizeof (*src))
+    grub_set_unaligned32 (buf, *src++);
   return 0;
 }
 
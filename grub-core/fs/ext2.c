@@ -139,6 +139,22 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define EXT3_JOURNAL_FLAG_LAST_TAG	8
 
 #define EXT4_EXTENTS_FLAG		0x80000
+#define EXT2_INDEX_FLAG			0x1000
+
+/* Superblock flags.  */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* Hash functions of indexed directories.  */
+#define EXT2_HASH_LEGACY		0
+#define EXT2_HASH_HALF_MD4		1
+#define EXT2_HASH_TEA			2
+#define EXT2_HASH_LEGACY_UNSIGNED	3
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_HASH_TEA_UNSIGNED		5
+
+/* Deepest index tree, large directories included.  */
+#define EXT2_DX_MAX_LEVELS		3
 
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
@@ -193,6 +209,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_high;
+  grub_uint32_t reserved_blocks_high;
+  grub_uint32_t free_blocks_high;
+  grub_uint16_t min_extra_inode_size;
+  grub_uint16_t want_extra_inode_size;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -259,6 +281,35 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* The root of a directory index, which takes the place of the `.' and
+   `..' entries in the first block of the directory.  */
+struct grub_ext2_dx_root
+{
+  struct ext2_dirent dot;
+  char dot_name[4];
+  struct ext2_dirent dotdot;
+  char dotdot_name[4];
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+/* An index entry.  The first entry of a node holds the limit and the
+   count of entries instead of a hash.  */
+struct grub_ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
+struct grub_ext2_dx_countlimit
+{
+  grub_uint16_t limit;
+  grub_uint16_t count;
+};
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -316,6 +367,14 @@ struct grub_ext4_extent_idx
   grub_uint16_t unused;
 };
 
+/* An extent of a leaf, decoded.  */
+struct grub_ext2_extent_map
+{
+  grub_uint32_t block;
+  grub_uint32_t len;
+  grub_disk_addr_t start;
+};
+
 struct grub_fshelp_node
 {
   struct grub_ext2_data *data;
@@ -332,10 +391,21 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+
+  /* The extents of the leaf looked up last, which covers the file
+     blocks from leaf_first to leaf_end - 1 of inode leaf_ino.  */
+  int leaf_ino;
+  grub_uint64_t leaf_first;
+  grub_uint64_t leaf_end;
+  struct grub_ext2_extent_map *leaf_extents;
+  int leaf_entries;
+  int leaf_cur;
 };
 
 static grub_dl_t my_mod;
 
+static struct grub_fs grub_ext2_fs;
+
 
 
 /* Check is a = b^x for some x.  */
@@ -403,14 +473,20 @@ grub_ext2_blockgroup (struct grub_ext2_data *data, grub_uint64_t group,
 			 sizeof (struct grub_ext2_block_group), blkgrp);
 }
 
+/* Find the extent leaf covering FILEBLOCK.  The range of file blocks
+   the leaf covers is returned in *FIRST and *END (exclusive).  */
 static struct grub_ext4_extent_header *
 grub_ext4_find_leaf (struct grub_ext2_data *data,
                      struct grub_ext4_extent_header *ext_block,
-                     grub_uint32_t fileblock)
+                     grub_uint32_t fileblock, grub_uint64_t *first,
+                     grub_uint64_t *end)
 {
   struct grub_ext4_extent_idx *index;
   void *buf = NULL;
 
+  *first = 0;
+  *end = 1ULL << 32;
+
   while (1)
     {
       int i;
@@ -430,9 +506,14 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
             break;
         }
 
+      if (i < grub_le_to_cpu16 (ext_block->entries))
+	*end = grub_le_to_cpu32 (index[i].block);
+
       if (--i < 0)
 	goto fail;
 
+      *first = grub_le_to_cpu32 (index[i].block);
+
       block = grub_le_to_cpu16 (index[i].leaf_hi);
       block = (block << 32) | grub_le_to_cpu32 (index[i].leaf);
       if (!buf)
@@ -451,6 +532,122 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return 0;
 }
 
+/* Decode the extent leaf of NODE covering FILEBLOCK and remember it
+   in DATA.  */
+static grub_err_t
+grub_ext4_load_leaf (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  struct grub_ext2_data *data = node->data;
+  struct grub_ext4_extent_header *root;
+  struct grub_ext4_extent_header *leaf;
+  struct grub_ext4_extent *ext;
+  struct grub_ext2_extent_map *map;
+  grub_uint64_t first, end;
+  int i, entries;
+
+  root = (struct grub_ext4_extent_header *) node->inode.blocks.dir_blocks;
+  leaf = grub_ext4_find_leaf (data, root, fileblock, &first, &end);
+  if (! leaf)
+    return grub_error (GRUB_ERR_BAD_FS, "invalid extent");
+
+  entries = grub_le_to_cpu16 (leaf->entries);
+  map = grub_malloc ((entries ? entries : 1) * sizeof (map[0]));
+  if (! map)
+    {
+      if (leaf != root)
+	grub_free (leaf);
+      return grub_errno;
+    }
+
+  ext = (struct grub_ext4_extent *) (leaf + 1);
+  for (i = 0; i < entries; i++)
+    {
+      map[i].block = grub_le_to_cpu32 (ext[i].block);
+      map[i].len = grub_le_to_cpu16 (ext[i].len);
+      map[i].start = grub_le_to_cpu16 (ext[i].start_hi);
+      map[i].start = (map[i].start << 32) + grub_le_to_cpu32 (ext[i].start);
+    }
+
+  if (leaf != root)
+    grub_free (leaf);
+
+  grub_free (data->leaf_extents);
+  data->leaf_extents = map;
+  data->leaf_entries = entries;
+  data->leaf_cur = 0;
+  data->leaf_ino = node->ino;
+  data->leaf_first = first;
+  data->leaf_end = end;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Map FILEBLOCK of the extent-based file NODE to a disk block and store
+   in *COUNT how many blocks following it are contiguous on disk (or
+   sparse, if 0 is returned).  */
+static grub_disk_addr_t
+grub_ext4_map_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
+{
+  struct grub_ext2_data *data = node->data;
+  struct grub_ext2_extent_map *map;
+  grub_disk_addr_t off;
+  int i, n;
+
+  *count = 1;
+
+  if (data->leaf_ino != node->ino || ! data->leaf_extents
+      || fileblock < data->leaf_first || fileblock >= data->leaf_end)
+    if (grub_ext4_load_leaf (node, fileblock))
+      return -1;
+
+  map = data->leaf_extents;
+  n = data->leaf_entries;
+
+  /* Sequential reads stay in the extent used last or move on to the
+     next one.  */
+  i = data->leaf_cur;
+  if (i + 1 < n && map[i + 1].block <= fileblock)
+    i++;
+  if (i >= n || map[i].block > fileblock
+      || (i + 1 < n && map[i + 1].block <= fileblock))
+    {
+      int lo = 0, hi = n;
+
+      /* Find the last extent starting at or before FILEBLOCK.  */
+      while (lo < hi)
+	{
+	  int mid = (lo + hi) / 2;
+	  if (map[mid].block <= fileblock)
+	    lo = mid + 1;
+	  else
+	    hi = mid;
+	}
+      i = lo - 1;
+    }
+
+  if (i < 0)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
+      return -1;
+    }
+  data->leaf_cur = i;
+
+  off = fileblock - map[i].block;
+  if (off >= map[i].len)
+    {
+      /* A hole, up to the next extent.  */
+      if (i + 1 < n)
+	*count = map[i + 1].block - fileblock;
+      else
+	*count = data->leaf_end - fileblock;
+      return 0;
+    }
+
+  *count = map[i].len - off;
+  return map[i].start + off;
+}
+
 static grub_disk_addr_t
 grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 {
@@ -465,50 +662,9 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
   if (inode->flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
     {
-      struct grub_ext4_extent_header *leaf;
-      struct grub_ext4_extent *ext;
-      int i;
-      grub_disk_addr_t ret;
+      grub_disk_addr_t count;
 
-      leaf = grub_ext4_find_leaf (data, (struct grub_ext4_extent_header *) inode->blocks.dir_blocks, fileblock);
-      if (! leaf)
-        {
-          grub_error (GRUB_ERR_BAD_FS, "invalid extent");
-          return -1;
-        }
-
-      ext = (struct grub_ext4_extent *) (leaf + 1);
-      for (i = 0; i < grub_le_to_cpu16 (leaf->entries); i++)
-        {
-          if (fileblock < grub_le_to_cpu32 (ext[i].block))
-            break;
-        }
-
-      if (--i >= 0)
-        {
-          fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
-	    ret = 0;
-          else
-            {
-              grub_disk_addr_t start;
-
-              start = grub_le_to_cpu16 (ext[i].start_hi);
-              start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
-
-              ret = fileblock + start;
-            }
-        }
-      else
-        {
-          grub_error (GRUB_ERR_BAD_FS, "something wrong with extent");
-	  ret = -1;
-        }
-
-      if (leaf != (struct grub_ext4_extent_header *) inode->blocks.dir_blocks)
-	grub_free (leaf);
-
-      return ret;
+      return grub_ext4_map_block (node, fileblock, &count);
     }
 
   /* Direct blocks.  */
@@ -561,6 +717,20 @@ indirect:
   return grub_le_to_cpu32 (indir);
 }
 
+/* Map FILEBLOCK like grub_ext2_read_block and store in *COUNT how many
+   blocks starting with it are contiguous on disk.  Only extents describe
+   runs longer than a block.  */
+static grub_disk_addr_t
+grub_ext2_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		      grub_disk_addr_t *count)
+{
+  if (node->inode.flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
+    return grub_ext4_map_block (node, fileblock, count);
+
+  *count = 1;
+  return grub_ext2_read_block (node, fileblock);
+}
+
 /* Read LEN bytes from the file described by DATA starting with byte
    POS.  Return the amount of read bytes in READ.  */
 static grub_ssize_t
@@ -568,12 +738,12 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_ext2_get_extent,
+					grub_cpu_to_le32 (node->inode.size)
+					| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+					LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -681,6 +851,9 @@ grub_ext2_mount (grub_disk_t disk)
 
   data->inode = &data->diropen.inode;
 
+  data->leaf_ino = 0;
+  data->leaf_extents = NULL;
+
   grub_ext2_read_inode (data, 2, data->inode);
   if (grub_errno)
     goto fail;
@@ -695,6 +868,14 @@ grub_ext2_mount (grub_disk_t disk)
   return 0;
 }
 
+static void
+grub_ext2_unmount (struct grub_ext2_data *data)
+{
+  if (data)
+    grub_free (data->leaf_extents);
+  grub_free (data);
+}
+
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
 {
@@ -735,6 +916,64 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Make a node for the file DIRENT refers to in the directory DIRO,
+   storing its type in *TYPE.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       const struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data,
+			    grub_le_to_cpu32 (dirent->inode),
+			    &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -766,67 +1005,527 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+	  filename[dirent.namelen] = '\0';
+
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
 	  if (! fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
+	  if (hook (filename, type, fdiro, hook_data))
+	    return 1;
+	}
 
-	  filename[dirent.namelen] = '\0';
+      fpos += grub_le_to_cpu16 (dirent.direntlen);
+    }
+
+  return 0;
+}
+
+/* Compute the hash of the NAME of LEN bytes the way the index of a
+   directory does, as in the kernel's fs/ext4/hash.c.  */
+
+static void
+grub_ext2_str2hashbuf (const char *name, int len, grub_uint32_t *buf,
+		       int num, int unsigned_chars)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      if (unsigned_chars)
+	val = ((grub_uint8_t) name[i]) + (val << 8);
+      else
+	val = ((grub_int32_t) (grub_int8_t) name[i]) + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+static inline grub_uint32_t
+rol32 (grub_uint32_t x, int s)
+{
+  return (x << s) | (x >> (32 - s));
+}
+
+#define HMD4_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define HMD4_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define HMD4_H(x, y, z) ((x) ^ (y) ^ (z))
+#define HMD4_ROUND(f, a, b, c, d, x, s) \
+  (a += f (b, c, d) + (x), a = rol32 (a, s))
+#define HMD4_K1 0
+#define HMD4_K2 013240474631U
+#define HMD4_K3 015666365641U
+
+static void
+grub_ext2_half_md4 (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  HMD4_ROUND (HMD4_F, a, b, c, d, in[0] + HMD4_K1, 3);
+  HMD4_ROUND (HMD4_F, d, a, b, c, in[1] + HMD4_K1, 7);
+  HMD4_ROUND (HMD4_F, c, d, a, b, in[2] + HMD4_K1, 11);
+  HMD4_ROUND (HMD4_F, b, c, d, a, in[3] + HMD4_K1, 19);
+  HMD4_ROUND (HMD4_F, a, b, c, d, in[4] + HMD4_K1, 3);
+  HMD4_ROUND (HMD4_F, d, a, b, c, in[5] + HMD4_K1, 7);
+  HMD4_ROUND (HMD4_F, c, d, a, b, in[6] + HMD4_K1, 11);
+  HMD4_ROUND (HMD4_F, b, c, d, a, in[7] + HMD4_K1, 19);
+
+  HMD4_ROUND (HMD4_G, a, b, c, d, in[1] + HMD4_K2, 3);
+  HMD4_ROUND (HMD4_G, d, a, b, c, in[3] + HMD4_K2, 5);
+  HMD4_ROUND (HMD4_G, c, d, a, b, in[5] + HMD4_K2, 9);
+  HMD4_ROUND (HMD4_G, b, c, d, a, in[7] + HMD4_K2, 13);
+  HMD4_ROUND (HMD4_G, a, b, c, d, in[0] + HMD4_K2, 3);
+  HMD4_ROUND (HMD4_G, d, a, b, c, in[2] + HMD4_K2, 5);
+  HMD4_ROUND (HMD4_G, c, d, a, b, in[4] + HMD4_K2, 9);
+  HMD4_ROUND (HMD4_G, b, c, d, a, in[6] + HMD4_K2, 13);
+
+  HMD4_ROUND (HMD4_H, a, b, c, d, in[3] + HMD4_K3, 3);
+  HMD4_ROUND (HMD4_H, d, a, b, c, in[7] + HMD4_K3, 9);
+  HMD4_ROUND (HMD4_H, c, d, a, b, in[2] + HMD4_K3, 11);
+  HMD4_ROUND (HMD4_H, b, c, d, a, in[6] + HMD4_K3, 15);
+  HMD4_ROUND (HMD4_H, a, b, c, d, in[1] + HMD4_K3, 3);
+  HMD4_ROUND (HMD4_H, d, a, b, c, in[5] + HMD4_K3, 9);
+  HMD4_ROUND (HMD4_H, c, d, a, b, in[0] + HMD4_K3, 11);
+  HMD4_ROUND (HMD4_H, b, c, d, a, in[4] + HMD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void
+grub_ext2_tea (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  int n = 16;
+
+  do
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+  while (--n);
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+static grub_uint32_t
+grub_ext2_legacy_hash (const char *name, int len, int unsigned_chars)
+{
+  grub_uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+  while (len--)
+    {
+      grub_uint32_t c;
+
+      if (unsigned_chars)
+	c = (grub_uint8_t) *name++;
+      else
+	c = (grub_int32_t) (grub_int8_t) *name++;
+      hash = hash1 + (hash0 ^ (c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+  return hash0 << 1;
+}
+
+/* Return the major hash of NAME, or set an error if HASH_VERSION is
+   unknown.  */
+static grub_err_t
+grub_ext2_dx_hash (struct grub_ext2_data *data, int hash_version,
+		   const char *name, grub_uint32_t *hash)
+{
+  grub_uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  grub_uint32_t in[8];
+  int len = grub_strlen (name);
+  const char *p;
+  int i, unsigned_chars = 0;
+
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+
+  switch (hash_version)
+    {
+    case EXT2_HASH_LEGACY_UNSIGNED:
+      unsigned_chars = 1;
+      /* Fallthrough.  */
+    case EXT2_HASH_LEGACY:
+      *hash = grub_ext2_legacy_hash (name, len, unsigned_chars);
+      break;
+
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+      unsigned_chars = 1;
+      /* Fallthrough.  */
+    case EXT2_HASH_HALF_MD4:
+      for (p = name; len > 0; len -= 32, p += 32)
+	{
+	  grub_ext2_str2hashbuf (p, len, in, 8, unsigned_chars);
+	  grub_ext2_half_md4 (buf, in);
+	}
+      *hash = buf[1];
+      break;
+
+    case EXT2_HASH_TEA_UNSIGNED:
+      unsigned_chars = 1;
+      /* Fallthrough.  */
+    case EXT2_HASH_TEA:
+      for (p = name; len > 0; len -= 16, p += 16)
+	{
+	  grub_ext2_str2hashbuf (p, len, in, 4, unsigned_chars);
+	  grub_ext2_tea (buf, in);
+	}
+      *hash = buf[0];
+      break;
+
+    default:
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "unsupported directory hash %d", hash_version);
+    }
+
+  *hash &= ~1;
+  /* The largest hash is reserved for the end of the hash space.  */
+  if (*hash == 0xfffffffeU)
+    *hash = 0xfffffffcU;
+  return GRUB_ERR_NONE;
+}
+
+/* Look NAME up in the directory block BLOCK of DIRO, whose contents are
+   read into BUF.  */
+static grub_err_t
+grub_ext2_dx_search_leaf (struct grub_fshelp_node *diro, grub_uint32_t block,
+			  char *buf, const char *name,
+			  grub_fshelp_node_t *foundnode,
+			  enum grub_fshelp_filetype *foundtype)
+{
+  grub_uint32_t blksz = EXT2_BLOCK_SIZE (diro->data);
+  grub_size_t len = grub_strlen (name);
+  grub_uint32_t off;
+
+  grub_ext2_read_file (diro, 0, 0,
+		       (grub_off_t) block << LOG2_BLOCK_SIZE (diro->data),
+		       blksz, buf);
+  if (grub_errno)
+    return grub_errno;
+
+  for (off = 0; off + sizeof (struct ext2_dirent) <= blksz; )
+    {
+      struct ext2_dirent *dirent = (struct ext2_dirent *) (buf + off);
+      grub_uint16_t direntlen = grub_le_to_cpu16 (dirent->direntlen);
+
+      if (direntlen < sizeof (struct ext2_dirent)
+	  || direntlen > blksz - off)
+	break;
+
+      if (dirent->inode != 0 && dirent->namelen == len
+	  && off + sizeof (struct ext2_dirent) + len <= blksz
+	  && grub_memcmp (dirent + 1, name, len) == 0)
+	{
+	  *foundnode = grub_ext2_dirent_node (diro, dirent, foundtype);
+	  /* Like fshelp, ignore entries of other types.  */
+	  if (*foundnode && *foundtype == GRUB_FSHELP_UNKNOWN)
 	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
+	      grub_free (*foundnode);
+	      *foundnode = NULL;
 	    }
+	  return grub_errno;
+	}
+
+      off += direntlen;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Read the index node in the directory block BLOCK of DIRO into BUF and
+   return its entries, storing their number in *COUNT.  Return NULL if the
+   node is invalid or can't be read.  */
+static struct grub_ext2_dx_entry *
+grub_ext2_dx_read_node (struct grub_fshelp_node *diro, grub_uint32_t block,
+			char *buf, unsigned *count)
+{
+  grub_uint32_t blksz = EXT2_BLOCK_SIZE (diro->data);
+  struct grub_ext2_dx_countlimit *cl;
+  grub_size_t off;
+  unsigned limit;
+
+  grub_ext2_read_file (diro, 0, 0,
+		       (grub_off_t) block << LOG2_BLOCK_SIZE (diro->data),
+		       blksz, buf);
+  if (grub_errno)
+    return NULL;
+
+  /* Other nodes begin with an empty entry covering the whole block.  */
+  if (block == 0)
+    off = sizeof (struct grub_ext2_dx_root);
+  else
+    off = sizeof (struct ext2_dirent);
+
+  cl = (struct grub_ext2_dx_countlimit *) (buf + off);
+  *count = grub_le_to_cpu16 (cl->count);
+  limit = grub_le_to_cpu16 (cl->limit);
+  if (*count == 0 || *count > limit
+      || limit > (blksz - off) / sizeof (struct grub_ext2_dx_entry))
+    return NULL;
+
+  return (struct grub_ext2_dx_entry *) (buf + off);
+}
+
+/* Context for grub_ext2_lookup_file.  */
+struct grub_ext2_lookup_ctx
+{
+  const char *name;
+  grub_fshelp_node_t *foundnode;
+  enum grub_fshelp_filetype *foundtype;
+};
+
+/* Helper for grub_ext2_lookup_file.  */
+static int
+grub_ext2_lookup_iter (const char *filename,
+		       enum grub_fshelp_filetype filetype,
+		       grub_fshelp_node_t node, void *data)
+{
+  struct grub_ext2_lookup_ctx *ctx = data;
+
+  if (filetype == GRUB_FSHELP_UNKNOWN
+      || grub_strcmp (ctx->name, filename) != 0)
+    {
+      grub_free (node);
+      return 0;
+    }
+
+  *ctx->foundnode = node;
+  *ctx->foundtype = filetype;
+  return 1;
+}
+
+/* Find NAME in the directory DIR through its hash index when it has one,
+   scanning every entry otherwise.  */
+static grub_err_t
+grub_ext2_lookup_file_real (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_fshelp_node *diro = dir;
+  struct grub_ext2_data *data = diro->data;
+  struct grub_ext2_lookup_ctx ctx = {
+    .name = name,
+    .foundnode = foundnode,
+    .foundtype = foundtype
+  };
+  struct
+  {
+    grub_uint32_t block;
+    unsigned count;
+    unsigned at;
+  } frames[EXT2_DX_MAX_LEVELS];
+  struct grub_ext2_dx_root root;
+  struct grub_ext2_dx_entry *entries;
+  grub_uint32_t blksz = EXT2_BLOCK_SIZE (data);
+  grub_uint32_t nblocks, hash, block = 0;
+  char *buf, *node_buf;
+  int hash_version, levels, level;
+
+  *foundnode = NULL;
+
+  if (! diro->inode_read)
+    {
+      grub_ext2_read_inode (data, diro->ino, &diro->inode);
+      if (grub_errno)
+	return grub_errno;
+      diro->inode_read = 1;
+    }
+
+  if (!(data->sblock.feature_compatibility
+	& grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX))
+      || !(diro->inode.flags & grub_cpu_to_le32_compile_time (EXT2_INDEX_FLAG)))
+    goto linear;
+
+  nblocks = grub_le_to_cpu32 (diro->inode.size) >> LOG2_BLOCK_SIZE (data);
+
+  grub_ext2_read_file (diro, 0, 0, 0, sizeof (root), (char *) &root);
+  if (grub_errno)
+    return grub_errno;
+
+  hash_version = root.hash_version;
+  levels = root.indirect_levels + 1;
+  if (root.reserved_zero != 0 || root.info_length != 8
+      || levels > EXT2_DX_MAX_LEVELS
+      || hash_version > EXT2_HASH_TEA_UNSIGNED)
+    goto linear;
+  if (hash_version <= EXT2_HASH_TEA
+      && (data->sblock.flags
+	  & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH)))
+    hash_version += EXT2_HASH_LEGACY_UNSIGNED;
+
+  if (grub_ext2_dx_hash (data, hash_version, name, &hash))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      goto linear;
+    }
+
+  buf = grub_malloc (2 * blksz);
+  if (! buf)
+    return grub_errno;
+  node_buf = buf + blksz;
+
+  /* Walk down to the leaf block which holds the hash, remembering the
+     path to step to the next leaf.  */
+  for (level = 0; level < levels; level++)
+    {
+      unsigned lo, hi;
+
+      if (level > 0 && (block == 0 || block >= nblocks))
+	goto fallback;
+      entries = grub_ext2_dx_read_node (diro, block, node_buf,
+					&frames[level].count);
+      if (! entries)
+	goto fallback;
+
+      /* Find the last entry whose hash is not above HASH.  The first one
+	 implicitly starts at hash 0.  */
+      lo = 1;
+      hi = frames[level].count;
+      while (lo < hi)
+	{
+	  unsigned mid = lo + (hi - lo) / 2;
+	  if (grub_le_to_cpu32 (entries[mid].hash) > hash)
+	    hi = mid;
 	  else
-	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
-	    }
+	    lo = mid + 1;
+	}
 
-	  if (hook (filename, type, fdiro, hook_data))
-	    return 1;
+      frames[level].block = block;
+      frames[level].at = lo - 1;
+      block = grub_le_to_cpu32 (entries[lo - 1].block) & 0x0fffffff;
+    }
+
+  while (1)
+    {
+      if (block == 0 || block >= nblocks)
+	goto fallback;
+      if (grub_ext2_dx_search_leaf (diro, block, buf, name,
+				    foundnode, foundtype))
+	goto fail;
+      if (*foundnode)
+	break;
+
+      /* Names whose hash collides may continue in the next leaf.  */
+      for (level = levels - 1; level >= 0; level--)
+	if (++frames[level].at < frames[level].count)
+	  break;
+      if (level < 0)
+	break;
+
+      entries = grub_ext2_dx_read_node (diro, frames[level].block, node_buf,
+					&frames[level].count);
+      if (! entries)
+	goto fallback;
+      if ((grub_le_to_cpu32 (entries[frames[level].at].hash) & ~1) != hash)
+	break;
+      block = grub_le_to_cpu32 (entries[frames[level].at].block) & 0x0fffffff;
+
+      for (level++; level < levels; level++)
+	{
+	  if (block == 0 || block >= nblocks)
+	    goto fallback;
+	  entries = grub_ext2_dx_read_node (diro, block, node_buf,
+					    &frames[level].count);
+	  if (! entries)
+	    goto fallback;
+	  frames[level].block = block;
+	  frames[level].at = 0;
+	  block = grub_le_to_cpu32 (entries[0].block) & 0x0fffffff;
 	}
+    }
 
-      fpos += grub_le_to_cpu16 (dirent.direntlen);
+  grub_free (buf);
+  return GRUB_ERR_NONE;
+
+ fallback:
+  /* Don't trust a damaged index, look at every entry instead.  */
+  grub_free (buf);
+  if (grub_errno)
+    return grub_errno;
+ linear:
+  grub_ext2_iterate_dir (dir, grub_ext2_lookup_iter, &ctx);
+  return grub_errno;
+
+ fail:
+  grub_free (buf);
+  return grub_errno;
+}
+
+/* Find NAME in the directory DIR, trying the fshelp lookup cache
+   first.  */
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_fshelp_node *diro = dir;
+  struct grub_ext2_data *data = diro->data;
+  grub_uint64_t ino;
+  grub_err_t err;
+
+  if (grub_fshelp_dcache_lookup (data->disk, &grub_ext2_fs, diro->ino, name,
+				 &ino, foundtype))
+    {
+      *foundnode = NULL;
+      if (*foundtype == GRUB_FSHELP_UNKNOWN)
+	return GRUB_ERR_NONE;
+
+      *foundnode = grub_malloc (sizeof (struct grub_fshelp_node));
+      if (! *foundnode)
+	return grub_errno;
+      (*foundnode)->data = data;
+      (*foundnode)->ino = ino;
+      (*foundnode)->inode_read = 0;
+      return GRUB_ERR_NONE;
     }
 
-  return 0;
+  err = grub_ext2_lookup_file_real (dir, name, foundnode, foundtype);
+  if (err)
+    return err;
+
+  if (*foundnode)
+    grub_fshelp_dcache_add (data->disk, &grub_ext2_fs, diro->ino, name,
+			    (*foundnode)->ino, *foundtype);
+  else
+    grub_fshelp_dcache_add (data->disk, &grub_ext2_fs, diro->ino, name,
+			    0, GRUB_FSHELP_UNKNOWN);
+  return GRUB_ERR_NONE;
 }
 
 /* Open a file named NAME and initialize FILE.  */
@@ -846,9 +1545,9 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_lookup (name, &data->diropen, &fdiro,
+				      grub_ext2_lookup_file,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG);
   if (err)
     goto fail;
 
@@ -872,7 +1571,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_ext2_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -882,7 +1581,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_ext2_unmount (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -929,6 +1628,12 @@ grub_ext2_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_le_to_cpu32 (node->inode.mtime);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_le_to_cpu32 (node->inode.size)
+	    | ((grub_uint64_t) grub_le_to_cpu32 (node->inode.size_high) << 32);
+	}
     }
 
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
@@ -952,9 +1657,9 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_lookup (path, &ctx.data->diropen, &fdiro,
+				grub_ext2_lookup_file, grub_ext2_read_symlink,
+				GRUB_FSHELP_DIR);
   if (grub_errno)
     goto fail;
 
@@ -963,7 +1668,7 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_ext2_unmount (ctx.data);
 
   grub_dl_unref (my_mod);
 
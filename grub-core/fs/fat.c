@@ -25,6 +25,7 @@
 #include <grub/mm.h>
 #include <grub/err.h>
 #include <grub/dl.h>
+#include <grub/env.h>
 #include <grub/charset.h>
 #ifndef MODE_EXFAT
 #include <grub/fat.h>
@@ -182,8 +183,31 @@ struct grub_fat_data
   grub_uint32_t num_clusters;
 
   grub_uint32_t uuid;
+
+  /* The whole FAT of FAT_BYTES bytes, once a file is opened if it is
+     small enough.  NULL otherwise.  */
+  grub_uint8_t *fat;
+  grub_size_t fat_bytes;
+};
+
+/* Largest FAT read whole when a file is opened, unless the variable
+   fat_prefetch_max says otherwise.  */
+#define GRUB_FAT_PREFETCH_MAX (1 << 20)
+
+/* Clusters LOGICAL to LOGICAL + LEN - 1 of a file, which lie one after
+   the other from CLUSTER on.  */
+struct grub_fat_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t len;
 };
 
+/* Nodes are freed by fshelp as they are, so the runs live in the node.
+   Once they are all used the last one is recycled for whatever follows
+   the others.  */
+#define GRUB_FAT_MAX_RUNS 16
+
 struct grub_fshelp_node {
   grub_disk_t disk;
   struct grub_fat_data *data;
@@ -191,8 +215,13 @@ struct grub_fshelp_node {
   grub_uint8_t attr;
   grub_ssize_t file_size;
   grub_uint32_t file_cluster;
-  grub_uint32_t cur_cluster_num;
-  grub_uint32_t cur_cluster;
+
+  /* The cluster chain as far as it has been followed, from logical
+     cluster 0 on except for a gap before the last run once they are all
+     used.  CHAIN_END is set if the last run ends the chain.  */
+  struct grub_fat_run runs[GRUB_FAT_MAX_RUNS];
+  unsigned nruns;
+  int chain_end;
 
 #ifdef MODE_EXFAT
   int is_contiguous;
@@ -233,6 +262,8 @@ grub_fat_mount (grub_disk_t disk)
   data = (struct grub_fat_data *) grub_malloc (sizeof (*data));
   if (! data)
     goto fail;
+  data->fat = NULL;
+  data->fat_bytes = 0;
 
   /* Read the BPB.  */
   if (grub_disk_read (disk, 0, 0, sizeof (bpb), &bpb))
@@ -444,6 +475,190 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+/* Read the whole FAT if it is small, so that following the chain of the
+   file needs no more disk reads.  Without it the chain is followed on
+   disk as before.  */
+static void
+grub_fat_prefetch (grub_disk_t disk, struct grub_fat_data *data)
+{
+  const char *val = grub_env_get ("fat_prefetch_max");
+  grub_uint64_t max, bytes;
+
+  max = val ? grub_strtoull (val, 0, 0) : GRUB_FAT_PREFETCH_MAX;
+  grub_errno = GRUB_ERR_NONE;
+
+  bytes = (grub_uint64_t) data->sectors_per_fat << GRUB_DISK_SECTOR_BITS;
+  if (data->fat || bytes > max)
+    return;
+
+  data->fat = grub_malloc (bytes);
+  if (data->fat
+      && grub_disk_read (disk, data->fat_sector, 0, bytes, data->fat))
+    {
+      grub_free (data->fat);
+      data->fat = NULL;
+    }
+  if (data->fat)
+    data->fat_bytes = bytes;
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Read the FAT entry of CLUSTER.  */
+static grub_err_t
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t next_cluster = 0;
+  grub_uint32_t fat_offset;
+  unsigned fat_entry_bytes = (data->fat_size + 7) >> 3;
+
+  switch (data->fat_size)
+    {
+    case 32:
+      fat_offset = cluster << 2;
+      break;
+    case 16:
+      fat_offset = cluster << 1;
+      break;
+    default:
+      /* case 12: */
+      fat_offset = cluster + (cluster >> 1);
+      break;
+    }
+
+  if (data->fat && fat_offset + fat_entry_bytes <= data->fat_bytes)
+    grub_memcpy (&next_cluster, data->fat + fat_offset, fat_entry_bytes);
+  else if (grub_disk_read (disk, data->fat_sector, fat_offset,
+			   fat_entry_bytes, (char *) &next_cluster))
+    return grub_errno;
+
+  next_cluster = grub_le_to_cpu32 (next_cluster);
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+
+  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		data->fat_size, next_cluster);
+
+  *next = next_cluster;
+  return GRUB_ERR_NONE;
+}
+
+/* Set *RUN to the run holding logical cluster LOGICAL of NODE, following
+   the chain further as needed, or to NULL if the chain ends before.  */
+static grub_err_t
+grub_fat_find_run (grub_disk_t disk, grub_fshelp_node_t node,
+		   grub_uint32_t logical, struct grub_fat_run **run)
+{
+  struct grub_fat_run *last;
+  unsigned i;
+
+  for (i = 0; i < node->nruns; i++)
+    if (logical < node->runs[i].logical + node->runs[i].len)
+      break;
+  if (i < node->nruns && logical >= node->runs[i].logical)
+    {
+      *run = &node->runs[i];
+      return GRUB_ERR_NONE;
+    }
+  if (i < node->nruns)
+    {
+      /* In the gap before the recycled run: follow the chain again from
+	 the end of the one before.  */
+      node->nruns = i;
+      node->chain_end = 0;
+    }
+
+#ifdef MODE_EXFAT
+  /* A NoFatChain stream has no FAT entries to follow: it is one run as
+     long as its size, and the FAT is never read for it.  */
+  if (node->nruns == 0 && node->is_contiguous)
+    {
+      grub_uint64_t len;
+      unsigned bits = node->data->cluster_bits + GRUB_DISK_SECTOR_BITS;
+
+      len = ((grub_uint64_t) node->file_size + (1ULL << bits) - 1) >> bits;
+      /* Data clusters are numbered from 2.  */
+      if (len && (node->file_cluster < 2
+		  || node->file_cluster - 2 >= node->data->num_clusters
+		  || len > node->data->num_clusters - (node->file_cluster - 2)))
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			   node->file_cluster);
+      node->runs[0].logical = 0;
+      node->runs[0].cluster = node->file_cluster;
+      node->runs[0].len = len;
+      node->nruns = 1;
+      node->chain_end = 1;
+      *run = logical < len ? &node->runs[0] : NULL;
+      return GRUB_ERR_NONE;
+    }
+#endif
+
+  if (node->nruns == 0)
+    {
+      node->runs[0].logical = 0;
+      node->runs[0].cluster = node->file_cluster;
+      node->runs[0].len = 1;
+      node->nruns = 1;
+      node->chain_end = 0;
+    }
+
+  while (1)
+    {
+      grub_uint32_t next_cluster = 0, next_logical;
+
+      last = &node->runs[node->nruns - 1];
+      if (logical < last->logical + last->len)
+	{
+	  *run = last;
+	  return GRUB_ERR_NONE;
+	}
+
+      if (node->chain_end)
+	break;
+
+      if (grub_fat_next_cluster (disk, node->data,
+				 last->cluster + last->len - 1, &next_cluster))
+	return grub_errno;
+
+      /* Check the end.  */
+      if (next_cluster >= node->data->cluster_eof_mark)
+	{
+	  node->chain_end = 1;
+	  break;
+	}
+
+      if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
+			   next_cluster);
+
+      if (next_cluster == last->cluster + last->len)
+	{
+	  last->len++;
+	  continue;
+	}
+
+      next_logical = last->logical + last->len;
+      if (node->nruns < GRUB_FAT_MAX_RUNS)
+	last = &node->runs[node->nruns++];
+      last->logical = next_logical;
+      last->cluster = next_cluster;
+      last->len = 1;
+    }
+
+  *run = NULL;
+  return GRUB_ERR_NONE;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -471,105 +686,32 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
     }
 #endif
 
-#ifdef MODE_EXFAT
-  if (node->is_contiguous)
-    {
-      /* Read the data here.  */
-      sector = (node->data->cluster_sector
-		+ ((node->file_cluster - 2)
-		   << node->data->cluster_bits));
-
-      disk->read_hook = read_hook;
-      disk->read_hook_data = read_hook_data;
-      grub_disk_read (disk, sector + (offset >> GRUB_DISK_SECTOR_BITS),
-		      offset & (GRUB_DISK_SECTOR_SIZE - 1), len, buf);
-      disk->read_hook = 0;
-      if (grub_errno)
-	return -1;
-
-      return len;
-    }
-#endif
-
   /* Calculate the logical cluster number and offset.  */
   logical_cluster_bits = (node->data->cluster_bits
 			  + GRUB_DISK_SECTOR_BITS);
   logical_cluster = offset >> logical_cluster_bits;
   offset &= (1ULL << logical_cluster_bits) - 1;
 
-  if (logical_cluster < node->cur_cluster_num)
-    {
-      node->cur_cluster_num = 0;
-      node->cur_cluster = node->file_cluster;
-    }
-
   while (len)
     {
-      while (logical_cluster > node->cur_cluster_num)
-	{
-	  /* Find next cluster.  */
-	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
-
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
-
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
-	    return -1;
-
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
-
-	  /* Check the end.  */
-	  if (next_cluster >= node->data->cluster_eof_mark)
-	    return ret;
-
-	  if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
-			  next_cluster);
-	      return -1;
-	    }
+      struct grub_fat_run *run = NULL;
+      grub_uint64_t run_size;
 
-	  node->cur_cluster = next_cluster;
-	  node->cur_cluster_num++;
-	}
+      if (grub_fat_find_run (disk, node, logical_cluster, &run))
+	return -1;
+      if (! run)
+	return ret;
 
-      /* Read the data here.  */
+      /* Read the data here, up to the end of the run at once.  */
       sector = (node->data->cluster_sector
-		+ ((node->cur_cluster - 2)
+		+ ((grub_disk_addr_t) (run->cluster - 2
+				       + logical_cluster - run->logical)
 		   << node->data->cluster_bits));
-      size = (1 << logical_cluster_bits) - offset;
-      if (size > len)
-	size = len;
+      run_size = ((grub_uint64_t) (run->logical + run->len - logical_cluster)
+		  << logical_cluster_bits) - offset;
+      size = len;
+      if (size > run_size)
+	size = run_size;
 
       disk->read_hook = read_hook;
       disk->read_hook_data = read_hook_data;
@@ -581,8 +723,8 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
       len -= size;
       buf += size;
       ret += size;
-      logical_cluster++;
-      offset = 0;
+      logical_cluster += (offset + size) >> logical_cluster_bits;
+      offset = (offset + size) & ((1ULL << logical_cluster_bits) - 1);
     }
 
   return ret;
@@ -681,8 +823,8 @@ grub_fat_iterate_dir_next (grub_fshelp_node_t node,
 		  ctxt->dir.file_size
 		    = grub_cpu_to_le64 (sec.type_specific.stream_extension.file_size);
 		  ctxt->dir.have_stream = 1;
-		  ctxt->dir.is_contiguous = !!(dir.type_specific.stream_extension.flags
-					       & grub_cpu_to_le16_compile_time (FLAG_CONTIGUOUS));
+		  ctxt->dir.is_contiguous = !!(sec.type_specific.stream_extension.flags
+					       & FLAG_CONTIGUOUS);
 		  break;
 		case 0xc1:
 		  {
@@ -895,7 +1037,8 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	  if (!(*foundnode)->file_cluster)
 	    (*foundnode)->file_cluster = node->data->root_cluster;
 #endif
-	  (*foundnode)->cur_cluster_num = ~0U;
+	  (*foundnode)->nruns = 0;
+	  (*foundnode)->chain_end = 0;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
 
@@ -936,8 +1079,7 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
     .file_cluster = data->root_cluster,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
+    .nruns = 0,
 #ifdef MODE_EXFAT
     .is_contiguous = 0,
 #endif
@@ -966,6 +1108,16 @@ grub_fat_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
 	continue;
 #endif
 
+      if (! info.dir)
+	{
+	  info.sizeset = 1;
+#ifdef MODE_EXFAT
+	  info.size = ctxt.dir.file_size;
+#else
+	  info.size = grub_le_to_cpu32 (ctxt.dir.file_size);
+#endif
+	}
+
       if (hook (ctxt.filename, &info, hook_data))
 	break;
     }
@@ -1004,8 +1156,7 @@ grub_fat_open (grub_file_t file, const char *name)
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
     .file_cluster = data->root_cluster,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
+    .nruns = 0,
 #ifdef MODE_EXFAT
     .is_contiguous = 0,
 #endif
@@ -1018,6 +1169,11 @@ grub_fat_open (grub_file_t file, const char *name)
   file->data = found;
   file->size = found->file_size;
 
+#ifdef MODE_EXFAT
+  if (! found->is_contiguous)
+#endif
+    grub_fat_prefetch (disk, data);
+
   return GRUB_ERR_NONE;
 
  fail:
@@ -1045,6 +1201,7 @@ grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
+  grub_free (node->data->fat);
   grub_free (node->data);
   grub_free (node);
 
@@ -1064,8 +1221,7 @@ grub_fat_label (grub_device_t device, char **label)
     .disk = disk,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
+    .nruns = 0,
     .is_contiguous = 0,
   };
 
@@ -1129,8 +1285,7 @@ grub_fat_label (grub_device_t device, char **label)
     .disk = disk,
     .attr = GRUB_FAT_ATTR_DIRECTORY,
     .file_size = 0,
-    .cur_cluster_num = ~0U,
-    .cur_cluster = 0,
+    .nruns = 0,
   };
 
   *label = 0;
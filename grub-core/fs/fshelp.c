@@ -24,6 +24,7 @@
 #include <grub/fshelp.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -344,6 +345,174 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 
 }
 
+/* The directory lookup cache.  Entries are hashed on the disk, the
+   directory and the name, and the least recently used ones are dropped
+   once there are DCACHE_MAX of them.  */
+
+#define DCACHE_HASH_SIZE 256
+#define DCACHE_MAX 1024
+
+struct dcache_entry
+{
+  struct dcache_entry *hash_next;
+  struct dcache_entry *lru_next;
+  struct dcache_entry *lru_prev;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  const struct grub_fs *fs;
+  grub_uint64_t dir;
+  grub_uint64_t id;
+  enum grub_fshelp_filetype type;
+  unsigned hash;
+  char name[0];
+};
+
+static struct dcache_entry *dcache_table[DCACHE_HASH_SIZE];
+/* Most recently used first.  */
+static struct dcache_entry *dcache_lru_head;
+static struct dcache_entry *dcache_lru_tail;
+static unsigned dcache_count;
+
+static unsigned
+dcache_hash (grub_disk_t disk, grub_uint64_t dir, const char *name)
+{
+  unsigned h = 2166136261U;
+
+  h = (h ^ disk->id) * 16777619;
+  h = (h ^ (unsigned) dir) * 16777619;
+  h = (h ^ (unsigned) (dir >> 32)) * 16777619;
+  for (; *name; name++)
+    h = (h ^ (grub_uint8_t) *name) * 16777619;
+  return h;
+}
+
+static struct dcache_entry *
+dcache_find (grub_disk_t disk, const struct grub_fs *fs, grub_uint64_t dir,
+	     const char *name, unsigned hash)
+{
+  struct dcache_entry *e;
+
+  for (e = dcache_table[hash % DCACHE_HASH_SIZE]; e; e = e->hash_next)
+    if (e->hash == hash && e->dir == dir && e->fs == fs
+	&& e->dev_id == disk->dev->id && e->disk_id == disk->id
+	&& e->part_start == grub_partition_get_start (disk->partition)
+	&& grub_strcmp (e->name, name) == 0)
+      return e;
+  return NULL;
+}
+
+static void
+dcache_lru_unlink (struct dcache_entry *e)
+{
+  if (e->lru_prev)
+    e->lru_prev->lru_next = e->lru_next;
+  else
+    dcache_lru_head = e->lru_next;
+  if (e->lru_next)
+    e->lru_next->lru_prev = e->lru_prev;
+  else
+    dcache_lru_tail = e->lru_prev;
+}
+
+static void
+dcache_lru_push (struct dcache_entry *e)
+{
+  e->lru_prev = NULL;
+  e->lru_next = dcache_lru_head;
+  if (dcache_lru_head)
+    dcache_lru_head->lru_prev = e;
+  else
+    dcache_lru_tail = e;
+  dcache_lru_head = e;
+}
+
+static void
+dcache_remove (struct dcache_entry *e)
+{
+  struct dcache_entry **p;
+
+  for (p = &dcache_table[e->hash % DCACHE_HASH_SIZE]; *p != e;
+       p = &(*p)->hash_next);
+  *p = e->hash_next;
+  dcache_lru_unlink (e);
+  dcache_count--;
+  grub_free (e);
+}
+
+int
+grub_fshelp_dcache_lookup (grub_disk_t disk, const struct grub_fs *fs,
+			   grub_uint64_t dir, const char *name,
+			   grub_uint64_t *id, enum grub_fshelp_filetype *type)
+{
+  struct dcache_entry *e;
+
+  e = dcache_find (disk, fs, dir, name, dcache_hash (disk, dir, name));
+  if (!e)
+    return 0;
+
+  if (e != dcache_lru_head)
+    {
+      dcache_lru_unlink (e);
+      dcache_lru_push (e);
+    }
+  *id = e->id;
+  *type = e->type;
+  return 1;
+}
+
+void
+grub_fshelp_dcache_add (grub_disk_t disk, const struct grub_fs *fs,
+			grub_uint64_t dir, const char *name,
+			grub_uint64_t id, enum grub_fshelp_filetype type)
+{
+  struct dcache_entry *e;
+  unsigned hash = dcache_hash (disk, dir, name);
+  grub_size_t len = grub_strlen (name);
+
+  e = dcache_find (disk, fs, dir, name, hash);
+  if (e)
+    {
+      e->id = id;
+      e->type = type;
+      return;
+    }
+
+  /* Caching is only an optimization, so don't report failures.  The
+     allocation may also flush the cache through the disk cache hook.  */
+  e = grub_malloc (sizeof (*e) + len + 1);
+  if (!e)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if (dcache_count >= DCACHE_MAX)
+    dcache_remove (dcache_lru_tail);
+
+  e->dev_id = disk->dev->id;
+  e->disk_id = disk->id;
+  e->part_start = grub_partition_get_start (disk->partition);
+  e->fs = fs;
+  e->dir = dir;
+  e->id = id;
+  e->type = type;
+  e->hash = hash;
+  grub_memcpy (e->name, name, len + 1);
+
+  e->hash_next = dcache_table[hash % DCACHE_HASH_SIZE];
+  dcache_table[hash % DCACHE_HASH_SIZE] = e;
+  dcache_lru_push (e);
+  dcache_count++;
+}
+
+void
+grub_fshelp_dcache_flush (void)
+{
+  while (dcache_lru_tail)
+    dcache_remove (dcache_lru_tail);
+}
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  READ_HOOK_DATA is passed through as
@@ -427,3 +596,107 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 
   return len;
 }
+
+/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
+   beginning with the byte POS.  GET_EXTENT translates a file block to
+   a disk block and returns the length of the run of contiguous blocks
+   it starts, so that every run is read with a single disk read.  A disk
+   block of 0 means the run is sparse.  Everything else is as for
+   grub_fshelp_read_file.  */
+grub_ssize_t
+grub_fshelp_read_file_extents (grub_disk_t disk, grub_fshelp_node_t node,
+			       grub_disk_read_hook_t read_hook,
+			       void *read_hook_data,
+			       grub_off_t pos, grub_size_t len, char *buf,
+			       grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+							       grub_disk_addr_t block,
+							       grub_disk_addr_t *count),
+			       grub_off_t filesize, int log2blocksize,
+			       grub_disk_addr_t blocks_start)
+{
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_size_t blocksize = (grub_size_t) 1 << log2bytes;
+  grub_disk_addr_t block;
+  grub_size_t skip, remaining;
+
+  if (pos > filesize)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE,
+		  N_("attempt to read past the end of file"));
+      return -1;
+    }
+
+  /* Adjust LEN so it we can't read past the end of the file.  */
+  if (pos + len > filesize)
+    len = filesize - pos;
+
+  block = pos >> log2bytes;
+  skip = pos & (blocksize - 1);
+  remaining = len;
+
+  while (remaining)
+    {
+      grub_disk_addr_t blknr, count = 0, needed;
+      grub_size_t run;
+
+      blknr = get_extent (node, block, &count);
+      if (grub_errno)
+	return -1;
+
+      needed = (skip + remaining + blocksize - 1) >> log2bytes;
+      if (count == 0)
+	count = 1;
+      if (count > needed)
+	count = needed;
+
+      run = (count << log2bytes) - skip;
+      if (run > remaining)
+	run = remaining;
+
+      /* If the block number is 0 the run is not stored on disk but
+	 is zero filled instead.  */
+      if (blknr)
+	{
+	  disk->read_hook = read_hook;
+	  disk->read_hook_data = read_hook_data;
+
+	  grub_disk_read (disk, (blknr << log2blocksize) + blocks_start,
+			  skip, run, buf);
+	  disk->read_hook = 0;
+	  if (grub_errno)
+	    return -1;
+	}
+      else
+	grub_memset (buf, 0, run);
+
+      buf += run;
+      remaining -= run;
+      block += count;
+      skip = 0;
+    }
+
+  return len;
+}
+
+static void (*prev_invalidate_hook) (void);
+
+/* Other modules (gpt) hook the disk cache too, so chain to them.  */
+static void
+fshelp_invalidate_hook (void)
+{
+  grub_fshelp_dcache_flush ();
+  if (prev_invalidate_hook)
+    prev_invalidate_hook ();
+}
+
+GRUB_MOD_INIT(fshelp)
+{
+  prev_invalidate_hook = grub_disk_cache_invalidate_hook;
+  grub_disk_cache_invalidate_hook = fshelp_invalidate_hook;
+}
+
+GRUB_MOD_FINI(fshelp)
+{
+  grub_disk_cache_invalidate_hook = prev_invalidate_hook;
+  grub_fshelp_dcache_flush ();
+}
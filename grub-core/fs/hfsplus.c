@@ -223,6 +223,24 @@ grub_hfsplus_read_file (grub_fshelp_node_t node,
 				node->data->embedded_offset);
 }
 
+static void
+grub_hfsplus_free_data (struct grub_hfsplus_data *data)
+{
+  struct grub_hfsplus_btree *trees[3];
+  unsigned i, j;
+
+  if (!data)
+    return;
+
+  trees[0] = &data->catalog_tree;
+  trees[1] = &data->extoverflow_tree;
+  trees[2] = &data->attr_tree;
+  for (i = 0; i < ARRAY_SIZE (trees); i++)
+    for (j = 0; j < GRUB_HFSPLUS_BTNODE_CACHE; j++)
+      grub_free (trees[i]->cache[j].buf);
+  grub_free (data);
+}
+
 static struct grub_hfsplus_data *
 grub_hfsplus_mount (grub_disk_t disk)
 {
@@ -235,7 +253,7 @@ grub_hfsplus_mount (grub_disk_t disk)
     struct grub_hfsplus_volheader hfsplus;
   } volheader;
 
-  data = grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (!data)
     return 0;
 
@@ -380,7 +398,7 @@ grub_hfsplus_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a HFS+ filesystem");
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
   return 0;
 }
 
@@ -491,6 +509,46 @@ grub_hfsplus_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Read the node NUM of BTREE into BUF, from the tree's cache if it
+   was read recently.  */
+static grub_err_t
+grub_hfsplus_btree_read_node (struct grub_hfsplus_btree *btree,
+			      grub_uint64_t num, char *buf)
+{
+  grub_ssize_t got;
+  unsigned i;
+
+  for (i = 0; i < GRUB_HFSPLUS_BTNODE_CACHE; i++)
+    if (btree->cache[i].buf && btree->cache[i].num == num)
+      {
+	grub_memcpy (buf, btree->cache[i].buf, btree->nodesize);
+	return GRUB_ERR_NONE;
+      }
+
+  got = grub_hfsplus_read_file (&btree->file, 0, 0,
+				num * (grub_disk_addr_t) btree->nodesize,
+				btree->nodesize, buf);
+  if (got <= 0)
+    return grub_errno ? : GRUB_ERR_READ_ERROR;
+
+  /* Only whole nodes are cached, and not having the memory for one
+     just means it isn't.  */
+  if (got != (grub_ssize_t) btree->nodesize)
+    return GRUB_ERR_NONE;
+  i = btree->cache_next;
+  if (!btree->cache[i].buf)
+    btree->cache[i].buf = grub_malloc (btree->nodesize);
+  if (btree->cache[i].buf)
+    {
+      grub_memcpy (btree->cache[i].buf, buf, btree->nodesize);
+      btree->cache[i].num = num;
+      btree->cache_next = (i + 1) % GRUB_HFSPLUS_BTNODE_CACHE;
+    }
+  else
+    grub_errno = GRUB_ERR_NONE;
+  return GRUB_ERR_NONE;
+}
+
 static int
 grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 				 struct grub_hfsplus_btnode *first_node,
@@ -525,11 +583,9 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 	saved_node = first_node->next;
       node_count++;
 
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (((grub_disk_addr_t)
-				    grub_be_to_cpu32 (first_node->next))
-				   * btree->nodesize),
-				  btree->nodesize, cnode) <= 0)
+      if (grub_hfsplus_btree_read_node (btree,
+					grub_be_to_cpu32 (first_node->next),
+					cnode))
 	return 1;
 
       /* Don't skip any record in the next iteration.  */
@@ -584,10 +640,7 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
       node_count++;
 
       /* Read a node.  */
-      if (grub_hfsplus_read_file (&btree->file, 0, 0,
-				  (grub_disk_addr_t) currnode
-				  * (grub_disk_addr_t) btree->nodesize,
-				  btree->nodesize, (char *) node) <= 0)
+      if (grub_hfsplus_btree_read_node (btree, currnode, node))
 	{
 	  grub_free (node);
 	  return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
@@ -761,6 +814,7 @@ list_nodes (void *record, void *hook_arg)
   node->data = ctx->dir->data;
   node->compressed = 0;
   node->cbuf = 0;
+  node->ctmp = 0;
   node->compress_index = 0;
 
   grub_memcpy (node->extents, fileinfo->data.extents,
@@ -864,7 +918,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -879,9 +933,10 @@ grub_hfsplus_close (grub_file_t file)
     (struct grub_hfsplus_data *) file->data;
 
   grub_free (data->opened_file.cbuf);
+  grub_free (data->opened_file.ctmp);
   grub_free (data->opened_file.compress_index);
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -960,7 +1015,7 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -995,7 +1050,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 				 grub_hfsplus_cmp_catkey_id, &node, &ptr)
       || !node)
     {
-      grub_free (data);
+      grub_hfsplus_free_data (data);
       return 0;
     }
 
@@ -1020,7 +1075,7 @@ grub_hfsplus_label (grub_device_t device, char **label)
 		       label_len) = '\0';
 
   grub_free (node);
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   return GRUB_ERR_NONE;
 }
@@ -1042,7 +1097,7 @@ grub_hfsplus_mtime (grub_device_t device, grub_int32_t *tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   return grub_errno;
 
@@ -1068,7 +1123,7 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_free_data (data);
 
   return grub_errno;
 }
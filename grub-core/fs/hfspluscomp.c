@@ -112,11 +112,66 @@ grub_hfsplus_cmp_attrkey (struct grub_hfsplus_key *keya,
 
 #define HFSPLUS_COMPRESS_BLOCK_SIZE 65536
 
+/* Return the decompressed chunk BLOCK of NODE, decompressing it into
+   the least recently filled slot of NODE->cbuf unless it is there.  */
+static char *
+hfsplus_get_chunk (struct grub_hfsplus_file *node, grub_uint32_t block)
+{
+  grub_uint32_t sz;
+  grub_size_t ts;
+  unsigned slot;
+  char *out;
+
+  for (slot = 0; slot < GRUB_HFSPLUS_CBUF_CHUNKS; slot++)
+    if (node->cbuf_blocks[slot] == block)
+      return node->cbuf + slot * HFSPLUS_COMPRESS_BLOCK_SIZE;
+
+  if (block >= node->compress_index_size)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "compressed chunk out of range");
+      return NULL;
+    }
+  sz = grub_le_to_cpu32 (node->compress_index[block].size);
+  if (sz > HFSPLUS_COMPRESS_BLOCK_SIZE)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "compressed chunk too big");
+      return NULL;
+    }
+
+  if (!node->ctmp)
+    node->ctmp = grub_malloc (HFSPLUS_COMPRESS_BLOCK_SIZE);
+  if (!node->ctmp)
+    return NULL;
+
+  slot = node->cbuf_next;
+  out = node->cbuf + slot * HFSPLUS_COMPRESS_BLOCK_SIZE;
+  node->cbuf_blocks[slot] = -1;
+
+  if (grub_hfsplus_read_file (node, 0, 0,
+			      grub_le_to_cpu32 (node->compress_index[block].start) + 0x104,
+			      sz, node->ctmp)
+      != (grub_ssize_t) sz)
+    return NULL;
+  ts = HFSPLUS_COMPRESS_BLOCK_SIZE;
+  if (ts > node->size - (grub_uint64_t) block * HFSPLUS_COMPRESS_BLOCK_SIZE)
+    ts = node->size - (grub_uint64_t) block * HFSPLUS_COMPRESS_BLOCK_SIZE;
+  if (grub_zlib_decompress (node->ctmp, sz, 0, out, ts) != (grub_ssize_t) ts)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		    "premature end of compressed");
+      return NULL;
+    }
+
+  node->cbuf_blocks[slot] = block;
+  node->cbuf_next = (slot + 1) % GRUB_HFSPLUS_CBUF_CHUNKS;
+  return out;
+}
+
 static grub_ssize_t
 hfsplus_read_compressed_real (struct grub_hfsplus_file *node,
 			      grub_off_t pos, grub_size_t len, char *buf)
 {
-  char *tmp_buf = 0;
   grub_size_t len0 = len;
 
   if (node->compressed == 1)
@@ -130,52 +185,23 @@ hfsplus_read_compressed_real (struct grub_hfsplus_file *node,
   while (len)
     {
       grub_uint32_t block = pos / HFSPLUS_COMPRESS_BLOCK_SIZE;
+      char *chunk;
       grub_size_t curlen = HFSPLUS_COMPRESS_BLOCK_SIZE
 	- (pos % HFSPLUS_COMPRESS_BLOCK_SIZE);
 
       if (curlen > len)
 	curlen = len;
 
-      if (node->cbuf_block != block)
-	{
-	  grub_uint32_t sz = grub_le_to_cpu32 (node->compress_index[block].size);
-	  grub_size_t ts;
-	  if (!tmp_buf)
-	    tmp_buf = grub_malloc (HFSPLUS_COMPRESS_BLOCK_SIZE);
-	  if (!tmp_buf)
-	    return -1;
-	  if (grub_hfsplus_read_file (node, 0, 0,
-				      grub_le_to_cpu32 (node->compress_index[block].start) + 0x104,
-				      sz, tmp_buf)
-	      != (grub_ssize_t) sz)
-	    {
-	      grub_free (tmp_buf);
-	      return -1;
-	    }
-	  ts = HFSPLUS_COMPRESS_BLOCK_SIZE;
-	  if (ts > node->size - (pos & ~(HFSPLUS_COMPRESS_BLOCK_SIZE)))
-	    ts = node->size - (pos & ~(HFSPLUS_COMPRESS_BLOCK_SIZE));
-	  if (grub_zlib_decompress (tmp_buf, sz, 0,
-				    node->cbuf, ts) != (grub_ssize_t) ts)
-	    {
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-			    "premature end of compressed");
-
-	      grub_free (tmp_buf);
-	      return -1;
-	    }
-	  node->cbuf_block = block;
-	}
-      grub_memcpy (buf, node->cbuf + (pos % HFSPLUS_COMPRESS_BLOCK_SIZE),
-		   curlen);
+      chunk = hfsplus_get_chunk (node, block);
+      if (!chunk)
+	return -1;
+      grub_memcpy (buf, chunk + (pos % HFSPLUS_COMPRESS_BLOCK_SIZE), curlen);
       if (grub_file_progress_hook && node->file)
 	grub_file_progress_hook (0, 0, curlen, node->file);
       buf += curlen;
       pos += curlen;
       len -= curlen;
     }
-  grub_free (tmp_buf);
   return len0;
 }
 
@@ -267,9 +293,11 @@ hfsplus_open_compressed_real (struct grub_hfsplus_file *node)
 	  return 0;
 	}
 
-      node->cbuf_block = -1;
+      grub_memset (node->cbuf_blocks, 0xff, sizeof (node->cbuf_blocks));
+      node->cbuf_next = 0;
 
-      node->cbuf = grub_malloc (HFSPLUS_COMPRESS_BLOCK_SIZE);
+      node->cbuf = grub_malloc (GRUB_HFSPLUS_CBUF_CHUNKS
+				* HFSPLUS_COMPRESS_BLOCK_SIZE);
       grub_free (attr_node);
       if (!node->cbuf)
 	{
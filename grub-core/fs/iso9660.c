@@ -23,6 +23,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
@@ -654,8 +655,9 @@ susp_iterate_dir (struct grub_iso9660_susp_entry *entry,
 }
 
 static int
-grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
-			  grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
+grub_iso9660_iterate_dir_real (grub_fshelp_node_t dir,
+			       grub_fshelp_iterate_dir_hook_t hook,
+			       void *hook_data)
 {
   struct grub_iso9660_dir dirent;
   grub_off_t offset = 0;
@@ -840,6 +842,237 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* Parsed directories, kept across mounts so that lookups in large
+   directories neither read them nor parse their SUSP entries again.  A
+   directory is identified by the device, the volume descriptor it was
+   reached through and its first sector.  At most DIRCACHE_MAX are kept,
+   the least recently used being dropped first.  */
+
+#define DIRCACHE_MAX 8
+
+struct dircache_entry
+{
+  char *name;
+  enum grub_fshelp_filetype type;
+  struct grub_fshelp_node *node;
+  grub_size_t node_size;
+};
+
+struct dircache
+{
+  struct dircache *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  struct grub_iso9660_primary_voldesc voldesc;
+  grub_uint32_t first_sector;
+  grub_size_t count, alloc;
+  struct dircache_entry *entries;
+};
+
+/* Most recently used first.  */
+static struct dircache *dircache_head;
+
+static void
+dircache_free (struct dircache *c)
+{
+  grub_size_t i;
+
+  for (i = 0; i < c->count; i++)
+    {
+      grub_free (c->entries[i].name);
+      grub_free (c->entries[i].node);
+    }
+  grub_free (c->entries);
+  grub_free (c);
+}
+
+static struct dircache *
+dircache_find (grub_fshelp_node_t dir)
+{
+  grub_disk_t disk = dir->data->disk;
+  struct dircache **p, *c;
+
+  for (p = &dircache_head; *p; p = &(*p)->next)
+    {
+      c = *p;
+      if (c->first_sector == dir->dirents[0].first_sector
+	  && c->dev_id == disk->dev->id && c->disk_id == disk->id
+	  && c->part_start == grub_partition_get_start (disk->partition)
+	  && grub_memcmp (&c->voldesc, &dir->data->voldesc,
+			  sizeof (c->voldesc)) == 0)
+	{
+	  *p = c->next;
+	  c->next = dircache_head;
+	  dircache_head = c;
+	  return c;
+	}
+    }
+  return NULL;
+}
+
+static void
+dircache_insert (struct dircache *c)
+{
+  struct dircache **p;
+  int n = 1;
+
+  c->next = dircache_head;
+  dircache_head = c;
+  for (p = &c->next; *p; p = &(*p)->next)
+    if (++n > DIRCACHE_MAX)
+      {
+	dircache_free (*p);
+	*p = NULL;
+	break;
+      }
+}
+
+/* The bytes of NODE in use: its extents and the symlink after them.  */
+static grub_size_t
+node_size (grub_fshelp_node_t node)
+{
+  grub_size_t size;
+
+  size = sizeof (*node) - sizeof (node->dirents)
+    + node->have_dirents * sizeof (node->dirents[0]);
+  if (node->have_symlink)
+    size += grub_strlen (node->symlink
+			 + node->have_dirents * sizeof (node->dirents[0])
+			 - sizeof (node->dirents)) + 1;
+  return size < sizeof (*node) ? sizeof (*node) : size;
+}
+
+/* Context for grub_iso9660_iterate_dir.  */
+struct dircache_ctx
+{
+  grub_fshelp_iterate_dir_hook_t hook;
+  void *hook_data;
+  struct dircache *c;
+  int found;
+};
+
+static void
+dircache_drop (struct dircache_ctx *ctx)
+{
+  dircache_free (ctx->c);
+  ctx->c = NULL;
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Helper for grub_iso9660_iterate_dir.  Record each entry, and keep
+   going after the caller's hook is done so that the whole directory is
+   cached.  */
+static int
+dircache_add_iter (const char *filename, enum grub_fshelp_filetype filetype,
+		   grub_fshelp_node_t node, void *data)
+{
+  struct dircache_ctx *ctx = data;
+  struct dircache *c = ctx->c;
+
+  if (c && c->count == c->alloc)
+    {
+      struct dircache_entry *entries;
+
+      entries = grub_realloc (c->entries, (c->alloc ? c->alloc * 2 : 64)
+			      * sizeof (c->entries[0]));
+      if (entries)
+	{
+	  c->entries = entries;
+	  c->alloc = c->alloc ? c->alloc * 2 : 64;
+	}
+      else
+	dircache_drop (ctx);
+    }
+
+  if (ctx->c)
+    {
+      struct dircache_entry *e = &c->entries[c->count];
+
+      e->node_size = node_size (node);
+      e->node = grub_malloc (e->node_size);
+      e->name = grub_strdup (filename);
+      if (e->node && e->name)
+	{
+	  grub_memcpy (e->node, node, e->node_size);
+	  e->node->data = NULL;
+	  e->node->alloc_dirents = e->node->have_dirents;
+	  e->type = filetype;
+	  c->count++;
+	}
+      else
+	{
+	  grub_free (e->node);
+	  grub_free (e->name);
+	  dircache_drop (ctx);
+	}
+    }
+
+  if (ctx->found)
+    {
+      grub_free (node);
+      return !ctx->c;
+    }
+  ctx->found = ctx->hook (filename, filetype, node, ctx->hook_data);
+  return ctx->found && !ctx->c;
+}
+
+static int
+grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
+			  grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
+{
+  struct dircache_ctx ctx = { hook, hook_data, NULL, 0 };
+  struct dircache *c;
+  grub_disk_t disk = dir->data->disk;
+
+  c = dircache_find (dir);
+  if (c)
+    {
+      grub_size_t i;
+
+      for (i = 0; i < c->count; i++)
+	{
+	  struct grub_fshelp_node *node;
+
+	  node = grub_malloc (c->entries[i].node_size);
+	  if (!node)
+	    return 0;
+	  grub_memcpy (node, c->entries[i].node, c->entries[i].node_size);
+	  node->data = dir->data;
+	  if (hook (c->entries[i].name, c->entries[i].type, node, hook_data))
+	    return 1;
+	}
+      return 0;
+    }
+
+  /* Caching is only an optimization, so its failures aren't reported.  */
+  ctx.c = grub_zalloc (sizeof (*ctx.c));
+  if (ctx.c)
+    {
+      ctx.c->dev_id = disk->dev->id;
+      ctx.c->disk_id = disk->id;
+      ctx.c->part_start = grub_partition_get_start (disk->partition);
+      ctx.c->voldesc = dir->data->voldesc;
+      ctx.c->first_sector = dir->dirents[0].first_sector;
+    }
+  else
+    grub_errno = GRUB_ERR_NONE;
+
+  grub_iso9660_iterate_dir_real (dir, dircache_add_iter, &ctx);
+
+  if (ctx.c && grub_errno)
+    {
+      /* Only reading the rest of the directory for the cache failed.  */
+      dircache_free (ctx.c);
+      if (ctx.found)
+	grub_errno = GRUB_ERR_NONE;
+    }
+  else if (ctx.c)
+    dircache_insert (ctx.c);
+
+  return ctx.found;
+}
+
 
 
 /* Context for grub_iso9660_dir.  */
@@ -1126,4 +1359,11 @@ GRUB_MOD_INIT(iso9660)
 GRUB_MOD_FINI(iso9660)
 {
   grub_fs_unregister (&grub_iso9660_fs);
+  while (dircache_head)
+    {
+      struct dircache *c = dircache_head;
+
+      dircache_head = c->next;
+      dircache_free (c);
+    }
 }
@@ -25,6 +25,7 @@
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/charset.h>
+#include <grub/fshelp.h>
 #include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -228,6 +229,13 @@ struct grub_jfs_data
   int namecomponentlen;
 } GRUB_PACKED;
 
+/* What grub_fshelp_read_file_extents passes back to get_extent.  */
+struct grub_fshelp_node
+{
+  struct grub_jfs_data *data;
+  struct grub_jfs_inode *inode;
+};
+
 struct grub_jfs_diropen
 {
   int index;
@@ -258,11 +266,13 @@ static grub_dl_t my_mod;
 
 static grub_err_t grub_jfs_lookup_symlink (struct grub_jfs_data *data, grub_uint32_t ino);
 
+/* Get the disk block of BLK.  Unless COUNT is NULL, store in it how many
+   blocks from BLK on the extent covers.  */
 static grub_int64_t
 getblk (struct grub_jfs_treehead *treehead,
 	struct grub_jfs_tree_extent *extents,
 	struct grub_jfs_data *data,
-	grub_uint64_t blk)
+	grub_uint64_t blk, grub_uint64_t *count)
 {
   int found = -1;
   int i;
@@ -276,8 +286,14 @@ getblk (struct grub_jfs_treehead *treehead,
 	      && ((grub_le_to_cpu16 (extents[i].extent.length))
 		  + (extents[i].extent.length2 << 16)
 		  + grub_le_to_cpu32 (extents[i].offset2)) > blk)
-	    return (blk - grub_le_to_cpu32 (extents[i].offset2)
-		    + grub_le_to_cpu32 (extents[i].extent.blk2));
+	    {
+	      if (count)
+		*count = (grub_le_to_cpu16 (extents[i].extent.length)
+			  + (extents[i].extent.length2 << 16)
+			  + grub_le_to_cpu32 (extents[i].offset2)) - blk;
+	      return (blk - grub_le_to_cpu32 (extents[i].offset2)
+		      + grub_le_to_cpu32 (extents[i].extent.blk2));
+	    }
 	}
       else
 	if (blk >= grub_le_to_cpu32 (extents[i].offset2))
@@ -302,7 +318,7 @@ getblk (struct grub_jfs_treehead *treehead,
 			   << (grub_le_to_cpu16 (data->sblock.log2_blksz)
 			       - GRUB_DISK_SECTOR_BITS), 0,
 			   sizeof (*tree), (char *) tree))
-	ret = getblk (&tree->treehead, &tree->extents[0], data, blk);
+	ret = getblk (&tree->treehead, &tree->extents[0], data, blk, count);
       grub_free (tree);
       return ret;
     }
@@ -316,7 +332,27 @@ static grub_int64_t
 grub_jfs_blkno (struct grub_jfs_data *data, struct grub_jfs_inode *inode,
 		grub_uint64_t blk)
 {
-  return getblk (&inode->file.tree, &inode->file.extents[0], data, blk);
+  return getblk (&inode->file.tree, &inode->file.extents[0], data, blk, 0);
+}
+
+/* Map BLOCK of the file NODE for grub_fshelp_read_file_extents.  Blocks
+   no extent covers are holes.  */
+static grub_disk_addr_t
+grub_jfs_get_extent (grub_fshelp_node_t node, grub_disk_addr_t block,
+		     grub_disk_addr_t *count)
+{
+  grub_uint64_t len = 1;
+  grub_int64_t blknr;
+
+  blknr = getblk (&node->inode->file.tree, &node->inode->file.extents[0],
+		  node->data, block, &len);
+  if (blknr < 0)
+    {
+      *count = 1;
+      return 0;
+    }
+  *count = len;
+  return blknr;
 }
 
 
@@ -590,55 +626,17 @@ grub_jfs_read_file (struct grub_jfs_data *data,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf)
 {
-  grub_off_t i;
-  grub_off_t blockcnt;
-
-  blockcnt = (len + pos + grub_le_to_cpu32 (data->sblock.blksz) - 1)
-    >> grub_le_to_cpu16 (data->sblock.log2_blksz);
-
-  for (i = pos >> grub_le_to_cpu16 (data->sblock.log2_blksz); i < blockcnt; i++)
-    {
-      grub_disk_addr_t blknr;
-      grub_uint32_t blockoff = pos & (grub_le_to_cpu32 (data->sblock.blksz) - 1);
-      grub_uint32_t blockend = grub_le_to_cpu32 (data->sblock.blksz);
-
-      grub_uint64_t skipfirst = 0;
-
-      blknr = grub_jfs_blkno (data, &data->currinode, i);
-      if (grub_errno)
-	return -1;
-
-      /* Last block.  */
-      if (i == blockcnt - 1)
-	{
-	  blockend = (len + pos) & (grub_le_to_cpu32 (data->sblock.blksz) - 1);
-
-	  if (!blockend)
-	    blockend = grub_le_to_cpu32 (data->sblock.blksz);
-	}
-
-      /* First block.  */
-      if (i == (pos >> grub_le_to_cpu16 (data->sblock.log2_blksz)))
-	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
-	}
-
-      data->disk->read_hook = read_hook;
-      data->disk->read_hook_data = read_hook_data;
-      grub_disk_read (data->disk,
-		      blknr << (grub_le_to_cpu16 (data->sblock.log2_blksz)
-				- GRUB_DISK_SECTOR_BITS),
-		      skipfirst, blockend, buf);
-
-      data->disk->read_hook = 0;
-      if (grub_errno)
-	return -1;
-
-      buf += grub_le_to_cpu32 (data->sblock.blksz) - skipfirst;
-    }
+  struct grub_fshelp_node node = {
+    .data = data,
+    .inode = &data->currinode
+  };
 
-  return len;
+  return grub_fshelp_read_file_extents (data->disk, &node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_jfs_get_extent,
+					grub_le_to_cpu64 (data->currinode.size),
+					grub_le_to_cpu16 (data->sblock.log2_blksz)
+					- GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
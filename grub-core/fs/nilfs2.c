@@ -282,6 +282,9 @@ struct grub_nilfs2_data
   struct grub_fshelp_node diropen;
 };
 
+/* Blocks looked up ahead for a contiguous run at most.  */
+#define NILFS2_EXTENT_MAX 16
+
 /* Log2 size of nilfs2 block in 512 blocks.  */
 #define LOG2_NILFS2_BLOCK_SIZE(data)			\
 	(grub_le_to_cpu32 (data->sblock.s_log_block_size) + 1)
@@ -636,6 +639,41 @@ grub_nilfs2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   return pptr;
 }
 
+/* Map FILEBLOCK like grub_nilfs2_read_block and store in *COUNT how many
+   blocks from it on are contiguous on disk.  Nothing records runs in a
+   log-structured filesystem, so the following blocks are looked up one
+   by one, up to NILFS2_EXTENT_MAX of them.  */
+static grub_disk_addr_t
+grub_nilfs2_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+			grub_disk_addr_t *count)
+{
+  struct grub_nilfs2_data *data = node->data;
+  grub_uint64_t pptr, next, nblocks;
+
+  *count = 1;
+  pptr = grub_nilfs2_read_block (node, fileblock);
+  if (grub_errno)
+    return pptr;
+
+  nblocks = (grub_le_to_cpu64 (node->inode.i_size)
+	     + (1 << LOG2_BLOCK_SIZE (data)) - 1) >> LOG2_BLOCK_SIZE (data);
+  while (*count < NILFS2_EXTENT_MAX && fileblock + *count < nblocks)
+    {
+      next = grub_nilfs2_bmap_lookup (data, &node->inode,
+				      fileblock + *count, 1);
+      if (grub_errno)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  break;
+	}
+      if (next != pptr + *count)
+	break;
+      (*count)++;
+    }
+
+  return pptr;
+}
+
 /* Read LEN bytes from the file described by DATA starting with byte
    POS.  Return the amount of read bytes in READ.  */
 static grub_ssize_t
@@ -643,11 +681,11 @@ grub_nilfs2_read_file (grub_fshelp_node_t node,
 		       grub_disk_read_hook_t read_hook, void *read_hook_data,
 		       grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_nilfs2_read_block,
-				grub_le_to_cpu64 (node->inode.i_size),
-				LOG2_NILFS2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_nilfs2_get_extent,
+					grub_le_to_cpu64 (node->inode.i_size),
+					LOG2_NILFS2_BLOCK_SIZE (node->data), 0);
 
 }
 
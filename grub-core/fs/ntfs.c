@@ -108,6 +108,7 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->flags = (mft == &mft->data->mmft) ? GRUB_NTFS_AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
   at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->ext = NULL;
 }
 
 static void
@@ -116,6 +117,7 @@ free_attr (struct grub_ntfs_attr *at)
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
   grub_free (at->sbuf);
+  grub_free (at->ext);
 }
 
 static grub_uint8_t *
@@ -345,21 +347,108 @@ retry:
   return 0;
 }
 
+/* Decode the run list of PA into AT->ext, unless it is already there.
+   Only the runs in PA itself are decoded; with an attribute list the
+   others are in further segments.  Return 0 if PA can't be decoded, so
+   that the caller walks the run list instead.  */
+static int
+load_extents (struct grub_ntfs_attr *at, grub_uint8_t *pa)
+{
+  grub_uint8_t *run, *end;
+  grub_disk_addr_t vcn, lcn, val;
+  grub_size_t n, i;
+  int c1, c2;
+
+  if (at->ext && at->ext_type == pa[0] && at->ext_id == u16at (pa, 0xE)
+      && at->ext[0].vcn == u32at (pa, 0x10)
+      && at->ext_last == u64at (pa, 0x18))
+    return 1;
+
+  grub_free (at->ext);
+  at->ext = NULL;
+
+  run = pa + u16at (pa, 0x20);
+  end = pa + u32at (pa, 4);
+  for (n = 0; run < end && (*run & 0x7); n++)
+    run += 1 + (*run & 0x7) + ((*run >> 4) & 0x7);
+  if (run >= end)
+    return 0;
+
+  at->ext = grub_malloc ((n + 1) * sizeof (at->ext[0]));
+  if (!at->ext)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  run = pa + u16at (pa, 0x20);
+  vcn = u32at (pa, 0x10);
+  lcn = 0;
+  for (i = 0; i < n; i++)
+    {
+      c1 = (*run & 0x7);
+      c2 = (*run >> 4) & 0x7;
+      run++;
+      at->ext[i].vcn = vcn;
+      vcn += read_run_data (run, c1, 0);
+      run += c1;
+      val = read_run_data (run, c2, 1);
+      run += c2;
+      lcn += val;
+      at->ext[i].lcn = lcn;
+      at->ext[i].sparse = (val == 0);
+    }
+  at->ext[n].vcn = vcn;
+  at->ext_count = n;
+  at->ext_type = pa[0];
+  at->ext_id = u16at (pa, 0xE);
+  at->ext_last = u64at (pa, 0x18);
+  return 1;
+}
+
+static struct grub_ntfs_extent *
+find_extent (struct grub_ntfs_attr *at, grub_disk_addr_t vcn)
+{
+  grub_size_t lo, hi, mid;
+
+  if (!at->ext || at->ext_count == 0
+      || vcn < at->ext[0].vcn || vcn >= at->ext[at->ext_count].vcn)
+    return NULL;
+
+  lo = 0;
+  hi = at->ext_count;
+  while (hi - lo > 1)
+    {
+      mid = (lo + hi) / 2;
+      if (at->ext[mid].vcn <= vcn)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return &at->ext[lo];
+}
+
 static grub_disk_addr_t
 grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
 {
   struct grub_ntfs_rlst *ctx;
 
   ctx = (struct grub_ntfs_rlst *) node;
-  if (block >= ctx->next_vcn)
+  if (ctx->flags & GRUB_NTFS_RF_EXT)
     {
-      if (grub_ntfs_read_run_list (ctx))
-	return -1;
-      return ctx->curr_lcn;
+      struct grub_ntfs_extent *e;
+
+      e = find_extent (ctx->attr, block);
+      if (e)
+	return e->sparse ? 0 : block - e->vcn + e->lcn;
     }
-  else
-    return (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : (block -
-					 ctx->curr_vcn + ctx->curr_lcn);
+
+  /* Past the decoded runs: go on from wherever CTX got to.  */
+  while (block >= ctx->next_vcn)
+    if (grub_ntfs_read_run_list (ctx))
+      return -1;
+  return (ctx->flags & GRUB_NTFS_RF_BLNK) ? 0 : (block -
+				       ctx->curr_vcn + ctx->curr_lcn);
 }
 
 static grub_err_t
@@ -406,11 +495,15 @@ read_data (struct grub_ntfs_attr *at, grub_uint8_t *pa, grub_uint8_t *dest,
     }
 
   ctx->target_vcn = ofs >> (GRUB_NTFS_BLK_SHR + ctx->comp.log_spc);
-  while (ctx->next_vcn <= ctx->target_vcn)
-    {
-      if (grub_ntfs_read_run_list (ctx))
-	return grub_errno;
-    }
+  if (!(at->flags & GRUB_NTFS_AF_GPOS) && load_extents (at, pa)
+      && find_extent (at, ctx->target_vcn))
+    ctx->flags |= GRUB_NTFS_RF_EXT;
+  else
+    while (ctx->next_vcn <= ctx->target_vcn)
+      {
+	if (grub_ntfs_read_run_list (ctx))
+	  return grub_errno;
+      }
 
   if (at->flags & GRUB_NTFS_AF_GPOS)
     {
@@ -493,11 +586,36 @@ read_attr (struct grub_ntfs_attr *at, grub_uint8_t *dest, grub_disk_addr_t ofs,
 static grub_err_t
 read_mft (struct grub_ntfs_data *data, grub_uint8_t *buf, grub_uint64_t mftno)
 {
+  grub_size_t size = data->mft_size << GRUB_NTFS_BLK_SHR;
+  int i;
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE; i++)
+    if (data->mft_cache[i].buf && data->mft_cache[i].mftno == mftno)
+      {
+	grub_memcpy (buf, data->mft_cache[i].buf, size);
+	return 0;
+      }
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << GRUB_NTFS_BLK_SHR),
        data->mft_size << GRUB_NTFS_BLK_SHR, 0, 0, 0))
     return grub_error (GRUB_ERR_BAD_FS, "read MFT 0x%llx fails", (unsigned long long) mftno);
-  return fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE");
+  if (fixup (buf, data->mft_size, (const grub_uint8_t *) "FILE"))
+    return grub_errno;
+
+  /* A failed allocation only means the record isn't cached.  */
+  i = data->mft_cache_next;
+  if (!data->mft_cache[i].buf)
+    data->mft_cache[i].buf = grub_malloc (size);
+  if (data->mft_cache[i].buf)
+    {
+      grub_memcpy (data->mft_cache[i].buf, buf, size);
+      data->mft_cache[i].mftno = mftno;
+      data->mft_cache_next = (i + 1) % GRUB_NTFS_MFT_CACHE;
+    }
+  else
+    grub_errno = GRUB_ERR_NONE;
+  return 0;
 }
 
 static grub_err_t
@@ -549,6 +667,18 @@ free_file (struct grub_ntfs_file *mft)
   grub_free (mft->buf);
 }
 
+static void
+free_data (struct grub_ntfs_data *data)
+{
+  int i;
+
+  free_file (&data->mmft);
+  free_file (&data->cmft);
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE; i++)
+    grub_free (data->mft_cache[i].buf);
+  grub_free (data);
+}
+
 static char *
 get_utf8 (grub_uint8_t *in, grub_size_t len)
 {
@@ -967,9 +1097,7 @@ fail:
 
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
   return 0;
 }
@@ -1029,9 +1157,7 @@ fail:
     }
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1078,9 +1204,7 @@ grub_ntfs_open (grub_file_t file, const char *name)
 fail:
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1111,9 +1235,7 @@ grub_ntfs_close (grub_file_t file)
 
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1171,9 +1293,7 @@ fail:
     }
   if (data)
     {
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
 
   grub_dl_unref (my_mod);
@@ -1197,9 +1317,7 @@ grub_ntfs_uuid (grub_device_t device, char **uuid)
       if (*uuid)
 	for (ptr = *uuid; *ptr; ptr++)
 	  *ptr = grub_toupper (*ptr);
-      free_file (&data->mmft);
-      free_file (&data->cmft);
-      grub_free (data);
+      free_data (data);
     }
   else
     *uuid = NULL;
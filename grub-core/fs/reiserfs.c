@@ -1058,7 +1058,7 @@ grub_reiserfs_read_real (struct grub_fshelp_node *node,
 			 grub_off_t off, char *buf, grub_size_t len,
 			 grub_disk_read_hook_t read_hook, void *read_hook_data)
 {
-  unsigned int indirect_block, indirect_block_count;
+  unsigned int indirect_block, indirect_block_count, run;
   struct grub_reiserfs_key key;
   struct grub_reiserfs_data *data = node->data;
   struct grub_fshelp_node found;
@@ -1151,32 +1151,43 @@ grub_reiserfs_read_real (struct grub_fshelp_node *node,
             goto fail;
           found.data->disk->read_hook = read_hook;
           found.data->disk->read_hook_data = read_hook_data;
+          /* Blocks that follow each other on disk, or holes that do, are
+             read or zeroed at once.  */
           for (indirect_block = 0;
                indirect_block < indirect_block_count
                  && current_position < final_position;
-               indirect_block++)
+               indirect_block += run)
             {
-              block = grub_le_to_cpu32 (indirect_block_ptr[indirect_block]) *
-                      (block_size >> GRUB_DISK_SECTOR_BITS);
+              grub_uint32_t first;
+
+              first = grub_le_to_cpu32 (indirect_block_ptr[indirect_block]);
+              block = ((grub_disk_addr_t) first
+                       * (block_size >> GRUB_DISK_SECTOR_BITS));
               grub_dprintf ("reiserfs_blocktype", "I: %u\n", (unsigned) block);
-              if (current_position + block_size >= initial_position)
+              run = 1;
+              if (current_position + block_size > initial_position)
                 {
                   offset = MAX ((signed) (initial_position - current_position),
                                 0);
-                  length = (MIN (block_size, final_position - current_position)
+                  while (indirect_block + run < indirect_block_count
+                         && (current_position + (grub_off_t) run * block_size
+                             < final_position)
+                         && (grub_le_to_cpu32 (indirect_block_ptr[indirect_block
+                                                                  + run])
+                             == (first ? first + run : 0)))
+                    run++;
+                  length = (MIN ((grub_off_t) run * block_size,
+                                 final_position - current_position)
                             - offset);
                   grub_dprintf ("reiserfs",
-                                "Reading indirect block %u from %u to %u...\n",
-                                (unsigned) block, (unsigned) offset,
+                                "Reading %u indirect blocks at %u from %u to %u...\n",
+                                run, (unsigned) block, (unsigned) offset,
                                 (unsigned) (offset + length));
-#if 0
-                  grub_dprintf ("reiserfs",
-                                "\nib=%04d/%04d, ip=%d, cp=%d, fp=%d, off=%d, l=%d, tl=%d\n",
-                                indirect_block + 1, indirect_block_count,
-                                initial_position, current_position,
-                                final_position, offset, length, len);
-#endif
-                  grub_disk_read (found.data->disk, block, offset, length, buf);
+                  if (first)
+                    grub_disk_read (found.data->disk, block, offset, length,
+                                    buf);
+                  else
+                    grub_memset (buf, 0, length);
                   if (grub_errno)
                     goto fail;
                   buf += length;
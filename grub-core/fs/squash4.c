@@ -26,6 +26,9 @@
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
+#include <grub/partition.h>
+#include <grub/lz4.h>
+#include <grub/zstd.h>
 #include <minilzo.h>
 
 #include "xz.h"
@@ -183,16 +186,53 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
 
 #define SQUASH_CHUNK_SIZE 0x2000
 #define XZBUFSIZ 0x2000
 
+/* Largest block size allowed by the format.  */
+#define SQUASH_MAX_BLOCK_SIZE (1 << 20)
+
+/* Upper bound on the decompressed metadata and data blocks kept around.  */
+#define SQUASH_CACHE_MAX (4 << 20)
+
+/* What identifies a filesystem across mounts.  */
+struct grub_squash_cache_key
+{
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t creation_time;
+  grub_uint64_t total_size;
+};
+
+/* A decompressed block, keyed by the on-disk offset of its compressed
+   data.  Entries are shared by all mounts of the same filesystem, so
+   that they survive from one `ls' or file open to the next.  */
+struct grub_squash_cache_entry
+{
+  struct grub_squash_cache_entry *next;
+  struct grub_squash_cache_entry *prev;
+  struct grub_squash_cache_key key;
+  grub_uint64_t offset;
+  grub_size_t size;
+  char *data;
+};
+
+/* Most recently used first.  */
+static struct grub_squash_cache_entry *cache_head;
+static struct grub_squash_cache_entry *cache_tail;
+static grub_size_t cache_size;
+
 struct grub_squash_data
 {
   grub_disk_t disk;
   struct grub_squash_super sb;
+  struct grub_squash_cache_key key;
   struct grub_squash_cache_inode ino;
   grub_uint64_t fragments;
   int log2_blksz;
@@ -216,6 +256,124 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+static int
+cache_key_eq (const struct grub_squash_cache_key *a,
+	      const struct grub_squash_cache_key *b)
+{
+  return (a->dev_id == b->dev_id && a->disk_id == b->disk_id
+	  && a->part_start == b->part_start
+	  && a->creation_time == b->creation_time
+	  && a->total_size == b->total_size);
+}
+
+static void
+cache_unlink (struct grub_squash_cache_entry *e)
+{
+  if (e->prev)
+    e->prev->next = e->next;
+  else
+    cache_head = e->next;
+  if (e->next)
+    e->next->prev = e->prev;
+  else
+    cache_tail = e->prev;
+}
+
+static void
+cache_push (struct grub_squash_cache_entry *e)
+{
+  e->prev = NULL;
+  e->next = cache_head;
+  if (cache_head)
+    cache_head->prev = e;
+  else
+    cache_tail = e;
+  cache_head = e;
+}
+
+static void
+cache_evict (struct grub_squash_cache_entry *e)
+{
+  cache_unlink (e);
+  cache_size -= e->size;
+  grub_free (e->data);
+  grub_free (e);
+}
+
+/* Return the decompressed contents of the CSIZE-byte compressed block at
+   OFFSET, of at most USIZE bytes.  The entry stays valid until the next
+   call.  */
+static struct grub_squash_cache_entry *
+get_block (struct grub_squash_data *data, grub_uint64_t offset,
+	   grub_size_t csize, grub_size_t usize)
+{
+  struct grub_squash_cache_entry *e;
+  char *tmp, *out;
+  grub_ssize_t ret;
+  grub_err_t err;
+
+  for (e = cache_head; e; e = e->next)
+    if (e->offset == offset && cache_key_eq (&e->key, &data->key))
+      {
+	if (e != cache_head)
+	  {
+	    cache_unlink (e);
+	    cache_push (e);
+	  }
+	return e;
+      }
+
+  tmp = grub_malloc (csize);
+  if (!tmp)
+    return NULL;
+  err = grub_disk_read (data->disk, offset >> GRUB_DISK_SECTOR_BITS,
+			offset & (GRUB_DISK_SECTOR_SIZE - 1), csize, tmp);
+  if (err)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+
+  out = grub_malloc (usize);
+  if (!out)
+    {
+      grub_free (tmp);
+      return NULL;
+    }
+  ret = data->decompress (tmp, csize, 0, out, usize, data);
+  grub_free (tmp);
+  if (ret <= 0)
+    {
+      grub_free (out);
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      return NULL;
+    }
+  if ((grub_size_t) ret < usize)
+    {
+      tmp = grub_realloc (out, ret);
+      if (tmp)
+	out = tmp;
+    }
+
+  e = grub_malloc (sizeof (*e));
+  if (!e)
+    {
+      grub_free (out);
+      return NULL;
+    }
+  e->key = data->key;
+  e->offset = offset;
+  e->size = ret;
+  e->data = out;
+
+  while (cache_tail && cache_size + e->size > SQUASH_CACHE_MAX)
+    cache_evict (cache_tail);
+  cache_push (e);
+  cache_size += e->size;
+  return e;
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -254,29 +412,15 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
+	  struct grub_squash_cache_entry *e;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  e = get_block (data, chunk_start + 2, bsize, SQUASH_CHUNK_SIZE);
+	  if (!e)
+	    return grub_errno;
+	  if (offset + csize > e->size)
+	    return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_memcpy (buf, e->data + offset, csize);
 	}
       len -= csize;
       offset += csize;
@@ -314,11 +458,58 @@ lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
       grub_free (udata);
       return -1;
     }
+  if (off > usize)
+    off = usize;
+  if (len > usize - off)
+    len = usize - off;
   grub_memcpy (outbuf, udata + off, len);
   grub_free (udata);
   return len;
 }
 
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = data->blksz;
+  grub_ssize_t ret;
+  char *udata;
+
+  if (usize < SQUASH_CHUNK_SIZE)
+    usize = SQUASH_CHUNK_SIZE;
+
+  /* The block may be as large as USIZE, so decode straight into OUTBUF
+     only when it has room for all of it.  */
+  if (off == 0 && len >= usize)
+    return grub_lz4_decompress (inbuf, insize, outbuf, len);
+
+  udata = grub_malloc (usize);
+  if (!udata)
+    return -1;
+
+  ret = grub_lz4_decompress (inbuf, insize, udata, usize);
+  if (ret < 0)
+    {
+      grub_free (udata);
+      return -1;
+    }
+  if (off > (grub_size_t) ret)
+    off = ret;
+  if (len > ret - off)
+    len = ret - off;
+  grub_memcpy (outbuf, udata + off, len);
+  grub_free (udata);
+  return len;
+}
+
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t outsize,
+		 struct grub_squash_data *data __attribute__ ((unused)))
+{
+  return grub_zstd_decompress (inbuf, insize, off, outbuf, outsize);
+}
+
 static grub_ssize_t
 xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 	       char *outbuf, grub_size_t len, struct grub_squash_data *data)
@@ -392,6 +583,7 @@ squash_mount (grub_disk_t disk)
     return NULL;
   if (sb.magic != grub_cpu_to_le32_compile_time (SQUASH_MAGIC)
       || sb.block_size == 0
+      || grub_le_to_cpu32 (sb.block_size) > SQUASH_MAX_BLOCK_SIZE
       || ((sb.block_size - 1) & sb.block_size))
     {
       grub_error (GRUB_ERR_BAD_FS, "not squash4");
@@ -414,6 +606,11 @@ squash_mount (grub_disk_t disk)
   data->sb = sb;
   data->disk = disk;
   data->fragments = grub_le_to_cpu64 (frag);
+  data->key.dev_id = disk->dev->id;
+  data->key.disk_id = disk->id;
+  data->key.part_start = grub_partition_get_start (disk->partition);
+  data->key.creation_time = grub_le_to_cpu32 (sb.creation_time);
+  data->key.total_size = grub_le_to_cpu64 (sb.total_size);
 
   switch (sb.compression)
     {
@@ -439,6 +636,12 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->decompress = zstd_decompress;
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -826,32 +1029,20 @@ direct_read (struct grub_squash_data *data,
       if (!(ino->block_sizes[i]
 	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
-	  char *block;
+	  struct grub_squash_cache_entry *e;
 	  grub_size_t csize;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
-	  block = grub_malloc (csize);
-	  if (!block)
+	  e = get_block (data, ino->cumulated_block_sizes[i] + a, csize,
+			 data->blksz);
+	  if (!e)
 	    return -1;
-	  err = grub_disk_read (data->disk,
-				(ino->cumulated_block_sizes[i] + a)
-				>> GRUB_DISK_SECTOR_BITS,
-				(ino->cumulated_block_sizes[i] + a)
-				& (GRUB_DISK_SECTOR_SIZE - 1),
-				csize, block);
-	  if (err)
-	    {
-	      grub_free (block);
-	      return -1;
-	    }
-	  if (data->decompress (block, csize, boff, buf, curread, data)
-	      != (grub_ssize_t) curread)
+	  if (boff + curread > e->size)
 	    {
-	      grub_free (block);
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	      grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	      return -1;
 	    }
-	  grub_free (block);
+	  grub_memcpy (buf, e->data + boff, curread);
+	  err = GRUB_ERR_NONE;
 	}
       else
 	err = grub_disk_read (data->disk, 
@@ -909,32 +1100,18 @@ grub_squash_read_data (struct grub_squash_data *data,
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
-      if (!block)
+      struct grub_squash_cache_entry *e;
+      e = get_block (data, a, grub_le_to_cpu32 (frag.size), data->blksz);
+      if (!e)
 	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
+      if (b + len > e->size)
 	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      grub_free (block);
+      grub_memcpy (buf, e->data + b, len);
     }
   else
     {
@@ -998,5 +1175,7 @@ GRUB_MOD_INIT(squash4)
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  while (cache_tail)
+    cache_evict (cache_tail);
 }
 
@@ -138,6 +138,15 @@ struct grub_udf_extent_ad
   grub_uint32_t start;
 } GRUB_PACKED;
 
+struct grub_udf_ext_ad
+{
+  grub_uint32_t length;
+  grub_uint32_t recorded_length;
+  grub_uint32_t info_length;
+  struct grub_udf_lb_addr block;
+  grub_uint8_t imp_use[2];
+} GRUB_PACKED;
+
 struct grub_udf_charspec
 {
   grub_uint8_t charset_type;
@@ -345,6 +354,16 @@ struct grub_udf_aed
   grub_uint32_t ae_len;
 } GRUB_PACKED;
 
+/* A run of file blocks, BLOCK being where it starts on disk unless the
+   run is SPARSE.  */
+struct grub_udf_extent
+{
+  grub_disk_addr_t fileblock;
+  grub_disk_addr_t count;
+  grub_disk_addr_t block;
+  int sparse;
+};
+
 struct grub_udf_data
 {
   grub_disk_t disk;
@@ -353,6 +372,13 @@ struct grub_udf_data
   struct grub_udf_partmap *pms[GRUB_UDF_MAX_PMS];
   struct grub_udf_long_ad root_icb;
   int npd, npm, lbshift;
+
+  /* The allocation descriptors of the file entry at EXT_ICB in
+     partition EXT_PART_REF, as sorted extents.  */
+  struct grub_udf_extent *extents;
+  grub_size_t nextents;
+  grub_uint32_t ext_icb;
+  int ext_part_ref;
 };
 
 struct grub_fshelp_node
@@ -423,13 +449,27 @@ grub_udf_read_icb (struct grub_udf_data *data,
   return 0;
 }
 
-static grub_disk_addr_t
-grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+/* Decode the allocation descriptors of NODE, following allocation
+   extent descriptors, into DATA->extents.  Nothing is done if they are
+   there already.  */
+static grub_err_t
+grub_udf_load_extents (grub_fshelp_node_t node)
 {
-  char *buf = NULL;
-  char *ptr;
+  struct grub_udf_data *data = node->data;
+  grub_uint32_t bsize = U32 (data->lvd.bsize);
+  grub_disk_addr_t fileblock = 0;
+  grub_size_t alloc = 0, adsize;
+  char *ptr, *buf = NULL;
   grub_ssize_t len;
-  grub_disk_addr_t filebytes;
+  int adtype;
+
+  if (data->extents && data->ext_icb == node->block.fe.tag.tag_location
+      && data->ext_part_ref == node->part_ref)
+    return GRUB_ERR_NONE;
+
+  grub_free (data->extents);
+  data->extents = NULL;
+  data->nextents = 0;
 
   switch (U16 (node->block.fe.tag.tag_ident))
     {
@@ -444,124 +484,188 @@ grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       break;
 
     default:
-      grub_error (GRUB_ERR_BAD_FS, "invalid file entry");
-      return 0;
+      return grub_error (GRUB_ERR_BAD_FS, "invalid file entry");
     }
 
-  if ((U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
-      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT)
+  adtype = U16 (node->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK;
+  switch (adtype)
     {
-      struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+    case GRUB_UDF_ICBTAG_FLAG_AD_SHORT:
+      adsize = sizeof (struct grub_udf_short_ad);
+      break;
+    case GRUB_UDF_ICBTAG_FLAG_AD_LONG:
+      adsize = sizeof (struct grub_udf_long_ad);
+      break;
+    case GRUB_UDF_ICBTAG_FLAG_AD_EXT:
+      adsize = sizeof (struct grub_udf_ext_ad);
+      break;
+    default:
+      return grub_error (GRUB_ERR_BAD_FS, "invalid extent type");
+    }
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_short_ad))
-	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
-	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							node->part_ref,
-							ad->position);
-	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
-		goto fail;
+  while (len >= (grub_ssize_t) adsize)
+    {
+      grub_uint32_t length, block_num, adlen;
+      grub_uint16_t part_ref;
+      struct grub_udf_extent *e;
 
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
+      if (adtype == GRUB_UDF_ICBTAG_FLAG_AD_SHORT)
+	{
+	  struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
 
-	      len = U32 (extension->ae_len);
-	      ad = (struct grub_udf_short_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
-	    }
+	  length = U32 (ad->length);
+	  block_num = ad->position;
+	  part_ref = node->part_ref;
+	}
+      else if (adtype == GRUB_UDF_ICBTAG_FLAG_AD_LONG)
+	{
+	  struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
 
-	  if (filebytes < adlen)
-	    {
-	      grub_uint32_t ad_pos = ad->position;
-	      grub_free (buf);
-	      return ((U32 (ad_pos) & GRUB_UDF_EXT_MASK) ? 0 :
-		      (grub_udf_get_block (node->data, node->part_ref, ad_pos)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-					+ node->data->lbshift))));
-	    }
+	  length = U32 (ad->length);
+	  block_num = ad->block.block_num;
+	  part_ref = ad->block.part_ref;
+	}
+      else
+	{
+	  struct grub_udf_ext_ad *ad = (struct grub_udf_ext_ad *) ptr;
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_short_ad);
+	  length = U32 (ad->length);
+	  block_num = ad->block.block_num;
+	  part_ref = ad->block.part_ref;
 	}
-    }
-  else
-    {
-      struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
 
-      filebytes = fileblock * U32 (node->data->lvd.bsize);
-      while (len >= (grub_ssize_t) sizeof (struct grub_udf_long_ad))
+      adlen = length & ~GRUB_UDF_EXT_MASK;
+      if (adlen == 0)
+	break;
+
+      /* The descriptors go on in an allocation extent.  */
+      if ((length & GRUB_UDF_EXT_MASK) == GRUB_UDF_EXT_MASK)
 	{
-	  grub_uint32_t adlen = U32 (ad->length) & 0x3fffffff;
-	  grub_uint32_t adtype = U32 (ad->length) >> 30;
-	  if (adtype == 3)
+	  struct grub_udf_aed *extension;
+	  grub_disk_addr_t sec;
+
+	  sec = grub_udf_get_block (data, part_ref, block_num);
+	  if (grub_errno)
+	    goto fail;
+	  if (!buf)
 	    {
-	      struct grub_udf_aed *extension;
-	      grub_disk_addr_t sec = grub_udf_get_block(node->data,
-							ad->block.part_ref,
-							ad->block.block_num);
+	      buf = grub_malloc (bsize);
 	      if (!buf)
-		{
-		  buf = grub_malloc (U32 (node->data->lvd.bsize));
-		  if (!buf)
-		    return 0;
-		}
-	      if (grub_disk_read (node->data->disk, sec << node->data->lbshift,
-				  0, adlen, buf))
 		goto fail;
-
-	      extension = (struct grub_udf_aed *) buf;
-	      if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
-		{
-		  grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
-		  goto fail;
-		}
-
-	      len = U32 (extension->ae_len);
-	      ad = (struct grub_udf_long_ad *)
-		    (buf + sizeof (struct grub_udf_aed));
-	      continue;
 	    }
-	      
-	  if (filebytes < adlen)
+	  if (adlen > bsize)
+	    adlen = bsize;
+	  if (adlen < sizeof (struct grub_udf_aed))
 	    {
-	      grub_uint32_t ad_block_num = ad->block.block_num;
-	      grub_uint32_t ad_part_ref = ad->block.part_ref;
-	      grub_free (buf);
-	      return ((U32 (ad_block_num) & GRUB_UDF_EXT_MASK) ?  0 :
-		      (grub_udf_get_block (node->data, ad_part_ref,
-					   ad_block_num)
-		       + (filebytes >> (GRUB_DISK_SECTOR_BITS
-				        + node->data->lbshift))));
+	      grub_error (GRUB_ERR_BAD_FS, "invalid aed length");
+	      goto fail;
 	    }
+	  if (grub_disk_read (data->disk, sec << data->lbshift,
+			      0, adlen, buf))
+	    goto fail;
 
-	  filebytes -= adlen;
-	  ad++;
-	  len -= sizeof (struct grub_udf_long_ad);
+	  extension = (struct grub_udf_aed *) buf;
+	  if (U16 (extension->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "invalid aed tag");
+	      goto fail;
+	    }
+
+	  len = U32 (extension->ae_len);
+	  if (len > (grub_ssize_t) (adlen - sizeof (struct grub_udf_aed)))
+	    len = adlen - sizeof (struct grub_udf_aed);
+	  ptr = buf + sizeof (struct grub_udf_aed);
+	  continue;
+	}
+
+      if (data->nextents == alloc)
+	{
+	  struct grub_udf_extent *extents;
+
+	  alloc = alloc ? alloc * 2 : 16;
+	  extents = grub_realloc (data->extents, alloc * sizeof (*extents));
+	  if (!extents)
+	    goto fail;
+	  data->extents = extents;
 	}
+
+      e = &data->extents[data->nextents];
+      e->fileblock = fileblock;
+      e->count = (adlen + bsize - 1) / bsize;
+      /* Extents that are not recorded read as zeros.  */
+      e->sparse = (length & GRUB_UDF_EXT_MASK) != GRUB_UDF_EXT_NORMAL;
+      e->block = 0;
+      if (!e->sparse)
+	{
+	  e->block = grub_udf_get_block (data, part_ref, block_num);
+	  if (grub_errno)
+	    goto fail;
+	}
+      fileblock += e->count;
+      data->nextents++;
+
+      ptr += adsize;
+      len -= adsize;
     }
 
-fail:
   grub_free (buf);
+  data->ext_icb = node->block.fe.tag.tag_location;
+  data->ext_part_ref = node->part_ref;
+  /* Mark an empty file as loaded too.  */
+  if (!data->extents)
+    {
+      data->extents = grub_malloc (sizeof (*data->extents));
+      if (!data->extents)
+	return grub_errno;
+    }
+  return GRUB_ERR_NONE;
 
-  return 0;
+ fail:
+  grub_free (buf);
+  grub_free (data->extents);
+  data->extents = NULL;
+  data->nextents = 0;
+  return grub_errno;
+}
+
+/* Map FILEBLOCK of NODE through the extents loaded by
+   grub_udf_load_extents, storing in *COUNT how many blocks from it on
+   are contiguous.  Blocks past the last extent read as zeros.  */
+static grub_disk_addr_t
+grub_udf_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
+{
+  struct grub_udf_data *data = node->data;
+  struct grub_udf_extent *e;
+  grub_size_t lo = 0, hi = data->nextents, mid;
+
+  *count = 1;
+  if (hi == 0 || fileblock < data->extents[0].fileblock)
+    return 0;
+
+  while (hi - lo > 1)
+    {
+      mid = (lo + hi) / 2;
+      if (data->extents[mid].fileblock <= fileblock)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  e = &data->extents[lo];
+  if (fileblock >= e->fileblock + e->count)
+    return 0;
+
+  *count = e->fileblock + e->count - fileblock;
+  return e->sparse ? 0 : e->block + (fileblock - e->fileblock);
+}
+
+static void
+grub_udf_free_data (struct grub_udf_data *data)
+{
+  if (data)
+    grub_free (data->extents);
+  grub_free (data);
 }
 
 static grub_ssize_t
@@ -586,16 +690,16 @@ grub_udf_read_file (grub_fshelp_node_t node,
 	return len;
       }
 
-    case GRUB_UDF_ICBTAG_FLAG_AD_EXT:
-      grub_error (GRUB_ERR_BAD_FS, "invalid extent type");
-      return 0;
     }
 
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_udf_read_block,
-				U64 (node->block.fe.file_size),
-				node->data->lbshift, 0);
+  if (grub_udf_load_extents (node))
+    return -1;
+
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_udf_get_extent,
+					U64 (node->block.fe.file_size),
+					node->data->lbshift, 0);
 }
 
 static unsigned sblocklist[] = { 256, 512, 0 };
@@ -614,6 +718,8 @@ grub_udf_mount (grub_disk_t disk)
     return 0;
 
   data->disk = disk;
+  data->extents = NULL;
+  data->nextents = 0;
 
   /* Search for Anchor Volume Descriptor Pointer (AVDP)
    * and determine logical block size.  */
@@ -1114,7 +1220,7 @@ grub_udf_dir (grub_device_t device, const char *path,
 fail:
   grub_free (rootnode);
 
-  grub_free (data);
+  grub_udf_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -1153,12 +1259,19 @@ grub_udf_open (struct grub_file *file, const char *name)
 
   grub_free (rootnode);
 
+  /* Decode its allocation descriptors now rather than on the first
+     read.  */
+  if ((U16 (foundnode->block.fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+      != GRUB_UDF_ICBTAG_FLAG_AD_IN_ICB)
+    grub_udf_load_extents (foundnode);
+  grub_errno = GRUB_ERR_NONE;
+
   return 0;
 
 fail:
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_udf_free_data (data);
   grub_free (rootnode);
 
   return grub_errno;
@@ -1180,7 +1293,7 @@ grub_udf_close (grub_file_t file)
     {
       struct grub_fshelp_node *node = (struct grub_fshelp_node *) file->data;
 
-      grub_free (node->data);
+      grub_udf_free_data (node->data);
       grub_free (node);
     }
 
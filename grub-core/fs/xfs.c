@@ -204,6 +204,21 @@ struct grub_fshelp_node
   struct grub_xfs_inode inode;
 };
 
+/* Number of B+tree blocks kept per mount.  */
+#define XFS_NODE_CACHE_SIZE	16
+/* Leaves read at once when a leaf is missing from the cache: the one
+   needed and the siblings following it.  */
+#define XFS_LEAF_PREFETCH	8
+
+/* A B+tree block, either a node or a leaf.  FSB is 0 for unused
+   entries.  */
+struct grub_xfs_cached_block
+{
+  grub_uint64_t fsb;
+  unsigned long last_used;
+  char *buf;
+};
+
 struct grub_xfs_data
 {
   struct grub_xfs_sblock sblock;
@@ -213,6 +228,9 @@ struct grub_xfs_data
   grub_uint32_t agsize;
   unsigned int hasftype:1;
   unsigned int hascrc:1;
+  struct grub_xfs_cached_block block_cache[XFS_NODE_CACHE_SIZE];
+  unsigned long block_cache_clock;
+  /* Must be last, the inode has a variable size.  */
   struct grub_fshelp_node diropen;
 };
 
@@ -495,26 +513,139 @@ get_fsb (const void *keys, int idx)
   return grub_be_to_cpu64 (grub_get_unaligned64 (p));
 }
 
+static struct grub_xfs_cached_block *
+grub_xfs_cache_find (struct grub_xfs_data *data, grub_uint64_t fsb)
+{
+  int i;
+
+  for (i = 0; i < XFS_NODE_CACHE_SIZE; i++)
+    if (data->block_cache[i].fsb == fsb && data->block_cache[i].buf)
+      return &data->block_cache[i];
+  return NULL;
+}
+
+/* Return the least recently used cache entry, emptied.  */
+static struct grub_xfs_cached_block *
+grub_xfs_cache_alloc (struct grub_xfs_data *data)
+{
+  struct grub_xfs_cached_block *c = &data->block_cache[0];
+  int i;
+
+  for (i = 1; i < XFS_NODE_CACHE_SIZE && c->buf; i++)
+    if (! data->block_cache[i].buf
+	|| data->block_cache[i].last_used < c->last_used)
+      c = &data->block_cache[i];
+
+  if (! c->buf)
+    {
+      c->buf = grub_malloc (data->bsize);
+      if (! c->buf)
+	return NULL;
+    }
+  c->fsb = 0;
+  c->last_used = ++data->block_cache_clock;
+  return c;
+}
+
+static void
+grub_xfs_unmount (struct grub_xfs_data *data)
+{
+  int i;
+
+  if (! data)
+    return;
+  for (i = 0; i < XFS_NODE_CACHE_SIZE; i++)
+    grub_free (data->block_cache[i].buf);
+  grub_free (data);
+}
+
+/* Return the B+tree block PTRS[IDX] points to, one of the NPTRS children
+   of a node.  If they are LEAVES, the siblings following it are read
+   along with it on a cache miss, as reading a file walks the leaves in
+   order.  The block stays valid until the next call.  */
+static struct grub_xfs_btree_node *
+grub_xfs_read_btree_block (struct grub_xfs_data *data, const char *ptrs,
+			   int nptrs, int idx, int leaves)
+{
+  struct grub_xfs_cached_block *c;
+  struct grub_xfs_btree_node *node;
+
+  c = grub_xfs_cache_find (data, get_fsb (ptrs, idx));
+  if (c)
+    c->last_used = ++data->block_cache_clock;
+  else
+    {
+      grub_uint64_t fsbs[XFS_LEAF_PREFETCH];
+      struct grub_xfs_cached_block *slots[XFS_LEAF_PREFETCH];
+      struct grub_disk_vec vec[XFS_LEAF_PREFETCH];
+      int i, n = 0;
+
+      /* Collect the pointers first, taking cache entries may reuse the
+	 buffer PTRS is in.  */
+      for (i = idx; i < nptrs && n < (leaves ? XFS_LEAF_PREFETCH : 1); i++)
+	{
+	  grub_uint64_t fsb = get_fsb (ptrs, i);
+
+	  if (i > idx && grub_xfs_cache_find (data, fsb))
+	    continue;
+	  fsbs[n++] = fsb;
+	}
+
+      for (i = 0; i < n; i++)
+	{
+	  slots[i] = grub_xfs_cache_alloc (data);
+	  if (! slots[i])
+	    return NULL;
+	  vec[i].sector = (GRUB_XFS_FSB_TO_BLOCK (data, fsbs[i])
+			   << (data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS));
+	  vec[i].size = data->bsize;
+	  vec[i].buf = slots[i]->buf;
+	}
+
+      if (grub_disk_read_vec (data->disk, vec, n))
+	return NULL;
+
+      for (i = 0; i < n; i++)
+	slots[i]->fsb = fsbs[i];
+      c = slots[0];
+    }
+
+  node = (struct grub_xfs_btree_node *) c->buf;
+  if ((!data->hascrc &&
+       grub_strncmp ((char *) node->magic, "BMAP", 4)) ||
+      (data->hascrc &&
+       grub_strncmp ((char *) node->magic, "BMA3", 4)))
+    {
+      c->fsb = 0;
+      grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+      return NULL;
+    }
+
+  return node;
+}
+
+/* Map FILEBLOCK of NODE to a disk block and store in *COUNT how many
+   blocks following it are contiguous on disk (or sparse, if 0 is
+   returned).  */
 static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_xfs_get_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		     grub_disk_addr_t *count)
 {
-  struct grub_xfs_btree_node *leaf = 0;
   int ex, nrec;
   struct grub_xfs_extent *exts;
-  grub_uint64_t ret = 0;
+
+  *count = 1;
 
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
       struct grub_xfs_btree_root *root;
+      struct grub_xfs_btree_node *leaf;
       const char *keys;
-      int recoffset;
-
-      leaf = grub_malloc (node->data->bsize);
-      if (leaf == 0)
-        return 0;
+      int recoffset, level;
 
       root = (struct grub_xfs_btree_root *) grub_xfs_inode_data(&node->inode);
       nrec = grub_be_to_cpu16 (root->numrecs);
+      level = grub_be_to_cpu16 (root->level);
       keys = (char *) &root->keys[0];
       if (node->inode.fork_offset)
 	recoffset = (node->inode.fork_offset - 1) / 2;
@@ -534,33 +665,23 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
           /* Sparse block.  */
           if (i == 0)
-            {
-              grub_free (leaf);
-              return 0;
-            }
-
-          if (grub_disk_read (node->data->disk,
-                              GRUB_XFS_FSB_TO_BLOCK (node->data, get_fsb (keys, i - 1 + recoffset)) << (node->data->sblock.log2_bsize - GRUB_DISK_SECTOR_BITS),
-                              0, node->data->bsize, leaf))
             return 0;
 
-	  if ((!node->data->hascrc &&
-	       grub_strncmp ((char *) leaf->magic, "BMAP", 4)) ||
-	      (node->data->hascrc &&
-	       grub_strncmp ((char *) leaf->magic, "BMA3", 4)))
-            {
-              grub_free (leaf);
-              grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
-              return 0;
-            }
+	  leaf = grub_xfs_read_btree_block (node->data,
+					    keys + recoffset
+					    * sizeof (grub_uint64_t),
+					    nrec, i - 1, level == 1);
+	  if (! leaf)
+	    return 0;
 
           nrec = grub_be_to_cpu16 (leaf->numrecs);
+	  level = grub_be_to_cpu16 (leaf->level);
           keys = grub_xfs_btree_keys(node->data, leaf);
 	  recoffset = ((node->data->bsize - ((char *) keys
 					     - (char *) leaf))
 		       / (2 * sizeof (grub_uint64_t)));
 	}
-      while (leaf->level);
+      while (level);
       exts = (struct grub_xfs_extent *) keys;
     }
   else if (node->inode.format == XFS_INODE_FORMAT_EXT)
@@ -586,20 +707,21 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       /* Sparse block.  */
       if (fileblock < offset)
-        break;
+	{
+	  *count = offset - fileblock;
+	  break;
+	}
       else if (fileblock < offset + size)
         {
-          ret = (fileblock - offset + start);
-          break;
+	  *count = offset + size - fileblock;
+	  return GRUB_XFS_FSB_TO_BLOCK (node->data,
+					fileblock - offset + start);
         }
     }
 
-  grub_free (leaf);
-
-  return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
+  return 0;
 }
 
-
 /* Read LEN bytes from the file described by DATA starting with byte
    POS.  Return the amount of read bytes in READ.  */
 static grub_ssize_t
@@ -607,12 +729,13 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_xfs_get_extent,
+					grub_be_to_cpu64 (node->inode.size)
+					+ header_size,
+					node->data->sblock.log2_bsize
+					- GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -948,6 +1071,11 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
     {
       info.mtimeset = 1;
       info.mtime = grub_be_to_cpu32 (node->inode.mtime.sec);
+      if ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_REG)
+	{
+	  info.sizeset = 1;
+	  info.size = grub_be_to_cpu64 (node->inode.size);
+	}
     }
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
   grub_free (node);
@@ -978,7 +1106,7 @@ grub_xfs_dir (grub_device_t device, const char *path,
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_unmount (data);
 
  mount_fail:
 
@@ -1028,7 +1156,7 @@ grub_xfs_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_unmount (data);
 
  mount_fail:
   grub_dl_unref (my_mod);
@@ -1052,7 +1180,7 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_xfs_unmount (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -1076,7 +1204,7 @@ grub_xfs_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_xfs_unmount (data);
 
   return grub_errno;
 }
@@ -1107,7 +1235,7 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_xfs_unmount (data);
 
   return grub_errno;
 }
@@ -53,6 +53,7 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
 #include <grub/crypto.h>
 #include <grub/i18n.h>
 
@@ -159,7 +160,19 @@ ZAP_LEAF_ENTRY(zap_leaf_phys_t *l, int bs, int idx)
 
 extern grub_err_t lzjb_decompress (void *, void *, grub_size_t, grub_size_t);
 
-extern grub_err_t lz4_decompress (void *, void *, grub_size_t, grub_size_t);
+static grub_err_t
+lz4_decompress (void *s_start, void *d_start, grub_size_t s_len,
+		grub_size_t d_len)
+{
+  const grub_uint8_t *src = s_start;
+  grub_uint32_t bufsiz = grub_be_to_cpu32 (grub_get_unaligned32 (src));
+
+  /* The compressed size is stored in front of the LZ4 block.  */
+  if (bufsiz + 4 > s_len
+      || grub_lz4_decompress (src + 4, bufsiz, d_start, d_len) < 0)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed.");
+  return GRUB_ERR_NONE;
+}
 
 typedef grub_err_t zfs_decomp_func_t (void *s_start, void *d_start,
 				      grub_size_t s_len, grub_size_t d_len);
@@ -1995,6 +2008,141 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Decompressed indirect and dnode blocks, shared between mounts so that
+ * repeated lookups do not read, verify and decompress them again.  A
+ * block is never rewritten in place, so the pool, its first DVA and the
+ * txg it was born in identify its contents.
+ */
+#define ZFS_BLOCK_CACHE_ENTRIES	32
+#define ZFS_BLOCK_CACHE_MAX	(2 << 20)
+
+struct zfs_block_cache_entry
+{
+  grub_uint64_t guid;
+  dva_t dva;
+  grub_uint64_t birth;
+  void *buf;
+  grub_size_t size;
+  grub_uint64_t last_use;
+};
+
+static struct zfs_block_cache_entry zfs_block_cache[ZFS_BLOCK_CACHE_ENTRIES];
+static grub_size_t zfs_block_cache_bytes;
+static grub_uint64_t zfs_block_cache_clock;
+
+static void
+zfs_block_cache_evict (struct zfs_block_cache_entry *e)
+{
+  zfs_block_cache_bytes -= e->size;
+  grub_free (e->buf);
+  e->buf = NULL;
+}
+
+static void
+zfs_block_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (zfs_block_cache); i++)
+    if (zfs_block_cache[i].buf)
+      zfs_block_cache_evict (&zfs_block_cache[i]);
+}
+
+static struct zfs_block_cache_entry *
+zfs_block_cache_find (grub_uint64_t guid, const blkptr_t *bp)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (zfs_block_cache); i++)
+    {
+      struct zfs_block_cache_entry *e = &zfs_block_cache[i];
+
+      if (e->buf && e->guid == guid && e->birth == bp->blk_birth
+	  && e->dva.dva_word[0] == bp->blk_dva[0].dva_word[0]
+	  && e->dva.dva_word[1] == bp->blk_dva[0].dva_word[1])
+	{
+	  e->last_use = ++zfs_block_cache_clock;
+	  return e;
+	}
+    }
+
+  return NULL;
+}
+
+/* Hand BUF over to the cache, evicting the least recently used blocks
+   to make room.  Returns 0 if BUF stays with the caller.  */
+static int
+zfs_block_cache_insert (grub_uint64_t guid, const blkptr_t *bp,
+			void *buf, grub_size_t size)
+{
+  struct zfs_block_cache_entry *e;
+
+  if (size > ZFS_BLOCK_CACHE_MAX / 4)
+    return 0;
+
+  while (1)
+    {
+      struct zfs_block_cache_entry *victim = NULL;
+      unsigned i;
+
+      e = NULL;
+      for (i = 0; i < ARRAY_SIZE (zfs_block_cache); i++)
+	if (!zfs_block_cache[i].buf)
+	  e = &zfs_block_cache[i];
+	else if (!victim
+		 || zfs_block_cache[i].last_use < victim->last_use)
+	  victim = &zfs_block_cache[i];
+
+      if (e && zfs_block_cache_bytes + size <= ZFS_BLOCK_CACHE_MAX)
+	break;
+      zfs_block_cache_evict (victim);
+    }
+
+  e->guid = guid;
+  e->dva = bp->blk_dva[0];
+  e->birth = bp->blk_birth;
+  e->buf = buf;
+  e->size = size;
+  e->last_use = ++zfs_block_cache_clock;
+  zfs_block_cache_bytes += size;
+  return 1;
+}
+
+/*
+ * Like zio_read, but through the block cache.  *OWNED tells whether
+ * the caller has to free *BUF; a cached buffer stays valid only until
+ * the next read through the cache.
+ */
+static grub_err_t
+zio_read_cached (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
+		 grub_size_t *size, int *owned, struct grub_zfs_data *data)
+{
+  struct zfs_block_cache_entry *e;
+  grub_err_t err;
+
+  *owned = 1;
+  if (BP_IS_EMBEDDED (bp))
+    return zio_read (bp, endian, buf, size, data);
+
+  e = zfs_block_cache_find (data->guid, bp);
+  if (e)
+    {
+      *buf = e->buf;
+      *size = e->size;
+      *owned = 0;
+      return GRUB_ERR_NONE;
+    }
+
+  err = zio_read (bp, endian, buf, size, data);
+  if (err)
+    return err;
+
+  if (zfs_block_cache_insert (data->guid, bp, *buf, *size))
+    *owned = 0;
+  return GRUB_ERR_NONE;
+}
+
 /*
  * Get the block from a block id.
  * push the block onto the stack.
@@ -2007,9 +2155,12 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
   int level;
   grub_off_t idx;
   blkptr_t *bp_array = dn->dn.dn_blkptr;
+  int bp_array_owned = 0;
   int epbs = dn->dn.dn_indblkshift - SPA_BLKPTRSHIFT;
   blkptr_t *bp;
   void *tmpbuf = 0;
+  grub_size_t lsize;
+  int owned;
   grub_zfs_endian_t endian;
   grub_err_t err = GRUB_ERR_NONE;
 
@@ -2023,11 +2174,10 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
       grub_dprintf ("zfs", "endian = %d\n", endian);
       idx = (blkid >> (epbs * level)) & ((1 << epbs) - 1);
       *bp = bp_array[idx];
-      if (bp_array != dn->dn.dn_blkptr)
-	{
-	  grub_free (bp_array);
-	  bp_array = 0;
-	}
+      if (bp_array_owned)
+	grub_free (bp_array);
+      bp_array = 0;
+      bp_array_owned = 0;
 
       if (BP_IS_HOLE (bp))
 	{
@@ -2044,7 +2194,7 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
 	  endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
 	  break;
 	}
-      if (level == 0)
+      if (level == 0 && dn->dn.dn_type != DMU_OT_DNODE)
 	{
 	  grub_dprintf ("zfs", "endian = %d\n", endian);
 	  err = zio_read (bp, endian, buf, 0, data);
@@ -2052,13 +2202,31 @@ dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf,
 	  break;
 	}
       grub_dprintf ("zfs", "endian = %d\n", endian);
-      err = zio_read (bp, endian, &tmpbuf, 0, data);
+      err = zio_read_cached (bp, endian, &tmpbuf, &lsize, &owned, data);
       endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
       if (err)
 	break;
+      if (level == 0)
+	{
+	  /* Dnode blocks go to the caller, who frees them.  */
+	  if (owned)
+	    *buf = tmpbuf;
+	  else
+	    {
+	      *buf = grub_malloc (lsize);
+	      if (!*buf)
+		{
+		  err = grub_errno;
+		  break;
+		}
+	      grub_memcpy (*buf, tmpbuf, lsize);
+	    }
+	  break;
+	}
       bp_array = tmpbuf;
+      bp_array_owned = owned;
     }
-  if (bp_array != dn->dn.dn_blkptr)
+  if (bp_array_owned)
     grub_free (bp_array);
   if (endian_out)
     *endian_out = endian;
@@ -4367,6 +4535,10 @@ GRUB_MOD_INIT (zfs)
 {
   COMPILE_TIME_ASSERT (sizeof (zap_leaf_chunk_t) == ZAP_LEAF_CHUNKSIZE);
   grub_fs_register (&grub_zfs_fs);
+#ifdef ZFS_FLETCHER_4_SIMD
+  if (fletcher_4_simd_usable ())
+    zio_checksum_table[ZIO_CHECKSUM_FLETCHER_4].ci_func = fletcher_4_simd;
+#endif
 #ifndef GRUB_UTIL
   my_mod = mod;
 #endif
@@ -4375,4 +4547,5 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zfs_block_cache_flush ();
 }
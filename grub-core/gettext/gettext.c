@@ -38,7 +38,6 @@ static const char *(*grub_gettext_original) (const char *s);
 
 struct grub_gettext_msg
 {
-  char *name;
   char *translated;
 };
 
@@ -49,6 +48,8 @@ struct header
   grub_uint32_t number_of_strings;
   grub_uint32_t offset_original;
   grub_uint32_t offset_translation;
+  grub_uint32_t hash_size;
+  grub_uint32_t offset_hash;
 };
 
 struct string_descriptor 
@@ -57,11 +58,17 @@ struct string_descriptor
   grub_uint32_t offset;
 };
 
+/* The whole .mo file is kept in memory, so that translating a string
+   doesn't read the file.  Translations handed out are copied to
+   grub_gettext_msg_list, as they may be in use after the file is
+   dropped.  */
 struct grub_gettext_context
 {
-  grub_file_t fd_mo;
+  char *mo_data;
   grub_off_t grub_gettext_offset_original;
   grub_off_t grub_gettext_offset_translation;
+  grub_off_t grub_gettext_offset_hash;
+  grub_uint32_t grub_gettext_hash_size;
   grub_size_t grub_gettext_max;
   int grub_gettext_max_log;
   struct grub_gettext_msg *grub_gettext_msg_list;
@@ -88,40 +95,17 @@ grub_gettext_pread (grub_file_t file, void *buf, grub_size_t len,
   return GRUB_ERR_NONE;
 }
 
-static char *
+/* String POSITION of the table at OFF.  grub_mofile_open has checked
+   that it lies in the file and is terminated.  */
+static const char *
 grub_gettext_getstr_from_position (struct grub_gettext_context *ctx,
 				   grub_off_t off,
 				   grub_size_t position)
 {
-  grub_off_t internal_position;
-  grub_size_t length;
-  grub_off_t offset;
-  char *translation;
-  struct string_descriptor desc;
-  grub_err_t err;
-
-  internal_position = (off + position * sizeof (desc));
-
-  err = grub_gettext_pread (ctx->fd_mo, (char *) &desc,
-			    sizeof (desc), internal_position);
-  if (err)
-    return NULL;
-  length = grub_cpu_to_le32 (desc.length);
-  offset = grub_cpu_to_le32 (desc.offset);
+  const char *desc = ctx->mo_data + off + position
+    * sizeof (struct string_descriptor);
 
-  translation = grub_malloc (length + 1);
-  if (!translation)
-    return NULL;
-
-  err = grub_gettext_pread (ctx->fd_mo, translation, length, offset);
-  if (err)
-    {
-      grub_free (translation);
-      return NULL;
-    }
-  translation[length] = '\0';
-
-  return translation;
+  return ctx->mo_data + grub_le_to_cpu32 (grub_get_unaligned32 (desc + 4));
 }
 
 static const char *
@@ -130,9 +114,9 @@ grub_gettext_gettranslation_from_position (struct grub_gettext_context *ctx,
 {
   if (!ctx->grub_gettext_msg_list[position].translated)
     ctx->grub_gettext_msg_list[position].translated
-      = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_translation,
-					   position);
+      = grub_strdup (grub_gettext_getstr_from_position (ctx,
+							ctx->grub_gettext_offset_translation,
+							position));
   return ctx->grub_gettext_msg_list[position].translated;
 }
 
@@ -140,35 +124,73 @@ static const char *
 grub_gettext_getstring_from_position (struct grub_gettext_context *ctx,
 				      grub_size_t position)
 {
-  if (!ctx->grub_gettext_msg_list[position].name)
-    ctx->grub_gettext_msg_list[position].name
-      = grub_gettext_getstr_from_position (ctx,
-					   ctx->grub_gettext_offset_original,
-					   position);
-  return ctx->grub_gettext_msg_list[position].name;
+  return grub_gettext_getstr_from_position (ctx,
+					    ctx->grub_gettext_offset_original,
+					    position);
 }
 
-static const char *
-grub_gettext_translate_real (struct grub_gettext_context *ctx,
-			     const char *orig)
+/* The hash function of GNU gettext, which the .mo hash table is built
+   with.  */
+static grub_uint32_t
+grub_gettext_hash (const char *str)
 {
-  grub_size_t current = 0;
-  int i;
-  const char *current_string;
-  static int depth = 0;
+  grub_uint32_t hval = 0, g;
 
-  if (!ctx->grub_gettext_msg_list || !ctx->fd_mo)
-    return NULL;
+  for (; *str; str++)
+    {
+      hval <<= 4;
+      hval += (grub_uint8_t) *str;
+      g = hval & ((grub_uint32_t) 0xf << 28);
+      if (g)
+	{
+	  hval ^= g >> 24;
+	  hval ^= g;
+	}
+    }
+  return hval;
+}
 
-  /* Shouldn't happen. Just a precaution if our own code
-     calls gettext somehow.  */
-  if (depth > 2)
-    return NULL;
-  depth++;
+/* Look ORIG up in the hash table of the file.  Returns the position of
+   the string or -1.  */
+static grub_ssize_t
+grub_gettext_lookup_hash (struct grub_gettext_context *ctx, const char *orig)
+{
+  grub_uint32_t size = ctx->grub_gettext_hash_size;
+  grub_uint32_t hval = grub_gettext_hash (orig);
+  grub_uint32_t idx = hval % size;
+  grub_uint32_t incr = 1 + hval % (size - 2);
+  grub_uint32_t probes;
 
-  /* Make sure we can use grub_gettext_translate for error messages.  Push
-     active error message to error stack and reset error message.  */
-  grub_error_push ();
+  for (probes = 0; probes < size; probes++)
+    {
+      grub_uint32_t entry;
+
+      entry = grub_le_to_cpu32 (grub_get_unaligned32
+				(ctx->mo_data + ctx->grub_gettext_offset_hash
+				 + idx * sizeof (grub_uint32_t)));
+      if (entry == 0)
+	return -1;
+      if (entry <= ctx->grub_gettext_max
+	  && grub_strcmp (grub_gettext_getstring_from_position (ctx,
+								 entry - 1),
+			  orig) == 0)
+	return entry - 1;
+
+      if (idx >= size - incr)
+	idx -= size - incr;
+      else
+	idx += incr;
+    }
+  return -1;
+}
+
+/* Look ORIG up by bisection of the sorted original strings.  */
+static grub_ssize_t
+grub_gettext_lookup_sorted (struct grub_gettext_context *ctx,
+			    const char *orig)
+{
+  grub_size_t current = 0;
+  int i;
 
   for (i = ctx->grub_gettext_max_log; i >= 0; i--)
     {
@@ -179,69 +201,56 @@ grub_gettext_translate_real (struct grub_gettext_context *ctx,
       if (test >= ctx->grub_gettext_max)
 	continue;
 
-      current_string = grub_gettext_getstring_from_position (ctx, test);
-
-      if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
-
-      /* Search by bisection.  */
-      cmp = grub_strcmp (current_string, orig);
+      cmp = grub_strcmp (grub_gettext_getstring_from_position (ctx, test),
+			 orig);
       if (cmp <= 0)
 	current = test;
       if (cmp == 0)
-	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;      
-	}
+	return current;
     }
 
-  if (current == 0 && ctx->grub_gettext_max != 0)
-    {
-      current_string = grub_gettext_getstring_from_position (ctx, 0);
+  if (current == 0 && ctx->grub_gettext_max != 0
+      && grub_strcmp (grub_gettext_getstring_from_position (ctx, 0),
+		      orig) == 0)
+    return 0;
 
-      if (!current_string)
-	{
-	  grub_errno = GRUB_ERR_NONE;
-	  grub_error_pop ();
-	  depth--;
-	  return NULL;
-	}
+  return -1;
+}
 
-      if (grub_strcmp (current_string, orig) == 0)
-	{
-	  const char *ret = 0;
-	  ret = grub_gettext_gettranslation_from_position (ctx, current);
-	  if (!ret)
-	    {
-	      grub_errno = GRUB_ERR_NONE;
-	      grub_error_pop ();
-	      depth--;
-	      return NULL;
-	    }
-	  grub_error_pop ();
-	  depth--;
-	  return ret;      
-	}
-    }
+static const char *
+grub_gettext_translate_real (struct grub_gettext_context *ctx,
+			     const char *orig)
+{
+  grub_ssize_t position;
+  const char *ret;
+  static int depth = 0;
+
+  if (!ctx->grub_gettext_msg_list || !ctx->mo_data)
+    return NULL;
 
+  /* Shouldn't happen. Just a precaution if our own code
+     calls gettext somehow.  */
+  if (depth > 2)
+    return NULL;
+  depth++;
+
+  /* Make sure we can use grub_gettext_translate for error messages.  Push
+     active error message to error stack and reset error message.  */
+  grub_error_push ();
+
+  if (ctx->grub_gettext_hash_size > 2)
+    position = grub_gettext_lookup_hash (ctx, orig);
+  else
+    position = grub_gettext_lookup_sorted (ctx, orig);
+
+  ret = NULL;
+  if (position >= 0)
+    ret = grub_gettext_gettranslation_from_position (ctx, position);
+
+  grub_errno = GRUB_ERR_NONE;
   grub_error_pop ();
   depth--;
-  return NULL;
+  return ret;
 }
 
 static const char *
@@ -264,21 +273,40 @@ static void
 grub_gettext_delete_list (struct grub_gettext_context *ctx)
 {
   struct grub_gettext_msg *l = ctx->grub_gettext_msg_list;
-  grub_size_t i;
 
   if (!l)
     return;
   ctx->grub_gettext_msg_list = 0;
-  for (i = 0; i < ctx->grub_gettext_max; i++)
-    grub_free (l[i].name);
   /* Don't delete the translated message because could be in use.  */
   grub_free (l);
-  if (ctx->fd_mo)
-    grub_file_close (ctx->fd_mo);
-  ctx->fd_mo = 0;
+  grub_free (ctx->mo_data);
   grub_memset (ctx, 0, sizeof (*ctx));
 }
 
+/* Check that the N descriptors of the table at OFF point to terminated
+   strings within the file.  */
+static int
+grub_gettext_check_table (const char *data, grub_size_t size,
+			  grub_size_t off, grub_size_t n)
+{
+  grub_size_t i;
+
+  if (off > size || n > (size - off) / sizeof (struct string_descriptor))
+    return 0;
+
+  for (i = 0; i < n; i++)
+    {
+      const char *desc = data + off + i * sizeof (struct string_descriptor);
+      grub_uint32_t length = grub_le_to_cpu32 (grub_get_unaligned32 (desc));
+      grub_uint32_t offset = grub_le_to_cpu32 (grub_get_unaligned32 (desc + 4));
+
+      if (offset >= size || length >= size - offset
+	  || data[offset + length] != '\0')
+	return 0;
+    }
+  return 1;
+}
+
 /* This is similar to grub_file_open. */
 static grub_err_t
 grub_mofile_open (struct grub_gettext_context *ctx,
@@ -287,39 +315,75 @@ grub_mofile_open (struct grub_gettext_context *ctx,
   struct header head;
   grub_err_t err;
   grub_file_t fd;
-
-  /* Using fd_mo and not another variable because
-     it's needed for grub_gettext_get_info.  */
+  char *data;
+  grub_size_t size, n, hash_size, hash_off;
 
   fd = grub_file_open (filename);
 
   if (!fd)
     return grub_errno;
 
-  err = grub_gettext_pread (fd, &head, sizeof (head), 0);
-  if (err)
+  if (fd->size == GRUB_FILE_SIZE_UNKNOWN || fd->size < sizeof (head)
+      || fd->size > GRUB_UINT_MAX)
+    {
+      grub_file_close (fd);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "mo: invalid mo size in file: %s", filename);
+    }
+  size = fd->size;
+
+  data = grub_malloc (size);
+  if (!data)
     {
       grub_file_close (fd);
+      return grub_errno;
+    }
+
+  err = grub_gettext_pread (fd, data, size, 0);
+  grub_file_close (fd);
+  if (err)
+    {
+      grub_free (data);
       return err;
     }
+  grub_memcpy (&head, data, sizeof (head));
 
   if (head.magic != grub_cpu_to_le32_compile_time (MO_MAGIC_NUMBER))
     {
-      grub_file_close (fd);
+      grub_free (data);
       return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			 "mo: invalid mo magic in file: %s", filename);
     }
 
   if (head.version != 0)
     {
-      grub_file_close (fd);
+      grub_free (data);
       return grub_error (GRUB_ERR_BAD_FILE_TYPE,
 			 "mo: invalid mo version in file: %s", filename);
     }
 
+  n = grub_le_to_cpu32 (head.number_of_strings);
+  hash_size = grub_le_to_cpu32 (head.hash_size);
+  hash_off = grub_le_to_cpu32 (head.offset_hash);
+  if (!grub_gettext_check_table (data, size,
+				 grub_le_to_cpu32 (head.offset_original), n)
+      || !grub_gettext_check_table (data, size,
+				    grub_le_to_cpu32 (head.offset_translation),
+				    n)
+      || (hash_size > 2 && (hash_off > size
+			    || hash_size > (size - hash_off)
+			    / sizeof (grub_uint32_t))))
+    {
+      grub_free (data);
+      return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+			 "mo: invalid string table in file: %s", filename);
+    }
+
   ctx->grub_gettext_offset_original = grub_le_to_cpu32 (head.offset_original);
   ctx->grub_gettext_offset_translation = grub_le_to_cpu32 (head.offset_translation);
-  ctx->grub_gettext_max = grub_le_to_cpu32 (head.number_of_strings);
+  ctx->grub_gettext_offset_hash = hash_off;
+  ctx->grub_gettext_hash_size = hash_size;
+  ctx->grub_gettext_max = n;
   for (ctx->grub_gettext_max_log = 0; ctx->grub_gettext_max >> ctx->grub_gettext_max_log;
        ctx->grub_gettext_max_log++);
 
@@ -327,10 +391,10 @@ grub_mofile_open (struct grub_gettext_context *ctx,
 					    * sizeof (ctx->grub_gettext_msg_list[0]));
   if (!ctx->grub_gettext_msg_list)
     {
-      grub_file_close (fd);
+      grub_free (data);
       return grub_errno;
     }
-  ctx->fd_mo = fd;
+  ctx->mo_data = data;
   if (grub_gettext != grub_gettext_translate)
     {
       grub_gettext_original = grub_gettext;
@@ -340,7 +404,7 @@ grub_mofile_open (struct grub_gettext_context *ctx,
 }
 
 /* Returning grub_file_t would be more natural, but grub_mofile_open assigns
-   to fd_mo anyway ...  */
+   to mo_data anyway ...  */
 static grub_err_t
 grub_mofile_open_lang (struct grub_gettext_context *ctx,
 		       const char *part1, const char *part2, const char *locale)
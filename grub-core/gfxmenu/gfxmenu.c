@@ -83,13 +83,16 @@ grub_gfxmenu_try (int entry, grub_menu_t menu, int nested)
   if (!cached_view || grub_strcmp (cached_view->theme_path,
 				   full_theme_path ? : theme_path) != 0
       || cached_view->screen.width != mode_info.width
-      || cached_view->screen.height != mode_info.height)
+      || cached_view->screen.height != mode_info.height
+      || cached_view->blit_format != grub_video_get_blit_format (&mode_info))
     {
       grub_gfxmenu_view_destroy (cached_view);
       /* Create the view.  */
       cached_view = grub_gfxmenu_view_new (full_theme_path ? : theme_path,
 					   mode_info.width,
 					   mode_info.height);
+      if (cached_view)
+	cached_view->blit_format = grub_video_get_blit_format (&mode_info);
     }
   grub_free (full_theme_path);
 
@@ -88,7 +88,7 @@ load_bitmap (const char *dir, const char *file)
 
   /* Load the image.  */
   grub_errno = GRUB_ERR_NONE;
-  grub_video_bitmap_load (&bitmap, abspath);
+  grub_gui_load_bitmap (&bitmap, abspath);
   grub_errno = GRUB_ERR_NONE;
 
   grub_free (abspath);
@@ -216,15 +216,20 @@ circprog_get_bounds (void *vself, grub_video_rect_t *bounds)
   *bounds = self->bounds;
 }
 
-static void
+static int
 circprog_set_state (void *vself, int visible, int start,
 		    int current, int end)
 {
   circular_progress_t self = vself;  
+  int changed = (visible != self->visible
+		 || (visible && (start != self->start || current != self->value
+				 || end != self->end)));
+
   self->visible = visible;
   self->start = start;
   self->value = current;
   self->end = end;
+  return changed;
 }
 
 static int
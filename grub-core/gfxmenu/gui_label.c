@@ -156,15 +156,19 @@ label_get_minimal_size (void *vself, unsigned *width, unsigned *height)
 
 #pragma GCC diagnostic ignored "-Wformat-nonliteral"
 
-static void
+static int
 label_set_state (void *vself, int visible, int start __attribute__ ((unused)),
 		 int current, int end __attribute__ ((unused)))
 {
   grub_gui_label_t self = vself;  
+  int changed = (visible != self->visible
+		 || (visible && -current != self->value));
+
   self->value = -current;
   self->visible = visible;
   grub_free (self->text);
   self->text = grub_xasprintf (self->template ? : "%d", self->value);
+  return changed;
 }
 
 static grub_err_t
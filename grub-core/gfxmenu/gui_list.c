@@ -224,13 +224,8 @@ list_is_instance (void *vself __attribute__((unused)), const char *type)
 }
 
 static struct grub_video_bitmap *
-get_item_icon (list_impl_t self, int item_index)
+get_item_icon (list_impl_t self, grub_menu_entry_t entry)
 {
-  grub_menu_entry_t entry;
-  entry = grub_menu_get_entry (self->view->menu, item_index);
-  if (! entry)
-    return 0;
-
   return grub_gfxmenu_icon_manager_get_icon (self->icon_manager, entry);
 }
 
@@ -314,9 +309,10 @@ draw_scrollbar (list_impl_t self,
   thumb->draw (thumb, thumbx, thumby);
 }
 
-/* Draw the list of items.  */
+/* Draw the items of the list which meet REGION.  */
 static void
-draw_menu (list_impl_t self, int num_shown_items)
+draw_menu (list_impl_t self, int num_shown_items,
+           const grub_video_rect_t *region)
 {
   if (! self->menu_box || ! self->selected_item_box || ! self->item_box)
     return;
@@ -339,17 +335,22 @@ draw_menu (list_impl_t self, int num_shown_items)
   int item_rightpad = itembox->get_right_pad (itembox);
   int item_border_width = item_leftpad + item_rightpad;
   int item_toppad = itembox->get_top_pad (itembox);
+  int item_bottompad = itembox->get_bottom_pad (itembox);
   int sel_leftpad = selbox->get_left_pad (selbox);
   int sel_rightpad = selbox->get_right_pad (selbox);
   int sel_border_width = sel_leftpad + sel_rightpad;
   int sel_toppad = selbox->get_top_pad (selbox);
+  int sel_bottompad = selbox->get_bottom_pad (selbox);
 
   int max_leftpad = grub_max (item_leftpad, sel_leftpad);
   int max_toppad = grub_max (item_toppad, sel_toppad);
+  int max_bottompad = grub_max (item_bottompad, sel_bottompad);
   int item_top = 0;
   int menu_index;
   int visible_index;
+  grub_menu_entry_t entry;
   struct grub_video_rect oviewport;
+  grub_video_rect_t row;
 
   grub_video_get_viewport (&oviewport.x, &oviewport.y,
 			   &oviewport.width, &oviewport.height);
@@ -360,6 +361,11 @@ draw_menu (list_impl_t self, int num_shown_items)
 
   int cwidth = oviewport.width - 2 * boxpad;
 
+  /* Where each row is on the screen, to skip those outside REGION.  */
+  row.x = oviewport.x + boxpad;
+  row.width = cwidth;
+  row.height = max_toppad + text_box_height + max_bottompad;
+
   itembox->set_content_size (itembox, cwidth - item_border_width,
                              text_box_height);
   selbox->set_content_size (selbox, cwidth - sel_border_width,
@@ -389,9 +395,12 @@ draw_menu (list_impl_t self, int num_shown_items)
   int item_icon_top_offset = item_toppad + tmp_icon_top_offset;
   int sel_icon_top_offset = sel_toppad + tmp_icon_top_offset;
 
+  /* The entries are a list: find the first shown once, then follow it.  */
+  entry = grub_menu_get_entry (self->view->menu, self->first_shown_index);
   for (visible_index = 0, menu_index = self->first_shown_index;
-       visible_index < num_shown_items && menu_index < self->view->menu->size;
-       visible_index++, menu_index++)
+       visible_index < num_shown_items && entry;
+       visible_index++, menu_index++, entry = entry->next,
+         item_top += text_box_height + item_vspace)
     {
       int is_selected = (menu_index == self->view->selected);
       struct grub_video_bitmap *icon;
@@ -402,6 +411,10 @@ draw_menu (list_impl_t self, int num_shown_items)
       int icon_top_offset;
       int viewport_width;
 
+      row.y = oviewport.y + boxpad + item_top;
+      if (!grub_video_have_common_points (region, &row))
+        continue;
+
       if (is_selected)
         {
           selbox->draw (selbox, 0, item_top + sel_box_top_offset);
@@ -423,15 +436,14 @@ draw_menu (list_impl_t self, int num_shown_items)
           viewport_width = item_viewport_width;
         }
 
-      icon = get_item_icon (self, menu_index);
+      icon = get_item_icon (self, entry);
       if (icon != 0)
         grub_video_blit_bitmap (icon, GRUB_VIDEO_BLIT_BLEND,
                                 max_leftpad,
                                 item_top + icon_top_offset,
                                 0, 0, self->icon_width, self->icon_height);
 
-      const char *item_title =
-        grub_menu_get_entry (self->view->menu, menu_index)->title;
+      const char *item_title = entry->title;
 
       sviewport.y = item_top + top_pad;
       sviewport.width = viewport_width;
@@ -442,8 +454,6 @@ draw_menu (list_impl_t self, int num_shown_items)
                              0,
                              text_top_offset);
       grub_gui_restore_viewport (&svpsave);
-
-      item_top += text_box_height + item_vspace;
     }
   grub_video_set_viewport (oviewport.x,
 			   oviewport.y,
@@ -507,7 +517,7 @@ list_paint (void *vself, const grub_video_rect_t *region)
       }
 
     grub_gui_set_viewport (&content_rect, &vpsave2);
-    draw_menu (self, num_shown_items);
+    draw_menu (self, num_shown_items, region);
     grub_gui_restore_viewport (&vpsave2);
 
     if (drawing_scrollbar)
@@ -860,6 +870,44 @@ list_refresh_info (void *vself,
   list_impl_t self = vself;
   if (view->nested)
     self->first_shown_index = 0;
+  /* A new menu: the entries of the one before may be gone.  */
+  grub_gfxmenu_icon_manager_forget_entries (self->icon_manager);
+}
+
+/* Get the screen area of item INDEX, if the list shows it without having
+   to scroll.  Otherwise return 0, as redrawing the item alone won't do.  */
+static int
+list_get_item_bounds (void *vself, int index, grub_video_rect_t *bounds)
+{
+  list_impl_t self = vself;
+  int num_shown_items;
+
+  if (! self->visible || ! check_boxes (self))
+    return 0;
+
+  num_shown_items = get_num_shown_items (self);
+  if (index < self->first_shown_index
+      || index >= self->first_shown_index + num_shown_items
+      || index >= self->view->menu->size)
+    return 0;
+
+  grub_gfxmenu_box_t box = self->menu_box;
+  grub_gfxmenu_box_t itembox = self->item_box;
+  grub_gfxmenu_box_t selbox = self->selected_item_box;
+  int max_toppad = grub_max (itembox->get_top_pad (itembox),
+                             selbox->get_top_pad (selbox));
+  int max_bottompad = grub_max (itembox->get_bottom_pad (itembox),
+                                selbox->get_bottom_pad (selbox));
+
+  /* The whole width, so that the box and scrollbar edges are redrawn
+     with the row.  */
+  bounds->x = self->bounds.x;
+  bounds->width = self->bounds.width;
+  bounds->y = (self->bounds.y + box->get_top_pad (box) + self->item_padding
+               + (index - self->first_shown_index)
+               * (self->item_height + self->item_spacing));
+  bounds->height = max_toppad + self->item_height + max_bottompad;
+  return 1;
 }
 
 static struct grub_gui_component_ops list_comp_ops =
@@ -879,7 +927,8 @@ static struct grub_gui_component_ops list_comp_ops =
 static struct grub_gui_list_ops list_ops =
 {
   .set_view_info = list_set_view_info,
-  .refresh_list = list_refresh_info
+  .refresh_list = list_refresh_info,
+  .get_item_bounds = list_get_item_bounds
 };
 
 grub_gui_component_t
@@ -20,6 +20,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/gui.h>
+#include <grub/bitmap.h>
 #include <grub/gui_string_util.h>
 
 
@@ -99,3 +100,32 @@ grub_gui_iterate_recursively (grub_gui_component_t root,
   state.userdata = userdata;
   iterate_recursively_cb (root, &state);
 }
+
+/* Theme images stay loaded for as long as the view does and are drawn on
+   every redraw, so convert them once to the display's format instead of
+   in every blit; scaled copies inherit it.  Failing to convert only
+   costs speed.  */
+grub_err_t
+grub_gui_load_bitmap (struct grub_video_bitmap **bitmap, const char *path)
+{
+  return grub_gui_load_bitmap_scaled (bitmap, path, 0, 0);
+}
+
+/* Likewise for an image that is only ever shown scaled down to
+   MIN_WIDTH x MIN_HEIGHT or less.  */
+grub_err_t
+grub_gui_load_bitmap_scaled (struct grub_video_bitmap **bitmap,
+			     const char *path,
+			     unsigned min_width, unsigned min_height)
+{
+  struct grub_video_mode_info mode_info;
+
+  if (grub_video_bitmap_load_scaled (bitmap, path, min_width, min_height)
+      != GRUB_ERR_NONE)
+    return grub_errno;
+
+  if (grub_video_get_info (&mode_info) == GRUB_ERR_NONE)
+    grub_video_bitmap_convert (bitmap, grub_video_get_blit_format (&mode_info));
+  grub_errno = GRUB_ERR_NONE;
+  return GRUB_ERR_NONE;
+}
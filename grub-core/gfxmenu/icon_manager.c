@@ -24,6 +24,7 @@
 #include <grub/gui_string_util.h>
 #include <grub/bitmap.h>
 #include <grub/bitmap_scale.h>
+#include <grub/gui.h>
 #include <grub/menu.h>
 #include <grub/icon_manager.h>
 #include <grub/env.h>
@@ -38,6 +39,17 @@ typedef struct icon_entry
   struct icon_entry *next;
 } *icon_entry_t;
 
+/* The icon found for a menu entry, so that its classes are searched only
+   the first time it is drawn.  */
+typedef struct entry_icon
+{
+  grub_menu_entry_t entry;
+  struct grub_video_bitmap *bitmap;
+  struct entry_icon *next;
+} *entry_icon_t;
+
+#define ENTRY_ICON_HASH_SIZE 64
+
 struct grub_gfxmenu_icon_manager
 {
   char *theme_path;
@@ -46,6 +58,8 @@ struct grub_gfxmenu_icon_manager
 
   /* Icon cache: linked list w/ dummy head node.  */
   struct icon_entry cache;
+
+  entry_icon_t entries[ENTRY_ICON_HASH_SIZE];
 };
 
 
@@ -54,7 +68,7 @@ grub_gfxmenu_icon_manager_t
 grub_gfxmenu_icon_manager_new (void)
 {
   grub_gfxmenu_icon_manager_t mgr;
-  mgr = grub_malloc (sizeof (*mgr));
+  mgr = grub_zalloc (sizeof (*mgr));
   if (! mgr)
     return 0;
 
@@ -83,12 +97,34 @@ grub_gfxmenu_icon_manager_destroy (grub_gfxmenu_icon_manager_t mgr)
   grub_free (mgr);
 }
 
+/* Forget the icons found for menu entries, which must be done before the
+   entries are freed.  */
+void
+grub_gfxmenu_icon_manager_forget_entries (grub_gfxmenu_icon_manager_t mgr)
+{
+  entry_icon_t cur;
+  entry_icon_t next;
+  unsigned i;
+
+  for (i = 0; i < ENTRY_ICON_HASH_SIZE; i++)
+    {
+      for (cur = mgr->entries[i]; cur; cur = next)
+	{
+	  next = cur->next;
+	  grub_free (cur);
+	}
+      mgr->entries[i] = 0;
+    }
+}
+
 /* Clear the icon cache.  */
 void
 grub_gfxmenu_icon_manager_clear_cache (grub_gfxmenu_icon_manager_t mgr)
 {
   icon_entry_t cur;
   icon_entry_t next;
+
+  grub_gfxmenu_icon_manager_forget_entries (mgr);
   for (cur = mgr->cache.next; cur; cur = next)
     {
       next = cur->next;
@@ -154,7 +190,7 @@ try_loading_icon (grub_gfxmenu_icon_manager_t mgr,
   *ptr = '\0';
 
   struct grub_video_bitmap *raw_bitmap;
-  grub_video_bitmap_load (&raw_bitmap, path);
+  grub_gui_load_bitmap (&raw_bitmap, path);
   grub_free (path);
   grub_errno = GRUB_ERR_NONE;  /* Critical to clear the error!!  */
   if (! raw_bitmap)
@@ -175,7 +211,8 @@ try_loading_icon (grub_gfxmenu_icon_manager_t mgr,
 /* Get the icon for the specified class CLASS_NAME.  If an icon for
    CLASS_NAME already exists in the cache, then a reference to the cached
    bitmap is returned.  If it is not cached, then it is loaded and cached.
-   If no icon could be could for CLASS_NAME, then 0 is returned.  */
+   If no icon could be could for CLASS_NAME, then 0 is returned, and that
+   is cached as well.  */
 static struct grub_video_bitmap *
 get_icon_by_class (grub_gfxmenu_icon_manager_t mgr, const char *class_name)
 {
@@ -213,13 +250,8 @@ get_icon_by_class (grub_gfxmenu_icon_manager_t mgr, const char *class_name)
 	icon = try_loading_icon (mgr, icondir, class_name);
     }
 
-  /* No icon was found.  */
-  /* This should probably be noted in the cache, so that a search is not
-     performed each time an icon for CLASS_NAME is requested.  */
-  if (! icon)
-    return 0;
-
-  /* Insert a new cache entry for this icon.  */
+  /* Insert a new cache entry for this icon, or for there being none, so
+     that the search isn't repeated each time the class is drawn.  */
   entry = grub_malloc (sizeof (*entry));
   if (! entry)
     {
@@ -227,6 +259,12 @@ get_icon_by_class (grub_gfxmenu_icon_manager_t mgr, const char *class_name)
       return 0;
     }
   entry->class_name = grub_strdup (class_name);
+  if (! entry->class_name)
+    {
+      grub_video_bitmap_destroy (icon);
+      grub_free (entry);
+      return 0;
+    }
   entry->bitmap = icon;
   entry->next = mgr->cache.next;
   mgr->cache.next = entry;   /* Link it into the cache.  */
@@ -248,10 +286,28 @@ grub_gfxmenu_icon_manager_get_icon (grub_gfxmenu_icon_manager_t mgr,
 {
   struct grub_menu_entry_class *c;
   struct grub_video_bitmap *icon;
+  entry_icon_t known;
+  unsigned hash;
+
+  hash = ((grub_addr_t) entry / sizeof (*entry)) % ENTRY_ICON_HASH_SIZE;
+  for (known = mgr->entries[hash]; known; known = known->next)
+    if (known->entry == entry)
+      return known->bitmap;
 
   /* Try each class in succession.  */
   icon = 0;
   for (c = entry->classes; c && ! icon; c = c->next)
     icon = get_icon_by_class (mgr, c->name);
+
+  known = grub_malloc (sizeof (*known));
+  if (! known)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return icon;
+    }
+  known->entry = entry;
+  known->bitmap = icon;
+  known->next = mgr->entries[hash];
+  mgr->entries[hash] = known;
   return icon;
 }
@@ -169,7 +169,9 @@ theme_set_string (grub_gfxmenu_view_t view,
       path = grub_resolve_relative_path (theme_dir, value);
       if (! path)
         return grub_errno;
-      if (grub_video_bitmap_load (&raw_bitmap, path) != GRUB_ERR_NONE)
+      /* The desktop image is always scaled to the screen.  */
+      if (grub_gui_load_bitmap_scaled (&raw_bitmap, path, view->screen.width,
+                                       view->screen.height) != GRUB_ERR_NONE)
         {
           grub_free (path);
           return grub_errno;
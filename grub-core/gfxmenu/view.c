@@ -169,8 +169,10 @@ redraw_background (grub_gfxmenu_view_t view,
 }
 
 static void
-draw_title (grub_gfxmenu_view_t view)
+draw_title (grub_gfxmenu_view_t view, const grub_video_rect_t *region)
 {
+  grub_video_rect_t r;
+
   if (! view->title_text)
     return;
 
@@ -179,6 +181,15 @@ draw_title (grub_gfxmenu_view_t view)
                                                 view->title_text);
   int x = (view->screen.width - title_width) / 2;
   int y = 40 + grub_font_get_ascent (view->title_font);
+
+  r.x = x;
+  r.y = 40;
+  r.width = title_width;
+  r.height = (grub_font_get_ascent (view->title_font)
+	      + grub_font_get_descent (view->title_font));
+  if (!grub_video_have_common_points (region, &r))
+    return;
+
   grub_font_draw_string (view->title_text,
                          view->title_font,
                          grub_video_map_rgba_color (view->title_color),
@@ -201,21 +212,93 @@ update_timeouts (int visible, int start, int value, int end)
   struct grub_gfxmenu_timeout_notify *cur;
 
   for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
-    cur->set_state (cur->self, visible, start, value, end);
+    if (cur->set_state (cur->self, visible, start, value, end))
+      cur->dirty = 1;
 }
 
+/* Bounds of COMPONENT on the screen: those it keeps are relative to its
+   container.  */
 static void
-redraw_timeouts (struct grub_gfxmenu_view *view)
+get_screen_bounds (grub_gui_component_t component, grub_video_rect_t *bounds)
+{
+  grub_gui_container_t parent;
+
+  component->ops->get_bounds (component, bounds);
+  for (parent = component->ops->get_parent (component); parent;
+       parent = parent->component.ops->get_parent (parent))
+    {
+      grub_video_rect_t pbounds;
+
+      parent->component.ops->get_bounds (parent, &pbounds);
+      bounds->x += pbounds.x;
+      bounds->y += pbounds.y;
+    }
+}
+
+#define MAX_TIMEOUT_RECTS 8
+
+/* Repaint the screen areas of the timeout components whose state changed,
+   each area once even where components overlap.  Return the number of
+   areas repainted.  */
+static int
+redraw_timeouts (struct grub_gfxmenu_view *view,
+		 grub_video_rect_t *rects, int nrects)
 {
   struct grub_gfxmenu_timeout_notify *cur;
+  int i, j;
 
-  for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
+  if (nrects < 0)
+    {
+      nrects = 0;
+      for (cur = grub_gfxmenu_timeout_notifications; cur; cur = cur->next)
+	{
+	  grub_video_rect_t r;
+
+	  if (!cur->dirty)
+	    continue;
+	  cur->dirty = 0;
+	  get_screen_bounds (cur->self, &r);
+
+	  for (i = 0; i < nrects; i++)
+	    if (grub_video_have_common_points (&rects[i], &r))
+	      break;
+	  if (i == nrects && nrects == MAX_TIMEOUT_RECTS)
+	    i = 0;
+	  if (i == nrects)
+	    {
+	      rects[nrects++] = r;
+	      continue;
+	    }
+	  /* Grow the area to take R in.  */
+	  j = grub_max (rects[i].x + rects[i].width, r.x + r.width);
+	  rects[i].x = grub_min (rects[i].x, r.x);
+	  rects[i].width = j - rects[i].x;
+	  j = grub_max (rects[i].y + rects[i].height, r.y + r.height);
+	  rects[i].y = grub_min (rects[i].y, r.y);
+	  rects[i].height = j - rects[i].y;
+	}
+    }
+
+  for (i = 0; i < nrects; i++)
     {
-      grub_video_rect_t bounds;
-      cur->self->ops->get_bounds (cur->self, &bounds);
       grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
-      grub_gfxmenu_view_redraw (view, &bounds);
+      grub_gfxmenu_view_redraw (view, &rects[i]);
     }
+  return nrects;
+}
+
+static void
+repaint_timeouts (struct grub_gfxmenu_view *view)
+{
+  grub_video_rect_t rects[MAX_TIMEOUT_RECTS];
+  int nrects;
+
+  nrects = redraw_timeouts (view, rects, -1);
+  if (!nrects)
+    return;
+  grub_video_swap_buffers ();
+  if (view->double_repaint)
+    redraw_timeouts (view, rects, nrects);
 }
 
 void 
@@ -227,10 +310,7 @@ grub_gfxmenu_print_timeout (int timeout, void *data)
     view->first_timeout = timeout;
 
   update_timeouts (1, -view->first_timeout, -timeout, 0);
-  redraw_timeouts (view);
-  grub_video_swap_buffers ();
-  if (view->double_repaint)
-    redraw_timeouts (view);
+  repaint_timeouts (view);
 }
 
 void 
@@ -239,10 +319,7 @@ grub_gfxmenu_clear_timeout (void *data)
   struct grub_gfxmenu_view *view = data;
 
   update_timeouts (0, 1, 0, 0);
-  redraw_timeouts (view);
-  grub_video_swap_buffers ();
-  if (view->double_repaint)
-    redraw_timeouts (view);
+  repaint_timeouts (view);
 }
 
 static void
@@ -331,7 +408,7 @@ grub_gfxmenu_view_redraw (grub_gfxmenu_view_t view,
   redraw_background (view, region);
   if (view->canvas)
     view->canvas->component.ops->paint (view->canvas, region);
-  draw_title (view);
+  draw_title (view, region);
   if (grub_video_have_common_points (&view->progress_message_frame, region))
     draw_message (view);
 
@@ -401,13 +478,75 @@ grub_gfxmenu_redraw_menu (grub_gfxmenu_view_t view)
     }
 }
 
+struct redraw_items_ctx
+{
+  grub_gfxmenu_view_t view;
+  int items[2];
+  int nrects;
+  grub_video_rect_t rects[4];
+};
+
+static void
+redraw_items_visit (grub_gui_component_t component, void *userdata)
+{
+  struct redraw_items_ctx *ctx = userdata;
+  grub_gui_list_t list;
+  int i;
+
+  if (!component->ops->is_instance (component, "list"))
+    return;
+
+  list = (grub_gui_list_t) component;
+  for (i = 0; i < 2; i++)
+    if (ctx->nrects < 0 || ctx->nrects == ARRAY_SIZE (ctx->rects)
+	|| !list->ops->get_item_bounds
+	|| !list->ops->get_item_bounds (list, ctx->items[i],
+					&ctx->rects[ctx->nrects++]))
+      {
+	ctx->nrects = -1;
+	return;
+      }
+}
+
+/* Redraw just the items whose selection changed from OLD to NEW, which
+   with a long menu is much less than the whole list.  Return 0 if that
+   won't do, because a list has to scroll.  */
+static int
+redraw_items (grub_gfxmenu_view_t view, int old, int new)
+{
+  struct redraw_items_ctx ctx = { .view = view, .items = { old, new } };
+  int i;
+
+  update_menu_components (view);
+  grub_gui_iterate_recursively ((grub_gui_component_t) view->canvas,
+				redraw_items_visit, &ctx);
+  if (ctx.nrects <= 0)
+    return 0;
+
+  for (i = 0; i < ctx.nrects; i++)
+    {
+      grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
+      grub_gfxmenu_view_redraw (view, &ctx.rects[i]);
+    }
+  grub_video_swap_buffers ();
+  if (view->double_repaint)
+    for (i = 0; i < ctx.nrects; i++)
+      {
+	grub_video_set_area_status (GRUB_VIDEO_AREA_ENABLED);
+	grub_gfxmenu_view_redraw (view, &ctx.rects[i]);
+      }
+  return 1;
+}
+
 void 
 grub_gfxmenu_set_chosen_entry (int entry, void *data)
 {
   grub_gfxmenu_view_t view = data;
+  int old = view->selected;
 
   view->selected = entry;
-  grub_gfxmenu_redraw_menu (view);
+  if (old == entry || !redraw_items (view, old, entry))
+    grub_gfxmenu_redraw_menu (view);
 }
 
 static void
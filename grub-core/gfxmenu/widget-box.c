@@ -25,6 +25,7 @@
 #include <grub/bitmap.h>
 #include <grub/bitmap_scale.h>
 #include <grub/gfxwidgets.h>
+#include <grub/gui.h>
 
 enum box_pixmaps
 {
@@ -335,7 +336,7 @@ grub_gfxmenu_create_box (const char *pixmaps_prefix,
           path_end = grub_stpcpy (path_end, box_pixmap_names[i]);
           path_end = grub_stpcpy (path_end, pixmaps_suffix);
 
-          grub_video_bitmap_load (&box->raw_pixmaps[i], path);
+          grub_gui_load_bitmap (&box->raw_pixmaps[i], path);
           grub_free (path);
 
           /* Ignore missing pixmaps.  */
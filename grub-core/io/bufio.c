@@ -30,20 +30,26 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_BUFIO_DEF_SIZE	8192
 #define GRUB_BUFIO_MAX_SIZE	1048576
 
+/* The buffer starts at BLOCK_SIZE bytes and doubles, up to
+   GRUB_BUFIO_MAX_SIZE, each time it is refilled for reads continuing
+   where the last one ended.  */
 struct grub_bufio
 {
   grub_file_t file;
   grub_size_t block_size;
   grub_size_t buffer_len;
   grub_off_t buffer_at;
-  char buffer[0];
+  /* Where the last read ended.  */
+  grub_off_t next_offset;
+  int hint;
+  char *buffer;
 };
 typedef struct grub_bufio *grub_bufio_t;
 
 static struct grub_fs grub_bufio_fs;
 
 grub_file_t
-grub_bufio_open (grub_file_t io, int size)
+grub_bufio_open (grub_file_t io, int size, int hint)
 {
   grub_file_t file;
   grub_bufio_t bufio = 0;
@@ -61,15 +67,23 @@ grub_bufio_open (grub_file_t io, int size)
     size = ((io->size > GRUB_BUFIO_MAX_SIZE) ? GRUB_BUFIO_MAX_SIZE :
             io->size);
 
-  bufio = grub_zalloc (sizeof (struct grub_bufio) + size);
+  bufio = grub_zalloc (sizeof (struct grub_bufio));
   if (! bufio)
     {
       grub_free (file);
       return 0;
     }
+  bufio->buffer = grub_malloc (size ? : 1);
+  if (! bufio->buffer)
+    {
+      grub_free (bufio);
+      grub_free (file);
+      return 0;
+    }
 
   bufio->file = io;
   bufio->block_size = size;
+  bufio->hint = hint;
 
   file->device = io->device;
   file->size = io->size;
@@ -81,7 +95,7 @@ grub_bufio_open (grub_file_t io, int size)
 }
 
 grub_file_t
-grub_buffile_open (const char *name, int size)
+grub_buffile_open (const char *name, int size, int hint)
 {
   grub_file_t io, file;
 
@@ -89,7 +103,7 @@ grub_buffile_open (const char *name, int size)
   if (! io)
     return 0;
 
-  file = grub_bufio_open (io, size);
+  file = grub_bufio_open (io, size, hint);
   if (! file)
     {
       grub_file_close (io);
@@ -99,86 +113,100 @@ grub_buffile_open (const char *name, int size)
   return file;
 }
 
+/* Double the buffer, which is about to be refilled, unless it's as large
+   as it may get.  */
+static void
+grub_bufio_grow (grub_bufio_t bufio, grub_off_t file_size)
+{
+  grub_size_t size = bufio->block_size * 2;
+  char *buffer;
+
+  if (size > GRUB_BUFIO_MAX_SIZE)
+    size = GRUB_BUFIO_MAX_SIZE;
+  if (file_size != GRUB_FILE_SIZE_UNKNOWN && size > file_size)
+    size = file_size;
+  if (size <= bufio->block_size)
+    return;
+
+  buffer = grub_malloc (size);
+  if (! buffer)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_free (bufio->buffer);
+  bufio->buffer = buffer;
+  bufio->block_size = size;
+  bufio->buffer_len = 0;
+}
+
 static grub_ssize_t
 grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
 {
   grub_size_t res = 0;
-  grub_off_t next_buf;
+  grub_off_t pos = file->offset;
   grub_bufio_t bufio = file->data;
   grub_ssize_t really_read;
+  int sequential = (pos == bufio->next_offset);
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
   /* First part: use whatever we already have in the buffer.  */
-  if ((file->offset >= bufio->buffer_at) &&
-      (file->offset < bufio->buffer_at + bufio->buffer_len))
+  if ((pos >= bufio->buffer_at) &&
+      (pos < bufio->buffer_at + bufio->buffer_len))
     {
       grub_size_t n;
-      grub_uint64_t pos;
 
-      pos = file->offset - bufio->buffer_at;
-      n = bufio->buffer_len - pos;
+      n = bufio->buffer_len - (pos - bufio->buffer_at);
       if (n > len)
         n = len;
 
-      grub_memcpy (buf, &bufio->buffer[pos], n);
+      grub_memcpy (buf, &bufio->buffer[pos - bufio->buffer_at], n);
       len -= n;
       res += n;
-
+      pos += n;
       buf += n;
     }
   if (len == 0)
-    return res;
+    goto done;
 
-  /* Need to read some more.  */
-  next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->block_size - 1);
-  /* Now read between file->offset + res and bufio->buffer_at.  */
-  if (file->offset + res < next_buf)
+  /* Reads the buffer couldn't hold anyway, and large reads of callers
+     going through the file in order, are copied only once.  */
+  if (len >= bufio->block_size
+      || (bufio->hint == GRUB_BUFIO_HINT_SEQUENTIAL
+	  && len >= GRUB_BUFIO_DEF_SIZE))
     {
-      grub_size_t read_now;
-      read_now = next_buf - (file->offset + res);
-      grub_file_seek (bufio->file, file->offset + res);
-      really_read = grub_file_read (bufio->file, buf, read_now);
+      grub_file_seek (bufio->file, pos);
+      really_read = grub_file_read (bufio->file, buf, len);
       if (really_read < 0)
 	return -1;
-      if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-	file->size = bufio->file->size;
-      len -= really_read;
-      buf += really_read;
       res += really_read;
-
-      /* Partial read. File ended unexpectedly. Save the last chunk in buffer.
-       */
-      if (really_read != (grub_ssize_t) read_now)
-	{
-	  bufio->buffer_len = really_read;
-	  if (bufio->buffer_len > bufio->block_size)
-	    bufio->buffer_len = bufio->block_size;
-	  bufio->buffer_at = file->offset + res - bufio->buffer_len;
-	  grub_memcpy (&bufio->buffer[0], buf - bufio->buffer_len,
-		       bufio->buffer_len);
-	  return res;
-	}
+      goto done;
     }
 
+  if (sequential && bufio->hint != GRUB_BUFIO_HINT_RANDOM)
+    grub_bufio_grow (bufio, bufio->file->size);
+
   /* Read into buffer.  */
-  grub_file_seek (bufio->file, next_buf);
+  grub_file_seek (bufio->file, pos);
   really_read = grub_file_read (bufio->file, bufio->buffer,
 				bufio->block_size);
   if (really_read < 0)
     return -1;
-  bufio->buffer_at = next_buf;
+  bufio->buffer_at = pos;
   bufio->buffer_len = really_read;
 
-  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-    file->size = bufio->file->size;
-
   if (len > bufio->buffer_len)
     len = bufio->buffer_len;
-  grub_memcpy (buf, &bufio->buffer[file->offset + res - next_buf], len);
+  grub_memcpy (buf, bufio->buffer, len);
   res += len;
 
+ done:
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = bufio->file->size;
+  bufio->next_offset = file->offset + res;
+
   return res;
 }
 
@@ -188,6 +216,7 @@ grub_bufio_close (grub_file_t file)
   grub_bufio_t bufio = file->data;
 
   grub_file_close (bufio->file);
+  grub_free (bufio->buffer);
   grub_free (bufio);
 
   file->device = 0;
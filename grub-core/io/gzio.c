@@ -43,6 +43,7 @@
 #include <grub/dl.h>
 #include <grub/deflate.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -57,6 +58,20 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* Default distance between access points, see gzio_add_point.  */
+#define GZIO_INDEX_INTERVAL	(1024 * 1024)
+
+/* A place decompression can be resumed from: the start of a block, with
+   the window of data before it.  */
+struct grub_gzio_point
+{
+  /* Offset in the uncompressed data.  */
+  grub_off_t out;
+  /* Offset of the block header in the input, in bits.  */
+  grub_uint64_t in_bits;
+  grub_uint8_t *window;
+};
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
@@ -100,6 +115,16 @@ struct grub_gzio
   int bd;
   /* The original offset value.  */
   grub_off_t saved_offset;
+  /* The state of the table-driven decoder, if it's used.  */
+  struct grub_gzio_fast *fast;
+  /* Where in the slide inflating the next window starts.  */
+  unsigned resume_wp;
+  /* Access points found so far, in increasing order, and the minimum
+     distance between them or 0 not to make any.  */
+  struct grub_gzio_point *points;
+  unsigned npoints;
+  unsigned points_alloc;
+  grub_off_t index_interval;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -1031,11 +1056,738 @@ get_new_block (grub_gzio_t gzio)
 }
 
 
+/*
+ *  Table-driven inflate.
+ *
+ *  This decodes the same blocks as the code above, into the same sliding
+ *  window, but keeps up to 64 bits of input in the bit buffer, refilling
+ *  it a word at a time, and decodes most codes with a single lookup in
+ *  flat tables.  Entries of the literal/length table for short literals
+ *  also decode the literal following it when that fits in the lookup
+ *  bits.  The tables take about 10KiB, so if they can't be allocated the
+ *  code above is used instead.
+ */
+
+#define FAST_LIT_BITS	10
+#define FAST_DIST_BITS	8
+#define FAST_CL_BITS	7
+/* Enough for the root tables plus every possible subtable.  */
+#define FAST_LIT_SIZE	2048
+#define FAST_DIST_SIZE	512
+#define FAST_MAX_BITS	15
+
+/* The high nibble of OP says what an entry is, the low one adds a
+   parameter.  */
+#define OP_LITERAL	0x00
+#define OP_LITERAL2	0x10	/* + bits of the first literal */
+#define OP_BASE		0x20	/* + extra bits */
+#define OP_END		0x30
+#define OP_SUBTABLE	0x40	/* + index bits of the subtable */
+#define OP_INVALID	0x50
+#define OP_TYPE(op)	((op) & 0xf0)
+#define OP_PARAM(op)	((op) & 0x0f)
+
+struct grub_gzio_code
+{
+  grub_uint8_t op;
+  /* Bits taken by the whole entry, or by the root part for subtables.  */
+  grub_uint8_t bits;
+  /* Literal(s), base value or subtable offset.  */
+  grub_uint16_t val;
+};
+
+struct grub_gzio_fast
+{
+  /* The input not yet in the bit buffer.  */
+  const grub_uint8_t *in;
+  const grub_uint8_t *in_end;
+  /* The offset of the input buffer in the input.  */
+  grub_off_t in_base;
+  /* The bit buffer.  Bits above the count may be set but are always a
+     copy of the next input bits.  */
+  grub_uint64_t bb;
+  unsigned bk;
+  struct grub_gzio_code lit[FAST_LIT_SIZE];
+  struct grub_gzio_code dist[FAST_DIST_SIZE];
+};
+
+static void
+fast_reset (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+
+  f->bb = 0;
+  f->bk = 0;
+  if (gzio->mem_input)
+    {
+      f->in = gzio->mem_input + gzio->mem_input_off;
+      f->in_end = gzio->mem_input + gzio->mem_input_size;
+      f->in_base = 0;
+    }
+  else
+    {
+      f->in = f->in_end = gzio->inbuf;
+      f->in_base = grub_file_tell (gzio->file);
+    }
+}
+
+/* The position of the next bit to decode in the input.  */
+static grub_uint64_t
+fast_bit_offset (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  const grub_uint8_t *start = gzio->mem_input ? gzio->mem_input : gzio->inbuf;
+
+  return (f->in_base + (f->in - start)) * 8 - f->bk;
+}
+
+/* Refill the bit buffer to at least 56 bits.  */
+static inline void
+fast_refill (grub_gzio_t gzio, grub_uint64_t *b, unsigned *k)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+
+  if (f->in_end - f->in >= 8)
+    {
+      *b |= grub_le_to_cpu64 (grub_get_unaligned64 (f->in)) << *k;
+      f->in += (63 - *k) >> 3;
+      *k |= 56;
+      return;
+    }
+
+  while (*k <= 56)
+    {
+      if (f->in == f->in_end && gzio->file)
+	{
+	  grub_ssize_t r;
+
+	  f->in_base = grub_file_tell (gzio->file);
+	  r = grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+	  f->in = gzio->inbuf;
+	  f->in_end = gzio->inbuf + (r > 0 ? r : 0);
+	  if (f->in_end - f->in >= 8)
+	    {
+	      fast_refill (gzio, b, k);
+	      return;
+	    }
+	}
+      /* Past the end of the input read zeros, like get_byte.  */
+      if (f->in < f->in_end)
+	*b |= (grub_uint64_t) *f->in++ << *k;
+      else
+	*b &= (1ULL << *k) - 1;
+      *k += 8;
+    }
+}
+
+#define FNEEDBITS(n) do { if (k < (n)) fast_refill (gzio, &b, &k); } while (0)
+#define FDUMPBITS(n) do { b >>= (n); k -= (n); } while (0)
+#define FBITS(n) ((unsigned) b & ((1U << (n)) - 1))
+
+static unsigned
+reverse_bits (unsigned code, unsigned len)
+{
+  unsigned r = 0;
+
+  while (len--)
+    {
+      r = (r << 1) | (code & 1);
+      code >>= 1;
+    }
+  return r;
+}
+
+/* Build the decoding table for the N code lengths in LENS, with ROOT
+   lookup bits, into TABLE of SIZE entries.  Symbols from FIRST on take
+   their value from BASE and EXT, like the arguments of huft_build; if
+   BASE is NULL every symbol is a literal.  Return non-zero if the code
+   is oversubscribed or doesn't fit.  */
+static int
+fast_build (const grub_uint8_t *lens, unsigned n, unsigned root,
+	    struct grub_gzio_code *table, unsigned size,
+	    const ush *base, const ush *ext, unsigned first)
+{
+  unsigned count[FAST_MAX_BITS + 1], offs[FAST_MAX_BITS + 1];
+  grub_uint16_t sorted[N_MAX];
+  unsigned len, sym, i, j, code, used, idx;
+  unsigned prefix = ~0U, sub = 0, subbits = 0;
+  struct grub_gzio_code invalid = { OP_INVALID, 1, 0 };
+  int left;
+
+  grub_memset (count, 0, sizeof (count));
+  for (sym = 0; sym < n; sym++)
+    count[lens[sym]]++;
+  count[0] = 0;
+
+  left = 1;
+  for (len = 1; len <= FAST_MAX_BITS; len++)
+    {
+      left <<= 1;
+      left -= count[len];
+      if (left < 0)
+	return 1;
+    }
+
+  offs[1] = 0;
+  for (len = 1; len < FAST_MAX_BITS; len++)
+    offs[len + 1] = offs[len] + count[len];
+  for (sym = 0; sym < n; sym++)
+    if (lens[sym])
+      sorted[offs[lens[sym]]++] = sym;
+
+  for (i = 0; i < (1U << root); i++)
+    table[i] = invalid;
+  used = 1U << root;
+
+  code = 0;
+  idx = 0;
+  for (len = 1; len <= FAST_MAX_BITS; len++, code <<= 1)
+    while (count[len])
+      {
+	struct grub_gzio_code e;
+	unsigned rev = reverse_bits (code, len);
+
+	sym = sorted[idx++];
+	e.bits = len;
+	if (!base || sym < first)
+	  {
+	    e.op = (base && sym == 256) ? OP_END : OP_LITERAL;
+	    e.val = sym;
+	  }
+	else if (ext[sym - first] == 99)
+	  {
+	    e.op = OP_INVALID;
+	    e.val = 0;
+	  }
+	else
+	  {
+	    e.op = OP_BASE | ext[sym - first];
+	    e.val = base[sym - first];
+	  }
+
+	if (len <= root)
+	  for (j = rev; j < (1U << root); j += 1U << len)
+	    table[j] = e;
+	else
+	  {
+	    if ((rev & ((1U << root) - 1)) != prefix)
+	      {
+		/* Size the subtable for the codes left with this prefix.  */
+		prefix = rev & ((1U << root) - 1);
+		subbits = len - root;
+		left = 1 << subbits;
+		while (subbits + root < FAST_MAX_BITS)
+		  {
+		    left -= count[subbits + root];
+		    if (left <= 0)
+		      break;
+		    subbits++;
+		    left <<= 1;
+		  }
+		if (used + (1U << subbits) > size)
+		  return 1;
+		sub = used;
+		used += 1U << subbits;
+		for (j = 0; j < (1U << subbits); j++)
+		  table[sub + j] = invalid;
+		table[prefix].op = OP_SUBTABLE | subbits;
+		table[prefix].bits = root;
+		table[prefix].val = sub;
+	      }
+	    for (j = rev >> root; j < (1U << subbits); j += 1U << (len - root))
+	      table[sub + j] = e;
+	  }
+
+	count[len]--;
+	code++;
+      }
+
+  if (!base || first == 0)
+    return 0;
+
+  /* Pair up short literals.  Going downwards, the entry looked up for the
+     second literal has not been paired yet.  */
+  for (i = (1U << root); i-- > 0; )
+    {
+      struct grub_gzio_code *e = &table[i], *e2;
+
+      if (OP_TYPE (e->op) != OP_LITERAL || e->bits >= root)
+	continue;
+      e2 = &table[i >> e->bits];
+      if (OP_TYPE (e2->op) != OP_LITERAL || e->bits + e2->bits > root)
+	continue;
+      e->op = OP_LITERAL2 | e->bits;
+      e->val |= e2->val << 8;
+      e->bits += e2->bits;
+    }
+
+  return 0;
+}
+
+static void
+fast_init_stored_block (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  grub_uint64_t b = f->bb;
+  unsigned k = f->bk;
+
+  FDUMPBITS (k & 7);
+  FNEEDBITS (32);
+  gzio->block_len = FBITS (16);
+  if (gzio->block_len != (int) ((~b >> 16) & 0xffff))
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		"the length of a stored block does not match");
+  FDUMPBITS (32);
+
+  f->bb = b;
+  f->bk = k;
+}
+
+static void
+fast_inflate_stored (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  unsigned w = gzio->wp;
+
+  /* Whole bytes still in the bit buffer come first.  */
+  while (gzio->block_len && w < WSIZE && f->bk >= 8)
+    {
+      gzio->slide[w++] = f->bb & 0xff;
+      f->bb >>= 8;
+      f->bk -= 8;
+      gzio->block_len--;
+    }
+  if (f->bk == 0)
+    f->bb = 0;
+
+  while (gzio->block_len && w < WSIZE)
+    {
+      grub_size_t n = f->in_end - f->in;
+
+      if (n == 0)
+	{
+	  grub_ssize_t r;
+
+	  if (!gzio->file)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "premature end of compressed");
+	      break;
+	    }
+	  f->in_base = grub_file_tell (gzio->file);
+	  r = grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+	  if (r <= 0)
+	    {
+	      if (grub_errno == GRUB_ERR_NONE)
+		grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			    "premature end of compressed");
+	      break;
+	    }
+	  f->in = gzio->inbuf;
+	  f->in_end = gzio->inbuf + r;
+	  continue;
+	}
+      if (n > (grub_size_t) gzio->block_len)
+	n = gzio->block_len;
+      if (n > WSIZE - w)
+	n = WSIZE - w;
+      grub_memcpy (gzio->slide + w, f->in, n);
+      f->in += n;
+      w += n;
+      gzio->block_len -= n;
+    }
+
+  gzio->wp = w;
+}
+
+static void
+fast_init_fixed_block (grub_gzio_t gzio)
+{
+  grub_uint8_t l[288];
+  int i;
+
+  for (i = 0; i < 144; i++)
+    l[i] = 8;
+  for (; i < 256; i++)
+    l[i] = 9;
+  for (; i < 280; i++)
+    l[i] = 7;
+  for (; i < 288; i++)
+    l[i] = 8;
+  if (fast_build (l, 288, FAST_LIT_BITS, gzio->fast->lit, FAST_LIT_SIZE,
+		  cplens, cplext, 257))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return;
+    }
+
+  for (i = 0; i < 30; i++)
+    l[i] = 5;
+  if (fast_build (l, 30, FAST_DIST_BITS, gzio->fast->dist, FAST_DIST_SIZE,
+		  cpdist, cpdext, 0))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return;
+    }
+
+  gzio->code_state = 0;
+  gzio->block_len++;
+}
+
+static void
+fast_init_dynamic_block (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  grub_uint64_t b = f->bb;
+  unsigned k = f->bk;
+  grub_uint8_t ll[286 + 30];
+  unsigned nl, nd, nb, n, i, j, l;
+
+  FNEEDBITS (14);
+  nl = 257 + FBITS (5);
+  FDUMPBITS (5);
+  nd = 1 + FBITS (5);
+  FDUMPBITS (5);
+  nb = 4 + FBITS (4);
+  FDUMPBITS (4);
+  if (nl > 286 || nd > 30)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "too much data");
+      return;
+    }
+
+  for (j = 0; j < 19; j++)
+    ll[j] = 0;
+  for (j = 0; j < nb; j++)
+    {
+      FNEEDBITS (3);
+      ll[bitorder[j]] = FBITS (3);
+      FDUMPBITS (3);
+    }
+
+  /* The literal/length table is free to decode the code lengths.  */
+  if (fast_build (ll, 19, FAST_CL_BITS, f->lit, FAST_LIT_SIZE, NULL, NULL, 0))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return;
+    }
+
+  n = nl + nd;
+  i = l = 0;
+  while (i < n)
+    {
+      struct grub_gzio_code e;
+
+      FNEEDBITS (FAST_CL_BITS + 7);
+      e = f->lit[FBITS (FAST_CL_BITS)];
+      if (OP_TYPE (e.op) == OP_INVALID)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
+	}
+      FDUMPBITS (e.bits);
+      if (e.val < 16)
+	{
+	  ll[i++] = l = e.val;
+	  continue;
+	}
+      if (e.val == 16)
+	{
+	  j = 3 + FBITS (2);
+	  FDUMPBITS (2);
+	}
+      else if (e.val == 17)
+	{
+	  j = 3 + FBITS (3);
+	  FDUMPBITS (3);
+	  l = 0;
+	}
+      else
+	{
+	  j = 11 + FBITS (7);
+	  FDUMPBITS (7);
+	  l = 0;
+	}
+      if (i + j > n)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "too many codes found");
+	  return;
+	}
+      while (j--)
+	ll[i++] = l;
+    }
+
+  f->bb = b;
+  f->bk = k;
+
+  if (fast_build (ll, nl, FAST_LIT_BITS, f->lit, FAST_LIT_SIZE,
+		  cplens, cplext, 257)
+      || fast_build (ll + nl, nd, FAST_DIST_BITS, f->dist, FAST_DIST_SIZE,
+		     cpdist, cpdext, 0))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
+      return;
+    }
+
+  gzio->code_state = 0;
+  gzio->block_len++;
+}
+
+static void
+fast_get_new_block (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  grub_uint64_t b = f->bb;
+  unsigned k = f->bk;
+
+  FNEEDBITS (3);
+  gzio->last_block = FBITS (1);
+  gzio->block_type = (FBITS (3) >> 1);
+  FDUMPBITS (3);
+
+  f->bb = b;
+  f->bk = k;
+
+  switch (gzio->block_type)
+    {
+    case INFLATE_STORED:
+      fast_init_stored_block (gzio);
+      break;
+    case INFLATE_FIXED:
+      fast_init_fixed_block (gzio);
+      break;
+    case INFLATE_DYNAMIC:
+      fast_init_dynamic_block (gzio);
+      break;
+    default:
+      break;
+    }
+}
+
+/* Copy N bytes from D on in the window, stopping if it fills up.  */
+static inline unsigned
+fast_copy (grub_uint8_t *slide, unsigned w, unsigned *d, unsigned *n)
+{
+  unsigned s = *d, len = *n;
+
+  if (w + len <= WSIZE && s + len <= WSIZE && (s > w || w - s >= len))
+    {
+      grub_memmove (slide + w, slide + s, len);
+      *n = 0;
+      *d = s + len;
+      return w + len;
+    }
+
+  while (len && w < WSIZE)
+    {
+      slide[w++] = slide[s];
+      s = (s + 1) & (WSIZE - 1);
+      len--;
+    }
+  *n = len;
+  *d = s;
+  return w;
+}
+
+/* Decode a Huffman coded block into the window.  Return non-zero at the
+   end of the block.  */
+static int
+fast_inflate_codes (grub_gzio_t gzio)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  grub_uint8_t *slide = gzio->slide;
+  grub_uint64_t b = f->bb;
+  unsigned k = f->bk;
+  unsigned w = gzio->wp;
+  unsigned n = gzio->inflate_n, d = gzio->inflate_d;
+
+  /* Finish the copy the window filled up in.  */
+  if (gzio->code_state)
+    {
+      w = fast_copy (slide, w, &d, &n);
+      if (!n)
+	gzio->code_state = 0;
+    }
+
+  while (w < WSIZE)
+    {
+      struct grub_gzio_code e;
+
+      FNEEDBITS (48);
+      e = f->lit[FBITS (FAST_LIT_BITS)];
+      if (OP_TYPE (e.op) == OP_SUBTABLE)
+	e = f->lit[e.val + ((b >> FAST_LIT_BITS)
+			    & ((1U << OP_PARAM (e.op)) - 1))];
+
+      switch (OP_TYPE (e.op))
+	{
+	case OP_LITERAL2:
+	  if (w + 1 < WSIZE)
+	    {
+	      slide[w] = e.val & 0xff;
+	      slide[w + 1] = e.val >> 8;
+	      w += 2;
+	      FDUMPBITS (e.bits);
+	    }
+	  else
+	    {
+	      slide[w++] = e.val & 0xff;
+	      FDUMPBITS (OP_PARAM (e.op));
+	    }
+	  continue;
+
+	case OP_LITERAL:
+	  slide[w++] = e.val;
+	  FDUMPBITS (e.bits);
+	  continue;
+
+	case OP_END:
+	  FDUMPBITS (e.bits);
+	  gzio->block_len = 0;
+	  goto out;
+
+	case OP_BASE:
+	  break;
+
+	default:
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  goto out;
+	}
+
+      FDUMPBITS (e.bits);
+      n = e.val + FBITS (OP_PARAM (e.op));
+      FDUMPBITS (OP_PARAM (e.op));
+
+      e = f->dist[FBITS (FAST_DIST_BITS)];
+      if (OP_TYPE (e.op) == OP_SUBTABLE)
+	e = f->dist[e.val + ((b >> FAST_DIST_BITS)
+			     & ((1U << OP_PARAM (e.op)) - 1))];
+      if (OP_TYPE (e.op) != OP_BASE)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  goto out;
+	}
+      FDUMPBITS (e.bits);
+      d = (w - e.val - FBITS (OP_PARAM (e.op))) & (WSIZE - 1);
+      FDUMPBITS (OP_PARAM (e.op));
+
+      w = fast_copy (slide, w, &d, &n);
+      if (n)
+	gzio->code_state = 1;
+    }
+
+ out:
+  gzio->inflate_d = d;
+  gzio->inflate_n = n;
+  gzio->wp = w;
+  f->bb = b;
+  f->bk = k;
+
+  return ! gzio->block_len;
+}
+
+/*
+ *  Access points.
+ *
+ *  While decompressing, the position of the first block starting at least
+ *  index_interval bytes after the previous access point is recorded along
+ *  with a copy of the window, so that seeking back, or forward over data
+ *  already seen, resumes from there instead of from the start.  This only
+ *  works with the table-driven decoder, which knows where it is in the
+ *  input.
+ */
+
+static void
+gzio_add_point (grub_gzio_t gzio)
+{
+  struct grub_gzio_point *p;
+  grub_off_t out = gzio->saved_offset + gzio->wp;
+
+  if (out < (gzio->npoints ? gzio->points[gzio->npoints - 1].out : 0)
+      + gzio->index_interval)
+    return;
+
+  if (gzio->npoints == gzio->points_alloc)
+    {
+      unsigned alloc = gzio->points_alloc ? 2 * gzio->points_alloc : 16;
+
+      p = grub_realloc (gzio->points, alloc * sizeof (p[0]));
+      if (! p)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      gzio->points = p;
+      gzio->points_alloc = alloc;
+    }
+
+  p = &gzio->points[gzio->npoints];
+  p->window = grub_malloc (WSIZE);
+  if (! p->window)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (p->window, gzio->slide, WSIZE);
+  p->out = out;
+  p->in_bits = fast_bit_offset (gzio);
+  gzio->npoints++;
+}
+
+/* The last access point at or before OFFSET, if any.  */
+static struct grub_gzio_point *
+gzio_find_point (grub_gzio_t gzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = gzio->npoints;
+
+  if (! gzio->npoints || gzio->points[0].out > offset)
+    return NULL;
+
+  while (hi - lo > 1)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (gzio->points[mid].out <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return &gzio->points[lo];
+}
+
+static void
+gzio_restore_point (grub_gzio_t gzio, struct grub_gzio_point *p)
+{
+  struct grub_gzio_fast *f = gzio->fast;
+  unsigned skip = p->in_bits & 7;
+
+  gzio_seek (gzio, p->in_bits >> 3);
+  gzio->last_block = 0;
+  gzio->block_len = 0;
+  gzio->code_state = 0;
+  fast_reset (gzio);
+  if (skip)
+    {
+      fast_refill (gzio, &f->bb, &f->bk);
+      f->bb >>= skip;
+      f->bk -= skip;
+    }
+
+  grub_memcpy (gzio->slide, p->window, WSIZE);
+  gzio->saved_offset = p->out & ~(grub_off_t) (WSIZE - 1);
+  gzio->resume_wp = p->out & (WSIZE - 1);
+}
+
 static void
 inflate_window (grub_gzio_t gzio)
 {
   /* initialize window */
-  gzio->wp = 0;
+  gzio->wp = gzio->resume_wp;
+  gzio->resume_wp = 0;
 
   /*
    *  Main decompression loop.
@@ -1048,7 +1800,13 @@ inflate_window (grub_gzio_t gzio)
 	  if (gzio->last_block)
 	    break;
 
-	  get_new_block (gzio);
+	  if (gzio->fast && gzio->index_interval)
+	    gzio_add_point (gzio);
+
+	  if (gzio->fast)
+	    fast_get_new_block (gzio);
+	  else
+	    get_new_block (gzio);
 	}
 
       if (gzio->block_type > INFLATE_DYNAMIC)
@@ -1061,6 +1819,11 @@ inflate_window (grub_gzio_t gzio)
       /*
        *  Expand stored block here.
        */
+      if (gzio->block_type == INFLATE_STORED && gzio->fast)
+	{
+	  fast_inflate_stored (gzio);
+	  continue;
+	}
       if (gzio->block_type == INFLATE_STORED)
 	{
 	  int w = gzio->wp;
@@ -1084,7 +1847,9 @@ inflate_window (grub_gzio_t gzio)
        *  Expand other kind of block.
        */
 
-      if (inflate_codes_in_window (gzio))
+      if (gzio->fast)
+	fast_inflate_codes (gzio);
+      else if (inflate_codes_in_window (gzio))
 	{
 	  huft_free (gzio->tl);
 	  huft_free (gzio->td);
@@ -1103,6 +1868,7 @@ static void
 initialize_tables (grub_gzio_t gzio)
 {
   gzio->saved_offset = 0;
+  gzio->resume_wp = 0;
   gzio_seek (gzio, gzio->data_offset);
 
   /* Initialize the bit buffer.  */
@@ -1118,6 +1884,9 @@ initialize_tables (grub_gzio_t gzio)
   huft_free (gzio->td);
   gzio->tl = NULL;
   gzio->td = NULL;
+
+  if (gzio->fast)
+    fast_reset (gzio);
 }
 
 
@@ -1148,9 +1917,24 @@ grub_gzio_open (grub_file_t io, const char *name __attribute__ ((unused)))
   file->fs = &grub_gzio_fs;
   file->not_easily_seekable = 1;
 
+  /* Fall back to the small decoder when memory is tight.  */
+  gzio->fast = grub_malloc (sizeof (*gzio->fast));
+  grub_errno = GRUB_ERR_NONE;
+
+  {
+    const char *val = grub_env_get ("gzio_index_interval");
+
+    gzio->index_interval = val ? grub_strtoull (val, 0, 0)
+      : GZIO_INDEX_INTERVAL;
+    grub_errno = GRUB_ERR_NONE;
+    if (gzio->index_interval && gzio->index_interval < WSIZE)
+      gzio->index_interval = WSIZE;
+  }
+
   if (! test_gzip_header (file))
     {
       grub_errno = GRUB_ERR_NONE;
+      grub_free (gzio->fast);
       grub_free (gzio);
       grub_free (file);
       grub_file_seek (io, 0);
@@ -1218,10 +2002,20 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 		     char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
+  struct grub_gzio_point *p = gzio_find_point (gzio, offset);
 
-  /* Do we reset decompression to the beginning of the file?  */
+  /* Do we reset decompression to the beginning of the file, or to an
+     access point?  */
   if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+    {
+      if (p)
+	gzio_restore_point (gzio, p);
+      else
+	initialize_tables (gzio);
+    }
+  /* Or skip data we have decompressed before?  */
+  else if (p && p->out > gzio->saved_offset)
+    gzio_restore_point (gzio, p);
 
   /*
    *  This loop operates upon uncompressed data only.  The only
@@ -1283,10 +2077,15 @@ static grub_err_t
 grub_gzio_close (grub_file_t file)
 {
   grub_gzio_t gzio = file->data;
+  unsigned i;
 
   grub_file_close (gzio->file);
   huft_free (gzio->tl);
   huft_free (gzio->td);
+  grub_free (gzio->fast);
+  for (i = 0; i < gzio->npoints; i++)
+    grub_free (gzio->points[i].window);
+  grub_free (gzio->points);
   grub_free (gzio);
 
   /* No need to close the same device twice.  */
@@ -1309,14 +2108,18 @@ grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   gzio->mem_input = (grub_uint8_t *) inbuf;
   gzio->mem_input_size = insize;
   gzio->mem_input_off = 0;
+  gzio->fast = grub_malloc (sizeof (*gzio->fast));
+  grub_errno = GRUB_ERR_NONE;
 
   if (!test_zlib_header (gzio))
     {
+      grub_free (gzio->fast);
       grub_free (gzio);
       return -1;
     }
 
   ret = grub_gzio_read_real (gzio, off, outbuf, outsize);
+  grub_free (gzio->fast);
   grub_free (gzio);
 
   /* FIXME: Check Adler.  */
@@ -1336,10 +2139,13 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   gzio->mem_input = (grub_uint8_t *) inbuf;
   gzio->mem_input_size = insize;
   gzio->mem_input_off = 0;
+  gzio->fast = grub_malloc (sizeof (*gzio->fast));
+  grub_errno = GRUB_ERR_NONE;
 
   initialize_tables (gzio);
 
   ret = grub_gzio_read_real (gzio, off, outbuf, outsize);
+  grub_free (gzio->fast);
   grub_free (gzio);
 
   return ret;
@@ -0,0 +1,556 @@
+/* lz4io.c - decompression support for lz4 */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZ4_MAGIC		0x184d2204
+#define LZ4_SKIPPABLE_MAGIC	0x184d2a50
+#define LZ4_SKIPPABLE_MASK	0xfffffff0
+
+#define LZ4_FLG_VERSION_MASK	0xc0
+#define LZ4_FLG_VERSION		0x40
+#define LZ4_FLG_INDEPENDENT	0x20
+#define LZ4_FLG_BLOCK_CHECKSUM	0x10
+#define LZ4_FLG_CONTENT_SIZE	0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_RESERVED	0x02
+#define LZ4_FLG_DICT_ID		0x01
+
+#define LZ4_BLOCK_UNCOMPRESSED	0x80000000
+#define LZ4_MAX_HEADER_SIZE	19
+#define LZ4_HISTORY		(64 * 1024)
+
+/* A block header decompression can be resumed from: the first block of
+   a frame, or any block of a frame with independent blocks.  */
+struct grub_lz4io_point
+{
+  grub_off_t frame;
+  grub_off_t block;
+  grub_off_t upos;
+};
+
+struct grub_lz4io
+{
+  grub_file_t file;
+
+  /* Parameters of the current frame.  */
+  int in_frame;
+  grub_off_t frame;
+  grub_uint8_t flags;
+  grub_size_t block_max;
+
+  /* The next block header, or the next frame if not IN_FRAME.  */
+  grub_off_t cpos;
+  int eof;
+
+  /* Resume points found so far, in increasing order.  */
+  struct grub_lz4io_point *points;
+  unsigned npoints;
+  unsigned points_alloc;
+
+  /* Decompressed data.  WINDOW[0] is at offset WSTART of the output and
+     WLEN bytes of it are valid.  Matches may not reach before HIST.  */
+  grub_uint8_t *window;
+  grub_size_t window_alloc;
+  grub_off_t wstart;
+  grub_size_t wlen;
+  grub_size_t hist;
+
+  grub_uint8_t *inbuf;
+  grub_size_t inbuf_alloc;
+};
+
+typedef struct grub_lz4io *grub_lz4io_t;
+static struct grub_fs grub_lz4io_fs;
+
+static grub_err_t
+corrupted (void)
+{
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lz4 data corrupted"));
+}
+
+static grub_err_t
+read_at (grub_lz4io_t lz, grub_off_t off, void *buf, grub_size_t len)
+{
+  grub_file_seek (lz->file, off);
+  if (grub_errno)
+    return grub_errno;
+  if (grub_file_read (lz->file, buf, len) != (grub_ssize_t) len)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("premature end of file"));
+      return grub_errno;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+add_point (grub_lz4io_t lz, grub_off_t block)
+{
+  struct grub_lz4io_point *p;
+
+  /* Already known from an earlier pass.  */
+  if (lz->npoints && lz->points[lz->npoints - 1].block >= block)
+    return GRUB_ERR_NONE;
+
+  if (lz->npoints == lz->points_alloc)
+    {
+      unsigned alloc = lz->points_alloc ? 2 * lz->points_alloc : 16;
+
+      p = grub_realloc (lz->points, alloc * sizeof (p[0]));
+      if (!p)
+	return grub_errno;
+      lz->points = p;
+      lz->points_alloc = alloc;
+    }
+
+  p = &lz->points[lz->npoints++];
+  p->frame = lz->frame;
+  p->block = block;
+  p->upos = lz->wstart + lz->wlen;
+  return GRUB_ERR_NONE;
+}
+
+/* Parse the frame header at FRAME.  */
+static grub_err_t
+read_frame_header (grub_lz4io_t lz, grub_off_t frame,
+		   grub_uint64_t *content_size)
+{
+  static const grub_size_t block_sizes[8] =
+    { 0, 0, 0, 0, 64 * 1024, 256 * 1024, 1024 * 1024, 4 * 1024 * 1024 };
+  grub_uint8_t hdr[LZ4_MAX_HEADER_SIZE];
+  grub_size_t hsize = sizeof (hdr), bmax;
+  grub_off_t end = lz->file->size;
+
+  if (hsize > end - frame)
+    hsize = end - frame;
+  if (hsize < 7 || read_at (lz, frame, hdr, hsize))
+    return corrupted ();
+
+  if ((hdr[4] & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION
+      || (hdr[4] & LZ4_FLG_RESERVED) || (hdr[5] & 0x8f))
+    return corrupted ();
+  if (hdr[4] & LZ4_FLG_DICT_ID)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "lz4 dictionaries aren't supported");
+  bmax = block_sizes[(hdr[5] >> 4) & 7];
+  if (!bmax)
+    return corrupted ();
+
+  lz->flags = hdr[4];
+  lz->frame = frame;
+  lz->cpos = frame + 6;
+  *content_size = 0;
+  if (hdr[4] & LZ4_FLG_CONTENT_SIZE)
+    {
+      if (hsize < 15)
+	return corrupted ();
+      *content_size = grub_le_to_cpu64 (grub_get_unaligned64 (hdr + 6));
+      lz->cpos += 8;
+    }
+
+  if (bmax > lz->inbuf_alloc)
+    {
+      grub_free (lz->inbuf);
+      grub_free (lz->window);
+      lz->inbuf_alloc = lz->window_alloc = 0;
+      lz->wstart += lz->wlen;
+      lz->wlen = 0;
+      lz->inbuf = grub_malloc (bmax);
+      lz->window = grub_malloc (LZ4_HISTORY + bmax);
+      if (!lz->inbuf || !lz->window)
+	{
+	  grub_free (lz->inbuf);
+	  grub_free (lz->window);
+	  lz->inbuf = lz->window = NULL;
+	  return grub_errno;
+	}
+      lz->inbuf_alloc = bmax;
+      lz->window_alloc = LZ4_HISTORY + bmax;
+    }
+  lz->block_max = bmax;
+  lz->in_frame = 1;
+  lz->hist = lz->wlen;
+  return GRUB_ERR_NONE;
+}
+
+/* Decode whatever comes next: a block, or the start or end of a frame.  */
+static grub_err_t
+decode_next (grub_lz4io_t lz)
+{
+  grub_uint8_t hdr[8];
+  grub_uint32_t bsize;
+  grub_uint64_t content_size;
+  grub_size_t room;
+
+  if (!lz->in_frame)
+    {
+      grub_uint32_t magic;
+
+      if (lz->cpos + 4 > lz->file->size)
+	{
+	  lz->eof = 1;
+	  return GRUB_ERR_NONE;
+	}
+      if (read_at (lz, lz->cpos, hdr, 4))
+	return grub_errno;
+      magic = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+
+      if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC)
+	{
+	  if (read_at (lz, lz->cpos + 4, hdr + 4, 4))
+	    return grub_errno;
+	  lz->cpos += 8 + grub_le_to_cpu32 (grub_get_unaligned32 (hdr + 4));
+	  return GRUB_ERR_NONE;
+	}
+      /* Anything else after the last frame is ignored, like lz4 does.  */
+      if (magic != LZ4_MAGIC)
+	{
+	  lz->eof = 1;
+	  return GRUB_ERR_NONE;
+	}
+
+      if (read_frame_header (lz, lz->cpos, &content_size))
+	return grub_errno;
+      /* Skip the header checksum.  */
+      lz->cpos++;
+      return add_point (lz, lz->frame);
+    }
+
+  if (read_at (lz, lz->cpos, hdr, 4))
+    return grub_errno;
+  bsize = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+
+  /* End mark.  The content checksum is xxh32 and isn't verified.  */
+  if (bsize == 0)
+    {
+      lz->cpos += 4;
+      if (lz->flags & LZ4_FLG_CONTENT_CHECKSUM)
+	lz->cpos += 4;
+      lz->in_frame = 0;
+      return GRUB_ERR_NONE;
+    }
+
+  if ((bsize & ~LZ4_BLOCK_UNCOMPRESSED) > lz->block_max)
+    return corrupted ();
+
+  if (lz->flags & LZ4_FLG_INDEPENDENT)
+    {
+      if (add_point (lz, lz->cpos))
+	return grub_errno;
+      lz->hist = lz->wlen;
+    }
+
+  if (lz->wlen + lz->block_max > lz->window_alloc)
+    {
+      grub_size_t shift = lz->wlen - LZ4_HISTORY;
+
+      grub_memmove (lz->window, lz->window + shift, LZ4_HISTORY);
+      lz->wstart += shift;
+      lz->wlen = LZ4_HISTORY;
+      lz->hist = lz->hist > shift ? lz->hist - shift : 0;
+    }
+
+  if (read_at (lz, lz->cpos + 4, lz->inbuf, bsize & ~LZ4_BLOCK_UNCOMPRESSED))
+    return grub_errno;
+
+  room = lz->wlen + lz->block_max;
+  if (bsize & LZ4_BLOCK_UNCOMPRESSED)
+    {
+      bsize &= ~LZ4_BLOCK_UNCOMPRESSED;
+      grub_memcpy (lz->window + lz->wlen, lz->inbuf, bsize);
+      lz->wlen += bsize;
+    }
+  else
+    {
+      grub_ssize_t n;
+
+      /* Matches may reach back into the window as far as HIST.  */
+      n = grub_lz4_decompress_continue (lz->inbuf, bsize,
+					lz->window + lz->wlen, room - lz->wlen,
+					lz->wlen - lz->hist);
+      if (n < 0)
+	return grub_errno;
+      lz->wlen += n;
+    }
+
+  lz->cpos += 4 + bsize;
+  if (lz->flags & LZ4_FLG_BLOCK_CHECKSUM)
+    lz->cpos += 4;
+  return GRUB_ERR_NONE;
+}
+
+/* Resume decompression from resume point IDX.  */
+static grub_err_t
+restart (grub_lz4io_t lz, unsigned idx)
+{
+  struct grub_lz4io_point *p = &lz->points[idx];
+  grub_uint64_t content_size;
+
+  lz->wstart = p->upos;
+  lz->wlen = 0;
+  lz->eof = 0;
+  if (read_frame_header (lz, p->frame, &content_size))
+    return grub_errno;
+  if (p->block == p->frame)
+    lz->cpos++;
+  else
+    lz->cpos = p->block;
+  return GRUB_ERR_NONE;
+}
+
+/* Work out the decompressed size.  It's recorded in the frame headers if
+   lz4 was told the input size, otherwise the whole file is decompressed,
+   which at the same time finds every resume point.  */
+static int
+find_size (grub_file_t file)
+{
+  grub_lz4io_t lz = file->data;
+  grub_uint64_t total = 0;
+  grub_off_t pos = 0;
+
+  while (pos + 4 <= lz->file->size)
+    {
+      grub_uint8_t hdr[8];
+      grub_uint32_t magic, bsize;
+      grub_uint64_t content_size;
+
+      if (read_at (lz, pos, hdr, 4))
+	return 0;
+      magic = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+      if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC)
+	{
+	  if (read_at (lz, pos + 4, hdr + 4, 4))
+	    return 0;
+	  pos += 8 + grub_le_to_cpu32 (grub_get_unaligned32 (hdr + 4));
+	  continue;
+	}
+      if (magic != LZ4_MAGIC)
+	break;
+
+      if (read_frame_header (lz, pos, &content_size))
+	return 0;
+      if (!(lz->flags & LZ4_FLG_CONTENT_SIZE))
+	{
+	  total = GRUB_FILE_SIZE_UNKNOWN;
+	  break;
+	}
+      total += content_size;
+
+      /* Walk the block headers to find the next frame.  */
+      pos = lz->cpos + 1;
+      do
+	{
+	  if (read_at (lz, pos, hdr, 4))
+	    return 0;
+	  bsize = grub_le_to_cpu32 (grub_get_unaligned32 (hdr))
+	    & ~LZ4_BLOCK_UNCOMPRESSED;
+	  pos += 4;
+	  if (bsize)
+	    pos += bsize + ((lz->flags & LZ4_FLG_BLOCK_CHECKSUM) ? 4 : 0);
+	}
+      while (bsize);
+      if (lz->flags & LZ4_FLG_CONTENT_CHECKSUM)
+	pos += 4;
+    }
+
+  lz->in_frame = 0;
+  lz->cpos = 0;
+  lz->wstart = 0;
+  lz->wlen = 0;
+
+  if (total == GRUB_FILE_SIZE_UNKNOWN)
+    {
+      while (!lz->eof)
+	if (decode_next (lz))
+	  return 0;
+      total = lz->wstart + lz->wlen;
+    }
+
+  while (!lz->npoints && !lz->eof)
+    if (decode_next (lz))
+      return 0;
+  if (!lz->npoints)
+    return 0;
+
+  file->size = total;
+  return 1;
+}
+
+static grub_file_t
+grub_lz4io_open (grub_file_t io,
+		 const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_lz4io_t lz;
+  grub_uint32_t magic;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || (grub_le_to_cpu32 (magic) != LZ4_MAGIC
+	  && ((grub_le_to_cpu32 (magic) & LZ4_SKIPPABLE_MASK)
+	      != LZ4_SKIPPABLE_MAGIC)))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  lz = grub_zalloc (sizeof (*lz));
+  if (!lz)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  lz->file = io;
+
+  file->device = io->device;
+  file->data = lz;
+  file->fs = &grub_lz4io_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  if (!find_size (file) || restart (lz, 0))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_free (lz->points);
+      grub_free (lz->window);
+      grub_free (lz->inbuf);
+      grub_free (lz);
+      grub_free (file);
+
+      return io;
+    }
+
+  return file;
+}
+
+static grub_ssize_t
+grub_lz4io_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_lz4io_t lz = file->data;
+  grub_ssize_t ret = 0;
+
+  while (len > 0)
+    {
+      grub_off_t off = file->offset + ret;
+
+      if (off >= file->size)
+	break;
+
+      /* Backwards, or far enough ahead that a known resume point is
+	 closer: jump to the last point before OFF.  */
+      if (off < lz->wstart
+	  || (lz->points[lz->npoints - 1].upos > lz->wstart + lz->wlen
+	      && lz->points[lz->npoints - 1].upos <= off))
+	{
+	  unsigned lo = 0, hi = lz->npoints;
+
+	  while (hi - lo > 1)
+	    {
+	      unsigned mid = (lo + hi) / 2;
+
+	      if (lz->points[mid].upos <= off)
+		lo = mid;
+	      else
+		hi = mid;
+	    }
+	  if (restart (lz, lo))
+	    return -1;
+	}
+
+      if (off < lz->wstart + lz->wlen)
+	{
+	  grub_size_t n = lz->wstart + lz->wlen - off;
+
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, lz->window + (off - lz->wstart), n);
+	  buf += n;
+	  len -= n;
+	  ret += n;
+	  continue;
+	}
+
+      if (lz->eof)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      N_("premature end of file"));
+	  return -1;
+	}
+      if (decode_next (lz))
+	return -1;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_lz4io_close (grub_file_t file)
+{
+  grub_lz4io_t lz = file->data;
+
+  grub_free (lz->points);
+  grub_free (lz->window);
+  grub_free (lz->inbuf);
+
+  grub_file_close (lz->file);
+  grub_free (lz);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_lz4io_fs = {
+  .name = "lz4io",
+  .dir = 0,
+  .open = 0,
+  .read = grub_lz4io_read,
+  .close = grub_lz4io_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (lz4io)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_LZ4IO, grub_lz4io_open);
+}
+
+GRUB_MOD_FINI (lz4io)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_LZ4IO);
+}
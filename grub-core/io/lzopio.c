@@ -59,6 +59,13 @@ struct block_header
   unsigned char *udata;
 };
 
+/* Where each block starts, in the output and in the file.  */
+struct block_index
+{
+  grub_off_t uoff;
+  grub_off_t header_off;
+};
+
 struct grub_lzopio
 {
   grub_file_t file;
@@ -69,6 +76,10 @@ struct grub_lzopio
   grub_off_t saved_off;		/* Rounded down to block boundary.  */
   grub_off_t start_block_off;
   struct block_header block;
+  /* Filled while computing the size, so that seeks go straight to the
+     block they land in.  NBLOCKS is 0 if it couldn't be allocated.  */
+  struct block_index *blocks;
+  unsigned nblocks;
 };
 
 typedef struct grub_lzopio *grub_lzopio_t;
@@ -257,16 +268,46 @@ static int
 calculate_uncompressed_size (grub_file_t file)
 {
   grub_lzopio_t lzopio = file->data;
-  grub_off_t usize_total = 0;
+  grub_off_t usize_total = 0, header_off;
+  unsigned alloc = 0;
+  int index = 1;
 
+  header_off = grub_file_tell (lzopio->file);
   if (read_block_header (lzopio) < 0)
     return -1;
 
   /* FIXME: Don't do this for not easily seekable files.  */
   while (lzopio->block.usize != 0)
     {
+      if (index && lzopio->nblocks == alloc)
+	{
+	  struct block_index *blocks;
+
+	  alloc = alloc ? alloc * 2 : 32;
+	  blocks = grub_realloc (lzopio->blocks,
+				 alloc * sizeof (lzopio->blocks[0]));
+	  if (!blocks)
+	    {
+	      /* Seeks walk the headers instead.  */
+	      grub_errno = GRUB_ERR_NONE;
+	      grub_free (lzopio->blocks);
+	      lzopio->blocks = NULL;
+	      lzopio->nblocks = 0;
+	      index = 0;
+	    }
+	  else
+	    lzopio->blocks = blocks;
+	}
+      if (index)
+	{
+	  lzopio->blocks[lzopio->nblocks].uoff = usize_total;
+	  lzopio->blocks[lzopio->nblocks].header_off = header_off;
+	  lzopio->nblocks++;
+	}
+
       usize_total += lzopio->block.usize;
 
+      header_off = grub_file_tell (lzopio->file) + lzopio->block.csize;
       if (jump_block (lzopio) < 0)
 	return -1;
     }
@@ -276,6 +317,33 @@ calculate_uncompressed_size (grub_file_t file)
   return 0;
 }
 
+/* Make the block holding offset OFF of the output the current one, using
+   the index.  */
+static int
+seek_block (struct grub_lzopio *lzopio, grub_off_t off)
+{
+  unsigned lo = 0, hi = lzopio->nblocks;
+
+  while (hi - lo > 1)
+    {
+      unsigned mid = lo + (hi - lo) / 2;
+
+      if (lzopio->blocks[mid].uoff <= off)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  if (grub_file_seek (lzopio->file, lzopio->blocks[lo].header_off)
+      == (grub_off_t) -1)
+    return -1;
+
+  /* read_block_header advances SAVED_OFF past the current block.  */
+  lzopio->block.usize = 0;
+  lzopio->saved_off = lzopio->blocks[lo].uoff;
+  return read_block_header (lzopio);
+}
+
 struct lzop_header
 {
   grub_uint8_t magic[LZOP_MAGIC_SIZE];
@@ -439,12 +507,17 @@ grub_lzopio_open (grub_file_t io,
     {
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
+      grub_free (lzopio->blocks);
       grub_free (lzopio);
       grub_free (file);
 
       return io;
     }
 
+  /* With the index a seek costs one block at most.  */
+  if (lzopio->nblocks)
+    file->not_easily_seekable = 0;
+
   return file;
 }
 
@@ -455,6 +528,16 @@ grub_lzopio_read (grub_file_t file, char *buf, grub_size_t len)
   grub_ssize_t ret = 0;
   grub_off_t off;
 
+  /* Not in the current block: look it up.  Reads past the end are left
+     to the loop below.  */
+  if (lzopio->nblocks
+      && (lzopio->saved_off > grub_file_tell (file)
+	  || (lzopio->saved_off + lzopio->block.usize
+	      <= grub_file_tell (file)
+	      && grub_file_tell (file) < file->size))
+      && seek_block (lzopio, grub_file_tell (file)) < 0)
+    goto CORRUPTED;
+
   /* Backward seek before last read block.  */
   if (lzopio->saved_off > grub_file_tell (file))
     {
@@ -519,6 +602,7 @@ grub_lzopio_close (grub_file_t file)
   grub_file_close (lzopio->file);
   grub_free (lzopio->block.cdata);
   grub_free (lzopio->block.udata);
+  grub_free (lzopio->blocks);
   grub_free (lzopio);
 
   /* Device must not be closed twice.  */
@@ -0,0 +1,282 @@
+/* lzssio.c - decompression support for lzss compressed kernelcaches */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Apple kernelcaches and prelinked kernels are a big-endian header
+   followed by an LZSS stream, the one of Okumura's LZSS.C: a flag byte
+   announces eight items, each a literal byte or a 12-bit position and
+   4-bit length into a 4096-byte ring.  The stream has no end marker, the
+   header gives both sizes.  */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZSS_SIGNATURE		0x636f6d70	/* "comp" */
+#define LZSS_TYPE		0x6c7a7373	/* "lzss" */
+#define LZSS_DATA_OFFSET	0x180
+
+#define LZSS_RING_SIZE		4096
+#define LZSS_MAX_MATCH		18
+#define LZSS_THRESHOLD		2
+
+/* Nothing sensible is larger; the whole output is kept in memory.  */
+#define LZSS_MAX_SIZE		(512 * 1024 * 1024)
+
+struct grub_lzss_header
+{
+  grub_uint32_t signature;
+  grub_uint32_t type;
+  grub_uint32_t adler32;
+  grub_uint32_t uncompressed_size;
+  grub_uint32_t compressed_size;
+} GRUB_PACKED;
+
+struct grub_lzssio
+{
+  grub_file_t file;
+  grub_uint8_t *data;
+};
+typedef struct grub_lzssio *grub_lzssio_t;
+
+static struct grub_fs grub_lzssio_fs;
+
+static grub_uint32_t
+lzss_adler32 (const grub_uint8_t *buf, grub_size_t len)
+{
+  grub_uint32_t a = 1, b = 0;
+
+  while (len)
+    {
+      /* 5552 bytes is the most that can be summed before B overflows.  */
+      grub_size_t n = len < 5552 ? len : 5552;
+
+      len -= n;
+      while (n--)
+	{
+	  a += *buf++;
+	  b += a;
+	}
+      a %= 65521;
+      b %= 65521;
+    }
+  return (b << 16) | a;
+}
+
+/* Decompress IN into OUT, which must come out exactly OUT_LEN long.  */
+static grub_err_t
+lzss_decode (const grub_uint8_t *in, grub_size_t in_len,
+	     grub_uint8_t *out, grub_size_t out_len)
+{
+  grub_uint8_t ring[LZSS_RING_SIZE];
+  const grub_uint8_t *in_end = in + in_len;
+  grub_uint8_t *out_end = out + out_len;
+  unsigned r = LZSS_RING_SIZE - LZSS_MAX_MATCH;
+  unsigned flags = 0;
+
+  grub_memset (ring, ' ', r);
+
+  while (out < out_end)
+    {
+      flags >>= 1;
+      if (!(flags & 0x100))
+	{
+	  if (in == in_end)
+	    break;
+	  flags = *in++ | 0xff00;
+	}
+
+      if (flags & 1)
+	{
+	  if (in == in_end)
+	    break;
+	  *out++ = ring[r++] = *in++;
+	  r &= LZSS_RING_SIZE - 1;
+	}
+      else
+	{
+	  unsigned pos, len;
+
+	  if (in_end - in < 2)
+	    break;
+	  pos = in[0] | ((in[1] & 0xf0) << 4);
+	  len = (in[1] & 0x0f) + LZSS_THRESHOLD + 1;
+	  in += 2;
+	  while (len-- && out < out_end)
+	    {
+	      *out++ = ring[r++] = ring[pos++ & (LZSS_RING_SIZE - 1)];
+	      r &= LZSS_RING_SIZE - 1;
+	    }
+	}
+    }
+
+  if (out != out_end)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of compressed"));
+  return GRUB_ERR_NONE;
+}
+
+/* The whole file is decompressed here: the Mach-O loaders seek all over
+   the image, and the output has to be checksummed anyway.  */
+static grub_file_t
+grub_lzssio_open (grub_file_t io,
+		  const char *name __attribute__ ((unused)))
+{
+  struct grub_lzss_header hdr;
+  grub_uint32_t usize, csize;
+  grub_uint8_t *cdata = 0;
+  const grub_uint8_t *in;
+  grub_file_t file;
+  grub_lzssio_t lz;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, &hdr, sizeof (hdr)) != sizeof (hdr)
+      || grub_be_to_cpu32 (hdr.signature) != LZSS_SIGNATURE
+      || grub_be_to_cpu32 (hdr.type) != LZSS_TYPE)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  usize = grub_be_to_cpu32 (hdr.uncompressed_size);
+  csize = grub_be_to_cpu32 (hdr.compressed_size);
+  if (usize > LZSS_MAX_SIZE || csize > LZSS_MAX_SIZE
+      || (io->size != GRUB_FILE_SIZE_UNKNOWN
+	  && io->size < (grub_off_t) LZSS_DATA_OFFSET + csize))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("invalid lzss header"));
+      return 0;
+    }
+
+  file = grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+  lz = grub_zalloc (sizeof (*lz));
+  if (!lz)
+    goto fail;
+  lz->data = grub_malloc (usize ? : 1);
+  if (!lz->data)
+    goto fail;
+
+  /* From a memdisk the compressed image is decoded in place.  */
+  in = grub_file_map (io, LZSS_DATA_OFFSET, csize);
+  if (!in)
+    {
+      cdata = grub_malloc (csize ? : 1);
+      if (!cdata)
+	goto fail;
+      io->streaming = 1;
+      grub_file_seek (io, LZSS_DATA_OFFSET);
+      if (grub_file_read (io, cdata, csize) != (grub_ssize_t) csize)
+	{
+	  if (!grub_errno)
+	    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			N_("premature end of compressed"));
+	  goto fail;
+	}
+      in = cdata;
+    }
+
+  if (lzss_decode (in, csize, lz->data, usize))
+    goto fail;
+  if (lzss_adler32 (lz->data, usize) != grub_be_to_cpu32 (hdr.adler32))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("lzss checksum mismatch"));
+      goto fail;
+    }
+  grub_free (cdata);
+
+  lz->file = io;
+  file->device = io->device;
+  file->data = lz;
+  file->fs = &grub_lzssio_fs;
+  file->size = usize;
+  return file;
+
+ fail:
+  grub_free (cdata);
+  if (lz)
+    grub_free (lz->data);
+  grub_free (lz);
+  grub_free (file);
+  return 0;
+}
+
+static grub_ssize_t
+grub_lzssio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_lzssio_t lz = file->data;
+
+  /* grub_file_read has already clipped LEN to the file size.  */
+  grub_memcpy (buf, lz->data + file->offset, len);
+  return len;
+}
+
+/* Release everything, including the underlying file object.  */
+static const void *
+grub_lzssio_map (grub_file_t file, grub_off_t offset,
+		 grub_size_t len __attribute__ ((unused)))
+{
+  grub_lzssio_t lz = file->data;
+
+  return lz->data + offset;
+}
+
+static grub_err_t
+grub_lzssio_close (grub_file_t file)
+{
+  grub_lzssio_t lz = file->data;
+
+  grub_free (lz->data);
+  grub_file_close (lz->file);
+  grub_free (lz);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_lzssio_fs = {
+  .name = "lzssio",
+  .dir = 0,
+  .open = 0,
+  .read = grub_lzssio_read,
+  .close = grub_lzssio_close,
+  .map = grub_lzssio_map,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (lzssio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_LZSSIO, grub_lzssio_open);
+}
+
+GRUB_MOD_FINI (lzssio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_LZSSIO);
+}
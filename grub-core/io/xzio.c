@@ -33,6 +33,29 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
 
+/* Blocks up to this size are decompressed whole and kept in a small cache,
+   larger ones are streamed through OUTBUF.  */
+#define XZIO_CACHE_BLOCK_MAX	(2 * 1024 * 1024)
+#define XZIO_CACHE_SLOTS	4
+
+#define XZIO_NO_BLOCK		((unsigned) -1)
+
+/* A block, as listed by the stream index.  */
+struct grub_xzio_block
+{
+  grub_off_t cstart;
+  grub_off_t ustart;
+  grub_uint64_t usize;
+};
+
+struct grub_xzio_cached
+{
+  unsigned block;
+  grub_uint8_t *data;
+  grub_size_t alloc;
+  unsigned long last_use;
+};
+
 struct grub_xzio
 {
   grub_file_t file;
@@ -40,7 +63,15 @@ struct grub_xzio
   struct xz_dec *dec;
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
+  /* The decoder is at SAVED_OFFSET in block CUR_BLOCK.  */
   grub_off_t saved_offset;
+  unsigned cur_block;
+  /* The stream header, fed to the decoder before jumping to a block.  */
+  grub_uint8_t header[STREAM_HEADER_SIZE];
+  struct grub_xzio_block *blocks;
+  unsigned nblocks;
+  struct grub_xzio_cached cache[XZIO_CACHE_SLOTS];
+  unsigned long use_count;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -100,6 +131,7 @@ test_header (grub_file_t file)
   if (xzio->buf.in_size != STREAM_HEADER_SIZE)
     return 0;
 
+  grub_memcpy (xzio->header, xzio->inbuf, STREAM_HEADER_SIZE);
   ret = xz_dec_run (xzio->dec, &xzio->buf);
 
   if (ret == XZ_FORMAT_ERROR)
@@ -122,7 +154,10 @@ test_footer (grub_file_t file)
   grub_uint8_t imarker;
   grub_uint64_t uncompressed_size_total = 0;
   grub_uint64_t uncompressed_size;
+  grub_uint64_t unpadded_size;
   grub_uint64_t records;
+  grub_off_t index_start, block_start = STREAM_HEADER_SIZE;
+  unsigned i;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -139,26 +174,46 @@ test_footer (grub_file_t file)
   backsize = (grub_le_to_cpu32 (backsize) + 1) * 4;
 
   /* Set file to the beginning of stream index.  */
-  grub_file_seek (xzio->file,
-		  xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize);
+  index_start = xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize;
+  grub_file_seek (xzio->file, index_start);
 
   /* Test index marker.  */
   if (grub_file_read (xzio->file, &imarker, sizeof (imarker))
       != sizeof (imarker) && imarker != 0x00)
     goto ERROR;
 
-  if (read_vli (xzio->file, &records) <= 0)
+  if (read_vli (xzio->file, &records) <= 0
+      || records > xzio->file->size / 2)
+    goto ERROR;
+
+  xzio->blocks = grub_malloc ((records ? records : 1) * sizeof (xzio->blocks[0]));
+  if (!xzio->blocks)
     goto ERROR;
 
-  for (; records != 0; records--)
+  for (i = 0; i < records; i++)
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
+      if (read_vli (xzio->file, &unpadded_size) <= 0)
 	goto ERROR;
       if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
 	goto ERROR;
 
+      xzio->blocks[i].cstart = block_start;
+      xzio->blocks[i].ustart = uncompressed_size_total;
+      xzio->blocks[i].usize = uncompressed_size;
+      block_start += ALIGN_UP (unpadded_size, 4);
       uncompressed_size_total += uncompressed_size;
     }
+  xzio->nblocks = records;
+
+  /* If the blocks don't add up, as with several concatenated streams,
+     decode everything in one go as if it was a single block.  */
+  if (block_start != index_start || records == 0)
+    {
+      xzio->blocks[0].cstart = STREAM_HEADER_SIZE;
+      xzio->blocks[0].ustart = 0;
+      xzio->blocks[0].usize = uncompressed_size_total;
+      xzio->nblocks = 1;
+    }
 
   file->size = uncompressed_size_total;
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
@@ -174,6 +229,7 @@ grub_xzio_open (grub_file_t io,
 {
   grub_file_t file;
   grub_xzio_t xzio;
+  unsigned i;
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (!file)
@@ -210,6 +266,9 @@ grub_xzio_open (grub_file_t io,
   xzio->buf.in = xzio->inbuf;
   xzio->buf.out = xzio->outbuf;
   xzio->buf.out_size = XZBUFSIZ;
+  xzio->cur_block = XZIO_NO_BLOCK;
+  for (i = 0; i < XZIO_CACHE_SLOTS; i++)
+    xzio->cache[i].block = XZIO_NO_BLOCK;
 
   /* FIXME: don't test footer on not easily seekable files.  */
   if (!test_header (file) || !test_footer (file))
@@ -217,6 +276,7 @@ grub_xzio_open (grub_file_t io,
       grub_errno = GRUB_ERR_NONE;
       grub_file_seek (io, 0);
       xz_dec_end (xzio->dec);
+      grub_free (xzio->blocks);
       grub_free (xzio);
       grub_free (file);
 
@@ -226,40 +286,41 @@ grub_xzio_open (grub_file_t io,
   return file;
 }
 
-static grub_ssize_t
-grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+/* Make the decoder continue with block B.  */
+static void
+start_block (grub_xzio_t xzio, unsigned b)
 {
-  grub_ssize_t ret = 0;
-  grub_ssize_t readret;
-  enum xz_ret xzret;
-  grub_xzio_t xzio = file->data;
-  grub_off_t current_offset;
+  xz_dec_reset (xzio->dec);
+  grub_memcpy (xzio->inbuf, xzio->header, STREAM_HEADER_SIZE);
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = STREAM_HEADER_SIZE;
+  grub_file_seek (xzio->file, xzio->blocks[b].cstart);
+  xzio->cur_block = b;
+  xzio->saved_offset = xzio->blocks[b].ustart;
+}
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
-  if (file->offset < xzio->saved_offset)
-    {
-      xz_dec_reset (xzio->dec);
-      xzio->saved_offset = 0;
-      xzio->buf.out_pos = 0;
-      xzio->buf.in_pos = 0;
-      xzio->buf.in_size = 0;
-      grub_file_seek (xzio->file, 0);
-    }
+/* Decompress the next SIZE bytes into OUT.  */
+static grub_err_t
+decode (grub_xzio_t xzio, grub_uint8_t *out, grub_size_t size)
+{
+  enum xz_ret xzret;
 
-  current_offset = xzio->saved_offset;
+  xzio->buf.out = out;
+  xzio->buf.out_pos = 0;
+  xzio->buf.out_size = size;
 
-  while (len > 0)
+  while (xzio->buf.out_pos < size)
     {
-      xzio->buf.out_size = file->offset + ret + len - current_offset;
-      if (xzio->buf.out_size > XZBUFSIZ)
-	xzio->buf.out_size = XZBUFSIZ;
       /* Feed input.  */
       if (xzio->buf.in_pos == xzio->buf.in_size)
 	{
+	  grub_ssize_t readret;
+
 	  readret = grub_file_read (xzio->file, xzio->inbuf, XZBUFSIZ);
 	  if (readret < 0)
-	    return -1;
+	    return grub_errno;
+	  if (readret == 0)
+	    break;
 	  xzio->buf.in_size = readret;
 	  xzio->buf.in_pos = 0;
 	}
@@ -272,36 +333,150 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
 	case XZ_OPTIONS_ERROR:
 	case XZ_DATA_ERROR:
 	case XZ_BUF_ERROR:
-	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		      N_("xz file corrupted or unsupported block options"));
-	  return -1;
+	  /* Past the last block the decoder checks the index against the
+	     blocks it saw, which fails if it was made to skip some.  */
+	  if (xzio->buf.out_pos == size && xzio->cur_block != 0
+	      && xzio->cur_block == xzio->nblocks - 1)
+	    {
+	      xzio->cur_block = XZIO_NO_BLOCK;
+	      break;
+	    }
+	  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			     N_("xz file corrupted or unsupported block options"));
 	default:
 	  break;
 	}
 
-      {
-	grub_off_t new_offset = current_offset + xzio->buf.out_pos;
-	
-	if (file->offset <= new_offset)
-	  /* Store first chunk of data in buffer.  */
-	  {
-	    grub_size_t delta = new_offset - (file->offset + ret);
-	    grub_memmove (buf, xzio->buf.out + (xzio->buf.out_pos - delta),
-			  delta);
-	    len -= delta;
-	    buf += delta;
-	    ret += delta;
-	  }
-	current_offset = new_offset;
-      }
-      xzio->buf.out_pos = 0;
-
-      if (xzret == XZ_STREAM_END)	/* Stream end, EOF.  */
+      if (xzret == XZ_STREAM_END || xzio->cur_block == XZIO_NO_BLOCK)
 	break;
     }
 
-  if (ret >= 0)
-    xzio->saved_offset = file->offset + ret;
+  xzio->saved_offset += xzio->buf.out_pos;
+  if (xzio->buf.out_pos != size)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of compressed"));
+  return GRUB_ERR_NONE;
+}
+
+/* The decompressed data of block B, from the cache.  */
+static grub_uint8_t *
+get_cached_block (grub_xzio_t xzio, unsigned b)
+{
+  struct grub_xzio_cached *slot = &xzio->cache[0];
+  grub_size_t usize = xzio->blocks[b].usize;
+  unsigned i;
+
+  for (i = 0; i < XZIO_CACHE_SLOTS; i++)
+    {
+      if (xzio->cache[i].block == b)
+	{
+	  xzio->cache[i].last_use = ++xzio->use_count;
+	  return xzio->cache[i].data;
+	}
+      if (xzio->cache[i].last_use < slot->last_use)
+	slot = &xzio->cache[i];
+    }
+
+  slot->block = XZIO_NO_BLOCK;
+  if (slot->alloc < usize)
+    {
+      grub_free (slot->data);
+      slot->alloc = 0;
+      slot->data = grub_malloc (usize);
+      if (!slot->data)
+	return NULL;
+      slot->alloc = usize;
+    }
+
+  start_block (xzio, b);
+  if (decode (xzio, slot->data, usize))
+    return NULL;
+
+  slot->block = b;
+  slot->last_use = ++xzio->use_count;
+  return slot->data;
+}
+
+/* The block containing OFFSET.  */
+static unsigned
+find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  unsigned lo = 0, hi = xzio->nblocks;
+
+  while (hi - lo > 1)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (xzio->blocks[mid].ustart <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static grub_ssize_t
+grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+  grub_xzio_t xzio = file->data;
+
+  while (len > 0)
+    {
+      grub_off_t offset = file->offset + ret;
+      struct grub_xzio_block *block;
+      grub_off_t block_end;
+      grub_size_t n;
+      unsigned b;
+
+      if (offset >= file->size)
+	break;
+
+      b = find_block (xzio, offset);
+      block = &xzio->blocks[b];
+      block_end = block->ustart + block->usize;
+
+      if (block->usize <= XZIO_CACHE_BLOCK_MAX)
+	{
+	  grub_uint8_t *data = get_cached_block (xzio, b);
+
+	  if (!data)
+	    return -1;
+	  n = block_end - offset;
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, data + (offset - block->ustart), n);
+	}
+      else
+	{
+	  grub_off_t start;
+
+	  /* Going backwards restarts the block, going to another block
+	     jumps straight to it.  */
+	  if (b != xzio->cur_block || offset < xzio->saved_offset)
+	    start_block (xzio, b);
+
+	  start = xzio->saved_offset;
+	  n = block_end - start;
+	  if (n > XZBUFSIZ)
+	    n = XZBUFSIZ;
+	  if (decode (xzio, xzio->outbuf, n))
+	    {
+	      xzio->cur_block = XZIO_NO_BLOCK;
+	      return -1;
+	    }
+	  if (offset >= start + n)
+	    continue;
+	  n = start + n - offset;
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, xzio->outbuf + (offset - start), n);
+	}
+
+      buf += n;
+      len -= n;
+      ret += n;
+    }
 
   return ret;
 }
@@ -311,9 +486,14 @@ static grub_err_t
 grub_xzio_close (grub_file_t file)
 {
   grub_xzio_t xzio = file->data;
+  unsigned i;
 
   xz_dec_end (xzio->dec);
 
+  for (i = 0; i < XZIO_CACHE_SLOTS; i++)
+    grub_free (xzio->cache[i].data);
+  grub_free (xzio->blocks);
+
   grub_file_close (xzio->file);
   grub_free (xzio);
 
@@ -0,0 +1,519 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* The seek table of the zstd seekable format is a skippable frame at the
+   very end of the file, closed by this footer.  */
+#define ZSTDIO_SEEK_TABLE_MAGIC		0x184d2a5e
+#define ZSTDIO_SEEKABLE_MAGIC		0x8f92eab1
+#define ZSTDIO_SEEK_FOOTER_SIZE		9
+#define ZSTDIO_SEEK_CHECKSUM_FLAG	0x80
+#define ZSTDIO_SEEK_RESERVED		0x7c
+
+#define ZSTDIO_MAX_HEADER_SIZE		18
+
+/* Every frame starts with a fresh decoder, so a frame start is a place
+   decompression can be resumed from.  */
+struct grub_zstdio_frame
+{
+  grub_off_t cstart;
+  grub_off_t ustart;
+  grub_uint64_t usize;
+};
+
+struct grub_zstdio
+{
+  grub_file_t file;
+  grub_zstd_dctx_t dctx;
+
+  struct grub_zstdio_frame *frames;
+  unsigned nframes;
+  unsigned frames_alloc;
+
+  /* The frame being decoded and where its next block starts.  */
+  unsigned cur;
+  grub_off_t cpos;
+  int frame_done;
+
+  /* Output of the current frame.  WINDOW[0] is at offset WSTART of the
+     uncompressed data and WLEN bytes of it are valid.  At least KEEP
+     bytes are kept when it is shifted, as later blocks may refer to
+     them.  */
+  grub_uint8_t *window;
+  grub_size_t window_alloc;
+  grub_size_t keep;
+  grub_off_t wstart;
+  grub_size_t wlen;
+
+  grub_uint8_t inbuf[GRUB_ZSTD_BLOCK_MAX + 3];
+};
+
+typedef struct grub_zstdio *grub_zstdio_t;
+static struct grub_fs grub_zstdio_fs;
+
+static grub_err_t
+read_at (grub_zstdio_t zio, grub_off_t off, void *buf, grub_size_t len)
+{
+  grub_file_seek (zio->file, off);
+  if (grub_errno)
+    return grub_errno;
+  if (grub_file_read (zio->file, buf, len) != (grub_ssize_t) len)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, N_("premature end of file"));
+      return grub_errno;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_zstdio_frame *
+add_frame (grub_zstdio_t zio)
+{
+  if (zio->nframes == zio->frames_alloc)
+    {
+      struct grub_zstdio_frame *n;
+      unsigned alloc = zio->frames_alloc ? 2 * zio->frames_alloc : 16;
+
+      n = grub_realloc (zio->frames, alloc * sizeof (n[0]));
+      if (!n)
+	return NULL;
+      zio->frames = n;
+      zio->frames_alloc = alloc;
+    }
+  return &zio->frames[zio->nframes++];
+}
+
+/* Position the decoder at the start of frame IDX.  */
+static grub_err_t
+start_frame (grub_zstdio_t zio, unsigned idx)
+{
+  struct grub_zstdio_frame *f = &zio->frames[idx];
+  grub_uint8_t hdr[ZSTDIO_MAX_HEADER_SIZE];
+  struct grub_zstd_frame info;
+  grub_size_t hsize = sizeof (hdr);
+  grub_uint64_t keep, need;
+
+  if (hsize > zio->file->size - f->cstart)
+    hsize = zio->file->size - f->cstart;
+  if (read_at (zio, f->cstart, hdr, hsize)
+      || grub_zstd_read_frame_header (hdr, hsize, &info))
+    return grub_errno;
+
+  keep = info.window_size;
+  if (info.content_size != GRUB_ZSTD_SIZE_UNKNOWN
+      && info.content_size < keep)
+    keep = info.content_size;
+  /* Shift the window by at least a block at a time, but no more often
+     than every KEEP bytes, or the copying would dominate.  */
+  need = keep + (keep > GRUB_ZSTD_BLOCK_MAX ? keep : GRUB_ZSTD_BLOCK_MAX);
+  if (need != (grub_size_t) need)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+
+  if (need > zio->window_alloc)
+    {
+      grub_free (zio->window);
+      zio->window_alloc = 0;
+      zio->window = grub_malloc (need);
+      if (!zio->window)
+	return grub_errno;
+      zio->window_alloc = need;
+    }
+
+  grub_zstd_dctx_reset (zio->dctx);
+  zio->keep = keep;
+  zio->cur = idx;
+  zio->cpos = f->cstart + info.header_size;
+  zio->frame_done = 0;
+  zio->wstart = f->ustart;
+  zio->wlen = 0;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+decode_block (grub_zstdio_t zio)
+{
+  grub_uint32_t h;
+  grub_size_t bsize, used;
+  int last;
+
+  if (zio->frame_done)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of file"));
+
+  if (read_at (zio, zio->cpos, zio->inbuf, 3))
+    return grub_errno;
+  h = zio->inbuf[0] | (zio->inbuf[1] << 8) | (zio->inbuf[2] << 16);
+  bsize = (((h >> 1) & 3) == 1) ? 1 : (h >> 3);
+  if (bsize > GRUB_ZSTD_BLOCK_MAX)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("zstd data corrupted"));
+  if (read_at (zio, zio->cpos + 3, zio->inbuf + 3, bsize))
+    return grub_errno;
+
+  if (zio->wlen + GRUB_ZSTD_BLOCK_MAX > zio->window_alloc)
+    {
+      grub_size_t shift = zio->wlen - zio->keep;
+
+      grub_memmove (zio->window, zio->window + shift, zio->keep);
+      zio->wstart += shift;
+      zio->wlen = zio->keep;
+    }
+
+  if (grub_zstd_decode_block (zio->dctx, zio->inbuf, bsize + 3, &used, &last,
+			      zio->window, &zio->wlen, zio->window_alloc))
+    return grub_errno;
+
+  zio->cpos += used;
+  zio->frame_done = last;
+  return GRUB_ERR_NONE;
+}
+
+/* Find the compressed end of the frame whose header is at *POS by walking
+   its block headers.  */
+static grub_err_t
+skip_frame (grub_zstdio_t zio, grub_off_t *pos,
+	    const struct grub_zstd_frame *info)
+{
+  grub_off_t p = *pos + info->header_size;
+  grub_uint8_t bh[3];
+  grub_uint32_t h;
+
+  do
+    {
+      if (read_at (zio, p, bh, sizeof (bh)))
+	return grub_errno;
+      h = bh[0] | (bh[1] << 8) | (bh[2] << 16);
+      if (((h >> 1) & 3) == 3)
+	return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			   N_("zstd data corrupted"));
+      p += 3 + ((((h >> 1) & 3) == 1) ? 1 : (h >> 3));
+    }
+  while (!(h & 1));
+
+  /* The content checksum isn't verified, there's no xxh64 here.  */
+  if (info->checksum)
+    p += 4;
+  if (p > zio->file->size)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       N_("premature end of file"));
+  *pos = p;
+  return GRUB_ERR_NONE;
+}
+
+/* Build the frame index from the seek table, if the file has one.  */
+static int
+read_seek_table (grub_file_t file)
+{
+  grub_zstdio_t zio = file->data;
+  grub_uint8_t footer[ZSTDIO_SEEK_FOOTER_SIZE], hdr[8];
+  grub_uint8_t *entries, *e;
+  grub_uint32_t n, i;
+  grub_size_t esize;
+  grub_uint64_t tsize;
+  grub_off_t cpos = 0, upos = 0, tstart;
+
+  if (zio->file->size < ZSTDIO_SEEK_FOOTER_SIZE + 8
+      || read_at (zio, zio->file->size - ZSTDIO_SEEK_FOOTER_SIZE,
+		  footer, sizeof (footer)))
+    return 0;
+  if (grub_le_to_cpu32 (grub_get_unaligned32 (footer + 5))
+      != ZSTDIO_SEEKABLE_MAGIC
+      || (footer[4] & ZSTDIO_SEEK_RESERVED))
+    return 0;
+
+  n = grub_le_to_cpu32 (grub_get_unaligned32 (footer));
+  esize = (footer[4] & ZSTDIO_SEEK_CHECKSUM_FLAG) ? 12 : 8;
+  tsize = (grub_uint64_t) n * esize + ZSTDIO_SEEK_FOOTER_SIZE;
+  if (n == 0 || tsize + 8 > zio->file->size)
+    return 0;
+  tstart = zio->file->size - tsize - 8;
+
+  if (read_at (zio, tstart, hdr, sizeof (hdr))
+      || grub_le_to_cpu32 (grub_get_unaligned32 (hdr))
+      != ZSTDIO_SEEK_TABLE_MAGIC
+      || grub_le_to_cpu32 (grub_get_unaligned32 (hdr + 4)) != tsize)
+    return 0;
+
+  entries = grub_malloc (n * esize);
+  if (!entries)
+    return 0;
+  zio->frames = grub_malloc (n * sizeof (zio->frames[0]));
+  if (!zio->frames || read_at (zio, tstart + 8, entries, n * esize))
+    {
+      grub_free (entries);
+      return 0;
+    }
+  zio->frames_alloc = n;
+
+  for (i = 0, e = entries; i < n; i++, e += esize)
+    {
+      struct grub_zstdio_frame *f = &zio->frames[i];
+
+      f->cstart = cpos;
+      f->ustart = upos;
+      f->usize = grub_le_to_cpu32 (grub_get_unaligned32 (e + 4));
+      cpos += grub_le_to_cpu32 (grub_get_unaligned32 (e));
+      upos += f->usize;
+    }
+  grub_free (entries);
+
+  if (cpos != tstart)
+    return 0;
+
+  zio->nframes = n;
+  file->size = upos;
+  return 1;
+}
+
+/* Build the frame index by walking every frame.  Frames that don't record
+   their size have to be decompressed to find it.  */
+static int
+scan_frames (grub_file_t file)
+{
+  grub_zstdio_t zio = file->data;
+  grub_off_t pos = 0, upos = 0;
+
+  zio->nframes = 0;
+  while (pos + 4 <= zio->file->size)
+    {
+      grub_uint8_t hdr[ZSTDIO_MAX_HEADER_SIZE];
+      struct grub_zstd_frame info;
+      struct grub_zstdio_frame *f;
+      grub_size_t hsize = sizeof (hdr);
+      grub_uint32_t magic;
+
+      if (hsize > zio->file->size - pos)
+	hsize = zio->file->size - pos;
+      if (read_at (zio, pos, hdr, hsize))
+	return 0;
+      magic = grub_le_to_cpu32 (grub_get_unaligned32 (hdr));
+
+      if ((magic & GRUB_ZSTD_SKIPPABLE_MASK) == GRUB_ZSTD_SKIPPABLE_MAGIC)
+	{
+	  if (hsize < 8)
+	    return 0;
+	  pos += 8 + grub_le_to_cpu32 (grub_get_unaligned32 (hdr + 4));
+	  continue;
+	}
+      if (magic != GRUB_ZSTD_MAGIC)
+	break;
+
+      if (grub_zstd_read_frame_header (hdr, hsize, &info))
+	return 0;
+      f = add_frame (zio);
+      if (!f)
+	return 0;
+      f->cstart = pos;
+      f->ustart = upos;
+      f->usize = info.content_size;
+
+      if (info.content_size == GRUB_ZSTD_SIZE_UNKNOWN)
+	{
+	  if (start_frame (zio, zio->nframes - 1))
+	    return 0;
+	  while (!zio->frame_done)
+	    if (decode_block (zio))
+	      return 0;
+	  f->usize = zio->wstart + zio->wlen - f->ustart;
+	  pos = zio->cpos + (info.checksum ? 4 : 0);
+	}
+      else if (skip_frame (zio, &pos, &info))
+	return 0;
+
+      upos += f->usize;
+    }
+
+  if (zio->nframes == 0)
+    return 0;
+  file->size = upos;
+  return 1;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io,
+		  const char *name __attribute__ ((unused)))
+{
+  grub_file_t file;
+  grub_zstdio_t zio;
+  grub_uint32_t magic;
+
+  if (grub_file_tell (io) != 0)
+    grub_file_seek (io, 0);
+  if (grub_file_read (io, &magic, sizeof (magic)) != sizeof (magic)
+      || (grub_le_to_cpu32 (magic) != GRUB_ZSTD_MAGIC
+	  && ((grub_le_to_cpu32 (magic) & GRUB_ZSTD_SKIPPABLE_MASK)
+	      != GRUB_ZSTD_SKIPPABLE_MAGIC)))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      return io;
+    }
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  zio = grub_zalloc (sizeof (*zio));
+  if (!zio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  zio->file = io;
+
+  file->device = io->device;
+  file->data = zio;
+  file->fs = &grub_zstdio_fs;
+  file->size = GRUB_FILE_SIZE_UNKNOWN;
+  file->not_easily_seekable = 1;
+
+  zio->dctx = grub_zstd_dctx_new ();
+  if (zio->dctx && !read_seek_table (file))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      zio->nframes = 0;
+    }
+
+  /* FIXME: don't look at the end of not easily seekable files.  */
+  if (!zio->dctx || (!zio->nframes && !scan_frames (file))
+      || start_frame (zio, 0))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_zstd_dctx_free (zio->dctx);
+      grub_free (zio->frames);
+      grub_free (zio->window);
+      grub_free (zio);
+      grub_free (file);
+
+      return io;
+    }
+
+  return file;
+}
+
+/* Find the last non-empty frame starting at or before OFF.  */
+static unsigned
+find_frame (grub_zstdio_t zio, grub_off_t off)
+{
+  unsigned lo = 0, hi = zio->nframes;
+
+  while (hi - lo > 1)
+    {
+      unsigned mid = (lo + hi) / 2;
+
+      if (zio->frames[mid].ustart <= off)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_zstdio_t zio = file->data;
+  grub_ssize_t ret = 0;
+
+  while (len > 0)
+    {
+      grub_off_t off = file->offset + ret;
+      unsigned idx;
+
+      if (off >= file->size)
+	break;
+
+      /* Backwards or into another frame: jump to the frame's start.  */
+      idx = find_frame (zio, off);
+      if (idx != zio->cur || off < zio->wstart)
+	{
+	  if (start_frame (zio, idx))
+	    return -1;
+	  continue;
+	}
+
+      if (off < zio->wstart + zio->wlen)
+	{
+	  grub_size_t n = zio->wstart + zio->wlen - off;
+
+	  if (n > len)
+	    n = len;
+	  grub_memcpy (buf, zio->window + (off - zio->wstart), n);
+	  buf += n;
+	  len -= n;
+	  ret += n;
+	  continue;
+	}
+
+      if (decode_block (zio))
+	return -1;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zio = file->data;
+
+  grub_zstd_dctx_free (zio->dctx);
+  grub_free (zio->frames);
+  grub_free (zio->window);
+
+  grub_file_close (zio->file);
+  grub_free (zio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .dir = 0,
+  .open = 0,
+  .read = grub_zstdio_read,
+  .close = grub_zstdio_close,
+  .label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
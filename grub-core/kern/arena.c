@@ -0,0 +1,186 @@
+/* arena.c - bump allocator with bulk release */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/err.h>
+#include <grub/i18n.h>
+
+/* Arenas hand out memory from a list of chunks, newest first, bumping a
+   pointer in the newest one.  Requests too large to share a chunk get
+   one of their own behind it, so the newest one keeps filling up.  */
+
+#define ARENA_ALIGN		(2 * sizeof (void *))
+#define ARENA_DEFAULT_CHUNK	4000
+
+struct grub_arena_chunk
+{
+  struct grub_arena_chunk *next;
+  grub_size_t size;
+  grub_size_t used;
+};
+
+#define ARENA_CHUNK_HEADER \
+  ALIGN_UP (sizeof (struct grub_arena_chunk), ARENA_ALIGN)
+#define ARENA_CHUNK_DATA(c) ((char *) (c) + ARENA_CHUNK_HEADER)
+
+struct grub_arena
+{
+  struct grub_arena_chunk *chunks;
+  grub_size_t chunk_size;
+  /* The latest allocation, which may still grow in place.  */
+  char *last;
+};
+
+grub_arena_t
+grub_arena_new (grub_size_t chunk_size)
+{
+  grub_arena_t arena;
+
+  arena = grub_malloc (sizeof (*arena));
+  if (! arena)
+    return 0;
+  arena->chunks = 0;
+  arena->last = 0;
+  arena->chunk_size = ALIGN_UP (chunk_size ? : ARENA_DEFAULT_CHUNK,
+				ARENA_ALIGN);
+  return arena;
+}
+
+void
+grub_arena_destroy (grub_arena_t arena)
+{
+  struct grub_arena_chunk *c, *next;
+
+  if (! arena)
+    return;
+  for (c = arena->chunks; c; c = next)
+    {
+      next = c->next;
+      grub_free (c);
+    }
+  grub_free (arena);
+}
+
+void *
+grub_arena_alloc (grub_arena_t arena, grub_size_t size)
+{
+  struct grub_arena_chunk *c = arena->chunks;
+  char *ret;
+
+  if (size > ~(grub_size_t) 0 - ARENA_CHUNK_HEADER - ARENA_ALIGN)
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      return 0;
+    }
+  size = ALIGN_UP (size, ARENA_ALIGN);
+
+  if (c && c->size - c->used >= size)
+    {
+      ret = ARENA_CHUNK_DATA (c) + c->used;
+      c->used += size;
+      arena->last = ret;
+      return ret;
+    }
+
+  if (size > arena->chunk_size / 4)
+    {
+      c = grub_malloc (ARENA_CHUNK_HEADER + size);
+      if (! c)
+	return 0;
+      c->size = c->used = size;
+      if (arena->chunks)
+	{
+	  c->next = arena->chunks->next;
+	  arena->chunks->next = c;
+	}
+      else
+	{
+	  c->next = 0;
+	  arena->chunks = c;
+	}
+      return ARENA_CHUNK_DATA (c);
+    }
+
+  c = grub_malloc (ARENA_CHUNK_HEADER + arena->chunk_size);
+  if (! c)
+    return 0;
+  c->size = arena->chunk_size;
+  c->used = size;
+  c->next = arena->chunks;
+  arena->chunks = c;
+  arena->last = ARENA_CHUNK_DATA (c);
+  return arena->last;
+}
+
+void *
+grub_arena_zalloc (grub_arena_t arena, grub_size_t size)
+{
+  void *ret;
+
+  ret = grub_arena_alloc (arena, size);
+  if (ret)
+    grub_memset (ret, 0, size);
+  return ret;
+}
+
+void *
+grub_arena_realloc (grub_arena_t arena, void *ptr, grub_size_t old_size,
+		    grub_size_t new_size)
+{
+  struct grub_arena_chunk *c = arena->chunks;
+  void *ret;
+
+  if (! ptr)
+    return grub_arena_alloc (arena, new_size);
+
+  if (ptr == arena->last
+      && new_size <= c->size - ((char *) ptr - ARENA_CHUNK_DATA (c)))
+    {
+      c->used = ALIGN_UP ((char *) ptr - ARENA_CHUNK_DATA (c) + new_size,
+			  ARENA_ALIGN);
+      return ptr;
+    }
+
+  ret = grub_arena_alloc (arena, new_size);
+  if (ret)
+    grub_memcpy (ret, ptr, old_size < new_size ? old_size : new_size);
+  return ret;
+}
+
+char *
+grub_arena_strndup (grub_arena_t arena, const char *s, grub_size_t n)
+{
+  grub_size_t len;
+  char *ret;
+
+  for (len = 0; len < n && s[len]; len++);
+  ret = grub_arena_alloc (arena, len + 1);
+  if (! ret)
+    return 0;
+  grub_memcpy (ret, s, len);
+  ret[len] = '\0';
+  return ret;
+}
+
+char *
+grub_arena_strdup (grub_arena_t arena, const char *s)
+{
+  return grub_arena_strndup (arena, s, grub_strlen (s));
+}
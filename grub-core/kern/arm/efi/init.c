@@ -55,6 +55,7 @@ grub_machine_init (void)
   efi_call_3 (b->set_timer, tmr_evt, GRUB_EFI_TIMER_PERIODIC, 10000);
 
   grub_install_get_time_ms (grub_efi_get_time_ms);
+  grub_arm_timer_init ();
 }
 
 void
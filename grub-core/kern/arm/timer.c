@@ -0,0 +1,51 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/time.h>
+
+/* Virtual count of the generic timer, which the ARMv7 virtualization
+   extensions and later have.  */
+static grub_uint64_t
+grub_arm_get_cntvct (void)
+{
+  grub_uint32_t lo, hi;
+
+  __asm__ __volatile__ ("isb\n\tmrrc p15, 1, %0, %1, c14"
+			: "=r" (lo), "=r" (hi) : : "memory");
+  return (((grub_uint64_t) hi) << 32) | lo;
+}
+
+void
+grub_arm_timer_init (void)
+{
+  grub_uint32_t main_id, pfr1, freq;
+
+  /* ID_PFR1 only exists with the CPUID scheme.  */
+  __asm__ __volatile__ ("mrc p15, 0, %0, c0, c0, 0" : "=r" (main_id));
+  if (((main_id >> 16) & 0xf) != 0xf)
+    return;
+
+  __asm__ __volatile__ ("mrc p15, 0, %0, c0, c1, 1" : "=r" (pfr1));
+  if (((pfr1 >> 16) & 0xf) == 0)
+    return;
+
+  /* Set by the firmware, if at all.  */
+  __asm__ __volatile__ ("mrc p15, 0, %0, c14, c0, 0" : "=r" (freq));
+  grub_install_get_cycles (grub_arm_get_cntvct, freq, "CNTVCT");
+}
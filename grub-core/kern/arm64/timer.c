@@ -0,0 +1,41 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/time.h>
+
+static grub_uint64_t
+grub_arm64_get_cntvct (void)
+{
+  grub_uint64_t cnt;
+
+  __asm__ __volatile__ ("isb\n\tmrs %0, cntvct_el0" : "=r" (cnt) : : "memory");
+  return cnt;
+}
+
+void
+grub_arm_timer_init (void)
+{
+  grub_uint64_t freq;
+
+  /* The generic timer is always there, but the firmware may have left
+     its frequency unset.  */
+  __asm__ __volatile__ ("mrs %0, cntfrq_el0" : "=r" (freq));
+  grub_install_get_cycles (grub_arm64_get_cntvct, freq & 0xffffffff,
+			   "CNTVCT");
+}
@@ -21,6 +21,56 @@
 #include <grub/command.h>
 
 grub_command_t grub_command_list;
+unsigned grub_command_generation;
+
+/* The first, active, command of each name, hashed by name.  */
+#define COMMAND_HASH_SIZE	128
+
+static grub_command_t command_hash[COMMAND_HASH_SIZE];
+
+static unsigned
+command_hashval (const char *s)
+{
+  unsigned h = 2166136261U;
+
+  while (*s)
+    h = (h ^ (grub_uint8_t) *s++) * 16777619U;
+
+  return h & (COMMAND_HASH_SIZE - 1);
+}
+
+/* Hash NEW in place of OLD.  Either may be NULL.  */
+static void
+command_hash_replace (const char *name, grub_command_t old, grub_command_t new)
+{
+  grub_command_t *p = &command_hash[command_hashval (name)];
+
+  if (old)
+    {
+      grub_command_t *q;
+
+      for (q = p; *q != old; q = &(*q)->hash_next);
+      *q = old->hash_next;
+    }
+
+  if (new)
+    {
+      new->hash_next = *p;
+      *p = new;
+    }
+}
+
+grub_command_t
+grub_command_find (const char *name)
+{
+  grub_command_t cmd;
+
+  for (cmd = command_hash[command_hashval (name)]; cmd; cmd = cmd->hash_next)
+    if (grub_strcmp (cmd->name, name) == 0)
+      return cmd;
+
+  return 0;
+}
 
 grub_command_t
 grub_register_command_prio (const char *name,
@@ -72,7 +122,12 @@ grub_register_command_prio (const char *name,
   cmd->prev = p;
 
   if (! inactive)
-    cmd->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+    {
+      cmd->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+      command_hash_replace (name, (q && grub_strcmp (q->name, name) == 0)
+			    ? q : 0, cmd);
+    }
+  grub_command_generation++;
 
   return cmd;
 }
@@ -82,6 +137,12 @@ grub_unregister_command (grub_command_t cmd)
 {
   if ((cmd->prio & GRUB_COMMAND_FLAG_ACTIVE) && (cmd->next))
     cmd->next->prio |= GRUB_COMMAND_FLAG_ACTIVE;
+  if (grub_command_find (cmd->name) == cmd)
+    command_hash_replace (cmd->name, cmd,
+			  (cmd->next
+			   && grub_strcmp (cmd->next->name, cmd->name) == 0)
+			  ? cmd->next : 0);
   grub_list_remove (GRUB_AS_LIST (cmd));
+  grub_command_generation++;
   grub_free (cmd);
 }
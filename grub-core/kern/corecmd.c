@@ -68,7 +68,7 @@ grub_core_cmd_unset (struct grub_command *cmd __attribute__ ((unused)),
   return 0;
 }
 
-/* insmod MODULE */
+/* insmod MODULE... */
 static grub_err_t
 grub_core_cmd_insmod (struct grub_command *cmd __attribute__ ((unused)),
 		      int argc, char *argv[])
@@ -78,6 +78,13 @@ grub_core_cmd_insmod (struct grub_command *cmd __attribute__ ((unused)),
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
 
+  /* Several modules by name are resolved and read together.  */
+  if (argc > 1)
+    {
+      grub_dl_load_batch (argc, argv);
+      return 0;
+    }
+
   if (argv[0][0] == '/' || argv[0][0] == '(' || argv[0][0] == '+')
     mod = grub_dl_load_file (argv[0]);
   else
@@ -185,5 +192,5 @@ grub_register_core_commands (void)
   grub_register_command ("ls", grub_core_cmd_ls,
 			 N_("[ARG]"), N_("List devices or files."));
   grub_register_command ("insmod", grub_core_cmd_insmod,
-			 N_("MODULE"), N_("Insert a module."));
+			 N_("MODULE..."), N_("Insert modules."));
 }
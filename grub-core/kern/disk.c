@@ -25,15 +25,27 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/list.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
 
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+/* The table used until the cache is resized for the first time.  */
+static struct grub_disk_cache grub_disk_cache_default[GRUB_DISK_CACHE_NUM];
+
+struct grub_disk_cache *grub_disk_cache_table = grub_disk_cache_default;
+unsigned grub_disk_cache_sets = GRUB_DISK_CACHE_NUM / GRUB_DISK_CACHE_WAYS;
+
+/* Incremented on every cache access, used to find the least recently
+   used entry of a set.  */
+static unsigned long grub_disk_cache_clock;
 
 void (*grub_disk_firmware_fini) (void);
+void (*grub_disk_cache_invalidate_hook) (void);
+void (*grub_disk_profile_hook) (grub_disk_t disk, grub_disk_addr_t sector,
+				grub_off_t offset, grub_size_t size);
 int grub_disk_firmware_is_tainted;
 
 #if DISK_CACHE_STATS
@@ -46,7 +58,127 @@ grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
   *hits = grub_disk_cache_hits;
   *misses = grub_disk_cache_misses;
 }
+
+struct grub_disk_stats *grub_disk_stats_list;
+
+/* Find the statistics of DISK, creating them on first use.  */
+static struct grub_disk_stats *
+grub_disk_stats_get (grub_disk_t disk)
+{
+  struct grub_disk_stats *stats;
+
+  FOR_LIST_ELEMENTS (stats, grub_disk_stats_list)
+    if (stats->dev_id == disk->dev->id && stats->disk_id == disk->id)
+      return stats;
+
+  stats = grub_zalloc (sizeof (*stats));
+  if (! stats)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  stats->name = grub_strdup (disk->name);
+  if (! stats->name)
+    {
+      grub_free (stats);
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  stats->dev_id = disk->dev->id;
+  stats->disk_id = disk->id;
+  grub_list_push (GRUB_AS_LIST_P (&grub_disk_stats_list),
+		  GRUB_AS_LIST (stats));
+  return stats;
+}
+
+static void
+grub_disk_stats_device (grub_disk_t disk, grub_uint64_t sectors,
+			grub_uint64_t ms)
+{
+  struct grub_disk_stats *stats = disk->stats;
+  unsigned bucket;
+
+  if (! stats)
+    return;
+
+  stats->device_sectors += sectors;
+  stats->device_reads++;
+  stats->device_ms += ms;
+  for (bucket = 0; ms && bucket < GRUB_DISK_STATS_LATENCY_BUCKETS - 1;
+       bucket++)
+    ms >>= 1;
+  stats->latency[bucket]++;
+}
+#endif
+
+static inline void
+grub_disk_stats_request (grub_disk_t disk __attribute__ ((unused)),
+			 grub_size_t size __attribute__ ((unused)))
+{
+#if DISK_CACHE_STATS
+  if (disk->stats)
+    {
+      disk->stats->requests++;
+      disk->stats->bytes += size;
+    }
+#endif
+}
+
+/* Account the SIZE bytes at OFFSET in a cache block copied out of the
+   cache, as the sectors they touch.  */
+static inline void
+grub_disk_stats_cached (grub_disk_t disk __attribute__ ((unused)),
+			grub_off_t offset __attribute__ ((unused)),
+			grub_size_t size __attribute__ ((unused)))
+{
+#if DISK_CACHE_STATS
+  if (disk->stats && size)
+    disk->stats->cached_sectors
+      += ((offset + size - 1) >> GRUB_DISK_SECTOR_BITS)
+      - (offset >> GRUB_DISK_SECTOR_BITS) + 1;
+#endif
+}
+
+/* Call the read function of the driver, accounting the time spent.
+   SECTOR and SIZE are in device sectors.  */
+static grub_err_t
+grub_disk_dev_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+#if DISK_CACHE_STATS
+  grub_uint64_t start = grub_get_time_ms ();
+  grub_err_t err;
+
+  err = (disk->dev->read) (disk, sector, size, buf);
+  grub_disk_stats_device (disk, (grub_uint64_t) size
+			  << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS),
+			  grub_get_time_ms () - start);
+  return err;
+#else
+  return (disk->dev->read) (disk, sector, size, buf);
+#endif
+}
+
+static grub_err_t
+grub_disk_dev_read_vec (grub_disk_t disk, const struct grub_disk_vec *vec,
+			grub_size_t n)
+{
+#if DISK_CACHE_STATS
+  grub_uint64_t start = grub_get_time_ms ();
+  grub_uint64_t sectors = 0;
+  grub_size_t i;
+  grub_err_t err;
+
+  err = (disk->dev->read_vec) (disk, vec, n);
+  for (i = 0; i < n; i++)
+    sectors += (grub_uint64_t) vec[i].size
+      << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
+  grub_disk_stats_device (disk, sectors, grub_get_time_ms () - start);
+  return err;
+#else
+  return (disk->dev->read_vec) (disk, vec, n);
 #endif
+}
 
 grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    grub_disk_addr_t sector,
@@ -60,7 +192,7 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
@@ -70,6 +202,74 @@ grub_disk_cache_invalidate_all (void)
 	  cache->data = 0;
 	}
     }
+
+  grub_file_cache_flush ();
+  grub_partition_cache_flush ();
+
+  if (grub_disk_cache_invalidate_hook)
+    grub_disk_cache_invalidate_hook ();
+}
+
+grub_size_t
+grub_disk_cache_shrink (grub_size_t bytes)
+{
+  grub_size_t freed = 0;
+  unsigned i;
+
+  while (freed < bytes)
+    {
+      struct grub_disk_cache *victim = 0;
+
+      for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
+	{
+	  struct grub_disk_cache *cache = grub_disk_cache_table + i;
+
+	  if (cache->data && ! cache->lock
+	      && (! victim || cache->last_used < victim->last_used))
+	    victim = cache;
+	}
+      if (! victim)
+	break;
+
+      grub_free (victim->data);
+      victim->data = 0;
+      freed += GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS;
+    }
+
+  return freed;
+}
+
+grub_err_t
+grub_disk_cache_resize (unsigned num)
+{
+  struct grub_disk_cache *table;
+  unsigned sets, i;
+
+  if (num > GRUB_DISK_CACHE_MAX_NUM)
+    num = GRUB_DISK_CACHE_MAX_NUM;
+  sets = (num + GRUB_DISK_CACHE_WAYS - 1) / GRUB_DISK_CACHE_WAYS;
+  if (sets == 0)
+    sets = 1;
+
+  if (sets == grub_disk_cache_sets)
+    return GRUB_ERR_NONE;
+
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
+    if (grub_disk_cache_table[i].lock)
+      return grub_error (GRUB_ERR_BAD_ARGUMENT, "disk cache is in use");
+
+  table = grub_zalloc (sets * GRUB_DISK_CACHE_WAYS * sizeof (*table));
+  if (! table)
+    return grub_errno;
+
+  grub_disk_cache_invalidate_all ();
+  if (grub_disk_cache_table != grub_disk_cache_default)
+    grub_free (grub_disk_cache_table);
+
+  grub_disk_cache_table = table;
+  grub_disk_cache_sets = sets;
+
+  return GRUB_ERR_NONE;
 }
 
 static char *
@@ -77,15 +277,12 @@ grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
+      cache->last_used = ++grub_disk_cache_clock;
 #if DISK_CACHE_STATS
       grub_disk_cache_hits++;
 #endif
@@ -104,13 +301,9 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
@@ -118,31 +311,53 @@ static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
-  struct grub_disk_cache *cache;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  struct grub_disk_cache *set, *cache;
+  unsigned i;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  /* Prefer the entry already holding SECTOR, then an empty one, then the
+     least recently used one which isn't locked.  */
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
+  if (! cache)
+    {
+      set = grub_disk_cache_table + grub_disk_cache_get_index (dev_id, disk_id,
+							       sector);
+      for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+	{
+	  if (set[i].lock)
+	    continue;
+	  if (! set[i].data)
+	    {
+	      cache = set + i;
+	      break;
+	    }
+	  if (! cache || set[i].last_used < cache->last_used)
+	    cache = set + i;
+	}
+      if (! cache)
+	return GRUB_ERR_NONE;
+    }
+  else if (cache->lock)
+    return GRUB_ERR_NONE;
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  /* All entries have the same size, so reuse the evicted buffer.  */
   if (! cache->data)
-    return grub_errno;
+    {
+      cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+      if (! cache->data)
+	return grub_errno;
+    }
 
   grub_memcpy (cache->data, data,
 	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->last_used = ++grub_disk_cache_clock;
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -248,6 +463,10 @@ grub_disk_open (const char *name)
 
   disk->dev = dev;
 
+#if DISK_CACHE_STATS
+  disk->stats = grub_disk_stats_get (disk);
+#endif
+
   if (p)
     {
       disk->partition = grub_partition_probe (disk, p + 1);
@@ -326,6 +545,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     {
       /* Just copy it!  */
       grub_memcpy (buf, data + offset, size);
+      grub_disk_stats_cached (disk, offset, size);
       grub_disk_cache_unlock (disk->dev->id, disk->id, sector);
       return GRUB_ERR_NONE;
     }
@@ -341,7 +561,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
-      err = (disk->dev->read) (disk, transform_sector (disk, sector),
+      err = grub_disk_dev_read (disk, transform_sector (disk, sector),
 			       1U << (GRUB_DISK_CACHE_BITS
 				      + GRUB_DISK_SECTOR_BITS
 				      - disk->log_sector_size), tmp_buf);
@@ -377,7 +597,7 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
     if (!tmp_buf)
       return grub_errno;
     
-    if ((disk->dev->read) (disk, transform_sector (disk, aligned_sector),
+    if (grub_disk_dev_read (disk, transform_sector (disk, aligned_sector),
 			   num, tmp_buf))
       {
 	grub_error_push ();
@@ -408,10 +628,93 @@ grub_disk_read_small (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
-/* Read data from the disk.  */
-grub_err_t
-grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		grub_off_t offset, grub_size_t size, void *buf)
+/* Track sequential streams of reads.  When a read in such a stream misses
+   the cache, fill the cache with a whole window of blocks in a single
+   request instead of one block at a time.  The window doubles with every
+   such miss and is halved when the stream is interrupted.  */
+static void
+grub_disk_read_ahead (grub_disk_t disk, grub_disk_addr_t sector,
+		      grub_off_t offset, grub_size_t size)
+{
+  grub_disk_addr_t start, end;
+  unsigned n, i;
+  char *tmp_buf;
+
+  end = sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+		  >> GRUB_DISK_SECTOR_BITS);
+  if (sector != disk->read_ahead_next)
+    {
+      disk->read_ahead_window >>= 1;
+      disk->read_ahead_next = end;
+      return;
+    }
+  disk->read_ahead_next = end;
+
+  start = sector & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  if (grub_disk_cache_lookup (disk->dev->id, disk->id, start))
+    return;
+
+  n = disk->read_ahead_window;
+  if (n < GRUB_DISK_READ_AHEAD_MIN)
+    n = GRUB_DISK_READ_AHEAD_MIN;
+  disk->read_ahead_window = n * 2;
+  if (disk->read_ahead_window > GRUB_DISK_READ_AHEAD_MAX)
+    disk->read_ahead_window = GRUB_DISK_READ_AHEAD_MAX;
+
+  /* Large reads are agglomerated by the caller anyway.  */
+  if (end - start >= ((grub_disk_addr_t) n << GRUB_DISK_CACHE_BITS))
+    return;
+
+  if (n > disk->max_agglomerate)
+    n = disk->max_agglomerate;
+  if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN)
+    {
+      grub_disk_addr_t total;
+
+      total = disk->total_sectors << (disk->log_sector_size
+				      - GRUB_DISK_SECTOR_BITS);
+      if (start >= total)
+	return;
+      if (((total - start) >> GRUB_DISK_CACHE_BITS) < n)
+	n = (total - start) >> GRUB_DISK_CACHE_BITS;
+    }
+
+  /* Don't read again what is already cached.  */
+  for (i = 1; i < n; i++)
+    if (grub_disk_cache_lookup (disk->dev->id, disk->id,
+				start + (i << GRUB_DISK_CACHE_BITS)))
+      break;
+  n = i;
+  if (n < 2)
+    return;
+
+  tmp_buf = grub_malloc (n << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+  if (! tmp_buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if (grub_disk_dev_read (disk, transform_sector (disk, start),
+			 n << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+			       - disk->log_sector_size),
+			 tmp_buf) == GRUB_ERR_NONE)
+    for (i = 0; i < n; i++)
+      grub_disk_cache_store (disk->dev->id, disk->id,
+			     start + (i << GRUB_DISK_CACHE_BITS),
+			     tmp_buf + (i << (GRUB_DISK_CACHE_BITS
+					      + GRUB_DISK_SECTOR_BITS)));
+  else
+    disk->read_ahead_window = 0;
+
+  /* Errors are reported by the real read, if at all.  */
+  grub_free (tmp_buf);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_disk_read_real (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size, void *buf)
 {
   /* First of all, check if the region is within the disk.  */
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
@@ -423,6 +726,21 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  grub_disk_stats_request (disk, size);
+
+  /* Memory-backed devices have nothing to gain from the cache.  */
+  if (disk->dev->map)
+    {
+      grub_memcpy (buf, disk->dev->map (disk, sector) + offset, size);
+      if (disk->read_hook)
+	(disk->read_hook) (sector + (offset >> GRUB_DISK_SECTOR_BITS),
+			   offset & (GRUB_DISK_SECTOR_SIZE - 1),
+			   size, disk->read_hook_data);
+      return GRUB_ERR_NONE;
+    }
+
+  grub_disk_read_ahead (disk, sector, offset, size);
+
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -474,6 +792,8 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		       + (agglomerate << (GRUB_DISK_CACHE_BITS
 					  + GRUB_DISK_SECTOR_BITS)),
 		       data, GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
+	  grub_disk_stats_cached (disk, 0,
+				  GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS);
 	  grub_disk_cache_unlock (disk->dev->id, disk->id,
 				  sector + (agglomerate
 					    << GRUB_DISK_CACHE_BITS));
@@ -483,15 +803,16 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	{
 	  grub_disk_addr_t i;
 
-	  err = (disk->dev->read) (disk, transform_sector (disk, sector),
+	  err = grub_disk_dev_read (disk, transform_sector (disk, sector),
 				   agglomerate << (GRUB_DISK_CACHE_BITS
 						   + GRUB_DISK_SECTOR_BITS
 						   - disk->log_sector_size),
 				   buf);
 	  if (err)
 	    return err;
-	  
-	  for (i = 0; i < agglomerate; i ++)
+
+	  /* Bulk data which is read only once isn't worth caching.  */
+	  for (i = 0; ! disk->streaming && i < agglomerate; i ++)
 	    grub_disk_cache_store (disk->dev->id, disk->id,
 				   sector + (i << GRUB_DISK_CACHE_BITS),
 				   (char *) buf
@@ -532,6 +853,550 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Read data from the disk.  */
+grub_err_t
+grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_err_t err;
+
+  grub_trace_enter (GRUB_TRACE_DISK_READ, 0, size);
+  if (grub_disk_profile_hook && ! disk->streaming)
+    grub_disk_profile_hook (disk, sector, offset, size);
+  err = grub_disk_read_real (disk, sector, offset, size, buf);
+  grub_trace_exit (GRUB_TRACE_DISK_READ, 0, size);
+  return err;
+}
+
+/* Return the address in memory of SIZE bytes at SECTOR and OFFSET of DISK,
+   relative to its partition, or NULL if DISK isn't in memory or the range
+   is out of it.  */
+void *
+grub_disk_map (grub_disk_t disk, grub_disk_addr_t sector,
+	       grub_off_t offset, grub_size_t size)
+{
+  if (! disk->dev->map)
+    return NULL;
+  if (grub_disk_adjust_range (disk, &sector, &offset, size))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return NULL;
+    }
+  return disk->dev->map (disk, sector) + offset;
+}
+
+/* Append SIZE bytes at SECTOR of DISK, relative to its partition, to the
+   device vector DVEC of *ND pieces, merging them into the last piece if
+   they follow it both on disk and in memory.  Returns 1 if the range is
+   out of DISK or isn't aligned to device sectors, and so must go through
+   grub_disk_read, and -1 if out of memory.  */
+static int
+grub_disk_vec_add (grub_disk_t disk, struct grub_disk_vec **dvec,
+		   grub_size_t *nd, grub_size_t *alloc,
+		   grub_disk_addr_t sector, grub_size_t size, char *buf)
+{
+  grub_size_t max, mask;
+  grub_off_t offset = 0;
+
+  max = (grub_size_t) disk->max_agglomerate
+    << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - disk->log_sector_size);
+  mask = (1 << disk->log_sector_size) - 1;
+
+  if (grub_disk_adjust_range (disk, &sector, &offset, size))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 1;
+    }
+
+  if ((sector & (mask >> GRUB_DISK_SECTOR_BITS)) || (size & mask))
+    return 1;
+
+  sector = transform_sector (disk, sector);
+  size >>= disk->log_sector_size;
+
+  while (size)
+    {
+      grub_size_t len = size;
+      struct grub_disk_vec *last = *nd ? *dvec + *nd - 1 : NULL;
+
+      if (last && last->sector + last->size == sector
+	  && last->buf + (last->size << disk->log_sector_size) == buf
+	  && last->size < max)
+	{
+	  if (len > max - last->size)
+	    len = max - last->size;
+	  last->size += len;
+	}
+      else
+	{
+	  if (*nd == *alloc)
+	    {
+	      struct grub_disk_vec *t;
+	      grub_size_t a = *alloc ? 2 * *alloc : 16;
+
+	      t = grub_realloc (*dvec, a * sizeof (t[0]));
+	      if (! t)
+		return -1;
+	      *dvec = t;
+	      *alloc = a;
+	    }
+	  if (len > max)
+	    len = max;
+	  (*dvec)[*nd].sector = sector;
+	  (*dvec)[*nd].size = len;
+	  (*dvec)[*nd].buf = buf;
+	  (*nd)++;
+	}
+
+      sector += len;
+      size -= len;
+      buf += len << disk->log_sector_size;
+    }
+  return 0;
+}
+
+/* Read the N pieces described by VEC.  Pieces aligned to device sectors
+   are passed to the read_vec callback of the device, if any, bypassing
+   the cache, with neighbours contiguous both on disk and in memory merged
+   together.  Everything else goes through grub_disk_read.  */
+grub_err_t
+grub_disk_read_vec (grub_disk_t disk, const struct grub_disk_vec *vec,
+		    grub_size_t n)
+{
+  struct grub_disk_vec *dvec = NULL;
+  grub_size_t i, nd = 0, alloc = 0;
+
+  if (! disk->dev->read_vec)
+    {
+      for (i = 0; i < n; i++)
+	if (grub_disk_read (disk, vec[i].sector, 0, vec[i].size, vec[i].buf))
+	  return grub_errno;
+      return GRUB_ERR_NONE;
+    }
+
+  for (i = 0; i < n; i++)
+    switch (grub_disk_vec_add (disk, &dvec, &nd, &alloc, vec[i].sector,
+			       vec[i].size, vec[i].buf))
+      {
+      case 0:
+	break;
+      case 1:
+	if (grub_disk_read (disk, vec[i].sector, 0, vec[i].size, vec[i].buf))
+	  goto fail;
+	break;
+      default:
+	goto fail;
+      }
+
+  if (nd && grub_disk_dev_read_vec (disk, dvec, nd) == GRUB_ERR_NONE
+      && disk->read_hook)
+    for (i = 0; i < nd; i++)
+      (disk->read_hook) (dvec[i].sector << (disk->log_sector_size
+					    - GRUB_DISK_SECTOR_BITS),
+			 0, dvec[i].size << disk->log_sector_size,
+			 disk->read_hook_data);
+
+ fail:
+  grub_free (dvec);
+  return grub_errno;
+}
+
+/* Reads queued by grub_disk_queue_read, in submission order.  */
+static struct grub_disk_request *grub_disk_queue;
+static struct grub_disk_request **grub_disk_queue_tail = &grub_disk_queue;
+
+void
+grub_disk_queue_read (struct grub_disk_request *req)
+{
+  req->next = NULL;
+  *grub_disk_queue_tail = req;
+  grub_disk_queue_tail = &req->next;
+}
+
+/* Elevator order: by physical disk, then by position on it.  */
+static int
+grub_disk_request_before (const struct grub_disk_request *a,
+			  const struct grub_disk_request *b)
+{
+  grub_disk_addr_t sa, sb;
+
+  if (a->disk->dev->id != b->disk->dev->id)
+    return a->disk->dev->id < b->disk->dev->id;
+  if (a->disk->id != b->disk->id)
+    return a->disk->id < b->disk->id;
+  sa = a->sector + grub_partition_get_start (a->disk->partition);
+  sb = b->sector + grub_partition_get_start (b->disk->partition);
+  return sa < sb;
+}
+
+static void
+grub_disk_request_done (struct grub_disk_request *req, grub_err_t err)
+{
+  grub_errno = GRUB_ERR_NONE;
+  if (req->done)
+    req->done (req, err);
+}
+
+/* Issue the N requests of REQS, all for the same physical disk and in
+   elevator order, as one vector if the device can take it.  */
+static void
+grub_disk_run_group (struct grub_disk_request **reqs, grub_size_t n)
+{
+  grub_disk_t disk = reqs[0]->disk;
+  struct grub_disk_vec *dvec = NULL;
+  char *direct;
+  grub_size_t i, nd = 0, alloc = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  direct = grub_zalloc (n);
+  if (n > 1 && disk->dev->read_vec && direct)
+    {
+      for (i = 0; i < n; i++)
+	{
+	  if (reqs[i]->disk->log_sector_size != disk->log_sector_size
+	      || reqs[i]->disk->max_agglomerate != disk->max_agglomerate)
+	    continue;
+	  switch (grub_disk_vec_add (reqs[i]->disk, &dvec, &nd, &alloc,
+				     reqs[i]->sector, reqs[i]->size,
+				     reqs[i]->buf))
+	    {
+	    case 0:
+	      direct[i] = 1;
+	      break;
+	    case 1:
+	      break;
+	    default:
+	      grub_errno = GRUB_ERR_NONE;
+	      grub_memset (direct, 0, n);
+	      nd = 0;
+	      i = n;
+	      break;
+	    }
+	}
+      if (nd)
+	err = grub_disk_dev_read_vec (disk, dvec, nd);
+      grub_free (dvec);
+      /* Without per-piece results, redo them one by one to find which
+	 failed.  */
+      if (err)
+	grub_memset (direct, 0, n);
+    }
+
+  for (i = 0; i < n; i++)
+    {
+      if (direct && direct[i])
+	{
+	  grub_disk_t d = reqs[i]->disk;
+
+	  /* grub_disk_read calls the hook itself.  */
+	  if (d->read_hook)
+	    (d->read_hook) (reqs[i]->sector
+			    + grub_partition_get_start (d->partition),
+			    0, reqs[i]->size, d->read_hook_data);
+	  grub_disk_request_done (reqs[i], GRUB_ERR_NONE);
+	  continue;
+	}
+      err = grub_disk_read (reqs[i]->disk, reqs[i]->sector, 0, reqs[i]->size,
+			    reqs[i]->buf);
+      grub_disk_request_done (reqs[i], err);
+    }
+  grub_free (direct);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Issue every queued read: demand reads first, then read-ahead, each
+   class sorted by disk and position and sent to each disk as a single
+   vector, so that the device may overlap and merge them.  The callbacks
+   of the requests get the results.  */
+grub_err_t
+grub_disk_run_queue (void)
+{
+  struct grub_disk_request *queue, *req, **reqs = NULL;
+  grub_size_t n, count, nclass[2], i, j, first;
+  int readahead;
+
+  while (grub_disk_queue)
+    {
+      queue = grub_disk_queue;
+      grub_disk_queue = NULL;
+      grub_disk_queue_tail = &grub_disk_queue;
+
+      for (count = 0, req = queue; req; req = req->next)
+	count++;
+      reqs = grub_malloc (count * sizeof (reqs[0]));
+      if (! reqs)
+	{
+	  /* Issue them in order one by one.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  while (queue)
+	    {
+	      req = queue;
+	      queue = req->next;
+	      grub_disk_run_group (&req, 1);
+	    }
+	  continue;
+	}
+
+      /* Sort both classes before issuing anything: callbacks may free
+	 their requests.  */
+      nclass[0] = 0;
+      for (req = queue; req; req = req->next)
+	if (! req->readahead)
+	  nclass[0]++;
+      nclass[1] = count - nclass[0];
+      for (readahead = 0; readahead < 2; readahead++)
+	{
+	  struct grub_disk_request **r = reqs + (readahead ? nclass[0] : 0);
+
+	  n = 0;
+	  for (req = queue; req; req = req->next)
+	    if (!! req->readahead == readahead)
+	      {
+		for (j = n; j > 0 && grub_disk_request_before (req, r[j - 1]);
+		     j--)
+		  r[j] = r[j - 1];
+		r[j] = req;
+		n++;
+	      }
+	}
+
+      for (readahead = 0; readahead < 2; readahead++)
+	{
+	  struct grub_disk_request **r = reqs + (readahead ? nclass[0] : 0);
+
+	  n = nclass[readahead];
+	  for (first = 0, i = 1; i <= n; i++)
+	    if (i == n
+		|| r[i]->disk->dev->id != r[first]->disk->dev->id
+		|| r[i]->disk->id != r[first]->disk->id)
+	      {
+		grub_disk_run_group (r + first, i - first);
+		first = i;
+	      }
+	}
+      grub_free (reqs);
+      /* Callbacks may have queued more.  */
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* A run of cache blocks read by grub_disk_preload.  */
+struct grub_disk_preload_request
+{
+  struct grub_disk_request req;
+  /* The first block, from the start of the disk.  */
+  grub_disk_addr_t start;
+  unsigned n;
+};
+
+static void
+grub_disk_preload_done (struct grub_disk_request *req, grub_err_t err)
+{
+  struct grub_disk_preload_request *p
+    = (struct grub_disk_preload_request *) req;
+  unsigned i;
+
+  for (i = 0; err == GRUB_ERR_NONE && i < p->n; i++)
+    grub_disk_cache_store (req->disk->dev->id, req->disk->id,
+			   p->start + (i << GRUB_DISK_CACHE_BITS),
+			   (char *) req->buf + (i << (GRUB_DISK_CACHE_BITS
+						      + GRUB_DISK_SECTOR_BITS)));
+  grub_free (req->buf);
+  grub_free (p);
+}
+
+/* Queue read-ahead requests for the cache blocks covering SIZE bytes at
+   SECTOR of DISK which aren't cached yet, in runs as long as
+   max_agglomerate allows.  They are read by the next grub_disk_run_queue,
+   before which DISK must not be closed.  This is only a hint and errors
+   are ignored.  */
+void
+grub_disk_preload (grub_disk_t disk, grub_disk_addr_t sector,
+		   grub_size_t size)
+{
+  grub_disk_addr_t end, total;
+  grub_off_t offset = 0;
+  unsigned n;
+
+  if (! size || disk->log_sector_size > (GRUB_DISK_CACHE_BITS
+					 + GRUB_DISK_SECTOR_BITS))
+    return;
+  if (grub_disk_adjust_range (disk, &sector, &offset, size))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  end = ALIGN_UP (sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+			    >> GRUB_DISK_SECTOR_BITS), GRUB_DISK_CACHE_SIZE);
+  sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN)
+    {
+      total = disk->total_sectors << (disk->log_sector_size
+				      - GRUB_DISK_SECTOR_BITS);
+      total &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+      if (end > total)
+	end = total;
+    }
+
+  while (sector < end)
+    {
+      struct grub_disk_preload_request *p;
+
+      if (grub_disk_cache_lookup (disk->dev->id, disk->id, sector))
+	{
+	  sector += GRUB_DISK_CACHE_SIZE;
+	  continue;
+	}
+
+      /* The run of blocks missing from the cache.  */
+      for (n = 1; n < disk->max_agglomerate
+	     && sector + ((grub_disk_addr_t) n << GRUB_DISK_CACHE_BITS) < end;
+	   n++)
+	if (grub_disk_cache_lookup (disk->dev->id, disk->id,
+				    sector + (n << GRUB_DISK_CACHE_BITS)))
+	  break;
+
+      p = grub_zalloc (sizeof (*p));
+      if (! p)
+	break;
+      p->req.buf = grub_malloc (n << (GRUB_DISK_CACHE_BITS
+				      + GRUB_DISK_SECTOR_BITS));
+      if (! p->req.buf)
+	{
+	  grub_free (p);
+	  break;
+	}
+      p->req.disk = disk;
+      p->req.sector = sector - grub_partition_get_start (disk->partition);
+      p->req.size = n << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+      p->req.readahead = 1;
+      p->req.done = grub_disk_preload_done;
+      p->start = sector;
+      p->n = n;
+      grub_disk_queue_read (&p->req);
+
+      sector += (grub_disk_addr_t) n << GRUB_DISK_CACHE_BITS;
+    }
+
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Bring the cache blocks covering SIZE bytes at SECTOR of each of the N
+   DISKS into the cache, overlapping the reads of all disks whose device
+   can do so.  This is only a hint: nothing is read from devices without
+   read_multi and errors are ignored.  */
+void
+grub_disk_prefetch (grub_disk_t *disks, grub_size_t n,
+		    grub_disk_addr_t sector, grub_size_t size)
+{
+  grub_disk_t *group = NULL;
+  struct grub_disk_vec *vec = NULL;
+  grub_disk_addr_t *start = NULL;
+  char *handled = NULL, *done = NULL;
+  grub_size_t i, j, k;
+
+  if (n < 2)
+    return;
+
+  group = grub_malloc (n * sizeof (group[0]));
+  vec = grub_malloc (n * sizeof (vec[0]));
+  start = grub_malloc (n * sizeof (start[0]));
+  handled = grub_zalloc (n);
+  done = grub_malloc (n);
+  if (! group || ! vec || ! start || ! handled || ! done)
+    goto out;
+
+  for (i = 0; i < n; i++)
+    {
+      grub_disk_dev_t dev = disks[i]->dev;
+
+      if (handled[i])
+	continue;
+
+      k = 0;
+      for (j = i; j < n; j++)
+	{
+	  grub_disk_t disk = disks[j];
+	  grub_disk_addr_t s = sector, end, total;
+	  grub_off_t offset = 0;
+	  grub_size_t blocks;
+
+	  if (handled[j] || disk->dev != dev)
+	    continue;
+	  handled[j] = 1;
+
+	  if (! dev->read_multi
+	      || disk->log_sector_size > (GRUB_DISK_CACHE_BITS
+					  + GRUB_DISK_SECTOR_BITS))
+	    continue;
+
+	  if (grub_disk_adjust_range (disk, &s, &offset, size))
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      continue;
+	    }
+
+	  end = ALIGN_UP (s + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+			       >> GRUB_DISK_SECTOR_BITS), GRUB_DISK_CACHE_SIZE);
+	  s &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+	  total = disk->total_sectors << (disk->log_sector_size
+					  - GRUB_DISK_SECTOR_BITS);
+	  if (total > (1ULL << 51))
+	    total = (1ULL << 51);
+	  while (end > s && end > total)
+	    end -= GRUB_DISK_CACHE_SIZE;
+	  blocks = (end - s) >> GRUB_DISK_CACHE_BITS;
+	  if (blocks > disk->max_agglomerate)
+	    blocks = disk->max_agglomerate;
+	  if (! blocks
+	      || grub_disk_cache_lookup (dev->id, disk->id, s))
+	    continue;
+
+	  vec[k].buf = grub_malloc (blocks << (GRUB_DISK_CACHE_BITS
+					       + GRUB_DISK_SECTOR_BITS));
+	  if (! vec[k].buf)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      continue;
+	    }
+	  vec[k].sector = transform_sector (disk, s);
+	  vec[k].size = blocks << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+				   - disk->log_sector_size);
+	  start[k] = s;
+	  group[k] = disk;
+	  done[k] = 0;
+	  k++;
+	}
+
+      if (k)
+	(dev->read_multi) (group, vec, k, done);
+
+      for (j = 0; j < k; j++)
+	{
+	  grub_size_t b, blocks;
+
+	  blocks = vec[j].size >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+				   - group[j]->log_sector_size);
+	  for (b = 0; done[j] && b < blocks; b++)
+	    grub_disk_cache_store (dev->id, group[j]->id,
+				   start[j] + (b << GRUB_DISK_CACHE_BITS),
+				   vec[j].buf + (b << (GRUB_DISK_CACHE_BITS
+						       + GRUB_DISK_SECTOR_BITS)));
+	  grub_free (vec[j].buf);
+	}
+    }
+
+ out:
+  grub_free (group);
+  grub_free (vec);
+  grub_free (start);
+  grub_free (handled);
+  grub_free (done);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 grub_uint64_t
 grub_disk_get_size (grub_disk_t disk)
 {
@@ -55,11 +55,30 @@ transform_sector (grub_disk_t disk, grub_disk_addr_t sector)
   return sector >> (disk->log_sector_size - GRUB_DISK_SECTOR_BITS);
 }
 
+/* Return the index of the first entry of the set SECTOR belongs to.  */
 static unsigned
 grub_disk_cache_get_index (unsigned long dev_id, unsigned long disk_id,
 			   grub_disk_addr_t sector)
 {
   return ((dev_id * 524287UL + disk_id * 2606459UL
 	   + ((unsigned) (sector >> GRUB_DISK_CACHE_BITS)))
-	  % GRUB_DISK_CACHE_NUM);
+	  % grub_disk_cache_sets) * GRUB_DISK_CACHE_WAYS;
+}
+
+/* Return the cache entry holding SECTOR or NULL if it isn't cached.  */
+static struct grub_disk_cache *
+grub_disk_cache_lookup (unsigned long dev_id, unsigned long disk_id,
+			grub_disk_addr_t sector)
+{
+  struct grub_disk_cache *set;
+  unsigned i;
+
+  set = grub_disk_cache_table + grub_disk_cache_get_index (dev_id, disk_id,
+							   sector);
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    if (set[i].data && set[i].dev_id == dev_id && set[i].disk_id == disk_id
+	&& set[i].sector == sector)
+      return set + i;
+
+  return NULL;
 }
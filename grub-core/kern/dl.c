@@ -33,6 +33,8 @@
 #include <grub/cache.h>
 #include <grub/i18n.h>
 #include <grub/tpm.h>
+#include <grub/kernel.h>
+#include <grub/time.h>
 
 /* Platforms where modules are in a readonly area of memory.  */
 #if defined(GRUB_MACHINE_QEMU)
@@ -89,48 +91,92 @@ struct grub_symbol
   void *addr;
   int isfunc;
   grub_dl_t mod;	/* The module to which this symbol belongs.  */
+  grub_uint32_t hash;	/* Of the name, before reducing to a bucket.  */
 };
 typedef struct grub_symbol *grub_symbol_t;
 
-/* The size of the symbol table.  */
-#define GRUB_SYMTAB_SIZE	509
+/* The initial number of buckets, a power of two.  The table doubles
+   whenever it holds more symbols than buckets.  */
+#define GRUB_SYMTAB_INITIAL_SIZE	1024
 
 /* The symbol table (using an open-hash).  */
-static struct grub_symbol *grub_symtab[GRUB_SYMTAB_SIZE];
+static grub_symbol_t *grub_symtab;
+static grub_size_t grub_symtab_size;
+static grub_size_t grub_symtab_count;
 
 /* Simple hash function.  */
-static unsigned
+static grub_uint32_t
 grub_symbol_hash (const char *s)
 {
-  unsigned key = 0;
+  grub_uint32_t key = 0;
 
   while (*s)
     key = key * 65599 + *s++;
 
-  return (key + (key >> 5)) % GRUB_SYMTAB_SIZE;
+  return key ^ (key >> 15);
 }
 
+#define GRUB_SYMTAB_BUCKET(hash)	((hash) & (grub_symtab_size - 1))
+
 /* Resolve the symbol name NAME and return the address.
    Return NULL, if not found.  */
 static grub_symbol_t
 grub_dl_resolve_symbol (const char *name)
 {
   grub_symbol_t sym;
+  grub_uint32_t hash;
+
+  if (! grub_symtab)
+    return 0;
 
-  for (sym = grub_symtab[grub_symbol_hash (name)]; sym; sym = sym->next)
-    if (grub_strcmp (sym->name, name) == 0)
+  hash = grub_symbol_hash (name);
+  for (sym = grub_symtab[GRUB_SYMTAB_BUCKET (hash)]; sym; sym = sym->next)
+    if (sym->hash == hash && grub_strcmp (sym->name, name) == 0)
       return sym;
 
   return 0;
 }
 
+/* Rehash into SIZE buckets.  On failure the old table stays, only
+   slower.  */
+static grub_err_t
+grub_symtab_resize (grub_size_t size)
+{
+  grub_symbol_t *table, sym, next;
+  grub_size_t i;
+
+  table = grub_zalloc (size * sizeof (table[0]));
+  if (! table)
+    return grub_errno;
+
+  for (i = 0; i < grub_symtab_size; i++)
+    for (sym = grub_symtab[i]; sym; sym = next)
+      {
+	next = sym->next;
+	sym->next = table[sym->hash & (size - 1)];
+	table[sym->hash & (size - 1)] = sym;
+      }
+
+  grub_free (grub_symtab);
+  grub_symtab = table;
+  grub_symtab_size = size;
+  return GRUB_ERR_NONE;
+}
+
 /* Register a symbol with the name NAME and the address ADDR.  */
 grub_err_t
 grub_dl_register_symbol (const char *name, void *addr, int isfunc,
 			 grub_dl_t mod)
 {
   grub_symbol_t sym;
-  unsigned k;
+  grub_size_t k;
+
+  if (! grub_symtab && grub_symtab_resize (GRUB_SYMTAB_INITIAL_SIZE))
+    return grub_errno;
+
+  if (grub_symtab_count >= grub_symtab_size
+      && grub_symtab_resize (grub_symtab_size * 2))
+    grub_errno = GRUB_ERR_NONE;
 
   sym = (grub_symbol_t) grub_malloc (sizeof (*sym));
   if (! sym)
@@ -151,10 +197,12 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
   sym->addr = addr;
   sym->mod = mod;
   sym->isfunc = isfunc;
+  sym->hash = grub_symbol_hash (name);
 
-  k = grub_symbol_hash (name);
+  k = GRUB_SYMTAB_BUCKET (sym->hash);
   sym->next = grub_symtab[k];
   grub_symtab[k] = sym;
+  grub_symtab_count++;
 
   return GRUB_ERR_NONE;
 }
@@ -163,12 +211,12 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
 static void
 grub_dl_unregister_symbols (grub_dl_t mod)
 {
-  unsigned i;
+  grub_size_t i;
 
   if (! mod)
     grub_fatal ("core symbols cannot be unregistered");
 
-  for (i = 0; i < GRUB_SYMTAB_SIZE; i++)
+  for (i = 0; i < grub_symtab_size; i++)
     {
       grub_symbol_t sym, *p, q;
 
@@ -180,6 +228,7 @@ grub_dl_unregister_symbols (grub_dl_t mod)
 	      *p = q;
 	      grub_free ((void *) sym->name);
 	      grub_free (sym);
+	      grub_symtab_count--;
 	    }
 	  else
 	    p = &sym->next;
@@ -600,6 +649,7 @@ grub_dl_load_core_noinit (void *addr, grub_size_t size)
 {
   Elf_Ehdr *e;
   grub_dl_t mod;
+  grub_uint64_t start, deps;
 
   grub_dprintf ("modules", "module at %p, size 0x%lx\n", addr,
 		(unsigned long) size);
@@ -625,6 +675,7 @@ grub_dl_load_core_noinit (void *addr, grub_size_t size)
     return 0;
 
   mod->ref_count = 1;
+  start = grub_get_time_ns ();
 
   grub_dprintf ("modules", "relocating to %p\n", mod);
   /* Me, Vladimir Serbinenko, hereby I add this module check as per new
@@ -636,18 +687,22 @@ grub_dl_load_core_noinit (void *addr, grub_size_t size)
      Be sure to understand your license obligations.
   */
   if (grub_dl_check_license (e)
-      || grub_dl_resolve_name (mod, e)
-      || grub_dl_resolve_dependencies (mod, e)
-      || grub_dl_load_segments (mod, e)
+      || grub_dl_resolve_name (mod, e))
+    goto fail;
+
+  /* Dependencies loaded here account for themselves.  */
+  deps = grub_get_time_ns ();
+  if (grub_dl_resolve_dependencies (mod, e))
+    goto fail;
+  start += grub_get_time_ns () - deps;
+
+  if (grub_dl_load_segments (mod, e)
       || grub_dl_resolve_symbols (mod, e)
       || grub_dl_relocate_symbols (mod, e))
-    {
-      mod->fini = 0;
-      grub_dl_unload (mod);
-      return 0;
-    }
+    goto fail;
 
   grub_dl_flush_cache (mod);
+  mod->link_ns = grub_get_time_ns () - start;
 
   grub_dprintf ("modules", "module name: %s\n", mod->name);
   grub_dprintf ("modules", "init function: %p\n", mod->init);
@@ -659,12 +714,18 @@ grub_dl_load_core_noinit (void *addr, grub_size_t size)
     }
 
   return mod;
+
+ fail:
+  mod->fini = 0;
+  grub_dl_unload (mod);
+  return 0;
 }
 
 grub_dl_t
 grub_dl_load_core (void *addr, grub_size_t size)
 {
   grub_dl_t mod;
+  grub_uint64_t start;
 
   grub_boot_time ("Parsing module");
 
@@ -674,7 +735,9 @@ grub_dl_load_core (void *addr, grub_size_t size)
     return NULL;
 
   grub_boot_time ("Initing module %s", mod->name);
+  start = grub_get_time_ns ();
   grub_dl_init (mod);
+  mod->init_ns = grub_get_time_ns () - start;
   grub_boot_time ("Module %s inited", mod->name);
 
   return mod;
@@ -688,6 +751,7 @@ grub_dl_load_file (const char *filename)
   grub_ssize_t size;
   void *core = 0;
   grub_dl_t mod = 0;
+  grub_uint64_t start, read_ns;
 
 #ifdef GRUB_MACHINE_EFI
   if (grub_efi_secure_boot ())
@@ -699,7 +763,10 @@ grub_dl_load_file (const char *filename)
 #endif
 
   grub_boot_time ("Loading module %s", filename);
+  start = grub_get_time_ns ();
 
+  /* Modules are never compressed.  */
+  grub_file_filter_disable_compression ();
   file = grub_file_open (filename);
   if (! file)
     return 0;
@@ -723,6 +790,7 @@ grub_dl_load_file (const char *filename)
      Some disk backends do not handle gracefully multiple concurrent
      opens of the same device.  */
   grub_file_close (file);
+  read_ns = grub_get_time_ns () - start;
 
   grub_tpm_measure(core, size, GRUB_TPM_PCR, filename);
 
@@ -731,13 +799,154 @@ grub_dl_load_file (const char *filename)
   if (! mod)
     return 0;
 
+  mod->read_ns = read_ns;
+  mod->ref_count--;
+  return mod;
+}
+
+/* The module bundle of the platform directory under grub_dl_bundle_dir,
+   while some of its modules are still to be loaded.  */
+static char *grub_dl_bundle;
+static grub_size_t grub_dl_bundle_size;
+static unsigned grub_dl_bundle_left;
+static char *grub_dl_bundle_dir;
+
+/* Read the bundle from the platform directory under DIR, if there is a
+   valid one.  */
+static void
+grub_dl_read_bundle (const char *dir)
+{
+  struct grub_module_bundle_header *header;
+  struct grub_module_bundle_entry *entries;
+  grub_file_t file;
+  char *filename;
+  grub_ssize_t size;
+  unsigned i;
+
+  grub_free (grub_dl_bundle);
+  grub_dl_bundle = 0;
+  grub_free (grub_dl_bundle_dir);
+  grub_dl_bundle_dir = grub_strdup (dir);
+  if (! grub_dl_bundle_dir)
+    goto fail;
+
+#ifdef GRUB_MACHINE_EFI
+  /* Let grub_dl_load_file refuse, like it does for every module.  */
+  if (grub_efi_secure_boot ())
+    return;
+#endif
+
+  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM "/"
+			     GRUB_MODULE_BUNDLE_FILE, dir);
+  if (! filename)
+    goto fail;
+  grub_file_filter_disable_compression ();
+  file = grub_file_open (filename);
+  if (! file)
+    {
+      grub_free (filename);
+      goto fail;
+    }
+
+  size = grub_file_size (file);
+  if (size < (grub_ssize_t) sizeof (*header))
+    goto close;
+  grub_dl_bundle = grub_malloc (size);
+  if (! grub_dl_bundle)
+    goto close;
+  if (grub_file_read (file, grub_dl_bundle, size) != size)
+    goto close;
+  grub_file_close (file);
+
+  header = (struct grub_module_bundle_header *) grub_dl_bundle;
+  entries = (struct grub_module_bundle_entry *) (header + 1);
+  if (header->magic != GRUB_MODULE_BUNDLE_MAGIC
+      || header->count > (size - sizeof (*header)) / sizeof (*entries))
+    {
+      grub_dprintf ("modules", "%s isn't a module bundle\n", filename);
+      grub_free (filename);
+      goto fail;
+    }
+  for (i = 0; i < header->count; i++)
+    if (entries[i].offset % GRUB_MODULE_BUNDLE_ALIGN
+	|| entries[i].offset > (grub_size_t) size
+	|| entries[i].size > size - entries[i].offset
+	|| ! grub_memchr (entries[i].name, 0, sizeof (entries[i].name)))
+      {
+	grub_dprintf ("modules", "%s is corrupted\n", filename);
+	grub_free (filename);
+	goto fail;
+      }
+
+  grub_tpm_measure ((unsigned char *) grub_dl_bundle, size, GRUB_TPM_PCR,
+		    filename);
+  grub_free (filename);
+  grub_dl_bundle_size = size;
+  grub_dl_bundle_left = header->count;
+  return;
+
+ close:
+  grub_file_close (file);
+  grub_free (filename);
+ fail:
+  grub_free (grub_dl_bundle);
+  grub_dl_bundle = 0;
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Find the module NAME in the bundle under DIR.  */
+static struct grub_module_bundle_entry *
+grub_dl_bundle_find (const char *dir, const char *name)
+{
+  struct grub_module_bundle_header *header;
+  struct grub_module_bundle_entry *entries;
+  unsigned i;
+
+  if (! grub_dl_bundle_dir || grub_strcmp (grub_dl_bundle_dir, dir) != 0)
+    grub_dl_read_bundle (dir);
+  if (! grub_dl_bundle)
+    return 0;
+
+  header = (struct grub_module_bundle_header *) grub_dl_bundle;
+  entries = (struct grub_module_bundle_entry *) (header + 1);
+  for (i = 0; i < header->count; i++)
+    if (grub_strcmp (entries[i].name, name) == 0)
+      return &entries[i];
+  return 0;
+}
+
+/* Load the module NAME from the bundle under DIR.  Return NULL with
+   grub_errno clear if the bundle doesn't have it.  */
+static grub_dl_t
+grub_dl_load_bundled (const char *dir, const char *name)
+{
+  struct grub_module_bundle_entry *entry;
+  grub_dl_t mod;
+
+  entry = grub_dl_bundle_find (dir, name);
+  if (! entry)
+    return 0;
+
+  /* Each module is loaded from it once; drop the bundle after the last
+     one.  Modules unloaded and loaded again come from their files.  */
+  entry->name[0] = 0;
+  grub_boot_time ("Loading module %s from bundle", name);
+  mod = grub_dl_load_core (grub_dl_bundle + entry->offset, entry->size);
+  if (--grub_dl_bundle_left == 0)
+    {
+      grub_free (grub_dl_bundle);
+      grub_dl_bundle = 0;
+    }
+  if (! mod)
+    return 0;
+
   mod->ref_count--;
   return mod;
 }
 
 /* Load a module using a symbolic name.  */
-grub_dl_t
-grub_dl_load (const char *name)
+static grub_dl_t
+grub_dl_load_real (const char *name)
 {
   char *filename;
   grub_dl_t mod;
@@ -755,6 +964,12 @@ grub_dl_load (const char *name)
     return 0;
   }
 
+  mod = grub_dl_load_bundled (grub_dl_dir, name);
+  if (mod)
+    goto check_name;
+  if (grub_errno)
+    return 0;
+
   filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM "/%s.mod",
 			     grub_dl_dir, name);
   if (! filename)
@@ -766,12 +981,331 @@ grub_dl_load (const char *name)
   if (! mod)
     return 0;
 
+ check_name:
   if (grub_strcmp (mod->name, name) != 0)
     grub_error (GRUB_ERR_BAD_MODULE, "mismatched names");
 
   return mod;
 }
 
+grub_dl_t
+grub_dl_load (const char *name)
+{
+  grub_dl_t mod;
+
+  grub_trace_enter (GRUB_TRACE_DL_LOAD, 0, 0);
+  mod = grub_dl_load_real (name);
+  grub_trace_exit (GRUB_TRACE_DL_LOAD, mod ? mod->name : 0, 0);
+  return mod;
+}
+
+/* A module of a batch, with the file read ahead of linking.  */
+struct grub_dl_batch
+{
+  char *name;
+  unsigned position;
+  void *core;
+  grub_ssize_t size;
+  grub_uint64_t read_ns;
+};
+
+struct grub_dl_batch_ctx
+{
+  struct grub_dl_batch *mods;
+  unsigned count;
+  unsigned alloc;
+  char *moddep;
+  const char *dir;
+  unsigned position;
+};
+
+/* Return the dependency list of NAME in moddep.lst, or NULL.  */
+static const char *
+grub_dl_batch_deps (struct grub_dl_batch_ctx *ctx, const char *name,
+		    grub_size_t len)
+{
+  const char *line;
+
+  for (line = ctx->moddep; *line; )
+    {
+      if (grub_strncmp (line, name, len) == 0 && line[len] == ':')
+	return line + len + 1;
+      line = grub_strchr (line, '\n');
+      if (! line)
+	break;
+      line++;
+    }
+  return 0;
+}
+
+/* Add NAME, of LEN bytes, after everything it depends on.  Modules
+   already loaded or added are skipped.  */
+static grub_err_t
+grub_dl_batch_add (struct grub_dl_batch_ctx *ctx, const char *name,
+		   grub_size_t len, unsigned depth)
+{
+  const char *deps, *end;
+  unsigned i;
+  char *copy;
+
+  copy = grub_strndup (name, len);
+  if (! copy)
+    return grub_errno;
+  if (grub_dl_get (copy))
+    {
+      grub_free (copy);
+      return GRUB_ERR_NONE;
+    }
+  for (i = 0; i < ctx->count; i++)
+    if (grub_strcmp (ctx->mods[i].name, copy) == 0)
+      {
+	grub_free (copy);
+	return GRUB_ERR_NONE;
+      }
+  if (depth > 32)
+    {
+      grub_free (copy);
+      return grub_error (GRUB_ERR_BAD_MODULE, "module dependencies loop");
+    }
+
+  deps = grub_dl_batch_deps (ctx, name, len);
+  while (deps && *deps && *deps != '\n')
+    {
+      grub_err_t err;
+
+      for (; *deps == ' '; deps++);
+      for (end = deps; *end && *end != ' ' && *end != '\n'; end++);
+      if (end == deps)
+	break;
+      err = grub_dl_batch_add (ctx, deps, end - deps, depth + 1);
+      if (err)
+	{
+	  grub_free (copy);
+	  return err;
+	}
+      deps = end;
+    }
+
+  if (ctx->count == ctx->alloc)
+    {
+      struct grub_dl_batch *n;
+
+      n = grub_realloc (ctx->mods, 2 * (ctx->alloc + 4) * sizeof (*n));
+      if (! n)
+	{
+	  grub_free (copy);
+	  return grub_errno;
+	}
+      ctx->mods = n;
+      ctx->alloc = 2 * (ctx->alloc + 4);
+    }
+  ctx->mods[ctx->count].name = copy;
+  ctx->mods[ctx->count].position = (unsigned) -1;
+  ctx->mods[ctx->count].core = 0;
+  ctx->mods[ctx->count].size = 0;
+  ctx->count++;
+  return GRUB_ERR_NONE;
+}
+
+/* Note where each module of the batch is in its directory.  */
+static int
+grub_dl_batch_position (const char *filename,
+			const struct grub_dirhook_info *info,
+			void *data)
+{
+  struct grub_dl_batch_ctx *ctx = data;
+  grub_size_t len = grub_strlen (filename);
+  unsigned i;
+
+  if (info->dir || len < 4 || grub_strcmp (filename + len - 4, ".mod") != 0)
+    return 0;
+  for (i = 0; i < ctx->count; i++)
+    if (grub_strncmp (ctx->mods[i].name, filename, len - 4) == 0
+	&& ctx->mods[i].name[len - 4] == 0)
+      ctx->mods[i].position = ctx->position++;
+  return 0;
+}
+
+/* List the platform directory once to learn the order of the files.  */
+static void
+grub_dl_batch_sort (struct grub_dl_batch_ctx *ctx, const char *platdir)
+{
+  char *device_name;
+  grub_device_t dev;
+  grub_fs_t fs;
+  const char *path;
+
+  device_name = grub_file_get_device_name (platdir);
+  dev = grub_errno ? 0 : grub_device_open (device_name);
+  fs = dev ? grub_fs_probe (dev) : 0;
+  path = grub_strchr (platdir, ')');
+  path = path ? path + 1 : platdir;
+  if (fs)
+    (fs->dir) (dev, path, grub_dl_batch_position, ctx);
+  if (dev)
+    grub_device_close (dev);
+  grub_free (device_name);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Read the whole FILENAME.  */
+static void *
+grub_dl_batch_read (const char *filename, grub_ssize_t *size)
+{
+  grub_file_t file;
+  void *buf;
+
+  grub_file_filter_disable_compression ();
+  file = grub_file_open (filename);
+  if (! file)
+    return 0;
+  *size = grub_file_size (file);
+  buf = grub_malloc (*size);
+  if (buf && grub_file_read (file, buf, *size) != *size)
+    {
+      grub_free (buf);
+      buf = 0;
+    }
+  grub_file_close (file);
+  return buf;
+}
+
+/* Load the modules NAMES and what they depend on, taking the whole set
+   from moddep.lst first.  The files are read in the order of their
+   directory, then linked with their dependencies first.  Without
+   moddep.lst modules are loaded one by one.  Like insmod, take a
+   reference on every module of NAMES.  */
+grub_err_t
+grub_dl_load_batch (int count, char **names)
+{
+  struct grub_dl_batch_ctx ctx;
+  char *platdir = 0, *filename;
+  grub_ssize_t size;
+  unsigned i, j, *order = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+  int n;
+
+  grub_memset (&ctx, 0, sizeof (ctx));
+  ctx.dir = grub_env_get ("prefix");
+
+#ifdef GRUB_MACHINE_EFI
+  if (grub_efi_secure_boot ())
+    goto one_by_one;
+#endif
+  if (grub_no_modules || ! ctx.dir)
+    goto one_by_one;
+
+  platdir = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM,
+			    ctx.dir);
+  if (! platdir)
+    return grub_errno;
+  filename = grub_xasprintf ("%s/moddep.lst", platdir);
+  if (! filename)
+    goto fail;
+  ctx.moddep = grub_dl_batch_read (filename, &size);
+  grub_free (filename);
+  if (! ctx.moddep)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      goto one_by_one;
+    }
+  grub_free (platdir);
+  platdir = 0;
+  {
+    char *t = grub_realloc (ctx.moddep, size + 1);
+    if (! t)
+      goto fail;
+    ctx.moddep = t;
+    ctx.moddep[size] = 0;
+  }
+
+  for (n = 0; n < count; n++)
+    if (grub_dl_batch_add (&ctx, names[n], grub_strlen (names[n]), 0))
+      goto fail;
+
+  platdir = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM,
+			    ctx.dir);
+  order = grub_malloc ((ctx.count + 1) * sizeof (order[0]));
+  if (! platdir || ! order)
+    goto fail;
+  grub_dl_batch_sort (&ctx, platdir);
+
+  /* Read ahead in directory order.  */
+  for (i = 0; i < ctx.count; i++)
+    {
+      for (j = i; j > 0 && ctx.mods[order[j - 1]].position
+	     > ctx.mods[i].position; j--)
+	order[j] = order[j - 1];
+      order[j] = i;
+    }
+  for (i = 0; i < ctx.count; i++)
+    {
+      struct grub_dl_batch *m = &ctx.mods[order[i]];
+
+      if (grub_dl_bundle_find (ctx.dir, m->name))
+	continue;
+      filename = grub_xasprintf ("%s/%s.mod", platdir, m->name);
+      if (! filename)
+	goto fail;
+      grub_boot_time ("Reading module %s", filename);
+      m->read_ns = grub_get_time_ns ();
+      m->core = grub_dl_batch_read (filename, &m->size);
+      m->read_ns = grub_get_time_ns () - m->read_ns;
+      if (m->core)
+	grub_tpm_measure (m->core, m->size, GRUB_TPM_PCR, filename);
+      grub_free (filename);
+      /* grub_dl_load reports it if it's really missing.  */
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  /* Dependencies come first, so no module opens another file here.  */
+  for (i = 0; i < ctx.count; i++)
+    {
+      struct grub_dl_batch *m = &ctx.mods[i];
+      grub_dl_t mod;
+
+      if (! m->core)
+	mod = grub_dl_load (m->name);
+      else
+	{
+	  mod = grub_dl_load_core (m->core, m->size);
+	  grub_free (m->core);
+	  m->core = 0;
+	  if (mod)
+	    {
+	      mod->read_ns = m->read_ns;
+	      mod->ref_count--;
+	      if (grub_strcmp (mod->name, m->name) != 0)
+		grub_error (GRUB_ERR_BAD_MODULE, "mismatched names");
+	    }
+	}
+      if (! mod || grub_errno)
+	goto fail;
+    }
+
+ one_by_one:
+  for (n = 0; n < count; n++)
+    {
+      grub_dl_t mod = grub_dl_load (names[n]);
+      if (! mod)
+	break;
+      grub_dl_ref (mod);
+    }
+
+ fail:
+  err = grub_errno;
+  for (i = 0; i < ctx.count; i++)
+    {
+      grub_free (ctx.mods[i].name);
+      grub_free (ctx.mods[i].core);
+    }
+  grub_free (ctx.mods);
+  grub_free (ctx.moddep);
+  grub_free (order);
+  grub_free (platdir);
+  return err;
+}
+
 /* Unload the module MOD.  */
 int
 grub_dl_unload (grub_dl_t mod)
@@ -22,6 +22,7 @@
 #include <grub/efi/api.h>
 #include <grub/efi/efi.h>
 #include <grub/cpu/efi/memory.h>
+#include <grub/i18n.h>
 
 #if defined (__i386__) || defined (__x86_64__)
 #include <grub/pci.h>
@@ -38,17 +39,28 @@
    a multiplier of 4KB.  */
 #define MEMORY_MAP_SIZE	0x3000
 
-/* The minimum and maximum heap size for GRUB itself.  */
+/* The minimum and initial heap size for GRUB itself.  The heap grows by
+   at least MIN_HEAP_GROWTH whenever it runs out.  */
 #define MIN_HEAP_SIZE	0x100000
-#define MAX_HEAP_SIZE	(1600 * 0x100000)
+#define DEFAULT_HEAP_SIZE	(32 * 0x100000)
+#define MIN_HEAP_GROWTH	(4 * 0x100000)
+
+/* Room for this many more descriptors is left in the memory map buffer
+   for ExitBootServices, as allocating it, or anything the firmware does
+   between retries, may grow the map.  */
+#define FINISH_MMAP_HEADROOM	16
 
 static void *finish_mmap_buf = 0;
 static grub_efi_uintn_t finish_mmap_size = 0;
+static grub_efi_uintn_t finish_mmap_alloc = 0;
 static grub_efi_uintn_t finish_key = 0;
 static grub_efi_uintn_t finish_desc_size;
 static grub_efi_uint32_t finish_desc_version;
 int grub_efi_is_finished = 0;
 
+/* Size of the buffer get_heap_memory_map starts with.  */
+static grub_efi_uintn_t heap_map_size = MEMORY_MAP_SIZE;
+
 /* Allocate pages below a specified address */
 void *
 grub_efi_allocate_pages_max (grub_efi_physical_address_t max,
@@ -194,26 +206,35 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
 			   apple, sizeof (apple)) == 0);
 #endif
 
+  /* The buffer is kept, so that a retry only has to get the map again
+     unless it outgrew the headroom.  */
   while (1)
     {
-      if (grub_efi_get_memory_map (&finish_mmap_size, finish_mmap_buf, &finish_key,
-				   &finish_desc_size, &finish_desc_version) < 0)
-	return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+      grub_efi_uintn_t size = finish_mmap_alloc;
+      int ret;
 
-      if (outbuf && *outbuf_size < finish_mmap_size)
-	return grub_error (GRUB_ERR_IO, "memory map buffer is too small");
-
-      finish_mmap_buf = grub_malloc (finish_mmap_size);
-      if (!finish_mmap_buf)
-	return grub_errno;
+      ret = grub_efi_get_memory_map (&size, finish_mmap_buf, &finish_key,
+				     &finish_desc_size, &finish_desc_version);
+      if (ret < 0)
+	return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
 
-      if (grub_efi_get_memory_map (&finish_mmap_size, finish_mmap_buf, &finish_key,
-				   &finish_desc_size, &finish_desc_version) <= 0)
+      if (ret == 0)
 	{
 	  grub_free (finish_mmap_buf);
-	  return grub_error (GRUB_ERR_IO, "couldn't retrieve memory map");
+	  finish_mmap_alloc = size + FINISH_MMAP_HEADROOM * finish_desc_size;
+	  finish_mmap_buf = grub_malloc (finish_mmap_alloc);
+	  if (!finish_mmap_buf)
+	    {
+	      finish_mmap_alloc = 0;
+	      return grub_errno;
+	    }
+	  continue;
 	}
 
+      finish_mmap_size = size;
+      if (outbuf && *outbuf_size < finish_mmap_size)
+	return grub_error (GRUB_ERR_IO, "memory map buffer is too small");
+
       b = grub_efi_system_table->boot_services;
       status = efi_call_2 (b->exit_boot_services, grub_efi_image_handle,
 			   finish_key);
@@ -221,12 +242,8 @@ grub_efi_finish_boot_services (grub_efi_uintn_t *outbuf_size, void *outbuf,
 	break;
 
       if (status != GRUB_EFI_INVALID_PARAMETER)
-	{
-	  grub_free (finish_mmap_buf);
-	  return grub_error (GRUB_ERR_IO, "couldn't terminate EFI services");
-	}
+	return grub_error (GRUB_ERR_IO, "couldn't terminate EFI services");
 
-      grub_free (finish_mmap_buf);
       grub_printf ("Trying to terminate EFI services again\n");
     }
   grub_efi_is_finished = 1;
@@ -308,37 +325,64 @@ grub_efi_get_memory_map (grub_efi_uintn_t *memory_map_size,
     return -1;
 }
 
-/* Sort the memory map in place.  */
+#define MEMORY_DESCRIPTOR_AT(map, i, size)	\
+  NEXT_MEMORY_DESCRIPTOR (map, (i) * (size))
+
+/* Sift descriptor ROOT down the min-heap of the first N descriptors.  */
 static void
-sort_memory_map (grub_efi_memory_descriptor_t *memory_map,
+sift_memory_map (grub_efi_memory_descriptor_t *memory_map,
 		 grub_efi_uintn_t desc_size,
-		 grub_efi_memory_descriptor_t *memory_map_end)
+		 grub_efi_uintn_t root, grub_efi_uintn_t n)
 {
-  grub_efi_memory_descriptor_t *d1;
-  grub_efi_memory_descriptor_t *d2;
-
-  for (d1 = memory_map;
-       d1 < memory_map_end;
-       d1 = NEXT_MEMORY_DESCRIPTOR (d1, desc_size))
+  while (2 * root + 1 < n)
     {
-      grub_efi_memory_descriptor_t *max_desc = d1;
+      grub_efi_uintn_t child = 2 * root + 1;
+      grub_efi_memory_descriptor_t *r, *c, tmp;
 
-      for (d2 = NEXT_MEMORY_DESCRIPTOR (d1, desc_size);
-	   d2 < memory_map_end;
-	   d2 = NEXT_MEMORY_DESCRIPTOR (d2, desc_size))
+      c = MEMORY_DESCRIPTOR_AT (memory_map, child, desc_size);
+      if (child + 1 < n
+	  && NEXT_MEMORY_DESCRIPTOR (c, desc_size)->num_pages < c->num_pages)
 	{
-	  if (max_desc->num_pages < d2->num_pages)
-	    max_desc = d2;
+	  child++;
+	  c = NEXT_MEMORY_DESCRIPTOR (c, desc_size);
 	}
+      r = MEMORY_DESCRIPTOR_AT (memory_map, root, desc_size);
+      if (r->num_pages <= c->num_pages)
+	break;
 
-      if (max_desc != d1)
-	{
-	  grub_efi_memory_descriptor_t tmp;
+      tmp = *r;
+      *r = *c;
+      *c = tmp;
+      root = child;
+    }
+}
 
-	  tmp = *d1;
-	  *d1 = *max_desc;
-	  *max_desc = tmp;
-	}
+/* Sort the memory map in place, largest first.  Maps of large machines
+   have thousands of descriptors, so this is a heap sort.  */
+static void
+sort_memory_map (grub_efi_memory_descriptor_t *memory_map,
+		 grub_efi_uintn_t desc_size,
+		 grub_efi_memory_descriptor_t *memory_map_end)
+{
+  grub_efi_uintn_t n, i;
+
+  n = ((char *) memory_map_end - (char *) memory_map) / desc_size;
+  if (n < 2)
+    return;
+
+  for (i = n / 2; i > 0; i--)
+    sift_memory_map (memory_map, desc_size, i - 1, n);
+
+  /* Move the smallest remaining descriptor to the end each time.  */
+  for (i = n - 1; i > 0; i--)
+    {
+      grub_efi_memory_descriptor_t *last, tmp;
+
+      last = MEMORY_DESCRIPTOR_AT (memory_map, i, desc_size);
+      tmp = *memory_map;
+      *memory_map = *last;
+      *last = tmp;
+      sift_memory_map (memory_map, desc_size, 0, i);
     }
 }
 
@@ -472,69 +516,164 @@ print_memory_map (grub_efi_memory_descriptor_t *memory_map,
 }
 #endif
 
-void
-grub_efi_mm_init (void)
+/* Get the memory map, keep its usable conventional memory and sort it by
+   size, largest first.  Return the buffer holding both maps, which is
+   *MAP_PAGES pages long, or NULL if the firmware fails.  */
+static grub_efi_memory_descriptor_t *
+get_heap_memory_map (grub_efi_uintn_t *map_pages,
+		     grub_efi_uintn_t *desc_size,
+		     grub_efi_memory_descriptor_t **filtered_memory_map,
+		     grub_efi_memory_descriptor_t **filtered_memory_map_end)
 {
   grub_efi_memory_descriptor_t *memory_map;
   grub_efi_memory_descriptor_t *memory_map_end;
-  grub_efi_memory_descriptor_t *filtered_memory_map;
-  grub_efi_memory_descriptor_t *filtered_memory_map_end;
   grub_efi_uintn_t map_size;
-  grub_efi_uintn_t desc_size;
-  grub_efi_uint64_t total_pages;
-  grub_efi_uint64_t required_pages;
   int mm_status;
 
   /* Prepare a memory region to store two memory maps.  */
-  memory_map = grub_efi_allocate_pages (0,
-					2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+  *map_pages = 2 * BYTES_TO_PAGES (heap_map_size);
+  memory_map = grub_efi_allocate_pages (0, *map_pages);
   if (! memory_map)
-    grub_fatal ("cannot allocate memory");
+    return 0;
 
   /* Obtain descriptors for available memory.  */
-  map_size = MEMORY_MAP_SIZE;
+  map_size = heap_map_size;
 
-  mm_status = grub_efi_get_memory_map (&map_size, memory_map, 0, &desc_size, 0);
+  mm_status = grub_efi_get_memory_map (&map_size, memory_map, 0, desc_size, 0);
 
   if (mm_status == 0)
     {
       grub_efi_free_pages
 	((grub_efi_physical_address_t) ((grub_addr_t) memory_map),
-	 2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+	 *map_pages);
 
       /* Freeing/allocating operations may increase memory map size.  */
-      map_size += desc_size * 32;
+      map_size += *desc_size * 32;
 
-      memory_map = grub_efi_allocate_pages (0, 2 * BYTES_TO_PAGES (map_size));
+      *map_pages = 2 * BYTES_TO_PAGES (map_size);
+      memory_map = grub_efi_allocate_pages (0, *map_pages);
       if (! memory_map)
-	grub_fatal ("cannot allocate memory");
+	return 0;
 
       mm_status = grub_efi_get_memory_map (&map_size, memory_map, 0,
-					   &desc_size, 0);
+					   desc_size, 0);
     }
 
   if (mm_status < 0)
-    grub_fatal ("cannot get memory map");
+    {
+      grub_efi_free_pages
+	((grub_efi_physical_address_t) ((grub_addr_t) memory_map),
+	 *map_pages);
+      return 0;
+    }
+
+  /* Size the buffer for next time from this map, so that a large one
+     needs a single call.  */
+  if (map_size + *desc_size * 32 > heap_map_size)
+    heap_map_size = ALIGN_UP (map_size + *desc_size * 32, 0x1000);
 
   memory_map_end = NEXT_MEMORY_DESCRIPTOR (memory_map, map_size);
 
-  filtered_memory_map = memory_map_end;
+  *filtered_memory_map = memory_map_end;
+
+  *filtered_memory_map_end = filter_memory_map (memory_map,
+						*filtered_memory_map,
+						*desc_size, memory_map_end);
 
-  filtered_memory_map_end = filter_memory_map (memory_map, filtered_memory_map,
-					       desc_size, memory_map_end);
+  /* Sort the filtered descriptors, so that GRUB can allocate pages
+     from larger regions first.  */
+  sort_memory_map (*filtered_memory_map, *desc_size,
+		   *filtered_memory_map_end);
+
+  return memory_map;
+}
+
+/* Add a region with room for BYTES to the heap.  Take at least
+   MIN_HEAP_GROWTH, so that growing stays rare, from the top of the
+   largest block of conventional memory, like at startup.  */
+static grub_err_t
+grub_efi_mm_add_region (grub_size_t bytes)
+{
+  grub_efi_memory_descriptor_t *memory_map;
+  grub_efi_memory_descriptor_t *filtered_memory_map;
+  grub_efi_memory_descriptor_t *filtered_memory_map_end;
+  grub_efi_memory_descriptor_t *desc;
+  grub_efi_uintn_t map_pages;
+  grub_efi_uintn_t desc_size;
+  grub_efi_uint64_t required_pages, pages = 0;
+  void *addr = 0;
+
+  /* Boot services are gone, so is the memory map.  */
+  if (grub_efi_is_finished)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+
+  required_pages = BYTES_TO_PAGES ((grub_efi_uint64_t) bytes);
 
-  /* By default, request a quarter of the available memory.  */
+  memory_map = get_heap_memory_map (&map_pages, &desc_size,
+				    &filtered_memory_map,
+				    &filtered_memory_map_end);
+  if (! memory_map)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+
+  for (desc = filtered_memory_map;
+       desc < filtered_memory_map_end && desc->num_pages >= required_pages;
+       desc = NEXT_MEMORY_DESCRIPTOR (desc, desc_size))
+    {
+      grub_efi_physical_address_t start;
+
+      start = desc->physical_start;
+      pages = desc->num_pages;
+      if (pages > required_pages
+	  && pages > BYTES_TO_PAGES (MIN_HEAP_GROWTH))
+	{
+	  grub_efi_uint64_t want = required_pages;
+
+	  if (want < BYTES_TO_PAGES (MIN_HEAP_GROWTH))
+	    want = BYTES_TO_PAGES (MIN_HEAP_GROWTH);
+	  start += PAGES_TO_BYTES (pages - want);
+	  pages = want;
+	}
+
+      addr = grub_efi_allocate_pages (start, pages);
+      if (addr)
+	break;
+    }
+
+  grub_efi_free_pages ((grub_addr_t) memory_map, map_pages);
+
+  if (! addr)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+
+  grub_mm_init_region (addr, PAGES_TO_BYTES (pages));
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_efi_mm_init (void)
+{
+  grub_efi_memory_descriptor_t *memory_map;
+  grub_efi_memory_descriptor_t *filtered_memory_map;
+  grub_efi_memory_descriptor_t *filtered_memory_map_end;
+  grub_efi_uintn_t map_pages;
+  grub_efi_uintn_t desc_size;
+  grub_efi_uint64_t total_pages;
+  grub_efi_uint64_t required_pages;
+
+  memory_map = get_heap_memory_map (&map_pages, &desc_size,
+				    &filtered_memory_map,
+				    &filtered_memory_map_end);
+  if (! memory_map)
+    grub_fatal ("cannot get memory map");
+
+  /* By default, request a quarter of the available memory, but no more
+     than DEFAULT_HEAP_SIZE.  The rest is requested when needed.  */
   total_pages = get_total_pages (filtered_memory_map, desc_size,
 				 filtered_memory_map_end);
   required_pages = (total_pages >> 2);
   if (required_pages < BYTES_TO_PAGES (MIN_HEAP_SIZE))
     required_pages = BYTES_TO_PAGES (MIN_HEAP_SIZE);
-  else if (required_pages > BYTES_TO_PAGES (MAX_HEAP_SIZE))
-    required_pages = BYTES_TO_PAGES (MAX_HEAP_SIZE);
-
-  /* Sort the filtered descriptors, so that GRUB can allocate pages
-     from smaller regions.  */
-  sort_memory_map (filtered_memory_map, desc_size, filtered_memory_map_end);
+  else if (required_pages > BYTES_TO_PAGES (DEFAULT_HEAP_SIZE))
+    required_pages = BYTES_TO_PAGES (DEFAULT_HEAP_SIZE);
 
   /* Allocate memory regions for GRUB's memory management.  */
   add_memory_regions (filtered_memory_map, desc_size,
@@ -542,18 +681,21 @@ grub_efi_mm_init (void)
 
 #if 0
   /* For debug.  */
-  map_size = MEMORY_MAP_SIZE;
+  {
+    grub_efi_uintn_t map_size = MEMORY_MAP_SIZE;
 
-  if (grub_efi_get_memory_map (&map_size, memory_map, 0, &desc_size, 0) < 0)
-    grub_fatal ("cannot get memory map");
+    if (grub_efi_get_memory_map (&map_size, memory_map, 0, &desc_size, 0) < 0)
+      grub_fatal ("cannot get memory map");
 
-  grub_printf ("printing memory map\n");
-  print_memory_map (memory_map, desc_size,
-		    NEXT_MEMORY_DESCRIPTOR (memory_map, map_size));
-  grub_fatal ("Debug. ");
+    grub_printf ("printing memory map\n");
+    print_memory_map (memory_map, desc_size,
+		      NEXT_MEMORY_DESCRIPTOR (memory_map, map_size));
+    grub_fatal ("Debug. ");
+  }
 #endif
 
   /* Release the memory maps.  */
-  grub_efi_free_pages ((grub_addr_t) memory_map,
-		       2 * BYTES_TO_PAGES (MEMORY_MAP_SIZE));
+  grub_efi_free_pages ((grub_addr_t) memory_map, map_pages);
+
+  grub_mm_add_region_fn = grub_efi_mm_add_region;
 }
@@ -0,0 +1,114 @@
+/* mp.c - run jobs on the application processors */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mp.h>
+#include <grub/misc.h>
+#include <grub/efi/api.h>
+#include <grub/efi/efi.h>
+
+static grub_efi_guid_t mp_guid = GRUB_EFI_MP_SERVICES_PROTOCOL_GUID;
+static grub_efi_mp_services_t *mp;
+static int mp_probed;
+
+struct mp_run
+{
+  grub_mp_job_t job;
+  void *data;
+  grub_size_t count;
+  /* Next index to hand out, shared by all processors.  */
+  grub_size_t next;
+};
+
+static void
+mp_work (struct mp_run *run)
+{
+  grub_size_t i;
+
+  while ((i = __sync_fetch_and_add (&run->next, 1)) < run->count)
+    run->job (run->data, i);
+}
+
+static void GRUB_EFI_ABI
+mp_ap_entry (void *arg)
+{
+  mp_work (arg);
+}
+
+static void
+mp_probe (void)
+{
+  grub_efi_uintn_t total, enabled;
+
+  mp_probed = 1;
+  mp = grub_efi_locate_protocol (&mp_guid, 0);
+  if (!mp)
+    return;
+  if (efi_call_3 (mp->get_number_of_processors, mp, &total, &enabled)
+      != GRUB_EFI_SUCCESS || enabled < 2)
+    mp = 0;
+  else
+    grub_dprintf ("mp", "%lu of %lu processors enabled\n",
+		  (unsigned long) enabled, (unsigned long) total);
+}
+
+void
+grub_mp_run (grub_mp_job_t job, void *data, grub_size_t count)
+{
+  struct mp_run run = { job, data, count, 0 };
+  grub_efi_boot_services_t *b;
+  grub_efi_event_t event;
+  grub_efi_status_t status;
+
+  if (count > 1 && !mp_probed && !grub_efi_is_finished)
+    mp_probe ();
+  if (count < 2 || !mp || grub_efi_is_finished)
+    {
+      mp_work (&run);
+      return;
+    }
+
+  b = grub_efi_system_table->boot_services;
+  if (efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK, 0, 0, &event)
+      != GRUB_EFI_SUCCESS)
+    event = 0;
+
+  /* With an event, the call returns at once and this processor takes
+     jobs too.  Without one, it waits for the others to do them all.  */
+  status = efi_call_7 (mp->startup_all_aps, mp, mp_ap_entry, 0, event, 0,
+		       &run, 0);
+  if (status != GRUB_EFI_SUCCESS && event)
+    {
+      efi_call_1 (b->close_event, event);
+      event = 0;
+      status = efi_call_7 (mp->startup_all_aps, mp, mp_ap_entry, 0, 0, 0,
+			   &run, 0);
+    }
+
+  /* Whatever the APs left, including everything if they didn't start.  */
+  mp_work (&run);
+
+  if (event)
+    {
+      /* Jobs taken by the APs may still be running.  */
+      do
+	status = efi_call_1 (b->check_event, event);
+      while (status == GRUB_EFI_NOT_READY);
+      efi_call_1 (b->close_event, event);
+    }
+}
@@ -262,3 +262,72 @@ grub_tpm_log_event(unsigned char *buf, grub_size_t size, grub_uint8_t pcr,
     }
   }
 }
+
+int
+grub_tpm_log_digest_supported (void)
+{
+  grub_efi_handle_t tpm_handle;
+  grub_efi_uint8_t protocol_version;
+  grub_efi_tpm_protocol_t *tpm;
+
+  /* TCG2's HashLogExtendEvent always hashes the data itself.  */
+  if (!grub_tpm_handle_find (&tpm_handle, &protocol_version)
+      || protocol_version != 1)
+    return 0;
+
+  tpm = grub_efi_open_protocol (tpm_handle, &tpm_guid,
+				GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  return tpm && grub_tpm_present (tpm);
+}
+
+/* Extend PCR with the SHA-1 DIGEST and log it.  With no data to hash the
+   TCG protocol takes the digest in the event as it is.  */
+grub_err_t
+grub_tpm_log_digest (const grub_uint8_t *digest, grub_uint8_t pcr,
+		     const char *description)
+{
+  grub_efi_handle_t tpm_handle;
+  grub_efi_status_t status;
+  grub_efi_tpm_protocol_t *tpm;
+  grub_efi_physical_address_t lastevent;
+  grub_efi_uint8_t protocol_version;
+  grub_uint32_t eventnum = 0;
+  Event *event;
+
+  if (!grub_tpm_handle_find (&tpm_handle, &protocol_version)
+      || protocol_version != 1)
+    return 0;
+
+  tpm = grub_efi_open_protocol (tpm_handle, &tpm_guid,
+				GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  if (!grub_tpm_present (tpm))
+    return 0;
+
+  event = grub_zalloc (sizeof (Event) + grub_strlen (description) + 1);
+  if (!event)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY,
+		       N_("cannot allocate TPM event buffer"));
+
+  event->pcrindex = pcr;
+  event->eventtype = 0x0d;
+  grub_memcpy (event->digest, digest, sizeof (event->digest));
+  event->eventsize = grub_strlen (description) + 1;
+  grub_memcpy (event->event, description, event->eventsize);
+
+  status = efi_call_7 (tpm->log_extend_event, tpm, 0, (grub_uint64_t) 0,
+		       0x00000004 /* SHA 1 */, event, &eventnum, &lastevent);
+  grub_free (event);
+
+  switch (status) {
+  case GRUB_EFI_SUCCESS:
+    return 0;
+  case GRUB_EFI_DEVICE_ERROR:
+    return grub_error (GRUB_ERR_IO, N_("Command failed"));
+  case GRUB_EFI_INVALID_PARAMETER:
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("Invalid parameter"));
+  case GRUB_EFI_NOT_FOUND:
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, N_("TPM unavailable"));
+  default:
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, N_("Unknown TPM error"));
+  }
+}
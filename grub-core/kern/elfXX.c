@@ -91,14 +91,26 @@ grub_elfXX_load (grub_elf_t elf, const char *filename,
 {
   grub_addr_t load_base = (grub_addr_t) -1ULL;
   grub_size_t load_size = 0;
-  ElfXX_Phdr *phdr;
+  ElfXX_Phdr *phdr, *p, *last = 0;
 
-  FOR_ELFXX_PHDRS(elf, phdr)
+  /* Segments are loaded in the order they are in the file, since seeking
+     back in a compressed file means inflating it again from the start.  */
+  while (1)
   {
     grub_addr_t load_addr;
 
-    if (phdr->p_type != PT_LOAD && !((load_flags & GRUB_ELF_LOAD_FLAGS_LOAD_PT_DYNAMIC) && phdr->p_type == PT_DYNAMIC))
-      continue;
+    phdr = 0;
+    FOR_ELFXX_PHDRS(elf, p)
+      if ((p->p_type == PT_LOAD
+	   || ((load_flags & GRUB_ELF_LOAD_FLAGS_LOAD_PT_DYNAMIC)
+	       && p->p_type == PT_DYNAMIC))
+	  && (!last || p->p_offset > last->p_offset
+	      || (p->p_offset == last->p_offset && p > last))
+	  && (!phdr || p->p_offset < phdr->p_offset))
+	phdr = p;
+    if (!phdr)
+      break;
+    last = phdr;
 
     load_addr = (grub_addr_t) phdr->p_paddr;
     switch (load_flags & GRUB_ELF_LOAD_FLAGS_BITS)
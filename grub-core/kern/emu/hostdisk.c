@@ -141,6 +141,8 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
   data->fd = GRUB_UTIL_FD_INVALID;
   data->is_disk = 0;
   data->device_map = map[drive].device_map;
+  data->map = NULL;
+  data->map_size = 0;
 
   /* Get the size.  */
   {
@@ -169,6 +171,17 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
     }
 #endif
 
+#ifdef __linux__
+    /* Partitions there don't share the cache of their disk, which
+       grub_util_fd_open_device works around by reading through them.
+       Only image files are mapped.  */
+    if (grub_util_is_regular (map[drive].device))
+#endif
+      {
+	data->map_size = disk->total_sectors << disk->log_sector_size;
+	data->map = grub_util_fd_map (fd, data->map_size);
+      }
+
     grub_util_fd_close (fd);
 
     grub_util_info ("the size of %s is %" GRUB_HOST_PRIuLONG_LONG,
@@ -218,6 +231,14 @@ grub_hostdisk_os_dev_to_grub_drive (const char *os_disk, int add)
   return map[i].drive;
 }
 
+const char *
+grub_hostdisk_get_os_dev (unsigned int n)
+{
+  if (n >= ARRAY_SIZE (map))
+    return NULL;
+  return map[n].device;
+}
+
 #ifndef __linux__
 grub_util_fd_t
 grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags,
@@ -282,6 +303,18 @@ static grub_err_t
 grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 			 grub_size_t size, char *buf)
 {
+  struct grub_util_hostdisk_data *data = disk->data;
+
+  /* Writes go through the fd, but the mapping is shared, so it sees
+     them.  */
+  if (data->map
+      && ((sector + size) << disk->log_sector_size) <= data->map_size)
+    {
+      memcpy (buf, (char *) data->map + (sector << disk->log_sector_size),
+	      size << disk->log_sector_size);
+      return GRUB_ERR_NONE;
+    }
+
   while (size)
     {
       grub_util_fd_t fd;
@@ -313,6 +346,54 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
+#if defined (__linux__) && defined (USE_LIBURING)
+static grub_err_t
+grub_util_biosdisk_read_vec (grub_disk_t disk, const struct grub_disk_vec *vec,
+			     grub_size_t n)
+{
+  struct grub_util_hostdisk_data *data = disk->data;
+  grub_size_t i;
+  int ret = 1;
+
+  /* Mapped disks gain nothing, and grub_util_fd_open_device may switch
+     to the device of the partition from one piece to the next.  */
+  if (!data->map && !disk->partition)
+    {
+      struct grub_util_fd_vec *pieces;
+      grub_disk_addr_t max;
+      grub_util_fd_t fd;
+      grub_size_t npieces = 0;
+
+      fd = grub_util_fd_open_device (disk, 0, GRUB_UTIL_FD_O_RDONLY, &max);
+      if (!GRUB_UTIL_FD_IS_VALID (fd))
+	return grub_errno;
+
+      pieces = xmalloc (n * sizeof (pieces[0]));
+      for (i = 0; i < n; i++)
+	/* The MBR is read on its own, see grub_util_biosdisk_read.  */
+	if (vec[i].sector != 0)
+	  {
+	    pieces[npieces].off = vec[i].sector << disk->log_sector_size;
+	    pieces[npieces].len = vec[i].size << disk->log_sector_size;
+	    pieces[npieces].buf = vec[i].buf;
+	    npieces++;
+	  }
+      ret = grub_hostdisk_linux_read_vec (fd, pieces, npieces);
+      free (pieces);
+      if (ret < 0)
+	return grub_error (GRUB_ERR_READ_ERROR, N_("cannot read `%s': %s"),
+			   map[disk->id].device, grub_util_fd_strerror ());
+    }
+
+  for (i = 0; i < n; i++)
+    if ((ret > 0 || vec[i].sector == 0)
+	&& grub_util_biosdisk_read (disk, vec[i].sector, vec[i].size,
+				    vec[i].buf))
+      return grub_errno;
+  return GRUB_ERR_NONE;
+}
+#endif
+
 static grub_err_t
 grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 			  grub_size_t size, const char *buf)
@@ -375,6 +456,8 @@ grub_util_biosdisk_close (struct grub_disk *disk)
   struct grub_util_hostdisk_data *data = disk->data;
 
   free (data->dev);
+  if (data->map)
+    grub_util_fd_unmap (data->map, data->map_size);
   if (GRUB_UTIL_FD_IS_VALID (data->fd))
     {
       if (data->access_mode == O_RDWR || data->access_mode == O_WRONLY)
@@ -393,6 +476,9 @@ static struct grub_disk_dev grub_util_biosdisk_dev =
     .close = grub_util_biosdisk_close,
     .read = grub_util_biosdisk_read,
     .write = grub_util_biosdisk_write,
+#if defined (__linux__) && defined (USE_LIBURING)
+    .read_vec = grub_util_biosdisk_read_vec,
+#endif
     .next = 0
   };
 
@@ -58,6 +58,8 @@ struct grub_hostfs_data
 {
   char *filename;
   grub_util_fd_t f;
+  /* The whole file mapped, or NULL to read through F.  */
+  void *map;
 };
 
 static grub_err_t
@@ -127,6 +129,7 @@ grub_hostfs_open (struct grub_file *file, const char *name)
   file->data = data;
 
   file->size = grub_util_get_fd_size (f, name, NULL);
+  data->map = grub_util_fd_map (f, file->size);
 
   return GRUB_ERR_NONE;
 }
@@ -137,6 +140,13 @@ grub_hostfs_read (grub_file_t file, char *buf, grub_size_t len)
   struct grub_hostfs_data *data;
 
   data = file->data;
+  if (data->map)
+    {
+      /* The file layer keeps reads within file->size.  */
+      memcpy (buf, (char *) data->map + file->offset, len);
+      return len;
+    }
+
   if (grub_util_fd_seek (data->f, file->offset) != 0)
     {
       grub_error (GRUB_ERR_OUT_OF_RANGE, N_("cannot seek `%s': %s"),
@@ -158,6 +168,8 @@ grub_hostfs_close (grub_file_t file)
   struct grub_hostfs_data *data;
 
   data = file->data;
+  if (data->map)
+    grub_util_fd_unmap (data->map, file->size);
   grub_util_fd_close (data->f);
   grub_free (data->filename);
   grub_free (data);
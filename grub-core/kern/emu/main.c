@@ -43,6 +43,7 @@
 #include <grub/i18n.h>
 #include <grub/loader.h>
 #include <grub/util/misc.h>
+#include <grub/emu/net.h>
 
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 
@@ -95,6 +96,8 @@ static struct argp_option options[] = {
    N_("use GRUB files in the directory DIR [default=%s]"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   {"hold",     'H', N_("SECS"),      OPTION_ARG_OPTIONAL, N_("wait until a debugger will attach"), 0},
+  {"net-udp",  'n', N_("LOCALPORT:REMOTEPORT"), 0,
+   N_("connect the network card to REMOTEPORT on localhost over UDP, one frame per datagram, instead of to a TAP device"), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -148,6 +151,10 @@ argp_parser (int key, char *arg, struct argp_state *state)
     case 'v':
       verbosity++;
       break;
+    case 'n':
+      if (grub_emunet_set_udp (arg))
+	argp_error (state, _("invalid UDP ports `%s'"), arg);
+      break;
 
     case ARGP_KEY_ARG:
       {
@@ -25,6 +25,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/types.h>
 
 #include <grub/mm.h>
@@ -69,6 +70,8 @@ grub_util_info (const char *fmt, ...)
     }
 }
 
+void (*grub_util_error_hook) (void);
+
 void
 grub_util_error (const char *fmt, ...)
 {
@@ -80,6 +83,8 @@ grub_util_error (const char *fmt, ...)
   vfprintf (stderr, fmt, ap);
   va_end (ap);
   fprintf (stderr, ".\n");
+  if (grub_util_error_hook)
+    grub_util_error_hook ();
   exit (1);
 }
 
@@ -149,3 +154,25 @@ grub_get_time_ms (void)
 
   return (tv.tv_sec * 1000 + tv.tv_usec / 1000);
 }
+
+grub_uint64_t
+grub_get_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+grub_uint64_t
+grub_get_cycles (void)
+{
+  return grub_get_time_ns ();
+}
+
+grub_uint64_t
+grub_get_cycles_hz (void)
+{
+  return 1000000000;
+}
@@ -62,3 +62,23 @@ grub_realloc (void *ptr, grub_size_t size)
     grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return ret;
 }
+
+/* The host's heap doesn't run short the way GRUB's does; shrinkers are
+   never called.  */
+void
+grub_mm_shrinker_register (struct grub_mm_shrinker *shrinker
+			   __attribute__ ((unused)))
+{
+}
+
+void
+grub_mm_shrinker_unregister (struct grub_mm_shrinker *shrinker
+			     __attribute__ ((unused)))
+{
+}
+
+grub_size_t
+grub_mm_reclaim (grub_size_t bytes __attribute__ ((unused)))
+{
+  return 0;
+}
@@ -28,45 +28,100 @@ static struct grub_env_context initial_context;
 /* The current context.  */
 struct grub_env_context *grub_current_context = &initial_context;
 
-/* Return the hash representation of the string S.  */
+/* Buckets a context starts with; the table doubles whenever it holds
+   more variables than buckets.  */
+#define GRUB_ENV_HASH_MIN	16
+
+/* Return the hash representation of the string S (FNV-1a).  */
 static unsigned int
 grub_env_hashval (const char *s)
 {
-  unsigned int i = 0;
+  unsigned int h = 2166136261U;
 
-  /* XXX: This can be done much more efficiently.  */
   while (*s)
-    i += 5 * *(s++);
+    h = (h ^ (grub_uint8_t) *s++) * 16777619U;
 
-  return i % HASHSZ;
+  return h;
 }
 
 static struct grub_env_var *
 grub_env_find (const char *name)
 {
   struct grub_env_var *var;
-  int idx = grub_env_hashval (name);
+  unsigned int hash;
+
+  if (! grub_current_context->size)
+    return 0;
+
+  hash = grub_env_hashval (name);
 
   /* Look for the variable in the current context.  */
-  for (var = grub_current_context->vars[idx]; var; var = var->next)
-    if (grub_strcmp (var->name, name) == 0)
+  for (var = grub_current_context->vars[hash & (grub_current_context->size - 1)];
+       var; var = var->next)
+    if (var->hash == hash && grub_strcmp (var->name, name) == 0)
       return var;
 
   return 0;
 }
 
 static void
+grub_env_link (struct grub_env_var **vars, unsigned size,
+	       struct grub_env_var *var)
+{
+  unsigned idx = var->hash & (size - 1);
+
+  var->prevp = &vars[idx];
+  var->next = vars[idx];
+  if (var->next)
+    var->next->prevp = &(var->next);
+  vars[idx] = var;
+}
+
+/* Move the variables of CONTEXT to a table of SIZE buckets.  */
+static grub_err_t
+grub_env_rehash (struct grub_env_context *context, unsigned size)
+{
+  struct grub_env_var **vars;
+  unsigned i;
+
+  vars = grub_zalloc (size * sizeof (vars[0]));
+  if (! vars)
+    return grub_errno;
+
+  for (i = 0; i < context->size; i++)
+    {
+      struct grub_env_var *var, *next;
+
+      for (var = context->vars[i]; var; var = next)
+	{
+	  next = var->next;
+	  grub_env_link (vars, size, var);
+	}
+    }
+
+  grub_free (context->vars);
+  context->vars = vars;
+  context->size = size;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
 grub_env_insert (struct grub_env_context *context,
 		 struct grub_env_var *var)
 {
-  int idx = grub_env_hashval (var->name);
+  if (! context->size
+      && grub_env_rehash (context, GRUB_ENV_HASH_MIN) != GRUB_ERR_NONE)
+    return grub_errno;
+
+  /* Growing is only an optimization, the old table still works.  */
+  if (context->count >= context->size
+      && grub_env_rehash (context, 2 * context->size) != GRUB_ERR_NONE)
+    grub_errno = GRUB_ERR_NONE;
 
   /* Insert the variable into the hashtable.  */
-  var->prevp = &context->vars[idx];
-  var->next = context->vars[idx];
-  if (var->next)
-    var->next->prevp = &(var->next);
-  context->vars[idx] = var;
+  grub_env_link (context->vars, context->size, var);
+  context->count++;
+  return GRUB_ERR_NONE;
 }
 
 static void
@@ -76,6 +131,7 @@ grub_env_remove (struct grub_env_var *var)
   *var->prevp = var->next;
   if (var->next)
     var->next->prevp = var->prevp;
+  grub_current_context->count--;
 }
 
 grub_err_t
@@ -117,7 +173,9 @@ grub_env_set (const char *name, const char *val)
   if (! var->value)
     goto fail;
 
-  grub_env_insert (grub_current_context, var);
+  var->hash = grub_env_hashval (name);
+  if (grub_env_insert (grub_current_context, var) != GRUB_ERR_NONE)
+    goto fail;
 
   return GRUB_ERR_NONE;
 
@@ -170,10 +228,10 @@ struct grub_env_var *
 grub_env_update_get_sorted (void)
 {
   struct grub_env_var *sorted_list = 0;
-  int i;
+  unsigned i;
 
   /* Add variables associated with this context into a sorted list.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < grub_current_context->size; i++)
     {
       struct grub_env_var *var;
 
@@ -24,13 +24,350 @@
 #include <grub/mm.h>
 #include <grub/fs.h>
 #include <grub/device.h>
+#include <grub/partition.h>
 #include <grub/i18n.h>
+#include <grub/tpm.h>
 
 void (*EXPORT_VAR (grub_grubnet_fini)) (void);
 
 grub_file_filter_t grub_file_filters_all[GRUB_FILE_FILTER_MAX];
 grub_file_filter_t grub_file_filters_enabled[GRUB_FILE_FILTER_MAX];
 
+/* Small files opened again and again during a boot, such as grub.cfg,
+   theme files, fonts and translations, are kept whole in memory so that
+   later opens skip path lookup and block mapping.  Entries are keyed by
+   disk, partition, filesystem and path, and are dropped along with the
+   disk cache and whenever a disk is written.  */
+struct grub_file_cache_entry
+{
+  struct grub_file_cache_entry *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_fs_t fs;
+  char *path;
+  grub_off_t size;
+  char *data;
+  /* Files open from the entry, which is freed only once they are closed
+     if it was dropped.  */
+  unsigned refs;
+  int dropped;
+};
+
+/* The data of a file open from the cache.  REAL is the file opened in
+   its filesystem for reads with a read hook.  */
+struct grub_file_cache_file
+{
+  struct grub_file_cache_entry *entry;
+  grub_fs_t fs;
+  char *path;
+  grub_file_t real;
+};
+
+#ifdef GRUB_UTIL
+/* Utilities may read from several threads.  */
+grub_size_t grub_file_cache_max = 0;
+#else
+grub_size_t grub_file_cache_max = GRUB_FILE_CACHE_DEFAULT;
+#endif
+
+/* Most recently used first.  */
+static struct grub_file_cache_entry *file_cache;
+static grub_size_t file_cache_used;
+
+static void
+file_cache_free (struct grub_file_cache_entry *entry)
+{
+  grub_free (entry->path);
+  grub_free (entry->data);
+  grub_free (entry);
+}
+
+/* Remove the entry *P points to from the list.  */
+static void
+file_cache_drop (struct grub_file_cache_entry **p)
+{
+  struct grub_file_cache_entry *entry = *p;
+
+  *p = entry->next;
+  file_cache_used -= entry->size;
+  entry->dropped = 1;
+  if (entry->refs == 0)
+    file_cache_free (entry);
+}
+
+/* Drop the least recently used entries until at most MAX bytes are
+   cached.  */
+static void
+file_cache_shrink (grub_size_t max)
+{
+  struct grub_file_cache_entry **p;
+
+  while (file_cache_used > max)
+    {
+      for (p = &file_cache; (*p)->next; p = &(*p)->next);
+      file_cache_drop (p);
+    }
+}
+
+void
+grub_file_cache_flush (void)
+{
+  while (file_cache)
+    file_cache_drop (&file_cache);
+}
+
+void
+grub_file_cache_resize (grub_size_t max)
+{
+  grub_file_cache_max = max;
+  file_cache_shrink (max);
+}
+
+grub_size_t
+grub_file_cache_reclaim (grub_size_t bytes)
+{
+  grub_size_t used = file_cache_used;
+
+  file_cache_shrink (used > bytes ? used - bytes : 0);
+  return used - file_cache_used;
+}
+
+static int
+file_cache_match (struct grub_file_cache_entry *entry, grub_disk_t disk,
+		  grub_fs_t fs, const char *path)
+{
+  return (entry->dev_id == disk->dev->id && entry->disk_id == disk->id
+	  && entry->part_start == grub_partition_get_start (disk->partition)
+	  && entry->fs == fs && grub_strcmp (entry->path, path) == 0);
+}
+
+static struct grub_file_cache_entry *
+file_cache_find (grub_disk_t disk, grub_fs_t fs, const char *path)
+{
+  struct grub_file_cache_entry **p, *entry;
+
+  for (p = &file_cache; *p; p = &(*p)->next)
+    if (file_cache_match (*p, disk, fs, path))
+      {
+	entry = *p;
+	*p = entry->next;
+	entry->next = file_cache;
+	file_cache = entry;
+	return entry;
+      }
+  return NULL;
+}
+
+/* Read the whole of FILE, just opened as PATH, into the cache if it's
+   small enough.  Failing to is not an error.  */
+static void
+file_cache_add (grub_file_t file, const char *path)
+{
+  struct grub_file_cache_entry *entry;
+  grub_disk_t disk = file->device->disk;
+
+  if (file->size > grub_file_cache_max / 4)
+    return;
+  /* A copy of what is in memory already would only take room.  */
+  if (file->fs->map && (file->fs->map) (file, 0, file->size))
+    return;
+
+  entry = grub_zalloc (sizeof (*entry));
+  if (!entry)
+    goto fail;
+  entry->path = grub_strdup (path);
+  entry->data = grub_malloc (file->size ? : 1);
+  if (!entry->path || !entry->data)
+    goto fail;
+  if ((file->fs->read) (file, entry->data, file->size)
+      != (grub_ssize_t) file->size)
+    goto fail;
+
+  entry->dev_id = disk->dev->id;
+  entry->disk_id = disk->id;
+  entry->part_start = grub_partition_get_start (disk->partition);
+  entry->fs = file->fs;
+  entry->size = file->size;
+
+  file_cache_shrink (grub_file_cache_max - entry->size);
+  entry->next = file_cache;
+  file_cache = entry;
+  file_cache_used += entry->size;
+  return;
+
+ fail:
+  if (entry)
+    file_cache_free (entry);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+static grub_ssize_t
+grub_file_cache_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  struct grub_file_cache_file *cached = file->data;
+
+  /* A read hook wants to see the sectors read, so reads with one go to
+     the filesystem.  */
+  if (file->read_hook && file->read_hook != grub_file_progress_hook)
+    {
+      if (!cached->real)
+	{
+	  cached->real = grub_zalloc (sizeof (*cached->real));
+	  if (!cached->real)
+	    return -1;
+	  cached->real->device = file->device;
+	  cached->real->fs = cached->fs;
+	  if ((cached->fs->open) (cached->real, cached->path))
+	    {
+	      grub_free (cached->real);
+	      cached->real = NULL;
+	      return -1;
+	    }
+	}
+      cached->real->offset = file->offset;
+      cached->real->read_hook = file->read_hook;
+      cached->real->read_hook_data = file->read_hook_data;
+      return (cached->fs->read) (cached->real, buf, len);
+    }
+
+  grub_memcpy (buf, cached->entry->data + file->offset, len);
+  return len;
+}
+
+static const void *
+grub_file_cache_map (grub_file_t file, grub_off_t offset,
+		     grub_size_t len __attribute__ ((unused)))
+{
+  struct grub_file_cache_file *cached = file->data;
+
+  return cached->entry->data + offset;
+}
+
+static grub_err_t
+grub_file_cache_close (grub_file_t file)
+{
+  struct grub_file_cache_file *cached = file->data;
+
+  if (cached->real)
+    {
+      if (cached->fs->close)
+	(cached->fs->close) (cached->real);
+      grub_free (cached->real);
+    }
+  if (--cached->entry->refs == 0 && cached->entry->dropped)
+    file_cache_free (cached->entry);
+  grub_free (cached->path);
+  grub_free (cached);
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_fs grub_file_cache_fs =
+  {
+    .name = "file_cache",
+    .read = grub_file_cache_read,
+    .close = grub_file_cache_close,
+    .map = grub_file_cache_map
+  };
+
+/* Open FILE from the cache if its contents are there.  */
+static int
+file_cache_open (grub_file_t file, const char *path)
+{
+  struct grub_file_cache_entry *entry;
+  struct grub_file_cache_file *cached;
+
+  entry = file_cache_find (file->device->disk, file->fs, path);
+  if (!entry)
+    return 0;
+
+  cached = grub_zalloc (sizeof (*cached));
+  if (!cached)
+    goto fail;
+  cached->path = grub_strdup (path);
+  if (!cached->path)
+    goto fail;
+  cached->entry = entry;
+  cached->fs = file->fs;
+  entry->refs++;
+
+  file->fs = &grub_file_cache_fs;
+  file->data = cached;
+  file->size = entry->size;
+  return 1;
+
+ fail:
+  grub_free (cached);
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+/* The magic numbers the decompression filters look for at the start of a
+   file.  Filters with none here are always run.  */
+static const struct
+{
+  grub_file_filter_id_t id;
+  grub_uint8_t len;
+  grub_uint8_t magic[9];
+} file_filter_magics[] =
+  {
+    { GRUB_FILE_FILTER_GZIO, 2, { 0x1f, 0x8b } },
+    { GRUB_FILE_FILTER_GZIO, 2, { 0x1f, 0x9e } },
+    { GRUB_FILE_FILTER_XZIO, 6, { 0xfd, '7', 'z', 'X', 'Z', 0x00 } },
+    { GRUB_FILE_FILTER_LZOPIO, 9,
+      { 0x89, 'L', 'Z', 'O', 0x00, 0x0d, 0x0a, 0x1a, 0x0a } },
+    { GRUB_FILE_FILTER_ZSTDIO, 4, { 0x28, 0xb5, 0x2f, 0xfd } },
+    { GRUB_FILE_FILTER_LZ4IO, 4, { 0x04, 0x22, 0x4d, 0x18 } },
+    { GRUB_FILE_FILTER_LZSSIO, 8, { 'c', 'o', 'm', 'p', 'l', 'z', 's', 's' } },
+  };
+
+/* Read the start of FILE once and leave enabled only the decompression
+   filter its magic number calls for, rather than having every filter
+   read and test the header in turn.  */
+static void
+file_filter_dispatch (grub_file_t file)
+{
+  grub_uint8_t buf[16];
+  grub_uint32_t known = 0, wanted = 0;
+  grub_file_filter_id_t id;
+  grub_ssize_t len;
+  unsigned i;
+
+  for (id = GRUB_FILE_FILTER_COMPRESSION_FIRST;
+       id <= GRUB_FILE_FILTER_COMPRESSION_LAST; id++)
+    if (grub_file_filters_enabled[id])
+      break;
+  if (id > GRUB_FILE_FILTER_COMPRESSION_LAST)
+    return;
+
+  len = grub_file_read (file, buf, sizeof (buf));
+  grub_file_seek (file, 0);
+  if (len < 0)
+    {
+      /* Let the filters run into the error themselves.  */
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  for (i = 0; i < ARRAY_SIZE (file_filter_magics); i++)
+    {
+      known |= 1 << file_filter_magics[i].id;
+      if (len >= file_filter_magics[i].len
+	  && grub_memcmp (buf, file_filter_magics[i].magic,
+			  file_filter_magics[i].len) == 0)
+	wanted |= 1 << file_filter_magics[i].id;
+    }
+  /* Both zstd and lz4 streams may start with a skippable frame.  */
+  if (len >= 4 && (grub_le_to_cpu32 (grub_get_unaligned32 (buf)) & 0xfffffff0)
+      == 0x184d2a50)
+    wanted |= (1 << GRUB_FILE_FILTER_ZSTDIO) | (1 << GRUB_FILE_FILTER_LZ4IO);
+
+  for (id = GRUB_FILE_FILTER_COMPRESSION_FIRST;
+       id <= GRUB_FILE_FILTER_COMPRESSION_LAST; id++)
+    if ((known & (1 << id)) && !(wanted & (1 << id)))
+      grub_file_filters_enabled[id] = 0;
+}
+
 /* Get the device part of the filename NAME. It is enclosed by parentheses.  */
 char *
 grub_file_get_device_name (const char *name)
@@ -67,6 +404,7 @@ grub_file_open (const char *name)
   const char *file_name;
   grub_file_filter_id_t filter;
 
+  grub_trace_enter (GRUB_TRACE_FILE_OPEN, 0, 0);
   device_name = grub_file_get_device_name (name);
   if (grub_errno)
     goto fail;
@@ -99,12 +437,20 @@ grub_file_open (const char *name)
 	goto fail;
     }
 
-  if ((file->fs->open) (file, file_name) != GRUB_ERR_NONE)
+  if (grub_file_cache_max && device->disk && file->fs != &grub_fs_blocklist
+      && file_cache_open (file, file_name))
+    ;
+  else if ((file->fs->open) (file, file_name) != GRUB_ERR_NONE)
     goto fail;
+  else if (grub_file_cache_max && device->disk
+	   && file->fs != &grub_fs_blocklist)
+    file_cache_add (file, file_name);
 
   file->name = grub_strdup (name);
   grub_errno = GRUB_ERR_NONE;
 
+  file_filter_dispatch (file);
+
   for (filter = 0; file && filter < ARRAY_SIZE (grub_file_filters_enabled);
        filter++)
     if (grub_file_filters_enabled[filter])
@@ -118,6 +464,7 @@ grub_file_open (const char *name)
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
 
+  grub_trace_exit (GRUB_TRACE_FILE_OPEN, 0, 0);
   return file;
 
  fail:
@@ -131,17 +478,52 @@ grub_file_open (const char *name)
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
 
+  grub_trace_exit (GRUB_TRACE_FILE_OPEN, 0, 0);
   return 0;
 }
 
 grub_disk_read_hook_t grub_file_progress_hook;
 
+#ifndef GRUB_UTIL
+/* Read in pieces and measure each one while it's still in the cache.  */
+static grub_ssize_t
+grub_file_read_measured (grub_file_t file, void *buf, grub_size_t len)
+{
+  grub_off_t offset = file->offset;
+  grub_ssize_t res = 0, r = 0;
+
+  while (len)
+    {
+      grub_size_t n = grub_min (len, GRUB_TPM_MEASURE_CHUNK);
+
+      /* The filesystems read from FILE->offset.  */
+      file->offset = offset + res;
+      r = (file->fs->read) (file, (char *) buf + res, n);
+      if (r <= 0)
+	break;
+      if (grub_tpm_measure_update (file->measure, (char *) buf + res, r))
+	{
+	  r = -1;
+	  break;
+	}
+      res += r;
+      len -= r;
+      if ((grub_size_t) r < n)
+	break;
+    }
+  file->offset = offset;
+  return r < 0 ? r : res;
+}
+#endif
+
 grub_ssize_t
 grub_file_read (grub_file_t file, void *buf, grub_size_t len)
 {
   grub_ssize_t res;
   grub_disk_read_hook_t read_hook;
   void *read_hook_data;
+  grub_disk_t disk = NULL;
+  int streaming = 0;
 
   if (file->offset > file->size)
     {
@@ -170,7 +552,24 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
       file->read_hook_data = file;
       file->progress_offset = file->offset;
     }
-  res = (file->fs->read) (file, buf, len);
+  /* Filters read their underlying file with the same disk, so only ever
+     turn streaming on here and let the outermost file restore it.  */
+  if (file->streaming && file->device && file->device->disk)
+    {
+      disk = file->device->disk;
+      streaming = disk->streaming;
+      disk->streaming = 1;
+    }
+  grub_trace_enter (GRUB_TRACE_FILE_READ, 0, len);
+#ifndef GRUB_UTIL
+  if (file->measure)
+    res = grub_file_read_measured (file, buf, len);
+  else
+#endif
+    res = (file->fs->read) (file, buf, len);
+  grub_trace_exit (GRUB_TRACE_FILE_READ, 0, res > 0 ? res : 0);
+  if (disk)
+    disk->streaming = streaming;
   file->read_hook = read_hook;
   file->read_hook_data = read_hook_data;
   if (res > 0)
@@ -192,6 +591,19 @@ grub_file_close (grub_file_t file)
   return grub_errno;
 }
 
+const void *
+grub_file_map (grub_file_t file, grub_off_t offset, grub_size_t len)
+{
+  /* Read hooks and measurements must see every byte go through a read.  */
+  if (! file->fs->map || file->read_hook
+#ifndef GRUB_UTIL
+      || file->measure
+#endif
+      || offset > file->size || len > file->size - offset)
+    return NULL;
+  return (file->fs->map) (file, offset, len);
+}
+
 grub_off_t
 grub_file_seek (grub_file_t file, grub_off_t offset)
 {
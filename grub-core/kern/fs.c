@@ -41,8 +41,8 @@ probe_dummy_iter (const char *filename __attribute__ ((unused)),
   return 1;
 }
 
-grub_fs_t
-grub_fs_probe (grub_device_t device)
+static grub_fs_t
+grub_fs_probe_real (grub_device_t device)
 {
   grub_fs_t p;
 
@@ -121,6 +121,17 @@ grub_fs_probe (grub_device_t device)
   return 0;
 }
 
+grub_fs_t
+grub_fs_probe (grub_device_t device)
+{
+  grub_fs_t p;
+
+  grub_trace_enter (GRUB_TRACE_FS_PROBE, 0, 0);
+  p = grub_fs_probe_real (device);
+  grub_trace_exit (GRUB_TRACE_FS_PROBE, p ? p->name : 0, 0);
+  return p;
+}
+
 
 
 /* Block list support routines.  */
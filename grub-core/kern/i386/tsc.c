@@ -110,6 +110,16 @@ grub_tsc_get_time_ms (void)
   return ((al * grub_tsc_rate) >> 32) + ah * grub_tsc_rate;
 }
 
+static void
+grub_tsc_install (void)
+{
+  grub_install_get_time_ms (grub_tsc_get_time_ms);
+  if (grub_tsc_rate)
+    grub_install_get_cycles (grub_get_tsc,
+			     grub_divmod64 (1000ULL << 32, grub_tsc_rate, 0),
+			     "TSC");
+}
+
 #ifndef GRUB_MACHINE_XEN
 /* Calibrate the TSC based on the RTC.  */
 static void
@@ -142,12 +152,12 @@ grub_tsc_init (void)
   else
     t >>= -grub_xen_shared_info->vcpu_info[0].time.tsc_shift;
   grub_tsc_rate = grub_divmod64 (t, 1000000, 0);
-  grub_install_get_time_ms (grub_tsc_get_time_ms);
+  grub_tsc_install ();
 #else
   if (grub_cpu_is_tsc_supported ())
     {
       calibrate_tsc ();
-      grub_install_get_time_ms (grub_tsc_get_time_ms);
+      grub_tsc_install ();
     }
   else
     {
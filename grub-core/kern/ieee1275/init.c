@@ -273,6 +273,45 @@ grub_parse_cmdline (void)
     }
 }
 
+#ifdef __powerpc__
+static grub_uint64_t
+grub_powerpc_get_timebase (void)
+{
+  grub_uint32_t hi, lo, hi2;
+
+  /* Retry if the low word wrapped between the two reads.  */
+  do
+    __asm__ __volatile__ ("mftbu %0\n\tmftb %1\n\tmftbu %2"
+			  : "=r" (hi), "=r" (lo), "=r" (hi2));
+  while (hi != hi2);
+
+  return (((grub_uint64_t) hi) << 32) | lo;
+}
+
+/* The timebase frequency is a property of each CPU node.  */
+static void
+grub_powerpc_timebase_init (void)
+{
+  struct grub_ieee1275_devalias alias;
+  grub_uint32_t freq = 0;
+
+  FOR_IEEE1275_DEVCHILDREN ("/cpus", alias)
+    {
+      if (grub_strcmp (alias.type, "cpu") != 0)
+	continue;
+      if (grub_ieee1275_get_integer_property (alias.phandle,
+					      "timebase-frequency", &freq,
+					      sizeof (freq), 0) == 0
+	  && freq)
+	break;
+      freq = 0;
+    }
+  grub_ieee1275_devalias_free (&alias);
+
+  grub_install_get_cycles (grub_powerpc_get_timebase, freq, "timebase");
+}
+#endif
+
 grub_addr_t grub_modbase;
 
 void
@@ -295,6 +334,9 @@ grub_machine_init (void)
 #else
   grub_install_get_time_ms (grub_rtc_get_time_ms);
 #endif
+#ifdef __powerpc__
+  grub_powerpc_timebase_init ();
+#endif
 }
 
 void
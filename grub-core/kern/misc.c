@@ -1105,6 +1105,10 @@ grub_fatal (const char *fmt, ...)
 #if BOOT_TIME_STATS
 
 #include <grub/time.h>
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU)
+#include <grub/i386/tsc.h>
+#endif
 
 struct grub_boot_time *grub_boot_time_head;
 static struct grub_boot_time **boot_time_last = &grub_boot_time_head;
@@ -1140,4 +1144,62 @@ grub_real_boot_time (const char *file,
   grub_errno = 0;
   grub_error_pop ();
 }
+
+struct grub_trace_event grub_trace_ring[GRUB_TRACE_RING_SIZE];
+grub_uint32_t grub_trace_count;
+struct grub_trace_total grub_trace_totals[GRUB_TRACE_MAX];
+
+grub_uint64_t
+grub_trace_time_us (void)
+{
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU)
+  /* grub_tsc_rate is milliseconds per cycle, in 32.32 fixed point.  */
+  if (grub_tsc_rate)
+    {
+      grub_uint32_t lo, hi;
+      grub_uint64_t a, rate;
+
+      /* Unlike grub_get_tsc, don't serialize with CPUID: it's slow under
+	 hypervisors and a few cycles of skew don't matter here.  */
+      __asm__ __volatile__ ("rdtsc":"=a" (lo), "=d" (hi));
+      a = (((grub_uint64_t) hi) << 32) | lo;
+      rate = (grub_uint64_t) grub_tsc_rate * 1000;
+
+      return (((a & 0xffffffff) * rate) >> 32) + (a >> 32) * rate;
+    }
+#endif
+  return grub_get_time_ms () * 1000;
+}
+
+/* Record an event of TYPE.  This is on the disk read path, so it
+   allocates nothing and overwrites the oldest event.  */
+void
+grub_trace (grub_uint32_t type, const char *name, grub_uint32_t arg)
+{
+  struct grub_trace_event *e;
+  struct grub_trace_total *t;
+  grub_uint64_t now;
+
+  t = &grub_trace_totals[type & ~GRUB_TRACE_EXIT];
+  now = grub_trace_time_us ();
+  if (!(type & GRUB_TRACE_EXIT))
+    {
+      t->count++;
+      if (t->depth++ == 0)
+	t->start = now;
+    }
+  else if (t->depth && --t->depth == 0)
+    t->us += now - t->start;
+
+  e = &grub_trace_ring[grub_trace_count++ % GRUB_TRACE_RING_SIZE];
+  e->us = now;
+  e->type = type;
+  e->arg = arg;
+  /* The name may be gone by the time the ring is read.  */
+  if (name)
+    grub_strncpy (e->name, name, sizeof (e->name));
+  else
+    e->name[0] = 0;
+}
 #endif
@@ -28,6 +28,13 @@
   - multiple regions may be used as free space. They may not be
   contiguous.
 
+  - the platform may add regions when the heap runs out, through
+  grub_mm_add_region_fn.
+
+  - caches register shrinkers, which are asked to give memory back before
+  the heap is grown, and to give all of it back before an allocation
+  fails.
+
   Regions are managed by a singly linked list, and the meta information is
   stored in the beginning of each region. Space after the meta information
   is used to allocate memory.
@@ -53,6 +60,14 @@
   a typical optimization against defragmentation, and makes the
   implementation a bit easier.
 
+  Small blocks, of up to GRUB_MM_SMALL_CELLS cells, are not put back into
+  the ring when freed. They go onto a free list for their exact size, and
+  allocations of that size pop them again, so neither needs to walk the
+  ring. When a list is empty it is refilled by carving a slab of
+  GRUB_MM_SLAB_CELLS cells into blocks of that size. Blocks on these lists
+  do not coalesce; when memory runs short they are all returned to the
+  rings with grub_mm_release_small.
+
   For safety, both allocated blocks and free ones are marked by magic
   numbers. Whenever anything unexpected is detected, GRUB aborts the
   operation.
@@ -65,6 +80,8 @@
 #include <grub/types.h>
 #include <grub/disk.h>
 #include <grub/dl.h>
+#include <grub/file.h>
+#include <grub/list.h>
 #include <grub/i18n.h>
 #include <grub/mm_private.h>
 
@@ -79,6 +96,70 @@
 
 
 grub_mm_region_t grub_mm_base;
+grub_mm_add_region_func_t grub_mm_add_region_fn;
+
+struct grub_mm_stats grub_mm_stats;
+
+static struct grub_mm_shrinker *grub_mm_shrinkers;
+
+/* Free small blocks, by size in cells, linked through their headers.  */
+static grub_mm_header_t small_free[GRUB_MM_SMALL_CELLS + 1];
+
+static void grub_real_free (grub_mm_header_t p, grub_mm_region_t r);
+
+#ifdef MM_DEBUG
+/* Open addressing on FILE and LINE.  */
+struct grub_mm_site grub_mm_sites[GRUB_MM_SITES];
+
+/* Charge the block at PTR to FILE:LINE, where it was just allocated.  */
+static void
+site_charge (void *ptr, const char *file, int line)
+{
+  grub_mm_header_t p = (grub_mm_header_t) ptr - 1;
+  struct grub_mm_site *site = 0;
+  unsigned h, i;
+
+  if (! ptr)
+    return;
+
+  h = ((grub_addr_t) file ^ ((unsigned) line * 0x9e3779b1U))
+    % (GRUB_MM_SITES - 1);
+  for (i = 0; i < GRUB_MM_SITES - 1; i++, h = (h + 1) % (GRUB_MM_SITES - 1))
+    if (grub_mm_sites[h].file == file && grub_mm_sites[h].line == line)
+      {
+	site = &grub_mm_sites[h];
+	break;
+      }
+    else if (! grub_mm_sites[h].file)
+      {
+	site = &grub_mm_sites[h];
+	site->file = file;
+	site->line = line;
+	break;
+      }
+  if (! site)
+    site = &grub_mm_sites[GRUB_MM_SITES - 1];
+
+  site->allocs++;
+  site->count++;
+  site->live += p->size << GRUB_MM_ALIGN_LOG2;
+  p->site = site;
+}
+
+/* Take the block P off its site.  Headers the relocator makes up have
+   garbage there, so only trust pointers into the table.  */
+static void
+site_forget (grub_mm_header_t p)
+{
+  struct grub_mm_site *site = p->site;
+
+  p->site = 0;
+  if (site < &grub_mm_sites[0] || site >= &grub_mm_sites[GRUB_MM_SITES])
+    return;
+  site->count--;
+  site->live -= p->size << GRUB_MM_ALIGN_LOG2;
+}
+#endif
 
 /* Get a header from the pointer PTR, and set *P and *R to a pointer
    to the header and a pointer to its region, respectively. PTR must
@@ -98,7 +179,8 @@ get_header_from_pointer (void *ptr, grub_mm_header_t *p, grub_mm_region_t *r)
     grub_fatal ("out of range pointer %p", ptr);
 
   *p = (grub_mm_header_t) ptr - 1;
-  if ((*p)->magic == GRUB_MM_FREE_MAGIC)
+  if ((*p)->magic == GRUB_MM_FREE_MAGIC
+      || (*p)->magic == GRUB_MM_SMALL_MAGIC)
     grub_fatal ("double free at %p", *p);
   if ((*p)->magic != GRUB_MM_ALLOC_MAGIC)
     grub_fatal ("alloc magic is broken at %p: %lx", *p,
@@ -141,7 +223,7 @@ grub_mm_init_region (void *addr, grub_size_t size)
 	    r->size += h->size << GRUB_MM_ALIGN_LOG2;
 	    r->pre_size &= (GRUB_MM_ALIGN - 1);
 	    *p = r;
-	    grub_free (h + 1);
+	    grub_real_free (h, r);
 	  }
 	*p = r;
 	return;
@@ -314,6 +396,98 @@ grub_real_malloc (grub_mm_header_t *first, grub_size_t n, grub_size_t align)
   return 0;
 }
 
+/* Carve a slab into blocks of N cells and put them on their free list.
+   The last block takes whatever is left over.  Return non-zero if
+   successful.  */
+static int
+refill_small (grub_size_t n)
+{
+  grub_mm_region_t r;
+  grub_mm_header_t h, end;
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      h = grub_real_malloc (&(r->first), GRUB_MM_SLAB_CELLS, 1);
+      if (h)
+	break;
+    }
+  if (! r)
+    return 0;
+
+  h--;
+  end = h + h->size;
+  for (; h < end; h += h->size)
+    {
+      h->size = ((grub_size_t) (end - h) >= 2 * n) ? n
+	: (grub_size_t) (end - h);
+      if (h->size > GRUB_MM_SMALL_CELLS)
+	{
+	  h->magic = GRUB_MM_ALLOC_MAGIC;
+	  grub_real_free (h, r);
+	  continue;
+	}
+      h->magic = GRUB_MM_SMALL_MAGIC;
+      h->next = small_free[h->size];
+      small_free[h->size] = h;
+      grub_mm_stats.small_cached += h->size << GRUB_MM_ALIGN_LOG2;
+    }
+  return 1;
+}
+
+/* Account for the block at PTR, about to be handed out.  */
+static void *
+count_alloc (void *ptr)
+{
+  grub_mm_header_t p = (grub_mm_header_t) ptr - 1;
+
+  grub_mm_stats.allocs++;
+  grub_mm_stats.live += p->size << GRUB_MM_ALIGN_LOG2;
+  if (grub_mm_stats.live > grub_mm_stats.peak)
+    grub_mm_stats.peak = grub_mm_stats.live;
+#ifdef MM_DEBUG
+  p->site = 0;
+#endif
+  return ptr;
+}
+
+void
+grub_mm_shrinker_register (struct grub_mm_shrinker *shrinker)
+{
+  grub_list_push (GRUB_AS_LIST_P (&grub_mm_shrinkers), GRUB_AS_LIST (shrinker));
+}
+
+void
+grub_mm_shrinker_unregister (struct grub_mm_shrinker *shrinker)
+{
+  grub_list_remove (GRUB_AS_LIST (shrinker));
+}
+
+/* The least recently used disk cache blocks go first, then cached files,
+   then whatever the modules cache.  Only if that isn't enough is the
+   disk cache dropped whole, and with it every cache built on top.  */
+grub_size_t
+grub_mm_reclaim (grub_size_t bytes)
+{
+  struct grub_mm_shrinker *shrinker;
+  grub_size_t freed = 0;
+
+  if (bytes != GRUB_MM_RECLAIM_ALL)
+    {
+      freed = grub_disk_cache_shrink (bytes);
+      if (freed < bytes)
+	freed += grub_file_cache_reclaim (bytes - freed);
+    }
+  for (shrinker = grub_mm_shrinkers; shrinker && freed < bytes;
+       shrinker = shrinker->next)
+    freed += shrinker->shrink (bytes - freed);
+  if (freed < bytes)
+    grub_disk_cache_invalidate_all ();
+
+  /* Let the small blocks coalesce with what was freed.  */
+  grub_mm_release_small ();
+  return freed;
+}
+
 /* Allocate SIZE bytes with the alignment ALIGN and return the pointer.  */
 void *
 grub_memalign (grub_size_t align, grub_size_t size)
@@ -329,6 +503,19 @@ grub_memalign (grub_size_t align, grub_size_t size)
   if (align == 0)
     align = 1;
 
+  /* Small blocks come off their free list.  Failing to get a slab, the
+     rings may still have room for the block itself.  */
+  if (align == 1 && n <= GRUB_MM_SMALL_CELLS
+      && (small_free[n] || refill_small (n)))
+    {
+      grub_mm_header_t h = small_free[n];
+
+      small_free[n] = h->next;
+      grub_mm_stats.small_cached -= n << GRUB_MM_ALIGN_LOG2;
+      h->magic = GRUB_MM_ALLOC_MAGIC;
+      return count_alloc (h + 1);
+    }
+
  again:
 
   for (r = grub_mm_base; r; r = r->next)
@@ -337,20 +524,44 @@ grub_memalign (grub_size_t align, grub_size_t size)
 
       p = grub_real_malloc (&(r->first), n, align);
       if (p)
-	return p;
+	return count_alloc (p);
     }
 
   /* If failed, increase free memory somehow.  */
   switch (count)
     {
     case 0:
-      /* Invalidate disk caches.  */
-      grub_disk_cache_invalidate_all ();
+      /* Have the caches give back about as much as is needed.  */
+      grub_mm_reclaim (n << GRUB_MM_ALIGN_LOG2);
       count++;
       goto again;
 
-#if 0
     case 1:
+      /* Ask the platform for more, enough for the block and the header
+	 of the region holding it.  */
+      count++;
+      {
+	grub_size_t bytes = ((n + align) << GRUB_MM_ALIGN_LOG2)
+	  + sizeof (struct grub_mm_region) + GRUB_MM_ALIGN;
+
+	if (grub_mm_add_region_fn && (bytes >> GRUB_MM_ALIGN_LOG2) > n
+	    && grub_mm_add_region_fn (bytes) == GRUB_ERR_NONE)
+	  {
+	    grub_mm_stats.grown++;
+	    goto again;
+	  }
+      }
+      /* Fall through.  */
+
+    case 2:
+      /* Freed memory may be too scattered for the block: drop all the
+	 caches.  */
+      count = 3;
+      grub_mm_reclaim (GRUB_MM_RECLAIM_ALL);
+      goto again;
+
+#if 0
+    case 3:
       /* Unload unneeded modules.  */
       grub_dl_unload_unneeded ();
       count++;
@@ -362,6 +573,7 @@ grub_memalign (grub_size_t align, grub_size_t size)
     }
 
  fail:
+  grub_mm_stats.failures++;
   grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return 0;
 }
@@ -386,18 +598,10 @@ grub_zalloc (grub_size_t size)
   return ret;
 }
 
-/* Deallocate the pointer PTR.  */
-void
-grub_free (void *ptr)
+/* Put the block P back into the ring of its region R.  */
+static void
+grub_real_free (grub_mm_header_t p, grub_mm_region_t r)
 {
-  grub_mm_header_t p;
-  grub_mm_region_t r;
-
-  if (! ptr)
-    return;
-
-  get_header_from_pointer (ptr, &p, &r);
-
   if (r->first->magic == GRUB_MM_ALLOC_MAGIC)
     {
       p->magic = GRUB_MM_FREE_MAGIC;
@@ -456,6 +660,59 @@ grub_free (void *ptr)
     }
 }
 
+/* Deallocate the pointer PTR.  */
+void
+grub_free (void *ptr)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+
+  if (! ptr)
+    return;
+
+  get_header_from_pointer (ptr, &p, &r);
+
+  /* Blocks the relocator hands back were never counted as handed out.  */
+  grub_mm_stats.frees++;
+  if (grub_mm_stats.live >= p->size << GRUB_MM_ALIGN_LOG2)
+    grub_mm_stats.live -= p->size << GRUB_MM_ALIGN_LOG2;
+  else
+    grub_mm_stats.live = 0;
+#ifdef MM_DEBUG
+  site_forget (p);
+#endif
+
+  if (p->size <= GRUB_MM_SMALL_CELLS)
+    {
+      p->magic = GRUB_MM_SMALL_MAGIC;
+      p->next = small_free[p->size];
+      small_free[p->size] = p;
+      grub_mm_stats.small_cached += p->size << GRUB_MM_ALIGN_LOG2;
+      return;
+    }
+
+  grub_real_free (p, r);
+}
+
+void
+grub_mm_release_small (void)
+{
+  grub_mm_header_t p;
+  grub_mm_region_t r;
+  grub_size_t n;
+
+  for (n = 1; n <= GRUB_MM_SMALL_CELLS; n++)
+    while (small_free[n])
+      {
+	p = small_free[n];
+	small_free[n] = p->next;
+	grub_mm_stats.small_cached -= n << GRUB_MM_ALIGN_LOG2;
+	p->magic = GRUB_MM_ALLOC_MAGIC;
+	get_header_from_pointer (p + 1, &p, &r);
+	grub_real_free (p, r);
+      }
+}
+
 /* Reallocate SIZE bytes and return the pointer. The contents will be
    the same as that of PTR.  */
 void *
@@ -545,6 +802,9 @@ grub_mm_dump (unsigned lineno)
 	    case GRUB_MM_ALLOC_MAGIC:
 	      grub_printf ("A:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
 	      break;
+	    case GRUB_MM_SMALL_MAGIC:
+	      grub_printf ("S:%p:%u\n", p, (unsigned int) p->size << GRUB_MM_ALIGN_LOG2);
+	      break;
 	    }
 	}
     }
@@ -560,6 +820,7 @@ grub_debug_malloc (const char *file, int line, grub_size_t size)
   if (grub_mm_debug)
     grub_printf ("%s:%d: malloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
   ptr = grub_malloc (size);
+  site_charge (ptr, file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -573,6 +834,7 @@ grub_debug_zalloc (const char *file, int line, grub_size_t size)
   if (grub_mm_debug)
     grub_printf ("%s:%d: zalloc (0x%" PRIxGRUB_SIZE ") = ", file, line, size);
   ptr = grub_zalloc (size);
+  site_charge (ptr, file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -592,6 +854,12 @@ grub_debug_realloc (const char *file, int line, void *ptr, grub_size_t size)
   if (grub_mm_debug)
     grub_printf ("%s:%d: realloc (%p, 0x%" PRIxGRUB_SIZE ") = ", file, line, ptr, size);
   ptr = grub_realloc (ptr, size);
+  if (ptr)
+    {
+      /* It may have stayed in place, charge it afresh either way.  */
+      site_forget ((grub_mm_header_t) ptr - 1);
+      site_charge (ptr, file, line);
+    }
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
@@ -607,6 +875,7 @@ grub_debug_memalign (const char *file, int line, grub_size_t align,
     grub_printf ("%s:%d: memalign (0x%" PRIxGRUB_SIZE  ", 0x%" PRIxGRUB_SIZE  
 		 ") = ", file, line, align, size);
   ptr = grub_memalign (align, size);
+  site_charge (ptr, file, line);
   if (grub_mm_debug)
     grub_printf ("%p\n", ptr);
   return ptr;
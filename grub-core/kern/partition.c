@@ -27,6 +27,191 @@
 #endif
 
 grub_partition_map_t grub_partition_map_list;
+grub_partition_autoload_hook_t grub_partition_autoload_hook;
+
+/* What each partition map found, so that iterating the partitions of a
+   disk again, as search, ls and the diskfilter scans all do, doesn't
+   reread every table.  Entries are keyed by disk, map and the partition
+   the map was looked for in, and are dropped along with the disk cache
+   and whenever a disk is written.  */
+struct grub_partition_cache_entry
+{
+  struct grub_partition_cache_entry *next;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  const struct grub_partition_map *partmap;
+  grub_disk_addr_t parent_start;
+  grub_uint64_t parent_len;
+  grub_partition_map_t parent_partmap;
+  grub_uint8_t parent_msdostype;
+  struct grub_partition *parts;
+  int nparts;
+  /* The error the map returned after the last partition, and its
+     message.  */
+  grub_err_t err;
+  char *errmsg;
+  /* Iterations going through the entry, which is freed only once they
+     are done if it was dropped.  */
+  unsigned refs;
+  int dropped;
+};
+
+static struct grub_partition_cache_entry *partition_cache;
+
+static void
+partition_cache_free (struct grub_partition_cache_entry *entry)
+{
+  grub_free (entry->parts);
+  grub_free (entry->errmsg);
+  grub_free (entry);
+}
+
+void
+grub_partition_cache_flush (void)
+{
+  while (partition_cache)
+    {
+      struct grub_partition_cache_entry *entry = partition_cache;
+
+      partition_cache = entry->next;
+      entry->dropped = 1;
+      if (entry->refs == 0)
+	partition_cache_free (entry);
+    }
+}
+
+static int
+partition_cache_match (struct grub_partition_cache_entry *entry,
+		       const struct grub_partition_map *partmap,
+		       grub_disk_t disk)
+{
+  if (entry->dev_id != disk->dev->id || entry->disk_id != disk->id
+      || entry->partmap != partmap)
+    return 0;
+  if (! disk->partition)
+    return entry->parent_partmap == 0;
+  return (entry->parent_start == grub_partition_get_start (disk->partition)
+	  && entry->parent_len == disk->partition->len
+	  && entry->parent_partmap == disk->partition->partmap
+	  && entry->parent_msdostype == disk->partition->msdostype);
+}
+
+/* Helper for partition_cache_fill.  */
+static int
+fill_iter (grub_disk_t dsk __attribute__ ((unused)),
+	   const grub_partition_t partition, void *data)
+{
+  struct grub_partition_cache_entry *entry = data;
+  struct grub_partition *parts;
+
+  /* Room for 4, then doubled whenever full.  */
+  if (entry->nparts == 0
+      || (entry->nparts >= 4 && (entry->nparts & (entry->nparts - 1)) == 0))
+    {
+      parts = grub_realloc (entry->parts, (entry->nparts ? entry->nparts * 2
+					    : 4) * sizeof (parts[0]));
+      if (! parts)
+	return 1;
+      entry->parts = parts;
+    }
+  entry->parts[entry->nparts] = *partition;
+  entry->parts[entry->nparts].parent = 0;
+  entry->nparts++;
+  return 0;
+}
+
+/* Run PARTMAP over DISK and keep what it finds.  */
+static struct grub_partition_cache_entry *
+partition_cache_fill (const struct grub_partition_map *partmap,
+		      grub_disk_t disk)
+{
+  struct grub_partition_cache_entry *entry;
+
+  entry = grub_zalloc (sizeof (*entry));
+  if (! entry)
+    return 0;
+  entry->dev_id = disk->dev->id;
+  entry->disk_id = disk->id;
+  entry->partmap = partmap;
+  if (disk->partition)
+    {
+      entry->parent_start = grub_partition_get_start (disk->partition);
+      entry->parent_len = disk->partition->len;
+      entry->parent_partmap = disk->partition->partmap;
+      entry->parent_msdostype = disk->partition->msdostype;
+    }
+
+  entry->err = partmap->iterate (disk, fill_iter, entry);
+  /* Out of memory or a failing read may come and go, so only what the
+     tables say is kept.  */
+  if (grub_errno == GRUB_ERR_OUT_OF_MEMORY
+      || (entry->err && entry->err != GRUB_ERR_BAD_PART_TABLE))
+    {
+      partition_cache_free (entry);
+      return 0;
+    }
+  if (entry->err)
+    {
+      entry->errmsg = grub_strdup (grub_errmsg);
+      if (! entry->errmsg)
+	{
+	  partition_cache_free (entry);
+	  return 0;
+	}
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  entry->next = partition_cache;
+  partition_cache = entry;
+  return entry;
+}
+
+/* Call HOOK with each partition PARTMAP finds on DISK, as PARTMAP->iterate
+   would, from the cache if the same table was read before.  */
+static grub_err_t
+grub_partition_map_iterate (const struct grub_partition_map *partmap,
+			    grub_disk_t disk,
+			    grub_partition_iterate_hook_t hook,
+			    void *hook_data)
+{
+  struct grub_partition_cache_entry *entry;
+  int i;
+
+#ifdef GRUB_UTIL
+  /* Utilities may read from several threads.  */
+  return partmap->iterate (disk, hook, hook_data);
+#endif
+
+  for (entry = partition_cache; entry; entry = entry->next)
+    if (partition_cache_match (entry, partmap, disk))
+      break;
+  if (! entry)
+    {
+      entry = partition_cache_fill (partmap, disk);
+      if (! entry)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return partmap->iterate (disk, hook, hook_data);
+	}
+    }
+
+  /* The hook may open disks, which may flush the cache.  */
+  entry->refs++;
+  for (i = 0; i < entry->nparts; i++)
+    {
+      struct grub_partition p = entry->parts[i];
+
+      if (hook (disk, &p, hook_data))
+	break;
+    }
+  entry->refs--;
+
+  if (i == entry->nparts && entry->err)
+    grub_error (entry->err, "%s", entry->errmsg);
+  if (entry->dropped && entry->refs == 0)
+    partition_cache_free (entry);
+  return grub_errno;
+}
 
 /*
  * Checks that disk->partition contains part.  This function assumes that the
@@ -95,7 +280,7 @@ grub_partition_map_probe (const grub_partition_map_t partmap,
     .p = 0
   };
 
-  partmap->iterate (disk, probe_iter, &ctx);
+  grub_partition_map_iterate (partmap, disk, probe_iter, &ctx);
   if (grub_errno)
     goto fail;
 
@@ -106,6 +291,24 @@ grub_partition_map_probe (const grub_partition_map_t partmap,
   return 0;
 }
 
+/* Look for partition NUM with PARTMAP, unless it's not the map named
+   PARTNAME.  Set grub_errno if no other map should be tried.  */
+static grub_partition_t
+grub_partition_try_map (const grub_partition_map_t partmap, grub_disk_t disk,
+			const char *partname, grub_size_t len, int num)
+{
+  grub_partition_t p;
+
+  if (len && (grub_strncmp (partmap->name, partname, len) != 0
+	      || partmap->name[len] != 0))
+    return 0;
+
+  p = grub_partition_map_probe (partmap, disk, num);
+  if (! p && grub_errno == GRUB_ERR_BAD_PART_TABLE)
+    grub_errno = GRUB_ERR_NONE;
+  return p;
+}
+
 grub_partition_t
 grub_partition_probe (struct grub_disk *disk, const char *str)
 {
@@ -129,30 +332,25 @@ grub_partition_probe (struct grub_disk *disk, const char *str)
       num = grub_strtoul (ptr, (char **) &ptr, 0) - 1;
 
       curpart = 0;
+      disk->partition = part;
       /* Use the first partition map type found.  */
       FOR_PARTITION_MAPS(partmap)
       {
-	if (partname_end != partname &&
-	    (grub_strncmp (partmap->name, partname, partname_end - partname)
-	     != 0 || partmap->name[partname_end - partname] != 0))
-	  continue;
-
-	disk->partition = part;
-	curpart = grub_partition_map_probe (partmap, disk, num);
-	disk->partition = tail;
-	if (curpart)
+	curpart = grub_partition_try_map (partmap, disk, partname,
+					  partname_end - partname, num);
+	if (curpart || grub_errno)
 	  break;
-
-	if (grub_errno == GRUB_ERR_BAD_PART_TABLE)
-	  {
-	    /* Continue to next partition map type.  */
-	    grub_errno = GRUB_ERR_NONE;
-	    continue;
-	  }
-
-	break;
       }
 
+      /* A newly loaded map is at the head of the list.  */
+      while (! curpart && ! grub_errno && grub_partition_autoload_hook
+	     && grub_partition_autoload_hook (partname,
+					      partname_end - partname))
+	curpart = grub_partition_try_map (grub_partition_map_list, disk,
+					  partname, partname_end - partname,
+					  num);
+      disk->partition = tail;
+
       if (! curpart)
 	{
 	  while (part)
@@ -205,7 +403,7 @@ part_iterate (grub_disk_t dsk, const grub_partition_t partition, void *data)
       FOR_PARTITION_MAPS(partmap)
       {
 	grub_err_t err;
-	err = partmap->iterate (dsk, part_iterate, ctx);
+	err = grub_partition_map_iterate (partmap, dsk, part_iterate, ctx);
 	if (err)
 	  grub_errno = GRUB_ERR_NONE;
 	if (ctx->ret)
@@ -227,10 +425,13 @@ grub_partition_iterate (struct grub_disk *disk,
   };
   const struct grub_partition_map *partmap;
 
+  /* Every partition needs every map.  */
+  while (grub_partition_autoload_hook && grub_partition_autoload_hook (0, 0));
+
   FOR_PARTITION_MAPS(partmap)
   {
     grub_err_t err;
-    err = partmap->iterate (disk, part_iterate, &ctx);
+    err = grub_partition_map_iterate (partmap, disk, part_iterate, &ctx);
     if (err)
       grub_errno = GRUB_ERR_NONE;
     if (ctx.ret)
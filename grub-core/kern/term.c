@@ -33,6 +33,7 @@ grub_uint8_t grub_term_normal_color = GRUB_TERM_DEFAULT_NORMAL_COLOR;
 grub_uint8_t grub_term_highlight_color = GRUB_TERM_DEFAULT_HIGHLIGHT_COLOR;
 
 void (*grub_term_poll_usb) (int wait_for_completion) = NULL;
+void (*grub_term_flush_deferred) (void) = NULL;
 void (*grub_net_poll_cards_idle) (void) = NULL;
 
 /* Put a Unicode character.  */
@@ -94,6 +95,9 @@ grub_getkey_noblock (void)
   if (grub_net_poll_cards_idle)
     grub_net_poll_cards_idle ();
 
+  if (grub_term_flush_deferred)
+    grub_term_flush_deferred ();
+
   FOR_ACTIVE_TERM_INPUTS(term)
   {
     int key = term->getkey (term);
@@ -18,12 +18,24 @@
  */
 
 #include <grub/time.h>
+#include <grub/misc.h>
 
 typedef grub_uint64_t (*get_time_ms_func_t) (void);
+typedef grub_uint64_t (*get_cycles_func_t) (void);
 
 /* Function pointer to the implementation in use.  */
 static get_time_ms_func_t get_time_ms_func;
 
+/* The cycle counter, if the platform found one.  Without it cycles are
+   milliseconds.  */
+static get_cycles_func_t get_cycles_func;
+static grub_uint64_t cycles_hz = 1000;
+static grub_uint64_t cycles_base;
+/* Nanoseconds per cycle, in 32.32 fixed point split in two so that the
+   conversion doesn't overflow.  */
+static grub_uint64_t ns_per_cycle = 1000000;
+static grub_uint32_t ns_per_cycle_frac;
+
 grub_uint64_t
 grub_get_time_ms (void)
 {
@@ -35,3 +47,46 @@ grub_install_get_time_ms (get_time_ms_func_t func)
 {
   get_time_ms_func = func;
 }
+
+grub_uint64_t
+grub_get_cycles (void)
+{
+  if (get_cycles_func)
+    return get_cycles_func () - cycles_base;
+  return get_time_ms_func ();
+}
+
+grub_uint64_t
+grub_get_cycles_hz (void)
+{
+  return cycles_hz;
+}
+
+grub_uint64_t
+grub_get_time_ns (void)
+{
+  grub_uint64_t c = grub_get_cycles ();
+
+  return c * ns_per_cycle
+    + (((c & 0xffffffff) * ns_per_cycle_frac) >> 32)
+    + (c >> 32) * ns_per_cycle_frac;
+}
+
+void
+grub_install_get_cycles (get_cycles_func_t func, grub_uint64_t hz,
+			 const char *name)
+{
+  grub_uint64_t rem;
+
+  if (hz == 0)
+    return;
+
+  ns_per_cycle = grub_divmod64 (1000000000, hz, &rem);
+  ns_per_cycle_frac = grub_divmod64 (rem << 32, hz, 0);
+  cycles_hz = hz;
+  cycles_base = func ();
+  get_cycles_func = func;
+
+  grub_dprintf ("time", "%s counter at %llu Hz\n", name,
+		(unsigned long long) hz);
+}
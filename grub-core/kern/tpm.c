@@ -11,3 +11,158 @@ grub_tpm_measure (unsigned char *buf, grub_size_t size, grub_uint8_t pcr,
 {
   return grub_tpm_log_event(buf, size, pcr, description);
 }
+
+#ifdef GRUB_MACHINE_EFI
+#define ROL(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+/* One SHA-1 block.  The schedule is kept as a ring of 16 words.  */
+static void
+sha1_block (grub_uint32_t *h, const grub_uint8_t *p)
+{
+  grub_uint32_t w[16], a, b, c, d, e, t;
+  int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = grub_be_to_cpu32 (grub_get_unaligned32 (p + 4 * i));
+
+  a = h[0];
+  b = h[1];
+  c = h[2];
+  d = h[3];
+  e = h[4];
+  for (i = 0; i < 80; i++)
+    {
+      if (i >= 16)
+	{
+	  t = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15];
+	  w[i & 15] = ROL (t, 1);
+	}
+      if (i < 20)
+	t = ((b & c) | (~b & d)) + 0x5a827999;
+      else if (i < 40)
+	t = (b ^ c ^ d) + 0x6ed9eba1;
+      else if (i < 60)
+	t = ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdc;
+      else
+	t = (b ^ c ^ d) + 0xca62c1d6;
+      t += ROL (a, 5) + e + w[i & 15];
+      e = d;
+      d = c;
+      c = ROL (b, 30);
+      b = a;
+      a = t;
+    }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+  h[4] += e;
+}
+
+static void
+sha1_write (struct grub_tpm_measure_ctx *ctx, const grub_uint8_t *p,
+	    grub_size_t size)
+{
+  unsigned used = ctx->sha1.count & 63;
+
+  ctx->sha1.count += size;
+  if (used)
+    {
+      unsigned n = 64 - used;
+
+      if (n > size)
+	n = size;
+      grub_memcpy (ctx->sha1.block + used, p, n);
+      p += n;
+      size -= n;
+      if (used + n < 64)
+	return;
+      sha1_block (ctx->sha1.h, ctx->sha1.block);
+    }
+  for (; size >= 64; p += 64, size -= 64)
+    sha1_block (ctx->sha1.h, p);
+  grub_memcpy (ctx->sha1.block, p, size);
+}
+
+static void
+sha1_final (struct grub_tpm_measure_ctx *ctx, grub_uint8_t *digest)
+{
+  grub_uint64_t bits = ctx->sha1.count << 3;
+  grub_uint8_t pad[72];
+  unsigned n, i;
+
+  n = 64 - ((ctx->sha1.count + 8) & 63);
+  grub_memset (pad, 0, sizeof (pad));
+  pad[0] = 0x80;
+  for (i = 0; i < 8; i++)
+    pad[n + i] = bits >> (56 - 8 * i);
+  sha1_write (ctx, pad, n + 8);
+  for (i = 0; i < 5; i++)
+    grub_set_unaligned32 (digest + 4 * i, grub_cpu_to_be32 (ctx->sha1.h[i]));
+}
+#endif
+
+void
+grub_tpm_measure_begin (struct grub_tpm_measure_ctx *ctx, grub_uint8_t pcr,
+			const char *description)
+{
+  grub_memset (ctx, 0, sizeof (*ctx));
+  ctx->pcr = pcr;
+  ctx->description = description;
+#ifdef GRUB_MACHINE_EFI
+  ctx->hashing = grub_tpm_log_digest_supported ();
+  ctx->sha1.h[0] = 0x67452301;
+  ctx->sha1.h[1] = 0xefcdab89;
+  ctx->sha1.h[2] = 0x98badcfe;
+  ctx->sha1.h[3] = 0x10325476;
+  ctx->sha1.h[4] = 0xc3d2e1f0;
+#endif
+}
+
+/* Add SIZE bytes at BUF.  Without hashing here pieces have to follow each
+   other in memory; a piece which doesn't starts a new measurement.  */
+grub_err_t
+grub_tpm_measure_update (struct grub_tpm_measure_ctx *ctx, void *buf,
+			 grub_size_t size)
+{
+#ifdef GRUB_MACHINE_EFI
+  if (ctx->hashing)
+    {
+      sha1_write (ctx, buf, size);
+      return GRUB_ERR_NONE;
+    }
+#endif
+  if (ctx->size && ctx->start + ctx->size != buf)
+    {
+      grub_err_t err;
+
+      err = grub_tpm_measure_finish (ctx);
+      if (err)
+	return err;
+    }
+  if (! ctx->size)
+    ctx->start = buf;
+  ctx->size += size;
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_tpm_measure_finish (struct grub_tpm_measure_ctx *ctx)
+{
+  grub_err_t err;
+
+#ifdef GRUB_MACHINE_EFI
+  if (ctx->hashing)
+    {
+      grub_uint8_t digest[SHA1_DIGEST_SIZE];
+
+      sha1_final (ctx, digest);
+      return grub_tpm_log_digest (digest, ctx->pcr, ctx->description);
+    }
+#endif
+  err = grub_tpm_log_event (ctx->start, ctx->size, ctx->pcr,
+			    ctx->description);
+  ctx->start = 0;
+  ctx->size = 0;
+  return err;
+}
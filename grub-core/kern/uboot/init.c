@@ -137,6 +137,9 @@ grub_machine_init (void)
       timer_start = grub_uboot_get_timer (0);
       grub_install_get_time_ms (uboot_timer_ms);
     }
+#if defined (__arm__) || defined (__aarch64__)
+  grub_arm_timer_init ();
+#endif
 
   /* Initialize  */
   grub_ubootdisk_init ();
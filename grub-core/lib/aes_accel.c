@@ -0,0 +1,328 @@
+/* aes_accel.c - AES using the instructions of the CPU.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/crypto.h>
+#if defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Both AES-NI and the ARMv8 crypto extensions only provide the rounds.
+   The key schedule is expanded here, the decryption one being in the
+   "equivalent inverse cipher" form both of them expect: encryption keys
+   in reverse order, InvMixColumns applied to all but the outer two.  */
+
+#define AES_BLOCKSIZE	16
+#define AES_MAX_ROUNDS	14
+
+struct aes_accel_context
+{
+  grub_uint8_t enc[AES_MAX_ROUNDS + 1][AES_BLOCKSIZE];
+  grub_uint8_t dec[AES_MAX_ROUNDS + 1][AES_BLOCKSIZE];
+  unsigned rounds;
+};
+
+/* In lib/ARCH/aes_accel.S.  */
+void grub_aes_accel_encrypt (const void *keys, unsigned rounds,
+			     grub_uint8_t *out, const grub_uint8_t *in);
+void grub_aes_accel_decrypt (const void *keys, unsigned rounds,
+			     grub_uint8_t *out, const grub_uint8_t *in);
+void grub_aes_accel_encrypt_blocks (const void *keys, unsigned rounds,
+				    grub_uint8_t *out, const grub_uint8_t *in,
+				    grub_size_t nblocks);
+void grub_aes_accel_decrypt_blocks (const void *keys, unsigned rounds,
+				    grub_uint8_t *out, const grub_uint8_t *in,
+				    grub_size_t nblocks);
+
+static grub_uint8_t sbox[256];
+
+static inline grub_uint8_t
+rotl8 (grub_uint8_t x, int n)
+{
+  return (x << n) | (x >> (8 - n));
+}
+
+static inline grub_uint8_t
+xtime (grub_uint8_t x)
+{
+  return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static grub_uint8_t
+gf_mul (grub_uint8_t a, grub_uint8_t b)
+{
+  grub_uint8_t r = 0;
+
+  for (; b; b >>= 1, a = xtime (a))
+    if (b & 1)
+      r ^= a;
+  return r;
+}
+
+static void
+init_sbox (void)
+{
+  grub_uint8_t p = 1, q = 1;
+
+  /* P walks through all non-zero elements of GF(2^8) as powers of 3,
+     Q through their inverses as powers of 3^-1.  */
+  do
+    {
+      p = p ^ xtime (p);
+      q ^= q << 1;
+      q ^= q << 2;
+      q ^= q << 4;
+      if (q & 0x80)
+	q ^= 0x09;
+      sbox[p] = 0x63 ^ q ^ rotl8 (q, 1) ^ rotl8 (q, 2)
+	^ rotl8 (q, 3) ^ rotl8 (q, 4);
+    }
+  while (p != 1);
+  sbox[0] = 0x63;
+}
+
+static void
+inv_mix_column (grub_uint8_t *d, const grub_uint8_t *s)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    d[i] = gf_mul (s[i], 14) ^ gf_mul (s[(i + 1) % 4], 11)
+      ^ gf_mul (s[(i + 2) % 4], 13) ^ gf_mul (s[(i + 3) % 4], 9);
+}
+
+static gcry_err_code_t
+aes_accel_setkey (void *context, const unsigned char *key, unsigned keylen)
+{
+  struct aes_accel_context *ctx = context;
+  grub_uint8_t *w = &ctx->enc[0][0];
+  grub_uint8_t rcon = 1;
+  unsigned nk, i, total;
+
+  if (keylen != 16 && keylen != 24 && keylen != 32)
+    return GPG_ERR_INV_KEYLEN;
+
+  nk = keylen / 4;
+  ctx->rounds = nk + 6;
+  total = 4 * (ctx->rounds + 1);
+
+  grub_memcpy (w, key, keylen);
+  for (i = nk; i < total; i++)
+    {
+      grub_uint8_t t[4];
+
+      grub_memcpy (t, w + 4 * (i - 1), 4);
+      if (i % nk == 0)
+	{
+	  grub_uint8_t t0 = t[0];
+	  t[0] = sbox[t[1]] ^ rcon;
+	  t[1] = sbox[t[2]];
+	  t[2] = sbox[t[3]];
+	  t[3] = sbox[t0];
+	  rcon = xtime (rcon);
+	}
+      else if (nk > 6 && i % nk == 4)
+	{
+	  t[0] = sbox[t[0]];
+	  t[1] = sbox[t[1]];
+	  t[2] = sbox[t[2]];
+	  t[3] = sbox[t[3]];
+	}
+      w[4 * i] = w[4 * (i - nk)] ^ t[0];
+      w[4 * i + 1] = w[4 * (i - nk) + 1] ^ t[1];
+      w[4 * i + 2] = w[4 * (i - nk) + 2] ^ t[2];
+      w[4 * i + 3] = w[4 * (i - nk) + 3] ^ t[3];
+    }
+
+  grub_memcpy (ctx->dec[0], ctx->enc[ctx->rounds], AES_BLOCKSIZE);
+  for (i = 1; i < ctx->rounds; i++)
+    {
+      unsigned j;
+      for (j = 0; j < AES_BLOCKSIZE; j += 4)
+	inv_mix_column (&ctx->dec[i][j], &ctx->enc[ctx->rounds - i][j]);
+    }
+  grub_memcpy (ctx->dec[ctx->rounds], ctx->enc[0], AES_BLOCKSIZE);
+
+  return GPG_ERR_NO_ERROR;
+}
+
+static void
+aes_accel_encrypt (void *context, unsigned char *out, const unsigned char *in)
+{
+  struct aes_accel_context *ctx = context;
+
+  grub_aes_accel_encrypt (ctx->enc, ctx->rounds, out, in);
+}
+
+static void
+aes_accel_decrypt (void *context, unsigned char *out, const unsigned char *in)
+{
+  struct aes_accel_context *ctx = context;
+
+  grub_aes_accel_decrypt (ctx->dec, ctx->rounds, out, in);
+}
+
+static void
+aes_accel_encrypt_blocks (void *context, unsigned char *out,
+			  const unsigned char *in, grub_size_t nblocks)
+{
+  struct aes_accel_context *ctx = context;
+
+  grub_aes_accel_encrypt_blocks (ctx->enc, ctx->rounds, out, in, nblocks);
+}
+
+static void
+aes_accel_decrypt_blocks (void *context, unsigned char *out,
+			  const unsigned char *in, grub_size_t nblocks)
+{
+  struct aes_accel_context *ctx = context;
+
+  grub_aes_accel_decrypt_blocks (ctx->dec, ctx->rounds, out, in, nblocks);
+}
+
+static int
+aes_accel_supported (void)
+{
+#if defined (__x86_64__)
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  /* CPUID.01H:ECX.AESNI.  */
+  return !!(ecx & (1 << 25));
+#elif defined (__aarch64__)
+  grub_uint64_t isar0;
+
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  /* ID_AA64ISAR0_EL1.AES is at least 1 when AESE and friends exist.  */
+  return ((isar0 >> 4) & 0xf) != 0;
+#else
+  return 0;
+#endif
+}
+
+/* FIPS-197, appendix C.1.  */
+static int
+aes_accel_selftest (void)
+{
+  static const grub_uint8_t key[16] =
+    { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+      0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+  static const grub_uint8_t plain[16] =
+    { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+      0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+  static const grub_uint8_t cipher[16] =
+    { 0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+      0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a };
+  struct aes_accel_context ctx;
+  grub_uint8_t buf[16];
+
+  aes_accel_setkey (&ctx, key, sizeof (key));
+  aes_accel_encrypt (&ctx, buf, plain);
+  if (grub_memcmp (buf, cipher, sizeof (buf)) != 0)
+    return 0;
+  aes_accel_decrypt (&ctx, buf, cipher);
+  return grub_memcmp (buf, plain, sizeof (buf)) == 0;
+}
+
+static const char *aes_accel_names[] =
+  {
+    "RIJNDAEL",
+    "AES128",
+    "AES-128",
+    NULL
+  };
+
+static const char *aes_accel192_names[] =
+  {
+    "RIJNDAEL192",
+    "AES-192",
+    NULL
+  };
+
+static const char *aes_accel256_names[] =
+  {
+    "RIJNDAEL256",
+    "AES-256",
+    NULL
+  };
+
+/* Preferred to gcry_rijndael whichever gets loaded first.  */
+#define AES_ACCEL_PRIORITY	10
+
+#ifdef GRUB_UTIL
+#define AES_ACCEL_MODNAME	.modname = "aes_accel",
+#else
+#define AES_ACCEL_MODNAME
+#endif
+
+#define AES_ACCEL_SPEC(nm, names, bits)				\
+  {								\
+    .name = nm,							\
+    .aliases = names,						\
+    .blocksize = AES_BLOCKSIZE,					\
+    .keylen = bits,						\
+    .contextsize = sizeof (struct aes_accel_context),		\
+    .setkey = aes_accel_setkey,					\
+    .encrypt = aes_accel_encrypt,				\
+    .decrypt = aes_accel_decrypt,				\
+    AES_ACCEL_MODNAME						\
+    .priority = AES_ACCEL_PRIORITY,				\
+    .encrypt_blocks = aes_accel_encrypt_blocks,			\
+    .decrypt_blocks = aes_accel_decrypt_blocks			\
+  }
+
+static gcry_cipher_spec_t aes_accel_specs[] =
+  {
+    AES_ACCEL_SPEC ("AES", aes_accel_names, 128),
+    AES_ACCEL_SPEC ("AES192", aes_accel192_names, 192),
+    AES_ACCEL_SPEC ("AES256", aes_accel256_names, 256)
+  };
+
+static int aes_accel_registered;
+
+GRUB_MOD_INIT(aes_accel)
+{
+  unsigned i;
+
+  if (!aes_accel_supported ())
+    return;
+
+  init_sbox ();
+  if (!aes_accel_selftest ())
+    return;
+
+  for (i = 0; i < ARRAY_SIZE (aes_accel_specs); i++)
+    grub_cipher_register (&aes_accel_specs[i]);
+  aes_accel_registered = 1;
+}
+
+GRUB_MOD_FINI(aes_accel)
+{
+  unsigned i;
+
+  if (!aes_accel_registered)
+    return;
+
+  for (i = 0; i < ARRAY_SIZE (aes_accel_specs); i++)
+    grub_cipher_unregister (&aes_accel_specs[i]);
+}
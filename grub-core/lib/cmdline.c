@@ -63,8 +63,10 @@ unsigned int grub_loader_cmdline_size (int argc, char *argv[])
   return size;
 }
 
-int grub_create_loader_cmdline (int argc, char *argv[], char *buf,
-				grub_size_t size)
+/* Write the arguments quoted and separated by spaces, followed by EXTRA as
+   is, keeping track of the length instead of measuring the result.  */
+int grub_create_loader_cmdline_extra (int argc, char *argv[], const char *extra,
+				      char *buf, grub_size_t size)
 {
   int i, space;
   unsigned int arg_size;
@@ -99,14 +101,32 @@ int grub_create_loader_cmdline (int argc, char *argv[], char *buf,
       *buf++ = ' ';
     }
 
+  if (extra && i == argc)
+    {
+      grub_size_t extra_size = grub_strlen (extra);
+
+      if (size >= extra_size + 1)
+	{
+	  grub_memcpy (buf, extra, extra_size);
+	  buf += extra_size;
+	  *buf++ = ' ';
+	}
+    }
+
   /* Replace last space with null.  */
-  if (i)
+  if (buf != orig)
     buf--;
 
   *buf = 0;
 
-  grub_tpm_measure ((void *)orig, grub_strlen (orig), GRUB_CMDLINE_PCR,
+  grub_tpm_measure ((void *)orig, buf - orig, GRUB_CMDLINE_PCR,
 		    "Kernel Commandline");
 
   return i;
 }
+
+int grub_create_loader_cmdline (int argc, char *argv[], char *buf,
+				grub_size_t size)
+{
+  return grub_create_loader_cmdline_extra (argc, argv, 0, buf, size);
+}
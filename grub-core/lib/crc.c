@@ -18,59 +18,156 @@
  */
 
 #include <grub/types.h>
+#include <grub/dl.h>
 #include <grub/lib/crc.h>
+#if defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
 
-static grub_uint32_t crc32c_table [256];
+GRUB_MOD_LICENSE ("GPLv3+");
 
-/* Helper for init_crc32c_table.  */
-static grub_uint32_t
-reflect (grub_uint32_t ref, int len)
+/* Both CRCs are the reflected form, processed eight bytes per step with
+   one table per byte position ("slice-by-8").  CRC32C can also use the
+   instructions SSE4.2 and ARMv8 provide for it; the IEEE polynomial has
+   no such instruction outside of carry-less multiplication.  */
+
+#define CRC32C_POLY	0x82f63b78
+#define CRC32_POLY	0xedb88320
+
+static grub_uint32_t crc32c_table[8][256];
+static grub_uint32_t crc32_table[8][256];
+
+static void
+init_crc_table (grub_uint32_t table[8][256], grub_uint32_t poly)
 {
-  grub_uint32_t result = 0;
-  int i;
+  unsigned i, j;
 
-  for (i = 1; i <= len; i++)
+  for (i = 0; i < 256; i++)
     {
-      if (ref & 1)
-	result |= 1 << (len - i);
-      ref >>= 1;
+      grub_uint32_t c = i;
+
+      for (j = 0; j < 8; j++)
+	c = (c & 1) ? (c >> 1) ^ poly : (c >> 1);
+      table[0][i] = c;
     }
 
-  return result;
+  for (i = 0; i < 256; i++)
+    for (j = 1; j < 8; j++)
+      table[j][i] = (table[j - 1][i] >> 8)
+	^ table[0][table[j - 1][i] & 0xff];
 }
 
-static void
-init_crc32c_table (void)
+static grub_uint32_t
+crc_slice8 (grub_uint32_t table[8][256], grub_uint32_t crc,
+	    const grub_uint8_t *p, grub_size_t size)
 {
-  grub_uint32_t polynomial = 0x1edc6f41;
-  int i, j;
+  for (; size && ((grub_addr_t) p & 7); size--)
+    crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
 
-  for(i = 0; i < 256; i++)
+  for (; size >= 8; size -= 8, p += 8)
     {
-      crc32c_table[i] = reflect(i, 8) << 24;
-      for (j = 0; j < 8; j++)
-        crc32c_table[i] = (crc32c_table[i] << 1) ^
-            (crc32c_table[i] & (1 << 31) ? polynomial : 0);
-      crc32c_table[i] = reflect(crc32c_table[i], 32);
+      grub_uint32_t a, b;
+
+      a = grub_le_to_cpu32 (*(const grub_uint32_t *) p) ^ crc;
+      b = grub_le_to_cpu32 (*(const grub_uint32_t *) (p + 4));
+      crc = table[7][a & 0xff] ^ table[6][(a >> 8) & 0xff]
+	^ table[5][(a >> 16) & 0xff] ^ table[4][a >> 24]
+	^ table[3][b & 0xff] ^ table[2][(b >> 8) & 0xff]
+	^ table[1][(b >> 16) & 0xff] ^ table[0][b >> 24];
     }
+
+  for (; size; size--)
+    crc = (crc >> 8) ^ table[0][(crc ^ *p++) & 0xff];
+
+  return crc;
+}
+
+#if defined (__x86_64__) || (defined (__aarch64__) && !defined (GRUB_UTIL))
+#define CRC32C_HW	1
+
+static int
+crc32c_hw_supported (void)
+{
+  static int supported = -1;
+
+  if (supported >= 0)
+    return supported;
+
+#if defined (__x86_64__)
+  {
+    grub_uint32_t eax, ebx, ecx, edx;
+
+    grub_cpuid (1, eax, ebx, ecx, edx);
+    /* CPUID.01H:ECX.SSE4_2.  */
+    supported = !!(ecx & (1 << 20));
+  }
+#else
+  {
+    grub_uint64_t isar0;
+
+    asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+    /* ID_AA64ISAR0_EL1.CRC32 is 1 when CRC32C and friends exist.  */
+    supported = ((isar0 >> 16) & 0xf) != 0;
+  }
+#endif
+  return supported;
+}
+
+static grub_uint32_t
+crc32c_hw (grub_uint32_t crc, const grub_uint8_t *p, grub_size_t size)
+{
+#if defined (__x86_64__)
+  grub_uint64_t crc64;
+
+  for (; size && ((grub_addr_t) p & 7); size--, p++)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+
+  crc64 = crc;
+  for (; size >= 8; size -= 8, p += 8)
+    asm ("crc32q %1, %0" : "+r" (crc64)
+	 : "rm" (*(const grub_uint64_t *) p));
+  crc = crc64;
+
+  for (; size; size--, p++)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*p));
+#else
+  for (; size && ((grub_addr_t) p & 7); size--, p++)
+    asm (".arch_extension crc\n\tcrc32cb %w0, %w0, %w1"
+	 : "+r" (crc) : "r" (*p));
+
+  for (; size >= 8; size -= 8, p += 8)
+    asm (".arch_extension crc\n\tcrc32cx %w0, %w0, %x1"
+	 : "+r" (crc) : "r" (*(const grub_uint64_t *) p));
+
+  for (; size; size--, p++)
+    asm (".arch_extension crc\n\tcrc32cb %w0, %w0, %w1"
+	 : "+r" (crc) : "r" (*p));
+#endif
+  return crc;
 }
+#endif
 
 grub_uint32_t
-grub_getcrc32c (grub_uint32_t crc, const void *buf, int size)
+grub_getcrc32c (grub_uint32_t crc, const void *buf, grub_size_t size)
 {
-  int i;
-  const grub_uint8_t *data = buf;
+  crc ^= 0xffffffff;
 
-  if (! crc32c_table[1])
-    init_crc32c_table ();
+#ifdef CRC32C_HW
+  if (crc32c_hw_supported ())
+    return crc32c_hw (crc, buf, size) ^ 0xffffffff;
+#endif
 
-  crc^= 0xffffffff;
+  if (! crc32c_table[0][1])
+    init_crc_table (crc32c_table, CRC32C_POLY);
 
-  for (i = 0; i < size; i++)
-    {
-      crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *data];
-      data++;
-    }
+  return crc_slice8 (crc32c_table, crc, buf, size) ^ 0xffffffff;
+}
+
+grub_uint32_t
+grub_getcrc32 (grub_uint32_t crc, const void *buf, grub_size_t size)
+{
+  if (! crc32_table[0][1])
+    init_crc_table (crc32_table, CRC32_POLY);
 
-  return crc ^ 0xffffffff;
+  return crc_slice8 (crc32_table, crc ^ 0xffffffff, buf, size) ^ 0xffffffff;
 }
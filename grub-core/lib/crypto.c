@@ -86,8 +86,13 @@ void _gcry_log_error (const char *fmt, ...)
 void 
 grub_cipher_register (gcry_cipher_spec_t *cipher)
 {
-  cipher->next = grub_ciphers;
-  grub_ciphers = cipher;
+  gcry_cipher_spec_t **ciph;
+
+  for (ciph = &grub_ciphers; *ciph; ciph = &((*ciph)->next))
+    if ((*ciph)->priority <= cipher->priority)
+      break;
+  cipher->next = *ciph;
+  *ciph = cipher;
 }
 
 void
@@ -105,8 +110,13 @@ grub_cipher_unregister (gcry_cipher_spec_t *cipher)
 void 
 grub_md_register (gcry_md_spec_t *digest)
 {
-  digest->next = grub_digests;
-  grub_digests = digest;
+  gcry_md_spec_t **md;
+
+  for (md = &grub_digests; *md; md = &((*md)->next))
+    if ((*md)->priority <= digest->priority)
+      break;
+  digest->next = *md;
+  *md = digest;
 }
 
 void 
@@ -212,6 +222,11 @@ grub_crypto_ecb_decrypt (grub_crypto_cipher_handle_t cipher,
   if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
       || ((size & (blocksize - 1)) != 0))
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->decrypt_blocks)
+    {
+      cipher->cipher->decrypt_blocks (cipher->ctx, out, in, size / blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (const grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += blocksize, outptr += blocksize)
@@ -232,6 +247,11 @@ grub_crypto_ecb_encrypt (grub_crypto_cipher_handle_t cipher,
   if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
       || ((size & (blocksize - 1)) != 0))
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->encrypt_blocks)
+    {
+      cipher->cipher->encrypt_blocks (cipher->ctx, out, in, size / blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (const grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += blocksize, outptr += blocksize)
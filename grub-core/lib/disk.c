@@ -34,15 +34,12 @@ static void
 grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
 			    grub_disk_addr_t sector)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
 
   sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_lookup (dev_id, disk_id, sector);
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector && cache->data)
+  if (cache)
     {
       cache->lock = 1;
       grub_free (cache->data);
@@ -63,6 +60,11 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     return -1;
 
+  /* Cached file contents or partition tables may be what's
+     overwritten.  */
+  grub_file_cache_flush ();
+  grub_partition_cache_flush ();
+
   aligned_sector = (sector & ~((1ULL << (disk->log_sector_size
 					 - GRUB_DISK_SECTOR_BITS)) - 1));
   real_offset = offset + ((sector - aligned_sector) << GRUB_DISK_SECTOR_BITS);
@@ -19,7 +19,6 @@
  */
 
 #include <grub/charset.h>
-#include <grub/crypto.h>
 #include <grub/device.h>
 #include <grub/disk.h>
 #include <grub/misc.h>
@@ -27,11 +26,26 @@
 #include <grub/dl.h>
 #include <grub/msdos_partition.h>
 #include <grub/gpt_partition.h>
+#include <grub/lib/crc.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 static grub_uint8_t grub_gpt_magic[] = GRUB_GPT_HEADER_MAGIC;
 
+/* Parsed tables kept across grub_gpt_read calls, one per disk.  */
+struct grub_gpt_cache
+{
+  struct grub_gpt_cache *next;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t total_sectors;
+  grub_gpt_t gpt;
+};
+
+static struct grub_gpt_cache *grub_gpt_cache_list;
+static int grub_gpt_cache_hooked;
+static void (*grub_gpt_prev_invalidate_hook) (void);
+
 
 char *
 grub_gpt_guid_to_str (grub_gpt_guid_t *guid)
@@ -146,12 +160,7 @@ grub_gpt_size_to_sectors (grub_gpt_t gpt, grub_size_t size)
 static void
 grub_gpt_lecrc32 (grub_uint32_t *crc, const void *data, grub_size_t len)
 {
-  grub_uint32_t crc32_val;
-
-  grub_crypto_hash (GRUB_MD_CRC32, &crc32_val, data, len);
-
-  /* GRUB_MD_CRC32 always uses big endian, gpt is always little.  */
-  *crc = grub_swap_bytes32 (crc32_val);
+  *crc = grub_cpu_to_le32 (grub_getcrc32 (0, data, len));
 }
 
 static void
@@ -309,8 +318,8 @@ fail:
   return grub_errno;
 }
 
-grub_gpt_t
-grub_gpt_read (grub_disk_t disk)
+static grub_gpt_t
+grub_gpt_read_uncached (grub_disk_t disk)
 {
   grub_gpt_t gpt;
 
@@ -367,6 +376,150 @@ fail:
   return NULL;
 }
 
+static grub_gpt_t
+grub_gpt_copy (grub_gpt_t gpt)
+{
+  grub_gpt_t copy;
+
+  copy = grub_malloc (sizeof (*copy));
+  if (!copy)
+    return NULL;
+
+  grub_memcpy (copy, gpt, sizeof (*copy));
+  copy->entries = grub_malloc (gpt->entries_size);
+  if (!copy->entries)
+    {
+      grub_free (copy);
+      return NULL;
+    }
+
+  grub_memcpy (copy->entries, gpt->entries, gpt->entries_size);
+  return copy;
+}
+
+static void
+grub_gpt_cache_flush (void)
+{
+  struct grub_gpt_cache *cache, *next;
+
+  for (cache = grub_gpt_cache_list; cache; cache = next)
+    {
+      next = cache->next;
+      grub_gpt_free (cache->gpt);
+      grub_free (cache);
+    }
+  grub_gpt_cache_list = NULL;
+}
+
+/* Tables modified behind our back by the host (tests) or a raw disk
+   write show up as a flush of the disk cache.  */
+static void
+grub_gpt_cache_invalidate_hook (void)
+{
+  grub_gpt_cache_flush ();
+
+  if (grub_gpt_prev_invalidate_hook)
+    grub_gpt_prev_invalidate_hook ();
+}
+
+static struct grub_gpt_cache **
+grub_gpt_cache_find (grub_disk_t disk)
+{
+  struct grub_gpt_cache **p;
+
+  for (p = &grub_gpt_cache_list; *p; p = &(*p)->next)
+    if ((*p)->dev_id == disk->dev->id && (*p)->disk_id == disk->id)
+      break;
+
+  return p;
+}
+
+static void
+grub_gpt_cache_drop (grub_disk_t disk)
+{
+  struct grub_gpt_cache **p, *cache;
+
+  p = grub_gpt_cache_find (disk);
+  cache = *p;
+  if (!cache)
+    return;
+
+  *p = cache->next;
+  grub_gpt_free (cache->gpt);
+  grub_free (cache);
+}
+
+/* The MBR and primary header are nearly always in the disk cache, so
+   comparing them catches writes that bypassed grub_gpt_write (gptsync
+   for example) without re-reading and summing the entry tables.  */
+static int
+grub_gpt_cache_valid (grub_disk_t disk, struct grub_gpt_cache *cache)
+{
+  struct grub_msdos_partition_mbr mbr;
+  struct grub_gpt_header primary;
+  grub_gpt_t gpt = cache->gpt;
+
+  if (cache->total_sectors != disk->total_sectors ||
+      gpt->log_sector_size != disk->log_sector_size)
+    return 0;
+
+  if (grub_disk_read (disk, 0, 0, sizeof (mbr), &mbr) ||
+      grub_disk_read (disk, grub_gpt_sector_to_addr (gpt, 1), 0,
+		      sizeof (primary), &primary))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  return (grub_memcmp (&mbr, &gpt->mbr, sizeof (mbr)) == 0 &&
+	  grub_memcmp (&primary, &gpt->primary, sizeof (primary)) == 0);
+}
+
+grub_gpt_t
+grub_gpt_read (grub_disk_t disk)
+{
+  struct grub_gpt_cache **p, *cache;
+  grub_gpt_t gpt;
+
+  p = grub_gpt_cache_find (disk);
+  if (*p)
+    {
+      if (grub_gpt_cache_valid (disk, *p))
+	return grub_gpt_copy ((*p)->gpt);
+      grub_gpt_cache_drop (disk);
+    }
+
+  gpt = grub_gpt_read_uncached (disk);
+  if (!gpt)
+    return NULL;
+
+  /* Failing to cache is not an error, the next call just reads again.  */
+  cache = grub_zalloc (sizeof (*cache));
+  if (cache)
+    cache->gpt = grub_gpt_copy (gpt);
+  if (!cache || !cache->gpt)
+    {
+      grub_free (cache);
+      grub_errno = GRUB_ERR_NONE;
+      return gpt;
+    }
+
+  if (!grub_gpt_cache_hooked)
+    {
+      grub_gpt_prev_invalidate_hook = grub_disk_cache_invalidate_hook;
+      grub_disk_cache_invalidate_hook = grub_gpt_cache_invalidate_hook;
+      grub_gpt_cache_hooked = 1;
+    }
+
+  cache->dev_id = disk->dev->id;
+  cache->disk_id = disk->id;
+  cache->total_sectors = disk->total_sectors;
+  cache->next = grub_gpt_cache_list;
+  grub_gpt_cache_list = cache;
+
+  return gpt;
+}
+
 grub_err_t
 grub_gpt_repair (grub_disk_t disk, grub_gpt_t gpt)
 {
@@ -475,6 +628,9 @@ grub_gpt_write (grub_disk_t disk, grub_gpt_t gpt)
   if (!(gpt->status & GRUB_GPT_BOTH_VALID))
     return grub_error (GRUB_ERR_BAD_PART_TABLE, "Invalid GPT data");
 
+  /* Even a partial write leaves the cached copy stale.  */
+  grub_gpt_cache_drop (disk);
+
   if (grub_gpt_write_table (disk, gpt, &gpt->primary))
     return grub_errno;
 
@@ -493,3 +649,10 @@ grub_gpt_free (grub_gpt_t gpt)
   grub_free (gpt->entries);
   grub_free (gpt);
 }
+
+GRUB_MOD_FINI(gpt)
+{
+  if (grub_gpt_cache_hooked)
+    grub_disk_cache_invalidate_hook = grub_gpt_prev_invalidate_hook;
+  grub_gpt_cache_flush ();
+}
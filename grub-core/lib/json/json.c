@@ -0,0 +1,564 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/json.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* The document is kept as an array of tokens in the order they appear.
+   Each token records where its subtree ends, so that walking the children
+   of a value only touches the children themselves.  */
+struct grub_json_token
+{
+  grub_json_type_t type;
+  /* Offsets of the contents in the string.  */
+  grub_size_t start, end;
+  grub_size_t size;
+  /* Index of the first token after this one's subtree.  */
+  grub_size_t next;
+};
+
+/* Nesting deeper than this is rejected rather than risking the stack.  */
+#define JSON_MAX_DEPTH 32
+
+struct json_parser
+{
+  char *string;
+  grub_size_t len;
+  grub_size_t pos;
+  struct grub_json_token *tokens;
+  grub_size_t ntokens;
+  grub_size_t alloc;
+};
+
+static grub_err_t
+json_syntax_error (struct json_parser *p)
+{
+  return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		     N_("invalid JSON at offset %" PRIuGRUB_SIZE), p->pos);
+}
+
+static int
+json_more (struct json_parser *p)
+{
+  return p->pos < p->len && p->string[p->pos] != '\0';
+}
+
+static void
+json_skip_space (struct json_parser *p)
+{
+  while (json_more (p) && (p->string[p->pos] == ' '
+			   || p->string[p->pos] == '\t'
+			   || p->string[p->pos] == '\n'
+			   || p->string[p->pos] == '\r'))
+    p->pos++;
+}
+
+static grub_ssize_t
+json_new_token (struct json_parser *p, grub_json_type_t type)
+{
+  struct grub_json_token *tok;
+
+  if (p->ntokens == p->alloc)
+    {
+      struct grub_json_token *n;
+      grub_size_t alloc = p->alloc ? 2 * p->alloc : 64;
+
+      n = grub_realloc (p->tokens, alloc * sizeof (*n));
+      if (!n)
+	return -1;
+      p->tokens = n;
+      p->alloc = alloc;
+    }
+  tok = &p->tokens[p->ntokens];
+  tok->type = type;
+  tok->start = p->pos;
+  tok->end = p->pos;
+  tok->size = 0;
+  tok->next = p->ntokens + 1;
+  return p->ntokens++;
+}
+
+static int
+json_hex (char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  return -1;
+}
+
+static grub_err_t
+json_parse_string (struct json_parser *p)
+{
+  grub_ssize_t t;
+
+  /* Skip the opening quote.  */
+  p->pos++;
+  t = json_new_token (p, GRUB_JSON_STRING);
+  if (t < 0)
+    return grub_errno;
+
+  for (; p->pos < p->len; p->pos++)
+    {
+      char c = p->string[p->pos];
+
+      if (c == '"')
+	{
+	  p->tokens[t].end = p->pos++;
+	  return GRUB_ERR_NONE;
+	}
+      if ((grub_uint8_t) c < 0x20)
+	break;
+      if (c != '\\')
+	continue;
+
+      if (++p->pos >= p->len)
+	break;
+      switch (p->string[p->pos])
+	{
+	case '"': case '\\': case '/':
+	case 'b': case 'f': case 'n': case 'r': case 't':
+	  break;
+	case 'u':
+	  {
+	    int i;
+	    for (i = 1; i <= 4; i++)
+	      if (p->pos + i >= p->len || json_hex (p->string[p->pos + i]) < 0)
+		return json_syntax_error (p);
+	    p->pos += 4;
+	  }
+	  break;
+	default:
+	  return json_syntax_error (p);
+	}
+    }
+  return json_syntax_error (p);
+}
+
+static grub_err_t
+json_parse_primitive (struct json_parser *p)
+{
+  grub_ssize_t t;
+  char c = p->string[p->pos];
+
+  if (!(c == '-' || (c >= '0' && c <= '9') || c == 't' || c == 'f'
+	|| c == 'n'))
+    return json_syntax_error (p);
+
+  t = json_new_token (p, GRUB_JSON_PRIMITIVE);
+  if (t < 0)
+    return grub_errno;
+
+  while (json_more (p))
+    {
+      c = p->string[p->pos];
+      if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ','
+	  || c == ']' || c == '}')
+	break;
+      if ((grub_uint8_t) c < 0x20 || c == '"' || c == '[' || c == '{'
+	  || c == ':')
+	return json_syntax_error (p);
+      p->pos++;
+    }
+  p->tokens[t].end = p->pos;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+json_parse_value (struct json_parser *p, int depth)
+{
+  grub_ssize_t t;
+  char close;
+
+  json_skip_space (p);
+  if (!json_more (p))
+    return json_syntax_error (p);
+
+  if (p->string[p->pos] == '"')
+    return json_parse_string (p);
+  if (p->string[p->pos] != '{' && p->string[p->pos] != '[')
+    return json_parse_primitive (p);
+
+  if (depth >= JSON_MAX_DEPTH)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("JSON nested too deeply"));
+
+  close = p->string[p->pos] == '{' ? '}' : ']';
+  t = json_new_token (p, close == '}' ? GRUB_JSON_OBJECT : GRUB_JSON_ARRAY);
+  if (t < 0)
+    return grub_errno;
+  p->pos++;
+
+  json_skip_space (p);
+  if (json_more (p) && p->string[p->pos] == close)
+    p->pos++;
+  else
+    for (;;)
+      {
+	grub_err_t err;
+
+	if (close == '}')
+	  {
+	    grub_size_t key = p->ntokens;
+
+	    json_skip_space (p);
+	    if (!json_more (p) || p->string[p->pos] != '"')
+	      return json_syntax_error (p);
+	    err = json_parse_string (p);
+	    if (err)
+	      return err;
+	    json_skip_space (p);
+	    if (!json_more (p) || p->string[p->pos] != ':')
+	      return json_syntax_error (p);
+	    p->pos++;
+	    err = json_parse_value (p, depth + 1);
+	    if (err)
+	      return err;
+	    p->tokens[key].size = 1;
+	    p->tokens[key].next = p->ntokens;
+	  }
+	else
+	  {
+	    err = json_parse_value (p, depth + 1);
+	    if (err)
+	      return err;
+	  }
+	p->tokens[t].size++;
+
+	json_skip_space (p);
+	if (!json_more (p))
+	  return json_syntax_error (p);
+	if (p->string[p->pos] == close)
+	  {
+	    p->pos++;
+	    break;
+	  }
+	if (p->string[p->pos] != ',')
+	  return json_syntax_error (p);
+	p->pos++;
+      }
+
+  p->tokens[t].end = p->pos;
+  p->tokens[t].next = p->ntokens;
+  return GRUB_ERR_NONE;
+}
+
+static void
+json_put_utf8 (char **out, grub_uint32_t code)
+{
+  if (code < 0x80)
+    *(*out)++ = code;
+  else if (code < 0x800)
+    {
+      *(*out)++ = 0xc0 | (code >> 6);
+      *(*out)++ = 0x80 | (code & 0x3f);
+    }
+  else
+    {
+      *(*out)++ = 0xe0 | (code >> 12);
+      *(*out)++ = 0x80 | ((code >> 6) & 0x3f);
+      *(*out)++ = 0x80 | (code & 0x3f);
+    }
+}
+
+/* Decode the escapes of the syntactically valid string TOK in place and
+   terminate it.  The result is never longer than the original.  */
+static void
+json_unescape (char *string, struct grub_json_token *tok)
+{
+  char *in = string + tok->start, *end = string + tok->end;
+  char *out = in;
+
+  while (in < end)
+    {
+      if (*in != '\\')
+	{
+	  *out++ = *in++;
+	  continue;
+	}
+      in++;
+      switch (*in++)
+	{
+	case 'b': *out++ = '\b'; break;
+	case 'f': *out++ = '\f'; break;
+	case 'n': *out++ = '\n'; break;
+	case 'r': *out++ = '\r'; break;
+	case 't': *out++ = '\t'; break;
+	case 'u':
+	  json_put_utf8 (&out, (json_hex (in[0]) << 12) | (json_hex (in[1]) << 8)
+			 | (json_hex (in[2]) << 4) | json_hex (in[3]));
+	  in += 4;
+	  break;
+	default:
+	  *out++ = in[-1];
+	  break;
+	}
+    }
+  *out = '\0';
+}
+
+grub_err_t
+grub_json_parse (grub_json_t **out, char *string, grub_size_t string_len)
+{
+  struct json_parser p;
+  grub_json_t *json;
+  grub_size_t i;
+  grub_err_t err;
+
+  *out = NULL;
+  if (!string)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid argument"));
+
+  grub_memset (&p, 0, sizeof (p));
+  p.string = string;
+  p.len = string_len;
+
+  err = json_parse_value (&p, 0);
+  if (!err)
+    {
+      json_skip_space (&p);
+      for (; p.pos < p.len; p.pos++)
+	if (p.string[p.pos] != '\0')
+	  {
+	    err = json_syntax_error (&p);
+	    break;
+	  }
+    }
+  if (err)
+    {
+      grub_free (p.tokens);
+      return err;
+    }
+
+  json = grub_malloc (sizeof (*json));
+  if (!json)
+    {
+      grub_free (p.tokens);
+      return grub_errno;
+    }
+
+  /* Only now that the delimiters aren't needed anymore terminate the
+     strings and primitives.  A primitive may end the buffer.  */
+  for (i = 0; i < p.ntokens; i++)
+    if (p.tokens[i].type == GRUB_JSON_STRING)
+      json_unescape (string, &p.tokens[i]);
+    else if (p.tokens[i].type == GRUB_JSON_PRIMITIVE)
+      {
+	if (p.tokens[i].end < string_len)
+	  string[p.tokens[i].end] = '\0';
+	else
+	  {
+	    grub_free (p.tokens);
+	    grub_free (json);
+	    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			       N_("JSON value isn't terminated"));
+	  }
+      }
+
+  json->tokens = p.tokens;
+  json->string = string;
+  json->idx = 0;
+  *out = json;
+  return GRUB_ERR_NONE;
+}
+
+void
+grub_json_free (grub_json_t *json)
+{
+  if (json)
+    {
+      grub_free (json->tokens);
+      grub_free (json);
+    }
+}
+
+grub_err_t
+grub_json_getsize (grub_size_t *out, const grub_json_t *json)
+{
+  *out = json->tokens[json->idx].size;
+  return GRUB_ERR_NONE;
+}
+
+grub_json_type_t
+grub_json_gettype (const grub_json_t *json)
+{
+  return json->tokens[json->idx].type;
+}
+
+grub_err_t
+grub_json_getchild (grub_json_t *out, const grub_json_t *parent, grub_size_t n)
+{
+  const struct grub_json_token *p = &parent->tokens[parent->idx];
+  grub_size_t idx, i;
+
+  if (n >= p->size)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("JSON child out of range"));
+
+  for (idx = parent->idx + 1, i = 0; i < n; i++)
+    idx = parent->tokens[idx].next;
+
+  out->tokens = parent->tokens;
+  out->string = parent->string;
+  out->idx = idx;
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_json_getvalue (grub_json_t *out, const grub_json_t *parent,
+		    const char *key)
+{
+  grub_size_t idx, i;
+
+  if (grub_json_gettype (parent) != GRUB_JSON_OBJECT)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("JSON value is not an object"));
+
+  for (idx = parent->idx + 1, i = 0; i < parent->tokens[parent->idx].size;
+       i++, idx = parent->tokens[idx].next)
+    if (grub_strcmp (parent->string + parent->tokens[idx].start, key) == 0)
+      {
+	out->tokens = parent->tokens;
+	out->string = parent->string;
+	out->idx = idx + 1;
+	return GRUB_ERR_NONE;
+      }
+
+  return grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("JSON key `%s' not found"),
+		     key);
+}
+
+static grub_err_t
+get_value (grub_json_type_t *type, const char **value,
+	   const grub_json_t *parent, const char *key)
+{
+  grub_json_t child;
+  grub_err_t err;
+
+  child = *parent;
+  if (key)
+    {
+      err = grub_json_getvalue (&child, parent, key);
+      if (err)
+	return err;
+    }
+
+  *type = grub_json_gettype (&child);
+  *value = child.string + child.tokens[child.idx].start;
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_json_getstring (const char **out, const grub_json_t *parent,
+		     const char *key)
+{
+  grub_json_type_t type;
+  const char *value;
+  grub_err_t err;
+
+  err = get_value (&type, &value, parent, key);
+  if (err)
+    return err;
+  if (type != GRUB_JSON_STRING)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("JSON value is not a string"));
+
+  *out = value;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+get_number (const char **out, const grub_json_t *parent, const char *key)
+{
+  grub_json_type_t type;
+  const char *value;
+  grub_err_t err;
+
+  err = get_value (&type, &value, parent, key);
+  if (err)
+    return err;
+  if ((type != GRUB_JSON_STRING && type != GRUB_JSON_PRIMITIVE)
+      || !(*value == '-' || (*value >= '0' && *value <= '9')))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("JSON value is not a number"));
+
+  *out = value;
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_json_getuint64 (grub_uint64_t *out, const grub_json_t *parent,
+		     const char *key)
+{
+  const char *value;
+  char *end;
+  grub_err_t err;
+
+  err = get_number (&value, parent, key);
+  if (err)
+    return err;
+  if (*value == '-')
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("JSON number is negative"));
+
+  grub_errno = GRUB_ERR_NONE;
+  *out = grub_strtoull (value, &end, 10);
+  if (grub_errno)
+    return grub_errno;
+  if (*end)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("JSON number is not an integer"));
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_json_getint64 (grub_int64_t *out, const grub_json_t *parent,
+		    const char *key)
+{
+  const char *value;
+  grub_uint64_t magnitude;
+  char *end;
+  grub_err_t err;
+  int negative;
+
+  err = get_number (&value, parent, key);
+  if (err)
+    return err;
+
+  negative = (*value == '-');
+  grub_errno = GRUB_ERR_NONE;
+  magnitude = grub_strtoull (value + negative, &end, 10);
+  if (grub_errno)
+    return grub_errno;
+  if (*end)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       N_("JSON number is not an integer"));
+  if (magnitude > (grub_uint64_t) 1 << 63
+      || (!negative && magnitude == (grub_uint64_t) 1 << 63))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+
+  *out = negative ? -(grub_int64_t) (magnitude - 1) - 1
+    : (grub_int64_t) magnitude;
+  return GRUB_ERR_NONE;
+}
@@ -0,0 +1,304 @@
+/*
+ * LZ4 - Fast LZ compression algorithm
+ * Header File
+ * Copyright (C) 2011-2013, Yann Collet.
+ * BSD 2-Clause License (http://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *     * Redistributions of source code must retain the above copyright
+ * notice, this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above
+ * copyright notice, this list of conditions and the following disclaimer
+ * in the documentation and/or other materials provided with the
+ * distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * You can contact the author at :
+ * - LZ4 homepage : http://fastcompression.blogspot.com/p/lz4.html
+ * - LZ4 source repository : http://code.google.com/p/lz4/
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/types.h>
+#include <grub/dl.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/*
+ * Compiler Options
+ */
+
+#define	GCC_VERSION (__GNUC__ * 100 + __GNUC_MINOR__)
+
+#if (GCC_VERSION >= 302) || (defined (__INTEL_COMPILER) && __INTEL_COMPILER >= 800) || defined(__clang__)
+#define	expect(expr, value)    (__builtin_expect((expr), (value)))
+#else
+#define	expect(expr, value)    (expr)
+#endif
+
+#define	likely(expr)	expect((expr) != 0, 1)
+#define	unlikely(expr)	expect((expr) != 0, 0)
+
+/* Basic types */
+#define	BYTE	grub_uint8_t
+#define	U16	grub_uint16_t
+#define	U32	grub_uint32_t
+#define	U64	grub_uint64_t
+typedef grub_size_t size_t;
+
+typedef struct _U16_S {
+	U16 v;
+} GRUB_PACKED U16_S;
+typedef struct _U32_S {
+	U32 v;
+} GRUB_PACKED U32_S;
+typedef struct _U64_S {
+	U64 v;
+} GRUB_PACKED U64_S;
+
+#define	A64(x)	(((U64_S *)(x))->v)
+#define	A32(x)	(((U32_S *)(x))->v)
+#define	A16(x)	(((U16_S *)(x))->v)
+
+/*
+ * Constants
+ */
+#define	MINMATCH 4
+
+#define	ML_BITS 4
+#define	ML_MASK ((1U<<ML_BITS)-1)
+#define	RUN_BITS (8-ML_BITS)
+#define	RUN_MASK ((1U<<RUN_BITS)-1)
+
+/*
+ * Copies are done in whole 8 or 16 byte steps and may store up to
+ * WILDCOPYLENGTH - 1 bytes past their end, so they are only used while
+ * that much room is left in the output.  Near the end of the buffers
+ * the decoder falls back to exact copies.
+ */
+#define	WILDCOPYLENGTH 16
+
+/* The shortcut handles a token whose literal run and match both fit in
+   the token itself: up to 14 literals and up to 18 match bytes.  */
+#define	SHORT_LITERALS 14
+#define	SHORT_MATCH (ML_MASK - 1 + MINMATCH)
+
+#define	LZ4_COPY8(d, s)		A64(d) = A64(s)
+#define	LZ4_COPY16(d, s)	{ LZ4_COPY8(d, s); LZ4_COPY8((d) + 8, (s) + 8); }
+
+/* Copy from S to D until D reaches E, overrunning E by up to 7 bytes.  */
+#define	LZ4_WILDCOPY8(d, s, e) \
+	do { LZ4_COPY8(d, s); d += 8; s += 8; } while (d < e)
+/* Likewise, 16 bytes per step, overrunning E by up to 15 bytes.  */
+#define	LZ4_WILDCOPY16(d, s, e) \
+	do { LZ4_COPY16(d, s); d += 16; s += 16; } while (d < e)
+
+/* Read the bytes extending a length field of 15 into *LEN.  Lengths are
+   bounded by MAX, which also keeps the sum from overflowing.  */
+static inline int
+lz4_read_length(const BYTE **ip, const BYTE *iend, size_t *len, size_t max)
+{
+	unsigned s;
+
+	do {
+		if (unlikely(*ip >= iend))
+			return -1;
+		s = *(*ip)++;
+		*len += s;
+		if (unlikely(*len > max))
+			return -1;
+	} while (s == 255);
+	return 0;
+}
+
+/*
+ * Decode the raw block of ISIZE bytes at SOURCE into DEST, which has room
+ * for OSIZE bytes.  Matches may reach back PREFIX bytes before DEST, into
+ * the output of earlier blocks.  Returns the number of bytes stored or -1.
+ */
+static grub_ssize_t
+lz4_decompress_generic(const BYTE *source, BYTE *dest, size_t isize,
+    size_t osize, size_t prefix)
+{
+	const BYTE *ip = source;
+	const BYTE *const iend = ip + isize;
+	const BYTE *const lowest = dest - prefix;
+	BYTE *op = dest;
+	BYTE *const oend = op + osize;
+	const BYTE *ref;
+	BYTE *cpy;
+
+	/*
+	 * Overlapping matches (offset below 8) are first expanded by copying
+	 * 4 bytes singly and 4 more from a position that makes the pattern
+	 * repeat, after which REF is moved back so that OP - REF >= 8.
+	 */
+	static const unsigned inc32table[8] = { 0, 1, 2, 1, 0, 4, 4, 4 };
+	static const int dec64table[8] = { 0, 0, 0, -1, -4, 1, 2, 3 };
+
+	while (ip < iend) {
+		unsigned token;
+		size_t length, offset;
+
+		token = *ip++;
+		length = token >> ML_BITS;
+
+		/*
+		 * Shortcut for short sequences with room to spare on both
+		 * sides: copy 16 literal bytes and, unless the match overlaps
+		 * itself, 18 match bytes, without looking at the exact lengths.
+		 */
+		if (length != RUN_MASK
+		    && likely(iend - ip > 16 + 2)
+		    && likely((size_t) (oend - op) >= 16 + SHORT_LITERALS
+			      + SHORT_MATCH)) {
+			LZ4_COPY16(op, ip);
+			op += length;
+			ip += length;
+
+			offset = grub_le_to_cpu16(A16(ip));
+			ip += 2;
+			length = token & ML_MASK;
+			if (length != ML_MASK && offset >= 8
+			    && offset <= (size_t) (op - lowest)) {
+				ref = op - offset;
+				LZ4_COPY16(op, ref);
+				A16(op + 16) = A16(ref + 16);
+				op += length + MINMATCH;
+				continue;
+			}
+			goto _match;
+		}
+
+		/* get runlength */
+		if (length == RUN_MASK
+		    && lz4_read_length(&ip, iend, &length, osize))
+			goto _output_error;
+		if (unlikely(length > (size_t) (iend - ip))
+		    || unlikely(length > (size_t) (oend - op)))
+			goto _output_error;
+
+		/* copy literals */
+		cpy = op + length;
+		if (likely((size_t) (oend - cpy) >= WILDCOPYLENGTH)
+		    && likely((size_t) (iend - ip) >= length + WILDCOPYLENGTH)) {
+			const BYTE *s = ip;
+
+			LZ4_WILDCOPY16(op, s, cpy);
+		} else
+			grub_memcpy(op, ip, length);
+		op = cpy;
+		ip += length;
+
+		/* The last sequence has no match. */
+		if (ip == iend)
+			break;
+
+		/* get offset */
+		if (unlikely(iend - ip < 2))
+			goto _output_error;
+		offset = grub_le_to_cpu16(A16(ip));
+		ip += 2;
+		length = token & ML_MASK;
+
+	_match:
+		/*
+		 * Error: offset 0 or offset creating a reference outside of
+		 * the output.
+		 */
+		if (unlikely(offset == 0)
+		    || unlikely(offset > (size_t) (op - lowest)))
+			goto _output_error;
+		ref = op - offset;
+
+		/* get matchlength */
+		if (length == ML_MASK
+		    && lz4_read_length(&ip, iend, &length, osize))
+			goto _output_error;
+		length += MINMATCH;
+		if (unlikely(length > (size_t) (oend - op)))
+			goto _output_error;
+		cpy = op + length;
+
+		/* copy repeated sequence */
+		if (unlikely((size_t) (oend - cpy) < WILDCOPYLENGTH)) {
+			/* Near the end of the output: copy exactly. */
+			while (op < cpy)
+				*op++ = *ref++;
+			continue;
+		}
+		if (offset >= 16) {
+			LZ4_WILDCOPY16(op, ref, cpy);
+		} else {
+			if (offset < 8) {
+				op[0] = ref[0];
+				op[1] = ref[1];
+				op[2] = ref[2];
+				op[3] = ref[3];
+				ref += inc32table[offset];
+				A32(op + 4) = A32(ref);
+				ref -= dec64table[offset];
+			} else {
+				LZ4_COPY8(op, ref);
+				ref += 8;
+			}
+			op += 8;
+			if (op < cpy)
+				LZ4_WILDCOPY8(op, ref, cpy);
+		}
+		op = cpy;	/* correction */
+	}
+
+	/* end of decoding */
+	return op - dest;
+
+	/* write overflow error detected */
+	_output_error:
+	return -1;
+}
+
+/* Decompression functions */
+grub_ssize_t
+grub_lz4_decompress (const void *src, grub_size_t src_len, void *dst,
+		     grub_size_t dst_len)
+{
+	return grub_lz4_decompress_continue (src, src_len, dst, dst_len, 0);
+}
+
+grub_ssize_t
+grub_lz4_decompress_continue (const void *src, grub_size_t src_len,
+			      void *dst, grub_size_t dst_len,
+			      grub_size_t prefix)
+{
+	grub_ssize_t ret;
+
+	if (src_len > GRUB_INT_MAX || dst_len > GRUB_INT_MAX) {
+		grub_error(GRUB_ERR_OUT_OF_RANGE, "lz4 buffer too large");
+		return -1;
+	}
+
+	ret = lz4_decompress_generic(src, dst, src_len, dst_len, prefix);
+	if (ret < 0) {
+		grub_error(GRUB_ERR_BAD_COMPRESSED_DATA,
+		    "lz4 decompression failed");
+		return -1;
+	}
+	return ret;
+}
@@ -64,6 +64,10 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   if (dkLen > 4294967295U)
     return GPG_ERR_INV_ARG;
 
+  rc = grub_crypto_pbkdf2_sha2 (md, P, Plen, S, Slen, c, DK, dkLen);
+  if (rc != GPG_ERR_NOT_IMPLEMENTED)
+    return rc;
+
   l = ((dkLen - 1) / hLen) + 1;
   r = dkLen - (l - 1) * hLen;
 
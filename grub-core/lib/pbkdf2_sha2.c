@@ -0,0 +1,415 @@
+/* pbkdf2_sha2.c - PBKDF2 with HMAC-SHA256 and HMAC-SHA512.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/crypto.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+
+/* Going through the generic HMAC costs several allocations and four
+   compressions per iteration, two of them hashing the padded key again.
+   Here the states after the inner and outer pad blocks are computed
+   once, and since every iteration hashes exactly one digest, the padded
+   block it lives in is built once too: an iteration is then two bare
+   compressions.  */
+
+#define SHA2_MAX_BLOCKSIZE	128
+#define SHA2_MAX_STATESIZE	64
+
+struct sha2_engine
+{
+  const char *name;
+  grub_size_t mdlen;
+  grub_size_t blocksize;
+  grub_size_t statesize;
+  const void *iv;
+  void (*compress) (void *state, const grub_uint8_t *data,
+		    grub_size_t nblocks);
+  void (*output) (grub_uint8_t *out, const void *state);
+};
+
+static inline grub_uint32_t
+ror32 (grub_uint32_t x, int n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+static inline grub_uint64_t
+ror64 (grub_uint64_t x, int n)
+{
+  return (x >> n) | (x << (64 - n));
+}
+
+static const grub_uint32_t sha256_k[64] =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+static const grub_uint32_t sha256_iv[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+static void
+sha256_compress (void *state, const grub_uint8_t *data, grub_size_t nblocks)
+{
+  grub_uint32_t *h = state;
+  grub_uint32_t w[64];
+  grub_uint32_t a, b, c, d, e, f, g, hh, t1, t2;
+  unsigned i;
+
+  for (; nblocks; nblocks--, data += 64)
+    {
+      for (i = 0; i < 16; i++)
+	w[i] = grub_be_to_cpu32 (grub_get_unaligned32 (data + 4 * i));
+      for (; i < 64; i++)
+	w[i] = w[i - 16] + w[i - 7]
+	  + (ror32 (w[i - 15], 7) ^ ror32 (w[i - 15], 18) ^ (w[i - 15] >> 3))
+	  + (ror32 (w[i - 2], 17) ^ ror32 (w[i - 2], 19) ^ (w[i - 2] >> 10));
+
+      a = h[0]; b = h[1]; c = h[2]; d = h[3];
+      e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+      for (i = 0; i < 64; i++)
+	{
+	  t1 = hh + (ror32 (e, 6) ^ ror32 (e, 11) ^ ror32 (e, 25))
+	    + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+	  t2 = (ror32 (a, 2) ^ ror32 (a, 13) ^ ror32 (a, 22))
+	    + ((a & b) ^ (a & c) ^ (b & c));
+	  hh = g; g = f; f = e; e = d + t1;
+	  d = c; c = b; b = a; a = t1 + t2;
+	}
+      h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+      h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+}
+
+static void
+sha256_output (grub_uint8_t *out, const void *state)
+{
+  const grub_uint32_t *h = state;
+  unsigned i;
+
+  for (i = 0; i < 8; i++)
+    grub_set_unaligned32 (out + 4 * i, grub_cpu_to_be32 (h[i]));
+}
+
+static const grub_uint64_t sha512_k[80] =
+  {
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL, 0xb5c0fbcfec4d3b2fULL,
+    0xe9b5dba58189dbbcULL, 0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL, 0xd807aa98a3030242ULL,
+    0x12835b0145706fbeULL, 0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL, 0x9bdc06a725c71235ULL,
+    0xc19bf174cf692694ULL, 0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL, 0x2de92c6f592b0275ULL,
+    0x4a7484aa6ea6e483ULL, 0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL, 0xb00327c898fb213fULL,
+    0xbf597fc7beef0ee4ULL, 0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL, 0x27b70a8546d22ffcULL,
+    0x2e1b21385c26c926ULL, 0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL, 0x81c2c92e47edaee6ULL,
+    0x92722c851482353bULL, 0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL, 0xd192e819d6ef5218ULL,
+    0xd69906245565a910ULL, 0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL, 0x2748774cdf8eeb99ULL,
+    0x34b0bcb5e19b48a8ULL, 0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL, 0x748f82ee5defb2fcULL,
+    0x78a5636f43172f60ULL, 0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL, 0xbef9a3f7b2c67915ULL,
+    0xc67178f2e372532bULL, 0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL, 0x06f067aa72176fbaULL,
+    0x0a637dc5a2c898a6ULL, 0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL, 0x3c9ebe0a15c9bebcULL,
+    0x431d67c49c100d4cULL, 0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+  };
+
+static const grub_uint64_t sha512_iv[8] =
+  {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+
+static void
+sha512_compress (void *state, const grub_uint8_t *data, grub_size_t nblocks)
+{
+  grub_uint64_t *h = state;
+  grub_uint64_t w[80];
+  grub_uint64_t a, b, c, d, e, f, g, hh, t1, t2;
+  unsigned i;
+
+  for (; nblocks; nblocks--, data += 128)
+    {
+      for (i = 0; i < 16; i++)
+	w[i] = grub_be_to_cpu64 (grub_get_unaligned64 (data + 8 * i));
+      for (; i < 80; i++)
+	w[i] = w[i - 16] + w[i - 7]
+	  + (ror64 (w[i - 15], 1) ^ ror64 (w[i - 15], 8) ^ (w[i - 15] >> 7))
+	  + (ror64 (w[i - 2], 19) ^ ror64 (w[i - 2], 61) ^ (w[i - 2] >> 6));
+
+      a = h[0]; b = h[1]; c = h[2]; d = h[3];
+      e = h[4]; f = h[5]; g = h[6]; hh = h[7];
+      for (i = 0; i < 80; i++)
+	{
+	  t1 = hh + (ror64 (e, 14) ^ ror64 (e, 18) ^ ror64 (e, 41))
+	    + ((e & f) ^ (~e & g)) + sha512_k[i] + w[i];
+	  t2 = (ror64 (a, 28) ^ ror64 (a, 34) ^ ror64 (a, 39))
+	    + ((a & b) ^ (a & c) ^ (b & c));
+	  hh = g; g = f; f = e; e = d + t1;
+	  d = c; c = b; b = a; a = t1 + t2;
+	}
+      h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+      h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
+    }
+}
+
+static void
+sha512_output (grub_uint8_t *out, const void *state)
+{
+  const grub_uint64_t *h = state;
+  unsigned i;
+
+  for (i = 0; i < 8; i++)
+    grub_set_unaligned64 (out + 8 * i, grub_cpu_to_be64 (h[i]));
+}
+
+#if defined (__x86_64__) && !defined (GRUB_UTIL)
+/* In lib/x86_64/sha256_ni.S.  */
+void grub_sha256_ni_compress (grub_uint32_t *state, const grub_uint8_t *data,
+			      grub_size_t nblocks);
+
+static void
+sha256_ni_compress (void *state, const grub_uint8_t *data, grub_size_t nblocks)
+{
+  grub_sha256_ni_compress (state, data, nblocks);
+}
+
+static int
+sha256_ni_supported (void)
+{
+  static int supported = -1;
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (supported >= 0)
+    return supported;
+
+  /* CPUID.(EAX=07H,ECX=0):EBX.SHA; SSSE3 and SSE4.1 are implied.  */
+  asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "0" (0));
+  supported = 0;
+  if (eax >= 7)
+    {
+      asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		    : "0" (7), "2" (0));
+      supported = !!(ebx & (1 << 29));
+    }
+  return supported;
+}
+#endif
+
+static struct sha2_engine sha2_engines[] =
+  {
+    { "SHA256", 32, 64, 32, sha256_iv, sha256_compress, sha256_output },
+    { "SHA512", 64, 128, 64, sha512_iv, sha512_compress, sha512_output }
+  };
+
+static const struct sha2_engine *
+sha2_find_engine (const struct gcry_md_spec *md)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (sha2_engines); i++)
+    if (grub_strcmp (md->name, sha2_engines[i].name) == 0
+	&& md->mdlen == sha2_engines[i].mdlen
+	&& md->blocksize == sha2_engines[i].blocksize)
+      {
+#if defined (__x86_64__) && !defined (GRUB_UTIL)
+	if (sha2_engines[i].compress == sha256_compress
+	    && sha256_ni_supported ())
+	  sha2_engines[i].compress = sha256_ni_compress;
+#endif
+	return &sha2_engines[i];
+      }
+  return NULL;
+}
+
+/* Big-endian bit count of PREFIX bytes already compressed plus LEN
+   bytes, into the last 16 or 8 bytes of BLOCK.  */
+static void
+sha2_put_length (const struct sha2_engine *e, grub_uint8_t *block,
+		 grub_size_t len)
+{
+  grub_uint64_t bits = ((grub_uint64_t) e->blocksize + len) << 3;
+
+  grub_memset (block + e->blocksize - e->blocksize / 8, 0,
+	       e->blocksize / 8 - 8);
+  grub_set_unaligned64 (block + e->blocksize - 8, grub_cpu_to_be64 (bits));
+}
+
+/* Finish the hash STATE, having already compressed one pad block, over
+   the LEN1 bytes at D1 followed by the LEN2 bytes at D2.  */
+static void
+sha2_finish (const struct sha2_engine *e, void *state,
+	     const grub_uint8_t *d1, grub_size_t len1,
+	     const grub_uint8_t *d2, grub_size_t len2, grub_uint8_t *out)
+{
+  grub_uint8_t block[SHA2_MAX_BLOCKSIZE];
+  grub_size_t fill = 0, total = len1 + len2;
+
+  while (len1 + len2)
+    {
+      grub_size_t n;
+
+      if (len1)
+	{
+	  n = len1 < e->blocksize - fill ? len1 : e->blocksize - fill;
+	  grub_memcpy (block + fill, d1, n);
+	  d1 += n;
+	  len1 -= n;
+	}
+      else
+	{
+	  n = len2 < e->blocksize - fill ? len2 : e->blocksize - fill;
+	  grub_memcpy (block + fill, d2, n);
+	  d2 += n;
+	  len2 -= n;
+	}
+      fill += n;
+      if (fill == e->blocksize)
+	{
+	  e->compress (state, block, 1);
+	  fill = 0;
+	}
+    }
+
+  block[fill++] = 0x80;
+  if (fill > e->blocksize - e->blocksize / 8)
+    {
+      grub_memset (block + fill, 0, e->blocksize - fill);
+      e->compress (state, block, 1);
+      fill = 0;
+    }
+  grub_memset (block + fill, 0, e->blocksize - fill);
+  sha2_put_length (e, block, total);
+  e->compress (state, block, 1);
+  e->output (out, state);
+  grub_memset (block, 0, sizeof (block));
+}
+
+gcry_err_code_t
+grub_crypto_pbkdf2_sha2 (const struct gcry_md_spec *md,
+			 const grub_uint8_t *P, grub_size_t Plen,
+			 const grub_uint8_t *S, grub_size_t Slen,
+			 unsigned int c,
+			 grub_uint8_t *DK, grub_size_t dkLen)
+{
+  const struct sha2_engine *e;
+  grub_uint8_t key[SHA2_MAX_BLOCKSIZE];
+  grub_uint8_t block[SHA2_MAX_BLOCKSIZE];
+  grub_uint8_t T[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint64_t istate[SHA2_MAX_STATESIZE / 8];
+  grub_uint64_t ostate[SHA2_MAX_STATESIZE / 8];
+  grub_uint64_t state[SHA2_MAX_STATESIZE / 8];
+  grub_size_t hlen, done;
+  grub_uint32_t i;
+  unsigned int u, k;
+
+  e = sha2_find_engine (md);
+  if (!e)
+    return GPG_ERR_NOT_IMPLEMENTED;
+  hlen = e->mdlen;
+
+  grub_memset (key, 0, sizeof (key));
+  if (Plen > e->blocksize)
+    grub_crypto_hash (md, key, P, Plen);
+  else
+    grub_memcpy (key, P, Plen);
+
+  for (k = 0; k < e->blocksize; k++)
+    block[k] = key[k] ^ 0x36;
+  grub_memcpy (istate, e->iv, e->statesize);
+  e->compress (istate, block, 1);
+  for (k = 0; k < e->blocksize; k++)
+    block[k] = key[k] ^ 0x5c;
+  grub_memcpy (ostate, e->iv, e->statesize);
+  e->compress (ostate, block, 1);
+  grub_memset (key, 0, sizeof (key));
+
+  for (i = 1, done = 0; done < dkLen; i++, done += hlen)
+    {
+      grub_uint8_t be_i[4];
+
+      be_i[0] = i >> 24;
+      be_i[1] = i >> 16;
+      be_i[2] = i >> 8;
+      be_i[3] = i;
+
+      /* U_1 = PRF (P, S || INT (i)).  */
+      grub_memcpy (state, istate, e->statesize);
+      sha2_finish (e, state, S, Slen, be_i, 4, T);
+      grub_memcpy (state, ostate, e->statesize);
+      sha2_finish (e, state, T, hlen, NULL, 0, block);
+
+      /* From here on BLOCK is the padded single block both halves of the
+	 HMAC of a digest hash, with the digest in its first HLEN bytes.  */
+      grub_memcpy (T, block, hlen);
+      block[hlen] = 0x80;
+      grub_memset (block + hlen + 1, 0, e->blocksize - hlen - 1);
+      sha2_put_length (e, block, hlen);
+
+      for (u = 1; u < c; u++)
+	{
+	  grub_memcpy (state, istate, e->statesize);
+	  e->compress (state, block, 1);
+	  e->output (block, state);
+	  grub_memcpy (state, ostate, e->statesize);
+	  e->compress (state, block, 1);
+	  e->output (block, state);
+	  for (k = 0; k < hlen; k++)
+	    T[k] ^= block[k];
+	}
+
+      grub_memcpy (DK + done, T, dkLen - done < hlen ? dkLen - done : hlen);
+    }
+
+  grub_memset (block, 0, sizeof (block));
+  grub_memset (T, 0, sizeof (T));
+  grub_memset (istate, 0, sizeof (istate));
+  grub_memset (ostate, 0, sizeof (ostate));
+  grub_memset (state, 0, sizeof (state));
+
+  return GPG_ERR_NO_ERROR;
+}
@@ -27,10 +27,18 @@ struct grub_priority_queue
   grub_size_t elsize;
   grub_size_t allocated;
   grub_size_t used;
+  /* NULL for a sequence queue, whose elements are struct seq_el.  */
   grub_comparator_t cmp;
   void *els;
 };
 
+struct seq_el
+{
+  grub_uint32_t seq;
+  grub_uint32_t end;
+  void *ptr;
+};
+
 static inline void *
 element (struct grub_priority_queue *pq, grub_size_t k)
 {
@@ -42,6 +50,17 @@ swap (struct grub_priority_queue *pq, grub_size_t m, grub_size_t n)
 {
   grub_uint8_t *p1, *p2;
   grub_size_t l;
+
+  /* Queues of pointers are the common case.  */
+  if (pq->elsize == sizeof (void *))
+    {
+      void **e = pq->els, *t;
+      t = e[m];
+      e[m] = e[n];
+      e[n] = t;
+      return;
+    }
+
   p1 = (grub_uint8_t *) element (pq, m);
   p2 = (grub_uint8_t *) element (pq, n);
   for (l = pq->elsize; l; l--, p1++, p2++)
@@ -71,6 +90,42 @@ right_child (grub_size_t v)
   return 2 * v + 2;
 }
 
+/* Serial number order, so that sequence numbers may wrap.  */
+static inline int
+seq_before (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+static inline void
+seq_swap (struct seq_el *els, grub_size_t m, grub_size_t n)
+{
+  struct seq_el t;
+  t = els[m];
+  els[m] = els[n];
+  els[n] = t;
+}
+
+/* Heap property: the sequence number of an element isn't before that of
+   its parent.  */
+static void
+seq_sift_down (struct grub_priority_queue *pq)
+{
+  struct seq_el *els = pq->els;
+  grub_size_t p, c;
+
+  for (p = 0; left_child (p) < pq->used; p = c)
+    {
+      c = left_child (p);
+      if (right_child (p) < pq->used
+	  && seq_before (els[right_child (p)].seq, els[c].seq))
+	c = right_child (p);
+      if (!seq_before (els[c].seq, els[p].seq))
+	break;
+      seq_swap (els, p, c);
+    }
+}
+
 void *
 grub_priority_queue_top (grub_priority_queue_t pq)
 {
@@ -109,20 +164,84 @@ grub_priority_queue_new (grub_size_t elsize,
   return ret;
 }
 
-/* Heap property: pq->cmp (element (pq, p), element (pq, parent (p))) <= 0. */
+grub_priority_queue_t
+grub_priority_queue_new_seq (void)
+{
+  return grub_priority_queue_new (sizeof (struct seq_el), 0);
+}
+
+static grub_err_t
+grow (struct grub_priority_queue *pq)
+{
+  void *els;
+
+  if (pq->used < pq->allocated)
+    return GRUB_ERR_NONE;
+  els = grub_realloc (pq->els, pq->elsize * 2 * pq->allocated);
+  if (!els)
+    return grub_errno;
+  pq->allocated *= 2;
+  pq->els = els;
+  return GRUB_ERR_NONE;
+}
+
 grub_err_t
-grub_priority_queue_push (grub_priority_queue_t pq, const void *el)
+grub_priority_queue_push_seq (grub_priority_queue_t pq, grub_uint32_t seq,
+			      grub_uint32_t end, void *el)
 {
+  struct seq_el *els;
   grub_size_t p;
-  if (pq->used == pq->allocated)
+
+  if (grow (pq))
+    return grub_errno;
+  els = pq->els;
+  p = pq->used++;
+  els[p].seq = seq;
+  els[p].end = end;
+  els[p].ptr = el;
+  for (; p && seq_before (els[p].seq, els[parent (p)].seq); p = parent (p))
+    seq_swap (els, p, parent (p));
+
+  return GRUB_ERR_NONE;
+}
+
+void *
+grub_priority_queue_top_seq (grub_priority_queue_t pq, grub_uint32_t *seq)
+{
+  struct seq_el *els = pq->els;
+
+  if (!pq->used)
+    return 0;
+  if (seq)
+    *seq = els[0].seq;
+  return els[0].ptr;
+}
+
+grub_size_t
+grub_priority_queue_pop_while_in_order (grub_priority_queue_t pq,
+					grub_uint32_t *next,
+					void **out, grub_size_t max)
+{
+  struct seq_el *els = pq->els;
+  grub_size_t n;
+
+  for (n = 0; n < max && pq->used && els[0].seq == *next; n++)
     {
-      void *els;
-      els = grub_realloc (pq->els, pq->elsize * 2 * pq->allocated);
-      if (!els)
-	return grub_errno;
-      pq->allocated *= 2;
-      pq->els = els;
+      out[n] = els[0].ptr;
+      *next = els[0].end;
+      els[0] = els[--pq->used];
+      seq_sift_down (pq);
     }
+  return n;
+}
+
+/* Heap property: pq->cmp (element (pq, p), element (pq, parent (p))) <= 0. */
+grub_err_t
+grub_priority_queue_push (grub_priority_queue_t pq, const void *el)
+{
+  grub_size_t p;
+  if (grow (pq))
+    return grub_errno;
   pq->used++;
   grub_memcpy (element (pq, pq->used - 1), el, pq->elsize);
   for (p = pq->used - 1; p; p = parent (p))
@@ -139,7 +258,15 @@ void
 grub_priority_queue_pop (grub_priority_queue_t pq)
 {
   grub_size_t p;
-  
+
+  if (!pq->cmp)
+    {
+      struct seq_el *els = pq->els;
+      els[0] = els[--pq->used];
+      seq_sift_down (pq);
+      return;
+    }
+
   swap (pq, 0, pq->used - 1);
   pq->used--;
   for (p = 0; left_child (p) < pq->used; )
@@ -27,9 +27,22 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* A range of targets already given out.  */
+struct grub_relocator_range
+{
+  grub_phys_addr_t start;
+  grub_phys_addr_t end;
+};
+
 struct grub_relocator
 {
   struct grub_relocator_chunk *chunks;
+  /* The targets of CHUNKS, sorted and with adjacent ones merged, so that
+     collisions are found by bisection and loaders placing many chunks
+     next to each other keep the scan in malloc_in_range short.  */
+  struct grub_relocator_range *targets;
+  unsigned ntargets;
+  unsigned targets_max;
   grub_phys_addr_t postchunks;
   grub_phys_addr_t highestaddr;
   grub_phys_addr_t highestnonpostaddr;
@@ -129,6 +142,86 @@ is_start (int type)
   return !(type & 1) && (type != COLLISION_START);
 }
 
+/* Index of the first target range ending after ADDR.  */
+static unsigned
+targets_bisect (struct grub_relocator *rel, grub_phys_addr_t addr)
+{
+  unsigned lo = 0, hi = rel->ntargets;
+
+  while (lo < hi)
+    {
+      unsigned mid = (lo + hi) / 2;
+      if (rel->targets[mid].end <= addr)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* The target range overlapping START+SIZE, if any.  */
+static struct grub_relocator_range *
+targets_find (struct grub_relocator *rel, grub_phys_addr_t start,
+	      grub_size_t size)
+{
+  unsigned i = targets_bisect (rel, start);
+
+  if (i < rel->ntargets && rel->targets[i].start < start + size)
+    return &rel->targets[i];
+  return NULL;
+}
+
+/* Make room for one more range, so that recording a chunk can't fail
+   once it is allocated.  */
+static grub_err_t
+targets_reserve (struct grub_relocator *rel)
+{
+  struct grub_relocator_range *n;
+  unsigned max;
+
+  if (rel->ntargets < rel->targets_max)
+    return GRUB_ERR_NONE;
+  max = rel->targets_max ? 2 * rel->targets_max : 16;
+  n = grub_realloc (rel->targets, max * sizeof (n[0]));
+  if (!n)
+    return grub_errno;
+  rel->targets = n;
+  rel->targets_max = max;
+  return GRUB_ERR_NONE;
+}
+
+/* Record the target of a new chunk, which overlaps no other.  */
+static void
+targets_add (struct grub_relocator *rel, grub_phys_addr_t start,
+	     grub_size_t size)
+{
+  grub_phys_addr_t end = start + size;
+  unsigned i = targets_bisect (rel, start);
+
+  if (i > 0 && rel->targets[i - 1].end == start)
+    {
+      rel->targets[i - 1].end = end;
+      if (i < rel->ntargets && rel->targets[i].start == end)
+	{
+	  rel->targets[i - 1].end = rel->targets[i].end;
+	  grub_memmove (&rel->targets[i], &rel->targets[i + 1],
+			(rel->ntargets - i - 1) * sizeof (rel->targets[0]));
+	  rel->ntargets--;
+	}
+      return;
+    }
+  if (i < rel->ntargets && rel->targets[i].start == end)
+    {
+      rel->targets[i].start = start;
+      return;
+    }
+  grub_memmove (&rel->targets[i + 1], &rel->targets[i],
+		(rel->ntargets - i) * sizeof (rel->targets[0]));
+  rel->targets[i].start = start;
+  rel->targets[i].end = end;
+  rel->ntargets++;
+}
+
 static void
 allocate_regstart (grub_phys_addr_t addr, grub_size_t size, grub_mm_region_t rb,
 		   grub_mm_region_t *regancestor, grub_mm_header_t hancestor)
@@ -458,11 +551,7 @@ malloc_in_range (struct grub_relocator *rel,
     }
 
   if (collisioncheck && rel)
-    {
-      struct grub_relocator_chunk *chunk;
-      for (chunk = rel->chunks; chunk; chunk = chunk->next)
-	maxevents += 2;
-    }
+    maxevents += 2 * rel->ntargets;
 
 #if GRUB_RELOCATOR_HAVE_FIRMWARE_REQUESTS
   {
@@ -510,14 +599,14 @@ malloc_in_range (struct grub_relocator *rel,
 
   if (collisioncheck && rel)
     {
-      struct grub_relocator_chunk *chunk;
-      for (chunk = rel->chunks; chunk; chunk = chunk->next)
+      unsigned i;
+      for (i = 0; i < rel->ntargets; i++)
 	{
 	  events[N].type = COLLISION_START;
-	  events[N].pos = chunk->target;
+	  events[N].pos = rel->targets[i].start;
 	  N++;
 	  events[N].type = COLLISION_END;
-	  events[N].pos = chunk->target + chunk->size;
+	  events[N].pos = rel->targets[i].end;
 	  N++;
 	}
     }
@@ -586,6 +675,9 @@ malloc_in_range (struct grub_relocator *rel,
 #endif
 #endif
 
+  /* Only the rings are searched, let the cached small blocks back in.  */
+  grub_mm_release_small ();
+
   /* No malloc from this point.  */
   base_saved = grub_mm_base;
   grub_mm_base = NULL;
@@ -1220,16 +1312,18 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 {
   struct grub_relocator_chunk *chunk;
   grub_phys_addr_t min_addr = 0, max_addr;
+  int reclaimed = 0;
 
   if (target > ~size)
     return grub_error (GRUB_ERR_BUG, "address is out of range");
 
   adjust_limits (rel, &min_addr, &max_addr, target, target);
 
-  for (chunk = rel->chunks; chunk; chunk = chunk->next)
-    if ((chunk->target <= target && target < chunk->target + chunk->size)
-	|| (target <= chunk->target && chunk->target < target + size))
-      return grub_error (GRUB_ERR_BUG, "overlap detected");
+  if (targets_find (rel, target, size))
+    return grub_error (GRUB_ERR_BUG, "overlap detected");
+
+  if (targets_reserve (rel))
+    return grub_errno;
 
   chunk = grub_malloc (sizeof (struct grub_relocator_chunk));
   if (!chunk)
@@ -1240,6 +1334,7 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 		(unsigned long long) min_addr, (unsigned long long) max_addr,
 		(unsigned long long) target);
 
+ again:
   do
     {
       /* A trick to improve Linux allocation.  */
@@ -1267,6 +1362,14 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
 	  break;
 	}
 
+      /* The caches in the heap may be in the way.  */
+      if (!reclaimed)
+	{
+	  reclaimed = 1;
+	  grub_mm_reclaim (GRUB_MM_RECLAIM_ALL);
+	  goto again;
+	}
+
       grub_dprintf ("relocator", "not allocated\n");
       grub_free (chunk);
       return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
@@ -1306,6 +1409,7 @@ grub_relocator_alloc_chunk_addr (struct grub_relocator *rel,
   chunk->size = size;
   chunk->next = rel->chunks;
   rel->chunks = chunk;
+  targets_add (rel, target, size);
   grub_dprintf ("relocator", "cur = %p, next = %p\n", rel->chunks,
 		rel->chunks->next);
 
@@ -1375,6 +1479,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
     .found = 0
   };
   grub_addr_t min_addr2 = 0, max_addr2;
+  int reclaimed = 0;
 
   if (max_addr > ~size)
     max_addr = ~size;
@@ -1386,11 +1491,19 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 
   grub_dprintf ("relocator", "chunks = %p\n", rel->chunks);
 
+  if (targets_reserve (rel))
+    return grub_errno;
+
   ctx.chunk = grub_malloc (sizeof (struct grub_relocator_chunk));
   if (!ctx.chunk)
     return grub_errno;
 
-  if (malloc_in_range (rel, min_addr, max_addr, align,
+  /* MAX_ADDR is the highest start of the chunk, as in the target search
+     below, while malloc_in_range takes the end of the range.  Getting
+     this wrong made a chunk asked for at one address, or as high as it
+     fits, always land elsewhere and be copied into place at boot.  */
+ again:
+  if (malloc_in_range (rel, min_addr, max_addr + size, align,
 		       size, ctx.chunk,
 		       preference != GRUB_RELOCATOR_PREFERENCE_HIGH, 1))
     {
@@ -1402,6 +1515,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
       ctx.chunk->size = size;
       ctx.chunk->next = rel->chunks;
       rel->chunks = ctx.chunk;
+      targets_add (rel, ctx.chunk->target, size);
       ctx.chunk->srcv = grub_map_memory (ctx.chunk->src, ctx.chunk->size);
       *out = ctx.chunk;
       return GRUB_ERR_NONE;
@@ -1426,6 +1540,14 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
 	  break;
 	}
 
+      /* The caches in the heap may be in the way.  */
+      if (!reclaimed)
+	{
+	  reclaimed = 1;
+	  grub_mm_reclaim (GRUB_MM_RECLAIM_ALL);
+	  goto again;
+	}
+
       return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
     }
   while (0);
@@ -1446,22 +1568,20 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
   }
   while (1)
     {
-      struct grub_relocator_chunk *chunk2;
-      for (chunk2 = rel->chunks; chunk2; chunk2 = chunk2->next)
-	if ((chunk2->target <= ctx.chunk->target
-	     && ctx.chunk->target < chunk2->target + chunk2->size)
-	    || (ctx.chunk->target <= chunk2->target && chunk2->target
-		< ctx.chunk->target + size))
-	  {
-	    if (preference == GRUB_RELOCATOR_PREFERENCE_HIGH)
-	      ctx.chunk->target = ALIGN_DOWN (chunk2->target, align);
-	    else
-	      ctx.chunk->target = ALIGN_UP (chunk2->target + chunk2->size,
-					    align);
-	    break;
-	  }
-      if (!chunk2)
+      struct grub_relocator_range *used;
+
+      used = targets_find (rel, ctx.chunk->target, size);
+      if (!used)
 	break;
+      if (preference == GRUB_RELOCATOR_PREFERENCE_HIGH)
+	{
+	  if (used->start < size)
+	    return grub_error (GRUB_ERR_BAD_OS,
+			       "couldn't find suitable memory target");
+	  ctx.chunk->target = ALIGN_DOWN (used->start - size, align);
+	}
+      else
+	ctx.chunk->target = ALIGN_UP (used->end, align);
     }
 
   grub_dprintf ("relocator", "relocators_size=%ld\n",
@@ -1478,6 +1598,7 @@ grub_relocator_alloc_chunk_align (struct grub_relocator *rel,
   ctx.chunk->size = size;
   ctx.chunk->next = rel->chunks;
   rel->chunks = ctx.chunk;
+  targets_add (rel, ctx.chunk->target, size);
   grub_dprintf ("relocator", "cur = %p, next = %p\n", rel->chunks,
 		rel->chunks->next);
   ctx.chunk->srcv = grub_map_memory (ctx.chunk->src, ctx.chunk->size);
@@ -1505,6 +1626,7 @@ grub_relocator_unload (struct grub_relocator *rel)
       grub_free (chunk->subchunks);
       grub_free (chunk);
     }
+  grub_free (rel->targets);
   grub_free (rel);
 }
 
@@ -0,0 +1,350 @@
+/* sha_accel.c - SHA-1 and SHA-256 using the instructions of the CPU.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/crypto.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Both the x86 SHA extensions and the ARMv8 crypto extensions only
+   provide the compression function.  Buffering and padding are done
+   here, and whole blocks of the input are handed over without copying,
+   so hashing a file costs little beyond the rounds themselves.  */
+
+#define SHA_ACCEL_BLOCKSIZE	64
+
+typedef void (*sha_accel_compress_t) (grub_uint32_t *state,
+				      const grub_uint8_t *data,
+				      grub_size_t nblocks);
+
+struct sha_accel_context
+{
+  grub_uint32_t state[8];
+  /* Pending input, and the digest once finalized.  */
+  grub_uint8_t buf[SHA_ACCEL_BLOCKSIZE];
+  grub_uint64_t count;
+  sha_accel_compress_t compress;
+  unsigned mdlen;
+};
+
+/* In lib/ARCH/sha_accel.S.  */
+void grub_sha_accel_sha1_compress (grub_uint32_t *state,
+				   const grub_uint8_t *data,
+				   grub_size_t nblocks);
+void grub_sha_accel_sha256_compress (grub_uint32_t *state,
+				     const grub_uint8_t *data,
+				     grub_size_t nblocks);
+
+static void
+sha1_accel_init (void *context)
+{
+  struct sha_accel_context *ctx = context;
+
+  ctx->state[0] = 0x67452301;
+  ctx->state[1] = 0xefcdab89;
+  ctx->state[2] = 0x98badcfe;
+  ctx->state[3] = 0x10325476;
+  ctx->state[4] = 0xc3d2e1f0;
+  ctx->count = 0;
+  ctx->compress = grub_sha_accel_sha1_compress;
+  ctx->mdlen = 20;
+}
+
+static void
+sha224_accel_init (void *context)
+{
+  struct sha_accel_context *ctx = context;
+
+  ctx->state[0] = 0xc1059ed8;
+  ctx->state[1] = 0x367cd507;
+  ctx->state[2] = 0x3070dd17;
+  ctx->state[3] = 0xf70e5939;
+  ctx->state[4] = 0xffc00b31;
+  ctx->state[5] = 0x68581511;
+  ctx->state[6] = 0x64f98fa7;
+  ctx->state[7] = 0xbefa4fa4;
+  ctx->count = 0;
+  ctx->compress = grub_sha_accel_sha256_compress;
+  ctx->mdlen = 28;
+}
+
+static void
+sha256_accel_init (void *context)
+{
+  struct sha_accel_context *ctx = context;
+
+  ctx->state[0] = 0x6a09e667;
+  ctx->state[1] = 0xbb67ae85;
+  ctx->state[2] = 0x3c6ef372;
+  ctx->state[3] = 0xa54ff53a;
+  ctx->state[4] = 0x510e527f;
+  ctx->state[5] = 0x9b05688c;
+  ctx->state[6] = 0x1f83d9ab;
+  ctx->state[7] = 0x5be0cd19;
+  ctx->count = 0;
+  ctx->compress = grub_sha_accel_sha256_compress;
+  ctx->mdlen = 32;
+}
+
+static void
+sha_accel_write (void *context, const void *buf, grub_size_t len)
+{
+  struct sha_accel_context *ctx = context;
+  const grub_uint8_t *p = buf;
+  unsigned used = ctx->count & (SHA_ACCEL_BLOCKSIZE - 1);
+
+  ctx->count += len;
+
+  if (used)
+    {
+      grub_size_t n = SHA_ACCEL_BLOCKSIZE - used;
+
+      if (n > len)
+	n = len;
+      grub_memcpy (ctx->buf + used, p, n);
+      p += n;
+      len -= n;
+      if (used + n < SHA_ACCEL_BLOCKSIZE)
+	return;
+      ctx->compress (ctx->state, ctx->buf, 1);
+    }
+
+  if (len >= SHA_ACCEL_BLOCKSIZE)
+    {
+      grub_size_t nblocks = len / SHA_ACCEL_BLOCKSIZE;
+
+      ctx->compress (ctx->state, p, nblocks);
+      p += nblocks * SHA_ACCEL_BLOCKSIZE;
+      len -= nblocks * SHA_ACCEL_BLOCKSIZE;
+    }
+
+  grub_memcpy (ctx->buf, p, len);
+}
+
+static void
+sha_accel_final (void *context)
+{
+  struct sha_accel_context *ctx = context;
+  unsigned used = ctx->count & (SHA_ACCEL_BLOCKSIZE - 1);
+  unsigned i;
+
+  ctx->buf[used++] = 0x80;
+  if (used > SHA_ACCEL_BLOCKSIZE - 8)
+    {
+      grub_memset (ctx->buf + used, 0, SHA_ACCEL_BLOCKSIZE - used);
+      ctx->compress (ctx->state, ctx->buf, 1);
+      used = 0;
+    }
+  grub_memset (ctx->buf + used, 0, SHA_ACCEL_BLOCKSIZE - 8 - used);
+  grub_set_unaligned64 (ctx->buf + SHA_ACCEL_BLOCKSIZE - 8,
+			grub_cpu_to_be64 (ctx->count << 3));
+  ctx->compress (ctx->state, ctx->buf, 1);
+
+  for (i = 0; i < ctx->mdlen / 4; i++)
+    grub_set_unaligned32 (ctx->buf + 4 * i, grub_cpu_to_be32 (ctx->state[i]));
+}
+
+static unsigned char *
+sha_accel_read (void *context)
+{
+  struct sha_accel_context *ctx = context;
+
+  return ctx->buf;
+}
+
+static int
+sha_accel_supported (const char *name)
+{
+#if defined (__x86_64__)
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  (void) name;
+
+  /* CPUID.(EAX=07H,ECX=0):EBX.SHA covers both digests; SSSE3 and SSE4.1
+     are implied.  */
+  asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "0" (0));
+  if (eax < 7)
+    return 0;
+  asm volatile ("cpuid" : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+		: "0" (7), "2" (0));
+  return !!(ebx & (1 << 29));
+#elif defined (__aarch64__)
+  grub_uint64_t isar0;
+
+  asm volatile ("mrs %0, id_aa64isar0_el1" : "=r" (isar0));
+  /* ID_AA64ISAR0_EL1.SHA1 and .SHA2 are non-zero when the respective
+     instructions exist.  */
+  if (grub_strcmp (name, "SHA1") == 0)
+    return ((isar0 >> 8) & 0xf) != 0;
+  return ((isar0 >> 12) & 0xf) != 0;
+#else
+  (void) name;
+  return 0;
+#endif
+}
+
+static grub_uint8_t asn_sha1[15] = /* Object ID is 1.3.14.3.2.26 */
+  { 0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2b, 0x0e, 0x03,
+    0x02, 0x1a, 0x05, 0x00, 0x04, 0x14 };
+
+static gcry_md_oid_spec_t oid_spec_sha1[] =
+  {
+    { "1.2.840.113549.1.1.5" },
+    { "1.2.840.10040.4.3" },
+    { "1.3.14.3.2.26" },
+    { "1.3.14.3.2.29" },
+    { "1.3.36.3.3.1.2" },
+    { NULL }
+  };
+
+static grub_uint8_t asn_sha224[19] = /* Object ID is 2.16.840.1.101.3.4.2.4 */
+  { 0x30, 0x2d, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48,
+    0x01, 0x65, 0x03, 0x04, 0x02, 0x04, 0x05, 0x00, 0x04,
+    0x1c };
+
+static gcry_md_oid_spec_t oid_spec_sha224[] =
+  {
+    { "2.16.840.1.101.3.4.2.4" },
+    { NULL }
+  };
+
+static grub_uint8_t asn_sha256[19] = /* Object ID is 2.16.840.1.101.3.4.2.1 */
+  { 0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86,
+    0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05,
+    0x00, 0x04, 0x20 };
+
+static gcry_md_oid_spec_t oid_spec_sha256[] =
+  {
+    { "2.16.840.1.101.3.4.2.1" },
+    { "1.2.840.113549.1.1.11" },
+    { NULL }
+  };
+
+/* Preferred to gcry_sha1 and gcry_sha256 whichever gets loaded first.  */
+#define SHA_ACCEL_PRIORITY	10
+
+#ifdef GRUB_UTIL
+#define SHA_ACCEL_MODNAME	.modname = "sha_accel",
+#else
+#define SHA_ACCEL_MODNAME
+#endif
+
+#define SHA_ACCEL_SPEC(nm, asn, oidspec, len, initfn)		\
+  {								\
+    .name = nm,							\
+    .asnoid = asn,						\
+    .asnlen = sizeof (asn),					\
+    .oids = oidspec,						\
+    .mdlen = len,						\
+    .init = initfn,						\
+    .write = sha_accel_write,					\
+    .final = sha_accel_final,					\
+    .read = sha_accel_read,					\
+    .contextsize = sizeof (struct sha_accel_context),		\
+    .blocksize = SHA_ACCEL_BLOCKSIZE,				\
+    SHA_ACCEL_MODNAME						\
+    .priority = SHA_ACCEL_PRIORITY				\
+  }
+
+static gcry_md_spec_t sha_accel_specs[] =
+  {
+    SHA_ACCEL_SPEC ("SHA1", asn_sha1, oid_spec_sha1, 20, sha1_accel_init),
+    SHA_ACCEL_SPEC ("SHA224", asn_sha224, oid_spec_sha224, 28,
+		    sha224_accel_init),
+    SHA_ACCEL_SPEC ("SHA256", asn_sha256, oid_spec_sha256, 32,
+		    sha256_accel_init)
+  };
+
+/* FIPS 180-2 appendix examples.  The second one leaves no room for the
+   length in its block, so both paths of sha_accel_final get exercised.  */
+static const char sha_accel_msg1[] = "abc";
+static const char sha_accel_msg2[] =
+  "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+static const grub_uint8_t sha_accel_kat[][2][32] =
+  {
+    {
+      { 0xa9, 0x99, 0x3e, 0x36, 0x47, 0x06, 0x81, 0x6a, 0xba, 0x3e,
+	0x25, 0x71, 0x78, 0x50, 0xc2, 0x6c, 0x9c, 0xd0, 0xd8, 0x9d },
+      { 0x84, 0x98, 0x3e, 0x44, 0x1c, 0x3b, 0xd2, 0x6e, 0xba, 0xae,
+	0x4a, 0xa1, 0xf9, 0x51, 0x29, 0xe5, 0xe5, 0x46, 0x70, 0xf1 }
+    },
+    {
+      { 0x23, 0x09, 0x7d, 0x22, 0x34, 0x05, 0xd8, 0x22, 0x86, 0x42,
+	0xa4, 0x77, 0xbd, 0xa2, 0x55, 0xb3, 0x2a, 0xad, 0xbc, 0xe4,
+	0xbd, 0xa0, 0xb3, 0xf7, 0xe3, 0x6c, 0x9d, 0xa7 },
+      { 0x75, 0x38, 0x8b, 0x16, 0x51, 0x27, 0x76, 0xcc, 0x5d, 0xba,
+	0x5d, 0xa1, 0xfd, 0x89, 0x01, 0x50, 0xb0, 0xc6, 0x45, 0x5c,
+	0xb4, 0xf5, 0x8b, 0x19, 0x52, 0x52, 0x25, 0x25 }
+    },
+    {
+      { 0xba, 0x78, 0x16, 0xbf, 0x8f, 0x01, 0xcf, 0xea, 0x41, 0x41,
+	0x40, 0xde, 0x5d, 0xae, 0x22, 0x23, 0xb0, 0x03, 0x61, 0xa3,
+	0x96, 0x17, 0x7a, 0x9c, 0xb4, 0x10, 0xff, 0x61, 0xf2, 0x00,
+	0x15, 0xad },
+      { 0x24, 0x8d, 0x6a, 0x61, 0xd2, 0x06, 0x38, 0xb8, 0xe5, 0xc0,
+	0x26, 0x93, 0x0c, 0x3e, 0x60, 0x39, 0xa3, 0x3c, 0xe4, 0x59,
+	0x64, 0xff, 0x21, 0x67, 0xf6, 0xec, 0xed, 0xd4, 0x19, 0xdb,
+	0x06, 0xc1 }
+    }
+  };
+
+static int
+sha_accel_selftest (const gcry_md_spec_t *md, const grub_uint8_t kat[2][32])
+{
+  struct sha_accel_context ctx;
+
+  md->init (&ctx);
+  md->write (&ctx, sha_accel_msg1, sizeof (sha_accel_msg1) - 1);
+  md->final (&ctx);
+  if (grub_memcmp (md->read (&ctx), kat[0], md->mdlen) != 0)
+    return 0;
+
+  md->init (&ctx);
+  md->write (&ctx, sha_accel_msg2, sizeof (sha_accel_msg2) - 1);
+  md->final (&ctx);
+  return grub_memcmp (md->read (&ctx), kat[1], md->mdlen) == 0;
+}
+
+static int sha_accel_registered[ARRAY_SIZE (sha_accel_specs)];
+
+GRUB_MOD_INIT(sha_accel)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (sha_accel_specs); i++)
+    if (sha_accel_supported (sha_accel_specs[i].name)
+	&& sha_accel_selftest (&sha_accel_specs[i], sha_accel_kat[i]))
+      {
+	grub_md_register (&sha_accel_specs[i]);
+	sha_accel_registered[i] = 1;
+      }
+}
+
+GRUB_MOD_FINI(sha_accel)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (sha_accel_specs); i++)
+    if (sha_accel_registered[i])
+      grub_md_unregister (&sha_accel_specs[i]);
+}
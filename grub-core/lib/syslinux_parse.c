@@ -74,6 +74,8 @@ struct syslinux_menu
   unsigned long timeout;
   struct syslinux_say *say;
   grub_syslinux_flavour_t flavour;
+  /* Holds everything above, freed after the menu is printed.  */
+  grub_arena_t arena;
 };
 
 struct output_buffer
@@ -131,9 +133,11 @@ add_comment (struct syslinux_menu *menu, const char *comment, int nl)
     {
       if (menu->entries->commentslen == 0 && *comment == 0)
 	return GRUB_ERR_NONE;
-      menu->entries->comments = grub_realloc (menu->entries->comments,
-					      menu->entries->commentslen
-					      + 2 + grub_strlen (comment));
+      menu->entries->comments
+	= grub_arena_realloc (menu->arena, menu->entries->comments,
+			      menu->entries->commentslen + 1,
+			      menu->entries->commentslen
+			      + 2 + grub_strlen (comment));
       if (!menu->entries->comments)
 	return grub_errno;
       menu->entries->commentslen
@@ -148,8 +152,10 @@ add_comment (struct syslinux_menu *menu, const char *comment, int nl)
     {
       if (menu->commentslen == 0 && *comment == 0)
 	return GRUB_ERR_NONE;
-      menu->comments = grub_realloc (menu->comments, menu->commentslen
-				     + 2 + grub_strlen (comment));
+      menu->comments = grub_arena_realloc (menu->arena, menu->comments,
+					   menu->commentslen + 1,
+					   menu->commentslen
+					   + 2 + grub_strlen (comment));
       if (!menu->comments)
 	return grub_errno;
       menu->commentslen += grub_stpcpy (menu->comments + menu->commentslen,
@@ -178,16 +184,12 @@ label (const char *line, struct syslinux_menu *menu)
 {
   struct syslinux_menuentry *entry;
 
-  entry = grub_malloc (sizeof (*entry));
+  entry = grub_arena_zalloc (menu->arena, sizeof (*entry));
   if (!entry)
     return grub_errno;
-  grub_memset (entry, 0, sizeof (*entry));
-  entry->label = grub_strdup (line);
+  entry->label = grub_arena_strdup (menu->arena, line);
   if (!entry->label)
-    {
-      grub_free (entry);
-      return grub_errno;
-    }
+    return grub_errno;
   entry->next = menu->entries;
   entry->prev = NULL;
   if (menu->entries)
@@ -204,7 +206,7 @@ kernel (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
 
@@ -243,7 +245,7 @@ cmd_linux (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_LINUX;
@@ -257,7 +259,7 @@ cmd_boot (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_CHAINLOADER;
@@ -271,7 +273,7 @@ cmd_bss (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_CHAINLOADER_BPB;
@@ -285,7 +287,7 @@ cmd_pxe (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_PXE;
@@ -299,7 +301,7 @@ cmd_fdimage (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_IMG;
@@ -313,7 +315,7 @@ cmd_comboot (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_COM;
@@ -327,7 +329,7 @@ cmd_com32 (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = KERNEL_COM32;
@@ -343,13 +345,14 @@ cmd_config (const char *line, struct syslinux_menu *menu)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
   for (space = line; *space && !grub_isspace (*space); space++);
-  menu->entries->kernel_file = grub_strndup (line, space - line);
+  menu->entries->kernel_file = grub_arena_strndup (menu->arena, line,
+						   space - line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   for (; *space && grub_isspace (*space); space++);
   if (*space)
     {
-      menu->entries->argument = grub_strdup (space);
+      menu->entries->argument = grub_arena_strdup (menu->arena, space);
       if (!menu->entries->argument)
 	return grub_errno;
     }
@@ -364,7 +367,7 @@ cmd_append (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->append = grub_strdup (line);
+  menu->entries->append = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->append)
     return grub_errno;
   
@@ -383,15 +386,12 @@ cmd_initrd (const char *line, struct syslinux_menu *menu)
     {
       for (comma = line; *comma && *comma != ','; comma++);
 
-      ninitrd = grub_malloc (sizeof (*ninitrd));
+      ninitrd = grub_arena_alloc (menu->arena, sizeof (*ninitrd));
       if (!ninitrd)
 	return grub_errno;
-      ninitrd->file = grub_strndup (line, comma - line);
+      ninitrd->file = grub_arena_strndup (menu->arena, line, comma - line);
       if (!ninitrd->file)
-	{
-	  grub_free (ninitrd);
-	  return grub_errno;
-	}
+	return grub_errno;
       ninitrd->next = NULL;
       if (menu->entries->initrds_last)
 	menu->entries->initrds_last->next = ninitrd;
@@ -412,7 +412,7 @@ cmd_initrd (const char *line, struct syslinux_menu *menu)
 static grub_err_t
 cmd_default (const char *line, struct syslinux_menu *menu)
 {
-  menu->def = grub_strdup (line);
+  menu->def = grub_arena_strdup (menu->arena, line);
   if (!menu->def)
     return grub_errno;
   
@@ -442,7 +442,7 @@ static grub_err_t
 cmd_menubackground (const char *line,
 		    struct syslinux_menu *menu)
 {
-  menu->background = grub_strdup (line);
+  menu->background = grub_arena_strdup (menu->arena, line);
   return GRUB_ERR_NONE;
 }
 
@@ -453,7 +453,7 @@ cmd_localboot (const char *line,
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->kernel_file = grub_strdup (line);
+  menu->entries->kernel_file = grub_arena_strdup (menu->arena, line);
   if (!menu->entries->kernel_file)
     return grub_errno;
   menu->entries->entry_type = LOCALBOOT;
@@ -470,7 +470,8 @@ cmd_extlabel (const char *line, struct syslinux_menu *menu)
   if (!menu->entries)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "kernel without label");
 
-  menu->entries->extlabel = grub_malloc (grub_strlen (line) + 1);
+  menu->entries->extlabel = grub_arena_alloc (menu->arena,
+					      grub_strlen (line) + 1);
   if (!menu->entries->extlabel)
     return grub_errno;
   in = line;
@@ -494,7 +495,8 @@ static grub_err_t
 cmd_say (const char *line, struct syslinux_menu *menu)
 {
   struct syslinux_say *nsay;
-  nsay = grub_malloc (sizeof (*nsay) + grub_strlen (line) + 1);
+  nsay = grub_arena_alloc (menu->arena,
+			   sizeof (*nsay) + grub_strlen (line) + 1);
   if (!nsay)
     return grub_errno;
   nsay->prev = NULL;
@@ -648,7 +650,7 @@ helptext (const char *line, grub_file_t file, struct syslinux_menu *menu)
   char *buf = NULL;
   grub_size_t helplen, alloclen = 0;
 
-  help = grub_strdup (line);
+  help = grub_arena_strdup (menu->arena, line);
   if (!help)
     return grub_errno;
   helplen = grub_strlen (line);
@@ -673,7 +675,7 @@ helptext (const char *line, grub_file_t file, struct syslinux_menu *menu)
       if (alloclen < needlen)
 	{
 	  alloclen = 2 * needlen;
-	  help = grub_realloc (help, alloclen);
+	  help = grub_arena_realloc (menu->arena, help, helplen + 1, alloclen);
 	  if (!help)
 	    {
 	      grub_free (buf);
@@ -684,7 +686,6 @@ helptext (const char *line, grub_file_t file, struct syslinux_menu *menu)
     }
 
   grub_free (buf);
-  grub_free (help);
   return grub_errno;
 }
 
@@ -1385,69 +1386,14 @@ print_entry (struct output_buffer *outbuf,
   return GRUB_ERR_NONE;
 }
 
-static void
-free_menu (struct syslinux_menu *menu)
-{
-  struct syslinux_say *say, *nsay;
-  struct syslinux_menuentry *entry, *nentry;
-
-  grub_free (menu->def);
-  grub_free (menu->comments);
-  grub_free (menu->background);
-  for (say = menu->say; say ; say = nsay)
-    {
-      nsay = say->next;
-      grub_free (say);
-    }
-
-  for (entry = menu->entries; entry ; entry = nentry)
-    {
-      nentry = entry->next;
-      struct initrd_list *initrd, *ninitrd;
-
-      for (initrd = entry->initrds; initrd ; initrd = ninitrd)
-	{
-	  ninitrd = initrd->next;
-	  grub_free (initrd->file);
-	  grub_free (initrd);
-	}
- 
-      grub_free (entry->comments);
-      grub_free (entry->kernel_file);
-      grub_free (entry->label);
-      grub_free (entry->extlabel);
-      grub_free (entry->append);
-      grub_free (entry->help);
-      grub_free (entry);
-    }
-}
-
 static grub_err_t
-config_file (struct output_buffer *outbuf,
-	     const char *root, const char *target_root,
-	     const char *cwd, const char *target_cwd,
-	     const char *fname, struct syslinux_menu *parent,
-	     grub_syslinux_flavour_t flav)
+write_menu (struct output_buffer *outbuf, struct syslinux_menu *menu)
 {
   grub_err_t err;
-  struct syslinux_menu menu;
   struct syslinux_menuentry *curentry, *lentry;
   struct syslinux_say *say;
 
-  grub_memset (&menu, 0, sizeof (menu));
-  menu.flavour = flav;
-  menu.root_read_directory = root;
-  menu.root_target_directory = target_root;
-  menu.current_read_directory = cwd;
-  menu.current_target_directory = target_cwd;
-
-  menu.filename = fname;
-  menu.parent = parent;
-  err = syslinux_parse_real (&menu);
-  if (err)
-    return err;
-
-  for (say = menu.say; say && say->next; say = say->next);
+  for (say = menu->say; say && say->next; say = say->next);
   for (; say && say->prev; say = say->prev)
     {
       print_string ("echo ");
@@ -1457,43 +1403,43 @@ config_file (struct output_buffer *outbuf,
       print_string ("\n");
     }
 
-  if (menu.background)
+  if (menu->background)
     {
       print_string ("  background_image ");
-      err = print_file (outbuf, &menu, menu.background, NULL);
+      err = print_file (outbuf, menu, menu->background, NULL);
       if (err)
 	return err;
       print_string ("\n");
     }
 
-  if (menu.comments)
+  if (menu->comments)
     {
-      err = print (outbuf, menu.comments, grub_strlen (menu.comments));
+      err = print (outbuf, menu->comments, grub_strlen (menu->comments));
       if (err)
 	return err;
     }
 
-  if (menu.timeout == 0 && menu.entries && menu.def)
+  if (menu->timeout == 0 && menu->entries && menu->def)
     {
-      err = print_entry (outbuf, &menu, menu.def);
+      err = print_entry (outbuf, menu, menu->def);
       if (err)
 	return err;
     }
-  else if (menu.entries)
+  else if (menu->entries)
     {
-      for (curentry = menu.entries; curentry->next; curentry = curentry->next);
+      for (curentry = menu->entries; curentry->next; curentry = curentry->next);
       lentry = curentry;
 
       print_string ("set timeout=");
-      err = print_num (outbuf, (menu.timeout + 9) / 10);
+      err = print_num (outbuf, (menu->timeout + 9) / 10);
       if (err)
 	return err;
       print_string ("\n");
 
-      if (menu.def)
+      if (menu->def)
 	{
 	  print_string (" default=");
-	  err = print_escaped (outbuf, menu.def, NULL);
+	  err = print_escaped (outbuf, menu->def, NULL);
 	  if (err)
 	    return err;
 	  print_string ("\n");
@@ -1518,17 +1464,45 @@ config_file (struct output_buffer *outbuf,
 	    return err;
 	  print_string (" {\n");
 
-	  err = write_entry (outbuf, &menu, curentry);
+	  err = write_entry (outbuf, menu, curentry);
 	  if (err)
 	    return err;
 
 	  print_string ("}\n");
 	}
     }
-  free_menu (&menu);
   return GRUB_ERR_NONE;
 }
 
+static grub_err_t
+config_file (struct output_buffer *outbuf,
+	     const char *root, const char *target_root,
+	     const char *cwd, const char *target_cwd,
+	     const char *fname, struct syslinux_menu *parent,
+	     grub_syslinux_flavour_t flav)
+{
+  grub_err_t err;
+  struct syslinux_menu menu;
+
+  grub_memset (&menu, 0, sizeof (menu));
+  menu.flavour = flav;
+  menu.root_read_directory = root;
+  menu.root_target_directory = target_root;
+  menu.current_read_directory = cwd;
+  menu.current_target_directory = target_cwd;
+
+  menu.filename = fname;
+  menu.parent = parent;
+  menu.arena = grub_arena_new (0);
+  if (!menu.arena)
+    return grub_errno;
+  err = syslinux_parse_real (&menu);
+  if (!err)
+    err = write_menu (outbuf, &menu);
+  grub_arena_destroy (menu.arena);
+  return err;
+}
+
 char *
 grub_syslinux_config_file (const char *base, const char *target_base,
 			   const char *cwd, const char *target_cwd,
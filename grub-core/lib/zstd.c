@@ -0,0 +1,1090 @@
+/* zstd.c - Zstandard decoder.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Decoder for the format described in the Zstandard compression format
+   specification (RFC 8878).  Dictionaries aren't supported and checksums
+   aren't verified.  */
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/zstd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LL_MAX_SYMBOL	35
+#define ML_MAX_SYMBOL	52
+#define OF_MAX_SYMBOL	31
+#define LL_MAX_LOG	9
+#define ML_MAX_LOG	9
+#define OF_MAX_LOG	8
+#define FSE_MAX_LOG	9
+#define HUF_WEIGHT_MAX_LOG 6
+#define HUF_MAX_BITS	11
+#define HUF_MAX_SYMBOLS	256
+
+struct fse_entry
+{
+  grub_uint8_t symbol;
+  grub_uint8_t nbits;
+  grub_uint16_t base;
+};
+
+struct fse_table
+{
+  unsigned log;
+  int valid;
+  struct fse_entry e[1 << FSE_MAX_LOG];
+};
+
+struct huf_entry
+{
+  grub_uint8_t symbol;
+  grub_uint8_t nbits;
+};
+
+struct huf_table
+{
+  unsigned maxbits;
+  int valid;
+  struct huf_entry e[1 << HUF_MAX_BITS];
+};
+
+struct grub_zstd_dctx
+{
+  struct fse_table ll;
+  struct fse_table of;
+  struct fse_table ml;
+  struct huf_table huf;
+  grub_uint32_t rep[3];
+  grub_uint8_t literals[GRUB_ZSTD_BLOCK_MAX];
+};
+
+static const grub_int16_t ll_default[] =
+  {
+    4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+    -1, -1, -1, -1
+  };
+
+static const grub_int16_t ml_default[] =
+  {
+    1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+    -1, -1, -1, -1, -1
+  };
+
+static const grub_int16_t of_default[] =
+  {
+    1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+  };
+
+static const grub_uint32_t ll_base[LL_MAX_SYMBOL + 1] =
+  {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+    8192, 16384, 32768, 65536
+  };
+
+static const grub_uint8_t ll_bits[LL_MAX_SYMBOL + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+    13, 14, 15, 16
+  };
+
+static const grub_uint32_t ml_base[ML_MAX_SYMBOL + 1] =
+  {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+    19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+    35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+    4099, 8195, 16387, 32771, 65539
+  };
+
+static const grub_uint8_t ml_bits[ML_MAX_SYMBOL + 1] =
+  {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+    12, 13, 14, 15, 16
+  };
+
+static inline unsigned
+highbit (grub_uint32_t v)
+{
+  unsigned r = 0;
+
+  while (v >>= 1)
+    r++;
+  return r;
+}
+
+static grub_err_t
+corrupted (void)
+{
+  return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "corrupted zstd data");
+}
+
+/* Return the N (at most 56) bits starting at bit POS of the SIZE bytes
+   at SRC, counting from the least significant bit of the first byte.
+   Bits outside of the buffer read as 0.  */
+static inline grub_uint64_t
+get_bits (const grub_uint8_t *src, grub_size_t size, grub_int64_t pos,
+	  unsigned n)
+{
+  grub_uint64_t v = 0;
+  grub_size_t byte;
+  unsigned i;
+
+  if (n == 0)
+    return 0;
+  if (pos < 0)
+    {
+      if (pos + (grub_int64_t) n <= 0)
+	return 0;
+      return get_bits (src, size, 0, n + pos) << -pos;
+    }
+
+  byte = pos >> 3;
+  if (byte + 8 <= size)
+    v = grub_le_to_cpu64 (grub_get_unaligned64 (src + byte));
+  else
+    for (i = 0; i < 8 && byte + i < size; i++)
+      v |= (grub_uint64_t) src[byte + i] << (8 * i);
+
+  return (v >> (pos & 7)) & ((1ULL << n) - 1);
+}
+
+/* Bit streams written forward and read backward, starting just below
+   the highest set bit of the last byte.  */
+struct bitrd
+{
+  const grub_uint8_t *src;
+  grub_size_t size;
+  grub_int64_t pos;
+};
+
+static grub_err_t
+bitrd_init (struct bitrd *rd, const grub_uint8_t *src, grub_size_t size)
+{
+  if (size == 0 || src[size - 1] == 0)
+    return corrupted ();
+  rd->src = src;
+  rd->size = size;
+  rd->pos = (grub_int64_t) (size - 1) * 8 + highbit (src[size - 1]);
+  return GRUB_ERR_NONE;
+}
+
+static inline grub_uint32_t
+bitrd_read (struct bitrd *rd, unsigned n)
+{
+  rd->pos -= n;
+  return get_bits (rd->src, rd->size, rd->pos, n);
+}
+
+static inline grub_uint32_t
+bitrd_peek (struct bitrd *rd, unsigned n)
+{
+  return get_bits (rd->src, rd->size, rd->pos - n, n);
+}
+
+/* Read the normalized probabilities of an FSE table description.  */
+static grub_err_t
+fse_read_ncount (const grub_uint8_t *src, grub_size_t size,
+		 grub_size_t *consumed, grub_int16_t *norm,
+		 unsigned *maxsym, unsigned *log, unsigned maxlog)
+{
+  grub_int64_t pos = 4;
+  int remaining, threshold;
+  unsigned nbits, sym = 0;
+
+  if (size == 0)
+    return corrupted ();
+
+  *log = (src[0] & 0xf) + 5;
+  if (*log > maxlog)
+    return corrupted ();
+
+  remaining = (1 << *log) + 1;
+  threshold = 1 << *log;
+  nbits = *log + 1;
+
+  while (remaining > 1)
+    {
+      int max = (2 * threshold - 1) - remaining;
+      int count;
+      grub_uint32_t v;
+
+      if (sym > *maxsym)
+	return corrupted ();
+
+      v = get_bits (src, size, pos, nbits);
+      if ((int) (v & (threshold - 1)) < max)
+	{
+	  count = v & (threshold - 1);
+	  pos += nbits - 1;
+	}
+      else
+	{
+	  count = v & (2 * threshold - 1);
+	  if (count >= threshold)
+	    count -= max;
+	  pos += nbits;
+	}
+
+      /* The value is the probability plus one, so that -1 ("less than
+	 one") can be coded.  */
+      count--;
+      remaining -= count < 0 ? -count : count;
+      norm[sym++] = count;
+
+      /* Zero probabilities are followed by the number of further ones,
+	 2 bits at a time.  */
+      if (count == 0)
+	{
+	  unsigned rep;
+
+	  do
+	    {
+	      unsigned i;
+
+	      rep = get_bits (src, size, pos, 2);
+	      pos += 2;
+	      for (i = 0; i < rep; i++)
+		{
+		  if (sym > *maxsym)
+		    return corrupted ();
+		  norm[sym++] = 0;
+		}
+	    }
+	  while (rep == 3);
+	}
+
+      while (remaining < threshold)
+	{
+	  nbits--;
+	  threshold >>= 1;
+	}
+    }
+
+  if (remaining != 1 || pos > (grub_int64_t) size * 8)
+    return corrupted ();
+
+  *maxsym = sym - 1;
+  *consumed = (pos + 7) >> 3;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+fse_build (struct fse_table *t, const grub_int16_t *norm, unsigned maxsym,
+	   unsigned log)
+{
+  grub_uint16_t next[ML_MAX_SYMBOL + 1];
+  unsigned size = 1 << log;
+  unsigned high = size - 1;
+  unsigned step = (size >> 1) + (size >> 3) + 3;
+  unsigned s, u, pos = 0;
+
+  for (s = 0; s <= maxsym; s++)
+    if (norm[s] == -1)
+      {
+	t->e[high--].symbol = s;
+	next[s] = 1;
+      }
+    else
+      next[s] = norm[s];
+
+  for (s = 0; s <= maxsym; s++)
+    {
+      int i;
+
+      for (i = 0; i < norm[s]; i++)
+	{
+	  t->e[pos].symbol = s;
+	  do
+	    pos = (pos + step) & (size - 1);
+	  while (pos > high);
+	}
+    }
+  if (pos != 0)
+    return corrupted ();
+
+  for (u = 0; u < size; u++)
+    {
+      unsigned state = next[t->e[u].symbol]++;
+
+      t->e[u].nbits = log - highbit (state);
+      t->e[u].base = (state << t->e[u].nbits) - size;
+    }
+
+  t->log = log;
+  t->valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+static void
+fse_build_rle (struct fse_table *t, grub_uint8_t symbol)
+{
+  t->e[0].symbol = symbol;
+  t->e[0].nbits = 0;
+  t->e[0].base = 0;
+  t->log = 0;
+  t->valid = 1;
+}
+
+/* Decode the Huffman weights compressed with FSE, using two interleaved
+   states.  */
+static grub_err_t
+huf_read_fse_weights (const grub_uint8_t *src, grub_size_t size,
+		      grub_uint8_t *weights, unsigned *nweights)
+{
+  struct fse_table t;
+  grub_int16_t norm[16];
+  unsigned maxsym = 15, log, n = 0;
+  grub_size_t used;
+  struct bitrd rd;
+  grub_uint32_t s1, s2;
+
+  if (fse_read_ncount (src, size, &used, norm, &maxsym, &log,
+		       HUF_WEIGHT_MAX_LOG)
+      || fse_build (&t, norm, maxsym, log)
+      || bitrd_init (&rd, src + used, size - used))
+    return grub_errno;
+
+  s1 = bitrd_read (&rd, log);
+  s2 = bitrd_read (&rd, log);
+
+  /* The last symbols are those of the states left when the stream
+     runs out.  */
+  while (1)
+    {
+      if (n + 2 > HUF_MAX_SYMBOLS - 1)
+	return corrupted ();
+
+      weights[n++] = t.e[s1].symbol;
+      s1 = t.e[s1].base + bitrd_read (&rd, t.e[s1].nbits);
+      if (rd.pos < 0)
+	{
+	  weights[n++] = t.e[s2].symbol;
+	  break;
+	}
+
+      weights[n++] = t.e[s2].symbol;
+      s2 = t.e[s2].base + bitrd_read (&rd, t.e[s2].nbits);
+      if (rd.pos < 0)
+	{
+	  weights[n++] = t.e[s1].symbol;
+	  break;
+	}
+    }
+
+  *nweights = n;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+huf_read_table (struct huf_table *huf, const grub_uint8_t *src,
+		grub_size_t size, grub_size_t *consumed)
+{
+  grub_uint8_t weights[HUF_MAX_SYMBOLS];
+  unsigned n = 0, i, w, maxbits, pos;
+  grub_uint32_t total = 0, rest;
+
+  if (size == 0)
+    return corrupted ();
+
+  if (src[0] >= 128)
+    {
+      /* Weights stored directly, 4 bits each.  */
+      n = src[0] - 127;
+      if (1 + (n + 1) / 2 > size)
+	return corrupted ();
+      for (i = 0; i < n; i++)
+	weights[i] = (i & 1) ? (src[1 + i / 2] & 0xf) : (src[1 + i / 2] >> 4);
+      *consumed = 1 + (n + 1) / 2;
+    }
+  else
+    {
+      if (1 + (grub_size_t) src[0] > size
+	  || huf_read_fse_weights (src + 1, src[0], weights, &n))
+	return corrupted ();
+      *consumed = 1 + src[0];
+    }
+
+  if (n >= HUF_MAX_SYMBOLS)
+    return corrupted ();
+
+  for (i = 0; i < n; i++)
+    {
+      if (weights[i] > HUF_MAX_BITS)
+	return corrupted ();
+      if (weights[i])
+	total += 1 << (weights[i] - 1);
+    }
+  if (total == 0)
+    return corrupted ();
+
+  /* The weight of the last symbol is implied: it completes the sum to
+     the next power of 2.  */
+  maxbits = highbit (total) + 1;
+  rest = (1 << maxbits) - total;
+  if (maxbits > HUF_MAX_BITS || (rest & (rest - 1)))
+    return corrupted ();
+  weights[n++] = highbit (rest) + 1;
+
+  /* Longer codes come first in the table, symbols of equal length in
+     increasing order.  */
+  pos = 0;
+  for (w = 1; w <= maxbits; w++)
+    for (i = 0; i < n; i++)
+      if (weights[i] == w)
+	{
+	  unsigned j;
+
+	  for (j = 0; j < (1U << (w - 1)); j++)
+	    {
+	      huf->e[pos + j].symbol = i;
+	      huf->e[pos + j].nbits = maxbits + 1 - w;
+	    }
+	  pos += 1 << (w - 1);
+	}
+
+  huf->maxbits = maxbits;
+  huf->valid = 1;
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+huf_decode_stream (const struct huf_table *huf, const grub_uint8_t *src,
+		   grub_size_t size, grub_uint8_t *out, grub_size_t n)
+{
+  struct bitrd rd;
+  grub_size_t i;
+
+  if (bitrd_init (&rd, src, size))
+    return grub_errno;
+
+  for (i = 0; i < n; i++)
+    {
+      const struct huf_entry *e = &huf->e[bitrd_peek (&rd, huf->maxbits)];
+
+      out[i] = e->symbol;
+      rd.pos -= e->nbits;
+    }
+
+  if (rd.pos != 0)
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+decode_literals (grub_zstd_dctx_t dctx, const grub_uint8_t *src,
+		 grub_size_t size, grub_size_t *consumed,
+		 const grub_uint8_t **lit, grub_size_t *nlit)
+{
+  unsigned type, format;
+  grub_size_t hs, regen, csize;
+
+  if (size < 1)
+    return corrupted ();
+
+  type = src[0] & 3;
+  format = (src[0] >> 2) & 3;
+
+  if (type < 2)
+    {
+      /* Raw and RLE literals.  */
+      switch (format)
+	{
+	case 1:
+	  hs = 2;
+	  break;
+	case 3:
+	  hs = 3;
+	  break;
+	default:
+	  hs = 1;
+	  break;
+	}
+      if (size < hs)
+	return corrupted ();
+      if (hs == 1)
+	regen = src[0] >> 3;
+      else if (hs == 2)
+	regen = (src[0] >> 4) | (src[1] << 4);
+      else
+	regen = (src[0] >> 4) | (src[1] << 4) | ((grub_size_t) src[2] << 12);
+      if (regen > GRUB_ZSTD_BLOCK_MAX)
+	return corrupted ();
+
+      if (type == 0)
+	{
+	  if (size < hs + regen)
+	    return corrupted ();
+	  *lit = src + hs;
+	  *consumed = hs + regen;
+	}
+      else
+	{
+	  if (size < hs + 1)
+	    return corrupted ();
+	  grub_memset (dctx->literals, src[hs], regen);
+	  *lit = dctx->literals;
+	  *consumed = hs + 1;
+	}
+      *nlit = regen;
+      return GRUB_ERR_NONE;
+    }
+
+  /* Huffman-coded literals, with a new table or the previous one.  */
+  hs = format < 2 ? 3 : format + 2;
+  if (size < hs)
+    return corrupted ();
+  if (hs == 3)
+    {
+      grub_uint32_t h = src[0] | (src[1] << 8) | (src[2] << 16);
+      regen = (h >> 4) & 0x3ff;
+      csize = (h >> 14) & 0x3ff;
+    }
+  else if (hs == 4)
+    {
+      grub_uint32_t h = grub_le_to_cpu32 (grub_get_unaligned32 (src));
+      regen = (h >> 4) & 0x3fff;
+      csize = h >> 18;
+    }
+  else
+    {
+      grub_uint32_t h = grub_le_to_cpu32 (grub_get_unaligned32 (src));
+      regen = (h >> 4) & 0x3ffff;
+      csize = (h >> 22) | ((grub_size_t) src[4] << 10);
+    }
+  if (regen > GRUB_ZSTD_BLOCK_MAX || size < hs + csize)
+    return corrupted ();
+
+  src += hs;
+  *consumed = hs + csize;
+
+  if (type == 2)
+    {
+      grub_size_t used = 0;
+
+      if (huf_read_table (&dctx->huf, src, csize, &used))
+	return grub_errno;
+      src += used;
+      csize -= used;
+    }
+  else if (! dctx->huf.valid)
+    return corrupted ();
+
+  if (format == 0)
+    {
+      if (huf_decode_stream (&dctx->huf, src, csize, dctx->literals, regen))
+	return grub_errno;
+    }
+  else
+    {
+      grub_size_t sizes[4], seg, done = 0;
+      int i;
+
+      if (csize < 6)
+	return corrupted ();
+      sizes[0] = grub_le_to_cpu16 (grub_get_unaligned16 (src));
+      sizes[1] = grub_le_to_cpu16 (grub_get_unaligned16 (src + 2));
+      sizes[2] = grub_le_to_cpu16 (grub_get_unaligned16 (src + 4));
+      src += 6;
+      csize -= 6;
+      if (sizes[0] + sizes[1] + sizes[2] > csize)
+	return corrupted ();
+      sizes[3] = csize - sizes[0] - sizes[1] - sizes[2];
+
+      seg = (regen + 3) / 4;
+      if (3 * seg > regen)
+	return corrupted ();
+      for (i = 0; i < 4; i++)
+	{
+	  grub_size_t n = i < 3 ? seg : regen - 3 * seg;
+
+	  if (huf_decode_stream (&dctx->huf, src, sizes[i],
+				 dctx->literals + done, n))
+	    return grub_errno;
+	  src += sizes[i];
+	  done += n;
+	}
+    }
+
+  *lit = dctx->literals;
+  *nlit = regen;
+  return GRUB_ERR_NONE;
+}
+
+/* Set up the table of one of the sequence codes according to MODE.  */
+static grub_err_t
+read_seq_table (struct fse_table *t, unsigned mode, const grub_uint8_t *src,
+		grub_size_t size, grub_size_t *consumed,
+		const grub_int16_t *def, unsigned defmax, unsigned deflog,
+		unsigned maxsym, unsigned maxlog)
+{
+  grub_int16_t norm[ML_MAX_SYMBOL + 1];
+  unsigned log;
+
+  *consumed = 0;
+  switch (mode)
+    {
+    case 0:
+      return fse_build (t, def, defmax, deflog);
+    case 1:
+      if (size < 1 || src[0] > maxsym)
+	return corrupted ();
+      fse_build_rle (t, src[0]);
+      *consumed = 1;
+      return GRUB_ERR_NONE;
+    case 2:
+      if (fse_read_ncount (src, size, consumed, norm, &maxsym, &log, maxlog))
+	return grub_errno;
+      return fse_build (t, norm, maxsym, log);
+    default:
+      if (! t->valid)
+	return corrupted ();
+      return GRUB_ERR_NONE;
+    }
+}
+
+static inline void
+out_literals (grub_uint8_t *dst, grub_size_t *pos, grub_size_t limit,
+	      const grub_uint8_t *src, grub_size_t len)
+{
+  if (*pos < limit)
+    grub_memcpy (dst + *pos, src, len < limit - *pos ? len : limit - *pos);
+  *pos += len;
+}
+
+static inline void
+out_match (grub_uint8_t *dst, grub_size_t *pos, grub_size_t limit,
+	   grub_size_t offset, grub_size_t len)
+{
+  if (*pos < limit)
+    {
+      grub_size_t n = len < limit - *pos ? len : limit - *pos;
+      grub_uint8_t *d = dst + *pos;
+      const grub_uint8_t *s = d - offset;
+
+      if (offset >= n)
+	grub_memcpy (d, s, n);
+      else
+	while (n--)
+	  *d++ = *s++;
+    }
+  *pos += len;
+}
+
+static grub_err_t
+decode_sequences (grub_zstd_dctx_t dctx, const grub_uint8_t *src,
+		  grub_size_t size, const grub_uint8_t *lit, grub_size_t nlit,
+		  grub_uint8_t *dst, grub_size_t *pos, grub_size_t limit)
+{
+  const grub_uint8_t *lit_end = lit + nlit;
+  grub_size_t start = *pos;
+  grub_size_t nseq, hs, used;
+  grub_uint32_t ll_state, of_state, ml_state;
+  struct bitrd rd;
+  unsigned modes;
+
+  if (size < 1)
+    return corrupted ();
+
+  if (src[0] < 128)
+    {
+      nseq = src[0];
+      hs = 1;
+    }
+  else if (src[0] < 255)
+    {
+      if (size < 2)
+	return corrupted ();
+      nseq = ((src[0] - 128) << 8) + src[1];
+      hs = 2;
+    }
+  else
+    {
+      if (size < 3)
+	return corrupted ();
+      nseq = src[1] + (src[2] << 8) + 0x7f00;
+      hs = 3;
+    }
+
+  if (nseq == 0)
+    {
+      out_literals (dst, pos, limit, lit, nlit);
+      return GRUB_ERR_NONE;
+    }
+
+  if (size < hs + 1)
+    return corrupted ();
+  modes = src[hs];
+  if (modes & 3)
+    return corrupted ();
+  src += hs + 1;
+  size -= hs + 1;
+
+  if (read_seq_table (&dctx->ll, modes >> 6, src, size, &used,
+		      ll_default, ARRAY_SIZE (ll_default) - 1, 6,
+		      LL_MAX_SYMBOL, LL_MAX_LOG))
+    return grub_errno;
+  src += used;
+  size -= used;
+  if (read_seq_table (&dctx->of, (modes >> 4) & 3, src, size, &used,
+		      of_default, ARRAY_SIZE (of_default) - 1, 5,
+		      OF_MAX_SYMBOL, OF_MAX_LOG))
+    return grub_errno;
+  src += used;
+  size -= used;
+  if (read_seq_table (&dctx->ml, (modes >> 2) & 3, src, size, &used,
+		      ml_default, ARRAY_SIZE (ml_default) - 1, 6,
+		      ML_MAX_SYMBOL, ML_MAX_LOG))
+    return grub_errno;
+  src += used;
+  size -= used;
+
+  if (bitrd_init (&rd, src, size))
+    return grub_errno;
+
+  ll_state = bitrd_read (&rd, dctx->ll.log);
+  of_state = bitrd_read (&rd, dctx->of.log);
+  ml_state = bitrd_read (&rd, dctx->ml.log);
+
+  while (nseq--)
+    {
+      unsigned ll_code = dctx->ll.e[ll_state].symbol;
+      unsigned of_code = dctx->of.e[of_state].symbol;
+      unsigned ml_code = dctx->ml.e[ml_state].symbol;
+      grub_uint32_t offset, ll, ml;
+
+      if (of_code > OF_MAX_SYMBOL || ll_code > LL_MAX_SYMBOL
+	  || ml_code > ML_MAX_SYMBOL)
+	return corrupted ();
+
+      offset = (1U << of_code) + bitrd_read (&rd, of_code);
+      ml = ml_base[ml_code] + bitrd_read (&rd, ml_bits[ml_code]);
+      ll = ll_base[ll_code] + bitrd_read (&rd, ll_bits[ll_code]);
+
+      if (offset > 3)
+	{
+	  offset -= 3;
+	  dctx->rep[2] = dctx->rep[1];
+	  dctx->rep[1] = dctx->rep[0];
+	  dctx->rep[0] = offset;
+	}
+      else
+	{
+	  /* Repeat offsets, shifted by one without literals.  */
+	  unsigned idx = offset - 1 + (ll == 0);
+
+	  if (idx == 0)
+	    offset = dctx->rep[0];
+	  else
+	    {
+	      offset = idx == 3 ? dctx->rep[0] - 1 : dctx->rep[idx];
+	      if (idx != 1)
+		dctx->rep[2] = dctx->rep[1];
+	      dctx->rep[1] = dctx->rep[0];
+	      dctx->rep[0] = offset;
+	    }
+	}
+
+      if (nseq)
+	{
+	  ll_state = dctx->ll.e[ll_state].base
+	    + bitrd_read (&rd, dctx->ll.e[ll_state].nbits);
+	  ml_state = dctx->ml.e[ml_state].base
+	    + bitrd_read (&rd, dctx->ml.e[ml_state].nbits);
+	  of_state = dctx->of.e[of_state].base
+	    + bitrd_read (&rd, dctx->of.e[of_state].nbits);
+	}
+
+      if (rd.pos < 0 || ll > (grub_size_t) (lit_end - lit))
+	return corrupted ();
+      out_literals (dst, pos, limit, lit, ll);
+      lit += ll;
+
+      if (offset == 0 || offset > *pos
+	  || *pos - start + ml > GRUB_ZSTD_BLOCK_MAX)
+	return corrupted ();
+      out_match (dst, pos, limit, offset, ml);
+    }
+
+  if (rd.pos != 0)
+    return corrupted ();
+
+  out_literals (dst, pos, limit, lit, lit_end - lit);
+  if (*pos - start > GRUB_ZSTD_BLOCK_MAX)
+    return corrupted ();
+  return GRUB_ERR_NONE;
+}
+
+grub_err_t
+grub_zstd_decode_block (grub_zstd_dctx_t dctx, const void *src_,
+			grub_size_t size, grub_size_t *consumed, int *last,
+			grub_uint8_t *dst, grub_size_t *pos, grub_size_t limit)
+{
+  const grub_uint8_t *src = src_;
+  grub_uint32_t h;
+  grub_size_t bsize;
+
+  if (size < 3)
+    return corrupted ();
+
+  h = src[0] | (src[1] << 8) | (src[2] << 16);
+  *last = h & 1;
+  bsize = h >> 3;
+  if (bsize > GRUB_ZSTD_BLOCK_MAX)
+    return corrupted ();
+  src += 3;
+  size -= 3;
+
+  switch ((h >> 1) & 3)
+    {
+    case 0:
+      if (size < bsize)
+	return corrupted ();
+      out_literals (dst, pos, limit, src, bsize);
+      *consumed = 3 + bsize;
+      return GRUB_ERR_NONE;
+
+    case 1:
+      if (size < 1)
+	return corrupted ();
+      if (*pos < limit)
+	grub_memset (dst + *pos, src[0],
+		     bsize < limit - *pos ? bsize : limit - *pos);
+      *pos += bsize;
+      *consumed = 4;
+      return GRUB_ERR_NONE;
+
+    case 2:
+      {
+	const grub_uint8_t *lit = NULL;
+	grub_size_t nlit = 0, used = 0;
+
+	if (size < bsize)
+	  return corrupted ();
+	if (decode_literals (dctx, src, bsize, &used, &lit, &nlit)
+	    || decode_sequences (dctx, src + used, bsize - used, lit, nlit,
+				 dst, pos, limit))
+	  return grub_errno;
+	*consumed = 3 + bsize;
+	return GRUB_ERR_NONE;
+      }
+
+    default:
+      return corrupted ();
+    }
+}
+
+grub_err_t
+grub_zstd_read_frame_header (const void *src_, grub_size_t size,
+			     struct grub_zstd_frame *frame)
+{
+  static const grub_uint8_t dict_sizes[4] = { 0, 1, 2, 4 };
+  static const grub_uint8_t fcs_sizes[4] = { 0, 2, 4, 8 };
+  const grub_uint8_t *src = src_;
+  unsigned fhd, single, fcs, hs, i;
+
+  if (size < 5
+      || grub_le_to_cpu32 (grub_get_unaligned32 (src)) != GRUB_ZSTD_MAGIC)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "not a zstd frame");
+
+  fhd = src[4];
+  if (fhd & 0x08)
+    return corrupted ();
+  single = (fhd >> 5) & 1;
+  frame->checksum = (fhd >> 2) & 1;
+
+  hs = 5;
+  frame->window_size = 0;
+  if (! single)
+    {
+      unsigned exponent, mantissa;
+
+      if (size < 6)
+	return corrupted ();
+      exponent = src[5] >> 3;
+      mantissa = src[5] & 7;
+      frame->window_size = 1ULL << (10 + exponent);
+      frame->window_size += (frame->window_size / 8) * mantissa;
+      hs++;
+    }
+
+  if (size < hs + dict_sizes[fhd & 3])
+    return corrupted ();
+  for (i = 0; i < dict_sizes[fhd & 3]; i++)
+    if (src[hs + i])
+      return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			 "zstd dictionaries aren't supported");
+  hs += dict_sizes[fhd & 3];
+
+  fcs = fcs_sizes[fhd >> 6];
+  if (fcs == 0 && single)
+    fcs = 1;
+  if (size < hs + fcs)
+    return corrupted ();
+  if (fcs == 0)
+    frame->content_size = GRUB_ZSTD_SIZE_UNKNOWN;
+  else
+    {
+      frame->content_size = 0;
+      for (i = 0; i < fcs; i++)
+	frame->content_size |= (grub_uint64_t) src[hs + i] << (8 * i);
+      if (fcs == 2)
+	frame->content_size += 256;
+    }
+  hs += fcs;
+
+  if (single)
+    frame->window_size = frame->content_size;
+
+  frame->header_size = hs;
+  return GRUB_ERR_NONE;
+}
+
+grub_zstd_dctx_t
+grub_zstd_dctx_new (void)
+{
+  grub_zstd_dctx_t dctx;
+
+  dctx = grub_malloc (sizeof (*dctx));
+  if (dctx)
+    grub_zstd_dctx_reset (dctx);
+  return dctx;
+}
+
+void
+grub_zstd_dctx_free (grub_zstd_dctx_t dctx)
+{
+  grub_free (dctx);
+}
+
+void
+grub_zstd_dctx_reset (grub_zstd_dctx_t dctx)
+{
+  dctx->ll.valid = 0;
+  dctx->of.valid = 0;
+  dctx->ml.valid = 0;
+  dctx->huf.valid = 0;
+  dctx->rep[0] = 1;
+  dctx->rep[1] = 4;
+  dctx->rep[2] = 8;
+}
+
+grub_ssize_t
+grub_zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		      char *outbuf, grub_size_t outsize)
+{
+  const grub_uint8_t *src = (const grub_uint8_t *) inbuf;
+  grub_zstd_dctx_t dctx;
+  grub_uint8_t *out;
+  grub_size_t pos = 0, limit = off + outsize;
+  grub_ssize_t ret = -1;
+
+  /* Everything before OFF is still needed as history.  */
+  if (off)
+    {
+      out = grub_malloc (limit);
+      if (! out)
+	return -1;
+    }
+  else
+    out = (grub_uint8_t *) outbuf;
+
+  dctx = grub_zstd_dctx_new ();
+  if (! dctx)
+    goto fail;
+
+  /* Anything that isn't a frame ends the data, like the zeros padding
+     btrfs extents.  */
+  while (pos < limit && insize >= 4)
+    {
+      grub_uint32_t magic = grub_le_to_cpu32 (grub_get_unaligned32 (src));
+      struct grub_zstd_frame frame;
+      int last = 0;
+
+      if ((magic & GRUB_ZSTD_SKIPPABLE_MASK) == GRUB_ZSTD_SKIPPABLE_MAGIC)
+	{
+	  grub_uint32_t skip;
+
+	  if (insize < 8)
+	    break;
+	  skip = grub_le_to_cpu32 (grub_get_unaligned32 (src + 4));
+	  if (skip > insize - 8)
+	    break;
+	  src += 8 + skip;
+	  insize -= 8 + skip;
+	  continue;
+	}
+      if (magic != GRUB_ZSTD_MAGIC)
+	break;
+
+      if (grub_zstd_read_frame_header (src, insize, &frame))
+	goto fail;
+      src += frame.header_size;
+      insize -= frame.header_size;
+
+      grub_zstd_dctx_reset (dctx);
+      while (! last && pos < limit)
+	{
+	  grub_size_t used;
+
+	  if (grub_zstd_decode_block (dctx, src, insize, &used, &last,
+				      out, &pos, limit))
+	    goto fail;
+	  src += used;
+	  insize -= used;
+	}
+      if (! last)
+	break;
+
+      if (frame.checksum)
+	{
+	  if (insize < 4)
+	    break;
+	  src += 4;
+	  insize -= 4;
+	}
+    }
+
+  if (pos > limit)
+    pos = limit;
+  if (pos <= off)
+    ret = 0;
+  else
+    {
+      ret = pos - off;
+      if (off)
+	grub_memcpy (outbuf, out + off, ret);
+    }
+
+ fail:
+  grub_zstd_dctx_free (dctx);
+  if (off)
+    grub_free (out);
+  return ret;
+}
@@ -38,6 +38,11 @@ static int loaded;
 
 static void *kernel_addr;
 static grub_uint64_t kernel_size;
+/* Offset of the EFI stub's entry point in the image.  */
+static grub_uint32_t kernel_entry;
+/* The pages holding the kernel, which starts somewhere in them.  */
+static void *kernel_alloc_addr;
+static grub_efi_uintn_t kernel_alloc_pages;
 
 static char *linux_args;
 static grub_uint32_t cmdline_size;
@@ -121,6 +126,8 @@ grub_arm64_uefi_check_image (struct grub_arm64_linux_kernel_header * lh)
   grub_dprintf ("linux", "UEFI stub kernel:\n");
   grub_dprintf ("linux", "text_offset = 0x%012llx\n",
 		(long long unsigned) lh->text_offset);
+  grub_dprintf ("linux", "image_size = 0x%012llx\n",
+		(long long unsigned) lh->image_size);
   grub_dprintf ("linux", "PE/COFF header @ %08x\n", lh->hdr_offset);
 
   return GRUB_ERR_NONE;
@@ -236,63 +243,56 @@ out:
   return grub_errno;
 }
 
+typedef grub_efi_status_t
+(GRUB_EFI_ABI *grub_arm64_stub_entry_t) (grub_efi_handle_t,
+					 grub_efi_system_table_t *);
+
+/* Run the EFI stub of the kernel at ADDR in place.  Going through
+   LoadImage would copy the kernel to wherever the firmware likes, and
+   the stub would then move it again to its aligned address.  Like the
+   x86 EFI handover, the stub runs as GRUB's own image, with the command
+   line as its load options.  */
 grub_err_t
-grub_arm64_uefi_boot_image (grub_addr_t addr, grub_size_t size, char *args)
+grub_arm64_uefi_boot_image (grub_addr_t addr, grub_size_t size,
+			    grub_uint32_t entry, char *args)
 {
-  grub_efi_memory_mapped_device_path_t *mempath;
-  grub_efi_handle_t image_handle;
-  grub_efi_boot_services_t *b;
-  grub_efi_status_t status;
   grub_efi_loaded_image_t *loaded_image;
+  grub_arm64_stub_entry_t stub;
+  grub_efi_loaded_image_t saved;
+  grub_efi_status_t status;
+  void *options;
   int len;
 
-  mempath = grub_malloc (2 * sizeof (grub_efi_memory_mapped_device_path_t));
-  if (!mempath)
-    return grub_errno;
-
-  mempath[0].header.type = GRUB_EFI_HARDWARE_DEVICE_PATH_TYPE;
-  mempath[0].header.subtype = GRUB_EFI_MEMORY_MAPPED_DEVICE_PATH_SUBTYPE;
-  mempath[0].header.length = grub_cpu_to_le16_compile_time (sizeof (*mempath));
-  mempath[0].memory_type = GRUB_EFI_LOADER_DATA;
-  mempath[0].start_address = addr;
-  mempath[0].end_address = addr + size;
-
-  mempath[1].header.type = GRUB_EFI_END_DEVICE_PATH_TYPE;
-  mempath[1].header.subtype = GRUB_EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE;
-  mempath[1].header.length = sizeof (grub_efi_device_path_t);
-
-  b = grub_efi_system_table->boot_services;
-  status = b->load_image (0, grub_efi_image_handle,
-			  (grub_efi_device_path_t *) mempath,
-			  (void *) addr, size, &image_handle);
-  if (status != GRUB_EFI_SUCCESS)
-    return grub_error (GRUB_ERR_BAD_OS, "cannot load image");
+  loaded_image = grub_efi_get_loaded_image (grub_efi_image_handle);
+  if (!loaded_image)
+    return grub_error (GRUB_ERR_BAD_OS, "no loaded image available");
 
   grub_dprintf ("linux", "linux command line: '%s'\n", args);
 
   /* Convert command line to UCS-2 */
-  loaded_image = grub_efi_get_loaded_image (image_handle);
-  loaded_image->load_options_size = len =
-    (grub_strlen (args) + 1) * sizeof (grub_efi_char16_t);
-  loaded_image->load_options =
-    grub_efi_allocate_pages (0,
-			     BYTES_TO_PAGES (loaded_image->load_options_size));
-  if (!loaded_image->load_options)
-    return grub_errno;
+  len = (grub_strlen (args) + 1) * sizeof (grub_efi_char16_t);
+  options = grub_efi_allocate_pages (0, BYTES_TO_PAGES (len));
+  if (!options)
+    return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
 
+  saved = *loaded_image;
+  loaded_image->load_options = options;
   loaded_image->load_options_size =
-    2 * grub_utf8_to_utf16 (loaded_image->load_options, len,
-			    (grub_uint8_t *) args, len, NULL);
+    2 * grub_utf8_to_utf16 (options, len, (grub_uint8_t *) args, len, NULL);
+  loaded_image->image_base = (void *) addr;
+  loaded_image->image_size = size;
 
-  grub_dprintf ("linux", "starting image %p\n", image_handle);
-  status = b->start_image (image_handle, 0, NULL);
+  stub = (grub_arm64_stub_entry_t) (addr + entry);
+  grub_dprintf ("linux", "starting stub at %p\n", stub);
+  status = stub (grub_efi_image_handle, grub_efi_system_table);
 
   /* When successful, not reached */
-  b->unload_image (image_handle);
-  grub_efi_free_pages ((grub_efi_physical_address_t) loaded_image->load_options,
-		       BYTES_TO_PAGES (loaded_image->load_options_size));
+  *loaded_image = saved;
+  grub_efi_free_pages ((grub_efi_physical_address_t) options,
+		       BYTES_TO_PAGES (len));
 
-  return grub_errno;
+  return grub_error (GRUB_ERR_BAD_OS, "EFI stub failed with status 0x%lx",
+		     (unsigned long) status);
 }
 
 static grub_err_t
@@ -302,7 +302,7 @@ grub_linux_boot (void)
     return grub_errno;
 
   return (grub_arm64_uefi_boot_image((grub_addr_t)kernel_addr,
-                                     kernel_size, linux_args));
+                                     kernel_size, kernel_entry, linux_args));
 }
 
 static grub_err_t
@@ -315,9 +315,10 @@ grub_linux_unload (void)
 			 BYTES_TO_PAGES (initrd_end - initrd_start));
   initrd_start = initrd_end = 0;
   grub_free (linux_args);
-  if (kernel_addr)
-    grub_efi_free_pages ((grub_efi_physical_address_t) kernel_addr,
-			 BYTES_TO_PAGES (kernel_size));
+  if (kernel_alloc_addr)
+    grub_efi_free_pages ((grub_efi_physical_address_t) kernel_alloc_addr,
+			 kernel_alloc_pages);
+  kernel_alloc_addr = kernel_addr = 0;
   if (fdt)
     grub_efi_free_pages ((grub_efi_physical_address_t) fdt,
 			 BYTES_TO_PAGES (grub_fdt_get_totalsize (fdt)));
@@ -383,6 +384,14 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
 {
   grub_file_t file = 0;
   struct grub_arm64_linux_kernel_header lh;
+  struct
+  {
+    char signature[GRUB_PE32_SIGNATURE_SIZE];
+    struct grub_pe32_coff_header coff_header;
+    struct grub_pe64_optional_header optional_header;
+  } GRUB_PACKED pe;
+  grub_uint64_t text_offset, mem_size, k;
+  grub_addr_t base;
 
   grub_dl_ref (my_mod);
 
@@ -395,6 +404,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   file = grub_file_open (argv[0]);
   if (!file)
     goto fail;
+  file->streaming = 1;
 
   kernel_size = grub_file_size (file);
 
@@ -404,18 +414,48 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   if (grub_arm64_uefi_check_image (&lh) != GRUB_ERR_NONE)
     goto fail;
 
+  /* The PE header gives the stub's entry point and the size the image
+     takes once loaded, BSS included.  */
+  if (grub_file_seek (file, lh.hdr_offset) == (grub_off_t) -1
+      || grub_file_read (file, &pe, sizeof (pe)) < (long) sizeof (pe))
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), argv[0]);
+      goto fail;
+    }
+  if (grub_memcmp (pe.signature, "PE\0\0", GRUB_PE32_SIGNATURE_SIZE) != 0
+      || pe.optional_header.magic != GRUB_PE32_PE64_MAGIC)
+    {
+      grub_error (GRUB_ERR_BAD_OS, "invalid PE/COFF header");
+      goto fail;
+    }
+
   grub_loader_unset();
 
+  text_offset = lh.image_size ? lh.text_offset : GRUB_ARM64_LINUX_TEXT_OFFSET;
+  mem_size = kernel_size;
+  if (mem_size < lh.image_size)
+    mem_size = lh.image_size;
+  if (mem_size < pe.optional_header.image_size)
+    mem_size = pe.optional_header.image_size;
+
+  /* Read the Image straight to where the stub wants it, TEXT_OFFSET above
+     a GRUB_ARM64_LINUX_ALIGN boundary, so that it needn't move it.  */
   grub_dprintf ("linux", "kernel file size: %lld\n", (long long) kernel_size);
-  kernel_addr = grub_efi_allocate_pages (0, BYTES_TO_PAGES (kernel_size));
+  kernel_alloc_pages = BYTES_TO_PAGES (mem_size + GRUB_ARM64_LINUX_ALIGN);
+  kernel_alloc_addr = grub_efi_allocate_pages (0, kernel_alloc_pages);
   grub_dprintf ("linux", "kernel numpages: %lld\n",
-		(long long) BYTES_TO_PAGES (kernel_size));
-  if (!kernel_addr)
+		(long long) kernel_alloc_pages);
+  if (!kernel_alloc_addr)
     {
       grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
       goto fail;
     }
 
+  k = GRUB_ARM64_LINUX_ALIGN - (text_offset & (GRUB_ARM64_LINUX_ALIGN - 1));
+  base = (grub_addr_t) kernel_alloc_addr;
+  kernel_addr = (void *) (ALIGN_UP (base + k, GRUB_ARM64_LINUX_ALIGN) - k);
+
   grub_file_seek (file, 0);
   if (grub_file_read (file, kernel_addr, kernel_size)
       < (grub_int64_t) kernel_size)
@@ -424,8 +464,13 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
 	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"), argv[0]);
       goto fail;
     }
+  grub_memset ((char *) kernel_addr + kernel_size, 0, mem_size - kernel_size);
 
-  grub_dprintf ("linux", "kernel @ %p\n", kernel_addr);
+  kernel_entry = pe.optional_header.entry_addr;
+  kernel_size = mem_size;
+
+  grub_dprintf ("linux", "kernel @ %p, entry at 0x%x\n", kernel_addr,
+		kernel_entry);
 
   cmdline_size = grub_loader_cmdline_size (argc, argv) + sizeof (LINUX_IMAGE);
   linux_args = grub_malloc (cmdline_size);
@@ -458,9 +503,12 @@ fail:
   if (linux_args && !loaded)
     grub_free (linux_args);
 
-  if (kernel_addr && !loaded)
-    grub_efi_free_pages ((grub_efi_physical_address_t) kernel_addr,
-			 BYTES_TO_PAGES (kernel_size));
+  if (kernel_alloc_addr && !loaded)
+    {
+      grub_efi_free_pages ((grub_efi_physical_address_t) kernel_alloc_addr,
+			   kernel_alloc_pages);
+      kernel_alloc_addr = kernel_addr = 0;
+    }
 
   return grub_errno;
 }
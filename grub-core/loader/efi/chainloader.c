@@ -35,6 +35,7 @@
 #include <grub/command.h>
 #include <grub/i18n.h>
 #include <grub/net.h>
+#include <grub/tpm.h>
 #if defined (__i386__) || defined (__x86_64__)
 #include <grub/macho.h>
 #include <grub/i386/macho.h>
@@ -50,6 +51,34 @@ static grub_efi_device_path_t *file_path;
 static grub_efi_handle_t image_handle;
 static grub_efi_char16_t *cmdline;
 
+/* With chainloader --loadfile2 GRUB doesn't read the image itself.
+   LoadImage gets a vendor media device path that has the LoadFile2
+   protocol installed on it.  The firmware then reads the file through it,
+   straight into its own buffer.  */
+#define GRUB_EFI_CHAINLOADER_MEDIA_GUID \
+  { 0x3b8c8162, 0x1a4e, 0x4f6b, \
+    { 0x9c, 0x1d, 0x52, 0x8e, 0x07, 0x6a, 0xd3, 0x41 } \
+  }
+
+static grub_file_t chain_lf2_file;
+static grub_efi_handle_t chain_lf2_handle;
+
+static struct
+{
+  grub_efi_vendor_device_path_t vendor;
+  grub_efi_device_path_t end;
+} GRUB_PACKED chain_lf2_device_path =
+  {
+    {
+      { GRUB_EFI_MEDIA_DEVICE_PATH_TYPE,
+	GRUB_EFI_VENDOR_MEDIA_DEVICE_PATH_SUBTYPE,
+	sizeof (grub_efi_vendor_device_path_t) },
+      GRUB_EFI_CHAINLOADER_MEDIA_GUID
+    },
+    { GRUB_EFI_END_DEVICE_PATH_TYPE, GRUB_EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE,
+      sizeof (grub_efi_device_path_t) }
+  };
+
 static grub_err_t
 grub_chainloader_unload (void)
 {
@@ -57,7 +86,8 @@ grub_chainloader_unload (void)
 
   b = grub_efi_system_table->boot_services;
   efi_call_1 (b->unload_image, image_handle);
-  efi_call_2 (b->free_pages, address, pages);
+  if (address)
+    efi_call_2 (b->free_pages, address, pages);
 
   grub_free (file_path);
   grub_free (cmdline);
@@ -106,6 +136,105 @@ grub_chainloader_boot (void)
   return grub_errno;
 }
 
+/* Read all of FILE into BUF, measuring it on the way.  */
+static grub_err_t
+grub_chainloader_read (grub_file_t file, const char *filename,
+		       void *buf, grub_ssize_t size)
+{
+  struct grub_tpm_measure_ctx measure;
+
+  grub_file_seek (file, 0);
+  grub_tpm_measure_begin (&measure, GRUB_KERNEL_PCR, "UEFI chainloaded image");
+  file->measure = &measure;
+  if (grub_file_read (file, buf, size) != size)
+    {
+      file->measure = 0;
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
+		    filename);
+      return grub_errno;
+    }
+  file->measure = 0;
+  grub_tpm_measure_finish (&measure);
+  return GRUB_ERR_NONE;
+}
+
+static grub_efi_status_t GRUB_EFI_ABI
+grub_chainloader_load_file (grub_efi_load_file2_t *this,
+			    grub_efi_device_path_t *dp,
+			    grub_efi_boolean_t boot_policy,
+			    grub_efi_uintn_t *buffer_size, void *buffer);
+
+static grub_efi_load_file2_t chain_lf2 =
+  {
+    grub_chainloader_load_file
+  };
+
+static grub_efi_status_t GRUB_EFI_ABI
+grub_chainloader_load_file (grub_efi_load_file2_t *this,
+			    grub_efi_device_path_t *dp,
+			    grub_efi_boolean_t boot_policy,
+			    grub_efi_uintn_t *buffer_size, void *buffer)
+{
+  grub_size_t size;
+
+  if (this != &chain_lf2 || !dp || !buffer_size)
+    return GRUB_EFI_INVALID_PARAMETER;
+  if (boot_policy)
+    return GRUB_EFI_UNSUPPORTED;
+  if (!chain_lf2_file)
+    return GRUB_EFI_NOT_FOUND;
+
+  size = grub_file_size (chain_lf2_file);
+  if (!buffer || *buffer_size < size)
+    {
+      *buffer_size = size;
+      return GRUB_EFI_BUFFER_TOO_SMALL;
+    }
+
+  if (grub_chainloader_read (chain_lf2_file, chain_lf2_file->name,
+			     buffer, size))
+    {
+      grub_print_error ();
+      return GRUB_EFI_LOAD_ERROR;
+    }
+  *buffer_size = size;
+  return GRUB_EFI_SUCCESS;
+}
+
+/* Have the firmware load FILE through chain_lf2.  */
+static grub_efi_status_t
+grub_chainloader_load_image_lf2 (grub_file_t file)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_guid_t dp_guid = GRUB_EFI_DEVICE_PATH_GUID;
+  grub_efi_guid_t lf2_guid = GRUB_EFI_LOAD_FILE2_PROTOCOL_GUID;
+  grub_efi_status_t status;
+
+  chain_lf2_handle = 0;
+  status = efi_call_4 (b->install_protocol_interface, &chain_lf2_handle,
+		       &dp_guid, GRUB_EFI_NATIVE_INTERFACE,
+		       &chain_lf2_device_path);
+  if (status != GRUB_EFI_SUCCESS)
+    return status;
+  status = efi_call_4 (b->install_protocol_interface, &chain_lf2_handle,
+		       &lf2_guid, GRUB_EFI_NATIVE_INTERFACE, &chain_lf2);
+  if (status == GRUB_EFI_SUCCESS)
+    {
+      chain_lf2_file = file;
+      status = efi_call_6 (b->load_image, 0, grub_efi_image_handle,
+			   (grub_efi_device_path_t *) &chain_lf2_device_path,
+			   0, 0, &image_handle);
+      chain_lf2_file = 0;
+      efi_call_3 (b->uninstall_protocol_interface, chain_lf2_handle,
+		  &lf2_guid, &chain_lf2);
+    }
+  efi_call_3 (b->uninstall_protocol_interface, chain_lf2_handle,
+	      &dp_guid, &chain_lf2_device_path);
+  chain_lf2_handle = 0;
+  return status;
+}
+
 static void
 copy_file_path (grub_efi_file_path_device_path_t *fp,
 		const char *str, grub_efi_uint16_t len)
@@ -201,6 +330,14 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
   char *filename;
   void *boot_image = 0;
   grub_efi_handle_t dev_handle = 0;
+  int loadfile2 = 0;
+
+  if (argc != 0 && grub_strcmp (argv[0], "--loadfile2") == 0)
+    {
+      argc--;
+      argv++;
+      loadfile2 = 1;
+    }
 
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
@@ -218,6 +355,7 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
   file = grub_file_open (filename);
   if (! file)
     goto fail;
+  file->streaming = 1;
 
   /* Get the root device's device path.  */
   dev = grub_device_open (0);
@@ -267,6 +405,32 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
 		  filename);
       goto fail;
     }
+
+#if defined (__i386__) || defined (__x86_64__)
+  /* Only a slice of a fat Mach-O binary is passed on, which LoadFile2
+     can't express.  */
+  if (loadfile2 && size >= (grub_ssize_t) sizeof (grub_uint32_t))
+    {
+      grub_uint32_t magic;
+
+      if (grub_file_read (file, &magic, sizeof (magic)) != sizeof (magic))
+	{
+	  if (grub_errno == GRUB_ERR_NONE)
+	    grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
+			filename);
+	  goto fail;
+	}
+      if (magic == grub_cpu_to_le32_compile_time (GRUB_MACHO_FAT_EFI_MAGIC))
+	loadfile2 = 0;
+    }
+#endif
+
+  if (loadfile2)
+    {
+      status = grub_chainloader_load_image_lf2 (file);
+      goto loaded;
+    }
+
   pages = (((grub_efi_uintn_t) size + ((1 << 12) - 1)) >> 12);
 
   status = efi_call_4 (b->allocate_pages, GRUB_EFI_ALLOCATE_ANY_PAGES,
@@ -281,14 +445,8 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
     }
 
   boot_image = (void *) ((grub_addr_t) address);
-  if (grub_file_read (file, boot_image, size) != size)
-    {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_OS, N_("premature end of file %s"),
-		    filename);
-
-      goto fail;
-    }
+  if (grub_chainloader_read (file, filename, boot_image, size))
+    goto fail;
 
 #if defined (__i386__) || defined (__x86_64__)
   if (size >= (grub_ssize_t) sizeof (struct grub_macho_fat_header))
@@ -329,6 +487,7 @@ grub_cmd_chainloader (grub_command_t cmd __attribute__ ((unused)),
   status = efi_call_6 (b->load_image, 0, grub_efi_image_handle, file_path,
 		       boot_image, size,
 		       &image_handle);
+ loaded:
   if (status != GRUB_EFI_SUCCESS)
     {
       if (status == GRUB_EFI_OUT_OF_RESOURCES)
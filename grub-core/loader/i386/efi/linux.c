@@ -23,10 +23,12 @@
 #include <grub/mm.h>
 #include <grub/cpu/linux.h>
 #include <grub/command.h>
+#include <grub/extcmd.h>
 #include <grub/i18n.h>
 #include <grub/lib/cmdline.h>
 #include <grub/efi/efi.h>
 #include <grub/tpm.h>
+#include <grub/linux.h>
 
 #include "../verity-hash.h"
 
@@ -41,6 +43,28 @@ static grub_uint32_t handover_offset;
 struct linux_kernel_params *params;
 static char *linux_cmdline;
 
+/* With initrdefi --loadfile2 the initrd is left on disk and read straight
+   into the kernel's buffer when its EFI stub asks for it.  */
+static struct grub_linux_initrd_context initrd_lf2_ctx;
+static char **initrd_names;
+static grub_efi_handle_t initrd_lf2_handle;
+
+static struct
+{
+  grub_efi_vendor_device_path_t vendor;
+  grub_efi_device_path_t end;
+} GRUB_PACKED initrd_lf2_device_path =
+  {
+    {
+      { GRUB_EFI_MEDIA_DEVICE_PATH_TYPE,
+	GRUB_EFI_VENDOR_MEDIA_DEVICE_PATH_SUBTYPE,
+	sizeof (grub_efi_vendor_device_path_t) },
+      GRUB_EFI_LINUX_INITRD_MEDIA_GUID
+    },
+    { GRUB_EFI_END_DEVICE_PATH_TYPE, GRUB_EFI_END_ENTIRE_DEVICE_PATH_SUBTYPE,
+      sizeof (grub_efi_device_path_t) }
+  };
+
 #define BYTES_TO_PAGES(bytes)   (((bytes) + 0xfff) >> 12)
 
 #define SHIM_LOCK_GUID \
@@ -73,6 +97,122 @@ grub_linuxefi_secure_validate (void *data, grub_uint32_t size)
   return 0;
 }
 
+static grub_efi_status_t GRUB_EFI_ABI
+grub_linuxefi_initrd_load_file (grub_efi_load_file2_t *this,
+				grub_efi_device_path_t *file_path,
+				grub_efi_boolean_t boot_policy,
+				grub_efi_uintn_t *buffer_size, void *buffer);
+
+static grub_efi_load_file2_t initrd_lf2 =
+  {
+    grub_linuxefi_initrd_load_file
+  };
+
+static grub_efi_status_t GRUB_EFI_ABI
+grub_linuxefi_initrd_load_file (grub_efi_load_file2_t *this,
+				grub_efi_device_path_t *file_path,
+				grub_efi_boolean_t boot_policy,
+				grub_efi_uintn_t *buffer_size, void *buffer)
+{
+  grub_size_t size;
+
+  if (this != &initrd_lf2 || !file_path || !buffer_size)
+    return GRUB_EFI_INVALID_PARAMETER;
+  if (boot_policy)
+    return GRUB_EFI_UNSUPPORTED;
+  if (!initrd_lf2_ctx.nfiles)
+    return GRUB_EFI_NOT_FOUND;
+
+  size = grub_get_initrd_size (&initrd_lf2_ctx);
+  if (!buffer || *buffer_size < size)
+    {
+      *buffer_size = size;
+      return GRUB_EFI_BUFFER_TOO_SMALL;
+    }
+
+  if (grub_initrd_load (&initrd_lf2_ctx, initrd_names, buffer))
+    {
+      grub_print_error ();
+      return GRUB_EFI_LOAD_ERROR;
+    }
+  *buffer_size = size;
+  return GRUB_EFI_SUCCESS;
+}
+
+static void
+grub_linuxefi_initrd_release (void)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_guid_t dp_guid = GRUB_EFI_DEVICE_PATH_GUID;
+  grub_efi_guid_t lf2_guid = GRUB_EFI_LOAD_FILE2_PROTOCOL_GUID;
+  int i;
+
+  if (initrd_lf2_handle)
+    {
+      efi_call_3 (b->uninstall_protocol_interface, initrd_lf2_handle,
+		  &lf2_guid, &initrd_lf2);
+      efi_call_3 (b->uninstall_protocol_interface, initrd_lf2_handle,
+		  &dp_guid, &initrd_lf2_device_path);
+      initrd_lf2_handle = 0;
+    }
+  grub_initrd_close (&initrd_lf2_ctx);
+  for (i = 0; initrd_names && initrd_names[i]; i++)
+    grub_free (initrd_names[i]);
+  grub_free (initrd_names);
+  initrd_names = 0;
+}
+
+/* Keep the files of the initrd open and offer them to the kernel under
+   the Linux initrd media device path.  */
+static grub_err_t
+grub_linuxefi_initrd_offer (int argc, char *argv[])
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  grub_efi_guid_t dp_guid = GRUB_EFI_DEVICE_PATH_GUID;
+  grub_efi_guid_t lf2_guid = GRUB_EFI_LOAD_FILE2_PROTOCOL_GUID;
+  grub_efi_status_t status;
+  int i;
+
+  initrd_names = grub_zalloc ((argc + 1) * sizeof (initrd_names[0]));
+  if (!initrd_names)
+    return grub_errno;
+  for (i = 0; i < argc; i++)
+    {
+      initrd_names[i] = grub_strdup (argv[i]);
+      if (!initrd_names[i])
+	goto fail;
+    }
+
+  if (grub_initrd_init (argc, argv, &initrd_lf2_ctx))
+    goto fail;
+  initrd_lf2_ctx.measure_description = "UEFI Linux initrd";
+
+  status = efi_call_4 (b->install_protocol_interface, &initrd_lf2_handle,
+		       &dp_guid, GRUB_EFI_NATIVE_INTERFACE,
+		       &initrd_lf2_device_path);
+  if (status == GRUB_EFI_SUCCESS)
+    {
+      status = efi_call_4 (b->install_protocol_interface, &initrd_lf2_handle,
+			   &lf2_guid, GRUB_EFI_NATIVE_INTERFACE, &initrd_lf2);
+      if (status != GRUB_EFI_SUCCESS)
+	efi_call_3 (b->uninstall_protocol_interface, initrd_lf2_handle,
+		    &dp_guid, &initrd_lf2_device_path);
+    }
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      initrd_lf2_handle = 0;
+      grub_error (GRUB_ERR_IO,
+		  "couldn't install the initrd LoadFile2 protocol");
+      goto fail;
+    }
+
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_linuxefi_initrd_release ();
+  return grub_errno;
+}
+
 typedef void(*handover_func)(void *, grub_efi_system_table_t *, struct linux_kernel_params *);
 
 static grub_err_t
@@ -100,6 +240,7 @@ grub_linuxefi_unload (void)
 {
   grub_dl_unref (my_mod);
   loaded = 0;
+  grub_linuxefi_initrd_release ();
   if (initrd_mem)
     grub_efi_free_pages((grub_efi_physical_address_t)initrd_mem, BYTES_TO_PAGES(params->ramdisk_size));
   if (linux_cmdline)
@@ -111,14 +252,19 @@ grub_linuxefi_unload (void)
   return GRUB_ERR_NONE;
 }
 
+static const struct grub_arg_option initrd_options[] =
+  {
+    {"loadfile2", 'l', 0,
+     N_("Don't load the initrd now, let the kernel fetch it through"
+	" the LoadFile2 protocol (Linux 5.8 and later)."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
 static grub_err_t
-grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
-                 int argc, char *argv[])
+grub_cmd_initrd (grub_extcmd_context_t ctxt, int argc, char *argv[])
 {
-  grub_file_t *files = 0;
-  int i, nfiles = 0;
+  struct grub_linux_initrd_context initrd_ctx = { 0, 0, 0 };
   grub_size_t size = 0;
-  grub_uint8_t *ptr;
 
   if (argc == 0)
     {
@@ -132,19 +278,17 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
     }
 
-  files = grub_zalloc (argc * sizeof (files[0]));
-  if (!files)
+  grub_linuxefi_initrd_release ();
+  if (ctxt->state[0].set)
+    return grub_linuxefi_initrd_offer (argc, argv);
+
+  /* The reading and measuring is shared with the other Linux loaders.  */
+  if (grub_initrd_init (argc, argv, &initrd_ctx))
     goto fail;
+  /* What linuxefi always logged, which policies may match on.  */
+  initrd_ctx.measure_description = "UEFI Linux initrd";
 
-  for (i = 0; i < argc; i++)
-    {
-      grub_file_filter_disable_compression ();
-      files[i] = grub_file_open (argv[i]);
-      if (! files[i])
-        goto fail;
-      nfiles++;
-      size += ALIGN_UP (grub_file_size (files[i]), 4);
-    }
+  size = grub_get_initrd_size (&initrd_ctx);
 
   initrd_mem = grub_efi_allocate_pages_max (0x3fffffff, BYTES_TO_PAGES(size));
 
@@ -157,30 +301,13 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
   params->ramdisk_size = size;
   params->ramdisk_image = (grub_uint32_t)(grub_uint64_t) initrd_mem;
 
-  ptr = initrd_mem;
-
-  for (i = 0; i < nfiles; i++)
-    {
-      grub_ssize_t cursize = grub_file_size (files[i]);
-      if (grub_file_read (files[i], ptr, cursize) != cursize)
-        {
-          if (!grub_errno)
-            grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-                        argv[i]);
-          goto fail;
-        }
-      grub_tpm_measure (ptr, cursize, GRUB_INITRD_PCR, "UEFI Linux initrd");
-      ptr += cursize;
-      grub_memset (ptr, 0, ALIGN_UP_OVERHEAD (cursize, 4));
-      ptr += ALIGN_UP_OVERHEAD (cursize, 4);
-    }
+  if (grub_initrd_load (&initrd_ctx, argv, initrd_mem))
+    goto fail;
 
   params->ramdisk_size = size;
 
  fail:
-  for (i = 0; i < nfiles; i++)
-    grub_file_close (files[i]);
-  grub_free (files);
+  grub_initrd_close (&initrd_ctx);
 
   if (initrd_mem && grub_errno)
     grub_efi_free_pages((grub_efi_physical_address_t)initrd_mem, BYTES_TO_PAGES(size));
@@ -196,6 +323,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   struct linux_kernel_header lh;
   grub_ssize_t len, start, filelen;
   void *kernel = NULL;
+  char verity_arg[VERITY_ARG_SIZE];
 
   grub_dl_ref (my_mod);
 
@@ -280,11 +408,11 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
     }
 
   grub_memcpy (linux_cmdline, LINUX_IMAGE, sizeof (LINUX_IMAGE));
-  grub_create_loader_cmdline (argc, argv,
-                              linux_cmdline + sizeof (LINUX_IMAGE) - 1,
-			      lh.cmdline_size - (sizeof (LINUX_IMAGE) - 1));
+  grub_create_loader_cmdline_extra (argc, argv,
+				    grub_verity_hash_arg (&lh, verity_arg),
+				    linux_cmdline + sizeof (LINUX_IMAGE) - 1,
+				    lh.cmdline_size - (sizeof (LINUX_IMAGE) - 1));
 
-  grub_pass_verity_hash(&lh, linux_cmdline);
   lh.cmd_line_ptr = (grub_uint32_t)(grub_uint64_t)linux_cmdline;
 
   handover_offset = lh.handover_offset;
@@ -340,7 +468,8 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   return grub_errno;
 }
 
-static grub_command_t cmd_linux, cmd_initrd;
+static grub_command_t cmd_linux;
+static grub_extcmd_t cmd_initrd;
 
 GRUB_MOD_INIT(linuxefi)
 {
@@ -348,13 +477,14 @@ GRUB_MOD_INIT(linuxefi)
     grub_register_command ("linuxefi", grub_cmd_linux,
                            0, N_("Load Linux."));
   cmd_initrd =
-    grub_register_command ("initrdefi", grub_cmd_initrd,
-                           0, N_("Load initrd."));
+    grub_register_extcmd ("initrdefi", grub_cmd_initrd, 0,
+			  N_("[--loadfile2] FILE..."), N_("Load initrd."),
+			  initrd_options);
   my_mod = mod;
 }
 
 GRUB_MOD_FINI(linuxefi)
 {
   grub_unregister_command (cmd_linux);
-  grub_unregister_command (cmd_initrd);
+  grub_unregister_extcmd (cmd_initrd);
 }
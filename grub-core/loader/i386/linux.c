@@ -689,6 +689,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   int relocatable;
   grub_uint64_t preferred_address = GRUB_LINUX_BZIMAGE_ADDR;
   grub_uint8_t *kernel = NULL;
+  char verity_arg[VERITY_ARG_SIZE];
 
   grub_dl_ref (my_mod);
 
@@ -701,6 +702,7 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   file = grub_file_open (argv[0]);
   if (! file)
     goto fail;
+  file->streaming = 1;
 
   len = grub_file_size (file);
   kernel = grub_malloc (len);
@@ -1022,13 +1024,13 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   if (!linux_cmdline)
     goto fail;
   grub_memcpy (linux_cmdline, LINUX_IMAGE, sizeof (LINUX_IMAGE));
-  grub_create_loader_cmdline (argc, argv,
-			      linux_cmdline
-			      + sizeof (LINUX_IMAGE) - 1,
-			      maximal_cmdline_size
-			      - (sizeof (LINUX_IMAGE) - 1));
+  grub_create_loader_cmdline_extra (argc, argv,
+				    grub_verity_hash_arg (&lh, verity_arg),
+				    linux_cmdline
+				    + sizeof (LINUX_IMAGE) - 1,
+				    maximal_cmdline_size
+				    - (sizeof (LINUX_IMAGE) - 1));
 
-  grub_pass_verity_hash(&lh, linux_cmdline);
   len = prot_file_size;
   grub_memcpy (prot_mode_mem, kernel + kernel_offset, len);
   kernel_offset += len;
@@ -1,25 +1,25 @@
-#define VERITY_ARG " verity.usrhash="
+#define VERITY_ARG "verity.usrhash="
 #define VERITY_HASH_OFFSET 0x40
 #define VERITY_HASH_LENGTH 64
 
-static inline void grub_pass_verity_hash(struct linux_kernel_header *lh,
-					 char *cmdline)
+/* Room for the argument grub_verity_hash_arg makes.  */
+#define VERITY_ARG_SIZE (sizeof (VERITY_ARG) + VERITY_HASH_LENGTH)
+
+/* The verity.usrhash= argument for the hash CoreOS keeps in the kernel
+   header, written to BUF, or NULL if there's none.  */
+static inline const char *grub_verity_hash_arg(struct linux_kernel_header *lh,
+					       char *buf)
 {
-  char *buf = (char *)lh;
-  grub_size_t cmdline_len;
+  const char *hash = (const char *)lh + VERITY_HASH_OFFSET;
   int i;
 
-  for (i=VERITY_HASH_OFFSET; i<VERITY_HASH_OFFSET + VERITY_HASH_LENGTH; i++)
-    {
-      if (buf[i] < '0' || buf[i] > '9') // Not a number
-	if (buf[i] < 'a' || buf[i] > 'f') // Not a hex letter
-	  return;
-    }
+  for (i = 0; i < VERITY_HASH_LENGTH; i++)
+    if (!((hash[i] >= '0' && hash[i] <= '9')
+	  || (hash[i] >= 'a' && hash[i] <= 'f')))
+      return NULL;
 
-  grub_memcpy (cmdline + grub_strlen(cmdline), VERITY_ARG,
-	       sizeof (VERITY_ARG));
-  cmdline_len = grub_strlen(cmdline);
-  grub_memcpy (cmdline + cmdline_len, buf + VERITY_HASH_OFFSET,
-	       VERITY_HASH_LENGTH);
-  cmdline[cmdline_len + VERITY_HASH_LENGTH] = '\0';
+  grub_memcpy (buf, VERITY_ARG, sizeof (VERITY_ARG) - 1);
+  grub_memcpy (buf + sizeof (VERITY_ARG) - 1, hash, VERITY_HASH_LENGTH);
+  buf[sizeof (VERITY_ARG) - 1 + VERITY_HASH_LENGTH] = '\0';
+  return buf;
 }
@@ -158,6 +158,7 @@ grub_initrd_init (int argc, char *argv[],
     return grub_errno;
 
   initrd_ctx->size = 0;
+  initrd_ctx->measure_description = "Linux Initrd";
 
   for (i = 0; i < argc; i++)
     {
@@ -206,6 +207,7 @@ grub_initrd_init (int argc, char *argv[],
 	  grub_initrd_close (initrd_ctx);
 	  return grub_errno;
 	}
+      initrd_ctx->components[i].file->streaming = 1;
       initrd_ctx->nfiles++;
       initrd_ctx->components[i].size
 	= grub_file_size (initrd_ctx->components[i].file);
@@ -243,6 +245,7 @@ grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx)
     }
   grub_free (initrd_ctx->components);
   initrd_ctx->components = 0;
+  initrd_ctx->nfiles = 0;
 }
 
 grub_err_t
@@ -254,6 +257,7 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
   int newc = 0;
   struct dir *root = 0;
   grub_ssize_t cursize = 0;
+  struct grub_tpm_measure_ctx measure;
 
   for (i = 0; i < initrd_ctx->nfiles; i++)
     {
@@ -280,6 +284,11 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	}
 
       cursize = initrd_ctx->components[i].size;
+      /* The initrd may be asked for more than once.  */
+      grub_file_seek (initrd_ctx->components[i].file, 0);
+      grub_tpm_measure_begin (&measure, GRUB_INITRD_PCR,
+			      initrd_ctx->measure_description);
+      initrd_ctx->components[i].file->measure = &measure;
       if (grub_file_read (initrd_ctx->components[i].file, ptr, cursize)
 	  != cursize)
 	{
@@ -289,7 +298,8 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	  grub_initrd_close (initrd_ctx);
 	  return grub_errno;
 	}
-      grub_tpm_measure (ptr, cursize, GRUB_INITRD_PCR, "Linux Initrd");
+      initrd_ctx->components[i].file->measure = 0;
+      grub_tpm_measure_finish (&measure);
       ptr += cursize;
     }
   if (newc)
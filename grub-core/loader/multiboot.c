@@ -157,6 +157,11 @@ grub_multiboot_unload (void)
 
 static grub_uint64_t highest_load;
 
+/* Where the module after the last one would go.  Each module is first
+   tried right there, so that hypervisors with many modules get them packed
+   one after the other and the relocator rarely has to search for space.  */
+static grub_uint64_t next_module_addr;
+
 #define MULTIBOOT_LOAD_ELF64
 #include "multiboot_elfxx.c"
 #undef MULTIBOOT_LOAD_ELF64
@@ -238,6 +243,7 @@ grub_cmd_multiboot (grub_command_t cmd __attribute__ ((unused)),
   grub_loader_unset ();
 
   highest_load = 0;
+  next_module_addr = 0;
 
 #ifndef GRUB_USE_MULTIBOOT2
   grub_multiboot_quirks = GRUB_MULTIBOOT_QUIRKS_NONE;
@@ -308,6 +314,7 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
   grub_err_t err;
   int nounzip = 0;
   grub_uint64_t lowest_addr = 0;
+  struct grub_tpm_measure_ctx measure;
 
   if (argc == 0)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
@@ -332,6 +339,7 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
   file = grub_file_open (argv[0]);
   if (! file)
     return grub_errno;
+  file->streaming = 1;
 
 #ifndef GRUB_USE_MULTIBOOT2
   lowest_addr = 0x100000;
@@ -343,10 +351,23 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
   if (size)
   {
     grub_relocator_chunk_t ch;
-    err = grub_relocator_alloc_chunk_align (grub_multiboot_relocator, &ch,
-					    lowest_addr, (0xffffffff - size) + 1,
-					    size, MULTIBOOT_MOD_ALIGN,
-					    GRUB_RELOCATOR_PREFERENCE_NONE, 1);
+    grub_uint64_t next = ALIGN_UP (next_module_addr, MULTIBOOT_MOD_ALIGN);
+
+    err = GRUB_ERR_OUT_OF_RANGE;
+    if (next_module_addr && next >= lowest_addr
+	&& next + size <= 0x100000000ULL)
+      {
+	err = grub_relocator_alloc_chunk_addr (grub_multiboot_relocator, &ch,
+					       next, size);
+	if (err)
+	  grub_errno = GRUB_ERR_NONE;
+      }
+    if (err)
+      err = grub_relocator_alloc_chunk_align (grub_multiboot_relocator, &ch,
+					      lowest_addr,
+					      (0xffffffff - size) + 1,
+					      size, MULTIBOOT_MOD_ALIGN,
+					      GRUB_RELOCATOR_PREFERENCE_NONE, 1);
     if (err)
       {
 	grub_file_close (file);
@@ -368,6 +389,9 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
       return err;
     }
 
+  /* Measured while it's read, straight into its final place.  */
+  grub_tpm_measure_begin (&measure, GRUB_KERNEL_PCR, argv[0]);
+  file->measure = &measure;
   if (size && grub_file_read (file, module, size) != size)
     {
       grub_file_close (file);
@@ -378,7 +402,9 @@ grub_cmd_module (grub_command_t cmd __attribute__ ((unused)),
     }
 
   grub_file_close (file);
-  grub_tpm_measure (module, size, GRUB_KERNEL_PCR, argv[0]);
+  if (size)
+    next_module_addr = (grub_uint64_t) target + size;
+  grub_tpm_measure_finish (&measure);
   return GRUB_ERR_NONE;
 }
 
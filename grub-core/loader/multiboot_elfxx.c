@@ -50,12 +50,48 @@ CONCAT(grub_multiboot_is_elf, XX) (void *buffer)
   return ehdr->e_ident[EI_CLASS] == ELFCLASSXX;
 }
 
+/* Read SIZE bytes at OFFSET into DEST.  The first BUFFERED bytes of the
+   file are already in BUFFER, and the file is left just past them, so
+   a compressed kernel needn't be inflated again from the start for a
+   segment in that range.  */
+static grub_err_t
+CONCAT(grub_multiboot_read_elf, XX) (grub_file_t file, const char *filename,
+				     const char *buffer, grub_off_t buffered,
+				     grub_off_t offset, void *dest,
+				     grub_size_t size)
+{
+  if (offset < buffered && grub_file_tell (file) == buffered)
+    {
+      grub_size_t n = buffered - offset;
+
+      if (n > size)
+	n = size;
+      grub_memcpy (dest, buffer + offset, n);
+      dest = (char *) dest + n;
+      size -= n;
+      offset += n;
+    }
+  if (!size)
+    return GRUB_ERR_NONE;
+  if (grub_file_seek (file, offset) == (grub_off_t) -1)
+    return grub_errno;
+  if (grub_file_read (file, dest, size) != (grub_ssize_t) size)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    filename);
+      return grub_errno;
+    }
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 CONCAT(grub_multiboot_load_elf, XX) (grub_file_t file, const char *filename, void *buffer)
 {
   Elf_Ehdr *ehdr = (Elf_Ehdr *) buffer;
   char *phdr_base;
-  int i;
+  grub_off_t buffered = grub_file_tell (file);
+  int i, last = -1;
 
   if (ehdr->e_ident[EI_MAG0] != ELFMAG0
       || ehdr->e_ident[EI_MAG1] != ELFMAG1
@@ -78,53 +114,57 @@ CONCAT(grub_multiboot_load_elf, XX) (grub_file_t file, const char *filename, voi
   phdr_base = (char *) buffer + ehdr->e_phoff;
 #define phdr(i)			((Elf_Phdr *) (phdr_base + (i) * ehdr->e_phentsize))
 
-  /* Load every loadable segment in memory.  */
-  for (i = 0; i < ehdr->e_phnum; i++)
+  /* Load every loadable segment in memory, in the order they are in the
+     file: seeking back in a compressed file means inflating it again.  */
+  while (1)
     {
-      if (phdr(i)->p_type == PT_LOAD)
-        {
-	  grub_err_t err;
-	  void *source;
+      int next = -1;
+      grub_err_t err;
+      void *source;
+
+      for (i = 0; i < ehdr->e_phnum; i++)
+	if (phdr(i)->p_type == PT_LOAD
+	    && (last < 0 || phdr(i)->p_offset > phdr(last)->p_offset
+		|| (phdr(i)->p_offset == phdr(last)->p_offset && i > last))
+	    && (next < 0 || phdr(i)->p_offset < phdr(next)->p_offset))
+	  next = i;
+      if (next < 0)
+	break;
+      last = i = next;
 
-	  if (phdr(i)->p_paddr + phdr(i)->p_memsz > highest_load)
-	    highest_load = phdr(i)->p_paddr + phdr(i)->p_memsz;
+      if (phdr(i)->p_paddr + phdr(i)->p_memsz > highest_load)
+	highest_load = phdr(i)->p_paddr + phdr(i)->p_memsz;
 
-	  grub_dprintf ("multiboot_loader", "segment %d: paddr=0x%lx, memsz=0x%lx, vaddr=0x%lx\n",
-			i, (long) phdr(i)->p_paddr, (long) phdr(i)->p_memsz, (long) phdr(i)->p_vaddr);
+      grub_dprintf ("multiboot_loader", "segment %d: paddr=0x%lx, memsz=0x%lx, vaddr=0x%lx\n",
+		    i, (long) phdr(i)->p_paddr, (long) phdr(i)->p_memsz, (long) phdr(i)->p_vaddr);
 
+      {
+	grub_relocator_chunk_t ch;
+	err = grub_relocator_alloc_chunk_addr (grub_multiboot_relocator, 
+					       &ch, phdr(i)->p_paddr,
+					       phdr(i)->p_memsz);
+	if (err)
 	  {
-	    grub_relocator_chunk_t ch;
-	    err = grub_relocator_alloc_chunk_addr (grub_multiboot_relocator, 
-						   &ch, phdr(i)->p_paddr,
-						   phdr(i)->p_memsz);
-	    if (err)
-	      {
-		grub_dprintf ("multiboot_loader", "Error loading phdr %d\n", i);
-		return err;
-	      }
-	    source = get_virtual_current_address (ch);
+	    grub_dprintf ("multiboot_loader", "Error loading phdr %d\n", i);
+	    return err;
 	  }
+	source = get_virtual_current_address (ch);
+      }
 
-	  if (phdr(i)->p_filesz != 0)
-	    {
-	      if (grub_file_seek (file, (grub_off_t) phdr(i)->p_offset)
-		  == (grub_off_t) -1)
-		return grub_errno;
-
-	      if (grub_file_read (file, source, phdr(i)->p_filesz)
-		  != (grub_ssize_t) phdr(i)->p_filesz)
-		{
-		  if (!grub_errno)
-		    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-				filename);
-		  return grub_errno;
-		}
-	    }
+      if (phdr(i)->p_filesz != 0)
+	{
+	  err = CONCAT(grub_multiboot_read_elf, XX) (file, filename,
+						     buffer, buffered,
+						     phdr(i)->p_offset,
+						     source,
+						     phdr(i)->p_filesz);
+	  if (err)
+	    return err;
+	}
 
-          if (phdr(i)->p_filesz < phdr(i)->p_memsz)
-            grub_memset ((grub_uint8_t *) source + phdr(i)->p_filesz, 0,
-			 phdr(i)->p_memsz - phdr(i)->p_filesz);
-        }
+      if (phdr(i)->p_filesz < phdr(i)->p_memsz)
+	grub_memset ((grub_uint8_t *) source + phdr(i)->p_filesz, 0,
+		     phdr(i)->p_memsz - phdr(i)->p_filesz);
     }
 
   for (i = 0; i < ehdr->e_phnum; i++)
@@ -163,26 +203,53 @@ CONCAT(grub_multiboot_load_elf, XX) (grub_file_t file, const char *filename, voi
   if (ehdr->e_shnum)
     {
       grub_uint8_t *shdr, *shdrptr;
+      grub_size_t shdr_size = ehdr->e_shnum * ehdr->e_shentsize;
+      grub_uint8_t *tail = 0;
+      grub_off_t tail_start = grub_file_tell (file);
+      grub_size_t tail_size = 0;
 
-      shdr = grub_malloc (ehdr->e_shnum * ehdr->e_shentsize);
+      shdr = grub_malloc (shdr_size);
       if (!shdr)
 	return grub_errno;
-      
-      if (grub_file_seek (file, ehdr->e_shoff) == (grub_off_t) -1)
+
+      /* The section headers usually come after the sections they describe.
+	 When the file can't seek cheaply, read everything up to the end of
+	 them in one go rather than going back for each section.  */
+      if (file->not_easily_seekable && ehdr->e_shoff >= tail_start)
+	{
+	  tail_size = ehdr->e_shoff + shdr_size - tail_start;
+	  tail = grub_malloc (tail_size);
+	  if (!tail)
+	    grub_errno = GRUB_ERR_NONE;
+	  else if (grub_file_read (file, tail, tail_size)
+		   != (grub_ssize_t) tail_size)
+	    {
+	      grub_free (tail);
+	      grub_free (shdr);
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_FILE_READ_ERROR,
+			    N_("premature end of file %s"), filename);
+	      return grub_errno;
+	    }
+	}
+
+      if (tail)
+	grub_memcpy (shdr, tail + (ehdr->e_shoff - tail_start), shdr_size);
+      else if (grub_file_seek (file, ehdr->e_shoff) == (grub_off_t) -1)
 	{
 	  grub_free (shdr);
 	  return grub_errno;
 	}
-
-      if (grub_file_read (file, shdr, ehdr->e_shnum * ehdr->e_shentsize)
-              != (grub_ssize_t) ehdr->e_shnum * ehdr->e_shentsize)
+      else if (grub_file_read (file, shdr, shdr_size)
+	       != (grub_ssize_t) shdr_size)
 	{
+	  grub_free (shdr);
 	  if (!grub_errno)
 	    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
 			filename);
 	  return grub_errno;
 	}
-      
+
       for (shdrptr = shdr, i = 0; i < ehdr->e_shnum;
 	   shdrptr += ehdr->e_shentsize, i++)
 	{
@@ -212,25 +279,33 @@ CONCAT(grub_multiboot_load_elf, XX) (grub_file_t file, const char *filename, voi
 	    if (err)
 	      {
 		grub_dprintf ("multiboot_loader", "Error loading shdr %d\n", i);
+		grub_free (tail);
+		grub_free (shdr);
 		return err;
 	      }
 	    src = get_virtual_current_address (ch);
 	    target = get_physical_target_address (ch);
 	  }
 
-	  if (grub_file_seek (file, sh->sh_offset) == (grub_off_t) -1)
-	    return grub_errno;
-
-          if (grub_file_read (file, src, sh->sh_size)
-              != (grub_ssize_t) sh->sh_size)
+	  if (tail && sh->sh_offset >= tail_start
+	      && sh->sh_offset + sh->sh_size <= tail_start + tail_size)
+	    grub_memcpy (src, tail + (sh->sh_offset - tail_start), sh->sh_size);
+	  else
 	    {
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-			    filename);
-	      return grub_errno;
+	      err = CONCAT(grub_multiboot_read_elf, XX) (file, filename,
+							 buffer, buffered,
+							 sh->sh_offset, src,
+							 sh->sh_size);
+	      if (err)
+		{
+		  grub_free (tail);
+		  grub_free (shdr);
+		  return err;
+		}
 	    }
 	  sh->sh_addr = target;
 	}
+      grub_free (tail);
       grub_multiboot_add_elfsyms (ehdr->e_shnum, ehdr->e_shentsize,
 				  ehdr->e_shstrndx, shdr);
     }
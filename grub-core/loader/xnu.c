@@ -908,22 +908,38 @@ grub_cmd_xnu_ramdisk (grub_command_t cmd __attribute__ ((unused)),
   return grub_xnu_register_memory ("RAMDisk", 0, loadto_target, size);
 }
 
+/* Returns true if a kext whose OSBundleRequired is BUNDLEREQ, or which
+   has none if BUNDLEREQ is NULL, should be loaded according to
+   osbundlereq.  */
+static int
+grub_xnu_bundle_wanted (const char *osbundlereq, const char *bundlereq)
+{
+  if (! osbundlereq)
+    return 1;
+  if (! bundlereq)
+    return grub_strword (osbundlereq, "all") || grub_strword (osbundlereq, "-");
+  return grub_strword (osbundlereq, bundlereq)
+    || grub_strword (osbundlereq, "all");
+}
+
 /* Returns true if the kext should be loaded according to plist
-   and osbundlereq. Also fill BINNAME. */
+   and osbundlereq. Also fill BINNAME and, lowercased, BUNDLEREQ. */
 static int
 grub_xnu_check_os_bundle_required (char *plistname,
 				   const char *osbundlereq,
-				   char **binname)
+				   char **binname, char **bundlereq)
 {
   grub_file_t file;
   char *buf = 0, *tagstart = 0, *ptr1 = 0, *keyptr = 0;
-  char *stringptr = 0, *ptr2 = 0;
+  char *stringptr = 0, *ptr2 = 0, *found = 0;
   grub_size_t size;
   int depth = 0;
   int ret;
   int osbundlekeyfound = 0, binnamekeyfound = 0;
   if (binname)
     *binname = 0;
+  if (bundlereq)
+    *bundlereq = 0;
 
   file = grub_file_open (plistname);
   if (! file)
@@ -945,12 +961,6 @@ grub_xnu_check_os_bundle_required (char *plistname,
     }
   grub_file_close (file);
 
-  /* Set the return value for the case when no OSBundleRequired tag is found. */
-  if (osbundlereq)
-    ret = grub_strword (osbundlereq, "all") || grub_strword (osbundlereq, "-");
-  else
-    ret = 1;
-
   /* Parse plist. It's quite dirty and inextensible but does its job. */
   for (ptr1 = buf; ptr1 < buf + size; ptr1++)
     switch (*ptr1)
@@ -964,12 +974,11 @@ grub_xnu_check_os_bundle_required (char *plistname,
 	if (keyptr && depth == 4 &&
 	    grub_strcmp (keyptr, "CFBundleExecutable") == 0)
 	  binnamekeyfound = 1;
-	if (stringptr && osbundlekeyfound && osbundlereq && depth == 4)
+	if (stringptr && osbundlekeyfound && depth == 4)
 	  {
 	    for (ptr2 = stringptr; *ptr2; ptr2++)
 	      *ptr2 = grub_tolower (*ptr2);
-	    ret = grub_strword (osbundlereq, stringptr)
-	      || grub_strword (osbundlereq, "all");
+	    found = stringptr;
 	  }
 	if (stringptr && binnamekeyfound && binname && depth == 4)
 	  {
@@ -1013,11 +1022,90 @@ grub_xnu_check_os_bundle_required (char *plistname,
 	  depth++;
 	break;
       }
+
+  /* FOUND points into BUF, terminated by the '<' replaced above.  */
+  if (found)
+    *grub_strchr (found, '<') = 0;
+  ret = grub_xnu_bundle_wanted (osbundlereq, found);
+  if (found && bundlereq)
+    *bundlereq = grub_strdup (found);
   grub_free (buf);
 
   return ret;
 }
 
+/* What a scan of a kext directory found, so that scanning it again while
+   it is unchanged only loads the kexts: walking the bundles and parsing
+   every Info.plist is most of the time spent in xnu_kextdir.  */
+struct grub_xnu_kext_index_entry
+{
+  struct grub_xnu_kext_index_entry *next;
+  char *plistname;
+  /* NULL if the kext has no executable.  */
+  char *binname;
+  /* Lowercased OSBundleRequired, NULL if the kext has none.  */
+  char *bundlereq;
+};
+
+struct grub_xnu_kext_index
+{
+  struct grub_xnu_kext_index *next;
+  char *dirname;
+  grub_int64_t mtime;
+  struct grub_xnu_kext_index_entry *entries;
+  struct grub_xnu_kext_index_entry **tail;
+  int failed;
+};
+
+static struct grub_xnu_kext_index *kext_indices;
+/* The index being filled by the scan in progress, if any.  */
+static struct grub_xnu_kext_index *kext_index_recording;
+
+static void
+grub_xnu_kext_index_free (struct grub_xnu_kext_index *index)
+{
+  struct grub_xnu_kext_index_entry *entry, *next;
+
+  for (entry = index->entries; entry; entry = next)
+    {
+      next = entry->next;
+      grub_free (entry->plistname);
+      grub_free (entry->binname);
+      grub_free (entry->bundlereq);
+      grub_free (entry);
+    }
+  grub_free (index->dirname);
+  grub_free (index);
+}
+
+static void
+grub_xnu_kext_index_record (const char *plistname, const char *binname,
+			    const char *bundlereq)
+{
+  struct grub_xnu_kext_index *index = kext_index_recording;
+  struct grub_xnu_kext_index_entry *entry;
+
+  if (! index || index->failed)
+    return;
+
+  entry = grub_zalloc (sizeof (*entry));
+  if (! entry)
+    goto fail;
+  *index->tail = entry;
+  index->tail = &entry->next;
+  entry->plistname = grub_strdup (plistname);
+  if (! entry->plistname
+      || (binname && ! (entry->binname = grub_strdup (binname)))
+      || (bundlereq && ! (entry->bundlereq = grub_strdup (bundlereq))))
+    goto fail;
+  return;
+
+ fail:
+  /* An index missing a kext must not be used.  */
+  index->failed = 1;
+  grub_errno = GRUB_ERR_NONE;
+}
+
 /* Context for grub_xnu_scan_dir_for_kexts.  */
 struct grub_xnu_scan_dir_for_kexts_ctx
 {
@@ -1164,8 +1252,9 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
   char *device_name;
   grub_fs_t fs;
   const char *path;
-  char *binsuffix;
+  char *binsuffix = 0, *bundlereq = 0, *binname = 0;
   grub_file_t binfile;
+  int load;
 
   ctx.newdirname = grub_malloc (grub_strlen (dirname) + 20);
   if (! ctx.newdirname)
@@ -1194,21 +1283,41 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
       if (fs)
 	(fs->dir) (dev, path, grub_xnu_load_kext_from_dir_load, &ctx);
 
-      if (ctx.plistname && grub_xnu_check_os_bundle_required
-	  (ctx.plistname, osbundlerequired, &binsuffix))
+      load = ctx.plistname
+	&& grub_xnu_check_os_bundle_required (ctx.plistname, osbundlerequired,
+					      &binsuffix, &bundlereq);
+
+      if (ctx.plistname)
 	{
 	  if (binsuffix)
+	    {
+	      binname = grub_malloc (grub_strlen (dirname)
+				     + grub_strlen (binsuffix)
+				     + sizeof ("/MacOS/"));
+	      if (binname)
+		{
+		  grub_strcpy (binname, dirname);
+		  if (ctx.usemacos)
+		    grub_strcpy (binname + grub_strlen (binname), "/MacOS/");
+		  else
+		    grub_strcpy (binname + grub_strlen (binname), "/");
+		  grub_strcpy (binname + grub_strlen (binname), binsuffix);
+		}
+	    }
+
+	  /* A plist that couldn't be read is left out of the index: it is
+	     skipped whatever is asked for.  */
+	  if (binsuffix && ! binname)
+	    {
+	      if (kext_index_recording)
+		kext_index_recording->failed = 1;
+	    }
+	  else if (load || grub_errno == GRUB_ERR_NONE)
+	    grub_xnu_kext_index_record (ctx.plistname, binname, bundlereq);
+
+	  if (load && binname)
 	    {
 	      /* Open the binary. */
-	      char *binname = grub_malloc (grub_strlen (dirname)
-					   + grub_strlen (binsuffix)
-					   + sizeof ("/MacOS/"));
-	      grub_strcpy (binname, dirname);
-	      if (ctx.usemacos)
-		grub_strcpy (binname + grub_strlen (binname), "/MacOS/");
-	      else
-		grub_strcpy (binname + grub_strlen (binname), "/");
-	      grub_strcpy (binname + grub_strlen (binname), binsuffix);
 	      grub_dprintf ("xnu", "%s:%s\n", ctx.plistname, binname);
 	      binfile = grub_file_open (binname);
 	      if (! binfile)
@@ -1217,14 +1326,15 @@ grub_xnu_load_kext_from_dir (char *dirname, const char *osbundlerequired,
 	      /* Load the extension. */
 	      grub_xnu_load_driver (ctx.plistname, binfile,
 				    binname);
-	      grub_free (binname);
-	      grub_free (binsuffix);
 	    }
-	  else
+	  else if (load && ! binsuffix)
 	    {
 	      grub_dprintf ("xnu", "%s:0\n", ctx.plistname);
 	      grub_xnu_load_driver (ctx.plistname, 0, 0);
 	    }
+	  grub_free (binname);
+	  grub_free (binsuffix);
+	  grub_free (bundlereq);
 	}
       grub_free (ctx.plistname);
       grub_device_close (dev);
@@ -1268,6 +1378,151 @@ grub_cmd_xnu_kext (grub_command_t cmd __attribute__ ((unused)),
   return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
 }
 
+/* Context for grub_xnu_dir_mtime.  */
+struct grub_xnu_dir_mtime_ctx
+{
+  const char *name;
+  grub_int64_t mtime;
+  int found;
+};
+
+/* Helper for grub_xnu_dir_mtime.  */
+static int
+grub_xnu_dir_mtime_iter (const char *filename,
+			 const struct grub_dirhook_info *info, void *data)
+{
+  struct grub_xnu_dir_mtime_ctx *ctx = data;
+
+  if (! info->dir || ! info->mtimeset || grub_strcmp (filename, ctx->name))
+    return 0;
+  ctx->mtime = info->mtime;
+  ctx->found = 1;
+  return 1;
+}
+
+/* Find the modification time of directory DIRNAME, which its parent
+   lists.  Returns false if the file system doesn't say.  */
+static int
+grub_xnu_dir_mtime (const char *dirname, grub_int64_t *mtime)
+{
+  struct grub_xnu_dir_mtime_ctx ctx = { .found = 0 };
+  grub_device_t dev;
+  grub_fs_t fs;
+  char *device_name, *parent, *slash;
+  const char *path;
+
+  path = grub_strchr (dirname, ')');
+  path = path ? path + 1 : dirname;
+  parent = grub_strdup (path);
+  if (! parent)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  slash = grub_strrchr (parent, '/');
+  if (! slash || ! slash[1])
+    {
+      grub_free (parent);
+      return 0;
+    }
+  ctx.name = path + (slash - parent) + 1;
+  /* Keep the root's slash.  */
+  if (slash == parent)
+    slash++;
+  *slash = 0;
+
+  device_name = grub_file_get_device_name (dirname);
+  dev = grub_device_open (device_name);
+  if (dev)
+    {
+      fs = grub_fs_probe (dev);
+      if (fs)
+	(fs->dir) (dev, parent, grub_xnu_dir_mtime_iter, &ctx);
+      grub_device_close (dev);
+    }
+  grub_free (device_name);
+  grub_free (parent);
+  grub_errno = GRUB_ERR_NONE;
+
+  *mtime = ctx.mtime;
+  return ctx.found;
+}
+
+/* Load the kexts of DIRNAME matching OSBUNDLEREQUIRED, from the index if
+   the directory hasn't changed since it was last scanned.  Installing or
+   removing a kext changes the mtime of the directory, and so does
+   kextcache's touch of it after an update.  */
+static grub_err_t
+grub_xnu_scan_dir_indexed (char *dirname, const char *osbundlerequired)
+{
+  struct grub_xnu_kext_index *index, **prev;
+  struct grub_xnu_kext_index_entry *entry;
+  grub_int64_t mtime;
+  grub_file_t binfile;
+  grub_err_t err;
+
+  if (! grub_xnu_dir_mtime (dirname, &mtime))
+    return grub_xnu_scan_dir_for_kexts (dirname, osbundlerequired, 10);
+
+  for (prev = &kext_indices; *prev; prev = &(*prev)->next)
+    if (grub_strcmp ((*prev)->dirname, dirname) == 0)
+      break;
+  index = *prev;
+
+  if (index && index->mtime == mtime)
+    {
+      grub_dprintf ("xnu", "using the kext index of %s\n", dirname);
+      for (entry = index->entries; entry; entry = entry->next)
+	{
+	  if (! grub_xnu_bundle_wanted (osbundlerequired, entry->bundlereq))
+	    continue;
+	  binfile = 0;
+	  if (entry->binname)
+	    {
+	      binfile = grub_file_open (entry->binname);
+	      if (! binfile)
+		grub_errno = GRUB_ERR_NONE;
+	    }
+	  grub_xnu_load_driver (entry->plistname, binfile, entry->binname);
+	  if (grub_errno == GRUB_ERR_BAD_OS)
+	    grub_errno = GRUB_ERR_NONE;
+	}
+      return GRUB_ERR_NONE;
+    }
+
+  /* Out of date.  */
+  if (index)
+    {
+      *prev = index->next;
+      grub_xnu_kext_index_free (index);
+    }
+
+  index = grub_zalloc (sizeof (*index));
+  if (index)
+    index->dirname = grub_strdup (dirname);
+  if (! index || ! index->dirname)
+    {
+      grub_free (index);
+      grub_errno = GRUB_ERR_NONE;
+      return grub_xnu_scan_dir_for_kexts (dirname, osbundlerequired, 10);
+    }
+  index->mtime = mtime;
+  index->tail = &index->entries;
+
+  kext_index_recording = index;
+  err = grub_xnu_scan_dir_for_kexts (dirname, osbundlerequired, 10);
+  kext_index_recording = 0;
+
+  if (err || index->failed)
+    grub_xnu_kext_index_free (index);
+  else
+    {
+      index->next = kext_indices;
+      kext_indices = index;
+    }
+  return err;
+}
+
 /* Load a directory containing kexts. */
 static grub_err_t
 grub_cmd_xnu_kextdir (grub_command_t cmd __attribute__ ((unused)),
@@ -1280,9 +1535,8 @@ grub_cmd_xnu_kextdir (grub_command_t cmd __attribute__ ((unused)),
     return grub_error (GRUB_ERR_BAD_OS, N_("you need to load the kernel first"));
 
   if (argc == 1)
-    return grub_xnu_scan_dir_for_kexts (args[0],
-					"console,root,local-root,network-root",
-					10);
+    return grub_xnu_scan_dir_indexed (args[0],
+				      "console,root,local-root,network-root");
   else
     {
       char *osbundlerequired = grub_strdup (args[1]), *ptr;
@@ -1291,7 +1545,7 @@ grub_cmd_xnu_kextdir (grub_command_t cmd __attribute__ ((unused)),
 	return grub_errno;
       for (ptr = osbundlerequired; *ptr; ptr++)
 	*ptr = grub_tolower (*ptr);
-      err = grub_xnu_scan_dir_for_kexts (args[0], osbundlerequired, 10);
+      err = grub_xnu_scan_dir_indexed (args[0], osbundlerequired);
       grub_free (osbundlerequired);
       return err;
     }
@@ -1520,5 +1774,13 @@ GRUB_MOD_FINI(xnu)
   grub_unregister_extcmd (cmd_splash);
   grub_unregister_command (cmd_kernel64);
 
+  while (kext_indices)
+    {
+      struct grub_xnu_kext_index *next = kext_indices->next;
+
+      grub_xnu_kext_index_free (kext_indices);
+      kext_indices = next;
+    }
+
   grub_cpu_xnu_fini ();
 }
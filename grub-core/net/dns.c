@@ -97,6 +97,7 @@ enum
 
 enum
   {
+    ERRCODE_NXDOMAIN = 0x03,
     ERRCODE_MASK = 0x0f
   };
 
@@ -105,18 +106,64 @@ enum
     DNS_PORT = 53
   };
 
+enum
+  {
+    DNS_WANT_A = 1,
+    DNS_WANT_AAAA = 2
+  };
+
+/* Number of rounds of queries and how long to wait after each.  */
+#define DNS_TRIES 4
+#define DNS_ROUND_MS 200
+
 struct recv_data
 {
   grub_size_t *naddresses;
   struct grub_net_network_level_address **addresses;
-  int cache;
   grub_uint16_t id;
   int dns_err;
   char *name;
-  const char *oname;
+  /* DNS_WANT_* bits of the queries sent and of those already answered.  */
+  int wanted;
+  int answered;
+  grub_dns_option_t prefer;
+  /* Smallest TTL of the records used.  */
+  grub_uint32_t ttl;
   int stop;
 };
 
+static inline int
+server_wants (grub_dns_option_t option)
+{
+  return ((option == DNS_OPTION_IPV6 ? 0 : DNS_WANT_A)
+	  | (option == DNS_OPTION_IPV4 ? 0 : DNS_WANT_AAAA));
+}
+
+static int
+family_found (const struct recv_data *data, grub_network_level_protocol_id_t type)
+{
+  grub_size_t i;
+
+  for (i = 0; i < *data->naddresses; i++)
+    if ((*data->addresses)[i].type == type)
+      return 1;
+  return 0;
+}
+
+/* Every family asked for has its answer or the preferred one gave
+   addresses, which is all the caller will look at first anyway.  */
+static int
+lookup_done (const struct recv_data *data)
+{
+  if ((data->answered & data->wanted) == data->wanted)
+    return 1;
+  if (data->prefer == DNS_OPTION_PREFER_IPV4)
+    return family_found (data, GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4);
+  if (data->prefer == DNS_OPTION_PREFER_IPV6)
+    return family_found (data, GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6);
+  return 0;
+}
+
 static inline int
 hash (const char *str)
 {
@@ -237,6 +284,9 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
   int redirect_cnt = 0;
   char *redirect_save = NULL;
   grub_uint32_t ttl_all = ~0U;
+  int answer = 0;
+  grub_size_t alloc;
+  struct grub_net_network_level_address *naddr;
 
   head = (struct dns_header *) nb->data;
   ptr = (grub_uint8_t *) (head + 1);
@@ -256,12 +306,6 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
     }
-  if (head->ra_z_r_code & ERRCODE_MASK)
-    {
-      data->dns_err = 1;
-      grub_netbuff_free (nb);
-      return GRUB_ERR_NONE;
-    }
   for (i = 0; i < grub_be_to_cpu16 (head->qdcount); i++)
     {
       if (ptr >= nb->tail)
@@ -274,16 +318,41 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       if (ptr < nb->tail && (*ptr & 0xc0))
 	ptr++;
       ptr++;
+      /* The question tells which of the queries this answers.  */
+      if (i == 0 && ptr + 2 <= nb->tail && ptr[0] == 0)
+	answer = (ptr[1] == GRUB_DNS_QTYPE_A ? DNS_WANT_A
+		  : ptr[1] == GRUB_DNS_QTYPE_AAAA ? DNS_WANT_AAAA : 0);
       ptr += 4;
     }
-  *data->addresses = grub_malloc (sizeof ((*data->addresses)[0])
-				 * grub_be_to_cpu16 (head->ancount));
-  if (!*data->addresses)
+  /* Another server or a retransmission answered already.  */
+  if (!answer || (data->answered & answer))
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+  if (head->ra_z_r_code & ERRCODE_MASK)
+    {
+      /* Only a missing name is final, another server may do better on
+	 other errors.  */
+      data->dns_err = 1;
+      if ((head->ra_z_r_code & ERRCODE_MASK) == ERRCODE_NXDOMAIN)
+	{
+	  data->answered |= answer;
+	  data->stop = lookup_done (data);
+	}
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+  /* Both answers go to the same array.  */
+  alloc = *data->naddresses + grub_be_to_cpu16 (head->ancount);
+  naddr = grub_realloc (*data->addresses, sizeof (naddr[0]) * (alloc ? : 1));
+  if (!naddr)
     {
       grub_errno = GRUB_ERR_NONE;
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
     }
+  *data->addresses = naddr;
   reparse_ptr = ptr;
  reparse:
   for (i = 0, ptr = reparse_ptr; i < grub_be_to_cpu16 (head->ancount); i++)
@@ -294,8 +363,6 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       grub_uint16_t length;
       if (ptr >= nb->tail)
 	{
-	  if (!*data->naddresses)
-	    grub_free (*data->addresses);
 	  return GRUB_ERR_NONE;
 	}
       ignored = !check_name (ptr, nb->data, nb->tail, data->name);
@@ -306,8 +373,6 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       ptr++;
       if (ptr + 10 >= nb->tail)
 	{
-	  if (!*data->naddresses)
-	    grub_free (*data->addresses);
 	  grub_netbuff_free (nb);
 	  return GRUB_ERR_NONE;
 	}
@@ -327,8 +392,6 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
       length |= *ptr++;
       if (ptr + length > nb->tail)
 	{
-	  if (!*data->naddresses)
-	    grub_free (*data->addresses);
 	  grub_netbuff_free (nb);
 	  return GRUB_ERR_NONE;
 	}
@@ -339,24 +402,22 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  switch (class)
 	    {
 	    case DNS_CLASS_A:
-	      if (length != 4)
+	      if (length != 4 || *data->naddresses >= alloc)
 		break;
 	      (*data->addresses)[*data->naddresses].type
 		= GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
 	      grub_memcpy (&(*data->addresses)[*data->naddresses].ipv4,
 			   ptr, 4);
 	      (*data->naddresses)++;
-	      data->stop = 1;
 	      break;
 	    case DNS_CLASS_AAAA:
-	      if (length != 16)
+	      if (length != 16 || *data->naddresses >= alloc)
 		break;
 	      (*data->addresses)[*data->naddresses].type
 		= GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6;
 	      grub_memcpy (&(*data->addresses)[*data->naddresses].ipv6,
 			   ptr, 16);
 	      (*data->naddresses)++;
-	      data->stop = 1;
 	      break;
 	    case DNS_CLASS_CNAME:
 	      if (!(redirect_cnt & (redirect_cnt - 1)))
@@ -386,34 +447,71 @@ recv_hook (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	}
       ptr += length;
     }
-  if (ttl_all && *data->naddresses && data->cache)
+  if (data->ttl > ttl_all)
+    data->ttl = ttl_all;
+  data->answered |= answer;
+  data->stop = lookup_done (data);
+  grub_netbuff_free (nb);
+  grub_free (redirect_save);
+  return GRUB_ERR_NONE;
+}
+
+static void
+dns_cache_store (const char *name,
+		 const struct grub_net_network_level_address *addresses,
+		 grub_size_t naddresses, grub_uint32_t ttl)
+{
+  int h;
+
+  grub_dprintf ("dns", "caching for %d seconds\n", ttl);
+  h = hash (name);
+  grub_free (dns_cache[h].name);
+  dns_cache[h].name = 0;
+  grub_free (dns_cache[h].addresses);
+  dns_cache[h].addresses = 0;
+  dns_cache[h].name = grub_strdup (name);
+  dns_cache[h].naddresses = naddresses;
+  dns_cache[h].addresses = grub_malloc (naddresses
+					* sizeof (dns_cache[h].addresses[0]));
+  dns_cache[h].limit_time = grub_get_time_ms () + 1000 * (grub_uint64_t) ttl;
+  if (!dns_cache[h].addresses || !dns_cache[h].name)
     {
-      int h;
-      grub_dprintf ("dns", "caching for %d seconds\n", ttl_all);
-      h = hash (data->oname);
       grub_free (dns_cache[h].name);
       dns_cache[h].name = 0;
       grub_free (dns_cache[h].addresses);
       dns_cache[h].addresses = 0;
-      dns_cache[h].name = grub_strdup (data->oname);
-      dns_cache[h].naddresses = *data->naddresses;
-      dns_cache[h].addresses = grub_malloc (*data->naddresses
-					    * sizeof (dns_cache[h].addresses[0]));
-      dns_cache[h].limit_time = grub_get_time_ms () + 1000 * ttl_all;
-      if (!dns_cache[h].addresses || !dns_cache[h].name)
-	{
-	  grub_free (dns_cache[h].name);
-	  dns_cache[h].name = 0;
-	  grub_free (dns_cache[h].addresses);
-	  dns_cache[h].addresses = 0;
-	}
-      grub_memcpy (dns_cache[h].addresses, *data->addresses,
-		   *data->naddresses
-		   * sizeof (dns_cache[h].addresses[0]));
+      grub_errno = GRUB_ERR_NONE;
+      return;
     }
-  grub_netbuff_free (nb);
-  grub_free (redirect_save);
-  return GRUB_ERR_NONE;
+  grub_memcpy (dns_cache[h].addresses, addresses,
+	       naddresses * sizeof (dns_cache[h].addresses[0]));
+}
+
+/* Put the addresses of the preferred family first, keeping the order
+   within each family.  */
+static void
+sort_addresses (struct grub_net_network_level_address *addresses,
+		grub_size_t naddresses, grub_dns_option_t prefer)
+{
+  grub_network_level_protocol_id_t first;
+  struct grub_net_network_level_address tmp;
+  grub_size_t i, j, k;
+
+  if (prefer == DNS_OPTION_PREFER_IPV4)
+    first = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+  else if (prefer == DNS_OPTION_PREFER_IPV6)
+    first = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6;
+  else
+    return;
+
+  for (i = 0, j = 0; j < naddresses; j++)
+    if (addresses[j].type == first)
+      {
+	tmp = addresses[j];
+	for (k = j; k > i; k--)
+	  addresses[k] = addresses[k - 1];
+	addresses[i++] = tmp;
+      }
 }
 
 grub_err_t
@@ -424,7 +522,6 @@ grub_net_dns_lookup (const char *name,
 		     struct grub_net_network_level_address **addresses,
 		     int cache)
 {
-  grub_size_t send_servers = 0;
   grub_size_t i, j;
   struct grub_net_buff *nb;
   grub_net_udp_socket_t *sockets;
@@ -434,8 +531,9 @@ grub_net_dns_lookup (const char *name,
   static grub_uint16_t id = 1;
   grub_uint8_t *qtypeptr;
   grub_err_t err = GRUB_ERR_NONE;
-  struct recv_data data = {naddresses, addresses, cache,
-			   grub_cpu_to_be16 (id++), 0, 0, name, 0};
+  struct recv_data data = {naddresses, addresses,
+			   grub_cpu_to_be16 (id++), 0, 0, 0, 0,
+			   DNS_OPTION_IPV4, ~0U, 0};
   grub_uint8_t *nbd;
   int have_server = 0;
 
@@ -450,6 +548,7 @@ grub_net_dns_lookup (const char *name,
 		       N_("no DNS servers configured"));
 
   *naddresses = 0;
+  *addresses = 0;
   if (cache)
     {
       int h;
@@ -470,7 +569,7 @@ grub_net_dns_lookup (const char *name,
 	}
     }
 
-  sockets = grub_malloc (sizeof (sockets[0]) * n_servers);
+  sockets = grub_zalloc (sizeof (sockets[0]) * n_servers);
   if (!sockets)
     return grub_errno;
 
@@ -509,6 +608,7 @@ grub_net_dns_lookup (const char *name,
 	{
 	  grub_free (sockets);
 	  grub_free (data.name);
+	  grub_netbuff_free (nb);
 	  return grub_error (GRUB_ERR_BAD_ARGUMENT,
 			     N_("domain name component is too long"));
 	}
@@ -540,73 +640,79 @@ grub_net_dns_lookup (const char *name,
 
   nbd = nb->data;
 
-  for (i = 0; i < n_servers * 4; i++)
+  /* Ask all the servers at once, so that a slow or dead one costs nothing
+     as long as another one answers.  The preference of the first server
+     decides the order of the addresses returned.  */
+  for (j = 0; j < n_servers; j++)
     {
-      /* Connect to a next server.  */
-      while (!(i & 1) && send_servers < n_servers)
+      sockets[j] = grub_net_udp_open (servers[j], DNS_PORT, recv_hook, &data);
+      if (!sockets[j])
 	{
-	  sockets[send_servers] = grub_net_udp_open (servers[send_servers],
-						     DNS_PORT,
-						     recv_hook,
-						     &data);
-	  send_servers++;
-	  if (!sockets[send_servers - 1])
-	    {
-	      err = grub_errno;
-	      grub_errno = GRUB_ERR_NONE;
-	    }
-	  else
-	    {
-	      have_server = 1;
-	      break;
-	    }
+	  err = grub_errno;
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
 	}
       if (!have_server)
-	goto out;
-      if (*data.naddresses)
-	goto out;
-      for (j = 0; j < send_servers; j++)
+	data.prefer = servers[j].option;
+      have_server = 1;
+      data.wanted |= server_wants (servers[j].option);
+    }
+  if (!have_server)
+    goto out;
+
+  for (i = 0; i < DNS_TRIES && !data.stop; i++)
+    {
+      for (j = 0; j < n_servers && !data.stop; j++)
 	{
-          grub_err_t err2;
-          if (!sockets[j])
-            continue;
-          nb->data = nbd;
-
-          grub_size_t t = 0;
-          do
-            {
-              if (servers[j].option == DNS_OPTION_IPV4 ||
-                 ((servers[j].option == DNS_OPTION_PREFER_IPV4) && (t++ == 0)) ||
-                 ((servers[j].option == DNS_OPTION_PREFER_IPV6) && (t++ == 1)))
-                *qtypeptr = GRUB_DNS_QTYPE_A;
-              else
-                *qtypeptr = GRUB_DNS_QTYPE_AAAA;
-
-              grub_dprintf ("dns", "QTYPE: %u QNAME: %s\n", *qtypeptr, name);
-
-              err2 = grub_net_send_udp_packet (sockets[j], nb);
-              if (err2)
-                {
-                  grub_errno = GRUB_ERR_NONE;
-                  err = err2;
-                }
-              if (*data.naddresses)
-                goto out;
-            }
-          while (t == 1);
+	  int want, k;
+
+	  if (!sockets[j])
+	    continue;
+	  want = server_wants (servers[j].option);
+
+	  /* A and AAAA go out back to back, the preferred one first.  */
+	  for (k = 0; k < 2; k++)
+	    {
+	      int q = ((k == 0) == (servers[j].option == DNS_OPTION_PREFER_IPV6))
+		? DNS_WANT_AAAA : DNS_WANT_A;
+	      grub_err_t err2;
+
+	      if (!(want & q) || (data.answered & q))
+		continue;
+
+	      *qtypeptr = (q == DNS_WANT_A) ? GRUB_DNS_QTYPE_A
+		: GRUB_DNS_QTYPE_AAAA;
+	      grub_dprintf ("dns", "QTYPE: %u QNAME: %s\n", *qtypeptr, name);
+
+	      nb->data = nbd;
+	      err2 = grub_net_send_udp_packet (sockets[j], nb);
+	      if (err2)
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  err = err2;
+		}
+	    }
 	}
-      grub_net_poll_cards (200, &data.stop);
+      grub_net_poll_cards (DNS_ROUND_MS, &data.stop);
     }
  out:
   grub_free (data.name);
   grub_netbuff_free (nb);
-  for (j = 0; j < send_servers; j++)
-    grub_net_udp_close (sockets[j]);
+  for (j = 0; j < n_servers; j++)
+    if (sockets[j])
+      grub_net_udp_close (sockets[j]);
   
   grub_free (sockets);
 
   if (*data.naddresses)
-    return GRUB_ERR_NONE;
+    {
+      sort_addresses (*addresses, *naddresses, data.prefer);
+      if (cache && data.ttl)
+	dns_cache_store (name, *addresses, *naddresses, data.ttl);
+      return GRUB_ERR_NONE;
+    }
+  grub_free (*addresses);
+  *addresses = 0;
   if (data.dns_err)
     return grub_error (GRUB_ERR_NET_NO_DOMAIN,
 		       N_("no DNS record found"));
@@ -29,6 +29,83 @@ GRUB_MOD_LICENSE ("GPLv3+");
 /* GUID.  */
 static grub_efi_guid_t net_io_guid = GRUB_EFI_SIMPLE_NETWORK_GUID;
 static grub_efi_guid_t pxe_io_guid = GRUB_EFI_PXE_GUID;
+static grub_efi_guid_t mnp_sb_guid = GRUB_EFI_MANAGED_NETWORK_SERVICE_BINDING_GUID;
+static grub_efi_guid_t mnp_guid = GRUB_EFI_MANAGED_NETWORK_GUID;
+
+/* Number of packets taken off the card in one go.  Draining them before
+   any is processed keeps the receive ring of the card from overflowing
+   while we are busy answering the first ones.  */
+#define EFINET_RX_RING	32
+
+struct grub_efinet_priv
+{
+  /* Slots HEAD to HEAD + COUNT - 1 hold received packets, the other ones
+     empty buffers to receive into or NULL.  */
+  struct grub_net_buff *ring[EFINET_RX_RING];
+  unsigned head;
+  unsigned count;
+
+  /* Our own Managed Network instance, used when SNP is shared with the
+     network stack of the firmware.  */
+  grub_efi_service_binding_t *mnp_sb;
+  grub_efi_handle_t mnp_child;
+  grub_efi_managed_network_t *mnp;
+  grub_efi_managed_network_completion_token_t rx_tokens[EFINET_RX_RING];
+  unsigned next_token;
+  grub_efi_managed_network_completion_token_t tx_token;
+  grub_efi_managed_network_transmit_data_t tx_data;
+};
+
+static grub_err_t
+send_card_buffer_mnp (struct grub_net_card *dev,
+		      struct grub_net_buff *pack)
+{
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  grub_efi_managed_network_t *mnp = priv->mnp;
+  grub_efi_managed_network_transmit_data_t *tx = &priv->tx_data;
+  grub_efi_managed_network_completion_token_t *token = &priv->tx_token;
+  grub_uint32_t header = dev->efi_net->mode->media_header_size;
+  grub_uint64_t limit_time = grub_get_time_ms () + 4000;
+  grub_size_t len;
+  grub_efi_status_t st;
+
+  len = pack->tail - pack->data;
+  if (len > dev->mtu)
+    len = dev->mtu;
+  if (len < header)
+    return grub_error (GRUB_ERR_IO, N_("couldn't send network packet"));
+
+  /* The frame is complete, MNP only has to know where its header ends.  */
+  grub_memset (tx, 0, sizeof (*tx));
+  tx->header_length = header;
+  tx->data_length = len - header;
+  tx->fragment_count = 1;
+  tx->fragment_table[0].fragment_length = len;
+  tx->fragment_table[0].fragment_buffer = pack->data;
+
+  token->status = GRUB_EFI_NOT_READY;
+  token->packet.tx_data = tx;
+  st = efi_call_2 (mnp->transmit, mnp, token);
+  if (st != GRUB_EFI_SUCCESS)
+    return grub_error (GRUB_ERR_IO, N_("couldn't send network packet"));
+
+  while (token->status == GRUB_EFI_NOT_READY)
+    {
+      if (limit_time < grub_get_time_ms ())
+	{
+	  efi_call_2 (mnp->cancel, mnp, token);
+	  return grub_error (GRUB_ERR_TIMEOUT,
+			     N_("couldn't send network packet"));
+	}
+      efi_call_1 (mnp->poll, mnp);
+    }
+
+  if (token->status != GRUB_EFI_SUCCESS)
+    return grub_error (GRUB_ERR_IO, N_("couldn't send network packet"));
+
+  return GRUB_ERR_NONE;
+}
+
 
 static grub_err_t
 send_card_buffer (struct grub_net_card *dev,
@@ -39,6 +116,9 @@ send_card_buffer (struct grub_net_card *dev,
   grub_uint64_t limit_time = grub_get_time_ms () + 4000;
   void *txbuf;
 
+  if (dev->efi_priv && dev->efi_priv->mnp)
+    return send_card_buffer_mnp (dev, pack);
+
   if (dev->txbusy)
     while (1)
       {
@@ -90,56 +170,262 @@ send_card_buffer (struct grub_net_card *dev,
   return GRUB_ERR_NONE;
 }
 
+/* The free slot after the received packets, with a buffer of at least
+   rcvbufsize bytes.  */
 static struct grub_net_buff *
-get_card_packet (struct grub_net_card *dev)
+get_rx_slot (struct grub_net_card *dev)
+{
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  struct grub_net_buff **slot;
+
+  slot = &priv->ring[(priv->head + priv->count) % EFINET_RX_RING];
+  if (*slot && (grub_size_t) ((*slot)->end - (*slot)->data) < dev->rcvbufsize)
+    {
+      grub_netbuff_free (*slot);
+      *slot = NULL;
+    }
+  if (*slot)
+    return *slot;
+
+  *slot = grub_net_card_alloc_buff (dev, dev->rcvbufsize + 2);
+  if (!*slot)
+    return NULL;
+
+  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
+     by 4. So that IP header is aligned on 4 bytes. */
+  if (grub_netbuff_reserve (*slot, 2))
+    {
+      grub_netbuff_free (*slot);
+      *slot = NULL;
+    }
+  return *slot;
+}
+
+/* Receive straight into the free slots until the card has nothing more.  */
+static void
+drain_snp (struct grub_net_card *dev)
 {
+  struct grub_efinet_priv *priv = dev->efi_priv;
   grub_efi_simple_network_t *net = dev->efi_net;
-  grub_err_t err;
-  grub_efi_status_t st;
-  grub_efi_uintn_t bufsize = dev->rcvbufsize;
-  struct grub_net_buff *nb;
-  int i;
 
-  for (i = 0; i < 2; i++)
+  while (priv->count < EFINET_RX_RING)
+    {
+      struct grub_net_buff *nb = NULL;
+      grub_efi_uintn_t bufsize = 0;
+      grub_efi_status_t st = GRUB_EFI_NOT_READY;
+      int i;
+
+      for (i = 0; i < 2; i++)
+	{
+	  nb = get_rx_slot (dev);
+	  if (!nb)
+	    return;
+
+	  bufsize = nb->end - nb->data;
+	  st = efi_call_7 (net->receive, net, NULL, &bufsize,
+			   nb->data, NULL, NULL, NULL);
+	  if (st != GRUB_EFI_BUFFER_TOO_SMALL)
+	    break;
+	  dev->rcvbufsize = 2 * ALIGN_UP (dev->rcvbufsize > bufsize
+					  ? dev->rcvbufsize : bufsize, 64);
+	}
+
+      if (st != GRUB_EFI_SUCCESS || grub_netbuff_put (nb, bufsize))
+	return;
+      priv->count++;
+    }
+}
+
+/* Collect the packets MNP delivered to our tokens, which complete in the
+   order they were queued, and queue each token again.  The firmware owns
+   the packet buffers so these have to be copied.  */
+static void
+drain_mnp (struct grub_net_card *dev)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  grub_efi_managed_network_t *mnp = priv->mnp;
+  unsigned n;
+
+  efi_call_1 (mnp->poll, mnp);
+
+  for (n = 0; n < EFINET_RX_RING && priv->count < EFINET_RX_RING; n++)
     {
-      if (!dev->rcvbuf)
-	dev->rcvbuf = grub_malloc (dev->rcvbufsize);
-      if (!dev->rcvbuf)
-	return NULL;
-
-      st = efi_call_7 (net->receive, net, NULL, &bufsize,
-		       dev->rcvbuf, NULL, NULL, NULL);
-      if (st != GRUB_EFI_BUFFER_TOO_SMALL)
+      grub_efi_managed_network_completion_token_t *token;
+      grub_efi_managed_network_receive_data_t *rx;
+      struct grub_net_buff *nb;
+
+      token = &priv->rx_tokens[priv->next_token];
+      if (token->status == GRUB_EFI_NOT_READY)
 	break;
-      dev->rcvbufsize = 2 * ALIGN_UP (dev->rcvbufsize > bufsize
-				      ? dev->rcvbufsize : bufsize, 64);
-      grub_free (dev->rcvbuf);
-      dev->rcvbuf = 0;
+
+      rx = token->packet.rx_data;
+      if (token->status == GRUB_EFI_SUCCESS && rx)
+	{
+	  if (rx->packet_length > dev->rcvbufsize)
+	    dev->rcvbufsize = ALIGN_UP (rx->packet_length, 64);
+	  nb = get_rx_slot (dev);
+	  if (nb && grub_netbuff_put (nb, rx->packet_length) == GRUB_ERR_NONE)
+	    {
+	      grub_memcpy (nb->data, rx->media_header, rx->packet_length);
+	      priv->count++;
+	    }
+	  else
+	    {
+	      grub_net_stats.rx_dropped++;
+	      grub_errno = GRUB_ERR_NONE;
+	    }
+	  efi_call_1 (b->signal_event, rx->recycle_event);
+	}
+
+      priv->next_token = (priv->next_token + 1) % EFINET_RX_RING;
+      token->status = GRUB_EFI_NOT_READY;
+      token->packet.rx_data = NULL;
+      if (efi_call_2 (mnp->receive, mnp, token) != GRUB_EFI_SUCCESS)
+	token->status = GRUB_EFI_ABORTED;
     }
+}
 
-  if (st != GRUB_EFI_SUCCESS)
+static struct grub_net_buff *
+get_card_packet (struct grub_net_card *dev)
+{
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  struct grub_net_buff *nb;
+
+  if (!priv)
     return NULL;
 
-  nb = grub_netbuff_alloc (bufsize + 2);
-  if (!nb)
+  if (!priv->count)
+    {
+      if (priv->mnp)
+	drain_mnp (dev);
+      else
+	drain_snp (dev);
+    }
+
+  if (!priv->count)
     return NULL;
 
-  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
-     by 4. So that IP header is aligned on 4 bytes. */
-  if (grub_netbuff_reserve (nb, 2))
+  nb = priv->ring[priv->head];
+  priv->ring[priv->head] = NULL;
+  priv->head = (priv->head + 1) % EFINET_RX_RING;
+  priv->count--;
+  return nb;
+}
+
+static void
+close_mnp (struct grub_net_card *dev)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  unsigned i;
+
+  if (priv->mnp)
     {
-      grub_netbuff_free (nb);
-      return NULL;
+      efi_call_2 (priv->mnp->cancel, priv->mnp, NULL);
+      for (i = 0; i < EFINET_RX_RING; i++)
+	if (priv->rx_tokens[i].status == GRUB_EFI_SUCCESS
+	    && priv->rx_tokens[i].packet.rx_data)
+	  efi_call_1 (b->signal_event,
+		      priv->rx_tokens[i].packet.rx_data->recycle_event);
+      efi_call_2 (priv->mnp->configure, priv->mnp, NULL);
     }
-  grub_memcpy (nb->data, dev->rcvbuf, bufsize);
-  err = grub_netbuff_put (nb, bufsize);
-  if (err)
+
+  for (i = 0; i < EFINET_RX_RING; i++)
+    if (priv->rx_tokens[i].event)
+      efi_call_1 (b->close_event, priv->rx_tokens[i].event);
+  if (priv->tx_token.event)
+    efi_call_1 (b->close_event, priv->tx_token.event);
+
+  if (priv->mnp_child)
+    efi_call_2 (priv->mnp_sb->destroy_child, priv->mnp_sb, priv->mnp_child);
+
+  priv->mnp = NULL;
+  priv->mnp_child = NULL;
+  grub_memset (priv->rx_tokens, 0, sizeof (priv->rx_tokens));
+  grub_memset (&priv->tx_token, 0, sizeof (priv->tx_token));
+}
+
+/* The firmware keeps SNP for its own network stack, whose MNP instance
+   polls it in the background and takes packets from under us.  Create our
+   own MNP child instead so that both sides are fed from the same queue,
+   without background polling and with a full ring of receive tokens.  */
+static grub_err_t
+open_mnp (struct grub_net_card *dev)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  grub_efi_managed_network_config_data_t config;
+  grub_efi_status_t st;
+  unsigned i;
+
+  priv->mnp_sb = grub_efi_open_protocol (dev->efi_handle, &mnp_sb_guid,
+					 GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  if (!priv->mnp_sb)
+    return grub_error (GRUB_ERR_NET_NO_CARD, "%s: no managed network",
+		       dev->name);
+
+  st = efi_call_2 (priv->mnp_sb->create_child, priv->mnp_sb,
+		   &priv->mnp_child);
+  if (st != GRUB_EFI_SUCCESS)
     {
-      grub_netbuff_free (nb);
-      return NULL;
+      priv->mnp_child = NULL;
+      return grub_error (GRUB_ERR_NET_NO_CARD,
+			 "%s: couldn't create managed network instance",
+			 dev->name);
     }
 
-  return nb;
+  priv->mnp = grub_efi_open_protocol (priv->mnp_child, &mnp_guid,
+				      GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
+  if (!priv->mnp)
+    {
+      close_mnp (dev);
+      return grub_error (GRUB_ERR_NET_NO_CARD, "%s: no managed network",
+			 dev->name);
+    }
+
+  /* Same filters as in the SNP case; MNP has no way to receive all
+     multicast so promiscuous it is.  */
+  grub_memset (&config, 0, sizeof (config));
+  config.enable_unicast_receive = 1;
+  config.enable_multicast_receive = 1;
+  config.enable_broadcast_receive = 1;
+  config.enable_promiscuous_receive = 1;
+  config.flush_queues_on_reset = 1;
+  config.disable_background_polling = 1;
+
+  st = efi_call_2 (priv->mnp->configure, priv->mnp, &config);
+  if (st != GRUB_EFI_SUCCESS)
+    {
+      priv->mnp = NULL;
+      close_mnp (dev);
+      return grub_error (GRUB_ERR_NET_NO_CARD,
+			 "%s: couldn't configure managed network", dev->name);
+    }
+
+  st = efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK,
+		   NULL, NULL, &priv->tx_token.event);
+  for (i = 0; st == GRUB_EFI_SUCCESS && i < EFINET_RX_RING; i++)
+    {
+      grub_efi_managed_network_completion_token_t *token = &priv->rx_tokens[i];
+
+      st = efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK,
+		       NULL, NULL, &token->event);
+      if (st != GRUB_EFI_SUCCESS)
+	break;
+      token->status = GRUB_EFI_NOT_READY;
+      if (efi_call_2 (priv->mnp->receive, priv->mnp, token)
+	  != GRUB_EFI_SUCCESS)
+	token->status = GRUB_EFI_ABORTED;
+    }
+  if (st != GRUB_EFI_SUCCESS)
+    {
+      close_mnp (dev);
+      return grub_error (GRUB_ERR_OUT_OF_MEMORY, "couldn't create event");
+    }
+
+  priv->next_token = 0;
+  return GRUB_ERR_NONE;
 }
 
 static grub_err_t
@@ -147,6 +433,13 @@ open_card (struct grub_net_card *dev)
 {
   grub_efi_simple_network_t *net;
 
+  if (!dev->efi_priv)
+    {
+      dev->efi_priv = grub_zalloc (sizeof (*dev->efi_priv));
+      if (!dev->efi_priv)
+	return grub_errno;
+    }
+
   /* Try to reopen SNP exlusively to close any active MNP protocol instance
      that may compete for packet polling
    */
@@ -196,19 +489,37 @@ open_card (struct grub_net_card *dev)
 		  grub_efi_image_handle, dev->efi_handle);
       dev->efi_net = net;
     }
+  else if (open_mnp (dev))
+    /* If it failed we just try to run as best as we can */
+    grub_errno = GRUB_ERR_NONE;
 
-  /* If it failed we just try to run as best as we can */
   return GRUB_ERR_NONE;
 }
 
 static void
 close_card (struct grub_net_card *dev)
 {
-  efi_call_1 (dev->efi_net->shutdown, dev->efi_net);
-  efi_call_1 (dev->efi_net->stop, dev->efi_net);
-  efi_call_4 (grub_efi_system_table->boot_services->close_protocol,
-	      dev->efi_net, &net_io_guid,
-	      grub_efi_image_handle, dev->efi_handle);
+  struct grub_efinet_priv *priv = dev->efi_priv;
+  unsigned i;
+
+  if (priv && priv->mnp)
+    close_mnp (dev);
+  else
+    {
+      efi_call_1 (dev->efi_net->shutdown, dev->efi_net);
+      efi_call_1 (dev->efi_net->stop, dev->efi_net);
+      efi_call_4 (grub_efi_system_table->boot_services->close_protocol,
+		  dev->efi_net, &net_io_guid,
+		  grub_efi_image_handle, dev->efi_handle);
+    }
+
+  if (!priv)
+    return;
+  for (i = 0; i < EFINET_RX_RING; i++)
+    if (priv->ring[i])
+      grub_netbuff_free (priv->ring[i]);
+  grub_free (priv);
+  dev->efi_priv = NULL;
 }
 
 static struct grub_net_card_driver efidriver =
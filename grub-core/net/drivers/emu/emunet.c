@@ -48,7 +48,8 @@ static struct grub_net_card emucard =
 			 .type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET,
 			 {.mac = {0, 1, 2, 3, 4, 5}}
 		       },
-    .flags = 0
+    /* Frames only ever cross host memory.  */
+    .flags = GRUB_NET_CARD_RX_CHECKSUM_VERIFIED
   };
 
 static grub_err_t 
@@ -70,7 +71,7 @@ get_card_packet (struct grub_net_card *dev __attribute__ ((unused)))
   grub_ssize_t actual;
   struct grub_net_buff *nb;
 
-  nb = grub_netbuff_alloc (emucard.mtu + 36 + 2);
+  nb = grub_net_card_alloc_buff (&emucard, emucard.mtu + 36 + 2);
   if (!nb)
     return NULL;
 
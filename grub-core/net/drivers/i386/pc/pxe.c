@@ -38,6 +38,9 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define SEGOFS(x)	((SEGMENT(x) << 16) + OFFSET(x))
 #define LINEAR(x)	(void *) ((((x) >> 16) << 4) + ((x) & 0xFFFF))
 
+/* Any port not used by GRUB's own stack.  */
+#define GRUB_PXE_TFTP_CLIENT_PORT	2070
+
 struct grub_pxe_undi_open
 {
   grub_uint16_t status;
@@ -75,27 +78,6 @@ struct grub_pxe_undi_isr
   grub_uint8_t pkt_type;
 } GRUB_PACKED;
 
-enum
-  {
-    GRUB_PXE_ISR_IN_START = 1,
-    GRUB_PXE_ISR_IN_PROCESS,
-    GRUB_PXE_ISR_IN_GET_NEXT
-  };
-
-enum
-  {
-    GRUB_PXE_ISR_OUT_OURS = 0,
-    GRUB_PXE_ISR_OUT_NOT_OURS = 1
-  };
-
-enum
-  {
-    GRUB_PXE_ISR_OUT_DONE = 0,
-    GRUB_PXE_ISR_OUT_TRANSMIT = 2,
-    GRUB_PXE_ISR_OUT_RECEIVE = 3,
-    GRUB_PXE_ISR_OUT_BUSY = 4,
-  };
-
 struct grub_pxe_undi_transmit
 {
   grub_uint16_t status;
@@ -166,86 +148,74 @@ grub_pxe_scan (void)
   return bangpxe;
 }
 
-static struct grub_net_buff *
-grub_pxe_recv (struct grub_net_card *dev __attribute__ ((unused)))
+/* Frames taken from UNDI by the last grub_pxe_drain and not handed out
+   yet.  They are copied out of the scratch area at once, as sending
+   reuses it.  */
+static struct grub_net_buff *queue[GRUB_PXE_DRAIN_MAX_FRAMES];
+static unsigned queue_head, queue_len;
+static int in_progress = 0;
+
+static void
+grub_pxe_fill_queue (struct grub_net_card *dev)
 {
-  struct grub_pxe_undi_isr *isr;
-  static int in_progress = 0;
-  grub_uint8_t *ptr, *end;
+  grub_uint8_t *ptr;
   struct grub_net_buff *buf;
-
-  isr = (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
-
-  if (!in_progress)
+  unsigned n, i;
+  int res;
+
+  res = grub_pxe_drain (in_progress ? GRUB_PXE_ISR_IN_GET_NEXT
+			: GRUB_PXE_ISR_IN_START, pxe_rm_entry);
+  in_progress = !(res & GRUB_PXE_DRAIN_DONE);
+  n = res & ~GRUB_PXE_DRAIN_DONE;
+
+  queue_head = 0;
+  queue_len = 0;
+  ptr = (grub_uint8_t *) (GRUB_MEMORY_MACHINE_SCRATCH_ADDR
+			  + GRUB_PXE_DRAIN_RING);
+  for (i = 0; i < n; i++)
     {
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_START;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-      /* Normally according to the specification we should also check
-	 that isr->func_flag != GRUB_PXE_ISR_OUT_OURS but unfortunately it
-	 breaks on intel cards.
-       */
-      if (isr->status)
+      grub_uint16_t len = grub_get_unaligned16 (ptr);
+
+      ptr += 2;
+      buf = grub_net_card_alloc_buff (dev, len + 2);
+      /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is
+	 divisible by 4. So that IP header is aligned on 4 bytes. */
+      if (buf && grub_netbuff_reserve (buf, 2))
 	{
-	  in_progress = 0;
-	  return NULL;
+	  grub_netbuff_free (buf);
+	  buf = NULL;
 	}
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_PROCESS;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-    }
-  else
-    {
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_GET_NEXT;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-    }
-
-  while (isr->func_flag != GRUB_PXE_ISR_OUT_RECEIVE)
-    {
-      if (isr->status || isr->func_flag == GRUB_PXE_ISR_OUT_DONE)
+      if (buf)
 	{
-	  in_progress = 0;
-	  return NULL;
+	  grub_memcpy (buf->data, ptr, len);
+	  grub_netbuff_put (buf, len);
+	  queue[queue_len++] = buf;
 	}
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_GET_NEXT;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
+      ptr += len;
     }
+}
 
-  buf = grub_netbuff_alloc (isr->frame_len + 2);
-  if (!buf)
-    return NULL;
-  /* Reserve 2 bytes so that 2 + 14/18 bytes of ethernet header is divisible
-     by 4. So that IP header is aligned on 4 bytes. */
-  if (grub_netbuff_reserve (buf, 2))
+static void
+grub_pxe_flush_queue (void)
+{
+  while (queue_len)
     {
-      grub_netbuff_free (buf);
-      return NULL;
+      grub_netbuff_free (queue[queue_head++]);
+      queue_len--;
     }
-  ptr = buf->data;
-  end = ptr + isr->frame_len;
-  grub_netbuff_put (buf, isr->frame_len);
-  grub_memcpy (ptr, LINEAR (isr->buffer), isr->buffer_len);
-  ptr += isr->buffer_len;
-  while (ptr < end)
-    {
-      grub_memset (isr, 0, sizeof (*isr));
-      isr->func_flag = GRUB_PXE_ISR_IN_GET_NEXT;
-      grub_pxe_call (GRUB_PXENV_UNDI_ISR, isr, pxe_rm_entry);
-      if (isr->status || isr->func_flag != GRUB_PXE_ISR_OUT_RECEIVE)
-	{
-	  in_progress = 1;
-	  grub_netbuff_free (buf);
-	  return NULL;
-	}
+  in_progress = 0;
+}
 
-      grub_memcpy (ptr, LINEAR (isr->buffer), isr->buffer_len);
-      ptr += isr->buffer_len;
-    }
-  in_progress = 1;
+static struct grub_net_buff *
+grub_pxe_recv (struct grub_net_card *dev)
+{
+  if (!queue_len)
+    grub_pxe_fill_queue (dev);
+  if (!queue_len)
+    return NULL;
 
-  return buf;
+  queue_len--;
+  return queue[queue_head++];
 }
 
 static grub_err_t 
@@ -277,6 +247,7 @@ grub_pxe_send (struct grub_net_card *dev __attribute__ ((unused)),
 static void
 grub_pxe_close (struct grub_net_card *dev __attribute__ ((unused)))
 {
+  grub_pxe_flush_queue ();
   if (pxe_rm_entry)
     grub_pxe_call (GRUB_PXENV_UNDI_CLOSE,
 		   (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR,
@@ -311,6 +282,98 @@ struct grub_net_card grub_pxe_card =
   .name = "pxe"
 };
 
+/* Download the whole of FILENAME with the TFTP client of the PXE stack,
+   which doesn't take a trip through real mode for every packet.  */
+static grub_err_t
+grub_pxe_tftp_open (struct grub_file *file, const char *filename)
+{
+  struct grub_pxenv_tftp_get_fsize *fsize;
+  struct grub_pxenv_tftp_read_file *rf;
+  grub_net_network_level_address_t addr;
+  grub_uint32_t size;
+  grub_err_t err;
+  char *buf;
+
+  if (grub_strlen (filename) >= sizeof (rf->filename))
+    return grub_error (GRUB_ERR_BAD_FILENAME, N_("filename is too long"));
+
+  err = grub_net_resolve_address (file->device->net->server, &addr);
+  if (err)
+    return err;
+  if (addr.type != GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    return grub_error (GRUB_ERR_NET_BAD_ADDRESS,
+		       N_("PXE TFTP needs an IPv4 server"));
+
+  /* The PXE stack drives UNDI itself.  */
+  if (grub_pxe_card.opened)
+    grub_pxe_close (&grub_pxe_card);
+
+  fsize = (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
+  grub_memset (fsize, 0, sizeof (*fsize));
+  grub_strcpy ((char *) fsize->filename, filename);
+  fsize->server_ip = addr.ipv4;
+  grub_pxe_call (GRUB_PXENV_TFTP_GET_FSIZE, fsize, pxe_rm_entry);
+  if (fsize->status)
+    {
+      err = grub_error (GRUB_ERR_FILE_NOT_FOUND, N_("file `%s' not found"),
+			filename);
+      goto out;
+    }
+  size = fsize->file_size;
+
+  buf = grub_malloc (size ? : 1);
+  if (!buf)
+    {
+      err = grub_errno;
+      goto out;
+    }
+
+  rf = (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
+  grub_memset (rf, 0, sizeof (*rf));
+  grub_strcpy ((char *) rf->filename, filename);
+  rf->buffer_size = size;
+  rf->buffer = (grub_addr_t) buf;
+  rf->server_ip = addr.ipv4;
+  rf->client_port = grub_cpu_to_be16_compile_time (GRUB_PXE_TFTP_CLIENT_PORT);
+  rf->server_port = grub_cpu_to_be16_compile_time (GRUB_PXE_TFTP_PORT);
+  grub_pxe_call (GRUB_PXENV_TFTP_READ_FILE, rf, pxe_rm_entry);
+  if (rf->status || rf->buffer_size != size)
+    {
+      grub_free (buf);
+      err = grub_error (GRUB_ERR_FILE_READ_ERROR,
+			N_("couldn't download `%s'"), filename);
+      goto out;
+    }
+
+  file->size = size;
+  file->device->net->mem = buf;
+  file->device->net->eof = 1;
+  err = GRUB_ERR_NONE;
+
+ out:
+  if (grub_pxe_card.opened && grub_pxe_open (&grub_pxe_card))
+    {
+      grub_pxe_card.opened = 0;
+      grub_errno = err;
+    }
+  return err;
+}
+
+static grub_err_t
+grub_pxe_tftp_close (struct grub_file *file)
+{
+  grub_free (file->device->net->mem);
+  file->device->net->mem = 0;
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_net_app_protocol grub_pxe_tftp_protocol =
+  {
+    .name = "pxetftp",
+    .open = grub_pxe_tftp_open,
+    .close = grub_pxe_tftp_close
+  };
+
 static grub_err_t
 grub_pxe_shutdown (int flags)
 {
@@ -319,6 +382,7 @@ grub_pxe_shutdown (int flags)
   if (!pxe_rm_entry)
     return GRUB_ERR_NONE;
 
+  grub_pxe_flush_queue ();
   grub_pxe_call (GRUB_PXENV_UNDI_CLOSE,
 		 (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR,
 		 pxe_rm_entry);
@@ -329,6 +393,7 @@ grub_pxe_shutdown (int flags)
 		 (void *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR,
 		 pxe_rm_entry);
   pxe_rm_entry = 0;
+  grub_net_app_level_unregister (&grub_pxe_tftp_protocol);
   grub_net_card_unregister (&grub_pxe_card);
 
   return GRUB_ERR_NONE;
@@ -405,6 +470,7 @@ GRUB_MOD_INIT(pxe)
   grub_pxe_card.default_address.type = GRUB_NET_LINK_LEVEL_PROTOCOL_ETHERNET;
 
   grub_net_card_register (&grub_pxe_card);
+  grub_net_app_level_register (&grub_pxe_tftp_protocol);
   grub_pc_net_config = grub_pc_net_config_real;
   fini_hnd = grub_loader_register_preboot_hook (grub_pxe_shutdown,
 						grub_pxe_restore,
@@ -76,7 +76,12 @@ send_ethernet_packet (struct grub_net_network_level_interface *inf,
 	return err;
       inf->card->opened = 1;
     }
-  return inf->card->driver->send (inf->card, nb);
+  grub_net_stats.tx_packets++;
+  grub_net_stats.tx_bytes += nb->tail - nb->data;
+  err = inf->card->driver->send (inf->card, nb);
+  if (err)
+    grub_net_stats.tx_errors++;
+  return err;
 }
 
 grub_err_t
@@ -26,6 +26,10 @@
 #include <grub/dl.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/list.h>
+#include <grub/env.h>
+#include <grub/disk.h>
+#include <grub/extcmd.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -34,6 +38,25 @@ enum
     HTTP_PORT = 80
   };
 
+/* Files at least this large are downloaded over net_http_connections
+   connections at once when it is above 1.  */
+#define HTTP_PARALLEL_MIN_SIZE (16 << 20)
+#define HTTP_PARALLEL_MAX_CONNECTIONS 16
+/* Parts are multiples of this, so that most of them stay aligned.  */
+#define HTTP_PARALLEL_ALIGN (64 << 10)
+
+/* A connection to SERVER.  It belongs to DATA while it answers a request
+   and waits in idle_conns between requests (HTTP/1.1 keep-alive).  */
+struct http_conn
+{
+  struct http_conn *next;
+  struct http_conn **prev;
+  char *server;
+  grub_net_tcp_socket_t sock;
+  struct http_data *data;
+};
+
+static struct http_conn *idle_conns;
 
 typedef struct http_data
 {
@@ -43,12 +66,32 @@ typedef struct http_data
   int first_line_recv;
   int size_recv;
   grub_net_tcp_socket_t sock;
+  const char *server;
   char *filename;
   grub_err_t err;
   char *errmsg;
   int chunked;
   grub_size_t chunk_rem;
   int in_chunk_len;
+  struct http_conn *conn;
+  grub_uint64_t content_length;
+  grub_uint64_t body_recv;
+  int have_length;
+  int keep_alive;
+  int complete;
+  int status;
+  int accept_ranges;
+  /* The size of the whole file, from the Content-Range of a 206.  */
+  grub_uint64_t range_total;
+  int have_range_total;
+  /* The strong ETag, or else the Last-Modified date, of the file.  */
+  char validator[128];
+  grub_file_t file;
+  /* Set for the parts of a parallel download: the body goes to SINK, at
+     most SINK_LEN bytes, instead of the packet list of FILE.  */
+  char *sink;
+  grub_uint64_t sink_len;
+  int *wake;
 } *http_data_t;
 
 static grub_off_t
@@ -62,6 +105,22 @@ have_ahead (struct grub_file *file)
   return ret;
 }
 
+/* The whole body of the response has arrived.  */
+static void
+response_done (grub_file_t file, http_data_t data)
+{
+  data->complete = 1;
+  if (data->sink)
+    {
+      *data->wake = 1;
+      return;
+    }
+  file->device->net->eof = 1;
+  file->device->net->stall = 1;
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = have_ahead (file);
+}
+
 static grub_err_t
 parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 {
@@ -92,8 +151,13 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
   if (ptr == end)
     {
       data->headers_recv = 1;
-      if (data->chunked)
+      /* A range never comes chunked, and sinks can't take it.  */
+      if (data->sink && data->chunked)
+	data->err = GRUB_ERR_NET_UNKNOWN_ERROR;
+      else if (data->chunked)
 	data->in_chunk_len = 2;
+      else if (data->have_length && data->content_length == 0)
+	response_done (file, data);
       return GRUB_ERR_NONE;
     }
 
@@ -107,9 +171,11 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 	  return GRUB_ERR_NONE;
 	}
       ptr += sizeof ("HTTP/1.1 ") - 1;
+      data->keep_alive = 1;
       code = grub_strtoul (ptr, &ptr, 10);
       if (grub_errno)
 	return grub_errno;
+      data->status = code;
       switch (code)
 	{
 	case 200:
@@ -131,11 +197,50 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Content-Length: ", sizeof ("Content-Length: ") - 1)
-      == 0 && !data->size_recv)
+      == 0)
     {
       ptr += sizeof ("Content-Length: ") - 1;
-      file->size = grub_strtoull (ptr, &ptr, 10);
-      data->size_recv = 1;
+      data->content_length = grub_strtoull (ptr, &ptr, 10);
+      data->have_length = 1;
+      if (!data->size_recv)
+	{
+	  file->size = data->content_length;
+	  data->size_recv = 1;
+	}
+      return GRUB_ERR_NONE;
+    }
+  if (grub_strncasecmp (ptr, "Content-Range: bytes ",
+			sizeof ("Content-Range: bytes ") - 1) == 0)
+    {
+      char *slash = grub_strchr (ptr, '/');
+
+      if (slash && grub_isdigit (slash[1]))
+	{
+	  data->range_total = grub_strtoull (slash + 1, 0, 10);
+	  data->have_range_total = !grub_errno;
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      return GRUB_ERR_NONE;
+    }
+  if (grub_strncasecmp (ptr, "ETag: \"", sizeof ("ETag: \"") - 1) == 0
+      || (!data->validator[0]
+	  && grub_strncasecmp (ptr, "Last-Modified: ",
+			       sizeof ("Last-Modified: ") - 1) == 0))
+    {
+      if (grub_strlen (ptr) < sizeof (data->validator))
+	grub_strcpy (data->validator, ptr);
+      return GRUB_ERR_NONE;
+    }
+  if (grub_strncasecmp (ptr, "Accept-Ranges: bytes",
+			sizeof ("Accept-Ranges: bytes") - 1) == 0)
+    {
+      data->accept_ranges = 1;
+      return GRUB_ERR_NONE;
+    }
+  if (grub_strncasecmp (ptr, "Connection: close",
+			sizeof ("Connection: close") - 1) == 0)
+    {
+      data->keep_alive = 0;
       return GRUB_ERR_NONE;
     }
   if (grub_memcmp (ptr, "Transfer-Encoding: chunked",
@@ -150,17 +255,35 @@ parse_line (grub_file_t file, http_data_t data, char *ptr, grub_size_t len)
 
 static void
 http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
-	  void *f)
+	  void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  http_data_t data = conn->data;
+  grub_file_t file;
 
+  /* An idle connection the server gave up on.  */
+  if (!data)
+    {
+      grub_list_remove (GRUB_AS_LIST (conn));
+      grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+      grub_free (conn->server);
+      grub_free (conn);
+      return;
+    }
+
+  file = data->file;
   if (data->sock)
     grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
   data->sock = 0;
+  conn->sock = 0;
   if (data->current_line)
     grub_free (data->current_line);
   data->current_line = 0;
+  if (data->sink)
+    {
+      *data->wake = 1;
+      return;
+    }
   file->device->net->eof = 1;
   file->device->net->stall = 1;
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
@@ -170,13 +293,21 @@ http_err (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 static grub_err_t
 http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
-	      void *f)
+	      void *c)
 {
-  grub_file_t file = f;
-  http_data_t data = file->data;
+  struct http_conn *conn = c;
+  http_data_t data = conn->data;
+  grub_file_t file;
   grub_err_t err;
 
-  if (!data->sock)
+  if (!data)
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  file = data->file;
+  if (!data->sock || data->complete || (data->sink && data->err))
     {
       grub_netbuff_free (nb);
       return GRUB_ERR_NONE;
@@ -272,6 +403,34 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
       if (!(data->chunked && (grub_ssize_t) data->chunk_rem
 	    < nb->tail - nb->data))
 	{
+	  if (data->sink)
+	    {
+	      grub_uint64_t len = nb->tail - nb->data;
+
+	      if (len > data->sink_len - data->body_recv)
+		len = data->sink_len - data->body_recv;
+	      grub_memcpy (data->sink + data->body_recv, nb->data, len);
+	      data->body_recv += len;
+	      grub_netbuff_free (nb);
+	      if (data->body_recv == data->sink_len)
+		response_done (file, data);
+	      return GRUB_ERR_NONE;
+	    }
+	  if (!data->chunked && data->have_length)
+	    {
+	      grub_uint64_t left = data->content_length - data->body_recv;
+
+	      if ((grub_uint64_t) (nb->tail - nb->data) > left)
+		grub_netbuff_unput (nb, (nb->tail - nb->data) - left);
+	      data->body_recv += nb->tail - nb->data;
+	      if (data->body_recv == data->content_length)
+		response_done (file, data);
+	      if (nb->tail == nb->data)
+		{
+		  grub_netbuff_free (nb);
+		  return GRUB_ERR_NONE;
+		}
+	    }
 	  grub_net_put_packet (&file->device->net->packs, nb);
 	  if (file->device->net->packs.count >= 20)
 	    file->device->net->stall = 1;
@@ -304,12 +463,13 @@ http_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
     }
 }
 
-static grub_err_t
-http_establish (struct grub_file *file, grub_off_t offset, int initial)
+/* Build the request for DATA, for the bytes from OFFSET to END, or to the
+   end of the file if END is 0, unless INITIAL.  */
+static struct grub_net_buff *
+http_request (http_data_t data, grub_off_t offset, grub_off_t end,
+	      int initial)
 {
-  http_data_t data = file->data;
   grub_uint8_t *ptr;
-  int i;
   struct grub_net_buff *nb;
   grub_err_t err;
 
@@ -317,13 +477,13 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
 			   + sizeof ("GET ") - 1
 			   + grub_strlen (data->filename)
 			   + sizeof (" HTTP/1.1\r\nHost: ") - 1
-			   + grub_strlen (file->device->net->server)
+			   + grub_strlen (data->server)
 			   + sizeof ("\r\nUser-Agent: " PACKAGE_STRING
 				     "\r\n") - 1
 			   + sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX"
-				     "-\r\n\r\n"));
+				     "-XXXXXXXXXXXXXXXXXXXX\r\n\r\n"));
   if (!nb)
-    return grub_errno;
+    return NULL;
 
   grub_netbuff_reserve (nb, GRUB_NET_TCP_RESERVE_SIZE);
   ptr = nb->tail;
@@ -331,7 +491,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "GET ", sizeof ("GET ") - 1);
 
@@ -341,7 +501,7 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, data->filename, grub_strlen (data->filename));
 
@@ -350,20 +510,19 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, " HTTP/1.1\r\nHost: ",
 	       sizeof (" HTTP/1.1\r\nHost: ") - 1);
 
   ptr = nb->tail;
-  err = grub_netbuff_put (nb, grub_strlen (file->device->net->server));
+  err = grub_netbuff_put (nb, grub_strlen (data->server));
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
-  grub_memcpy (ptr, file->device->net->server,
-	       grub_strlen (file->device->net->server));
+  grub_memcpy (ptr, data->server, grub_strlen (data->server));
 
   ptr = nb->tail;
   err = grub_netbuff_put (nb, 
@@ -372,53 +531,159 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   if (err)
     {
       grub_netbuff_free (nb);
-      return err;
+      return NULL;
     }
   grub_memcpy (ptr, "\r\nUser-Agent: " PACKAGE_STRING "\r\n",
 	       sizeof ("\r\nUser-Agent: " PACKAGE_STRING "\r\n") - 1);
   if (!initial)
     {
       ptr = nb->tail;
-      grub_snprintf ((char *) ptr,
-		     sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
-			     "\r\n"
-			     "\r\n"),
-		     "Range: bytes=%" PRIuGRUB_UINT64_T "-\r\n\r\n",
-		     offset);
+      if (end)
+	grub_snprintf ((char *) ptr,
+		       sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
+			       "XXXXXXXXXXXXXXXXXXXX\r\n"),
+		       "Range: bytes=%" PRIuGRUB_UINT64_T "-%"
+		       PRIuGRUB_UINT64_T "\r\n", offset, end - 1);
+      else
+	grub_snprintf ((char *) ptr,
+		       sizeof ("Range: bytes=XXXXXXXXXXXXXXXXXXXX-"
+			       "\r\n"),
+		       "Range: bytes=%" PRIuGRUB_UINT64_T "-\r\n",
+		       offset);
       grub_netbuff_put (nb, grub_strlen ((char *) ptr));
     }
   ptr = nb->tail;
   grub_netbuff_put (nb, 2);
   grub_memcpy (ptr, "\r\n", 2);
+  return nb;
+}
+
+/* Hand DATA a connection to its server, an idle one if there is any.  */
+static grub_err_t
+http_connect (http_data_t data, int *reused)
+{
+  struct http_conn *conn;
+
+  FOR_LIST_ELEMENTS (conn, idle_conns)
+    if (grub_strcmp (conn->server, data->server) == 0)
+      break;
 
-  data->sock = grub_net_tcp_open (file->device->net->server,
-				  HTTP_PORT, http_receive,
-				  http_err, http_err,
-				  file);
-  if (!data->sock)
+  if (conn)
     {
-      grub_netbuff_free (nb);
-      return grub_errno;
+      grub_list_remove (GRUB_AS_LIST (conn));
+      *reused = 1;
+    }
+  else
+    {
+      conn = grub_zalloc (sizeof (*conn));
+      if (!conn)
+	return grub_errno;
+      conn->server = grub_strdup (data->server);
+      if (!conn->server)
+	{
+	  grub_free (conn);
+	  return grub_errno;
+	}
+      conn->sock = grub_net_tcp_open (conn->server,
+				      HTTP_PORT, http_receive,
+				      http_err, http_err,
+				      conn);
+      if (!conn->sock)
+	{
+	  grub_free (conn->server);
+	  grub_free (conn);
+	  return grub_errno;
+	}
+      *reused = 0;
     }
 
-  //  grub_net_poll_cards (5000);
+  conn->data = data;
+  data->conn = conn;
+  data->sock = conn->sock;
+  return GRUB_ERR_NONE;
+}
 
-  err = grub_net_send_tcp_packet (data->sock, nb, 1);
-  if (err)
+/* Take the connection back from DATA, keeping it for the next request
+   if the response was read in full and the server allows it.  Chunked
+   responses aren't reused as their final CRLF may still be on the way.  */
+static void
+http_release (http_data_t data)
+{
+  struct http_conn *conn = data->conn;
+
+  if (!conn)
+    return;
+  data->conn = 0;
+  data->sock = 0;
+
+  if (conn->sock && data->complete && data->keep_alive && !data->chunked
+      && !data->err && data->have_length
+      && data->body_recv == data->content_length)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
-      return err;
+      conn->data = 0;
+      grub_net_tcp_unstall (conn->sock);
+      grub_list_push (GRUB_AS_LIST_P (&idle_conns), GRUB_AS_LIST (conn));
+      return;
     }
 
-  for (i = 0; !data->headers_recv && i < 100; i++)
+  if (conn->sock)
+    grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+  grub_free (conn->server);
+  grub_free (conn);
+}
+
+static grub_err_t
+http_establish (struct grub_file *file, grub_off_t offset, int initial)
+{
+  http_data_t data = file->data;
+  int i, attempt, reused;
+  struct grub_net_buff *nb;
+  grub_err_t err;
+
+  for (attempt = 0; ; attempt++)
     {
-      grub_net_tcp_retransmit ();
-      grub_net_poll_cards (300, &data->headers_recv);
+      nb = http_request (data, offset, 0, initial);
+      if (!nb)
+	return grub_errno;
+
+      err = http_connect (data, &reused);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
+
+      err = grub_net_send_tcp_packet (data->sock, nb, 1);
+      if (err)
+	{
+	  http_release (data);
+	  return err;
+	}
+
+      for (i = 0; !data->headers_recv && data->sock && i < 100; i++)
+	{
+	  grub_net_tcp_retransmit ();
+	  grub_net_poll_cards (300, &data->headers_recv);
+	}
+
+      /* The server closed the idle connection before answering, try again
+	 on a new one.  */
+      if (!data->headers_recv && !data->sock && reused && attempt == 0
+	  && !data->first_line_recv && !data->current_line && !data->err)
+	{
+	  http_release (data);
+	  file->device->net->eof = 0;
+	  file->device->net->stall = 0;
+	  if (!data->size_recv)
+	    file->size = GRUB_FILE_SIZE_UNKNOWN;
+	  continue;
+	}
+      break;
     }
 
   if (!data->headers_recv)
     {
-      grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+      http_release (data);
       if (data->err)
 	{
 	  char *str = data->errmsg;
@@ -432,16 +697,242 @@ http_establish (struct grub_file *file, grub_off_t offset, int initial)
   return GRUB_ERR_NONE;
 }
 
+/* Send the request for the part DATA is still missing.  */
+static grub_err_t
+http_part_start (http_data_t data, grub_uint64_t start)
+{
+  struct grub_net_buff *nb;
+  int reused;
+  grub_err_t err;
+
+  grub_free (data->current_line);
+  data->current_line = 0;
+  data->current_line_len = 0;
+  data->in_chunk_len = 0;
+  data->headers_recv = 0;
+  data->first_line_recv = 0;
+  data->chunked = 0;
+  data->have_length = 0;
+  data->keep_alive = 0;
+  data->status = 0;
+  data->complete = 0;
+
+  nb = http_request (data, start + data->body_recv,
+		     start + data->sink_len, 0);
+  if (!nb)
+    return grub_errno;
+  err = http_connect (data, &reused);
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      return err;
+    }
+  err = grub_net_send_tcp_packet (data->sock, nb, 1);
+  if (err)
+    http_release (data);
+  return err;
+}
+
+static unsigned
+http_parallel_connections (void)
+{
+  const char *val = grub_env_get ("net_http_connections");
+  unsigned long n;
+
+  if (!val)
+    return 1;
+  n = grub_strtoul (val, 0, 0);
+  if (grub_errno)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 1;
+    }
+  if (n > HTTP_PARALLEL_MAX_CONNECTIONS)
+    n = HTTP_PARALLEL_MAX_CONNECTIONS;
+  return n ? n : 1;
+}
+
+/* Wait for the N parts of FILENAME in PARTS, each a range from STARTS on
+   arriving into its sink, restarting the ones whose connection drops at
+   most GRUB_NET_TRIES times as counted in TRIES.  If ORIGINAL, the first
+   part is the response to a plain request and so may be a 200.  */
+static grub_err_t
+http_wait_parts (http_data_t *parts, grub_uint64_t *starts, int *tries,
+		 unsigned n, int original, const char *filename, int *wake)
+{
+  grub_uint64_t total, last_total = 0;
+  unsigned i, idle = 0;
+
+  while (1)
+    {
+      int done = 1;
+
+      total = 0;
+      for (i = 0; i < n; i++)
+	{
+	  http_data_t part = parts[i];
+
+	  total += part->body_recv;
+	  if (part->complete)
+	    continue;
+	  done = 0;
+
+	  /* Nothing but the original response may be anything else than
+	     the 206 answering a range.  */
+	  if (part->sock && part->headers_recv && !part->err
+	      && (part->chunked
+		  || ((i || tries[i] || !original) && part->status != 206)))
+	    part->err = GRUB_ERR_NET_UNKNOWN_ERROR;
+
+	  if (part->err)
+	    return grub_error (part->err, N_("couldn't download `%s'"),
+			       filename);
+	  if (part->sock)
+	    continue;
+	  if (++tries[i] > GRUB_NET_TRIES)
+	    return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			       N_("couldn't download `%s'"), filename);
+	  http_release (part);
+	  if (http_part_start (part, starts[i]))
+	    grub_errno = GRUB_ERR_NONE;
+	}
+      if (done)
+	return GRUB_ERR_NONE;
+
+      if (total != last_total)
+	{
+	  last_total = total;
+	  idle = 0;
+	}
+      else if (++idle > 100)
+	return grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"),
+			   filename);
+
+      *wake = 0;
+      grub_net_poll_cards (300, wake);
+    }
+}
+
+/* Download FILE, whose response is arriving on its own connection, in
+   N byte ranges over N connections into one buffer which then serves all
+   the reads.  The current response becomes the first range.  Falls back
+   to streaming when there isn't enough memory.  */
+static grub_err_t
+http_parallel_download (grub_file_t file, unsigned n)
+{
+  http_data_t data = file->data;
+  http_data_t *parts;
+  grub_uint64_t size = file->size, part_size;
+  grub_uint64_t *starts;
+  int *tries;
+  char *buf;
+  int wake = 0;
+  unsigned i;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  part_size = ALIGN_UP (size / n, HTTP_PARALLEL_ALIGN);
+  n = (size + part_size - 1) / part_size;
+  if (n < 2)
+    return GRUB_ERR_NONE;
+
+  buf = grub_malloc (size);
+  parts = grub_zalloc (n * sizeof (parts[0]));
+  starts = grub_malloc (n * sizeof (starts[0]));
+  tries = grub_zalloc (n * sizeof (tries[0]));
+  if (!buf || !parts || !starts || !tries)
+    {
+      grub_free (buf);
+      grub_free (parts);
+      grub_free (starts);
+      grub_free (tries);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+
+  /* Move what the first range already received into the buffer.  */
+  data->sink = buf;
+  data->sink_len = part_size;
+  data->wake = &wake;
+  data->body_recv = 0;
+  while (file->device->net->packs.first)
+    {
+      struct grub_net_buff *nb = file->device->net->packs.first->nb;
+      grub_uint64_t len = nb->tail - nb->data;
+
+      if (len > data->sink_len - data->body_recv)
+	len = data->sink_len - data->body_recv;
+      grub_memcpy (buf + data->body_recv, nb->data, len);
+      data->body_recv += len;
+      grub_netbuff_free (nb);
+      grub_net_remove_packet (file->device->net->packs.first);
+    }
+  if (data->body_recv == data->sink_len)
+    data->complete = 1;
+  file->device->net->stall = 0;
+  if (data->sock)
+    grub_net_tcp_unstall (data->sock);
+  parts[0] = data;
+  starts[0] = 0;
+
+  for (i = 1; i < n; i++)
+    {
+      parts[i] = grub_zalloc (sizeof (*parts[i]));
+      if (!parts[i])
+	{
+	  err = grub_errno;
+	  goto out;
+	}
+      parts[i]->file = file;
+      parts[i]->server = data->server;
+      parts[i]->filename = data->filename;
+      parts[i]->size_recv = 1;
+      parts[i]->wake = &wake;
+      starts[i] = i * part_size;
+      parts[i]->sink = buf + starts[i];
+      parts[i]->sink_len = (i == n - 1) ? size - starts[i] : part_size;
+      /* A failed start is retried below like a dropped connection.  */
+      if (http_part_start (parts[i], starts[i]))
+	grub_errno = GRUB_ERR_NONE;
+    }
+
+  err = http_wait_parts (parts, starts, tries, n, 1, data->filename, &wake);
+  if (err)
+    goto out;
+
+  file->device->net->mem = buf;
+  file->device->net->eof = 1;
+  buf = NULL;
+
+ out:
+  for (i = 0; i < n; i++)
+    if (parts[i])
+      {
+	http_release (parts[i]);
+	parts[i]->sink = 0;
+	if (i)
+	  {
+	    grub_free (parts[i]->current_line);
+	    grub_free (parts[i]->errmsg);
+	    grub_free (parts[i]);
+	  }
+      }
+  grub_free (buf);
+  grub_free (parts);
+  grub_free (starts);
+  grub_free (tries);
+  return err;
+}
+
 static grub_err_t
 http_seek (struct grub_file *file, grub_off_t off)
 {
   struct http_data *old_data, *data;
   grub_err_t err;
   old_data = file->data;
-  /* FIXME: Reuse socket?  */
-  if (old_data->sock)
-    grub_net_tcp_close (old_data->sock, GRUB_NET_TCP_ABORT);
-  old_data->sock = 0;
+  http_release (old_data);
+  if (old_data->current_line)
+    grub_free (old_data->current_line);
+  old_data->current_line = 0;
 
   while (file->device->net->packs.first)
     {
@@ -450,6 +941,7 @@ http_seek (struct grub_file *file, grub_off_t off)
     }
 
   file->device->net->stall = 0;
+  file->device->net->eof = 0;
   file->device->net->offset = off;
 
   data = grub_zalloc (sizeof (*data));
@@ -457,6 +949,8 @@ http_seek (struct grub_file *file, grub_off_t off)
     return grub_errno;
 
   data->size_recv = 1;
+  data->file = file;
+  data->server = old_data->server;
   data->filename = old_data->filename;
   if (!data->filename)
     {
@@ -483,6 +977,7 @@ http_open (struct grub_file *file, const char *filename)
 {
   grub_err_t err;
   struct http_data *data;
+  char *key = NULL;
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
@@ -498,6 +993,8 @@ http_open (struct grub_file *file, const char *filename)
 
   file->not_easily_seekable = 0;
   file->data = data;
+  data->file = file;
+  data->server = file->device->net->server;
 
   err = http_establish (file, 0, 1);
   if (err)
@@ -507,6 +1004,49 @@ http_open (struct grub_file *file, const char *filename)
       return err;
     }
 
+  /* A version of the file the cache has is read from there.  Others are
+     downloaded whole so that the cache can keep them.  */
+  if (grub_net_cache_lookup && data->validator[0] && data->status == 200
+      && data->have_length && !data->chunked && !data->err)
+    {
+      key = grub_xasprintf ("http://%s%s", data->server, data->filename);
+      if (key)
+	file->device->net->mem = grub_net_cache_lookup (key, data->validator,
+							file->size);
+      grub_errno = GRUB_ERR_NONE;
+      if (file->device->net->mem)
+	{
+	  /* Drops the rest of the response unless it's in already.  */
+	  http_release (data);
+	  file->device->net->eof = 1;
+	  grub_free (key);
+	  return GRUB_ERR_NONE;
+	}
+    }
+
+  if (data->accept_ranges && data->have_length && !data->chunked
+      && !data->err && (file->size >= HTTP_PARALLEL_MIN_SIZE || key))
+    {
+      unsigned n = http_parallel_connections ();
+
+      if (n > 1 || key)
+	err = http_parallel_download (file, n > 1 ? n : 2);
+      if (err)
+	{
+	  http_release (data);
+	  grub_free (data->current_line);
+	  grub_free (data->errmsg);
+	  grub_free (data->filename);
+	  grub_free (data);
+	  grub_free (key);
+	  return err;
+	}
+    }
+
+  if (key && file->device->net->mem)
+    grub_net_cache_store (key, data->validator, file->device->net->mem,
+			  file->size);
+  grub_free (key);
   return GRUB_ERR_NONE;
 }
 
@@ -518,12 +1058,13 @@ http_close (struct grub_file *file)
   if (!data)
     return GRUB_ERR_NONE;
 
-  if (data->sock)
-    grub_net_tcp_close (data->sock, GRUB_NET_TCP_ABORT);
+  http_release (data);
   if (data->current_line)
     grub_free (data->current_line);
   grub_free (data->filename);
   grub_free (data);
+  grub_free (file->device->net->mem);
+  file->device->net->mem = 0;
   return GRUB_ERR_NONE;
 }
 
@@ -542,6 +1083,461 @@ http_packets_pulled (struct grub_file *file)
   return 0;
 }
 
+/* httpdisk: a remote image as a disk, read in blocks fetched with range
+   requests on the kept-alive connections, so that loopback and the
+   filesystems can use an image without downloading all of it.  */
+
+#define HTTPDISK_BLOCK_SIZE (128 << 10)
+#define HTTPDISK_CACHE_BLOCKS 32
+/* Reads are served this many blocks at a time, half the cache, so that
+   the blocks of one never push each other out.  */
+#define HTTPDISK_WINDOW (HTTPDISK_CACHE_BLOCKS / 2)
+/* Blocks fetched ahead of a read which continues the one before.  */
+#define HTTPDISK_READ_AHEAD 4
+
+struct httpdisk_block
+{
+  grub_uint64_t index;
+  char *data;
+  unsigned long last_use;
+};
+
+struct httpdisk
+{
+  struct httpdisk *next;
+  char *devname;
+  char *server;
+  char *filename;
+  unsigned long id;
+  grub_uint64_t size;
+  /* The block after the last one read, to tell sequential reads.  */
+  grub_uint64_t next_block;
+  struct httpdisk_block cache[HTTPDISK_CACHE_BLOCKS];
+};
+
+static struct httpdisk *httpdisk_list;
+static unsigned long httpdisk_last_id;
+static unsigned long httpdisk_clock;
+/* Set while a read relies on the blocks it fetched staying cached.  */
+static int httpdisk_busy;
+
+static struct httpdisk_block *
+httpdisk_lookup (struct httpdisk *dev, grub_uint64_t index)
+{
+  unsigned i;
+
+  for (i = 0; i < HTTPDISK_CACHE_BLOCKS; i++)
+    if (dev->cache[i].data && dev->cache[i].index == index)
+      {
+	dev->cache[i].last_use = ++httpdisk_clock;
+	return &dev->cache[i];
+      }
+  return NULL;
+}
+
+/* Cache DATA as block INDEX of DEV in place of the least recently used.  */
+static void
+httpdisk_insert (struct httpdisk *dev, grub_uint64_t index, char *data)
+{
+  struct httpdisk_block *victim = &dev->cache[0];
+  unsigned i;
+
+  for (i = 0; i < HTTPDISK_CACHE_BLOCKS; i++)
+    {
+      if (!dev->cache[i].data)
+	{
+	  victim = &dev->cache[i];
+	  break;
+	}
+      if (dev->cache[i].last_use < victim->last_use)
+	victim = &dev->cache[i];
+    }
+  grub_free (victim->data);
+  victim->index = index;
+  victim->data = data;
+  victim->last_use = ++httpdisk_clock;
+}
+
+static grub_uint64_t
+httpdisk_block_len (struct httpdisk *dev, grub_uint64_t index)
+{
+  grub_uint64_t left = dev->size - index * HTTPDISK_BLOCK_SIZE;
+
+  return left < HTTPDISK_BLOCK_SIZE ? left : HTTPDISK_BLOCK_SIZE;
+}
+
+/* Fetch the blocks FIRST to LAST of DEV which aren't cached, one range
+   request each, over up to net_http_connections connections at once.  */
+static grub_err_t
+httpdisk_fill (struct httpdisk *dev, grub_uint64_t first, grub_uint64_t last)
+{
+  http_data_t parts[HTTPDISK_WINDOW + HTTPDISK_READ_AHEAD];
+  grub_uint64_t starts[HTTPDISK_WINDOW + HTTPDISK_READ_AHEAD];
+  grub_uint64_t missing[HTTPDISK_WINDOW + HTTPDISK_READ_AHEAD];
+  int tries[HTTPDISK_WINDOW + HTTPDISK_READ_AHEAD];
+  unsigned n = 0, done, batch, started, i, conns;
+  grub_err_t err = GRUB_ERR_NONE;
+  grub_uint64_t b;
+  int wake = 0;
+
+  for (b = first; b <= last && n < ARRAY_SIZE (missing); b++)
+    if (!httpdisk_lookup (dev, b))
+      missing[n++] = b;
+
+  conns = http_parallel_connections ();
+  for (done = 0; done < n && !err; done += batch)
+    {
+      batch = n - done;
+      if (batch > conns)
+	batch = conns;
+
+      for (started = 0; started < batch; started++)
+	{
+	  http_data_t part = grub_zalloc (sizeof (*part));
+	  char *buf = grub_malloc (HTTPDISK_BLOCK_SIZE);
+
+	  if (!part || !buf)
+	    {
+	      grub_free (part);
+	      grub_free (buf);
+	      err = grub_errno;
+	      break;
+	    }
+	  part->server = dev->server;
+	  part->filename = dev->filename;
+	  part->size_recv = 1;
+	  part->wake = &wake;
+	  part->sink = buf;
+	  part->sink_len = httpdisk_block_len (dev, missing[done + started]);
+	  parts[started] = part;
+	  starts[started] = missing[done + started] * HTTPDISK_BLOCK_SIZE;
+	  tries[started] = 0;
+	  /* A failed start is retried like a dropped connection.  */
+	  if (http_part_start (part, starts[started]))
+	    grub_errno = GRUB_ERR_NONE;
+	}
+
+      if (!err)
+	err = http_wait_parts (parts, starts, tries, batch, 0, dev->filename,
+			       &wake);
+
+      for (i = 0; i < started; i++)
+	{
+	  http_release (parts[i]);
+	  if (err)
+	    grub_free (parts[i]->sink);
+	  else
+	    httpdisk_insert (dev, missing[done + i], parts[i]->sink);
+	  grub_free (parts[i]->current_line);
+	  grub_free (parts[i]->errmsg);
+	  grub_free (parts[i]);
+	}
+    }
+  return err;
+}
+
+static grub_err_t
+grub_httpdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		    grub_size_t size, char *buf)
+{
+  struct httpdisk *dev = disk->data;
+  grub_uint64_t off = sector << GRUB_DISK_SECTOR_BITS;
+  grub_uint64_t end = off + ((grub_uint64_t) size << GRUB_DISK_SECTOR_BITS);
+  grub_uint64_t nblocks = (dev->size + HTTPDISK_BLOCK_SIZE - 1)
+    / HTTPDISK_BLOCK_SIZE;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  httpdisk_busy = 1;
+  while (off < end)
+    {
+      grub_uint64_t first = off / HTTPDISK_BLOCK_SIZE;
+      grub_uint64_t last = (end - 1) / HTTPDISK_BLOCK_SIZE;
+      grub_uint64_t fetch, b;
+
+      if (last - first >= HTTPDISK_WINDOW)
+	last = first + HTTPDISK_WINDOW - 1;
+      fetch = last;
+      if (first == dev->next_block || first + 1 == dev->next_block)
+	fetch += HTTPDISK_READ_AHEAD;
+      if (fetch >= nblocks)
+	fetch = nblocks - 1;
+      dev->next_block = last + 1;
+
+      err = httpdisk_fill (dev, first, fetch);
+      if (err)
+	break;
+
+      for (b = first; b <= last; b++)
+	{
+	  struct httpdisk_block *blk = httpdisk_lookup (dev, b);
+	  grub_uint64_t start = b * HTTPDISK_BLOCK_SIZE;
+	  grub_uint64_t from = off - start, to, avail;
+
+	  if (!blk)
+	    {
+	      err = grub_error (GRUB_ERR_READ_ERROR,
+				N_("couldn't download `%s'"), dev->filename);
+	      goto out;
+	    }
+	  to = end - start < HTTPDISK_BLOCK_SIZE ? end - start
+	    : HTTPDISK_BLOCK_SIZE;
+	  /* The last sector may reach past the end of the file.  */
+	  avail = httpdisk_block_len (dev, b);
+	  if (avail > to)
+	    avail = to;
+	  if (from < avail)
+	    {
+	      grub_memcpy (buf, blk->data + from, avail - from);
+	      grub_memset (buf + (avail - from), 0, to - avail);
+	    }
+	  else
+	    grub_memset (buf, 0, to - from);
+	  buf += to - from;
+	  off = start + to;
+	}
+    }
+
+ out:
+  httpdisk_busy = 0;
+  return err;
+}
+
+static grub_err_t
+grub_httpdisk_write (grub_disk_t disk __attribute__ ((unused)),
+		     grub_disk_addr_t sector __attribute__ ((unused)),
+		     grub_size_t size __attribute__ ((unused)),
+		     const char *buf __attribute__ ((unused)))
+{
+  return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		     "httpdisk write is not supported");
+}
+
+static int
+grub_httpdisk_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		       grub_disk_pull_t pull)
+{
+  struct httpdisk *dev;
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+  for (dev = httpdisk_list; dev; dev = dev->next)
+    if (hook (dev->devname, hook_data))
+      return 1;
+  return 0;
+}
+
+static grub_err_t
+grub_httpdisk_open (const char *name, grub_disk_t disk)
+{
+  struct httpdisk *dev;
+
+  for (dev = httpdisk_list; dev; dev = dev->next)
+    if (grub_strcmp (dev->devname, name) == 0)
+      break;
+  if (!dev)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
+
+  disk->total_sectors = ((dev->size + GRUB_DISK_SECTOR_SIZE - 1)
+			 >> GRUB_DISK_SECTOR_BITS);
+  disk->max_agglomerate = ((HTTPDISK_WINDOW * HTTPDISK_BLOCK_SIZE)
+			   >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS));
+  disk->id = dev->id;
+  disk->data = dev;
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_httpdisk_close (grub_disk_t disk __attribute__ ((unused)))
+{
+}
+
+static struct grub_disk_dev grub_httpdisk_dev =
+  {
+    .name = "httpdisk",
+    .id = GRUB_DISK_DEVICE_HTTPDISK_ID,
+    .iterate = grub_httpdisk_iterate,
+    .open = grub_httpdisk_open,
+    .close = grub_httpdisk_close,
+    .read = grub_httpdisk_read,
+    .write = grub_httpdisk_write,
+    .next = 0
+  };
+
+static void
+httpdisk_free (struct httpdisk *dev)
+{
+  unsigned i;
+
+  for (i = 0; i < HTTPDISK_CACHE_BLOCKS; i++)
+    grub_free (dev->cache[i].data);
+  grub_free (dev->devname);
+  grub_free (dev->server);
+  grub_free (dev->filename);
+  grub_free (dev);
+}
+
+static grub_err_t
+httpdisk_delete (const char *name)
+{
+  struct httpdisk *dev, **prev;
+
+  for (prev = &httpdisk_list; *prev; prev = &(*prev)->next)
+    if (grub_strcmp ((*prev)->devname, name) == 0)
+      break;
+  if (!*prev)
+    return grub_error (GRUB_ERR_BAD_DEVICE, "device not found");
+
+  dev = *prev;
+  *prev = dev->next;
+  httpdisk_free (dev);
+  return GRUB_ERR_NONE;
+}
+
+/* Learn the size of the file of DEV from the answer to a range request
+   for its first byte, which also checks that the server takes ranges.  */
+static grub_err_t
+httpdisk_probe (struct httpdisk *dev)
+{
+  http_data_t part;
+  grub_uint64_t start = 0;
+  int tries = 0, wake = 0;
+  grub_err_t err;
+  char byte;
+
+  part = grub_zalloc (sizeof (*part));
+  if (!part)
+    return grub_errno;
+  part->server = dev->server;
+  part->filename = dev->filename;
+  part->size_recv = 1;
+  part->wake = &wake;
+  part->sink = &byte;
+  part->sink_len = 1;
+  if (http_part_start (part, 0))
+    grub_errno = GRUB_ERR_NONE;
+
+  err = http_wait_parts (&part, &start, &tries, 1, 0, dev->filename, &wake);
+  if (!err && (!part->have_range_total || !part->range_total))
+    err = grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		      N_("server doesn't give the size of `%s'"),
+		      dev->filename);
+  dev->size = part->range_total;
+
+  http_release (part);
+  grub_free (part->current_line);
+  grub_free (part->errmsg);
+  grub_free (part);
+  return err;
+}
+
+static grub_err_t
+grub_cmd_httpdisk (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  struct httpdisk *dev;
+  const char *server, *path;
+  char *device;
+  grub_err_t err;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "device name required");
+  if (state[0].set)
+    return httpdisk_delete (args[0]);
+  if (argc < 2)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("filename expected"));
+
+  device = grub_file_get_device_name (args[1]);
+  if (!device)
+    return grub_errno ? : grub_error (GRUB_ERR_BAD_ARGUMENT,
+				      "(http,SERVER)/FILE expected");
+  if (grub_strcmp (device, "http") == 0)
+    server = grub_env_get ("net_default_server") ? :
+      grub_env_get ("pxe_default_server");
+  else if (grub_strncmp (device, "http,", sizeof ("http,") - 1) == 0)
+    server = device + sizeof ("http,") - 1;
+  else
+    server = NULL;
+  path = grub_strchr (args[1], ')') + 1;
+  if (!server || !*server || *path != '/')
+    {
+      grub_free (device);
+      return grub_error (GRUB_ERR_BAD_ARGUMENT, "(http,SERVER)/FILE expected");
+    }
+
+  dev = grub_zalloc (sizeof (*dev));
+  if (!dev)
+    {
+      grub_free (device);
+      return grub_errno;
+    }
+  dev->devname = grub_strdup (args[0]);
+  dev->server = grub_strdup (server);
+  dev->filename = grub_strdup (path);
+  grub_free (device);
+  if (!dev->devname || !dev->server || !dev->filename)
+    {
+      httpdisk_free (dev);
+      return grub_errno;
+    }
+
+  err = httpdisk_probe (dev);
+  if (err)
+    {
+      httpdisk_free (dev);
+      return err;
+    }
+
+  /* Replace the device of the same name, if there is one.  */
+  if (httpdisk_delete (args[0]))
+    grub_errno = GRUB_ERR_NONE;
+  dev->id = httpdisk_last_id++;
+  dev->next = httpdisk_list;
+  httpdisk_list = dev;
+  return GRUB_ERR_NONE;
+}
+
+/* Drop the least recently used blocks of every httpdisk, unless a read is
+   using them.  */
+static grub_size_t
+httpdisk_shrink (grub_size_t bytes)
+{
+  grub_size_t freed = 0;
+
+  if (httpdisk_busy)
+    return 0;
+  while (freed < bytes)
+    {
+      struct httpdisk_block *victim = NULL;
+      struct httpdisk *dev;
+      unsigned i;
+
+      for (dev = httpdisk_list; dev; dev = dev->next)
+	for (i = 0; i < HTTPDISK_CACHE_BLOCKS; i++)
+	  if (dev->cache[i].data
+	      && (!victim || dev->cache[i].last_use < victim->last_use))
+	    victim = &dev->cache[i];
+      if (!victim)
+	break;
+      grub_free (victim->data);
+      victim->data = NULL;
+      freed += HTTPDISK_BLOCK_SIZE;
+    }
+  return freed;
+}
+
+static struct grub_mm_shrinker httpdisk_shrinker =
+  {
+    .shrink = httpdisk_shrink
+  };
+
+static const struct grub_arg_option httpdisk_options[] =
+  {
+    {"delete", 'd', 0, N_("Delete the specified HTTP disk."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static grub_extcmd_t cmd_httpdisk;
+
 static struct grub_net_app_protocol grub_http_protocol = 
   {
     .name = "http",
@@ -554,9 +1550,33 @@ static struct grub_net_app_protocol grub_http_protocol =
 GRUB_MOD_INIT (http)
 {
   grub_net_app_level_register (&grub_http_protocol);
+  grub_disk_dev_register (&grub_httpdisk_dev);
+  grub_mm_shrinker_register (&httpdisk_shrinker);
+  cmd_httpdisk = grub_register_extcmd ("httpdisk", grub_cmd_httpdisk, 0,
+				       N_("[-d] DEVICENAME (http,SERVER)/FILE"),
+				       N_("Make a disk of a file on an HTTP"
+					  " server."), httpdisk_options);
 }
 
 GRUB_MOD_FINI (http)
 {
+  struct http_conn *conn, *next;
+
+  FOR_LIST_ELEMENTS_SAFE (conn, next, idle_conns)
+    {
+      grub_net_tcp_close (conn->sock, GRUB_NET_TCP_ABORT);
+      grub_free (conn->server);
+      grub_free (conn);
+    }
+  idle_conns = 0;
+  grub_unregister_extcmd (cmd_httpdisk);
+  grub_mm_shrinker_unregister (&httpdisk_shrinker);
+  grub_disk_dev_unregister (&grub_httpdisk_dev);
+  while (httpdisk_list)
+    {
+      struct httpdisk *dev = httpdisk_list;
+      httpdisk_list = dev->next;
+      httpdisk_free (dev);
+    }
   grub_net_app_level_unregister (&grub_http_protocol);
 }
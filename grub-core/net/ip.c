@@ -24,7 +24,7 @@
 #include <grub/net.h>
 #include <grub/net/netbuff.h>
 #include <grub/mm.h>
-#include <grub/priority_queue.h>
+#include <grub/list.h>
 #include <grub/time.h>
 
 struct iphdr {
@@ -58,63 +58,101 @@ struct ip6hdr {
   ip6addr dest;
 } GRUB_PACKED ;
 
-static int
-cmp (const void *a__, const void *b__)
-{
-  struct grub_net_buff *a_ = *(struct grub_net_buff **) a__;
-  struct grub_net_buff *b_ = *(struct grub_net_buff **) b__;
-  struct iphdr *a = (struct iphdr *) a_->data;
-  struct iphdr *b = (struct iphdr *) b_->data;
-  /* We want the first elements to be on top.  */
-  if ((grub_be_to_cpu16 (a->frags) & OFFSET_MASK)
-      < (grub_be_to_cpu16 (b->frags) & OFFSET_MASK))
-    return +1;
-  if ((grub_be_to_cpu16 (a->frags) & OFFSET_MASK)
-      > (grub_be_to_cpu16 (b->frags) & OFFSET_MASK))
-    return -1;
-  return 0;
-}
+/* Longest payload a fragmented datagram may have.  */
+#define REASSEMBLE_MAX_LEN	65535
+/* Payload bytes per bit of the bitmap, fragment offsets are multiples of
+   it.  */
+#define REASSEMBLE_UNIT		8
+#define REASSEMBLE_UNITS	(ALIGN_UP (REASSEMBLE_MAX_LEN, REASSEMBLE_UNIT) \
+				 / REASSEMBLE_UNIT)
+#define REASSEMBLE_HASH_SIZE	32
+/* Each datagram being reassembled holds a buffer of REASSEMBLE_MAX_LEN,
+   so only keep that many; the least recently active one makes room.  */
+#define REASSEMBLE_MAX		16
+#define REASSEMBLE_TIMEOUT	90000
 
 struct reassemble
 {
   struct reassemble *next;
+  struct reassemble **prev;
   grub_uint32_t source;
   grub_uint32_t dest;
   grub_uint16_t id;
   grub_uint8_t proto;
   grub_uint64_t last_time;
-  grub_priority_queue_t pq;
+  /* Fragments are copied into place as soon as they arrive.  */
   struct grub_net_buff *asm_netbuff;
+  /* Known once the last fragment was seen, 0 before.  */
   grub_size_t total_len;
-  grub_size_t cur_ptr;
+  /* End of the furthest fragment seen.  */
+  grub_size_t max_end;
+  /* One bit per REASSEMBLE_UNIT of payload present and how many are set.  */
+  grub_uint8_t received[ALIGN_UP (REASSEMBLE_UNITS, 8) / 8];
+  grub_size_t nreceived;
   grub_uint8_t ttl;
 };
 
-static struct reassemble *reassembles;
+static struct reassemble *reassembles[REASSEMBLE_HASH_SIZE];
+static unsigned nreassembles;
+static grub_uint64_t last_expiry;
+
+static inline unsigned
+reassemble_hash (grub_uint32_t source, grub_uint32_t dest, grub_uint16_t id,
+		 grub_uint8_t proto)
+{
+  grub_uint32_t h = source ^ dest ^ ((grub_uint32_t) id << 8) ^ proto;
 
+  h ^= h >> 16;
+  h ^= h >> 8;
+  return h % REASSEMBLE_HASH_SIZE;
+}
+
+/* The ones' complement sum doesn't depend on byte order (RFC 1071): the
+   data is summed in 32-bit words of host order into a 64-bit accumulator,
+   which can't overflow before 16 GiB, and folded once at the end.  The
+   result is then in network order already.  */
 grub_uint16_t
 grub_net_ip_chksum (void *ipv, grub_size_t len)
 {
-  grub_uint16_t *ip = (grub_uint16_t *) ipv;
-  grub_uint32_t sum = 0;
+  const grub_uint8_t *ip = ipv;
+  grub_uint64_t sum = 0;
 
-  for (; len >= 2; len -= 2)
+  for (; len >= 32; len -= 32, ip += 32)
+    {
+      sum += grub_get_unaligned32 (ip);
+      sum += grub_get_unaligned32 (ip + 4);
+      sum += grub_get_unaligned32 (ip + 8);
+      sum += grub_get_unaligned32 (ip + 12);
+      sum += grub_get_unaligned32 (ip + 16);
+      sum += grub_get_unaligned32 (ip + 20);
+      sum += grub_get_unaligned32 (ip + 24);
+      sum += grub_get_unaligned32 (ip + 28);
+    }
+  for (; len >= 4; len -= 4, ip += 4)
+    sum += grub_get_unaligned32 (ip);
+  if (len >= 2)
     {
-      sum += grub_be_to_cpu16 (grub_get_unaligned16 (ip++));
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      sum += grub_get_unaligned16 (ip);
+      ip += 2;
+      len -= 2;
     }
   if (len)
     {
-      sum += *((grub_uint8_t *) ip) << 8;
-      if (sum > 0xFFFF)
-	sum -= 0xFFFF;
+      /* Padded with a zero byte.  */
+      grub_uint8_t last[2] = { *ip, 0 };
+
+      sum += grub_get_unaligned16 (last);
     }
 
-  if (sum >= 0xFFFF)
-    sum -= 0xFFFF;
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffffffff) + (sum >> 32);
+  sum = (sum & 0xffff) + (sum >> 16);
+  sum = (sum & 0xffff) + (sum >> 16);
+  /* Of the two zeros, return the same one as ever.  */
+  if (sum == 0xffff)
+    sum = 0;
 
-  return grub_cpu_to_be16 ((~sum) & 0x0000FFFF);
+  return (grub_uint16_t) ~sum;
 }
 
 static int id = 0x2400;
@@ -348,33 +386,72 @@ handle_dgram (struct grub_net_buff *nb,
 static void
 free_rsm (struct reassemble *rsm)
 {
-  struct grub_net_buff **nb;
-  while ((nb = grub_priority_queue_top (rsm->pq)))
-    {
-      grub_netbuff_free (*nb);
-      grub_priority_queue_pop (rsm->pq);
-    }
+  grub_list_remove (GRUB_AS_LIST (rsm));
+  nreassembles--;
   grub_netbuff_free (rsm->asm_netbuff);
-  grub_priority_queue_destroy (rsm->pq);
   grub_free (rsm);
 }
 
+/* Drop the datagrams which saw no fragment for REASSEMBLE_TIMEOUT.  Done
+   at most once a second rather than for every fragment.  */
 static void
-free_old_fragments (void)
+free_old_fragments (grub_uint64_t now)
 {
-  struct reassemble *rsm, **prev;
-  grub_uint64_t limit_time = grub_get_time_ms () - 90000;
+  struct reassemble *rsm, *next;
+  unsigned i;
 
-  for (prev = &reassembles, rsm = *prev; rsm; rsm = *prev)
-    if (rsm->last_time < limit_time)
-      {
-	*prev = rsm->next;
+  if (now - last_expiry < 1000)
+    return;
+  last_expiry = now;
+
+  for (i = 0; i < REASSEMBLE_HASH_SIZE; i++)
+    FOR_LIST_ELEMENTS_SAFE (rsm, next, reassembles[i])
+      if (rsm->last_time + REASSEMBLE_TIMEOUT < now)
 	free_rsm (rsm);
-      }
-    else
-      {
-	prev = &rsm->next;
-      }
+}
+
+static void
+free_oldest_fragments (void)
+{
+  struct reassemble *rsm, *oldest = NULL;
+  unsigned i;
+
+  for (i = 0; i < REASSEMBLE_HASH_SIZE; i++)
+    FOR_LIST_ELEMENTS (rsm, reassembles[i])
+      if (!oldest || rsm->last_time < oldest->last_time)
+	oldest = rsm;
+  if (oldest)
+    free_rsm (oldest);
+}
+
+/* Set the bits of the units FIRST to END - 1 and return how many of them
+   were clear.  Whole bytes are handled at once, fragments rarely
+   overlap.  */
+static grub_size_t
+mark_received (struct reassemble *rsm, grub_size_t first, grub_size_t end)
+{
+  grub_size_t i = first, n = 0;
+
+  while (i < end)
+    {
+      grub_uint8_t *byte = &rsm->received[i / 8];
+
+      if (i % 8 == 0 && end - i >= 8 && (*byte == 0 || *byte == 0xff))
+	{
+	  if (*byte == 0)
+	    n += 8;
+	  *byte = 0xff;
+	  i += 8;
+	  continue;
+	}
+      if (!(*byte & (1 << (i % 8))))
+	{
+	  *byte |= 1 << (i % 8);
+	  n++;
+	}
+      i++;
+    }
+  return n;
 }
 
 static grub_err_t
@@ -385,7 +462,11 @@ grub_net_recv_ip4_packets (struct grub_net_buff *nb,
 {
   struct iphdr *iph = (struct iphdr *) nb->data;
   grub_err_t err;
-  struct reassemble *rsm, **prev;
+  struct reassemble *rsm;
+  grub_size_t hdrlen, off, len;
+  grub_uint64_t now;
+  unsigned hash;
+  int more;
 
   if ((iph->verhdrlen >> 4) != 4)
     {
@@ -411,6 +492,16 @@ grub_net_recv_ip4_packets (struct grub_net_buff *nb,
       return GRUB_ERR_NONE;
     }
 
+  /* The header isn't checksummed on receive, so this can be anything.  */
+  if (grub_be_to_cpu16 (iph->len) < (iph->verhdrlen & 0xf)
+      * sizeof (grub_uint32_t))
+    {
+      grub_dprintf ("net", "IP length shorter than its header: %d\n",
+		    grub_be_to_cpu16 (iph->len));
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
   /* Check size.  */
   {
     grub_size_t expected_size = grub_be_to_cpu16 (iph->len);
@@ -459,142 +550,118 @@ grub_net_recv_ip4_packets (struct grub_net_buff *nb,
 			   &source, &dest, iph->ttl);
     }
 
-  for (prev = &reassembles, rsm = *prev; rsm; prev = &rsm->next, rsm = *prev)
+  hdrlen = (iph->verhdrlen & 0xf) * sizeof (grub_uint32_t);
+  off = REASSEMBLE_UNIT * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK);
+  len = (nb->tail - nb->data) - hdrlen;
+  more = !!(grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS);
+
+  /* All fragments but the last carry whole units.  */
+  if (off > REASSEMBLE_MAX_LEN || len > REASSEMBLE_MAX_LEN - off
+      || (more && (len == 0 || len % REASSEMBLE_UNIT)))
+    {
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+
+  now = grub_get_time_ms ();
+  free_old_fragments (now);
+
+  hash = reassemble_hash (iph->src, iph->dest, iph->ident, iph->protocol);
+  FOR_LIST_ELEMENTS (rsm, reassembles[hash])
     if (rsm->source == iph->src && rsm->dest == iph->dest
 	&& rsm->id == iph->ident && rsm->proto == iph->protocol)
       break;
   if (!rsm)
     {
-      rsm = grub_malloc (sizeof (*rsm));
+      if (nreassembles >= REASSEMBLE_MAX)
+	free_oldest_fragments ();
+
+      rsm = grub_zalloc (sizeof (*rsm));
       if (!rsm)
-	return grub_errno;
-      rsm->source = iph->src;
-      rsm->dest = iph->dest;
-      rsm->id = iph->ident;
-      rsm->proto = iph->protocol;
-      rsm->next = reassembles;
-      reassembles = rsm;
-      prev = &reassembles;
-      rsm->pq = grub_priority_queue_new (sizeof (struct grub_net_buff **), cmp);
-      if (!rsm->pq)
+	{
+	  grub_netbuff_free (nb);
+	  return grub_errno;
+	}
+      rsm->asm_netbuff = grub_netbuff_alloc (REASSEMBLE_MAX_LEN);
+      if (!rsm->asm_netbuff)
 	{
 	  grub_free (rsm);
+	  grub_netbuff_free (nb);
 	  return grub_errno;
 	}
-      rsm->asm_netbuff = 0;
-      rsm->total_len = 0;
-      rsm->cur_ptr = 0;
+      rsm->source = iph->src;
+      rsm->dest = iph->dest;
+      rsm->id = iph->ident;
+      rsm->proto = iph->protocol;
       rsm->ttl = 0xff;
+      grub_list_push (GRUB_AS_LIST_P (&reassembles[hash]), GRUB_AS_LIST (rsm));
+      nreassembles++;
     }
   if (rsm->ttl > iph->ttl)
     rsm->ttl = iph->ttl;
-  rsm->last_time = grub_get_time_ms ();
-  free_old_fragments ();
+  rsm->last_time = now;
 
-  err = grub_priority_queue_push (rsm->pq, &nb);
-  if (err)
-    return err;
-
-  if (!(grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS))
+  if (!more)
     {
-      rsm->total_len = (8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-			+ (nb->tail - nb->data));
-      rsm->total_len -= ((iph->verhdrlen & 0xf) * sizeof (grub_uint32_t));
-      rsm->asm_netbuff = grub_netbuff_alloc (rsm->total_len);
-      if (!rsm->asm_netbuff)
+      /* A second, different, end or data past it: give up on it.  */
+      if ((rsm->total_len && rsm->total_len != off + len)
+	  || rsm->max_end > off + len)
 	{
-	  *prev = rsm->next;
 	  free_rsm (rsm);
-	  return grub_errno;
+	  grub_netbuff_free (nb);
+	  return GRUB_ERR_NONE;
 	}
+      rsm->total_len = off + len;
     }
-  if (!rsm->asm_netbuff)
-    return GRUB_ERR_NONE;
-
-  while (1)
+  else if (rsm->total_len && off + len > rsm->total_len)
     {
-      struct grub_net_buff **nb_top_p, *nb_top;
-      grub_size_t copy;
-      grub_size_t res_len;
-      struct grub_net_buff *ret;
-      grub_net_ip_protocol_t proto;
-      grub_uint32_t src;
-      grub_uint32_t dst;
-      grub_net_network_level_address_t source;
-      grub_net_network_level_address_t dest;
-      grub_uint8_t ttl;
-
-      nb_top_p = grub_priority_queue_top (rsm->pq);
-      if (!nb_top_p)
-	return GRUB_ERR_NONE;
-      nb_top = *nb_top_p;
-      grub_priority_queue_pop (rsm->pq);
-      iph = (struct iphdr *) nb_top->data;
-      err = grub_netbuff_pull (nb_top, ((iph->verhdrlen & 0xf)
-					* sizeof (grub_uint32_t)));
-      if (err)
-	{
-	  grub_netbuff_free (nb_top);
-	  return err;
-	}
-      if (rsm->cur_ptr < (grub_size_t) 8 * (grub_be_to_cpu16 (iph->frags)
-					    & OFFSET_MASK))
-	{
-	  grub_netbuff_free (nb_top);
-	  return GRUB_ERR_NONE;
-	}
-
-      rsm->cur_ptr = (8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-		      + (nb_top->tail - nb_top->head));
-      if ((grub_size_t) 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-	  >= rsm->total_len)
-	{
-	  grub_netbuff_free (nb_top);
-	  continue;
-	}
-      copy = nb_top->tail - nb_top->data;
-      if (rsm->total_len - 8 * (grub_be_to_cpu16 (iph->frags) & OFFSET_MASK)
-	  < copy)
-	copy = rsm->total_len - 8 * (grub_be_to_cpu16 (iph->frags)
-				     & OFFSET_MASK);
-      grub_memcpy (&rsm->asm_netbuff->data[8 * (grub_be_to_cpu16 (iph->frags)
-						& OFFSET_MASK)],
-		   nb_top->data, copy);
-
-      if ((grub_be_to_cpu16 (iph->frags) & MORE_FRAGMENTS))
-	{
-	  grub_netbuff_free (nb_top);
-	  continue;
-	}
-      grub_netbuff_free (nb_top);
-
-      ret = rsm->asm_netbuff;
-      proto = rsm->proto;
-      src = rsm->source;
-      dst = rsm->dest;
-      ttl = rsm->ttl;
-
-      rsm->asm_netbuff = 0;
-      res_len = rsm->total_len;
-      *prev = rsm->next;
       free_rsm (rsm);
+      grub_netbuff_free (nb);
+      return GRUB_ERR_NONE;
+    }
+  if (rsm->max_end < off + len)
+    rsm->max_end = off + len;
 
-      if (grub_netbuff_put (ret, res_len))
-	{
-	  grub_netbuff_free (ret);
-	  return GRUB_ERR_NONE;
-	}
+  grub_memcpy (rsm->asm_netbuff->data + off, nb->data + hdrlen, len);
+  rsm->nreceived += mark_received (rsm, off / REASSEMBLE_UNIT,
+				   ALIGN_UP (off + len, REASSEMBLE_UNIT)
+				   / REASSEMBLE_UNIT);
+  grub_netbuff_free (nb);
 
-      source.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-      source.ipv4 = src;
+  if (!rsm->total_len
+      || rsm->nreceived != ALIGN_UP (rsm->total_len, REASSEMBLE_UNIT)
+      / REASSEMBLE_UNIT)
+    return GRUB_ERR_NONE;
 
-      dest.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
-      dest.ipv4 = dst;
+  {
+    struct grub_net_buff *ret;
+    grub_net_ip_protocol_t proto;
+    grub_net_network_level_address_t source;
+    grub_net_network_level_address_t dest;
+    grub_uint8_t ttl;
+
+    ret = rsm->asm_netbuff;
+    proto = rsm->proto;
+    source.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+    source.ipv4 = rsm->source;
+    dest.type = GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4;
+    dest.ipv4 = rsm->dest;
+    ttl = rsm->ttl;
+
+    len = rsm->total_len;
+    rsm->asm_netbuff = 0;
+    free_rsm (rsm);
+
+    if (grub_netbuff_put (ret, len))
+      {
+	grub_netbuff_free (ret);
+	return GRUB_ERR_NONE;
+      }
 
-      return handle_dgram (ret, card, src_hwaddress,
-			   hwaddress, proto, &source, &dest,
-			   ttl);
-    }
+    return handle_dgram (ret, card, src_hwaddress,
+			 hwaddress, proto, &source, &dest,
+			 ttl);
+  }
 }
 
 static grub_err_t
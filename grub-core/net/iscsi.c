@@ -0,0 +1,1231 @@
+/* iscsi.c - read-only iSCSI initiator.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Each iSCSI disk is a session of one TCP connection to a target, logged
+   in without authentication and without digests (RFC 7143).  A read is
+   split in commands of at most ISCSI_MAX_TRANSFER bytes, up to
+   ISCSI_QUEUE_DEPTH of which are outstanding at once as far as the
+   command window of the target allows, their headers going out together.
+   Data-In PDUs are copied straight from the received packets into the
+   buffer of the read.  */
+
+#include <grub/misc.h>
+#include <grub/net/tcp.h>
+#include <grub/net.h>
+#include <grub/mm.h>
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/scsicmd.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ISCSI_PORT 3260
+#define ISCSI_BHS_SIZE 48
+#define ISCSI_QUEUE_DEPTH 16
+#define ISCSI_MAX_TRANSFER (256 << 10)
+/* Kept of the data segment of PDUs other than Data-In: login keys, sense
+   data and the header of rejected PDUs.  */
+#define ISCSI_TEXT_MAX 4096
+/* Longest iSCSI name.  */
+#define ISCSI_NAME_MAX 223
+#define ISCSI_LOGIN_ROUNDS 8
+#define ISCSI_POLL_MS 300
+/* Polls without any byte from the target before giving up.  */
+#define ISCSI_IDLE_POLLS 100
+#define ISCSI_DEFAULT_INITIATOR "iqn.2010-04.org.gnu:grub"
+
+enum
+  {
+    ISCSI_OP_NOP_OUT = 0x00,
+    ISCSI_OP_SCSI_CMD = 0x01,
+    ISCSI_OP_LOGIN = 0x03,
+    ISCSI_OP_LOGOUT = 0x06,
+    ISCSI_OP_NOP_IN = 0x20,
+    ISCSI_OP_SCSI_RSP = 0x21,
+    ISCSI_OP_LOGIN_RSP = 0x23,
+    ISCSI_OP_DATA_IN = 0x25,
+    ISCSI_OP_LOGOUT_RSP = 0x26,
+    ISCSI_OP_ASYNC = 0x32,
+    ISCSI_OP_REJECT = 0x3f,
+    ISCSI_OP_MASK = 0x3f,
+    ISCSI_OP_IMMEDIATE = 0x40
+  };
+
+enum
+  {
+    ISCSI_FLAG_FINAL = 0x80,
+    ISCSI_FLAG_TRANSIT = 0x80,
+    ISCSI_FLAG_READ = 0x40,
+    ISCSI_FLAG_STATUS = 0x01,
+    ISCSI_ATTR_SIMPLE = 0x01
+  };
+
+enum
+  {
+    ISCSI_STAGE_SECURITY = 0,
+    ISCSI_STAGE_OPERATIONAL = 1,
+    ISCSI_STAGE_FULL = 3
+  };
+
+enum
+  {
+    ISCSI_STATUS_GOOD = 0x00,
+    ISCSI_STATUS_CHECK_CONDITION = 0x02,
+    ISCSI_STATUS_BUSY = 0x08,
+    ISCSI_STATUS_TASK_SET_FULL = 0x28
+  };
+
+#define ISCSI_SENSE_UNIT_ATTENTION 0x6
+#define ISCSI_RESERVED_TAG 0xffffffff
+
+/* The basic header segment which starts every PDU.  Fields meaning
+   different things in different PDUs are named after their main use.  */
+struct iscsi_bhs
+{
+  grub_uint8_t opcode;
+  grub_uint8_t flags;
+  grub_uint8_t response;
+  grub_uint8_t status;
+  grub_uint8_t ahs_len;
+  grub_uint8_t data_len[3];
+  /* Login: ISID and TSIH.  */
+  grub_uint8_t lun[8];
+  grub_uint32_t itt;
+  /* SCSI command: expected data transfer length.  */
+  grub_uint32_t ttt;
+  /* CmdSN going out, StatSN coming in.  */
+  grub_uint32_t sn;
+  /* ExpStatSN going out, ExpCmdSN coming in.  */
+  grub_uint32_t exp_sn;
+  union
+  {
+    grub_uint8_t cdb[16];
+    struct
+    {
+      grub_uint32_t max_cmdsn;
+      /* Login response: status class and detail in the first bytes.  */
+      grub_uint32_t data_sn;
+      grub_uint32_t offset;
+      grub_uint32_t residual;
+    } GRUB_PACKED in;
+  } u;
+} GRUB_PACKED;
+
+enum iscsi_task_state
+  {
+    ISCSI_TASK_FREE,
+    ISCSI_TASK_QUEUED,
+    ISCSI_TASK_SENT,
+    ISCSI_TASK_DONE
+  };
+
+struct iscsi_task
+{
+  enum iscsi_task_state state;
+  grub_uint8_t cdb[16];
+  char *buf;
+  grub_uint32_t len;
+  /* Less than this is a short read.  */
+  grub_uint32_t need;
+  grub_uint32_t itt;
+  grub_uint32_t received;
+  int bad;
+  int tries;
+  grub_uint8_t response;
+  grub_uint8_t status;
+  grub_uint8_t sense_key;
+  grub_uint8_t asc;
+  grub_uint8_t ascq;
+};
+
+struct iscsi_session
+{
+  struct iscsi_session *next;
+  char *devname;
+  char *server;
+  char *target;
+  char *initiator;
+  grub_uint16_t port;
+  grub_uint16_t lun;
+  unsigned long id;
+  grub_uint8_t isid[6];
+
+  grub_net_tcp_socket_t sock;
+  grub_uint32_t itt;
+  grub_uint32_t cmdsn;
+  grub_uint32_t max_cmdsn;
+  grub_uint32_t exp_statsn;
+  grub_uint32_t max_transfer;
+
+  grub_uint64_t blocks;
+  unsigned block_bits;
+
+  /* The commands of the read in progress.  */
+  struct iscsi_task *tasks;
+  unsigned ntasks;
+
+  /* The PDU being received.  */
+  struct iscsi_bhs rx;
+  grub_size_t rx_got;
+  grub_size_t rx_ahs;
+  grub_size_t rx_left;
+  grub_size_t rx_pad;
+  grub_size_t rx_keep;
+  char *rx_dst;
+  grub_uint64_t rx_bytes;
+  char text[ISCSI_TEXT_MAX + 1];
+  grub_size_t text_len;
+
+  struct iscsi_bhs login_rsp;
+  int login_done;
+  int logout_done;
+  int wake;
+};
+
+static struct iscsi_session *iscsi_list;
+static unsigned long iscsi_last_id;
+
+static grub_uint32_t
+iscsi_get_data_len (const struct iscsi_bhs *bhs)
+{
+  return ((grub_uint32_t) bhs->data_len[0] << 16)
+    | (bhs->data_len[1] << 8) | bhs->data_len[2];
+}
+
+static void
+iscsi_set_data_len (struct iscsi_bhs *bhs, grub_uint32_t len)
+{
+  bhs->data_len[0] = len >> 16;
+  bhs->data_len[1] = len >> 8;
+  bhs->data_len[2] = len;
+}
+
+/* Single level LUN, in the flat space addressing above 255.  */
+static void
+iscsi_set_lun (struct iscsi_bhs *bhs, grub_uint16_t lun)
+{
+  bhs->lun[0] = lun < 256 ? 0 : 0x40 | (lun >> 8);
+  bhs->lun[1] = lun;
+}
+
+static grub_uint32_t
+iscsi_next_itt (struct iscsi_session *s)
+{
+  if (s->itt == ISCSI_RESERVED_TAG)
+    s->itt = 0;
+  return grub_cpu_to_be32 (s->itt++);
+}
+
+static void
+iscsi_disconnect (struct iscsi_session *s)
+{
+  if (s->sock)
+    grub_net_tcp_close (s->sock, GRUB_NET_TCP_ABORT);
+  s->sock = 0;
+  s->rx_got = 0;
+  s->wake = 1;
+}
+
+/* Append a PDU of header BHS and LEN bytes of DATA to *NB, allocating it
+   with room for ROOM bytes of PDUs if there is none yet.  */
+static grub_err_t
+iscsi_append (struct grub_net_buff **nb, grub_size_t room,
+	      const struct iscsi_bhs *bhs, const void *data, grub_size_t len)
+{
+  grub_size_t pad = -len & 3;
+  grub_uint8_t *ptr;
+
+  if (!*nb)
+    {
+      *nb = grub_netbuff_alloc (GRUB_NET_TCP_RESERVE_SIZE + room);
+      if (!*nb)
+	return grub_errno;
+      grub_netbuff_reserve (*nb, GRUB_NET_TCP_RESERVE_SIZE);
+    }
+  ptr = (*nb)->tail;
+  if (grub_netbuff_put (*nb, ISCSI_BHS_SIZE + len + pad))
+    return grub_errno;
+  grub_memcpy (ptr, bhs, ISCSI_BHS_SIZE);
+  grub_memcpy (ptr + ISCSI_BHS_SIZE, data, len);
+  grub_memset (ptr + ISCSI_BHS_SIZE + len, 0, pad);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+iscsi_send (struct iscsi_session *s, struct grub_net_buff *nb)
+{
+  grub_err_t err;
+
+  if (!s->sock)
+    {
+      grub_netbuff_free (nb);
+      return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			 N_("iSCSI connection to `%s' lost"), s->server);
+    }
+  err = grub_net_send_tcp_packet (s->sock, nb, 1);
+  if (err)
+    iscsi_disconnect (s);
+  return err;
+}
+
+/* Answer a NOP-In the target sent to see whether we are still there.  */
+static void
+iscsi_nop_reply (struct iscsi_session *s)
+{
+  struct grub_net_buff *nb = 0;
+  struct iscsi_bhs bhs;
+
+  grub_memset (&bhs, 0, sizeof (bhs));
+  bhs.opcode = ISCSI_OP_NOP_OUT | ISCSI_OP_IMMEDIATE;
+  bhs.flags = ISCSI_FLAG_FINAL;
+  grub_memcpy (bhs.lun, s->rx.lun, sizeof (bhs.lun));
+  bhs.itt = ISCSI_RESERVED_TAG;
+  bhs.ttt = s->rx.ttt;
+  bhs.sn = grub_cpu_to_be32 (s->cmdsn);
+  bhs.exp_sn = grub_cpu_to_be32 (s->exp_statsn);
+  if (iscsi_append (&nb, ISCSI_BHS_SIZE, &bhs, 0, 0))
+    {
+      grub_netbuff_free (nb);
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  if (iscsi_send (s, nb))
+    grub_errno = GRUB_ERR_NONE;
+}
+
+static struct iscsi_task *
+iscsi_find_task (struct iscsi_session *s, grub_uint32_t itt)
+{
+  unsigned i;
+
+  for (i = 0; i < s->ntasks; i++)
+    if (s->tasks[i].state == ISCSI_TASK_SENT && s->tasks[i].itt == itt)
+      return &s->tasks[i];
+  return NULL;
+}
+
+/* The header of a PDU is in: decide where its data segment goes.  */
+static void
+iscsi_pdu_start (struct iscsi_session *s)
+{
+  grub_uint32_t len = iscsi_get_data_len (&s->rx);
+
+  s->rx_ahs = s->rx.ahs_len * 4;
+  s->rx_left = len;
+  s->rx_pad = -len & 3;
+  s->rx_dst = 0;
+  s->rx_keep = 0;
+  s->text_len = 0;
+
+  if ((s->rx.opcode & ISCSI_OP_MASK) == ISCSI_OP_DATA_IN)
+    {
+      struct iscsi_task *t = iscsi_find_task (s, s->rx.itt);
+      grub_uint32_t off = grub_be_to_cpu32 (s->rx.u.in.offset);
+
+      if (t && off <= t->len && len <= t->len - off)
+	{
+	  s->rx_dst = t->buf + off;
+	  s->rx_keep = len;
+	}
+      else if (t)
+	t->bad = 1;
+    }
+  else
+    {
+      s->rx_dst = s->text;
+      s->rx_keep = len < ISCSI_TEXT_MAX ? len : ISCSI_TEXT_MAX;
+      s->text_len = s->rx_keep;
+    }
+}
+
+static void
+iscsi_pdu_done (struct iscsi_session *s)
+{
+  struct iscsi_bhs *bhs = &s->rx;
+  grub_uint8_t op = bhs->opcode & ISCSI_OP_MASK;
+  grub_uint32_t max_cmdsn = grub_be_to_cpu32 (bhs->u.in.max_cmdsn);
+  struct iscsi_task *t;
+
+  s->text[s->text_len] = 0;
+  if ((grub_int32_t) (max_cmdsn - s->max_cmdsn) > 0)
+    s->max_cmdsn = max_cmdsn;
+  if (op == ISCSI_OP_SCSI_RSP || op == ISCSI_OP_LOGIN_RSP
+      || op == ISCSI_OP_LOGOUT_RSP || op == ISCSI_OP_REJECT
+      || op == ISCSI_OP_ASYNC
+      || (op == ISCSI_OP_DATA_IN && (bhs->flags & ISCSI_FLAG_STATUS)))
+    s->exp_statsn = grub_be_to_cpu32 (bhs->sn) + 1;
+
+  switch (op)
+    {
+    case ISCSI_OP_DATA_IN:
+      t = iscsi_find_task (s, bhs->itt);
+      if (!t)
+	break;
+      if (!t->bad)
+	t->received += iscsi_get_data_len (bhs);
+      if (bhs->flags & ISCSI_FLAG_STATUS)
+	{
+	  t->status = bhs->status;
+	  t->state = ISCSI_TASK_DONE;
+	  s->wake = 1;
+	}
+      break;
+
+    case ISCSI_OP_SCSI_RSP:
+      t = iscsi_find_task (s, bhs->itt);
+      if (!t)
+	break;
+      t->response = bhs->response;
+      t->status = bhs->status;
+      if (t->status == ISCSI_STATUS_CHECK_CONDITION && s->text_len >= 6)
+	{
+	  const grub_uint8_t *sense = (const grub_uint8_t *) s->text + 2;
+
+	  /* Descriptor or fixed format.  */
+	  if ((sense[0] & 0x7f) >= 0x72)
+	    {
+	      t->sense_key = sense[1] & 0xf;
+	      t->asc = sense[2];
+	      t->ascq = sense[3];
+	    }
+	  else if (s->text_len >= 2 + 14)
+	    {
+	      t->sense_key = sense[2] & 0xf;
+	      t->asc = sense[12];
+	      t->ascq = sense[13];
+	    }
+	}
+      t->state = ISCSI_TASK_DONE;
+      s->wake = 1;
+      break;
+
+    case ISCSI_OP_NOP_IN:
+      if (bhs->ttt != ISCSI_RESERVED_TAG)
+	iscsi_nop_reply (s);
+      break;
+
+    case ISCSI_OP_LOGIN_RSP:
+      s->login_rsp = *bhs;
+      s->login_done = 1;
+      s->wake = 1;
+      break;
+
+    case ISCSI_OP_LOGOUT_RSP:
+      s->logout_done = 1;
+      s->wake = 1;
+      break;
+
+    case ISCSI_OP_REJECT:
+      /* The data segment is the header of the rejected PDU.  */
+      if (s->text_len < ISCSI_BHS_SIZE)
+	break;
+      t = iscsi_find_task (s, ((struct iscsi_bhs *) s->text)->itt);
+      if (!t)
+	break;
+      t->response = 0xff;
+      t->state = ISCSI_TASK_DONE;
+      s->wake = 1;
+      break;
+
+    case ISCSI_OP_ASYNC:
+      {
+	grub_uint8_t event = ((grub_uint8_t *) &bhs->u.in.data_sn)[0];
+
+	grub_dprintf ("iscsi", "%s: async event %d\n", s->devname, event);
+	/* The target asks for a logout or is dropping the connection; the
+	   next read logs in again.  */
+	if (event >= 1 && event <= 3)
+	  iscsi_disconnect (s);
+	break;
+      }
+    }
+}
+
+static grub_err_t
+iscsi_receive (grub_net_tcp_socket_t sock __attribute__ ((unused)),
+	       struct grub_net_buff *nb, void *data)
+{
+  struct iscsi_session *s = data;
+
+  s->rx_bytes += nb->tail - nb->data;
+  while (s->sock && nb->tail > nb->data)
+    {
+      grub_size_t avail = nb->tail - nb->data, n;
+
+      if (s->rx_got < ISCSI_BHS_SIZE)
+	{
+	  n = ISCSI_BHS_SIZE - s->rx_got;
+	  if (n > avail)
+	    n = avail;
+	  grub_memcpy ((grub_uint8_t *) &s->rx + s->rx_got, nb->data, n);
+	  s->rx_got += n;
+	  if (s->rx_got == ISCSI_BHS_SIZE)
+	    iscsi_pdu_start (s);
+	}
+      else if (s->rx_ahs)
+	{
+	  n = s->rx_ahs < avail ? s->rx_ahs : avail;
+	  s->rx_ahs -= n;
+	}
+      else if (s->rx_left)
+	{
+	  grub_size_t keep;
+
+	  n = s->rx_left < avail ? s->rx_left : avail;
+	  keep = s->rx_keep < n ? s->rx_keep : n;
+	  grub_memcpy (s->rx_dst, nb->data, keep);
+	  s->rx_dst += keep;
+	  s->rx_keep -= keep;
+	  s->rx_left -= n;
+	}
+      else
+	{
+	  n = s->rx_pad < avail ? s->rx_pad : avail;
+	  s->rx_pad -= n;
+	}
+      grub_netbuff_pull (nb, n);
+
+      if (s->rx_got == ISCSI_BHS_SIZE && !s->rx_ahs && !s->rx_left
+	  && !s->rx_pad)
+	{
+	  s->rx_got = 0;
+	  iscsi_pdu_done (s);
+	}
+    }
+
+  grub_netbuff_free (nb);
+  return GRUB_ERR_NONE;
+}
+
+static void
+iscsi_err (grub_net_tcp_socket_t sock __attribute__ ((unused)), void *data)
+{
+  iscsi_disconnect (data);
+}
+
+/* Wait for the target to answer something, giving up after a long enough
+   silence.  */
+static grub_err_t
+iscsi_wait (struct iscsi_session *s)
+{
+  grub_uint64_t seen = s->rx_bytes;
+  unsigned idle = 0;
+
+  while (!s->wake)
+    {
+      if (!s->sock)
+	break;
+      grub_net_poll_cards (ISCSI_POLL_MS, &s->wake);
+      if (s->rx_bytes != seen)
+	{
+	  seen = s->rx_bytes;
+	  idle = 0;
+	}
+      else if (++idle > ISCSI_IDLE_POLLS)
+	{
+	  iscsi_disconnect (s);
+	  return grub_error (GRUB_ERR_TIMEOUT, N_("timeout reading `%s'"),
+			     s->devname);
+	}
+    }
+  s->wake = 0;
+  if (!s->sock)
+    return grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		       N_("iSCSI connection to `%s' lost"), s->server);
+  return GRUB_ERR_NONE;
+}
+
+/* Append KEY=VALUE to the login keys in BUF from POS.  */
+static grub_size_t
+iscsi_add_key (char *buf, grub_size_t pos, const char *key,
+	       const char *value)
+{
+  grub_size_t klen = grub_strlen (key), vlen = grub_strlen (value);
+
+  grub_memcpy (buf + pos, key, klen);
+  buf[pos + klen] = '=';
+  grub_memcpy (buf + pos + klen + 1, value, vlen + 1);
+  return pos + klen + vlen + 2;
+}
+
+/* Return the value of KEY in the keys of the last login response.  */
+static const char *
+iscsi_get_key (struct iscsi_session *s, const char *key)
+{
+  grub_size_t klen = grub_strlen (key);
+  const char *p = s->text, *end = s->text + s->text_len;
+
+  while (p < end)
+    {
+      grub_size_t len = grub_strlen (p);
+
+      if (len > klen && grub_memcmp (p, key, klen) == 0 && p[klen] == '=')
+	return p + klen + 1;
+      p += len + 1;
+    }
+  return NULL;
+}
+
+/* What we ask for: no digests, no writes and the largest bursts.  */
+static const char *const iscsi_operational_keys[][2] =
+  {
+    { "HeaderDigest", "None" },
+    { "DataDigest", "None" },
+    { "MaxRecvDataSegmentLength", "262144" },
+    { "MaxBurstLength", "16776192" },
+    { "FirstBurstLength", "262144" },
+    { "InitialR2T", "Yes" },
+    { "ImmediateData", "No" },
+    { "MaxOutstandingR2T", "1" },
+    { "MaxConnections", "1" },
+    { "DataPDUInOrder", "Yes" },
+    { "DataSequenceInOrder", "Yes" },
+    { "DefaultTime2Wait", "0" },
+    { "DefaultTime2Retain", "0" },
+    { "ErrorRecoveryLevel", "0" }
+  };
+
+static grub_err_t
+iscsi_login (struct iscsi_session *s)
+{
+  char keys[2 * ISCSI_NAME_MAX + 512];
+  int stage = ISCSI_STAGE_SECURITY, next = ISCSI_STAGE_OPERATIONAL;
+  int round, sent_operational = 0;
+  grub_uint32_t max_burst = 0;
+  grub_err_t err;
+
+  iscsi_disconnect (s);
+  s->sock = grub_net_tcp_open (s->server, s->port, iscsi_receive,
+			       iscsi_err, iscsi_err, s);
+  if (!s->sock)
+    return grub_errno;
+  s->max_cmdsn = s->cmdsn;
+  s->wake = 0;
+
+  for (round = 0; round < ISCSI_LOGIN_ROUNDS; round++)
+    {
+      struct grub_net_buff *nb = 0;
+      struct iscsi_bhs bhs;
+      const grub_uint8_t *status;
+      const char *value;
+      grub_size_t len = 0;
+      unsigned i;
+
+      if (stage == ISCSI_STAGE_SECURITY && round == 0)
+	{
+	  len = iscsi_add_key (keys, len, "InitiatorName", s->initiator);
+	  len = iscsi_add_key (keys, len, "SessionType", "Normal");
+	  len = iscsi_add_key (keys, len, "TargetName", s->target);
+	  len = iscsi_add_key (keys, len, "AuthMethod", "None");
+	}
+      else if (stage == ISCSI_STAGE_OPERATIONAL && !sent_operational)
+	{
+	  for (i = 0; i < ARRAY_SIZE (iscsi_operational_keys); i++)
+	    len = iscsi_add_key (keys, len, iscsi_operational_keys[i][0],
+				 iscsi_operational_keys[i][1]);
+	  sent_operational = 1;
+	}
+
+      grub_memset (&bhs, 0, sizeof (bhs));
+      bhs.opcode = ISCSI_OP_LOGIN | ISCSI_OP_IMMEDIATE;
+      bhs.flags = ISCSI_FLAG_TRANSIT | (stage << 2) | next;
+      iscsi_set_data_len (&bhs, len);
+      grub_memcpy (bhs.lun, s->isid, sizeof (s->isid));
+      bhs.itt = iscsi_next_itt (s);
+      bhs.sn = grub_cpu_to_be32 (s->cmdsn);
+      bhs.exp_sn = grub_cpu_to_be32 (s->exp_statsn);
+
+      s->login_done = 0;
+      err = iscsi_append (&nb, ISCSI_BHS_SIZE + ALIGN_UP (len, 4), &bhs,
+			  keys, len);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  goto fail;
+	}
+      err = iscsi_send (s, nb);
+      while (!err && !s->login_done)
+	err = iscsi_wait (s);
+      if (err)
+	goto fail;
+
+      status = (const grub_uint8_t *) &s->login_rsp.u.in.data_sn;
+      if (status[0])
+	{
+	  err = grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+			    N_("iSCSI login to `%s' failed with status %02x%02x"),
+			    s->target, status[0], status[1]);
+	  goto fail;
+	}
+      value = iscsi_get_key (s, "AuthMethod");
+      if (value && grub_strcmp (value, "None") != 0)
+	{
+	  err = grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+			    N_("iSCSI target `%s' requires authentication"),
+			    s->target);
+	  goto fail;
+	}
+      value = iscsi_get_key (s, "MaxBurstLength");
+      if (value)
+	max_burst = grub_strtoul (value, 0, 10);
+
+      if (s->login_rsp.flags & ISCSI_FLAG_TRANSIT)
+	{
+	  stage = s->login_rsp.flags & 3;
+	  if (stage == ISCSI_STAGE_FULL)
+	    {
+	      s->max_transfer = ISCSI_MAX_TRANSFER;
+	      if (max_burst && max_burst < s->max_transfer)
+		s->max_transfer = max_burst;
+	      grub_dprintf ("iscsi", "%s: logged in to %s, bursts of %u\n",
+			    s->devname, s->target, s->max_transfer);
+	      return GRUB_ERR_NONE;
+	    }
+	  next = ISCSI_STAGE_FULL;
+	}
+    }
+  err = grub_error (GRUB_ERR_NET_UNKNOWN_ERROR,
+		    N_("iSCSI login to `%s' failed"), s->target);
+
+ fail:
+  iscsi_disconnect (s);
+  return err;
+}
+
+static void
+iscsi_logout (struct iscsi_session *s)
+{
+  struct grub_net_buff *nb = 0;
+  struct iscsi_bhs bhs;
+
+  if (!s->sock)
+    return;
+  grub_memset (&bhs, 0, sizeof (bhs));
+  bhs.opcode = ISCSI_OP_LOGOUT | ISCSI_OP_IMMEDIATE;
+  bhs.flags = ISCSI_FLAG_FINAL;
+  bhs.itt = iscsi_next_itt (s);
+  bhs.sn = grub_cpu_to_be32 (s->cmdsn);
+  bhs.exp_sn = grub_cpu_to_be32 (s->exp_statsn);
+  s->logout_done = 0;
+  if (iscsi_append (&nb, ISCSI_BHS_SIZE, &bhs, 0, 0))
+    grub_netbuff_free (nb);
+  else if (!iscsi_send (s, nb))
+    while (!s->logout_done && !iscsi_wait (s));
+  grub_errno = GRUB_ERR_NONE;
+  iscsi_disconnect (s);
+}
+
+/* Add the SCSI command PDU of T to *NB.  */
+static grub_err_t
+iscsi_queue_task (struct iscsi_session *s, struct grub_net_buff **nb,
+		  struct iscsi_task *t)
+{
+  struct iscsi_bhs bhs;
+
+  grub_memset (&bhs, 0, sizeof (bhs));
+  bhs.opcode = ISCSI_OP_SCSI_CMD;
+  bhs.flags = ISCSI_FLAG_FINAL | ISCSI_ATTR_SIMPLE;
+  if (t->len)
+    bhs.flags |= ISCSI_FLAG_READ;
+  iscsi_set_lun (&bhs, s->lun);
+  t->itt = bhs.itt = iscsi_next_itt (s);
+  bhs.ttt = grub_cpu_to_be32 (t->len);
+  bhs.sn = grub_cpu_to_be32 (s->cmdsn++);
+  bhs.exp_sn = grub_cpu_to_be32 (s->exp_statsn);
+  grub_memcpy (bhs.u.cdb, t->cdb, sizeof (t->cdb));
+
+  t->received = 0;
+  t->bad = 0;
+  t->response = 0;
+  t->status = 0;
+  t->sense_key = 0;
+  t->state = ISCSI_TASK_SENT;
+  return iscsi_append (nb, ISCSI_QUEUE_DEPTH * ISCSI_BHS_SIZE, &bhs, 0, 0);
+}
+
+/* Check how T ended.  It goes out again if the target was only busy or
+   had something to tell first.  */
+static grub_err_t
+iscsi_task_end (struct iscsi_session *s, struct iscsi_task *t)
+{
+  if (!t->response)
+    switch (t->status)
+      {
+      case ISCSI_STATUS_GOOD:
+	if (t->bad || t->received < t->need)
+	  return grub_error (GRUB_ERR_READ_ERROR,
+			     N_("short iSCSI read from `%s'"), s->devname);
+	t->state = ISCSI_TASK_FREE;
+	return GRUB_ERR_NONE;
+
+      case ISCSI_STATUS_CHECK_CONDITION:
+	if (t->sense_key != ISCSI_SENSE_UNIT_ATTENTION)
+	  break;
+	/* Fallthrough.  */
+      case ISCSI_STATUS_BUSY:
+      case ISCSI_STATUS_TASK_SET_FULL:
+	if (t->tries++ < GRUB_NET_TRIES)
+	  {
+	    t->state = ISCSI_TASK_QUEUED;
+	    return GRUB_ERR_NONE;
+	  }
+	break;
+      }
+
+  return grub_error (GRUB_ERR_READ_ERROR,
+		     N_("iSCSI command %02x failed on `%s'"
+			" (response %02x, status %02x, sense %x/%02x/%02x)"),
+		     t->cdb[0], s->devname, t->response, t->status,
+		     t->sense_key, t->asc, t->ascq);
+}
+
+/* Run the command CDB of CDB_LEN bytes alone, reading up to LEN bytes
+   into BUF of which NEED at least.  */
+static grub_err_t
+iscsi_command (struct iscsi_session *s, const void *cdb, grub_size_t cdb_len,
+	       void *buf, grub_uint32_t len, grub_uint32_t need)
+{
+  struct iscsi_task t;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  grub_memset (&t, 0, sizeof (t));
+  grub_memcpy (t.cdb, cdb, cdb_len);
+  t.buf = buf;
+  t.len = len;
+  t.need = need;
+  t.state = ISCSI_TASK_QUEUED;
+  s->tasks = &t;
+  s->ntasks = 1;
+
+  while (!err && t.state != ISCSI_TASK_FREE)
+    {
+      struct grub_net_buff *nb = 0;
+
+      if (t.state == ISCSI_TASK_QUEUED)
+	{
+	  err = iscsi_queue_task (s, &nb, &t);
+	  if (err)
+	    grub_netbuff_free (nb);
+	  else
+	    err = iscsi_send (s, nb);
+	}
+      else if (t.state == ISCSI_TASK_DONE)
+	err = iscsi_task_end (s, &t);
+      else
+	err = iscsi_wait (s);
+    }
+
+  s->tasks = 0;
+  s->ntasks = 0;
+  return err;
+}
+
+static void
+iscsi_read_task (struct iscsi_session *s, struct iscsi_task *t,
+		 grub_disk_addr_t lba, grub_uint32_t count, char *buf)
+{
+  grub_memset (t, 0, sizeof (*t));
+  if (lba + count <= 0xffffffff && count <= 0xffff)
+    {
+      struct grub_scsi_read10 *rd = (struct grub_scsi_read10 *) t->cdb;
+
+      rd->opcode = grub_scsi_cmd_read10;
+      rd->lba = grub_cpu_to_be32 (lba);
+      rd->size = grub_cpu_to_be16 (count);
+    }
+  else
+    {
+      struct grub_scsi_read16 *rd = (struct grub_scsi_read16 *) t->cdb;
+
+      rd->opcode = grub_scsi_cmd_read16;
+      rd->lba = grub_cpu_to_be64 (lba);
+      rd->size = grub_cpu_to_be32 (count);
+    }
+  t->buf = buf;
+  t->len = t->need = count << s->block_bits;
+  t->state = ISCSI_TASK_QUEUED;
+}
+
+/* Read the N pieces of VEC, in blocks, keeping the queue full.  */
+static grub_err_t
+iscsi_transfer (struct iscsi_session *s, const struct grub_disk_vec *vec,
+		grub_size_t n)
+{
+  struct iscsi_task tasks[ISCSI_QUEUE_DEPTH];
+  grub_uint32_t max_blocks = s->max_transfer >> s->block_bits;
+  grub_size_t piece = 0;
+  grub_uint64_t done = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+  unsigned i;
+
+  if (!max_blocks)
+    max_blocks = 1;
+  grub_memset (tasks, 0, sizeof (tasks));
+  s->tasks = tasks;
+  s->ntasks = ISCSI_QUEUE_DEPTH;
+
+  while (1)
+    {
+      struct grub_net_buff *nb = 0;
+      int busy = 0;
+
+      for (i = 0; i < ISCSI_QUEUE_DEPTH && !err; i++)
+	{
+	  struct iscsi_task *t = &tasks[i];
+
+	  if (t->state == ISCSI_TASK_DONE)
+	    err = iscsi_task_end (s, t);
+	  if (err)
+	    break;
+
+	  if (t->state == ISCSI_TASK_FREE && piece < n)
+	    {
+	      grub_uint64_t count = vec[piece].size - done;
+
+	      if (count > max_blocks)
+		count = max_blocks;
+	      iscsi_read_task (s, t, vec[piece].sector + done, count,
+			       vec[piece].buf + (done << s->block_bits));
+	      done += count;
+	      if (done == vec[piece].size)
+		{
+		  piece++;
+		  done = 0;
+		}
+	    }
+
+	  if (t->state == ISCSI_TASK_QUEUED
+	      && (grub_int32_t) (s->cmdsn - s->max_cmdsn) <= 0)
+	    err = iscsi_queue_task (s, &nb, t);
+	  if (t->state != ISCSI_TASK_FREE)
+	    busy = 1;
+	}
+
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  break;
+	}
+      if (nb)
+	err = iscsi_send (s, nb);
+      if (err || !busy)
+	break;
+      err = iscsi_wait (s);
+      if (err)
+	break;
+    }
+
+  s->tasks = 0;
+  s->ntasks = 0;
+  return err;
+}
+
+static grub_err_t
+grub_iscsi_read_vec (grub_disk_t disk, const struct grub_disk_vec *vec,
+		     grub_size_t n)
+{
+  struct iscsi_session *s = disk->data;
+  grub_err_t err;
+  int tries;
+
+  for (tries = 0; ; tries++)
+    {
+      err = s->sock ? GRUB_ERR_NONE : iscsi_login (s);
+      if (!err)
+	err = iscsi_transfer (s, vec, n);
+      if (!err || s->sock || tries == GRUB_NET_TRIES)
+	return err;
+      /* The connection dropped: log in again and read it all again.  */
+      grub_dprintf ("iscsi", "%s: %s, reconnecting\n", s->devname,
+		    grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+}
+
+static grub_err_t
+grub_iscsi_read (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, char *buf)
+{
+  struct grub_disk_vec vec = { .sector = sector, .size = size, .buf = buf };
+
+  return grub_iscsi_read_vec (disk, &vec, 1);
+}
+
+static grub_err_t
+grub_iscsi_write (grub_disk_t disk __attribute__ ((unused)),
+		  grub_disk_addr_t sector __attribute__ ((unused)),
+		  grub_size_t size __attribute__ ((unused)),
+		  const char *buf __attribute__ ((unused)))
+{
+  return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		     "iSCSI write is not supported");
+}
+
+static int
+grub_iscsi_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		    grub_disk_pull_t pull)
+{
+  struct iscsi_session *s;
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+  for (s = iscsi_list; s; s = s->next)
+    if (hook (s->devname, hook_data))
+      return 1;
+  return 0;
+}
+
+static grub_err_t
+grub_iscsi_open (const char *name, grub_disk_t disk)
+{
+  struct iscsi_session *s;
+
+  for (s = iscsi_list; s; s = s->next)
+    if (grub_strcmp (s->devname, name) == 0)
+      break;
+  if (!s)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
+
+  disk->total_sectors = s->blocks;
+  disk->log_sector_size = s->block_bits;
+  /* Large enough for a read to fill the queue.  */
+  disk->max_agglomerate = ((ISCSI_QUEUE_DEPTH * ISCSI_MAX_TRANSFER)
+			   >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS));
+  disk->id = s->id;
+  disk->data = s;
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_iscsi_close (grub_disk_t disk __attribute__ ((unused)))
+{
+}
+
+static struct grub_disk_dev grub_iscsi_dev =
+  {
+    .name = "iscsi",
+    .id = GRUB_DISK_DEVICE_ISCSI_ID,
+    .iterate = grub_iscsi_iterate,
+    .open = grub_iscsi_open,
+    .close = grub_iscsi_close,
+    .read = grub_iscsi_read,
+    .write = grub_iscsi_write,
+    .read_vec = grub_iscsi_read_vec,
+    .next = 0
+  };
+
+/* Log in and learn the size of the logical unit of S.  */
+static grub_err_t
+iscsi_probe (struct iscsi_session *s)
+{
+  struct grub_scsi_read_capacity10 rc10;
+  struct grub_scsi_read_capacity10_data rc10d;
+  struct grub_scsi_read_capacity16 rc16;
+  struct grub_scsi_read_capacity16_data rc16d;
+  grub_uint32_t block_size;
+  grub_err_t err;
+
+  err = iscsi_login (s);
+  if (err)
+    return err;
+
+  grub_memset (&rc10, 0, sizeof (rc10));
+  rc10.opcode = grub_scsi_cmd_read_capacity10;
+  err = iscsi_command (s, &rc10, sizeof (rc10), &rc10d, sizeof (rc10d),
+		       sizeof (rc10d));
+  if (err)
+    return err;
+  s->blocks = (grub_uint64_t) grub_be_to_cpu32 (rc10d.last_block) + 1;
+  block_size = grub_be_to_cpu32 (rc10d.blocksize);
+
+  if (rc10d.last_block == 0xffffffff)
+    {
+      grub_memset (&rc16, 0, sizeof (rc16));
+      rc16.opcode = grub_scsi_cmd_read_capacity16;
+      rc16.lun = 0x10;
+      rc16.alloc_len = grub_cpu_to_be32_compile_time (sizeof (rc16d));
+      err = iscsi_command (s, &rc16, sizeof (rc16), &rc16d, sizeof (rc16d),
+			   12);
+      if (err)
+	return err;
+      s->blocks = grub_be_to_cpu64 (rc16d.last_block) + 1;
+      block_size = grub_be_to_cpu32 (rc16d.blocksize);
+    }
+
+  for (s->block_bits = GRUB_DISK_SECTOR_BITS;
+       (1U << s->block_bits) < block_size
+	 && s->block_bits < GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS;
+       s->block_bits++);
+  if ((1U << s->block_bits) != block_size)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "unsupported iSCSI block size %u", block_size);
+  return GRUB_ERR_NONE;
+}
+
+static void
+iscsi_free (struct iscsi_session *s)
+{
+  iscsi_disconnect (s);
+  grub_free (s->devname);
+  grub_free (s->server);
+  grub_free (s->target);
+  grub_free (s->initiator);
+  grub_free (s);
+}
+
+static grub_err_t
+iscsi_delete (const char *name)
+{
+  struct iscsi_session *s, **prev;
+
+  for (prev = &iscsi_list; *prev; prev = &(*prev)->next)
+    if (grub_strcmp ((*prev)->devname, name) == 0)
+      break;
+  if (!*prev)
+    return grub_error (GRUB_ERR_BAD_DEVICE, "device not found");
+
+  s = *prev;
+  *prev = s->next;
+  iscsi_logout (s);
+  iscsi_free (s);
+  return GRUB_ERR_NONE;
+}
+
+static const struct grub_arg_option options[] =
+  {
+    {"delete", 'd', 0, N_("Log out and delete the specified iSCSI disk."),
+     0, 0},
+    {"lun", 'l', 0, N_("Use logical unit LUN (default 0)."), N_("LUN"),
+     ARG_TYPE_INT},
+    {"port", 'p', 0, N_("Connect to PORT (default 3260)."), N_("PORT"),
+     ARG_TYPE_INT},
+    {"initiator", 'i', 0,
+     N_("Log in as initiator NAME (default " ISCSI_DEFAULT_INITIATOR ")."),
+     N_("NAME"), ARG_TYPE_STRING},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+enum
+  {
+    OPTION_DELETE,
+    OPTION_LUN,
+    OPTION_PORT,
+    OPTION_INITIATOR
+  };
+
+static grub_err_t
+grub_cmd_iscsi (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  const char *initiator = ISCSI_DEFAULT_INITIATOR;
+  unsigned long lun = 0, port = ISCSI_PORT;
+  struct iscsi_session *s;
+  grub_err_t err;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "device name required");
+  if (state[OPTION_DELETE].set)
+    return iscsi_delete (args[0]);
+  if (argc != 3)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("three arguments expected"));
+
+  if (state[OPTION_LUN].set)
+    {
+      lun = grub_strtoul (state[OPTION_LUN].arg, 0, 0);
+      if (grub_errno || lun >= 0x4000)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid LUN");
+    }
+  if (state[OPTION_PORT].set)
+    {
+      port = grub_strtoul (state[OPTION_PORT].arg, 0, 0);
+      if (grub_errno || !port || port > 0xffff)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, "invalid port");
+    }
+  if (state[OPTION_INITIATOR].set)
+    initiator = state[OPTION_INITIATOR].arg;
+  if (grub_strlen (initiator) > ISCSI_NAME_MAX
+      || grub_strlen (args[2]) > ISCSI_NAME_MAX)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "iSCSI name too long");
+
+  s = grub_zalloc (sizeof (*s));
+  if (!s)
+    return grub_errno;
+  s->devname = grub_strdup (args[0]);
+  s->server = grub_strdup (args[1]);
+  s->target = grub_strdup (args[2]);
+  s->initiator = grub_strdup (initiator);
+  if (!s->devname || !s->server || !s->target || !s->initiator)
+    {
+      iscsi_free (s);
+      return grub_errno;
+    }
+  s->port = port;
+  s->lun = lun;
+  s->id = iscsi_last_id++;
+  s->cmdsn = 1;
+  /* A random ISID, constant for a device, so that logging in again after
+     a reboot replaces the session left behind.  */
+  s->isid[0] = 0x80;
+  s->isid[2] = 'G';
+  s->isid[3] = 'R';
+  s->isid[4] = s->id >> 8;
+  s->isid[5] = s->id;
+
+  err = iscsi_probe (s);
+  if (err)
+    {
+      iscsi_logout (s);
+      iscsi_free (s);
+      return err;
+    }
+
+  /* Replace the device of the same name, if there is one.  */
+  if (iscsi_delete (args[0]))
+    grub_errno = GRUB_ERR_NONE;
+  s->next = iscsi_list;
+  iscsi_list = s;
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT (iscsi)
+{
+  grub_disk_dev_register (&grub_iscsi_dev);
+  cmd = grub_register_extcmd ("iscsi", grub_cmd_iscsi, 0,
+			      N_("[-d] [-l LUN] [-p PORT] [-i NAME]"
+				 " DEVICENAME SERVER TARGET"),
+			      N_("Make a disk of a logical unit of an iSCSI"
+				 " target."), options);
+}
+
+GRUB_MOD_FINI (iscsi)
+{
+  grub_unregister_extcmd (cmd);
+  grub_disk_dev_unregister (&grub_iscsi_dev);
+  while (iscsi_list)
+    {
+      struct iscsi_session *s = iscsi_list;
+
+      iscsi_list = s->next;
+      iscsi_free (s);
+    }
+}
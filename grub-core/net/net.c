@@ -56,30 +56,88 @@ struct grub_net_route *grub_net_routes = NULL;
 struct grub_net_network_level_interface *grub_net_network_level_interfaces = NULL;
 struct grub_net_card *grub_net_cards = NULL;
 struct grub_net_network_level_protocol *grub_net_network_level_protocols = NULL;
+char *(*grub_net_cache_lookup) (const char *key, const char *validator,
+				grub_uint64_t size) = NULL;
+void (*grub_net_cache_store) (const char *key, const char *validator,
+			      const char *buf, grub_uint64_t size) = NULL;
 static struct grub_fs grub_net_fs;
 
 struct grub_net_link_layer_entry {
   int avail;
   grub_net_network_level_address_t nl_address;
   grub_net_link_level_address_t ll_address;
+  /* Last time the entry was looked up, and last time the neighbour told
+     its address.  */
+  grub_uint64_t last_used;
+  grub_uint64_t confirmed;
 };
 
-#define LINK_LAYER_CACHE_SIZE 256
+/* The cache table of each card consists of LINK_LAYER_CACHE_SETS sets of
+   LINK_LAYER_CACHE_WAYS consecutive entries, the set given by a hash of
+   the network address.  Every ARP or neighbour discovery packet received
+   goes through it, so it must not be scanned whole.  */
+#define LINK_LAYER_CACHE_SETS 64
+#define LINK_LAYER_CACHE_WAYS 4
+#define LINK_LAYER_CACHE_SIZE (LINK_LAYER_CACHE_SETS * LINK_LAYER_CACHE_WAYS)
+
+/* Entries not confirmed for this long are resolved again, in case the
+   neighbour changed its hardware address.  */
+#define LINK_LAYER_CACHE_TIMEOUT_MS (5 * 60 * 1000)
+
+static struct grub_net_link_layer_entry *
+link_layer_get_set (const grub_net_network_level_address_t *proto,
+		    const struct grub_net_card *card)
+{
+  grub_uint32_t h;
+
+  switch (proto->type)
+    {
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4:
+      h = proto->ipv4;
+      break;
+    case GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6:
+      /* The interface identifier, mostly.  */
+      h = proto->ipv6[1] ^ (proto->ipv6[1] >> 32) ^ proto->ipv6[0];
+      break;
+    default:
+      h = 0;
+      break;
+    }
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return card->link_layer_table
+    + (h % LINK_LAYER_CACHE_SETS) * LINK_LAYER_CACHE_WAYS;
+}
+
+static int
+link_layer_expired (const struct grub_net_link_layer_entry *entry,
+		    grub_uint64_t now)
+{
+  return now - entry->confirmed > LINK_LAYER_CACHE_TIMEOUT_MS;
+}
 
 static struct grub_net_link_layer_entry *
 link_layer_find_entry (const grub_net_network_level_address_t *proto,
 		       const struct grub_net_card *card)
 {
+  struct grub_net_link_layer_entry *set;
+  grub_uint64_t now;
   unsigned i;
+
   if (!card->link_layer_table)
     return NULL;
-  for (i = 0; i < LINK_LAYER_CACHE_SIZE; i++)
-    {
-      if (card->link_layer_table[i].avail == 1 
-	  && grub_net_addr_cmp (&card->link_layer_table[i].nl_address,
-				proto) == 0)
-	return &card->link_layer_table[i];
-    }
+  set = link_layer_get_set (proto, card);
+  for (i = 0; i < LINK_LAYER_CACHE_WAYS; i++)
+    if (set[i].avail == 1 && grub_net_addr_cmp (&set[i].nl_address,
+						proto) == 0)
+      {
+	now = grub_get_time_ms ();
+	if (link_layer_expired (&set[i], now))
+	  return NULL;
+	set[i].last_used = now;
+	return &set[i];
+      }
   return NULL;
 }
 
@@ -89,27 +147,62 @@ grub_net_link_layer_add_address (struct grub_net_card *card,
 				 const grub_net_link_level_address_t *ll,
 				 int override)
 {
-  struct grub_net_link_layer_entry *entry;
+  struct grub_net_link_layer_entry *set, *entry = NULL;
+  grub_uint64_t now = grub_get_time_ms ();
+  unsigned i;
+
+  if (card->link_layer_table == NULL)
+    {
+      card->link_layer_table = grub_zalloc (LINK_LAYER_CACHE_SIZE
+					    * sizeof (card->link_layer_table[0]));
+      if (card->link_layer_table == NULL)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+    }
+
+  /* Prefer the entry already holding NL, then an empty one, then the
+     least recently used one.  */
+  set = link_layer_get_set (nl, card);
+  for (i = 0; i < LINK_LAYER_CACHE_WAYS; i++)
+    if (set[i].avail == 1 && grub_net_addr_cmp (&set[i].nl_address, nl) == 0)
+      {
+	entry = &set[i];
+	break;
+      }
 
-  /* Check if the sender is in the cache table.  */
-  entry = link_layer_find_entry (nl, card);
-  /* Update sender hardware address.  */
-  if (entry && override)
-    grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
   if (entry)
-    return;
+    {
+      /* Update sender hardware address.  */
+      if (override || link_layer_expired (entry, now))
+	entry->ll_address = *ll;
+      else if (grub_memcmp (&entry->ll_address, ll,
+			    sizeof (entry->ll_address)) != 0)
+	return;
+      entry->confirmed = now;
+      return;
+    }
 
-  /* Add sender to cache table.  */
-  if (card->link_layer_table == NULL)
-    card->link_layer_table = grub_zalloc (LINK_LAYER_CACHE_SIZE
-					  * sizeof (card->link_layer_table[0]));
-  entry = &(card->link_layer_table[card->new_ll_entry]);
+  for (i = 0; i < LINK_LAYER_CACHE_WAYS; i++)
+    {
+      if (set[i].avail != 1)
+	{
+	  entry = &set[i];
+	  break;
+	}
+      if (!entry || set[i].last_used < entry->last_used)
+	entry = &set[i];
+    }
+
+  /* Add sender to cache table.  Until it is looked up, it goes before
+     the entries in use, so that the ARP requests of other hosts don't
+     push out the gateway.  */
   entry->avail = 1;
-  grub_memcpy (&entry->ll_address, ll, sizeof (entry->ll_address));
-  grub_memcpy (&entry->nl_address, nl, sizeof (entry->nl_address));
-  card->new_ll_entry++;
-  if (card->new_ll_entry == LINK_LAYER_CACHE_SIZE)
-    card->new_ll_entry = 0;
+  entry->ll_address = *ll;
+  entry->nl_address = *nl;
+  entry->last_used = 0;
+  entry->confirmed = now;
 }
 
 int
@@ -207,9 +300,39 @@ grub_net_card_unregister (struct grub_net_card *card)
 	card->driver->close (card);
       card->opened = 0;
     }
+  grub_netbuff_pool_destroy (card->rx_pool);
+  card->rx_pool = NULL;
   grub_list_remove (GRUB_AS_LIST (card));
 }
 
+/* 256 buffers of 2K cover the bursts of received frames and a good part
+   of a queued TCP window; frames beyond them come from the heap.  */
+#define GRUB_NET_CARD_POOL_BUFFERS 256
+
+struct grub_net_buff *
+grub_net_card_alloc_buff (struct grub_net_card *card, grub_size_t len)
+{
+  struct grub_net_buff *nb;
+
+  if (!card->rx_pool)
+    {
+      /* The largest request of any driver for this MTU.  */
+      card->rx_pool = grub_netbuff_pool_new (ALIGN_UP (card->mtu, 64) + 256 + 2,
+					     GRUB_NET_CARD_POOL_BUFFERS);
+      if (!card->rx_pool)
+	grub_errno = GRUB_ERR_NONE;
+    }
+
+  if (len <= grub_netbuff_pool_len (card->rx_pool))
+    {
+      nb = grub_netbuff_pool_alloc (card->rx_pool);
+      if (nb)
+	return nb;
+    }
+
+  return grub_netbuff_alloc (len);
+}
+
 static struct grub_net_slaac_mac_list *
 grub_net_ipv6_get_slaac (struct grub_net_card *card,
 			 const grub_net_link_level_address_t *hwaddr)
@@ -1405,7 +1528,7 @@ grub_net_fs_open (struct grub_file *file_out, const char *name)
       grub_free (file);
       return err;
     }
-  bufio = grub_bufio_open (file, 32768);
+  bufio = grub_bufio_open (file, 32768, GRUB_BUFIO_HINT_SEQUENTIAL);
   if (! bufio)
     {
       while (file->device->net->packs.first)
@@ -1437,12 +1560,14 @@ grub_net_fs_close (grub_file_t file)
   return GRUB_ERR_NONE;
 }
 
-static void
+struct grub_net_stats grub_net_stats;
+
+static int
 receive_packets (struct grub_net_card *card, int *stop_condition)
 {
   int received = 0;
   if (card->num_ifaces == 0)
-    return;
+    return 0;
   if (!card->opened)
     {
       grub_err_t err = GRUB_ERR_NONE;
@@ -1451,7 +1576,7 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
       if (err)
 	{
 	  grub_errno = GRUB_ERR_NONE;
-	  return;
+	  return 0;
 	}
       card->opened = 1;
     }
@@ -1471,6 +1596,8 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
 	  break;
 	}
       received++;
+      grub_net_stats.rx_packets++;
+      grub_net_stats.rx_bytes += nb->tail - nb->data;
       grub_net_recv_ethernet_packet (nb, card);
       if (grub_errno)
 	{
@@ -1480,6 +1607,7 @@ receive_packets (struct grub_net_card *card, int *stop_condition)
 	}
     }
   grub_print_error ();
+  return received;
 }
 
 static char *
@@ -1524,12 +1652,23 @@ void
 grub_net_poll_cards (unsigned time, int *stop_condition)
 {
   struct grub_net_card *card;
-  grub_uint64_t start_time;
-  start_time = grub_get_time_ms ();
-  while ((grub_get_time_ms () - start_time) < time
+  grub_uint64_t start_time, now;
+  start_time = now = grub_get_time_ms ();
+  while ((now - start_time) < time
 	 && (!stop_condition || !*stop_condition))
-    FOR_NET_CARDS (card)
-      receive_packets (card, stop_condition);
+    {
+      grub_uint64_t round_start = now;
+      int received = 0;
+
+      FOR_NET_CARDS (card)
+	received += receive_packets (card, stop_condition);
+      /* Rounds shorter than a millisecond still add up right on average,
+	 as the chance of one spanning a tick is its length.  */
+      now = grub_get_time_ms ();
+      grub_net_stats.poll_ms += now - round_start;
+      if (received)
+	grub_net_stats.poll_busy_ms += now - round_start;
+    }
   grub_net_tcp_retransmit ();
 }
 
@@ -1662,6 +1801,14 @@ grub_net_seek_real (struct grub_file *file, grub_off_t offset)
 static grub_ssize_t
 grub_net_fs_read (grub_file_t file, char *buf, grub_size_t len)
 {
+  if (file->device->net->mem)
+    {
+      grub_memcpy (buf, file->device->net->mem + file->offset, len);
+      file->device->net->offset = file->offset + len;
+      if (grub_file_progress_hook)
+	grub_file_progress_hook (0, 0, len, file);
+      return len;
+    }
   if (file->offset != file->device->net->offset)
     {
       grub_err_t err;
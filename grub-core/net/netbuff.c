@@ -94,6 +94,7 @@ grub_netbuff_alloc (grub_size_t len)
 				 + len / sizeof (grub_properly_aligned_t));
   nb->head = nb->data = nb->tail = data;
   nb->end = (grub_uint8_t *) nb;
+  nb->pool = NULL;
   return nb;
 }
 
@@ -117,12 +118,115 @@ grub_netbuff_make_pkt (grub_size_t len)
   return NULL;
 }
 
+struct grub_net_buff_pool
+{
+  grub_size_t len;
+  unsigned count;
+  /* Buffers not handed out, NFREE of them at the start of FREE.  */
+  struct grub_net_buff **free;
+  unsigned nfree;
+  int dead;
+  /* COUNT buffers of LEN bytes and their descriptors.  Keeping the
+     descriptors out of the slab lets each buffer take exactly LEN bytes
+     rounded to NETBUFF_ALIGN.  */
+  grub_uint8_t *slab;
+  struct grub_net_buff *bufs;
+};
+
+static void
+pool_free (struct grub_net_buff_pool *pool)
+{
+  grub_free (pool->slab);
+  grub_free (pool->bufs);
+  grub_free (pool->free);
+  grub_free (pool);
+}
+
+struct grub_net_buff_pool *
+grub_netbuff_pool_new (grub_size_t len, unsigned count)
+{
+  struct grub_net_buff_pool *pool;
+  unsigned i;
+
+  if (len < NETBUFFMINLEN)
+    len = NETBUFFMINLEN;
+  len = ALIGN_UP (len, NETBUFF_ALIGN);
+
+  pool = grub_zalloc (sizeof (*pool));
+  if (!pool)
+    return NULL;
+  pool->len = len;
+  pool->count = count;
+  pool->free = grub_malloc (count * sizeof (pool->free[0]));
+  pool->bufs = grub_malloc (count * sizeof (pool->bufs[0]));
+#ifdef GRUB_MACHINE_EMU
+  pool->slab = grub_malloc (count * len);
+#else
+  pool->slab = grub_memalign (NETBUFF_ALIGN, count * len);
+#endif
+  if (!pool->free || !pool->bufs || !pool->slab)
+    {
+      pool_free (pool);
+      return NULL;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      struct grub_net_buff *nb = &pool->bufs[i];
+
+      nb->head = nb->data = nb->tail = pool->slab + i * len;
+      nb->end = nb->head + len;
+      nb->pool = pool;
+      pool->free[i] = nb;
+    }
+  pool->nfree = count;
+  return pool;
+}
+
+struct grub_net_buff *
+grub_netbuff_pool_alloc (struct grub_net_buff_pool *pool)
+{
+  struct grub_net_buff *nb;
+
+  if (!pool || pool->dead || !pool->nfree)
+    return NULL;
+  nb = pool->free[--pool->nfree];
+  nb->data = nb->tail = nb->head;
+  return nb;
+}
+
+grub_size_t
+grub_netbuff_pool_len (const struct grub_net_buff_pool *pool)
+{
+  return pool ? pool->len : 0;
+}
+
+void
+grub_netbuff_pool_destroy (struct grub_net_buff_pool *pool)
+{
+  if (!pool)
+    return;
+  pool->dead = 1;
+  if (pool->nfree == pool->count)
+    pool_free (pool);
+}
+
 void
 grub_netbuff_free (struct grub_net_buff *nb)
 {
+  struct grub_net_buff_pool *pool;
+
   if (!nb)
     return;
-  grub_free (nb->head);
+  pool = nb->pool;
+  if (!pool)
+    {
+      grub_free (nb->head);
+      return;
+    }
+  pool->free[pool->nfree++] = nb;
+  if (pool->dead && pool->nfree == pool->count)
+    pool_free (pool);
 }
 
 grub_err_t
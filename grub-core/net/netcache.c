@@ -0,0 +1,607 @@
+/* netcache.c - keep downloaded files on a local partition  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The cache is a partition formatted by "netcache --format", laid out as
+   a header, the index, the manifests and the chunks.  Files are split in
+   chunks of NETCACHE_CHUNK_SIZE bytes, each stored once in a slot however
+   many files have it and known by its SHA-256, which the index gives for
+   every slot.  A manifest names a file, the version of it the server had
+   and the hashes of its chunks.
+
+   Chunks are checked against their hash when read back, and a manifest is
+   cleared before the slots it refers to can be reused, so that a store
+   interrupted halfway at worst misses.  */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/disk.h>
+#include <grub/net.h>
+#include <grub/crypto.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define NETCACHE_MAGIC "GRUB netcache 1"
+#define NETCACHE_CHUNK_BITS 20
+#define NETCACHE_CHUNK_SIZE (1 << NETCACHE_CHUNK_BITS)
+#define NETCACHE_CHUNK_SECTORS (NETCACHE_CHUNK_SIZE >> GRUB_DISK_SECTOR_BITS)
+#define NETCACHE_HASH_SIZE 32
+#define NETCACHE_MANIFESTS 64
+#define NETCACHE_MANIFEST_SECTORS 128
+/* Chunks a manifest has room for after its first sector.  */
+#define NETCACHE_MAX_CHUNKS (((NETCACHE_MANIFEST_SECTORS - 1)		\
+			      << GRUB_DISK_SECTOR_BITS) / NETCACHE_HASH_SIZE)
+#define NETCACHE_HEADER_SECTORS 8
+#define NETCACHE_INDEX_START NETCACHE_HEADER_SECTORS
+
+struct netcache_header
+{
+  char magic[16];
+  grub_uint64_t nslots;
+  /* Bumped by every use of a manifest, to tell the least recently used.  */
+  grub_uint64_t clock;
+} GRUB_PACKED;
+
+/* The first sector of a manifest; the chunk hashes follow.  */
+struct netcache_manifest
+{
+  /* 0 if the manifest is free.  */
+  grub_uint64_t last_use;
+  grub_uint64_t size;
+  char key[248];
+  char validator[248];
+} GRUB_PACKED;
+
+static char *cache_name;
+static struct netcache_header header;
+static grub_uint8_t (*slots)[NETCACHE_HASH_SIZE];
+static struct netcache_manifest manifests[NETCACHE_MANIFESTS];
+/* Slots by hash, slot + 1 in each entry and 0 for none, probed linearly
+   from the first bytes of the hash.  Entries of slots which got another
+   chunk since are left behind and skipped.  */
+static grub_uint32_t *table;
+static grub_uint64_t table_size, table_used;
+static const gcry_md_spec_t *sha256;
+/* Where to look for a free slot next.  */
+static grub_uint64_t next_slot;
+
+static grub_disk_addr_t
+manifest_sector (unsigned i)
+{
+  return NETCACHE_INDEX_START
+    + ((header.nslots * NETCACHE_HASH_SIZE + GRUB_DISK_SECTOR_SIZE - 1)
+       >> GRUB_DISK_SECTOR_BITS)
+    + (grub_disk_addr_t) i * NETCACHE_MANIFEST_SECTORS;
+}
+
+static grub_disk_addr_t
+chunk_sector (grub_uint64_t slot)
+{
+  return manifest_sector (NETCACHE_MANIFESTS)
+    + slot * NETCACHE_CHUNK_SECTORS;
+}
+
+static grub_uint64_t
+chunk_count (grub_uint64_t size)
+{
+  return (size + NETCACHE_CHUNK_SIZE - 1) >> NETCACHE_CHUNK_BITS;
+}
+
+static grub_size_t
+chunk_len (grub_uint64_t size, grub_uint64_t chunk)
+{
+  grub_uint64_t left = size - (chunk << NETCACHE_CHUNK_BITS);
+
+  return left < NETCACHE_CHUNK_SIZE ? left : NETCACHE_CHUNK_SIZE;
+}
+
+static int
+slot_empty (grub_uint64_t slot)
+{
+  unsigned i;
+
+  for (i = 0; i < NETCACHE_HASH_SIZE; i++)
+    if (slots[slot][i])
+      return 0;
+  return 1;
+}
+
+static grub_uint64_t
+table_pos (const grub_uint8_t *hash)
+{
+  grub_uint64_t pos;
+
+  grub_memcpy (&pos, hash, sizeof (pos));
+  return pos & (table_size - 1);
+}
+
+static void
+table_add (grub_uint64_t slot)
+{
+  grub_uint64_t pos = table_pos (slots[slot]);
+
+  while (table[pos])
+    pos = (pos + 1) & (table_size - 1);
+  table[pos] = slot + 1;
+  table_used++;
+}
+
+/* Index the slots afresh, at most a quarter full.  */
+static grub_err_t
+table_build (void)
+{
+  grub_uint64_t slot;
+
+  grub_free (table);
+  for (table_size = 1; table_size < 4 * header.nslots; table_size <<= 1);
+  table = grub_zalloc (table_size * sizeof (table[0]));
+  if (!table)
+    return grub_errno;
+  table_used = 0;
+  for (slot = 0; slot < header.nslots; slot++)
+    if (!slot_empty (slot))
+      table_add (slot);
+  return GRUB_ERR_NONE;
+}
+
+/* Give SLOT the chunk of hash HASH.  */
+static grub_err_t
+set_slot (grub_uint64_t slot, const grub_uint8_t *hash)
+{
+  grub_memcpy (slots[slot], hash, NETCACHE_HASH_SIZE);
+  if (table_used >= table_size / 2)
+    return table_build ();
+  table_add (slot);
+  return GRUB_ERR_NONE;
+}
+
+/* The slot holding the chunk of hash HASH, or header.nslots.  */
+static grub_uint64_t
+find_slot (const grub_uint8_t *hash)
+{
+  grub_uint64_t pos = table_pos (hash);
+
+  for (; table[pos]; pos = (pos + 1) & (table_size - 1))
+    if (grub_memcmp (slots[table[pos] - 1], hash, NETCACHE_HASH_SIZE) == 0)
+      return table[pos] - 1;
+  return header.nslots;
+}
+
+static grub_disk_t
+cache_open (void)
+{
+  grub_disk_t disk = grub_disk_open (cache_name);
+
+  if (disk)
+    disk->streaming = 1;
+  return disk;
+}
+
+static grub_err_t
+write_header (grub_disk_t disk)
+{
+  return grub_disk_write (disk, 0, 0, sizeof (header), &header);
+}
+
+static grub_err_t
+write_manifest (grub_disk_t disk, unsigned i)
+{
+  return grub_disk_write (disk, manifest_sector (i), 0,
+			  sizeof (manifests[i]), &manifests[i]);
+}
+
+static char *
+netcache_lookup (const char *key, const char *validator, grub_uint64_t size)
+{
+  grub_uint8_t (*hashes)[NETCACHE_HASH_SIZE] = NULL;
+  grub_uint8_t hash[NETCACHE_HASH_SIZE];
+  grub_uint64_t n = chunk_count (size), c;
+  grub_disk_t disk = NULL;
+  char *buf = NULL;
+  unsigned i;
+
+  for (i = 0; i < NETCACHE_MANIFESTS; i++)
+    if (manifests[i].last_use && manifests[i].size == size
+	&& grub_strcmp (manifests[i].key, key) == 0
+	&& grub_strcmp (manifests[i].validator, validator) == 0)
+      break;
+  if (i == NETCACHE_MANIFESTS)
+    return NULL;
+
+  disk = cache_open ();
+  hashes = grub_malloc (n * NETCACHE_HASH_SIZE);
+  buf = grub_malloc (size ? : 1);
+  if (!disk || !hashes || !buf
+      || grub_disk_read (disk, manifest_sector (i) + 1, 0,
+			 n * NETCACHE_HASH_SIZE, hashes))
+    goto miss;
+
+  for (c = 0; c < n; c++)
+    {
+      grub_uint64_t slot = find_slot (hashes[c]);
+      grub_size_t len = chunk_len (size, c);
+      char *dst = buf + (c << NETCACHE_CHUNK_BITS);
+
+      if (slot == header.nslots
+	  || grub_disk_read (disk, chunk_sector (slot), 0, len, dst))
+	goto miss;
+      grub_crypto_hash (sha256, hash, dst, len);
+      if (grub_memcmp (hash, hashes[c], NETCACHE_HASH_SIZE) != 0)
+	{
+	  grub_dprintf ("netcache", "chunk %" PRIuGRUB_UINT64_T
+			" of %s is corrupt\n", c, key);
+	  goto miss;
+	}
+    }
+
+  manifests[i].last_use = ++header.clock;
+  if (write_manifest (disk, i) || write_header (disk))
+    grub_errno = GRUB_ERR_NONE;
+  grub_dprintf ("netcache", "%s read from the cache\n", key);
+  grub_disk_close (disk);
+  grub_free (hashes);
+  return buf;
+
+ miss:
+  grub_errno = GRUB_ERR_NONE;
+  if (disk)
+    grub_disk_close (disk);
+  grub_free (hashes);
+  grub_free (buf);
+  return NULL;
+}
+
+static grub_err_t
+store (grub_disk_t disk, unsigned m, const char *key, const char *validator,
+       const char *buf, grub_uint64_t size)
+{
+  grub_uint8_t (*hashes)[NETCACHE_HASH_SIZE], (*other)[NETCACHE_HASH_SIZE];
+  grub_uint64_t n = chunk_count (size), c, s;
+  grub_uint8_t *used;
+  grub_err_t err = GRUB_ERR_NONE;
+  unsigned i;
+
+  hashes = grub_malloc (n * NETCACHE_HASH_SIZE);
+  other = grub_malloc (NETCACHE_MAX_CHUNKS * NETCACHE_HASH_SIZE);
+  used = grub_zalloc ((header.nslots + 7) / 8);
+  if (!hashes || !other || !used)
+    {
+      err = grub_errno;
+      goto out;
+    }
+
+  /* The chunks of the other manifests stay.  */
+  for (i = 0; i < NETCACHE_MANIFESTS; i++)
+    {
+      grub_uint64_t count = chunk_count (manifests[i].size);
+
+      if (i == m || !manifests[i].last_use)
+	continue;
+      err = grub_disk_read (disk, manifest_sector (i) + 1, 0,
+			    count * NETCACHE_HASH_SIZE, other);
+      if (err)
+	goto out;
+      for (c = 0; c < count; c++)
+	{
+	  s = find_slot (other[c]);
+	  if (s < header.nslots)
+	    used[s / 8] |= 1 << (s % 8);
+	}
+    }
+
+  for (c = 0; c < n; c++)
+    {
+      grub_size_t len = chunk_len (size, c);
+      const char *src = buf + (c << NETCACHE_CHUNK_BITS);
+
+      grub_crypto_hash (sha256, hashes[c], src, len);
+      s = find_slot (hashes[c]);
+      if (s == header.nslots)
+	{
+	  grub_uint64_t tried;
+
+	  for (tried = 0; tried < header.nslots; tried++)
+	    {
+	      s = next_slot++ % header.nslots;
+	      if (!(used[s / 8] & (1 << (s % 8))))
+		break;
+	    }
+	  if (tried == header.nslots)
+	    {
+	      err = grub_error (GRUB_ERR_OUT_OF_RANGE,
+				"not enough room in the cache");
+	      goto out;
+	    }
+	  /* The old hash stays until the new chunk is in.  */
+	  err = grub_disk_write (disk, chunk_sector (s), 0, len, src);
+	  if (!err)
+	    err = grub_disk_write (disk, NETCACHE_INDEX_START,
+				   s * NETCACHE_HASH_SIZE, NETCACHE_HASH_SIZE,
+				   hashes[c]);
+	  if (!err)
+	    err = set_slot (s, hashes[c]);
+	  if (err)
+	    goto out;
+	}
+      used[s / 8] |= 1 << (s % 8);
+    }
+
+  err = grub_disk_write (disk, manifest_sector (m) + 1, 0,
+			 n * NETCACHE_HASH_SIZE, hashes);
+  if (err)
+    goto out;
+  grub_memset (&manifests[m], 0, sizeof (manifests[m]));
+  manifests[m].last_use = ++header.clock;
+  manifests[m].size = size;
+  grub_strcpy (manifests[m].key, key);
+  grub_strcpy (manifests[m].validator, validator);
+  err = write_manifest (disk, m);
+  if (!err)
+    err = write_header (disk);
+
+ out:
+  grub_free (hashes);
+  grub_free (other);
+  grub_free (used);
+  return err;
+}
+
+static void
+netcache_store (const char *key, const char *validator, const char *buf,
+		grub_uint64_t size)
+{
+  grub_disk_t disk;
+  unsigned i, m = NETCACHE_MANIFESTS;
+
+  if (grub_strlen (key) >= sizeof (manifests[0].key)
+      || grub_strlen (validator) >= sizeof (manifests[0].validator)
+      || chunk_count (size) > NETCACHE_MAX_CHUNKS)
+    return;
+
+  /* The older version of the same file, a free manifest or the least
+     recently used.  */
+  for (i = 0; i < NETCACHE_MANIFESTS; i++)
+    if (manifests[i].last_use && grub_strcmp (manifests[i].key, key) == 0)
+      {
+	m = i;
+	break;
+      }
+  if (m == NETCACHE_MANIFESTS)
+    for (i = 0, m = 0; i < NETCACHE_MANIFESTS; i++)
+      if (manifests[i].last_use < manifests[m].last_use)
+	m = i;
+
+  disk = cache_open ();
+  if (!disk)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  /* Nothing may refer to the chunks about to be overwritten.  */
+  manifests[m].last_use = 0;
+  if (write_manifest (disk, m)
+      || store (disk, m, key, validator, buf, size))
+    {
+      grub_dprintf ("netcache", "couldn't store %s: %s\n", key, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+  else
+    grub_dprintf ("netcache", "%s stored in the cache\n", key);
+  grub_disk_close (disk);
+}
+
+static void
+netcache_off (void)
+{
+  grub_net_cache_lookup = NULL;
+  grub_net_cache_store = NULL;
+  grub_free (cache_name);
+  cache_name = NULL;
+  grub_free (slots);
+  slots = NULL;
+  grub_free (table);
+  table = NULL;
+}
+
+static grub_err_t
+netcache_format (grub_disk_t disk)
+{
+  grub_uint64_t size = grub_disk_get_size (disk), avail, done, len;
+  grub_uint8_t zero[GRUB_DISK_SECTOR_SIZE];
+  grub_err_t err;
+  unsigned i;
+
+  grub_memset (&header, 0, sizeof (header));
+  grub_memcpy (header.magic, NETCACHE_MAGIC, sizeof (header.magic));
+  avail = size - NETCACHE_HEADER_SECTORS
+    - NETCACHE_MANIFESTS * NETCACHE_MANIFEST_SECTORS;
+  if (size == GRUB_DISK_SIZE_UNKNOWN
+      || size < NETCACHE_HEADER_SECTORS
+      + NETCACHE_MANIFESTS * NETCACHE_MANIFEST_SECTORS
+      + 2 * NETCACHE_CHUNK_SECTORS)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "partition too small");
+  /* Each slot takes its chunk and its hash in the index.  */
+  header.nslots = grub_divmod64 (avail << GRUB_DISK_SECTOR_BITS,
+				 NETCACHE_CHUNK_SIZE + NETCACHE_HASH_SIZE, 0);
+
+  grub_memset (zero, 0, sizeof (zero));
+  len = (header.nslots * NETCACHE_HASH_SIZE + GRUB_DISK_SECTOR_SIZE - 1)
+    >> GRUB_DISK_SECTOR_BITS;
+  for (done = 0; done < len; done++)
+    {
+      err = grub_disk_write (disk, NETCACHE_INDEX_START + done, 0,
+			     sizeof (zero), zero);
+      if (err)
+	return err;
+    }
+  for (i = 0; i < NETCACHE_MANIFESTS; i++)
+    {
+      err = grub_disk_write (disk, manifest_sector (i), 0, sizeof (zero),
+			     zero);
+      if (err)
+	return err;
+    }
+  return write_header (disk);
+}
+
+static grub_err_t
+netcache_on (const char *name, int format)
+{
+  grub_disk_t disk;
+  grub_err_t err;
+  unsigned i;
+
+  sha256 = grub_crypto_lookup_md_by_name ("sha256");
+  if (!sha256)
+    return grub_error (GRUB_ERR_FILE_NOT_FOUND,
+		       N_("no %s found"), "sha256");
+
+  netcache_off ();
+  disk = grub_disk_open (name);
+  if (!disk)
+    return grub_errno;
+  err = format ? netcache_format (disk)
+    : grub_disk_read (disk, 0, 0, sizeof (header), &header);
+  if (err)
+    goto fail;
+  if (grub_memcmp (header.magic, NETCACHE_MAGIC, sizeof (header.magic)) != 0
+      || !header.nslots
+      || chunk_sector (header.nslots) > grub_disk_get_size (disk))
+    {
+      err = grub_error (GRUB_ERR_BAD_FS, "not a netcache partition");
+      goto fail;
+    }
+
+  slots = grub_malloc (header.nslots * NETCACHE_HASH_SIZE);
+  if (!slots)
+    {
+      err = grub_errno;
+      goto fail;
+    }
+  err = grub_disk_read (disk, NETCACHE_INDEX_START, 0,
+			header.nslots * NETCACHE_HASH_SIZE, slots);
+  if (!err)
+    err = table_build ();
+  for (i = 0; !err && i < NETCACHE_MANIFESTS; i++)
+    err = grub_disk_read (disk, manifest_sector (i), 0,
+			  sizeof (manifests[i]), &manifests[i]);
+  if (err)
+    goto fail;
+  for (i = 0; i < NETCACHE_MANIFESTS; i++)
+    {
+      manifests[i].key[sizeof (manifests[i].key) - 1] = 0;
+      manifests[i].validator[sizeof (manifests[i].validator) - 1] = 0;
+      if (chunk_count (manifests[i].size) > NETCACHE_MAX_CHUNKS)
+	manifests[i].last_use = 0;
+    }
+
+  cache_name = grub_strdup (name);
+  if (!cache_name)
+    {
+      err = grub_errno;
+      goto fail;
+    }
+  grub_disk_close (disk);
+  grub_net_cache_lookup = netcache_lookup;
+  grub_net_cache_store = netcache_store;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_disk_close (disk);
+  netcache_off ();
+  return err;
+}
+
+static const struct grub_arg_option options[] =
+  {
+    {"format", 'f', 0, N_("Format DEVICE as a cache first."), 0, 0},
+    {"off", 'o', 0, N_("Stop using the cache."), 0, 0},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static grub_err_t
+grub_cmd_netcache (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_uint64_t used = 0, s;
+  grub_size_t len;
+  unsigned i;
+
+  if (state[1].set)
+    {
+      netcache_off ();
+      return GRUB_ERR_NONE;
+    }
+
+  if (argc == 1)
+    {
+      char *name = args[0];
+      grub_err_t err;
+
+      len = grub_strlen (name);
+      if (name[0] == '(' && name[len - 1] == ')')
+	{
+	  name = grub_strndup (name + 1, len - 2);
+	  if (!name)
+	    return grub_errno;
+	}
+      err = netcache_on (name, state[0].set);
+      if (name != args[0])
+	grub_free (name);
+      return err;
+    }
+  if (argc)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  if (!cache_name)
+    {
+      grub_printf_ (N_("No cache in use.\n"));
+      return GRUB_ERR_NONE;
+    }
+  for (s = 0; s < header.nslots; s++)
+    if (!slot_empty (s))
+      used++;
+  grub_printf_ (N_("Cache on %s: %" PRIuGRUB_UINT64_T " of %"
+		   PRIuGRUB_UINT64_T " MiB used\n"), cache_name, used,
+		header.nslots);
+  for (i = 0; i < NETCACHE_MANIFESTS; i++)
+    if (manifests[i].last_use)
+      grub_printf ("%s\t%" PRIuGRUB_UINT64_T "\t%s\n", manifests[i].key,
+		   manifests[i].size, manifests[i].validator);
+  return GRUB_ERR_NONE;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(netcache)
+{
+  cmd = grub_register_extcmd ("netcache", grub_cmd_netcache, 0,
+			      N_("[--format] [DEVICE] | --off"),
+			      N_("Keep downloaded files on DEVICE and read"
+				 " them from there while they don't change."),
+			      options);
+}
+
+GRUB_MOD_FINI(netcache)
+{
+  netcache_off ();
+  grub_unregister_extcmd (cmd);
+}
@@ -22,12 +22,28 @@
 #include <grub/net/netbuff.h>
 #include <grub/time.h>
 #include <grub/priority_queue.h>
+#include <grub/env.h>
 
 #define TCP_SYN_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_SYN_RETRANSMISSION_COUNT GRUB_NET_TRIES
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/* Receive window used unless net_tcp_window says otherwise, and the limits
+   of the latter.  Anything above 64 KiB needs the peer to agree to window
+   scaling (RFC 7323).  */
+#define TCP_DEFAULT_WINDOW (1 << 20)
+#define TCP_MIN_WINDOW 8192
+#define TCP_MAX_WINDOW (16 << 20)
+#define TCP_MAX_WINDOW_SCALE 14
+
+/* The most SACK blocks an ACK carries, all that fit in the options.  */
+#define TCP_SACK_BLOCKS 4
+/* Duplicate ACKs triggering a fast retransmit (RFC 5681).  */
+#define TCP_DUP_ACK_THRESHOLD 3
+/* Queued segments taken off the reassembly queue at once.  */
+#define TCP_REASSEMBLY_BATCH 32
+
 struct unacked
 {
   struct unacked *next;
@@ -35,6 +51,7 @@ struct unacked
   struct grub_net_buff *nb;
   grub_uint64_t last_try;
   int try_count;
+  int sacked;
 };
 
 enum
@@ -47,6 +64,21 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_END = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_WINDOW_SCALE = 3,
+    TCP_OPT_SACK_PERMITTED = 4,
+    TCP_OPT_SACK = 5,
+  };
+
+struct tcp_sack_block
+{
+  grub_uint32_t start;
+  grub_uint32_t end;
+};
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +97,18 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  grub_uint32_t my_window;
+  int my_window_scale;
+  int window_scaling;
+  int sack_ok;
+  /* Out-of-order data we hold, most recently extended first.  */
+  struct tcp_sack_block sack[TCP_SACK_BLOCKS];
+  int nsack;
+  /* Fast retransmit state of the data we send.  */
+  grub_uint32_t last_ack;
+  int dup_acks;
+  int in_recovery;
+  grub_uint32_t recover;
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -130,6 +173,243 @@ static struct grub_net_tcp_listen *tcp_listens;
 #define FOR_TCP_SOCKETS(var) FOR_LIST_ELEMENTS (var, tcp_sockets)
 #define FOR_TCP_LISTENS(var) FOR_LIST_ELEMENTS (var, tcp_listens)
 
+/* Size the receive window of SOCK from net_tcp_window and pick the
+   smallest scale which lets the header carry it.  */
+static void
+tcp_init_window (grub_net_tcp_socket_t sock)
+{
+  const char *val = grub_env_get ("net_tcp_window");
+  unsigned long window = TCP_DEFAULT_WINDOW;
+
+  if (val)
+    {
+      window = grub_strtoul (val, 0, 0);
+      if (grub_errno)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  window = TCP_DEFAULT_WINDOW;
+	}
+    }
+  if (window < TCP_MIN_WINDOW)
+    window = TCP_MIN_WINDOW;
+  if (window > TCP_MAX_WINDOW)
+    window = TCP_MAX_WINDOW;
+
+  sock->my_window = window;
+  sock->my_window_scale = 0;
+  while ((sock->my_window >> sock->my_window_scale) > 0xffff
+	 && sock->my_window_scale < TCP_MAX_WINDOW_SCALE)
+    sock->my_window_scale++;
+}
+
+/* Called once the handshake tells whether the peer scales windows.  */
+static void
+tcp_set_window_scaling (grub_net_tcp_socket_t sock, int enabled)
+{
+  sock->window_scaling = enabled;
+  if (enabled)
+    return;
+  sock->my_window_scale = 0;
+  if (sock->my_window > 0xffff)
+    sock->my_window = 0xffff;
+}
+
+/* The window field of a segment other than SYN, which is never scaled.  */
+static grub_uint16_t
+tcp_window (grub_net_tcp_socket_t sock)
+{
+  if (sock->i_stall)
+    return 0;
+  return grub_cpu_to_be16 (sock->my_window >> sock->my_window_scale);
+}
+
+static grub_uint16_t
+tcp_syn_window (grub_net_tcp_socket_t sock)
+{
+  return grub_cpu_to_be16 (sock->my_window > 0xffff ? 0xffff
+			   : sock->my_window);
+}
+
+/* Sequence numbers compare modulo 2^32.  */
+static inline int
+tcp_seq_lt (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+static inline int
+tcp_seq_le (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) <= 0;
+}
+
+/* Return the option KIND in the options of TCPH or NULL.  */
+static const grub_uint8_t *
+tcp_find_option (const struct tcphdr *tcph, grub_uint8_t kind)
+{
+  const grub_uint8_t *opt = (const grub_uint8_t *) (tcph + 1);
+  const grub_uint8_t *end = (const grub_uint8_t *) tcph
+    + (grub_be_to_cpu16 (tcph->flags) >> 12) * sizeof (grub_uint32_t);
+
+  while (opt < end)
+    {
+      if (*opt == TCP_OPT_END)
+	break;
+      if (*opt == TCP_OPT_NOP)
+	{
+	  opt++;
+	  continue;
+	}
+      if (end - opt < 2 || opt[1] < 2 || opt[1] > end - opt)
+	break;
+      if (opt[0] == kind)
+	return opt;
+      opt += opt[1];
+    }
+  return NULL;
+}
+
+/* Return the window scale offered in the options of TCPH or -1.  */
+static int
+tcp_window_scale_option (const struct tcphdr *tcph)
+{
+  const grub_uint8_t *opt = tcp_find_option (tcph, TCP_OPT_WINDOW_SCALE);
+
+  if (!opt || opt[1] != 3)
+    return -1;
+  return opt[2] > TCP_MAX_WINDOW_SCALE ? TCP_MAX_WINDOW_SCALE : opt[2];
+}
+
+static int
+tcp_sack_permitted_option (const struct tcphdr *tcph)
+{
+  const grub_uint8_t *opt = tcp_find_option (tcph, TCP_OPT_SACK_PERMITTED);
+
+  return opt && opt[1] == 2;
+}
+
+/* Append LEN bytes of options, a multiple of 4, to the header in NB.  */
+static grub_err_t
+tcp_put_options (struct grub_net_buff *nb, const grub_uint8_t *opts,
+		 grub_size_t len)
+{
+  struct tcphdr *tcph = (struct tcphdr *) nb->data;
+  grub_uint8_t *opt;
+  grub_err_t err;
+
+  opt = nb->tail;
+  err = grub_netbuff_put (nb, len);
+  if (err)
+    return err;
+  grub_memcpy (opt, opts, len);
+  tcph->flags = grub_cpu_to_be16 (grub_be_to_cpu16 (tcph->flags)
+				  + ((len / 4) << 12));
+  return GRUB_ERR_NONE;
+}
+
+/* Append the window scale and SACK permitted options to the SYN in NB.  */
+static grub_err_t
+tcp_put_syn_options (struct grub_net_buff *nb, grub_net_tcp_socket_t sock,
+		     int window_scale, int sack)
+{
+  grub_uint8_t opts[8];
+  grub_size_t len = 0;
+
+  if (window_scale)
+    {
+      opts[len++] = TCP_OPT_NOP;
+      opts[len++] = TCP_OPT_WINDOW_SCALE;
+      opts[len++] = 3;
+      opts[len++] = sock->my_window_scale;
+    }
+  if (sack)
+    {
+      opts[len++] = TCP_OPT_NOP;
+      opts[len++] = TCP_OPT_NOP;
+      opts[len++] = TCP_OPT_SACK_PERMITTED;
+      opts[len++] = 2;
+    }
+  if (!len)
+    return GRUB_ERR_NONE;
+  return tcp_put_options (nb, opts, len);
+}
+
+/* Note that [START, END) arrived out of order.  */
+static void
+tcp_sack_add (grub_net_tcp_socket_t sock, grub_uint32_t start,
+	      grub_uint32_t end)
+{
+  struct tcp_sack_block merged = { start, end };
+  int i, n = 0;
+
+  /* Fold every block touching the new one into it, keep the others.  */
+  for (i = 0; i < sock->nsack; i++)
+    {
+      struct tcp_sack_block *b = &sock->sack[i];
+
+      if (tcp_seq_le (b->start, merged.end)
+	  && tcp_seq_le (merged.start, b->end))
+	{
+	  if (tcp_seq_lt (b->start, merged.start))
+	    merged.start = b->start;
+	  if (tcp_seq_lt (merged.end, b->end))
+	    merged.end = b->end;
+	}
+      else
+	sock->sack[n++] = *b;
+    }
+
+  /* The block just extended goes first (RFC 2018).  */
+  if (n == TCP_SACK_BLOCKS)
+    n--;
+  grub_memmove (sock->sack + 1, sock->sack, n * sizeof (sock->sack[0]));
+  sock->sack[0] = merged;
+  sock->nsack = n + 1;
+}
+
+/* Forget the blocks which are no longer ahead of what was received.  */
+static void
+tcp_sack_prune (grub_net_tcp_socket_t sock)
+{
+  int i, n = 0;
+
+  for (i = 0; i < sock->nsack; i++)
+    if (tcp_seq_lt (sock->their_cur_seq, sock->sack[i].end))
+      sock->sack[n++] = sock->sack[i];
+  sock->nsack = n;
+}
+
+/* Mark the unacknowledged segments the peer reports holding in TCPH.  */
+static void
+tcp_sack_mark (grub_net_tcp_socket_t sock, const struct tcphdr *tcph)
+{
+  const grub_uint8_t *opt = tcp_find_option (tcph, TCP_OPT_SACK);
+  struct unacked *unack;
+  int i, n;
+
+  if (!opt || opt[1] < 10 || (opt[1] - 2) % 8)
+    return;
+  n = (opt[1] - 2) / 8;
+
+  for (unack = sock->unack_first; unack; unack = unack->next)
+    {
+      struct tcphdr *u = (struct tcphdr *) unack->nb->data;
+      grub_uint32_t start = grub_be_to_cpu32 (u->seqnr);
+      grub_uint32_t end = start + (unack->nb->tail - unack->nb->data
+				   - (grub_be_to_cpu16 (u->flags) >> 12) * 4);
+
+      for (i = 0; i < n; i++)
+	{
+	  grub_uint32_t left = grub_get_unaligned32 (opt + 2 + 8 * i);
+	  grub_uint32_t right = grub_get_unaligned32 (opt + 6 + 8 * i);
+
+	  if (tcp_seq_le (grub_be_to_cpu32 (left), start)
+	      && tcp_seq_le (end, grub_be_to_cpu32 (right)))
+	    unack->sacked = 1;
+	}
+    }
+}
+
 grub_net_tcp_listen_t
 grub_net_tcp_listen (grub_uint16_t port,
 		     const struct grub_net_network_level_interface *inf,
@@ -214,6 +494,7 @@ tcp_send (struct grub_net_buff *nb, grub_net_tcp_socket_t socket)
       unack->next = NULL;
       unack->nb = nb;
       unack->try_count = 1;
+      unack->sacked = 0;
       unack->last_try = grub_get_time_ms ();
       if (!socket->unack_last)
 	socket->unack_first = socket->unack_last = unack;
@@ -301,7 +582,8 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   struct tcphdr *tcph_ack;
   grub_err_t err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 128);
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 4
+				+ 8 * TCP_SACK_BLOCKS + 128);
   if (!nb_ack)
     return;
   err = grub_netbuff_reserve (nb_ack, 128);
@@ -332,8 +614,26 @@ ack_real (grub_net_tcp_socket_t sock, int res)
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
       tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->window = tcp_window (sock);
+      if (sock->sack_ok && sock->nsack)
+	{
+	  grub_uint8_t opts[4 + 8 * TCP_SACK_BLOCKS];
+	  int i;
+
+	  opts[0] = TCP_OPT_NOP;
+	  opts[1] = TCP_OPT_NOP;
+	  opts[2] = TCP_OPT_SACK;
+	  opts[3] = 2 + 8 * sock->nsack;
+	  for (i = 0; i < sock->nsack; i++)
+	    {
+	      grub_set_unaligned32 (opts + 4 + 8 * i,
+				    grub_cpu_to_be32 (sock->sack[i].start));
+	      grub_set_unaligned32 (opts + 8 + 8 * i,
+				    grub_cpu_to_be32 (sock->sack[i].end));
+	    }
+	  /* Can't fail, the room was allocated above.  */
+	  tcp_put_options (nb_ack, opts, 4 + 8 * sock->nsack);
+	}
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -358,6 +658,58 @@ reset (grub_net_tcp_socket_t sock)
   ack_real (sock, 1);
 }
 
+static void
+tcp_resend (grub_net_tcp_socket_t sock, struct unacked *unack,
+	    grub_uint64_t ctime)
+{
+  struct tcphdr *tcph;
+  grub_uint8_t *nbd;
+  grub_err_t err;
+
+  unack->try_count++;
+  unack->last_try = ctime;
+  nbd = unack->nb->data;
+  tcph = (struct tcphdr *) nbd;
+
+  if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
+      && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
+    {
+      tcph->checksum = 0;
+      tcph->checksum = grub_net_ip_transport_checksum (unack->nb,
+						       GRUB_NET_IP_TCP,
+						       &sock->inf->address,
+						       &sock->out_nla);
+    }
+
+  err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
+				 &(sock->ll_target_addr), unack->nb,
+				 GRUB_NET_IP_TCP);
+  unack->nb->data = nbd;
+  if (err)
+    {
+      grub_dprintf ("net", "TCP retransmit failed: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+}
+
+/* Resend the first segment the peer doesn't hold.  Used on the third
+   duplicate ACK and on each partial ACK of the recovery which follows,
+   so that a loss costs a round trip rather than a timeout.  */
+static void
+tcp_fast_retransmit (grub_net_tcp_socket_t sock)
+{
+  struct unacked *unack;
+
+  for (unack = sock->unack_first; unack; unack = unack->next)
+    if (!unack->sacked)
+      {
+	grub_dprintf ("net", "TCP fast retransmit\n");
+	grub_net_stats.tcp_fast_retransmits++;
+	tcp_resend (sock, unack, grub_get_time_ms ());
+	return;
+      }
+}
+
 void
 grub_net_tcp_retransmit (void)
 {
@@ -370,10 +722,6 @@ grub_net_tcp_retransmit (void)
     struct unacked *unack;
     for (unack = sock->unack_first; unack; unack = unack->next)
       {
-	struct tcphdr *tcph;
-	grub_uint8_t *nbd;
-	grub_err_t err;
-
 	if (unack->last_try > limit_time)
 	  continue;
 	
@@ -382,30 +730,12 @@ grub_net_tcp_retransmit (void)
 	    error (sock);
 	    break;
 	  }
-	unack->try_count++;
-	unack->last_try = ctime;
-	nbd = unack->nb->data;
-	tcph = (struct tcphdr *) nbd;
-
-	if ((tcph->flags & grub_cpu_to_be16_compile_time (TCP_ACK))
-	    && tcph->ack != grub_cpu_to_be32 (sock->their_cur_seq))
-	  {
-	    tcph->checksum = 0;
-	    tcph->checksum = grub_net_ip_transport_checksum (unack->nb,
-							     GRUB_NET_IP_TCP,
-							     &sock->inf->address,
-							     &sock->out_nla);
-	  }
-
-	err = grub_net_send_ip_packet (sock->inf, &(sock->out_nla),
-				       &(sock->ll_target_addr), unack->nb,
-				       GRUB_NET_IP_TCP);
-	unack->nb->data = nbd;
-	if (err)
-	  {
-	    grub_dprintf ("net", "TCP retransmit failed: %s\n", grub_errmsg);
-	    grub_errno = GRUB_ERR_NONE;
-	  }
+	/* After a timeout the peer may have dropped what it reported
+	   (RFC 2018, section 8).  */
+	unack->sacked = 0;
+	sock->in_recovery = 0;
+	grub_net_stats.tcp_retransmits++;
+	tcp_resend (sock, unack, ctime);
       }
   }
 }
@@ -455,29 +785,13 @@ grub_net_ip_transport_checksum (struct grub_net_buff *nb,
   return grub_cpu_to_be16 (~c);
 }
 
-/* FIXME: overflow. */
-static int
-cmp (const void *a__, const void *b__)
-{
-  struct grub_net_buff *a_ = *(struct grub_net_buff **) a__;
-  struct grub_net_buff *b_ = *(struct grub_net_buff **) b__;
-  struct tcphdr *a = (struct tcphdr *) a_->data;
-  struct tcphdr *b = (struct tcphdr *) b_->data;
-  /* We want the first elements to be on top.  */
-  if (grub_be_to_cpu32 (a->seqnr) < grub_be_to_cpu32 (b->seqnr))
-    return +1;
-  if (grub_be_to_cpu32 (a->seqnr) > grub_be_to_cpu32 (b->seqnr))
-    return -1;
-  return 0;
-}
-
 static void
 destroy_pq (grub_net_tcp_socket_t sock)
 {
-  struct grub_net_buff **nb_p;
-  while ((nb_p = grub_priority_queue_top (sock->pq)))
+  struct grub_net_buff *nb;
+  while ((nb = grub_priority_queue_top_seq (sock->pq, 0)))
     {
-      grub_netbuff_free (*nb_p);
+      grub_netbuff_free (nb);
       grub_priority_queue_pop (sock->pq);
     }
 
@@ -503,7 +817,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   sock->error_hook = error_hook;
   sock->fin_hook = fin_hook;
   sock->hook_data = hook_data;
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph)
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph) + 8
 			       + GRUB_NET_OUR_MAX_IP_HEADER_SIZE
 			       + GRUB_NET_MAX_LINK_HEADER_SIZE);
   if (!nb_ack)
@@ -525,8 +839,15 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   tcph = (void *) nb_ack->data;
   tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
   tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
+  tcph->window = tcp_syn_window (sock);
   tcph->urgent = 0;
+  err = tcp_put_syn_options (nb_ack, sock, sock->window_scaling,
+			     sock->sack_ok);
+  if (err)
+    {
+      grub_netbuff_free (nb_ack);
+      return err;
+    }
   sock->established = 1;
   tcp_socket_register (sock);
   err = tcp_send (nb_ack, sock);
@@ -593,7 +914,7 @@ grub_net_tcp_open (char *server,
   socket->fin_hook = fin_hook;
   socket->hook_data = hook_data;
 
-  nb = grub_netbuff_alloc (sizeof (*tcph) + 128);
+  nb = grub_netbuff_alloc (sizeof (*tcph) + 8 + 128);
   if (!nb)
     return NULL;
   err = grub_netbuff_reserve (nb, 128);
@@ -609,7 +930,7 @@ grub_net_tcp_open (char *server,
       grub_netbuff_free (nb);
       return NULL;
     }
-  socket->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *), cmp);
+  socket->pq = grub_priority_queue_new_seq ();
   if (!socket->pq)
     {
       grub_netbuff_free (nb);
@@ -619,14 +940,22 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
+  tcp_init_window (socket);
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
   tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->window = tcp_syn_window (socket);
   tcph->urgent = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
+  err = tcp_put_syn_options (nb, socket, 1, 1);
+  if (err)
+    {
+      grub_netbuff_free (nb);
+      destroy_pq (socket);
+      grub_free (socket);
+      return NULL;
+    }
   tcph->checksum = 0;
   tcph->checksum = grub_net_ip_transport_checksum (nb, GRUB_NET_IP_TCP,
 						   &socket->inf->address,
@@ -709,8 +1038,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = tcp_window (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -733,7 +1061,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = tcp_window (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -778,7 +1106,8 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  && inf == sock->inf
 	  && grub_net_addr_cmp (source, &sock->out_nla) == 0))
       continue;
-    if (tcph->checksum)
+    if (tcph->checksum
+	&& !(inf->card->flags & GRUB_NET_CARD_RX_CHECKSUM_VERIFIED))
       {
 	grub_uint16_t chk, expected;
 	chk = tcph->checksum;
@@ -805,6 +1134,9 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->established = 1;
+	tcp_set_window_scaling (sock, tcp_window_scale_option (tcph) >= 0);
+	sock->sack_ok = tcp_sack_permitted_option (tcph);
+	sock->last_ack = grub_be_to_cpu32 (tcph->ack);
       }
 
     if (grub_be_to_cpu16 (tcph->flags) & TCP_RST)
@@ -822,6 +1154,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
       {
 	struct unacked *unack, *next;
 	grub_uint32_t acked = grub_be_to_cpu32 (tcph->ack);
+	grub_uint64_t now = grub_get_time_ms ();
 	for (unack = sock->unack_first; unack; unack = next)
 	  {
 	    grub_uint32_t seqnr;
@@ -837,12 +1170,47 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 
 	    if (seqnr > acked)
 	      break;
+	    /* Only segments sent once tell the round trip time.  */
+	    if (unack->try_count == 1)
+	      grub_net_rtt_sample (&grub_net_stats.tcp_rtt,
+				   now - unack->last_try);
 	    grub_netbuff_free (unack->nb);
 	    grub_free (unack);
 	  }
 	sock->unack_first = unack;
 	if (!sock->unack_first)
 	  sock->unack_last = NULL;
+
+	if (sock->sack_ok)
+	  tcp_sack_mark (sock, tcph);
+
+	if (acked == sock->last_ack)
+	  {
+	    /* A pure duplicate ACK while we have data in flight.  */
+	    if (sock->unack_first && !(grub_be_to_cpu16 (tcph->flags)
+				       & (TCP_SYN | TCP_FIN))
+		&& nb->tail - nb->data
+		== (grub_be_to_cpu16 (tcph->flags) >> 12) * 4
+		&& ++sock->dup_acks == TCP_DUP_ACK_THRESHOLD
+		&& !sock->in_recovery)
+	      {
+		sock->in_recovery = 1;
+		sock->recover = sock->my_cur_seq;
+		tcp_fast_retransmit (sock);
+	      }
+	  }
+	else if (tcp_seq_lt (sock->last_ack, acked))
+	  {
+	    sock->last_ack = acked;
+	    sock->dup_acks = 0;
+	    if (sock->in_recovery)
+	      {
+		if (tcp_seq_lt (acked, sock->recover))
+		  tcp_fast_retransmit (sock);
+		else
+		  sock->in_recovery = 0;
+	      }
+	  }
       }
 
     if (grub_be_to_cpu32 (tcph->seqnr) < sock->their_cur_seq)
@@ -851,6 +1219,14 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	grub_netbuff_free (nb);
 	return GRUB_ERR_NONE;
       }
+    /* Segments past the window would only pile up in the queue.  */
+    if (grub_be_to_cpu32 (tcph->seqnr) - sock->their_cur_seq
+	>= sock->my_window)
+      {
+	ack (sock);
+	grub_netbuff_free (nb);
+	return GRUB_ERR_NONE;
+      }
     if (sock->i_reseted && (nb->tail - nb->data
 			    - (grub_be_to_cpu16 (tcph->flags)
 			       >> 12) * sizeof (grub_uint32_t)) > 0)
@@ -858,68 +1234,90 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	reset (sock);
       }
 
-    err = grub_priority_queue_push (sock->pq, &nb);
-    if (err)
-      {
-	grub_netbuff_free (nb);
-	return err;
-      }
+    {
+      grub_uint32_t seqnr = grub_be_to_cpu32 (tcph->seqnr);
+      grub_ssize_t len = (nb->tail - nb->data
+			  - (grub_be_to_cpu16 (tcph->flags) >> 12) * 4);
+
+      /* FIN takes a sequence number of its own.  */
+      err = grub_priority_queue_push_seq (sock->pq, seqnr, seqnr + len
+					  + !!(grub_be_to_cpu16 (tcph->flags)
+					       & TCP_FIN), nb);
+      if (err)
+	{
+	  grub_netbuff_free (nb);
+	  return err;
+	}
+
+      /* Tell the peer at once what we hold past the hole so that it can
+	 retransmit the missing segment without waiting for a timeout.  */
+      if (seqnr != sock->their_cur_seq && len > 0)
+	{
+	  if (tcp_seq_lt (sock->their_cur_seq, seqnr))
+	    grub_net_stats.tcp_out_of_order++;
+	  tcp_sack_add (sock, seqnr, seqnr + len);
+	  ack (sock);
+	  return GRUB_ERR_NONE;
+	}
+    }
 
     {
-      struct grub_net_buff **nb_top_p, *nb_top;
+      struct grub_net_buff *nb_top;
+      void *batch[TCP_REASSEMBLY_BATCH];
+      grub_size_t n, i;
+      grub_uint32_t seqnr, next;
       int do_ack = 0;
       int just_closed = 0;
       while (1)
 	{
-	  nb_top_p = grub_priority_queue_top (sock->pq);
-	  if (!nb_top_p)
+	  nb_top = grub_priority_queue_top_seq (sock->pq, &seqnr);
+	  if (!nb_top)
 	    return GRUB_ERR_NONE;
-	  nb_top = *nb_top_p;
-	  tcph = (struct tcphdr *) nb_top->data;
-	  if (grub_be_to_cpu32 (tcph->seqnr) >= sock->their_cur_seq)
+	  if (!tcp_seq_lt (seqnr, sock->their_cur_seq))
 	    break;
 	  grub_netbuff_free (nb_top);
 	  grub_priority_queue_pop (sock->pq);
 	}
-      if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
+      if (seqnr != sock->their_cur_seq)
 	return GRUB_ERR_NONE;
-      while (1)
-	{
-	  nb_top_p = grub_priority_queue_top (sock->pq);
-	  if (!nb_top_p)
-	    break;
-	  nb_top = *nb_top_p;
-	  tcph = (struct tcphdr *) nb_top->data;
 
-	  if (grub_be_to_cpu32 (tcph->seqnr) != sock->their_cur_seq)
-	    break;
-	  grub_priority_queue_pop (sock->pq);
-
-	  err = grub_netbuff_pull (nb_top, (grub_be_to_cpu16 (tcph->flags)
-					    >> 12) * sizeof (grub_uint32_t));
-	  if (err)
-	    {
+      /* Take everything that is now contiguous, a batch at a time.  */
+      next = sock->their_cur_seq;
+      while ((n = grub_priority_queue_pop_while_in_order (sock->pq, &next,
+							  batch,
+							  ARRAY_SIZE (batch))))
+	for (i = 0; i < n; i++)
+	  {
+	    nb_top = batch[i];
+	    tcph = (struct tcphdr *) nb_top->data;
+
+	    err = grub_netbuff_pull (nb_top, (grub_be_to_cpu16 (tcph->flags)
+					      >> 12) * sizeof (grub_uint32_t));
+	    if (err)
+	      {
+		for (; i < n; i++)
+		  grub_netbuff_free (batch[i]);
+		return err;
+	      }
+
+	    sock->their_cur_seq += (nb_top->tail - nb_top->data);
+	    if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
+	      {
+		sock->they_closed = 1;
+		just_closed = 1;
+		sock->their_cur_seq++;
+		do_ack = 1;
+	      }
+	    /* If there is data, puts packet in socket list. */
+	    if ((nb_top->tail - nb_top->data) > 0)
+	      {
+		grub_net_put_packet (&sock->packs, nb_top);
+		do_ack = 1;
+	      }
+	    else
 	      grub_netbuff_free (nb_top);
-	      return err;
-	    }
-
-	  sock->their_cur_seq += (nb_top->tail - nb_top->data);
-	  if (grub_be_to_cpu16 (tcph->flags) & TCP_FIN)
-	    {
-	      sock->they_closed = 1;
-	      just_closed = 1;
-	      sock->their_cur_seq++;
-	      do_ack = 1;
-	    }
-	  /* If there is data, puts packet in socket list. */
-	  if ((nb_top->tail - nb_top->data) > 0)
-	    {
-	      grub_net_put_packet (&sock->packs, nb_top);
-	      do_ack = 1;
-	    }
-	  else
-	    grub_netbuff_free (nb_top);
-	}
+	  }
+      tcp_sack_prune (sock);
       if (do_ack)
 	ack (sock);
       while (sock->packs.first)
@@ -958,10 +1356,12 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	tcp_init_window (sock);
+	tcp_set_window_scaling (sock, tcp_window_scale_option (tcph) >= 0);
+	sock->sack_ok = tcp_sack_permitted_option (tcph);
+	sock->last_ack = sock->my_cur_seq + 1;
 
-	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
-					    cmp);
+	sock->pq = grub_priority_queue_new_seq ();
 	if (!sock->pq)
 	  {
 	    grub_netbuff_free (nb);
@@ -25,8 +25,10 @@
 #include <grub/mm.h>
 #include <grub/dl.h>
 #include <grub/file.h>
+#include <grub/env.h>
 #include <grub/priority_queue.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -44,6 +46,20 @@ enum
     TFTP_DEFAULTSIZE_PACKET = 512,
   };
 
+/* Blocks the server may send before waiting for an ACK (RFC 7440), unless
+   net_tftp_window says otherwise, and the largest window we accept.  */
+enum
+  {
+    TFTP_DEFAULT_WINDOW = 16,
+    TFTP_MAX_WINDOW = 64
+  };
+
+/* Queued blocks taken off the reassembly queue at once.  */
+enum
+  {
+    TFTP_REASSEMBLY_BATCH = 32
+  };
+
 enum
   {
     TFTP_CODE_EOF = 1,
@@ -103,12 +119,43 @@ typedef struct tftp_data
   grub_uint64_t block;
   grub_uint32_t block_size;
   grub_uint64_t ack_sent;
+  grub_uint64_t nack_sent;
+  grub_uint32_t window;
+  int lost;
   int have_oack;
+  /* When the ACK of ack_sent went out, 0 once it was sent again.  */
+  grub_uint64_t ack_time;
   struct grub_error_saved save_err;
   grub_net_udp_socket_t sock;
   grub_priority_queue_t pq;
 } *tftp_data_t;
 
+/* Window to ask for next, halved after a transfer which lost blocks and
+   doubled after one which didn't.  */
+static grub_uint32_t tftp_window_hint = TFTP_MAX_WINDOW;
+
+static grub_uint32_t
+tftp_window_max (void)
+{
+  const char *val = grub_env_get ("net_tftp_window");
+  unsigned long window = TFTP_DEFAULT_WINDOW;
+
+  if (val)
+    {
+      window = grub_strtoul (val, 0, 0);
+      if (grub_errno)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  window = TFTP_DEFAULT_WINDOW;
+	}
+    }
+  if (window < 1)
+    window = 1;
+  if (window > TFTP_MAX_WINDOW)
+    window = TFTP_MAX_WINDOW;
+  return window;
+}
+
 static int
 cmp_block (grub_uint16_t a, grub_uint16_t b)
 {
@@ -120,15 +167,12 @@ cmp_block (grub_uint16_t a, grub_uint16_t b)
   return 0;
 }
 
-static int
-cmp (const void *a__, const void *b__)
+/* The reassembly queue orders by 32-bit sequence numbers; shifting a
+   block number up makes their wrapping match that of cmp_block.  */
+static inline grub_uint32_t
+block_seq (grub_uint64_t block)
 {
-  struct grub_net_buff *a_ = *(struct grub_net_buff **) a__;
-  struct grub_net_buff *b_ = *(struct grub_net_buff **) b__;
-  struct tftphdr *a = (struct tftphdr *) a_->data;
-  struct tftphdr *b = (struct tftphdr *) b_->data;
-  /* We want the first elements to be on top.  */
-  return -cmp_block (grub_be_to_cpu16 (a->u.data.block), grub_be_to_cpu16 (b->u.data.block));
+  return (grub_uint32_t) block << 16;
 }
 
 static grub_err_t
@@ -155,6 +199,7 @@ ack (tftp_data_t data, grub_uint64_t block)
   err = grub_net_send_udp_packet (data->sock, &nb_ack);
   if (err)
     return err;
+  data->ack_time = (block == data->ack_sent) ? 0 : grub_get_time_ms ();
   data->ack_sent = block;
   return GRUB_ERR_NONE;
 }
@@ -169,6 +214,8 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   tftp_data_t data = file->data;
   grub_err_t err;
   grub_uint8_t *ptr;
+  grub_uint32_t requested;
+  grub_uint16_t block;
 
   if (nb->tail - nb->data < (grub_ssize_t) sizeof (tftph->opcode))
     {
@@ -180,7 +227,9 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
   switch (grub_be_to_cpu16 (tftph->opcode))
     {
     case TFTP_OACK:
+      requested = data->window;
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
+      data->window = 1;
       data->have_oack = 1; 
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
@@ -190,11 +239,18 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0",
+			   sizeof ("windowsize\0") - 1) == 0)
+	    data->window = grub_strtoul ((char *) ptr
+					 + sizeof ("windowsize\0") - 1, 0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      if (data->window < 1 || data->window > requested)
+	data->window = 1;
       data->block = 0;
+      data->nack_sent = ~(grub_uint64_t) 0;
       grub_netbuff_free (nb);
       err = ack (data, 0);
       grub_error_save (&data->save_err);
@@ -207,71 +263,122 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
-      err = grub_priority_queue_push (data->pq, &nb);
+      if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block),
+		     data->block + 1) > 0)
+	grub_net_stats.tftp_out_of_order++;
+
+      block = grub_be_to_cpu16 (tftph->u.data.block);
+      err = grub_priority_queue_push_seq (data->pq, block_seq (block),
+					  block_seq (block + 1), nb);
       if (err)
 	return err;
 
+      /* A block past the next one means some were lost.  Acknowledge what
+	 we have at once, once per hole, so that the server restarts its
+	 window there instead of waiting for its timeout.  */
+      if (data->window > 1
+	  && cmp_block (grub_be_to_cpu16 (tftph->u.data.block),
+			data->block + 1) > 0
+	  && data->nack_sent != data->block)
+	{
+	  data->lost = 1;
+	  data->nack_sent = data->block;
+	  ack (data, data->block);
+	}
+
       {
-	struct grub_net_buff **nb_top_p, *nb_top;
+	struct grub_net_buff *nb_top;
+	void *batch[TFTP_REASSEMBLY_BATCH];
+	grub_size_t n, i;
+	grub_uint32_t seq, next;
+
 	while (1)
 	  {
-	    nb_top_p = grub_priority_queue_top (data->pq);
-	    if (!nb_top_p)
+	    nb_top = grub_priority_queue_top_seq (data->pq, &seq);
+	    if (!nb_top)
 	      return GRUB_ERR_NONE;
-	    nb_top = *nb_top_p;
-	    tftph = (struct tftphdr *) nb_top->data;
-	    if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) >= 0)
+	    if (cmp_block (seq >> 16, data->block + 1) >= 0)
 	      break;
-	    ack (data, grub_be_to_cpu16 (tftph->u.data.block));
+	    grub_net_stats.tftp_duplicates++;
+	    /* The server didn't get the ACK ending this window.  */
+	    if ((seq >> 16) == (grub_uint16_t) data->ack_sent)
+	      ack (data, data->ack_sent);
 	    grub_netbuff_free (nb_top);
 	    grub_priority_queue_pop (data->pq);
 	  }
-	while (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) == 0)
-	  {
-	    unsigned size;
 
-	    grub_priority_queue_pop (data->pq);
-
-	    if (file->device->net->packs.count < 50)
-	      err = ack (data, data->block + 1);
-	    else
+	/* Take everything that is now contiguous, a batch at a time.  */
+	next = block_seq (data->block + 1);
+	while ((n = grub_priority_queue_pop_while_in_order (data->pq, &next,
+							    batch,
+							    ARRAY_SIZE (batch))))
+	  {
+	    for (i = 0; i < n; i++)
 	      {
-		file->device->net->stall = 1;
-		err = 0;
-	      }
-	    if (err)
-	      return err;
-
-	    err = grub_netbuff_pull (nb_top, sizeof (tftph->opcode) +
-				     sizeof (tftph->u.data.block));
-	    if (err)
-	      return err;
-	    size = nb_top->tail - nb_top->data;
+		unsigned size;
+
+		nb_top = batch[i];
+
+		/* The first block of a window answers the ACK of the last.  */
+		if (data->ack_time && data->block == data->ack_sent)
+		  {
+		    grub_net_rtt_sample (&grub_net_stats.tftp_rtt,
+					 grub_get_time_ms () - data->ack_time);
+		    data->ack_time = 0;
+		  }
+
+		if (file->device->net->packs.count >= 50)
+		  {
+		    file->device->net->stall = 1;
+		    err = 0;
+		  }
+		else if (data->block + 1 - data->ack_sent >= data->window)
+		  err = ack (data, data->block + 1);
+		else
+		  {
+		    file->device->net->stall = 1;
+		    err = 0;
+		  }
+		if (err)
+		  break;
 
-	    data->block++;
-	    if (size < data->block_size)
-	      {
-		if (data->ack_sent < data->block)
-		  ack (data, data->block);
-		file->device->net->eof = 1;
-		file->device->net->stall = 1;
-		grub_net_udp_close (data->sock);
-		data->sock = NULL;
+		err = grub_netbuff_pull (nb_top, sizeof (tftph->opcode) +
+					 sizeof (tftph->u.data.block));
+		if (err)
+		  break;
+		size = nb_top->tail - nb_top->data;
+
+		data->block++;
+		if (size < data->block_size)
+		  {
+		    if (data->ack_sent < data->block)
+		      ack (data, data->block);
+		    file->device->net->eof = 1;
+		    file->device->net->stall = 1;
+		    grub_net_udp_close (data->sock);
+		    data->sock = NULL;
+		  }
+		/* Prevent garbage in broken cards. Is it still necessary
+		   given that IP implementation has been fixed?
+		 */
+		if (size > data->block_size)
+		  {
+		    err = grub_netbuff_unput (nb_top, size - data->block_size);
+		    if (err)
+		      break;
+		  }
+		/* If there is data, puts packet in socket list. */
+		if ((nb_top->tail - nb_top->data) > 0)
+		  grub_net_put_packet (&file->device->net->packs, nb_top);
+		else
+		  grub_netbuff_free (nb_top);
 	      }
-	    /* Prevent garbage in broken cards. Is it still necessary
-	       given that IP implementation has been fixed?
-	     */
-	    if (size > data->block_size)
+	    if (i < n)
 	      {
-		err = grub_netbuff_unput (nb_top, size - data->block_size);
-		if (err)
-		  return err;
+		for (; i < n; i++)
+		  grub_netbuff_free (batch[i]);
+		return err;
 	      }
-	    /* If there is data, puts packet in socket list. */
-	    if ((nb_top->tail - nb_top->data) > 0)
-	      grub_net_put_packet (&file->device->net->packs, nb_top);
-	    else
-	      grub_netbuff_free (nb_top);
 	  }
       }
       return GRUB_ERR_NONE;
@@ -290,10 +397,10 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 static void
 destroy_pq (tftp_data_t data)
 {
-  struct grub_net_buff **nb_p;
-  while ((nb_p = grub_priority_queue_top (data->pq)))
+  struct grub_net_buff *nb;
+  while ((nb = grub_priority_queue_top_seq (data->pq, 0)))
     {
-      grub_netbuff_free (*nb_p);
+      grub_netbuff_free (nb);
       grub_priority_queue_pop (data->pq);
     }
 
@@ -357,6 +464,20 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_strcpy (rrq, "0");
   rrqlen += grub_strlen ("0") + 1;
   rrq += grub_strlen ("0") + 1;
+
+  data->window = tftp_window_max ();
+  if (data->window > tftp_window_hint)
+    data->window = tftp_window_hint;
+  if (data->window > 1)
+    {
+      grub_strcpy (rrq, "windowsize");
+      rrqlen += grub_strlen ("windowsize") + 1;
+      rrq += grub_strlen ("windowsize") + 1;
+
+      grub_snprintf (rrq, sizeof ("65535"), "%u", (unsigned) data->window);
+      rrqlen += grub_strlen (rrq) + 1;
+      rrq += grub_strlen (rrq) + 1;
+    }
   hdrlen = sizeof (tftph->opcode) + rrqlen;
 
   err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
@@ -366,7 +487,7 @@ tftp_open (struct grub_file *file, const char *filename)
   file->not_easily_seekable = 1;
   file->data = data;
 
-  data->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *), cmp);
+  data->pq = grub_priority_queue_new_seq ();
   if (!data->pq)
     return grub_errno;
 
@@ -453,6 +574,11 @@ tftp_close (struct grub_file *file)
 	grub_print_error ();
       grub_net_udp_close (data->sock);
     }
+  if (data->lost)
+    tftp_window_hint = data->window > 1 ? data->window / 2 : 1;
+  else if (file->device->net->eof && data->window >= tftp_window_hint)
+    tftp_window_hint = data->window < TFTP_MAX_WINDOW / 2
+      ? 2 * data->window : TFTP_MAX_WINDOW;
   destroy_pq (data);
   grub_free (data);
   return GRUB_ERR_NONE;
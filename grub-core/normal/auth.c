@@ -233,6 +233,12 @@ grub_auth_check_authentication (const char *userlist)
   if (!cur || ! cur->callback)
     goto access_denied;
 
+  /* The password of a user who has logged in was checked then, and is
+     valid for the session: checking it again, which for PBKDF2 takes
+     seconds, can't let the user in where it wasn't allowed already.  */
+  if (cur->authenticated)
+    goto access_denied;
+
   cur->callback (login, entered, cur->arg);
   if (is_authenticated (userlist))
     {
@@ -1,4 +1,4 @@
-/* autofs.c - support auto-loading from fs.lst */
+/* autofs.c - support auto-loading from fs.lst and partmap.lst */
 /*
  *  GRUB  --  GRand Unified Bootloader
  *  Copyright (C) 2009  Free Software Foundation, Inc.
@@ -22,16 +22,21 @@
 #include <grub/env.h>
 #include <grub/misc.h>
 #include <grub/fs.h>
+#include <grub/partition.h>
 #include <grub/normal.h>
 
 /* This is used to store the names of filesystem modules for auto-loading.  */
 static grub_named_list_t fs_module_list;
 
-/* The auto-loading hook for filesystems.  */
+/* And this the names of partition map modules.  */
+static grub_named_list_t partmap_module_list;
+
+/* Load the first module in LIST, or the one called NAME if it's there.
+   Return non-zero if a module was loaded.  */
 static int
-autoload_fs_module (void)
+autoload_module (grub_named_list_t *list, const char *name)
 {
-  grub_named_list_t p;
+  grub_named_list_t p, *q;
   int ret = 0;
   grub_file_filter_t grub_file_filters_was[GRUB_FILE_FILTER_MAX];
 
@@ -40,20 +45,30 @@ autoload_fs_module (void)
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_all,
 	       sizeof (grub_file_filters_enabled));
 
-  while ((p = fs_module_list) != NULL)
+  while (*list)
     {
-      if (! grub_dl_get (p->name) && grub_dl_load (p->name))
+      q = list;
+      if (name)
 	{
-	  ret = 1;
-	  break;
+	  for (; *q; q = &(*q)->next)
+	    if (grub_strcmp ((*q)->name, name) == 0)
+	      break;
+	  if (! *q)
+	    break;
 	}
+      p = *q;
+
+      if (! grub_dl_get (p->name) && grub_dl_load (p->name))
+	ret = 1;
 
       if (grub_errno)
 	grub_print_error ();
 
-      fs_module_list = p->next;
+      *q = p->next;
       grub_free (p->name);
       grub_free (p);
+      if (ret || name)
+	break;
     }
 
   grub_memcpy (grub_file_filters_enabled, grub_file_filters_was,
@@ -62,44 +77,87 @@ autoload_fs_module (void)
   return ret;
 }
 
-/* Read the file fs.lst for auto-loading.  */
-void
-read_fs_list (const char *prefix)
+/* The auto-loading hook for filesystems.  */
+static int
+autoload_fs_module (void)
+{
+  return autoload_module (&fs_module_list, 0);
+}
+
+/* The auto-loading hook for partition maps.  A map called NAME comes
+   from part_NAME.  */
+static int
+autoload_partmap_module (const char *name, grub_size_t len)
+{
+  static int busy;
+  char *modname = 0;
+  int ret = 0;
+
+  /* Loading a module may probe partitions in turn.  */
+  if (busy)
+    return 0;
+  busy = 1;
+
+  if (len)
+    modname = grub_xasprintf ("part_%.*s", (int) len, name);
+  if (! len || modname)
+    ret = autoload_module (&partmap_module_list, modname);
+  grub_free (modname);
+  grub_errno = GRUB_ERR_NONE;
+
+  busy = 0;
+  return ret;
+}
+
+static void
+free_module_list (grub_named_list_t *list)
+{
+  while (*list)
+    {
+      grub_named_list_t tmp;
+      tmp = (*list)->next;
+      grub_free ((*list)->name);
+      grub_free (*list);
+      *list = tmp;
+    }
+}
+
+/* Read the module list NAME for auto-loading into LIST.  */
+static void
+read_module_list (const char *prefix, const char *name,
+		  grub_named_list_t *list)
 {
   if (prefix)
     {
       char *filename;
 
       filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM
-				 "/fs.lst", prefix);
+				 "/%s", prefix, name);
       if (filename)
 	{
 	  grub_file_t file;
 	  grub_fs_autoload_hook_t tmp_autoload_hook;
+	  grub_partition_autoload_hook_t tmp_partmap_hook;
 
 	  /* This rules out the possibility that read_fs_list() is invoked
 	     recursively when we call grub_file_open() below.  */
 	  tmp_autoload_hook = grub_fs_autoload_hook;
 	  grub_fs_autoload_hook = NULL;
+	  tmp_partmap_hook = grub_partition_autoload_hook;
+	  grub_partition_autoload_hook = NULL;
 
 	  file = grub_file_open (filename);
 	  if (file)
 	    {
-	      /* Override previous fs.lst.  */
-	      while (fs_module_list)
-		{
-		  grub_named_list_t tmp;
-		  tmp = fs_module_list->next;
-		  grub_free (fs_module_list);
-		  fs_module_list = tmp;
-		}
+	      /* Override previous list.  */
+	      free_module_list (list);
 
 	      while (1)
 		{
 		  char *buf;
 		  char *p;
 		  char *q;
-		  grub_named_list_t fs_mod;
+		  grub_named_list_t mod;
 
 		  buf = grub_file_getline (file);
 		  if (! buf)
@@ -122,28 +180,29 @@ read_fs_list (const char *prefix)
 		      continue;
 		    }
 
-		  fs_mod = grub_malloc (sizeof (*fs_mod));
-		  if (! fs_mod)
+		  mod = grub_malloc (sizeof (*mod));
+		  if (! mod)
 		    {
 		      grub_free (buf);
 		      continue;
 		    }
 
-		  fs_mod->name = grub_strdup (p);
+		  mod->name = grub_strdup (p);
 		  grub_free (buf);
-		  if (! fs_mod->name)
+		  if (! mod->name)
 		    {
-		      grub_free (fs_mod);
+		      grub_free (mod);
 		      continue;
 		    }
 
-		  fs_mod->next = fs_module_list;
-		  fs_module_list = fs_mod;
+		  mod->next = *list;
+		  *list = mod;
 		}
 
 	      grub_file_close (file);
-	      grub_fs_autoload_hook = tmp_autoload_hook;
 	    }
+	  grub_fs_autoload_hook = tmp_autoload_hook;
+	  grub_partition_autoload_hook = tmp_partmap_hook;
 
 	  grub_free (filename);
 	}
@@ -151,7 +210,24 @@ read_fs_list (const char *prefix)
 
   /* Ignore errors.  */
   grub_errno = GRUB_ERR_NONE;
+}
+
+/* Read the file fs.lst for auto-loading.  */
+void
+read_fs_list (const char *prefix)
+{
+  read_module_list (prefix, "fs.lst", &fs_module_list);
 
   /* Set the hook.  */
   grub_fs_autoload_hook = autoload_fs_module;
 }
+
+/* Read the file partmap.lst for auto-loading.  */
+void
+read_partmap_list (const char *prefix)
+{
+  read_module_list (prefix, "partmap.lst", &partmap_module_list);
+
+  /* Set the hook.  */
+  grub_partition_autoload_hook = autoload_partmap_module;
+}
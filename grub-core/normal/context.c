@@ -56,7 +56,7 @@ static grub_err_t
 grub_env_new_context (int export_all)
 {
   struct grub_env_context *context;
-  int i;
+  unsigned i;
   struct menu_pointer *menu;
 
   context = grub_zalloc (sizeof (*context));
@@ -76,7 +76,7 @@ grub_env_new_context (int export_all)
   current_menu = menu;
 
   /* Copy exported variables.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < context->prev->size; i++)
     {
       struct grub_env_var *var;
 
@@ -115,7 +115,7 @@ grub_err_t
 grub_env_context_close (void)
 {
   struct grub_env_context *context;
-  int i;
+  unsigned i;
   struct menu_pointer *menu;
 
   if (! grub_current_context->prev)
@@ -123,7 +123,7 @@ grub_env_context_close (void)
 		       "cannot close the initial context");
 
   /* Free the variables associated with this context.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < grub_current_context->size; i++)
     {
       struct grub_env_var *p, *q;
 
@@ -138,6 +138,7 @@ grub_env_context_close (void)
 
   /* Restore the previous context.  */
   context = grub_current_context->prev;
+  grub_free (grub_current_context->vars);
   grub_free (grub_current_context);
   grub_current_context = context;
 
@@ -110,7 +110,7 @@ read_command_list (const char *prefix)
 	  if (file)
 	    {
 	      char *buf = NULL;
-	      grub_command_t ptr, last = 0, next;
+	      grub_command_t ptr, next;
 
 	      /* Override previous commands.lst.  */
 	      for (ptr = grub_command_list; ptr; ptr = next)
@@ -118,15 +118,9 @@ read_command_list (const char *prefix)
 		  next = ptr->next;
 		  if (ptr->flags & GRUB_COMMAND_FLAG_DYNCMD)
 		    {
-		      if (last)
-			last->next = ptr->next;
-		      else
-			grub_command_list = ptr->next;
 		      grub_free (ptr->data); /* extcmd struct */
-		      grub_free (ptr);
+		      grub_unregister_command (ptr);
 		    }
-		  else
-		    last = ptr;
 		}
 
 	      for (;; grub_free (buf))
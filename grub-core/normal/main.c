@@ -32,7 +32,8 @@
 #include <grub/i18n.h>
 #include <grub/charset.h>
 #include <grub/script_sh.h>
-#include <grub/bufio.h>
+#include <grub/disk.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -78,18 +79,93 @@ grub_normal_free_menu (grub_menu_t menu)
   grub_env_unset_menu ();
 }
 
+/* A config file read whole, so that its lines are taken from memory
+   rather than a byte at a time through grub_file_read.  */
+struct config_source
+{
+  char *buf;
+  grub_size_t len;
+  grub_size_t pos;
+};
+
+static grub_err_t
+config_source_read (grub_file_t file, struct config_source *src)
+{
+  grub_size_t alloc = 4096;
+  grub_ssize_t r;
+
+  src->buf = 0;
+  src->len = src->pos = 0;
+
+  /* One byte more than the size, to see the end without growing.  */
+  if (file->size != GRUB_FILE_SIZE_UNKNOWN)
+    {
+      if (file->size >= GRUB_SIZE_MAX / 2)
+	return grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
+      alloc = file->size + 1;
+    }
+
+  while (1)
+    {
+      if (! src->buf || src->len == alloc)
+	{
+	  char *b;
+
+	  if (src->buf)
+	    alloc *= 2;
+	  b = grub_realloc (src->buf, alloc);
+	  if (! b)
+	    return grub_errno;
+	  src->buf = b;
+	}
+      r = grub_file_read (file, src->buf + src->len, alloc - src->len);
+      if (r < 0)
+	return grub_errno;
+      if (r == 0)
+	return GRUB_ERR_NONE;
+      src->len += r;
+    }
+}
+
+/* Like grub_file_getline, from SRC.  */
+static char *
+config_source_getline (struct config_source *src)
+{
+  const char *start = src->buf + src->pos, *nl;
+  grub_size_t n, i, j;
+  char *line;
+
+  if (src->pos == src->len)
+    return 0;
+
+  nl = grub_memchr (start, '\n', src->len - src->pos);
+  n = nl ? (grub_size_t) (nl - start) : src->len - src->pos;
+  src->pos += nl ? n + 1 : n;
+
+  line = grub_malloc (n + 1);
+  if (! line)
+    return 0;
+
+  /* Skip all carriage returns.  */
+  for (i = j = 0; i < n; i++)
+    if (start[i] != '\r')
+      line[j++] = start[i];
+  line[j] = '\0';
+  return line;
+}
+
 /* Helper for read_config_file.  */
 static grub_err_t
 read_config_file_getline (char **line, int cont __attribute__ ((unused)),
 			  void *data)
 {
-  grub_file_t file = data;
+  struct config_source *src = data;
 
   while (1)
     {
       char *buf;
 
-      *line = buf = grub_file_getline (file);
+      *line = buf = config_source_getline (src);
       if (! buf)
 	return grub_errno;
 
@@ -102,10 +178,340 @@ read_config_file_getline (char **line, int cont __attribute__ ((unused)),
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Lazy menus.  With lazy_menu set to 1, a menuentry or submenu command
+ * that starts a line of a config file and whose header is made of plain
+ * words is run without parsing its body.  The body is only scanned for
+ * the brace closing it and parsed when the entry is run, so a big
+ * generated menu costs little more than its titles.  Syntax errors in a
+ * body are then reported when the entry runs rather than when the file
+ * is read.  Anything else goes through the parser.
+ */
+
+static int
+lazy_menu_enabled (void)
+{
+  const char *val = grub_env_get ("lazy_menu");
+
+  return val && grub_strcmp (val, "1") == 0;
+}
+
+/* Characters that end an unquoted word, or that the lazy path leaves to
+   the parser: escapes, globs and the shell operators.  */
+#define LAZY_NOT_PLAIN	" \t{}|&;<>\\*?[]'\"$"
+
+/* Length of the plain characters starting S.  */
+static grub_size_t
+lazy_plain_len (const char *s)
+{
+  const char *e;
+
+  for (e = s; *e && *e != '\n' && ! grub_strchr (LAZY_NOT_PLAIN, *e); e++);
+  return e - s;
+}
+
+static int
+lazy_is_name_start (char c)
+{
+  return grub_isalpha (c) || c == '_';
+}
+
+static int
+lazy_is_name_char (char c)
+{
+  return grub_isalnum (c) || c == '_';
+}
+
+/* Expand the variable reference at *P, $NAME or ${NAME}, into ARGV.
+   The value has to be one plain word.  */
+static int
+lazy_header_var (const char **p, struct grub_script_argv *argv)
+{
+  const char *s = *p + 1, *e;
+  const char *val;
+  char *name;
+  int braced = (*s == '{');
+
+  if (braced)
+    s++;
+  if (! lazy_is_name_start (*s))
+    return -1;
+  for (e = s; lazy_is_name_char (*e); e++);
+  if (braced && *e != '}')
+    return -1;
+
+  name = grub_strndup (s, e - s);
+  if (! name)
+    return -1;
+  val = grub_env_get (name);
+  grub_free (name);
+
+  if (! val || ! *val || val[lazy_plain_len (val)])
+    return -1;
+  if (grub_script_argv_append (argv, val, grub_strlen (val)))
+    return -1;
+
+  *p = e + braced;
+  return 0;
+}
+
+/* Add the header word at *P to ARGV, as the parser would after quote
+   removal and expansion.  */
+static int
+lazy_header_word (const char **p, struct grub_script_argv *argv)
+{
+  const char *s = *p, *e;
+
+  if (*s == '#' || grub_script_argv_next (argv))
+    return -1;
+
+  while (*s && *s != ' ' && *s != '\t' && *s != '{')
+    {
+      switch (*s)
+	{
+	case '\'':
+	  e = grub_strchr (s + 1, '\'');
+	  if (! e || grub_script_argv_append (argv, s + 1, e - s - 1))
+	    return -1;
+	  s = e + 1;
+	  break;
+
+	case '"':
+	  for (e = s + 1; *e && *e != '"'; e++)
+	    if (*e == '\\' || *e == '$')
+	      return -1;
+	  if (! *e || grub_script_argv_append (argv, s + 1, e - s - 1))
+	    return -1;
+	  s = e + 1;
+	  break;
+
+	case '$':
+	  if (lazy_header_var (&s, argv))
+	    return -1;
+	  break;
+
+	default:
+	  e = s + lazy_plain_len (s);
+	  if (e == s || grub_script_argv_append (argv, s, e - s))
+	    return -1;
+	  s = e;
+	  break;
+	}
+    }
+
+  *p = s;
+  return 0;
+}
+
+/* Find the brace closing a block in LINE, DEPTH braces deep, keeping
+   track of quotes in *QUOTE and of whether a word is in progress in
+   *IN_WORD across lines, the way the lexer tokenizes.  Returns the
+   closing brace, or NULL if the block goes on past LINE or LINE can't
+   be scanned (*QUOTE is set to -1 then).  */
+static const char *
+lazy_block_end (const char *line, int *depth, int *quote, int *in_word)
+{
+  const char *q;
+
+  for (q = line; *q; q++)
+    {
+      if (*quote == '\'')
+	{
+	  if (*q == '\'')
+	    *quote = 0;
+	  continue;
+	}
+      if (*quote == '"')
+	{
+	  if (*q == '\\' && q[1])
+	    q++;
+	  else if (*q == '"')
+	    *quote = 0;
+	  continue;
+	}
+
+      switch (*q)
+	{
+	case '\\':
+	  *in_word = 1;
+	  if (! q[1])
+	    return NULL;
+	  q++;
+	  break;
+
+	case '\'':
+	case '"':
+	  *quote = *q;
+	  *in_word = 1;
+	  break;
+
+	case '#':
+	  if (! *in_word)
+	    return NULL;
+	  break;
+
+	case '$':
+	  *in_word = 1;
+	  if (q[1] == '"')
+	    {
+	      *quote = '"';
+	      q++;
+	    }
+	  else if (q[1] == '{')
+	    {
+	      const char *e = q + 2;
+
+	      if (lazy_is_name_start (*e))
+		while (lazy_is_name_char (*e))
+		  e++;
+	      else if (grub_isdigit (*e))
+		while (grub_isdigit (*e))
+		  e++;
+	      else if (*e && grub_strchr ("?#*@", *e))
+		e++;
+	      if (e == q + 2 || *e != '}')
+		{
+		  *quote = -1;
+		  return NULL;
+		}
+	      q = e;
+	    }
+	  break;
+
+	case '{':
+	  (*depth)++;
+	  *in_word = 0;
+	  break;
+
+	case '}':
+	  *in_word = 0;
+	  if (--*depth == 0)
+	    return q;
+	  break;
+
+	case ' ':
+	case '\t':
+	case ';':
+	case '|':
+	case '&':
+	case '<':
+	case '>':
+	  *in_word = 0;
+	  break;
+
+	default:
+	  *in_word = 1;
+	  break;
+	}
+    }
+
+  /* The newline ends the word, unless escaped (handled above).  */
+  *in_word = 0;
+  return NULL;
+}
+
+static grub_err_t
+read_config_file_getline (char **line, int cont, void *data);
+
+/* Try to run the menuentry or submenu starting at LINE without parsing
+   its body.  Returns 1 if it did; otherwise SRC is left where it was
+   for the parser to read the same lines.  */
+static int
+read_lazy_entry (const char *line, struct config_source *src)
+{
+  struct grub_script_argv argv = { 0, 0, 0 };
+  grub_size_t pos = src->pos;
+  const char *p = line, *end, *seg;
+  char *body = NULL, *next = NULL;
+  grub_size_t len = 0, alloc = 0;
+  int depth = 1, quote = 0, in_word = 0;
+
+  while (*p == ' ' || *p == '\t')
+    p++;
+  if (! ((grub_strncmp (p, "menuentry", 9) == 0 && (p[9] == ' ' || p[9] == '\t'))
+	 || (grub_strncmp (p, "submenu", 7) == 0 && (p[7] == ' ' || p[7] == '\t'))))
+    return 0;
+
+  while (1)
+    {
+      while (*p == ' ' || *p == '\t')
+	p++;
+      if (*p == '{')
+	break;
+      if (! *p || lazy_header_word (&p, &argv))
+	goto fail;
+    }
+  if (! grub_command_find (argv.args[0]))
+    goto fail;
+
+  /* Collect the body, as the lexer records it: the lines joined with
+     newlines, from after the opening brace to before the closing one.  */
+  seg = p + 1;
+  while (1)
+    {
+      grub_size_t n;
+
+      end = lazy_block_end (seg, &depth, &quote, &in_word);
+      if (quote < 0)
+	goto fail;
+      n = end ? (grub_size_t) (end - seg) : grub_strlen (seg) + 1;
+      if (len + n + 1 > alloc)
+	{
+	  char *b;
+
+	  alloc = 2 * (len + n + 1);
+	  b = grub_realloc (body, alloc);
+	  if (! b)
+	    goto fail;
+	  body = b;
+	}
+      grub_memcpy (body + len, seg, end ? n : n - 1);
+      len += n;
+      if (! end)
+	body[len - 1] = '\n';
+      body[len] = '\0';
+      if (end)
+	break;
+
+      grub_free (next);
+      next = NULL;
+      if (read_config_file_getline (&next, 0, src) || ! next)
+	goto fail;
+      seg = next;
+    }
+
+  /* Nothing but a comment may follow on the line of the closing brace.  */
+  for (p = end + 1; *p == ' ' || *p == '\t'; p++);
+  if (*p && *p != '#')
+    goto fail;
+
+  if (grub_script_argv_next (&argv)
+      || grub_script_argv_append (&argv, "{", 1)
+      || grub_script_argv_append (&argv, body, len)
+      || grub_script_argv_append (&argv, "}", 1))
+    goto fail;
+
+  grub_script_execute_unparsed_block (&argv);
+
+  grub_script_argv_free (&argv);
+  grub_free (body);
+  grub_free (next);
+  return 1;
+
+ fail:
+  grub_script_argv_free (&argv);
+  grub_free (body);
+  grub_free (next);
+  grub_errno = GRUB_ERR_NONE;
+  src->pos = pos;
+  return 0;
+}
+
 static grub_menu_t
 read_config_file (const char *config)
 {
-  grub_file_t rawfile, file;
+  grub_file_t file;
+  struct config_source src;
   char *old_file = 0, *old_dir = 0;
   char *config_dir, *ptr = 0;
   const char *ctmp;
@@ -123,16 +529,17 @@ read_config_file (const char *config)
     }
 
   /* Try to open the config file.  */
-  rawfile = grub_file_open (config);
-  if (! rawfile)
+  file = grub_file_open (config);
+  if (! file)
     return 0;
 
-  file = grub_bufio_open (rawfile, 0);
-  if (! file)
+  if (config_source_read (file, &src))
     {
-      grub_file_close (rawfile);
+      grub_free (src.buf);
+      grub_file_close (file);
       return 0;
     }
+  grub_file_close (file);
 
   ctmp = grub_env_get ("config_file");
   if (ctmp)
@@ -172,10 +579,11 @@ read_config_file (const char *config)
       grub_print_error ();
       grub_errno = GRUB_ERR_NONE;
 
-      if ((read_config_file_getline (&line, 0, file)) || (! line))
+      if ((read_config_file_getline (&line, 0, &src)) || (! line))
 	break;
 
-      grub_normal_parse_line (line, read_config_file_getline, file);
+      if (! lazy_menu_enabled () || ! read_lazy_entry (line, &src))
+	grub_normal_parse_line (line, read_config_file_getline, &src);
       grub_free (line);
     }
 
@@ -190,7 +598,7 @@ read_config_file (const char *config)
   grub_free (old_file);
   grub_free (old_dir);
 
-  grub_file_close (file);
+  grub_free (src.buf);
 
   return newmenu;
 }
@@ -240,6 +648,7 @@ read_lists (const char *val)
     {
       read_command_list (val);
       read_fs_list (val);
+      read_partmap_list (val);
       read_crypto_list (val);
       read_terminal_list (val);
     }
@@ -273,7 +682,9 @@ grub_normal_execute (const char *config, int nested, int batch)
 
   if (config)
     {
+      grub_script_measure_batch_begin ();
       menu = read_config_file (config);
+      grub_script_measure_batch_end ();
 
       /* Ignore any error.  */
       grub_errno = GRUB_ERR_NONE;
@@ -471,6 +882,59 @@ grub_env_write_pager (struct grub_env_var *var __attribute__ ((unused)),
   return grub_strdup (val);
 }
 
+static char *
+grub_env_write_disk_cache_size (struct grub_env_var *var
+				__attribute__ ((unused)),
+				const char *val)
+{
+  char *end;
+  unsigned long num;
+  char buf[sizeof ("XXXXXXXXXX")];
+
+  grub_errno = GRUB_ERR_NONE;
+  num = grub_strtoul (val, &end, 0);
+  if (grub_errno != GRUB_ERR_NONE)
+    return NULL;
+  if (*end != '\0')
+    {
+      grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+      return NULL;
+    }
+
+  /* Larger than the limit anyway, which grub_disk_cache_resize applies.  */
+  if (num > GRUB_UINT_MAX)
+    num = GRUB_UINT_MAX;
+  if (grub_disk_cache_resize (num) != GRUB_ERR_NONE)
+    return NULL;
+
+  /* The size is rounded to whole sets and clamped: show what it is.  */
+  grub_snprintf (buf, sizeof (buf), "%u",
+		 grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS);
+  return grub_strdup (buf);
+}
+
+static char *
+grub_env_write_file_cache_size (struct grub_env_var *var
+				__attribute__ ((unused)),
+				const char *val)
+{
+  char *end;
+  unsigned long num;
+
+  num = grub_strtoul (val, &end, 0);
+  if (grub_errno != GRUB_ERR_NONE)
+    return NULL;
+  if (*end != '\0')
+    {
+      grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+      return NULL;
+    }
+
+  grub_file_cache_resize (num);
+
+  return grub_strdup (val);
+}
+
 /* clear */
 static grub_err_t
 grub_mini_cmd_clear (struct grub_command *cmd __attribute__ ((unused)),
@@ -504,6 +968,7 @@ GRUB_MOD_INIT(normal)
   grub_normal_auth_init ();
   grub_context_init ();
   grub_script_init ();
+  grub_script_measure_init ();
   grub_menu_init ();
 
   grub_xputs_saved = grub_xputs;
@@ -522,6 +987,31 @@ GRUB_MOD_INIT(normal)
   grub_register_variable_hook ("pager", 0, grub_env_write_pager);
   grub_env_export ("pager");
 
+  /* Number of disk cache entries, each holding GRUB_DISK_CACHE_SIZE
+     sectors.  */
+  {
+    char buf[sizeof ("XXXXXXXXXX")];
+
+    grub_snprintf (buf, sizeof (buf), "%u",
+		   grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS);
+    grub_env_set ("disk_cache_size", buf);
+    grub_register_variable_hook ("disk_cache_size", 0,
+				 grub_env_write_disk_cache_size);
+    grub_env_export ("disk_cache_size");
+  }
+
+  /* Bytes of small file contents kept in memory.  */
+  {
+    char buf[sizeof ("XXXXXXXXXXXXXXXXXXXX")];
+
+    grub_snprintf (buf, sizeof (buf), "%llu",
+		   (unsigned long long) grub_file_cache_max);
+    grub_env_set ("file_cache_size", buf);
+    grub_register_variable_hook ("file_cache_size", 0,
+				 grub_env_write_file_cache_size);
+    grub_env_export ("file_cache_size");
+  }
+
   /* Register a command "normal" for the rescue mode.  */
   grub_register_command ("normal", grub_cmd_normal,
 			 0, N_("Enter normal mode."));
@@ -557,6 +1047,7 @@ GRUB_MOD_FINI(normal)
 {
   grub_context_fini ();
   grub_script_fini ();
+  grub_script_measure_fini ();
   grub_menu_fini ();
   grub_normal_auth_fini ();
 
@@ -564,6 +1055,9 @@ GRUB_MOD_FINI(normal)
 
   grub_set_history (0);
   grub_register_variable_hook ("pager", 0, 0);
+  grub_register_variable_hook ("disk_cache_size", 0, 0);
+  grub_register_variable_hook ("file_cache_size", 0, 0);
   grub_fs_autoload_hook = 0;
+  grub_partition_autoload_hook = 0;
   grub_unregister_command (cmd_clear);
 }
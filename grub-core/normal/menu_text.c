@@ -263,63 +263,135 @@ print_entry (int y, int highlight, grub_menu_entry_t entry,
   grub_free (unicode_title);
 }
 
+/* Draw the arrows beside the list that show whether it continues above
+   or below.  MORE is set if entries follow the last visible one.  */
 static void
-print_entries (grub_menu_t menu, const struct menu_viewer_data *data)
+print_scroll_arrows (const struct menu_viewer_data *data, int more)
 {
-  grub_menu_entry_t e;
-  int i;
-
-  grub_term_gotoxy (data->term,
-		    (struct grub_term_coordinate) { 
-		      data->geo.first_entry_x + data->geo.entry_width
-			+ data->geo.border + 1,
-			data->geo.first_entry_y });
+  int x = data->geo.first_entry_x + data->geo.entry_width
+    + data->geo.border + 1;
 
   if (data->geo.num_entries != 1)
     {
+      grub_term_gotoxy (data->term,
+			(struct grub_term_coordinate) { x,
+			    data->geo.first_entry_y });
       if (data->first)
 	grub_putcode (GRUB_UNICODE_UPARROW, data->term);
       else
 	grub_putcode (' ', data->term);
     }
-  e = grub_menu_get_entry (menu, data->first);
-
-  for (i = 0; i < data->geo.num_entries; i++)
-    {
-      print_entry (data->geo.first_entry_y + i, data->offset == i,
-		   e, data);
-      if (e)
-	e = e->next;
-    }
 
   grub_term_gotoxy (data->term,
-		    (struct grub_term_coordinate) { data->geo.first_entry_x + data->geo.entry_width
-			+ data->geo.border + 1,
+		    (struct grub_term_coordinate) { x,
 			data->geo.first_entry_y + data->geo.num_entries - 1 });
   if (data->geo.num_entries == 1)
     {
-      if (data->first && e)
+      if (data->first && more)
 	grub_putcode (GRUB_UNICODE_UPDOWNARROW, data->term);
       else if (data->first)
 	grub_putcode (GRUB_UNICODE_UPARROW, data->term);
-      else if (e)
+      else if (more)
 	grub_putcode (GRUB_UNICODE_DOWNARROW, data->term);
       else
 	grub_putcode (' ', data->term);
     }
   else
     {
-      if (e)
+      if (more)
 	grub_putcode (GRUB_UNICODE_DOWNARROW, data->term);
       else
 	grub_putcode (' ', data->term);
     }
+}
+
+static void
+print_entries (grub_menu_t menu, const struct menu_viewer_data *data)
+{
+  grub_menu_entry_t e;
+  int i;
+
+  e = grub_menu_get_entry (menu, data->first);
+
+  for (i = 0; i < data->geo.num_entries; i++)
+    {
+      print_entry (data->geo.first_entry_y + i, data->offset == i,
+		   e, data);
+      if (e)
+	e = e->next;
+    }
+
+  print_scroll_arrows (data, e != NULL);
 
   grub_term_gotoxy (data->term,
 		    (struct grub_term_coordinate) { grub_term_cursor_x (&data->geo),
 			data->geo.first_entry_y + data->offset });
 }
 
+/* The list moved by one entry since OLDFIRST/OLDOFFSET were shown.  Let
+   the terminal shift the rows and repaint only the new row, the old and
+   new selection and the arrows.  Return 0 if the terminal can't scroll.  */
+static int
+scroll_entries (grub_menu_t menu, const struct menu_viewer_data *data,
+		int oldfirst, int oldoffset)
+{
+  int up = data->first > oldfirst;
+  int top = data->geo.first_entry_y;
+  int bottom = top + data->geo.num_entries - 1;
+  int new_y = up ? bottom : top;
+  int old_y = top + oldoffset + (up ? -1 : 1);
+  int sel_y = top + data->offset;
+  int arrow_x = data->geo.first_entry_x + data->geo.entry_width
+    + data->geo.border + 1;
+
+  if (data->geo.num_entries < 2)
+    return 0;
+
+  /* Rows freed by the scroll take the current background.  */
+  grub_term_setcolorstate (data->term, GRUB_TERM_COLOR_NORMAL);
+  if (!grub_term_scroll (data->term, top, bottom, up))
+    return 0;
+
+  if (data->geo.border)
+    {
+      grub_uint8_t old_color_normal = grub_term_normal_color;
+
+      grub_term_normal_color = grub_color_menu_normal;
+      grub_term_setcolorstate (data->term, GRUB_TERM_COLOR_NORMAL);
+      grub_term_gotoxy (data->term, (struct grub_term_coordinate) {
+	  data->geo.first_entry_x - 1, new_y });
+      grub_putcode (GRUB_UNICODE_VLINE, data->term);
+      grub_term_gotoxy (data->term, (struct grub_term_coordinate) {
+	  data->geo.first_entry_x + data->geo.entry_width + 1, new_y });
+      grub_putcode (GRUB_UNICODE_VLINE, data->term);
+      grub_term_normal_color = old_color_normal;
+      grub_term_setcolorstate (data->term, GRUB_TERM_COLOR_NORMAL);
+    }
+
+  /* The edge arrow moved one row inwards along with the list.  */
+  grub_term_gotoxy (data->term, (struct grub_term_coordinate) {
+      arrow_x, up ? bottom - 1 : top + 1 });
+  grub_putcode (' ', data->term);
+
+  print_entry (new_y, new_y == sel_y,
+	       grub_menu_get_entry (menu, data->first + new_y - top), data);
+  if (old_y >= top && old_y <= bottom && old_y != new_y && old_y != sel_y)
+    print_entry (old_y, 0,
+		 grub_menu_get_entry (menu, data->first + old_y - top), data);
+  if (sel_y != new_y)
+    print_entry (sel_y, 1,
+		 grub_menu_get_entry (menu, data->first + data->offset), data);
+
+  print_scroll_arrows (data, grub_menu_get_entry (menu, data->first
+						   + data->geo.num_entries)
+		       != NULL);
+
+  grub_term_gotoxy (data->term,
+		    (struct grub_term_coordinate) { grub_term_cursor_x (&data->geo),
+			sel_y });
+  return 1;
+}
+
 /* Initialize the screen.  If NESTED is non-zero, assume that this menu
    is run from another menu or a command-line. If EDIT is non-zero, show
    a message for the menu entry editor.  */
@@ -483,6 +555,7 @@ menu_text_set_chosen_entry (int entry, void *dataptr)
 {
   struct menu_viewer_data *data = dataptr;
   int oldoffset = data->offset;
+  int oldfirst = data->first;
   int complete_redraw = 0;
 
   data->offset = entry - data->first;
@@ -499,7 +572,11 @@ menu_text_set_chosen_entry (int entry, void *dataptr)
       complete_redraw = 1;
     }
   if (complete_redraw)
-    print_entries (data->menu, data);
+    {
+      if ((data->first != oldfirst + 1 && data->first != oldfirst - 1)
+	  || !scroll_entries (data->menu, data, oldfirst, oldoffset))
+	print_entries (data->menu, data);
+    }
   else
     {
       print_entry (data->geo.first_entry_y + oldoffset, 0,
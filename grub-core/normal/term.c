@@ -869,6 +869,124 @@ getcharwidth (const struct grub_unicode_glyph *c, void *term)
   return grub_term_getcharwidth (term, c);
 }
 
+/* Menu entry titles and other fixed strings go through the bidi
+   algorithm again on every redraw, so the visual form of recently printed
+   strings is kept.  Only results with no allocated combining lists are
+   stored, so an entry can be handed out with a plain copy.  */
+#define VISUAL_CACHE_SIZE	32
+#define VISUAL_CACHE_MAX_LEN	256
+
+struct visual_cache_entry
+{
+  grub_uint32_t *logical;
+  grub_size_t logical_len;
+  struct grub_term_output *term;
+  grub_size_t maxwidth;
+  grub_size_t startwidth;
+  grub_uint32_t contchar;
+  /* Sum of the glyph widths, to notice a change of font.  */
+  grub_size_t width;
+  struct grub_unicode_glyph *visual;
+  grub_ssize_t visual_len;
+  unsigned long last_use;
+};
+
+static struct visual_cache_entry visual_cache[VISUAL_CACHE_SIZE];
+static unsigned long visual_cache_clock;
+
+static grub_size_t
+visual_width (const struct grub_unicode_glyph *visual, grub_ssize_t len,
+	      struct grub_term_output *term)
+{
+  grub_size_t width = 0;
+  grub_ssize_t i;
+
+  for (i = 0; i < len; i++)
+    width += grub_term_getcharwidth (term, &visual[i]);
+  return width;
+}
+
+/* Like grub_bidi_logical_to_visual, but returns a copy of the stored result
+   if the same string was laid out the same way before.  */
+static grub_ssize_t
+logical_to_visual (const grub_uint32_t *str, grub_size_t len,
+		   struct grub_unicode_glyph **visual_out,
+		   struct grub_term_output *term,
+		   grub_size_t maxwidth, grub_size_t startwidth,
+		   grub_uint32_t contchar, struct grub_term_pos *pos)
+{
+  struct visual_cache_entry *entry, *victim = &visual_cache[0];
+  struct grub_unicode_glyph *visual;
+  grub_ssize_t visual_len, i;
+
+  /* POS is filled in as a side effect, which a copy wouldn't do.  */
+  if (pos || len == 0 || len > VISUAL_CACHE_MAX_LEN)
+    return grub_bidi_logical_to_visual (str, len, visual_out, getcharwidth,
+					term, maxwidth, startwidth, contchar,
+					pos, !!contchar);
+
+  for (entry = visual_cache; entry < visual_cache + VISUAL_CACHE_SIZE;
+       entry++)
+    {
+      if (entry->last_use < victim->last_use)
+	victim = entry;
+      if (!entry->visual || entry->term != term
+	  || entry->logical_len != len || entry->maxwidth != maxwidth
+	  || entry->startwidth != startwidth || entry->contchar != contchar
+	  || grub_memcmp (entry->logical, str, len * sizeof (str[0])) != 0)
+	continue;
+      if (visual_width (entry->visual, entry->visual_len, term)
+	  != entry->width)
+	{
+	  victim = entry;
+	  break;
+	}
+
+      *visual_out = grub_malloc (entry->visual_len * sizeof (visual[0]));
+      if (!*visual_out)
+	return -1;
+      grub_memcpy (*visual_out, entry->visual,
+		   entry->visual_len * sizeof (visual[0]));
+      entry->last_use = ++visual_cache_clock;
+      return entry->visual_len;
+    }
+
+  visual_len = grub_bidi_logical_to_visual (str, len, &visual, getcharwidth,
+					    term, maxwidth, startwidth,
+					    contchar, pos, !!contchar);
+  *visual_out = visual;
+  if (visual_len <= 0)
+    return visual_len;
+
+  for (i = 0; i < visual_len; i++)
+    if (visual[i].ncomb > (int) ARRAY_SIZE (visual[i].combining_inline))
+      return visual_len;
+
+  grub_free (victim->logical);
+  grub_free (victim->visual);
+  victim->visual = 0;
+  victim->logical = grub_malloc (len * sizeof (str[0]));
+  victim->visual_len = visual_len;
+  if (victim->logical)
+    victim->visual = grub_malloc (visual_len * sizeof (visual[0]));
+  if (!victim->visual)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return visual_len;
+    }
+  grub_memcpy (victim->logical, str, len * sizeof (str[0]));
+  grub_memcpy (victim->visual, visual, visual_len * sizeof (visual[0]));
+  victim->logical_len = len;
+  victim->term = term;
+  victim->maxwidth = maxwidth;
+  victim->startwidth = startwidth;
+  victim->contchar = contchar;
+  victim->width = visual_width (visual, visual_len, term);
+  victim->last_use = ++visual_cache_clock;
+
+  return visual_len;
+}
+
 static int
 print_ucs4_real (const grub_uint32_t * str,
 		 const grub_uint32_t * last_position,
@@ -911,14 +1029,13 @@ print_ucs4_real (const grub_uint32_t * str,
       int ret;
       struct grub_unicode_glyph *vptr;
 
-      visual_len = grub_bidi_logical_to_visual (str, last_position - str,
-						&visual, getcharwidth, term,
-						get_maxwidth (term, 
-							      margin_left,
-							      margin_right),
-						dry_run ? 0 : get_startwidth (term, 
-									      margin_left),
-						contchar, pos, !!contchar);
+      visual_len = logical_to_visual (str, last_position - str,
+				      &visual, term,
+				      get_maxwidth (term, margin_left,
+						    margin_right),
+				      dry_run ? 0 : get_startwidth (term,
+								    margin_left),
+				      contchar, pos);
       if (visual_len < 0)
 	{
 	  grub_print_error ();
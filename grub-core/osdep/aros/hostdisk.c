@@ -500,6 +500,24 @@ grub_util_disable_fd_syncs (void)
   allow_fd_syncs = 0;
 }
 
+void
+grub_util_fd_map_sequential (void)
+{
+}
+
+void *
+grub_util_fd_map (grub_util_fd_t fd __attribute__ ((unused)),
+		  grub_uint64_t len __attribute__ ((unused)))
+{
+  return NULL;
+}
+
+void
+grub_util_fd_unmap (void *addr __attribute__ ((unused)),
+		    grub_uint64_t len __attribute__ ((unused)))
+{
+}
+
 void
 grub_hostdisk_flush_initial_buffer (const char *os_dev __attribute__ ((unused)))
 {
@@ -22,6 +22,12 @@
 #include <grub/i18n.h>
 #include <grub/emu/net.h>
 
+int
+grub_emunet_set_udp (const char *spec __attribute__ ((unused)))
+{
+  return -1;
+}
+
 grub_ssize_t
 grub_emunet_send (const void *packet __attribute__ ((unused)),
 		  grub_size_t sz __attribute__ ((unused)))
@@ -1,3 +1,5 @@
 #if (!defined (__MINGW32__) || defined (__CYGWIN__)) && !defined (__AROS__)
 #include "unix/exec.c"
+#else
+#include "basic/exec.c"
 #endif
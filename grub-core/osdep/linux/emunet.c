@@ -21,27 +21,128 @@
 
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <netinet/in.h>
 #include <linux/if.h>
 #include <linux/if_tun.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 #include <fcntl.h>
 #include <string.h>
+#include <stdlib.h>
 
 #include <grub/emu/net.h>
 
 static int fd;
 
+/* With --net-udp the card is a UDP socket on localhost carrying one frame
+   per datagram, as QEMU's socket netdev does.  Unlike a TAP device it
+   needs no privileges, and frames can be drained many per system call.  */
+static int udp_local_port, udp_remote_port;
+
+#define EMUNET_BATCH		32
+#define EMUNET_FRAME_SIZE	2048
+
+/* Large enough to hold a whole burst while GRUB is busy elsewhere.  */
+#define EMUNET_UDP_RCVBUF	(4 * 1024 * 1024)
+
+static char batch[EMUNET_BATCH][EMUNET_FRAME_SIZE];
+static grub_size_t batch_len[EMUNET_BATCH];
+static unsigned batch_count, batch_next;
+
+int
+grub_emunet_set_udp (const char *spec)
+{
+  char *end;
+  unsigned long local, remote;
+
+  local = strtoul (spec, &end, 10);
+  if (*end != ':' || local == 0 || local > 65535)
+    return -1;
+  remote = strtoul (end + 1, &end, 10);
+  if (*end || remote == 0 || remote > 65535)
+    return -1;
+  udp_local_port = local;
+  udp_remote_port = remote;
+  return 0;
+}
+
 grub_ssize_t
 grub_emunet_send (const void *packet, grub_size_t sz)
 {
   return write (fd, packet, sz);
 }
 
+static void
+udp_refill (void)
+{
+  struct mmsghdr msgs[EMUNET_BATCH];
+  struct iovec iov[EMUNET_BATCH];
+  int i, n;
+
+  memset (msgs, 0, sizeof (msgs));
+  for (i = 0; i < EMUNET_BATCH; i++)
+    {
+      iov[i].iov_base = batch[i];
+      iov[i].iov_len = EMUNET_FRAME_SIZE;
+      msgs[i].msg_hdr.msg_iov = &iov[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+  batch_count = batch_next = 0;
+  n = recvmmsg (fd, msgs, EMUNET_BATCH, MSG_DONTWAIT, NULL);
+  for (i = 0; i < n; i++)
+    batch_len[i] = msgs[i].msg_len;
+  if (n > 0)
+    batch_count = n;
+}
+
 grub_ssize_t
 grub_emunet_receive (void *packet, grub_size_t sz)
 {
-  return read (fd, packet, sz);
+  grub_size_t len;
+
+  if (! udp_remote_port)
+    return read (fd, packet, sz);
+
+  if (batch_next == batch_count)
+    udp_refill ();
+  if (batch_next == batch_count)
+    return -1;
+
+  len = batch_len[batch_next];
+  if (len > sz)
+    len = sz;
+  memcpy (packet, batch[batch_next++], len);
+  return len;
+}
+
+static int
+udp_create (void)
+{
+  struct sockaddr_in addr;
+  int rcvbuf = EMUNET_UDP_RCVBUF;
+
+  fd = socket (AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+    return -1;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof (rcvbuf));
+
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (udp_local_port);
+  if (bind (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    goto fail;
+  addr.sin_port = htons (udp_remote_port);
+  if (connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0)
+    goto fail;
+  batch_count = batch_next = 0;
+  return 0;
+
+ fail:
+  close (fd);
+  fd = -1;
+  return -1;
 }
 
 int
@@ -49,6 +150,8 @@ grub_emunet_create (grub_size_t *mtu)
 {
   struct ifreq ifr;
   *mtu = 1500;
+  if (udp_remote_port)
+    return udp_create ();
   fd = open ("/dev/net/tun", O_RDWR | O_NONBLOCK);
   if (fd < 0)
     return -1;
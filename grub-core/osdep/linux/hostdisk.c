@@ -45,6 +45,10 @@
 #include <errno.h>
 #include <limits.h>
 
+#ifdef USE_LIBURING
+#include <liburing.h>
+#endif
+
 # include <sys/ioctl.h>         /* ioctl */
 # include <sys/mount.h>
 # ifndef BLKFLSBUF
@@ -459,3 +463,116 @@ grub_util_fd_open_device (const grub_disk_t disk, grub_disk_addr_t sector, int f
 
   return fd;
 }
+
+#ifdef USE_LIBURING
+
+/* Reads in flight at once.  */
+#define URING_ENTRIES 64
+
+static struct io_uring ring;
+/* 0 before the first use, 1 once set up, -1 if io_uring can't be used.  */
+static int ring_state;
+
+/* Finish a read which came back short.  */
+static int
+read_rest (int fd, const struct grub_util_fd_vec *v, grub_size_t done)
+{
+  while (done < v->len)
+    {
+      ssize_t ret = pread (fd, v->buf + done, v->len - done, v->off + done);
+
+      if (ret < 0 && errno == EINTR)
+	continue;
+      if (ret <= 0)
+	{
+	  if (ret == 0)
+	    errno = EIO;
+	  return -1;
+	}
+      done += ret;
+    }
+  return 0;
+}
+
+int
+grub_hostdisk_linux_read_vec (int fd, const struct grub_util_fd_vec *vec,
+			      grub_size_t n)
+{
+  grub_size_t start, i;
+  int err = 0;
+
+  if (ring_state == 0)
+    ring_state = io_uring_queue_init (URING_ENTRIES, &ring, 0) == 0 ? 1 : -1;
+
+  for (start = 0; start < n && ring_state > 0 && !err;
+       start += URING_ENTRIES)
+    {
+      grub_size_t count = n - start, queued = 0, done = 0;
+
+      if (count > URING_ENTRIES)
+	count = URING_ENTRIES;
+
+      for (i = start; i < start + count; i++)
+	{
+	  struct io_uring_sqe *sqe = io_uring_get_sqe (&ring);
+
+	  io_uring_prep_read (sqe, fd, vec[i].buf, vec[i].len, vec[i].off);
+	  io_uring_sqe_set_data (sqe, (void *) &vec[i]);
+	}
+
+      while (queued < count)
+	{
+	  int ret = io_uring_submit (&ring);
+
+	  if (ret == -EINTR)
+	    continue;
+	  if (ret <= 0)
+	    {
+	      /* Give up on the ring once what went in is done; the
+		 caller reads everything again.  */
+	      ring_state = -1;
+	      break;
+	    }
+	  queued += ret;
+	}
+
+      while (done < queued)
+	{
+	  const struct grub_util_fd_vec *v;
+	  struct io_uring_cqe *cqe;
+	  int ret;
+
+	  ret = io_uring_wait_cqe (&ring, &cqe);
+	  if (ret == -EINTR)
+	    continue;
+	  if (ret < 0)
+	    {
+	      err = -ret;
+	      break;
+	    }
+	  v = io_uring_cqe_get_data (cqe);
+	  ret = cqe->res;
+	  io_uring_cqe_seen (&ring, cqe);
+	  done++;
+
+	  if (err)
+	    continue;
+	  /* IORING_OP_READ came after io_uring itself.  */
+	  if (ret == -EINVAL)
+	    ring_state = -1;
+	  else if (ret < 0)
+	    err = -ret;
+	  else if ((grub_size_t) ret < v->len && read_rest (fd, v, ret) < 0)
+	    err = errno;
+	}
+    }
+
+  if (err)
+    {
+      errno = err;
+      return -1;
+    }
+  return ring_state > 0 ? 0 : 1;
+}
+
+#endif
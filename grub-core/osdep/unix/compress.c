@@ -39,3 +39,18 @@ grub_install_compress_lzop (const char *src, const char *dest)
   return grub_util_exec_redirect ((const char * []) { "lzop", "-9",  "-c",
 	NULL }, src, dest);
 }
+
+int 
+grub_install_compress_lz4 (const char *src, const char *dest)
+{
+  /* With the size in the frame lz4io needn't walk the blocks for it.  */
+  return grub_util_exec_redirect ((const char * []) { "lz4", "-9",
+	"--content-size", "-c", NULL }, src, dest);
+}
+
+int 
+grub_install_compress_zstd (const char *src, const char *dest)
+{
+  return grub_util_exec_redirect ((const char * []) { "zstd", "-19", "-q",
+	"-c", NULL }, src, dest);
+}
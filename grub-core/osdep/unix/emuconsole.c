@@ -59,6 +59,19 @@ put (struct grub_term_output *term __attribute__ ((unused)), const int c)
     }
 }
 
+static void
+write_buf (struct grub_term_output *term __attribute__ ((unused)),
+	   const char *buf, grub_size_t len)
+{
+  ssize_t actual;
+
+  actual = write (STDOUT_FILENO, buf, len);
+  if (actual < (ssize_t) len)
+    {
+      /* Same as above.  */
+    }
+}
+
 static int
 readkey (struct grub_term_input *term __attribute__ ((unused)))
 {
@@ -131,6 +144,7 @@ struct grub_terminfo_input_state grub_console_terminfo_input =
 struct grub_terminfo_output_state grub_console_terminfo_output =
   {
     .put = put,
+    .write = write_buf,
     .size = { 80, 24 }
   };
 
@@ -154,6 +168,7 @@ static struct grub_term_output grub_console_term_output =
     .cls = grub_terminfo_cls,
     .setcolorstate = grub_terminfo_setcolorstate,
     .setcursor = grub_terminfo_setcursor,
+    .refresh = grub_terminfo_refresh,
     .data = &grub_console_terminfo_output,
     .progress_update_divisor = GRUB_PROGRESS_FAST
   };
@@ -175,6 +190,7 @@ grub_console_init (void)
 void
 grub_console_fini (void)
 {
+  grub_terminfo_refresh (&grub_console_term_output);
   if (saved_orig)
     {
       fcntl (STDIN_FILENO, F_SETFL, original_fl);
@@ -243,3 +243,62 @@ grub_util_exec_pipe_stderr (const char *const *argv, int *fd)
       return pid;
     }
 }
+
+static int max_jobs = 1;
+static int running_jobs;
+
+void
+grub_util_set_jobs (int n)
+{
+  max_jobs = (n > 0) ? n : 1;
+}
+
+static void
+wait_one_job (void)
+{
+  int status;
+
+  if (wait (&status) < 0)
+    grub_util_error (_("cannot wait for a job: %s"), strerror (errno));
+  running_jobs--;
+  if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+    grub_util_error ("%s", _("a parallel job failed"));
+}
+
+void
+grub_util_run_job (void (*fn) (void *arg), void *arg)
+{
+  pid_t pid;
+
+  if (max_jobs == 1)
+    {
+      fn (arg);
+      return;
+    }
+
+  while (running_jobs >= max_jobs)
+    wait_one_job ();
+
+  /* Or the child would print what is buffered a second time.  */
+  fflush (stdout);
+  fflush (stderr);
+
+  pid = fork ();
+  if (pid < 0)
+    grub_util_error (_("Unable to fork: %s"), strerror (errno));
+  else if (pid == 0)
+    {
+      fn (arg);
+      fflush (stdout);
+      fflush (stderr);
+      _exit (0);
+    }
+  running_jobs++;
+}
+
+void
+grub_util_wait_jobs (void)
+{
+  while (running_jobs)
+    wait_one_job ();
+}
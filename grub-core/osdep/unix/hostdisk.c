@@ -45,6 +45,8 @@
 
 #if !defined (__CYGWIN__) && !defined (__MINGW32__) && !defined (__AROS__)
 
+#include <sys/mman.h>
+
 #ifdef __linux__
 # include <sys/ioctl.h>         /* ioctl */
 # include <sys/mount.h>
@@ -197,6 +199,45 @@ grub_util_fd_close (grub_util_fd_t fd)
   close (fd);
 }
 
+static int map_sequential;
+
+void
+grub_util_fd_map_sequential (void)
+{
+  map_sequential = 1;
+}
+
+void *
+grub_util_fd_map (grub_util_fd_t fd, grub_uint64_t len)
+{
+  struct stat st;
+  void *addr;
+
+  if (len == 0 || len != (size_t) len || fstat (fd, &st) < 0)
+    return NULL;
+#if GRUB_DISK_DEVS_ARE_CHAR
+  if (! S_ISREG (st.st_mode) && ! S_ISCHR (st.st_mode))
+#else
+  if (! S_ISREG (st.st_mode) && ! S_ISBLK (st.st_mode))
+#endif
+    return NULL;
+
+  addr = mmap (NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED)
+    return NULL;
+#ifdef MADV_SEQUENTIAL
+  if (map_sequential)
+    madvise (addr, len, MADV_SEQUENTIAL);
+#endif
+  return addr;
+}
+
+void
+grub_util_fd_unmap (void *addr, grub_uint64_t len)
+{
+  munmap (addr, len);
+}
+
 char *
 grub_canonicalize_file_name (const char *path)
 {
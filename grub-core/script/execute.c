@@ -28,11 +28,18 @@
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
 #include <grub/tpm.h>
+#include <grub/loader.h>
 
 /* Max digits for a char is 3 (0xFF is 255), similarly for an int it
    is sizeof (int) * 3, and one extra for a possible -ve sign.  */
 #define ERRNO_DIGITS_MAX  (sizeof (int) * 3 + 1)
 
+/* Command lines waiting to be measured as one event.  */
+static char *measure_batch;
+static grub_size_t measure_len;
+static grub_size_t measure_alloc;
+static int measure_depth;
+
 static unsigned long is_continue;
 static unsigned long active_loops;
 static unsigned long active_breaks;
@@ -77,6 +84,15 @@ wildcard_escape (const char *s)
   return p;
 }
 
+static int
+has_wildcard_chars (const char *s)
+{
+  for (; *s; s++)
+    if (*s == '*' || *s == '\\' || *s == '?')
+      return 1;
+  return 0;
+}
+
 static char*
 wildcard_unescape (const char *s)
 {
@@ -247,13 +263,14 @@ grub_script_return (grub_command_t cmd __attribute__((unused)),
   return n ? grub_error (n, N_("false")) : GRUB_ERR_NONE;
 }
 
+/* Positional parameters and $#, $* and $@ live in the scope, not the
+   environment, so they are told apart by their first character.  */
 static int
 grub_env_special (const char *name)
 {
-  if (grub_isdigit (name[0]) ||
-      grub_strcmp (name, "#") == 0 ||
-      grub_strcmp (name, "*") == 0 ||
-      grub_strcmp (name, "@") == 0)
+  if (grub_isdigit (name[0]))
+    return 1;
+  if ((name[0] == '#' || name[0] == '*' || name[0] == '@') && ! name[1])
     return 1;
   return 0;
 }
@@ -287,14 +304,14 @@ grub_script_env_get (const char *name, grub_script_arg_type_t type)
       if (grub_script_argv_append (&result, 0, 0))
 	goto fail;
     }
-  else if (grub_strcmp (name, "#") == 0)
+  else if (name[0] == '#')
     {
       char buffer[ERRNO_DIGITS_MAX + 1];
       grub_snprintf (buffer, sizeof (buffer), "%u", scope->argv.argc);
       if (grub_script_argv_append (&result, buffer, grub_strlen (buffer)))
 	goto fail;
     }
-  else if (grub_strcmp (name, "*") == 0)
+  else if (name[0] == '*')
     {
       for (i = 0; i < scope->argv.argc; i++)
 	if (type == GRUB_SCRIPT_ARG_TYPE_VAR)
@@ -315,7 +332,7 @@ grub_script_env_get (const char *name, grub_script_arg_type_t type)
 	      goto fail;
 	  }
     }
-  else if (grub_strcmp (name, "@") == 0)
+  else if (name[0] == '@')
     {
       for (i = 0; i < scope->argv.argc; i++)
 	{
@@ -335,7 +352,12 @@ grub_script_env_get (const char *name, grub_script_arg_type_t type)
     }
   else
     {
-      unsigned long num = grub_strtoul (name, 0, 10);
+      unsigned long num;
+
+      if (! name[1])
+	num = name[0] - '0';
+      else
+	num = grub_strtoul (name, 0, 10);
       if (num == 0)
 	; /* XXX no file name, for now.  */
 
@@ -629,6 +651,14 @@ grub_script_arglist_to_argv (struct grub_script_arglist *arglist,
       if (grub_script_argv_next (&result))
 	goto fail;
 
+      if (arglist->literal)
+	{
+	  if (grub_script_argv_append (&result, arglist->literal,
+				       grub_strlen (arglist->literal)))
+	    goto fail;
+	  continue;
+	}
+
       arg = arglist->arg;
       while (arg)
 	{
@@ -764,9 +794,24 @@ cleanup:
 
   result.argc = 0;
   result.args = 0;
-  for (i = 0; unexpanded.args[i]; i++)
+  for (i = 0; i < (int) unexpanded.argc; i++)
     {
       char **expansions = 0;
+
+      /* Without these characters there is nothing to expand or
+	 unescape, so the argument can be taken over as it is.  */
+      if (! has_wildcard_chars (unexpanded.args[i]))
+	{
+	  if (grub_script_argv_next (&result))
+	    {
+	      grub_script_argv_free (&unexpanded);
+	      goto fail;
+	    }
+	  result.args[result.argc - 1] = unexpanded.args[i];
+	  unexpanded.args[i] = 0;
+	  continue;
+	}
+
       if (grub_wildcard_translator
 	  && grub_wildcard_translator->expand (unexpanded.args[i],
 					       &expansions))
@@ -875,16 +920,197 @@ grub_script_execute_sourcecode_getline (char **line,
   return 0;
 }
 
+/* Sources parsed before, so that menu entries, submenus and eval strings
+   that run again are not lexed and parsed again.  Since parsing a
+   function definition registers the function, a source is only cached
+   once it has parsed completely without defining any.  */
+#define SCRIPT_CACHE_ENTRIES	32
+
+struct script_cache_entry
+{
+  char *source;
+  grub_size_t len;
+  grub_uint32_t hash;
+  /* The top-level commands, executed in order.  */
+  struct grub_script **scripts;
+  unsigned nscripts;
+  /* Executions of this entry in progress; such entries are not evicted.  */
+  unsigned busy;
+  grub_uint64_t last_use;
+};
+
+static struct script_cache_entry script_cache[SCRIPT_CACHE_ENTRIES];
+static grub_uint64_t script_cache_clock;
+
+/* FNV-1a.  */
+static grub_uint32_t
+script_cache_hash (const char *source, grub_size_t len)
+{
+  grub_uint32_t hash = 0x811c9dc5;
+
+  while (len--)
+    hash = (hash ^ (grub_uint8_t) *source++) * 0x01000193;
+  return hash;
+}
+
+static void
+script_cache_free_scripts (struct grub_script **scripts, unsigned nscripts)
+{
+  unsigned i;
+
+  for (i = 0; i < nscripts; i++)
+    grub_script_free (scripts[i]);
+  grub_free (scripts);
+}
+
+static void
+script_cache_evict (struct script_cache_entry *e)
+{
+  script_cache_free_scripts (e->scripts, e->nscripts);
+  grub_free (e->source);
+  e->source = NULL;
+}
+
+void
+grub_script_cache_flush (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (script_cache); i++)
+    if (script_cache[i].source && ! script_cache[i].busy)
+      script_cache_evict (&script_cache[i]);
+}
+
+/* Evict the least recently used sources until BYTES are freed.  Only the
+   sources are counted; their parsed scripts are freed along with them.  */
+static grub_size_t
+script_cache_shrink (grub_size_t bytes)
+{
+  grub_size_t freed = 0;
+  unsigned i;
+
+  while (freed < bytes)
+    {
+      struct script_cache_entry *victim = NULL;
+
+      for (i = 0; i < ARRAY_SIZE (script_cache); i++)
+	if (script_cache[i].source && ! script_cache[i].busy
+	    && (! victim || script_cache[i].last_use < victim->last_use))
+	  victim = &script_cache[i];
+      if (! victim)
+	break;
+      freed += victim->len;
+      script_cache_evict (victim);
+    }
+
+  return freed;
+}
+
+struct grub_mm_shrinker grub_script_cache_shrinker =
+  {
+    .shrink = script_cache_shrink
+  };
+
+static struct script_cache_entry *
+script_cache_find (const char *source, grub_size_t len, grub_uint32_t hash)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (script_cache); i++)
+    {
+      struct script_cache_entry *e = &script_cache[i];
+
+      if (e->source && e->hash == hash && e->len == len
+	  && grub_memcmp (e->source, source, len) == 0)
+	{
+	  e->last_use = ++script_cache_clock;
+	  return e;
+	}
+    }
+
+  return NULL;
+}
+
+/* Hand SCRIPTS over to the cache.  Returns 0 if they stay with the
+   caller.  */
+static int
+script_cache_insert (const char *source, grub_size_t len, grub_uint32_t hash,
+		     struct grub_script **scripts, unsigned nscripts)
+{
+  struct script_cache_entry *e = NULL;
+  unsigned i;
+
+  /* A nested execution of the same source may have got there first.  */
+  if (script_cache_find (source, len, hash))
+    return 0;
+
+  for (i = 0; i < ARRAY_SIZE (script_cache); i++)
+    {
+      if (! script_cache[i].source)
+	{
+	  e = &script_cache[i];
+	  break;
+	}
+      if (! script_cache[i].busy
+	  && (! e || script_cache[i].last_use < e->last_use))
+	e = &script_cache[i];
+    }
+  if (! e)
+    return 0;
+  if (e->source)
+    script_cache_evict (e);
+
+  e->source = grub_malloc (len);
+  if (! e->source)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  grub_memcpy (e->source, source, len);
+  e->len = len;
+  e->hash = hash;
+  e->scripts = scripts;
+  e->nscripts = nscripts;
+  e->busy = 0;
+  e->last_use = ++script_cache_clock;
+  return 1;
+}
+
 /* Execute a source script.  */
 grub_err_t
 grub_script_execute_sourcecode (const char *source)
 {
   grub_err_t ret = 0;
   struct grub_script *parsed_script;
+  struct script_cache_entry *cached;
+  struct grub_script **scripts = NULL;
+  unsigned nscripts = 0, scripts_alloc = 0;
+  const char *start = source;
+  grub_size_t len;
+  grub_uint32_t hash;
+  int cacheable = 1;
+
+  if (! source)
+    return 0;
+
+  len = grub_strlen (source);
+  hash = script_cache_hash (source, len);
+  cached = script_cache_find (source, len, hash);
+  if (cached)
+    {
+      unsigned i;
+
+      cached->busy++;
+      for (i = 0; i < cached->nscripts; i++)
+	ret = grub_script_execute (cached->scripts[i]);
+      cached->busy--;
+      return ret;
+    }
 
   while (source)
     {
       char *line;
+      unsigned generation = grub_script_function_generation;
 
       grub_script_execute_sourcecode_getline (&line, 0, &source);
       parsed_script = grub_script_parse
@@ -893,14 +1119,40 @@ grub_script_execute_sourcecode (const char *source)
 	{
 	  ret = grub_errno;
 	  grub_free (line);
+	  cacheable = 0;
 	  break;
 	}
+      if (generation != grub_script_function_generation)
+	cacheable = 0;
 
       ret = grub_script_execute (parsed_script);
-      grub_script_free (parsed_script);
       grub_free (line);
+
+      if (cacheable && nscripts == scripts_alloc)
+	{
+	  struct grub_script **n;
+
+	  scripts_alloc = scripts_alloc ? 2 * scripts_alloc : 8;
+	  n = grub_realloc (scripts, scripts_alloc * sizeof (scripts[0]));
+	  if (! n)
+	    {
+	      /* Only the cache is lost; keep the error of the command.  */
+	      grub_errno = ret;
+	      cacheable = 0;
+	    }
+	  else
+	    scripts = n;
+	}
+      if (cacheable)
+	scripts[nscripts++] = parsed_script;
+      else
+	grub_script_free (parsed_script);
     }
 
+  if (! cacheable || nscripts == 0
+      || ! script_cache_insert (start, len, hash, scripts, nscripts))
+    script_cache_free_scripts (scripts, nscripts);
+
   return ret;
 }
 
@@ -925,6 +1177,161 @@ grub_script_execute_new_scope (const char *source, int argc, char **args)
   return ret;
 }
 
+/* Measure the pending command lines.  They are joined with newlines and
+   the event data is exactly what was hashed, so the log can be replayed
+   by hashing each event.  */
+grub_err_t
+grub_script_measure_flush (void)
+{
+  grub_err_t err;
+
+  if (! measure_len)
+    return GRUB_ERR_NONE;
+  measure_batch[measure_len - 1] = '\0';
+  err = grub_tpm_measure ((unsigned char *) measure_batch, measure_len,
+			  GRUB_COMMAND_PCR, measure_batch);
+  measure_len = 0;
+  return err;
+}
+
+void
+grub_script_measure_batch_begin (void)
+{
+  grub_script_measure_flush ();
+  measure_depth++;
+}
+
+void
+grub_script_measure_batch_end (void)
+{
+  grub_script_measure_flush ();
+  if (measure_depth && --measure_depth == 0)
+    {
+      grub_free (measure_batch);
+      measure_batch = 0;
+      measure_alloc = 0;
+    }
+}
+
+static grub_err_t
+grub_script_measure_preboot (int noret __attribute__ ((unused)))
+{
+  /* Whatever ran must be in the PCR before the OS gets control.  */
+  return grub_script_measure_flush ();
+}
+
+static grub_err_t
+grub_script_measure_preboot_rest (void)
+{
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_preboot *measure_preboot;
+
+void
+grub_script_measure_init (void)
+{
+  measure_preboot
+    = grub_loader_register_preboot_hook (grub_script_measure_preboot,
+					 grub_script_measure_preboot_rest,
+					 GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
+}
+
+void
+grub_script_measure_fini (void)
+{
+  grub_script_measure_flush ();
+  if (measure_preboot)
+    grub_loader_unregister_preboot_hook (measure_preboot);
+  measure_preboot = 0;
+}
+
+/* Queue CMDSTRING, of LEN bytes with its NUL.  Return non-zero if it
+   has to be measured on its own.  */
+static int
+grub_script_measure_queue (const char *cmdstring, grub_size_t len)
+{
+  const char *val;
+
+  if (! measure_depth)
+    return 1;
+  val = grub_env_get ("tpm_batch_commands");
+  if (! val || grub_strcmp (val, "1") != 0)
+    {
+      grub_script_measure_flush ();
+      return 1;
+    }
+
+  if (measure_len + len > measure_alloc)
+    {
+      grub_size_t n = 2 * (measure_len + len);
+      char *p = grub_realloc (measure_batch, n);
+      if (! p)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_script_measure_flush ();
+	  return 1;
+	}
+      measure_batch = p;
+      measure_alloc = n;
+    }
+  grub_memcpy (measure_batch + measure_len, cmdstring, len - 1);
+  measure_len += len;
+  measure_batch[measure_len - 1] = '\n';
+  return 0;
+}
+
+/* Measure the command line ARGV is about to run.  */
+static grub_err_t
+grub_script_measure_argv (struct grub_script_argv *argv)
+{
+  char *cmdstring;
+  int offset = 0, cmdlen = 0;
+  unsigned int i;
+
+  for (i = 0; i < argv->argc; i++) {
+	  cmdlen += grub_strlen (argv->args[i]) + 1;
+  }
+
+  cmdstring = grub_malloc (cmdlen);
+  if (!cmdstring)
+  {
+	  return grub_error (GRUB_ERR_OUT_OF_MEMORY,
+			     N_("cannot allocate command buffer"));
+  }
+
+  for (i = 0; i < argv->argc; i++) {
+	  offset += grub_snprintf(cmdstring + offset, cmdlen - offset, "%s ",
+				  argv->args[i]);
+  }
+  cmdstring[cmdlen-1]= '\0';
+  if (grub_script_measure_queue (cmdstring, cmdlen))
+    grub_tpm_measure((unsigned char *)cmdstring, cmdlen, GRUB_COMMAND_PCR,
+		     cmdstring);
+  return GRUB_ERR_NONE;
+}
+
+/* Look up the command CMDNAME of CMDLINE, reusing the last result if
+   the name is literal text and no command came or went since.  */
+static grub_command_t
+grub_script_cmdline_find (struct grub_script_cmdline *cmdline,
+			  const char *cmdname, int invert)
+{
+  struct grub_script_arglist *word = cmdline->arglist;
+
+  if (invert)
+    word = word->literal ? word->next : 0;
+  if (! word || ! word->literal)
+    return grub_command_find (cmdname);
+
+  if (cmdline->generation != grub_command_generation)
+    {
+      cmdline->grubcmd = grub_command_find (cmdname);
+      cmdline->generation = grub_command_generation;
+    }
+  return cmdline->grubcmd;
+}
+
 /* Execute a single command line.  */
 grub_err_t
 grub_script_execute_cmdline (struct grub_script_cmd *cmd)
@@ -934,9 +1341,8 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   grub_err_t ret = 0;
   grub_script_function_t func = 0;
   char errnobuf[18];
-  char *cmdname, *cmdstring;
-  int argc, offset = 0, cmdlen = 0;
-  unsigned int i;
+  char *cmdname;
+  int argc;
   char **args;
   int invert;
   struct grub_script_argv argv = { 0, 0, 0 };
@@ -945,24 +1351,8 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   if (grub_script_arglist_to_argv (cmdline->arglist, &argv) || ! argv.args[0])
     return grub_errno;
 
-  for (i = 0; i < argv.argc; i++) {
-	  cmdlen += grub_strlen (argv.args[i]) + 1;
-  }
-
-  cmdstring = grub_malloc (cmdlen);
-  if (!cmdstring)
-  {
-	  return grub_error (GRUB_ERR_OUT_OF_MEMORY,
-			     N_("cannot allocate command buffer"));
-  }
-
-  for (i = 0; i < argv.argc; i++) {
-	  offset += grub_snprintf(cmdstring + offset, cmdlen - offset, "%s ",
-				  argv.args[i]);
-  }
-  cmdstring[cmdlen-1]= '\0';
-  grub_tpm_measure((unsigned char *)cmdstring, cmdlen, GRUB_COMMAND_PCR,
-		   cmdstring);
+  if (grub_script_measure_argv (&argv))
+    return grub_errno;
 
   invert = 0;
   argc = argv.argc - 1;
@@ -982,7 +1372,7 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
       args = argv.args + 2;
       cmdname = argv.args[1];
     }
-  grubcmd = grub_command_find (cmdname);
+  grubcmd = grub_script_cmdline_find (cmdline, cmdname, invert);
   if (! grubcmd)
     {
       grub_errno = GRUB_ERR_NONE;
@@ -1025,11 +1415,16 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
 	ret = grub_error (GRUB_ERR_EXTRACTOR,
 			  "%s isn't allowed to execute in an extractor",
 			  cmdname);
-      else if ((grubcmd->flags & GRUB_COMMAND_FLAG_BLOCKS) &&
-	       (grubcmd->flags & GRUB_COMMAND_FLAG_EXTCMD))
-	ret = grub_extcmd_dispatcher (grubcmd, argc, args, argv.script);
       else
-	ret = (grubcmd->func) (grubcmd, argc, args);
+	{
+	  grub_trace_enter (GRUB_TRACE_COMMAND, grubcmd->name, 0);
+	  if ((grubcmd->flags & GRUB_COMMAND_FLAG_BLOCKS) &&
+	      (grubcmd->flags & GRUB_COMMAND_FLAG_EXTCMD))
+	    ret = grub_extcmd_dispatcher (grubcmd, argc, args, argv.script);
+	  else
+	    ret = (grubcmd->func) (grubcmd, argc, args);
+	  grub_trace_exit (GRUB_TRACE_COMMAND, 0, ret);
+	}
     }
   else
     ret = grub_script_function_call (func, argc, args);
@@ -1061,6 +1456,55 @@ grub_script_execute_cmdline (struct grub_script_cmd *cmd)
   return ret;
 }
 
+/* Run the block command ARGV[0] as grub_script_execute_cmdline would,
+   the last argument being the text of its block enclosed in braces, but
+   without parsing the block.  The command gets an empty script for it,
+   which suits commands that only keep the text, like menuentry.  */
+grub_err_t
+grub_script_execute_unparsed_block (struct grub_script_argv *argv)
+{
+  grub_command_t grubcmd;
+  struct grub_script *script;
+  char errnobuf[18];
+  grub_err_t ret;
+
+  grubcmd = grub_command_find (argv->args[0]);
+  if (! grubcmd || ! (grubcmd->flags & GRUB_COMMAND_FLAG_BLOCKS)
+      || ! (grubcmd->flags & GRUB_COMMAND_FLAG_EXTCMD))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT,
+		       "`%s' doesn't take a block", argv->args[0]);
+
+  if (grub_script_measure_argv (argv))
+    return grub_errno;
+
+  if (grub_extractor_level && !(grubcmd->flags & GRUB_COMMAND_FLAG_EXTRACTOR))
+    ret = grub_error (GRUB_ERR_EXTRACTOR,
+		      "%s isn't allowed to execute in an extractor",
+		      argv->args[0]);
+  else
+    {
+      script = grub_script_create (0, 0);
+      if (! script)
+	return grub_errno;
+
+      grub_trace_enter (GRUB_TRACE_COMMAND, grubcmd->name, 0);
+      ret = grub_extcmd_dispatcher (grubcmd, argv->argc - 1, argv->args + 1,
+				    script);
+      grub_trace_exit (GRUB_TRACE_COMMAND, 0, ret);
+      grub_script_free (script);
+    }
+
+  if (grub_errno == GRUB_ERR_TEST_FAILURE)
+    grub_errno = GRUB_ERR_NONE;
+
+  grub_print_error ();
+
+  grub_snprintf (errnobuf, sizeof (errnobuf), "%d", ret);
+  grub_env_set ("?", errnobuf);
+
+  return ret;
+}
+
 /* Execute a block of one or more commands.  */
 grub_err_t
 grub_script_execute_cmdlist (struct grub_script_cmd *list)
@@ -41,7 +41,8 @@ grub_script_lexer_deref (struct grub_lexer_param *state)
   state->refs--;
 }
 
-/* Start recording all characters passing through the lexer.  */
+/* Start recording all characters passing through the lexer.  The buffer
+   is kept from one recording to the next, until the lexer goes away.  */
 unsigned
 grub_script_lexer_record_start (struct grub_parser_param *parser)
 {
@@ -79,36 +80,30 @@ grub_script_lexer_record_stop (struct grub_parser_param *parser, unsigned offset
   count = lexer->recordpos - offset;
   result = grub_script_malloc (parser, count + 1);
   if (result) {
-    grub_strncpy (result, lexer->recording + offset, count);
+    grub_memcpy (result, lexer->recording + offset, count);
     result[count] = '\0';
   }
 
   if (lexer->record == 0)
-    {
-      grub_free (lexer->recording);
-      lexer->recording = 0;
-      lexer->recordlen = 0;
-      lexer->recordpos = 0;
-    }
+    lexer->recordpos = 0;
   return result;
 }
 
-/* Record STR if input recording is enabled.  */
+/* Record the LEN characters of STR if input recording is enabled.  */
 void
-grub_script_lexer_record (struct grub_parser_param *parser, char *str)
+grub_script_lexer_record (struct grub_parser_param *parser, const char *str,
+			  grub_size_t len)
 {
-  int len;
   char *old;
   struct grub_lexer_param *lexer = parser->lexerstate;
 
   if (!lexer->record || !lexer->recording)
     return;
 
-  len = grub_strlen (str);
-  if (lexer->recordpos + len + 1 > lexer->recordlen)
+  if (lexer->recordpos + len + 1 > (grub_size_t) lexer->recordlen)
     {
       old = lexer->recording;
-      if (lexer->recordlen < len)
+      if ((grub_size_t) lexer->recordlen < len)
 	lexer->recordlen = len;
       lexer->recordlen *= 2;
       lexer->recording = grub_realloc (lexer->recording, lexer->recordlen);
@@ -121,18 +116,20 @@ grub_script_lexer_record (struct grub_parser_param *parser, char *str)
 	  return;
 	}
     }
-  grub_strcpy (lexer->recording + lexer->recordpos, str);
+  grub_memcpy (lexer->recording + lexer->recordpos, str, len);
   lexer->recordpos += len;
 }
 
-/* Read next line of input if necessary, and set yyscanner buffers.  */
+/* Read next line of input if necessary, and set yyscanner buffers.  The
+   line is scanned in place in LEXERSTATE->input, which is reused from one
+   line to the next rather than duplicated for flex each time.  */
 int
 grub_script_lexer_yywrap (struct grub_parser_param *parserstate,
 			  const char *input)
 {
-  grub_size_t len = 0;
-  char *p = 0;
+  grub_size_t len, plen, need;
   char *line = 0;
+  char *p;
   YY_BUFFER_STATE buffer;
   struct grub_lexer_param *lexerstate = parserstate->lexerstate;
 
@@ -145,73 +142,70 @@ grub_script_lexer_yywrap (struct grub_parser_param *parserstate,
       return 1;
     }
 
-  line = 0;
   if (! input)
-    lexerstate->getline (&line, 1, lexerstate->getline_data);
-  else
-    line = grub_strdup (input);
-
-  if (! line)
     {
-      grub_script_yyerror (parserstate, N_("out of memory"));
-      return 1;
+      lexerstate->getline (&line, 1, lexerstate->getline_data);
+      if (! line)
+	{
+	  grub_script_yyerror (parserstate, N_("out of memory"));
+	  return 1;
+	}
+      input = line;
     }
 
-  len = grub_strlen (line);
+  len = grub_strlen (input);
+  plen = lexerstate->prefix ? grub_strlen (lexerstate->prefix) : 0;
 
-  /* Ensure '\n' at the end.  */
-  if (line[0] == '\0')
-    {
-      grub_free (line);
-      line = grub_strdup ("\n");
-      len = 1;
-    }
-  else if (len && line[len - 1] != '\n')
+  /* Room for a '\n' and the two NULs flex wants at the end.  */
+  need = plen + len + 3;
+  p = lexerstate->input;
+  if (need > lexerstate->inputlen)
     {
-      p = grub_realloc (line, len + 2);
-      if (p)
+      p = grub_malloc (need * 2);
+      if (! p)
 	{
-	  p[len++] = '\n';
-	  p[len] = '\0';
+	  grub_free (line);
+	  grub_script_yyerror (parserstate, 0);
+	  return 1;
 	}
-      line = p;
     }
 
-  if (! line)
+  /* The buffer of the previous line is done with; yy_scan_buffer would
+     otherwise leave it behind.  */
+  if (lexerstate->buffer)
+    yy_delete_buffer (lexerstate->buffer, lexerstate->yyscanner);
+  lexerstate->buffer = 0;
+  if (p != lexerstate->input)
     {
-      grub_script_yyerror (parserstate, N_("out of memory"));
-      return 1;
+      grub_free (lexerstate->input);
+      lexerstate->input = p;
+      lexerstate->inputlen = need * 2;
     }
 
   /* Prepend any left over unput-text.  */
   if (lexerstate->prefix)
     {
-      int plen = grub_strlen (lexerstate->prefix);
-
-      p = grub_malloc (len + plen + 1);
-      if (! p)
-	{
-	  grub_free (line);
-	  return 1;
-	}
-      grub_strcpy (p, lexerstate->prefix);
+      grub_memcpy (p, lexerstate->prefix, plen);
+      grub_free (lexerstate->prefix);
       lexerstate->prefix = 0;
-
-      grub_strcpy (p + plen, line);
-      grub_free (line);
-
-      line = p;
-      len = len + plen;
     }
-
-  buffer = yy_scan_string (line, lexerstate->yyscanner);
+  grub_memcpy (p + plen, input, len);
+  len += plen;
   grub_free (line);
 
+  /* Ensure '\n' at the end.  */
+  if (len == 0 || p[len - 1] != '\n')
+    p[len++] = '\n';
+  p[len++] = '\0';
+  p[len++] = '\0';
+
+  buffer = yy_scan_buffer (p, len, lexerstate->yyscanner);
   if (! buffer)
     {
       grub_script_yyerror (parserstate, 0);
       return 1;
     }
+  lexerstate->buffer = buffer;
   return 0;
 }
 
@@ -252,6 +246,7 @@ grub_script_lexer_init (struct grub_parser_param *parser, char *script,
       parser->lexerstate = 0;
       yylex_destroy (lexerstate->yyscanner);
       grub_free (lexerstate->yyscanner);
+      grub_free (lexerstate->input);
       grub_free (lexerstate->text);
       grub_free (lexerstate);
       return 0;
@@ -268,6 +263,8 @@ grub_script_lexer_fini (struct grub_lexer_param *lexerstate)
 
   yylex_destroy (lexerstate->yyscanner);
 
+  grub_free (lexerstate->input);
+  grub_free (lexerstate->prefix);
   grub_free (lexerstate->recording);
   grub_free (lexerstate->text);
   grub_free (lexerstate);
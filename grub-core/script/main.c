@@ -17,6 +17,7 @@
  */
 
 #include <grub/dl.h>
+#include <grub/mm.h>
 #include <grub/i18n.h>
 #include <grub/parser.h>
 #include <grub/script_sh.h>
@@ -71,6 +72,8 @@ grub_script_init (void)
 					 has exactly the same semanics as bash
 					 equivalent.  */
 				      N_("Return from a function."));
+
+  grub_mm_shrinker_register (&grub_script_cache_shrinker);
 }
 
 void
@@ -95,4 +98,7 @@ grub_script_fini (void)
   if (cmd_return)
     grub_unregister_command (cmd_return);
   cmd_return = 0;
+
+  grub_mm_shrinker_unregister (&grub_script_cache_shrinker);
+  grub_script_cache_flush ();
 }
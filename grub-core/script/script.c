@@ -150,6 +150,39 @@ grub_script_arg_add (struct grub_parser_param *state,
   return arg;
 }
 
+/* Return the text ARG always expands to, or NULL if it has variables,
+   blocks or translated strings, or characters that the wildcard code
+   would treat specially.  */
+static char *
+grub_script_arg_literal (struct grub_parser_param *state,
+			 struct grub_script_arg *arg)
+{
+  struct grub_script_arg *part;
+  grub_size_t len = 0;
+  char *literal, *p;
+
+  for (part = arg; part; part = part->next)
+    {
+      if (part->type != GRUB_SCRIPT_ARG_TYPE_TEXT
+	  && part->type != GRUB_SCRIPT_ARG_TYPE_DQSTR
+	  && part->type != GRUB_SCRIPT_ARG_TYPE_SQSTR)
+	return 0;
+      for (p = part->str; *p; p++, len++)
+	if (*p == '*' || *p == '?' || *p == '\\')
+	  return 0;
+    }
+  if (! len)
+    return 0;
+
+  literal = grub_script_malloc (state, len + 1);
+  if (! literal)
+    return 0;
+
+  for (p = literal, part = arg; part; part = part->next)
+    p = grub_stpcpy (p, part->str);
+  return literal;
+}
+
 /* Add the argument ARG to the end of the argument list LIST.  If LIST
    is zero, a new list will be created.  */
 struct grub_script_arglist *
@@ -169,6 +202,7 @@ grub_script_add_arglist (struct grub_parser_param *state,
 
   link->next = 0;
   link->arg = arg;
+  link->literal = grub_script_arg_literal (state, arg);
   link->argcount = 0;
 
   if (!list)
@@ -204,6 +238,8 @@ grub_script_create_cmdline (struct grub_parser_param *state,
   cmd->cmd.exec = grub_script_execute_cmdline;
   cmd->cmd.next = 0;
   cmd->arglist = arglist;
+  cmd->grubcmd = 0;
+  cmd->generation = grub_command_generation - 1;
 
   return (struct grub_script_cmd *) cmd;
 }
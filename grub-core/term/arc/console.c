@@ -48,6 +48,15 @@ put (struct grub_term_output *term __attribute__ ((unused)), const int c)
   GRUB_ARC_FIRMWARE_VECTOR->write (GRUB_ARC_STDOUT, &chr, 1, &count);
 }
 
+static void
+write_buf (struct grub_term_output *term __attribute__ ((unused)),
+	   const char *buf, grub_size_t len)
+{
+  unsigned long count;
+
+  GRUB_ARC_FIRMWARE_VECTOR->write (GRUB_ARC_STDOUT, buf, len, &count);
+}
+
 static struct grub_terminfo_output_state grub_console_terminfo_output;
 
 int
@@ -164,6 +173,7 @@ static struct grub_terminfo_input_state grub_console_terminfo_input =
 static struct grub_terminfo_output_state grub_console_terminfo_output =
   {
     .put = put,
+    .write = write_buf,
     .size = { 80, 20 }
   };
 
@@ -186,6 +196,7 @@ static struct grub_term_output grub_console_term_output =
     .cls = grub_terminfo_cls,
     .setcolorstate = grub_terminfo_setcolorstate,
     .setcursor = grub_terminfo_setcursor,
+    .refresh = grub_terminfo_refresh,
     .flags = GRUB_TERM_CODE_TYPE_ASCII,
     .data = &grub_console_terminfo_output,
     .progress_update_divisor = GRUB_PROGRESS_FAST
@@ -29,6 +29,7 @@
 #include <grub/command.h>
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -117,6 +118,15 @@ static struct grub_virtual_screen virtual_screen;
 static int repaint_scheduled = 0;
 static int repaint_was_scheduled = 0;
 
+/* Scrolling repaints the whole window, which on a big framebuffer costs
+   far more than drawing the text.  While text streams in, refreshes that
+   would scroll are held back until this many milliseconds have passed
+   since the last one, so a burst of lines is scrolled in one go.  */
+#define REFRESH_INTERVAL_MS	20
+
+static grub_uint64_t last_refresh_ms;
+static int refresh_deferred;
+
 static void destroy_window (void);
 
 static struct grub_video_render_target *text_layer;
@@ -137,6 +147,7 @@ static unsigned int calculate_normal_character_width (grub_font_t font);
 static unsigned char calculate_character_width (struct grub_font_glyph *glyph);
 
 static void grub_gfxterm_refresh (struct grub_term_output *term __attribute__ ((unused)));
+static void grub_gfxterm_refresh_real (void);
 
 static grub_size_t
 grub_gfxterm_getcharwidth (struct grub_term_output *term __attribute__ ((unused)),
@@ -406,6 +417,7 @@ static grub_err_t
 grub_gfxterm_term_fini (struct grub_term_output *term __attribute__ ((unused)))
 {
   unsigned i;
+  refresh_deferred = 0;
   destroy_window ();
   grub_video_restore ();
 
@@ -1035,7 +1047,7 @@ grub_gfxterm_cls (struct grub_term_output *term)
   /* Mark virtual screen to be redrawn.  */
   dirty_region_add_virtualscreen ();
 
-  grub_gfxterm_refresh (term);
+  grub_gfxterm_refresh_real ();
 }
 
 static void
@@ -1080,8 +1092,11 @@ grub_gfxterm_setcursor (struct grub_term_output *term __attribute__ ((unused)),
 }
 
 static void
-grub_gfxterm_refresh (struct grub_term_output *term __attribute__ ((unused)))
+grub_gfxterm_refresh_real (void)
 {
+  refresh_deferred = 0;
+  last_refresh_ms = grub_get_time_ms ();
+
   real_scroll ();
 
   /* Redraw only changed regions.  */
@@ -1094,6 +1109,26 @@ grub_gfxterm_refresh (struct grub_term_output *term __attribute__ ((unused)))
   dirty_region_reset ();
 }
 
+static void
+grub_gfxterm_refresh (struct grub_term_output *term __attribute__ ((unused)))
+{
+  if (virtual_screen.total_scroll
+      && grub_get_time_ms () - last_refresh_ms < REFRESH_INTERVAL_MS)
+    {
+      refresh_deferred = 1;
+      return;
+    }
+
+  grub_gfxterm_refresh_real ();
+}
+
+static void
+grub_gfxterm_flush_deferred (void)
+{
+  if (refresh_deferred && virtual_screen.functional)
+    grub_gfxterm_refresh_real ();
+}
+
 static struct grub_term_output grub_video_term =
   {
     .name = "gfxterm",
@@ -1137,9 +1172,11 @@ grub_gfxterm_get_dimensions (unsigned *width, unsigned *height)
 GRUB_MOD_INIT(gfxterm)
 {
   grub_term_register_output ("gfxterm", &grub_video_term);
+  grub_term_flush_deferred = grub_gfxterm_flush_deferred;
 }
 
 GRUB_MOD_FINI(gfxterm)
 {
+  grub_term_flush_deferred = NULL;
   grub_term_unregister_output (&grub_video_term);
 }
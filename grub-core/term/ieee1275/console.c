@@ -154,6 +154,13 @@ grub_console_setcursor (struct grub_term_output *term,
     grub_ieee1275_interpret ("cursor-off", 0);
 }
 
+static void
+write_buf (struct grub_term_output *term __attribute__ ((unused)),
+	   const char *buf, grub_size_t len)
+{
+  grub_ieee1275_write (stdout_ihandle, buf, len, 0);
+}
+
 static grub_err_t
 grub_console_init_input (struct grub_term_input *term)
 {
@@ -212,6 +219,7 @@ struct grub_terminfo_input_state grub_console_terminfo_input =
 struct grub_terminfo_output_state grub_console_terminfo_output =
   {
     .put = put,
+    .write = write_buf,
     .size = { 80, 24 }
   };
 
@@ -234,6 +242,7 @@ static struct grub_term_output grub_console_term_output =
     .cls = grub_terminfo_cls,
     .setcolorstate = grub_terminfo_setcolorstate,
     .setcursor = grub_console_setcursor,
+    .refresh = grub_terminfo_refresh,
     .flags = GRUB_TERM_CODE_TYPE_ASCII,
     .data = &grub_console_terminfo_output,
     .progress_update_divisor = GRUB_PROGRESS_FAST
@@ -264,4 +273,5 @@ grub_console_init_lately (void)
 void
 grub_console_fini (void)
 {
+  grub_terminfo_refresh (&grub_console_term_output);
 }
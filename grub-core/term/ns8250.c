@@ -126,6 +126,15 @@ do_real_config (struct grub_serial_port *port)
       grub_outb (UART_ENABLE_DTRRTS | UART_ENABLE_OUT2, port->port + UART_MCR);
     }
 
+  /* A 16550 reports its FIFO as enabled in IIR; older parts take only one
+     byte per THR-empty.  */
+  if ((grub_inb (port->port + UART_IIR) & UART_FIFO_ENABLED)
+      == UART_FIFO_ENABLED)
+    port->tx_fifo_size = UART_FIFO_SIZE;
+  else
+    port->tx_fifo_size = 1;
+  port->tx_room = 0;
+
   /* Drain the input buffer.  */
   endtime = grub_get_time_ms () + 1000;
   while (grub_inb (port->port + UART_LSR) & UART_DATA_READY)
@@ -141,24 +150,16 @@ do_real_config (struct grub_serial_port *port)
   port->configured = 1;
 }
 
-/* Fetch a key.  */
+/* Wait until the transmitter holding register is empty and note how
+   many bytes the transmitter takes from then on.  Return 0 if it never
+   empties.  */
 static int
-serial_hw_fetch (struct grub_serial_port *port)
-{
-  do_real_config (port);
-  if (grub_inb (port->port + UART_LSR) & UART_DATA_READY)
-    return grub_inb (port->port + UART_RX);
-
-  return -1;
-}
-
-/* Put a character.  */
-static void
-serial_hw_put (struct grub_serial_port *port, const int c)
+serial_hw_wait_tx (struct grub_serial_port *port)
 {
   grub_uint64_t endtime;
 
-  do_real_config (port);
+  if (port->tx_room)
+    return 1;
 
   if (port->broken > 5)
     endtime = grub_get_time_ms ();
@@ -166,21 +167,109 @@ serial_hw_put (struct grub_serial_port *port, const int c)
     endtime = grub_get_time_ms () + 50;
   else
     endtime = grub_get_time_ms () + 200;
-  /* Wait until the transmitter holding register is empty.  */
   while ((grub_inb (port->port + UART_LSR) & UART_EMPTY_TRANSMITTER) == 0)
     {
       if (grub_get_time_ms () > endtime)
 	{
 	  port->broken++;
 	  /* There is something wrong. But what can I do?  */
-	  return;
+	  return 0;
 	}
     }
 
   if (port->broken)
     port->broken--;
 
-  grub_outb (c, port->port + UART_TX);
+  port->tx_room = port->tx_fifo_size;
+  return 1;
+}
+
+/* Move queued output into the transmitter.  Without WAIT stop as soon as
+   the transmitter is full.  */
+static void
+serial_hw_drain (struct grub_serial_port *port, int wait)
+{
+  while (port->tx_len)
+    {
+      if (!port->tx_room)
+	{
+	  if (wait)
+	    {
+	      if (!serial_hw_wait_tx (port))
+		{
+		  /* Drop the byte, as an unbuffered put would.  */
+		  port->tx_head = (port->tx_head + 1) % GRUB_SERIAL_TXBUF_SIZE;
+		  port->tx_len--;
+		  continue;
+		}
+	    }
+	  else if (grub_inb (port->port + UART_LSR) & UART_EMPTY_TRANSMITTER)
+	    port->tx_room = port->tx_fifo_size;
+	  else
+	    return;
+	}
+
+      grub_outb (port->tx_buf[port->tx_head], port->port + UART_TX);
+      port->tx_head = (port->tx_head + 1) % GRUB_SERIAL_TXBUF_SIZE;
+      port->tx_len--;
+      port->tx_room--;
+    }
+}
+
+/* Fetch a key.  */
+static int
+serial_hw_fetch (struct grub_serial_port *port)
+{
+  do_real_config (port);
+
+  /* Input is polled while GRUB waits, which is when the ring drains.  */
+  if (port->tx_len)
+    serial_hw_drain (port, 0);
+
+  if (grub_inb (port->port + UART_LSR) & UART_DATA_READY)
+    return grub_inb (port->port + UART_RX);
+
+  return -1;
+}
+
+/* Put a character.  */
+static void
+serial_hw_put (struct grub_serial_port *port, const int c)
+{
+  do_real_config (port);
+
+  if (!port->config.txbuf)
+    {
+      if (!serial_hw_wait_tx (port))
+	return;
+      grub_outb (c, port->port + UART_TX);
+      port->tx_room--;
+      return;
+    }
+
+  serial_hw_drain (port, 0);
+  if (port->tx_len == GRUB_SERIAL_TXBUF_SIZE)
+    {
+      /* Ring full: wait for the transmitter once and refill it.  */
+      if (serial_hw_wait_tx (port))
+	serial_hw_drain (port, 0);
+      else
+	{
+	  port->tx_head = (port->tx_head + 1) % GRUB_SERIAL_TXBUF_SIZE;
+	  port->tx_len--;
+	}
+    }
+
+  port->tx_buf[(port->tx_head + port->tx_len) % GRUB_SERIAL_TXBUF_SIZE] = c;
+  port->tx_len++;
+}
+
+/* Write out everything still in the ring.  */
+static void
+serial_hw_flush (struct grub_serial_port *port)
+{
+  if (port->configured && port->tx_len)
+    serial_hw_drain (port, 1);
 }
 
 /* Initialize a serial device. PORT is the port number for a serial device.
@@ -216,6 +305,9 @@ serial_hw_configure (struct grub_serial_port *port,
     return grub_error (GRUB_ERR_BAD_ARGUMENT,
 		       N_("unsupported serial port word length"));
 
+  /* Queued output belongs to the old settings.  */
+  serial_hw_flush (port);
+
   port->config = *config;
   port->configured = 0;
 
@@ -228,7 +320,8 @@ struct grub_serial_driver grub_ns8250_driver =
   {
     .configure = serial_hw_configure,
     .fetch = serial_hw_fetch,
-    .put = serial_hw_put
+    .put = serial_hw_put,
+    .flush = serial_hw_flush
   };
 
 static char com_names[GRUB_SERIAL_PORT_NUM][20];
@@ -300,7 +393,7 @@ grub_serial_ns8250_add_port (grub_port_t port)
   if (grub_inb (port + UART_SR) != 0xa5)
     return NULL;
 
-  p = grub_malloc (sizeof (*p));
+  p = grub_zalloc (sizeof (*p));
   if (!p)
     return NULL;
   p->name = grub_xasprintf ("port%lx", (unsigned long) port);
@@ -48,7 +48,8 @@ enum
     OPTION_PARITY,
     OPTION_STOP,
     OPTION_BASE_CLOCK,
-    OPTION_RTSCTS
+    OPTION_RTSCTS,
+    OPTION_TXBUF
   };
 
 /* Argument options.  */
@@ -62,6 +63,7 @@ static const struct grub_arg_option options[] =
   {"stop",   't', 0, N_("Set the serial port stop bits."),   0, ARG_TYPE_INT},
   {"base-clock",   'b', 0, N_("Set the base frequency."),   0, ARG_TYPE_STRING},
   {"rtscts",   'f', 0, N_("Enable/disable RTS/CTS."),   "on|off", ARG_TYPE_STRING},
+  {"buffer",   'o', 0, N_("Enable/disable output buffering."),   "on|off", ARG_TYPE_STRING},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -86,6 +88,14 @@ serial_put (grub_term_output_t term, const int c)
   data->port->driver->put (data->port, c);
 }
 
+static void
+serial_refresh (grub_term_output_t term)
+{
+  struct grub_serial_output_state *data = term->data;
+  if (data->port && data->port->driver->flush)
+    data->port->driver->flush (data->port);
+}
+
 static int
 serial_fetch (grub_term_input_t term)
 {
@@ -135,6 +145,8 @@ static struct grub_term_output grub_serial_term_output =
   .cls = grub_terminfo_cls,
   .setcolorstate = grub_terminfo_setcolorstate,
   .setcursor = grub_terminfo_setcursor,
+  .refresh = serial_refresh,
+  .scroll = grub_terminfo_scroll,
   .flags = GRUB_TERM_CODE_TYPE_ASCII,
   .data = &grub_serial_terminfo_output,
   .progress_update_divisor = GRUB_PROGRESS_SLOW
@@ -254,6 +266,17 @@ grub_cmd_serial (grub_extcmd_context_t ctxt, int argc, char **args)
 			   N_("unsupported serial port flow control"));
     }
 
+  if (state[OPTION_TXBUF].set)
+    {
+      if (grub_strcmp (state[OPTION_TXBUF].arg, "on") == 0)
+	config.txbuf = 1;
+      else if (grub_strcmp (state[OPTION_TXBUF].arg, "off") == 0)
+	config.txbuf = 0;
+      else
+	return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			   N_("unsupported serial port buffering"));
+    }
+
   if (state[OPTION_STOP].set)
     {
       if (! grub_strcmp (state[OPTION_STOP].arg, "1"))
@@ -398,6 +421,8 @@ grub_serial_register (struct grub_serial_port *port)
 void
 grub_serial_unregister (struct grub_serial_port *port)
 {
+  if (port->driver->flush)
+    port->driver->flush (port);
   if (port->driver->fini)
     port->driver->fini (port);
   
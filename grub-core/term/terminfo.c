@@ -75,6 +75,9 @@ grub_terminfo_all_free (struct grub_term_output *term)
   grub_terminfo_free (&data->reverse_video_off);
   grub_terminfo_free (&data->cursor_on);
   grub_terminfo_free (&data->cursor_off);
+  grub_terminfo_free (&data->scroll_region);
+  grub_terminfo_free (&data->scroll_forward);
+  grub_terminfo_free (&data->scroll_reverse);
 }
 
 /* Set current terminfo type.  */
@@ -102,6 +105,7 @@ grub_terminfo_set_current (struct grub_term_output *term,
    */
 
   grub_terminfo_all_free (term);
+  data->pos_known = data->attr_known = data->cursor_known = 0;
 
   if (grub_strcmp ("vt100", str) == 0)
     {
@@ -113,6 +117,9 @@ grub_terminfo_set_current (struct grub_term_output *term,
       data->cursor_on         = grub_strdup ("\e[?25h");
       data->cursor_off        = grub_strdup ("\e[?25l");
       data->setcolor          = NULL;
+      data->scroll_region     = grub_strdup ("\e[%i%p1%d;%p2%dr");
+      data->scroll_forward    = grub_strdup ("\eD");
+      data->scroll_reverse    = grub_strdup ("\eM");
       return grub_errno;
     }
 
@@ -126,6 +133,9 @@ grub_terminfo_set_current (struct grub_term_output *term,
       data->cursor_on         = grub_strdup ("\e[?25h");
       data->cursor_off        = grub_strdup ("\e[?25l");
       data->setcolor          = grub_strdup ("\e[3%p1%dm\e[4%p2%dm");
+      data->scroll_region     = grub_strdup ("\e[%i%p1%d;%p2%dr");
+      data->scroll_forward    = grub_strdup ("\eD");
+      data->scroll_reverse    = grub_strdup ("\eM");
       return grub_errno;
     }
 
@@ -220,14 +230,42 @@ grub_terminfo_output_unregister (struct grub_term_output *term)
   return grub_error (GRUB_ERR_BUG, "terminal not found");
 }
 
-/* Wrapper for grub_putchar to write strings.  */
+/* Write out what is buffered.  */
+void
+grub_terminfo_refresh (struct grub_term_output *term)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  if (data->outbuf_len)
+    {
+      data->write (term, data->outbuf, data->outbuf_len);
+      data->outbuf_len = 0;
+    }
+}
+
 static void
-putstr (struct grub_term_output *term, const char *str)
+put (struct grub_term_output *term, const int c)
 {
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
+
+  if (!data->write)
+    {
+      data->put (term, c);
+      return;
+    }
+  data->outbuf[data->outbuf_len++] = c;
+  if (data->outbuf_len == sizeof (data->outbuf))
+    grub_terminfo_refresh (term);
+}
+
+/* Wrapper for grub_putchar to write strings.  */
+static void
+putstr (struct grub_term_output *term, const char *str)
+{
   while (*str)
-    data->put (term, *str++);
+    put (term, *str++);
 }
 
 struct grub_term_coordinate
@@ -252,15 +290,38 @@ grub_terminfo_gotoxy (struct grub_term_output *term,
       return;
     }
 
-  if (data->gotoxy)
-    putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
-  else
+  if (!data->gotoxy)
     {
       if ((pos.y == data->pos.y) && (pos.x == data->pos.x - 1))
-	data->put (term, '\b');
+	put (term, '\b');
     }
+  /* Past the last column the terminal may or may not have wrapped yet.  */
+  else if (!data->pos_known || data->pos.x >= grub_term_width (term))
+    putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
+  else if (pos.y == data->pos.y)
+    {
+      /* Redrawing the menu goes to where the cursor already is more
+	 often than not.  */
+      if (pos.x == data->pos.x)
+	;
+      else if (pos.x == 0)
+	put (term, '\r');
+      else if (pos.x == data->pos.x - 1)
+	put (term, '\b');
+      else
+	putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
+    }
+  else if (pos.y == data->pos.y + 1 && pos.x == 0
+	   && pos.y < grub_term_height (term))
+    {
+      put (term, '\r');
+      put (term, '\n');
+    }
+  else
+    putstr (term, grub_terminfo_tparm (data->gotoxy, pos.y, pos.x));
 
   data->pos = pos;
+  data->pos_known = 1;
 }
 
 /* Clear the screen.  */
@@ -271,6 +332,8 @@ grub_terminfo_cls (struct grub_term_output *term)
     = (struct grub_terminfo_output_state *) term->data;
 
   putstr (term, grub_terminfo_tparm (data->cls));
+  /* Not every clear moves the cursor home.  */
+  data->pos_known = 0;
   grub_terminfo_gotoxy (term, (struct grub_term_coordinate) { 0, 0 });
 }
 
@@ -312,8 +375,13 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
 	  return;
 	}
 
-      putstr (term, grub_terminfo_tparm (data->setcolor, colormap[fg & 7],
-					 colormap[bg & 7]));
+      fg = colormap[fg & 7];
+      bg = colormap[bg & 7];
+      if (data->attr_known && data->attr == (fg | (bg << 4)))
+	return;
+      putstr (term, grub_terminfo_tparm (data->setcolor, fg, bg));
+      data->attr = fg | (bg << 4);
+      data->attr_known = 1;
       return;
     }
 
@@ -321,14 +389,21 @@ grub_terminfo_setcolorstate (struct grub_term_output *term,
     {
     case GRUB_TERM_COLOR_STANDARD:
     case GRUB_TERM_COLOR_NORMAL:
+      if (data->attr_known && !data->attr)
+	return;
       putstr (term, grub_terminfo_tparm (data->reverse_video_off));
+      data->attr = 0;
       break;
     case GRUB_TERM_COLOR_HIGHLIGHT:
+      if (data->attr_known && data->attr)
+	return;
       putstr (term, grub_terminfo_tparm (data->reverse_video_on));
+      data->attr = 1;
       break;
     default:
-      break;
+      return;
     }
+  data->attr_known = 1;
 }
 
 void
@@ -337,10 +412,40 @@ grub_terminfo_setcursor (struct grub_term_output *term, const int on)
   struct grub_terminfo_output_state *data
     = (struct grub_terminfo_output_state *) term->data;
 
+  if (data->cursor_known && !data->cursor_visible == !on)
+    return;
   if (on)
     putstr (term, grub_terminfo_tparm (data->cursor_on));
   else
     putstr (term, grub_terminfo_tparm (data->cursor_off));
+  data->cursor_visible = on;
+  data->cursor_known = 1;
+}
+
+/* Scroll rows TOP..BOTTOM by one through a scroll region.  */
+int
+grub_terminfo_scroll (struct grub_term_output *term, unsigned top,
+		      unsigned bottom, int up)
+{
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  if (!data->scroll_region || !data->scroll_forward || !data->scroll_reverse
+      || !data->gotoxy || top >= bottom || bottom >= grub_term_height (term))
+    return 0;
+
+  putstr (term, grub_terminfo_tparm (data->scroll_region, top, bottom));
+  /* Setting a region moves the cursor home.  */
+  data->pos_known = 0;
+  grub_terminfo_gotoxy (term, (struct grub_term_coordinate) { 0,
+	up ? bottom : top });
+  putstr (term, grub_terminfo_tparm (up ? data->scroll_forward
+				     : data->scroll_reverse));
+  putstr (term, grub_terminfo_tparm (data->scroll_region, 0,
+				     grub_term_height (term) - 1));
+  data->pos_known = 0;
+  grub_terminfo_gotoxy (term, (struct grub_term_coordinate) { 0, top });
+  return 1;
 }
 
 /* The terminfo version of putchar.  */
@@ -378,14 +483,20 @@ grub_terminfo_putchar (struct grub_term_output *term,
 	  data->pos.x = 0;
 	  if (data->pos.y < grub_term_height (term) - 1)
 	    data->pos.y++;
-	  data->put (term, '\r');
-	  data->put (term, '\n');
+	  put (term, '\r');
+	  put (term, '\n');
 	}
       data->pos.x += c->estimated_width;
+      /* Whatever a control character does, it isn't tracked.  */
+      if (c->base < 0x20)
+	data->pos_known = 0;
       break;
     }
 
-  data->put (term, c->base);
+  put (term, c->base);
+  /* Lines come out whole, as with line buffered stdio.  */
+  if (c->base == '\n' && data->write)
+    grub_terminfo_refresh (term);
 }
 
 struct grub_term_coordinate
@@ -650,6 +761,11 @@ grub_terminfo_input_init (struct grub_term_input *termi)
 grub_err_t
 grub_terminfo_output_init (struct grub_term_output *term)
 {
+  struct grub_terminfo_output_state *data
+    = (struct grub_terminfo_output_state *) term->data;
+
+  /* Something else may have used the terminal meanwhile.  */
+  data->attr_known = data->cursor_known = 0;
   grub_terminfo_cls (term);
   return GRUB_ERR_NONE;
 }
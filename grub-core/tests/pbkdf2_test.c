@@ -25,6 +25,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 static struct
 {
+  const gcry_md_spec_t *md;
   const char *P;
   grub_size_t Plen;
   const char *S;
@@ -35,6 +36,7 @@ static struct
 } vectors[] = {
   /* RFC6070. */
   {
+    GRUB_MD_SHA1,
     "password", 8,
     "salt", 4,
     1, 20,
@@ -42,6 +44,7 @@ static struct
     "\x06\x2f\xe0\x37\xa6"
   },
   {
+    GRUB_MD_SHA1,
     "password", 8,
     "salt", 4,
     2, 20,
@@ -50,6 +53,7 @@ static struct
     "\xd8\xde\x89\x57"
   },
   {
+    GRUB_MD_SHA1,
     "password", 8,
     "salt", 4,
     4096, 20,
@@ -57,6 +61,7 @@ static struct
     "\x21\xd0\x65\xa4\x29\xc1"
   },
   {
+    GRUB_MD_SHA1,
     "passwordPASSWORDpassword", 24,
     "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36,
     4096, 25,
@@ -64,10 +69,57 @@ static struct
     "\xe4\x4a\x8b\x29\x1a\x96\x4c\xf2\xf0\x70\x38"
   },
   {
+    GRUB_MD_SHA1,
     "pass\0word", 9,
     "sa\0lt", 5,
     4096, 16,
     "\x56\xfa\x6a\xa7\x55\x48\x09\x9d\xcc\x37\xd7\xf0\x34\x25\xe0\xc3"
+  },
+  /* Same inputs with HMAC-SHA256 and HMAC-SHA512.  */
+  {
+    GRUB_MD_SHA256,
+    "password", 8,
+    "salt", 4,
+    1, 32,
+    "\x12\x0f\xb6\xcf\xfc\xf8\xb3\x2c\x43\xe7\x22\x52\x56\xc4\xf8\x37"
+    "\xa8\x65\x48\xc9\x2c\xcc\x35\x48\x08\x05\x98\x7c\xb7\x0b\xe1\x7b"
+  },
+  {
+    GRUB_MD_SHA256,
+    "password", 8,
+    "salt", 4,
+    4096, 32,
+    "\xc5\xe4\x78\xd5\x92\x88\xc8\x41\xaa\x53\x0d\xb6\x84\x5c\x4c\x8d"
+    "\x96\x28\x93\xa0\x01\xce\x4e\x11\xa4\x96\x38\x73\xaa\x98\x13\x4a"
+  },
+  {
+    GRUB_MD_SHA256,
+    "passwordPASSWORDpassword", 24,
+    "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36,
+    4096, 40,
+    "\x34\x8c\x89\xdb\xcb\xd3\x2b\x2f\x32\xd8\x14\xb8\x11\x6e\x84\xcf"
+    "\x2b\x17\x34\x7e\xbc\x18\x00\x18\x1c\x4e\x2a\x1f\xb8\xdd\x53\xe1"
+    "\xc6\x35\x51\x8c\x7d\xac\x47\xe9"
+  },
+  {
+    GRUB_MD_SHA512,
+    "password", 8,
+    "salt", 4,
+    1, 64,
+    "\x86\x7f\x70\xcf\x1a\xde\x02\xcf\xf3\x75\x25\x99\xa3\xa5\x3d\xc4"
+    "\xaf\x34\xc7\xa6\x69\x81\x5a\xe5\xd5\x13\x55\x4e\x1c\x8c\xf2\x52"
+    "\xc0\x2d\x47\x0a\x28\x5a\x05\x01\xba\xd9\x99\xbf\xe9\x43\xc0\x8f"
+    "\x05\x02\x35\xd7\xd6\x8b\x1d\xa5\x5e\x63\xf7\x3b\x60\xa5\x7f\xce"
+  },
+  {
+    GRUB_MD_SHA512,
+    "passwordPASSWORDpassword", 24,
+    "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36,
+    4096, 64,
+    "\x8c\x05\x11\xf4\xc6\xe5\x97\xc6\xac\x63\x15\xd8\xf0\x36\x2e\x22"
+    "\x5f\x3c\x50\x14\x95\xba\x23\xb8\x68\xc0\x05\x17\x4d\xc4\xee\x71"
+    "\x11\x5b\x59\xf9\xe6\x0c\xd9\x53\x2f\xa3\x3e\x0f\x75\xae\xfe\x30"
+    "\x22\x5c\x58\x3a\x18\x6c\xd8\x2b\xd4\xda\xea\x97\x24\xa3\xd3\xb8"
   }
 };
 
@@ -79,8 +131,8 @@ pbkdf2_test (void)
   for (i = 0; i < ARRAY_SIZE (vectors); i++)
     {
       gcry_err_code_t err;
-      grub_uint8_t DK[32];
-      err = grub_crypto_pbkdf2 (GRUB_MD_SHA1,
+      grub_uint8_t DK[64];
+      err = grub_crypto_pbkdf2 (vectors[i].md,
 				(const grub_uint8_t *) vectors[i].P,
 				vectors[i].Plen,
 				(const grub_uint8_t *) vectors[i].S,
@@ -97,6 +97,22 @@ grub_video_bitmap_create (struct grub_video_bitmap **bitmap,
         mode_info->reserved_field_pos = 24;
         break;
 
+      case GRUB_VIDEO_BLIT_FORMAT_BGRA_8888:
+        mode_info->mode_type = GRUB_VIDEO_MODE_TYPE_RGB
+                               | GRUB_VIDEO_MODE_TYPE_ALPHA;
+        mode_info->bpp = 32;
+        mode_info->bytes_per_pixel = 4;
+        mode_info->number_of_colors = 256;
+        mode_info->red_mask_size = 8;
+        mode_info->red_field_pos = 16;
+        mode_info->green_mask_size = 8;
+        mode_info->green_field_pos = 8;
+        mode_info->blue_mask_size = 8;
+        mode_info->blue_field_pos = 0;
+        mode_info->reserved_mask_size = 8;
+        mode_info->reserved_field_pos = 24;
+        break;
+
       case GRUB_VIDEO_BLIT_FORMAT_RGB_888:
         mode_info->mode_type = GRUB_VIDEO_MODE_TYPE_RGB;
         mode_info->bpp = 24;
@@ -165,6 +181,73 @@ grub_video_bitmap_destroy (struct grub_video_bitmap *bitmap)
   return GRUB_ERR_NONE;
 }
 
+/* Convert *BITMAP to FORMAT, replacing it, so that blitting it to a
+   target of that format needs no per-pixel conversion.  Only RGB_888 and
+   RGBA_8888 bitmaps are converted, and only to RGBA_8888 or BGRA_8888;
+   anything else is left as it is.  */
+grub_err_t
+grub_video_bitmap_convert (struct grub_video_bitmap **bitmap,
+			   enum grub_video_blit_format format)
+{
+  struct grub_video_bitmap *src = *bitmap;
+  struct grub_video_bitmap *dst;
+  enum grub_video_blit_format from;
+  const grub_uint8_t *sptr;
+  grub_uint32_t *dptr;
+  grub_size_t i, n;
+
+  if (! src)
+    return GRUB_ERR_NONE;
+
+  from = src->mode_info.blit_format;
+  if (from == format
+      || (from != GRUB_VIDEO_BLIT_FORMAT_RGB_888
+	  && from != GRUB_VIDEO_BLIT_FORMAT_RGBA_8888)
+      || (format != GRUB_VIDEO_BLIT_FORMAT_RGBA_8888
+	  && format != GRUB_VIDEO_BLIT_FORMAT_BGRA_8888))
+    return GRUB_ERR_NONE;
+
+  if (grub_video_bitmap_create (&dst, src->mode_info.width,
+				src->mode_info.height, format))
+    return grub_errno;
+
+  sptr = src->data;
+  dptr = dst->data;
+  n = (grub_size_t) src->mode_info.width * src->mode_info.height;
+  for (i = 0; i < n; i++)
+    {
+      grub_uint32_t r, g, b, a;
+
+      if (from == GRUB_VIDEO_BLIT_FORMAT_RGBA_8888)
+	{
+	  grub_uint32_t color = *(const grub_uint32_t *) sptr;
+
+	  r = color & 0xff;
+	  g = (color >> 8) & 0xff;
+	  b = (color >> 16) & 0xff;
+	  a = color >> 24;
+	  sptr += 4;
+	}
+      else
+	{
+	  r = sptr[0];
+	  g = sptr[1];
+	  b = sptr[2];
+	  a = 255;
+	  sptr += 3;
+	}
+
+      if (format == GRUB_VIDEO_BLIT_FORMAT_BGRA_8888)
+	*dptr++ = (a << 24) | (r << 16) | (g << 8) | b;
+      else
+	*dptr++ = (a << 24) | (b << 16) | (g << 8) | r;
+    }
+
+  grub_video_bitmap_destroy (src);
+  *bitmap = dst;
+  return GRUB_ERR_NONE;
+}
+
 /* Match extension to filename.  */
 static int
 match_extension (const char *filename, const char *ext)
@@ -187,6 +270,17 @@ match_extension (const char *filename, const char *ext)
 grub_err_t
 grub_video_bitmap_load (struct grub_video_bitmap **bitmap,
                         const char *filename)
+{
+  return grub_video_bitmap_load_scaled (bitmap, filename, 0, 0);
+}
+
+/* Loads bitmap for showing at MIN_WIDTH x MIN_HEIGHT or smaller, which
+   lets readers that can do it cheaply decode it at a reduced size.  A
+   zero size loads it at full size.  */
+grub_err_t
+grub_video_bitmap_load_scaled (struct grub_video_bitmap **bitmap,
+			       const char *filename,
+			       unsigned min_width, unsigned min_height)
 {
   grub_video_bitmap_reader_t reader = bitmap_readers_list;
 
@@ -198,7 +292,12 @@ grub_video_bitmap_load (struct grub_video_bitmap **bitmap,
   while (reader)
     {
       if (match_extension (filename, reader->extension))
-        return reader->reader (bitmap, filename);
+	{
+	  if (reader->reader_scaled && min_width && min_height)
+	    return reader->reader_scaled (bitmap, filename,
+					  min_width, min_height);
+	  return reader->reader (bitmap, filename);
+	}
 
       reader = reader->next;
     }
@@ -5,6 +5,9 @@
 #include <grub/video_fb.h>
 #include <grub/mm.h>
 #include <grub/misc.h>
+#include <grub/dl.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
 
 static struct
 {
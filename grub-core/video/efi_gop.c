@@ -36,6 +36,7 @@ static grub_efi_guid_t graphics_output_guid = GRUB_EFI_GOP_GUID;
 static grub_efi_guid_t active_edid_guid = GRUB_EFI_EDID_ACTIVE_GUID;
 static grub_efi_guid_t discovered_edid_guid = GRUB_EFI_EDID_DISCOVERED_GUID;
 static grub_efi_guid_t efi_var_guid = GRUB_EFI_GLOBAL_VARIABLE_GUID;
+static grub_efi_guid_t grub_var_guid = GRUB_EFI_GRUB_VARIABLE_GUID;
 static struct grub_efi_gop *gop;
 static unsigned old_mode;
 static int restore_needed;
@@ -347,6 +348,215 @@ grub_gop_get_preferred_mode (unsigned int *width, unsigned int *height)
   return GRUB_ERR_NONE;
 }
 
+/* QueryMode can take tens of milliseconds on some firmware, so the modes
+   found the first time are kept in a non-volatile variable, keyed by the
+   device path of the GOP and the number of modes.  */
+#define GOP_MODE_CACHE_VAR	"GrubGopModes"
+#define GOP_MODE_CACHE_MAGIC	0x4d504f47	/* "GOPM" */
+
+struct gop_mode_cache_header
+{
+  grub_uint32_t magic;
+  grub_uint32_t max_mode;
+  grub_uint32_t dp_size;
+  /* Followed by the device path and then max_mode entries.  */
+} GRUB_PACKED;
+
+struct gop_mode_cache_entry
+{
+  grub_uint32_t width;
+  grub_uint32_t height;
+  /* 0 if the mode couldn't be queried or isn't usable.  */
+  grub_uint32_t bpp;
+} GRUB_PACKED;
+
+static grub_size_t
+gop_dp_size (const grub_efi_device_path_t *dp)
+{
+  const grub_efi_device_path_t *p;
+
+  for (p = dp; !GRUB_EFI_END_ENTIRE_DEVICE_PATH (p);
+       p = GRUB_EFI_NEXT_DEVICE_PATH (p))
+    if (GRUB_EFI_DEVICE_PATH_LENGTH (p) < sizeof (*p))
+      return 0;
+  return (const grub_uint8_t *) p - (const grub_uint8_t *) dp
+    + GRUB_EFI_DEVICE_PATH_LENGTH (p);
+}
+
+/* Return the cached modes of the current GOP, or NULL.  */
+static struct gop_mode_cache_entry *
+gop_mode_cache_read (void)
+{
+  grub_efi_device_path_t *dp;
+  struct gop_mode_cache_header *head;
+  struct gop_mode_cache_entry *modes = 0;
+  grub_size_t size, dp_size, modes_size;
+
+  dp = grub_efi_get_device_path (gop_handle);
+  if (!dp)
+    return 0;
+  dp_size = gop_dp_size (dp);
+  modes_size = gop->mode->max_mode * sizeof (*modes);
+
+  head = grub_efi_get_variable (GOP_MODE_CACHE_VAR, &grub_var_guid, &size);
+  if (!head)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  if (dp_size && size == sizeof (*head) + dp_size + modes_size
+      && head->magic == GOP_MODE_CACHE_MAGIC
+      && head->max_mode == gop->mode->max_mode
+      && head->dp_size == dp_size
+      && grub_memcmp (head + 1, dp, dp_size) == 0)
+    {
+      modes = grub_malloc (modes_size);
+      if (modes)
+	grub_memcpy (modes, (grub_uint8_t *) (head + 1) + dp_size,
+		     modes_size);
+    }
+
+  grub_free (head);
+  grub_errno = GRUB_ERR_NONE;
+  return modes;
+}
+
+static void
+gop_mode_cache_write (const struct gop_mode_cache_entry *modes)
+{
+  grub_efi_device_path_t *dp;
+  struct gop_mode_cache_header *head;
+  grub_size_t dp_size, modes_size;
+
+  dp = grub_efi_get_device_path (gop_handle);
+  if (!dp)
+    return;
+  dp_size = gop_dp_size (dp);
+  if (!dp_size)
+    return;
+  modes_size = gop->mode->max_mode * sizeof (*modes);
+
+  head = grub_malloc (sizeof (*head) + dp_size + modes_size);
+  if (!head)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  head->magic = GOP_MODE_CACHE_MAGIC;
+  head->max_mode = gop->mode->max_mode;
+  head->dp_size = dp_size;
+  grub_memcpy (head + 1, dp, dp_size);
+  grub_memcpy ((grub_uint8_t *) (head + 1) + dp_size, modes, modes_size);
+
+  if (grub_efi_set_variable (GOP_MODE_CACHE_VAR, &grub_var_guid, head,
+			     sizeof (*head) + dp_size + modes_size))
+    {
+      grub_dprintf ("video", "GOP: couldn't save the mode list\n");
+      grub_errno = GRUB_ERR_NONE;
+    }
+  grub_free (head);
+}
+
+/* Query every mode of the GOP.  */
+static struct gop_mode_cache_entry *
+gop_query_modes (void)
+{
+  struct gop_mode_cache_entry *modes;
+  unsigned mode;
+
+  modes = grub_zalloc (gop->mode->max_mode * sizeof (*modes));
+  if (!modes)
+    return 0;
+
+  grub_dprintf ("video", "GOP: %d modes detected\n", gop->mode->max_mode);
+  for (mode = 0; mode < gop->mode->max_mode; mode++)
+    {
+      struct grub_efi_gop_mode_info *info;
+      grub_efi_uintn_t size;
+      grub_efi_status_t status;
+
+      status = efi_call_4 (gop->query_mode, gop, mode, &size, &info);
+      if (status)
+	continue;
+
+      grub_dprintf ("video", "GOP: mode %d: %dx%d\n", mode, info->width,
+		    info->height);
+
+      modes[mode].width = info->width;
+      modes[mode].height = info->height;
+      modes[mode].bpp = grub_video_gop_get_bpp (info);
+      if (!modes[mode].bpp)
+	grub_dprintf ("video", "GOP: mode %d: incompatible pixel mode\n",
+		      mode);
+    }
+
+  return modes;
+}
+
+/* Check that MODE still is what the cache says.  */
+static int
+gop_mode_matches (unsigned mode, const struct gop_mode_cache_entry *entry)
+{
+  struct grub_efi_gop_mode_info *info;
+  grub_efi_uintn_t size;
+
+  if (efi_call_4 (gop->query_mode, gop, mode, &size, &info))
+    return 0;
+  return info->width == entry->width && info->height == entry->height
+    && (grub_uint32_t) grub_video_gop_get_bpp (info) == entry->bpp;
+}
+
+static int
+gop_select_mode (const struct gop_mode_cache_entry *modes,
+		 unsigned int width, unsigned int height, unsigned int depth,
+		 unsigned int preferred_width, unsigned int preferred_height,
+		 unsigned *best_mode)
+{
+  unsigned long long best_volume = 0;
+  int found = 0;
+  unsigned mode;
+
+  for (mode = 0; mode < gop->mode->max_mode; mode++)
+    {
+      const struct gop_mode_cache_entry *m = &modes[mode];
+
+      if (!m->bpp)
+	continue;
+
+      if (preferred_width && (m->width > preferred_width
+			      || m->height > preferred_height))
+	{
+	  grub_dprintf ("video", "GOP: mode %d: too large\n", mode);
+	  continue;
+	}
+
+      grub_dprintf ("video", "GOP: mode %d: depth %d\n", mode, m->bpp);
+
+      if (!(((m->width == width && m->height == height)
+	     || (width == 0 && height == 0))
+	    && (m->bpp == depth || depth == 0)))
+	{
+	  grub_dprintf ("video", "GOP: mode %d: rejected\n", mode);
+	  continue;
+	}
+
+      if (best_volume < ((unsigned long long) m->width)
+	  * ((unsigned long long) m->height)
+	  * ((unsigned long long) m->bpp))
+	{
+	  best_volume = ((unsigned long long) m->width)
+	    * ((unsigned long long) m->height)
+	    * ((unsigned long long) m->bpp);
+	  *best_mode = mode;
+	}
+      found = 1;
+    }
+
+  return found;
+}
+
 static grub_err_t
 grub_video_gop_setup (unsigned int width, unsigned int height,
 		      unsigned int mode_type,
@@ -358,25 +568,14 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
   grub_err_t err;
   unsigned bpp;
   int found = 0;
-  unsigned long long best_volume = 0;
   unsigned int preferred_width = 0, preferred_height = 0;
   grub_uint8_t *buffer;
 
   depth = (mode_type & GRUB_VIDEO_MODE_TYPE_DEPTH_MASK)
     >> GRUB_VIDEO_MODE_TYPE_DEPTH_POS;
 
-  if (width == 0 && height == 0)
-    {
-      err = grub_gop_get_preferred_mode (&preferred_width, &preferred_height);
-      if (err || preferred_width >= 4096 || preferred_height >= 4096)
-	{
-	  preferred_width = 800;
-	  preferred_height = 600;
-	  grub_errno = GRUB_ERR_NONE;
-	}
-    }
-
-  /* Keep current mode if possible.  */
+  /* Keep current mode if possible.  This comes first, as it needs
+     neither EDID nor any mode queries.  */
   if (gop->mode->info)
     {
       bpp = grub_video_gop_get_bpp (gop->mode->info);
@@ -393,59 +592,49 @@ grub_video_gop_setup (unsigned int width, unsigned int height,
  
   if (!found)
     {
-      unsigned mode;
-      grub_dprintf ("video", "GOP: %d modes detected\n", gop->mode->max_mode);
-      for (mode = 0; mode < gop->mode->max_mode; mode++)
-	{
-	  grub_efi_uintn_t size;
-	  grub_efi_status_t status;
-	 
-	  status = efi_call_4 (gop->query_mode, gop, mode, &size, &info);
-	  if (status)
-	    {
-	      info = 0;
-	      continue;
-	    }
-
-	  grub_dprintf ("video", "GOP: mode %d: %dx%d\n", mode, info->width,
-			info->height);
+      struct gop_mode_cache_entry *modes;
 
-	  if (preferred_width && (info->width > preferred_width
-				  || info->height > preferred_height))
-	    {
-	      grub_dprintf ("video", "GOP: mode %d: too large\n", mode);
-	      continue;
-	    }
-
-	  bpp = grub_video_gop_get_bpp (info);
-	  if (!bpp)
+      if (width == 0 && height == 0)
+	{
+	  err = grub_gop_get_preferred_mode (&preferred_width,
+					     &preferred_height);
+	  if (err || preferred_width >= 4096 || preferred_height >= 4096)
 	    {
-	      grub_dprintf ("video", "GOP: mode %d: incompatible pixel mode\n",
-			    mode);
-	      continue;
+	      preferred_width = 800;
+	      preferred_height = 600;
+	      grub_errno = GRUB_ERR_NONE;
 	    }
+	}
 
-	  grub_dprintf ("video", "GOP: mode %d: depth %d\n", mode, bpp);
-
-	  if (!(((info->width == width && info->height == height)
-		|| (width == 0 && height == 0))
-		&& (bpp == depth || depth == 0)))
+      modes = gop_mode_cache_read ();
+      if (modes)
+	{
+	  grub_dprintf ("video", "GOP: using the saved mode list\n");
+	  found = gop_select_mode (modes, width, height, depth,
+				   preferred_width, preferred_height,
+				   &best_mode);
+	  /* The list is trusted for the modes it rules out; a mode it
+	     picks is checked, since the firmware may have changed.  */
+	  if (found && !gop_mode_matches (best_mode, &modes[best_mode]))
 	    {
-	      grub_dprintf ("video", "GOP: mode %d: rejected\n", mode);
-	      continue;
+	      grub_dprintf ("video", "GOP: saved mode list is stale\n");
+	      grub_free (modes);
+	      modes = 0;
 	    }
+	}
 
-	  if (best_volume < ((unsigned long long) info->width)
-	      * ((unsigned long long) info->height)
-	      * ((unsigned long long) bpp))
-	    {
-	      best_volume = ((unsigned long long) info->width)
-		* ((unsigned long long) info->height)
-		* ((unsigned long long) bpp);
-	      best_mode = mode;
-	    }
-	  found = 1;
+      if (!modes)
+	{
+	  modes = gop_query_modes ();
+	  if (!modes)
+	    return grub_errno;
+	  gop_mode_cache_write (modes);
+	  found = gop_select_mode (modes, width, height, depth,
+				   preferred_width, preferred_height,
+				   &best_mode);
 	}
+
+      grub_free (modes);
     }
 
   if (!found)
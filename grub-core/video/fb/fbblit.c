@@ -34,6 +34,12 @@
 #include <grub/types.h>
 #include <grub/video.h>
 
+#ifdef GRUB_VIDEO_FB_ACCEL
+/* -1 until grub_video_fb_accel has checked the SIMD kernels, then
+   whether the 32-bit blitters use them.  */
+static int accel_state = -1;
+#endif
+
 /* Generic replacing blitter (slow).  Works for every supported format.  */
 static void
 grub_video_fbblit_replace (struct grub_video_fbblit_info *dst,
@@ -784,7 +790,20 @@ grub_video_fbblit_replace_BGRX8888_RGBX8888 (struct grub_video_fbblit_info *dst,
 
   for (j = 0; j < height; j++)
     {
-      for (i = 0; i < width; i++)
+      i = 0;
+#ifdef GRUB_VIDEO_FB_ACCEL
+      if (accel_state > 0)
+	{
+	  grub_size_t n = width / GRUB_VIDEO_FB_ACCEL_BLOCK;
+
+	  grub_video_fb_accel_swap32 ((grub_uint32_t *) dstptr,
+				      (const grub_uint32_t *) srcptr, n);
+	  i = n * GRUB_VIDEO_FB_ACCEL_BLOCK;
+	  srcptr += 4 * i;
+	  dstptr += 4 * i;
+	}
+#endif
+      for (; i < width; i++)
         {
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
           grub_uint8_t a = *srcptr++;
@@ -1242,7 +1261,19 @@ grub_video_fbblit_blend_BGRA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
 
   for (j = 0; j < height; j++)
     {
-      for (i = 0; i < width; i++)
+      i = 0;
+#ifdef GRUB_VIDEO_FB_ACCEL
+      if (accel_state > 0)
+	{
+	  grub_size_t n = width / GRUB_VIDEO_FB_ACCEL_BLOCK;
+
+	  grub_video_fb_accel_blend32_swap (dstptr, srcptr, n);
+	  i = n * GRUB_VIDEO_FB_ACCEL_BLOCK;
+	  srcptr += i;
+	  dstptr += i;
+	}
+#endif
+      for (; i < width; i++)
         {
           grub_uint32_t color;
           unsigned int sr;
@@ -1423,7 +1454,19 @@ grub_video_fbblit_blend_RGBA8888_RGBA8888 (struct grub_video_fbblit_info *dst,
 
   for (j = 0; j < height; j++)
     {
-      for (i = 0; i < width; i++)
+      i = 0;
+#ifdef GRUB_VIDEO_FB_ACCEL
+      if (accel_state > 0)
+	{
+	  grub_size_t n = width / GRUB_VIDEO_FB_ACCEL_BLOCK;
+
+	  grub_video_fb_accel_blend32 (dstptr, srcptr, n);
+	  i = n * GRUB_VIDEO_FB_ACCEL_BLOCK;
+	  srcptr += i;
+	  dstptr += i;
+	}
+#endif
+      for (; i < width; i++)
         {
           color = *srcptr++;
 
@@ -1927,6 +1970,78 @@ grub_video_fbblit_blend_XXX565_1bit (struct grub_video_fbblit_info *dst,
     }
 }
 
+#ifdef GRUB_VIDEO_FB_ACCEL
+typedef void (*blitter_t) (struct grub_video_fbblit_info *dst,
+			   struct grub_video_fbblit_info *src,
+			   int x, int y, int width, int height,
+			   int offset_x, int offset_y);
+
+/* Run the blitters that have SIMD paths with and without them over a
+   small image, with a width that leaves a scalar tail and a pitch
+   wider than the rows, and use the kernels only if all results
+   agree.  */
+int
+grub_video_fb_accel (void)
+{
+  enum { W = 13, H = 2, STRIDE = 16 };
+  static const blitter_t blitters[] =
+    {
+      grub_video_fbblit_replace_BGRX8888_RGBX8888,
+      grub_video_fbblit_blend_BGRA8888_RGBA8888,
+      grub_video_fbblit_blend_RGBA8888_RGBA8888
+    };
+  grub_uint32_t src[H * STRIDE];
+  grub_uint32_t dst[2][H * STRIDE];
+  struct grub_video_mode_info mode;
+  struct grub_video_fbblit_info srcinfo, dstinfo;
+  unsigned i, b;
+  int k;
+
+  if (accel_state >= 0)
+    return accel_state;
+
+  grub_memset (&mode, 0, sizeof (mode));
+  mode.pitch = STRIDE * sizeof (grub_uint32_t);
+  mode.bytes_per_pixel = sizeof (grub_uint32_t);
+  srcinfo.mode_info = &mode;
+  srcinfo.data = (grub_uint8_t *) src;
+  dstinfo.mode_info = &mode;
+
+  /* Transparent, opaque and translucent source pixels.  */
+  for (i = 0; i < ARRAY_SIZE (src); i++)
+    {
+      src[i] = 0x9e3779b9 * (i + 1);
+      if (i % 4 == 0)
+	src[i] &= 0x00ffffff;
+      else if (i % 4 == 1)
+	src[i] |= 0xff000000;
+    }
+
+  for (b = 0; b < ARRAY_SIZE (blitters); b++)
+    {
+      for (k = 0; k < 2; k++)
+	{
+	  for (i = 0; i < ARRAY_SIZE (dst[k]); i++)
+	    dst[k][i] = 0x7f4a7c15 * (i + 3);
+	  accel_state = k;
+	  dstinfo.data = (grub_uint8_t *) dst[k];
+	  blitters[b] (&dstinfo, &srcinfo, 0, 0, W, H, 0, 0);
+	}
+      if (grub_memcmp (dst[0], dst[1], sizeof (dst[0])) != 0)
+	return accel_state = 0;
+    }
+
+  grub_video_fb_accel_fill32 (dst[0], 0x12345678,
+			      STRIDE / GRUB_VIDEO_FB_ACCEL_BLOCK - 1);
+  for (i = 0; i < STRIDE; i++)
+    if (dst[0][i] != (i < STRIDE - GRUB_VIDEO_FB_ACCEL_BLOCK
+		      ? 0x12345678 : dst[1][i]))
+      return accel_state = 0;
+
+  return accel_state = 1;
+}
+#endif
+
 /* NOTE: This function assumes that given coordinates are within bounds of
    handled data.  */
 void
@@ -1936,6 +2051,11 @@ grub_video_fb_dispatch_blit (struct grub_video_fbblit_info *target,
 			     unsigned int width, unsigned int height,
 			     int offset_x, int offset_y)
 {
+#ifdef GRUB_VIDEO_FB_ACCEL
+  if (accel_state < 0)
+    grub_video_fb_accel ();
+#endif
+
   if (oper == GRUB_VIDEO_BLIT_REPLACE)
     {
       /* Try to figure out more optimized version for replace operator.  */
@@ -2129,6 +2249,20 @@ grub_video_fb_dispatch_blit (struct grub_video_fbblit_info *target,
 	      break;
 	    }
 	  break;
+	case GRUB_VIDEO_BLIT_FORMAT_BGRA_8888:
+	  switch (target->mode_info->blit_format)
+	    {
+	    case GRUB_VIDEO_BLIT_FORMAT_BGRA_8888:
+	      /* Only the position of the alpha matters to this blender, so
+		 it serves any pair of equal 32-bit formats.  */
+	      grub_video_fbblit_blend_RGBA8888_RGBA8888 (target, source,
+							       x, y, width, height,
+							       offset_x, offset_y);
+	      return;
+	    default:
+	      break;
+	    }
+	  break;
 	case GRUB_VIDEO_BLIT_FORMAT_RGB_888:
 	  /* Note: There is really no alpha information here, so blend is
 	     changed to replace.  */
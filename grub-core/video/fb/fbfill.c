@@ -68,7 +68,18 @@ grub_video_fbfill_direct32 (struct grub_video_fbblit_info *dst,
 
   for (j = 0; j < height; j++)
     {
-      for (i = 0; i < width; i++)
+      i = 0;
+#ifdef GRUB_VIDEO_FB_ACCEL
+      if (grub_video_fb_accel ())
+	{
+	  grub_size_t n = width / GRUB_VIDEO_FB_ACCEL_BLOCK;
+
+	  grub_video_fb_accel_fill32 (dstptr, color, n);
+	  i = n * GRUB_VIDEO_FB_ACCEL_BLOCK;
+	  dstptr += i;
+	}
+#endif
+      for (; i < width; i++)
         *dstptr++ = color;
 
       /* Advance the dest pointer to the right location on the next line.  */
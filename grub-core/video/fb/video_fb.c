@@ -55,6 +55,9 @@ static struct
   grub_video_fb_set_page_t set_page;
   char *offscreen_buffer;
   grub_video_fb_doublebuf_update_screen_t update_screen;
+  /* Without double buffering, drawing still goes to OFFSCREEN_BUFFER and
+     each operation copies what it drew to the screen.  */
+  int write_through;
 } framebuffer;
 
 /* Specify "standard" VGA palette, some video cards may
@@ -335,6 +338,7 @@ grub_video_fb_init (void)
   framebuffer.palette = 0;
   framebuffer.palette_size = 0;
   framebuffer.set_page = 0;
+  framebuffer.write_through = 0;
   return GRUB_ERR_NONE;
 }
 
@@ -351,6 +355,7 @@ grub_video_fb_fini (void)
   framebuffer.palette_size = 0;
   framebuffer.set_page = 0;
   framebuffer.offscreen_buffer = 0;
+  framebuffer.write_through = 0;
   return GRUB_ERR_NONE;
 }
 
@@ -832,7 +837,8 @@ grub_video_fb_unmap_color_int (struct grub_video_fbblit_info * source,
 static void
 dirty (int y, int height)
 {
-  if (framebuffer.render_target != framebuffer.back_target)
+  if (framebuffer.render_target != framebuffer.back_target
+      || framebuffer.write_through)
     return;
   if (framebuffer.current_dirty.first_line > y)
     framebuffer.current_dirty.first_line = y;
@@ -840,6 +846,38 @@ dirty (int y, int height)
     framebuffer.current_dirty.last_line = y + height;
 }
 
+/* Copy the rectangle just drawn from the shadow buffer to the screen, if
+   the screen isn't double buffered.  Video memory is often uncached, so
+   blending there would be slow; this way it is only ever written.  */
+static void
+write_through (int x, int y, unsigned int width, unsigned int height)
+{
+  struct grub_video_mode_info *mode_info;
+  grub_size_t offset, len;
+
+  if (!framebuffer.write_through
+      || framebuffer.render_target != framebuffer.back_target
+      || width == 0 || height == 0)
+    return;
+
+  mode_info = &framebuffer.back_target->mode_info;
+  if (mode_info->bpp < 8)
+    {
+      /* Pixels don't start on byte boundaries; copy whole lines.  */
+      offset = y * mode_info->pitch;
+      len = mode_info->pitch;
+    }
+  else
+    {
+      offset = y * mode_info->pitch + x * mode_info->bytes_per_pixel;
+      len = width * mode_info->bytes_per_pixel;
+    }
+
+  for (; height; height--, offset += mode_info->pitch)
+    grub_memcpy ((char *) framebuffer.pages[0] + offset,
+		 (char *) framebuffer.back_target->data + offset, len);
+}
+
 grub_err_t
 grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
 			 unsigned int width, unsigned int height)
@@ -903,6 +941,7 @@ grub_video_fb_fill_rect (grub_video_color_t color, int x, int y,
 
   grub_video_fb_fill_dispatch (&target, color, x, y,
 			       width, height);
+  write_through (x, y, width, height);
   return GRUB_ERR_NONE;
 }
 
@@ -1011,6 +1050,7 @@ grub_video_fb_blit_source (struct grub_video_fbblit_info *source,
   dirty (y, height);
   grub_video_fb_dispatch_blit (&target, source, oper, x, y, width, height,
                                offset_x, offset_y);
+  write_through (x, y, width, height);
 
   return GRUB_ERR_NONE;
 }
@@ -1170,6 +1210,8 @@ grub_video_fb_scroll (grub_video_color_t color, int dx, int dy)
 	  grub_uint8_t *src, *dst;
 	  DO_SCROLL
 	}	
+
+      write_through (dst_x, dst_y, width, height);
     }
 
   /* 4. Fill empty space with specified color.  In this implementation
@@ -1573,6 +1615,8 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
 {
   grub_err_t err;
 
+  framebuffer.write_through = 0;
+
   /* Do double buffering only if it's either requested or efficient.  */
   if (set_page_in && grub_video_check_mode_flag (mode_type, mode_mask,
 						 GRUB_VIDEO_MODE_TYPE_DOUBLE_BUFFERED,
@@ -1622,13 +1666,37 @@ grub_video_fb_setup (unsigned int mode_type, unsigned int mode_mask,
       grub_errno = GRUB_ERR_NONE;
     }
 
-  /* Fall back to no double buffering.  */
-  err = grub_video_fb_create_render_target_from_pointer (&framebuffer.back_target,
-							 mode_info,
-							 (void *) page0_ptr);
+  /* Fall back to no double buffering.  Drawing still goes to a copy in
+     memory if there is room for one, only writes reach the screen.  */
+  framebuffer.offscreen_buffer = grub_zalloc (mode_info->pitch
+					      * mode_info->height);
+  if (framebuffer.offscreen_buffer)
+    {
+      err = grub_video_fb_create_render_target_from_pointer (&framebuffer.back_target,
+							     mode_info,
+							     framebuffer.offscreen_buffer);
+      if (!err)
+	{
+	  framebuffer.back_target->is_allocated = 1;
+	  framebuffer.write_through = 1;
+	}
+      else
+	{
+	  grub_free (framebuffer.offscreen_buffer);
+	  framebuffer.offscreen_buffer = 0;
+	}
+    }
+  grub_errno = GRUB_ERR_NONE;
 
-  if (err)
-    return err;
+  if (!framebuffer.write_through)
+    {
+      err = grub_video_fb_create_render_target_from_pointer (&framebuffer.back_target,
+							     mode_info,
+							     (void *) page0_ptr);
+
+      if (err)
+	return err;
+    }
 
   framebuffer.update_screen = 0;
   framebuffer.pages[0] = page0_ptr;
@@ -83,11 +83,19 @@ struct grub_jpeg_data
   unsigned image_width;
   unsigned image_height;
 
+  /* Size to decode at least at, 0 for full size; the image is decoded at
+     1 / (1 << scale) of its size, bitmap_width x bitmap_height.  */
+  unsigned min_width, min_height;
+  unsigned scale;
+  unsigned bitmap_width, bitmap_height;
+
   grub_uint8_t *huff_value[4];
   int huff_offset[4][16];
   int huff_maxval[4][16];
 
   grub_uint8_t quan_table[2][64];
+  /* Quantization tables in the form the IDCT in use wants them.  */
+  int quan_mult[2][64];
   int comp_index[3][3];
 
   jpeg_data_unit_t ydu[4];
@@ -298,6 +306,19 @@ grub_jpeg_decode_sof (struct grub_jpeg_data *data)
   if ((!data->image_height) || (!data->image_width))
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: invalid image size");
 
+  /* Halve the size for as long as it stays at least the one asked for,
+     down to one pixel per data unit.  */
+  data->scale = 0;
+  if (data->min_width && data->min_height)
+    while (data->scale < 3
+	   && (data->image_width >> (data->scale + 1)) >= data->min_width
+	   && (data->image_height >> (data->scale + 1)) >= data->min_height)
+      data->scale++;
+  data->bitmap_width = ((data->image_width + (1 << data->scale) - 1)
+			>> data->scale);
+  data->bitmap_height = ((data->image_height + (1 << data->scale) - 1)
+			 >> data->scale);
+
   cc = grub_jpeg_get_byte (data);
   if (cc != 1 && cc != 3)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE,
@@ -348,13 +369,96 @@ grub_jpeg_decode_dri (struct grub_jpeg_data *data)
   return grub_errno;
 }
 
+/* The full-size IDCT is the AAN one: its scale factors are folded into
+   the dequantization (quan_mult), leaving five multiplications per
+   eight samples.  Results carry JPEG_PASS1_BITS extra bits between the
+   passes.  */
+#define JPEG_PASS1_BITS		2
+#define JPEG_AAN_BITS		14
+/* Extra precision of quan_mult, dropped once a coefficient is scaled.  */
+#define JPEG_MULT_BITS		8
+
+#define FIX_1_082392200		CONST (1.082392200)
+#define FIX_1_414213562		CONST (1.414213562)
+#define FIX_1_847759065		CONST (1.847759065)
+#define FIX_2_613125930		CONST (2.613125930)
+
+#define MULTIPLY(v, c)		(((v) * (c)) >> SHIFT_BITS)
+#define JPEG_DEQUANTIZE(v, m)	\
+  (((v) * (m) + (1 << (JPEG_MULT_BITS - 1))) >> JPEG_MULT_BITS)
+
+/* cos (k * pi / 16) * sqrt (2) for the row and column of each
+   coefficient, in natural order, times 1 << JPEG_AAN_BITS.  */
+static const grub_uint16_t jpeg_aan_scales[64] = {
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  22725, 31521, 29692, 26722, 22725, 17855, 12299,  6270,
+  21407, 29692, 27969, 25172, 21407, 16819, 11585,  5906,
+  19266, 26722, 25172, 22654, 19266, 15137, 10426,  5315,
+  16384, 22725, 21407, 19266, 16384, 12873,  8867,  4520,
+  12873, 17855, 16819, 15137, 12873, 10114,  6967,  3552,
+   8867, 12299, 11585, 10426,  8867,  6967,  4799,  2446,
+   4520,  6270,  5906,  5315,  4520,  3552,  2446,  1247
+};
+
+static inline grub_uint8_t
+grub_jpeg_clamp (int v)
+{
+  if (v < 0)
+    return 0;
+  if (v > 255)
+    return 255;
+  return v;
+}
+
+/* The common butterflies of both passes, on P[0], P[S] ... P[7 * S].  */
+#define JPEG_AAN_IDCT(p, s, out, shift)					\
+  do									\
+    {									\
+      int t0, t1, t2, t3, t4, t5, t6, t7, t10, t11, t12, t13;		\
+      int z5, z10, z11, z12, z13;					\
+									\
+      t10 = p[0] + p[4 * s];						\
+      t11 = p[0] - p[4 * s];						\
+      t13 = p[2 * s] + p[6 * s];					\
+      t12 = MULTIPLY (p[2 * s] - p[6 * s], FIX_1_414213562) - t13;	\
+      t0 = t10 + t13;							\
+      t3 = t10 - t13;							\
+      t1 = t11 + t12;							\
+      t2 = t11 - t12;							\
+									\
+      z13 = p[5 * s] + p[3 * s];					\
+      z10 = p[5 * s] - p[3 * s];					\
+      z11 = p[s] + p[7 * s];						\
+      z12 = p[s] - p[7 * s];						\
+      t7 = z11 + z13;							\
+      t11 = MULTIPLY (z11 - z13, FIX_1_414213562);			\
+      z5 = MULTIPLY (z10 + z12, FIX_1_847759065);			\
+      t10 = MULTIPLY (z12, FIX_1_082392200) - z5;			\
+      t12 = z5 - MULTIPLY (z10, FIX_2_613125930);			\
+      t6 = t12 - t7;							\
+      t5 = t11 - t6;							\
+      t4 = t10 + t5;							\
+									\
+      p[0] = out (t0 + t7, shift);					\
+      p[7 * s] = out (t0 - t7, shift);					\
+      p[s] = out (t1 + t6, shift);					\
+      p[6 * s] = out (t1 - t6, shift);					\
+      p[2 * s] = out (t2 + t5, shift);					\
+      p[5 * s] = out (t2 - t5, shift);					\
+      p[4 * s] = out (t3 + t4, shift);					\
+      p[3 * s] = out (t3 - t4, shift);					\
+    }									\
+  while (0)
+
+#define JPEG_KEEP(v, shift)	(v)
+#define JPEG_PIXEL(v, shift)	\
+  grub_jpeg_clamp ((((v) + (1 << ((shift) - 1))) >> (shift)) + 128)
+
 static void
 grub_jpeg_idct_transform (jpeg_data_unit_t du)
 {
   int *pd;
   int i;
-  int t0, t1, t2, t3, t4, t5, t6, t7;
-  int v0, v1, v2, v3, v4;
 
   pd = du;
   for (i = 0; i < JPEG_UNIT_SIZE; i++, pd++)
@@ -364,8 +468,6 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
 	   pd[JPEG_UNIT_SIZE * 5] | pd[JPEG_UNIT_SIZE * 6] |
 	   pd[JPEG_UNIT_SIZE * 7]) == 0)
 	{
-	  pd[JPEG_UNIT_SIZE * 0] <<= SHIFT_BITS;
-
 	  pd[JPEG_UNIT_SIZE * 1] = pd[JPEG_UNIT_SIZE * 2]
 	    = pd[JPEG_UNIT_SIZE * 3] = pd[JPEG_UNIT_SIZE * 4]
 	    = pd[JPEG_UNIT_SIZE * 5] = pd[JPEG_UNIT_SIZE * 6]
@@ -374,53 +476,7 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
 	  continue;
 	}
 
-      t0 = pd[JPEG_UNIT_SIZE * 0];
-      t1 = pd[JPEG_UNIT_SIZE * 2];
-      t2 = pd[JPEG_UNIT_SIZE * 4];
-      t3 = pd[JPEG_UNIT_SIZE * 6];
-
-      v4 = (t1 + t3) * CONST (0.541196100);
-
-      v0 = ((t0 + t2) << SHIFT_BITS);
-      v1 = ((t0 - t2) << SHIFT_BITS);
-      v2 = v4 - t3 * CONST (1.847759065);
-      v3 = v4 + t1 * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[JPEG_UNIT_SIZE * 7];
-      t5 = pd[JPEG_UNIT_SIZE * 5];
-      t6 = pd[JPEG_UNIT_SIZE * 3];
-      t7 = pd[JPEG_UNIT_SIZE * 1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[JPEG_UNIT_SIZE * 0] = t0 + t7;
-      pd[JPEG_UNIT_SIZE * 7] = t0 - t7;
-      pd[JPEG_UNIT_SIZE * 1] = t1 + t6;
-      pd[JPEG_UNIT_SIZE * 6] = t1 - t6;
-      pd[JPEG_UNIT_SIZE * 2] = t2 + t5;
-      pd[JPEG_UNIT_SIZE * 5] = t2 - t5;
-      pd[JPEG_UNIT_SIZE * 3] = t3 + t4;
-      pd[JPEG_UNIT_SIZE * 4] = t3 - t4;
+      JPEG_AAN_IDCT (pd, JPEG_UNIT_SIZE, JPEG_KEEP, 0);
     }
 
   pd = du;
@@ -428,64 +484,88 @@ grub_jpeg_idct_transform (jpeg_data_unit_t du)
     {
       if ((pd[1] | pd[2] | pd[3] | pd[4] | pd[5] | pd[6] | pd[7]) == 0)
 	{
-	  pd[0] >>= (SHIFT_BITS + 3);
+	  pd[0] = JPEG_PIXEL (pd[0], JPEG_PASS1_BITS + 3);
 	  pd[1] = pd[2] = pd[3] = pd[4] = pd[5] = pd[6] = pd[7] = pd[0];
 	  continue;
 	}
 
-      v4 = (pd[2] + pd[6]) * CONST (0.541196100);
-
-      v0 = (pd[0] + pd[4]) << SHIFT_BITS;
-      v1 = (pd[0] - pd[4]) << SHIFT_BITS;
-      v2 = v4 - pd[6] * CONST (1.847759065);
-      v3 = v4 + pd[2] * CONST (0.765366865);
-
-      t0 = v0 + v3;
-      t3 = v0 - v3;
-      t1 = v1 + v2;
-      t2 = v1 - v2;
-
-      t4 = pd[7];
-      t5 = pd[5];
-      t6 = pd[3];
-      t7 = pd[1];
-
-      v0 = t4 + t7;
-      v1 = t5 + t6;
-      v2 = t4 + t6;
-      v3 = t5 + t7;
-
-      v4 = (v2 + v3) * CONST (1.175875602);
-
-      v0 *= CONST (0.899976223);
-      v1 *= CONST (2.562915447);
-      v2 = v2 * CONST (1.961570560) - v4;
-      v3 = v3 * CONST (0.390180644) - v4;
-
-      t4 = t4 * CONST (0.298631336) - v0 - v2;
-      t5 = t5 * CONST (2.053119869) - v1 - v3;
-      t6 = t6 * CONST (3.072711026) - v1 - v2;
-      t7 = t7 * CONST (1.501321110) - v0 - v3;
-
-      pd[0] = (t0 + t7) >> (SHIFT_BITS * 2 + 3);
-      pd[7] = (t0 - t7) >> (SHIFT_BITS * 2 + 3);
-      pd[1] = (t1 + t6) >> (SHIFT_BITS * 2 + 3);
-      pd[6] = (t1 - t6) >> (SHIFT_BITS * 2 + 3);
-      pd[2] = (t2 + t5) >> (SHIFT_BITS * 2 + 3);
-      pd[5] = (t2 - t5) >> (SHIFT_BITS * 2 + 3);
-      pd[3] = (t3 + t4) >> (SHIFT_BITS * 2 + 3);
-      pd[4] = (t3 - t4) >> (SHIFT_BITS * 2 + 3);
+      JPEG_AAN_IDCT (pd, 1, JPEG_PIXEL, JPEG_PASS1_BITS + 3);
     }
+}
 
-  for (i = 0; i < JPEG_UNIT_SIZE * JPEG_UNIT_SIZE; i++)
-    {
-      du[i] += 128;
+/* Reduced IDCTs for decoding at 1/2, 1/4 and 1/8 of the size: the
+   SIZE-point transform of the lowest SIZE x SIZE coefficients, which
+   approximates the average of what the full one would give for each
+   8 / SIZE pixels.  The result is left in the top left corner of DU.  */
+/* What averaging 2, 4 and 8 pixels does to the amplitude of the
+   frequencies that are kept, sin (k u pi / 16) / (k sin (u pi / 16)),
+   times 1 << JPEG_MULT_BITS; folded into quan_mult.  */
+static const grub_uint16_t jpeg_reduce_gain[3][4] = {
+  { 256, 251, 237, 213 },
+  { 256, 232 },
+  { 256 }
+};
+
+static void
+grub_jpeg_idct_reduced (jpeg_data_unit_t du, unsigned size)
+{
+  int *pd;
+  unsigned i;
 
-      if (du[i] < 0)
-	du[i] = 0;
-      if (du[i] > 255)
-	du[i] = 255;
+  if (size == 1)
+    {
+      du[0] = JPEG_PIXEL (du[0], 3);
+      return;
     }
+
+  for (i = 0, pd = du; i < size; i++, pd++)
+    if (size == 2)
+      {
+	int e = pd[0] * CONST (0.707106781);
+	int o = pd[JPEG_UNIT_SIZE] * CONST (0.707106781);
+
+	pd[0] = e + o;
+	pd[JPEG_UNIT_SIZE] = e - o;
+      }
+    else
+      {
+	int e0 = (pd[0] + pd[JPEG_UNIT_SIZE * 2]) * CONST (0.707106781);
+	int e1 = (pd[0] - pd[JPEG_UNIT_SIZE * 2]) * CONST (0.707106781);
+	int o0 = pd[JPEG_UNIT_SIZE] * CONST (0.923879533)
+	  + pd[JPEG_UNIT_SIZE * 3] * CONST (0.382683432);
+	int o1 = pd[JPEG_UNIT_SIZE] * CONST (0.382683432)
+	  - pd[JPEG_UNIT_SIZE * 3] * CONST (0.923879533);
+
+	pd[0] = e0 + o0;
+	pd[JPEG_UNIT_SIZE * 3] = e0 - o0;
+	pd[JPEG_UNIT_SIZE] = e1 + o1;
+	pd[JPEG_UNIT_SIZE * 2] = e1 - o1;
+      }
+
+  /* Both passes halve, and the first left SHIFT_BITS extra bits.  */
+  for (i = 0, pd = du; i < size; i++, pd += JPEG_UNIT_SIZE)
+    if (size == 2)
+      {
+	int e = MULTIPLY (pd[0], CONST (0.707106781));
+	int o = MULTIPLY (pd[1], CONST (0.707106781));
+
+	pd[0] = JPEG_PIXEL (e + o, SHIFT_BITS + 2);
+	pd[1] = JPEG_PIXEL (e - o, SHIFT_BITS + 2);
+      }
+    else
+      {
+	int e0 = MULTIPLY (pd[0] + pd[2], CONST (0.707106781));
+	int e1 = MULTIPLY (pd[0] - pd[2], CONST (0.707106781));
+	int o0 = MULTIPLY (pd[1], CONST (0.923879533))
+	  + MULTIPLY (pd[3], CONST (0.382683432));
+	int o1 = MULTIPLY (pd[1], CONST (0.382683432))
+	  - MULTIPLY (pd[3], CONST (0.923879533));
+
+	pd[0] = JPEG_PIXEL (e0 + o0, SHIFT_BITS + 2);
+	pd[3] = JPEG_PIXEL (e0 - o0, SHIFT_BITS + 2);
+	pd[1] = JPEG_PIXEL (e1 + o1, SHIFT_BITS + 2);
+	pd[2] = JPEG_PIXEL (e1 - o1, SHIFT_BITS + 2);
+      }
 }
 
 static void
@@ -503,9 +583,9 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
   data->dc_value[id] +=
     grub_jpeg_get_number (data, grub_jpeg_get_huff_code (data, h1));
 
-  du[0] = data->dc_value[id] * (int) data->quan_table[qt][0];
+  du[0] = JPEG_DEQUANTIZE (data->dc_value[id], data->quan_mult[qt][0]);
   pos = 1;
-  while (pos < ARRAY_SIZE (data->quan_table[qt]))
+  while (pos < ARRAY_SIZE (data->quan_mult[qt]))
     {
       int num, val;
 
@@ -516,56 +596,51 @@ grub_jpeg_decode_du (struct grub_jpeg_data *data, int id, jpeg_data_unit_t du)
       val = grub_jpeg_get_number (data, num & 0xF);
       num >>= 4;
       pos += num;
-      du[jpeg_zigzag_order[pos]] = val * (int) data->quan_table[qt][pos];
+      du[jpeg_zigzag_order[pos]] = JPEG_DEQUANTIZE (val,
+						    data->quan_mult[qt][pos]);
       pos++;
     }
 
-  grub_jpeg_idct_transform (du);
+  if (data->scale)
+    grub_jpeg_idct_reduced (du, JPEG_UNIT_SIZE >> data->scale);
+  else
+    grub_jpeg_idct_transform (du);
 }
 
+/* Per-Cr and per-Cb terms of the colour conversion.  */
+static int jpeg_cr_r[256], jpeg_cr_g[256], jpeg_cb_g[256], jpeg_cb_b[256];
+
 static void
-grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
+grub_jpeg_init_tables (void)
 {
-  int dd;
+  int i;
 
-  cr -= 128;
-  cb -= 128;
+  for (i = 0; i < 256; i++)
+    {
+      jpeg_cr_r[i] = ((i - 128) * CONST (1.402)) >> SHIFT_BITS;
+      jpeg_cr_g[i] = (i - 128) * CONST (0.71414);
+      jpeg_cb_g[i] = (i - 128) * CONST (0.34414);
+      jpeg_cb_b[i] = ((i - 128) * CONST (1.772)) >> SHIFT_BITS;
+    }
+}
 
-  /* Red  */
-  dd = yy + ((cr * CONST (1.402)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[2] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+static void
+grub_jpeg_ycrcb_to_rgb (int yy, int cr, int cb, grub_uint8_t * rgb)
+{
+  grub_uint8_t r, g, b;
 
-  /* Green  */
-  dd = yy - ((cb * CONST (0.34414) + cr * CONST (0.71414)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
-#ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[1] = dd;
-#else
-  *(rgb++) = dd;
-#endif
+  r = grub_jpeg_clamp (yy + jpeg_cr_r[cr]);
+  g = grub_jpeg_clamp (yy - ((jpeg_cb_g[cb] + jpeg_cr_g[cr]) >> SHIFT_BITS));
+  b = grub_jpeg_clamp (yy + jpeg_cb_b[cb]);
 
-  /* Blue  */
-  dd = yy + ((cb * CONST (1.772)) >> SHIFT_BITS);
-  if (dd < 0)
-    dd = 0;
-  if (dd > 255)
-    dd = 255;
 #ifdef GRUB_CPU_WORDS_BIGENDIAN
-  rgb[0] = dd;
-  rgb += 3;
+  rgb[0] = b;
+  rgb[1] = g;
+  rgb[2] = r;
 #else
-  *(rgb++) = dd;
+  rgb[0] = r;
+  rgb[1] = g;
+  rgb[2] = b;
 #endif
 }
 
@@ -604,8 +679,35 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
   if (data->file->offset != data_offset)
     return grub_error (GRUB_ERR_BAD_FILE_TYPE, "jpeg: extra byte in sos");
 
-  if (grub_video_bitmap_create (data->bitmap, data->image_width,
-				data->image_height,
+  for (i = 0; i < 2; i++)
+    {
+      unsigned pos;
+
+      for (pos = 0; pos < ARRAY_SIZE (data->quan_mult[i]); pos++)
+	if (data->scale)
+	  {
+	    const grub_uint16_t *gain = jpeg_reduce_gain[data->scale - 1];
+	    unsigned u = jpeg_zigzag_order[pos] / 8;
+	    unsigned v = jpeg_zigzag_order[pos] % 8;
+	    unsigned size = JPEG_UNIT_SIZE >> data->scale;
+
+	    if (u < size && v < size)
+	      data->quan_mult[i][pos]
+		= ((int) data->quan_table[i][pos] * gain[u] * gain[v])
+		>> JPEG_MULT_BITS;
+	    else
+	      data->quan_mult[i][pos] = 0;
+	  }
+	else
+	  data->quan_mult[i][pos]
+	    = (((int) data->quan_table[i][pos]
+		* jpeg_aan_scales[jpeg_zigzag_order[pos]]
+		+ (1 << (JPEG_AAN_BITS - JPEG_PASS1_BITS - JPEG_MULT_BITS - 1)))
+	       >> (JPEG_AAN_BITS - JPEG_PASS1_BITS - JPEG_MULT_BITS));
+    }
+
+  if (grub_video_bitmap_create (data->bitmap, data->bitmap_width,
+				data->bitmap_height,
 				GRUB_VIDEO_BLIT_FORMAT_RGB_888))
     return grub_errno;
 
@@ -616,16 +718,20 @@ grub_jpeg_decode_sos (struct grub_jpeg_data *data)
 static grub_err_t
 grub_jpeg_decode_data (struct grub_jpeg_data *data)
 {
-  unsigned c1, vb, hb, nr1, nc1;
+  unsigned c1, vb, hb, nr1, nc1, du_size;
   int rst = data->dri;
 
-  vb = 8 << data->log_vs;
-  hb = 8 << data->log_hs;
-  nr1 = (data->image_height + vb - 1) >> (3 + data->log_vs);
-  nc1 = (data->image_width + hb - 1)  >> (3 + data->log_hs);
+  /* Data units are DU_SIZE pixels square in the bitmap.  */
+  du_size = JPEG_UNIT_SIZE >> data->scale;
+  vb = du_size << data->log_vs;
+  hb = du_size << data->log_hs;
+  nr1 = (data->image_height + (8 << data->log_vs) - 1) >> (3 + data->log_vs);
+  nc1 = (data->image_width + (8 << data->log_hs) - 1)  >> (3 + data->log_hs);
 
+  /* Scaled down, the last MCU of a row may reach past the bitmap.  */
   for (; data->r1 < nr1 && (!data->dri || rst);
-       data->r1++, data->bitmap_ptr += (vb * data->image_width - hb * nc1) * 3)
+       data->r1++, data->bitmap_ptr += ((int) (vb * data->bitmap_width)
+					- (int) (hb * nc1)) * 3)
     for (c1 = 0;  c1 < nc1 && (!data->dri || rst);
 	c1++, rst--, data->bitmap_ptr += hb * 3)
       {
@@ -645,18 +751,19 @@ grub_jpeg_decode_data (struct grub_jpeg_data *data)
 	if (grub_errno)
 	  return grub_errno;
 
-	nr2 = (data->r1 == nr1 - 1) ? (data->image_height - data->r1 * vb) : vb;
-	nc2 = (c1 == nc1 - 1) ? (data->image_width - c1 * hb) : hb;
+	nr2 = (data->r1 == nr1 - 1) ? (data->bitmap_height - data->r1 * vb) : vb;
+	nc2 = (c1 == nc1 - 1) ? (data->bitmap_width - c1 * hb) : hb;
 
 	ptr2 = data->bitmap_ptr;
-	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->image_width - nc2) * 3)
+	for (r2 = 0; r2 < nr2; r2++, ptr2 += (data->bitmap_width - nc2) * 3)
 	  for (c2 = 0; c2 < nc2; c2++, ptr2 += 3)
 	    {
 	      unsigned i0;
 	      int yy;
 
 	      i0 = (r2 >> data->log_vs) * 8 + (c2 >> data->log_hs);
-	      yy = data->ydu[(r2 / 8) * 2 + (c2 / 8)][(r2 % 8) * 8 + (c2 % 8)];
+	      yy = data->ydu[(r2 / du_size) * 2 + (c2 / du_size)]
+		[(r2 % du_size) * 8 + (c2 % du_size)];
 
 	      if (data->color_components >= 3)
 		{
@@ -765,13 +872,14 @@ grub_jpeg_decode_jpeg (struct grub_jpeg_data *data)
 }
 
 static grub_err_t
-grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
-			const char *filename)
+grub_video_reader_jpeg_scaled (struct grub_video_bitmap **bitmap,
+			       const char *filename,
+			       unsigned min_width, unsigned min_height)
 {
   grub_file_t file;
   struct grub_jpeg_data *data;
 
-  file = grub_buffile_open (filename, 0);
+  file = grub_buffile_open (filename, 0, GRUB_BUFIO_HINT_SEQUENTIAL);
   if (!file)
     return grub_errno;
 
@@ -782,6 +890,8 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
 
       data->file = file;
       data->bitmap = bitmap;
+      data->min_width = min_width;
+      data->min_height = min_height;
       grub_jpeg_decode_jpeg (data);
 
       for (i = 0; i < 4; i++)
@@ -800,6 +910,13 @@ grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
   return grub_errno;
 }
 
+static grub_err_t
+grub_video_reader_jpeg (struct grub_video_bitmap **bitmap,
+			const char *filename)
+{
+  return grub_video_reader_jpeg_scaled (bitmap, filename, 0, 0);
+}
+
 #if defined(JPEG_DEBUG)
 static grub_err_t
 grub_cmd_jpegtest (grub_command_t cmdd __attribute__ ((unused)),
@@ -823,17 +940,20 @@ grub_cmd_jpegtest (grub_command_t cmdd __attribute__ ((unused)),
 static struct grub_video_bitmap_reader jpg_reader = {
   .extension = ".jpg",
   .reader = grub_video_reader_jpeg,
+  .reader_scaled = grub_video_reader_jpeg_scaled,
   .next = 0
 };
 
 static struct grub_video_bitmap_reader jpeg_reader = {
   .extension = ".jpeg",
   .reader = grub_video_reader_jpeg,
+  .reader_scaled = grub_video_reader_jpeg_scaled,
   .next = 0
 };
 
 GRUB_MOD_INIT (jpeg)
 {
+  grub_jpeg_init_tables ();
   grub_video_bitmap_reader_register (&jpg_reader);
   grub_video_bitmap_reader_register (&jpeg_reader);
 #if defined(JPEG_DEBUG)
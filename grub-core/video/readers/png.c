@@ -23,6 +23,7 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/bufio.h>
+#include <grub/deflate.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -574,6 +575,120 @@ grub_png_init_dynamic_block (struct grub_png_data *data)
   return grub_errno;
 }
 
+/* Bytewise sums and rounded-down averages of words, with nothing
+   carried from one byte to the next.  */
+static inline grub_uint32_t
+grub_png_add_bytes32 (grub_uint32_t a, grub_uint32_t b)
+{
+  return ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((a ^ b) & 0x80808080);
+}
+
+static inline grub_uint64_t
+grub_png_add_bytes64 (grub_uint64_t a, grub_uint64_t b)
+{
+  return (((a & 0x7f7f7f7f7f7f7f7fULL) + (b & 0x7f7f7f7f7f7f7f7fULL))
+	  ^ ((a ^ b) & 0x8080808080808080ULL));
+}
+
+static inline grub_uint32_t
+grub_png_avg_bytes32 (grub_uint32_t a, grub_uint32_t b)
+{
+  return (a & b) + (((a ^ b) & 0xfefefefe) >> 1);
+}
+
+/* Undo FILTER on the row CUR, UP being the row above it.  Up works on
+   eight bytes at a time; Sub and Avg on whole pixels at a time when those
+   are three or four bytes, MASK keeping the byte after a three-byte pixel
+   as it is.  The module is built without SSE, hence plain words.  */
+static void
+grub_png_unfilter_row (struct grub_png_data *data, grub_uint8_t *cur,
+		       const grub_uint8_t *up, int filter)
+{
+  int bpp = data->bpp;
+  int row_bytes = data->row_bytes;
+  int words = (bpp == 3 || bpp == 4);
+  grub_uint32_t mask = (bpp == 4) ? 0xffffffff
+    : grub_cpu_to_le32_compile_time (0x00ffffff);
+  int i = 0;
+
+  switch (filter)
+    {
+    case PNG_FILTER_VALUE_SUB:
+      i = bpp;
+      if (words)
+	for (; i + 4 <= row_bytes; i += bpp)
+	  {
+	    grub_uint32_t x = grub_get_unaligned32 (cur + i);
+	    grub_uint32_t left = grub_get_unaligned32 (cur + i - bpp);
+
+	    grub_set_unaligned32 (cur + i,
+				  grub_png_add_bytes32 (x, left & mask));
+	  }
+      for (; i < row_bytes; i++)
+	cur[i] += cur[i - bpp];
+      break;
+
+    case PNG_FILTER_VALUE_UP:
+      for (; i + 8 <= row_bytes; i += 8)
+	{
+	  grub_uint64_t x = grub_get_unaligned64 (cur + i);
+
+	  grub_set_unaligned64 (cur + i,
+				grub_png_add_bytes64 (x,
+						      grub_get_unaligned64 (up + i)));
+	}
+      for (; i < row_bytes; i++)
+	cur[i] += up[i];
+      break;
+
+    case PNG_FILTER_VALUE_AVG:
+      for (; i < bpp; i++)
+	cur[i] += up[i] >> 1;
+      if (words)
+	for (; i + 4 <= row_bytes; i += bpp)
+	  {
+	    grub_uint32_t x = grub_get_unaligned32 (cur + i);
+	    grub_uint32_t avg;
+
+	    avg = grub_png_avg_bytes32 (grub_get_unaligned32 (cur + i - bpp),
+					grub_get_unaligned32 (up + i));
+	    grub_set_unaligned32 (cur + i, grub_png_add_bytes32 (x, avg & mask));
+	  }
+      for (; i < row_bytes; i++)
+	cur[i] += ((int) up[i] + (int) cur[i - bpp]) >> 1;
+      break;
+
+    case PNG_FILTER_VALUE_PAETH:
+      for (; i < bpp; i++)
+	cur[i] += up[i];
+
+      for (; i < row_bytes; i++)
+	{
+	  int a, b, c, pa, pb, pc;
+
+	  a = cur[i - bpp];
+	  b = up[i];
+	  c = up[i - bpp];
+
+	  pa = b - c;
+	  pb = a - c;
+	  pc = pa + pb;
+
+	  if (pa < 0)
+	    pa = -pa;
+
+	  if (pb < 0)
+	    pb = -pb;
+
+	  if (pc < 0)
+	    pc = -pc;
+
+	  cur[i] += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
+	}
+      break;
+    }
+}
+
 static grub_err_t
 grub_png_output_byte (struct grub_png_data *data, grub_uint8_t n)
 {
@@ -595,7 +710,6 @@ grub_png_output_byte (struct grub_png_data *data, grub_uint8_t n)
     {
       grub_uint8_t *blank_line = NULL;
       grub_uint8_t *cur = data->cur_rgb - data->row_bytes;
-      grub_uint8_t *left = cur;
       grub_uint8_t *up;
 
       if (data->first_line)
@@ -609,72 +723,7 @@ grub_png_output_byte (struct grub_png_data *data, grub_uint8_t n)
       else
 	up = cur - data->row_bytes;
 
-      switch (data->cur_filter)
-	{
-	case PNG_FILTER_VALUE_SUB:
-	  {
-	    int i;
-
-	    cur += data->bpp;
-	    for (i = data->bpp; i < data->row_bytes; i++, cur++, left++)
-	      *cur += *left;
-
-	    break;
-	  }
-	case PNG_FILTER_VALUE_UP:
-	  {
-	    int i;
-
-	    for (i = 0; i < data->row_bytes; i++, cur++, up++)
-	      *cur += *up;
-
-	    break;
-	  }
-	case PNG_FILTER_VALUE_AVG:
-	  {
-	    int i;
-
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up >> 1;
-
-	    for (; i < data->row_bytes; i++, cur++, up++, left++)
-	      *cur += ((int) *up + (int) *left) >> 1;
-
-	    break;
-	  }
-	case PNG_FILTER_VALUE_PAETH:
-	  {
-	    int i;
-	    grub_uint8_t *upper_left = up;
-
-	    for (i = 0; i < data->bpp; i++, cur++, up++)
-	      *cur += *up;
-
-	    for (; i < data->row_bytes; i++, cur++, up++, left++, upper_left++)
-	      {
-		int a, b, c, pa, pb, pc;
-
-                a = *left;
-                b = *up;
-                c = *upper_left;
-
-                pa = b - c;
-                pb = a - c;
-                pc = pa + pb;
-
-                if (pa < 0)
-                  pa = -pa;
-
-                if (pb < 0)
-                  pb = -pb;
-
-                if (pc < 0)
-                  pc = -pc;
-
-                *cur += ((pa <= pb) && (pa <= pc)) ? a : (pb <= pc) ? b : c;
-	      }
-	  }
-	}
+      grub_png_unfilter_row (data, cur, up, data->cur_filter);
 
       grub_free (blank_line);
 
@@ -813,6 +862,112 @@ grub_png_decode_image_data (struct grub_png_data *data)
   return grub_errno;
 }
 
+/* Decode the image data with the inflate code gzio shares, which is much
+   faster than the bytewise decoder above: read the IDAT chunks starting
+   with the one of length LEN into memory, inflate them into a buffer of
+   filtered rows and unfilter those as they are copied out.  Returns 0,
+   having read nothing, when the memory for that is not available and
+   the data has to be decoded as a stream instead.  */
+static int
+grub_png_inflate_image_data (struct grub_png_data *data, grub_uint32_t len)
+{
+  grub_uint8_t *zbuf = NULL, *raw = NULL, *blank_line = NULL;
+  grub_uint8_t *dst;
+  grub_size_t zsize = 0, avail;
+  grub_ssize_t n;
+  unsigned y;
+
+  if (! data->cur_rgb || ! data->first_line
+      || data->file->size == GRUB_FILE_SIZE_UNKNOWN
+      || data->file->size < data->file->offset)
+    return 0;
+
+  avail = data->file->size - data->file->offset;
+  zbuf = grub_malloc (avail);
+  raw = grub_malloc (data->raw_bytes);
+  blank_line = grub_zalloc (data->row_bytes);
+  if (! zbuf || ! raw || ! blank_line)
+    {
+      grub_free (zbuf);
+      grub_free (raw);
+      grub_free (blank_line);
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  while (1)
+    {
+      grub_off_t pos;
+
+      if (len > avail - zsize)
+	{
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: chunk size error");
+	  goto fail;
+	}
+      if (grub_file_read (data->file, zbuf + zsize, len) != (grub_ssize_t) len)
+	{
+	  if (! grub_errno)
+	    grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: unexpected end of data");
+	  goto fail;
+	}
+      zsize += len;
+
+      /* Skip crc checksum.  */
+      grub_png_get_dword (data);
+
+      if (data->file->offset != data->next_offset)
+	{
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: chunk size error");
+	  goto fail;
+	}
+
+      /* Leave the next chunk to the caller unless it continues the data.  */
+      pos = data->file->offset;
+      len = grub_png_get_dword (data);
+      if (grub_png_get_dword (data) != PNG_CHUNK_IDAT)
+	{
+	  grub_file_seek (data->file, pos);
+	  break;
+	}
+      data->next_offset = data->file->offset + len + 4;
+    }
+
+  n = grub_zlib_decompress ((char *) zbuf, zsize, 0, (char *) raw,
+			    data->raw_bytes);
+  if (n != data->raw_bytes)
+    {
+      if (! grub_errno)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, "png: image data truncated");
+      goto fail;
+    }
+
+  dst = data->cur_rgb;
+  for (y = 0; y < data->image_height; y++, dst += data->row_bytes)
+    {
+      const grub_uint8_t *row = raw + (grub_size_t) y * (data->row_bytes + 1);
+
+      if (row[0] >= PNG_FILTER_VALUE_LAST)
+	{
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "invalid filter value");
+	  goto fail;
+	}
+
+      grub_memcpy (dst, row + 1, data->row_bytes);
+      grub_png_unfilter_row (data, dst, y ? dst - data->row_bytes : blank_line,
+			     row[0]);
+    }
+
+  data->cur_rgb = dst;
+  data->raw_bytes = 0;
+  data->first_line = 0;
+
+ fail:
+  grub_free (zbuf);
+  grub_free (raw);
+  grub_free (blank_line);
+  return 1;
+}
+
 static const grub_uint8_t png_magic[8] =
   { 0x89, 0x50, 0x4e, 0x47, 0xd, 0xa, 0x1a, 0x0a };
 
@@ -1049,6 +1204,9 @@ grub_png_decode_png (struct grub_png_data *data)
 	  break;
 
 	case PNG_CHUNK_IDAT:
+	  if (grub_png_inflate_image_data (data, len))
+	    break;
+
 	  data->inside_idat = 1;
 	  data->idat_remain = len;
 	  data->bit_count = 0;
@@ -1086,7 +1244,7 @@ grub_video_reader_png (struct grub_video_bitmap **bitmap,
   grub_file_t file;
   struct grub_png_data *data;
 
-  file = grub_buffile_open (filename, 0);
+  file = grub_buffile_open (filename, 0, GRUB_BUFIO_HINT_SEQUENTIAL);
   if (!file)
     return grub_errno;
 
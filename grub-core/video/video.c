@@ -22,6 +22,8 @@
 #include <grub/misc.h>
 #include <grub/mm.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
+#include <grub/file.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -531,6 +533,59 @@ parse_modespec (const char *current_mode, int *width, int *height, int *depth)
   return GRUB_ERR_NONE;
 }
 
+#ifndef GRUB_UTIL
+/* Load the drivers in video.lst the first time they are needed, so that
+   configurations don't have to insmod them up front.  */
+void
+grub_video_autoload (void)
+{
+  static int loaded;
+  const char *prefix;
+  char *filename, *buf, *name, *end;
+  grub_file_t file;
+  grub_ssize_t size;
+
+  if (loaded || grub_no_modules)
+    return;
+  prefix = grub_env_get ("prefix");
+  if (! prefix)
+    return;
+
+  filename = grub_xasprintf ("%s/" GRUB_TARGET_CPU "-" GRUB_PLATFORM
+			     "/video.lst", prefix);
+  file = filename ? grub_file_open (filename) : 0;
+  grub_free (filename);
+  if (! file)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  loaded = 1;
+
+  size = grub_file_size (file);
+  buf = grub_malloc (size + 1);
+  if (buf && grub_file_read (file, buf, size) == size)
+    {
+      buf[size] = '\0';
+      for (name = buf; *name; name = end)
+	{
+	  while (grub_isspace (*name))
+	    name++;
+	  for (end = name; grub_isgraph (*end); end++);
+	  if (*end)
+	    *end++ = '\0';
+	  if (*name && ! grub_dl_get (name))
+	    grub_dl_load (name);
+	  /* A driver which finds no hardware is no reason to stop.  */
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+  grub_free (buf);
+  grub_errno = GRUB_ERR_NONE;
+  grub_file_close (file);
+}
+#endif
+
 grub_err_t
 grub_video_set_mode (const char *modestring,
 		     unsigned int modemask,
@@ -694,6 +749,10 @@ grub_video_set_mode (const char *modestring,
       /* Try to initialize requested mode.  Ignore any errors.  */
       grub_video_adapter_t p;
 
+#ifndef GRUB_UTIL
+      grub_video_autoload ();
+#endif
+
       /* Loop thru all possible video adapter trying to find requested mode.  */
       for (p = grub_video_adapter_list; p; p = p->next)
 	{
@@ -47,6 +47,17 @@ struct grub_archelp_ops
 
   void
   (*rewind) (struct grub_archelp_data *data);
+
+  /* Optional, for the name index: where the next find_file reads its
+     header, start reading there instead, and the disk being read.  */
+  grub_off_t
+  (*tell) (struct grub_archelp_data *data);
+
+  void
+  (*seek) (struct grub_archelp_data *data, grub_off_t pos);
+
+  grub_disk_t
+  (*get_disk) (struct grub_archelp_data *data);
 };
 
 grub_err_t
@@ -26,4 +26,7 @@ grub_cpu_idle (void)
 /*  __asm__ __volatile__ ("wfi"); */
 }
 
+/* Use the generic timer for grub_get_cycles, if there is one.  */
+void grub_arm_timer_init (void);
+
 #endif /* ! KERNEL_CPU_TIME_HEADER */
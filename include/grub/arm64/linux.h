@@ -27,14 +27,19 @@
 #define BYTES_TO_PAGES(bytes)   (((bytes) + 0xfff) >> GRUB_EFI_PAGE_SHIFT)
 #define GRUB_EFI_PE_MAGIC	0x5A4D
 
+/* The kernel wants to sit TEXT_OFFSET bytes above a boundary of this.  */
+#define GRUB_ARM64_LINUX_ALIGN	0x200000
+/* Assumed when the header has no image_size, as before Linux 3.17.  */
+#define GRUB_ARM64_LINUX_TEXT_OFFSET	0x80000
+
 /* From linux/Documentation/arm64/booting.txt */
 struct grub_arm64_linux_kernel_header
 {
   grub_uint32_t code0;		/* Executable code */
   grub_uint32_t code1;		/* Executable code */
   grub_uint64_t text_offset;    /* Image load offset */
-  grub_uint64_t res0;		/* reserved */
-  grub_uint64_t res1;		/* reserved */
+  grub_uint64_t image_size;	/* Effective Image size, 0 before 3.17 */
+  grub_uint64_t flags;		/* Kernel flags */
   grub_uint64_t res2;		/* reserved */
   grub_uint64_t res3;		/* reserved */
   grub_uint64_t res4;		/* reserved */
@@ -47,6 +52,6 @@ void *grub_linux_get_fdt (void);
 grub_err_t grub_arm64_uefi_check_image (struct grub_arm64_linux_kernel_header
                                         *lh);
 grub_err_t grub_arm64_uefi_boot_image (grub_addr_t addr, grub_size_t size,
-                                       char *args);
+                                       grub_uint32_t entry, char *args);
 
 #endif /* ! GRUB_LINUX_CPU_HEADER */
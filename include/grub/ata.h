@@ -85,6 +85,7 @@ enum grub_ata_commands
     GRUB_ATA_CMD_READ_SECTORS_EXT	= 0x24,
     GRUB_ATA_CMD_READ_SECTORS_DMA	= 0xc8,
     GRUB_ATA_CMD_READ_SECTORS_DMA_EXT	= 0x25,
+    GRUB_ATA_CMD_READ_FPDMA_QUEUED	= 0x60,
 
     GRUB_ATA_CMD_SECURITY_FREEZE_LOCK	= 0xf5,
     GRUB_ATA_CMD_SET_FEATURES		= 0xef,
@@ -161,6 +162,9 @@ struct grub_disk_ata_pass_through_parms
   int dma;
 };
 
+/* Maximum number of NCQ tags defined by SATA.  */
+#define GRUB_ATA_MAX_NCQ_DEPTH 32
+
 struct grub_ata
 {
   /* Addressing methods available for accessing this device.  If CHS
@@ -182,6 +186,12 @@ struct grub_ata
 
   int dma;
 
+  /* Number of commands that may be in flight at once through native
+     command queuing, 0 if NCQ is not used.  Set by the backend to what
+     the controller supports and lowered to the device's limit on
+     identification.  */
+  int ncq_depth;
+
   grub_size_t maxbuffer;
 
   int *present;
@@ -213,6 +223,14 @@ struct grub_ata_dev
 			   struct grub_disk_ata_pass_through_parms *parms,
 			   int spinup);
 
+  /* Issue the N GRUB_ATA_CMD_READ_FPDMA_QUEUED commands in PARMS at
+     once.  The sector count is passed in the same registers as for any
+     other LBA48 command; the driver moves it where NCQ expects it and
+     assigns the tags.  Optional.  */
+  grub_err_t (*readwrite_queued) (struct grub_ata *ata,
+				  struct grub_disk_ata_pass_through_parms *parms,
+				  int n);
+
   /* The next scsi device.  */
   struct grub_ata_dev *next;
 };
@@ -42,6 +42,12 @@ struct grub_video_bitmap_reader
   grub_err_t (*reader) (struct grub_video_bitmap **bitmap,
                         const char *filename);
 
+  /* Optional reader that may reduce the image on the way, as long as it
+     stays at least min_width x min_height.  */
+  grub_err_t (*reader_scaled) (struct grub_video_bitmap **bitmap,
+                               const char *filename,
+                               unsigned min_width, unsigned min_height);
+
   /* Next reader.  */
   struct grub_video_bitmap_reader *next;
 };
@@ -59,6 +65,14 @@ grub_err_t EXPORT_FUNC (grub_video_bitmap_destroy) (struct grub_video_bitmap *bi
 grub_err_t EXPORT_FUNC (grub_video_bitmap_load) (struct grub_video_bitmap **bitmap,
 						 const char *filename);
 
+grub_err_t EXPORT_FUNC (grub_video_bitmap_load_scaled) (struct grub_video_bitmap **bitmap,
+							const char *filename,
+							unsigned min_width,
+							unsigned min_height);
+
+grub_err_t EXPORT_FUNC (grub_video_bitmap_convert) (struct grub_video_bitmap **bitmap,
+						    enum grub_video_blit_format format);
+
 /* Return bitmap width.  */
 static inline unsigned int
 grub_video_bitmap_get_width (struct grub_video_bitmap *bitmap)
@@ -22,7 +22,16 @@
 
 #include <grub/file.h>
 
-grub_file_t EXPORT_FUNC (grub_bufio_open) (grub_file_t io, int size);
-grub_file_t EXPORT_FUNC (grub_buffile_open) (const char *name, int size);
+/* How the caller is going to read the file.  Sequential readers get
+   their large reads copied straight into their buffer; the buffer of
+   random readers doesn't grow.  */
+#define GRUB_BUFIO_HINT_NONE		0
+#define GRUB_BUFIO_HINT_SEQUENTIAL	1
+#define GRUB_BUFIO_HINT_RANDOM		2
+
+grub_file_t EXPORT_FUNC (grub_bufio_open) (grub_file_t io, int size,
+					   int hint);
+grub_file_t EXPORT_FUNC (grub_buffile_open) (const char *name, int size,
+					     int hint);
 
 #endif /* ! GRUB_BUFIO_H */
@@ -75,11 +75,19 @@ struct grub_command
 
   /* Arbitrary data.  */
   void *data;
+
+  /* The next command in the same hash bucket, if this is the first
+     command of its name.  */
+  struct grub_command *hash_next;
 };
 typedef struct grub_command *grub_command_t;
 
 extern grub_command_t EXPORT_VAR(grub_command_list);
 
+/* Changed whenever a command is registered or unregistered, so lookups
+   can be cached.  */
+extern unsigned EXPORT_VAR(grub_command_generation);
+
 grub_command_t
 EXPORT_FUNC(grub_register_command_prio) (const char *name,
 					 grub_command_func_t func,
@@ -106,11 +114,7 @@ grub_register_command_p1 (const char *name,
   return grub_register_command_prio (name, func, summary, description, 1);
 }
 
-static inline grub_command_t
-grub_command_find (const char *name)
-{
-  return grub_named_list_find (GRUB_AS_NAMED_LIST (grub_command_list), name);
-}
+grub_command_t EXPORT_FUNC(grub_command_find) (const char *name);
 
 static inline grub_err_t
 grub_command_execute (const char *name, int argc, char **argv)
@@ -117,6 +117,13 @@ typedef void (*gcry_cipher_stdecrypt_t) (void *c,
 					 const unsigned char *inbuf,
 					 unsigned int n);
 
+/* Type for the cipher_encrypt_blocks and cipher_decrypt_blocks
+   functions.  */
+typedef void (*gcry_cipher_blocks_t) (void *c,
+				      unsigned char *outbuf,
+				      const unsigned char *inbuf,
+				      grub_size_t nblocks);
+
 typedef struct gcry_cipher_oid_spec
 {
   const char *oid;
@@ -140,6 +147,12 @@ typedef struct gcry_cipher_spec
 #ifdef GRUB_UTIL
   const char *modname;
 #endif
+  /* Implementations registering under the same name are looked up in
+     decreasing order of priority.  The generic ones leave it at 0.  */
+  int priority;
+  /* Optional.  Process NBLOCKS consecutive blocks in ECB mode at once.  */
+  gcry_cipher_blocks_t encrypt_blocks;
+  gcry_cipher_blocks_t decrypt_blocks;
   struct gcry_cipher_spec *next;
 } gcry_cipher_spec_t;
 
@@ -178,6 +191,8 @@ typedef struct gcry_md_spec
 #ifdef GRUB_UTIL
   const char *modname;
 #endif
+  /* As for ciphers, lookups prefer the highest priority.  */
+  int priority;
   struct gcry_md_spec *next;
 } gcry_md_spec_t;
 
@@ -393,6 +408,15 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 		    unsigned int c,
 		    grub_uint8_t *DK, grub_size_t dkLen);
 
+/* grub_crypto_pbkdf2 for HMAC-SHA256 and HMAC-SHA512 without going through
+   the generic HMAC.  Returns GPG_ERR_NOT_IMPLEMENTED for other digests.  */
+gcry_err_code_t
+grub_crypto_pbkdf2_sha2 (const struct gcry_md_spec *md,
+			 const grub_uint8_t *P, grub_size_t Plen,
+			 const grub_uint8_t *S, grub_size_t Slen,
+			 unsigned int c,
+			 grub_uint8_t *DK, grub_size_t dkLen);
+
 int
 grub_crypto_memcmp (const void *a, const void *b, grub_size_t n);
 
@@ -129,6 +129,12 @@ grub_cryptodisk_dev_unregister (grub_cryptodisk_dev_t cr)
 
 #define FOR_CRYPTODISK_DEVS(var) FOR_LIST_ELEMENTS((var), (grub_cryptodisk_list))
 
+/* Look up CIPHERNAME and set up the mode and IV generation CIPHERMODE
+   describes, e.g. "xts-plain64", for CRYPT.  What CRYPT had before is
+   only released on success.  */
+grub_err_t
+grub_cryptodisk_setcipher (grub_cryptodisk_t crypt, const char *ciphername,
+			   const char *ciphermode);
 gcry_err_code_t
 grub_cryptodisk_setkey (grub_cryptodisk_t dev,
 			grub_uint8_t *key, grub_size_t keysize);
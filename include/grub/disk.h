@@ -49,6 +49,9 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_CBFSDISK_ID,
     GRUB_DISK_DEVICE_UBOOTDISK_ID,
     GRUB_DISK_DEVICE_XEN,
+    GRUB_DISK_DEVICE_NVME_ID,
+    GRUB_DISK_DEVICE_HTTPDISK_ID,
+    GRUB_DISK_DEVICE_ISCSI_ID,
   };
 
 struct grub_disk;
@@ -66,6 +69,17 @@ typedef enum
 
 typedef int (*grub_disk_dev_iterate_hook_t) (const char *name, void *data);
 
+/* One piece of a vectored read.  For grub_disk_read_vec SECTOR is in
+   512-byte units relative to the partition and SIZE is in bytes.  For
+   the read_vec device callback SECTOR is in device sectors relative to the
+   disk and SIZE is the number of device sectors.  */
+struct grub_disk_vec
+{
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  char *buf;
+};
+
 /* Disk device.  */
 struct grub_disk_dev
 {
@@ -93,6 +107,23 @@ struct grub_disk_dev
   grub_err_t (*write) (struct grub_disk *disk, grub_disk_addr_t sector,
 		       grub_size_t size, const char *buf);
 
+  /* Read the N pieces described by VEC at once.  Optional; no piece is
+     larger than the maximum agglomerate of DISK.  */
+  grub_err_t (*read_vec) (struct grub_disk *disk,
+			  const struct grub_disk_vec *vec, grub_size_t n);
+
+  /* Read VEC[I] from DISKS[I] for every I below N, overlapping the reads
+     of the different disks.  Optional; all of DISKS belong to this device
+     and DONE[I] is set for every piece which was read.  */
+  grub_err_t (*read_multi) (struct grub_disk **disks,
+			    const struct grub_disk_vec *vec, grub_size_t n,
+			    char *done);
+
+  /* Return the address in memory of SECTOR, in 512-byte sectors, of DISK.
+     Optional, for devices whose contents are in memory already: reads
+     from them are copied from there and skip the disk cache.  */
+  char *(*map) (struct grub_disk *disk, grub_disk_addr_t sector);
+
 #ifdef GRUB_UTIL
   struct grub_disk_memberlist *(*memberlist) (struct grub_disk *disk);
   const char * (*raidname) (struct grub_disk *disk);
@@ -132,6 +163,19 @@ struct grub_disk
   /* The id used by the disk cache manager.  */
   unsigned long id;
 
+  /* The sector following the last read, used to detect sequential
+     streams.  */
+  grub_disk_addr_t read_ahead_next;
+
+  /* Current read-ahead window in GRUB_DISK_CACHE_SIZE units.  */
+  unsigned int read_ahead_window;
+
+  /* If set, reads of whole cache blocks bypass the disk cache.  */
+  int streaming;
+
+  /* I/O statistics of the underlying device, if collected.  */
+  struct grub_disk_stats *stats;
+
   /* The partition information. This is machine-specific.  */
   struct grub_partition *partition;
 
@@ -160,21 +204,49 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+/* The default number of disk cache entries.  */
+#define GRUB_DISK_CACHE_NUM	1024
+
+/* The number of entries in one set of the set-associative disk cache.  */
+#define GRUB_DISK_CACHE_WAYS	4
+
+/* Upper limit on the number of disk cache entries, 2GiB worth of data.  */
+#define GRUB_DISK_CACHE_MAX_NUM	65536
 
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
 #define GRUB_DISK_CACHE_BITS	6
 #define GRUB_DISK_CACHE_SIZE	(1 << GRUB_DISK_CACHE_BITS)
 
+/* Bounds of the read-ahead window, 128KiB to 4MiB.  */
+#define GRUB_DISK_READ_AHEAD_MIN (131072 >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS))
+#define GRUB_DISK_READ_AHEAD_MAX (4194304 >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS))
+
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
 #define GRUB_DISK_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
-/* This is called from the memory manager.  */
+/* These are called from the memory manager.  */
 void grub_disk_cache_invalidate_all (void);
+/* Free the least recently used blocks until BYTES are freed, returning
+   how much was.  */
+grub_size_t grub_disk_cache_shrink (grub_size_t bytes);
+
+/* Called by grub_disk_cache_invalidate_all, so that caches built on top
+   of the disk cache are dropped along with it.  */
+extern void (*EXPORT_VAR(grub_disk_cache_invalidate_hook)) (void);
+
+/* Called by grub_disk_read with its arguments, unless DISK is streaming,
+   so that the reads of a boot can be recorded.  */
+extern void (*EXPORT_VAR(grub_disk_profile_hook)) (grub_disk_t disk,
+						   grub_disk_addr_t sector,
+						   grub_off_t offset,
+						   grub_size_t size);
+
+/* Change the number of disk cache entries to NUM, rounded up to a whole
+   number of sets.  Cached data is dropped.  */
+grub_err_t EXPORT_FUNC(grub_disk_cache_resize) (unsigned num);
 
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
@@ -199,6 +271,38 @@ grub_err_t EXPORT_FUNC(grub_disk_read) (grub_disk_t disk,
 					grub_off_t offset,
 					grub_size_t size,
 					void *buf);
+grub_err_t EXPORT_FUNC(grub_disk_read_vec) (grub_disk_t disk,
+					    const struct grub_disk_vec *vec,
+					    grub_size_t n);
+void *EXPORT_FUNC(grub_disk_map) (grub_disk_t disk, grub_disk_addr_t sector,
+				  grub_off_t offset, grub_size_t size);
+
+/* A read queued by grub_disk_queue_read.  The caller owns it and must
+   keep it, and DISK open, until DONE is called.  */
+struct grub_disk_request
+{
+  struct grub_disk_request *next;
+  grub_disk_t disk;
+  /* As for grub_disk_read, with no offset.  */
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  void *buf;
+  /* Read-ahead is issued after all demand reads.  */
+  int readahead;
+  /* Called with the result once the read is over.  It may queue more
+     reads, which are issued by the same grub_disk_run_queue.  */
+  void (*done) (struct grub_disk_request *req, grub_err_t err);
+  void *data;
+};
+
+void EXPORT_FUNC(grub_disk_queue_read) (struct grub_disk_request *req);
+grub_err_t EXPORT_FUNC(grub_disk_run_queue) (void);
+void EXPORT_FUNC(grub_disk_prefetch) (grub_disk_t *disks, grub_size_t n,
+				      grub_disk_addr_t sector,
+				      grub_size_t size);
+void EXPORT_FUNC(grub_disk_preload) (grub_disk_t disk,
+				     grub_disk_addr_t sector,
+				     grub_size_t size);
 grub_err_t grub_disk_write (grub_disk_t disk,
 			    grub_disk_addr_t sector,
 			    grub_off_t offset,
@@ -216,6 +320,37 @@ grub_uint64_t EXPORT_FUNC(grub_disk_get_size) (grub_disk_t disk);
 #if DISK_CACHE_STATS
 void
 EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
+
+#define GRUB_DISK_STATS_LATENCY_BUCKETS 16
+
+/* Counters kept for every disk read from since startup.  Sectors are
+   GRUB_DISK_SECTOR_SIZE units.  */
+struct grub_disk_stats
+{
+  struct grub_disk_stats *next;
+  struct grub_disk_stats **prev;
+  unsigned long dev_id;
+  unsigned long disk_id;
+  char *name;
+
+  /* Calls to grub_disk_read and the bytes they asked for.  */
+  unsigned long requests;
+  grub_uint64_t bytes;
+
+  /* Sectors served by the disk cache and read from the device.  */
+  grub_uint64_t cached_sectors;
+  grub_uint64_t device_sectors;
+
+  /* Calls into the driver and the time they took.  Bucket 0 of the
+     histogram counts reads that took less than 1 ms, bucket I those
+     that took between 2^(I-1) and 2^I - 1 ms.  The last bucket takes
+     everything longer.  */
+  unsigned long device_reads;
+  grub_uint64_t device_ms;
+  unsigned long latency[GRUB_DISK_STATS_LATENCY_BUCKETS];
+};
+
+extern struct grub_disk_stats *EXPORT_VAR(grub_disk_stats_list);
 #endif
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
@@ -241,9 +376,14 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  /* Value of the cache clock at the last access, for LRU replacement.  */
+  unsigned long last_used;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+/* The cache table consists of grub_disk_cache_sets sets of
+   GRUB_DISK_CACHE_WAYS consecutive entries.  */
+extern struct grub_disk_cache *EXPORT_VAR(grub_disk_cache_table);
+extern unsigned EXPORT_VAR(grub_disk_cache_sets);
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
@@ -72,6 +72,12 @@ struct grub_diskfilter_pv {
   struct grub_diskfilter_pv *next;
   /* Optional.  */
   grub_uint8_t *internal_id;
+  /* Reads of mirrored data from this volume so far: sectors and time
+     taken by the large ones, and failures.  Used to order the members
+     of mirrors.  */
+  grub_uint64_t mirror_sectors;
+  grub_uint64_t mirror_ms;
+  unsigned int mirror_errors;
 #ifdef GRUB_UTIL
   char **partmaps;
 #endif
@@ -148,11 +154,16 @@ struct grub_diskfilter
 typedef struct grub_diskfilter *grub_diskfilter_t;
 
 extern grub_diskfilter_t grub_diskfilter_list;
+/* Bumped whenever grub_diskfilter_list changes, so that disks already
+   scanned get probed again by the new set of backends.  */
+extern unsigned int grub_diskfilter_list_generation;
+
 static inline void
 grub_diskfilter_register_front (grub_diskfilter_t diskfilter)
 {
   grub_list_push (GRUB_AS_LIST_P (&grub_diskfilter_list),
 		  GRUB_AS_LIST (diskfilter));
+  grub_diskfilter_list_generation++;
 }
 
 static inline void
@@ -163,11 +174,13 @@ grub_diskfilter_register_back (grub_diskfilter_t diskfilter)
   diskfilter->next = NULL;
   diskfilter->prev = q;
   *q = diskfilter;
+  grub_diskfilter_list_generation++;
 }
 static inline void
 grub_diskfilter_unregister (grub_diskfilter_t diskfilter)
 {
   grub_list_remove (GRUB_AS_LIST (diskfilter));
+  grub_diskfilter_list_generation++;
 }
 
 struct grub_diskfilter_vg *
@@ -192,6 +192,11 @@ struct grub_dl
 #endif
   void *base;
   grub_size_t sz;
+  /* What loading it cost, in nanoseconds, for lsmod -v: reading its file,
+     linking it (without its dependencies) and running its init.  */
+  grub_uint64_t read_ns;
+  grub_uint64_t link_ns;
+  grub_uint64_t init_ns;
   struct grub_dl *next;
 };
 #endif
@@ -199,6 +204,7 @@ typedef struct grub_dl *grub_dl_t;
 
 grub_dl_t grub_dl_load_file (const char *filename);
 grub_dl_t EXPORT_FUNC(grub_dl_load) (const char *name);
+grub_err_t grub_dl_load_batch (int count, char **names);
 grub_dl_t grub_dl_load_core (void *addr, grub_size_t size);
 grub_dl_t EXPORT_FUNC(grub_dl_load_core_noinit) (void *addr, grub_size_t size);
 int EXPORT_FUNC(grub_dl_unload) (grub_dl_t mod);
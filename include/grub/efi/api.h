@@ -86,6 +86,11 @@
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
   }
 
+#define GRUB_EFI_BLOCK_IO2_GUID	\
+  { 0xa77b2472, 0xe282, 0x4e9f, \
+    { 0xa2, 0x45, 0xc2, 0xc0, 0xe2, 0x7b, 0xbc, 0xc1 } \
+  }
+
 #define GRUB_EFI_SERIAL_IO_GUID \
   { 0xbb25cf6f, 0xf1d4, 0x11d2, \
     { 0x9a, 0x0c, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0xfd } \
@@ -101,6 +106,16 @@
     { 0x9a, 0x2d, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } \
   }
 
+#define GRUB_EFI_MANAGED_NETWORK_SERVICE_BINDING_GUID	\
+  { 0xf36ff770, 0xa7e1, 0x42cf, \
+    { 0x9e, 0xd2, 0x56, 0xf0, 0xf2, 0x71, 0xf4, 0x4c } \
+  }
+
+#define GRUB_EFI_MANAGED_NETWORK_GUID	\
+  { 0x7ab33a91, 0xace5, 0x4326, \
+    { 0xb5, 0x72, 0xe7, 0xee, 0x33, 0xd3, 0x9f, 0x16 } \
+  }
+
 #define GRUB_EFI_DEVICE_PATH_GUID	\
   { 0x09576e91, 0x6d3f, 0x11d2, \
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
@@ -146,6 +161,17 @@
     { 0x8E, 0x3F, 0x00, 0xA0, 0xC9, 0x69, 0x72, 0x3B } \
   }
 
+#define GRUB_EFI_LOAD_FILE2_PROTOCOL_GUID \
+  { 0x4006c0c1, 0xfcb3, 0x403e, \
+    { 0x99, 0x6d, 0x4a, 0x6c, 0x87, 0x24, 0xe0, 0x6d } \
+  }
+
+/* The vendor media device path under which Linux looks for its initrd.  */
+#define GRUB_EFI_LINUX_INITRD_MEDIA_GUID \
+  { 0x5568e427, 0x68fc, 0x4f3d, \
+    { 0xac, 0x74, 0xca, 0x55, 0x52, 0x31, 0xcc, 0x68 } \
+  }
+
 #define GRUB_EFI_SIMPLE_FILE_SYSTEM_PROTOCOL_GUID \
   { 0x0964e5b22, 0x6459, 0x11d2, \
     { 0x8e, 0x39, 0x00, 0xa0, 0xc9, 0x69, 0x72, 0x3b } \
@@ -246,6 +272,11 @@
     { 0x8E, 0x8B, 0xBB, 0xA2, 0x0B, 0x1B, 0x5B, 0x75 } \
   }
 
+#define GRUB_EFI_MP_SERVICES_PROTOCOL_GUID \
+  { 0x3fdda605, 0xa76e, 0x4f46, \
+    { 0xad, 0x29, 0x12, 0xf4, 0x53, 0x1b, 0x3d, 0x08 } \
+  }
+
 #define GRUB_EFI_MPS_TABLE_GUID	\
   { 0xeb9d2d2f, 0x2d88, 0x11d3, \
     { 0x9a, 0x16, 0x00, 0x90, 0x27, 0x3f, 0xc1, 0x4d } \
@@ -281,6 +312,12 @@
       { 0x83, 0x0b, 0xd9, 0x15, 0x2c, 0x69, 0xaa, 0xe0 } \
   }
 
+/* The boot trace GRUB leaves behind when built with boot time stats.  */
+#define GRUB_EFI_GRUB_TRACE_TABLE_GUID \
+  { 0x6b2e7d15, 0x3c4a, 0x4f0e, \
+      { 0x9d, 0x58, 0x21, 0xa3, 0xc6, 0x0b, 0x7e, 0x94 } \
+  }
+
 #define GRUB_EFI_VENDOR_APPLE_GUID \
   { 0x2B0585EB, 0xD8B8, 0x49A9,	\
       { 0x8B, 0x8C, 0xE2, 0x1B, 0x01, 0xAE, 0xF2, 0xB7 } \
@@ -1217,6 +1254,10 @@ struct grub_efi_runtime_services
 #define GRUB_EFI_GLOBAL_VARIABLE_GUID \
   { 0x8BE4DF61, 0x93CA, 0x11d2, { 0xAA, 0x0D, 0x00, 0xE0, 0x98, 0x03, 0x2B,0x8C }}
 
+/* Vendor GUID of the variables GRUB keeps for itself.  */
+#define GRUB_EFI_GRUB_VARIABLE_GUID \
+  { 0x91376aff, 0xcba6, 0x42be, { 0x94, 0x9d, 0x06, 0xfd, 0xe8, 0x11, 0x28, 0xe8 }}
+
 
   grub_efi_status_t
   (*get_variable) (grub_efi_char16_t *variable_name,
@@ -1573,6 +1614,128 @@ struct grub_efi_block_io
 };
 typedef struct grub_efi_block_io grub_efi_block_io_t;
 
+struct grub_efi_block_io2_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t transaction_status;
+};
+typedef struct grub_efi_block_io2_token grub_efi_block_io2_token_t;
+
+struct grub_efi_block_io2
+{
+  grub_efi_block_io_media_t *media;
+  grub_efi_status_t (*reset) (struct grub_efi_block_io2 *this,
+			      grub_efi_boolean_t extended_verification);
+  grub_efi_status_t (*read_blocks_ex) (struct grub_efi_block_io2 *this,
+				       grub_efi_uint32_t media_id,
+				       grub_efi_lba_t lba,
+				       grub_efi_block_io2_token_t *token,
+				       grub_efi_uintn_t buffer_size,
+				       void *buffer);
+  grub_efi_status_t (*write_blocks_ex) (struct grub_efi_block_io2 *this,
+					grub_efi_uint32_t media_id,
+					grub_efi_lba_t lba,
+					grub_efi_block_io2_token_t *token,
+					grub_efi_uintn_t buffer_size,
+					void *buffer);
+  grub_efi_status_t (*flush_blocks_ex) (struct grub_efi_block_io2 *this,
+					grub_efi_block_io2_token_t *token);
+};
+typedef struct grub_efi_block_io2 grub_efi_block_io2_t;
+
+struct grub_efi_service_binding
+{
+  grub_efi_status_t (*create_child) (struct grub_efi_service_binding *this,
+				     grub_efi_handle_t *child_handle);
+  grub_efi_status_t (*destroy_child) (struct grub_efi_service_binding *this,
+				      grub_efi_handle_t child_handle);
+};
+typedef struct grub_efi_service_binding grub_efi_service_binding_t;
+
+struct grub_efi_managed_network_config_data
+{
+  grub_efi_uint32_t received_queue_timeout_value;
+  grub_efi_uint32_t transmit_queue_timeout_value;
+  grub_efi_uint16_t protocol_type_filter;
+  grub_efi_boolean_t enable_unicast_receive;
+  grub_efi_boolean_t enable_multicast_receive;
+  grub_efi_boolean_t enable_broadcast_receive;
+  grub_efi_boolean_t enable_promiscuous_receive;
+  grub_efi_boolean_t flush_queues_on_reset;
+  grub_efi_boolean_t enable_receive_timestamps;
+  grub_efi_boolean_t disable_background_polling;
+};
+typedef struct grub_efi_managed_network_config_data grub_efi_managed_network_config_data_t;
+
+struct grub_efi_managed_network_receive_data
+{
+  grub_efi_time_t timestamp;
+  grub_efi_event_t recycle_event;
+  grub_efi_uint32_t packet_length;
+  grub_efi_uint32_t header_length;
+  grub_efi_uint32_t address_length;
+  grub_efi_uint32_t data_length;
+  grub_efi_boolean_t broadcast_flag;
+  grub_efi_boolean_t multicast_flag;
+  grub_efi_boolean_t promiscuous_flag;
+  grub_efi_uint16_t protocol_type;
+  void *destination_address;
+  void *source_address;
+  void *media_header;
+  void *packet_data;
+};
+typedef struct grub_efi_managed_network_receive_data grub_efi_managed_network_receive_data_t;
+
+struct grub_efi_managed_network_fragment_data
+{
+  grub_efi_uint32_t fragment_length;
+  void *fragment_buffer;
+};
+typedef struct grub_efi_managed_network_fragment_data grub_efi_managed_network_fragment_data_t;
+
+struct grub_efi_managed_network_transmit_data
+{
+  grub_efi_mac_t *destination_address;
+  grub_efi_mac_t *source_address;
+  grub_efi_uint16_t protocol_type;
+  grub_efi_uint32_t data_length;
+  grub_efi_uint16_t header_length;
+  grub_efi_uint16_t fragment_count;
+  grub_efi_managed_network_fragment_data_t fragment_table[1];
+};
+typedef struct grub_efi_managed_network_transmit_data grub_efi_managed_network_transmit_data_t;
+
+struct grub_efi_managed_network_completion_token
+{
+  grub_efi_event_t event;
+  grub_efi_status_t status;
+  union
+  {
+    grub_efi_managed_network_receive_data_t *rx_data;
+    grub_efi_managed_network_transmit_data_t *tx_data;
+  } packet;
+};
+typedef struct grub_efi_managed_network_completion_token grub_efi_managed_network_completion_token_t;
+
+struct grub_efi_managed_network
+{
+  grub_efi_status_t (*get_mode_data) (struct grub_efi_managed_network *this,
+				      grub_efi_managed_network_config_data_t *mnp_config,
+				      struct grub_efi_simple_network_mode *snp_mode);
+  grub_efi_status_t (*configure) (struct grub_efi_managed_network *this,
+				  grub_efi_managed_network_config_data_t *mnp_config);
+  void (*mcast_ip_to_mac) (void);
+  void (*groups) (void);
+  grub_efi_status_t (*transmit) (struct grub_efi_managed_network *this,
+				 grub_efi_managed_network_completion_token_t *token);
+  grub_efi_status_t (*receive) (struct grub_efi_managed_network *this,
+				grub_efi_managed_network_completion_token_t *token);
+  grub_efi_status_t (*cancel) (struct grub_efi_managed_network *this,
+			       grub_efi_managed_network_completion_token_t *token);
+  grub_efi_status_t (*poll) (struct grub_efi_managed_network *this);
+};
+typedef struct grub_efi_managed_network grub_efi_managed_network_t;
+
 #if (GRUB_TARGET_SIZEOF_VOID_P == 4) || defined (__ia64__) \
   || defined (__aarch64__) || defined (__MINGW64__) || defined (__CYGWIN__)
 
@@ -1586,8 +1749,13 @@ typedef struct grub_efi_block_io grub_efi_block_io_t;
 #define efi_call_7(func, a, b, c, d, e, f, g) func(a, b, c, d, e, f, g)
 #define efi_call_10(func, a, b, c, d, e, f, g, h, i, j)	func(a, b, c, d, e, f, g, h, i, j)
 
+/* For functions GRUB hands to the firmware or the OS to call.  */
+#define GRUB_EFI_ABI
+
 #else
 
+#define GRUB_EFI_ABI	__attribute__ ((ms_abi))
+
 #define efi_call_0(func) \
   efi_wrap_0(func)
 #define efi_call_1(func, a) \
@@ -1645,4 +1813,35 @@ grub_uint64_t EXPORT_FUNC(efi_wrap_10) (void *func, grub_uint64_t arg1,
                                         grub_uint64_t arg10);
 #endif
 
+/* PI Multi-Processor Services.  Only the members GRUB calls are typed.  */
+struct grub_efi_mp_services
+{
+  grub_efi_status_t (*get_number_of_processors) (struct grub_efi_mp_services *this,
+						 grub_efi_uintn_t *number,
+						 grub_efi_uintn_t *enabled);
+  void (*get_processor_info) (void);
+  grub_efi_status_t (*startup_all_aps) (struct grub_efi_mp_services *this,
+					void (GRUB_EFI_ABI *procedure) (void *arg),
+					grub_efi_boolean_t single_thread,
+					grub_efi_event_t wait_event,
+					grub_efi_uintn_t timeout,
+					void *arg,
+					grub_efi_uintn_t **failed_cpus);
+  void (*startup_this_ap) (void);
+  void (*switch_bsp) (void);
+  void (*enable_disable_ap) (void);
+  void (*who_am_i) (void);
+};
+typedef struct grub_efi_mp_services grub_efi_mp_services_t;
+
+struct grub_efi_load_file2
+{
+  grub_efi_status_t (GRUB_EFI_ABI *load_file) (struct grub_efi_load_file2 *this,
+					       grub_efi_device_path_t *file_path,
+					       grub_efi_boolean_t boot_policy,
+					       grub_efi_uintn_t *buffer_size,
+					       void *buffer);
+};
+typedef struct grub_efi_load_file2 grub_efi_load_file2_t;
+
 #endif /* ! GRUB_EFI_API_HEADER */
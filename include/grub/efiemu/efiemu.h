@@ -171,6 +171,7 @@ grub_err_t grub_efiemu_loadcore_unload(void);
 grub_err_t grub_efiemu_loadcore_init (grub_file_t file,
 				      const char *filename);
 grub_err_t grub_efiemu_loadcore_load (void);
+void grub_efiemu_loadcore_fini (void);
 
 /* Configuration tables manipulation. Definitions and functions */
 struct grub_efiemu_configuration_table
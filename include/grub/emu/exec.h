@@ -39,4 +39,15 @@ grub_util_exec_redirect (const char *const *argv, const char *stdin_file,
 int
 grub_util_exec_redirect_null (const char *const *argv);
 
+/* Let up to N jobs run at the same time.  */
+void
+grub_util_set_jobs (int n);
+/* Run FN (ARG) as a job, in a child process when more than one job may
+   run at a time.  The state of the caller is what the job sees.  */
+void
+grub_util_run_job (void (*fn) (void *arg), void *arg);
+/* Wait until all jobs are done, failing if one of them failed.  */
+void
+grub_util_wait_jobs (void);
+
 #endif
@@ -41,6 +41,8 @@ char *grub_make_system_path_relative_to_its_root (const char *path);
 char *
 grub_make_system_path_relative_to_its_root_os (const char *path);
 char *grub_util_get_grub_dev (const char *os_dev);
+void grub_util_dev_cache_open (const char *file);
+void grub_util_dev_cache_close (void);
 #if defined (__FreeBSD__) || defined(__FreeBSD_kernel__)
 void grub_util_follow_gpart_up (const char *name, grub_disk_addr_t *off_out,
 				char **name_out);
@@ -55,6 +55,9 @@ grub_util_ldm_embed (struct grub_disk *disk, unsigned int *nsectors,
 #endif
 const char *
 grub_hostdisk_os_dev_to_grub_drive (const char *os_dev, int add);
+/* The OS device of the Nth mapped drive, NULL past the last one.  */
+const char *
+grub_hostdisk_get_os_dev (unsigned int n);
 
 
 char *
@@ -75,6 +78,23 @@ grub_hostdisk_find_partition_start_os (const char *dev);
 void
 grub_hostdisk_flush_initial_buffer (const char *os_dev);
 
+#if defined (__linux__) && defined (USE_LIBURING)
+struct grub_util_fd_vec
+{
+  grub_uint64_t off;
+  grub_size_t len;
+  char *buf;
+};
+
+/* Read every piece of VEC from FD, all in flight at once through io_uring.
+   Returns 0 on success, -1 with errno set on error and 1 when io_uring
+   isn't usable, leaving all reads to the caller.  */
+int
+grub_hostdisk_linux_read_vec (grub_util_fd_t fd,
+			      const struct grub_util_fd_vec *vec,
+			      grub_size_t n);
+#endif
+
 #ifdef __GNU__
 int
 grub_util_hurd_get_disk_info (const char *dev, grub_uint32_t *secsize, grub_disk_addr_t *offset,
@@ -88,6 +108,9 @@ struct grub_util_hostdisk_data
   grub_util_fd_t fd;
   int is_disk;
   int device_map;
+  /* The whole disk mapped, or NULL to read through FD.  */
+  void *map;
+  grub_uint64_t map_size;
 };
 
 void grub_host_init (void);
@@ -53,6 +53,15 @@ void
 grub_util_disable_fd_syncs (void);
 void
 EXPORT_FUNC(grub_util_fd_close) (grub_util_fd_t fd);
+/* Map the first LEN bytes of FD, if it is a regular file or a disk, for
+   reading.  NULL if the OS can't.  The mapping outlives FD.  */
+void *
+grub_util_fd_map (grub_util_fd_t fd, grub_uint64_t len);
+void
+grub_util_fd_unmap (void *addr, grub_uint64_t len);
+/* Tell the OS that mappings made from now on are read front to back.  */
+void
+grub_util_fd_map_sequential (void);
 
 grub_uint64_t
 grub_util_get_fd_size (grub_util_fd_t fd, const char *name, unsigned *log_secsize);
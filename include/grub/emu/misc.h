@@ -59,6 +59,9 @@ char * EXPORT_FUNC(xasprintf) (const char *fmt, ...) __attribute__ ((format (__p
 void EXPORT_FUNC(grub_util_warn) (const char *fmt, ...) __attribute__ ((format (__printf__, 1, 2)));
 void EXPORT_FUNC(grub_util_info) (const char *fmt, ...) __attribute__ ((format (__printf__, 1, 2)));
 void EXPORT_FUNC(grub_util_error) (const char *fmt, ...) __attribute__ ((format (__printf__, 1, 2), noreturn));
+/* If set, grub_util_error calls it instead of exiting.  It must not
+   return.  */
+extern void (*EXPORT_VAR(grub_util_error_hook)) (void);
 
 grub_uint64_t EXPORT_FUNC (grub_util_get_cpu_time_ms) (void);
 
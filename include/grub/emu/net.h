@@ -34,4 +34,9 @@ EXPORT_FUNC(grub_emunet_create) (grub_size_t *mtu);
 void
 EXPORT_FUNC(grub_emunet_close) (void);
 
+/* Use a UDP socket on localhost, bound to the port before the colon and
+   sending to the one after, instead of a TAP device.  */
+int
+grub_emunet_set_udp (const char *spec);
+
 #endif
@@ -40,6 +40,7 @@ struct grub_env_var
   struct grub_env_var *next;
   struct grub_env_var **prevp;
   struct grub_env_var *sorted_next;
+  unsigned int hash;
   int global;
 };
 
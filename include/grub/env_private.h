@@ -21,14 +21,14 @@
 
 #include <grub/env.h>
 
-/* The size of the hash table.  */
-#define	HASHSZ	13
-
 /* A hashtable for quick lookup of variables.  */
 struct grub_env_context
 {
-  /* A hash table for variables.  */
-  struct grub_env_var *vars[HASHSZ];
+  /* A hash table for variables, SIZE buckets (a power of two, or 0 until
+     the first variable is set) holding COUNT variables.  */
+  struct grub_env_var **vars;
+  unsigned size;
+  unsigned count;
 
   /* One level deeper on the stack.  */
   struct grub_env_context *prev;
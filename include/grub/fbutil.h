@@ -56,4 +56,25 @@ grub_video_color_t get_pixel (struct grub_video_fbblit_info *source,
 void set_pixel (struct grub_video_fbblit_info *source,
                 unsigned int x, unsigned int y, grub_video_color_t color);
 
+#if defined (GRUB_MACHINE_EFI) && (defined (__x86_64__) || defined (__aarch64__))
+/* SSE2 and Advanced SIMD kernels for 32-bit pixels, working on blocks
+   of GRUB_VIDEO_FB_ACCEL_BLOCK pixels.  */
+#define GRUB_VIDEO_FB_ACCEL	1
+#define GRUB_VIDEO_FB_ACCEL_BLOCK	8
+
+void grub_video_fb_accel_fill32 (grub_uint32_t *dst, grub_uint32_t color,
+				 grub_size_t nblocks);
+void grub_video_fb_accel_swap32 (grub_uint32_t *dst, const grub_uint32_t *src,
+				 grub_size_t nblocks);
+void grub_video_fb_accel_blend32 (grub_uint32_t *dst,
+				  const grub_uint32_t *src,
+				  grub_size_t nblocks);
+void grub_video_fb_accel_blend32_swap (grub_uint32_t *dst,
+				       const grub_uint32_t *src,
+				       grub_size_t nblocks);
+
+/* Nonzero once the kernels have matched the C blitters.  */
+int grub_video_fb_accel (void);
+#endif
+
 #endif /* ! GRUB_VBEUTIL_MACHINE_HEADER */
@@ -52,6 +52,14 @@ struct grub_file
   /* If file is not easily seekable. Should be set by underlying layer.  */
   int not_easily_seekable;
 
+  /* If set, bulk reads of this file go straight into the destination
+     buffer without passing through the disk cache.  Set by the caller for
+     large files which are read only once, such as kernels and initrds.  */
+  int streaming;
+
+  /* If set, everything read from this file is measured into it.  */
+  struct grub_tpm_measure_ctx *measure;
+
   /* Filesystem-specific data.  */
   void *data;
 
@@ -65,6 +73,22 @@ typedef struct grub_file *grub_file_t;
 
 extern grub_disk_read_hook_t EXPORT_VAR(grub_file_progress_hook);
 
+/* Default total size of the file contents cache, in bytes.  Files larger
+   than a quarter of the total aren't cached.  */
+#define GRUB_FILE_CACHE_DEFAULT	524288
+
+extern grub_size_t EXPORT_VAR(grub_file_cache_max);
+
+/* Drop every cached file.  Files open from the cache keep their data.  */
+void EXPORT_FUNC(grub_file_cache_flush) (void);
+
+/* Limit the file contents cache to MAX bytes, 0 disabling it.  */
+void EXPORT_FUNC(grub_file_cache_resize) (grub_size_t max);
+
+/* Drop the least recently used files until BYTES are dropped, for the
+   memory manager.  Returns how much was.  */
+grub_size_t grub_file_cache_reclaim (grub_size_t bytes);
+
 /* Filters with lower ID are executed first.  */
 typedef enum grub_file_filter_id
   {
@@ -72,9 +96,12 @@ typedef enum grub_file_filter_id
     GRUB_FILE_FILTER_GZIO,
     GRUB_FILE_FILTER_XZIO,
     GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_ZSTDIO,
+    GRUB_FILE_FILTER_LZ4IO,
+    GRUB_FILE_FILTER_LZSSIO,
     GRUB_FILE_FILTER_MAX,
     GRUB_FILE_FILTER_COMPRESSION_FIRST = GRUB_FILE_FILTER_GZIO,
-    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZSSIO,
   } grub_file_filter_id_t;
 
 typedef grub_file_t (*grub_file_filter_t) (grub_file_t in, const char *filename);
@@ -137,6 +164,12 @@ grub_ssize_t EXPORT_FUNC(grub_file_read) (grub_file_t file, void *buf,
 grub_off_t EXPORT_FUNC(grub_file_seek) (grub_file_t file, grub_off_t offset);
 grub_err_t EXPORT_FUNC(grub_file_close) (grub_file_t file);
 
+/* Return the address of LEN bytes at OFFSET of FILE if they can be used in
+   place, from a memdisk or a cache, or NULL if they have to be read.  The
+   bytes are read-only and stay valid until FILE is closed.  */
+const void *EXPORT_FUNC(grub_file_map) (grub_file_t file, grub_off_t offset,
+					grub_size_t len);
+
 /* Return value of grub_file_size() in case file size is unknown. */
 #define GRUB_FILE_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
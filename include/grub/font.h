@@ -44,7 +44,11 @@ struct grub_font
   short leading;
   grub_uint32_t num_chars;
   struct char_index_entry *char_index;
-  grub_uint16_t *bmp_idx;
+  /* Where the character index starts in FILE.  */
+  grub_off_t index_offset;
+  /* Which pages of CHAR_INDEX have been read.  */
+  grub_uint8_t *index_page_loaded;
+  grub_uint16_t *latin_idx;
 };
 
 /* Font type used to access font functions.  */
@@ -39,8 +39,11 @@ struct grub_dirhook_info
   unsigned mtimeset:1;
   unsigned case_insensitive:1;
   unsigned inodeset:1;
+  /* SIZE is the size of a regular file, as opening it would report.  */
+  unsigned sizeset:1;
   grub_int32_t mtime;
   grub_uint64_t inode;
+  grub_uint64_t size;
 };
 
 typedef int (*grub_fs_dir_hook_t) (const char *filename,
@@ -70,6 +73,11 @@ struct grub_fs
   /* Close the file FILE.  */
   grub_err_t (*close) (struct grub_file *file);
 
+  /* Return the address of LEN bytes at OFFSET of FILE if they are in
+     memory as they are, or NULL.  Optional.  */
+  const void *(*map) (struct grub_file *file, grub_off_t offset,
+		      grub_size_t len);
+
   /* Return the label of the device DEVICE in LABEL.  The label is
      returned in a grub_malloc'ed buffer and should be freed by the
      caller.  */
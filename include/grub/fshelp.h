@@ -26,6 +26,7 @@
 #include <grub/disk.h>
 
 typedef struct grub_fshelp_node *grub_fshelp_node_t;
+struct grub_fs;
 
 #define GRUB_FSHELP_CASE_INSENSITIVE	0x100
 #define GRUB_FSHELP_TYPE_MASK	0xff
@@ -73,6 +74,31 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Find the entry NAME of the directory DIR of a filesystem of type FS on
+   DISK in the lookup cache.  Return 1 if it is known, storing the node
+   it refers to in *ID and its type in *TYPE, GRUB_FSHELP_UNKNOWN if the
+   name doesn't exist, and 0 otherwise.  Drivers opt in to the cache by
+   trying it in their lookup_file hook first; DIR and *ID are numbers
+   which identify nodes across mounts, such as inode numbers.  */
+int
+EXPORT_FUNC(grub_fshelp_dcache_lookup) (grub_disk_t disk,
+					const struct grub_fs *fs,
+					grub_uint64_t dir, const char *name,
+					grub_uint64_t *id,
+					enum grub_fshelp_filetype *type);
+
+/* Remember the result of looking NAME up in DIR: the node ID of type
+   TYPE, or GRUB_FSHELP_UNKNOWN if NAME doesn't exist.  */
+void
+EXPORT_FUNC(grub_fshelp_dcache_add) (grub_disk_t disk,
+				     const struct grub_fs *fs,
+				     grub_uint64_t dir, const char *name,
+				     grub_uint64_t id,
+				     enum grub_fshelp_filetype type);
+
+/* Forget all cached entries.  */
+void EXPORT_FUNC(grub_fshelp_dcache_flush) (void);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
@@ -88,4 +114,21 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Like grub_fshelp_read_file, but GET_EXTENT additionally returns in
+   *COUNT the number of blocks starting with BLOCK that follow each other
+   on disk (or are all sparse), so that each run is read at once.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extents) (grub_disk_t disk,
+					    grub_fshelp_node_t node,
+					    grub_disk_read_hook_t read_hook,
+					    void *read_hook_data,
+					    grub_off_t pos, grub_size_t len,
+					    char *buf,
+					    grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+									    grub_disk_addr_t block,
+									    grub_disk_addr_t *count),
+					    grub_off_t filesize,
+					    int log2blocksize,
+					    grub_disk_addr_t blocks_start);
+
 #endif /* ! GRUB_FSHELP_HEADER */
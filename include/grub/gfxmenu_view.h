@@ -84,6 +84,8 @@ int grub_font_get_string_width (grub_font_t font,
 struct grub_gfxmenu_view
 {
   grub_video_rect_t screen;
+  /* Format the theme images were converted to.  */
+  enum grub_video_blit_format blit_format;
 
   int need_to_check_sanity;
   grub_video_rect_t terminal_rect;
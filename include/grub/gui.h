@@ -69,21 +69,26 @@ struct grub_gui_list_ops
                          grub_gfxmenu_view_t view);
   void (*refresh_list) (void *self,
                         grub_gfxmenu_view_t view);
+  int (*get_item_bounds) (void *self, int index,
+                          grub_video_rect_t *bounds);
 };
 
 struct grub_gui_progress_ops
 {
-  void (*set_state) (void *self, int visible, int start, int current, int end);
+  int (*set_state) (void *self, int visible, int start, int current, int end);
 };
 
-typedef void (*grub_gfxmenu_set_state_t) (void *self, int visible, int start,
-					  int current, int end);
+/* Return nonzero if the component looks different with the new state.  */
+typedef int (*grub_gfxmenu_set_state_t) (void *self, int visible, int start,
+					 int current, int end);
 
 struct grub_gfxmenu_timeout_notify
 {
   struct grub_gfxmenu_timeout_notify *next;
   grub_gfxmenu_set_state_t set_state;
   grub_gui_component_t self;
+  /* Whether the component needs repainting.  */
+  int dirty;
 };
 
 extern struct grub_gfxmenu_timeout_notify *grub_gfxmenu_timeout_notifications;
@@ -97,6 +102,7 @@ grub_gfxmenu_timeout_register (grub_gui_component_t self,
     return grub_errno;
   ne->set_state = set_state;
   ne->self = self;
+  ne->dirty = 0;
   ne->next = grub_gfxmenu_timeout_notifications;
   grub_gfxmenu_timeout_notifications = ne;
   return GRUB_ERR_NONE;
@@ -228,6 +234,14 @@ void grub_gui_iterate_recursively (grub_gui_component_t root,
 
 /* Helper functions.  */
 
+/* Load a theme image converted to the display's pixel format.  */
+grub_err_t grub_gui_load_bitmap (struct grub_video_bitmap **bitmap,
+                                 const char *path);
+grub_err_t grub_gui_load_bitmap_scaled (struct grub_video_bitmap **bitmap,
+                                        const char *path,
+                                        unsigned min_width,
+                                        unsigned min_height);
+
 static __inline void
 grub_gui_save_viewport (grub_video_rect_t *r)
 {
@@ -75,6 +75,12 @@ struct grub_hfsplus_compress_index
   grub_uint32_t size;
 };
 
+/* Decompressed chunks kept per compressed file.  */
+#define GRUB_HFSPLUS_CBUF_CHUNKS 4
+
+/* B-tree nodes kept per tree.  */
+#define GRUB_HFSPLUS_BTNODE_CACHE 8
+
 struct grub_hfsplus_file
 {
   struct grub_hfsplus_data *data;
@@ -88,7 +94,11 @@ struct grub_hfsplus_file
   char *cbuf;
   void *file;
   struct grub_hfsplus_compress_index *compress_index;
-  grub_uint32_t cbuf_block;
+  /* The chunks in each GRUB_HFSPLUS_CBUF_CHUNKS slot of CBUF, replaced
+     round-robin from CBUF_NEXT on, and a buffer for reading them.  */
+  grub_uint32_t cbuf_blocks[GRUB_HFSPLUS_CBUF_CHUNKS];
+  unsigned cbuf_next;
+  char *ctmp;
   grub_uint32_t compress_index_size;
 };
 
@@ -99,6 +109,14 @@ struct grub_hfsplus_btree
 
   /* Catalog file node.  */
   struct grub_hfsplus_file file;
+
+  /* Recently read nodes, replaced round-robin.  */
+  struct
+  {
+    grub_uint64_t num;
+    char *buf;
+  } cache[GRUB_HFSPLUS_BTNODE_CACHE];
+  unsigned cache_next;
 };
 
 /* Information about a "mounted" HFS+ filesystem.  */
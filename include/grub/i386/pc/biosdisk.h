@@ -24,6 +24,9 @@
 
 #define GRUB_BIOSDISK_FLAG_LBA	1
 #define GRUB_BIOSDISK_FLAG_CDROM 2
+/* Transfers go straight to and from the caller's buffer through its
+   EDD 3.0 64-bit flat address.  */
+#define GRUB_BIOSDISK_FLAG_FLAT	4
 
 #define GRUB_BIOSDISK_CDTYPE_NO_EMUL	0
 #define GRUB_BIOSDISK_CDTYPE_1_2_M	1
@@ -40,6 +43,8 @@ struct grub_biosdisk_data
   unsigned long heads;
   unsigned long sectors;
   unsigned long flags;
+  /* Sectors per transfer with GRUB_BIOSDISK_FLAG_FLAT.  */
+  unsigned max_sectors;
 };
 
 /* Drive Parameters.  */
@@ -96,7 +101,8 @@ struct grub_biosdisk_cdrp
   grub_uint8_t dummy[16];
 } GRUB_PACKED;
 
-/* Disk Address Packet.  */
+/* Disk Address Packet.  FLAT_BUFFER is only used, as EDD 3.0 defines,
+   when BUFFER is 0xffffffff, and LENGTH must then cover it.  */
 struct grub_biosdisk_dap
 {
   grub_uint8_t length;
@@ -104,6 +110,10 @@ struct grub_biosdisk_dap
   grub_uint16_t blocks;
   grub_uint32_t buffer;
   grub_uint64_t block;
+  grub_uint64_t flat_buffer;
 } GRUB_PACKED;
 
+/* The size of a packet without FLAT_BUFFER.  */
+#define GRUB_BIOSDISK_DAP_SIZE	0x10
+
 #endif /* ! GRUB_BIOSDISK_MACHINE_HEADER */
@@ -19,7 +19,9 @@
 #ifndef GRUB_CPU_PXE_H
 #define GRUB_CPU_PXE_H
 
+#ifndef ASM_FILE
 #include <grub/types.h>
+#endif
 
 #define GRUB_PXENV_TFTP_OPEN			0x0020
 #define GRUB_PXENV_TFTP_CLOSE			0x0021
@@ -161,6 +163,27 @@
 
 #define GRUB_PXE_ERR_LEN	0xFFFFFFFF
 
+#define GRUB_PXE_ISR_IN_START		1
+#define GRUB_PXE_ISR_IN_PROCESS		2
+#define GRUB_PXE_ISR_IN_GET_NEXT	3
+
+#define GRUB_PXE_ISR_OUT_OURS		0
+#define GRUB_PXE_ISR_OUT_NOT_OURS	1
+
+#define GRUB_PXE_ISR_OUT_DONE		0
+#define GRUB_PXE_ISR_OUT_TRANSMIT	2
+#define GRUB_PXE_ISR_OUT_RECEIVE	3
+#define GRUB_PXE_ISR_OUT_BUSY		4
+
+/* grub_pxe_drain keeps the UNDI_ISR parameter block at the start of the
+   scratch area and copies the frames it receives after it, each as a
+   16-bit length followed by the frame.  */
+#define GRUB_PXE_DRAIN_RING		0x100
+#define GRUB_PXE_DRAIN_MAX_FRAME	2048
+#define GRUB_PXE_DRAIN_MAX_FRAMES	32
+/* Or'ed to the frame count when UNDI has nothing more.  */
+#define GRUB_PXE_DRAIN_DONE		0x8000
+
 #ifndef ASM_FILE
 
 #define GRUB_PXE_SIGNATURE "PXENV+"
@@ -232,6 +255,21 @@ struct grub_pxenv_tftp_read
   grub_uint32_t buffer;
 } GRUB_PACKED;
 
+struct grub_pxenv_tftp_read_file
+{
+  grub_uint16_t status;
+  grub_uint8_t filename[128];
+  grub_uint32_t buffer_size;
+  grub_uint32_t buffer;
+  grub_uint32_t server_ip;
+  grub_uint32_t gateway_ip;
+  grub_uint32_t mcast_ip;
+  grub_uint16_t client_port;
+  grub_uint16_t server_port;
+  grub_uint16_t open_timeout;
+  grub_uint16_t reopen_delay;
+} GRUB_PACKED;
+
 struct grub_pxenv_tftp_get_fsize
 {
   grub_uint16_t status;
@@ -281,6 +319,7 @@ struct grub_pxenv_unload_stack
 } GRUB_PACKED;
 
 int EXPORT_FUNC(grub_pxe_call) (int func, void * data, grub_uint32_t pxe_rm_entry) __attribute__ ((regparm(3)));
+int EXPORT_FUNC(grub_pxe_drain) (int func, grub_uint32_t pxe_rm_entry) __attribute__ ((regparm(3)));
 
 extern struct grub_pxe_bangpxe *grub_pxe_pxenv;
 
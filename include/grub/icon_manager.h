@@ -29,6 +29,7 @@ typedef struct grub_gfxmenu_icon_manager *grub_gfxmenu_icon_manager_t;
 grub_gfxmenu_icon_manager_t grub_gfxmenu_icon_manager_new (void);
 void grub_gfxmenu_icon_manager_destroy (grub_gfxmenu_icon_manager_t mgr);
 void grub_gfxmenu_icon_manager_clear_cache (grub_gfxmenu_icon_manager_t mgr);
+void grub_gfxmenu_icon_manager_forget_entries (grub_gfxmenu_icon_manager_t mgr);
 void grub_gfxmenu_icon_manager_set_theme_path (grub_gfxmenu_icon_manager_t mgr,
                                                const char *path);
 void grub_gfxmenu_icon_manager_set_icon_size (grub_gfxmenu_icon_manager_t mgr,
@@ -0,0 +1,85 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_JSON_HEADER
+#define GRUB_JSON_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+
+enum grub_json_type
+{
+  /* Unordered collection of key-value pairs.  */
+  GRUB_JSON_OBJECT,
+  /* Ordered list of zero or more values.  */
+  GRUB_JSON_ARRAY,
+  /* Zero or more Unicode characters.  */
+  GRUB_JSON_STRING,
+  /* Number, boolean or null.  */
+  GRUB_JSON_PRIMITIVE,
+  /* Invalid token.  */
+  GRUB_JSON_UNDEFINED,
+};
+typedef enum grub_json_type grub_json_type_t;
+
+struct grub_json_token;
+
+/* A value inside a parsed document.  Copies are cheap and all of them
+   stay valid until the document is freed.  */
+struct grub_json
+{
+  struct grub_json_token *tokens;
+  char *string;
+  grub_size_t idx;
+};
+typedef struct grub_json grub_json_t;
+
+/* Parse the STRING_LEN bytes at STRING, which must stay around and is
+   modified in place: strings are unescaped and NUL-terminated.  Trailing
+   NUL bytes are accepted.  */
+grub_err_t grub_json_parse (grub_json_t **out, char *string,
+			    grub_size_t string_len);
+
+void grub_json_free (grub_json_t *json);
+
+/* Number of children: members of an object, elements of an array, 1 for
+   the key of a member and 0 otherwise.  */
+grub_err_t grub_json_getsize (grub_size_t *out, const grub_json_t *json);
+
+grub_json_type_t grub_json_gettype (const grub_json_t *json);
+
+/* The Nth child of PARENT.  The children of an object are its keys, the
+   child of a key is its value.  */
+grub_err_t grub_json_getchild (grub_json_t *out, const grub_json_t *parent,
+			       grub_size_t n);
+
+/* The value named KEY in the object PARENT.  */
+grub_err_t grub_json_getvalue (grub_json_t *out, const grub_json_t *parent,
+			       const char *key);
+
+/* Get the value named KEY in the object PARENT, or PARENT itself if KEY is
+   NULL, as a string.  Numbers may be given either as JSON numbers or as
+   strings containing them.  */
+grub_err_t grub_json_getstring (const char **out, const grub_json_t *parent,
+				const char *key);
+grub_err_t grub_json_getuint64 (grub_uint64_t *out, const grub_json_t *parent,
+				const char *key);
+grub_err_t grub_json_getint64 (grub_int64_t *out, const grub_json_t *parent,
+			       const char *key);
+
+#endif
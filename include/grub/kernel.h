@@ -64,6 +64,32 @@ struct grub_module_info64
   grub_uint64_t size;
 };
 
+/* "gmbn" (GRUB Module BuNdle).  */
+#define GRUB_MODULE_BUNDLE_MAGIC 0x676d626e
+#define GRUB_MODULE_BUNDLE_NAME_SIZE 32
+#define GRUB_MODULE_BUNDLE_ALIGN 16
+
+/* A file of modules read in one go: this header, COUNT entries, then the
+   modules themselves, each one aligned to GRUB_MODULE_BUNDLE_ALIGN.
+   Fields are in the byte order of the target.  */
+struct grub_module_bundle_header
+{
+  grub_uint32_t magic;
+  grub_uint32_t count;
+};
+
+struct grub_module_bundle_entry
+{
+  /* NUL-terminated module name.  */
+  char name[GRUB_MODULE_BUNDLE_NAME_SIZE];
+  /* Of the module, from the start of the file.  */
+  grub_uint32_t offset;
+  grub_uint32_t size;
+};
+
+/* The name of the bundle in the platform directory under $prefix.  */
+#define GRUB_MODULE_BUNDLE_FILE "modules.bundle"
+
 #ifndef GRUB_UTIL
 /* Space isn't reusable on some platforms.  */
 /* On Qemu the preload space is readonly.  */
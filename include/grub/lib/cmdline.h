@@ -27,5 +27,7 @@
 unsigned int grub_loader_cmdline_size (int argc, char *argv[]);
 int grub_create_loader_cmdline (int argc, char *argv[], char *buf,
 				grub_size_t size);
+int grub_create_loader_cmdline_extra (int argc, char *argv[], const char *extra,
+				      char *buf, grub_size_t size);
 
 #endif /* ! GRUB_CMDLINE_HEADER */
@@ -20,6 +20,11 @@
 #ifndef GRUB_CRC_H
 #define GRUB_CRC_H	1
 
-grub_uint32_t grub_getcrc32c (grub_uint32_t crc, const void *buf, int size);
+/* Both continue from CRC, 0 for a new checksum.  */
+grub_uint32_t grub_getcrc32c (grub_uint32_t crc, const void *buf,
+			      grub_size_t size);
+/* The IEEE 802.3 CRC32 of gzip, GPT and EFI tables.  */
+grub_uint32_t grub_getcrc32 (grub_uint32_t crc, const void *buf,
+			     grub_size_t size);
 
 #endif /* ! GRUB_CRC_H */
@@ -7,6 +7,9 @@ struct grub_linux_initrd_context
   int nfiles;
   struct grub_linux_initrd_component *components;
   grub_size_t size;
+  /* The TPM event description of the files, "Linux Initrd" unless the
+     loader sets another after grub_initrd_init.  */
+  const char *measure_description;
 };
 
 grub_err_t
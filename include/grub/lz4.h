@@ -0,0 +1,38 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_LZ4_HEADER
+#define GRUB_LZ4_HEADER 1
+
+#include <grub/types.h>
+#include <grub/err.h>
+
+/* Decompress the raw LZ4 block of SRC_LEN bytes at SRC into DST, which
+   holds DST_LEN bytes.  Matches may only refer to data in DST.  Returns
+   the number of bytes stored or -1 on error.  */
+grub_ssize_t grub_lz4_decompress (const void *src, grub_size_t src_len,
+				  void *dst, grub_size_t dst_len);
+
+/* Likewise for a block that depends on earlier ones: matches may also
+   refer to the PREFIX bytes preceding DST.  */
+grub_ssize_t grub_lz4_decompress_continue (const void *src,
+					   grub_size_t src_len,
+					   void *dst, grub_size_t dst_len,
+					   grub_size_t prefix);
+
+#endif
@@ -454,8 +454,67 @@ void EXPORT_FUNC(grub_real_boot_time) (const char *file,
 				       const int line,
 				       const char *fmt, ...) __attribute__ ((format (GNU_PRINTF, 3, 4)));
 #define grub_boot_time(...) grub_real_boot_time(GRUB_FILE, __LINE__, __VA_ARGS__)
+
+/* Boot phases traced on entry and exit.  */
+enum
+  {
+    GRUB_TRACE_DL_LOAD,
+    GRUB_TRACE_FILE_OPEN,
+    GRUB_TRACE_FILE_READ,
+    GRUB_TRACE_DISK_READ,
+    GRUB_TRACE_FS_PROBE,
+    GRUB_TRACE_COMMAND,
+    GRUB_TRACE_BOOT,
+    GRUB_TRACE_MAX
+  };
+
+#define GRUB_TRACE_EXIT		0x80000000
+#define GRUB_TRACE_RING_SIZE	1024
+#define GRUB_TRACE_NAME_SIZE	16
+#define GRUB_TRACE_TABLE_MAGIC	0x43525447
+
+/* This is also the layout handed over to the OS, after a struct
+   grub_trace_table.  */
+struct grub_trace_event
+{
+  grub_uint64_t us;
+  grub_uint32_t type;
+  grub_uint32_t arg;
+  /* Truncated, not always terminated.  */
+  char name[GRUB_TRACE_NAME_SIZE];
+};
+
+struct grub_trace_table
+{
+  grub_uint32_t magic;
+  grub_uint32_t count;
+  struct grub_trace_event events[0];
+};
+
+/* Time spent in each phase.  Nested entries into the same phase, like a
+   filter reading its underlying file, are counted once.  */
+struct grub_trace_total
+{
+  grub_uint64_t count;
+  grub_uint64_t us;
+  grub_uint64_t start;
+  unsigned depth;
+};
+
+extern struct grub_trace_event EXPORT_VAR(grub_trace_ring)[GRUB_TRACE_RING_SIZE];
+extern grub_uint32_t EXPORT_VAR(grub_trace_count);
+extern struct grub_trace_total EXPORT_VAR(grub_trace_totals)[GRUB_TRACE_MAX];
+
+grub_uint64_t EXPORT_FUNC(grub_trace_time_us) (void);
+void EXPORT_FUNC(grub_trace) (grub_uint32_t type, const char *name,
+			      grub_uint32_t arg);
+#define grub_trace_enter(type, name, arg) grub_trace ((type), (name), (arg))
+#define grub_trace_exit(type, name, arg) \
+  grub_trace ((type) | GRUB_TRACE_EXIT, (name), (arg))
 #else
 #define grub_boot_time(...)
+#define grub_trace_enter(type, name, arg)
+#define grub_trace_exit(type, name, arg)
 #endif
 
 #define grub_max(a, b) (((a) > (b)) ? (a) : (b))
@@ -22,6 +22,7 @@
 
 #include <grub/types.h>
 #include <grub/symbol.h>
+#include <grub/err.h>
 #include <config.h>
 
 #ifndef NULL
@@ -29,6 +30,13 @@
 #endif
 
 void grub_mm_init_region (void *addr, grub_size_t size);
+
+/* Called by the allocator when the heap is exhausted, to add regions with
+   a free block of at least BYTES.  Set by platforms able to grow the
+   heap.  */
+typedef grub_err_t (*grub_mm_add_region_func_t) (grub_size_t bytes);
+extern grub_mm_add_region_func_t grub_mm_add_region_fn;
+
 void *EXPORT_FUNC(grub_malloc) (grub_size_t size);
 void *EXPORT_FUNC(grub_zalloc) (grub_size_t size);
 void EXPORT_FUNC(grub_free) (void *ptr);
@@ -37,6 +45,41 @@ void *EXPORT_FUNC(grub_realloc) (void *ptr, grub_size_t size);
 void *EXPORT_FUNC(grub_memalign) (grub_size_t align, grub_size_t size);
 #endif
 
+/* A cache which gives memory back when the heap runs short.  SHRINK frees
+   at least BYTES if it can, least recently used first, and returns how
+   much it freed.  It must neither allocate nor free anything in use.  */
+struct grub_mm_shrinker
+{
+  struct grub_mm_shrinker *next;
+  struct grub_mm_shrinker **prev;
+  grub_size_t (*shrink) (grub_size_t bytes);
+};
+
+void EXPORT_FUNC(grub_mm_shrinker_register) (struct grub_mm_shrinker *shrinker);
+void EXPORT_FUNC(grub_mm_shrinker_unregister) (struct grub_mm_shrinker *shrinker);
+
+/* Have the caches free BYTES, everything they hold if BYTES is
+   GRUB_MM_RECLAIM_ALL.  Returns how much they freed.  */
+#define GRUB_MM_RECLAIM_ALL	((grub_size_t) -1)
+grub_size_t EXPORT_FUNC(grub_mm_reclaim) (grub_size_t bytes);
+
+/* A bump allocator for short-lived work: allocations come out of large
+   chunks and are all released at once by grub_arena_destroy.  */
+typedef struct grub_arena *grub_arena_t;
+
+grub_arena_t EXPORT_FUNC(grub_arena_new) (grub_size_t chunk_size);
+void EXPORT_FUNC(grub_arena_destroy) (grub_arena_t arena);
+void *EXPORT_FUNC(grub_arena_alloc) (grub_arena_t arena, grub_size_t size);
+void *EXPORT_FUNC(grub_arena_zalloc) (grub_arena_t arena, grub_size_t size);
+/* Resize PTR, of OLD_SIZE bytes, in place if it is the latest allocation,
+   otherwise by copying it.  The old copy stays until the arena goes.  */
+void *EXPORT_FUNC(grub_arena_realloc) (grub_arena_t arena, void *ptr,
+				       grub_size_t old_size,
+				       grub_size_t new_size);
+char *EXPORT_FUNC(grub_arena_strdup) (grub_arena_t arena, const char *s);
+char *EXPORT_FUNC(grub_arena_strndup) (grub_arena_t arena, const char *s,
+				       grub_size_t n);
+
 void grub_mm_check_real (const char *file, int line);
 #define grub_mm_check() grub_mm_check_real (GRUB_FILE, __LINE__);
 
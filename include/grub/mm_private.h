@@ -24,13 +24,32 @@
 /* Magic words.  */
 #define GRUB_MM_FREE_MAGIC	0x2d3c2808
 #define GRUB_MM_ALLOC_MAGIC	0x6db08fa4
+#define GRUB_MM_SMALL_MAGIC	0x4b1a3e57
+
+#ifdef MM_DEBUG
+/* Live allocations made from one place, in bytes.  */
+struct grub_mm_site
+{
+  const char *file;
+  int line;
+  grub_size_t live;
+  grub_size_t count;
+  grub_uint64_t allocs;
+};
+
+/* Sites beyond this many go into the last entry, which has no file.  */
+#define GRUB_MM_SITES	256
+#endif
 
 typedef struct grub_mm_header
 {
   struct grub_mm_header *next;
   grub_size_t size;
   grub_size_t magic;
-#if GRUB_CPU_SIZEOF_VOID_P == 4
+#ifdef MM_DEBUG
+  /* Of allocated blocks, NULL if unknown.  Fills the padding.  */
+  struct grub_mm_site *site;
+#elif GRUB_CPU_SIZEOF_VOID_P == 4
   char padding[4];
 #elif GRUB_CPU_SIZEOF_VOID_P == 8
   char padding[8];
@@ -48,6 +67,12 @@ typedef struct grub_mm_header
 
 #define GRUB_MM_ALIGN	(1 << GRUB_MM_ALIGN_LOG2)
 
+/* Blocks of at most this many cells, header included, are kept on
+   per-size free lists instead of going back to the rings.  */
+#define GRUB_MM_SMALL_CELLS	16
+/* Small blocks are carved out of slabs of this many cells.  */
+#define GRUB_MM_SLAB_CELLS	256
+
 typedef struct grub_mm_region
 {
   struct grub_mm_header *first;
@@ -59,6 +84,30 @@ typedef struct grub_mm_region
 
 #ifndef GRUB_MACHINE_EMU
 extern grub_mm_region_t EXPORT_VAR (grub_mm_base);
+
+/* Give the blocks on the small free lists back to the rings.  */
+void EXPORT_FUNC (grub_mm_release_small) (void);
+
+/* Counters kept by the allocator.  */
+struct grub_mm_stats
+{
+  grub_uint64_t allocs;
+  grub_uint64_t frees;
+  grub_uint64_t failures;
+  /* Times the platform added a region on demand.  */
+  grub_uint64_t grown;
+  /* Bytes handed out and not freed yet, headers included, and the
+     largest that ever was.  */
+  grub_size_t live;
+  grub_size_t peak;
+  /* Bytes sitting on the small free lists.  */
+  grub_size_t small_cached;
+};
+
+extern struct grub_mm_stats EXPORT_VAR (grub_mm_stats);
+#ifdef MM_DEBUG
+extern struct grub_mm_site EXPORT_VAR (grub_mm_sites)[GRUB_MM_SITES];
+#endif
 #endif
 
 #endif
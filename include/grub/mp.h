@@ -0,0 +1,47 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_MP_HEADER
+#define GRUB_MP_HEADER	1
+
+#include <grub/types.h>
+#include <grub/symbol.h>
+
+/* Called with every INDEX below the count given to grub_mp_run, maybe on
+   several processors at once and in any order.  A job may only compute:
+   it must not allocate memory, call the firmware or raise errors, and
+   reports failures through DATA.  */
+typedef void (*grub_mp_job_t) (void *data, grub_size_t index);
+
+#if defined (GRUB_MACHINE_EFI) && (defined (__i386__) || defined (__x86_64__))
+/* Run the jobs on the idle processors as well as this one, if the
+   firmware lets us, and return once they are all done.  */
+void EXPORT_FUNC (grub_mp_run) (grub_mp_job_t job, void *data,
+				grub_size_t count);
+#else
+static inline void
+grub_mp_run (grub_mp_job_t job, void *data, grub_size_t count)
+{
+  grub_size_t i;
+
+  for (i = 0; i < count; i++)
+    job (data, i);
+}
+#endif
+
+#endif /* ! GRUB_MP_HEADER */
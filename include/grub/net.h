@@ -64,7 +64,11 @@ typedef enum grub_net_interface_flags
 typedef enum grub_net_card_flags
   {
     GRUB_NET_CARD_HWADDRESS_IMMUTABLE = 1,
-    GRUB_NET_CARD_NO_MANUAL_INTERFACES = 2
+    GRUB_NET_CARD_NO_MANUAL_INTERFACES = 2,
+    /* The card checks the UDP and TCP checksums of received frames and
+       drops those that don't match, or frames can't be damaged on the
+       way to it.  */
+    GRUB_NET_CARD_RX_CHECKSUM_VERIFIED = 4
   } grub_net_card_flags_t;
 
 struct grub_net_card;
@@ -125,8 +129,9 @@ struct grub_net_card
   grub_uint64_t last_poll;
   grub_size_t mtu;
   struct grub_net_slaac_mac_list *slaac_list;
-  grub_ssize_t new_ll_entry;
   struct grub_net_link_layer_entry *link_layer_table;
+  /* Receive buffers, see grub_net_card_alloc_buff.  */
+  struct grub_net_buff_pool *rx_pool;
   void *txbuf;
   void *rcvbuf;
   grub_size_t rcvbufsize;
@@ -140,6 +145,7 @@ struct grub_net_card
       struct grub_efi_simple_network *efi_net;
       grub_efi_handle_t efi_handle;
       grub_size_t last_pkt_size;
+      struct grub_efinet_priv *efi_priv;
     };
 #endif
     void *data;
@@ -264,6 +270,9 @@ typedef struct grub_net
   grub_fs_t fs;
   int eof;
   int stall;
+  /* The whole file, when the protocol downloaded it at once.  Reads are
+     then served from here and the packet list is unused.  */
+  char *mem;
 } *grub_net_t;
 
 extern grub_net_t (*EXPORT_VAR (grub_net_open)) (const char *name);
@@ -333,6 +342,14 @@ extern struct grub_net_network_level_interface *grub_net_network_level_interface
 
 extern grub_net_app_level_t grub_net_app_level_list;
 
+/* Set by netcache, which keeps whole downloads on a local disk.  KEY names
+   a remote file and VALIDATOR the version of it the server has.  Lookup
+   returns the contents, SIZE bytes in a buffer to free, or NULL.  */
+extern char *(*grub_net_cache_lookup) (const char *key, const char *validator,
+				       grub_uint64_t size);
+extern void (*grub_net_cache_store) (const char *key, const char *validator,
+				     const char *buf, grub_uint64_t size);
+
 #ifndef GRUB_LST_GENERATOR
 static inline void
 grub_net_app_level_register (grub_net_app_level_t proto)
@@ -363,6 +380,12 @@ grub_net_card_register (struct grub_net_card *card)
 void
 grub_net_card_unregister (struct grub_net_card *card);
 
+/* A buffer of at least LEN bytes for a frame received by CARD.  Frames
+   which fit are taken from a pool sized after the MTU of the card rather
+   than from the heap.  */
+struct grub_net_buff *
+grub_net_card_alloc_buff (struct grub_net_card *card, grub_size_t len);
+
 #define FOR_NET_CARDS(var) for (var = grub_net_cards; var; var = var->next)
 #define FOR_NET_CARDS_SAFE(var, next) for (var = grub_net_cards, next = (var ? var->next : 0); var; var = next, next = (var ? var->next : 0))
 
@@ -487,6 +510,52 @@ grub_env_set_net_property (const char *intername, const char *suffix,
 void
 grub_net_poll_cards (unsigned time, int *stop_condition);
 
+/* Round trip times, in milliseconds.  Samples are taken with the
+   millisecond clock, the sum still averages out over many of them.  */
+struct grub_net_rtt_stats
+{
+  grub_uint64_t samples;
+  grub_uint64_t sum;
+  grub_uint64_t max;
+};
+
+/* Counters of the network stack.  Only the RTT maxima are ever reset,
+   netbench reports how much the others moved during a transfer.  */
+struct grub_net_stats
+{
+  /* Frames exchanged with the card drivers.  */
+  grub_uint64_t rx_packets;
+  grub_uint64_t rx_bytes;
+  grub_uint64_t tx_packets;
+  grub_uint64_t tx_bytes;
+  grub_uint64_t tx_errors;
+  /* Frames a driver took off the card but couldn't hand over.  */
+  grub_uint64_t rx_dropped;
+  /* Time spent in grub_net_poll_cards, and the part of it spent on rounds
+     which received something.  */
+  grub_uint64_t poll_ms;
+  grub_uint64_t poll_busy_ms;
+  grub_uint64_t tcp_retransmits;
+  grub_uint64_t tcp_fast_retransmits;
+  grub_uint64_t tcp_out_of_order;
+  struct grub_net_rtt_stats tcp_rtt;
+  /* Blocks past a hole and blocks received again.  */
+  grub_uint64_t tftp_out_of_order;
+  grub_uint64_t tftp_duplicates;
+  struct grub_net_rtt_stats tftp_rtt;
+};
+
+extern struct grub_net_stats grub_net_stats;
+
+static inline void
+grub_net_rtt_sample (struct grub_net_rtt_stats *rtt, grub_uint64_t ms)
+{
+  rtt->samples++;
+  rtt->sum += ms;
+  if (rtt->max < ms)
+    rtt->max = ms;
+}
+
 void grub_bootp_init (void);
 void grub_bootp_fini (void);
 
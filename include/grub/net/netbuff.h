@@ -16,8 +16,12 @@ struct grub_net_buff
   grub_uint8_t *tail;
   /* Pointer to the end of the buffer.  */
   grub_uint8_t *end;
+  /* Pool the buffer goes back to when freed, if any.  */
+  struct grub_net_buff_pool *pool;
 };
 
+struct grub_net_buff_pool;
+
 grub_err_t grub_netbuff_put (struct grub_net_buff *net_buff, grub_size_t len);
 grub_err_t grub_netbuff_unput (struct grub_net_buff *net_buff, grub_size_t len);
 grub_err_t grub_netbuff_push (struct grub_net_buff *net_buff, grub_size_t len);
@@ -28,4 +32,13 @@ struct grub_net_buff * grub_netbuff_alloc (grub_size_t len);
 struct grub_net_buff * grub_netbuff_make_pkt (grub_size_t len);
 void grub_netbuff_free (struct grub_net_buff *net_buff);
 
+/* A slab of COUNT buffers of LEN bytes each, recycled by grub_netbuff_free.
+   Destroying the pool only frees the slab once every buffer is back.  */
+struct grub_net_buff_pool *grub_netbuff_pool_new (grub_size_t len,
+						  unsigned count);
+/* A free buffer of the pool, or NULL if all of them are in use.  */
+struct grub_net_buff *grub_netbuff_pool_alloc (struct grub_net_buff_pool *pool);
+grub_size_t grub_netbuff_pool_len (const struct grub_net_buff_pool *pool);
+void grub_netbuff_pool_destroy (struct grub_net_buff_pool *pool);
+
 #endif
@@ -40,6 +40,12 @@
 #define UART_DATA_READY		0x01
 #define UART_EMPTY_TRANSMITTER	0x20
 
+/* For IIR bits.  */
+#define UART_FIFO_ENABLED	0xC0
+
+/* Transmit FIFO depth of a 16550.  */
+#define UART_FIFO_SIZE		16
+
 /* The type of parity.  */
 #define UART_NO_PARITY		0x00
 #define UART_ODD_PARITY		0x08
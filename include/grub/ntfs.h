@@ -98,9 +98,12 @@ enum
 
 enum
   {
-    GRUB_NTFS_RF_BLNK		= 1
+    GRUB_NTFS_RF_BLNK		= 1,
+    GRUB_NTFS_RF_EXT		= 2
   };
 
+#define GRUB_NTFS_MFT_CACHE		8
+
 struct grub_ntfs_bpb
 {
   grub_uint8_t jmp_boot[3];
@@ -127,6 +130,13 @@ struct grub_ntfs_bpb
   grub_uint32_t checksum;
 } GRUB_PACKED;
 
+/* One run of a decoded run list.  It ends where the next one starts.  */
+struct grub_ntfs_extent
+{
+  grub_disk_addr_t vcn, lcn;
+  int sparse;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
@@ -135,6 +145,14 @@ struct grub_ntfs_attr
   grub_uint32_t save_pos;
   grub_uint8_t *sbuf;
   struct grub_ntfs_file *mft;
+
+  /* Run list of the last non-resident attribute read, EXT_COUNT runs
+     followed by one holding its end VCN.  */
+  struct grub_ntfs_extent *ext;
+  grub_size_t ext_count;
+  grub_uint8_t ext_type;
+  grub_uint16_t ext_id;
+  grub_uint64_t ext_last;
 };
 
 struct grub_ntfs_file
@@ -158,6 +176,14 @@ struct grub_ntfs_data
   int log_spc;
   grub_uint64_t mft_start;
   grub_uint64_t uuid;
+
+  /* Fixed up MFT records, replaced round-robin.  */
+  struct
+  {
+    grub_uint64_t mftno;
+    grub_uint8_t *buf;
+  } mft_cache[GRUB_NTFS_MFT_CACHE];
+  int mft_cache_next;
 };
 
 struct grub_ntfs_comp_table_element
@@ -96,9 +96,21 @@ int EXPORT_FUNC(grub_partition_iterate) (struct grub_disk *disk,
 					 void *hook_data);
 char *EXPORT_FUNC(grub_partition_get_name) (const grub_partition_t partition);
 
+/* Forget the partitions found on every disk.  */
+void EXPORT_FUNC(grub_partition_cache_flush) (void);
+
 
 extern grub_partition_map_t EXPORT_VAR(grub_partition_map_list);
 
+/* This hook is used to automatically load partition map modules.  NAME,
+   of LEN bytes, is the map wanted, or any map if LEN is zero.  If this
+   hook loads a module, return non-zero.  Otherwise return zero.  The
+   newly loaded map is assumed to be inserted into the head of
+   GRUB_PARTITION_MAP_LIST.  */
+typedef int (*grub_partition_autoload_hook_t) (const char *name,
+					       grub_size_t len);
+extern grub_partition_autoload_hook_t EXPORT_VAR(grub_partition_autoload_hook);
+
 #ifndef GRUB_LST_GENERATOR
 static inline void
 grub_partition_map_register (grub_partition_map_t partmap)
@@ -112,6 +124,7 @@ static inline void
 grub_partition_map_unregister (grub_partition_map_t partmap)
 {
   grub_list_remove (GRUB_AS_LIST (partmap));
+  grub_partition_cache_flush ();
 }
 
 #define FOR_PARTITION_MAPS(var) FOR_LIST_ELEMENTS((var), (grub_partition_map_list))
@@ -37,6 +37,25 @@ void *grub_priority_queue_top (grub_priority_queue_t pq);
 void grub_priority_queue_pop (grub_priority_queue_t pq);
 grub_err_t grub_priority_queue_push (grub_priority_queue_t pq, const void *el);
 
+/* A queue of pointers ordered by 32-bit sequence number, earliest on top,
+   as for reassembling a stream.  Sequence numbers wrap; the queue must
+   never span more than half their range.  Each element also records the
+   sequence number following it.  grub_priority_queue_pop and
+   grub_priority_queue_destroy work on it as on any queue.  */
+grub_priority_queue_t grub_priority_queue_new_seq (void);
+grub_err_t grub_priority_queue_push_seq (grub_priority_queue_t pq,
+					 grub_uint32_t seq, grub_uint32_t end,
+					 void *el);
+/* Return the top element and store its sequence number in *SEQ.  */
+void *grub_priority_queue_top_seq (grub_priority_queue_t pq,
+				   grub_uint32_t *seq);
+/* Pop up to MAX elements into OUT for as long as the top one starts at
+   *NEXT, advancing *NEXT past each.  Return how many were popped.  */
+grub_size_t grub_priority_queue_pop_while_in_order (grub_priority_queue_t pq,
+						    grub_uint32_t *next,
+						    void **out,
+						    grub_size_t max);
+
 #ifdef __cplusplus
 }
 #endif
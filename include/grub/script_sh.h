@@ -96,6 +96,9 @@ struct grub_script_arglist
 {
   struct grub_script_arglist *next;
   struct grub_script_arg *arg;
+  /* The argument's final text, if it is made of quoted and unquoted
+     strings only and needs neither escaping nor wildcard expansion.  */
+  char *literal;
   /* Only stored in the first link.  */
   int argcount;
 };
@@ -107,6 +110,11 @@ struct grub_script_cmdline
 
   /* The arguments for this command.  */
   struct grub_script_arglist *arglist;
+
+  /* The command the name resolved to, valid while grub_command_generation
+     equals GENERATION.  */
+  grub_command_t grubcmd;
+  unsigned generation;
 };
 
 /* An if statement.  */
@@ -212,6 +220,10 @@ struct grub_lexer_param
 
   /* Flex scanner buffer.  */
   void *buffer;
+
+  /* The line being scanned, reused from one line to the next.  */
+  char *input;
+  grub_size_t inputlen;
 };
 
 #define GRUB_LEXER_INITIAL_TEXT_SIZE   32
@@ -306,7 +318,8 @@ void grub_script_lexer_deref (struct grub_lexer_param *);
 unsigned grub_script_lexer_record_start (struct grub_parser_param *);
 char *grub_script_lexer_record_stop (struct grub_parser_param *, unsigned);
 int  grub_script_lexer_yywrap (struct grub_parser_param *, const char *input);
-void grub_script_lexer_record (struct grub_parser_param *, char *);
+void grub_script_lexer_record (struct grub_parser_param *, const char *,
+			       grub_size_t);
 
 /* Functions to track allocated memory.  */
 struct grub_script_mem *grub_script_mem_record (struct grub_parser_param *state);
@@ -331,6 +344,17 @@ grub_err_t grub_script_execute_cmdwhile (struct grub_script_cmd *cmd);
 grub_err_t grub_script_execute (struct grub_script *script);
 grub_err_t grub_script_execute_sourcecode (const char *source);
 grub_err_t grub_script_execute_new_scope (const char *source, int argc, char **args);
+void grub_script_cache_flush (void);
+extern struct grub_mm_shrinker grub_script_cache_shrinker;
+grub_err_t grub_script_execute_unparsed_block (struct grub_script_argv *argv);
+
+/* Measure the command lines run between these as one TPM event, if
+   tpm_batch_commands is set.  */
+void grub_script_measure_batch_begin (void);
+void grub_script_measure_batch_end (void);
+grub_err_t grub_script_measure_flush (void);
+void grub_script_measure_init (void);
+void grub_script_measure_fini (void);
 
 /* Break command for loops.  */
 grub_err_t grub_script_break (grub_command_t cmd, int argc, char *argv[]);
@@ -370,6 +394,8 @@ struct grub_script_function
 typedef struct grub_script_function *grub_script_function_t;
 
 extern grub_script_function_t grub_script_function_list;
+/* Bumped whenever parsing defines a function.  */
+extern unsigned grub_script_function_generation;
 
 #define FOR_SCRIPT_FUNCTIONS(var) for((var) = grub_script_function_list; \
 				      (var); (var) = (var)->next)
@@ -44,6 +44,8 @@ struct grub_serial_driver
   int (*fetch) (struct grub_serial_port *port);
   void (*put) (struct grub_serial_port *port, const int c);
   void (*fini) (struct grub_serial_port *port);
+  /* Optional: push out any output the driver still holds.  */
+  void (*flush) (struct grub_serial_port *port);
 };
 
 /* The type of parity.  */
@@ -69,8 +71,12 @@ struct grub_serial_config
   grub_serial_stop_bits_t stop_bits;
   grub_uint64_t base_clock;
   int rtscts;
+  int txbuf;
 };
 
+/* Size of the ns8250 output ring used with txbuf.  */
+#define GRUB_SERIAL_TXBUF_SIZE 256
+
 struct grub_serial_port
 {
   struct grub_serial_port *next;
@@ -87,7 +93,17 @@ struct grub_serial_port
   union
   {
 #if defined(__mips__) || defined (__i386__) || defined (__x86_64__)
-    grub_port_t port;
+    struct
+    {
+      grub_port_t port;
+      /* Bytes the transmit FIFO takes before LSR has to be polled again.  */
+      unsigned tx_room;
+      unsigned tx_fifo_size;
+      /* Output ring, only used when config.txbuf is set.  */
+      unsigned tx_head;
+      unsigned tx_len;
+      grub_uint8_t tx_buf[GRUB_SERIAL_TXBUF_SIZE];
+    };
 #endif
     struct
     {
@@ -169,7 +185,8 @@ grub_serial_config_defaults (struct grub_serial_port *port)
       .word_len = 8,
       .parity = GRUB_SERIAL_PARITY_NONE,
       .stop_bits = GRUB_SERIAL_STOP_BITS_1,
-      .base_clock = 0
+      .base_clock = 0,
+      .txbuf = 0
     };
 
   return port->driver->configure (port, &config);
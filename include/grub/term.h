@@ -213,6 +213,11 @@ struct grub_term_output
   /* Update the screen.  */
   void (*refresh) (struct grub_term_output *term);
 
+  /* Optional: move rows TOP..BOTTOM up (or down) by one row, leaving the
+     freed row blank.  Returns 0 if the terminal can't.  */
+  int (*scroll) (struct grub_term_output *term, unsigned top,
+		 unsigned bottom, int up);
+
   /* gfxterm only: put in fullscreen mode.  */
   grub_err_t (*fullscreen) (void);
 
@@ -355,6 +360,15 @@ grub_term_refresh (struct grub_term_output *term)
     term->refresh (term);
 }
 
+static inline int
+grub_term_scroll (struct grub_term_output *term, unsigned top,
+		  unsigned bottom, int up)
+{
+  if (term->scroll)
+    return term->scroll (term, top, bottom, up);
+  return 0;
+}
+
 static inline void
 grub_term_gotoxy (struct grub_term_output *term, struct grub_term_coordinate pos)
 {
@@ -455,6 +469,8 @@ grub_print_spaces (struct grub_term_output *term, int number_spaces)
 }
 
 extern void (*EXPORT_VAR (grub_term_poll_usb)) (int wait_for_completion);
+/* Called while waiting for input, to show output a terminal held back.  */
+extern void (*EXPORT_VAR (grub_term_flush_deferred)) (void);
 
 #define GRUB_TERM_REPEAT_PRE_INTERVAL 400
 #define GRUB_TERM_REPEAT_INTERVAL 50
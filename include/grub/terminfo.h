@@ -28,6 +28,7 @@ grub_err_t EXPORT_FUNC(grub_terminfo_set_current) (struct grub_term_output *term
 												const char *);
 
 #define GRUB_TERMINFO_READKEY_MAX_LEN 6
+#define GRUB_TERMINFO_OUTBUF_SIZE 256
 struct grub_terminfo_input_state
 {
   int input_buf[GRUB_TERMINFO_READKEY_MAX_LEN];
@@ -52,11 +53,29 @@ struct grub_terminfo_output_state
   char *cursor_on;
   char *cursor_off;
   char *setcolor;
+  char *scroll_region;
+  char *scroll_forward;
+  char *scroll_reverse;
 
   struct grub_term_coordinate size;
   struct grub_term_coordinate pos;
 
+  /* What the terminal was last told, so that telling it again can be
+     skipped.  Each is unknown while its flag is 0.  */
+  int pos_known;
+  int attr_known;
+  int attr;
+  int cursor_known;
+  int cursor_visible;
+
   void (*put) (struct grub_term_output *term, const int c);
+
+  /* If set, output is collected in OUTBUF and written in one go at a
+     newline, when OUTBUF is full and on grub_terminfo_refresh.  */
+  void (*write) (struct grub_term_output *term, const char *buf,
+		 grub_size_t len);
+  char outbuf[GRUB_TERMINFO_OUTBUF_SIZE];
+  unsigned outbuf_len;
 };
 
 grub_err_t EXPORT_FUNC(grub_terminfo_output_init) (struct grub_term_output *term);
@@ -68,6 +87,9 @@ void EXPORT_FUNC (grub_terminfo_setcursor) (struct grub_term_output *term,
 					    const int on);
 void EXPORT_FUNC (grub_terminfo_setcolorstate) (struct grub_term_output *term,
 				  const grub_term_color_state state);
+int EXPORT_FUNC (grub_terminfo_scroll) (struct grub_term_output *term,
+					unsigned top, unsigned bottom, int up);
+void EXPORT_FUNC (grub_terminfo_refresh) (struct grub_term_output *term);
 
 
 grub_err_t EXPORT_FUNC (grub_terminfo_input_init) (struct grub_term_input *term);
@@ -32,6 +32,13 @@ grub_cpu_idle(void)
 
 void EXPORT_FUNC(grub_millisleep) (grub_uint32_t ms);
 grub_uint64_t EXPORT_FUNC(grub_get_time_ms) (void);
+/* For measuring short intervals.  Counts from an arbitrary point, at the
+   resolution of the best counter the platform has; with none it falls
+   back to milliseconds.  */
+grub_uint64_t EXPORT_FUNC(grub_get_time_ns) (void);
+grub_uint64_t EXPORT_FUNC(grub_get_cycles) (void);
+/* Rate at which grub_get_cycles counts.  */
+grub_uint64_t EXPORT_FUNC(grub_get_cycles_hz) (void);
 
 grub_uint64_t grub_rtc_get_time_ms (void);
 
@@ -42,5 +49,7 @@ grub_sleep (grub_uint32_t s)
 }
 
 void grub_install_get_time_ms (grub_uint64_t (*get_time_ms_func) (void));
+void grub_install_get_cycles (grub_uint64_t (*get_cycles_func) (void),
+			      grub_uint64_t hz, const char *name);
 
 #endif /* ! KERNEL_TIME_HEADER */
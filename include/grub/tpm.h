@@ -67,9 +67,37 @@ typedef struct {
         grub_uint8_t outDigest[SHA1_DIGEST_SIZE];               /* The PCR value after execution of the command. */
 } GRUB_PACKED ExtendOutgoing;
 
+/* Reads of a file being measured are split in pieces of this size, so
+   that they are hashed while still in the cache.  */
+#define GRUB_TPM_MEASURE_CHUNK	(256 * 1024)
+
+/* An incremental measurement.  When the TPM takes a digest GRUB hashes
+   the data as it goes, otherwise the data has to stay in memory until
+   grub_tpm_measure_finish and the firmware hashes it in one go.  */
+struct grub_tpm_measure_ctx
+{
+  grub_uint8_t pcr;
+  const char *description;
+  int hashing;
+  struct
+  {
+    grub_uint32_t h[5];
+    grub_uint64_t count;
+    grub_uint8_t block[64];
+  } sha1;
+  unsigned char *start;
+  grub_size_t size;
+};
+
 grub_err_t EXPORT_FUNC(grub_tpm_measure) (unsigned char *buf, grub_size_t size,
 					  grub_uint8_t pcr,
 					  const char *description);
+void EXPORT_FUNC(grub_tpm_measure_begin) (struct grub_tpm_measure_ctx *ctx,
+					  grub_uint8_t pcr,
+					  const char *description);
+grub_err_t EXPORT_FUNC(grub_tpm_measure_update) (struct grub_tpm_measure_ctx *ctx,
+						 void *buf, grub_size_t size);
+grub_err_t EXPORT_FUNC(grub_tpm_measure_finish) (struct grub_tpm_measure_ctx *ctx);
 #if defined (GRUB_MACHINE_EFI) || defined (GRUB_MACHINE_PCBIOS)
 grub_err_t grub_tpm_execute(PassThroughToTPM_InputParamBlock *inbuf,
 			    PassThroughToTPM_OutputParamBlock *outbuf);
@@ -87,4 +115,20 @@ static inline grub_err_t grub_tpm_log_event(unsigned char *buf,
 };
 #endif
 
+#ifdef GRUB_MACHINE_EFI
+/* Whether the TPM can be given a SHA-1 digest instead of the data.  */
+int grub_tpm_log_digest_supported (void);
+grub_err_t grub_tpm_log_digest (const grub_uint8_t *digest, grub_uint8_t pcr,
+				const char *description);
+#else
+static inline int grub_tpm_log_digest_supported (void) { return 0; }
+static inline grub_err_t
+grub_tpm_log_digest (const grub_uint8_t *digest __attribute__ ((unused)),
+		     grub_uint8_t pcr __attribute__ ((unused)),
+		     const char *description __attribute__ ((unused)))
+{
+	return 0;
+}
+#endif
+
 #endif
@@ -47,7 +47,8 @@ typedef enum
     GRUB_USB_SPEED_NONE,
     GRUB_USB_SPEED_LOW,
     GRUB_USB_SPEED_FULL,
-    GRUB_USB_SPEED_HIGH
+    GRUB_USB_SPEED_HIGH,
+    GRUB_USB_SPEED_SUPER
   } grub_usb_speed_t;
 
 typedef int (*grub_usb_iterate_hook_t) (grub_usb_device_t dev, void *data);
@@ -130,6 +131,12 @@ struct grub_usb_controller_dev
   /* Value is calculated/estimated in driver - some TDs should be */
   /* reserved for posible concurrent control or "interrupt" transfers */
   grub_size_t max_bulk_tds;
+
+  /* Max. length of one bulk transaction (TD) when the controller can
+     split it into packets itself, 0 if every packet needs its own TD.
+     Such transactions start page aligned, so this should be a multiple
+     of the page size.  */
+  grub_size_t max_bulk_trans_len;
   
   /* The next host controller.  */
   struct grub_usb_controller_dev *next;
@@ -182,6 +189,21 @@ struct grub_usb_hub_port
   } state;
 };
 
+/* Transfer counters of a device, shown by the usb command.  */
+struct grub_usb_stats
+{
+  grub_uint64_t control;	/* Control transfers.  */
+  grub_uint64_t bulk;		/* Bulk and interrupt transfers.  */
+  grub_uint64_t bytes;		/* Data moved by either.  */
+  grub_uint64_t short_packets;	/* Transfers ended by a short packet.  */
+  grub_uint64_t stalls;
+  grub_uint64_t timeouts;
+  grub_uint64_t errors;		/* Other failures.  */
+  grub_uint64_t clear_halts;	/* Endpoints recovered from a stall.  */
+  grub_uint64_t wait_ms;	/* Time spent in synchronous transfers.  */
+  grub_uint64_t max_ms;		/* Longest synchronous transfer.  */
+};
+
 struct grub_usb_device
 {
   /* The device descriptor of this device.  */
@@ -228,6 +250,8 @@ struct grub_usb_device
   int split_hubport;
 
   int split_hubaddr;
+
+  struct grub_usb_stats stats;
 };
 
 
@@ -39,10 +39,10 @@
   { "locales", GRUB_INSTALL_OPTIONS_INSTALL_LOCALES, N_("LOCALES"),\
     0, N_("install only LOCALES [default=all]"), 1 },			  \
   { "compress", GRUB_INSTALL_OPTIONS_INSTALL_COMPRESS,		  \
-    "no,xz,gz,lzo", OPTION_ARG_OPTIONAL,				  \
+    "no,xz,gz,lzo,lz4,zstd", OPTION_ARG_OPTIONAL,				  \
     N_("compress GRUB files [optional]"), 1 },			          \
   {"core-compress", GRUB_INSTALL_OPTIONS_INSTALL_CORE_COMPRESS,		\
-      "xz|none|auto",						\
+      "xz|lz4|none|auto",					\
       0, N_("choose the compression to use for core image"), 2},	\
     /* TRANSLATORS: platform here isn't identifier. It can be translated. */ \
   { "directory", 'd', N_("DIR"), 0,					\
@@ -129,6 +129,12 @@ void
 grub_install_copy_files (const char *src,
 			 const char *dst,
 			 enum grub_install_plat platid);
+void
+grub_install_copy_platform_files (const char *src,
+				  const char *dst,
+				  enum grub_install_plat platid);
+void
+grub_install_copy_shared_files (const char *src, const char *dst);
 char *
 grub_install_get_platform_name (enum grub_install_plat platid);
 
@@ -145,7 +151,8 @@ typedef enum {
   GRUB_COMPRESSION_AUTO,
   GRUB_COMPRESSION_NONE,
   GRUB_COMPRESSION_XZ,
-  GRUB_COMPRESSION_LZMA
+  GRUB_COMPRESSION_LZMA,
+  GRUB_COMPRESSION_LZ4
 } grub_compression_t;
 
 void
@@ -167,6 +174,10 @@ grub_install_copy_file (const char *src,
 
 struct grub_install_image_target_desc;
 
+/* Threads grub_install_generate_image may compress with.  Only xz uses
+   more than one.  */
+extern int grub_install_compression_threads;
+
 void
 grub_install_generate_image (const char *dir, const char *prefix,
 			     FILE *out,
@@ -178,6 +189,13 @@ grub_install_generate_image (const char *dir, const char *prefix,
 			     int note,
 			     grub_compression_t comp);
 
+/* Write the modules MODS found in DIR, and those they depend on, as a
+   bundle to OUT.  */
+void
+grub_install_generate_bundle (const char *dir, FILE *out,
+			      const char *outname, char *mods[],
+			      const struct grub_install_image_target_desc *image_target);
+
 const struct grub_install_image_target_desc *
 grub_install_get_image_target (const char *arg);
 
@@ -225,6 +243,10 @@ int
 grub_install_compress_lzop (const char *src, const char *dest);
 int 
 grub_install_compress_xz (const char *src, const char *dest);
+int 
+grub_install_compress_lz4 (const char *src, const char *dest);
+int 
+grub_install_compress_zstd (const char *src, const char *dest);
 
 void
 grub_install_get_blocklist (grub_device_t root_dev,
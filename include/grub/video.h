@@ -433,6 +433,9 @@ grub_video_unregister (grub_video_adapter_t adapter)
 
 #define FOR_VIDEO_ADAPTERS(var) FOR_LIST_ELEMENTS((var), (grub_video_adapter_list))
 
+/* Load the video drivers listed in video.lst, once.  */
+void EXPORT_FUNC (grub_video_autoload) (void);
+
 grub_err_t EXPORT_FUNC (grub_video_restore) (void);
 
 grub_err_t EXPORT_FUNC (grub_video_get_info) (struct grub_video_mode_info *mode_info);
@@ -30,4 +30,11 @@ extern void fletcher_2 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
 extern void fletcher_4 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
 			zio_cksum_t *);
 
+#if defined (GRUB_MACHINE_EFI) && (defined (__x86_64__) || defined (__aarch64__))
+#define ZFS_FLETCHER_4_SIMD	1
+extern void fletcher_4_simd (const void *, grub_uint64_t,
+			     grub_zfs_endian_t endian, zio_cksum_t *);
+extern int fletcher_4_simd_usable (void);
+#endif
+
 #endif	/* _SYS_ZIO_CHECKSUM_H */
@@ -0,0 +1,75 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2016  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_ZSTD_HEADER
+#define GRUB_ZSTD_HEADER 1
+
+#include <grub/types.h>
+#include <grub/err.h>
+
+#define GRUB_ZSTD_MAGIC			0xfd2fb528
+#define GRUB_ZSTD_SKIPPABLE_MAGIC	0x184d2a50
+#define GRUB_ZSTD_SKIPPABLE_MASK	0xfffffff0
+
+/* No block regenerates more than this.  */
+#define GRUB_ZSTD_BLOCK_MAX		(128 * 1024)
+
+#define GRUB_ZSTD_SIZE_UNKNOWN		0xffffffffffffffffULL
+
+struct grub_zstd_frame
+{
+  /* Decompressed size of the frame, or GRUB_ZSTD_SIZE_UNKNOWN.  */
+  grub_uint64_t content_size;
+  /* How much history the blocks of the frame may refer to.  */
+  grub_uint64_t window_size;
+  /* Size of the frame header, magic included.  */
+  grub_size_t header_size;
+  /* Whether a 4-byte checksum follows the last block.  */
+  int checksum;
+};
+
+typedef struct grub_zstd_dctx *grub_zstd_dctx_t;
+
+grub_zstd_dctx_t grub_zstd_dctx_new (void);
+void grub_zstd_dctx_free (grub_zstd_dctx_t dctx);
+
+/* Parse the frame header of SIZE bytes at SRC into FRAME.  */
+grub_err_t grub_zstd_read_frame_header (const void *src, grub_size_t size,
+					struct grub_zstd_frame *frame);
+
+/* Prepare DCTX for the first block of a new frame.  */
+void grub_zstd_dctx_reset (grub_zstd_dctx_t dctx);
+
+/* Decode the block at SRC, of at most SIZE bytes, storing the number of
+   bytes it took in *CONSUMED and whether it was the last of its frame in
+   *LAST.  The output is appended at DST + *POS, DST[0] to DST[*POS - 1]
+   being the history matches may refer to, and *POS is advanced by the
+   regenerated size.  Output at or beyond LIMIT is discarded.  */
+grub_err_t grub_zstd_decode_block (grub_zstd_dctx_t dctx, const void *src,
+				   grub_size_t size, grub_size_t *consumed,
+				   int *last, grub_uint8_t *dst,
+				   grub_size_t *pos, grub_size_t limit);
+
+/* Decompress the zstd frames in INBUF, skipping the first OFF bytes of
+   the output and storing the next OUTSIZE ones in OUTBUF.  Returns the
+   number of bytes stored or -1 on error.  */
+grub_ssize_t grub_zstd_decompress (char *inbuf, grub_size_t insize,
+				   grub_off_t off, char *outbuf,
+				   grub_size_t outsize);
+
+#endif
@@ -537,6 +537,27 @@ repair_test (void)
   close_disk (&data);
 }
 
+static void
+read_cache_test (void)
+{
+  struct test_data data;
+  grub_gpt_t gpt;
+
+  open_disk (&data);
+
+  /* A second read is served from the cache but must be a private copy.  */
+  gpt = read_disk (&data);
+  memset (&gpt->entries[0], 0, sizeof (gpt->entries[0]));
+  grub_gpt_free (gpt);
+  gpt = read_disk (&data);
+  grub_test_assert (memcmp (&gpt->entries[0], &example_entries[0],
+			    sizeof (gpt->entries[0])) == 0,
+		    "cached entries modified through a returned copy");
+  grub_gpt_free (gpt);
+
+  close_disk (&data);
+}
+
 static void
 search_part_label_test (void)
 {
@@ -657,6 +678,7 @@ grub_unit_test_init (void)
   grub_test_register ("gpt_read_invalid_test", read_invalid_entries_test);
   grub_test_register ("gpt_read_fallback_test", read_fallback_test);
   grub_test_register ("gpt_repair_test", repair_test);
+  grub_test_register ("gpt_read_cache_test", read_cache_test);
   grub_test_register ("gpt_search_part_label_test", search_part_label_test);
   grub_test_register ("gpt_search_uuid_test", search_part_uuid_test);
   grub_test_register ("gpt_search_disk_uuid_test", search_disk_uuid_test);
@@ -671,6 +693,7 @@ grub_unit_test_fini (void)
   grub_test_unregister ("gpt_read_invalid_test");
   grub_test_unregister ("gpt_read_fallback_test");
   grub_test_unregister ("gpt_repair_test");
+  grub_test_unregister ("gpt_read_cache_test");
   grub_test_unregister ("gpt_search_part_label_test");
   grub_test_unregister ("gpt_search_part_uuid_test");
   grub_test_unregister ("gpt_search_disk_uuid_test");
@@ -42,6 +42,59 @@ compar (const void *a_, const void *b_)
   return 0;
 }
 
+/* Segments of 100 pushed in random order from just below the wrap of
+   the sequence numbers must come out whole and in order.  */
+static int
+priority_queue_seq_test (void)
+{
+  grub_priority_queue_t pq;
+  grub_uint32_t base = 0xfffff000, next = base;
+  int perm[1000];
+  int i, got = 0;
+
+  pq = grub_priority_queue_new_seq ();
+  if (!pq)
+    {
+      grub_test_assert (0, "priority queue: seq queue creating failed\n");
+      return 0;
+    }
+
+  for (i = 0; i < 1000; i++)
+    perm[i] = i;
+  for (i = 999; i > 0; i--)
+    {
+      int j = rand () % (i + 1), t = perm[i];
+      perm[i] = perm[j];
+      perm[j] = t;
+    }
+
+  for (i = 0; i < 1000; i++)
+    {
+      grub_uint32_t s = base + perm[i] * 100;
+      void *out[7];
+      grub_size_t n, k;
+
+      if (grub_priority_queue_push_seq (pq, s, s + 100,
+					(void *) (grub_addr_t) (perm[i] + 1)))
+	{
+	  grub_test_assert (0, "priority queue: seq push failed");
+	  return 0;
+	}
+      while ((n = grub_priority_queue_pop_while_in_order (pq, &next, out, 7)))
+	for (k = 0; k < n; k++)
+	  if ((grub_addr_t) out[k] != (grub_addr_t) ++got)
+	    {
+	      grub_test_assert (0, "priority queue: seq error at %d\n", got);
+	      return 0;
+	    }
+    }
+
+  grub_test_assert (got == 1000 && !grub_priority_queue_top_seq (pq, 0),
+		    "priority queue: %d segments delivered\n", got);
+  grub_priority_queue_destroy (pq);
+  return 1;
+}
+
 static void
 priority_queue_test (void)
 {
@@ -99,6 +152,9 @@ priority_queue_test (void)
       pq.pop ();
       s--;
     }
+  grub_priority_queue_destroy (pq2);
+  if (!priority_queue_seq_test ())
+    return;
   printf ("priority_queue: passed successfully\n");
 }
 
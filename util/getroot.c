@@ -114,8 +114,185 @@ grub_util_pull_device (const char *os_dev)
     }
 }
 
-char *
-grub_util_get_grub_dev (const char *os_dev)
+/* Resolving a device pulls in what lies below it, which may mean running
+   LVM and mdadm tools and walking sysfs.  The cache keeps, for each OS
+   device, the GRUB device and the disks that got mapped on the way, so
+   that a later run only needs to map the disks again.  An entry is valid
+   while the device number, the device node and the start of the disk,
+   where partition tables and RAID and LVM labels live, are unchanged.  */
+
+struct dev_cache_entry
+{
+  struct dev_cache_entry *next;
+  char *os_dev;
+  char *key;
+  char *grub_dev;
+  char **disks;
+};
+
+static struct dev_cache_entry *dev_cache;
+static char *dev_cache_file;
+static int dev_cache_dirty;
+
+/* Enough for the GPT and its entries.  */
+#define DEV_CACHE_HASHED_BYTES	(34 * 512)
+
+static char *
+dev_cache_key (const char *os_dev)
+{
+  struct stat st;
+  grub_uint64_t hash = 0xcbf29ce484222325ULL;
+  char *disk, *buf;
+  grub_util_fd_t fd;
+  ssize_t len, i;
+
+  if (stat (os_dev, &st) < 0)
+    return NULL;
+
+  disk = grub_util_get_os_disk (os_dev);
+  if (!disk)
+    return NULL;
+  fd = grub_util_fd_open (disk, GRUB_UTIL_FD_O_RDONLY);
+  free (disk);
+  if (!GRUB_UTIL_FD_IS_VALID (fd))
+    return NULL;
+  buf = xmalloc (DEV_CACHE_HASHED_BYTES);
+  len = grub_util_fd_read (fd, buf, DEV_CACHE_HASHED_BYTES);
+  grub_util_fd_close (fd);
+  if (len < 0)
+    {
+      free (buf);
+      return NULL;
+    }
+
+  /* FNV-1a.  */
+  for (i = 0; i < len; i++)
+    hash = (hash ^ (grub_uint8_t) buf[i]) * 0x100000001b3ULL;
+  free (buf);
+
+  return xasprintf ("%llx %llx %llx", (unsigned long long) st.st_rdev,
+		    (unsigned long long) st.st_ctime,
+		    (unsigned long long) hash);
+}
+
+static struct dev_cache_entry *
+dev_cache_find (const char *os_dev)
+{
+  struct dev_cache_entry *e;
+
+  for (e = dev_cache; e; e = e->next)
+    if (strcmp (e->os_dev, os_dev) == 0)
+      return e;
+  return NULL;
+}
+
+static void
+dev_cache_free_entry (struct dev_cache_entry *e)
+{
+  char **d;
+
+  for (d = e->disks; *d; d++)
+    free (*d);
+  free (e->disks);
+  free (e->os_dev);
+  free (e->key);
+  free (e->grub_dev);
+  free (e);
+}
+
+/* A line is the OS device, the key, the GRUB device and the disks,
+   separated by tabs.  */
+void
+grub_util_dev_cache_open (const char *file)
+{
+  FILE *f;
+  char *line = NULL;
+  size_t alloc = 0;
+  ssize_t len;
+
+  dev_cache_file = xstrdup (file);
+
+  f = grub_util_fopen (file, "r");
+  if (!f)
+    return;
+
+  while ((len = getline (&line, &alloc, f)) > 0)
+    {
+      struct dev_cache_entry *e;
+      char *fields[3], *p, *save;
+      size_t n = 0, ndisks = 0;
+
+      if (line[len - 1] == '\n')
+	line[len - 1] = '\0';
+
+      for (p = strtok_r (line, "\t", &save); p && n < 3;
+	   p = strtok_r (NULL, "\t", &save))
+	fields[n++] = p;
+      if (n < 3 || dev_cache_find (fields[0]))
+	continue;
+
+      e = xmalloc (sizeof (*e));
+      e->os_dev = xstrdup (fields[0]);
+      e->key = xstrdup (fields[1]);
+      e->grub_dev = xstrdup (fields[2]);
+      e->disks = xmalloc (sizeof (e->disks[0]));
+      for (; p; p = strtok_r (NULL, "\t", &save))
+	{
+	  e->disks = xrealloc (e->disks, (ndisks + 2) * sizeof (e->disks[0]));
+	  e->disks[ndisks++] = xstrdup (p);
+	}
+      e->disks[ndisks] = NULL;
+      e->next = dev_cache;
+      dev_cache = e;
+    }
+
+  free (line);
+  fclose (f);
+}
+
+void
+grub_util_dev_cache_close (void)
+{
+  struct dev_cache_entry *e, *next;
+
+  if (dev_cache_dirty)
+    {
+      char *tmp = xasprintf ("%s.new", dev_cache_file);
+      FILE *f = grub_util_fopen (tmp, "w");
+
+      if (!f)
+	grub_util_warn (_("cannot open `%s': %s"), tmp, strerror (errno));
+      else
+	{
+	  for (e = dev_cache; e; e = e->next)
+	    {
+	      char **d;
+
+	      fprintf (f, "%s\t%s\t%s", e->os_dev, e->key, e->grub_dev);
+	      for (d = e->disks; *d; d++)
+		fprintf (f, "\t%s", *d);
+	      fprintf (f, "\n");
+	    }
+	  if (fclose (f) != 0 || grub_util_rename (tmp, dev_cache_file))
+	    grub_util_warn (_("cannot write to `%s': %s"), dev_cache_file,
+			    strerror (errno));
+	}
+      free (tmp);
+    }
+
+  for (e = dev_cache; e; e = next)
+    {
+      next = e->next;
+      dev_cache_free_entry (e);
+    }
+  dev_cache = NULL;
+  dev_cache_dirty = 0;
+  free (dev_cache_file);
+  dev_cache_file = NULL;
+}
+
+static char *
+get_grub_dev_real (const char *os_dev)
 {
   char *ret;
 
@@ -130,6 +307,66 @@ grub_util_get_grub_dev (const char *os_dev)
   return grub_util_biosdisk_get_grub_dev (os_dev);
 }
 
+char *
+grub_util_get_grub_dev (const char *os_dev)
+{
+  struct dev_cache_entry *e;
+  unsigned int first, n;
+  char *key, *ret;
+
+  if (!dev_cache_file)
+    return get_grub_dev_real (os_dev);
+
+  key = dev_cache_key (os_dev);
+  if (!key)
+    return get_grub_dev_real (os_dev);
+
+  e = dev_cache_find (os_dev);
+  if (e && strcmp (e->key, key) == 0)
+    {
+      char **d;
+
+      grub_util_info ("using the cached %s for %s", e->grub_dev, os_dev);
+      for (d = e->disks; *d; d++)
+	grub_hostdisk_os_dev_to_grub_drive (*d, 1);
+      free (key);
+      return xstrdup (e->grub_dev);
+    }
+
+  for (first = 0; grub_hostdisk_get_os_dev (first); first++);
+
+  ret = get_grub_dev_real (os_dev);
+  if (!ret)
+    {
+      free (key);
+      return NULL;
+    }
+
+  if (e)
+    {
+      struct dev_cache_entry **prev;
+
+      for (prev = &dev_cache; *prev != e; prev = &(*prev)->next);
+      *prev = e->next;
+      dev_cache_free_entry (e);
+    }
+
+  e = xmalloc (sizeof (*e));
+  e->os_dev = xstrdup (os_dev);
+  e->key = key;
+  e->grub_dev = xstrdup (ret);
+  for (n = first; grub_hostdisk_get_os_dev (n); n++);
+  e->disks = xmalloc ((n - first + 1) * sizeof (e->disks[0]));
+  for (n = first; grub_hostdisk_get_os_dev (n); n++)
+    e->disks[n - first] = xstrdup (grub_hostdisk_get_os_dev (n));
+  e->disks[n - first] = NULL;
+  e->next = dev_cache;
+  dev_cache = e;
+  dev_cache_dirty = 1;
+
+  return ret;
+}
+
 int
 grub_util_get_dev_abstraction (const char *os_dev)
 {
@@ -69,9 +69,10 @@ enum {
   CMD_BLOCKLIST,
   CMD_TESTLOAD,
   CMD_ZFSINFO,
-  CMD_XNU_UUID
+  CMD_XNU_UUID,
+  CMD_BATCH
 };
-#define BUF_SIZE  32256
+#define BUF_SIZE  (1024 * 1024)
 
 static grub_disk_addr_t skip, leng;
 static int uncompress = 0;
@@ -85,6 +86,7 @@ read_file (char *pathname, int (*hook) (grub_off_t ofs, char *buf, int len, void
   if ((pathname[0] == '-') && (pathname[1] == 0))
     {
       grub_device_t dev;
+      grub_disk_addr_t ofs = skip, left = leng;
 
       dev = grub_device_open (0);
       if ((! dev) || (! dev->disk))
@@ -93,27 +95,27 @@ read_file (char *pathname, int (*hook) (grub_off_t ofs, char *buf, int len, void
       grub_util_info ("total sectors : %" GRUB_HOST_PRIuLONG_LONG,
                       (unsigned long long) dev->disk->total_sectors);
 
-      if (! leng)
-        leng = (dev->disk->total_sectors << GRUB_DISK_SECTOR_BITS) - skip;
+      if (! left)
+        left = (dev->disk->total_sectors << GRUB_DISK_SECTOR_BITS) - ofs;
 
-      while (leng)
+      while (left)
         {
           grub_size_t len;
 
-          len = (leng > BUF_SIZE) ? BUF_SIZE : leng;
+          len = (left > BUF_SIZE) ? BUF_SIZE : left;
 
-          if (grub_disk_read (dev->disk, 0, skip, len, buf))
+          if (grub_disk_read (dev->disk, 0, ofs, len, buf))
 	    {
 	      char *msg = grub_xasprintf (_("disk read fails at offset %lld, length %lld"),
-					  (long long) skip, (long long) len);
+					  (long long) ofs, (long long) len);
 	      grub_util_error ("%s", msg);
 	    }
 
-          if (hook (skip, buf, len, hook_arg))
+          if (hook (ofs, buf, len, hook_arg))
             break;
 
-          skip += len;
-          leng -= len;
+          ofs += len;
+          left -= len;
         }
 
       grub_device_close (dev);
@@ -367,6 +369,40 @@ cmd_crc (char *pathname)
   free (crc32_context);
 }
 
+static const struct
+{
+  const char *name;
+  int cmd;
+  int nparm;
+} commands[] =
+  {
+    { "ls", CMD_LS, 0 },
+    { "zfsinfo", CMD_ZFSINFO, 0 },
+    { "cp", CMD_CP, 2 },
+    { "cat", CMD_CAT, 1 },
+    { "cmp", CMD_CMP, 2 },
+    { "hex", CMD_HEX, 1 },
+    { "crc", CMD_CRC, 1 },
+    { "blocklist", CMD_BLOCKLIST, 1 },
+    { "testload", CMD_TESTLOAD, 1 },
+    { "xnu_uuid", CMD_XNU_UUID, 0 },
+    { "batch", CMD_BATCH, 0 }
+  };
+
+static int
+find_command (const char *name, int *n)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (commands); i++)
+    if (grub_strcmp (name, commands[i].name) == 0)
+      {
+	*n = commands[i].nparm;
+	return commands[i].cmd;
+      }
+  return 0;
+}
+
 static const char *root = NULL;
 static int args_count = 0;
 static int nparm = 0;
@@ -377,6 +413,115 @@ static char *debug_str = NULL;
 static char **args = NULL;
 static int mount_crypt = 0;
 
+static void
+run_command (int command, int n, char **cargs)
+{
+  switch (command)
+    {
+    case CMD_LS:
+      execute_command ("ls", n, cargs);
+      break;
+    case CMD_ZFSINFO:
+      execute_command ("zfsinfo", n, cargs);
+      break;
+    case CMD_CP:
+      cmd_cp (cargs[0], cargs[1]);
+      break;
+    case CMD_CAT:
+      cmd_cat (cargs[0]);
+      break;
+    case CMD_CMP:
+      cmd_cmp (cargs[0], cargs[1]);
+      break;
+    case CMD_HEX:
+      cmd_hex (cargs[0]);
+      break;
+    case CMD_CRC:
+      cmd_crc (cargs[0]);
+      break;
+    case CMD_BLOCKLIST:
+      execute_command ("blocklist", n, cargs);
+      grub_printf ("\n");
+      break;
+    case CMD_TESTLOAD:
+      execute_command ("testload", n, cargs);
+      grub_printf ("\n");
+      break;
+    case CMD_XNU_UUID:
+      {
+	grub_device_t dev;
+	grub_fs_t fs;
+	char *uuid = 0;
+	char *argv[3] = { xstrdup ("-l"), NULL, NULL};
+	dev = grub_device_open (n ? cargs[0] : 0);
+	if (!dev)
+	  grub_util_error ("%s", grub_errmsg);
+	fs = grub_fs_probe (dev);
+	if (!fs)
+	  grub_util_error ("%s", grub_errmsg);
+	if (!fs->uuid)
+	  grub_util_error ("%s", _("couldn't retrieve UUID"));
+	if (fs->uuid (dev, &uuid))
+	  grub_util_error ("%s", grub_errmsg);
+	if (!uuid)
+	  grub_util_error ("%s", _("couldn't retrieve UUID"));
+	argv[1] = uuid;
+	execute_command ("xnu_uuid", 2, argv);
+	grub_free (argv[0]);
+	grub_free (uuid);
+	grub_device_close (dev);
+      }
+    }
+}
+
+/* Run the commands given one per line on standard input, with their
+   arguments separated by blanks.  The images stay mounted all along.  */
+static void
+run_batch (void)
+{
+  char *line = NULL;
+  size_t line_size = 0;
+  char **cargs = NULL;
+  int max_args = 0;
+
+  while (getline (&line, &line_size, stdin) >= 0)
+    {
+      char *name, *word, *saveptr;
+      int n = 0, nparm_needed, command;
+
+      name = strtok_r (line, " \t\r\n", &saveptr);
+      if (! name || name[0] == '#')
+	continue;
+      command = find_command (name, &nparm_needed);
+      if (! command || command == CMD_BATCH)
+	grub_util_error (_("invalid command %s"), name);
+
+      while ((word = strtok_r (NULL, " \t\r\n", &saveptr)))
+	{
+	  if (n == max_args)
+	    {
+	      max_args = max_args ? 2 * max_args : 8;
+	      cargs = xrealloc (cargs, max_args * sizeof (cargs[0]));
+	    }
+	  cargs[n++] = word;
+	}
+      if (n < nparm_needed)
+	grub_util_error (_("not enough parameters to command %s"),
+			 name);
+
+      run_command (command, n, cargs);
+      if (grub_errno)
+	{
+	  grub_print_error ();
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      fflush (stdout);
+    }
+
+  free (cargs);
+  free (line);
+}
+
 static void
 fstest (int n)
 {
@@ -384,6 +529,11 @@ fstest (int n)
   char *loop_name;
   int i;
 
+  /* These read one file through, which mostly reads the images through
+     too.  */
+  if (cmd == CMD_CP || cmd == CMD_CAT || cmd == CMD_CMP || cmd == CMD_CRC)
+    grub_util_fd_map_sequential ();
+
   for (i = 0; i < num_disks; i++)
     {
       char *argv[2];
@@ -427,63 +577,11 @@ fstest (int n)
   grub_lvm_init ();
   grub_ldm_init ();
 
-  switch (cmd)
-    {
-    case CMD_LS:
-      execute_command ("ls", n, args);
-      break;
-    case CMD_ZFSINFO:
-      execute_command ("zfsinfo", n, args);
-      break;
-    case CMD_CP:
-      cmd_cp (args[0], args[1]);
-      break;
-    case CMD_CAT:
-      cmd_cat (args[0]);
-      break;
-    case CMD_CMP:
-      cmd_cmp (args[0], args[1]);
-      break;
-    case CMD_HEX:
-      cmd_hex (args[0]);
-      break;
-    case CMD_CRC:
-      cmd_crc (args[0]);
-      break;
-    case CMD_BLOCKLIST:
-      execute_command ("blocklist", n, args);
-      grub_printf ("\n");
-      break;
-    case CMD_TESTLOAD:
-      execute_command ("testload", n, args);
-      grub_printf ("\n");
-      break;
-    case CMD_XNU_UUID:
-      {
-	grub_device_t dev;
-	grub_fs_t fs;
-	char *uuid = 0;
-	char *argv[3] = { xstrdup ("-l"), NULL, NULL};
-	dev = grub_device_open (n ? args[0] : 0);
-	if (!dev)
-	  grub_util_error ("%s", grub_errmsg);
-	fs = grub_fs_probe (dev);
-	if (!fs)
-	  grub_util_error ("%s", grub_errmsg);
-	if (!fs->uuid)
-	  grub_util_error ("%s", _("couldn't retrieve UUID"));
-	if (fs->uuid (dev, &uuid))
-	  grub_util_error ("%s", grub_errmsg);
-	if (!uuid)
-	  grub_util_error ("%s", _("couldn't retrieve UUID"));
-	argv[1] = uuid;
-	execute_command ("xnu_uuid", 2, argv);
-	grub_free (argv[0]);
-	grub_free (uuid);
-	grub_device_close (dev);
-      }
-    }
-    
+  if (cmd == CMD_BATCH)
+    run_batch ();
+  else
+    run_command (cmd, n, args);
+
   for (i = 0; i < num_disks; i++)
     {
       char *argv[2];
@@ -512,6 +610,7 @@ static struct argp_option options[] = {
   {N_("crc FILE"), 0, 0     , OPTION_DOC, N_("Get crc32 checksum of FILE."), 1},
   {N_("blocklist FILE"), 0, 0, OPTION_DOC, N_("Display blocklist of FILE."), 1},
   {N_("xnu_uuid DEVICE"), 0, 0, OPTION_DOC, N_("Compute XNU UUID of the device."), 1},
+  {N_("batch"), 0, 0, OPTION_DOC, N_("Run the commands given one per line on standard input."), 1},
   
   {"root",      'r', N_("DEVICE_NAME"), 0, N_("Set root device."),                 2},
   {"skip",      's', N_("NUM"),           0, N_("Skip N bytes from output file."),   2},
@@ -658,55 +757,8 @@ argp_parser (int key, char *arg, struct argp_state *state)
 
   if (args_count == num_disks)
     {
-      if (!grub_strcmp (arg, "ls"))
-        {
-          cmd = CMD_LS;
-        }
-      else if (!grub_strcmp (arg, "zfsinfo"))
-        {
-          cmd = CMD_ZFSINFO;
-        }
-      else if (!grub_strcmp (arg, "cp"))
-	{
-	  cmd = CMD_CP;
-          nparm = 2;
-	}
-      else if (!grub_strcmp (arg, "cat"))
-	{
-	  cmd = CMD_CAT;
-	  nparm = 1;
-	}
-      else if (!grub_strcmp (arg, "cmp"))
-	{
-	  cmd = CMD_CMP;
-          nparm = 2;
-	}
-      else if (!grub_strcmp (arg, "hex"))
-	{
-	  cmd = CMD_HEX;
-          nparm = 1;
-	}
-      else if (!grub_strcmp (arg, "crc"))
-	{
-	  cmd = CMD_CRC;
-          nparm = 1;
-	}
-      else if (!grub_strcmp (arg, "blocklist"))
-	{
-	  cmd = CMD_BLOCKLIST;
-          nparm = 1;
-	}
-      else if (!grub_strcmp (arg, "testload"))
-	{
-	  cmd = CMD_TESTLOAD;
-          nparm = 1;
-	}
-      else if (grub_strcmp (arg, "xnu_uuid") == 0)
-	{
-	  cmd = CMD_XNU_UUID;
-	  nparm = 0;
-	}
-      else
+      cmd = find_command (arg, &nparm);
+      if (! cmd)
 	{
 	  fprintf (stderr, _("Invalid command %s.\n"), arg);
 	  argp_usage (state);
@@ -73,6 +73,88 @@ grub_install_help_filter (int key, const char *text,
 
 static int (*compress_func) (const char *src, const char *dest) = NULL;
 char *grub_install_copy_buffer;
+static char *compare_buffer;
+
+/* Files clean_grub_dir found, removed once the copy is over unless they
+   were installed again.  */
+static char **stale_files;
+static size_t n_stale_files, n_stale_alloc;
+
+static void
+keep_file (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < n_stale_files; i++)
+    if (strcmp (stale_files[i], name) == 0)
+      {
+	free (stale_files[i]);
+	stale_files[i] = stale_files[--n_stale_files];
+	return;
+      }
+}
+
+static void
+remove_stale_files (void)
+{
+  size_t i;
+
+  for (i = 0; i < n_stale_files; i++)
+    {
+      grub_util_info ("removing `%s'", stale_files[i]);
+      if (grub_util_unlink (stale_files[i]) < 0)
+	grub_util_error (_("cannot delete `%s': %s"), stale_files[i],
+			 grub_util_fd_strerror ());
+      free (stale_files[i]);
+    }
+  n_stale_files = 0;
+}
+
+/* Return 1 if DST exists and has the same contents as the file open as
+   IN, leaving IN at its start either way.  */
+static int
+is_up_to_date (grub_util_fd_t in, const char *src, const char *dst)
+{
+  grub_util_fd_t out;
+  ssize_t r, r2;
+  int ret = 0;
+
+  if (!grub_util_is_regular (dst))
+    return 0;
+
+  out = grub_util_fd_open (dst, GRUB_UTIL_FD_O_RDONLY);
+  if (!GRUB_UTIL_FD_IS_VALID (out))
+    return 0;
+
+  if (grub_util_get_fd_size (in, src, NULL)
+      != grub_util_get_fd_size (out, dst, NULL))
+    goto out;
+
+  if (!compare_buffer)
+    compare_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+
+  while (1)
+    {
+      r = grub_util_fd_read (in, grub_install_copy_buffer,
+			     GRUB_INSTALL_COPY_BUFFER_SIZE);
+      r2 = grub_util_fd_read (out, compare_buffer,
+			      GRUB_INSTALL_COPY_BUFFER_SIZE);
+      if (r < 0 || r != r2
+	  || memcmp (grub_install_copy_buffer, compare_buffer, r) != 0)
+	break;
+      if (r == 0)
+	{
+	  ret = 1;
+	  break;
+	}
+    }
+
+ out:
+  grub_util_fd_close (out);
+  if (!ret)
+    grub_util_fd_seek (in, 0);
+  return ret;
+}
 
 int
 grub_install_copy_file (const char *src,
@@ -81,8 +163,8 @@ grub_install_copy_file (const char *src,
 {
   grub_util_fd_t in, out;  
   ssize_t r;
-
-  grub_util_info ("copying `%s' -> `%s'", src, dst);
+  char *dst_new;
+  int in_place;
 
   in = grub_util_fd_open (src, GRUB_UTIL_FD_O_RDONLY);
   if (!GRUB_UTIL_FD_IS_VALID (in))
@@ -93,19 +175,40 @@ grub_install_copy_file (const char *src,
 	grub_util_info (_("cannot open `%s': %s"), src, grub_util_fd_strerror ());
       return 0;
     }
-  out = grub_util_fd_open (dst, GRUB_UTIL_FD_O_WRONLY
+
+  if (!grub_install_copy_buffer)
+    grub_install_copy_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
+
+  keep_file (dst);
+
+  /* Installs mostly rewrite what is there already, and /boot is often
+     slow to write to.  */
+  if (is_up_to_date (in, src, dst))
+    {
+      grub_util_info ("`%s' is up to date", dst);
+      grub_util_fd_close (in);
+      return 1;
+    }
+
+  grub_util_info ("copying `%s' -> `%s'", src, dst);
+
+  /* Write under a new name and rename over the old file, so that an
+     interrupted install doesn't leave a truncated module behind.  A
+     symlink is written through as before.  */
+  in_place = grub_util_is_regular (dst) && grub_util_is_special_file (dst);
+  dst_new = in_place ? xstrdup (dst) : xasprintf ("%s.new", dst);
+
+  out = grub_util_fd_open (dst_new, GRUB_UTIL_FD_O_WRONLY
 			   | GRUB_UTIL_FD_O_CREATTRUNC);
   if (!GRUB_UTIL_FD_IS_VALID (out))
     {
-      grub_util_error (_("cannot open `%s': %s"), dst,
+      grub_util_error (_("cannot open `%s': %s"), dst_new,
 		       grub_util_fd_strerror ());
       grub_util_fd_close (in);
+      free (dst_new);
       return 0;
     }
 
-  if (!grub_install_copy_buffer)
-    grub_install_copy_buffer = xmalloc (GRUB_INSTALL_COPY_BUFFER_SIZE);
- 
   while (1)
     {
       r = grub_util_fd_read (in, grub_install_copy_buffer, GRUB_INSTALL_COPY_BUFFER_SIZE);
@@ -121,6 +224,15 @@ grub_install_copy_file (const char *src,
     grub_util_error (_("cannot copy `%s' to `%s': %s"),
 		     src, dst, grub_util_fd_strerror ());
 
+  if (!in_place && grub_util_rename (dst_new, dst))
+    {
+      /* Windows doesn't rename over an existing file.  */
+      grub_util_unlink (dst);
+      if (grub_util_rename (dst_new, dst))
+	grub_util_error (_("cannot rename the file %s to %s"), dst_new, dst);
+    }
+  free (dst_new);
+
   return 1;
 }
 
@@ -135,10 +247,17 @@ grub_install_compress_file (const char *in_name,
     ret = grub_install_copy_file (in_name, out_name, is_needed);
   else
     {
+      /* Compress aside, the result is installed only if it differs.  */
+      char *tmp = grub_util_make_temporary_file ();
+
       grub_util_info ("compressing `%s' -> `%s'", in_name, out_name);
-      ret = !compress_func (in_name, out_name);
+      ret = !compress_func (in_name, tmp);
       if (!ret && is_needed)
 	grub_util_warn (_("can't compress `%s' to `%s'"), in_name, out_name);
+      if (ret)
+	ret = grub_install_copy_file (tmp, out_name, is_needed);
+      grub_util_unlink (tmp);
+      free (tmp);
     }
 
   if (!ret && is_needed)
@@ -201,11 +320,14 @@ clean_grub_dir (const char *di)
 	  || strcmp (de->d_name, "efiemu32.o") == 0
 	  || strcmp (de->d_name, "efiemu64.o") == 0)
 	{
-	  char *x = grub_util_path_concat (2, di, de->d_name);
-	  if (grub_util_unlink (x) < 0)
-	    grub_util_error (_("cannot delete `%s': %s"), x,
-			     grub_util_fd_strerror ());
-	  free (x);
+	  if (n_stale_files == n_stale_alloc)
+	    {
+	      n_stale_alloc = 2 * n_stale_alloc + 16;
+	      stale_files = xrealloc (stale_files, n_stale_alloc
+				      * sizeof (stale_files[0]));
+	    }
+	  stale_files[n_stale_files++] = grub_util_path_concat (2, di,
+								 de->d_name);
 	}
     }
   grub_util_fd_closedir (d);
@@ -318,6 +440,8 @@ grub_install_parse (int key, char *arg)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	compression = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	compression = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -386,6 +510,16 @@ grub_install_parse (int key, char *arg)
 	  compress_func = grub_install_compress_lzop;
 	  return 1;
 	}
+      if (strcmp (arg, "lz4") == 0)
+	{
+	  compress_func = grub_install_compress_lz4;
+	  return 1;
+	}
+      if (strcmp (arg, "zstd") == 0)
+	{
+	  compress_func = grub_install_compress_zstd;
+	  return 1;
+	}
       grub_util_error (_("Unrecognized compression `%s'"), arg);
     case GRUB_INSTALL_OPTIONS_GRUB_MKIMAGE:
       return 1;
@@ -415,6 +549,16 @@ decompressors (void)
       grub_install_push_module ("gcry_crc");
       return 3;
     }
+  if (compress_func == grub_install_compress_lz4)
+    {
+      grub_install_push_module ("lz4io");
+      return 1;
+    }
+  if (compress_func == grub_install_compress_zstd)
+    {
+      grub_install_push_module ("zstdio");
+      return 1;
+    }
   return 0;
 }
 
@@ -432,6 +576,7 @@ grub_install_make_image_wrap_file (const char *dir, const char *prefix,
       [GRUB_COMPRESSION_NONE] = "none",
       [GRUB_COMPRESSION_XZ] = "xz",
       [GRUB_COMPRESSION_LZMA] = "lzma",
+      [GRUB_COMPRESSION_LZ4] = "lz4",
     };
   grub_size_t slen = 1;
   char *s, *p;
@@ -717,15 +862,14 @@ grub_install_get_platform_platform (enum grub_install_plat platid)
   return platforms[platid].platform;
 }
 
-
+/* Copy the modules and lists of platform PLATID from SRC to DST.  */
 void
-grub_install_copy_files (const char *src,
-			 const char *dst,
-			 enum grub_install_plat platid)
+grub_install_copy_platform_files (const char *src,
+				  const char *dst,
+				  enum grub_install_plat platid)
 {
-  char *dst_platform, *dst_locale, *dst_fonts;
-  const char *pkgdatadir = grub_util_get_pkgdatadir ();
-  char *themes_dir;
+  char *dst_platform;
+  size_t i;
 
   {
     char *platform;
@@ -734,13 +878,8 @@ grub_install_copy_files (const char *src,
     dst_platform = grub_util_path_concat (2, dst, platform);
     free (platform);
   }
-  dst_locale = grub_util_path_concat (2, dst, "locale");
-  dst_fonts = grub_util_path_concat (2, dst, "fonts");
   grub_install_mkdir_p (dst_platform);
-  grub_install_mkdir_p (dst_locale);
-  clean_grub_dir (dst);
   clean_grub_dir (dst_platform);
-  clean_grub_dir (dst_locale);
 
   if (install_modules.is_default)
     copy_by_ext (src, dst_platform, ".mod", 1);
@@ -773,7 +912,6 @@ grub_install_copy_files (const char *src,
 			       "parttool.lst",
 			       "video.lst", "crypto.lst",
 			       "terminal.lst", "modinfo.sh" };
-  size_t i;
 
   for (i = 0; i < ARRAY_SIZE (pkglib_DATA); i++)
     {
@@ -787,6 +925,26 @@ grub_install_copy_files (const char *src,
       free (dstf);
     }
 
+  remove_stale_files ();
+  free (dst_platform);
+}
+
+/* Copy what all platforms installed to DST share: locales, themes and
+   fonts.  SRC is the directory of any of them.  */
+void
+grub_install_copy_shared_files (const char *src, const char *dst)
+{
+  char *dst_locale, *dst_fonts;
+  const char *pkgdatadir = grub_util_get_pkgdatadir ();
+  char *themes_dir;
+  size_t i;
+
+  dst_locale = grub_util_path_concat (2, dst, "locale");
+  dst_fonts = grub_util_path_concat (2, dst, "fonts");
+  grub_install_mkdir_p (dst_locale);
+  clean_grub_dir (dst);
+  clean_grub_dir (dst_locale);
+
   if (install_locales.is_default)
     {
       char *srcd = grub_util_path_concat (2, src, "po");
@@ -892,11 +1050,20 @@ grub_install_copy_files (const char *src,
       free (dstf);
     }
 
-  free (dst_platform);
+  remove_stale_files ();
   free (dst_locale);
   free (dst_fonts);
 }
 
+void
+grub_install_copy_files (const char *src,
+			 const char *dst,
+			 enum grub_install_plat platid)
+{
+  grub_install_copy_platform_files (src, dst, platid);
+  grub_install_copy_shared_files (src, dst);
+}
+
 enum grub_install_plat
 grub_install_get_target (const char *src)
 {
@@ -77,9 +77,13 @@ static struct argp_option options[] = {
   {"pubkey",   'k', N_("FILE"), 0, N_("embed FILE as public key for signature checking"), 0},
   /* TRANSLATORS: NOTE is a name of segment.  */
   {"note",   'n', 0, 0, N_("add NOTE segment for CHRP IEEE1275"), 0},
+  {"bundle",   'b', 0, 0,
+   N_("write the modules and their dependencies as a bundle for the platform"
+      " directory, instead of generating an image"), 0},
   {"output",  'o', N_("FILE"), 0, N_("output a generated image to FILE [default=stdout]"), 0},
   {"format",  'O', N_("FORMAT"), 0, 0, 0},
-  {"compression",  'C', "(xz|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"compression",  'C', "(xz|lz4|none|auto)", 0, N_("choose the compression to use for core image"), 0},
+  {"threads",  't', N_("N"), 0, N_("compress with up to N threads, xz only [default=1]"), 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
@@ -122,6 +126,7 @@ struct arguments
   char *font;
   char *config;
   int note;
+  int bundle;
   const struct grub_install_image_target_desc *image_target;
   grub_compression_t comp;
 };
@@ -164,6 +169,10 @@ argp_parser (int key, char *arg, struct argp_state *state)
       arguments->note = 1;
       break;
 
+    case 'b':
+      arguments->bundle = 1;
+      break;
+
     case 'm':
       if (arguments->memdisk)
 	free (arguments->memdisk);
@@ -200,6 +209,8 @@ argp_parser (int key, char *arg, struct argp_state *state)
 			   _("grub-mkimage is compiled without XZ support"));
 #endif
 	}
+      else if (grub_strcmp (arg, "lz4") == 0)
+	arguments->comp = GRUB_COMPRESSION_LZ4;
       else if (grub_strcmp (arg, "none") == 0)
 	arguments->comp = GRUB_COMPRESSION_NONE;
       else if (grub_strcmp (arg, "auto") == 0)
@@ -208,6 +219,12 @@ argp_parser (int key, char *arg, struct argp_state *state)
 	grub_util_error (_("Unknown compression format %s"), arg);
       break;
 
+    case 't':
+      grub_install_compression_threads = strtol (arg, NULL, 0);
+      if (grub_install_compression_threads < 1)
+	grub_install_compression_threads = 1;
+      break;
+
     case 'p':
       if (arguments->prefix)
 	free (arguments->prefix);
@@ -266,7 +283,7 @@ main (int argc, char *argv[])
       exit(1);
     }
 
-  if (!arguments.prefix)
+  if (!arguments.prefix && !arguments.bundle)
     {
       char *program = xstrdup(program_name);
       printf ("%s\n", _("Prefix not specified (use the -p option)."));
@@ -294,12 +311,16 @@ main (int argc, char *argv[])
       strcpy (ptr, dn);
     }
 
-  grub_install_generate_image (arguments.dir, arguments.prefix, fp,
-			       arguments.output, arguments.modules,
-			       arguments.memdisk, arguments.pubkeys,
-			       arguments.npubkeys, arguments.config,
-			       arguments.image_target, arguments.note,
-			       arguments.comp);
+  if (arguments.bundle)
+    grub_install_generate_bundle (arguments.dir, fp, arguments.output,
+				  arguments.modules, arguments.image_target);
+  else
+    grub_install_generate_image (arguments.dir, arguments.prefix, fp,
+				 arguments.output, arguments.modules,
+				 arguments.memdisk, arguments.pubkeys,
+				 arguments.npubkeys, arguments.config,
+				 arguments.image_target, arguments.note,
+				 arguments.comp);
 
   grub_util_file_sync  (fp);
   fclose (fp);
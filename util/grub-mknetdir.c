@@ -19,6 +19,7 @@
 
 #include <grub/util/install.h>
 #include <grub/emu/config.h>
+#include <grub/emu/exec.h>
 #include <grub/util/misc.h>
 
 #include <string.h>
@@ -38,7 +39,8 @@ enum
     OPTION_NET_DIRECTORY = 0x301,
     OPTION_SUBDIR,
     OPTION_DEBUG,
-    OPTION_DEBUG_IMAGE
+    OPTION_DEBUG_IMAGE,
+    OPTION_JOBS
   };
 
 static struct argp_option options[] = {
@@ -49,6 +51,8 @@ static struct argp_option options[] = {
    0, N_("relative subdirectory on network server"), 2},
   {"debug", OPTION_DEBUG, 0, OPTION_HIDDEN, 0, 2},
   {"debug-image", OPTION_DEBUG_IMAGE, N_("STRING"), OPTION_HIDDEN, 0, 2},
+  {"jobs", OPTION_JOBS, N_("N"),
+   0, N_("build up to N platforms at the same time [default=1]"), 2},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -75,6 +79,9 @@ argp_parser (int key, char *arg, struct argp_state *state)
       free (debug_image);
       debug_image = xstrdup (arg);
       return 0;
+    case OPTION_JOBS:
+      grub_util_set_jobs (strtol (arg, NULL, 0));
+      return 0;
 
     case ARGP_KEY_ARG:
     default:
@@ -120,7 +127,7 @@ process_input_dir (const char *input_dir, enum grub_install_plat platform)
   char *grub_cfg;
   FILE *cfg;
 
-  grub_install_copy_files (input_dir, base, platform);
+  grub_install_copy_platform_files (input_dir, base, platform);
   grub_util_unlink (load_cfg);
 
   if (debug_image)
@@ -169,6 +176,20 @@ process_input_dir (const char *input_dir, enum grub_install_plat platform)
   free (grubdir);
 }
 
+struct input_job
+{
+  const char *input_dir;
+  enum grub_install_plat platform;
+};
+
+static void
+run_input_job (void *data)
+{
+  struct input_job *job = data;
+
+  process_input_dir (job->input_dir, job->platform);
+}
+
 
 int
 main (int argc, char *argv[])
@@ -193,7 +214,9 @@ main (int argc, char *argv[])
 
   if (!grub_install_source_directory)
     {
+      char *platdirs[GRUB_INSTALL_PLATFORM_MAX] = { 0 };
       enum grub_install_plat plat;
+      int shared_done = 0;
 
       for (plat = 0; plat < GRUB_INSTALL_PLATFORM_MAX; plat++)
 	if (targets[plat].mkimage_target)
@@ -208,13 +231,28 @@ main (int argc, char *argv[])
 		free (platdir);
 		continue;
 	      }
-	    process_input_dir (platdir, plat);
+	    platdirs[plat] = platdir;
+	  }
+
+      /* Locales, themes and fonts are shared by all platforms, copy them
+	 once before the platforms are processed side by side.  */
+      for (plat = 0; plat < GRUB_INSTALL_PLATFORM_MAX; plat++)
+	if (platdirs[plat])
+	  {
+	    struct input_job job = { platdirs[plat], plat };
+
+	    if (!shared_done)
+	      grub_install_copy_shared_files (platdirs[plat], base);
+	    shared_done = 1;
+	    grub_util_run_job (run_input_job, &job);
 	  }
+      grub_util_wait_jobs ();
     }
   else
     {
       enum grub_install_plat plat;
       plat = grub_install_get_target (grub_install_source_directory);
+      grub_install_copy_shared_files (grub_install_source_directory, base);
       process_input_dir (grub_install_source_directory, plat);
     }
   return 0;
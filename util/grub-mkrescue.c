@@ -89,7 +89,8 @@ enum
     OPTION_PRODUCT_NAME,
     OPTION_PRODUCT_VERSION,
     OPTION_SPARC_BOOT,
-    OPTION_ARCS_BOOT
+    OPTION_ARCS_BOOT,
+    OPTION_JOBS
   };
 
 static struct argp_option options[] = {
@@ -110,6 +111,7 @@ static struct argp_option options[] = {
   {"product-version", OPTION_PRODUCT_VERSION, N_("STRING"), 0, N_("use STRING as product version"), 2},
   {"sparc-boot", OPTION_SPARC_BOOT, 0, 0, N_("enable sparc boot. Disables HFS+, APM, ARCS and boot as disk image for i386-pc"), 2},
   {"arcs-boot", OPTION_ARCS_BOOT, 0, 0, N_("enable ARCS (big-endian mips machines, mostly SGI) boot. Disables HFS+, APM, sparc64 and boot as disk image for i386-pc"), 2},
+  {"jobs", OPTION_JOBS, N_("N"), 0, N_("build up to N platforms at the same time [default=1]"), 2},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -212,6 +214,10 @@ argp_parser (int key, char *arg, struct argp_state *state)
       xorriso = xstrdup (arg);
       return 0;
 
+    case OPTION_JOBS:
+      grub_util_set_jobs (strtol (arg, NULL, 0));
+      return 0;
+
     default:
       return ARGP_ERR_UNKNOWN;
     }
@@ -243,11 +249,34 @@ write_part (FILE *f, const char *srcdir)
   fclose (in);
 }
 
+struct image_job
+{
+  enum grub_install_plat plat;
+  const char *prefix;
+  const char *output;
+  char *load_cfg;
+  const char *mkimage_target;
+};
+
+/* The modules pushed by the caller are already in place, a job run in a
+   child process sees them as they were when it was started.  */
+static void
+run_image_job (void *data)
+{
+  struct image_job *job = data;
+
+  grub_install_make_image_wrap (source_dirs[job->plat], job->prefix,
+				job->output, 0, job->load_cfg,
+				job->mkimage_target, 0);
+  grub_util_unlink (job->load_cfg);
+}
+
 static void
 make_image_abs (enum grub_install_plat plat,
 		const char *mkimage_target,
 		const char *output)
 {
+  struct image_job job;
   char *load_cfg;
   FILE *load_cfg_f;
 
@@ -266,14 +295,18 @@ make_image_abs (enum grub_install_plat plat,
   write_part (load_cfg_f, source_dirs[plat]);
   fclose (load_cfg_f);
 
+  job.plat = plat;
+  job.prefix = "/boot/grub";
+  job.output = output;
+  job.load_cfg = load_cfg;
+  job.mkimage_target = mkimage_target;
+
   grub_install_push_module ("search");
   grub_install_push_module ("iso9660");
-  grub_install_make_image_wrap (source_dirs[plat], "/boot/grub", output,
-				0, load_cfg,
-				mkimage_target, 0);
+  grub_util_run_job (run_image_job, &job);
   grub_install_pop_module ();
   grub_install_pop_module ();
-  grub_util_unlink (load_cfg);
+  free (load_cfg);
 }
 
 static void
@@ -291,6 +324,7 @@ make_image_fwdisk_abs (enum grub_install_plat plat,
 		       const char *mkimage_target,
 		       const char *output)
 {
+  struct image_job job;
   char *load_cfg;
   FILE *load_cfg_f;
 
@@ -306,10 +340,30 @@ make_image_fwdisk_abs (enum grub_install_plat plat,
   write_part (load_cfg_f, source_dirs[plat]);
   fclose (load_cfg_f);
 
+  job.plat = plat;
+  job.prefix = "()/boot/grub";
+  job.output = output;
+  job.load_cfg = load_cfg;
+  job.mkimage_target = mkimage_target;
+
   grub_install_push_module ("iso9660");
-  grub_install_make_image_wrap (source_dirs[plat], "()/boot/grub", output,
-				0, load_cfg, mkimage_target, 0);
+  grub_util_run_job (run_image_job, &job);
   grub_install_pop_module ();
+  free (load_cfg);
+}
+
+struct copy_job
+{
+  const char *src;
+  enum grub_install_plat plat;
+};
+
+static void
+run_copy_job (void *data)
+{
+  struct copy_job *job = data;
+
+  grub_install_copy_platform_files (job->src, boot_grub, job->plat);
 }
 
 static int
@@ -509,9 +563,25 @@ main (int argc, char *argv[])
 	      continue;
 	    }
 	  source_dirs[plat] = platdir;
-	  grub_install_copy_files (platdir,
-				   boot_grub, plat);
 	}
+
+      /* Locales, themes and fonts are the same for all platforms,
+	 copy them once.  */
+      for (plat = 0; plat < GRUB_INSTALL_PLATFORM_MAX; plat++)
+	if (source_dirs[plat])
+	  {
+	    grub_install_copy_shared_files (source_dirs[plat], boot_grub);
+	    break;
+	  }
+
+      for (plat = 0; plat < GRUB_INSTALL_PLATFORM_MAX; plat++)
+	if (source_dirs[plat])
+	  {
+	    struct copy_job job = { source_dirs[plat], plat };
+	    grub_util_run_job (run_copy_job, &job);
+	  }
+      /* Images go next to the modules, whose copy would remove them.  */
+      grub_util_wait_jobs ();
     }
   else
     {
@@ -760,6 +830,8 @@ main (int argc, char *argv[])
 			     imgname);
       free (imgname);
 
+      grub_util_wait_jobs ();
+
       if (source_dirs[GRUB_INSTALL_PLATFORM_I386_EFI])
 	{
 	  imgname = grub_util_path_concat (2, efidir_efi_boot, "boot.efi");
@@ -911,6 +983,8 @@ main (int argc, char *argv[])
   grub_install_pop_module ();
   grub_install_pop_module ();
 
+  grub_util_wait_jobs ();
+
   if (rom_directory)
     {
       const struct
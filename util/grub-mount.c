@@ -40,6 +40,8 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #pragma GCC diagnostic ignored "-Wmissing-prototypes"
 #pragma GCC diagnostic ignored "-Wmissing-declarations"
@@ -58,6 +60,25 @@ static char **fuse_args = NULL;
 static int fuse_argc = 0;
 static int num_disks = 0;
 static int mount_crypt = 0;
+static int multithreaded = 0;
+
+/* GRUB itself isn't reentrant.  When FUSE runs several threads, every
+   call into it holds this lock.  */
+static pthread_mutex_t grub_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Reads smaller than this fetch this much, later reads of the same
+   handle are then served from the buffer without taking grub_lock.  */
+#define READAHEAD_SIZE (128 * 1024)
+
+struct mount_file
+{
+  grub_file_t file;
+  /* Protects the fields below.  */
+  pthread_mutex_t lock;
+  char *buf;
+  off_t buf_off;
+  size_t buf_len;
+};
 
 static grub_err_t
 execute_command (const char *name, int n, char **args)
@@ -147,7 +168,7 @@ fuse_getattr_find_file (const char *cur_filename,
 }
 
 static int
-fuse_getattr (const char *path, struct stat *st)
+fuse_getattr_real (const char *path, struct stat *st)
 {
   struct fuse_getattr_ctx ctx;
   char *pathname, *path2;
@@ -236,27 +257,47 @@ fuse_getattr (const char *path, struct stat *st)
   return 0;
 }
 
+static int
+fuse_getattr (const char *path, struct stat *st)
+{
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
+  ret = fuse_getattr_real (path, st);
+  pthread_mutex_unlock (&grub_lock);
+  return ret;
+}
+
 static int
 fuse_opendir (const char *path, struct fuse_file_info *fi) 
 {
   return 0;
 }
 
-/* FIXME */
-static grub_file_t files[65536];
-static int first_fd = 1;
-
 static int 
-fuse_open (const char *path, struct fuse_file_info *fi __attribute__ ((unused)))
+fuse_open (const char *path, struct fuse_file_info *fi)
 {
+  struct mount_file *mf;
   grub_file_t file;
+  int ret;
+
+  pthread_mutex_lock (&grub_lock);
   file = grub_file_open (path);
+  ret = translate_error ();
+  pthread_mutex_unlock (&grub_lock);
   if (! file)
-    return translate_error ();
-  files[first_fd++] = file;
-  fi->fh = first_fd;
-  files[first_fd++] = file;
-  grub_errno = GRUB_ERR_NONE;
+    return ret;
+
+  mf = xmalloc (sizeof (*mf));
+  mf->file = file;
+  pthread_mutex_init (&mf->lock, NULL);
+  mf->buf = NULL;
+  mf->buf_off = 0;
+  mf->buf_len = 0;
+
+  fi->fh = (uintptr_t) mf;
+  /* Images are mounted read-only, what the kernel caches stays valid.  */
+  fi->keep_cache = 1;
   return 0;
 } 
 
@@ -264,30 +305,68 @@ static int
 fuse_read (const char *path, char *buf, size_t sz, off_t off,
 	   struct fuse_file_info *fi)
 {
-  grub_file_t file = files[fi->fh];
+  struct mount_file *mf = (struct mount_file *) (uintptr_t) fi->fh;
+  grub_file_t file = mf->file;
   grub_ssize_t size;
+  off_t buf_end;
+  int ret;
 
   if (off > file->size)
     return -EINVAL;
 
+  pthread_mutex_lock (&mf->lock);
+
+  buf_end = mf->buf_off + mf->buf_len;
+  if (off >= mf->buf_off && off < buf_end
+      && (off + (off_t) sz <= buf_end || (grub_off_t) buf_end == file->size))
+    {
+      if (off + (off_t) sz > buf_end)
+	sz = buf_end - off;
+      memcpy (buf, mf->buf + (off - mf->buf_off), sz);
+      pthread_mutex_unlock (&mf->lock);
+      return sz;
+    }
+
+  pthread_mutex_lock (&grub_lock);
   file->offset = off;
-  
-  size = grub_file_read (file, buf, sz);
-  if (size < 0)
-    return translate_error ();
+  if (sz >= READAHEAD_SIZE)
+    size = grub_file_read (file, buf, sz);
   else
     {
-      grub_errno = GRUB_ERR_NONE;
-      return size;
+      if (! mf->buf)
+	mf->buf = xmalloc (READAHEAD_SIZE);
+      mf->buf_len = 0;
+      size = grub_file_read (file, mf->buf, READAHEAD_SIZE);
+      if (size >= 0)
+	{
+	  mf->buf_off = off;
+	  mf->buf_len = size;
+	  if ((size_t) size > sz)
+	    size = sz;
+	  memcpy (buf, mf->buf, size);
+	}
     }
+  ret = (size < 0) ? translate_error () : size;
+  grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+
+  pthread_mutex_unlock (&mf->lock);
+  return ret;
 } 
 
 static int 
 fuse_release (const char *path, struct fuse_file_info *fi)
 {
-  grub_file_close (files[fi->fh]);
-  files[fi->fh] = NULL;
+  struct mount_file *mf = (struct mount_file *) (uintptr_t) fi->fh;
+
+  pthread_mutex_lock (&grub_lock);
+  grub_file_close (mf->file);
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+
+  pthread_mutex_destroy (&mf->lock);
+  free (mf->buf);
+  free (mf);
   return 0;
 }
 
@@ -358,9 +437,11 @@ fuse_readdir (const char *path, void *buf,
 	 && pathname[grub_strlen (pathname) - 1] == '/')
     pathname[grub_strlen (pathname) - 1] = 0;
 
+  pthread_mutex_lock (&grub_lock);
   (fs->dir) (dev, pathname, fuse_readdir_call_fill, &ctx);
-  free (pathname);
   grub_errno = GRUB_ERR_NONE;
+  pthread_mutex_unlock (&grub_lock);
+  free (pathname);
   return 0;
 }
 
@@ -461,6 +542,7 @@ static struct argp_option options[] = {
   {"zfs-key",      'K',
    /* TRANSLATORS: "prompt" is a keyword.  */
    N_("FILE|prompt"), 0, N_("Load zfs crypto key."),                 2},
+  {"threads",   'T', NULL, 0, N_("Serve requests from several threads."), 2},
   {"verbose",   'v', NULL, 0, N_("print verbose messages."), 2},
   {0, 0, 0, 0, 0, 0}
 };
@@ -524,6 +606,10 @@ argp_parser (int key, char *arg, struct argp_state *state)
       mount_crypt = 1;
       return 0;
 
+    case 'T':
+      multithreaded = 1;
+      return 0;
+
     case 'd':
       debug_str = arg;
       return 0;
@@ -567,18 +653,21 @@ main (int argc, char *argv[])
 
   grub_util_host_init (&argc, &argv);
 
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 1) * sizeof (fuse_args[0]));
   fuse_args[fuse_argc] = xstrdup (argv[0]);
   fuse_argc++;
-  /* Run single-threaded.  */
-  fuse_args[fuse_argc] = xstrdup ("-s");
-  fuse_argc++;
 
   argp_parse (&argp, argc, argv, 0, 0, 0);
   
   if (num_disks < 2)
     grub_util_error ("%s", _("need an image and mountpoint"));
-  fuse_args = xrealloc (fuse_args, (fuse_argc + 2) * sizeof (fuse_args[0]));
+  fuse_args = xrealloc (fuse_args, (fuse_argc + 3) * sizeof (fuse_args[0]));
+  /* Run single-threaded unless asked not to.  */
+  if (! multithreaded)
+    {
+      fuse_args[fuse_argc] = xstrdup ("-s");
+      fuse_argc++;
+    }
   fuse_args[fuse_argc] = images[num_disks - 1];
   fuse_argc++;
   num_disks--;
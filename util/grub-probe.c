@@ -44,6 +44,8 @@
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
+#include <setjmp.h>
 
 #define _GNU_SOURCE	1
 
@@ -678,6 +680,10 @@ static struct argp_option options[] = {
   {"target",  't', N_("TARGET"), 0, 0, 0},
   {"verbose",     'v', 0,      0, N_("print verbose messages."), 0},
   {0, '0', 0, 0, N_("separate items in output using ASCII NUL characters"), 0},
+  {"cache",  'c', N_("FILE"), 0,
+   N_("remember how devices were resolved in FILE, and reuse it"), 0},
+  {"batch",  'b', 0, 0,
+   N_("answer queries read from standard input, one argument per line"), 0},
   { 0, 0, 0, 0, 0, 0 }
 };
 
@@ -717,7 +723,9 @@ struct arguments
   size_t device_max;
   size_t ndevices;
   char *dev_map;
+  char *cache;
   int zero_delim;
+  int batch;
 };
 
 static error_t
@@ -751,7 +759,11 @@ argp_parser (int key, char *arg, struct argp_state *state)
 	      break;
 	    }
 	if (i == ARRAY_SIZE (targets))
-	  argp_usage (state);
+	  {
+	    argp_usage (state);
+	    /* Only reached for batch queries.  */
+	    return EINVAL;
+	  }
       }
       break;
 
@@ -763,10 +775,21 @@ argp_parser (int key, char *arg, struct argp_state *state)
       verbosity++;
       break;
 
+    case 'b':
+      arguments->batch = 1;
+      break;
+
+    case 'c':
+      free (arguments->cache);
+      arguments->cache = xstrdup (arg);
+      break;
+
     case ARGP_KEY_NO_ARGS:
+      if (arguments->batch)
+	break;
       fprintf (stderr, "%s", _("No path or device is specified.\n"));
       argp_usage (state);
-      break;
+      return EINVAL;
 
     case ARGP_KEY_ARG:
       assert (arguments->ndevices < arguments->device_max);
@@ -786,10 +809,195 @@ Probe device information for a given path (or device, if the -d option is given)
   NULL, help_filter, NULL
 };
 
+static void
+probe_arguments (struct arguments *arguments)
+{
+  char delim;
+
+  if (print == PRINT_BIOS_HINT
+      || print == PRINT_IEEE1275_HINT || print == PRINT_BAREMETAL_HINT
+      || print == PRINT_EFI_HINT || print == PRINT_ARC_HINT)
+    delim = ' ';
+  else
+    delim = '\n';
+
+  if (arguments->zero_delim)
+    delim = '\0';
+
+  /* Do it.  */
+  if (argument_is_device)
+    probe (NULL, arguments->devices, delim);
+  else
+    probe (arguments->devices[0], NULL, delim);
+
+  if (delim == ' ')
+    putchar ('\n');
+}
+
+static jmp_buf batch_error;
+
+static void
+batch_error_hook (void)
+{
+  longjmp (batch_error, 1);
+}
+
+/* Parse and answer a query of batch mode, whose arguments are ARGV.  */
+static void
+batch_query (int argc, char **argv)
+{
+  struct arguments arguments;
+
+  print = PRINT_FS;
+  argument_is_device = 0;
+
+  memset (&arguments, 0, sizeof (struct arguments));
+  arguments.device_max = argc + 1;
+  arguments.devices = xmalloc ((arguments.device_max + 1)
+			       * sizeof (arguments.devices[0]));
+  memset (arguments.devices, 0, (arguments.device_max + 1)
+	  * sizeof (arguments.devices[0]));
+
+  if (argp_parse (&argp, argc, argv, ARGP_NO_EXIT | ARGP_NO_HELP,
+		  0, &arguments) != 0
+      || arguments.batch || arguments.dev_map || arguments.cache)
+    grub_util_error ("%s", _("Error in parsing command line arguments"));
+  if (arguments.ndevices == 0)
+    grub_util_error ("%s", _("No path or device is specified."));
+  if (arguments.ndevices != 1 && !argument_is_device)
+    grub_util_error (_("Unknown extra argument `%s'."), arguments.devices[1]);
+
+  probe_arguments (&arguments);
+
+  {
+    size_t i;
+    for (i = 0; i < arguments.ndevices; i++)
+      free (arguments.devices[i]);
+  }
+  free (arguments.devices);
+}
+
+static void
+copy_output (FILE *from)
+{
+  char buf[4096];
+  size_t len, total = 0;
+  int last = '\n';
+
+  fflush (from);
+  rewind (from);
+  while ((len = fread (buf, 1, sizeof (buf), from)) > 0)
+    {
+      fwrite (buf, 1, len, stdout);
+      last = buf[len - 1];
+      total += len;
+    }
+  if (total && last != '\n')
+    putchar ('\n');
+
+  rewind (from);
+  if (ftruncate (fileno (from), 0) < 0)
+    grub_util_error (_("cannot write to `%s': %s"), "tmpfile",
+		     strerror (errno));
+}
+
+#define BATCH_MARKER "@@grub-probe@@"
+
+/* Answer queries from standard input until its end, so that the devices
+   are scanned once for all of them.  A query is made of lines of a
+   colon followed by one argument each, ended by an empty line.  The
+   answer is its output, a line of the marker and the exit status, what
+   it printed on stderr, and a line of the marker alone.  */
+static void
+run_batch (void)
+{
+  FILE *out_tmp, *err_tmp;
+  int out_fd, err_fd;
+  char *line = NULL;
+  size_t line_alloc = 0;
+  char **args;
+  int nargs = 1, args_alloc = 8;
+  ssize_t len;
+
+  out_tmp = tmpfile ();
+  err_tmp = tmpfile ();
+  if (!out_tmp || !err_tmp)
+    grub_util_error (_("cannot open `%s': %s"), "tmpfile", strerror (errno));
+  out_fd = dup (1);
+  err_fd = dup (2);
+  if (out_fd < 0 || err_fd < 0)
+    grub_util_error (_("cannot open `%s': %s"), "stdout", strerror (errno));
+
+  args = xmalloc (args_alloc * sizeof (args[0]));
+  args[0] = xstrdup (program_name);
+
+  while ((len = getline (&line, &line_alloc, stdin)) > 0)
+    {
+      int status;
+
+      if (line[len - 1] == '\n')
+	line[--len] = '\0';
+
+      if (line[0] == ':')
+	{
+	  if (nargs + 1 >= args_alloc)
+	    {
+	      args_alloc *= 2;
+	      args = xrealloc (args, args_alloc * sizeof (args[0]));
+	    }
+	  args[nargs++] = xstrdup (line + 1);
+	  continue;
+	}
+      if (line[0] != '\0')
+	continue;
+      args[nargs] = NULL;
+
+      fflush (stdout);
+      fflush (stderr);
+      dup2 (fileno (out_tmp), 1);
+      dup2 (fileno (err_tmp), 2);
+
+      if (setjmp (batch_error) == 0)
+	{
+	  grub_util_error_hook = batch_error_hook;
+	  batch_query (nargs, args);
+	  status = 0;
+	}
+      else
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  status = 1;
+	}
+      grub_util_error_hook = NULL;
+
+      fflush (stdout);
+      fflush (stderr);
+      dup2 (out_fd, 1);
+      dup2 (err_fd, 2);
+
+      copy_output (out_tmp);
+      printf ("%s %d\n", BATCH_MARKER, status);
+      copy_output (err_tmp);
+      printf ("%s\n", BATCH_MARKER);
+      fflush (stdout);
+
+      while (nargs > 1)
+	free (args[--nargs]);
+    }
+
+  while (nargs > 0)
+    free (args[--nargs]);
+  free (args);
+  free (line);
+  fclose (out_tmp);
+  fclose (err_tmp);
+  close (out_fd);
+  close (err_fd);
+}
+
 int
 main (int argc, char *argv[])
 {
-  char delim;
   struct arguments arguments;
 
   grub_util_host_init (&argc, &argv);
@@ -812,7 +1020,17 @@ main (int argc, char *argv[])
     grub_env_set ("debug", "all");
 
   /* Obtain ARGUMENT.  */
-  if (arguments.ndevices != 1 && !argument_is_device)
+  if (arguments.batch)
+    {
+      if (arguments.ndevices)
+	{
+	  fprintf (stderr, _("Unknown extra argument `%s'."),
+		   arguments.devices[0]);
+	  fprintf (stderr, "\n");
+	  exit (1);
+	}
+    }
+  else if (arguments.ndevices != 1 && !argument_is_device)
     {
       char *program = xstrdup(program_name);
       fprintf (stderr, _("Unknown extra argument `%s'."), arguments.devices[1]);
@@ -825,6 +1043,9 @@ main (int argc, char *argv[])
   /* Initialize the emulated biosdisk driver.  */
   grub_util_biosdisk_init (arguments.dev_map ? : DEFAULT_DEVICE_MAP);
 
+  if (arguments.cache)
+    grub_util_dev_cache_open (arguments.cache);
+
   /* Initialize all modules. */
   grub_init_all ();
   grub_gcry_init_all ();
@@ -838,26 +1059,14 @@ main (int argc, char *argv[])
   grub_mdraid1x_init ();
   grub_lvm_init ();
 
-  if (print == PRINT_BIOS_HINT
-      || print == PRINT_IEEE1275_HINT || print == PRINT_BAREMETAL_HINT
-      || print == PRINT_EFI_HINT || print == PRINT_ARC_HINT)
-    delim = ' ';
-  else
-    delim = '\n';
-
-  if (arguments.zero_delim)
-    delim = '\0';
-
-  /* Do it.  */
-  if (argument_is_device)
-    probe (NULL, arguments.devices, delim);
+  if (arguments.batch)
+    run_batch ();
   else
-    probe (arguments.devices[0], NULL, delim);
-
-  if (delim == ' ')
-    putchar ('\n');
+    probe_arguments (&arguments);
 
   /* Free resources.  */
+  if (arguments.cache)
+    grub_util_dev_cache_close ();
   grub_gcry_fini_all ();
   grub_fini_all ();
   grub_util_biosdisk_fini ();
@@ -870,6 +1079,7 @@ main (int argc, char *argv[])
   free (arguments.devices);
 
   free (arguments.dev_map);
+  free (arguments.cache);
 
   return 0;
 }
@@ -96,6 +96,17 @@ cryptolist.write ("AES-128: gcry_rijndael\n");
 cryptolist.write ("AES-192: gcry_rijndael\n");
 cryptolist.write ("AES-256: gcry_rijndael\n");
 
+# aes_accel only registers itself when the CPU can run it and takes
+# precedence over gcry_rijndael then.  Where it isn't built loading it just
+# fails.
+for name in ["AES", "AES192", "AES256", "RIJNDAEL", "RIJNDAEL192",
+             "RIJNDAEL256", "AES128", "AES-128", "AES-192", "AES-256"]:
+    cryptolist.write ("%s: aes_accel\n" % name);
+
+# Likewise sha_accel for the digests it implements.
+for name in ["SHA1", "SHA224", "SHA256"]:
+    cryptolist.write ("%s: sha_accel\n" % name);
+
 cryptolist.write ("ADLER32: adler32\n");
 cryptolist.write ("CRC64: crc64\n");
 
@@ -51,6 +51,10 @@
 
 #ifdef USE_LIBLZMA
 #include <lzma.h>
+/* The multithreaded encoder is stable since 5.2.0.  */
+#if LZMA_VERSION >= 50020002
+#define USE_LIBLZMA_MT 1
+#endif
 #endif
 
 #define TARGET_NO_FIELD 0xffffffff
@@ -748,7 +752,100 @@ compress_kernel_lzma (char *kernel_img, size_t kernel_size,
     grub_util_error ("%s", _("cannot compress the kernel image"));
 }
 
+/* LZ4 block format, without the frame around it: the stub in
+   boot/i386/pc/lz4_decode.S trades ratio for decoding much faster than
+   LZMA does.  The format wants the last match to start at least
+   LZ4_MF_LIMIT bytes before the end and the last LZ4_LAST_LITERALS bytes
+   to be literals.  */
+#define LZ4_HASH_BITS 16
+#define LZ4_MIN_MATCH 4
+#define LZ4_MAX_OFFSET 0xffff
+#define LZ4_MF_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+
+static grub_uint8_t *
+lz4_put_length (grub_uint8_t *out, size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *out++ = 255;
+  *out++ = len;
+  return out;
+}
+
+static grub_uint8_t *
+lz4_put_literals (grub_uint8_t *out, const grub_uint8_t *lit, size_t len,
+		  grub_uint8_t **token)
+{
+  *token = out++;
+  **token = (len >= 15 ? 15 : len) << 4;
+  if (len >= 15)
+    out = lz4_put_length (out, len - 15);
+  memcpy (out, lit, len);
+  return out + len;
+}
+
+static void
+compress_kernel_lz4 (char *kernel_img, size_t kernel_size,
+		     char **core_img, size_t *core_size)
+{
+  const grub_uint8_t *in = (const grub_uint8_t *) kernel_img;
+  const grub_uint8_t *end = in + kernel_size;
+  const grub_uint8_t *ip = in, *anchor = in;
+  grub_uint8_t *out, *token;
+  /* Last position + 1 of each hashed 4-byte sequence, 0 if none.  */
+  grub_uint32_t *table;
+  size_t table_size = sizeof (*table) << LZ4_HASH_BITS;
+
+  table = xmalloc (table_size);
+  memset (table, 0, table_size);
+  *core_img = xmalloc (kernel_size + kernel_size / 255 + 16);
+  out = (grub_uint8_t *) *core_img;
+
+  while (kernel_size > LZ4_MF_LIMIT && ip < end - LZ4_MF_LIMIT)
+    {
+      const grub_uint8_t *ref;
+      grub_uint32_t seq, h;
+      size_t len;
+
+      memcpy (&seq, ip, sizeof (seq));
+      h = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+      ref = table[h] ? in + table[h] - 1 : NULL;
+      table[h] = ip - in + 1;
+      if (!ref || ip - ref > LZ4_MAX_OFFSET
+	  || memcmp (ref, ip, LZ4_MIN_MATCH) != 0)
+	{
+	  ip++;
+	  continue;
+	}
+
+      len = LZ4_MIN_MATCH;
+      while (ip + len < end - LZ4_LAST_LITERALS && ref[len] == ip[len])
+	len++;
+
+      out = lz4_put_literals (out, anchor, ip - anchor, &token);
+      *out++ = (ip - ref) & 0xff;
+      *out++ = (ip - ref) >> 8;
+      len -= LZ4_MIN_MATCH;
+      *token |= len >= 15 ? 15 : len;
+      if (len >= 15)
+	out = lz4_put_length (out, len - 15);
+
+      ip += len + LZ4_MIN_MATCH;
+      anchor = ip;
+    }
+
+  out = lz4_put_literals (out, anchor, end - anchor, &token);
+  *core_size = out - (grub_uint8_t *) *core_img;
+  free (table);
+}
+
+int grub_install_compression_threads = 1;
+
 #ifdef USE_LIBLZMA
+/* Each thread compresses blocks of this size on its own.  Fixing it keeps
+   the output the same whatever the number of threads.  */
+#define XZ_MT_BLOCK_SIZE (1 << 20)
+
 static void
 compress_kernel_xz (char *kernel_img, size_t kernel_size,
 		    char **core_img, size_t *core_size)
@@ -772,7 +869,24 @@ compress_kernel_xz (char *kernel_img, size_t kernel_size,
     { .id = LZMA_VLI_UNKNOWN, .options = NULL}
   };
 
-  xzret = lzma_stream_encoder (&strm, fltrs, LZMA_CHECK_NONE);
+  if (grub_install_compression_threads > 1)
+    {
+#ifdef USE_LIBLZMA_MT
+      lzma_mt mt = {
+	.threads = grub_install_compression_threads,
+	.block_size = XZ_MT_BLOCK_SIZE,
+	.filters = fltrs,
+	.check = LZMA_CHECK_NONE,
+      };
+
+      xzret = lzma_stream_encoder_mt (&strm, &mt);
+#else
+      grub_util_warn ("%s", _("this liblzma can't compress with threads"));
+      xzret = lzma_stream_encoder (&strm, fltrs, LZMA_CHECK_NONE);
+#endif
+    }
+  else
+    xzret = lzma_stream_encoder (&strm, fltrs, LZMA_CHECK_NONE);
   if (xzret != LZMA_OK)
     grub_util_error ("%s", _("cannot compress the kernel image"));
 
@@ -795,6 +909,7 @@ compress_kernel_xz (char *kernel_img, size_t kernel_size,
     }
 
   *core_size -= strm.avail_out;
+  lzma_end (&strm);
 }
 #endif
 
@@ -811,6 +926,14 @@ compress_kernel (const struct grub_install_image_target_desc *image_target, char
       return;
     }
 
+  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
+      && (comp == GRUB_COMPRESSION_LZ4))
+    {
+      compress_kernel_lz4 (kernel_img, kernel_size, core_img,
+			   core_size);
+      return;
+    }
+
 #ifdef USE_LIBLZMA
  if (image_target->flags & PLATFORM_FLAGS_DECOMPRESSORS
      && (comp == GRUB_COMPRESSION_XZ))
@@ -1006,9 +1129,10 @@ grub_install_generate_image (const char *dir, const char *prefix,
   if (comp == GRUB_COMPRESSION_AUTO)
     comp = image_target->default_compression;
 
-  if (image_target->id == IMAGE_I386_PC
-      || image_target->id == IMAGE_I386_PC_PXE
-      || image_target->id == IMAGE_I386_PC_ELTORITO)
+  if ((image_target->id == IMAGE_I386_PC
+       || image_target->id == IMAGE_I386_PC_PXE
+       || image_target->id == IMAGE_I386_PC_ELTORITO)
+      && comp != GRUB_COMPRESSION_LZ4)
     comp = GRUB_COMPRESSION_LZMA;
 
   path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
@@ -1230,6 +1354,9 @@ grub_install_generate_image (const char *dir, const char *prefix,
 	case GRUB_COMPRESSION_LZMA:
 	  name = "lzma_decompress.img";
 	  break;
+	case GRUB_COMPRESSION_LZ4:
+	  name = "lz4_decompress.img";
+	  break;
 	case GRUB_COMPRESSION_NONE:
 	  name = "none_decompress.img";
 	  break;
@@ -1924,3 +2051,71 @@ grub_install_generate_image (const char *dir, const char *prefix,
       path_list = next;
     }
 }
+
+void
+grub_install_generate_bundle (const char *dir, FILE *out,
+			      const char *outname, char *mods[],
+			      const struct grub_install_image_target_desc *image_target)
+{
+  struct grub_util_path_list *path_list, *p, *next;
+  struct grub_module_bundle_header *header;
+  struct grub_module_bundle_entry *entries;
+  size_t count = 0, offset, i;
+  char *bundle;
+
+  path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
+
+  for (p = path_list; p; p = p->next)
+    count++;
+
+  offset = ALIGN_UP (sizeof (*header) + count * sizeof (*entries),
+		     GRUB_MODULE_BUNDLE_ALIGN);
+  for (p = path_list; p; p = p->next)
+    offset += ALIGN_UP (grub_util_get_image_size (p->name),
+			GRUB_MODULE_BUNDLE_ALIGN);
+  if (offset > GRUB_UINT_MAX)
+    grub_util_error ("%s", _("the module bundle is too large"));
+
+  bundle = xmalloc (offset);
+  memset (bundle, 0, offset);
+  header = (struct grub_module_bundle_header *) bundle;
+  entries = (struct grub_module_bundle_entry *) (header + 1);
+  header->magic = grub_host_to_target32 (GRUB_MODULE_BUNDLE_MAGIC);
+  header->count = grub_host_to_target32 (count);
+
+  offset = ALIGN_UP (sizeof (*header) + count * sizeof (*entries),
+		     GRUB_MODULE_BUNDLE_ALIGN);
+  for (p = path_list, i = 0; p; p = p->next, i++)
+    {
+      const char *base;
+      size_t size, len;
+
+      base = strrchr (p->name, '/');
+      base = base ? base + 1 : p->name;
+      len = strlen (base);
+      if (len > 4 && strcmp (base + len - 4, ".mod") == 0)
+	len -= 4;
+      if (len >= GRUB_MODULE_BUNDLE_NAME_SIZE)
+	grub_util_error (_("module name `%s' is too long"), base);
+      memcpy (entries[i].name, base, len);
+
+      size = grub_util_get_image_size (p->name);
+      grub_util_info ("bundling %s at 0x%" GRUB_HOST_PRIxLONG_LONG,
+		      p->name, (unsigned long long) offset);
+      entries[i].offset = grub_host_to_target32 (offset);
+      entries[i].size = grub_host_to_target32 (size);
+      grub_util_load_image (p->name, bundle + offset);
+      offset += ALIGN_UP (size, GRUB_MODULE_BUNDLE_ALIGN);
+    }
+
+  grub_util_write_image (bundle, offset, out, outname);
+  free (bundle);
+
+  while (path_list)
+    {
+      next = path_list->next;
+      free ((void *) path_list->name);
+      free (path_list);
+      path_list = next;
+    }
+}